@@ -0,0 +1,34 @@
+//--------------------------------------------------------------------------------------
+// Exposure adaptation compute shader
+//--------------------------------------------------------------------------------------
+// Moves the brightness the exposure is adapted to towards the average brightness of the scene this frame. The change is
+// spread over time so the exposure adjusts gradually like an eye, e.g. after turning away from the bright lights
+
+#include "PostProcess.hlsli"
+
+
+//--------------------------------------------------------------------------------------
+// Textures
+//--------------------------------------------------------------------------------------
+
+Texture2D<float>   LuminanceMap     : register(t0); // Log of the scene brightness with mip-maps (see Luminance_ps)
+RWTexture2D<float> AdaptedLuminance : register(u0); // Single texel, kept from frame to frame
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+[numthreads(1, 1, 1)]
+void main()
+{
+	// The smallest mip-map of the luminance is the average log brightness
+	uint width, height, numMips;
+	LuminanceMap.GetDimensions(0, width, height, numMips);
+	float averageLuminance = exp(LuminanceMap.Load(int3(0, 0, numMips - 1)));
+
+	// Exponential approach - the same fraction of the way each second whatever the frame rate
+	float adapted = AdaptedLuminance[uint2(0, 0)];
+	adapted += (averageLuminance - adapted) * (1 - exp(-gAdaptationTime * gAdaptationRate));
+	AdaptedLuminance[uint2(0, 0)] = isfinite(adapted) ? adapted : averageLuminance;
+}
@@ -0,0 +1,571 @@
+//--------------------------------------------------------------------------------------
+// Skeletal animation - keyframed clips played and blended on the nodes of models
+//--------------------------------------------------------------------------------------
+
+#include "Animation.h"
+#include "Mesh.h"
+#include "Model.h"
+#include "JobSystem.h"
+#include "AssetArchive.h"
+#include "VertexFormat.h" // For FloatToSnorm16
+#include "MathHelpers.h"
+#include <assimp/Importer.hpp>
+#include <assimp/scene.h>
+#include <assimp/postprocess.h>
+#include <stdexcept>
+#include <algorithm>
+#include <unordered_map>
+#include <cmath>
+#include <cstring>
+#ifdef MATH_SIMD
+#include <emmintrin.h>
+#endif
+
+
+//--------------------------------------------------------------------------------------
+// Keyframe compression
+//--------------------------------------------------------------------------------------
+
+namespace
+{
+	// A rotation as a float quaternion, while a clip is being compressed
+	struct Rotation
+	{
+		float x, y, z, w;
+	};
+
+	// Normalised linear interpolation between two quaternions, as the animators interpolate the keys
+	Rotation Nlerp(const Rotation& a, const Rotation& b, float t)
+	{
+		Rotation r = { a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t, a.z + (b.z - a.z) * t, a.w + (b.w - a.w) * t };
+		float length = std::sqrt(r.x * r.x + r.y * r.y + r.z * r.z + r.w * r.w);
+		return { r.x / length, r.y / length, r.z / length, r.w / length };
+	}
+
+	// Angle in radians between the rotations of two unit quaternions
+	float RotationError(const Rotation& a, const Rotation& b)
+	{
+		float cosHalfAngle = std::abs(a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w);
+		return 2 * std::acos((std::min)(cosHalfAngle, 1.0f));
+	}
+
+	CVector3 LerpVector(const CVector3& a, const CVector3& b, float t)  { return Lerp(a, b, t); }
+	float    VectorError(const CVector3& a, const CVector3& b)          { return Length(b - a); }
+
+
+	// The keys of a channel worth keeping: the first and last, and between them those needed for interpolating the kept keys
+	// to stay within the tolerance of every key dropped. A channel that holds still keeps only its first key
+	template <class Value, class Interpolate, class Error>
+	std::vector<unsigned int> ReduceKeys(const std::vector<float>& times, const std::vector<Value>& values,
+	                                     Interpolate interpolate, Error error, float tolerance)
+	{
+		unsigned int numKeys = static_cast<unsigned int>(times.size());
+		std::vector<unsigned int> kept = { 0 };
+		if (numKeys == 1)  return kept;
+
+		// Stretch a span from the last key kept over the keys after it until one it skips can't be interpolated closely enough,
+		// then keep the key before that one and start the next span from there
+		unsigned int start = 0;
+		for (unsigned int end = 2; end < numKeys; ++end)
+		{
+			float spanTime = times[end] - times[start];
+			for (unsigned int key = start + 1; key < end; ++key)
+			{
+				float t = (spanTime > 0) ? (times[key] - times[start]) / spanTime : 0;
+				if (error(interpolate(values[start], values[end], t), values[key]) > tolerance)
+				{
+					start = end - 1;
+					kept.push_back(start);
+					break;
+				}
+			}
+		}
+		kept.push_back(numKeys - 1);
+
+		if (kept.size() == 2)
+		{
+			bool still = true;
+			for (unsigned int key = 1; key < numKeys && still; ++key)  still = error(values[0], values[key]) <= tolerance;
+			if (still)  kept.resize(1);
+		}
+		return kept;
+	}
+}
+
+
+//--------------------------------------------------------------------------------------
+// Animation set
+//--------------------------------------------------------------------------------------
+
+// Read the animations in the given mesh file for the given mesh, which must have been loaded from the same file - the tracks are
+// matched to its nodes by name. Keys are dropped while the rotations stay within rotationTolerance radians and the positions
+// and scales within positionTolerance of the original keys. A file with no animations has no clips
+// Will throw a std::runtime_error exception on failure (same as Mesh)
+AnimationSet::AnimationSet(const std::string& fileName, Mesh* mesh, float rotationTolerance /*= 0.002f*/,
+                           float positionTolerance /*= 0.001f*/)
+	: mNumNodes(mesh->NumberNodes())
+{
+	// Only the nodes and animations are used, left-handed like the mesh (see MeshLoaderSettings). None of the mesh's other
+	// post-processing changes its nodes
+	Assimp::Importer importer;
+	importer.SetIOHandler(NewAssetIOSystem());
+	const aiScene* scene = importer.ReadFile(fileName, aiProcess_MakeLeftHanded);
+	if (scene == nullptr)  throw std::runtime_error("Error loading animations (" + fileName + "). " + importer.GetErrorString());
+
+	mClips.reserve(scene->mNumAnimations);
+	for (unsigned int animationIndex = 0; animationIndex < scene->mNumAnimations; ++animationIndex)
+	{
+		const aiAnimation* animation = scene->mAnimations[animationIndex];
+		double ticksPerSecond = (animation->mTicksPerSecond > 0) ? animation->mTicksPerSecond : 25.0; // Assimp's default
+
+		mClips.emplace_back();
+		Clip& clip = mClips.back();
+		clip.name = animation->mName.C_Str();
+		clip.duration = static_cast<float>(animation->mDuration / ticksPerSecond);
+
+		std::unordered_map<std::string, const aiNodeAnim*> channels;
+		channels.reserve(animation->mNumChannels);
+		for (unsigned int i = 0; i < animation->mNumChannels; ++i)
+		{
+			channels.emplace(animation->mChannels[i]->mNodeName.C_Str(), animation->mChannels[i]);
+		}
+
+		clip.tracks.resize(mNumNodes);
+		std::vector<float>    rotationTimes, positionTimes, scaleTimes;
+		std::vector<Rotation> rotations;
+		std::vector<CVector3> positions, scales;
+		for (unsigned int node = 0; node < mNumNodes; ++node)
+		{
+			rotationTimes.clear();  positionTimes.clear();  scaleTimes.clear();
+			rotations.clear();      positions.clear();      scales.clear();
+
+			// The root node is the model's world matrix, never animated (see Animation.h)
+			auto found = channels.find(mesh->GetNodeName(node));
+			if (node != 0 && found != channels.end())
+			{
+				const aiNodeAnim* channel = found->second;
+				for (unsigned int key = 0; key < channel->mNumRotationKeys; ++key)
+				{
+					const aiQuatKey& rotationKey = channel->mRotationKeys[key];
+					rotationTimes.push_back(static_cast<float>(rotationKey.mTime / ticksPerSecond));
+					rotations.push_back({ rotationKey.mValue.x, rotationKey.mValue.y, rotationKey.mValue.z, rotationKey.mValue.w });
+				}
+				for (unsigned int key = 0; key < channel->mNumPositionKeys; ++key)
+				{
+					const aiVectorKey& positionKey = channel->mPositionKeys[key];
+					positionTimes.push_back(static_cast<float>(positionKey.mTime / ticksPerSecond));
+					positions.push_back({ positionKey.mValue.x, positionKey.mValue.y, positionKey.mValue.z });
+				}
+				for (unsigned int key = 0; key < channel->mNumScalingKeys; ++key)
+				{
+					const aiVectorKey& scaleKey = channel->mScalingKeys[key];
+					scaleTimes.push_back(static_cast<float>(scaleKey.mTime / ticksPerSecond));
+					scales.push_back({ scaleKey.mValue.x, scaleKey.mValue.y, scaleKey.mValue.z });
+				}
+				mUncompressedBytes += rotations.size() * (sizeof(float) + sizeof(Rotation)) +
+				                      (positions.size() + scales.size()) * (sizeof(float) + sizeof(CVector3));
+			}
+
+			// Nodes the clip doesn't move, and parts of a node it doesn't, hold the node's default pose
+			if (rotations.empty() || positions.empty() || scales.empty())
+			{
+				CMatrix4x4 defaultMatrix = mesh->GetNodeDefaultMatrix(node);
+				defaultMatrix.Transpose(); // Back to the way assimp stores matrices
+				aiMatrix4x4 matrix;
+				std::memcpy(&matrix.a1, &defaultMatrix.e00, sizeof(matrix));
+				aiVector3D   scale, position;
+				aiQuaternion rotation;
+				matrix.Decompose(scale, rotation, position);
+				if (rotations.empty())
+				{
+					rotationTimes.push_back(0);
+					rotations.push_back({ rotation.x, rotation.y, rotation.z, rotation.w });
+				}
+				if (positions.empty())
+				{
+					positionTimes.push_back(0);
+					positions.push_back({ position.x, position.y, position.z });
+				}
+				if (scales.empty())
+				{
+					scaleTimes.push_back(0);
+					scales.push_back({ scale.x, scale.y, scale.z });
+				}
+			}
+
+			// q and -q are the same rotation, but interpolating between them isn't. Keep each key on the same side as the last
+			for (size_t key = 1; key < rotations.size(); ++key)
+			{
+				Rotation& r = rotations[key];
+				const Rotation& previous = rotations[key - 1];
+				if (r.x * previous.x + r.y * previous.y + r.z * previous.z + r.w * previous.w < 0)  r = { -r.x, -r.y, -r.z, -r.w };
+			}
+
+			// Keep the keys needed, quantising the rotations
+			Track& track = clip.tracks[node];
+			std::vector<unsigned int> kept = ReduceKeys(rotationTimes, rotations, Nlerp, RotationError, rotationTolerance);
+			track.rotation = { static_cast<uint32_t>(clip.rotations.size()), static_cast<uint32_t>(kept.size()) };
+			for (unsigned int key : kept)
+			{
+				const Rotation& r = rotations[key];
+				clip.rotationTimes.push_back(rotationTimes[key]);
+				clip.rotations.push_back({ FloatToSnorm16(r.x), FloatToSnorm16(r.y), FloatToSnorm16(r.z), FloatToSnorm16(r.w) });
+			}
+
+			kept = ReduceKeys(positionTimes, positions, LerpVector, VectorError, positionTolerance);
+			track.position = { static_cast<uint32_t>(clip.positions.size()), static_cast<uint32_t>(kept.size()) };
+			for (unsigned int key : kept)
+			{
+				clip.positionTimes.push_back(positionTimes[key]);
+				clip.positions.push_back(positions[key]);
+			}
+
+			kept = ReduceKeys(scaleTimes, scales, LerpVector, VectorError, positionTolerance);
+			track.scale = { static_cast<uint32_t>(clip.scales.size()), static_cast<uint32_t>(kept.size()) };
+			for (unsigned int key : kept)
+			{
+				clip.scaleTimes.push_back(scaleTimes[key]);
+				clip.scales.push_back(scales[key]);
+			}
+		}
+
+		mBytes += clip.tracks.size() * sizeof(Track) +
+		          clip.rotations.size() * (sizeof(float) + sizeof(QuantisedRotation)) +
+		          (clip.positions.size() + clip.scales.size()) * (sizeof(float) + sizeof(CVector3));
+	}
+}
+
+
+// The index of the clip with the given name, or -1 if there is none
+int AnimationSet::FindClip(const std::string& name)
+{
+	for (int clip = 0; clip < NumClips(); ++clip)
+	{
+		if (mClips[clip].name == name)  return clip;
+	}
+	return -1;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Animator
+//--------------------------------------------------------------------------------------
+
+namespace
+{
+	// Find the keys either side of the given time among a channel's key times, starting from the key found last time (the
+	// cursor, updated to the first of the two), and return the fraction of the way from the first to the second. Times
+	// outside the keys hold the first or last key
+	float FindKey(const float* times, uint32_t numKeys, float time, uint32_t& cursor)
+	{
+		if (cursor >= numKeys || times[cursor] > time)  cursor = 0; // Looped round, or the clip was started again
+		while (cursor + 1 < numKeys && times[cursor + 1] <= time)  ++cursor;
+		if (cursor + 1 >= numKeys)  return 0;
+
+		float fraction = (time - times[cursor]) / (times[cursor + 1] - times[cursor]);
+		return (std::max)(0.0f, (std::min)(fraction, 1.0f));
+	}
+
+	// The local matrix of a node from a unit quaternion, position and scale. Scale, then rotation, then translation, as
+	// assimp's node matrices but with rows for axes as this app's matrices are (see CMatrix4x4.h)
+	void PoseMatrix(CMatrix4x4& m, float x, float y, float z, float w, const CVector3& position, const CVector3& scale)
+	{
+		float xx = x * x * 2, yy = y * y * 2, zz = z * z * 2;
+		float xy = x * y * 2, xz = x * z * 2, yz = y * z * 2;
+		float wx = w * x * 2, wy = w * y * 2, wz = w * z * 2;
+		m.e00 = (1 - yy - zz) * scale.x;  m.e01 = (xy + wz) * scale.x;      m.e02 = (xz - wy) * scale.x;      m.e03 = 0;
+		m.e10 = (xy - wz) * scale.y;      m.e11 = (1 - xx - zz) * scale.y;  m.e12 = (yz + wx) * scale.y;      m.e13 = 0;
+		m.e20 = (xz + wy) * scale.z;      m.e21 = (yz - wx) * scale.z;      m.e22 = (1 - xx - yy) * scale.z;  m.e23 = 0;
+		m.e30 = position.x;               m.e31 = position.y;               m.e32 = position.z;               m.e33 = 1;
+	}
+}
+
+
+// Play animations from the given set on the given model, which must be of the mesh the set was read for. Nothing plays until
+// a clip is started with Play
+Animator::Animator(AnimationSet* animations, Model* model)
+	: mAnimations(animations), mModel(model), mNumNodes(animations->NumNodes()), mPaddedNodes((animations->NumNodes() + 3) & ~3u)
+{
+	mCursors.resize(MaxLayers * mNumNodes * 3, 0);
+	mKeys.resize(NumKeyStreams * mPaddedNodes, 0.0f);
+	mPose.resize(NumPoseStreams * mPaddedNodes, 0.0f);
+	mMatrices.resize(mPaddedNodes);
+
+	// The padding nodes hold an identity pose, so the SSE loops never divide by zero for them
+	for (unsigned int node = mNumNodes; node < mPaddedNodes; ++node)
+	{
+		Keys(Rotation0 + 3)[node] = Keys(Rotation1 + 3)[node] = 1;
+		for (int i = 0; i < 3; ++i)  Keys(Scale0 + i)[node] = Keys(Scale1 + i)[node] = 1;
+	}
+}
+
+
+// Play a clip on the given layer (0 to MaxLayers - 1) from its start, replacing any clip already playing there. The pose is the
+// weighted average of the layers playing, speed 1 is the clip's own speed. Clips that don't loop hold their last pose at the end
+void Animator::Play(int layer, int clip, float weight /*= 1*/, float speed /*= 1*/, bool loop /*= true*/)
+{
+	mLayers[layer] = { clip, 0, weight, speed, loop };
+	std::fill(mCursors.begin() + layer * mNumNodes * 3, mCursors.begin() + (layer + 1) * mNumNodes * 3, 0);
+}
+
+
+// Move the clips on by the given time in seconds and write the blended pose into the model's nodes. Uses no DirectX and only
+// changes this animator's model, so animators of different models can be updated on different threads at once
+void Animator::Update(float frameTime)
+{
+	float totalWeight = 0;
+	for (int layer = 0; layer < MaxLayers; ++layer)
+	{
+		Layer& playing = mLayers[layer];
+		if (playing.clip < 0)  continue;
+
+		// Move the time on, round to the start of looping clips and stopping at the ends of others
+		float duration = mAnimations->Duration(playing.clip);
+		playing.time += frameTime * playing.speed;
+		if (playing.loop && duration > 0)
+		{
+			playing.time = std::fmod(playing.time, duration);
+			if (playing.time < 0)  playing.time += duration;
+		}
+		else
+		{
+			playing.time = (std::max)(0.0f, (std::min)(playing.time, duration));
+		}
+
+		if (playing.weight <= 0)  continue;
+		FindKeys(layer);
+		BlendKeys(playing.weight, totalWeight == 0);
+		totalWeight += playing.weight;
+	}
+	if (totalWeight <= 0)  return;
+	PoseMatrices(totalWeight);
+
+	// Only nodes that have moved are marked as changed, so parts holding still don't have their absolute matrices recalculated
+	for (unsigned int node = 1; node < mNumNodes; ++node)
+	{
+		CMatrix4x4 current = mModel->WorldMatrix(node);
+		if (std::memcmp(&current, &mMatrices[node], sizeof(CMatrix4x4)) != 0)  mModel->SetWorldMatrix(mMatrices[node], node);
+	}
+}
+
+
+// Update all the given animators, split across the job system in batches. Returns when all are done
+void Animator::UpdateAll(const std::vector<Animator*>& animators, float frameTime)
+{
+	gJobSystem->ParallelFor(static_cast<int>(animators.size()), AnimatorsPerBatch, [&](int i)
+	{
+		animators[i]->Update(frameTime);
+	});
+}
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions
+//--------------------------------------------------------------------------------------
+
+// Find the keys of one layer's clip at its time, for every node, into mKeys
+void Animator::FindKeys(int layer)
+{
+	const Layer& playing = mLayers[layer];
+	const AnimationSet::Clip& clip = mAnimations->mClips[playing.clip];
+	uint32_t* cursors = mCursors.data() + layer * mNumNodes * 3;
+
+	float* rotation0[4] = { Keys(Rotation0), Keys(Rotation0 + 1), Keys(Rotation0 + 2), Keys(Rotation0 + 3) };
+	float* rotation1[4] = { Keys(Rotation1), Keys(Rotation1 + 1), Keys(Rotation1 + 2), Keys(Rotation1 + 3) };
+	float* position0[3] = { Keys(Position0), Keys(Position0 + 1), Keys(Position0 + 2) };
+	float* position1[3] = { Keys(Position1), Keys(Position1 + 1), Keys(Position1 + 2) };
+	float* scale0[3]    = { Keys(Scale0), Keys(Scale0 + 1), Keys(Scale0 + 2) };
+	float* scale1[3]    = { Keys(Scale1), Keys(Scale1 + 1), Keys(Scale1 + 2) };
+	float* rotationFraction = Keys(RotationFraction);
+	float* positionFraction = Keys(PositionFraction);
+	float* scaleFraction    = Keys(ScaleFraction);
+
+	const float snormScale = 1.0f / 32767.0f;
+	for (unsigned int node = 0; node < mNumNodes; ++node, cursors += 3)
+	{
+		const AnimationSet::Track& track = clip.tracks[node];
+
+		const AnimationSet::Channel& rotation = track.rotation;
+		rotationFraction[node] = FindKey(clip.rotationTimes.data() + rotation.firstKey, rotation.numKeys, playing.time, cursors[0]);
+		const AnimationSet::QuantisedRotation& r0 = clip.rotations[rotation.firstKey + cursors[0]];
+		const AnimationSet::QuantisedRotation& r1 = clip.rotations[rotation.firstKey + (std::min)(cursors[0] + 1, rotation.numKeys - 1)];
+		rotation0[0][node] = r0.x * snormScale;  rotation0[1][node] = r0.y * snormScale;
+		rotation0[2][node] = r0.z * snormScale;  rotation0[3][node] = r0.w * snormScale;
+		rotation1[0][node] = r1.x * snormScale;  rotation1[1][node] = r1.y * snormScale;
+		rotation1[2][node] = r1.z * snormScale;  rotation1[3][node] = r1.w * snormScale;
+
+		const AnimationSet::Channel& position = track.position;
+		positionFraction[node] = FindKey(clip.positionTimes.data() + position.firstKey, position.numKeys, playing.time, cursors[1]);
+		const CVector3& p0 = clip.positions[position.firstKey + cursors[1]];
+		const CVector3& p1 = clip.positions[position.firstKey + (std::min)(cursors[1] + 1, position.numKeys - 1)];
+		position0[0][node] = p0.x;  position0[1][node] = p0.y;  position0[2][node] = p0.z;
+		position1[0][node] = p1.x;  position1[1][node] = p1.y;  position1[2][node] = p1.z;
+
+		const AnimationSet::Channel& scale = track.scale;
+		scaleFraction[node] = FindKey(clip.scaleTimes.data() + scale.firstKey, scale.numKeys, playing.time, cursors[2]);
+		const CVector3& s0 = clip.scales[scale.firstKey + cursors[2]];
+		const CVector3& s1 = clip.scales[scale.firstKey + (std::min)(cursors[2] + 1, scale.numKeys - 1)];
+		scale0[0][node] = s0.x;  scale0[1][node] = s0.y;  scale0[2][node] = s0.z;
+		scale1[0][node] = s1.x;  scale1[1][node] = s1.y;  scale1[2][node] = s1.z;
+	}
+}
+
+
+// Interpolate the keys found, weight them and add them to the pose. The first layer replaces the pose instead
+// Rotations use normalised linear interpolation (nlerp), which is close to slerp for keys this near together and far cheaper.
+// Blended rotations are summed on the same side of the 4D sphere as the pose so far, and normalised in PoseMatrices
+void Animator::BlendKeys(float weight, bool first)
+{
+	unsigned int node = 0;
+
+#ifdef MATH_SIMD
+	const __m128 weight4  = _mm_set1_ps(weight);
+	const __m128 zero     = _mm_setzero_ps();
+	const __m128 signBits = _mm_set1_ps(-0.0f);
+	for (; node < mPaddedNodes; node += 4)
+	{
+		__m128 t = _mm_loadu_ps(Keys(RotationFraction) + node);
+		__m128 rotation[4];
+		__m128 lengthSq = zero;
+		for (int i = 0; i < 4; ++i)
+		{
+			__m128 r0 = _mm_loadu_ps(Keys(Rotation0 + i) + node);
+			__m128 r1 = _mm_loadu_ps(Keys(Rotation1 + i) + node);
+			rotation[i] = _mm_add_ps(r0, _mm_mul_ps(_mm_sub_ps(r1, r0), t));
+			lengthSq = _mm_add_ps(lengthSq, _mm_mul_ps(rotation[i], rotation[i]));
+		}
+		__m128 scale = _mm_div_ps(weight4, _mm_sqrt_ps(lengthSq));
+		if (!first)
+		{
+			__m128 dot = zero;
+			for (int i = 0; i < 4; ++i)  dot = _mm_add_ps(dot, _mm_mul_ps(_mm_loadu_ps(Pose(PoseRotation + i) + node), rotation[i]));
+			scale = _mm_xor_ps(scale, _mm_and_ps(_mm_cmplt_ps(dot, zero), signBits)); // Negate where the rotation is on the other side
+		}
+		for (int i = 0; i < 4; ++i)
+		{
+			__m128 weighted = _mm_mul_ps(rotation[i], scale);
+			float* pose = Pose(PoseRotation + i) + node;
+			_mm_storeu_ps(pose, first ? weighted : _mm_add_ps(_mm_loadu_ps(pose), weighted));
+		}
+
+		// Positions and scales, linear interpolation
+		struct { int key0, key1, fraction, pose; } vectors[] =
+			{ { Position0, Position1, PositionFraction, PosePosition }, { Scale0, Scale1, ScaleFraction, PoseScale } };
+		for (auto& vector : vectors)
+		{
+			t = _mm_loadu_ps(Keys(vector.fraction) + node);
+			for (int i = 0; i < 3; ++i)
+			{
+				__m128 v0 = _mm_loadu_ps(Keys(vector.key0 + i) + node);
+				__m128 v1 = _mm_loadu_ps(Keys(vector.key1 + i) + node);
+				__m128 weighted = _mm_mul_ps(_mm_add_ps(v0, _mm_mul_ps(_mm_sub_ps(v1, v0), t)), weight4);
+				float* pose = Pose(vector.pose + i) + node;
+				_mm_storeu_ps(pose, first ? weighted : _mm_add_ps(_mm_loadu_ps(pose), weighted));
+			}
+		}
+	}
+#endif
+
+	// Without SIMD, the same a node at a time
+	for (; node < mNumNodes; ++node)
+	{
+		float t = Keys(RotationFraction)[node];
+		float rotation[4];
+		float lengthSq = 0;
+		for (int i = 0; i < 4; ++i)
+		{
+			float r0 = Keys(Rotation0 + i)[node];
+			rotation[i] = r0 + (Keys(Rotation1 + i)[node] - r0) * t;
+			lengthSq += rotation[i] * rotation[i];
+		}
+		float scale = weight / std::sqrt(lengthSq);
+		if (!first)
+		{
+			float dot = 0;
+			for (int i = 0; i < 4; ++i)  dot += Pose(PoseRotation + i)[node] * rotation[i];
+			if (dot < 0)  scale = -scale;
+		}
+		for (int i = 0; i < 4; ++i)
+		{
+			float& pose = Pose(PoseRotation + i)[node];
+			pose = (first ? 0 : pose) + rotation[i] * scale;
+		}
+
+		struct { int key0, key1, fraction, pose; } vectors[] =
+			{ { Position0, Position1, PositionFraction, PosePosition }, { Scale0, Scale1, ScaleFraction, PoseScale } };
+		for (auto& vector : vectors)
+		{
+			t = Keys(vector.fraction)[node];
+			for (int i = 0; i < 3; ++i)
+			{
+				float v0 = Keys(vector.key0 + i)[node];
+				float& pose = Pose(vector.pose + i)[node];
+				pose = (first ? 0 : pose) + (v0 + (Keys(vector.key1 + i)[node] - v0) * t) * weight;
+			}
+		}
+	}
+}
+
+
+// Turn the summed pose into local matrices (see mMatrices), given the total weight of the layers
+void Animator::PoseMatrices(float totalWeight)
+{
+	const float invWeight = 1 / totalWeight;
+	unsigned int node = 0;
+
+#ifdef MATH_SIMD
+	const __m128 invWeight4 = _mm_set1_ps(invWeight);
+	const __m128 one        = _mm_set1_ps(1.0f);
+	const __m128 zero       = _mm_setzero_ps();
+
+	// Store one row of each of the four matrices, from the row's x, y, z and w for the four nodes
+	auto storeRow = [&](int row, __m128 x, __m128 y, __m128 z, __m128 w)
+	{
+		_MM_TRANSPOSE4_PS(x, y, z, w);
+		_mm_store_ps(&mMatrices[node    ].e00 + row * 4, x);
+		_mm_store_ps(&mMatrices[node + 1].e00 + row * 4, y);
+		_mm_store_ps(&mMatrices[node + 2].e00 + row * 4, z);
+		_mm_store_ps(&mMatrices[node + 3].e00 + row * 4, w);
+	};
+
+	for (; node < mPaddedNodes; node += 4)
+	{
+		__m128 x = _mm_loadu_ps(Pose(PoseRotation    ) + node);
+		__m128 y = _mm_loadu_ps(Pose(PoseRotation + 1) + node);
+		__m128 z = _mm_loadu_ps(Pose(PoseRotation + 2) + node);
+		__m128 w = _mm_loadu_ps(Pose(PoseRotation + 3) + node);
+		__m128 lengthSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_add_ps(_mm_mul_ps(z, z), _mm_mul_ps(w, w)));
+		__m128 invLength = _mm_div_ps(one, _mm_sqrt_ps(lengthSq));
+		x = _mm_mul_ps(x, invLength);  y = _mm_mul_ps(y, invLength);  z = _mm_mul_ps(z, invLength);  w = _mm_mul_ps(w, invLength);
+
+		__m128 x2 = _mm_add_ps(x, x), y2 = _mm_add_ps(y, y), z2 = _mm_add_ps(z, z);
+		__m128 xx = _mm_mul_ps(x, x2), yy = _mm_mul_ps(y, y2), zz = _mm_mul_ps(z, z2);
+		__m128 xy = _mm_mul_ps(x, y2), xz = _mm_mul_ps(x, z2), yz = _mm_mul_ps(y, z2);
+		__m128 wx = _mm_mul_ps(w, x2), wy = _mm_mul_ps(w, y2), wz = _mm_mul_ps(w, z2);
+
+		__m128 sx = _mm_mul_ps(_mm_loadu_ps(Pose(PoseScale    ) + node), invWeight4);
+		__m128 sy = _mm_mul_ps(_mm_loadu_ps(Pose(PoseScale + 1) + node), invWeight4);
+		__m128 sz = _mm_mul_ps(_mm_loadu_ps(Pose(PoseScale + 2) + node), invWeight4);
+
+		storeRow(0, _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(yy, zz)), sx), _mm_mul_ps(_mm_add_ps(xy, wz), sx),
+		            _mm_mul_ps(_mm_sub_ps(xz, wy), sx), zero);
+		storeRow(1, _mm_mul_ps(_mm_sub_ps(xy, wz), sy), _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, zz)), sy),
+		            _mm_mul_ps(_mm_add_ps(yz, wx), sy), zero);
+		storeRow(2, _mm_mul_ps(_mm_add_ps(xz, wy), sz), _mm_mul_ps(_mm_sub_ps(yz, wx), sz),
+		            _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, yy)), sz), zero);
+		storeRow(3, _mm_mul_ps(_mm_loadu_ps(Pose(PosePosition    ) + node), invWeight4),
+		            _mm_mul_ps(_mm_loadu_ps(Pose(PosePosition + 1) + node), invWeight4),
+		            _mm_mul_ps(_mm_loadu_ps(Pose(PosePosition + 2) + node), invWeight4), one);
+	}
+#endif
+
+	// Without SIMD, the same a node at a time
+	for (; node < mNumNodes; ++node)
+	{
+		float x = Pose(PoseRotation)[node], y = Pose(PoseRotation + 1)[node], z = Pose(PoseRotation + 2)[node], w = Pose(PoseRotation + 3)[node];
+		float invLength = 1 / std::sqrt(x * x + y * y + z * z + w * w);
+		CVector3 position = { Pose(PosePosition)[node], Pose(PosePosition + 1)[node], Pose(PosePosition + 2)[node] };
+		CVector3 scale    = { Pose(PoseScale)[node],    Pose(PoseScale + 1)[node],    Pose(PoseScale + 2)[node] };
+		PoseMatrix(mMatrices[node], x * invLength, y * invLength, z * invLength, w * invLength, position * invWeight, scale * invWeight);
+	}
+}
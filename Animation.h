@@ -0,0 +1,211 @@
+//--------------------------------------------------------------------------------------
+// Skeletal animation - keyframed clips played and blended on the nodes of models
+//--------------------------------------------------------------------------------------
+// The mesh importer throws away the animations in mesh files (see Mesh.cpp), and a model's
+// nodes only move when the app moves them. An AnimationSet reads the animations (clips) of a
+// mesh file separately and compresses them: keys that interpolating their neighbours reproduces
+// closely enough are dropped, and rotations are stored as four 16-bit numbers rather than floats.
+// Every clip has a track for every node of the mesh, nodes the clip doesn't move just hold their
+// default pose, so the tracks of any two clips line up and can be blended.
+//
+// An Animator plays up to MaxLayers clips on one model, each with a weight, and writes the
+// blended local (parent-relative) matrices into the model's nodes. The keys either side of the
+// time are found for each track, then the tracks are interpolated, blended and turned into
+// matrices four at a time with SSE, in arrays of each component rather than arrays of keys.
+// Update uses no DirectX and only changes its own model, so UpdateAll updates the animators of
+// many characters in parallel on the job system (see JobSystem.h).
+//
+// The root node of a model is its world matrix (see Model.h), so animations never move it -
+// characters are placed by the app and animated relative to that.
+
+#include "CMatrix4x4.h" // For MATH_SIMD
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#ifndef _ANIMATION_H_INCLUDED_
+#define _ANIMATION_H_INCLUDED_
+
+class Mesh;
+class Model;
+
+class AnimationSet
+{
+//--------------------------------------------------------------------------------------
+// Construction / Usage
+//--------------------------------------------------------------------------------------
+public:
+
+	// Read the animations in the given mesh file for the given mesh, which must have been loaded from the same file - the
+	// tracks are matched to its nodes by name. Keys are dropped while the rotations stay within rotationTolerance radians
+	// and the positions and scales within positionTolerance of the original keys. A file with no animations has no clips
+	// Will throw a std::runtime_error exception on failure (same as Mesh)
+	AnimationSet(const std::string& fileName, Mesh* mesh, float rotationTolerance = 0.002f, float positionTolerance = 0.001f);
+
+	int NumClips()  { return static_cast<int>(mClips.size()); }
+
+	// The index of the clip with the given name, or -1 if there is none
+	int FindClip(const std::string& name);
+
+	const std::string& ClipName(int clip)  { return mClips[clip].name; }
+	float              Duration(int clip)  { return mClips[clip].duration; } // In seconds
+
+	unsigned int NumNodes()  { return mNumNodes; }
+
+	// Memory used by the keys of all the clips, and what they would use as float keys without any dropped
+	size_t Bytes()              { return mBytes; }
+	size_t UncompressedBytes()  { return mUncompressedBytes; }
+
+
+//--------------------------------------------------------------------------------------
+// Private data
+//--------------------------------------------------------------------------------------
+private:
+	friend class Animator;
+
+	// A unit quaternion with each component as a 16-bit normalised integer (as DXGI_FORMAT_R16_SNORM)
+	struct QuantisedRotation
+	{
+		int16_t x, y, z, w;
+	};
+
+	// The keys of one part of a node's animation, a range in the clip's key arrays below
+	struct Channel
+	{
+		uint32_t firstKey;
+		uint32_t numKeys; // At least 1
+	};
+
+	struct Track
+	{
+		Channel rotation;
+		Channel position;
+		Channel scale;
+	};
+
+	struct Clip
+	{
+		std::string name;
+		float       duration; // In seconds
+
+		std::vector<Track> tracks; // One for each node of the mesh, in the mesh's order
+
+		// The keys of all the tracks, each channel's together in time order. Times are in seconds
+		std::vector<float>             rotationTimes;
+		std::vector<QuantisedRotation> rotations;
+		std::vector<float>             positionTimes;
+		std::vector<CVector3>          positions;
+		std::vector<float>             scaleTimes;
+		std::vector<CVector3>          scales;
+	};
+
+	std::vector<Clip> mClips;
+	unsigned int      mNumNodes;
+
+	size_t mBytes = 0;
+	size_t mUncompressedBytes = 0;
+};
+
+
+class Animator
+{
+//--------------------------------------------------------------------------------------
+// Construction / Usage
+//--------------------------------------------------------------------------------------
+public:
+
+	// Clips that can be blended on one model at once
+	static constexpr int MaxLayers = 4;
+
+	// Play animations from the given set on the given model, which must be of the mesh the set was read for. Nothing plays
+	// until a clip is started with Play
+	Animator(AnimationSet* animations, Model* model);
+
+
+	// Play a clip on the given layer (0 to MaxLayers - 1) from its start, replacing any clip already playing there. The
+	// pose is the weighted average of the layers playing, speed 1 is the clip's own speed. Clips that don't loop hold
+	// their last pose at the end
+	void Play(int layer, int clip, float weight = 1, float speed = 1, bool loop = true);
+
+	// Stop the clip on the given layer. The model keeps its last pose when no layers are playing
+	void Stop(int layer)  { mLayers[layer].clip = -1; }
+
+	// Change the weight or speed of a layer, e.g. to fade between walking and running
+	void SetWeight(int layer, float weight)  { mLayers[layer].weight = weight; }
+	void SetSpeed(int layer, float speed)    { mLayers[layer].speed = speed; }
+
+	// Time in seconds into the clip playing on the given layer
+	float Time(int layer)  { return mLayers[layer].time; }
+
+
+	// Move the clips on by the given time in seconds and write the blended pose into the model's nodes. Uses no DirectX and
+	// only changes this animator's model, so animators of different models can be updated on different threads at once
+	void Update(float frameTime);
+
+	// Update all the given animators, split across the job system in batches. Returns when all are done
+	static void UpdateAll(const std::vector<Animator*>& animators, float frameTime);
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions / data
+//--------------------------------------------------------------------------------------
+private:
+
+	// Animators updated by each job, enough work to be worth a job for characters with a few dozen nodes
+	static constexpr int AnimatorsPerBatch = 8;
+
+	struct Layer
+	{
+		int   clip = -1; // -1 when nothing is playing on the layer
+		float time = 0;
+		float weight = 1;
+		float speed = 1;
+		bool  loop = true;
+	};
+
+	// The keys either side of a layer's time for each node, and the fraction of the way between them, as an array for each
+	// component (see mKeys)
+	enum KeyStream
+	{
+		Rotation0 = 0, Rotation1 = 4, Position0 = 8, Position1 = 11, Scale0 = 14, Scale1 = 17,
+		RotationFraction = 20, PositionFraction, ScaleFraction, NumKeyStreams
+	};
+
+	// The blended pose of each node, summed from the layers, as an array for each component (see mPose)
+	enum PoseStream
+	{
+		PoseRotation = 0, PosePosition = 4, PoseScale = 7, NumPoseStreams = 10
+	};
+
+	// Find the keys of one layer's clip at its time, for every node, into mKeys
+	void FindKeys(int layer);
+
+	// Interpolate the keys found, weight them and add them to the pose. The first layer replaces the pose instead
+	void BlendKeys(float weight, bool first);
+
+	// Turn the summed pose into local matrices (see mMatrices), given the total weight of the layers
+	void PoseMatrices(float totalWeight);
+
+	float* Keys(int stream)  { return mKeys.data() + stream * mPaddedNodes; }
+	float* Pose(int stream)  { return mPose.data() + stream * mPaddedNodes; }
+
+
+	AnimationSet* mAnimations;
+	Model*        mModel;
+
+	unsigned int mNumNodes;
+	unsigned int mPaddedNodes; // Rounded up to a multiple of 4 for SSE, the extra nodes hold an identity pose
+
+	Layer mLayers[MaxLayers];
+
+	// The key last used by each channel of each node for each layer, where the search for the next key starts. Clips
+	// played forwards only move on a key or two each frame
+	std::vector<uint32_t> mCursors;
+
+	std::vector<float>      mKeys;     // NumKeyStreams arrays of mPaddedNodes
+	std::vector<float>      mPose;     // NumPoseStreams arrays of mPaddedNodes
+	std::vector<CMatrix4x4> mMatrices; // The local matrix of each node
+};
+
+
+#endif //_ANIMATION_H_INCLUDED_
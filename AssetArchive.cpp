@@ -0,0 +1,479 @@
+//--------------------------------------------------------------------------------------
+// Asset archive - the app's files packed into one memory-mapped file
+//--------------------------------------------------------------------------------------
+
+#include "AssetArchive.h"
+#include "MappedFile.h"
+#include <assimp/IOSystem.hpp>
+#include <assimp/IOStream.hpp>
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#include <fstream>
+#include <map>
+#include <set>
+#include <mutex>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+
+
+//--------------------------------------------------------------------------------------
+// Archive data
+//--------------------------------------------------------------------------------------
+
+namespace
+{
+	const char     AssetArchiveID[4]   = { 'A', 'P', 'A', 'K' };
+	const uint32_t AssetArchiveVersion = 1;
+	const uint64_t AssetAlignment      = 4096; // Each file starts on a page
+
+	struct AssetArchiveHeader
+	{
+		char     id[4];
+		uint32_t version;
+		uint32_t numEntries;
+		uint32_t padding;
+	};
+
+	struct AssetArchiveEntry
+	{
+		char     name[64];
+		uint64_t sourceTime;   // Last write time of the loose file it was packed from
+		uint64_t offset;       // Position of the data from the start of the file
+		uint32_t size;         // Bytes in the archive
+		uint32_t originalSize; // Bytes once decompressed, the same as size for files that aren't compressed
+	};
+
+	// Compressed files must be at least this much smaller, otherwise decompressing them costs more than reading the bytes saved
+	const float MinCompression = 0.75f;
+
+
+	// The open archive and its files, those that are up to date. Only changed in OpenAssetArchive and CloseAssetArchive, so
+	// files can be opened from it on several threads at once
+	std::string                              gArchiveFileName;
+	std::unique_ptr<MappedFile>              gArchive;
+	std::map<std::string, AssetArchiveEntry> gArchiveEntries;
+
+	// The loose files opened or written since the archive was opened, to pack when it is closed. Once a file is here its
+	// archive copy isn't used, so a file the app writes (e.g. a cooked mesh) is read back as written
+	std::mutex            gLooseFilesMutex;
+	std::set<std::string> gLooseFiles;
+
+
+	// Find the files in the open archive. Returns false if it is broken. With checkLooseFiles, files with a loose copy
+	// written at a different time to the one packed are left out
+	bool ReadArchive(bool checkLooseFiles)
+	{
+		const unsigned char* data = gArchive->Data();
+		size_t               size = gArchive->Size();
+
+		AssetArchiveHeader header;
+		if (size < sizeof(header))  return false;
+		memcpy(&header, data, sizeof(header));
+		if (memcmp(header.id, AssetArchiveID, sizeof(AssetArchiveID)) != 0 || header.version != AssetArchiveVersion ||
+		    header.numEntries > (size - sizeof(header)) / sizeof(AssetArchiveEntry))  return false;
+
+		for (uint32_t i = 0; i < header.numEntries; ++i)
+		{
+			AssetArchiveEntry entry;
+			memcpy(&entry, data + sizeof(header) + i * sizeof(entry), sizeof(entry));
+			entry.name[sizeof(entry.name) - 1] = '\0';
+			if (entry.offset > size || entry.size > size - entry.offset)  return false;
+
+			uint64_t time;
+			if (checkLooseFiles && FileWriteTime(entry.name, time) && time != entry.sourceTime)  continue;
+			gArchiveEntries[entry.name] = entry;
+		}
+		return true;
+	}
+
+
+	//-------------------------------------
+	// LZ4 compression
+	//-------------------------------------
+	// The LZ4 block format (https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md): a series of sequences, each some
+	// literal bytes followed by a copy of earlier output (a match). Very fast to decompress, which is what matters here,
+	// and compression is only done when the archive is written. Matches are found with a simple hash table of the last
+	// position each 4 bytes were seen at
+
+	const size_t LZ4MinMatch     = 4;
+	const size_t LZ4LastLiterals = 5;  // The last bytes of a block are always literals
+	const size_t LZ4MatchLimit   = 12; // And the last match starts at least this far from the end
+	const int    LZ4HashBits     = 16;
+
+	// The most bytes that compressing the given number of bytes can give, for data that doesn't compress
+	size_t LZ4CompressBound(size_t size)  { return size + size / 255 + 16; }
+
+	uint32_t Read32(const unsigned char* data)
+	{
+		uint32_t value;
+		memcpy(&value, data, sizeof(value));
+		return value;
+	}
+
+	// Compress data, returning the size of the result. The destination must have space for LZ4CompressBound bytes
+	size_t LZ4Compress(const unsigned char* source, size_t sourceSize, unsigned char* dest)
+	{
+		size_t out = 0;
+		auto writeLength = [&](size_t length)
+		{
+			for (; length >= 255; length -= 255)  dest[out++] = 255;
+			dest[out++] = static_cast<unsigned char>(length);
+		};
+		auto writeLiterals = [&](const unsigned char* literals, size_t numLiterals, size_t matchLength)
+		{
+			size_t matchCode = matchLength - LZ4MinMatch;
+			dest[out++] = static_cast<unsigned char>(((std::min)(numLiterals, size_t(15)) << 4) | (std::min)(matchCode, size_t(15)));
+			if (numLiterals >= 15)  writeLength(numLiterals - 15);
+			memcpy(dest + out, literals, numLiterals);
+			out += numLiterals;
+		};
+
+		size_t anchor = 0; // Start of the literals not yet written
+		if (sourceSize > LZ4MatchLimit)
+		{
+			std::vector<uint32_t> table(1 << LZ4HashBits, 0);
+			size_t pos = 0;
+			while (pos < sourceSize - LZ4MatchLimit)
+			{
+				uint32_t sequence  = Read32(source + pos);
+				uint32_t hash      = (sequence * 2654435761u) >> (32 - LZ4HashBits);
+				size_t   candidate = table[hash];
+				table[hash] = static_cast<uint32_t>(pos);
+				if (candidate >= pos || pos - candidate > 65535 || Read32(source + candidate) != sequence)
+				{
+					++pos;
+					continue;
+				}
+
+				size_t matchEnd = pos + LZ4MinMatch;
+				while (matchEnd < sourceSize - LZ4LastLiterals && source[matchEnd] == source[candidate + matchEnd - pos])  ++matchEnd;
+
+				size_t matchLength = matchEnd - pos;
+				size_t offset      = pos - candidate;
+				writeLiterals(source + anchor, pos - anchor, matchLength);
+				dest[out++] = static_cast<unsigned char>(offset & 0xff);
+				dest[out++] = static_cast<unsigned char>(offset >> 8);
+				if (matchLength - LZ4MinMatch >= 15)  writeLength(matchLength - LZ4MinMatch - 15);
+				pos = anchor = matchEnd;
+			}
+		}
+
+		// The last sequence, literals only
+		writeLiterals(source + anchor, sourceSize - anchor, LZ4MinMatch);
+		return out;
+	}
+
+	// Decompress data, which must decompress to exactly the destination size. Returns false if the data is broken
+	bool LZ4Decompress(const unsigned char* source, size_t sourceSize, unsigned char* dest, size_t destSize)
+	{
+		size_t in = 0;
+		size_t out = 0;
+		auto readLength = [&](size_t& length)
+		{
+			unsigned char byte;
+			do
+			{
+				if (in >= sourceSize)  return false;
+				byte = source[in++];
+				length += byte;
+			} while (byte == 255);
+			return true;
+		};
+
+		while (in < sourceSize)
+		{
+			unsigned int token = source[in++];
+			size_t numLiterals = token >> 4;
+			if (numLiterals == 15 && !readLength(numLiterals))  return false;
+			if (numLiterals > sourceSize - in || numLiterals > destSize - out)  return false;
+			memcpy(dest + out, source + in, numLiterals);
+			in  += numLiterals;
+			out += numLiterals;
+			if (in == sourceSize)  break; // The last sequence has no match
+
+			if (sourceSize - in < 2)  return false;
+			size_t offset = source[in] | (static_cast<size_t>(source[in + 1]) << 8);
+			in += 2;
+			size_t matchLength = (token & 15);
+			if (matchLength == 15 && !readLength(matchLength))  return false;
+			matchLength += LZ4MinMatch;
+			if (offset == 0 || offset > out || matchLength > destSize - out)  return false;
+
+			// Matches can overlap the bytes they write, e.g. an offset of 1 repeats one byte
+			if (offset >= matchLength)
+			{
+				memcpy(dest + out, dest + out - offset, matchLength);
+				out += matchLength;
+			}
+			else
+			{
+				for (size_t i = 0; i < matchLength; ++i, ++out)  dest[out] = dest[out - offset];
+			}
+		}
+		return out == destSize;
+	}
+
+
+	// Write a new archive with the files in the open archive and the loose files opened since, the loose copies taking the
+	// place of those in the archive. Written to a temporary file and then moved over the old archive, so a failure leaves
+	// the old one as it was. Returns false on failure
+	bool WriteArchive()
+	{
+		std::set<std::string> fileNames = gLooseFiles;
+		for (auto& entry : gArchiveEntries)  fileNames.insert(entry.first);
+
+		std::string   tempFileName = gArchiveFileName + ".tmp";
+		std::ofstream file(tempFileName, std::ios::binary);
+		if (!file)  return false;
+
+		// The header and entries go before the data, so are written last when all the offsets are known. Space is left for them
+		const char padding[AssetAlignment] = {};
+		uint64_t offset = sizeof(AssetArchiveHeader) + fileNames.size() * sizeof(AssetArchiveEntry);
+		offset = (offset + AssetAlignment - 1) & ~(AssetAlignment - 1);
+		for (uint64_t i = 0; i < offset; i += AssetAlignment)  file.write(padding, AssetAlignment);
+
+		std::vector<AssetArchiveEntry> entries;
+		std::vector<unsigned char>     compressed;
+		for (auto& fileName : fileNames)
+		{
+			AssetArchiveEntry entry = {};
+			if (fileName.size() >= sizeof(entry.name))  continue; // Stays a loose file
+			memcpy(entry.name, fileName.data(), fileName.size());
+			entry.offset = offset;
+
+			const unsigned char* data;
+			auto archived = gArchiveEntries.find(fileName);
+			std::unique_ptr<MappedFile> looseFile;
+			if (gLooseFiles.count(fileName) == 0 && archived != gArchiveEntries.end())
+			{
+				// Copied as it is, compressed or not
+				data               = gArchive->Data() + archived->second.offset;
+				entry.size         = archived->second.size;
+				entry.originalSize = archived->second.originalSize;
+				entry.sourceTime   = archived->second.sourceTime;
+			}
+			else
+			{
+				looseFile.reset(new MappedFile(fileName));
+				if (!looseFile->IsOpen() || !FileWriteTime(fileName, entry.sourceTime) || looseFile->Size() > UINT32_MAX)  continue;
+				data = looseFile->Data();
+				entry.size = entry.originalSize = static_cast<uint32_t>(looseFile->Size());
+
+				compressed.resize(LZ4CompressBound(looseFile->Size()));
+				size_t compressedSize = LZ4Compress(looseFile->Data(), looseFile->Size(), compressed.data());
+				if (compressedSize <= entry.originalSize * MinCompression)
+				{
+					data = compressed.data();
+					entry.size = static_cast<uint32_t>(compressedSize);
+				}
+			}
+
+			file.write(reinterpret_cast<const char*>(data), entry.size);
+			file.write(padding, (AssetAlignment - entry.size % AssetAlignment) % AssetAlignment);
+			offset += (entry.size + AssetAlignment - 1) & ~(AssetAlignment - 1);
+			entries.push_back(entry);
+		}
+
+		AssetArchiveHeader header = {};
+		memcpy(header.id, AssetArchiveID, sizeof(AssetArchiveID));
+		header.version    = AssetArchiveVersion;
+		header.numEntries = static_cast<uint32_t>(entries.size());
+		file.seekp(0);
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(AssetArchiveEntry));
+
+		// The old archive must be closed before it can be replaced
+		file.close();
+		gArchiveEntries.clear();
+		gArchive.reset();
+		if (!file || !MoveFileExA(tempFileName.c_str(), gArchiveFileName.c_str(), MOVEFILE_REPLACE_EXISTING))
+		{
+			std::remove(tempFileName.c_str());
+			return false;
+		}
+		return true;
+	}
+}
+
+
+//--------------------------------------------------------------------------------------
+// Opening / closing the archive
+//--------------------------------------------------------------------------------------
+
+// Open the archive with the given file name, if it exists, for AssetFile to read from. With checkLooseFiles each file in the
+// archive is compared with its loose copy, if there is one, and the newer used - an app shipped with only the archive can
+// skip this. Call before loading anything, from one thread
+void OpenAssetArchive(const std::string& fileName, bool checkLooseFiles /*= true*/)
+{
+	gArchiveFileName = fileName;
+	gArchiveEntries.clear();
+	gLooseFiles.clear();
+	gArchive.reset(new MappedFile(fileName));
+	if (!gArchive->IsOpen() || !ReadArchive(checkLooseFiles))
+	{
+		gArchiveEntries.clear();
+		gArchive.reset();
+	}
+}
+
+
+// Close the archive, writing it again first with the files read from loose copies since it was opened (see above). Every
+// AssetFile must have been closed. Returns false if the archive needed writing but couldn't be written, the old one is kept
+bool CloseAssetArchive()
+{
+	bool written = gLooseFiles.empty() || WriteArchive();
+	gArchiveEntries.clear();
+	gArchive.reset();
+	gLooseFiles.clear();
+	gArchiveFileName.clear();
+	return written;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Asset files
+//--------------------------------------------------------------------------------------
+
+// Open the given file. Use IsOpen to see if it worked (it won't if the file doesn't exist)
+AssetFile::AssetFile(const std::string& fileName)
+{
+	auto entry = gArchiveEntries.end();
+	if (!gArchiveEntries.empty())
+	{
+		std::lock_guard<std::mutex> lock(gLooseFilesMutex);
+		if (gLooseFiles.count(fileName) == 0)  entry = gArchiveEntries.find(fileName);
+	}
+	if (entry != gArchiveEntries.end())
+	{
+		mInArchive = true;
+		const unsigned char* data = gArchive->Data() + entry->second.offset;
+		if (entry->second.size == entry->second.originalSize)
+		{
+			mData = data;
+			mSize = entry->second.size;
+		}
+		else
+		{
+			mDecompressed.resize(entry->second.originalSize);
+			if (LZ4Decompress(data, entry->second.size, mDecompressed.data(), mDecompressed.size()))
+			{
+				mData = mDecompressed.data();
+				mSize = mDecompressed.size();
+			}
+		}
+		return;
+	}
+
+	mLooseFile.reset(new MappedFile(fileName));
+	if (!mLooseFile->IsOpen())  return;
+	mData = mLooseFile->Data();
+	mSize = mLooseFile->Size();
+
+	if (!gArchiveFileName.empty())
+	{
+		std::lock_guard<std::mutex> lock(gLooseFilesMutex);
+		gLooseFiles.insert(fileName);
+	}
+}
+
+AssetFile::~AssetFile()
+{
+}
+
+
+// Tell the archive a loose file has been written
+void AssetFileWritten(const std::string& fileName)
+{
+	if (gArchiveFileName.empty())  return;
+	std::lock_guard<std::mutex> lock(gLooseFilesMutex);
+	gLooseFiles.insert(fileName);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Assimp file system
+//--------------------------------------------------------------------------------------
+
+namespace
+{
+	// A file opened by assimp, read from an AssetFile
+	class AssetIOStream : public Assimp::IOStream
+	{
+	public:
+		AssetIOStream(const std::string& fileName) : mFile(fileName) {}
+
+		bool IsOpen()  { return mFile.IsOpen(); }
+
+		size_t Read(void* buffer, size_t size, size_t count) override
+		{
+			if (size == 0)  return 0;
+			count = (std::min)(count, (mFile.Size() - mPosition) / size);
+			memcpy(buffer, mFile.Data() + mPosition, size * count);
+			mPosition += size * count;
+			return count;
+		}
+
+		size_t Write(const void*, size_t, size_t) override  { return 0; } // Read only
+
+		aiReturn Seek(size_t offset, aiOrigin origin) override
+		{
+			size_t position;
+			if      (origin == aiOrigin_SET)  position = offset;
+			else if (origin == aiOrigin_CUR)  position = mPosition + offset;
+			else if (offset <= mFile.Size())  position = mFile.Size() - offset; // aiOrigin_END, as assimp's MemoryIOStream
+			else                              return aiReturn_FAILURE;
+			if (position > mFile.Size())  return aiReturn_FAILURE;
+			mPosition = position;
+			return aiReturn_SUCCESS;
+		}
+
+		size_t Tell() const override      { return mPosition; }
+		size_t FileSize() const override  { return mFile.Size(); }
+		void   Flush() override           {}
+
+	private:
+		AssetFile mFile;
+		size_t    mPosition = 0;
+	};
+
+	class AssetIOSystem : public Assimp::IOSystem
+	{
+	public:
+		bool Exists(const char* fileName) const override
+		{
+			uint64_t time;
+			return gArchiveEntries.count(fileName) != 0 || FileWriteTime(fileName, time);
+		}
+
+		char getOsSeparator() const override  { return '\\'; }
+
+		Assimp::IOStream* Open(const char* fileName, const char* mode = "rb") override
+		{
+			if (strchr(mode, 'w') != nullptr || strchr(mode, 'a') != nullptr)  return nullptr; // Read only
+			std::unique_ptr<AssetIOStream> stream(new AssetIOStream(fileName));
+			return stream->IsOpen() ? stream.release() : nullptr;
+		}
+
+		void Close(Assimp::IOStream* file) override  { delete file; }
+	};
+}
+
+// A new assimp file system that opens files with AssetFile, so assimp can import from the archive. Give it to the importer with
+// Assimp::Importer::SetIOHandler, which deletes it
+Assimp::IOSystem* NewAssetIOSystem()
+{
+	return new AssetIOSystem();
+}
+
+
+// Get the last write time of a loose file, returns false if it doesn't exist
+bool FileWriteTime(const std::string& fileName, uint64_t& time)
+{
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+	if (!GetFileAttributesExA(fileName.c_str(), GetFileExInfoStandard, &attributes))  return false;
+	time = (static_cast<uint64_t>(attributes.ftLastWriteTime.dwHighDateTime) << 32) | attributes.ftLastWriteTime.dwLowDateTime;
+	return true;
+}
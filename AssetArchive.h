@@ -0,0 +1,94 @@
+//--------------------------------------------------------------------------------------
+// Asset archive - the app's files packed into one memory-mapped file
+//--------------------------------------------------------------------------------------
+// Meshes, textures and shaders are dozens of loose files, each opened separately as the app
+// starts. Opening a file costs far more than reading a few kilobytes of it, and with a cold disk
+// cache each file is another seek. Instead the files are packed into one archive, mapped into
+// memory once, and AssetFile serves each from a pointer into it - the same interface as
+// MappedFile, so loaders (the mesh and texture loaders, the shaders, and assimp through
+// AssetIOSystem) don't need to know where a file came from. Layout:
+// - AssetArchiveHeader
+// - An AssetArchiveEntry for each file, sorted by name
+// - The data of each file, starting on a 4KB boundary (a page) so each is mapped on its own
+// Files that shrink by a quarter or more with LZ4 compression are kept compressed, e.g. the text
+// of .x files, and decompressed when opened. Block compressed textures barely compress, so are
+// kept as they are and never copied.
+//
+// Like the shader library (see Shader.cpp), the archive is made by the app itself: every loose
+// file opened through AssetFile is recorded, and when the app closes the archive is written
+// again if any file wasn't in it or was newer than its copy. A loose file that is newer than the
+// archive's copy is used instead, so editing an asset works as before. Files not in the archive
+// and with no loose copy can't be opened, as usual.
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+
+#ifndef _ASSET_ARCHIVE_H_INCLUDED_
+#define _ASSET_ARCHIVE_H_INCLUDED_
+
+class MappedFile;
+namespace Assimp { class IOSystem; }
+
+
+// Open the archive with the given file name, if it exists, for AssetFile to read from. With checkLooseFiles each file in
+// the archive is compared with its loose copy, if there is one, and the newer used - an app shipped with only the archive
+// can skip this. Call before loading anything, from one thread
+void OpenAssetArchive(const std::string& fileName, bool checkLooseFiles = true);
+
+// Close the archive, writing it again first with the files read from loose copies since it was opened (see above). Every
+// AssetFile must have been closed. Returns false if the archive needed writing but couldn't be written, the old one is kept
+bool CloseAssetArchive();
+
+
+// A file from the asset archive if it is there, or the loose file with the same name otherwise. Can be used from any thread
+class AssetFile
+{
+public:
+
+	// Constructor / Destructor //
+
+	// Open the given file. Use IsOpen to see if it worked (it won't if the file doesn't exist)
+	AssetFile(const std::string& fileName);
+	~AssetFile();
+
+	AssetFile(const AssetFile&) = delete;
+	AssetFile& operator=(const AssetFile&) = delete;
+
+
+	// Usage //
+
+	bool                 IsOpen() const  { return mData != nullptr; }
+	const unsigned char* Data()   const  { return mData; }
+	size_t               Size()   const  { return mSize; }
+
+	// Whether the file came from the archive rather than a loose file
+	bool InArchive() const  { return mInArchive; }
+
+
+private:
+	std::unique_ptr<MappedFile> mLooseFile;
+	std::vector<unsigned char>  mDecompressed; // Files compressed in the archive
+	const unsigned char*        mData = nullptr;
+	size_t                      mSize = 0;
+	bool                        mInArchive = false;
+};
+
+
+// Tell the archive the app has written the given loose file, so AssetFile reads it from now on rather than the archive's
+// older copy, and it is packed when the archive closes. Call after writing each file that is read through AssetFile
+void AssetFileWritten(const std::string& fileName);
+
+
+// A new assimp file system that opens files with AssetFile, so assimp can import from the archive. Give it to the importer
+// with Assimp::Importer::SetIOHandler, which deletes it
+Assimp::IOSystem* NewAssetIOSystem();
+
+
+// Get the last write time of a loose file, returns false if it doesn't exist
+bool FileWriteTime(const std::string& fileName, uint64_t& time);
+
+
+#endif //_ASSET_ARCHIVE_H_INCLUDED_
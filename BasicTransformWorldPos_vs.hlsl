@@ -1,7 +1,8 @@
 //--------------------------------------------------------------------------------------
 // Simple Vertex Shader
 //--------------------------------------------------------------------------------------
-// Basic vertex shader that also outputs world position needed for reflection/refraction depth calculations
+// Basic vertex shader that also outputs world position needed for reflection/refraction depth calculations, and the object
+// colour to tint the texture with
 
 #include "Common.hlsli"
 
@@ -10,9 +11,9 @@
 // Shader code
 //--------------------------------------------------------------------------------------
 
-WorldPositionPixelShaderInput main(BasicVertex input)
+TintedPixelShaderInput main(BasicVertex input)
 {
-	WorldPositionPixelShaderInput output;
+	TintedPixelShaderInput output;
 	
 	// Transform the input model vertex position into world, then view then projection space
 	float4 modelPosition = float4(input.position, 1); // Add 4th element to position
@@ -26,5 +27,8 @@ WorldPositionPixelShaderInput main(BasicVertex input)
 	// Pass texture coordinates (UVs) on to the pixel shader
 	output.uv = input.uv;
 
+	// Same tint for the whole model
+	output.tint = gObjectColour;
+
 	return output;
 }
\ No newline at end of file
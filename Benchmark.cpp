@@ -0,0 +1,1071 @@
+//--------------------------------------------------------------------------------------
+// Benchmark mode - plays back a camera path at a fixed time step and saves the frame timings
+//--------------------------------------------------------------------------------------
+
+#include "Benchmark.h"
+#include "Settings.h"
+#include "GpuProfiler.h"
+#include "RenderGraph.h"
+#include "StateCache.h"
+#include "Mesh.h"
+#include "Model.h"
+#include "Shader.h"
+#include "AllocationCounter.h"
+#include "GpuMemory.h"
+#include "StressScene.h"
+#include "PortalMap.h"
+#include "WorldStreamer.h"
+#include "FrameCapture.h"
+#include "SpikeDetector.h"
+#include "Direct3DSetup.h"
+#include "CMatrix4x4.h"
+#include "BatchMath.h"
+#include "MathHelpers.h"
+#include "Timer.h"
+#include "Scene.h"
+#include "Common.h"
+
+#include <Windows.h>
+#include <shellapi.h>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <cmath>
+
+
+//--------------------------------------------------------------------------------------
+// Global data
+//--------------------------------------------------------------------------------------
+
+BenchmarkSettings gBenchmark;
+
+// Path being played back or recorded
+static std::vector<BenchmarkKey> gPath;
+static bool gRecordingPath = false;
+
+// Render graph passes whose DirectX calls are saved with each frame, every pass the scene adds (see ScenePass in Scene.h)
+// Passes with the same name (one for each group of water) are added together
+static const int NumGraphPasses = static_cast<int>(ScenePass::NumPasses);
+
+// DirectX call counts saved for the whole frame, from the state cache stats (see StateCache.h)
+static const struct { const char* name; unsigned int StateCacheStats::* count; } CallColumns[] =
+{
+	{ "draws",               &StateCacheStats::draws               },
+	{ "stateCalls",          &StateCacheStats::issued              },
+	{ "skippedCalls",        &StateCacheStats::filtered            },
+	{ "shaderCalls",         &StateCacheStats::shaderCalls         },
+	{ "constantBufferCalls", &StateCacheStats::constantBufferCalls },
+	{ "resourceCalls",       &StateCacheStats::resourceCalls       },
+	{ "samplerCalls",        &StateCacheStats::samplerCalls        },
+	{ "fixedStateCalls",     &StateCacheStats::stateCalls          },
+	{ "inputCalls",          &StateCacheStats::inputCalls          },
+	{ "targetCalls",         &StateCacheStats::targetCalls         },
+	{ "maps",                &StateCacheStats::maps                },
+	{ "mappedBytes",         &StateCacheStats::mappedBytes         },
+	{ "constantBytes",       &StateCacheStats::constantBytes       },
+};
+
+// Pipeline statistics saved for each GPU pass (see GpuProfiler::PassStatistics)
+static const struct { const char* name; UINT64 D3D11_QUERY_DATA_PIPELINE_STATISTICS::* count; } GpuStatColumns[] =
+{
+	{ "iaPrimitives",       &D3D11_QUERY_DATA_PIPELINE_STATISTICS::IAPrimitives  },
+	{ "vsInvocations",      &D3D11_QUERY_DATA_PIPELINE_STATISTICS::VSInvocations },
+	{ "clipperInvocations", &D3D11_QUERY_DATA_PIPELINE_STATISTICS::CInvocations  },
+	{ "clipperPrimitives",  &D3D11_QUERY_DATA_PIPELINE_STATISTICS::CPrimitives   },
+	{ "psInvocations",      &D3D11_QUERY_DATA_PIPELINE_STATISTICS::PSInvocations },
+};
+static const int NumGpuStats = sizeof(GpuStatColumns) / sizeof(GpuStatColumns[0]);
+
+// Timings and call counts for each measured frame
+static const int NumGpuPasses = static_cast<int>(GpuPass::NumPasses);
+struct BenchmarkFrame
+{
+	float           frameTime; // Milliseconds
+	float           gpuPassTimes[NumGpuPasses];
+	UINT64          gpuPassStats[NumGpuPasses][NumGpuStats];
+	StateCacheStats calls;
+	unsigned int    passDraws[NumGraphPasses];
+	unsigned int    passCalls[NumGraphPasses]; // State calls (see StateCacheStats::issued)
+};
+static std::vector<BenchmarkFrame> gFrames;
+static int gFramesAdded = 0; // Including warmup frames
+
+
+// Path used when no path file is given. A loop around the water at different heights, from the starting camera
+// position in InitScene, while the troll turns and the water rises and falls. Finishes where it starts so it loops
+// smoothly - the final camera rotation is a full turn on from the first
+static const BenchmarkKey DefaultPath[] =
+{
+	// time   camera position     camera rotation  troll position  troll rotation, water height (rotations in degrees)
+	{  0.0f, { -80, 50,  200 }, { 16, 145, 0 }, { 45, 0, 45 },   0, 10 },
+	{  8.0f, { 150, 20,  150 }, {  8, 225, 0 }, { 45, 0, 45 },  90, 12 },
+	{ 16.0f, { 150, 80, -150 }, { 25, 315, 0 }, { 45, 0, 45 }, 180, 10 },
+	{ 24.0f, {-150, 12, -100 }, {  2, 416, 0 }, { 45, 0, 45 }, 270,  8 },
+	{ 32.0f, { -80, 50,  200 }, { 16, 505, 0 }, { 45, 0, 45 }, 360, 10 },
+};
+
+
+//--------------------------------------------------------------------------------------
+// Settings
+//--------------------------------------------------------------------------------------
+
+// Read the benchmark settings from the app's command line into gBenchmark
+// Returns false with a message in gLastError if the command line is not valid
+bool ParseBenchmarkCommandLine()
+{
+	int numArgs;
+	LPWSTR* args = CommandLineToArgvW(GetCommandLineW(), &numArgs);
+	if (args == nullptr)
+	{
+		gLastError = "Error reading command line";
+		return false;
+	}
+
+	bool ok = true;
+	try
+	{
+		// First argument is the program name
+		for (int i = 1; i < numArgs && ok; ++i)
+		{
+			std::wstring arg = args[i];
+			bool hasValue = (i + 1 < numArgs);
+			if      (arg == L"-benchmark")              gBenchmark.enabled = true;
+			else if (arg == L"-frames"   && hasValue)  gBenchmark.numFrames    = std::stoi(args[++i]);
+			else if (arg == L"-warmup"   && hasValue)  gBenchmark.warmupFrames = std::stoi(args[++i]);
+			else if (arg == L"-timestep" && hasValue)  gBenchmark.timeStep     = std::stof(args[++i]);
+			else if (arg == L"-path"     && hasValue)  gBenchmark.pathFile     = args[++i];
+			else if (arg == L"-output"   && hasValue)  gBenchmark.outputFile   = args[++i];
+			else if (arg == L"-capture"  && hasValue)  gBenchmark.captureFrame = std::stoi(args[++i]);
+			else if (arg == L"-framecapture"  && hasValue)  gBenchmark.frameCaptureInterval = std::stoi(args[++i]);
+			else if (arg == L"-capturefolder" && hasValue)  gBenchmark.frameCaptureFolder   = args[++i];
+			else if (arg == L"-comparecaptures" && i + 2 < numArgs)
+			{
+				gBenchmark.compareCaptures = true;
+				gBenchmark.compareFolders[0] = args[++i];
+				gBenchmark.compareFolders[1] = args[++i];
+			}
+			else if (arg == L"-mathbenchmark")          gBenchmark.mathBenchmark = true;
+			else if (arg == L"-loadbenchmark")          gBenchmark.loadBenchmark = true;
+			else if (arg == L"-renderbenchmark")        gBenchmark.renderBenchmark = true;
+			else if (arg == L"-warp")                   gBenchmark.warpDevice = true;
+			else if (arg == L"-stress"       && hasValue)  gStressScene.numObjects = std::stoi(args[++i]);
+			else if (arg == L"-stressabove"  && hasValue)  gStressScene.aboveWater = std::stof(args[++i]);
+			else if (arg == L"-stressunder"  && hasValue)  gStressScene.underWater = std::stof(args[++i]);
+			else if (arg == L"-stresslights" && hasValue)  gStressScene.numLights  = std::stoi(args[++i]);
+			else if (arg == L"-stressseed"   && hasValue)  gStressScene.seed       = static_cast<unsigned int>(std::stoul(args[++i]));
+			else if (arg == L"-spikethreshold" && hasValue)  gSpikeSettings.threshold     = std::stof(args[++i]);
+			else if (arg == L"-spikemin"       && hasValue)  gSpikeSettings.minimumTimeMs = std::stof(args[++i]);
+			else if (arg == L"-portals"        && hasValue)  gPortalSettings.fileName = args[++i];
+			else if (arg == L"-chunksize"    && hasValue)  gWorldStreaming.chunkSize = std::stof(args[++i]);
+			else if (arg == L"-streamradius" && hasValue)  gWorldStreaming.radius    = std::stof(args[++i]);
+			else if (arg == L"-streambudget" && hasValue)  gWorldStreaming.budgetMB  = std::stof(args[++i]);
+			else if (IsRenderSettingsOption(arg) && hasValue)  ++i; // Read by LoadRenderSettings
+			else ok = false;
+		}
+	}
+	catch (std::logic_error) // Thrown by stoi / stof for text that isn't a number
+	{
+		ok = false;
+	}
+	LocalFree(args);
+
+	if (ok && (gBenchmark.numFrames <= 0 || gBenchmark.warmupFrames < 0 || gBenchmark.timeStep <= 0))  ok = false;
+	if (ok && (gBenchmark.captureFrame >= gBenchmark.numFrames || gBenchmark.frameCaptureInterval < 0))  ok = false;
+	if (ok && (gStressScene.numObjects < 0 || gStressScene.numLights < 0 || gStressScene.aboveWater < 0 ||
+	           gStressScene.underWater < 0 || gStressScene.aboveWater + gStressScene.underWater > 1))  ok = false;
+	if (ok && (gSpikeSettings.threshold < 0 || gSpikeSettings.minimumTimeMs < 0))  ok = false;
+	if (ok && (gWorldStreaming.chunkSize < 0 || gWorldStreaming.radius <= 0 || gWorldStreaming.budgetMB <= 0))  ok = false;
+	if (!ok)
+	{
+		gLastError = "Invalid command line. Options are: -benchmark -frames N -warmup N -timestep seconds -path file.txt -output file.csv|file.json -capture N -framecapture N -capturefolder dir -comparecaptures dirA dirB -mathbenchmark -loadbenchmark -renderbenchmark -warp -stress N -stressabove F -stressunder F -stresslights K -stressseed N -spikethreshold F -spikemin ms -portals file.x -chunksize N -streamradius N -streambudget MB, and the render settings (see Settings.h)";
+		return false;
+	}
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Scene path
+//--------------------------------------------------------------------------------------
+
+// Load the path chosen in gBenchmark. Call after ParseBenchmarkCommandLine
+// Returns false with a message in gLastError on failure
+bool LoadBenchmarkPath()
+{
+	gPath.clear();
+
+	// Keys are stored in degrees in the built-in path and in files
+	auto toRadians = [](BenchmarkKey key)
+	{
+		key.cameraRotation = { ToRadians(key.cameraRotation.x), ToRadians(key.cameraRotation.y), ToRadians(key.cameraRotation.z) };
+		key.trollRotation  = ToRadians(key.trollRotation);
+		return key;
+	};
+
+	if (gBenchmark.pathFile.empty())
+	{
+		for (auto& key : DefaultPath)  gPath.push_back(toRadians(key));
+		return true;
+	}
+
+	std::ifstream file(gBenchmark.pathFile);
+	if (!file)
+	{
+		gLastError = "Error opening benchmark path file";
+		return false;
+	}
+
+	std::string line;
+	while (std::getline(file, line))
+	{
+		if (line.empty() || line[0] == '#')  continue;
+
+		BenchmarkKey key;
+		std::istringstream values(line);
+		values >> key.time
+		       >> key.cameraPosition.x >> key.cameraPosition.y >> key.cameraPosition.z
+		       >> key.cameraRotation.x >> key.cameraRotation.y >> key.cameraRotation.z
+		       >> key.trollPosition.x  >> key.trollPosition.y  >> key.trollPosition.z
+		       >> key.trollRotation >> key.waterHeight;
+		if (!values || (!gPath.empty() && key.time < gPath.back().time))
+		{
+			gLastError = "Error reading benchmark path file, each line needs 12 values and times must increase";
+			return false;
+		}
+		gPath.push_back(toRadians(key));
+	}
+
+	if (gPath.empty())
+	{
+		gLastError = "Benchmark path file has no keys";
+		return false;
+	}
+	return true;
+}
+
+
+// Get the scene state at the given time along the path, interpolating between keys. The path loops if the time
+// is longer than the path
+BenchmarkKey BenchmarkPathKey(float time)
+{
+	if (gPath.size() == 1 || gPath.back().time <= gPath.front().time)  return gPath.front();
+
+	// Loop the time into the range covered by the path
+	float start = gPath.front().time;
+	float duration = gPath.back().time - start;
+	time = start + std::fmod(time - start, duration);
+	if (time < start)  time += duration;
+
+	// Find the keys either side of the time and blend between them
+	size_t next = 1;
+	while (next < gPath.size() - 1 && gPath[next].time < time)  ++next;
+	const BenchmarkKey& key0 = gPath[next - 1];
+	const BenchmarkKey& key1 = gPath[next];
+	float t = (key1.time > key0.time) ? (time - key0.time) / (key1.time - key0.time) : 0.0f;
+
+	BenchmarkKey key;
+	key.time           = time;
+	key.cameraPosition = key0.cameraPosition + (key1.cameraPosition - key0.cameraPosition) * t;
+	key.cameraRotation = key0.cameraRotation + (key1.cameraRotation - key0.cameraRotation) * t;
+	key.trollPosition  = key0.trollPosition  + (key1.trollPosition  - key0.trollPosition)  * t;
+	key.trollRotation  = key0.trollRotation + (key1.trollRotation - key0.trollRotation) * t;
+	key.waterHeight    = key0.waterHeight   + (key1.waterHeight   - key0.waterHeight)   * t;
+	return key;
+}
+
+
+// Record a path to play back later. Add a key at regular intervals between start and stop. Stopping saves the path
+// Returns false with a message in gLastError if the file can't be written
+void StartPathRecording()
+{
+	gPath.clear();
+	gRecordingPath = true;
+}
+
+void RecordPathKey(const BenchmarkKey& key)
+{
+	if (gRecordingPath)  gPath.push_back(key);
+}
+
+bool StopPathRecording(const std::wstring& fileName)
+{
+	gRecordingPath = false;
+
+	std::ofstream file(fileName);
+	file << "# time  camera position (x y z)  camera rotation (x y z degrees)  troll position (x y z)  troll rotation (degrees)  water height\n";
+	for (auto& key : gPath)
+	{
+		file << key.time << ' '
+		     << key.cameraPosition.x << ' ' << key.cameraPosition.y << ' ' << key.cameraPosition.z << ' '
+		     << ToDegrees(key.cameraRotation.x) << ' ' << ToDegrees(key.cameraRotation.y) << ' ' << ToDegrees(key.cameraRotation.z) << ' '
+		     << key.trollPosition.x << ' ' << key.trollPosition.y << ' ' << key.trollPosition.z << ' '
+		     << ToDegrees(key.trollRotation) << ' ' << key.waterHeight << '\n';
+	}
+	gPath.clear();
+
+	if (!file)
+	{
+		gLastError = "Error writing benchmark path file";
+		return false;
+	}
+	return true;
+}
+
+bool IsRecordingPath()
+{
+	return gRecordingPath;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Results
+//--------------------------------------------------------------------------------------
+
+// Add the timings for a frame, call after rendering it. Frame time is in seconds, measured on the CPU from one frame to
+// the next. The GPU pass times are the latest ones from gGpuProfiler (see GpuProfiler.h), which are a few frames behind
+// Returns true when all the frames needed have been added (warmup frames are not kept)
+bool AddBenchmarkFrame(float frameTime)
+{
+	++gFramesAdded;
+	if (gFramesAdded <= gBenchmark.warmupFrames)  return false;
+
+	if (gFrames.empty())  gFrames.reserve(gBenchmark.numFrames); // Avoid allocations while measuring
+
+	BenchmarkFrame frame;
+	frame.frameTime = frameTime * 1000.0f;
+	for (int pass = 0; pass < NumGpuPasses; ++pass)
+	{
+		frame.gpuPassTimes[pass] = gGpuProfiler->PassTime(static_cast<GpuPass>(pass));
+		const D3D11_QUERY_DATA_PIPELINE_STATISTICS& statistics = gGpuProfiler->PassStatistics(static_cast<GpuPass>(pass));
+		for (int stat = 0; stat < NumGpuStats; ++stat)  frame.gpuPassStats[pass][stat] = statistics.*GpuStatColumns[stat].count;
+	}
+	frame.calls = GetStateCacheStats();
+	for (int pass = 0; pass < NumGraphPasses; ++pass)
+	{
+		StateCacheStats passStats = gRenderGraph->PassStats(ScenePassNames[pass]);
+		frame.passDraws[pass] = passStats.draws;
+		frame.passCalls[pass] = passStats.issued;
+	}
+	gFrames.push_back(frame);
+
+	return static_cast<int>(gFrames.size()) >= gBenchmark.numFrames;
+}
+
+// Whether the frame about to be rendered is the one chosen to be captured with RenderDoc. Frames added so far include the
+// warmup frames
+bool IsBenchmarkCaptureFrame()
+{
+	return gBenchmark.enabled && gBenchmark.captureFrame >= 0 && gFramesAdded == gBenchmark.warmupFrames + gBenchmark.captureFrame;
+}
+
+// The number of the measured frame about to be rendered, from 0, or negative during the warmup. -1 when not benchmarking
+int BenchmarkFrameNumber()
+{
+	return gBenchmark.enabled ? gFramesAdded - gBenchmark.warmupFrames : -1;
+}
+
+
+// Return the given percentile (0-100) of a sorted list of values, using the nearest value
+static float Percentile(const std::vector<float>& sortedValues, float percentile)
+{
+	if (sortedValues.empty())  return 0;
+	size_t index = static_cast<size_t>(std::ceil(percentile / 100.0f * sortedValues.size()));
+	return sortedValues[index == 0 ? 0 : (std::min)(index, sortedValues.size()) - 1];
+}
+
+
+// Whether the results file chosen in gBenchmark should be JSON rather than CSV, from its extension
+bool IsJsonOutput()
+{
+	const std::wstring& fileName = gBenchmark.outputFile;
+	return fileName.size() >= 5 && fileName.compare(fileName.size() - 5, 5, L".json") == 0;
+}
+
+// Text in quotes for the JSON results, e.g. a resource name holding a file path
+static std::string JsonString(const std::string& text)
+{
+	std::string quoted = "\"";
+	for (auto c : text)
+	{
+		if (c == '"' || c == '\\')  quoted += '\\';
+		quoted += c;
+	}
+	return quoted + '"';
+}
+
+
+// Save the benchmark results to the file chosen in gBenchmark, as CSV or JSON depending on the file extension
+// Returns false with a message in gLastError if the file can't be written
+bool WriteBenchmarkResults()
+{
+	// The last captures are still on their way back from the GPU. Any that were missed fail the run once the results are saved
+	bool capturesOk = (gFrameCapture == nullptr || gFrameCapture->Finish());
+	std::string captureError = gLastError;
+
+	// Summary statistics
+	std::vector<float> frameTimes;
+	float averageGpuPassTimes[NumGpuPasses] = {};
+	double averageGpuPassStats[NumGpuPasses][NumGpuStats] = {};
+	double averageCalls[sizeof(CallColumns) / sizeof(CallColumns[0])] = {};
+	for (auto& frame : gFrames)
+	{
+		frameTimes.push_back(frame.frameTime);
+		for (int pass = 0; pass < NumGpuPasses; ++pass)
+		{
+			averageGpuPassTimes[pass] += frame.gpuPassTimes[pass];
+			for (int stat = 0; stat < NumGpuStats; ++stat)  averageGpuPassStats[pass][stat] += static_cast<double>(frame.gpuPassStats[pass][stat]);
+		}
+		for (auto& column : CallColumns)  averageCalls[&column - CallColumns] += frame.calls.*column.count;
+	}
+	std::sort(frameTimes.begin(), frameTimes.end());
+	float averageFrameTime = 0;
+	for (auto time : frameTimes)  averageFrameTime += time;
+	if (!gFrames.empty())
+	{
+		averageFrameTime /= gFrames.size();
+		for (auto& time : averageGpuPassTimes)  time /= gFrames.size();
+		for (auto& passStats : averageGpuPassStats)  for (auto& stat : passStats)  stat /= gFrames.size();
+		for (auto& calls : averageCalls)  calls /= gFrames.size();
+	}
+
+	// Pass names without spaces, for the column names
+	std::string graphPassColumns[NumGraphPasses];
+	for (int pass = 0; pass < NumGraphPasses; ++pass)
+	{
+		graphPassColumns[pass] = ScenePassNames[pass];
+		graphPassColumns[pass].erase(std::remove(graphPassColumns[pass].begin(), graphPassColumns[pass].end(), ' '), graphPassColumns[pass].end());
+	}
+	float p50 = Percentile(frameTimes, 50);
+	float p95 = Percentile(frameTimes, 95);
+	float p99 = Percentile(frameTimes, 99);
+
+	// GPU memory at the end of the run, from DXGI and from the resources registered (see GpuMemory.h)
+	uint64_t videoMemoryUsed, videoMemoryBudget;
+	VideoMemoryUsage(videoMemoryUsed, videoMemoryBudget);
+	std::vector<GpuMemoryOwner>  owners = GpuMemoryByOwner();
+	std::vector<GpuResourceInfo> resources = GpuResources();
+	std::vector<ShaderCost> shaderCosts = ShaderCosts(); // With the results, so builds with dearer shaders can be spotted
+	size_t registeredBytes = 0;
+	for (auto& resource : resources)  registeredBytes += resource.bytes;
+
+	std::ofstream file(gBenchmark.outputFile);
+	file.precision(4);
+	file << std::fixed;
+
+	if (IsJsonOutput())
+	{
+		file << "{\n";
+		file << "  \"frames\": " << gFrames.size() << ",\n";
+		file << "  \"timeStep\": " << gBenchmark.timeStep << ",\n";
+		file << "  \"stressScene\": { \"objects\": " << gStressScene.numObjects << ", \"above\": " << gStressScene.aboveWater
+		     << ", \"under\": " << gStressScene.underWater << ", \"lights\": " << gStressScene.numLights << ", \"seed\": " << gStressScene.seed << " },\n";
+		if (gFrameCapture != nullptr)
+		{
+			file << "  \"frameCaptures\": { \"interval\": " << gBenchmark.frameCaptureInterval << ", \"captured\": " << gFrameCapture->NumCaptured()
+			     << ", \"dropped\": " << gFrameCapture->NumDropped() << " },\n";
+		}
+		file << "  \"frameTimeMs\": { \"mean\": " << averageFrameTime << ", \"p50\": " << p50 << ", \"p95\": " << p95 << ", \"p99\": " << p99
+		     << ", \"min\": " << (frameTimes.empty() ? 0 : frameTimes.front()) << ", \"max\": " << (frameTimes.empty() ? 0 : frameTimes.back()) << " },\n";
+		file << "  \"gpuPassMs\": {";
+		for (int pass = 0; pass < NumGpuPasses; ++pass)
+		{
+			file << (pass == 0 ? " " : ", ") << '"' << GpuProfiler::PassName(static_cast<GpuPass>(pass)) << "\": " << averageGpuPassTimes[pass];
+		}
+		file << " },\n";
+		file << "  \"gpuPassStatsMean\": {\n";
+		for (int pass = 0; pass < NumGpuPasses; ++pass)
+		{
+			file << "    \"" << GpuProfiler::PassName(static_cast<GpuPass>(pass)) << "\": {";
+			for (int stat = 0; stat < NumGpuStats; ++stat)
+			{
+				file << (stat == 0 ? " " : ", ") << '"' << GpuStatColumns[stat].name << "\": " << averageGpuPassStats[pass][stat];
+			}
+			file << (pass + 1 < NumGpuPasses ? " },\n" : " }\n");
+		}
+		file << "  },\n";
+		file << "  \"callsMean\": {";
+		for (auto& column : CallColumns)
+		{
+			file << (&column == CallColumns ? " " : ", ") << '"' << column.name << "\": " << averageCalls[&column - CallColumns];
+		}
+		file << " },\n";
+		file << "  \"gpuMemory\": {\n";
+		file << "    \"usedBytes\": " << videoMemoryUsed << ", \"budgetBytes\": " << videoMemoryBudget << ", \"registeredBytes\": " << registeredBytes << ",\n";
+		file << "    \"owners\": {";
+		for (auto& owner : owners)
+		{
+			file << (&owner == owners.data() ? " " : ", ") << '"' << owner.owner << "\": " << owner.bytes;
+		}
+		file << " },\n";
+		file << "    \"resources\": [\n";
+		for (size_t i = 0; i < resources.size(); ++i)
+		{
+			auto& resource = resources[i];
+			file << "      { \"owner\": " << JsonString(resource.owner) << ", \"name\": " << JsonString(resource.name) << ", \"type\": \"" << resource.type
+			     << "\", \"format\": \"" << FormatName(resource.format) << "\", \"size\": [" << resource.width << ", " << resource.height << ", "
+			     << resource.depth << "], \"mips\": " << resource.mipLevels << ", \"samples\": " << resource.samples << ", \"bytes\": "
+			     << resource.bytes << (i + 1 < resources.size() ? " },\n" : " }\n");
+		}
+		file << "    ]\n";
+		file << "  },\n";
+		file << "  \"shaders\": [\n";
+		for (size_t i = 0; i < shaderCosts.size(); ++i)
+		{
+			auto& cost = shaderCosts[i];
+			file << "    { \"name\": " << JsonString(cost.name) << ", \"instructions\": " << cost.instructions << ", \"arithmetic\": "
+			     << cost.arithmetic << ", \"textureFetches\": " << cost.textureFetches << ", \"tempRegisters\": " << cost.tempRegisters
+			     << ", \"constantBuffers\": " << cost.constantBuffers << ", \"constantBytes\": " << cost.constantBytes
+			     << (i + 1 < shaderCosts.size() ? " },\n" : " }\n");
+		}
+		file << "  ],\n";
+		file << "  \"frameData\": [\n";
+		for (size_t i = 0; i < gFrames.size(); ++i)
+		{
+			file << "    [" << gFrames[i].frameTime;
+			for (auto time : gFrames[i].gpuPassTimes)  file << ", " << time;
+			file << (i + 1 < gFrames.size() ? "],\n" : "]\n");
+		}
+		file << "  ],\n";
+
+		// Call counts for each frame, a column for each count in the names list
+		file << "  \"frameCallColumns\": [";
+		for (auto& column : CallColumns)  file << (&column == CallColumns ? "" : ", ") << '"' << column.name << '"';
+		for (auto& pass : graphPassColumns)  file << ", \"draws" << pass << "\", \"calls" << pass << '"';
+		file << "],\n";
+		file << "  \"frameCalls\": [\n";
+		for (size_t i = 0; i < gFrames.size(); ++i)
+		{
+			file << "    [";
+			for (auto& column : CallColumns)  file << (&column == CallColumns ? "" : ", ") << gFrames[i].calls.*column.count;
+			for (int pass = 0; pass < NumGraphPasses; ++pass)  file << ", " << gFrames[i].passDraws[pass] << ", " << gFrames[i].passCalls[pass];
+			file << (i + 1 < gFrames.size() ? "],\n" : "]\n");
+		}
+		file << "  ],\n";
+
+		// Pipeline statistics for each frame, a column for each count of each GPU pass
+		file << "  \"frameGpuStatColumns\": [";
+		for (int pass = 0; pass < NumGpuPasses; ++pass)
+		{
+			for (int stat = 0; stat < NumGpuStats; ++stat)
+			{
+				file << (pass == 0 && stat == 0 ? "" : ", ") << '"' << GpuStatColumns[stat].name << GpuProfiler::PassName(static_cast<GpuPass>(pass)) << '"';
+			}
+		}
+		file << "],\n";
+		file << "  \"frameGpuStats\": [\n";
+		for (size_t i = 0; i < gFrames.size(); ++i)
+		{
+			file << "    [";
+			for (int pass = 0; pass < NumGpuPasses; ++pass)
+			{
+				for (int stat = 0; stat < NumGpuStats; ++stat)  file << (pass == 0 && stat == 0 ? "" : ", ") << gFrames[i].gpuPassStats[pass][stat];
+			}
+			file << (i + 1 < gFrames.size() ? "],\n" : "]\n");
+		}
+		file << "  ]\n";
+		file << "}\n";
+	}
+	else
+	{
+		// Summary lines first, starting with # so the per-frame table below can still be loaded as CSV
+		file << "# frames," << gFrames.size() << "\n";
+		file << "# timeStep," << gBenchmark.timeStep << "\n";
+		file << "# stressObjects," << gStressScene.numObjects << "\n";
+		file << "# stressAbove," << gStressScene.aboveWater << "\n";
+		file << "# stressUnder," << gStressScene.underWater << "\n";
+		file << "# stressLights," << gStressScene.numLights << "\n";
+		file << "# stressSeed," << gStressScene.seed << "\n";
+		if (gFrameCapture != nullptr)
+		{
+			file << "# frameCaptures interval," << gBenchmark.frameCaptureInterval << "\n";
+			file << "# frameCaptures captured," << gFrameCapture->NumCaptured() << "\n";
+			file << "# frameCaptures dropped," << gFrameCapture->NumDropped() << "\n";
+		}
+		file << "# frameTimeMs mean," << averageFrameTime << "\n";
+		file << "# frameTimeMs p50," << p50 << "\n";
+		file << "# frameTimeMs p95," << p95 << "\n";
+		file << "# frameTimeMs p99," << p99 << "\n";
+		for (int pass = 0; pass < NumGpuPasses; ++pass)
+		{
+			file << "# gpuMs " << GpuProfiler::PassName(static_cast<GpuPass>(pass)) << ',' << averageGpuPassTimes[pass] << "\n";
+		}
+		for (int pass = 0; pass < NumGpuPasses; ++pass)
+		{
+			for (int stat = 0; stat < NumGpuStats; ++stat)
+			{
+				file << "# " << GpuStatColumns[stat].name << ' ' << GpuProfiler::PassName(static_cast<GpuPass>(pass)) << " mean,"
+				     << averageGpuPassStats[pass][stat] << "\n";
+			}
+		}
+		for (auto& column : CallColumns)  file << "# " << column.name << " mean," << averageCalls[&column - CallColumns] << "\n";
+		file << "# videoMemoryBytes used," << videoMemoryUsed << "\n";
+		file << "# videoMemoryBytes budget," << videoMemoryBudget << "\n";
+		file << "# gpuMemoryBytes registered," << registeredBytes << "\n";
+		for (auto& owner : owners)  file << "# gpuMemoryBytes " << owner.owner << ',' << owner.bytes << "\n";
+		file << "# resource,owner,name,type,format,width,height,depth,mips,samples,bytes\n";
+		for (auto& resource : resources)
+		{
+			file << "# resource," << resource.owner << ',' << resource.name << ',' << resource.type << ',' << FormatName(resource.format) << ','
+			     << resource.width << ',' << resource.height << ',' << resource.depth << ',' << resource.mipLevels << ','
+			     << resource.samples << ',' << resource.bytes << "\n";
+		}
+		file << "# shader,name,instructions,arithmetic,textureFetches,tempRegisters,constantBuffers,constantBytes\n";
+		for (auto& cost : shaderCosts)
+		{
+			file << "# shader," << cost.name << ',' << cost.instructions << ',' << cost.arithmetic << ',' << cost.textureFetches << ','
+			     << cost.tempRegisters << ',' << cost.constantBuffers << ',' << cost.constantBytes << "\n";
+		}
+
+		file << "frame,frameTimeMs";
+		for (int pass = 0; pass < NumGpuPasses; ++pass)  file << ",gpu" << GpuProfiler::PassName(static_cast<GpuPass>(pass)) << "Ms";
+		for (auto& column : CallColumns)  file << ',' << column.name;
+		for (auto& pass : graphPassColumns)  file << ",draws" << pass << ",calls" << pass;
+		for (int pass = 0; pass < NumGpuPasses; ++pass)
+		{
+			for (auto& stat : GpuStatColumns)  file << ',' << stat.name << GpuProfiler::PassName(static_cast<GpuPass>(pass));
+		}
+		file << "\n";
+		for (size_t i = 0; i < gFrames.size(); ++i)
+		{
+			file << i << ',' << gFrames[i].frameTime;
+			for (auto time : gFrames[i].gpuPassTimes)  file << ',' << time;
+			for (auto& column : CallColumns)  file << ',' << gFrames[i].calls.*column.count;
+			for (int pass = 0; pass < NumGraphPasses; ++pass)  file << ',' << gFrames[i].passDraws[pass] << ',' << gFrames[i].passCalls[pass];
+			for (auto& passStats : gFrames[i].gpuPassStats)  for (auto stat : passStats)  file << ',' << stat;
+			file << "\n";
+		}
+	}
+
+	if (!file)
+	{
+		gLastError = "Error writing benchmark results file";
+		return false;
+	}
+	if (!capturesOk)
+	{
+		gLastError = captureError;
+		return false;
+	}
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Maths microbenchmark
+//--------------------------------------------------------------------------------------
+
+// Timing for one matrix function, or a batch function per point against one point at a time
+struct MathBenchmarkResult
+{
+	const char* name;
+	float       scalarNs;      // Nanoseconds per call
+	float       simdNs;
+	float       maxDifference; // Largest difference in any element between the two versions
+};
+
+// Number of inputs and how many times to go through them. The inputs fit in the L1 cache so the arithmetic is timed
+// rather than memory access
+static const int MathBenchmarkInputs = 256;
+static const int MathBenchmarkRepeats = 20000;
+
+// Call the given function on every input many times and return the nanoseconds per call. The results are summed into
+// the sink so the compiler can't remove the calls
+template <class Function>
+static float TimeMathFunction(Function function, float& sink)
+{
+	Timer timer;
+	timer.Start();
+	for (int repeat = 0; repeat < MathBenchmarkRepeats; ++repeat)
+	{
+		for (int i = 0; i < MathBenchmarkInputs; ++i)  sink += function(i);
+	}
+	return timer.GetTime() * 1e9f / (static_cast<float>(MathBenchmarkRepeats) * MathBenchmarkInputs);
+}
+
+// Largest difference between the elements of two matrices
+static float MaxDifference(const CMatrix4x4& m1, const CMatrix4x4& m2)
+{
+	float maxDifference = 0;
+	for (int i = 0; i < 16; ++i)  maxDifference = (std::max)(maxDifference, std::abs((&m1.e00)[i] - (&m2.e00)[i]));
+	return maxDifference;
+}
+
+
+// Time the SIMD matrix multiply, vector transform and InverseAffine against the plain C++ versions (see CMatrix4x4.h), and
+// the batch point transform and sphere tests against one at a time (see BatchMath.h), and save the time per call, the speedup and the largest difference in the results to the file chosen in gBenchmark
+// Returns false with a message in gLastError if the file can't be written
+bool RunMathBenchmark()
+{
+	// Random affine matrices like the ones in a model hierarchy, and random points. Same seed every run
+	srand(1);
+	std::vector<CMatrix4x4> matrices(MathBenchmarkInputs + 1);
+	std::vector<CVector4>   vectors(MathBenchmarkInputs);
+	for (auto& m : matrices)
+	{
+		m = MatrixScaling(Random(0.5f, 2.0f)) * MatrixRotationX(Random(-PI, PI)) * MatrixRotationY(Random(-PI, PI)) *
+		    MatrixTranslation({ Random(-100.0f, 100.0f), Random(-100.0f, 100.0f), Random(-100.0f, 100.0f) });
+	}
+	for (auto& v : vectors)  v = { Random(-100.0f, 100.0f), Random(-100.0f, 100.0f), Random(-100.0f, 100.0f), 1 };
+
+	// The same points and spheres around them for the batch functions (see BatchMath.h), and a camera's frustum that sees
+	// about half of them
+	PointArray points, transformed;
+	SphereArray spheres;
+	std::vector<char> inside;
+	points.Resize(MathBenchmarkInputs);
+	spheres.Resize(MathBenchmarkInputs);
+	for (int i = 0; i < MathBenchmarkInputs; ++i)
+	{
+		points.Set(i, { vectors[i].x, vectors[i].y, vectors[i].z });
+		spheres.Set(i, { points.Get(i), Random(1.0f, 10.0f) });
+	}
+	CMatrix4x4 projection = { 1, 0, 0, 0,   0, 1, 0, 0,   0, 0, 0, 1,   0, 0, 0.1f, 0 };
+	Frustum frustum = FrustumFromMatrix(InverseAffine(MatrixTranslation({ 0, 0, -100 })) * projection);
+	auto sphereAt = [&](int i) { BoundingSphere sphere;  sphere.centre = points.Get(i);  sphere.radius = spheres.radius[i];  return sphere; };
+
+	// The batch functions are timed per point, the whole array done on the first
+	float sink = 0;
+	MathBenchmarkResult results[] =
+	{
+		{ "multiply",
+		  TimeMathFunction([&](int i) { return MultiplyScalar(matrices[i], matrices[i + 1]).e30; }, sink),
+		  TimeMathFunction([&](int i) { return (matrices[i] * matrices[i + 1]).e30; }, sink), 0 },
+		{ "transform",
+		  TimeMathFunction([&](int i) { return TransformScalar(vectors[i], matrices[i]).x; }, sink),
+		  TimeMathFunction([&](int i) { return (vectors[i] * matrices[i]).x; }, sink), 0 },
+		{ "inverseAffine",
+		  TimeMathFunction([&](int i) { return InverseAffineScalar(matrices[i]).e30; }, sink),
+		  TimeMathFunction([&](int i) { return InverseAffine(matrices[i]).e30; }, sink), 0 },
+		{ "transformPoints",
+		  TimeMathFunction([&](int i) { return TransformScalar(vectors[i], matrices[0]).x; }, sink),
+		  TimeMathFunction([&](int i) { if (i == 0)  TransformPoints(points, matrices[0], transformed);  return transformed.x[i]; }, sink), 0 },
+		{ "spheresInFrustum",
+		  TimeMathFunction([&](int i) { return SphereInFrustum(frustum, sphereAt(i)) ? 1.0f : 0.0f; }, sink),
+		  TimeMathFunction([&](int i) { if (i == 0)  SpheresInFrustum(frustum, spheres, inside);  return static_cast<float>(inside[i]); }, sink), 0 },
+	};
+
+	// Check the two versions give the same results, allowing for rounding (fused multiply-add rounds less often)
+	for (int i = 0; i < MathBenchmarkInputs; ++i)
+	{
+		float& multiplyDifference = results[0].maxDifference;
+		float& transformDifference = results[1].maxDifference;
+		float& inverseDifference = results[2].maxDifference;
+		multiplyDifference = (std::max)(multiplyDifference, MaxDifference(MultiplyScalar(matrices[i], matrices[i + 1]), matrices[i] * matrices[i + 1]));
+		inverseDifference  = (std::max)(inverseDifference,  MaxDifference(InverseAffineScalar(matrices[i]), InverseAffine(matrices[i])));
+		CVector4 v1 = TransformScalar(vectors[i], matrices[i]);
+		CVector4 v2 = vectors[i] * matrices[i];
+		for (int e = 0; e < 4; ++e)  transformDifference = (std::max)(transformDifference, std::abs((&v1.x)[e] - (&v2.x)[e]));
+	}
+	TransformPoints(points, matrices[0], transformed);
+	SpheresInFrustum(frustum, spheres, inside);
+	for (int i = 0; i < MathBenchmarkInputs; ++i)
+	{
+		float& pointsDifference = results[3].maxDifference;
+		float& spheresDifference = results[4].maxDifference;
+		CVector4 v = TransformScalar(vectors[i], matrices[0]);
+		pointsDifference = (std::max)({ pointsDifference, std::abs(v.x - transformed.x[i]), std::abs(v.y - transformed.y[i]),
+		                                std::abs(v.z - transformed.z[i]) });
+		if (SphereInFrustum(frustum, sphereAt(i)) != (inside[i] != 0))  spheresDifference = 1;
+	}
+
+	std::ofstream file(gBenchmark.outputFile);
+	file.precision(4);
+	file << std::fixed;
+
+	if (IsJsonOutput())
+	{
+		file << "{\n";
+		for (auto& result : results)
+		{
+			file << "  \"" << result.name << "\": { \"scalarNs\": " << result.scalarNs << ", \"simdNs\": " << result.simdNs
+			     << ", \"speedup\": " << result.scalarNs / result.simdNs << ", \"maxDifference\": " << result.maxDifference << " },\n";
+		}
+		file << "  \"checksum\": " << sink << "\n";
+		file << "}\n";
+	}
+	else
+	{
+		file << "# checksum," << sink << "\n";
+		file << "function,scalarNs,simdNs,speedup,maxDifference\n";
+		for (auto& result : results)
+		{
+			file << result.name << ',' << result.scalarNs << ',' << result.simdNs << ','
+			     << result.scalarNs / result.simdNs << ',' << result.maxDifference << "\n";
+		}
+	}
+
+	if (!file)
+	{
+		gLastError = "Error writing benchmark results file";
+		return false;
+	}
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Mesh load benchmark
+//--------------------------------------------------------------------------------------
+
+// Every mesh file the app has, a mix of small and large meshes, skinned and not
+static const char* const LoadBenchmarkMeshes[] = { "Hills.x", "Troll.x", "CargoContainer.x", "Light.x", "Cube.x", "Floor.x", "Ground.x",
+                                                   "Portal.x", "Skybox.x", "Sphere.x", "Stars.x", "Teapot.x" };
+static const int NumLoadBenchmarkMeshes = sizeof(LoadBenchmarkMeshes) / sizeof(LoadBenchmarkMeshes[0]);
+
+// Times each mesh is imported each way. The two ways take turns so neither gains from the other warming the caches
+static const int LoadBenchmarkRepeats = 5;
+
+// Timing for imports of one mesh file, averaged over the repeats
+struct LoadBenchmarkResult
+{
+	float    heapMs;
+	float    arenaMs;
+	uint64_t heapAllocations; // Made with new during one import
+	uint64_t arenaAllocations;
+};
+
+
+// Import every mesh file of the app with assimp (ignoring the cooked mesh files) several times, with the import temporaries
+// taken from the import arena and from the heap (see useImportArena in MeshLoaderSettings). Saves the time and number of heap
+// allocations of each import both ways to the file chosen in gBenchmark. Call once Direct3D is set up, before the scene
+// Returns false with a message in gLastError if a mesh can't be loaded or the file can't be written
+bool RunLoadBenchmark()
+{
+	// Loader settings as the scene uses them
+	MeshLoaderSettings savedSettings = gMeshLoaderSettings;
+	gMeshLoaderSettings.quantiseVertices = true;
+	gMeshLoaderSettings.useCookedMeshes = false;
+
+	// One import of each mesh first, so the files are in the file cache and the arena has grown to its full size
+	LoadBenchmarkResult results[NumLoadBenchmarkMeshes] = {};
+	try
+	{
+		for (auto fileName : LoadBenchmarkMeshes)  Mesh mesh(fileName);
+
+		for (int repeat = 0; repeat < LoadBenchmarkRepeats; ++repeat)
+		{
+			for (int m = 0; m < NumLoadBenchmarkMeshes; ++m)
+			{
+				for (bool arena : { false, true })
+				{
+					gMeshLoaderSettings.useImportArena = arena;
+					Timer timer;
+					uint64_t allocationsAtStart = AllocationCount();
+					timer.Start();
+					{
+						Mesh mesh(LoadBenchmarkMeshes[m]);
+					}
+					float loadMs = timer.GetTime() * 1000.0f;
+					uint64_t allocations = AllocationCount() - allocationsAtStart;
+					(arena ? results[m].arenaMs : results[m].heapMs) += loadMs / LoadBenchmarkRepeats;
+					(arena ? results[m].arenaAllocations : results[m].heapAllocations) = allocations;
+				}
+			}
+		}
+	}
+	catch (std::runtime_error e)
+	{
+		gMeshLoaderSettings = savedSettings;
+		gLastError = e.what();
+		return false;
+	}
+	gMeshLoaderSettings = savedSettings;
+
+	LoadBenchmarkResult total = {};
+	for (auto& result : results)
+	{
+		total.heapMs           += result.heapMs;
+		total.arenaMs          += result.arenaMs;
+		total.heapAllocations  += result.heapAllocations;
+		total.arenaAllocations += result.arenaAllocations;
+	}
+
+	std::ofstream file(gBenchmark.outputFile);
+	file.precision(4);
+	file << std::fixed;
+
+	if (IsJsonOutput())
+	{
+		file << "{\n";
+		for (int m = 0; m < NumLoadBenchmarkMeshes; ++m)
+		{
+			auto& result = results[m];
+			file << "  \"" << LoadBenchmarkMeshes[m] << "\": { \"heapMs\": " << result.heapMs << ", \"arenaMs\": " << result.arenaMs
+			     << ", \"heapAllocations\": " << result.heapAllocations << ", \"arenaAllocations\": " << result.arenaAllocations << " },\n";
+		}
+		file << "  \"total\": { \"heapMs\": " << total.heapMs << ", \"arenaMs\": " << total.arenaMs << ", \"speedup\": "
+		     << total.heapMs / total.arenaMs << ", \"heapAllocations\": " << total.heapAllocations << ", \"arenaAllocations\": "
+		     << total.arenaAllocations << " }\n";
+		file << "}\n";
+	}
+	else
+	{
+		file << "# repeats," << LoadBenchmarkRepeats << "\n";
+		file << "mesh,heapMs,arenaMs,heapAllocations,arenaAllocations\n";
+		for (int m = 0; m < NumLoadBenchmarkMeshes; ++m)
+		{
+			auto& result = results[m];
+			file << LoadBenchmarkMeshes[m] << ',' << result.heapMs << ',' << result.arenaMs << ','
+			     << result.heapAllocations << ',' << result.arenaAllocations << "\n";
+		}
+		file << "total," << total.heapMs << ',' << total.arenaMs << ',' << total.heapAllocations << ',' << total.arenaAllocations << "\n";
+	}
+
+	if (!file)
+	{
+		gLastError = "Error writing benchmark results file";
+		return false;
+	}
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Render microbenchmark
+//--------------------------------------------------------------------------------------
+
+// Subdivisions of the grids made, the default water grid and two far larger, each made this many times
+static const int GridBenchmarkSizes[] = { 400, 1024, 4096 };
+static const int NumGridBenchmarkSizes = sizeof(GridBenchmarkSizes) / sizeof(GridBenchmarkSizes[0]);
+static const int GridBenchmarkRepeats = 3;
+
+// Times each mesh is rendered, and constants are sent each way
+static const int RenderBenchmarkRepeats = 2000;
+static const int ConstantBenchmarkUpdates = 100000;
+
+// Timing for the renders of one mesh file
+struct RenderBenchmarkResult
+{
+	float        renderUs; // Microseconds per render
+	unsigned int draws;    // Draw calls in one render
+};
+
+
+// Time creating the water grid at several sizes, rendering a model of every mesh file of the app (the CPU side: the state
+// cache, the constants and the draw calls, not waiting for the GPU) and sending per-model constants with and without the
+// constant ring (see StateCache.h). Saves the times to the file chosen in gBenchmark. Call once the scene has been set up
+// Returns false with a message in gLastError if a mesh can't be loaded or the file can't be written
+bool RunRenderBenchmark()
+{
+	// Grids with normals and UVs as the coarse water grid, each created and released in turn
+	float gridMs[NumGridBenchmarkSizes] = {};
+	RenderBenchmarkResult renderResults[NumLoadBenchmarkMeshes] = {};
+	try
+	{
+		for (int size = 0; size < NumGridBenchmarkSizes; ++size)
+		{
+			for (int repeat = 0; repeat < GridBenchmarkRepeats; ++repeat)
+			{
+				Timer timer;
+				timer.Start();
+				{
+					int subDivisions = GridBenchmarkSizes[size];
+					Mesh grid(CVector3(-200, 0, -200), CVector3(200, 0, 200), subDivisions, subDivisions, true, true);
+				}
+				gridMs[size] += timer.GetTime() * 1000.0f / GridBenchmarkRepeats;
+			}
+		}
+
+		// The meshes are drawn with the lit models' vertex shader and no pixel shader or render target, so the GPU has little
+		// to do and the CPU cost of each render is timed. Full detail, as the LODs only change the index count
+		ResetStateCache();
+		SetRenderTargets(0, nullptr, nullptr);
+		SetViewport({ 0, 0, static_cast<float>(gViewportWidth), static_cast<float>(gViewportHeight), 0, 1 });
+		SetVertexShader(gPixelLightingVertexShader);
+		SetHullShader(nullptr);
+		SetDomainShader(nullptr);
+		SetGeometryShader(nullptr);
+		SetPixelShader(nullptr);
+		SetConstants(0, gPerFrameConstantBuffer, gPerFrameConstants);
+		for (int m = 0; m < NumLoadBenchmarkMeshes; ++m)
+		{
+			Mesh  mesh(LoadBenchmarkMeshes[m]);
+			Model model(&mesh);
+			model.UpdateMatrices();
+
+			unsigned int drawsAtStart = GetStateCacheStats().draws;
+			Timer timer;
+			timer.Start();
+			for (int repeat = 0; repeat < RenderBenchmarkRepeats; ++repeat)  model.Render();
+			renderResults[m].renderUs = timer.GetTime() * 1e6f / RenderBenchmarkRepeats;
+			renderResults[m].draws    = (GetStateCacheStats().draws - drawsAtStart) / RenderBenchmarkRepeats;
+			gD3DContext->Flush(); // Before the mesh's buffers are released
+		}
+	}
+	catch (std::runtime_error e)
+	{
+		gLastError = e.what();
+		return false;
+	}
+
+	// Per-model constants sent to the constant ring and to the per-model buffer with a discard, in nanoseconds per update
+	float ringNs = 0;
+	float discardNs = 0;
+	bool ringWasEnabled = ConstantRingEnabled();
+	for (bool ring : { true, false })
+	{
+		if (ring && !ConstantRingSupported())  continue;
+		SetConstantRingEnabled(ring);
+		ResetStateCache();
+		Timer timer;
+		timer.Start();
+		for (int update = 0; update < ConstantBenchmarkUpdates; ++update)
+		{
+			gPerModelConstants.objectColour.x = static_cast<float>(update); // Different constants every time
+			SetConstants(1, gPerModelConstantBuffer, gPerModelConstants);
+		}
+		(ring ? ringNs : discardNs) = timer.GetTime() * 1e9f / ConstantBenchmarkUpdates;
+		gD3DContext->Flush();
+	}
+	SetConstantRingEnabled(ringWasEnabled);
+	float constantMBs[2] = { ringNs > 0 ? sizeof(PerModelConstants) * 1000.0f / ringNs : 0,  // Bytes per ns * 1000 = MB per second
+	                         sizeof(PerModelConstants) * 1000.0f / discardNs };
+
+	std::ofstream file(gBenchmark.outputFile);
+	file.precision(4);
+	file << std::fixed;
+	const char* device = gBenchmark.warpDevice ? "warp" : "hardware";
+
+	if (IsJsonOutput())
+	{
+		file << "{\n";
+		file << "  \"device\": \"" << device << "\",\n";
+		file << "  \"gridMs\": {";
+		for (int size = 0; size < NumGridBenchmarkSizes; ++size)
+		{
+			file << (size == 0 ? " " : ", ") << '"' << GridBenchmarkSizes[size] << "\": " << gridMs[size];
+		}
+		file << " },\n";
+		file << "  \"render\": {\n";
+		for (int m = 0; m < NumLoadBenchmarkMeshes; ++m)
+		{
+			auto& result = renderResults[m];
+			file << "    \"" << LoadBenchmarkMeshes[m] << "\": { \"renderUs\": " << result.renderUs << ", \"draws\": " << result.draws
+			     << (m + 1 < NumLoadBenchmarkMeshes ? " },\n" : " }\n");
+		}
+		file << "  },\n";
+		file << "  \"constants\": { \"ringNs\": " << ringNs << ", \"discardNs\": " << discardNs << ", \"ringMBs\": " << constantMBs[0]
+		     << ", \"discardMBs\": " << constantMBs[1] << " }\n";
+		file << "}\n";
+	}
+	else
+	{
+		file << "# device," << device << "\n";
+		file << "test,case,time,unit,draws\n";
+		for (int size = 0; size < NumGridBenchmarkSizes; ++size)  file << "grid," << GridBenchmarkSizes[size] << ',' << gridMs[size] << ",ms,0\n";
+		for (int m = 0; m < NumLoadBenchmarkMeshes; ++m)
+		{
+			file << "render," << LoadBenchmarkMeshes[m] << ',' << renderResults[m].renderUs << ",us," << renderResults[m].draws << "\n";
+		}
+		file << "constants,ring," << ringNs << ",ns,0\n";
+		file << "constants,discard," << discardNs << ",ns,0\n";
+	}
+
+	if (!file)
+	{
+		gLastError = "Error writing benchmark results file";
+		return false;
+	}
+	return true;
+}
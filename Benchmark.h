@@ -0,0 +1,175 @@
+//--------------------------------------------------------------------------------------
+// Benchmark mode - plays back a camera path at a fixed time step and saves the frame timings
+//--------------------------------------------------------------------------------------
+// Start the app with -benchmark on the command line to use this mode. Without any key input the scene follows a
+// path of key positions for the camera, the troll and the water height, and the app quits after a given number
+// of frames, writing the frame times (percentiles), GPU pass times and pipeline statistics (see GpuProfiler.h) and DirectX
+// call counts to a CSV or JSON file. Frames are always updated by the same time step, so every run renders exactly the same
+// images and runs can be compared directly.
+//
+// Command line options:
+//   -benchmark          Turn on benchmark mode
+//   -frames N           Number of frames to measure (default 2000)
+//   -warmup N           Number of frames to render before measuring starts (default 60)
+//   -timestep S         Seconds the scene moves on each frame (default 1/60), in updates of UpdateTimeStep (see Scene.h)
+//   -path file.txt      Path to play back, e.g. one recorded with the B key (default is a built-in path)
+//   -output file.csv    File for the results, written as JSON if the name ends in .json (default benchmark.csv)
+//   -capture N          Capture measured frame N (from 0) with RenderDoc, when started from RenderDoc (see GpuEvents.h)
+//   -framecapture N     Save every Nth measured frame as an image, to compare the pictures of two builds (see FrameCapture.h)
+//   -capturefolder dir  Folder for the images (default captures)
+//   -comparecaptures A B  Compare the images saved in folders A and B instead of running the scene, no window is opened.
+//                       Saves how much each pair differs to the -output file (see CompareFrameCaptures)
+//   -mathbenchmark      Time the matrix functions instead of the scene (see RunMathBenchmark), no window is opened
+//   -loadbenchmark      Time importing the mesh files instead of the scene (see RunLoadBenchmark)
+//   -renderbenchmark    Time making grids, drawing meshes and updating constants instead of the scene (see RunRenderBenchmark)
+//   -warp               Use WARP, the software rasteriser, instead of the GPU, e.g. to time the render benchmark without a driver
+//   -stress N           Add N copies of the teapot, sphere and cube to the scene (see StressScene.h)
+//   -stressabove F      Fraction of them above the water (default 0.4)
+//   -stressunder F      Fraction of them under the water (default 0.3), the rest cross the surface
+//   -stresslights K     Add K small point lights among them
+//   -stressseed N       Seed for the layout, each seed gives a different scene (default 1)
+//   -spikethreshold F   Save a trace of frames taking F times the median frame time, 0 for none (default 2, see SpikeDetector.h)
+//   -spikemin MS        Frames shorter than this many milliseconds are never saved as spikes (default 20)
+//   -portals file.x     Cull by the cells and portals in the nodes of the given mesh file (see PortalMap.h)
+//   -chunksize N        Divide the level into chunks N across, streamed in around the camera (see WorldStreamer.h)
+//   -streamradius N     Stream in the chunks within N of the camera (default 500)
+//   -streambudget MB    Most memory the meshes of the chunks streamed in can use (default 64)
+// The results also list the GPU memory in use at the end of the run, with every registered buffer and texture (see GpuMemory.h),
+// and the cost of each shader from its bytecode (see ShaderCosts in Shader.h).
+// The render settings can be given as well (see Settings.h), e.g. -quality low, to measure each preset. The stress scene
+// options can be used without -benchmark, to look around the scene being measured. The results list the stress scene options
+// The spike, portal and streaming options work with or without -benchmark
+//
+// Path files have one key per line: time, camera position (x y z), camera rotation in degrees (x y z), troll
+// position (x y z), troll y rotation in degrees, water height. Lines starting with # are ignored.
+
+#include "CVector3.h"
+#include <string>
+#include <vector>
+
+#ifndef _BENCHMARK_H_INCLUDED_
+#define _BENCHMARK_H_INCLUDED_
+
+
+//--------------------------------------------------------------------------------------
+// Settings
+//--------------------------------------------------------------------------------------
+
+struct BenchmarkSettings
+{
+	bool         enabled      = false;
+	int          numFrames    = 2000;
+	int          warmupFrames = 60;
+	float        timeStep     = 1.0f / 60.0f;
+	std::wstring pathFile;  // Empty for the built-in path
+	std::wstring outputFile = L"benchmark.csv";
+	int          captureFrame = -1; // Measured frame to capture with RenderDoc, -1 for none
+	int          frameCaptureInterval = 0; // Save every this many measured frames as images, 0 for none (see FrameCapture.h)
+	std::wstring frameCaptureFolder = L"captures";
+	bool         compareCaptures = false;
+	std::wstring compareFolders[2]; // Folders of the images of two runs to compare
+	bool         mathBenchmark = false;
+	bool         loadBenchmark = false;
+	bool         renderBenchmark = false;
+	bool         warpDevice = false; // Create the device on WARP (see InitDirect3D)
+};
+
+extern BenchmarkSettings gBenchmark;
+
+// Read the benchmark settings from the app's command line into gBenchmark
+// Returns false with a message in gLastError if the command line is not valid
+bool ParseBenchmarkCommandLine();
+
+
+//--------------------------------------------------------------------------------------
+// Scene path
+//--------------------------------------------------------------------------------------
+
+// State of the scene at a given time on the path
+struct BenchmarkKey
+{
+	float    time;
+	CVector3 cameraPosition;
+	CVector3 cameraRotation; // Radians
+	CVector3 trollPosition;
+	float    trollRotation;  // Radians, around y axis
+	float    waterHeight;
+};
+
+// Load the path chosen in gBenchmark. Call after ParseBenchmarkCommandLine
+// Returns false with a message in gLastError on failure
+bool LoadBenchmarkPath();
+
+// Get the scene state at the given time along the path, interpolating between keys. The path loops if the time
+// is longer than the path
+BenchmarkKey BenchmarkPathKey(float time);
+
+
+// Record a path to play back later. Add a key at regular intervals between start and stop. Stopping saves the path
+// Returns false with a message in gLastError if the file can't be written
+void StartPathRecording();
+void RecordPathKey(const BenchmarkKey& key);
+bool StopPathRecording(const std::wstring& fileName);
+bool IsRecordingPath();
+
+
+//--------------------------------------------------------------------------------------
+// Results
+//--------------------------------------------------------------------------------------
+
+// Add the timings for a frame, call after rendering it. Frame time is in seconds, measured on the CPU from one frame to
+// the next. The GPU pass times are the latest ones from gGpuProfiler (see GpuProfiler.h), which are a few frames behind
+// The DirectX call counts are the frame's state cache stats (see StateCache.h), so call on the thread that rendered it
+// Returns true when all the frames needed have been added (warmup frames are not kept)
+bool AddBenchmarkFrame(float frameTime);
+
+// Whether the frame about to be rendered is the one chosen to be captured with RenderDoc (see BenchmarkSettings::captureFrame)
+bool IsBenchmarkCaptureFrame();
+
+// The number of the measured frame about to be rendered, from 0, or negative during the warmup. -1 when not benchmarking
+int BenchmarkFrameNumber();
+
+// Whether the results file chosen in gBenchmark should be JSON rather than CSV, from its extension
+bool IsJsonOutput();
+
+// Save the benchmark results to the file chosen in gBenchmark, as CSV or JSON depending on the file extension
+// Waits for the frame captures to be written first, if there are any (see FrameCapture.h)
+// Returns false with a message in gLastError if the file can't be written or a frame capture was missed
+bool WriteBenchmarkResults();
+
+
+//--------------------------------------------------------------------------------------
+// Maths microbenchmark
+//--------------------------------------------------------------------------------------
+
+// Time the SIMD matrix multiply, vector transform and InverseAffine against the plain C++ versions (see CMatrix4x4.h), and
+// the batch point transform and sphere tests against one point or sphere at a time (see BatchMath.h), and save the time per call, the speedup and the largest difference in the results to the file chosen in gBenchmark
+// Returns false with a message in gLastError if the file can't be written
+bool RunMathBenchmark();
+
+
+//--------------------------------------------------------------------------------------
+// Mesh load benchmark
+//--------------------------------------------------------------------------------------
+
+// Import every mesh file of the app with assimp (ignoring the cooked mesh files) several times, with the import temporaries
+// taken from the import arena and from the heap (see useImportArena in MeshLoaderSettings). Saves the time and number of heap
+// allocations of each import both ways to the file chosen in gBenchmark. Call once Direct3D is set up, before the scene
+// Returns false with a message in gLastError if a mesh can't be loaded or the file can't be written
+bool RunLoadBenchmark();
+
+
+//--------------------------------------------------------------------------------------
+// Render microbenchmark
+//--------------------------------------------------------------------------------------
+
+// Time creating the water grid at several sizes, rendering a model of every mesh file of the app (the CPU side: the state
+// cache, the constants and the draw calls, not waiting for the GPU) and sending per-model constants with and without the
+// constant ring (see StateCache.h). Saves the times to the file chosen in gBenchmark. Call once the scene has been set up, it
+// uses the scene's shaders and constant buffers. With -warp the DirectX calls go to the software rasteriser, so the times
+// don't depend on the GPU's driver
+// Returns false with a message in gLastError if a mesh can't be loaded or the file can't be written
+bool RunRenderBenchmark();
+
+
+#endif //_BENCHMARK_H_INCLUDED_
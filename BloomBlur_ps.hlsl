@@ -0,0 +1,43 @@
+//--------------------------------------------------------------------------------------
+// Bloom blur Pixel Shader
+//--------------------------------------------------------------------------------------
+// Gaussian blur of the bloom texture along one axis, run across then down (a 2D Gaussian blur separates into two 1D blurs,
+// which needs far fewer samples). Each sample is taken between two texels so bilinear filtering reads both of them at once
+
+#include "PostProcess.hlsli"
+
+
+//--------------------------------------------------------------------------------------
+// Textures (texture maps)
+//--------------------------------------------------------------------------------------
+
+Texture2D    BloomMap : register(t0);
+SamplerState LinearFilter : register(s0);
+
+
+//--------------------------------------------------------------------------------------
+// Blur settings
+//--------------------------------------------------------------------------------------
+
+// A 17 texel wide Gaussian (binomial weights) in 9 samples: the centre texel, then each pair of texels either side merged into
+// one sample at the position between them weighted by their two weights
+static const int   BlurSamples = 5;
+static const float BlurOffsets[BlurSamples] = { 0.0f, 1.4118f, 3.2941f, 5.1765f, 7.0588f };
+static const float BlurWeights[BlurSamples] = { 0.1964f, 0.2968f, 0.0944f, 0.0104f, 0.0003f };
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+float4 main(PostProcessPixelShaderInput input) : SV_Target
+{
+	float3 colour = BloomMap.SampleLevel(LinearFilter, input.uv, 0).rgb * BlurWeights[0];
+	[unroll] for (int i = 1; i < BlurSamples; ++i)
+	{
+		float2 offset = gBlurStep * BlurOffsets[i];
+		colour += BloomMap.SampleLevel(LinearFilter, input.uv + offset, 0).rgb * BlurWeights[i];
+		colour += BloomMap.SampleLevel(LinearFilter, input.uv - offset, 0).rgb * BlurWeights[i];
+	}
+	return float4(colour, 1);
+}
@@ -0,0 +1,31 @@
+//--------------------------------------------------------------------------------------
+// Bloom bright pass Pixel Shader
+//--------------------------------------------------------------------------------------
+// Keeps the parts of the HDR scene that will be brighter than white on screen, at the current exposure. Rendered into a
+// half size texture, which is then blurred (see BloomBlur_ps) and added back to the scene by the tonemap so they glow
+
+#include "PostProcess.hlsli"
+
+
+//--------------------------------------------------------------------------------------
+// Textures (texture maps)
+//--------------------------------------------------------------------------------------
+
+Texture2D    SceneMap         : register(t0);
+Texture2D    AdaptedLuminance : register(t1); // Single texel, see AdaptExposure_cs
+SamplerState LinearFilter : register(s0);
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+float4 main(PostProcessPixelShaderInput input) : SV_Target
+{
+	// Each texel is half the size of the scene, a bilinear sample at its centre averages the four scene pixels under it
+	float3 sceneColour = SceneMap.SampleLevel(LinearFilter, SceneUV(input.uv, SceneMap), 0).rgb * Exposure(AdaptedLuminance.Load(int3(0, 0, 0)).r);
+	
+	// Remove the part of the colour up to the threshold, scaling the colour rather than clamping each channel so it keeps its hue
+	float luminance = Luminance(sceneColour);
+	return float4(sceneColour * max(luminance - gBloomThreshold, 0) / max(luminance, 0.0001f), 1);
+}
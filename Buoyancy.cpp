@@ -0,0 +1,172 @@
+//--------------------------------------------------------------------------------------
+// Buoyancy of floating objects on the waves
+//--------------------------------------------------------------------------------------
+
+#include "Buoyancy.h"
+#include "JobSystem.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+// Add a body for a model with the given world matrix (uniform scale only), as the given box in model space. The density is
+// compared to the water's, so 0.3 floats with 0.3 of its height under water. Returns the body's index
+int Buoyancy::Add(const CMatrix4x4& worldMatrix, const CVector3& boxMin, const CVector3& boxMax, float density /*= 0.3f*/)
+{
+	Body body;
+	body.scale = Length(worldMatrix.GetRow(0));
+	for (int i = 0; i < 3; ++i)  body.axes[i] = Normalise(worldMatrix.GetRow(i));
+
+	CVector3 boxCentre = (boxMin + boxMax) * (0.5f * body.scale);
+	body.halfSize    = (boxMax - boxMin) * (0.5f * body.scale);
+	body.modelOffset = boxCentre * -1.0f;
+	body.position    = worldMatrix.GetRow(3) + body.axes[0] * boxCentre.x + body.axes[1] * boxCentre.y + body.axes[2] * boxCentre.z;
+	body.velocity        = { 0, 0, 0 };
+	body.angularVelocity = { 0, 0, 0 };
+
+	// A solid box, the water weighing 1 for each cubic world unit
+	const CVector3& h = body.halfSize;
+	body.mass = density * 8 * h.x * h.y * h.z;
+	body.inverseInertia = { 3 / (body.mass * (h.y * h.y + h.z * h.z)),
+	                        3 / (body.mass * (h.x * h.x + h.z * h.z)),
+	                        3 / (body.mass * (h.x * h.x + h.y * h.y)) };
+
+	// It rests where it was placed, so starts asleep until the water lifts it
+	body.floorY = body.position.y - (std::abs(body.axes[0].y) * h.x + std::abs(body.axes[1].y) * h.y + std::abs(body.axes[2].y) * h.z);
+	body.stillSteps = SleepSteps;
+
+	mBodies.push_back(body);
+	return static_cast<int>(mBodies.size()) - 1;
+}
+
+
+// Move the bodies on by one step of the given length in seconds, on the open water at the given height with the given
+// waves, and write each body's world matrix for its model. The matrices must hold one for each body
+void Buoyancy::Step(float stepTime, const WaterHeights::Waves& waves, float waterHeight, CMatrix4x4* worldMatrices)
+{
+	int numBodies  = NumBodies();
+	int numBatches = (numBodies + BodiesPerBatch - 1) / BodiesPerBatch;
+	gJobSystem->ParallelFor(numBatches, 1, [&](int batch)
+	{
+		int first = batch * BodiesPerBatch;
+		int last  = (std::min)(first + BodiesPerBatch, numBodies);
+
+		// The water under every column of the batch in one query
+		float x[BodiesPerBatch * NumColumns], z[BodiesPerBatch * NumColumns], heights[BodiesPerBatch * NumColumns];
+		int numPoints = 0;
+		for (int i = first; i < last; ++i)
+		{
+			const Body& body = mBodies[i];
+			for (int column = 0; column < NumColumns; ++column)
+			{
+				CVector3 base = ColumnBase(body, column);
+				CVector3 world = body.position + body.axes[0] * base.x + body.axes[1] * base.y + body.axes[2] * base.z;
+				x[numPoints] = world.x;
+				z[numPoints] = world.z;
+				++numPoints;
+			}
+		}
+		gWaterHeights->Heights(waves, x, z, heights, numPoints);
+
+		for (int i = first; i < last; ++i)
+		{
+			StepBody(mBodies[i], stepTime, waterHeight, heights + (i - first) * NumColumns);
+			worldMatrices[i] = WorldMatrix(mBodies[i]);
+		}
+	});
+}
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions
+//--------------------------------------------------------------------------------------
+
+// Step one body given the water heights under the middle of its columns
+void Buoyancy::StepBody(Body& body, float stepTime, float waterHeight, const float* columnWaveHeights)
+{
+	// Each column is pushed up by the weight of the water it is holding out of the way, at the middle of its part under water.
+	// The columns only go up the box's own y axis, near enough while it floats fairly level
+	const float columnHeight = 2 * body.halfSize.y;
+	const float columnArea   = (2 * body.halfSize.x / ColumnsAcross) * (2 * body.halfSize.z / ColumnsAlong);
+	CVector3 force  = { 0, -body.mass * Gravity, 0 };
+	CVector3 torque = { 0, 0, 0 };
+	float submerged = 0; // Part of the body under water
+	for (int column = 0; column < NumColumns; ++column)
+	{
+		CVector3 base = ColumnBase(body, column);
+		CVector3 offset = body.axes[0] * base.x + body.axes[1] * base.y + body.axes[2] * base.z;
+		float depth = (std::min)(waterHeight + columnWaveHeights[column] - (body.position.y + offset.y), columnHeight);
+		if (depth <= 0)  continue;
+
+		CVector3 lift = { 0, columnArea * depth * Gravity, 0 };
+		force  += lift;
+		torque += Cross(offset + body.axes[1] * (depth / 2), lift);
+		submerged += depth / (columnHeight * NumColumns);
+	}
+
+	// A sleeping body stays where it is until the water would lift it
+	if (body.stillSteps >= SleepSteps && force.y <= 0)  return;
+
+	// Forces with the water drag, then move and turn. The spin is found about the box's own axes, where its inertia is known
+	body.velocity += force * (stepTime / body.mass);
+	CVector3 spin = { Dot(torque, body.axes[0]) * body.inverseInertia.x,
+	                  Dot(torque, body.axes[1]) * body.inverseInertia.y,
+	                  Dot(torque, body.axes[2]) * body.inverseInertia.z };
+	body.angularVelocity += (body.axes[0] * spin.x + body.axes[1] * spin.y + body.axes[2] * spin.z) * stepTime;
+	body.velocity        *= (std::max)(0.0f, 1 - LinearDrag  * submerged * stepTime);
+	body.angularVelocity *= (std::max)(0.0f, 1 - AngularDrag * submerged * stepTime);
+
+	body.position += body.velocity * stepTime;
+	for (auto& axis : body.axes)  axis += Cross(body.angularVelocity, axis) * stepTime;
+
+	// Keep the axes at right angles and unit length, as BlendWorldMatrices does
+	body.axes[2] = Normalise(body.axes[2]);
+	body.axes[0] = Normalise(Cross(body.axes[1], body.axes[2]));
+	body.axes[1] = Cross(body.axes[2], body.axes[0]);
+
+	// Stop at the floor, with friction
+	const CVector3& h = body.halfSize;
+	float lowest = body.position.y - (std::abs(body.axes[0].y) * h.x + std::abs(body.axes[1].y) * h.y + std::abs(body.axes[2].y) * h.z);
+	bool touching = lowest < body.floorY;
+	if (touching)
+	{
+		body.position.y += body.floorY - lowest;
+		body.velocity.y = (std::max)(body.velocity.y, 0.0f);
+		body.velocity.x *= Friction;
+		body.velocity.z *= Friction;
+		body.angularVelocity *= Friction;
+	}
+
+	// And sleep once still there
+	if (touching && Length(body.velocity) < SleepSpeed && Length(body.angularVelocity) < SleepSpin)
+	{
+		if (++body.stillSteps >= SleepSteps)
+		{
+			body.velocity        = { 0, 0, 0 };
+			body.angularVelocity = { 0, 0, 0 };
+		}
+	}
+	else
+	{
+		body.stillSteps = 0;
+	}
+}
+
+
+// The world matrix for the model of a body
+CMatrix4x4 Buoyancy::WorldMatrix(const Body& body)
+{
+	const CVector3& offset = body.modelOffset;
+	CMatrix4x4 matrix = MatrixTranslation(body.position + body.axes[0] * offset.x + body.axes[1] * offset.y + body.axes[2] * offset.z);
+	for (int i = 0; i < 3; ++i)  matrix.SetRow(i, body.axes[i] * body.scale);
+	return matrix;
+}
+
+
+// Where the middle of the base of each of a body's columns is, in the box's space
+CVector3 Buoyancy::ColumnBase(const Body& body, int column)
+{
+	float across = (column % ColumnsAcross + 0.5f) / ColumnsAcross * 2 - 1; // -1 to 1
+	float along  = (column / ColumnsAcross + 0.5f) / ColumnsAlong  * 2 - 1;
+	return { across * body.halfSize.x, -body.halfSize.y, along * body.halfSize.z };
+}
@@ -0,0 +1,104 @@
+//--------------------------------------------------------------------------------------
+// Buoyancy of floating objects on the waves
+//--------------------------------------------------------------------------------------
+// A light rigid body simulation for props floating on the water. Each body is a box, and the
+// water under it is found at a few points on its base with the batched wave height query (see
+// WaterHeights.h). Each point stands for a column of the box: the part of the column under the
+// water pushes up on it, which lifts the box and tilts it with the waves. Water drag slows the
+// parts under water, and the box can't sink below where it was placed, e.g. on the sea bed.
+//
+// Steps are at the scene's fixed update rate on the simulation thread (see SimulateStep in
+// Scene.cpp), with the bodies split across the job system in batches. Each batch queries the
+// heights of all its points at once. Bodies resting out of the water go to sleep and keep the
+// same matrix, so the models showing them aren't updated (see Model::SetDirty).
+
+#include "WaterHeights.h"
+#include "CVector3.h"
+#include "CMatrix4x4.h"
+#include <vector>
+
+#ifndef _BUOYANCY_H_INCLUDED_
+#define _BUOYANCY_H_INCLUDED_
+
+class Buoyancy
+{
+//--------------------------------------------------------------------------------------
+// Construction / Usage
+//--------------------------------------------------------------------------------------
+public:
+
+	// Remove all the bodies
+	void Clear()  { mBodies.clear(); }
+
+	// Add a body for a model with the given world matrix (uniform scale only), as the given box in model space. The density is
+	// compared to the water's, so 0.3 floats with 0.3 of its height under water. Returns the body's index
+	int Add(const CMatrix4x4& worldMatrix, const CVector3& boxMin, const CVector3& boxMax, float density = 0.3f);
+
+	int NumBodies()  { return static_cast<int>(mBodies.size()); }
+
+
+	// Move the bodies on by one step of the given length in seconds, on the open water at the given height with the given
+	// waves, and write each body's world matrix for its model. The matrices must hold one for each body
+	void Step(float stepTime, const WaterHeights::Waves& waves, float waterHeight, CMatrix4x4* worldMatrices);
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions / data
+//--------------------------------------------------------------------------------------
+private:
+
+	// Columns each box is split into for buoyancy, across and along it, with the water found under the middle of each
+	static constexpr int ColumnsAcross = 2;
+	static constexpr int ColumnsAlong  = 2;
+	static constexpr int NumColumns    = ColumnsAcross * ColumnsAlong;
+
+	// Bodies stepped by each job, enough to be worth a job and for several batches of four water height queries
+	static constexpr int BodiesPerBatch = 64;
+
+	// World units per second squared. The crate is 12 times the size of its model, so this is a little over 12 times
+	// Earth's gravity to make it bob at about the rate a real container would
+	static constexpr float Gravity = 120.0f;
+
+	// Drag of the water, as the part of a body's speed and spin lost each second when it is all under water
+	static constexpr float LinearDrag  = 5.0f;
+	static constexpr float AngularDrag = 6.0f;
+
+	// Part of the speed across the ground and spin kept each step a body touches its floor
+	static constexpr float Friction = 0.9f;
+
+	// A body touching its floor goes to sleep once its speed (world units per second) and spin (radians per second) stay
+	// under these for this many steps
+	static constexpr float SleepSpeed = 0.5f;
+	static constexpr float SleepSpin  = 0.05f;
+	static constexpr int   SleepSteps = 60;
+
+	struct Body
+	{
+		CVector3 position;        // Of the middle of the box
+		CVector3 axes[3];         // The box's x, y and z axes in world space, at right angles and unit length
+		CVector3 velocity;
+		CVector3 angularVelocity; // World space axis scaled by radians per second
+
+		CVector3 halfSize;        // Of the box in world units
+		CVector3 modelOffset;     // From the middle of the box to the model's origin, in the model's space scaled to world units
+		float    scale;           // Of the model
+
+		float    mass;
+		CVector3 inverseInertia;  // About the box's own axes
+		float    floorY;          // Lowest the base of the box can go
+		int      stillSteps;      // Steps the body has been touching its floor and nearly still, it sleeps after SleepSteps
+	};
+	std::vector<Body> mBodies;
+
+	// Step one body given the water heights under the middle of its columns. Water away from the open water isn't handled
+	void StepBody(Body& body, float stepTime, float waterHeight, const float* columnWaveHeights);
+
+	// The world matrix for the model of a body
+	CMatrix4x4 WorldMatrix(const Body& body);
+
+	// Where the middle of the base of each of a body's columns is, in the box's space
+	static CVector3 ColumnBase(const Body& body, int column);
+};
+
+
+#endif //_BUOYANCY_H_INCLUDED_
@@ -65,12 +65,17 @@ void Camera::UpdateMatrices()
     // View matrix is the usual matrix used for the camera in shaders, it is the inverse of the world matrix (see lectures)
     mViewMatrix = InverseAffine(mWorldMatrix);
 
-    // Projection matrix, how to flatten the 3D world onto the screen (needs field of view, near and far clip, aspect ratio)
+    // Projection matrix, how to flatten the 3D world onto the screen (needs field of view, near clip, aspect ratio)
+    // The depth is reversed and there is no far plane: the depth is near clip / distance, 1 at the near clip going down to 0 at
+    // infinity. Floats hold most precision near 0, which the reversal puts at the far distances where the 1/distance curve
+    // leaves least, so the precision is nearly even over the whole view and the near clip can be small. The depth states
+    // compare with GREATER and depth buffers are cleared to 0 to match (see State.cpp and ClearDepth). Shaders converting
+    // depths back to distances with the projection matrix work as before
     float tanFOVx = std::tan(mFOVx * 0.5f);
     float scaleX = 1.0f / tanFOVx;
     float scaleY = mAspectRatio / tanFOVx;
-    float scaleZa = mFarClip / (mFarClip - mNearClip);
-    float scaleZb = -mNearClip * scaleZa;
+    float scaleZa = 0.0f;
+    float scaleZb = mNearClip;
 
     mProjectionMatrix = { scaleX,   0.0f,    0.0f,   0.0f,
                             0.0f, scaleY,    0.0f,   0.0f,
@@ -116,6 +121,24 @@ CVector3 Camera::PixelFromWorldPt(CVector3 worldPoint, unsigned int viewportWidt
 	return { x, y, cameraPt.z };
 }
 
+// Return pixel coordinates corresponding to each of an array of world points, as PixelFromWorldPt
+void Camera::PixelsFromWorldPts(const PointArray& worldPoints, unsigned int viewportWidth, unsigned int viewportHeight,
+                                PointArray& pixelPoints)
+{
+	UpdateMatrices();
+
+	// Fold the conversion to pixels into the view-projection matrix, so the projection gives pixels straight away. The
+	// projected w is the camera space z: x pixel = (x / w + 1) * width / 2 = (x + w) * (width / 2) / w, and the same for y
+	// flipped. The z column isn't needed
+	float halfWidth  = viewportWidth  * 0.5f;
+	float halfHeight = viewportHeight * 0.5f;
+	CMatrix4x4 viewportMatrix = { halfWidth,        0.0f, 0.0f, 0.0f,
+	                                   0.0f, -halfHeight, 0.0f, 0.0f,
+	                                   0.0f,        0.0f, 0.0f, 0.0f,
+	                              halfWidth,  halfHeight, 0.0f, 1.0f };
+	ProjectPoints(worldPoints, mViewProjectionMatrix * viewportMatrix, pixelPoints);
+}
+
 
 // Return the size of a pixel in world space at the given Z distance. Allows us to convert the 2D size of areas on the screen to actualy sizes in the world
 // Pass the viewport width and height
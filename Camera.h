@@ -6,6 +6,8 @@
 #include "CVector2.h"
 #include "CVector3.h"
 #include "CMatrix4x4.h"
+#include "Frustum.h"
+#include "BatchMath.h"
 #include "MathHelpers.h"
 #include "Input.h"
 
@@ -53,16 +55,22 @@ public:
 	float FOV()       { return mFOVx;     }
 	float NearClip()  { return mNearClip; }
 	float FarClip()   { return mFarClip;  }
+	float AspectRatio()  { return mAspectRatio; }
 
 	void SetFOV     (float fov     )  { mFOVx     = fov;      }
 	void SetNearClip(float nearClip)  { mNearClip = nearClip; }
 	void SetFarClip (float farClip )  { mFarClip  = farClip;  }
+	void SetAspectRatio(float aspectRatio)  { mAspectRatio = aspectRatio; } // Viewport width / height
 
 	// Read only access to camera matrices, updated on request from position, rotation and camera settings
 	CMatrix4x4 ViewMatrix()            { UpdateMatrices(); return mViewMatrix;           }
 	CMatrix4x4 ProjectionMatrix()      { UpdateMatrices(); return mProjectionMatrix;     }
 	CMatrix4x4 ViewProjectionMatrix()  { UpdateMatrices(); return mViewProjectionMatrix; }
 
+	// The planes around the volume this camera can see, used to cull models that are off-screen. Follows the camera matrix,
+	// so a reflected camera gets a reflected frustum
+	Frustum ViewFrustum()  { UpdateMatrices(); return FrustumFromMatrix(mViewProjectionMatrix); }
+
 
 	//-------------------------------------
 	// Camera Picking
@@ -75,6 +83,11 @@ public:
 	// is less than the camera near clip (use NearClip() member function), then the world
 	// point is behind the camera and the 2D x and y coordinates are to be ignored.
 	CVector3 PixelFromWorldPt(CVector3 worldPoint, unsigned int viewportWidth, unsigned int viewportHeight);
+
+	// The same for a whole array of points, e.g. the labels of many models. The matrices are updated once for all of them
+	// and the points projected four at a time (see BatchMath.h). pixelPoints is resized to match, and may be worldPoints
+	void PixelsFromWorldPts(const PointArray& worldPoints, unsigned int viewportWidth, unsigned int viewportHeight,
+	                        PointArray& pixelPoints);
 	
 	// Return the size of a pixel in world space at the given Z distance. Allows us to convert the 2D size of areas on the screen to actualy sizes in the world
 	// Pass the viewport width and height
@@ -88,7 +101,8 @@ private:
 	// Update the matrices used for the camera in the rendering pipeline
 	void UpdateMatrices();
 
-	// Camera settings: field of view, aspect ratio, near and far clip plane distances.
+	// Camera settings: field of view, aspect ratio, near and far clip plane distances. The projection has no far plane (see
+	// UpdateMatrices), the far clip only limits effects that need a distance, e.g. the shadow cascades
 	// Note that the FOVx angle is measured in radians (radians = degrees * PI/180) from left to right of screen
 	float mFOVx;
     float mAspectRatio;
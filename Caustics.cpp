@@ -0,0 +1,111 @@
+//--------------------------------------------------------------------------------------
+// Underwater caustics from the water waves
+//--------------------------------------------------------------------------------------
+
+#include "Caustics.h"
+#include "Shader.h"
+#include "State.h"
+#include "Common.h"
+#include "GraphicsHelpers.h"
+#include "GpuEvents.h"
+#include "GpuMemory.h"
+
+#include <stdexcept>
+
+
+// Create the caustics texture, of the given size in texels across one tile of the waves (a multiple of 16)
+// Will throw a std::runtime_error exception on failure (same as Mesh)
+Caustics::Caustics(unsigned int resolution /*= 512*/)
+	: mResolution(resolution)
+{
+	if (resolution == 0 || resolution % 16 != 0)  throw std::runtime_error("Caustics size must be a multiple of 16");
+
+	mConstantBuffer = CreateConstantBuffer(sizeof(CausticsConstants));
+	if (mConstantBuffer == nullptr)  throw std::runtime_error("Error creating caustics constant buffer");
+
+	// One channel of intensity as a half float, with a full set of mip-maps. The compute shader writes the top level (the
+	// default UAV is mip 0) and GenerateMips does the rest, which requires the render target bind flag
+	D3D11_TEXTURE2D_DESC textureDesc = {};
+	textureDesc.Width  = resolution;
+	textureDesc.Height = resolution;
+	textureDesc.MipLevels = 0;
+	textureDesc.ArraySize = 1;
+	textureDesc.Format = DXGI_FORMAT_R16_FLOAT;
+	textureDesc.SampleDesc.Count = 1;
+	textureDesc.Usage = D3D11_USAGE_DEFAULT;
+	textureDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS | D3D11_BIND_RENDER_TARGET;
+	textureDesc.MiscFlags = D3D11_RESOURCE_MISC_GENERATE_MIPS;
+	if (FAILED(gD3DDevice->CreateTexture2D(&textureDesc, nullptr, &mTexture)) ||
+		FAILED(gD3DDevice->CreateShaderResourceView(mTexture, nullptr, &mSRV)) ||
+		FAILED(gD3DDevice->CreateUnorderedAccessView(mTexture, nullptr, &mUAV)))
+	{
+		Release();
+		throw std::runtime_error("Error creating caustics texture");
+	}
+	SetDebugNames("Caustics", mTexture, mSRV);
+	RegisterGpuResource(mTexture, "Caustics");
+}
+
+Caustics::~Caustics()
+{
+	Release();
+}
+
+
+// Generate the caustics for a light shining in the given direction through the current waves. The waves are the FFT ocean
+// when oceanPatchSize isn't 0, otherwise the layers of the scrolling wave normal map. Leaves the compute shader stage with
+// nothing bound. The caustics texture must not be bound to other shader stages when this is called
+void Caustics::Generate(const CVector3& lightDirection, ID3D11ShaderResourceView* waveNormals, float oceanPatchSize,
+                        float waveScale, const CVector2& waterMovement)
+{
+	// The wave map layers all repeat across two wave map widths, the largest layer's size is 0.5 (see WaterConstants)
+	mPatchSize = oceanPatchSize > 0 ? oceanPatchSize : 2 * WaveMapWidth;
+
+	mConstants.lightDirection = Normalise(lightDirection);
+	mConstants.patchSize      = mPatchSize;
+	mConstants.waterMovement  = waterMovement;
+	mConstants.waveScale      = waveScale;
+	mConstants.oceanEnabled   = oceanPatchSize > 0 ? 1.0f : 0.0f;
+	for (int i = 0; i < 4; ++i)
+	{
+		mConstants.waterSizes[i]  = gWaterConstants.waterSizes[i];
+		mConstants.waterSpeeds[i] = gWaterConstants.waterSpeeds[i];
+	}
+	mConstants.focusDepth = FocusDepth;
+	mConstants.resolution = mResolution;
+	UpdateConstantBuffer(mConstantBuffer, mConstants);
+
+	ID3D11ShaderResourceView*  nullSRV = nullptr;
+	ID3D11UnorderedAccessView* nullUAV = nullptr;
+
+	gD3DContext->CSSetShader(gCausticsComputeShader, nullptr, 0);
+	gD3DContext->CSSetConstantBuffers(0, 1, &mConstantBuffer);
+	gD3DContext->CSSetShaderResources(0, 1, &waveNormals);
+	gD3DContext->CSSetSamplers(0, 1, &gTrilinearSampler); // The waves repeat, so must the sampler
+	gD3DContext->CSSetUnorderedAccessViews(0, 1, &mUAV, nullptr);
+	unsigned int numGroups = mResolution / 16; // Must match CausticsThreadGroupSize in Caustics_cs.hlsl
+	gD3DContext->Dispatch(numGroups, numGroups, 1);
+
+	// Unbind everything so the result can be used by the pixel shaders, then fill in the mip-maps for them
+	gD3DContext->CSSetShaderResources(0, 1, &nullSRV);
+	gD3DContext->CSSetUnorderedAccessViews(0, 1, &nullUAV, nullptr);
+	gD3DContext->CSSetShader(nullptr, nullptr, 0);
+	gD3DContext->GenerateMips(mSRV);
+}
+
+
+// Set the constants the shaders need to project the caustics. A strength of 0 switches them off
+void Caustics::SetShaderConstants(PerFrameConstants& constants, float strength /*= 1*/)
+{
+	constants.causticsScale    = 1 / mPatchSize;
+	constants.causticsStrength = strength;
+}
+
+
+void Caustics::Release()
+{
+	if (mUAV)             { mUAV->Release();             mUAV             = nullptr; }
+	if (mSRV)             { mSRV->Release();             mSRV             = nullptr; }
+	if (mTexture)         { mTexture->Release();         mTexture         = nullptr; }
+	if (mConstantBuffer)  { mConstantBuffer->Release();  mConstantBuffer  = nullptr; }
+}
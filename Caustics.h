@@ -0,0 +1,93 @@
+//--------------------------------------------------------------------------------------
+// Underwater caustics from the water waves
+//--------------------------------------------------------------------------------------
+// Waves focus the key light into bright wavy lines on surfaces under the water. Each frame a
+// compute shader refracts the light through the current wave normals and measures how much each
+// bit of the surface is squashed or stretched on its way down to a plane under the water - light
+// squashed into a smaller area is brighter. The result is a caustic intensity texture covering
+// one tile of the waves, at a fixed resolution, so its cost doesn't depend on the screen size.
+// The lit pixel shaders project it down the key light onto anything under the water, one sample
+// per pixel (see Caustics.hlsli), in the refraction pass and the main pass alike.
+
+#include "CVector2.h"
+#include "CVector3.h"
+#include <d3d11.h>
+
+#ifndef _CAUSTICS_H_INCLUDED_
+#define _CAUSTICS_H_INCLUDED_
+
+struct PerFrameConstants;
+
+class Caustics
+{
+//--------------------------------------------------------------------------------------
+// Construction / Usage
+//--------------------------------------------------------------------------------------
+public:
+
+	// Create the caustics texture, of the given size in texels across one tile of the waves (a multiple of 16)
+	// Will throw a std::runtime_error exception on failure (same as Mesh)
+	Caustics(unsigned int resolution = 512);
+	~Caustics();
+
+
+	// Generate the caustics for a light shining in the given direction through the current waves. The waves are the FFT ocean
+	// when oceanPatchSize isn't 0, read from its normal / foam texture, which tiles every oceanPatchSize world units.
+	// Otherwise they are the layers of the scrolling wave normal map, with the current wave scale and movement. Call once per
+	// frame on the immediate context. The caustics texture must not be bound to any shader stage when this is called, and
+	// the compute shader stage is left with nothing bound
+	void Generate(const CVector3& lightDirection, ID3D11ShaderResourceView* waveNormals, float oceanPatchSize,
+	              float waveScale, const CVector2& waterMovement);
+
+	// Set the constants the shaders need to project the caustics. A strength of 0 switches them off
+	void SetShaderConstants(PerFrameConstants& constants, float strength = 1);
+
+	// The caustics texture for the lit pixel shaders, mip-mapped and tiling like the waves it was generated from
+	ID3D11ShaderResourceView* SRV()  { return mSRV; }
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions / data
+//--------------------------------------------------------------------------------------
+private:
+
+	void Release();
+
+	// The depth under the water the light is focused onto. The lines are sharpest at this depth and blur either side, but the
+	// blur isn't noticeable at the depths the scene has
+	static constexpr float FocusDepth = 6.0f;
+
+	// The scrolling wave normal map covers this many world units at a layer size of 1 (must match WaterWidth in Common.hlsli)
+	static constexpr float WaveMapWidth = 400.0f;
+
+	// Constants for the caustics compute shader. There is a structure in the shader code that exactly matches this one
+	struct CausticsConstants
+	{
+		CVector3     lightDirection; // Normalised, pointing down
+		float        patchSize;      // World units covered by the texture, it repeats beyond that
+
+		CVector2     waterMovement;
+		float        waveScale;
+		float        oceanEnabled;
+
+		float        waterSizes[4];
+		float        waterSpeeds[4];
+
+		float        focusDepth;
+		unsigned int resolution;
+		CVector2     padding;
+	};
+
+	unsigned int mResolution;
+	float        mPatchSize = 1; // Of the last Generate
+
+	CausticsConstants mConstants;
+	ID3D11Buffer*     mConstantBuffer = nullptr;
+
+	ID3D11Texture2D*           mTexture = nullptr;
+	ID3D11ShaderResourceView*  mSRV     = nullptr;
+	ID3D11UnorderedAccessView* mUAV     = nullptr;
+};
+
+
+#endif //_CAUSTICS_H_INCLUDED_
@@ -0,0 +1,48 @@
+//--------------------------------------------------------------------------------------
+// Caustics - the key light focused by the waves onto surfaces under the water
+//--------------------------------------------------------------------------------------
+// The caustics texture generated on the C++ side once per frame (see Caustics.h). It holds how
+// much the waves focus the light at each point of one tile of the water surface, and is projected
+// down the key light onto anything under the water with a single sample.
+
+#ifndef _CAUSTICS_HLSLI_DEFINED_
+#define _CAUSTICS_HLSLI_DEFINED_
+
+#include "Common.hlsli"
+
+
+//--------------------------------------------------------------------------------------
+// Textures and samplers
+//--------------------------------------------------------------------------------------
+
+// The slots must match the ones used in Scene.cpp
+Texture2D<float> CausticsMap    : register(t20); // Intensity of the focused light, 1 where the water is flat. Repeats like the waves
+SamplerState     CausticsFilter : register(s3);  // Trilinear with wrapping
+
+
+//--------------------------------------------------------------------------------------
+// Functions
+//--------------------------------------------------------------------------------------
+
+// The caustics fade in over this depth under the water, so they don't start suddenly at the water line, and out over the
+// second depth, where the light is spread out again
+static const float CausticsFadeInDepth  = 1.0f;
+static const float CausticsFadeOutDepth = 40.0f;
+
+// How much of the light from the given position reaches the given world position under the water, after the waves have
+// focused it. 1 above the water or when the caustics are off. The point on the water surface the light came through
+// is found by going back towards the light, with the water treated as flat
+float CausticsFactor(float3 worldPosition, float3 lightPosition)
+{
+	float depth = gWaterPlaneY - worldPosition.y;
+	if (gCausticsStrength == 0 || depth <= 0)  return 1;
+
+	float3 toLight = normalize(lightPosition - worldPosition);
+	float2 surfaceXZ = worldPosition.xz + toLight.xz * (depth / max(toLight.y, 0.05f)); // Light grazing the surface
+
+	float caustics = CausticsMap.Sample(CausticsFilter, surfaceXZ * gCausticsScale);
+	float fade = saturate(depth / CausticsFadeInDepth) * saturate(1 - depth / CausticsFadeOutDepth);
+	return lerp(1, caustics, fade * gCausticsStrength);
+}
+
+#endif // _CAUSTICS_HLSLI_DEFINED_
@@ -0,0 +1,138 @@
+//--------------------------------------------------------------------------------------
+// Caustics compute shader
+//--------------------------------------------------------------------------------------
+// Generates the caustics texture once per frame from the current water waves (see Caustics.h). Each
+// texel is a point on the water surface. The key light is refracted through the wave normal there and
+// at the next texels across and along, and followed down to a plane at the focus depth. Light from
+// the texel's bit of surface lands on the area between the three points it reaches - the smaller that
+// area, the more the light is focused and the brighter the caustic. Flat water gives 1 everywhere
+// The compute shaders don't use the rendering constant buffers so have their own, and don't include Common.hlsli
+
+
+//--------------------------------------------------------------------------------------
+// Constants
+//--------------------------------------------------------------------------------------
+
+static const uint  CausticsThreadGroupSize = 16;    // Must match the thread groups dispatched in Caustics::Generate
+static const float WaterWidth              = 400.0f; // Must match WaterWidth in Common.hlsli
+static const float WaterRefractionRatio    = 1.0f / 1.33f; // Air to water
+static const float MaxCausticIntensity     = 8.0f;  // Where the light is focused to a point the intensity would be infinite
+
+
+//--------------------------------------------------------------------------------------
+// Constant Buffers
+//--------------------------------------------------------------------------------------
+
+// These variables must match exactly the CausticsConstants structure in Caustics.h
+cbuffer CausticsConstants : register(b0) // Compute shaders have their own constant buffer slots, so b0 is not the per-frame constants here
+{
+	float3 gLightDirection;   // Normalised, pointing down
+	float  gPatchSize;        // World units covered by the texture, it repeats beyond that
+
+	float2 gWaterMovement;    // As the per-frame constants, for the wave normal map layers
+	float  gWaveScale;
+	float  gOceanEnabled;     // Waves come from the FFT ocean's slopes when set, otherwise from the wave normal map layers
+
+	float4 gWaterSizes;       // The layers of the wave normal map, as WaterSize1-4 and WaterSpeed1-4 in Common.hlsli
+	float4 gWaterSpeeds;
+
+	float  gFocusDepth;       // Depth under the water the light is followed down to
+	uint   gResolution;       // Of the caustics texture
+	float2 paddingCaustics;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Textures
+//--------------------------------------------------------------------------------------
+
+Texture2D    WaveNormals    : register(t0); // The ocean's normal / foam texture, or the wave normal map
+SamplerState StandardFilter : register(s0); // Wraps, the waves repeat
+
+RWTexture2D<float> CausticsOut : register(u0);
+
+
+//--------------------------------------------------------------------------------------
+// Functions
+//--------------------------------------------------------------------------------------
+
+// Mip-map of the wave normals whose texels are about the size of a caustics texel, one texel apart in the caustics covers
+// uvStep of the normals. Compute shaders can't choose mip-maps themselves, and the finer detail would only flicker
+float WaveNormalLod(float uvStep)
+{
+	float width, height;
+	WaveNormals.GetDimensions(width, height);
+	return max(log2(uvStep * width), 0);
+}
+
+
+// The normal of one layer of the wave normal map, corrected for its size as WaveComposite_cs.hlsl does for the water shaders
+float3 WaveLayerNormal(float2 waterUV, float size, float speed, float texelWorldSize)
+{
+	float2 xy = WaveNormals.SampleLevel(StandardFilter, size * (waterUV + gWaterMovement * speed),
+	                                    WaveNormalLod(size * texelWorldSize / WaterWidth)).rg * 2.0f - 1.0f;
+	float3 normal = float3(xy, sqrt(saturate(1.0f - dot(xy, xy))));
+	normal.y *= size;
+	return normalize(normal);
+}
+
+
+// Normal of the water surface at the given world position, the same as the water surface pixel shader finds it (always with
+// all four layers of the wave normal map)
+float3 WaterNormal(float2 worldXZ, float texelWorldSize)
+{
+	[branch] if (gOceanEnabled > 0)
+	{
+		float2 slopes = WaveNormals.SampleLevel(StandardFilter, worldXZ / gPatchSize,
+		                                        WaveNormalLod(texelWorldSize / gPatchSize)).xy;
+		return normalize(float3(-slopes.x * gWaveScale, 1.0f, -slopes.y * gWaveScale));
+	}
+
+	// Water UVs from the world position, as WaterUV in WaterWaves.hlsli
+	float2 waterUV = float2(worldXZ.x / WaterWidth + 0.5f, 0.5f - worldXZ.y / WaterWidth);
+	float3 normal = WaveLayerNormal(waterUV, gWaterSizes.x, gWaterSpeeds.x, texelWorldSize) +
+	                WaveLayerNormal(waterUV, gWaterSizes.y, gWaterSpeeds.y, texelWorldSize) +
+	                WaveLayerNormal(waterUV, gWaterSizes.z, gWaterSpeeds.z, texelWorldSize) +
+	                WaveLayerNormal(waterUV, gWaterSizes.w, gWaterSpeeds.w, texelWorldSize);
+
+	// Swap the z and the y axes, the normal map's z is up. The wave scale flattens the normals with the waves
+	normal = float3(normal.x, normal.z / (gWaveScale + 0.001f), normal.y);
+	return normalize(normal);
+}
+
+
+// Where the light through the water surface at the given world position reaches the focus depth, relative to the point
+// straight under it
+float2 FocusOffset(float2 worldXZ, float texelWorldSize)
+{
+	float3 refracted = refract(gLightDirection, WaterNormal(worldXZ, texelWorldSize), WaterRefractionRatio);
+	return refracted.xz * (gFocusDepth / max(-refracted.y, 0.05f)); // Light grazing the surface goes nearly sideways
+}
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+[numthreads(CausticsThreadGroupSize, CausticsThreadGroupSize, 1)]
+void main(uint3 id : SV_DispatchThreadID)
+{
+	if (any(id.xy >= gResolution))  return;
+
+	// The texel's point on the surface and the next texels across and along. The texture's v goes the same way as world z,
+	// the pixel shaders sample it with the world xz over the patch size
+	float  texelWorldSize = gPatchSize / gResolution;
+	float2 worldXZ = (id.xy + 0.5f) * texelWorldSize;
+	float2 nextX = float2(worldXZ.x + texelWorldSize, worldXZ.y);
+	float2 nextZ = float2(worldXZ.x, worldXZ.y + texelWorldSize);
+
+	float2 focus      = worldXZ + FocusOffset(worldXZ, texelWorldSize);
+	float2 focusNextX = nextX   + FocusOffset(nextX,   texelWorldSize);
+	float2 focusNextZ = nextZ   + FocusOffset(nextZ,   texelWorldSize);
+
+	// Area the texel's light lands on, over the area of the texel
+	float2 edgeX = focusNextX - focus;
+	float2 edgeZ = focusNextZ - focus;
+	float area = abs(edgeX.x * edgeZ.y - edgeX.y * edgeZ.x);
+	CausticsOut[id.xy] = min(texelWorldSize * texelWorldSize / max(area, 1e-6f), MaxCausticIntensity);
+}
@@ -0,0 +1,127 @@
+//--------------------------------------------------------------------------------------
+// Records rendering passes on several threads using deferred contexts
+//--------------------------------------------------------------------------------------
+
+#include "CommandRecorder.h"
+#include "JobSystem.h"
+#include "CpuProfiler.h"
+#include "Common.h"
+
+#include <stdexcept>
+
+
+// Create a deferred context for each of up to maxJobs jobs per call to Record
+// Will throw a std::runtime_error exception on failure (same as Mesh)
+CommandRecorder::CommandRecorder(int maxJobs)
+{
+	if (maxJobs < 1)  throw std::runtime_error("Command recorder needs at least one job");
+
+	D3D11_FEATURE_DATA_THREADING threading = {};
+	if (SUCCEEDED(gD3DDevice->CheckFeatureSupport(D3D11_FEATURE_THREADING, &threading, sizeof(threading))))
+	{
+		mDriverCommandLists = (threading.DriverCommandLists != FALSE);
+	}
+
+	mContexts.resize(maxJobs, nullptr);
+	mCommandLists.resize(maxJobs, nullptr);
+	mJobStats.resize(maxJobs);
+	for (auto& context : mContexts)
+	{
+		if (FAILED(gD3DDevice->CreateDeferredContext(0, &context)))
+		{
+			ReleaseContexts(); // Destructor isn't called when a constructor throws
+			throw std::runtime_error("Error creating deferred context");
+		}
+	}
+}
+
+CommandRecorder::~CommandRecorder()
+{
+	ReleaseContexts();
+}
+
+
+// Release the deferred contexts and any command lists
+void CommandRecorder::ReleaseContexts()
+{
+	for (auto& commandList : mCommandLists)
+	{
+		if (commandList)  commandList->Release();
+		commandList = nullptr;
+	}
+	for (auto& context : mContexts)
+	{
+		if (context)  context->Release();
+		context = nullptr;
+	}
+}
+
+
+// Record each job into its own deferred context, spread across the threads, then play back the command lists on the
+// immediate context in job order. Returns when they have all been sent. Call from the main thread
+bool CommandRecorder::Record(const Job* jobs, int numJobs)
+{
+	if (numJobs > static_cast<int>(mContexts.size()))
+	{
+		gLastError = "Too many jobs for command recorder";
+		return false;
+	}
+
+	// Recording a job resets this thread's state cache stats, keep them to add to at the end
+	StateCacheStats callerStats = GetStateCacheStats();
+
+	// Hand the jobs to the pool, then help record them. Recording a job here changes this thread's context, so set it back after
+	mJobs = jobs;
+	JobCounter recording;
+	for (int job = 0; job < numJobs; ++job)  gJobSystem->Run({ &CommandRecorder::RecordJob, this, job }, recording);
+	{
+		CpuProfileScope profile("Wait For Recording");
+		gJobSystem->Wait(recording);
+	}
+	mJobs = nullptr;
+	gD3DContext = gD3DImmediateContext;
+
+	// Play back the command lists in order. Don't restore the immediate context state after each one (faster), as the
+	// next command list doesn't depend on it - each job sets all the state it needs
+	CpuProfileScope profile("Execute Command Lists");
+	bool ok = true;
+	ResetStateCacheStats();
+	AddStateCacheStats(callerStats);
+	for (int job = 0; job < numJobs; ++job)
+	{
+		if (mCommandLists[job] == nullptr)
+		{
+			ok = false;
+			continue;
+		}
+		gD3DImmediateContext->ExecuteCommandList(mCommandLists[job], FALSE);
+		mCommandLists[job]->Release();
+		mCommandLists[job] = nullptr;
+		AddStateCacheStats(mJobStats[job]);
+	}
+	if (!ok)  gLastError = "Error recording command list";
+
+	// Playing back the command lists cleared the immediate context state
+	ResetStateCache();
+	return ok;
+}
+
+
+// Record the given job on the calling thread, run by the job system with the recorder as the data. Any thread's context and
+// state cache are left for the next job recorded on it, other jobs don't use them
+void CommandRecorder::RecordJob(void* recorder, int job)
+{
+	CommandRecorder& self = *static_cast<CommandRecorder*>(recorder);
+
+	// A deferred context starts with default state, so the state cache must start with nothing known
+	ID3D11DeviceContext* context = self.mContexts[job];
+	gD3DContext = context;
+	ResetStateCache();
+	ResetStateCacheStats();
+
+	self.mJobs[job].record(self.mJobs[job].camera, self.mJobs[job].index);
+
+	// FALSE - don't save the deferred context state to restore after recording, it starts from the default state each time
+	if (FAILED(context->FinishCommandList(FALSE, &self.mCommandLists[job])))  self.mCommandLists[job] = nullptr;
+	self.mJobStats[job] = GetStateCacheStats();
+}
@@ -0,0 +1,83 @@
+//--------------------------------------------------------------------------------------
+// Records rendering passes on several threads using deferred contexts
+//--------------------------------------------------------------------------------------
+// Only one thread can use the immediate context, so normally all the CPU work of issuing draw
+// calls happens on the main thread. A deferred context records calls into a command list
+// instead of sending them to the GPU, and each thread can have its own. Here each "job" (a
+// rendering pass) is recorded into its own deferred context as a job on the app's thread pool
+// (see JobSystem.h), then the command lists are played back on the immediate context in job
+// order. CPU submission time then scales with the number of cores rather than the number of draw
+// calls.
+//
+// While a job is recorded gD3DContext on its thread is the job's deferred context (see Common.h),
+// and the thread's state cache starts empty, as a deferred context starts with default state.
+// Jobs may run at the same time, so they must only read shared scene data.
+
+#include "StateCache.h"
+#include <d3d11.h>
+#include <vector>
+
+#ifndef _COMMAND_RECORDER_H_INCLUDED_
+#define _COMMAND_RECORDER_H_INCLUDED_
+
+class Camera;
+
+class CommandRecorder
+{
+//--------------------------------------------------------------------------------------
+// Construction / Usage
+//--------------------------------------------------------------------------------------
+public:
+
+	// A job records one pass from the given camera. A plain function pointer, so making jobs each frame allocates nothing
+	// Passes rendered more than once a frame are given an index to tell them apart (e.g. the group of water they are for)
+	struct Job
+	{
+		void  (*record)(Camera* camera, int index);
+		Camera* camera;
+		int     index;
+	};
+
+
+	// Create a deferred context for each of up to maxJobs jobs per call to Record. The jobs are recorded by gJobSystem's threads,
+	// including the thread calling Record, which records jobs itself rather than wait
+	// Will throw a std::runtime_error exception on failure (same as Mesh)
+	CommandRecorder(int maxJobs);
+	~CommandRecorder();
+
+
+	// Record each job into its own deferred context, spread across the threads, then play back the command lists on the
+	// immediate context in job order. Returns when they have all been sent. Call from the main thread.
+	// The state cache stats of the jobs are added to the calling thread's stats. The immediate context state is cleared by
+	// playing back command lists, so the calling thread's state cache is reset afterwards
+	// Returns false with a message in gLastError if any job's command list couldn't be created (that pass is missing)
+	bool Record(const Job* jobs, int numJobs);
+
+
+	// Whether the driver supports command lists itself. If not, the DirectX runtime emulates them, which still spreads the
+	// recording across threads, but playing back the lists costs more
+	bool DriverCommandLists()  { return mDriverCommandLists; }
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions / data
+//--------------------------------------------------------------------------------------
+private:
+
+	// Record the given job on the calling thread, run by the job system with the recorder as the data
+	static void RecordJob(void* recorder, int job);
+
+	// Release the deferred contexts and any command lists
+	void ReleaseContexts();
+
+
+	std::vector<ID3D11DeviceContext*> mContexts;     // One for each job
+	std::vector<ID3D11CommandList*>   mCommandLists; // Result of each job
+	std::vector<StateCacheStats>      mJobStats;     // State cache stats for each job
+	bool                              mDriverCommandLists = false;
+
+	const Job* mJobs = nullptr; // Jobs for the current call to Record
+};
+
+
+#endif //_COMMAND_RECORDER_H_INCLUDED_
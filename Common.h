@@ -30,13 +30,20 @@ extern int gViewportHeight;
 
 // Important DirectX variables
 extern ID3D11Device*           gD3DDevice;
-extern ID3D11DeviceContext*    gD3DContext;
+extern ID3D11DeviceContext*    gD3DImmediateContext;
+
+// The context used for rendering. Normally the immediate context, but each thread has its own so that passes can be recorded
+// into deferred contexts on worker threads (see CommandRecorder.h). Code that may run on any thread, such as texture loading,
+// must use the immediate context instead (and lock it)
+extern thread_local ID3D11DeviceContext* gD3DContext;
 
 extern IDXGISwapChain*           gSwapChain;
 extern ID3D11Texture2D*          gBackBufferTexture;
 extern ID3D11RenderTargetView*   gBackBufferRenderTarget; // Back buffer is where we render to
+extern ID3D11Texture2D*          gDepthStencilTexture;    // The texture holding the depth values
 extern ID3D11DepthStencilView*   gDepthStencil;           // The depth buffer contains a depth for each back buffer pixel
 extern ID3D11ShaderResourceView* gDepthShaderView;        // Allows access to the depth buffer as a texture for certain specialised shaders
+extern unsigned int              gMSAASamples;            // Samples per pixel in the main pass (1 for no MSAA), the depth buffer has as many
 
 
 // Input constsnts
@@ -58,42 +65,126 @@ extern std::string gLastError;
 // Data that remains constant for an entire frame, updated from C++ to the GPU shaders *once per frame*
 // We hold them together in a structure and send the whole thing to a "constant buffer" on the GPU each frame when
 // we have finished updating the scene. There is a structure in the shader code that exactly matches this one
+// The camera is in the per-view constants below, so a pass can change its view without sending all of these again
 struct PerFrameConstants
 {
-    // These are the matrices used to position the camera
-	CMatrix4x4 cameraMatrix;
-	CMatrix4x4 viewMatrix;
-    CMatrix4x4 projectionMatrix;
-    CMatrix4x4 viewProjectionMatrix; // The above two matrices multiplied together to combine their effects
-
-    CVector3   light1Position; // 3 floats: x, y z
+    // The lights are in the light grid's buffers (see LightGrid.h), these are what the shaders need to find a pixel's cell
+    CVector3   lightGridMin;   // Corner of the grid with the lowest coordinates
     float      viewportWidth;  // Using viewport width and height as padding - see this structure in earlier labs to read about padding here
-    CVector3   light1Colour;
+    CVector3   lightGridScale; // Cells per world unit in x, y and z
     float      viewportHeight;
 
-    CVector3   light2Position;
-    float      padding1;
-    CVector3   light2Colour;
-    float      padding2;
+    CVector3   lightGridSize;  // Number of cells in x, y and z
+    float      waterTextureScale; // Size of the reflection / refraction / water height textures relative to the viewport (1, 0.5 or 0.25)
+    float      cameraUnderwater; // 1 when the camera is under the water (see Scene.cpp)
+    CVector2   padding1;
+    float      oceanEnabled;   // 1 when the water waves come from the FFT ocean simulation (see OceanFFT.h), 0 for the scrolling normal/height map
 
     CVector3   ambientColour;
     float      specularPower;
 
-    CVector3   cameraPosition;
-	float      padding3;
+    CVector3   cameraPosition; // Of the main camera in every pass, so level of detail is chosen the same in them all
+	float      oceanPatchSize; // World size of the FFT ocean patch, the ocean textures repeat every this many units
 
 	// Miscellaneous water variables
 	float    waterPlaneY;   // Y coordinate of the water plane (before adding the height map)
 	float    waveScale;     // How tall the waves are (rescales weight heights and normals)
 	CVector2 waterMovement; // An offset added to the water height map UVs to make the water surface move
+
+	// Lit models are clipped by the GPU against this plane in the refraction / reflection passes, (0,0,0,1) clips nothing.
+	// The plane is moved away from the water by the margin, pixels nearer the water are clipped exactly in the pixel shader
+	CVector4 waterClipPlane;
+	float    waterClipMargin; // 0 when clipping is done in the pixel shader only
+
+	// Water nearer the camera than this shows the planar reflection, further water shows the environment map (see Scene.cpp)
+	float    planarReflectionDistance;
+	float    screenSpaceReflections; // 1 when the water traces its reflections through the main pass instead (see WaterSurface_ps.hlsl)
+	float    shoreMapEnabled;        // 1 when the water body being drawn has a shore map (see WaterBody.h)
+
+	// View-projection matrices of the camera when the refraction and reflection textures were last rendered, to find where the
+	// water is in them. The same as viewProjectionMatrix unless they are left over from the last frame (see Scene.cpp)
+	CMatrix4x4 refractionViewProjectionMatrix;
+	CMatrix4x4 reflectionViewProjectionMatrix;
+
+	// Parts of the textures rendered to this frame, which can be less than all of them with dynamic resolution (see Scene.cpp).
+	// UVs across the screen (0->1) are multiplied by these to find the rendered part
+	CVector2   refractionUVScale; // May be left over from the last frame like the matrices above
+	CVector2   reflectionUVScale;
+	CVector2   sceneUVScale;      // For the copy of the main pass colour
+	CVector2   waterViewportSize; // Size in pixels of the part of the water textures rendered this frame
+
+	// Heightmap terrain (see Terrain.h): world xz of the first height sample, the distance between samples and the number of
+	// samples across. UVs are made from the world xz position with the scale and offset
+	CVector2   terrainOrigin;
+	float      terrainSpacing;
+	float      terrainResolution;
+	CVector2   terrainUVScale;
+	CVector2   terrainUVOffset;
+
+	// Shore map of the water body being drawn (see WaterBody.h): UVs in the map are (world xz - origin) * scale
+	CVector2   shoreMapOrigin;
+	CVector2   shoreMapScale;
+
+	// Cascaded shadow maps of the key light (see ShadowMap.h): from world space to each cascade's shadow map UVs and depth
+	CMatrix4x4 shadowMatrices[4]; // One for each of ShadowMap::NumCascades
+	float      numShadowCascades; // 0 when shadows are off
+	float      shadowTexelSize;   // 1 / size of a cascade in texels
+
+	// Caustics under the water (see Caustics.h)
+	float      causticsScale;     // 1 / world size of the caustics texture
+	float      causticsStrength;  // 0 when caustics are off
+
+	// Ripples from the objects moving through the water around the camera (see Ripples.h). UVs in the ripple texture are
+	// (world xz - origin) * scale
+	CVector2   rippleOrigin;
+	float      rippleScale;       // 1 / world size of the ripple texture
+	float      rippleStrength;    // 0 when ripples are off
+	float      ripplePlaneY;      // The ripples are only on water at this height
+
+	float      waterLodDistance;  // Water further than this from the camera is shaded more cheaply (see WaterSurface_ps.hlsl)
+	float      waterCheckerboardDistance; // And further than this is shaded in a checkerboard of 2x2 blocks (see WaterWaves.hlsli)
+	float      screenSpaceRefraction;     // 1 when the water refracts the main pass rendered so far instead of a refraction texture
+
+	// Flow map of the water body being drawn (see WaterBody.h): UVs in the map are (world xz - origin) * scale
+	CVector2   flowMapOrigin;
+	CVector2   flowMapScale;
+	float      flowMapEnabled;    // 0 when the water body being drawn has no flow map
+	float      flowTime;          // Seconds, for the cycle of the flowing waves (see WaterWaves.hlsli)
+	CVector2   paddingFlow;
 };
 
-extern PerFrameConstants gPerFrameConstants;      // This variable holds the CPU-side constant buffer described above
+// The CPU-side constant variables are per-thread, so passes recorded on worker threads don't overwrite each other's constants
+extern thread_local PerFrameConstants gPerFrameConstants; // This variable holds the CPU-side constant buffer described above
 extern ID3D11Buffer*     gPerFrameConstantBuffer; // This variable controls the GPU-side constant buffer matching to the above structure
 
 
 
-static const int MAX_BONES = 64;
+// The matrices of the camera a pass is viewing from, sent each time the view changes (see SelectCamera in Scene.cpp), e.g. for
+// each environment map face or shadow cascade. Much smaller than the per-frame constants above
+struct PerViewConstants
+{
+	CMatrix4x4 cameraMatrix;
+	CMatrix4x4 viewMatrix;
+	CMatrix4x4 projectionMatrix;
+	CMatrix4x4 viewProjectionMatrix; // The above two matrices multiplied together to combine their effects
+};
+extern thread_local PerViewConstants gPerViewConstants; // As above, per-thread
+extern ID3D11Buffer*     gPerViewConstantBuffer;
+
+
+
+// The two views of the water views pass, which draws the lit models into the refraction and the reflection at once (see
+// RenderWaterViewsPass in Scene.cpp). View 0 is the camera itself for the refraction, view 1 the camera mirrored in the water
+// for the reflection. Set and sent by that pass only
+struct WaterViewConstants
+{
+	CMatrix4x4 viewProjectionMatrices[2];
+	CMatrix4x4 cameraMatrices[2];
+	CVector4   clipPlanes[2]; // As waterClipPlane in the per-frame constants, for each view
+};
+extern ID3D11Buffer*     gWaterViewConstantBuffer;
+
+
 
 // This is the matrix that positions the next thing to be rendered in the scene. Unlike the structure above this data can be
 // updated and sent to the GPU several times every frame (once per model). However, apart from that it works in the same way.
@@ -101,13 +192,47 @@ struct PerModelConstants
 {
     CMatrix4x4 worldMatrix;
 
-    CVector3   objectColour;  // Allows each light model to be tinted to match the light colour they cast
-	float      padding4;
+    CVector3   objectColour;  // Allows each light model to be tinted to match the light colour they cast, and lit models by their material (see Material.h)
+	float      gridResolution; // Water clipmap tiles only: number of grid squares across the tile (0 for everything else)
+
+	float      morphStart;     // Water clipmap tiles only: camera distances over which the tile vertices morph onto the
+	float      morphEnd;       // coarser grid of the next clipmap level (see WaterClipmap.cpp)
+	float      quantisedVertices; // 1 if the mesh uses quantised vertices (octahedral normals), set by Mesh::Render
+	float      textureLayer;      // Lit models only: layer of the texture array their material uses (see Material.h)
 
-	CMatrix4x4 boneMatrices[MAX_BONES];
+	CVector2   gridSubdivisions;  // Bufferless grids only: number of grid squares in x and z, set by Mesh::Render
+	CVector2   padding5;
 };
-extern PerModelConstants gPerModelConstants;      // This variable holds the CPU-side constant buffer described above
+extern thread_local PerModelConstants gPerModelConstants; // This variable holds the CPU-side constant buffer described above
 extern ID3D11Buffer*     gPerModelConstantBuffer; // This variable controls the GPU-side constant buffer related to the above structure
 
 
+
+// Settings for the look of the water. Only used by shaders built with WATER_RUNTIME_CONSTANTS set (debug builds), so they
+// can be tuned while the app runs. Other builds have the default values below built into the shaders (see Common.hlsli)
+struct WaterConstants
+{
+	float    refractionDistortion  = 20.0f; // How distorted the refractions are
+	float    reflectionDistortion  = 16.0f; // How distorted the reflections are
+	float    maxDistortionDistance = 40.0f; // Depth/height at which maximum distortion is reached
+	float    specularStrength      = 1.0f;  // Strength of specular lighting added to reflection
+
+	float    refractionStrength    = 0.8f;  // Maximum level of refraction (0-1)
+	float    reflectionStrength    = 0.85f; // Maximum level of reflection (0-1)
+	float    waterRefractiveIndex  = 1.5f;  // Affects the blending of reflection and refraction. Higher values give more reflection
+	float    waterDiffuseLevel     = 0.5f;  // Brightness of particulates in water
+
+	CVector3 waterExtinction       = { 9, 7, 3 }; // How far red, green and blue light can travel in the water
+	float    foamStrength          = 0.8f;
+
+	CVector3 foamColour            = { 0.9f, 0.95f, 1.0f };
+	float    shoreFoamDepth        = 1.5f;  // Depth of water over which foam fades out from the shore
+
+	float    waterSizes[4]         = { 0.5f, 1.0f, 2.0f, 4.0f }; // Sizes of the normal/height map layers that make the waves
+	float    waterSpeeds[4]        = { 0.5f, 1.0f, 1.7f, 2.6f }; // Speed each layer moves
+};
+extern WaterConstants gWaterConstants;
+extern ID3D11Buffer*  gWaterConstantBuffer;
+
+
 #endif //_COMMON_H_INCLUDED_
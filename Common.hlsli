@@ -12,14 +12,71 @@
 //	Water rendering
 //--------------------------------------------------------------------------------------
 
+//--------------------------------------------------------------------------------------
+// Water permutations
+//--------------------------------------------------------------------------------------
+// Compile-time options for the water shaders. Pass different definitions to the compiler to make specialised versions
+// of the shaders (in the project's HLSL compiler settings, and ShaderDefines in Shader.cpp for hot reload), otherwise
+// these defaults are used. Whatever is switched off costs nothing in the shaders
+
+#ifndef WATER_FRESNEL
+#define WATER_FRESNEL 1 // 1 to blend reflection and refraction by the viewing angle (Fresnel effect), 0 to use a fixed blend
+#endif
+
+#ifndef WATER_SPECULAR_LIGHTS
+#define WATER_SPECULAR_LIGHTS 1 // 1 for the lights of each pixel's light grid cell to add specular highlights to the water, 0 for none
+#endif
+
+// 1 to read the water constants below from the WaterConstants constant buffer so they can be changed while the app
+// runs (debug builds), 0 to build the values below into the shaders so the compiler can fold them in (release builds)
+#ifndef WATER_RUNTIME_CONSTANTS
+#define WATER_RUNTIME_CONSTANTS 0
+#endif
+
+
 //--------------------------------------------------------------------------------------
 // Water Constants
 //--------------------------------------------------------------------------------------
 
+#if WATER_RUNTIME_CONSTANTS
+
+// Must match exactly the WaterConstants structure in Common.h. The values are set in Scene.cpp (gWaterConstants)
+cbuffer WaterConstants : register(b2)
+{
+	float  RefractionDistortion;
+	float  ReflectionDistortion;
+	float  MaxDistortionDistance;
+	float  SpecularStrength;
+
+	float  RefractionStrength;
+	float  ReflectionStrength;
+	float  WaterRefractiveIndex;
+	float  WaterDiffuseLevel;
+
+	float3 WaterExtinction;
+	float  FoamStrength;
+
+	float3 FoamColour;
+	float  ShoreFoamDepth;
+
+	float  WaterSize1;
+	float  WaterSize2;
+	float  WaterSize3;
+	float  WaterSize4;
+
+	float  WaterSpeed1;
+	float  WaterSpeed2;
+	float  WaterSpeed3;
+	float  WaterSpeed4;
+}
+
+#else
+
+// Change the defaults for gWaterConstants in Scene.cpp to match if you change these
 static const float  RefractionDistortion  = 20.0f; // How distorted the refractions are
 static const float  ReflectionDistortion  = 16.0f; // How distorted the reflections are
 static const float  MaxDistortionDistance = 40;    // Depth/height at which maximum distortion is reached
-static const float  SpecularStrength      = 2.0f;  // Strength of specular lighting added to reflection, reduce to make water less shiny
+static const float  SpecularStrength      = 1.0f;  // Strength of specular lighting added to reflection, reduce to make water less shiny
 static const float  RefractionStrength    = 0.8f;  // Maximum level of refraction (0-1), use to help define water edge but should remain high, use WaterExtinction
 static const float  ReflectionStrength    = 0.85f; // Maximum level of reflection (0-1), reduce to make water less reflective, but it will also get darker
 static const float  WaterRefractiveIndex  = 1.5f;  // Refractive index of clean water is 1.33. Impurities increase this value and values up to about 7.0 are sensible
@@ -41,12 +98,26 @@ static const float WaterSpeed2 = 1.0f;
 static const float WaterSpeed3 = 1.7f;
 static const float WaterSpeed4 = 2.6f;
 
+// FFT ocean (see OceanFFT.h). Foam is blended into the final water colour, up to this amount
+static const float3 FoamColour   = float3(0.9f, 0.95f, 1.0f);
+static const float  FoamStrength = 0.8f;
+
+// Foam along the shore, found from the water body's shore map (see WaterBody.h). Fades out over this depth of water
+static const float  ShoreFoamDepth = 1.5f;
+
+#endif
+
+// These depend on the water textures and geometry so are always built in
 // To get the correct wave height, must specify the height/normal map dimensions exactly. Assuming square normal maps
 static const float HeightMapHeightOverWidth = 1 / 32.0f; // Maximum height of height map compared to its width, this is effectively embedded in the normals
                                                          // The normal maps for this lab have been created at this level. Used free AwesomeBump software
 static const float WaterWidth = 400.0f; // World space width of water surface (size of grid created when creating model in cpp file)
 static const float MaxWaveHeight = WaterWidth * HeightMapHeightOverWidth; // The above two values determine the maximum wave height in world units
 
+// Tessellated water (see WaterSurface_hs.hlsl). Patches are tessellated so their edges are about this many pixels long on screen
+static const float TessellationEdgePixels = 12.0f;
+static const float MaxTessellation        = 64.0f; // Maximum tessellation factor supported by DirectX
+
 
 																		  
 //--------------------------------------------------------------------------------------
@@ -54,6 +125,8 @@ static const float MaxWaveHeight = WaterWidth * HeightMapHeightOverWidth; // The
 //--------------------------------------------------------------------------------------
 
 // The structure below describes the model vertex data provided to the vertex shader for ordinary non-skinned models
+// Meshes can use a quantised vertex layout, which the GPU converts to these types as it reads it. Positions are already
+// decoded by the world matrix, but the normals are octahedral encoded in xy - always use ModelNormal (below) to read them
 struct BasicVertex
 {
     float3 position : position;
@@ -78,14 +151,71 @@ struct LightingPixelShaderInput
                                             // its position and normal in the world - required for lighting equations
     
     float2 uv : uv; // UVs are texture coordinates. The artist specifies for every vertex which point on the texture is "pinned" to that vertex.
+
+    float clipDistance : SV_ClipDistance0; // Distance to gWaterClipPlane, the GPU removes the parts of triangles where this is negative
 };
 
+// The lit models in the water views pass, drawn into the refraction and reflection at once by the geometry shader (see
+// WaterViews_gs.hlsl). The view chooses the slice of the water textures and the viewport, so also which of them the pixel is in
+struct WaterViewsPixelShaderInput
+{
+    LightingPixelShaderInput lighting; // For the view's camera, with its clip distance
+    uint view     : SV_RenderTargetArrayIndex; // 0 for the refraction, 1 for the reflection
+    uint viewport : SV_ViewportArrayIndex;     // The same as the view, each has its own scissor rectangle
+};
 
-// This structure is similar to the one above but for the light models, which aren't themselves lit
-struct SimplePixelShaderInput
+
+// This structure is similar to the one above but for the light models, which aren't themselves lit. The world
+// position is used to clip them against the water in the reflection / refraction passes. The tint comes from the vertex
+// shader rather than the constant buffer so it can be different for each copy of an instanced model
+struct TintedPixelShaderInput
 {
     float4 projectedPosition : SV_Position;
+    float3 worldPosition     : worldPosition;
     float2 uv                : uv;
+    nointerpolation float3 tint : tint; // Same for the whole triangle, no need to interpolate
+};
+
+// The particle billboards (see Particle_vs), each with its colour and alpha, and whether it is added to the scene
+struct ParticlePixelShaderInput
+{
+    float4 projectedPosition : SV_Position;
+    float2 uv                : uv;
+    nointerpolation float4 colour   : colour;
+    nointerpolation float  additive : additive; // 1 for additive particles, 0 for blended ones
+};
+
+// The sky is a single triangle covering the screen (see Sky_vs), which gives the pixel shader the direction of each pixel
+struct SkyPixelShaderInput
+{
+    float4 projectedPosition : SV_Position;
+    float3 worldDirection    : worldDirection;
+};
+
+// Output from the pixel shaders used in the refraction and reflection passes, which draw to two textures at once. The colour
+// goes to an HDR texture with no alpha channel, so the distance below / above the water used for distortion goes to a small
+// second texture (see WaterSurface_ps)
+struct WaterTexturePixelShaderOutput
+{
+	float4 colour     : SV_Target0;
+	float  distortion : SV_Target1; // 0->1 for distances of 0 to MaxDistortionDistance
+};
+
+// Data for each copy of an instanced model (see InstancedTransform_vs), must match InstanceData in InstancedModel.h
+struct InstanceData
+{
+    float4x4 worldMatrix;
+    float3   colour;
+    float    padding;
+};
+
+// Data for each model drawn as an impostor (see Impostor_vs), must match InstanceData in Impostor.h. The centre and radius
+// are of the sphere around the baked views, in model space
+struct ImpostorInstance
+{
+    float4x4 worldMatrix;
+    float3   centre;
+    float    radius;
 };
 
 
@@ -98,6 +228,20 @@ struct WorldPositionPixelShaderInput
 };
 
 
+// Control point for the tessellated water surface. Output from the vertex shader and passed through the hull shader unchanged
+struct WaterControlPoint
+{
+	float3 worldPosition : worldPosition; // Undisplaced, the domain shader adds the waves
+};
+
+// Tessellation factors for each triangle patch of the water surface, calculated by the hull shader's patch constant function
+struct WaterPatchTessellation
+{
+	float edges[3] : SV_TessFactor;
+	float inside   : SV_InsideTessFactor;
+};
+
+
 
 //--------------------------------------------------------------------------------------
 // Constant Buffers
@@ -111,37 +255,116 @@ struct WorldPositionPixelShaderInput
 // These variables must match exactly the gPerFrameConstants structure in Scene.cpp
 cbuffer PerFrameConstants : register(b0) // The b0 gives this constant buffer the number 0 - used in the C++ code
 {
-	float4x4 gCameraMatrix;         // World matrix for the camera (inverse of the ViewMatrix below)
-	float4x4 gViewMatrix;
-    float4x4 gProjectionMatrix;
-    float4x4 gViewProjectionMatrix; // The above two matrices multiplied together to combine their effects
-
-    float3   gLight1Position; // 3 floats: x, y z
+    // The lights are in the light grid's buffers (see LightGrid.hlsli), these are what the shaders need to find a pixel's cell
+    float3   gLightGridMin;   // Corner of the grid with the lowest coordinates
     float    gViewportWidth;  // Using viewport width and height as padding - see this structure in earlier labs to read about padding here
-    float3   gLight1Colour;
+    float3   gLightGridScale; // Cells per world unit in x, y and z
     float    gViewportHeight;
 
-    float3   gLight2Position;
-    float    padding1;
-    float3   gLight2Colour;
-    float    padding2;
+    float3   gLightGridSize;  // Number of cells in x, y and z
+    float    gWaterTextureScale; // Size of the reflection / refraction / water height textures relative to the viewport (1, 0.5 or 0.25)
+    float    gCameraUnderwater; // 1 when the camera is under the water (see Scene.cpp)
+    float2   gPadding1;
+    float    gOceanEnabled;   // 1 when the water waves come from the FFT ocean simulation (see OceanFFT.h), 0 for the scrolling normal/height map
 
     float3   gAmbientColour;
     float    gSpecularPower;
 
-    float3   gCameraPosition;
-    float    padding3;
+    float3   gCameraPosition; // Of the main camera in every pass, for level of detail. The view's own is gCameraMatrix[3]
+    float    gOceanPatchSize; // World size of the FFT ocean patch, the ocean textures repeat every this many units
 
 	// Miscellaneous water variables
 	float    gWaterPlaneY;   // Y coordinate of the water plane (before adding the height map)
 	float    gWaveScale;     // How tall the waves are (rescales weight heights and normals)
 	float2   gWaterMovement; // An offset added to the water height map UVs to make the water surface move
+
+	// Lit models are clipped by the GPU against this plane in the refraction / reflection passes, (0,0,0,1) clips nothing.
+	// The plane is moved away from the water by the margin, pixels nearer the water are clipped exactly in the pixel shader
+	float4   gWaterClipPlane;
+	float    gWaterClipMargin; // 0 when clipping is done in the pixel shader only
+
+	// Water nearer the camera than this shows the planar reflection, further water shows the environment map (see Scene.cpp)
+	float    gPlanarReflectionDistance;
+	float    gScreenSpaceReflections; // 1 when the water traces its reflections through the main pass instead (see WaterSurface_ps.hlsl)
+	float    gShoreMapEnabled;        // 1 when the water body being drawn has a shore map (see WaterBody.h)
+
+	// View-projection matrices of the camera when the refraction and reflection textures were last rendered, to find where the
+	// water is in them. The same as gViewProjectionMatrix unless they are left over from the last frame (see Scene.cpp)
+	float4x4 gRefractionViewProjectionMatrix;
+	float4x4 gReflectionViewProjectionMatrix;
+
+	// Parts of the textures rendered to this frame, which can be less than all of them with dynamic resolution (see Scene.cpp).
+	// UVs across the screen (0->1) are multiplied by these to find the rendered part
+	float2   gRefractionUVScale; // May be left over from the last frame like the matrices above
+	float2   gReflectionUVScale;
+	float2   gSceneUVScale;      // For the copy of the main pass colour
+	float2   gWaterViewportSize; // Size in pixels of the part of the water textures rendered this frame
+
+	// Heightmap terrain (see Terrain.h): world xz of the first height sample, the distance between samples and the number of
+	// samples across. UVs are made from the world xz position with the scale and offset
+	float2   gTerrainOrigin;
+	float    gTerrainSpacing;
+	float    gTerrainResolution;
+	float2   gTerrainUVScale;
+	float2   gTerrainUVOffset;
+
+	// Shore map of the water body being drawn (see WaterBody.h): UVs in the map are (world xz - origin) * scale
+	float2   gShoreMapOrigin;
+	float2   gShoreMapScale;
+
+	// Cascaded shadow maps of the key light (see ShadowMap.hlsli): from world space to each cascade's shadow map UVs and depth
+	float4x4 gShadowMatrices[4];
+	float    gNumShadowCascades; // 0 when shadows are off
+	float    gShadowTexelSize;   // 1 / size of a cascade in texels
+
+	// Caustics under the water (see Caustics.hlsli)
+	float    gCausticsScale;     // 1 / world size of the caustics texture
+	float    gCausticsStrength;  // 0 when caustics are off
+
+	// Ripples from the objects moving through the water around the camera (see WaterWaves.hlsli). UVs in the ripple texture
+	// are (world xz - origin) * scale
+	float2   gRippleOrigin;
+	float    gRippleScale;       // 1 / world size of the ripple texture
+	float    gRippleStrength;    // 0 when ripples are off
+	float    gRipplePlaneY;      // The ripples are only on water at this height
+
+	float    gWaterLodDistance;  // Water further than this from the camera is shaded more cheaply (see WaterSurface_ps.hlsl)
+	float    gWaterCheckerboardDistance; // And further than this is shaded in a checkerboard of 2x2 blocks (see WaterWaves.hlsli)
+	float    gScreenSpaceRefraction;     // 1 when the water refracts the main pass rendered so far instead of a refraction texture
+
+	// Flow map of the water body being drawn (see WaterBody.h): UVs in the map are (world xz - origin) * scale
+	float2   gFlowMapOrigin;
+	float2   gFlowMapScale;
+	float    gFlowMapEnabled;    // 0 when the water body being drawn has no flow map
+	float    gFlowTime;          // Seconds, for the cycle of the flowing waves (see WaterWaves.hlsli)
+	float2   paddingFlow;
 }
 // Note constant buffers are not structs: we don't use the name of the constant buffer, these are really just a collection of global variables (hence the 'g')
 
 
+// The camera the pass is viewing from. Changes more often than the per-frame constants above (e.g. for each environment map
+// face), so it is in a buffer of its own that is small to send. These variables must match exactly the PerViewConstants
+// structure in Common.h
+cbuffer PerViewConstants : register(b4)
+{
+	float4x4 gCameraMatrix;         // World matrix for the camera (inverse of the ViewMatrix below)
+	float4x4 gViewMatrix;
+	float4x4 gProjectionMatrix;
+	float4x4 gViewProjectionMatrix; // The above two matrices multiplied together to combine their effects
+}
+
+
+// The refraction and reflection views of the water views pass (see WaterViews_gs.hlsl), only used in that pass. View 0 is
+// the camera for the refraction, view 1 the camera mirrored in the water for the reflection. These variables must match
+// exactly the WaterViewConstants structure in Common.h
+cbuffer WaterViewConstants : register(b5)
+{
+	float4x4 gWaterViewProjectionMatrices[2];
+	float4x4 gWaterViewCameraMatrices[2];
+	float4   gWaterViewClipPlanes[2]; // As gWaterClipPlane, for each view
+}
+
 
-static const int MAX_BONES = 64;
 
 // If we have multiple models then we need to update the world matrix from C++ to GPU multiple times per frame because we
 // only have one world matrix here. Because this data is updated more frequently it is kept in a different buffer for better performance.
@@ -151,10 +374,79 @@ cbuffer PerModelConstants : register(b1) // The b1 gives this constant buffer th
 {
     float4x4 gWorldMatrix;
 
-    float3   gObjectColour;  // Useed for tinting light models
-	float    padding4;
+    float3   gObjectColour;  // Useed for tinting light models, and the tint of a lit model's material
+	float    gGridResolution; // Water clipmap tiles only: number of grid squares across the tile (0 for everything else)
+
+	float    gMorphStart;     // Water clipmap tiles only: camera distances over which the tile vertices morph onto the
+	float    gMorphEnd;       // coarser grid of the next clipmap level (see WaterClipmap.cpp)
+	float    gQuantisedVertices; // 1 if the mesh uses quantised vertices (see MeshLoaderSettings in Mesh.h), 0 otherwise
+	float    gTextureLayer;      // Lit models only: layer of the texture array their material uses (see Material.h)
+
+	float2   gGridSubdivisions;  // Bufferless grids only: number of grid squares in x and z (see Mesh.h)
+	float2   padding5;
+}
+
 
-	float4x4 gBoneMatrices[MAX_BONES];
+
+//--------------------------------------------------------------------------------------
+// Vertex decoding
+//--------------------------------------------------------------------------------------
+
+// Get the model space normal from a vertex, decoding it if the mesh uses quantised vertices. Normals in the quantised
+// layout are stored as points on a unit octahedron unfolded into a square (see WriteOctahedral in Mesh.cpp)
+float3 ModelNormal(BasicVertex modelVertex)
+{
+	if (gQuantisedVertices == 0)  return modelVertex.normal;
+
+	float2 encoded = modelVertex.normal.xy;
+	float3 normal = float3(encoded, 1 - abs(encoded.x) - abs(encoded.y));
+	float  fold = saturate(-normal.z); // Unfold the lower half of the octahedron
+	normal.xy += (normal.xy >= 0) ? -fold : fold;
+	return normalize(normal);
+}
+
+
+// Get the model space position of a vertex in a bufferless grid (see Mesh.h), which has no vertex data. Each instance is a
+// triangle strip along one row of the grid, alternating between the near and far edge of the row. Positions go from 0->1
+// across the grid in x and z, the world matrix scales them to the grid's size
+float3 GridVertexPosition(uint vertexID, uint instanceID)
+{
+	float2 gridPoint = float2(vertexID / 2, instanceID + (vertexID & 1));
+	float2 position  = gridPoint / gGridSubdivisions;
+	return float3(position.x, 0, position.y);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Water surface height
+//--------------------------------------------------------------------------------------
+
+// Depth of the water surface, rendered on its own in the water height pass (see RenderWaterHeightPass in Scene.cpp). The
+// same size as the refraction / reflection textures. Used by the refraction and reflection shaders to tell which side of
+// the water a pixel is on
+Texture2D WaterDepthMap : register(t2);
+
+// Height (world y) of the water surface seen at a pixel of the refraction / reflection textures, rebuilt from the water
+// depth. The water height pass uses the main camera, and so does the refraction pass, so the depth gives the water surface
+// directly. The reflection pass uses the camera mirrored in the water plane, so here the depth gives the water surface
+// mirrored in the plane as well - the bumps are upside down, which is what the reflection shaders need. Pixels with no
+// water in view give the flat water plane. The camera matrix is of the pass's camera, or of one of the water views
+float WaterSurfaceHeight(float4 projectedPosition, float4x4 cameraMatrix)
+{
+	float depth = WaterDepthMap.Load(int3(projectedPosition.xy, 0)).r;
+	if (depth == 0.0f)  return gWaterPlaneY; // Depth buffer was cleared to 0 (reversed depth), the water wasn't drawn here
+
+	// Position in camera space from the depth and the position on screen using the projection matrix, then into world space
+	float2 textureSize = gWaterViewportSize;
+	float2 projected   = float2(projectedPosition.x / textureSize.x * 2 - 1, 1 - projectedPosition.y / textureSize.y * 2);
+	float  viewZ       = gProjectionMatrix[2][3] / (depth - gProjectionMatrix[2][2]);
+	float4 viewPosition = float4(projected.x * viewZ / gProjectionMatrix[0][0], projected.y * viewZ / gProjectionMatrix[1][1], viewZ, 1);
+	return dot(cameraMatrix[1], viewPosition); // World y only
+}
+
+float WaterSurfaceHeight(float4 projectedPosition)
+{
+	return WaterSurfaceHeight(projectedPosition, gCameraMatrix);
 }
 
 #endif // _COMMON_HLSLI_DEFINED_
@@ -0,0 +1,156 @@
+//--------------------------------------------------------------------------------------
+// Class recording the CPU time taken by sections of code on each thread
+//--------------------------------------------------------------------------------------
+
+#include "CpuProfiler.h"
+#include "Timer.h"
+#include "Common.h"
+
+#include <fstream>
+
+
+CpuProfiler gCpuProfiler;
+
+
+//--------------------------------------------------------------------------------------
+// Construction / Usage
+//--------------------------------------------------------------------------------------
+
+CpuProfiler::CpuProfiler()
+{
+	mFrequency  = Timer::HighResFrequency();
+	mStartCount = Timer::HighResCount();
+}
+
+
+// Start a section on the calling thread. The name must last as long as the profiler
+void CpuProfiler::BeginSection(const char* name)
+{
+	ThreadBuffer& buffer = ThisThreadBuffer();
+	if (buffer.depth < MaxDepth)
+	{
+		buffer.open[buffer.depth].name  = name;
+		buffer.open[buffer.depth].start = Timer::HighResCount();
+	}
+	++buffer.depth; // Counted even when too deep, so the ends match up
+}
+
+// End the most recently started section on the calling thread, adding it to the thread's buffer
+void CpuProfiler::EndSection()
+{
+	ThreadBuffer& buffer = ThisThreadBuffer();
+	if (buffer.depth == 0)  return;
+	if (--buffer.depth >= MaxDepth)  return;
+
+	Section section = buffer.open[buffer.depth];
+	section.end = Timer::HighResCount();
+
+	// Write the section then publish it, the release store makes sure the trace sees the section complete
+	uint64_t numWritten = buffer.numWritten.load(std::memory_order_relaxed);
+	buffer.sections[numWritten & (MaxSections - 1)] = section;
+	buffer.numWritten.store(numWritten + 1, std::memory_order_release);
+}
+
+
+// Give the calling thread a name to show in the trace. The name must last as long as the profiler
+void CpuProfiler::NameThread(const char* name)
+{
+	ThisThreadBuffer().name = name;
+}
+
+
+// Save the sections in the threads' buffers as a Chrome trace. Call when no other thread is recording sections
+// Returns false with a message in gLastError if the file can't be written
+bool CpuProfiler::WriteTrace(const std::wstring& fileName)
+{
+	TraceSnapshot snapshot;
+	Snapshot(0, snapshot);
+
+	std::ofstream file(fileName);
+	file << "{\"traceEvents\":[\n";
+	bool first = true;
+	WriteTraceEvents(file, snapshot, first);
+	file << "\n]}\n";
+
+	if (!file)
+	{
+		gLastError = "Error writing CPU trace file";
+		return false;
+	}
+	return true;
+}
+
+
+// Copy the sections still in the threads' buffers that ended at or after the given high-resolution count
+void CpuProfiler::Snapshot(uint64_t since, TraceSnapshot& snapshot)
+{
+	snapshot.sections.clear();
+	snapshot.threadNames.clear();
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	for (auto& thread : mThreads)
+	{
+		snapshot.threadNames.push_back(thread->name);
+
+		// Only the most recent sections are still in the buffer. They are in the order they ended, so the search for the
+		// first one wanted can start from the newest
+		uint64_t numWritten = thread->numWritten.load(std::memory_order_acquire);
+		uint64_t oldest = (numWritten > MaxSections) ? numWritten - MaxSections : 0;
+		uint64_t first = numWritten;
+		while (first > oldest && thread->sections[(first - 1) & (MaxSections - 1)].end >= since)  --first;
+		for (uint64_t i = first; i < numWritten; ++i)
+		{
+			const Section& section = thread->sections[i & (MaxSections - 1)];
+			snapshot.sections.push_back({ section.name, section.start, section.end, thread->index });
+		}
+	}
+}
+
+
+// Write the thread names and sections of a snapshot as Chrome trace events, for a trace with other events too
+void CpuProfiler::WriteTraceEvents(std::ostream& file, const TraceSnapshot& snapshot, bool& first)
+{
+	auto precision = file.precision(3);
+	auto flags = file.setf(std::ios::fixed, std::ios::floatfield);
+
+	for (size_t thread = 0; thread < snapshot.threadNames.size(); ++thread)
+	{
+		if (snapshot.threadNames[thread] == nullptr)  continue;
+		file << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << thread
+		     << ",\"args\":{\"name\":\"" << snapshot.threadNames[thread] << "\"}}";
+		first = false;
+	}
+
+	// Sections are "complete" events, with a start time and duration in microseconds. The trace viewer nests the sections
+	// of each thread by their times, so the hierarchy doesn't need storing
+	double microsecondsPerCount = 1e6 / mFrequency;
+	for (auto& section : snapshot.sections)
+	{
+		file << (first ? "" : ",\n") << "{\"name\":\"" << section.name << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << section.thread
+		     << ",\"ts\":" << TraceTime(section.start) << ",\"dur\":" << (section.end - section.start) * microsecondsPerCount << "}";
+		first = false;
+	}
+
+	file.precision(precision);
+	file.flags(flags);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions
+//--------------------------------------------------------------------------------------
+
+// Buffer for the calling thread, created the first time the thread records a section. There is only one profiler so a
+// single pointer for each thread is enough
+CpuProfiler::ThreadBuffer& CpuProfiler::ThisThreadBuffer()
+{
+	static thread_local ThreadBuffer* threadBuffer = nullptr;
+	if (threadBuffer == nullptr)
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mThreads.push_back(std::make_unique<ThreadBuffer>());
+		threadBuffer = mThreads.back().get();
+		threadBuffer->index = static_cast<int>(mThreads.size()) - 1;
+	}
+	return *threadBuffer;
+}
@@ -0,0 +1,147 @@
+//--------------------------------------------------------------------------------------
+// Class recording the CPU time taken by sections of code on each thread
+//--------------------------------------------------------------------------------------
+// The frame time shows how long a frame takes but not where the CPU spends it. Sections of code
+// are marked with a CpuProfileScope, which records when it starts and ends using the Timer's
+// high-resolution counter. Sections inside other sections are recorded too, so the timings form
+// a hierarchy: a frame is the update and render, the render is its passes and so on.
+//
+// Each thread has its own ring buffer of the sections it has finished, so threads recording
+// passes at the same time never wait for each other - only the thread itself writes to its
+// buffer. The most recent sections can be saved as a Chrome trace, which can be opened in the
+// chrome://tracing page or https://ui.perfetto.dev to see the sections of each thread over time.
+// They can also be copied out to save later with events of one's own, which is how the frame
+// spike traces are made (see SpikeDetector.h).
+
+#include <atomic>
+#include <mutex>
+#include <ostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "stdint.h"
+
+#ifndef _CPU_PROFILER_H_INCLUDED_
+#define _CPU_PROFILER_H_INCLUDED_
+
+class CpuProfiler
+{
+//--------------------------------------------------------------------------------------
+// Construction / Usage
+//--------------------------------------------------------------------------------------
+public:
+
+	CpuProfiler();
+
+
+	// Start and end a section on the calling thread, use CpuProfileScope (below) rather than calling these directly. The
+	// name must last as long as the profiler, e.g. a string literal. Sections on a thread must end in the reverse order
+	// they started
+	void BeginSection(const char* name);
+	void EndSection();
+
+	// Give the calling thread a name to show in the trace, e.g. "Main". The name must last as long as the profiler
+	void NameThread(const char* name);
+
+
+	// Save the sections in the threads' buffers as a Chrome trace (JSON). Call when no other thread is recording sections,
+	// e.g. between frames, or the newest sections of the other threads may be missing or mixed up
+	// Returns false with a message in gLastError if the file can't be written
+	bool WriteTrace(const std::wstring& fileName);
+
+
+	// A finished section of a thread, copied out of the threads' buffers. Times are high-resolution counts (see Timer.h)
+	struct TraceSection
+	{
+		const char* name;
+		uint64_t    start;
+		uint64_t    end;
+		int         thread; // Id of the thread in the trace
+	};
+
+	// Sections copied out of the threads' buffers, with the names of the threads (nullptr for those without), by id
+	struct TraceSnapshot
+	{
+		std::vector<TraceSection> sections;
+		std::vector<const char*>  threadNames;
+	};
+
+	// Copy the sections still in the threads' buffers that ended at or after the given high-resolution count, e.g. to save
+	// them on another thread while more sections are recorded. Same caution as WriteTrace about other threads
+	void Snapshot(uint64_t since, TraceSnapshot& snapshot);
+
+	// Write the thread names and sections of a snapshot as Chrome trace events, for a trace with other events too. Events
+	// are separated by commas, first is whether nothing has been written before them and is cleared once something has
+	void WriteTraceEvents(std::ostream& file, const TraceSnapshot& snapshot, bool& first);
+
+	// Time in a trace of the given high-resolution count, in microseconds from when the profiler was created
+	double TraceTime(uint64_t count)  { return static_cast<double>(count - mStartCount) * 1e6 / mFrequency; }
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions / data
+//--------------------------------------------------------------------------------------
+private:
+
+	// Finished sections kept for each thread, older ones are overwritten. Must be a power of 2. Enough for a few frames with
+	// a mesh render section for each draw
+	static constexpr uint32_t MaxSections = 1 << 16;
+
+	// Sections started inside sections deeper than this are not recorded
+	static constexpr int MaxDepth = 32;
+
+	struct Section
+	{
+		const char* name;
+		uint64_t    start; // High-resolution counts (see Timer.h)
+		uint64_t    end;
+	};
+
+	// Each thread's buffer. Only the thread writes to it, the number of sections written is atomic so the trace sees the
+	// sections as finished
+	struct ThreadBuffer
+	{
+		int                   index; // Id of the thread in the trace
+		const char*           name = nullptr;
+		std::vector<Section>  sections = std::vector<Section>(MaxSections);
+		std::atomic<uint64_t> numWritten = { 0 };
+
+		// Sections started but not yet ended, innermost last
+		Section open[MaxDepth];
+		int     depth = 0;
+	};
+
+	// Buffer for the calling thread, created the first time the thread records a section
+	ThreadBuffer& ThisThreadBuffer();
+
+	uint64_t mFrequency;
+	uint64_t mStartCount; // Times in the trace are from when the profiler was created
+
+	// Buffers of every thread that has recorded a section. Only locked when a thread records its first section and when
+	// writing the trace
+	std::mutex                                 mMutex;
+	std::vector<std::unique_ptr<ThreadBuffer>> mThreads;
+};
+
+
+// The profiler used by the app. It needs no setup so is ready from the start
+extern CpuProfiler gCpuProfiler;
+
+
+// Records the time taken by the section of code from where it is declared until it goes out of scope, e.g.
+//     {
+//         CpuProfileScope profile("Update Scene");
+//         ...
+//     }
+class CpuProfileScope
+{
+public:
+	CpuProfileScope(const char* name)  { gCpuProfiler.BeginSection(name); }
+	~CpuProfileScope()                 { gCpuProfiler.EndSection(); }
+
+	CpuProfileScope(const CpuProfileScope&) = delete;
+	CpuProfileScope& operator=(const CpuProfileScope&) = delete;
+};
+
+
+#endif //_CPU_PROFILER_H_INCLUDED_
@@ -0,0 +1,34 @@
+//--------------------------------------------------------------------------------------
+// Depth Resolve Pixel Shader
+//--------------------------------------------------------------------------------------
+// DirectX can't resolve a multisampled depth buffer, so with MSAA the copy of the scene depth read by the water shader is
+// drawn with this shader instead. Each pixel keeps the nearest of its samples, so the edges of models in front of the water
+// keep their depth rather than getting an average of the model and what is behind it, which is no depth in the scene at all
+
+#include "PostProcess.hlsli"
+
+
+//--------------------------------------------------------------------------------------
+// Textures (texture maps)
+//--------------------------------------------------------------------------------------
+
+Texture2DMS<float> SceneDepthMap : register(t0); // The main depth buffer, see gDepthShaderView
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+float main(PostProcessPixelShaderInput input) : SV_Depth
+{
+	uint width, height, samples;
+	SceneDepthMap.GetDimensions(width, height, samples);
+
+	int2  pixel = int2(input.projectedPosition.xy);
+	float depth = 0.0f;
+	for (uint i = 0; i < samples; ++i)
+	{
+		depth = max(depth, SceneDepthMap.Load(pixel, i)); // Depths are reversed, nearer is greater
+	}
+	return depth;
+}
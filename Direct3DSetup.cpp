@@ -5,8 +5,16 @@
 #include "Direct3DSetup.h"
 #include "Shader.h"
 #include "Common.h"
+#include "PostProcess.h"
+#include "GpuEvents.h"
+#include "GpuMemory.h"
 #include <d3d11.h>
+#include <dxgi1_5.h>
 #include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 
 
 //--------------------------------------------------------------------------------------
@@ -16,24 +24,39 @@
 
 // The main Direct3D (D3D) variables
 ID3D11Device*        gD3DDevice  = nullptr; // D3D device for overall features
-ID3D11DeviceContext* gD3DContext = nullptr; // D3D context for specific rendering tasks
+ID3D11DeviceContext* gD3DImmediateContext = nullptr; // D3D context for specific rendering tasks
+
+// Rendering context for each thread, the immediate context on the main thread (see Common.h)
+thread_local ID3D11DeviceContext* gD3DContext = nullptr;
 
 // Swap chain and back buffer
 IDXGISwapChain*         gSwapChain              = nullptr;
+HANDLE                  gFrameLatencyWaitable   = nullptr; // Signalled when the swap chain can take another frame (flip model only)
+bool                    gFlipModel              = false;
+bool                    gTearingSupported       = false;   // Present without vsync can tear, rather than wait for the next refresh
 ID3D11Texture2D*        gBackBufferTexture      = nullptr;
 ID3D11RenderTargetView* gBackBufferRenderTarget = nullptr;
 
+// Adapter the device runs on, for video memory usage. Fetched the first time it is needed (see VideoMemoryUsage)
+IDXGIAdapter3*          gDXGIAdapter3           = nullptr;
+bool                    gDXGIAdapter3Fetched    = false;
+
 // Depth buffer (can also contain "stencil" values, which we will see later)
 ID3D11Texture2D*          gDepthStencilTexture = nullptr; // The texture holding the depth values
 ID3D11DepthStencilView*   gDepthStencil        = nullptr; // The depth buffer referencing above texture
 ID3D11ShaderResourceView* gDepthShaderView     = nullptr; // Allows access to the depth buffer as a texture for certain specialised shaders
 
+// Samples per pixel in the main pass for MSAA (1 for none). The back buffer itself is never multisampled, the main pass renders
+// into a multisampled HDR texture that is resolved before post-processing (see PostProcess.h)
+unsigned int gMSAASamples = 4;
+
 
 //--------------------------------------------------------------------------------------
 // Initialise / uninitialise Direct3D
 //--------------------------------------------------------------------------------------
-// Returns false on failure
-bool InitDirect3D()
+// Create the device on WARP, the software rasteriser, instead of the GPU if softwareDevice is set, e.g. to measure the CPU
+// cost of the DirectX calls without a GPU driver (see RunRenderBenchmark). Returns false on failure
+bool InitDirect3D(bool softwareDevice /*= false*/)
 {
     // Many DirectX functions return a "HRESULT" variable to indicate success or failure. Microsoft code often uses
     // the FAILED macro to test this variable, you'll see it throughout the code - it's fairly self explanatory.
@@ -42,28 +65,20 @@ bool InitDirect3D()
 
     //// Initialise DirectX ////
 
-    // Create a Direct3D device (i.e. initialise D3D) and create a swap-chain (create a back buffer to render to)
-    DXGI_SWAP_CHAIN_DESC swapDesc = {};
-    swapDesc.OutputWindow = gHWnd;                           // Target window
-    swapDesc.SwapEffect = DXGI_SWAP_EFFECT_DISCARD;          // Use DXGI_SWAP_EFFECT_SEQUENTIAL to retain the previous back buffer (for feedback blur effects)
-    swapDesc.Windowed = TRUE;
-    swapDesc.BufferCount = 1;
-    swapDesc.BufferDesc.Width  = gViewportWidth;             // Target window size
-    swapDesc.BufferDesc.Height = gViewportHeight;            // --"--
-    swapDesc.BufferDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM; // Pixel format of target window
-    swapDesc.BufferDesc.RefreshRate.Numerator   = 60;        // Refresh rate of monitor (provided as fraction = 60/1 here)
-    swapDesc.BufferDesc.RefreshRate.Denominator = 1;         // --"--
-    swapDesc.BufferUsage = DXGI_USAGE_RENDER_TARGET_OUTPUT;
-    swapDesc.SampleDesc.Count   = 1;
-    swapDesc.SampleDesc.Quality = 0;
+    // Create a Direct3D device (i.e. initialise D3D)
     UINT flags = D3D11_CREATE_DEVICE_DEBUG; // Set this to 0, or D3D11_CREATE_DEVICE_DEBUG to get more debugging information (in the "Output" window of Visual Studio)
-    hr = D3D11CreateDeviceAndSwapChain(nullptr, D3D_DRIVER_TYPE_HARDWARE, 0, flags, 0, 0, D3D11_SDK_VERSION,
-                                       &swapDesc, &gSwapChain, &gD3DDevice, nullptr, &gD3DContext);
+    D3D_DRIVER_TYPE driverType = softwareDevice ? D3D_DRIVER_TYPE_WARP : D3D_DRIVER_TYPE_HARDWARE;
+    hr = D3D11CreateDevice(nullptr, driverType, 0, flags, 0, 0, D3D11_SDK_VERSION,
+                           &gD3DDevice, nullptr, &gD3DImmediateContext);
     if (FAILED(hr))
     {
         gLastError = "Error creating Direct3D device";
         return false;
     }
+    gD3DContext = gD3DImmediateContext; // This is the main thread
+
+    // Create a swap-chain (create back buffers to render to)
+    if (!CreateSwapChain())  return false;
 
 
     // Get a "render target view" of back-buffer - standard behaviour
@@ -79,10 +94,76 @@ bool InitDirect3D()
         gLastError = "Error creating render target view";
         return false;
     }
+    SetDebugNames("Back Buffer", gBackBufferTexture, nullptr, gBackBufferRenderTarget);
+    RegisterGpuResource(gBackBufferTexture, "Swap Chain"); // Only the first back buffer can be seen, the others aren't counted
 
 
     //// Create depth buffer to go along with the back buffer ////
-    
+
+    // Fewer samples if the GPU can't multisample the main pass formats that many times
+    while (gMSAASamples > 1 && !MultisampleSupported(gMSAASamples))  gMSAASamples /= 2;
+    if (!CreateMainDepthBuffer(gMSAASamples))  return false;
+
+    return true;
+}
+
+
+// Resize the back buffers and the main depth buffer to the viewport size (gViewportWidth / Height), when the window has
+// changed size. Call between frames. Returns false on failure
+bool ResizeSwapChain()
+{
+    // The buffers can't be resized while the present thread is showing one
+    if (gPresentThread.joinable())  WaitForPresent();
+
+    // The swap chain can only resize its buffers when nothing else refers to them. The back buffer is still a render target
+    // from the last frame, and the context keeps objects alive until its queued work is done, so flush that too
+    gD3DContext->OMSetRenderTargets(0, nullptr, nullptr);
+    if (gBackBufferRenderTarget)  { gBackBufferRenderTarget->Release();  gBackBufferRenderTarget = nullptr; }
+    if (gBackBufferTexture)       { gBackBufferTexture->Release();       gBackBufferTexture      = nullptr; }
+    gD3DContext->Flush();
+
+    // Keep the buffer count and format, the flags must match those the swap chain was created with (see CreateSwapChain)
+    UINT flags = gFlipModel ? DXGI_SWAP_CHAIN_FLAG_FRAME_LATENCY_WAITABLE_OBJECT : 0;
+    if (gTearingSupported)  flags |= DXGI_SWAP_CHAIN_FLAG_ALLOW_TEARING;
+    if (FAILED(gSwapChain->ResizeBuffers(0, gViewportWidth, gViewportHeight, DXGI_FORMAT_UNKNOWN, flags)))
+    {
+        gLastError = "Error resizing swap chain";
+        return false;
+    }
+
+    if (FAILED(gSwapChain->GetBuffer(0, __uuidof(ID3D11Texture2D), reinterpret_cast<void**>(&gBackBufferTexture))) ||
+        FAILED(gD3DDevice->CreateRenderTargetView(gBackBufferTexture, nullptr, &gBackBufferRenderTarget)))
+    {
+        gLastError = "Error creating render target view";
+        return false;
+    }
+    SetDebugNames("Back Buffer", gBackBufferTexture, nullptr, gBackBufferRenderTarget);
+    RegisterGpuResource(gBackBufferTexture, "Swap Chain");
+
+    return CreateMainDepthBuffer(gMSAASamples);
+}
+
+
+// Whether the main pass can be rendered with the given number of samples per pixel, i.e. the GPU can multisample both the
+// depth buffer and the HDR scene texture that many times
+bool MultisampleSupported(unsigned int samples)
+{
+    UINT depthQuality = 0, sceneQuality = 0;
+    return SUCCEEDED(gD3DDevice->CheckMultisampleQualityLevels(DXGI_FORMAT_D32_FLOAT, samples, &depthQuality)) && depthQuality > 0 &&
+           SUCCEEDED(gD3DDevice->CheckMultisampleQualityLevels(PostProcess::HDRFormat, samples, &sceneQuality)) && sceneQuality > 0;
+}
+
+
+// Create the depth buffer used with the back buffer (the main pass) with the given number of samples per pixel, replacing
+// any existing one. Called by InitDirect3D, and again when the MSAA setting changes. Returns false on failure
+bool CreateMainDepthBuffer(unsigned int samples)
+{
+    if (gDepthShaderView)      { gDepthShaderView->Release();      gDepthShaderView     = nullptr; }
+    if (gDepthStencil)         { gDepthStencil->Release();         gDepthStencil        = nullptr; }
+    if (gDepthStencilTexture)  { gDepthStencilTexture->Release();  gDepthStencilTexture = nullptr; }
+
+    HRESULT hr = S_OK;
+
     // First create a texture to hold the depth buffer values
     D3D11_TEXTURE2D_DESC dbDesc = {};
     dbDesc.Width  = gViewportWidth; // Same size as viewport / back-buffer
@@ -91,7 +172,7 @@ bool InitDirect3D()
     dbDesc.ArraySize = 1;
     dbDesc.Format = DXGI_FORMAT_R32_TYPELESS; // Each depth value is a single float
                                               // Important point for when using depth buffer as texture, must use the TYPELESS constant shown here
-    dbDesc.SampleDesc.Count = 1;
+    dbDesc.SampleDesc.Count = samples; // Multisampled for MSAA, the main pass is resolved before post-processing
     dbDesc.SampleDesc.Quality = 0;
     dbDesc.Usage = D3D11_USAGE_DEFAULT;
     dbDesc.BindFlags = D3D11_BIND_DEPTH_STENCIL | D3D11_BIND_SHADER_RESOURCE; // Using this depth buffer in shaders so must say so;
@@ -108,7 +189,7 @@ bool InitDirect3D()
     // just created as a depth buffer
     D3D11_DEPTH_STENCIL_VIEW_DESC dsvDesc = {};
     dsvDesc.Format = DXGI_FORMAT_D32_FLOAT; // Important point for when using depth buffer as texture, ensure you use this setting - different from other labs
-    dsvDesc.ViewDimension = D3D11_DSV_DIMENSION_TEXTURE2D;
+    dsvDesc.ViewDimension = samples > 1 ? D3D11_DSV_DIMENSION_TEXTURE2DMS : D3D11_DSV_DIMENSION_TEXTURE2D;
     dsvDesc.Texture2D.MipSlice = 0;
     hr = gD3DDevice->CreateDepthStencilView(gDepthStencilTexture, &dsvDesc, &gDepthStencil);
     if (FAILED(hr))
@@ -121,7 +202,7 @@ bool InitDirect3D()
     // Note the veryt 
     D3D11_SHADER_RESOURCE_VIEW_DESC descSRV;
     descSRV.Format = DXGI_FORMAT_R32_FLOAT;
-    descSRV.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
+    descSRV.ViewDimension = samples > 1 ? D3D11_SRV_DIMENSION_TEXTURE2DMS : D3D11_SRV_DIMENSION_TEXTURE2D; // Read with Texture2DMS when multisampled
     descSRV.Texture2D.MipLevels = 1;
     descSRV.Texture2D.MostDetailedMip = 0;
     hr = gD3DDevice->CreateShaderResourceView( gDepthStencilTexture, &descSRV, &gDepthShaderView );
@@ -130,28 +211,279 @@ bool InitDirect3D()
         gLastError = "Error creating depth buffer shader resource view";
         return false;
     }
-    
+    SetDebugNames("Depth Buffer", gDepthStencilTexture, gDepthShaderView, nullptr, gDepthStencil);
+    RegisterGpuResource(gDepthStencilTexture, "Main Depth");
+
+    return true;
+}
+
+
+// Create the swap chain for the window. Uses the flip model where available (Windows 10): the back buffers are handed to the
+// desktop compositor rather than copied, which saves a copy each frame, and the swap chain tells us when it can take another
+// frame so we can wait before starting one rather than queue up frames (see WaitForSwapChain). Tearing is allowed when
+// presenting without vsync if the system supports it. Falls back to the older discard model otherwise
+// Returns false on failure
+bool CreateSwapChain()
+{
+    // Get the DXGI factory that made the device, to create the swap chain with it
+    IDXGIDevice*   dxgiDevice  = nullptr;
+    IDXGIAdapter*  dxgiAdapter = nullptr;
+    IDXGIFactory2* factory     = nullptr;
+    HRESULT hr = gD3DDevice->QueryInterface(__uuidof(IDXGIDevice), reinterpret_cast<void**>(&dxgiDevice));
+    if (SUCCEEDED(hr))  hr = dxgiDevice->GetAdapter(&dxgiAdapter);
+    if (SUCCEEDED(hr))  hr = dxgiAdapter->GetParent(__uuidof(IDXGIFactory2), reinterpret_cast<void**>(&factory));
+    if (dxgiAdapter)  dxgiAdapter->Release();
+    if (dxgiDevice)   dxgiDevice->Release();
+    if (FAILED(hr))
+    {
+        gLastError = "Error getting DXGI factory";
+        return false;
+    }
+
+    // Tearing needs the DXGI 1.5 factory and support from the display driver
+    IDXGIFactory5* factory5 = nullptr;
+    if (SUCCEEDED(factory->QueryInterface(__uuidof(IDXGIFactory5), reinterpret_cast<void**>(&factory5))))
+    {
+        BOOL allowTearing = FALSE;
+        if (SUCCEEDED(factory5->CheckFeatureSupport(DXGI_FEATURE_PRESENT_ALLOW_TEARING, &allowTearing, sizeof(allowTearing))))
+        {
+            gTearingSupported = (allowTearing != FALSE);
+        }
+        factory5->Release();
+    }
+
+    DXGI_SWAP_CHAIN_DESC1 swapDesc = {};
+    swapDesc.Width  = gViewportWidth;             // Target window size
+    swapDesc.Height = gViewportHeight;            // --"--
+    swapDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM; // Pixel format of target window
+    swapDesc.BufferUsage = DXGI_USAGE_RENDER_TARGET_OUTPUT;
+    swapDesc.SampleDesc.Count   = 1;
+    swapDesc.SampleDesc.Quality = 0;
+    swapDesc.SwapEffect  = DXGI_SWAP_EFFECT_FLIP_DISCARD;
+    swapDesc.BufferCount = SWAP_CHAIN_BUFFERS;
+    swapDesc.Flags = DXGI_SWAP_CHAIN_FLAG_FRAME_LATENCY_WAITABLE_OBJECT |
+                     (gTearingSupported ? DXGI_SWAP_CHAIN_FLAG_ALLOW_TEARING : 0);
+
+    IDXGISwapChain1* swapChain = nullptr;
+    hr = factory->CreateSwapChainForHwnd(gD3DDevice, gHWnd, &swapDesc, nullptr, nullptr, &swapChain);
+    gFlipModel = SUCCEEDED(hr);
+    if (!gFlipModel)
+    {
+        // Older versions of Windows - a single back buffer copied to the window
+        gTearingSupported = false;
+        swapDesc.SwapEffect  = DXGI_SWAP_EFFECT_DISCARD; // Use DXGI_SWAP_EFFECT_SEQUENTIAL to retain the previous back buffer (for feedback blur effects)
+        swapDesc.BufferCount = 1;
+        swapDesc.Flags = 0;
+        hr = factory->CreateSwapChainForHwnd(gD3DDevice, gHWnd, &swapDesc, nullptr, nullptr, &swapChain);
+    }
+
+    // The app doesn't handle the switches to full screen that DXGI makes on Alt+Enter (and tearing only works windowed)
+    factory->MakeWindowAssociation(gHWnd, DXGI_MWA_NO_ALT_ENTER);
+    factory->Release();
+    if (FAILED(hr))
+    {
+        gLastError = "Error creating swap chain";
+        return false;
+    }
+    gSwapChain = swapChain;
+
+    // Limit how many frames can be queued up for the GPU. Each queued frame adds a frame of latency between input and the
+    // screen, but with none the CPU would wait for the GPU every frame. Then get the object to wait on before each frame
+    if (gFlipModel)
+    {
+        IDXGISwapChain2* swapChain2 = nullptr;
+        if (SUCCEEDED(gSwapChain->QueryInterface(__uuidof(IDXGISwapChain2), reinterpret_cast<void**>(&swapChain2))))
+        {
+            swapChain2->SetMaximumFrameLatency(MAX_FRAME_LATENCY);
+            gFrameLatencyWaitable = swapChain2->GetFrameLatencyWaitableObject();
+            swapChain2->Release();
+        }
+    }
     return true;
 }
 
 
+//--------------------------------------------------------------------------------------
+// Presenting
+//--------------------------------------------------------------------------------------
+
+namespace
+{
+    // The present thread, if it is running (see SetPresentThread), and the frame handed to it. A frame is pending from when
+    // PresentFrame hands it over until it has been presented and the swap chain can take another
+    std::thread             gPresentThread;
+    std::mutex              gPresentMutex;
+    std::condition_variable gPresentWake; // A frame has been handed over or the thread should stop
+    std::condition_variable gPresentDone; // The pending frame has been presented
+    bool                    gPresentPending  = false;
+    bool                    gPresentStop     = false;
+    UINT                    gPresentInterval = 0;
+    UINT                    gPresentFlags    = 0;
+
+    // Whether the last present couldn't be seen, set by the present thread when it is running
+    std::atomic<bool>       gSwapChainOccluded{ false };
+
+    // Wait until the swap chain can take another frame, timing out in case a frame is lost
+    void WaitForFrameLatency()
+    {
+        if (gFrameLatencyWaitable)  WaitForSingleObjectEx(gFrameLatencyWaitable, 1000, TRUE);
+    }
+
+    // Present each frame handed over, then wait for the swap chain, until told to stop. A pending frame is presented first
+    void PresentThread()
+    {
+        std::unique_lock<std::mutex> lock(gPresentMutex);
+        while (true)
+        {
+            gPresentWake.wait(lock, [] { return gPresentPending || gPresentStop; });
+            if (gPresentPending)
+            {
+                UINT interval = gPresentInterval;
+                UINT flags    = gPresentFlags;
+                lock.unlock();
+                gSwapChainOccluded = (gSwapChain->Present(interval, flags) == DXGI_STATUS_OCCLUDED);
+                WaitForFrameLatency();
+                lock.lock();
+                gPresentPending = false;
+                gPresentDone.notify_all();
+            }
+            if (gPresentStop)  return;
+        }
+    }
+
+    // Wait until the frame handed to the present thread has been presented, if there is one
+    void WaitForPresent()
+    {
+        std::unique_lock<std::mutex> lock(gPresentMutex);
+        gPresentDone.wait(lock, [] { return !gPresentPending; });
+    }
+}
+
+
+// Wait until the swap chain can take another frame. Call before starting work on each frame, so the CPU reads input and
+// updates the scene as late as possible rather than running frames ahead of what is on screen. With the present thread it
+// waits for the thread, which presents the last frame and then waits for the swap chain itself
+void WaitForSwapChain()
+{
+    if (gPresentThread.joinable())
+    {
+        WaitForPresent();
+        return;
+    }
+    WaitForFrameLatency();
+}
+
+
+// Show the back buffer that has been rendered. With vsync the image is shown at the next monitor refresh. Without vsync it
+// is shown straight away, which can tear if the system supports it, otherwise (flip model) it may replace a waiting frame.
+// With the present thread the frame is handed to it and this returns straight away
+void PresentFrame(bool vsync)
+{
+    UINT presentFlags = (!vsync && gTearingSupported) ? DXGI_PRESENT_ALLOW_TEARING : 0;
+    if (!gPresentThread.joinable())
+    {
+        gSwapChainOccluded = (gSwapChain->Present(vsync ? 1 : 0, presentFlags) == DXGI_STATUS_OCCLUDED);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(gPresentMutex);
+    gPresentInterval = vsync ? 1 : 0;
+    gPresentFlags    = presentFlags;
+    gPresentPending  = true;
+    gPresentWake.notify_one();
+}
+
+
+// Whether the last frame presented couldn't be seen - the window is minimised or hidden, so Present returned
+// DXGI_STATUS_OCCLUDED. With the present thread this is the last frame it has presented
+bool SwapChainOccluded()
+{
+    return gSwapChainOccluded;
+}
+
+
+// Ask the swap chain whether a frame presented now would be seen, without presenting one (DXGI_PRESENT_TEST), updating
+// SwapChainOccluded. Call between frames, it waits for the present thread's frame first
+bool TestPresent()
+{
+    if (gPresentThread.joinable())  WaitForPresent();
+    gSwapChainOccluded = (gSwapChain->Present(0, DXGI_PRESENT_TEST) == DXGI_STATUS_OCCLUDED);
+    return !gSwapChainOccluded;
+}
+
+
+// Start or stop presenting on a thread of its own. Call between frames. Stopping waits for the last frame to be presented
+void SetPresentThread(bool enable)
+{
+    if (enable == gPresentThread.joinable())  return;
+    if (enable)
+    {
+        gPresentStop = false;
+        gPresentThread = std::thread(PresentThread);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(gPresentMutex);
+        gPresentStop = true;
+        gPresentWake.notify_one();
+    }
+    gPresentThread.join();
+}
+
+
+// Video memory used by the app and the amount the system gives it before it must start moving resources out, in bytes. The
+// local segment group is the memory on the graphics card (or the share of system memory for integrated graphics)
+// Both are 0 where this isn't supported (DXGI 1.4 is Windows 10 onwards)
+void VideoMemoryUsage(uint64_t& used, uint64_t& budget)
+{
+    used = budget = 0;
+    if (!gDXGIAdapter3Fetched)
+    {
+        gDXGIAdapter3Fetched = true;
+        IDXGIDevice*  dxgiDevice  = nullptr;
+        IDXGIAdapter* dxgiAdapter = nullptr;
+        HRESULT hr = gD3DDevice->QueryInterface(__uuidof(IDXGIDevice), reinterpret_cast<void**>(&dxgiDevice));
+        if (SUCCEEDED(hr))  hr = dxgiDevice->GetAdapter(&dxgiAdapter);
+        if (SUCCEEDED(hr))  dxgiAdapter->QueryInterface(__uuidof(IDXGIAdapter3), reinterpret_cast<void**>(&gDXGIAdapter3));
+        if (dxgiAdapter)  dxgiAdapter->Release();
+        if (dxgiDevice)   dxgiDevice->Release();
+    }
+    if (gDXGIAdapter3 == nullptr)  return;
+
+    DXGI_QUERY_VIDEO_MEMORY_INFO info;
+    if (SUCCEEDED(gDXGIAdapter3->QueryVideoMemoryInfo(0, DXGI_MEMORY_SEGMENT_GROUP_LOCAL, &info)))
+    {
+        used   = info.CurrentUsage;
+        budget = info.Budget;
+    }
+}
+
+
 // Release the memory held by all objects created
 void ShutdownDirect3D()
 {
+    SetPresentThread(false);
+
     // Release each Direct3D object to return resources to the system. Leaving these out will cause memory
     // leaks. Check documentation to see which objects need to be released when adding new features in your
     // own projects.
-    if (gD3DContext)
+    if (gD3DImmediateContext)
     {
-        gD3DContext->ClearState(); // This line is also needed to reset the GPU before shutting down DirectX
-        gD3DContext->Release();
+        gD3DImmediateContext->ClearState(); // This line is also needed to reset the GPU before shutting down DirectX
+        gD3DImmediateContext->Release();
     }
+    gD3DContext = nullptr;
     if (gDepthShaderView)        gDepthShaderView->Release();
     if (gDepthStencil)           gDepthStencil->Release();
     if (gDepthStencilTexture)    gDepthStencilTexture->Release();
     if (gBackBufferRenderTarget) gBackBufferRenderTarget->Release();
 	if (gBackBufferTexture)      gBackBufferTexture->Release();
 
+    if (gDXGIAdapter3)           gDXGIAdapter3->Release();
+    gDXGIAdapter3 = nullptr;
+    gDXGIAdapter3Fetched = false;
+    if (gFrameLatencyWaitable)   CloseHandle(gFrameLatencyWaitable);
     if (gSwapChain)              gSwapChain->Release();
     if (gD3DDevice)              gD3DDevice->Release();
 }
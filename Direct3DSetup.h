@@ -1,3 +1,5 @@
+#include "stdint.h"
+
 #ifndef _DIRECT3D_SETUP_H_INCLUDED_
 #define _DIRECT3D_SETUP_H_INCLUDED_
 
@@ -5,8 +7,55 @@
 // Initialisation of Direct3D and main resources
 //--------------------------------------------------------------------------------------
 
-// Returns false on failure
-bool InitDirect3D();
+// Back buffers in the swap chain and how many frames can be queued for the GPU, when using the flip model (see
+// CreateSwapChain). Three buffers let the CPU start a new frame while one is on screen and one is waiting to be shown. A
+// latency of one frame gives the quickest response to input, but the CPU may wait for the GPU when a frame takes longer
+const unsigned int SWAP_CHAIN_BUFFERS = 3;
+const unsigned int MAX_FRAME_LATENCY  = 2;
+
+// Create the device on WARP, the software rasteriser, instead of the GPU if softwareDevice is set, e.g. to measure the CPU
+// cost of the DirectX calls without a GPU driver (see RunRenderBenchmark). Returns false on failure
+bool InitDirect3D(bool softwareDevice = false);
+
+// Create the swap chain for the window, called by InitDirect3D. Returns false on failure
+bool CreateSwapChain();
+
+// Whether the main pass can be rendered with the given number of samples per pixel (MSAA)
+bool MultisampleSupported(unsigned int samples);
+
+// Create the depth buffer for the main pass with the given number of samples per pixel, replacing any existing one. Called by
+// InitDirect3D with gMSAASamples, call again when that changes. Returns false on failure
+bool CreateMainDepthBuffer(unsigned int samples);
+
+// Resize the back buffers and the main depth buffer to the viewport size (gViewportWidth / Height), when the window has
+// changed size. Call between frames. Returns false on failure
+bool ResizeSwapChain();
+
+// Wait until the swap chain can take another frame, call before starting work on each frame
+void WaitForSwapChain();
+
+// Show the back buffer that has been rendered, waiting for the next monitor refresh if vsync is requested
+void PresentFrame(bool vsync);
+
+// Whether the last frame presented couldn't be seen, because the window is minimised or hidden (DXGI_STATUS_OCCLUDED from
+// Present). While it is there is no point rendering, see the frame loop in Main.cpp
+bool SwapChainOccluded();
+
+// Ask the swap chain whether a frame presented now would be seen, without presenting one. Updates SwapChainOccluded. Returns
+// true if it would be. Call between frames
+bool TestPresent();
+
+// Start or stop presenting on a thread of its own, which also waits for the swap chain after each frame. The main thread hands
+// each frame over and goes on - to wait for the simulation and handle messages - while the driver finishes the frame and it
+// waits for its turn on screen. WaitForSwapChain then waits for the thread. Nothing else may use the immediate context while
+// a frame is being presented, which the frame loop keeps to: the next frame starts with WaitForSwapChain (as does
+// ResizeSwapChain). The window is never full screen, where Present can send messages to the window's thread and wait for
+// them. Call between frames, stopping waits for the last frame to be presented
+void SetPresentThread(bool enable);
+
+// Video memory used by the app and the amount the system gives it before it must start moving resources out, in bytes
+// Both are 0 where this isn't supported (before Windows 10)
+void VideoMemoryUsage(uint64_t& used, uint64_t& budget);
 
 // Release the memory held by all objects created
 void ShutdownDirect3D();
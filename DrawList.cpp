@@ -0,0 +1,52 @@
+//--------------------------------------------------------------------------------------
+// Draw list - the draws of a pass in the order that changes the least state between them
+//--------------------------------------------------------------------------------------
+
+#include "DrawList.h"
+#include "SceneObjects.h"
+
+#include <algorithm>
+#include <cstring>
+
+
+// Make the sort key of a draw from its fields
+uint64_t DrawList::SortKey(MaterialPass pass, int shaderID, int materialID, int meshID, float depth)
+{
+	// Each ID is clamped to the largest value its bits can hold
+	auto field = [](int value, int bits)
+	{
+		uint64_t maxValue = (uint64_t(1) << bits) - 1;
+		return (std::min)(static_cast<uint64_t>((std::max)(value, 0)), maxValue);
+	};
+
+	// The bits of a positive float sort in the same order as the float, so the depth is the top bits of the float's bits
+	// below the sign bit - in effect a float with a shorter mantissa, precise near the camera and coarse far away
+	depth = (std::max)(depth, 0.0f);
+	uint32_t depthBits;
+	std::memcpy(&depthBits, &depth, sizeof(depthBits));
+	uint64_t quantisedDepth = depthBits >> (31 - DepthBits);
+
+	uint64_t key = field(static_cast<int>(pass), PassBits);
+	key = (key << ShaderBits)   | field(shaderID,   ShaderBits);
+	key = (key << MaterialBits) | field(materialID, MaterialBits);
+	key = (key << MeshBits)     | field(meshID,     MeshBits);
+	key = (key << DepthBits)    | quantisedDepth;
+	return key;
+}
+
+
+// Fill the list with a draw for each of the given scene objects in the given kind of pass, sorted by key
+void DrawList::Build(const SceneObjects& objects, const std::vector<int>& visible, MaterialPass pass, const CVector3& cameraPosition)
+{
+	mDraws.clear(); // Keeps its memory, so only allocates when there are more draws than ever before
+	for (int object : visible)
+	{
+		const BoundingSphere& bounds = objects.Bounds(object);
+		float depth = Length(bounds.centre - cameraPosition) - bounds.radius;
+		int material = objects.MaterialID(object);
+		mDraws.push_back({ SortKey(pass, objects.ShaderID(material), material, objects.MeshID(object), depth), object });
+	}
+
+	// std::sort doesn't allocate. Draws with equal keys are drawn the same way, so their order doesn't matter
+	std::sort(mDraws.begin(), mDraws.end(), [](const Draw& a, const Draw& b) { return a.key < b.key; });
+}
@@ -0,0 +1,65 @@
+//--------------------------------------------------------------------------------------
+// Draw list - the draws of a pass in the order that changes the least state between them
+//--------------------------------------------------------------------------------------
+// Each visible scene object is given a 64-bit sort key, made of (from the highest bits) the kind
+// of pass, the object's shaders, its material, its mesh and its distance from the camera. Sorting
+// the keys as plain integers puts the draws that share shaders together, then within those the
+// draws that share a material, then a mesh, and nearest first within those so the depth test
+// can skip hidden pixels early. The draw loop then only binds what changes between one draw and
+// the next (see RenderLitModels in Scene.cpp).
+//
+// Each pass (and each thread recording one) has its own list. The list keeps its memory from one
+// pass to the next, so building and sorting it every pass doesn't allocate.
+
+#include "Material.h"
+#include "CVector3.h"
+#include <vector>
+#include "stdint.h"
+
+#ifndef _DRAW_LIST_H_INCLUDED_
+#define _DRAW_LIST_H_INCLUDED_
+
+class SceneObjects;
+
+class DrawList
+{
+//--------------------------------------------------------------------------------------
+// Construction / Usage
+//--------------------------------------------------------------------------------------
+public:
+
+	struct Draw
+	{
+		uint64_t key;
+		int      object; // Index in the scene objects
+	};
+
+
+	// Make the sort key of a draw from its fields. IDs past the number of bits kept for them share the highest value, which
+	// only makes the order less good. The depth is any positive distance from the camera
+	static uint64_t SortKey(MaterialPass pass, int shaderID, int materialID, int meshID, float depth);
+
+	// Fill the list with a draw for each of the given scene objects in the given kind of pass, sorted by key. The depths
+	// are the distances of the objects' bounding spheres from the camera position given
+	void Build(const SceneObjects& objects, const std::vector<int>& visible, MaterialPass pass, const CVector3& cameraPosition);
+
+	const std::vector<Draw>& Draws() const  { return mDraws; }
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions / data
+//--------------------------------------------------------------------------------------
+private:
+
+	// Bits of the sort key for each field, from the highest. They add up to 64
+	static constexpr int PassBits     = 3;
+	static constexpr int ShaderBits   = 10;
+	static constexpr int MaterialBits = 16;
+	static constexpr int MeshBits     = 16;
+	static constexpr int DepthBits    = 19;
+
+	std::vector<Draw> mDraws;
+};
+
+
+#endif //_DRAW_LIST_H_INCLUDED_
@@ -0,0 +1,54 @@
+//--------------------------------------------------------------------------------------
+// Class choosing the resolution to render at to keep to a GPU frame time
+//--------------------------------------------------------------------------------------
+
+#include "DynamicResolution.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+// Call each time there is a new GPU time (see GpuProfiler::CompletedFrames) with the milliseconds taken by the passes
+// being scaled and the milliseconds they should take
+void DynamicResolution::Update(float gpuTime, float targetTime)
+{
+	if (mFramesToSkip > 0)
+	{
+		--mFramesToSkip;
+		return;
+	}
+	if (gpuTime <= 0 || targetTime <= 0)  return; // Passes not rendered, e.g. no water in view
+
+	// Single slow frames (e.g. a texture being streamed in) shouldn't drop the resolution on their own
+	mSmoothedTime = (mSmoothedTime == 0) ? gpuTime : mSmoothedTime + (gpuTime - mSmoothedTime) * 0.3f;
+	if (std::abs(mSmoothedTime - targetTime) < targetTime * Deadband)  return;
+
+	// The time taken goes up with the number of pixels, i.e. with the square of the scale
+	float wantedScale = mScale * std::sqrt(targetTime / mSmoothedTime);
+	float scale = mScale + (wantedScale - mScale) * Damping;
+	scale = std::round(scale / ScaleStep) * ScaleStep;
+	scale = (std::min)((std::max)(scale, mMinScale), mMaxScale);
+	if (scale == mScale)  return;
+
+	// The smoothed time was for the old scale, adjust it to match the new one
+	mSmoothedTime *= (scale * scale) / (mScale * mScale);
+	mScale = scale;
+	mFramesToSkip = SettleFrames;
+}
+
+
+// Go back to the largest scale, e.g. when dynamic resolution is switched off
+void DynamicResolution::Reset()
+{
+	mScale = mMaxScale;
+	mSmoothedTime = 0;
+	mFramesToSkip = 0;
+}
+
+
+// The largest scale used, 1 for full resolution. Moves the current scale to it
+void DynamicResolution::SetMaxScale(float maxScale)
+{
+	mMaxScale = (std::min)((std::max)(maxScale, mMinScale), 1.0f);
+	Reset();
+}
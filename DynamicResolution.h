@@ -0,0 +1,71 @@
+//--------------------------------------------------------------------------------------
+// Class choosing the resolution to render at to keep to a GPU frame time
+//--------------------------------------------------------------------------------------
+// The time the GPU takes for a frame changes with what is in view - looking across a lot of
+// water needs large refraction and reflection passes, looking at the ground doesn't. Rather
+// than pick one resolution for the worst case, passes can be rendered into a smaller part of
+// their render targets when they take too long and upscaled afterwards. The targets are
+// created at full size, so changing scale never creates or releases anything.
+//
+// The GPU times used arrive a few frames late (see GpuProfiler), so after each change the
+// controller waits for times from frames rendered at the new scale before changing again,
+// otherwise it overshoots and the resolution swings back and forth.
+
+#ifndef _DYNAMIC_RESOLUTION_H_INCLUDED_
+#define _DYNAMIC_RESOLUTION_H_INCLUDED_
+
+
+class DynamicResolution
+{
+//--------------------------------------------------------------------------------------
+// Construction / Usage
+//--------------------------------------------------------------------------------------
+public:
+
+	// The smallest scale that will be used, i.e. the passes are never rendered at less than this fraction of each side
+	DynamicResolution(float minScale = 0.5f) : mMinScale(minScale) {}
+
+
+	// Call each time there is a new GPU time (see GpuProfiler::CompletedFrames) with the milliseconds taken by the passes
+	// being scaled and the milliseconds they should take
+	void Update(float gpuTime, float targetTime);
+
+	// Go back to the largest scale, e.g. when dynamic resolution is switched off
+	void Reset();
+
+	// The largest scale used, 1 for full resolution. Less than 1 renders below the viewport resolution all the time and
+	// relies on the upscaling to make up for it (see PostProcess::SetUpscaling). Moves the current scale to it
+	void SetMaxScale(float maxScale);
+	float MaxScale()  { return mMaxScale; }
+
+
+	// Fraction of each side of the render targets to render to this frame, between the minimum and maximum scales
+	float Scale()  { return mScale; }
+
+
+//--------------------------------------------------------------------------------------
+// Private data
+//--------------------------------------------------------------------------------------
+private:
+
+	// Results to skip after a change, the frames already in flight on the GPU were rendered at the old scale
+	static constexpr int SettleFrames = 5;
+
+	// Changes smaller than this fraction of the time are ignored, so noise in the timings doesn't keep changing the scale
+	static constexpr float Deadband = 0.05f;
+
+	// How much of the way to the estimated scale each change moves, less than 1 to avoid overshooting
+	static constexpr float Damping = 0.6f;
+
+	// Scales are rounded to multiples of this, so the resolution only ever takes a small number of values
+	static constexpr float ScaleStep = 1.0f / 32;
+
+	float mMinScale;
+	float mMaxScale = 1;
+	float mScale = 1;
+	float mSmoothedTime = 0; // Smoothed over a few frames, 0 until the first time arrives
+	int   mFramesToSkip = 0;
+};
+
+
+#endif //_DYNAMIC_RESOLUTION_H_INCLUDED_
@@ -0,0 +1,129 @@
+//--------------------------------------------------------------------------------------
+// Environment cube map for distant water reflections
+//--------------------------------------------------------------------------------------
+
+#include "EnvironmentMap.h"
+#include "Common.h"
+#include "GraphicsHelpers.h"
+#include "PostProcess.h"
+#include "GpuEvents.h"
+#include "GpuMemory.h"
+
+#include <stdexcept>
+
+
+// Create the cube map with faces of the given size in pixels
+// Will throw a std::runtime_error exception on failure (same as Mesh)
+EnvironmentMap::EnvironmentMap(unsigned int size /*= 256*/)
+	: mSize(size)
+{
+	// Six faces in one texture array, with mip-maps generated from the top level after rendering (see GenerateMips)
+	D3D11_TEXTURE2D_DESC textureDesc = {};
+	textureDesc.Width  = size;
+	textureDesc.Height = size;
+	textureDesc.MipLevels = 0; // Full chain of mip-maps
+	textureDesc.ArraySize = 6;
+	textureDesc.Format = PostProcess::HDRFormat; // Reflected by the water, so the lights stay bright in it
+	textureDesc.SampleDesc.Count = 1;
+	textureDesc.Usage = D3D11_USAGE_DEFAULT;
+	textureDesc.BindFlags = D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE;
+	textureDesc.MiscFlags = D3D11_RESOURCE_MISC_TEXTURECUBE | D3D11_RESOURCE_MISC_GENERATE_MIPS;
+	if (FAILED(gD3DDevice->CreateTexture2D(&textureDesc, nullptr, &mTexture)))
+	{
+		Release();
+		throw std::runtime_error("Error creating environment map");
+	}
+
+	// A render target for the top level of each face
+	for (unsigned int face = 0; face < 6; ++face)
+	{
+		D3D11_RENDER_TARGET_VIEW_DESC rtDesc = {};
+		rtDesc.Format = textureDesc.Format;
+		rtDesc.ViewDimension = D3D11_RTV_DIMENSION_TEXTURE2DARRAY;
+		rtDesc.Texture2DArray.MipSlice = 0;
+		rtDesc.Texture2DArray.FirstArraySlice = face;
+		rtDesc.Texture2DArray.ArraySize = 1;
+		if (FAILED(gD3DDevice->CreateRenderTargetView(mTexture, &rtDesc, &mFaceRenderTargets[face])))
+		{
+			Release();
+			throw std::runtime_error("Error creating environment map render targets");
+		}
+	}
+
+	D3D11_SHADER_RESOURCE_VIEW_DESC srDesc = {};
+	srDesc.Format = textureDesc.Format;
+	srDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURECUBE;
+	srDesc.TextureCube.MostDetailedMip = 0;
+	srDesc.TextureCube.MipLevels = static_cast<UINT>(-1);
+	if (FAILED(gD3DDevice->CreateShaderResourceView(mTexture, &srDesc, &mSRV)) ||
+		!CreateDepthBuffer(size, size, &mDepthStencilTexture, &mDepthStencil))
+	{
+		Release();
+		throw std::runtime_error("Error creating environment map views");
+	}
+	SetDebugNames("Environment Map", mTexture, mSRV);
+	SetDebugNames("Environment Map Depth", mDepthStencilTexture, nullptr, nullptr, mDepthStencil);
+	RegisterGpuResource(mTexture, "Environment Map");
+	RegisterGpuResource(mDepthStencilTexture, "Environment Map");
+}
+
+EnvironmentMap::~EnvironmentMap()
+{
+	Release();
+}
+
+
+// Choose the faces to render this frame and the point they are seen from. Call once per frame before rendering. All six
+// faces are chosen on the first call and after Invalidate, otherwise the next face in turn
+void EnvironmentMap::Update(CVector3 position)
+{
+	mPosition = position;
+	if (mValidFaces < 6)
+	{
+		mFirstFace = 0;
+		mNumFaces  = 6;
+		mValidFaces = 6;
+	}
+	else
+	{
+		mFirstFace = (mFirstFace + mNumFaces) % 6;
+		mNumFaces  = 1;
+	}
+}
+
+
+// A camera looking out through the given face (0-5 for +x, -x, +y, -y, +z, -z) from the point chosen by Update
+Camera EnvironmentMap::FaceCamera(unsigned int face)
+{
+	// Direction and up vector for each face, in the order DirectX expects the faces of a cube map
+	static const CVector3 forwards[6] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1,  0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+	static const CVector3 ups[6]      = { { 0, 1, 0 }, {  0, 1, 0 }, { 0, 0, -1 }, { 0,  0, 1 }, { 0, 1, 0 }, { 0, 1,  0 } };
+
+	// 90 degree field of view and a square aspect ratio, so the six faces meet exactly. There is no far plane (see Camera.cpp)
+	Camera camera(mPosition, { 0, 0, 0 }, PI / 2, 1.0f, 1.0f, 100000.0f);
+	face %= 6;
+	camera.ZAxis() = forwards[face];
+	camera.YAxis() = ups[face];
+	camera.XAxis() = Cross(ups[face], forwards[face]);
+	return camera;
+}
+
+
+// Make the mip-maps of all the faces from their top levels, call once the faces chosen this frame are rendered
+void EnvironmentMap::GenerateMips()
+{
+	gD3DContext->GenerateMips(mSRV);
+}
+
+
+void EnvironmentMap::Release()
+{
+	if (mDepthStencil)         { mDepthStencil->Release();         mDepthStencil         = nullptr; }
+	if (mDepthStencilTexture)  { mDepthStencilTexture->Release();  mDepthStencilTexture  = nullptr; }
+	if (mSRV)                  { mSRV->Release();                  mSRV                  = nullptr; }
+	for (auto& renderTarget : mFaceRenderTargets)
+	{
+		if (renderTarget)  { renderTarget->Release();  renderTarget = nullptr; }
+	}
+	if (mTexture)              { mTexture->Release();              mTexture              = nullptr; }
+}
@@ -0,0 +1,79 @@
+//--------------------------------------------------------------------------------------
+// Environment cube map for distant water reflections
+//--------------------------------------------------------------------------------------
+// The planar reflection renders the whole scene again, mirrored, every frame. Far from the
+// camera the water is small on screen and the waves blur its reflection, so a cube map of the
+// scene around the water is good enough there. The cube map is captured from the water surface
+// under the camera. All six faces are rendered the first time, then one face each frame, so
+// the cost is a small fraction of a full reflection pass. Mip-maps are made after each face is
+// rendered and the water shader samples the blurrier ones where the waves are rough.
+
+#include "Camera.h"
+#include "CVector3.h"
+#include <d3d11.h>
+
+#ifndef _ENVIRONMENT_MAP_H_INCLUDED_
+#define _ENVIRONMENT_MAP_H_INCLUDED_
+
+class EnvironmentMap
+{
+//--------------------------------------------------------------------------------------
+// Construction / Usage
+//--------------------------------------------------------------------------------------
+public:
+
+	// Create the cube map with faces of the given size in pixels
+	// Will throw a std::runtime_error exception on failure (same as Mesh)
+	EnvironmentMap(unsigned int size = 256);
+	~EnvironmentMap();
+
+
+	// Choose the faces to render this frame and the point they are seen from. Call once per frame before rendering. All six
+	// faces are chosen on the first call and after Invalidate, otherwise the next face in turn
+	void Update(CVector3 position);
+
+	// Capture all six faces again on the next Update, e.g. when the map hasn't been updated for a while
+	void Invalidate()  { mValidFaces = 0; }
+
+
+	// Faces chosen by the last Update, render face FirstFace() to FirstFace() + NumFaces() - 1 (wrapping round after 5)
+	unsigned int FirstFace()  { return mFirstFace; }
+	unsigned int NumFaces()   { return mNumFaces; }
+
+	// A camera looking out through the given face (0-5 for +x, -x, +y, -y, +z, -z) from the point chosen by Update
+	Camera FaceCamera(unsigned int face);
+
+	// Targets for rendering a face. Call GenerateMips once the faces chosen this frame are rendered
+	ID3D11RenderTargetView* FaceRenderTarget(unsigned int face)  { return mFaceRenderTargets[face % 6]; }
+	ID3D11DepthStencilView* DepthStencil()  { return mDepthStencil; }
+	unsigned int            Size()          { return mSize; }
+	void GenerateMips();
+
+	// The cube map for the water shader
+	ID3D11ShaderResourceView* SRV()  { return mSRV; }
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions / data
+//--------------------------------------------------------------------------------------
+private:
+
+	void Release();
+
+	unsigned int mSize;
+	CVector3     mPosition;
+	unsigned int mValidFaces = 0; // Faces captured since creation or Invalidate, there is nothing to show until all six are
+	unsigned int mFirstFace  = 0;
+	unsigned int mNumFaces   = 0;
+
+	ID3D11Texture2D*          mTexture = nullptr;
+	ID3D11RenderTargetView*   mFaceRenderTargets[6] = {};
+	ID3D11ShaderResourceView* mSRV = nullptr;
+
+	// One depth buffer for all the faces, they are rendered one after another
+	ID3D11Texture2D*        mDepthStencilTexture = nullptr;
+	ID3D11DepthStencilView* mDepthStencil = nullptr;
+};
+
+
+#endif //_ENVIRONMENT_MAP_H_INCLUDED_
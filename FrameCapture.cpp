@@ -0,0 +1,396 @@
+//--------------------------------------------------------------------------------------
+// Frame capture - every Nth frame saved as an image, to compare the pictures of two builds
+//--------------------------------------------------------------------------------------
+
+#include "FrameCapture.h"
+#include "GpuReadback.h"
+#include "Benchmark.h"
+#include "Common.h"
+
+#include <Windows.h>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <stdexcept>
+#include <cstring>
+#include <cmath>
+
+
+FrameCapture* gFrameCapture = nullptr;
+
+
+//--------------------------------------------------------------------------------------
+// BMP files
+//--------------------------------------------------------------------------------------
+
+// Captures are uncompressed 24-bit BMP files: lossless, quick to write and read back, and opened by any image viewer or
+// diff tool. Alpha isn't saved, the back buffer's alpha isn't part of the picture
+
+// The file for the given frame in the given folder
+static std::wstring CaptureFileName(const std::wstring& folder, int frame)
+{
+	std::wostringstream name;
+	name << folder << L"\\frame" << std::setw(6) << std::setfill(L'0') << frame << L".bmp";
+	return name.str();
+}
+
+// Bytes in each row of a 24-bit BMP file, rows are padded to a multiple of 4 bytes
+static unsigned int BmpRowBytes(unsigned int width)
+{
+	return (width * 3 + 3) & ~3u;
+}
+
+// Write the given 8-bit RGBA or BGRA pixels, rows top to bottom, to a BMP file. Returns false on failure
+static bool WriteBmp(const std::wstring& fileName, unsigned int width, unsigned int height, bool bgra, const uint8_t* pixels)
+{
+	unsigned int rowBytes = BmpRowBytes(width);
+
+	BITMAPFILEHEADER fileHeader = {};
+	fileHeader.bfType    = 0x4d42; // "BM"
+	fileHeader.bfOffBits = sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER);
+	fileHeader.bfSize    = fileHeader.bfOffBits + rowBytes * height;
+
+	BITMAPINFOHEADER infoHeader = {};
+	infoHeader.biSize        = sizeof(BITMAPINFOHEADER);
+	infoHeader.biWidth       = width;
+	infoHeader.biHeight      = height; // Positive for rows bottom to top
+	infoHeader.biPlanes      = 1;
+	infoHeader.biBitCount    = 24;
+	infoHeader.biCompression = BI_RGB;
+	infoHeader.biSizeImage   = rowBytes * height;
+
+	std::ofstream file(fileName, std::ios::binary);
+	file.write(reinterpret_cast<const char*>(&fileHeader), sizeof(fileHeader));
+	file.write(reinterpret_cast<const char*>(&infoHeader), sizeof(infoHeader));
+
+	// BMP pixels are BGR
+	int red = bgra ? 2 : 0;
+	int blue = bgra ? 0 : 2;
+	std::vector<uint8_t> row(rowBytes, 0);
+	for (unsigned int y = height; y-- > 0; )
+	{
+		const uint8_t* source = pixels + static_cast<size_t>(y) * width * 4;
+		for (unsigned int x = 0; x < width; ++x, source += 4)
+		{
+			row[x * 3 + 0] = source[blue];
+			row[x * 3 + 1] = source[1];
+			row[x * 3 + 2] = source[red];
+		}
+		file.write(reinterpret_cast<const char*>(row.data()), rowBytes);
+	}
+	return static_cast<bool>(file);
+}
+
+// Read a 24-bit BMP file as written by WriteBmp, into BGR pixels with rows bottom to top and no padding
+// Returns false if the file can't be read or isn't a 24-bit uncompressed BMP
+static bool ReadBmp(const std::wstring& fileName, unsigned int& width, unsigned int& height, std::vector<uint8_t>& pixels)
+{
+	std::ifstream file(fileName, std::ios::binary);
+	BITMAPFILEHEADER fileHeader;
+	BITMAPINFOHEADER infoHeader;
+	file.read(reinterpret_cast<char*>(&fileHeader), sizeof(fileHeader));
+	file.read(reinterpret_cast<char*>(&infoHeader), sizeof(infoHeader));
+	if (!file || fileHeader.bfType != 0x4d42 || infoHeader.biBitCount != 24 || infoHeader.biCompression != BI_RGB ||
+	    infoHeader.biWidth <= 0 || infoHeader.biHeight <= 0)  return false;
+
+	width  = infoHeader.biWidth;
+	height = infoHeader.biHeight;
+	unsigned int rowBytes = BmpRowBytes(width);
+	pixels.resize(static_cast<size_t>(width) * height * 3);
+	std::vector<uint8_t> row(rowBytes);
+	file.seekg(fileHeader.bfOffBits);
+	for (unsigned int y = 0; y < height; ++y)
+	{
+		file.read(reinterpret_cast<char*>(row.data()), rowBytes);
+		std::memcpy(pixels.data() + static_cast<size_t>(y) * width * 3, row.data(), width * 3);
+	}
+	return static_cast<bool>(file);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Construction
+//--------------------------------------------------------------------------------------
+
+// Capture one frame in every given number to numbered files in the given folder, which is made if it doesn't exist
+// Will throw a std::runtime_error exception on failure (same as Mesh)
+FrameCapture::FrameCapture(const std::wstring& folder, int interval)
+	: mFolder(folder), mInterval(interval)
+{
+	if (mInterval <= 0)  throw std::runtime_error("Frame capture interval must be at least 1");
+	if (!CreateDirectoryW(mFolder.c_str(), nullptr) && GetLastError() != ERROR_ALREADY_EXISTS)
+	{
+		throw std::runtime_error("Error creating frame capture folder");
+	}
+
+	mThread = std::thread(&FrameCapture::WriteImages, this);
+}
+
+// Writes the images already copied back, drops those still on the GPU
+FrameCapture::~FrameCapture()
+{
+	if (gGpuReadback != nullptr)  gGpuReadback->Cancel(this);
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mQuit = true;
+	}
+	mQueued.notify_one();
+	mThread.join();
+}
+
+
+//--------------------------------------------------------------------------------------
+// Usage
+//--------------------------------------------------------------------------------------
+
+// Copy the given back buffer back to be saved as the given frame number, if it is one of the frames to capture. Call after the
+// frame has been drawn, before it is presented, on the immediate context
+void FrameCapture::Capture(ID3D11Texture2D* backBuffer, int frame)
+{
+	if (frame < 0 || frame % mInterval != 0)  return;
+
+	// Only 8-bit back buffers are saved, which is what the swap chain uses (see Direct3DSetup.cpp)
+	D3D11_TEXTURE2D_DESC desc;
+	backBuffer->GetDesc(&desc);
+	bool bgra = (desc.Format == DXGI_FORMAT_B8G8R8A8_UNORM || desc.Format == DXGI_FORMAT_B8G8R8A8_UNORM_SRGB);
+	bool rgba = (desc.Format == DXGI_FORMAT_R8G8B8A8_UNORM || desc.Format == DXGI_FORMAT_R8G8B8A8_UNORM_SRGB);
+
+	// Drop the capture rather than wait if the writes have fallen behind, the readback drops it if the GPU has
+	size_t queued;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		queued = mQueue.size();
+	}
+	if ((!bgra && !rgba) || static_cast<int>(queued) + mCopying >= MaxQueuedImages)
+	{
+		++mDropped;
+		return;
+	}
+
+	if (gGpuReadback->Read(this, backBuffer, 0, nullptr, CopyArrived, mNextCopy))
+	{
+		mCopies[mNextCopy] = { frame, desc.Width, desc.Height, bgra };
+		mNextCopy = (mNextCopy + 1) % GpuReadback::MaxCopiesPerOwner;
+		++mCopying;
+	}
+	else
+	{
+		++mDropped;
+	}
+}
+
+
+// Wait until every capture has arrived from the GPU and been written. Updates gGpuReadback, so call between frames
+// Returns false with a message in gLastError if any capture was dropped or couldn't be written
+bool FrameCapture::Finish()
+{
+	// Copies that fail (e.g. the device was lost) are dropped by the readback without a call, so stop when it has none left
+	while (mCopying > 0 && gGpuReadback->NumPending() > 0)
+	{
+		gGpuReadback->Update();
+		if (mCopying > 0)  Sleep(1);
+	}
+	mDropped += mCopying;
+	mCopying = 0;
+
+	int failedWrites;
+	{
+		std::unique_lock<std::mutex> lock(mMutex);
+		mWritten.wait(lock, [this]() { return mQueue.empty() && !mWriting; });
+		failedWrites = mFailedWrites;
+	}
+
+	if (mDropped > 0 || failedWrites > 0)
+	{
+		gLastError = "Frame capture missed " + std::to_string(mDropped) + " frames and couldn't write " + std::to_string(failedWrites);
+		return false;
+	}
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions
+//--------------------------------------------------------------------------------------
+
+// Called by GpuReadback::Update with a back buffer copy that has arrived. The mapped rows are only readable during the call,
+// so they are copied out and the rest is left to the writing thread
+void FrameCapture::CopyArrived(void* owner, int slot, const D3D11_MAPPED_SUBRESOURCE& data)
+{
+	FrameCapture* capture = static_cast<FrameCapture*>(owner);
+	const Copy& copy = capture->mCopies[slot];
+	--capture->mCopying;
+	Image image = { copy.frame, copy.width, copy.height, copy.bgra, std::vector<uint8_t>(static_cast<size_t>(copy.width) * copy.height * 4) };
+	for (unsigned int y = 0; y < copy.height; ++y)
+	{
+		std::memcpy(image.pixels.data() + static_cast<size_t>(y) * copy.width * 4, static_cast<const uint8_t*>(data.pData) + y * data.RowPitch,
+		            copy.width * 4);
+	}
+	{
+		std::lock_guard<std::mutex> lock(capture->mMutex);
+		capture->mQueue.push_back(std::move(image));
+	}
+	capture->mQueued.notify_one();
+	++capture->mCaptured;
+}
+
+
+// The writing thread, writes queued images until told to quit, then writes those left
+void FrameCapture::WriteImages()
+{
+	std::unique_lock<std::mutex> lock(mMutex);
+	while (true)
+	{
+		mQueued.wait(lock, [this]() { return mQuit || !mQueue.empty(); });
+		if (mQueue.empty())  break; // Told to quit with everything written
+
+		Image image = std::move(mQueue.front());
+		mQueue.pop_front();
+		mWriting = true;
+		lock.unlock();
+
+		bool written = WriteBmp(CaptureFileName(mFolder, image.frame), image.width, image.height, image.bgra, image.pixels.data());
+
+		lock.lock();
+		mWriting = false;
+		if (!written)  ++mFailedWrites;
+		if (mQueue.empty())  mWritten.notify_all();
+	}
+}
+
+
+//--------------------------------------------------------------------------------------
+// Comparing captures
+//--------------------------------------------------------------------------------------
+
+// A channel differing by more than this (out of 255) counts as a visible difference
+static const int VisibleDifference = 8;
+
+// How much one pair of captures differs
+struct CaptureDifference
+{
+	std::string name;
+	int         maxDifference;     // Largest difference in any channel, 0-255
+	float       meanDifference;    // Average difference over every channel
+	float       rmsDifference;     // Root mean square of the channel differences
+	float       visiblePixels;     // Fraction of pixels with a channel differing by more than VisibleDifference
+};
+
+// Compare the captures of two runs, each image in the first folder with the image of the same name in the second, and save
+// how much each pair differs to the file chosen in gBenchmark
+// Returns false with a message in gLastError if the folders can't be read, an image is missing or has a different size,
+// or the file can't be written
+bool CompareFrameCaptures()
+{
+	const std::wstring& folderA = gBenchmark.compareFolders[0];
+	const std::wstring& folderB = gBenchmark.compareFolders[1];
+
+	// The captures of the first run, in frame order
+	std::vector<std::wstring> names;
+	WIN32_FIND_DATAW found;
+	HANDLE find = FindFirstFileW((folderA + L"\\*.bmp").c_str(), &found);
+	if (find == INVALID_HANDLE_VALUE)
+	{
+		gLastError = "No frame captures found in the first folder to compare";
+		return false;
+	}
+	do
+	{
+		names.push_back(found.cFileName);
+	} while (FindNextFileW(find, &found));
+	FindClose(find);
+	std::sort(names.begin(), names.end());
+
+	std::vector<CaptureDifference> differences;
+	std::vector<uint8_t> pixelsA, pixelsB;
+	for (auto& name : names)
+	{
+		unsigned int widthA, heightA, widthB, heightB;
+		std::string shortName(name.begin(), name.end()); // Capture names are plain ASCII
+		if (!ReadBmp(folderA + L"\\" + name, widthA, heightA, pixelsA) || !ReadBmp(folderB + L"\\" + name, widthB, heightB, pixelsB))
+		{
+			gLastError = "Error reading frame capture " + shortName + " from both folders";
+			return false;
+		}
+		if (widthA != widthB || heightA != heightB)
+		{
+			gLastError = "Frame capture " + shortName + " has a different size in each folder";
+			return false;
+		}
+
+		CaptureDifference difference = { shortName, 0, 0, 0, 0 };
+		double sum = 0, sumSquares = 0;
+		size_t visible = 0;
+		for (size_t pixel = 0; pixel < pixelsA.size(); pixel += 3)
+		{
+			int pixelDifference = 0;
+			for (size_t channel = pixel; channel < pixel + 3; ++channel)
+			{
+				int channelDifference = std::abs(pixelsA[channel] - pixelsB[channel]);
+				pixelDifference = (std::max)(pixelDifference, channelDifference);
+				sum += channelDifference;
+				sumSquares += channelDifference * channelDifference;
+			}
+			difference.maxDifference = (std::max)(difference.maxDifference, pixelDifference);
+			if (pixelDifference > VisibleDifference)  ++visible;
+		}
+		size_t numPixels = pixelsA.size() / 3;
+		difference.meanDifference = static_cast<float>(sum / pixelsA.size());
+		difference.rmsDifference  = static_cast<float>(std::sqrt(sumSquares / pixelsA.size()));
+		difference.visiblePixels  = static_cast<float>(visible) / numPixels;
+		differences.push_back(difference);
+	}
+
+	// The pair that differs most, by RMS difference
+	int numDifferent = 0;
+	const CaptureDifference* worst = &differences.front();
+	for (auto& difference : differences)
+	{
+		if (difference.maxDifference > 0)  ++numDifferent;
+		if (difference.rmsDifference > worst->rmsDifference)  worst = &difference;
+	}
+
+	std::ofstream file(gBenchmark.outputFile);
+	file.precision(4);
+	file << std::fixed;
+
+	if (IsJsonOutput())
+	{
+		file << "{\n";
+		file << "  \"images\": " << differences.size() << ",\n";
+		file << "  \"different\": " << numDifferent << ",\n";
+		file << "  \"worst\": \"" << worst->name << "\",\n";
+		file << "  \"visibleDifference\": " << VisibleDifference << ",\n";
+		file << "  \"imageData\": [\n";
+		for (size_t i = 0; i < differences.size(); ++i)
+		{
+			auto& difference = differences[i];
+			file << "    { \"name\": \"" << difference.name << "\", \"maxDifference\": " << difference.maxDifference << ", \"meanDifference\": "
+			     << difference.meanDifference << ", \"rmsDifference\": " << difference.rmsDifference << ", \"visiblePixels\": "
+			     << difference.visiblePixels << (i + 1 < differences.size() ? " },\n" : " }\n");
+		}
+		file << "  ]\n";
+		file << "}\n";
+	}
+	else
+	{
+		file << "# images," << differences.size() << "\n";
+		file << "# different," << numDifferent << "\n";
+		file << "# worst," << worst->name << "\n";
+		file << "# visibleDifference," << VisibleDifference << "\n";
+		file << "image,maxDifference,meanDifference,rmsDifference,visiblePixels\n";
+		for (auto& difference : differences)
+		{
+			file << difference.name << ',' << difference.maxDifference << ',' << difference.meanDifference << ','
+			     << difference.rmsDifference << ',' << difference.visiblePixels << "\n";
+		}
+	}
+
+	if (!file)
+	{
+		gLastError = "Error writing frame capture comparison file";
+		return false;
+	}
+	return true;
+}
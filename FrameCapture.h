@@ -0,0 +1,128 @@
+//--------------------------------------------------------------------------------------
+// Frame capture - every Nth frame saved as an image, to compare the pictures of two builds
+//--------------------------------------------------------------------------------------
+// Benchmark mode renders exactly the same frames every run (see Benchmark.h), so the images from
+// a run of one build can be compared with the images from another to see what a change did to the
+// picture, not only to the timings. With -framecapture N the back buffer of every Nth measured
+// frame is copied back through the GPU readback (see GpuReadback.h), so the CPU never waits for
+// the GPU. The main thread only copies the rows out of the staging texture, and a thread of the
+// capture's own writes the BMP files. That thread isn't from the job system, because a thread
+// waiting on the pool runs queued jobs itself, and a frame's pass waiting on its recording jobs
+// could end up writing an image in the middle of the frame being timed.
+//
+// Captures are only dropped, never waited for, if the GPU or the file writes fall too far
+// behind. The number dropped is reported at the end of the run, so a comparison can't silently
+// miss frames.
+//
+// CompareFrameCaptures is the other half: it reads the images of two runs and saves how much
+// each pair differs (see -comparecaptures in Benchmark.h).
+
+#include "GpuReadback.h"
+#include <d3d11.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+#ifndef _FRAME_CAPTURE_H_INCLUDED_
+#define _FRAME_CAPTURE_H_INCLUDED_
+
+class FrameCapture
+{
+//--------------------------------------------------------------------------------------
+// Construction / Usage
+//--------------------------------------------------------------------------------------
+public:
+
+	// Capture one frame in every given number to numbered files in the given folder, which is made if it doesn't exist
+	// Will throw a std::runtime_error exception on failure (same as Mesh)
+	FrameCapture(const std::wstring& folder, int interval);
+	~FrameCapture(); // Writes the images already copied back, drops those still on the GPU
+
+	FrameCapture(const FrameCapture&) = delete;
+	FrameCapture& operator=(const FrameCapture&) = delete;
+
+
+	// Copy the given back buffer back to be saved as the given frame number, if it is one of the frames to capture. Call
+	// after the frame has been drawn, before it is presented, on the immediate context
+	void Capture(ID3D11Texture2D* backBuffer, int frame);
+
+	// Wait until every capture has arrived from the GPU and been written. Updates gGpuReadback, so call between frames
+	// Returns false with a message in gLastError if any capture was dropped or couldn't be written
+	bool Finish();
+
+	int NumCaptured()  { return mCaptured; }
+	int NumDropped()   { return mDropped; }
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions / data
+//--------------------------------------------------------------------------------------
+private:
+
+	// Most images waiting to be written, about 8MB each at 1080p. Captures are dropped beyond this
+	static constexpr int MaxQueuedImages = 8;
+
+	// A frame copied back, its rows as they are in the back buffer with no padding
+	struct Image
+	{
+		int                  frame;
+		unsigned int         width, height;
+		bool                 bgra; // Channel order of the back buffer, RGBA otherwise
+		std::vector<uint8_t> pixels;
+	};
+
+	// The frame number, size and channel order of each copy on its way, in the slot given to GpuReadback::Read. Used in turn
+	// from mNextCopy
+	struct Copy
+	{
+		int          frame;
+		unsigned int width, height;
+		bool         bgra;
+	};
+
+	// Called by GpuReadback::Update with a back buffer copy that has arrived, queues it for the writing thread
+	static void CopyArrived(void* owner, int slot, const D3D11_MAPPED_SUBRESOURCE& data);
+
+	// The writing thread, writes queued images until told to quit
+	void WriteImages();
+
+
+	std::wstring mFolder;
+	int          mInterval;
+
+	// Used on the main thread only
+	int mCopying  = 0; // Copies on their way back from the GPU
+	int mCaptured = 0; // Images queued to be written
+	int mDropped  = 0; // Frames that should have been captured but weren't
+	Copy mCopies[GpuReadback::MaxCopiesPerOwner] = {};
+	int  mNextCopy = 0;
+
+	// Shared with the writing thread
+	std::mutex              mMutex;
+	std::condition_variable mQueued;  // Signalled when an image is queued or the thread should quit
+	std::condition_variable mWritten; // Signalled when the queue has been written
+	std::deque<Image>       mQueue;
+	bool                    mWriting = false; // Whether the thread is writing an image taken off the queue
+	bool                    mQuit    = false;
+	int                     mFailedWrites = 0;
+	std::thread             mThread;
+};
+
+
+// Compare the captures of two runs (see BenchmarkSettings::compareFolders), each image in the first folder with the image of
+// the same name in the second. Saves the largest and average channel difference, the RMS difference and the fraction of pixels that
+// differ visibly for each pair to the file chosen in gBenchmark (CSV, or JSON if the name ends in .json)
+// Returns false with a message in gLastError if the folders can't be read, an image is missing or has a different size,
+// or the file can't be written. Images that differ are not a failure, the results say how much
+bool CompareFrameCaptures();
+
+
+// The frame capture of a benchmark run with -framecapture, created in InitGeometry (see Scene.cpp), nullptr otherwise
+extern FrameCapture* gFrameCapture;
+
+
+#endif //_FRAME_CAPTURE_H_INCLUDED_
@@ -0,0 +1,144 @@
+//--------------------------------------------------------------------------------------
+// Labels for graphics debuggers - GPU event markers, debug names and RenderDoc captures
+//--------------------------------------------------------------------------------------
+
+#include "GpuEvents.h"
+#include "Common.h"
+
+#include <Windows.h>
+#include <d3d11_1.h>
+#include <cwchar>
+#include "stdint.h"
+
+
+//--------------------------------------------------------------------------------------
+// Event markers
+//--------------------------------------------------------------------------------------
+
+#ifdef GPU_EVENTS
+
+// The annotation interface of the calling thread's context, or nullptr if it has none. The interface is part of the context
+// object, so the reference from QueryInterface is released straight away - it stays valid as long as the context does. It
+// is looked up again whenever the thread's context changes (see CommandRecorder.h)
+static ID3DUserDefinedAnnotation* ThisThreadAnnotation()
+{
+	static thread_local ID3D11DeviceContext*       annotatedContext = nullptr;
+	static thread_local ID3DUserDefinedAnnotation* annotation       = nullptr;
+	if (gD3DContext != annotatedContext)
+	{
+		annotatedContext = gD3DContext;
+		annotation = nullptr;
+		if (gD3DContext != nullptr &&
+		    SUCCEEDED(gD3DContext->QueryInterface(__uuidof(ID3DUserDefinedAnnotation), reinterpret_cast<void**>(&annotation))))
+		{
+			annotation->Release();
+		}
+	}
+	return annotation;
+}
+
+
+// Start an event on the calling thread's context, with the index after the name when it is not negative
+void BeginGpuEvent(const char* name, int index /*= -1*/)
+{
+	ID3DUserDefinedAnnotation* annotation = ThisThreadAnnotation();
+	if (annotation == nullptr)  return;
+
+	// Annotations take wide strings, names longer than the buffer are cut short
+	wchar_t wideName[64];
+	if (index >= 0)  _snwprintf_s(wideName, _TRUNCATE, L"%hs %d", name, index);
+	else             _snwprintf_s(wideName, _TRUNCATE, L"%hs", name);
+	annotation->BeginEvent(wideName);
+}
+
+// End the most recently started event on the calling thread's context
+void EndGpuEvent()
+{
+	ID3DUserDefinedAnnotation* annotation = ThisThreadAnnotation();
+	if (annotation != nullptr)  annotation->EndEvent();
+}
+
+#endif
+
+
+//--------------------------------------------------------------------------------------
+// Debug names
+//--------------------------------------------------------------------------------------
+
+// Name a DirectX object for graphics debuggers and the debug layer's messages. Safe to call with nullptr
+void SetDebugName(ID3D11DeviceChild* object, const std::string& name)
+{
+	if (object == nullptr)  return;
+	object->SetPrivateData(WKPDID_D3DDebugObjectName, static_cast<UINT>(name.size()), name.c_str());
+}
+
+// Name a texture and any of its views, the views are given the texture's name followed by their kind
+void SetDebugNames(const std::string& name, ID3D11Resource* resource, ID3D11ShaderResourceView* srv,
+                   ID3D11RenderTargetView* renderTarget /*= nullptr*/, ID3D11DepthStencilView* depthStencil /*= nullptr*/)
+{
+	SetDebugName(resource,     name);
+	SetDebugName(srv,          name + " SRV");
+	SetDebugName(renderTarget, name + " RTV");
+	SetDebugName(depthStencil, name + " DSV");
+}
+
+
+//--------------------------------------------------------------------------------------
+// RenderDoc captures
+//--------------------------------------------------------------------------------------
+
+// The part of RenderDoc's in-application API used here, copied from renderdoc_app.h in the RenderDoc install rather than
+// adding it to the project. The API is a table of function pointers, which only ever grows, so only the entries up to
+// EndFrameCapture of version 1.0.0 are needed. A null device and window capture whichever window RenderDoc thinks current
+namespace
+{
+	const int RenderDocVersion_1_0_0 = 10000;
+	typedef int (__cdecl* RenderDocGetAPI)(int version, void** api);
+
+	struct RenderDocAPI
+	{
+		void* otherFunctions[19]; // GetAPIVersion to SetActiveWindow, not used
+		void     (__cdecl* StartFrameCapture)(void* device, void* window);
+		uint32_t (__cdecl* IsFrameCapturing)();
+		uint32_t (__cdecl* EndFrameCapture)(void* device, void* window);
+	};
+}
+
+// RenderDoc's API, fetched the first time it is needed. Only the main thread uses it
+static RenderDocAPI* gRenderDoc = nullptr;
+static bool          gRenderDocFetched = false;
+
+// The API if RenderDoc is loaded into the app, or nullptr. It is never loaded here, as it must hook DirectX before the
+// device is created to capture anything
+static RenderDocAPI* RenderDoc()
+{
+	if (!gRenderDocFetched)
+	{
+		gRenderDocFetched = true;
+		HMODULE module = GetModuleHandleA("renderdoc.dll");
+		if (module != nullptr)
+		{
+			auto getAPI = reinterpret_cast<RenderDocGetAPI>(GetProcAddress(module, "RENDERDOC_GetAPI"));
+			if (getAPI == nullptr || getAPI(RenderDocVersion_1_0_0, reinterpret_cast<void**>(&gRenderDoc)) != 1)  gRenderDoc = nullptr;
+		}
+	}
+	return gRenderDoc;
+}
+
+
+// Whether the app was started from RenderDoc
+bool GpuCaptureAvailable()
+{
+	return RenderDoc() != nullptr;
+}
+
+// Capture the DirectX calls between these two. Does nothing when RenderDoc isn't there
+void BeginGpuCapture()
+{
+	if (RenderDoc() != nullptr)  RenderDoc()->StartFrameCapture(nullptr, nullptr);
+}
+
+void EndGpuCapture()
+{
+	if (RenderDoc() != nullptr && RenderDoc()->IsFrameCapturing())  RenderDoc()->EndFrameCapture(nullptr, nullptr);
+}
@@ -0,0 +1,88 @@
+//--------------------------------------------------------------------------------------
+// Labels for graphics debuggers - GPU event markers, debug names and RenderDoc captures
+//--------------------------------------------------------------------------------------
+// Tools such as PIX, RenderDoc and Nsight show a frame as a flat list of thousands of DirectX
+// calls unless the app labels them. Event markers group the calls of each render graph pass
+// and its steps into a tree, e.g. "Refraction 1" > "Lit Models", and debug names show which
+// texture or buffer each call uses, e.g. "Reflection 0" rather than "Texture2D 37".
+//
+// Markers are recorded into the context in use on the calling thread (see gD3DContext in
+// Common.h), so passes recorded on worker threads are labelled too. They are compiled in debug
+// builds only, define GPU_EVENTS to have them in a release build for profiling. Debug names are
+// set once when each object is created and are kept in every build.
+//
+// When the app is started from RenderDoc a frame can be captured from code: with the F11 key or
+// with -capture N in benchmark mode (see Benchmark.h), captured into RenderDoc's capture list.
+
+#include <d3d11.h>
+#include <string>
+
+#ifndef _GPU_EVENTS_H_INCLUDED_
+#define _GPU_EVENTS_H_INCLUDED_
+
+#if defined(_DEBUG) && !defined(GPU_EVENTS)
+#define GPU_EVENTS
+#endif
+
+
+//--------------------------------------------------------------------------------------
+// Event markers
+//--------------------------------------------------------------------------------------
+
+#ifdef GPU_EVENTS
+
+// Start and end an event on the calling thread's context, use GpuEventScope (below) when the event covers a block of code
+// An index is shown after the name when it is not negative, e.g. the group of water a pass is for. Events on a thread must
+// end in the reverse order they started
+void BeginGpuEvent(const char* name, int index = -1);
+void EndGpuEvent();
+
+#else
+
+inline void BeginGpuEvent(const char* /*name*/, int /*index*/ = -1)  {}
+inline void EndGpuEvent()  {}
+
+#endif
+
+// Labels the DirectX calls made from where it is declared until it goes out of scope, e.g.
+//     {
+//         GpuEventScope event("Bloom");
+//         ...
+//     }
+class GpuEventScope
+{
+public:
+	GpuEventScope(const char* name, int index = -1)  { BeginGpuEvent(name, index); }
+	~GpuEventScope()                                 { EndGpuEvent(); }
+
+	GpuEventScope(const GpuEventScope&) = delete;
+	GpuEventScope& operator=(const GpuEventScope&) = delete;
+};
+
+
+//--------------------------------------------------------------------------------------
+// Debug names
+//--------------------------------------------------------------------------------------
+
+// Name a DirectX object for graphics debuggers and the debug layer's messages. Safe to call with nullptr
+void SetDebugName(ID3D11DeviceChild* object, const std::string& name);
+
+// Name a texture and any of its views, the views are given the texture's name followed by their kind, e.g. "Scene SRV"
+void SetDebugNames(const std::string& name, ID3D11Resource* resource, ID3D11ShaderResourceView* srv,
+                   ID3D11RenderTargetView* renderTarget = nullptr, ID3D11DepthStencilView* depthStencil = nullptr);
+
+
+//--------------------------------------------------------------------------------------
+// RenderDoc captures
+//--------------------------------------------------------------------------------------
+
+// Whether the app was started from RenderDoc (or RenderDoc was injected before the device was created)
+bool GpuCaptureAvailable();
+
+// Capture the DirectX calls between these two, call at the start of a frame and after presenting it. Does nothing when
+// RenderDoc isn't there. The capture is added to RenderDoc's list of captures
+void BeginGpuCapture();
+void EndGpuCapture();
+
+
+#endif //_GPU_EVENTS_H_INCLUDED_
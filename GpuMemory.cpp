@@ -0,0 +1,266 @@
+//--------------------------------------------------------------------------------------
+// GPU memory registry - the buffers and textures the app has created, and what they cost
+//--------------------------------------------------------------------------------------
+
+#include "GpuMemory.h"
+
+#include <Windows.h>
+#include <d3dcommon.h>
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+
+
+//--------------------------------------------------------------------------------------
+// Global data
+//--------------------------------------------------------------------------------------
+
+// The live resources, by the resource. The pointers aren't references, each entry is removed when its resource is destroyed.
+// The info is filled in when it is registered, apart from the debug name, which is often set afterwards
+static std::unordered_map<ID3D11Resource*, GpuResourceInfo> gResources;
+static std::mutex gResourcesMutex;
+
+
+//--------------------------------------------------------------------------------------
+// Helper functions
+//--------------------------------------------------------------------------------------
+
+// Bits used by each pixel of a format, by the ranges of the DXGI_FORMAT list that have the same size
+static unsigned int BitsPerPixel(DXGI_FORMAT format)
+{
+	if (format >= DXGI_FORMAT_R32G32B32A32_TYPELESS && format <= DXGI_FORMAT_R32G32B32A32_SINT)  return 128;
+	if (format >= DXGI_FORMAT_R32G32B32_TYPELESS    && format <= DXGI_FORMAT_R32G32B32_SINT)     return 96;
+	if (format >= DXGI_FORMAT_R16G16B16A16_TYPELESS && format <= DXGI_FORMAT_X32_TYPELESS_G8X24_UINT)  return 64;
+	if (format >= DXGI_FORMAT_R8G8_TYPELESS         && format <= DXGI_FORMAT_R16_SINT)           return 16;
+	if (format >= DXGI_FORMAT_R8_TYPELESS           && format <= DXGI_FORMAT_A8_UNORM)           return 8;
+	if (format == DXGI_FORMAT_B5G6R5_UNORM          || format == DXGI_FORMAT_B5G5R5A1_UNORM)     return 16;
+	if (format >= DXGI_FORMAT_BC1_TYPELESS          && format <= DXGI_FORMAT_BC1_UNORM_SRGB)     return 4;
+	if (format >= DXGI_FORMAT_BC4_TYPELESS          && format <= DXGI_FORMAT_BC4_SNORM)          return 4;
+	if (format >= DXGI_FORMAT_BC2_TYPELESS          && format <= DXGI_FORMAT_BC5_SNORM)          return 8;
+	if (format >= DXGI_FORMAT_BC6H_TYPELESS         && format <= DXGI_FORMAT_BC7_UNORM_SRGB)     return 8;
+	return 32; // RGBA8, R32, depth/stencil and similar
+}
+
+// Whether a format is block compressed, i.e. stored in blocks of 4x4 pixels
+static bool IsBlockCompressed(DXGI_FORMAT format)
+{
+	return format >= DXGI_FORMAT_BC1_TYPELESS && format <= DXGI_FORMAT_BC5_SNORM ||
+	       format >= DXGI_FORMAT_BC6H_TYPELESS && format <= DXGI_FORMAT_BC7_UNORM_SRGB;
+}
+
+// Bytes in a full chain of the given number of mip-maps of one slice of a texture
+static size_t MipChainBytes(DXGI_FORMAT format, unsigned int width, unsigned int height, unsigned int depth, unsigned int mipLevels)
+{
+	bool blocks = IsBlockCompressed(format);
+	size_t bytes = 0;
+	for (unsigned int mip = 0; mip < mipLevels; ++mip)
+	{
+		size_t mipWidth  = (std::max)(width  >> mip, 1u);
+		size_t mipHeight = (std::max)(height >> mip, 1u);
+		size_t mipDepth  = (std::max)(depth  >> mip, 1u);
+		if (blocks)
+		{
+			mipWidth  = (mipWidth  + 3) & ~3; // Blocks are always 4x4 even when the mip-map is smaller
+			mipHeight = (mipHeight + 3) & ~3;
+		}
+		bytes += mipWidth * mipHeight * mipDepth * BitsPerPixel(format) / 8;
+	}
+	return bytes;
+}
+
+
+// Fill in the parts of a resource's info that come from its description
+static void DescribeResource(ID3D11Resource* resource, GpuResourceInfo& info)
+{
+	info.format = DXGI_FORMAT_UNKNOWN;
+	info.width = info.height = info.depth = info.mipLevels = info.samples = 1;
+	info.bytes = 0;
+
+	D3D11_RESOURCE_DIMENSION dimension;
+	resource->GetType(&dimension);
+	if (dimension == D3D11_RESOURCE_DIMENSION_BUFFER)
+	{
+		D3D11_BUFFER_DESC desc;
+		static_cast<ID3D11Buffer*>(resource)->GetDesc(&desc);
+		info.type  = "Buffer";
+		info.width = desc.ByteWidth;
+		info.bytes = desc.ByteWidth;
+	}
+	else if (dimension == D3D11_RESOURCE_DIMENSION_TEXTURE1D)
+	{
+		D3D11_TEXTURE1D_DESC desc;
+		static_cast<ID3D11Texture1D*>(resource)->GetDesc(&desc);
+		info.type      = "Texture1D";
+		info.format    = desc.Format;
+		info.width     = desc.Width;
+		info.depth     = desc.ArraySize;
+		info.mipLevels = desc.MipLevels;
+		info.bytes     = MipChainBytes(desc.Format, desc.Width, 1, 1, desc.MipLevels) * desc.ArraySize;
+	}
+	else if (dimension == D3D11_RESOURCE_DIMENSION_TEXTURE2D)
+	{
+		D3D11_TEXTURE2D_DESC desc;
+		static_cast<ID3D11Texture2D*>(resource)->GetDesc(&desc);
+		info.type      = "Texture2D";
+		info.format    = desc.Format;
+		info.width     = desc.Width;
+		info.height    = desc.Height;
+		info.depth     = desc.ArraySize; // Six for cube maps
+		info.mipLevels = desc.MipLevels;
+		info.samples   = desc.SampleDesc.Count;
+		info.bytes     = MipChainBytes(desc.Format, desc.Width, desc.Height, 1, desc.MipLevels) * desc.ArraySize * desc.SampleDesc.Count;
+	}
+	else if (dimension == D3D11_RESOURCE_DIMENSION_TEXTURE3D)
+	{
+		D3D11_TEXTURE3D_DESC desc;
+		static_cast<ID3D11Texture3D*>(resource)->GetDesc(&desc);
+		info.type      = "Texture3D";
+		info.format    = desc.Format;
+		info.width     = desc.Width;
+		info.height    = desc.Height;
+		info.depth     = desc.Depth;
+		info.mipLevels = desc.MipLevels;
+		info.bytes     = MipChainBytes(desc.Format, desc.Width, desc.Height, desc.Depth, desc.MipLevels);
+	}
+}
+
+
+// Called by DirectX when a registered resource is destroyed, on whichever thread released it last
+static void WINAPI ResourceDestroyed(void* resource)
+{
+	std::lock_guard<std::mutex> lock(gResourcesMutex);
+	gResources.erase(static_cast<ID3D11Resource*>(resource));
+}
+
+
+//--------------------------------------------------------------------------------------
+// Registry
+//--------------------------------------------------------------------------------------
+
+// Record a buffer or texture under the given owner. Recording the same resource again changes its owner. Safe to call with
+// nullptr
+void RegisterGpuResource(ID3D11Resource* resource, const char* owner)
+{
+	if (resource == nullptr)  return;
+
+	{
+		std::lock_guard<std::mutex> lock(gResourcesMutex);
+		auto existing = gResources.find(resource);
+		if (existing != gResources.end())
+		{
+			existing->second.owner = owner;
+			return;
+		}
+	}
+
+	// Only resources that will say when they are destroyed can be recorded, any others would stay in the registry for ever
+	ID3DDestructionNotifier* notifier = nullptr;
+	if (FAILED(resource->QueryInterface(__uuidof(ID3DDestructionNotifier), reinterpret_cast<void**>(&notifier))))  return;
+
+	GpuResourceInfo info;
+	info.owner = owner;
+	DescribeResource(resource, info);
+	{
+		std::lock_guard<std::mutex> lock(gResourcesMutex);
+		gResources[resource] = info;
+	}
+	UINT callbackID;
+	if (FAILED(notifier->RegisterDestructionCallback(ResourceDestroyed, resource, &callbackID)))
+	{
+		std::lock_guard<std::mutex> lock(gResourcesMutex);
+		gResources.erase(resource);
+	}
+	notifier->Release();
+}
+
+
+// Every resource in the registry, the largest first
+std::vector<GpuResourceInfo> GpuResources()
+{
+	std::vector<GpuResourceInfo> resources;
+	{
+		std::lock_guard<std::mutex> lock(gResourcesMutex);
+		for (auto& entry : gResources)
+		{
+			resources.push_back(entry.second);
+
+			// Debug names are usually set after the resource is registered, so are read now
+			char name[256];
+			UINT nameSize = sizeof(name) - 1;
+			if (SUCCEEDED(entry.first->GetPrivateData(WKPDID_D3DDebugObjectName, &nameSize, name)))
+			{
+				resources.back().name.assign(name, nameSize);
+			}
+		}
+	}
+	std::sort(resources.begin(), resources.end(), [](const GpuResourceInfo& a, const GpuResourceInfo& b) { return a.bytes > b.bytes; });
+	return resources;
+}
+
+
+// Memory used by each owner in the registry, the largest first
+std::vector<GpuMemoryOwner> GpuMemoryByOwner()
+{
+	std::map<std::string, GpuMemoryOwner> owners;
+	{
+		std::lock_guard<std::mutex> lock(gResourcesMutex);
+		for (auto& entry : gResources)
+		{
+			GpuMemoryOwner& owner = owners[entry.second.owner];
+			owner.owner = entry.second.owner;
+			owner.bytes += entry.second.bytes;
+			++owner.numResources;
+		}
+	}
+	std::vector<GpuMemoryOwner> byOwner;
+	for (auto& owner : owners)  byOwner.push_back(owner.second);
+	std::sort(byOwner.begin(), byOwner.end(), [](const GpuMemoryOwner& a, const GpuMemoryOwner& b) { return a.bytes > b.bytes; });
+	return byOwner;
+}
+
+
+// GPU memory used by a buffer or texture from its description, in bytes
+size_t GpuResourceBytes(ID3D11Resource* resource)
+{
+	GpuResourceInfo info;
+	DescribeResource(resource, info);
+	return info.bytes;
+}
+
+
+// Short name of a format for reports. Only the formats this app creates have names, others are given as their number
+std::string FormatName(DXGI_FORMAT format)
+{
+	switch (format)
+	{
+		case DXGI_FORMAT_UNKNOWN:              return "None";
+		case DXGI_FORMAT_R32G32B32A32_FLOAT:   return "R32G32B32A32_FLOAT";
+		case DXGI_FORMAT_R16G16B16A16_FLOAT:   return "R16G16B16A16_FLOAT";
+		case DXGI_FORMAT_R16G16B16A16_UNORM:   return "R16G16B16A16_UNORM";
+		case DXGI_FORMAT_R32G32_FLOAT:         return "R32G32_FLOAT";
+		case DXGI_FORMAT_R11G11B10_FLOAT:      return "R11G11B10_FLOAT";
+		case DXGI_FORMAT_R8G8B8A8_UNORM:       return "R8G8B8A8_UNORM";
+		case DXGI_FORMAT_R8G8B8A8_UNORM_SRGB:  return "R8G8B8A8_UNORM_SRGB";
+		case DXGI_FORMAT_R16G16_FLOAT:         return "R16G16_FLOAT";
+		case DXGI_FORMAT_R32_TYPELESS:         return "R32_TYPELESS";
+		case DXGI_FORMAT_R32_FLOAT:            return "R32_FLOAT";
+		case DXGI_FORMAT_R16_FLOAT:            return "R16_FLOAT";
+		case DXGI_FORMAT_R8_UNORM:             return "R8_UNORM";
+		case DXGI_FORMAT_BC1_UNORM:            return "BC1_UNORM";
+		case DXGI_FORMAT_BC1_UNORM_SRGB:       return "BC1_UNORM_SRGB";
+		case DXGI_FORMAT_BC2_UNORM:            return "BC2_UNORM";
+		case DXGI_FORMAT_BC3_UNORM:            return "BC3_UNORM";
+		case DXGI_FORMAT_BC3_UNORM_SRGB:       return "BC3_UNORM_SRGB";
+		case DXGI_FORMAT_BC4_UNORM:            return "BC4_UNORM";
+		case DXGI_FORMAT_BC5_UNORM:            return "BC5_UNORM";
+		case DXGI_FORMAT_BC5_SNORM:            return "BC5_SNORM";
+		case DXGI_FORMAT_BC6H_UF16:            return "BC6H_UF16";
+		case DXGI_FORMAT_BC7_UNORM:            return "BC7_UNORM";
+		case DXGI_FORMAT_BC7_UNORM_SRGB:       return "BC7_UNORM_SRGB";
+		case DXGI_FORMAT_B8G8R8A8_UNORM:       return "B8G8R8A8_UNORM";
+		case DXGI_FORMAT_B8G8R8A8_UNORM_SRGB:  return "B8G8R8A8_UNORM_SRGB";
+		case DXGI_FORMAT_B8G8R8X8_UNORM:       return "B8G8R8X8_UNORM";
+		default:                               return "Format " + std::to_string(static_cast<int>(format));
+	}
+}
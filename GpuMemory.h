@@ -0,0 +1,68 @@
+//--------------------------------------------------------------------------------------
+// GPU memory registry - the buffers and textures the app has created, and what they cost
+//--------------------------------------------------------------------------------------
+// The video memory figures DXGI gives (see VideoMemoryUsage) are totals for the whole app. To see
+// where the memory goes, each buffer and texture is recorded here when created, under an owner
+// such as "Meshes" or "Water Textures". Its size is worked out from its description: every mip-map,
+// array slice and sample at the bits per pixel of its format. Drivers pad and align resources, so
+// the real cost is a little higher, but the registry shows which owners matter.
+//
+// Resources don't have to be removed from the registry when released. The registry asks each one to
+// tell it when it is destroyed (ID3DDestructionNotifier, Windows 10 onwards), so it only ever holds
+// live resources. Where that isn't supported nothing is recorded. Staging textures, which are in
+// system memory and only live for a copy back to the CPU, aren't recorded.
+//
+// The stats overlay shows the owners using the most memory, and the benchmark saves every resource
+// with its results. Can be used from any thread.
+
+#include <d3d11.h>
+#include <string>
+#include <vector>
+
+#ifndef _GPU_MEMORY_H_INCLUDED_
+#define _GPU_MEMORY_H_INCLUDED_
+
+
+// Record a buffer or texture under the given owner. Recording the same resource again changes its owner. Safe to call with
+// nullptr
+void RegisterGpuResource(ID3D11Resource* resource, const char* owner);
+
+
+// A resource in the registry
+struct GpuResourceInfo
+{
+	std::string  owner;
+	std::string  name;      // Its debug name (see SetDebugNames), empty if it has none
+	std::string  type;      // "Buffer", "Texture2D" etc.
+	DXGI_FORMAT  format;    // DXGI_FORMAT_UNKNOWN for buffers
+	unsigned int width;     // Bytes for buffers
+	unsigned int height;
+	unsigned int depth;     // Array slices for 1D and 2D textures
+	unsigned int mipLevels;
+	unsigned int samples;
+	size_t       bytes;
+};
+
+// Memory used by the resources of one owner
+struct GpuMemoryOwner
+{
+	std::string  owner;
+	size_t       bytes;
+	unsigned int numResources;
+};
+
+// Every resource in the registry, the largest first
+std::vector<GpuResourceInfo> GpuResources();
+
+// Memory used by each owner in the registry, the largest first
+std::vector<GpuMemoryOwner> GpuMemoryByOwner();
+
+
+// GPU memory used by a buffer or texture from its description, in bytes
+size_t GpuResourceBytes(ID3D11Resource* resource);
+
+// Short name of a format for reports, e.g. "R16G16B16A16_FLOAT"
+std::string FormatName(DXGI_FORMAT format);
+
+
+#endif //_GPU_MEMORY_H_INCLUDED_
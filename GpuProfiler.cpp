@@ -0,0 +1,256 @@
+//--------------------------------------------------------------------------------------
+// Class measuring the GPU time taken by each rendering pass
+//--------------------------------------------------------------------------------------
+
+#include "GpuProfiler.h"
+#include "OverdrawView.h"
+#include "Timer.h"
+#include "Common.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+
+// Will throw a std::runtime_error exception on failure (same as Mesh)
+GpuProfiler::GpuProfiler()
+{
+	D3D11_QUERY_DESC disjointDesc = {};
+	disjointDesc.Query = D3D11_QUERY_TIMESTAMP_DISJOINT;
+	D3D11_QUERY_DESC timestampDesc = {};
+	timestampDesc.Query = D3D11_QUERY_TIMESTAMP;
+	D3D11_QUERY_DESC statisticsDesc = {};
+	statisticsDesc.Query = D3D11_QUERY_PIPELINE_STATISTICS;
+
+	for (auto& frame : mFrames)
+	{
+		bool ok = SUCCEEDED(gD3DDevice->CreateQuery(&disjointDesc, &frame.disjoint));
+		for (int view = 0; view < MaxViews; ++view)
+		{
+			for (int pass = 0; pass < NumPasses; ++pass)
+			{
+				ok = ok && SUCCEEDED(gD3DDevice->CreateQuery(&timestampDesc, &frame.passBegin[view][pass]));
+				ok = ok && SUCCEEDED(gD3DDevice->CreateQuery(&timestampDesc, &frame.passEnd[view][pass]));
+				ok = ok && SUCCEEDED(gD3DDevice->CreateQuery(&statisticsDesc, &frame.passStats[view][pass]));
+			}
+		}
+		if (!ok)
+		{
+			ReleaseQueries(); // Destructor isn't called when a constructor throws
+			throw std::runtime_error("Error creating GPU timestamp queries");
+		}
+	}
+}
+
+GpuProfiler::~GpuProfiler()
+{
+	ReleaseQueries();
+}
+
+
+// Release the queries for all frames
+void GpuProfiler::ReleaseQueries()
+{
+	for (auto& frame : mFrames)
+	{
+		if (frame.disjoint)  frame.disjoint->Release();
+		frame.disjoint = nullptr;
+		for (int view = 0; view < MaxViews; ++view)
+		{
+			for (int pass = 0; pass < NumPasses; ++pass)
+			{
+				if (frame.passBegin[view][pass])  frame.passBegin[view][pass]->Release();
+				if (frame.passEnd[view][pass])    frame.passEnd[view][pass]->Release();
+				if (frame.passStats[view][pass])  frame.passStats[view][pass]->Release();
+				frame.passBegin[view][pass] = frame.passEnd[view][pass] = frame.passStats[view][pass] = nullptr;
+			}
+		}
+	}
+}
+
+
+// Call at the start and end of each frame's rendering. EndFrame reads back the results of earlier frames that have
+// finished on the GPU, it never waits for them
+void GpuProfiler::BeginFrame()
+{
+	FrameQueries& frame = mFrames[mCurrentFrame];
+
+	// If the GPU is more than FramesInFlight frames behind then this frame's queries still haven't got results. Give it
+	// one more chance then drop them rather than wait
+	if (frame.pending && !ReadResults(frame))  frame.pending = false;
+
+	for (auto& viewUsed : frame.passUsed)  for (auto& used : viewUsed)  used = false;
+	mView = 0;
+	frame.cpuStart = Timer::HighResCount();
+	gD3DContext->Begin(frame.disjoint);
+}
+
+void GpuProfiler::EndFrame()
+{
+	FrameQueries& frame = mFrames[mCurrentFrame];
+	gD3DContext->End(frame.disjoint);
+	frame.pending = true;
+	mCurrentFrame = (mCurrentFrame + 1) % FramesInFlight;
+
+	// Read any results that are ready, oldest first (the frame after the current one is the oldest). Stop at the first
+	// frame that isn't ready, so the results are always read in order
+	for (int i = 0; i < FramesInFlight; ++i)
+	{
+		FrameQueries& oldFrame = mFrames[(mCurrentFrame + i) % FramesInFlight];
+		if (oldFrame.pending && !ReadResults(oldFrame))  break;
+	}
+}
+
+
+// Bracket the rendering for a pass with these. Passes must not overlap, and each pass can be timed once per view a frame
+// A pass that isn't rendered in a frame (e.g. the ocean when it is switched off) is reported as taking no time
+void GpuProfiler::BeginPass(GpuPass pass)
+{
+	FrameQueries& frame = mFrames[mCurrentFrame];
+	gD3DContext->End(frame.passBegin[mView][static_cast<int>(pass)]); // Timestamp queries only use End
+	gD3DContext->Begin(frame.passStats[mView][static_cast<int>(pass)]);
+	if (gOverdrawView != nullptr)  gOverdrawView->BeginPass(pass); // Every pass is bracketed here, so the view hooks in here too
+}
+
+void GpuProfiler::EndPass(GpuPass pass)
+{
+	if (gOverdrawView != nullptr)  gOverdrawView->EndPass(pass);
+	FrameQueries& frame = mFrames[mCurrentFrame];
+	gD3DContext->End(frame.passStats[mView][static_cast<int>(pass)]);
+	gD3DContext->End(frame.passEnd[mView][static_cast<int>(pass)]);
+	frame.passUsed[mView][static_cast<int>(pass)] = true;
+}
+
+
+// Milliseconds taken by all the passes in the most recent frame with results
+float GpuProfiler::TotalTime()
+{
+	float total = 0;
+	for (auto time : mPassTimes)  total += time;
+	return total;
+}
+
+
+// Average milliseconds taken by a pass since the last call to ResetAverages. Returns 0 if there are no results yet
+float GpuProfiler::AveragePassTime(GpuPass pass)
+{
+	if (mAverageFrames == 0)  return 0;
+	return mPassTotals[static_cast<int>(pass)] / mAverageFrames;
+}
+
+void GpuProfiler::ResetAverages()
+{
+	for (auto& total : mPassTotals)  total = 0;
+	mAverageFrames = 0;
+}
+
+
+// Copy the kept pass times of the frames the CPU began at or after the given high-resolution count, oldest first
+void GpuProfiler::RecentFrames(uint64_t since, std::vector<GpuFrameTimings>& frames)
+{
+	frames.clear();
+	uint64_t oldest = (mHistoryWritten > HistoryFrames) ? mHistoryWritten - HistoryFrames : 0;
+	for (uint64_t i = oldest; i < mHistoryWritten; ++i)
+	{
+		const GpuFrameTimings& timings = mHistory[i % HistoryFrames];
+		if (timings.cpuStart >= since)  frames.push_back(timings);
+	}
+}
+
+
+// Short name for a pass, for display
+const char* GpuProfiler::PassName(GpuPass pass)
+{
+	switch (pass)
+	{
+		case GpuPass::OceanSimulation: return "Ocean";
+		case GpuPass::WaveComposite:   return "Waves";
+		case GpuPass::Caustics:        return "Caustics";
+		case GpuPass::Ripples:         return "Ripples";
+		case GpuPass::Particles:       return "Particles";
+		case GpuPass::Shadows:         return "Shadows";
+		case GpuPass::Environment:     return "Environment";
+		case GpuPass::WaterHeight:     return "Height";
+		case GpuPass::Refraction:      return "Refraction";
+		case GpuPass::Reflection:      return "Reflection";
+		case GpuPass::WaterViews:      return "Views";
+		case GpuPass::DepthPrepass:    return "Prepass";
+		case GpuPass::MainLit:         return "Lit";
+		case GpuPass::WaterSurface:    return "Water";
+		case GpuPass::SkyAndLights:    return "Sky";
+		case GpuPass::UnderwaterFog:   return "Fog";
+		case GpuPass::Occlusion:       return "Hi-Z";
+		case GpuPass::PostProcess:     return "Post";
+		default:                       return "";
+	}
+}
+
+
+// Try to read back the results for a frame without waiting. Returns false if they aren't ready yet
+bool GpuProfiler::ReadResults(FrameQueries& frame)
+{
+	// DONOTFLUSH - don't push the GPU to finish the work just because we asked
+	D3D11_QUERY_DATA_TIMESTAMP_DISJOINT disjointData;
+	if (gD3DContext->GetData(frame.disjoint, &disjointData, sizeof(disjointData), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK)  return false;
+
+	// Each pass's ticks and statistics are the totals over the views it was rendered in, and it starts where its first view did
+	UINT64 begin[NumPasses] = {};
+	UINT64 ticks[NumPasses] = {};
+	bool   used[NumPasses]  = {};
+	D3D11_QUERY_DATA_PIPELINE_STATISTICS statistics[NumPasses] = {};
+	for (int view = 0; view < MaxViews; ++view)
+	{
+		for (int pass = 0; pass < NumPasses; ++pass)
+		{
+			if (!frame.passUsed[view][pass])  continue;
+			UINT64 viewBegin, viewEnd;
+			D3D11_QUERY_DATA_PIPELINE_STATISTICS viewStatistics;
+			if (gD3DContext->GetData(frame.passBegin[view][pass], &viewBegin, sizeof(UINT64), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK ||
+			    gD3DContext->GetData(frame.passEnd[view][pass],   &viewEnd,   sizeof(UINT64), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK ||
+			    gD3DContext->GetData(frame.passStats[view][pass], &viewStatistics, sizeof(viewStatistics), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK)  return false;
+
+			if (!used[pass])  begin[pass] = viewBegin;
+			used[pass] = true;
+			ticks[pass] += viewEnd - viewBegin;
+			D3D11_QUERY_DATA_PIPELINE_STATISTICS& total = statistics[pass];
+			total.IAVertices    += viewStatistics.IAVertices;
+			total.IAPrimitives  += viewStatistics.IAPrimitives;
+			total.VSInvocations += viewStatistics.VSInvocations;
+			total.GSInvocations += viewStatistics.GSInvocations;
+			total.GSPrimitives  += viewStatistics.GSPrimitives;
+			total.CInvocations  += viewStatistics.CInvocations;
+			total.CPrimitives   += viewStatistics.CPrimitives;
+			total.PSInvocations += viewStatistics.PSInvocations;
+			total.HSInvocations += viewStatistics.HSInvocations;
+			total.DSInvocations += viewStatistics.DSInvocations;
+			total.CSInvocations += viewStatistics.CSInvocations;
+		}
+	}
+	frame.pending = false;
+
+	// Statistics don't depend on the clock so are kept even for disjoint frames
+	for (int pass = 0; pass < NumPasses; ++pass)  mPassStatistics[pass] = statistics[pass];
+
+	// Timestamps are meaningless if the clock changed during the frame, skip the frame
+	if (disjointData.Disjoint)  return true;
+
+	for (int pass = 0; pass < NumPasses; ++pass)
+	{
+		mPassTimes[pass] = static_cast<float>(static_cast<double>(ticks[pass]) * 1000.0 / disjointData.Frequency);
+		mPassTotals[pass] += mPassTimes[pass];
+	}
+
+	// Keep the frame's passes for traces, placed from the first pass the GPU reached
+	GpuFrameTimings& timings = mHistory[mHistoryWritten++ % HistoryFrames];
+	UINT64 firstBegin = UINT64_MAX;
+	for (int pass = 0; pass < NumPasses; ++pass)  if (used[pass])  firstBegin = (std::min)(firstBegin, begin[pass]);
+	timings.cpuStart = frame.cpuStart;
+	for (int pass = 0; pass < NumPasses; ++pass)
+	{
+		timings.passUsed[pass]  = used[pass];
+		timings.passTime[pass]  = used[pass] ? mPassTimes[pass] : 0.0f;
+		timings.passStart[pass] = used[pass] ? static_cast<float>(static_cast<double>(begin[pass] - firstBegin) * 1000.0 / disjointData.Frequency) : 0.0f;
+	}
+	++mAverageFrames;
+	++mCompletedFrames;
+	return true;
+}
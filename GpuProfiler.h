@@ -0,0 +1,168 @@
+//--------------------------------------------------------------------------------------
+// Class measuring the GPU time taken by each rendering pass
+//--------------------------------------------------------------------------------------
+// The CPU frame time doesn't show where the GPU spends its time. This class brackets each
+// pass with timestamp queries, which the GPU fills in when it reaches them. The results
+// arrive a few frames later, so several frames of queries are kept in flight and read back
+// when ready - waiting for them would stall the CPU until the GPU caught up. Each pass also
+// has a pipeline statistics query, read back in the same way, which counts the primitives the
+// input assembler read, the vertex shader runs, the triangles into and out of the clipper and
+// the pixel shader runs. These show why a pass takes its time - e.g. pixel shader runs far
+// above the pixels drawn are overdraw or pixels thrown away by clip(), and vertex shader runs
+// show how much a change of LOD saves.
+// The pass times of the last few seconds of frames are kept, for the frame spike traces (see
+// SpikeDetector.h).
+// A frame can render several views, e.g. the two cameras of a split screen, each with its own
+// queries. A pass rendered in more than one view reports the total over the views.
+
+#include <d3d11.h>
+#include <vector>
+#include "stdint.h"
+
+#ifndef _GPU_PROFILER_H_INCLUDED_
+#define _GPU_PROFILER_H_INCLUDED_
+
+// The passes that are timed, in the order they are rendered
+enum class GpuPass
+{
+	OceanSimulation,
+	WaveComposite,
+	Caustics,
+	Ripples,
+	Particles,
+	Shadows,
+	Environment,
+	WaterHeight,
+	Refraction,
+	Reflection,
+	WaterViews,
+	DepthPrepass,
+	MainLit,
+	WaterSurface,
+	SkyAndLights,
+	UnderwaterFog,
+	Occlusion,
+	PostProcess,
+	NumPasses,
+};
+
+// The pass times of a frame with results, kept for traces. Milliseconds, pass starts are from the start of the first pass
+struct GpuFrameTimings
+{
+	uint64_t cpuStart; // High-resolution count (see Timer.h) when the CPU began the frame's rendering
+	float    passStart[static_cast<int>(GpuPass::NumPasses)];
+	float    passTime[static_cast<int>(GpuPass::NumPasses)];
+	bool     passUsed[static_cast<int>(GpuPass::NumPasses)];
+};
+
+
+class GpuProfiler
+{
+//--------------------------------------------------------------------------------------
+// Construction / Usage
+//--------------------------------------------------------------------------------------
+public:
+
+	// Will throw a std::runtime_error exception on failure (same as Mesh)
+	GpuProfiler();
+	~GpuProfiler();
+
+
+	// Call at the start and end of each frame's rendering. EndFrame reads back the results of earlier frames that have
+	// finished on the GPU, it never waits for them
+	void BeginFrame();
+	void EndFrame();
+
+	// Bracket the rendering for a pass with these. Passes must not overlap, and each pass can be timed once per view a frame
+	// A pass that isn't rendered in a frame (e.g. the ocean when it is switched off) is reported as taking no time
+	void BeginPass(GpuPass pass);
+	void EndPass(GpuPass pass);
+
+	// Select the view the passes after this are timed in, from 0 to MaxViews - 1. Each frame begins in view 0
+	void SetView(int view)  { mView = view; }
+
+	// Views a frame can time its passes in
+	static constexpr int MaxViews = 2;
+
+
+	// Milliseconds taken by a pass (or by all the passes) in the most recent frame with results, over all its views
+	float PassTime(GpuPass pass)  { return mPassTimes[static_cast<int>(pass)]; }
+	float TotalTime();
+
+	// Pipeline statistics of a pass in the most recent frame with results, all zero for a pass that wasn't rendered. The
+	// counts used are IAPrimitives, VSInvocations, CInvocations (triangles into the clipper), CPrimitives (out of it, after
+	// clipping and culling) and PSInvocations
+	const D3D11_QUERY_DATA_PIPELINE_STATISTICS& PassStatistics(GpuPass pass)  { return mPassStatistics[static_cast<int>(pass)]; }
+
+	// Number of triangles sent to the rasteriser by a pass in the most recent frame with results
+	UINT64 PassTriangles(GpuPass pass)  { return mPassStatistics[static_cast<int>(pass)].CInvocations; }
+
+	// Average milliseconds taken by a pass since the last call to ResetAverages. Returns 0 if there are no results yet
+	float AveragePassTime(GpuPass pass);
+	void  ResetAverages();
+
+	// Number of frames with results so far, increases by one each time new results are read back
+	unsigned int CompletedFrames()  { return mCompletedFrames; }
+
+	// Copy the kept pass times of the frames the CPU began at or after the given high-resolution count, oldest first
+	void RecentFrames(uint64_t since, std::vector<GpuFrameTimings>& frames);
+
+	// Short name for a pass, for display
+	static const char* PassName(GpuPass pass);
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions / data
+//--------------------------------------------------------------------------------------
+private:
+
+	// Number of frames of queries waiting for results. Results for a frame that are still not ready when its queries are
+	// needed again are dropped
+	static constexpr int FramesInFlight = 4;
+
+	static constexpr int NumPasses = static_cast<int>(GpuPass::NumPasses);
+
+	// Frames of pass times kept for RecentFrames, a few seconds' worth
+	static constexpr int HistoryFrames = 512;
+
+	// Queries for a single frame, with a set of pass queries for each view. The disjoint query tells us the timestamp
+	// frequency and whether the timestamps are valid (they aren't if the GPU clock changed during the frame, e.g. when a
+	// laptop switches power mode)
+	struct FrameQueries
+	{
+		ID3D11Query* disjoint = nullptr;
+		ID3D11Query* passBegin[MaxViews][NumPasses] = {};
+		ID3D11Query* passEnd[MaxViews][NumPasses]   = {};
+		ID3D11Query* passStats[MaxViews][NumPasses] = {}; // Pipeline statistics
+		bool         passUsed[MaxViews][NumPasses]  = {};
+		bool         pending = false; // Frame has been issued, waiting for results
+		uint64_t     cpuStart = 0;    // High-resolution count when BeginFrame was called
+	};
+
+	// Release the queries for all frames
+	void ReleaseQueries();
+
+	// Try to read back the results for a frame without waiting. Returns false if they aren't ready yet
+	bool ReadResults(FrameQueries& frame);
+
+	FrameQueries mFrames[FramesInFlight];
+	int          mCurrentFrame = 0;
+	int          mView = 0; // Set by SetView
+
+	float        mPassTimes[NumPasses] = {};
+	D3D11_QUERY_DATA_PIPELINE_STATISTICS mPassStatistics[NumPasses] = {};
+	float        mPassTotals[NumPasses] = {}; // For averages
+	unsigned int mAverageFrames = 0;
+	unsigned int mCompletedFrames = 0;
+
+	// Ring of the pass times of the most recent frames with results
+	GpuFrameTimings mHistory[HistoryFrames];
+	uint64_t        mHistoryWritten = 0;
+};
+
+
+// The profiler used by the scene, created in InitGeometry (see Scene.cpp)
+extern GpuProfiler* gGpuProfiler;
+
+
+#endif //_GPU_PROFILER_H_INCLUDED_
@@ -0,0 +1,229 @@
+//--------------------------------------------------------------------------------------
+// GPU readback - data copied back from the GPU without waiting for it
+//--------------------------------------------------------------------------------------
+
+#include "GpuReadback.h"
+#include "Common.h"
+
+#include <algorithm>
+
+
+GpuReadback* gGpuReadback = nullptr;
+
+
+GpuReadback::~GpuReadback()
+{
+	// Staging resources can be released while the GPU is still copying into them, DirectX keeps them until it is done
+	for (auto& staging : mStaging)  staging->resource->Release();
+}
+
+
+//--------------------------------------------------------------------------------------
+// Usage
+//--------------------------------------------------------------------------------------
+
+// Copy the given subresource of a buffer or texture towards the CPU, or the part of it in the box (nullptr for all of it), and
+// call the given function with it from a later Update once it has arrived. Call on the immediate context. Returns false
+// without copying if the owner already has as many copies on their way as it can, or the staging resource couldn't be made
+bool GpuReadback::Read(void* owner, ID3D11Resource* source, unsigned int subresource, const D3D11_BOX* box, Callback callback,
+                       int slot /*= 0*/)
+{
+	auto ownerCopies = std::count_if(mPending.begin(), mPending.end(), [owner](const Pending& pending) { return pending.owner == owner; });
+	if (ownerCopies >= MaxCopiesPerOwner)  return false;
+
+	Shape shape;
+	if (!CopyShape(source, subresource, box, shape))  return false;
+	Staging* staging = FreeStaging(shape);
+	if (staging == nullptr)  return false;
+
+	gD3DImmediateContext->CopySubresourceRegion(staging->resource, 0, 0, 0, 0, source, subresource, box);
+	staging->inUse = true;
+	staging->lastUsedFrame = mFrame;
+	mPending.push_back({ staging, owner, callback, slot });
+	return true;
+}
+
+
+// Call the functions of the copies that have arrived, in the order they were asked for, without waiting for the GPU
+void GpuReadback::Update()
+{
+	// The GPU makes the copies in order, so stop at the first that hasn't arrived. DO_NOT_WAIT fails while it is still to be
+	// done. Any other failure (e.g. the device was lost) drops the copy
+	while (!mPending.empty())
+	{
+		Pending pending = mPending.front();
+		D3D11_MAPPED_SUBRESOURCE mapped;
+		HRESULT result = gD3DImmediateContext->Map(pending.staging->resource, 0, D3D11_MAP_READ, D3D11_MAP_FLAG_DO_NOT_WAIT, &mapped);
+		if (result == DXGI_ERROR_WAS_STILL_DRAWING)  break;
+		mPending.erase(mPending.begin()); // Before the callback, which may ask for another copy
+
+		if (SUCCEEDED(result))
+		{
+			if (pending.callback)  pending.callback(pending.owner, pending.slot, mapped);
+			gD3DImmediateContext->Unmap(pending.staging->resource, 0);
+		}
+		pending.staging->inUse = false;
+		pending.staging->lastUsedFrame = mFrame;
+	}
+
+	// Release the staging resources that have been left unused, e.g. those of a texture that has been resized
+	mStaging.erase(std::remove_if(mStaging.begin(), mStaging.end(), [this](const std::unique_ptr<Staging>& staging)
+	{
+		if (staging->inUse || mFrame - staging->lastUsedFrame < IdleFramesBeforeRelease)  return false;
+		staging->resource->Release();
+		return true;
+	}), mStaging.end());
+
+	++mFrame;
+}
+
+
+// Drop the copies of the given owner on their way without calling their functions. Their staging resources stay in use until
+// the GPU has finished copying into them
+void GpuReadback::Cancel(const void* owner)
+{
+	for (auto& pending : mPending)
+	{
+		if (pending.owner != owner)  continue;
+		pending.owner    = nullptr;
+		pending.callback = nullptr;
+	}
+}
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions
+//--------------------------------------------------------------------------------------
+
+// The shape of the copy of the given subresource or box of it. Returns false for resources that can't be read back
+bool GpuReadback::CopyShape(ID3D11Resource* source, unsigned int subresource, const D3D11_BOX* box, Shape& shape)
+{
+	source->GetType(&shape.dimension);
+	unsigned int mipLevels = 1;
+	switch (shape.dimension)
+	{
+		case D3D11_RESOURCE_DIMENSION_BUFFER:
+		{
+			D3D11_BUFFER_DESC desc;
+			static_cast<ID3D11Buffer*>(source)->GetDesc(&desc);
+			shape = { shape.dimension, DXGI_FORMAT_UNKNOWN, desc.ByteWidth, 1, 1 };
+			break;
+		}
+		case D3D11_RESOURCE_DIMENSION_TEXTURE1D:
+		{
+			D3D11_TEXTURE1D_DESC desc;
+			static_cast<ID3D11Texture1D*>(source)->GetDesc(&desc);
+			shape = { shape.dimension, desc.Format, desc.Width, 1, 1 };
+			mipLevels = desc.MipLevels;
+			break;
+		}
+		case D3D11_RESOURCE_DIMENSION_TEXTURE2D:
+		{
+			D3D11_TEXTURE2D_DESC desc;
+			static_cast<ID3D11Texture2D*>(source)->GetDesc(&desc);
+			if (desc.SampleDesc.Count > 1)  return false;
+			shape = { shape.dimension, desc.Format, desc.Width, desc.Height, 1 };
+			mipLevels = desc.MipLevels;
+			break;
+		}
+		case D3D11_RESOURCE_DIMENSION_TEXTURE3D:
+		{
+			D3D11_TEXTURE3D_DESC desc;
+			static_cast<ID3D11Texture3D*>(source)->GetDesc(&desc);
+			shape = { shape.dimension, desc.Format, desc.Width, desc.Height, desc.Depth };
+			mipLevels = desc.MipLevels;
+			break;
+		}
+		default:
+			return false;
+	}
+
+	// Subresources run through the mip-maps of each array slice in turn
+	if (shape.dimension != D3D11_RESOURCE_DIMENSION_BUFFER)
+	{
+		unsigned int mip = subresource % mipLevels;
+		shape.width  = (std::max)(shape.width  >> mip, 1u);
+		shape.height = (std::max)(shape.height >> mip, 1u);
+		shape.depth  = (std::max)(shape.depth  >> mip, 1u);
+	}
+	if (box != nullptr)
+	{
+		shape.width  = box->right  - box->left;
+		shape.height = box->bottom - box->top;
+		shape.depth  = box->back   - box->front;
+	}
+	return shape.width > 0 && shape.height > 0 && shape.depth > 0;
+}
+
+
+// A free staging resource of the given shape, made if there isn't one. nullptr on failure. Staging resources are in system
+// memory, so they aren't recorded with the GPU memory (see GpuMemory.h)
+GpuReadback::Staging* GpuReadback::FreeStaging(const Shape& shape)
+{
+	for (auto& staging : mStaging)
+	{
+		if (!staging->inUse && staging->shape == shape)  return staging.get();
+	}
+
+	ID3D11Resource* resource = nullptr;
+	HRESULT result = E_FAIL;
+	switch (shape.dimension)
+	{
+		case D3D11_RESOURCE_DIMENSION_BUFFER:
+		{
+			D3D11_BUFFER_DESC desc = {};
+			desc.ByteWidth      = shape.width;
+			desc.Usage          = D3D11_USAGE_STAGING;
+			desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+			result = gD3DDevice->CreateBuffer(&desc, nullptr, reinterpret_cast<ID3D11Buffer**>(&resource));
+			break;
+		}
+		case D3D11_RESOURCE_DIMENSION_TEXTURE1D:
+		{
+			D3D11_TEXTURE1D_DESC desc = {};
+			desc.Width          = shape.width;
+			desc.MipLevels      = 1;
+			desc.ArraySize      = 1;
+			desc.Format         = shape.format;
+			desc.Usage          = D3D11_USAGE_STAGING;
+			desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+			result = gD3DDevice->CreateTexture1D(&desc, nullptr, reinterpret_cast<ID3D11Texture1D**>(&resource));
+			break;
+		}
+		case D3D11_RESOURCE_DIMENSION_TEXTURE2D:
+		{
+			D3D11_TEXTURE2D_DESC desc = {};
+			desc.Width            = shape.width;
+			desc.Height           = shape.height;
+			desc.MipLevels        = 1;
+			desc.ArraySize        = 1;
+			desc.Format           = shape.format;
+			desc.SampleDesc.Count = 1;
+			desc.Usage            = D3D11_USAGE_STAGING;
+			desc.CPUAccessFlags   = D3D11_CPU_ACCESS_READ;
+			result = gD3DDevice->CreateTexture2D(&desc, nullptr, reinterpret_cast<ID3D11Texture2D**>(&resource));
+			break;
+		}
+		case D3D11_RESOURCE_DIMENSION_TEXTURE3D:
+		{
+			D3D11_TEXTURE3D_DESC desc = {};
+			desc.Width          = shape.width;
+			desc.Height         = shape.height;
+			desc.Depth          = shape.depth;
+			desc.MipLevels      = 1;
+			desc.Format         = shape.format;
+			desc.Usage          = D3D11_USAGE_STAGING;
+			desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+			result = gD3DDevice->CreateTexture3D(&desc, nullptr, reinterpret_cast<ID3D11Texture3D**>(&resource));
+			break;
+		}
+		default:
+			break;
+	}
+	if (FAILED(result))  return nullptr;
+
+	mStaging.push_back(std::make_unique<Staging>());
+	mStaging.back()->shape    = shape;
+	mStaging.back()->resource = resource;
+	return mStaging.back().get();
+}
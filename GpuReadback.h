@@ -0,0 +1,123 @@
+//--------------------------------------------------------------------------------------
+// GPU readback - data copied back from the GPU without waiting for it
+//--------------------------------------------------------------------------------------
+// Mapping a resource the GPU is still working on stalls the CPU until the GPU catches up, and then
+// the GPU sits idle until the CPU sends it more. Instead a copy is made on the GPU into a staging
+// resource, which the CPU can read, and polled each frame with DO_NOT_WAIT, which fails at once
+// while the copy is still to be done. A few frames later it has arrived and the caller's function
+// is called with the data. Anything that needs results from the GPU goes through here: the FFT
+// ocean's heights for floating objects (see WaterHeights.h), the depth for occlusion culling (see
+// HiZBuffer.h) and so on.
+//
+// The staging resources are shared by everyone reading back, made as needed for each size and
+// format of copy and reused once read, so a reader copying every frame cycles through a ring of a
+// few of them. Those left unused for a while are released. Each reader has only a few copies on
+// their way at once, when the GPU falls further behind than that the reader's new copies are
+// skipped rather than waited for. A copy's function is a plain function given the reader and a
+// slot number the reader chose, for whatever it keeps about each copy, so asking for a copy never
+// allocates once the staging resources have been made.
+
+#include <d3d11.h>
+#include <memory>
+#include <vector>
+
+#ifndef _GPU_READBACK_H_INCLUDED_
+#define _GPU_READBACK_H_INCLUDED_
+
+class GpuReadback
+{
+//--------------------------------------------------------------------------------------
+// Construction / Usage
+//--------------------------------------------------------------------------------------
+public:
+
+	GpuReadback() = default;
+	~GpuReadback();
+
+	GpuReadback(const GpuReadback&) = delete;
+	GpuReadback& operator=(const GpuReadback&) = delete;
+
+
+	// Most copies one owner can have on their way. Readers copying every frame get their data this many frames late at most
+	// A reader keeping this many slots, and using the next in turn each time a copy is asked for, never reuses one in use
+	static constexpr int MaxCopiesPerOwner = 3;
+
+	// Called with a copy that has arrived, mapped for reading (pData, RowPitch and DepthPitch as from Map). The owner and slot
+	// are those given to Read. The data can only be read during the call
+	using Callback = void (*)(void* owner, int slot, const D3D11_MAPPED_SUBRESOURCE& data);
+
+	// Copy the given subresource of a buffer or texture towards the CPU, or the part of it in the box (nullptr for all of it),
+	// and call the given function with it from a later Update once it has arrived. The owner identifies the reader, for
+	// Cancel, and is passed to the function with the slot. Call on the immediate context. Returns false without copying if the
+	// owner already has as many copies on their way as it can (the GPU is behind), or the staging resource couldn't be made
+	// Multisampled textures can't be read. Fill in the slot's data after this returns true, the function is never called before
+	bool Read(void* owner, ID3D11Resource* source, unsigned int subresource, const D3D11_BOX* box, Callback callback, int slot = 0);
+
+	// Call the functions of the copies that have arrived, in the order they were asked for, without waiting for the GPU.
+	// Call once per frame on the immediate context, while nothing that is given the data is in use on other threads
+	void Update();
+
+	// Drop the copies of the given owner on their way without calling their functions, e.g. before it is destroyed
+	void Cancel(const void* owner);
+
+	// Copies on their way
+	int NumPending()  { return static_cast<int>(mPending.size()); }
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions / data
+//--------------------------------------------------------------------------------------
+private:
+
+	// Staging resources not used for this many frames are released
+	static constexpr unsigned int IdleFramesBeforeRelease = 120;
+
+	// The size and format of a staging resource: buffers have their bytes in width and an unknown format
+	struct Shape
+	{
+		D3D11_RESOURCE_DIMENSION dimension;
+		DXGI_FORMAT              format;
+		unsigned int             width, height, depth;
+
+		bool operator==(const Shape& other) const
+		{
+			return dimension == other.dimension && format == other.format &&
+			       width == other.width && height == other.height && depth == other.depth;
+		}
+	};
+
+	struct Staging
+	{
+		Shape           shape;
+		ID3D11Resource* resource = nullptr;
+		bool            inUse = false;
+		unsigned int    lastUsedFrame = 0;
+	};
+
+	// A copy on its way, owner and callback are cleared when it is cancelled
+	struct Pending
+	{
+		Staging* staging;
+		void*    owner;
+		Callback callback;
+		int      slot;
+	};
+
+	// The shape of the copy of the given subresource or box of it. Returns false for resources that can't be read back
+	static bool CopyShape(ID3D11Resource* source, unsigned int subresource, const D3D11_BOX* box, Shape& shape);
+
+	// A free staging resource of the given shape, made if there isn't one. nullptr on failure
+	Staging* FreeStaging(const Shape& shape);
+
+
+	std::vector<std::unique_ptr<Staging>> mStaging; // Kept as pointers, the pending copies point at them
+	std::vector<Pending>                  mPending; // In the order they were asked for, only a few so the first is erased
+	unsigned int                          mFrame = 0;
+};
+
+
+// The readback used by the app, created in InitGeometry (see Scene.cpp)
+extern GpuReadback* gGpuReadback;
+
+
+#endif //_GPU_READBACK_H_INCLUDED_
@@ -0,0 +1,261 @@
+//--------------------------------------------------------------------------------------
+// GPU uploader - data copied up to the GPU a little at a time
+//--------------------------------------------------------------------------------------
+
+#include "GpuUploader.h"
+#include "Common.h"
+
+#include <algorithm>
+#include <cstring>
+
+
+GpuUploader* gGpuUploader = nullptr;
+
+
+//--------------------------------------------------------------------------------------
+// Helper functions
+//--------------------------------------------------------------------------------------
+
+// Width and height in texels of the blocks a format is stored in: 4 for the block compressed formats, 1 for the others
+static unsigned int BlockSize(DXGI_FORMAT format)
+{
+	return (format >= DXGI_FORMAT_BC1_TYPELESS  && format <= DXGI_FORMAT_BC5_SNORM) ||
+	       (format >= DXGI_FORMAT_BC6H_TYPELESS && format <= DXGI_FORMAT_BC7_UNORM_SRGB) ? 4 : 1;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Construction
+//--------------------------------------------------------------------------------------
+
+// The frame budget is the most bytes copied each frame, though at least one band is copied each frame however large
+GpuUploader::GpuUploader(size_t frameBudget /*= DefaultFrameBudget*/)
+	: mFrameBudget(frameBudget)
+{
+}
+
+GpuUploader::~GpuUploader()
+{
+	// Staging resources can be released while the GPU is still copying from them, DirectX keeps them until it is done
+	for (auto& upload : mUploads)   upload.destination->Release();
+	for (auto& staging : mStaging)  staging->resource->Release();
+}
+
+
+//--------------------------------------------------------------------------------------
+// Usage
+//--------------------------------------------------------------------------------------
+
+// Upload a subresource of a 2D texture from the data, starting at the given offset. The rows (of 4x4 blocks for the block
+// compressed formats) are rowPitch bytes apart. The texture is kept until the upload is done
+void GpuUploader::UploadTexture(const void* owner, ID3D11Texture2D* texture, unsigned int subresource,
+                                Data data, size_t offset, unsigned int rowPitch)
+{
+	D3D11_TEXTURE2D_DESC desc;
+	texture->GetDesc(&desc);
+	unsigned int mip = subresource % desc.MipLevels;
+	unsigned int blockSize = BlockSize(desc.Format);
+
+	// Block compressed mip-maps smaller than a block are copied as a whole block, the size the GPU stores them at
+	Upload upload;
+	upload.owner       = owner;
+	upload.destination = texture;
+	upload.subresource = subresource;
+	upload.data        = std::move(data);
+	upload.offset      = offset;
+	upload.shape       = { D3D11_RESOURCE_DIMENSION_TEXTURE2D, desc.Format,
+	                       ((std::max)(desc.Width  >> mip, 1u) + blockSize - 1) / blockSize * blockSize,
+	                       ((std::max)(desc.Height >> mip, 1u) + blockSize - 1) / blockSize * blockSize };
+	upload.rowPitch    = rowPitch;
+	upload.blockHeight = blockSize;
+	unsigned int rows  = upload.shape.height / blockSize;
+	upload.bandRows    = (std::max)((std::min)(static_cast<unsigned int>(MaxCopyBytes / rowPitch), rows), 1u);
+
+	texture->AddRef();
+	mQueuedBytes += RemainingBytes(upload);
+	mUploads.push_back(std::move(upload));
+}
+
+
+// Upload bytes from the data, starting at the given offset, into a buffer at the given offset. The buffer is kept until the
+// upload is done
+void GpuUploader::UploadBuffer(const void* owner, ID3D11Buffer* buffer, unsigned int bufferOffset, Data data, size_t offset, size_t bytes)
+{
+	if (bytes == 0)  return;
+
+	// Buffers are copied in pieces of MaxCopyBytes through staging buffers of that size, so they all share the same ones
+	Upload upload;
+	upload.owner       = owner;
+	upload.destination = buffer;
+	upload.subresource = bufferOffset;
+	upload.data        = std::move(data);
+	upload.offset      = offset;
+	upload.shape       = { D3D11_RESOURCE_DIMENSION_BUFFER, DXGI_FORMAT_UNKNOWN, static_cast<unsigned int>(bytes), 1 };
+	upload.rowPitch    = 0;
+	upload.blockHeight = 1;
+	upload.bandRows    = 0;
+
+	buffer->AddRef();
+	mQueuedBytes += bytes;
+	mUploads.push_back(std::move(upload));
+}
+
+
+// Copy the next uploads, up to the frame budget, without waiting for the GPU
+void GpuUploader::Update()
+{
+	mFrameBytes = 0;
+	while (!mUploads.empty() && mFrameBytes < mFrameBudget)
+	{
+		Upload& upload = mUploads.front();
+		size_t bytes = CopyBand(upload);
+		if (bytes == 0)  break; // The GPU is behind, carry on next frame
+		mFrameBytes  += bytes;
+		mQueuedBytes -= bytes;
+
+		if (RemainingBytes(upload) == 0)
+		{
+			upload.destination->Release();
+			mUploads.pop_front();
+		}
+	}
+
+	// Release the staging resources that have been left unused, e.g. those for a size of texture no longer being streamed
+	mStaging.erase(std::remove_if(mStaging.begin(), mStaging.end(), [this](const std::unique_ptr<Staging>& staging)
+	{
+		if (mFrame - staging->lastUsedFrame < IdleFramesBeforeRelease)  return false;
+		staging->resource->Release();
+		return true;
+	}), mStaging.end());
+
+	++mFrame;
+}
+
+
+// Whether the given owner has uploads still to be copied
+bool GpuUploader::IsPending(const void* owner)
+{
+	return std::any_of(mUploads.begin(), mUploads.end(), [owner](const Upload& upload) { return upload.owner == owner; });
+}
+
+
+// Drop the uploads of the given owner that haven't been copied. The bands already copied stay on their way to the GPU
+void GpuUploader::Cancel(const void* owner)
+{
+	mUploads.erase(std::remove_if(mUploads.begin(), mUploads.end(), [this, owner](Upload& upload)
+	{
+		if (upload.owner != owner)  return false;
+		mQueuedBytes -= RemainingBytes(upload);
+		upload.destination->Release();
+		return true;
+	}), mUploads.end());
+}
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions
+//--------------------------------------------------------------------------------------
+
+// Copy the next band of an upload. Returns the bytes copied, 0 if there was no staging resource free to copy with this frame
+size_t GpuUploader::CopyBand(Upload& upload)
+{
+	D3D11_MAPPED_SUBRESOURCE mapped;
+	if (upload.shape.dimension == D3D11_RESOURCE_DIMENSION_BUFFER)
+	{
+		Staging* staging = MapStaging({ D3D11_RESOURCE_DIMENSION_BUFFER, DXGI_FORMAT_UNKNOWN, static_cast<unsigned int>(MaxCopyBytes), 1 }, mapped);
+		if (staging == nullptr)  return 0;
+
+		unsigned int bytes = (std::min)(upload.shape.width - upload.done, static_cast<unsigned int>(MaxCopyBytes));
+		memcpy(mapped.pData, upload.data->data() + upload.offset + upload.done, bytes);
+		gD3DImmediateContext->Unmap(staging->resource, 0);
+
+		D3D11_BOX box = { 0, 0, 0, bytes, 1, 1 };
+		gD3DImmediateContext->CopySubresourceRegion(upload.destination, 0, upload.subresource + upload.done, 0, 0, staging->resource, 0, &box);
+		upload.done += bytes;
+		return bytes;
+	}
+
+	// Every band of a texture uses a staging texture of the full band's size, the last band only copies the rows it has
+	Staging* staging = MapStaging({ D3D11_RESOURCE_DIMENSION_TEXTURE2D, upload.shape.format,
+	                                upload.shape.width, upload.bandRows * upload.blockHeight }, mapped);
+	if (staging == nullptr)  return 0;
+
+	unsigned int rows = (std::min)(upload.shape.height / upload.blockHeight - upload.done, upload.bandRows);
+	const uint8_t* source = upload.data->data() + upload.offset + static_cast<size_t>(upload.done) * upload.rowPitch;
+	for (unsigned int row = 0; row < rows; ++row)
+	{
+		memcpy(static_cast<uint8_t*>(mapped.pData) + row * mapped.RowPitch, source + row * upload.rowPitch,
+		       (std::min)(upload.rowPitch, mapped.RowPitch));
+	}
+	gD3DImmediateContext->Unmap(staging->resource, 0);
+
+	D3D11_BOX box = { 0, 0, 0, upload.shape.width, rows * upload.blockHeight, 1 };
+	gD3DImmediateContext->CopySubresourceRegion(upload.destination, upload.subresource, 0, upload.done * upload.blockHeight, 0,
+	                                            staging->resource, 0, &box);
+	upload.done += rows;
+	return static_cast<size_t>(rows) * upload.rowPitch;
+}
+
+
+// A staging resource of the given shape the GPU has finished with, mapped for writing. Made if there are none. Mapping with
+// DO_NOT_WAIT fails at once for those the GPU has yet to copy from. Staging resources are in system memory, so they aren't
+// recorded with the GPU memory (see GpuMemory.h)
+GpuUploader::Staging* GpuUploader::MapStaging(const Shape& shape, D3D11_MAPPED_SUBRESOURCE& mapped)
+{
+	int numOfShape = 0;
+	for (auto& staging : mStaging)
+	{
+		if (!(staging->shape == shape))  continue;
+		++numOfShape;
+		if (SUCCEEDED(gD3DImmediateContext->Map(staging->resource, 0, D3D11_MAP_WRITE, D3D11_MAP_FLAG_DO_NOT_WAIT, &mapped)))
+		{
+			staging->lastUsedFrame = mFrame;
+			return staging.get();
+		}
+	}
+	if (numOfShape >= MaxStagingPerShape)  return nullptr;
+
+	ID3D11Resource* resource = nullptr;
+	HRESULT result;
+	if (shape.dimension == D3D11_RESOURCE_DIMENSION_BUFFER)
+	{
+		D3D11_BUFFER_DESC desc = {};
+		desc.ByteWidth      = shape.width;
+		desc.Usage          = D3D11_USAGE_STAGING;
+		desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+		result = gD3DDevice->CreateBuffer(&desc, nullptr, reinterpret_cast<ID3D11Buffer**>(&resource));
+	}
+	else
+	{
+		D3D11_TEXTURE2D_DESC desc = {};
+		desc.Width            = shape.width;
+		desc.Height           = shape.height;
+		desc.MipLevels        = 1;
+		desc.ArraySize        = 1;
+		desc.Format           = shape.format;
+		desc.SampleDesc.Count = 1;
+		desc.Usage            = D3D11_USAGE_STAGING;
+		desc.CPUAccessFlags   = D3D11_CPU_ACCESS_WRITE;
+		result = gD3DDevice->CreateTexture2D(&desc, nullptr, reinterpret_cast<ID3D11Texture2D**>(&resource));
+	}
+	if (FAILED(result))  return nullptr;
+	if (FAILED(gD3DImmediateContext->Map(resource, 0, D3D11_MAP_WRITE, 0, &mapped)))
+	{
+		resource->Release();
+		return nullptr;
+	}
+
+	mStaging.push_back(std::make_unique<Staging>());
+	mStaging.back()->shape         = shape;
+	mStaging.back()->resource      = resource;
+	mStaging.back()->lastUsedFrame = mFrame;
+	return mStaging.back().get();
+}
+
+
+// Bytes of an upload still to be copied
+size_t GpuUploader::RemainingBytes(const Upload& upload)
+{
+	if (upload.shape.dimension == D3D11_RESOURCE_DIMENSION_BUFFER)  return upload.shape.width - upload.done;
+	return static_cast<size_t>(upload.shape.height / upload.blockHeight - upload.done) * upload.rowPitch;
+}
@@ -0,0 +1,149 @@
+//--------------------------------------------------------------------------------------
+// GPU uploader - data copied up to the GPU a little at a time
+//--------------------------------------------------------------------------------------
+// Making a texture or buffer with its initial data, or UpdateSubresource into one, hands all of
+// its data to the driver at once, which copies it in the same frame - a large texture loaded
+// mid-session shows as a hitch. Instead the data here is written into staging resources, which
+// the CPU can write, and copied into the destination on the GPU with CopySubresourceRegion. Only
+// so many bytes are copied each frame, so a large upload is spread over several frames.
+//
+// Large subresources are copied in bands of rows, so each copy is small. The staging resources
+// are shared by everyone uploading, made as needed for each size and format of band and reused
+// once the GPU has finished copying from them, so a steady stream of uploads cycles through a
+// ring of a few of them. Those left unused for a while are released. This is the reverse of
+// GpuReadback (see GpuReadback.h).
+//
+// The uploads are done in the order they were asked for. The destination isn't ready to use until
+// all of its uploads are done (see IsPending). Used for the mip-maps of streamed textures (see
+// TextureStreamer.h), and can be used in the same way for mesh buffers.
+
+#include <d3d11.h>
+#include <memory>
+#include <vector>
+#include <deque>
+#include "stdint.h"
+
+#ifndef _GPU_UPLOADER_H_INCLUDED_
+#define _GPU_UPLOADER_H_INCLUDED_
+
+class GpuUploader
+{
+//--------------------------------------------------------------------------------------
+// Construction / Usage
+//--------------------------------------------------------------------------------------
+public:
+
+	// The frame budget is the most bytes copied each frame, though at least one band is copied each frame however large
+	GpuUploader(size_t frameBudget = DefaultFrameBudget);
+	~GpuUploader();
+
+	GpuUploader(const GpuUploader&) = delete;
+	GpuUploader& operator=(const GpuUploader&) = delete;
+
+
+	// The data to upload, shared by the uploads made from it (e.g. every mip-map of a texture) and kept until they are done
+	using Data = std::shared_ptr<const std::vector<uint8_t>>;
+
+	// Upload a subresource of a 2D texture from the data, starting at the given offset. The rows (of 4x4 blocks for the block
+	// compressed formats) are rowPitch bytes apart and there are as many as the subresource has. The owner is anything that
+	// identifies the uploader, for IsPending and Cancel. The texture must be D3D11_USAGE_DEFAULT and not multisampled, it is
+	// kept until the upload is done. Call on the main thread
+	void UploadTexture(const void* owner, ID3D11Texture2D* texture, unsigned int subresource,
+	                   Data data, size_t offset, unsigned int rowPitch);
+
+	// Upload bytes from the data, starting at the given offset, into a buffer at the given offset. The buffer must be
+	// D3D11_USAGE_DEFAULT, it is kept until the upload is done. Call on the main thread
+	void UploadBuffer(const void* owner, ID3D11Buffer* buffer, unsigned int bufferOffset, Data data, size_t offset, size_t bytes);
+
+	// Copy the next uploads, up to the frame budget, without waiting for the GPU. Call once per frame on the immediate context
+	void Update();
+
+	// Whether the given owner has uploads still to be copied. Once there are none the destinations can be used, the GPU does
+	// the copies before anything rendered after them
+	bool IsPending(const void* owner);
+
+	// Drop the uploads of the given owner that haven't been copied, e.g. before the destination is released
+	void Cancel(const void* owner);
+
+	// Bytes still to be copied, and copied in the last Update
+	size_t QueuedBytes()  { return mQueuedBytes; }
+	size_t FrameBytes()   { return mFrameBytes; }
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions / data
+//--------------------------------------------------------------------------------------
+private:
+
+	static constexpr size_t DefaultFrameBudget = 4 * 1024 * 1024;
+
+	// Largest single copy, subresources larger than this are copied in bands of rows
+	static constexpr size_t MaxCopyBytes = 1024 * 1024;
+
+	// Staging resources not used for this many frames are released
+	static constexpr unsigned int IdleFramesBeforeRelease = 120;
+
+	// Most staging resources made of each shape. When the GPU falls further behind than that, copies wait for the next frame
+	static constexpr int MaxStagingPerShape = 4;
+
+	// The size and format of a staging resource: buffers have their bytes in width and an unknown format
+	struct Shape
+	{
+		D3D11_RESOURCE_DIMENSION dimension;
+		DXGI_FORMAT              format;
+		unsigned int             width, height;
+
+		bool operator==(const Shape& other) const
+		{
+			return dimension == other.dimension && format == other.format && width == other.width && height == other.height;
+		}
+	};
+
+	struct Staging
+	{
+		Shape           shape;
+		ID3D11Resource* resource = nullptr;
+		unsigned int    lastUsedFrame = 0;
+	};
+
+	// An upload still to be copied, holding a reference to the destination until it is done or cancelled
+	struct Upload
+	{
+		const void*     owner;
+		ID3D11Resource* destination;
+		unsigned int    subresource;  // Or the offset into a buffer
+		Data            data;
+		size_t          offset;
+		Shape           shape;        // Of the whole subresource (texture sizes rounded up to whole blocks), or the bytes
+		unsigned int    rowPitch;     // Bytes between rows of blocks, textures only
+		unsigned int    blockHeight;  // Texels in a row of blocks, textures only
+		unsigned int    bandRows;     // Rows of blocks in each copy, textures only
+		unsigned int    done = 0;     // Rows of blocks (texture) or bytes (buffer) copied so far
+	};
+
+	// Copy the next band of an upload. Returns the bytes copied, 0 if there was no staging resource free to copy with this
+	// frame (the GPU is behind) - the upload is left to try again next frame
+	size_t CopyBand(Upload& upload);
+
+	// A staging resource of the given shape the GPU has finished with, mapped for writing. Made if there are none. nullptr if
+	// every one of the shape is still in use by the GPU and it has the most it can, or on failure
+	Staging* MapStaging(const Shape& shape, D3D11_MAPPED_SUBRESOURCE& mapped);
+
+	// Bytes of an upload still to be copied
+	static size_t RemainingBytes(const Upload& upload);
+
+
+	std::vector<std::unique_ptr<Staging>> mStaging;
+	std::deque<Upload>                    mUploads; // In the order they were asked for
+	size_t                                mFrameBudget;
+	size_t                                mQueuedBytes = 0;
+	size_t                                mFrameBytes = 0;
+	unsigned int                          mFrame = 0;
+};
+
+
+// The uploader used by the app, created in InitGeometry (see Scene.cpp)
+extern GpuUploader* gGpuUploader;
+
+
+#endif //_GPU_UPLOADER_H_INCLUDED_
@@ -0,0 +1,350 @@
+//--------------------------------------------------------------------------------------
+// Hierarchical depth (Hi-Z) buffer - occlusion culling from the depth of an earlier frame
+//--------------------------------------------------------------------------------------
+
+#include "HiZBuffer.h"
+#include "Shader.h"
+#include "Common.h"
+#include "GraphicsHelpers.h"
+#include "GpuEvents.h"
+#include "GpuMemory.h"
+#include "GpuReadback.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cstring>
+
+
+// Settings for the pyramid shaders, matches HiZConstants in HiZ_cs.hlsl and HiZMultisampled_cs.hlsl
+struct HiZConstants
+{
+	unsigned int sourceWidth; // Parts of the level read and the level written that are in use
+	unsigned int sourceHeight;
+	unsigned int destWidth;
+	unsigned int destHeight;
+};
+
+// Texels written by each thread group across and down, must match numthreads in the pyramid shaders
+static const unsigned int HIZ_THREAD_GROUP_SIZE = 8;
+
+
+// Size of a level half the size of another, rounded up so every texel of the other is under one of it
+static int HalfSize(int size)
+{
+	return (size + 1) / 2;
+}
+
+
+HiZBuffer::~HiZBuffer()
+{
+	Release();
+}
+
+
+//--------------------------------------------------------------------------------------
+// Usage
+//--------------------------------------------------------------------------------------
+
+// Build the pyramid of the given depth buffer, rendered with the given view-projection matrix into its top left width x
+// height pixels. Returns false with a message in gLastError on failure
+bool HiZBuffer::Build(ID3D11ShaderResourceView* depth, int width, int height, const CMatrix4x4& viewProjection)
+{
+	// The textures are made again for a new depth buffer (e.g. after a resize), the copies in flight are dropped
+	if (depth != mDepth && !Create(depth))
+	{
+		Release();
+		return false;
+	}
+
+	// Each level from the one below, the first from the depth buffer. The level written is unbound before the next reads it
+	ID3D11ShaderResourceView*  nullSRV = nullptr;
+	ID3D11UnorderedAccessView* nullUAV = nullptr;
+	gD3DContext->CSSetConstantBuffers(0, 1, &mConstantBuffer);
+	HiZConstants constants = { static_cast<unsigned int>(width), static_cast<unsigned int>(height), 0, 0 };
+	for (int level = 0; level < mNumGpuLevels; ++level)
+	{
+		constants.destWidth  = HalfSize(constants.sourceWidth);
+		constants.destHeight = HalfSize(constants.sourceHeight);
+		UpdateConstantBuffer(mConstantBuffer, constants);
+
+		ID3D11ShaderResourceView* source = level == 0 ? mDepthArray : mLevelSRVs[level - 1];
+		gD3DContext->CSSetShader(level == 0 && mMultisampled ? gHiZMultisampledComputeShader : gHiZComputeShader, nullptr, 0);
+		gD3DContext->CSSetShaderResources(0, 1, &source);
+		gD3DContext->CSSetUnorderedAccessViews(0, 1, &mLevelUAVs[level], nullptr);
+		gD3DContext->Dispatch((constants.destWidth  + HIZ_THREAD_GROUP_SIZE - 1) / HIZ_THREAD_GROUP_SIZE,
+		                      (constants.destHeight + HIZ_THREAD_GROUP_SIZE - 1) / HIZ_THREAD_GROUP_SIZE, 1);
+		gD3DContext->CSSetUnorderedAccessViews(0, 1, &nullUAV, nullptr);
+
+		constants.sourceWidth  = constants.destWidth;
+		constants.sourceHeight = constants.destHeight;
+	}
+	gD3DContext->CSSetShaderResources(0, 1, &nullSRV);
+	gD3DContext->CSSetShader(nullptr, nullptr, 0);
+
+	// Copy the last level towards the CPU, skipped while the GPU is too far behind for another. It arrives in a later frame's
+	// GpuReadback::Update with the size of the depth and the camera it was built from, and only the part in use is read. The
+	// whole level is copied so the staging texture is the same size whatever part of it is in use
+	if (gGpuReadback->Read(this, mPyramid, mNumGpuLevels - 1, nullptr, CopyArrived, mNextCopy))
+	{
+		Copy& copy = mCopies[mNextCopy];
+		copy.width  = width;
+		copy.height = height;
+		copy.viewProjection = viewProjection;
+		mNextCopy = (mNextCopy + 1) % GpuReadback::MaxCopiesPerOwner;
+	}
+	return true;
+}
+
+
+// Whether the given sphere is certainly hidden in the last depth to arrive
+bool HiZBuffer::IsOccluded(const BoundingSphere& sphere) const
+{
+	if (mNumLevels == 0)  return false;
+
+	// The corners of the box around the sphere with the camera of the depth. Points are row vectors, so each corner is the
+	// centre's clip space position plus or minus the radius times each of the first three rows of the matrix
+	const CMatrix4x4& m = mViewProjection;
+	const float* rows[3] = { &m.e00, &m.e10, &m.e20 };
+	CVector4 centre = CVector4(sphere.centre, 1) * m;
+	float minX = FLT_MAX, maxX = -FLT_MAX, minY = FLT_MAX, maxY = -FLT_MAX;
+	float nearestDepth = 0;
+	for (int corner = 0; corner < 8; ++corner)
+	{
+		float clip[4] = { centre.x, centre.y, centre.z, centre.w };
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			float offset = (corner & (1 << axis)) ? sphere.radius : -sphere.radius;
+			for (int i = 0; i < 4; ++i)  clip[i] += offset * rows[axis][i];
+		}
+		if (clip[3] <= 0)  return false; // Reaches behind the camera
+
+		float x = clip[0] / clip[3];
+		float y = clip[1] / clip[3];
+		minX = (std::min)(minX, x);  maxX = (std::max)(maxX, x);
+		minY = (std::min)(minY, y);  maxY = (std::max)(maxY, y);
+		nearestDepth = (std::max)(nearestDepth, clip[2] / clip[3]); // Reversed depth, nearer is greater
+	}
+
+	// Nothing is known of what was beyond the edges of the view
+	if (minX < -1 || maxX > 1 || minY < -1 || maxY > 1)  return false;
+
+	// The texels of the first level under the box, then the level where those are no more than 2x2 texels
+	int left   = static_cast<int>((minX * 0.5f + 0.5f) * mWidth);
+	int right  = (std::min)(static_cast<int>((maxX * 0.5f + 0.5f) * mWidth), mWidth - 1);
+	int top    = static_cast<int>((0.5f - maxY * 0.5f) * mHeight);
+	int bottom = (std::min)(static_cast<int>((0.5f - minY * 0.5f) * mHeight), mHeight - 1);
+	left /= mTexelPixels;  right  /= mTexelPixels;
+	top  /= mTexelPixels;  bottom /= mTexelPixels;
+	int level = 0;
+	while (level < mNumLevels - 1 && ((right >> level) - (left >> level) > 1 || (bottom >> level) - (top >> level) > 1))  ++level;
+
+	// Hidden if the nearest of the box is further than the farthest of what was drawn there
+	const Level& texels = mLevels[level];
+	float farthestDepth = 1;
+	for (int y = top >> level; y <= bottom >> level; ++y)
+	for (int x = left >> level; x <= right >> level; ++x)
+	{
+		farthestDepth = (std::min)(farthestDepth, texels.depths[y * texels.width + x]);
+	}
+	return nearestDepth < farthestDepth;
+}
+
+
+// Forget the depth built so far and the copies on their way. Keeps the textures
+void HiZBuffer::Reset()
+{
+	gGpuReadback->Cancel(this);
+	mNumLevels = 0;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions
+//--------------------------------------------------------------------------------------
+
+// Make the pyramid textures for the given depth buffer. Returns false with a message in gLastError on failure
+bool HiZBuffer::Create(ID3D11ShaderResourceView* depth)
+{
+	Release();
+	mDepth = depth;
+	mDepth->AddRef();
+
+	ID3D11Resource*  resource = nullptr;
+	ID3D11Texture2D* texture  = nullptr;
+	depth->GetResource(&resource);
+	HRESULT hr = resource->QueryInterface(__uuidof(ID3D11Texture2D), reinterpret_cast<void**>(&texture));
+	resource->Release();
+	if (FAILED(hr))
+	{
+		gLastError = "Occlusion culling depth buffer isn't a 2D texture";
+		return false;
+	}
+	D3D11_TEXTURE2D_DESC textureDesc;
+	texture->GetDesc(&textureDesc);
+
+	// View the same slice as the view given, as an array of one slice, so the shaders read every kind of depth buffer the same way
+	D3D11_SHADER_RESOURCE_VIEW_DESC depthDesc;
+	depth->GetDesc(&depthDesc);
+	D3D11_SHADER_RESOURCE_VIEW_DESC arrayDesc = {};
+	arrayDesc.Format = depthDesc.Format;
+	mMultisampled = textureDesc.SampleDesc.Count > 1;
+	if (mMultisampled)
+	{
+		arrayDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2DMSARRAY;
+		arrayDesc.Texture2DMSArray.FirstArraySlice = depthDesc.ViewDimension == D3D11_SRV_DIMENSION_TEXTURE2DMSARRAY ?
+		                                             depthDesc.Texture2DMSArray.FirstArraySlice : 0;
+		arrayDesc.Texture2DMSArray.ArraySize = 1;
+	}
+	else
+	{
+		arrayDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2DARRAY;
+		arrayDesc.Texture2DArray.MostDetailedMip = 0;
+		arrayDesc.Texture2DArray.MipLevels = 1;
+		arrayDesc.Texture2DArray.FirstArraySlice = depthDesc.ViewDimension == D3D11_SRV_DIMENSION_TEXTURE2DARRAY ?
+		                                           depthDesc.Texture2DArray.FirstArraySlice : 0;
+		arrayDesc.Texture2DArray.ArraySize = 1;
+	}
+	hr = gD3DDevice->CreateShaderResourceView(texture, &arrayDesc, &mDepthArray);
+	texture->Release();
+	if (FAILED(hr))
+	{
+		gLastError = "Error creating occlusion culling depth buffer view";
+		return false;
+	}
+
+	// Levels from half the depth buffer's size down to the first narrower than MaxCpuWidth. The first level is rounded up to a
+	// multiple of the last level's texel size, so each level is exactly half of the one before
+	int firstWidth  = HalfSize(static_cast<int>(textureDesc.Width));
+	int firstHeight = HalfSize(static_cast<int>(textureDesc.Height));
+	mNumGpuLevels = 1;
+	for (int width = firstWidth; width > MaxCpuWidth; width = HalfSize(width))  ++mNumGpuLevels;
+	int lastTexel = 1 << (mNumGpuLevels - 1);
+	firstWidth  = (firstWidth  + lastTexel - 1) / lastTexel * lastTexel;
+	firstHeight = (firstHeight + lastTexel - 1) / lastTexel * lastTexel;
+
+	mConstantBuffer = CreateConstantBuffer(sizeof(HiZConstants));
+	if (mConstantBuffer == nullptr)
+	{
+		gLastError = "Error creating occlusion culling constant buffer";
+		return false;
+	}
+
+	D3D11_TEXTURE2D_DESC pyramidDesc = {};
+	pyramidDesc.Width  = firstWidth;
+	pyramidDesc.Height = firstHeight;
+	pyramidDesc.MipLevels = mNumGpuLevels;
+	pyramidDesc.ArraySize = 1;
+	pyramidDesc.Format = DXGI_FORMAT_R32_FLOAT;
+	pyramidDesc.SampleDesc.Count = 1;
+	pyramidDesc.Usage = D3D11_USAGE_DEFAULT;
+	pyramidDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS;
+	if (FAILED(gD3DDevice->CreateTexture2D(&pyramidDesc, nullptr, &mPyramid)))
+	{
+		gLastError = "Error creating occlusion culling pyramid";
+		return false;
+	}
+	SetDebugNames("Hi-Z Pyramid", mPyramid, nullptr);
+	RegisterGpuResource(mPyramid, "Occlusion Culling");
+
+	mLevelSRVs.resize(mNumGpuLevels, nullptr);
+	mLevelUAVs.resize(mNumGpuLevels, nullptr);
+	for (int level = 0; level < mNumGpuLevels; ++level)
+	{
+		D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+		srvDesc.Format = DXGI_FORMAT_R32_FLOAT;
+		srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2DARRAY; // Read like the depth buffer
+		srvDesc.Texture2DArray.MostDetailedMip = level;
+		srvDesc.Texture2DArray.MipLevels = 1;
+		srvDesc.Texture2DArray.ArraySize = 1;
+		D3D11_UNORDERED_ACCESS_VIEW_DESC uavDesc = {};
+		uavDesc.Format = DXGI_FORMAT_R32_FLOAT;
+		uavDesc.ViewDimension = D3D11_UAV_DIMENSION_TEXTURE2D;
+		uavDesc.Texture2D.MipSlice = level;
+		if (FAILED(gD3DDevice->CreateShaderResourceView(mPyramid, &srvDesc, &mLevelSRVs[level])) ||
+			FAILED(gD3DDevice->CreateUnorderedAccessView(mPyramid, &uavDesc, &mLevelUAVs[level])))
+		{
+			gLastError = "Error creating occlusion culling pyramid views";
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+// Called by GpuReadback::Update with a copy of the GPU's last level that has arrived, makes the CPU levels from it
+void HiZBuffer::CopyArrived(void* owner, int slot, const D3D11_MAPPED_SUBRESOURCE& mapped)
+{
+	HiZBuffer* hiZ = static_cast<HiZBuffer*>(owner);
+	hiZ->ReadCopy(mapped, hiZ->mCopies[slot]);
+}
+
+// Make the CPU levels from a copy of the GPU's last level, of a depth of the copy's size rendered with its view-projection
+// matrix
+
+void HiZBuffer::ReadCopy(const D3D11_MAPPED_SUBRESOURCE& mapped, const Copy& copy)
+{
+	// The part of the GPU's last level in use, then the levels above it down to a single texel
+	int width = copy.width, height = copy.height;
+	for (int level = 0; level < mNumGpuLevels; ++level)
+	{
+		width  = HalfSize(width);
+		height = HalfSize(height);
+	}
+	int numLevels = 1;
+	for (int w = width, h = height; w > 1 || h > 1; w = HalfSize(w), h = HalfSize(h))  ++numLevels;
+	if (static_cast<int>(mLevels.size()) < numLevels)  mLevels.resize(numLevels);
+
+	Level& first = mLevels[0];
+	first.width  = width;
+	first.height = height;
+	first.depths.resize(width * height);
+	for (int y = 0; y < height; ++y)
+	{
+		std::memcpy(&first.depths[y * width], static_cast<const uint8_t*>(mapped.pData) + y * mapped.RowPitch, width * sizeof(float));
+	}
+
+	// Each CPU level takes the farthest of the 2x2 texels under each texel, as the shaders do
+	for (int l = 1; l < numLevels; ++l)
+	{
+		const Level& below = mLevels[l - 1];
+		Level& level = mLevels[l];
+		level.width  = HalfSize(below.width);
+		level.height = HalfSize(below.height);
+		level.depths.resize(level.width * level.height);
+		for (int y = 0; y < level.height; ++y)
+		{
+			const float* row0 = &below.depths[(y * 2) * below.width];
+			const float* row1 = &below.depths[(std::min)(y * 2 + 1, below.height - 1) * below.width];
+			for (int x = 0; x < level.width; ++x)
+			{
+				int x0 = x * 2;
+				int x1 = (std::min)(x * 2 + 1, below.width - 1);
+				level.depths[y * level.width + x] = (std::min)((std::min)(row0[x0], row0[x1]), (std::min)(row1[x0], row1[x1]));
+			}
+		}
+	}
+
+	mNumLevels   = numLevels;
+	mTexelPixels = 1 << mNumGpuLevels;
+	mWidth  = copy.width;
+	mHeight = copy.height;
+	mViewProjection = copy.viewProjection;
+}
+
+
+// Release the textures and the depth buffer view the pyramid is built from
+void HiZBuffer::Release()
+{
+	if (gGpuReadback)  gGpuReadback->Cancel(this);
+	for (auto& uav : mLevelUAVs)  if (uav)  uav->Release();
+	for (auto& srv : mLevelSRVs)  if (srv)  srv->Release();
+	mLevelUAVs.clear();
+	mLevelSRVs.clear();
+	if (mPyramid)         { mPyramid->Release();         mPyramid         = nullptr; }
+	if (mConstantBuffer)  { mConstantBuffer->Release();  mConstantBuffer  = nullptr; }
+	if (mDepthArray)      { mDepthArray->Release();      mDepthArray      = nullptr; }
+	if (mDepth)           { mDepth->Release();           mDepth           = nullptr; }
+	mNumGpuLevels = 0;
+	Reset();
+}
@@ -0,0 +1,126 @@
+//--------------------------------------------------------------------------------------
+// Hierarchical depth (Hi-Z) buffer - occlusion culling from the depth of an earlier frame
+//--------------------------------------------------------------------------------------
+// Frustum culling still draws everything in front of the camera, including what is hidden
+// behind the hills. After a pass has rendered, a compute shader builds a pyramid of its depth:
+// each texel of a level holds the farthest depth of the 2x2 texels under it in the level below,
+// so one texel gives the farthest depth of a whole block of the screen. A small level is copied
+// to the CPU without waiting for the GPU (see GpuReadback.h), arriving a few
+// frames later, and the rest of the pyramid is built from it on the CPU.
+//
+// An object is then tested by projecting the box around its bounding sphere with the camera the
+// depth was rendered from, and reading the level where the box covers no more than 2x2 texels.
+// If the nearest point of the box is further away than the farthest depth there, something that
+// was drawn hides all of it and it is culled. Objects partly outside that camera's view, or
+// reaching behind it, are never culled. Depths are reversed (see MakeProjectionMatrix), pixels
+// where nothing was drawn are 0 and so never hide anything.
+//
+// Being several frames old, the depth can be out of date when the camera moves quickly, and an
+// object coming out from behind a hill can appear a frame or two late. Each pass that can use
+// occlusion culling has its own pyramid, the main pass and each water group's refraction and
+// reflection (see Scene.cpp).
+
+#include "Frustum.h"
+#include "CMatrix4x4.h"
+#include "GpuReadback.h"
+#include <d3d11.h>
+#include <vector>
+
+#ifndef _HIZ_BUFFER_H_INCLUDED_
+#define _HIZ_BUFFER_H_INCLUDED_
+
+class HiZBuffer
+{
+//--------------------------------------------------------------------------------------
+// Construction / Usage
+//--------------------------------------------------------------------------------------
+public:
+
+	// Nothing is created until the first call to Build
+	HiZBuffer() = default;
+	~HiZBuffer();
+
+	HiZBuffer(const HiZBuffer&) = delete;
+	HiZBuffer& operator=(const HiZBuffer&) = delete;
+
+
+	// Build the pyramid of the given depth buffer, rendered with the given view-projection matrix into its top left width x
+	// height pixels (less than the whole texture with dynamic resolution). The depth is a shader resource view of an R32_FLOAT
+	// texture, which may be multisampled or one slice of an array, and must not be bound as a depth buffer. The level for the
+	// CPU is copied towards it, and taken as the depth to cull against when it arrives in a later frame's GpuReadback::Update.
+	// Call on the immediate context once per frame after the pass, while no pass is culling. Returns false with a message in
+	// gLastError on failure
+	bool Build(ID3D11ShaderResourceView* depth, int width, int height, const CMatrix4x4& viewProjection);
+
+	// Whether the given sphere is certainly hidden in the last depth to arrive. False until one has. Doesn't change the pyramid,
+	// so passes on several threads can test at once, but not during Build
+	bool IsOccluded(const BoundingSphere& sphere) const;
+
+	// Forget the depth built so far and the copies on their way, e.g. when the scene it was of has changed. Keeps the textures
+	void Reset();
+
+	// Release the textures and the depth buffer view the pyramid is built from, e.g. when that depth buffer is released
+	void Release();
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions / data
+//--------------------------------------------------------------------------------------
+private:
+
+	// Make the pyramid textures for the depth buffer given to Build. Returns false with a message in gLastError on failure
+	bool Create(ID3D11ShaderResourceView* depth);
+
+	// The size of the depth and the camera each copy on its way was built from, in the slot given to GpuReadback::Read. The
+	// slots are used in turn, from mNextCopy
+	struct Copy
+	{
+		int        width = 0;  // Pixels of the depth buffer rendered to
+		int        height = 0;
+		CMatrix4x4 viewProjection;
+	};
+
+	// Called by GpuReadback::Update with a copy of the GPU's last level that has arrived, makes the CPU levels from it
+	static void CopyArrived(void* owner, int slot, const D3D11_MAPPED_SUBRESOURCE& mapped);
+	void ReadCopy(const D3D11_MAPPED_SUBRESOURCE& mapped, const Copy& copy);
+
+
+	// Levels narrower than this are copied to the CPU. At 1080p that is a level of 120 x 68 texels, each 16 pixels across
+	static constexpr int MaxCpuWidth = 160;
+
+	// The depth buffer the pyramid is made for (a reference is held so another can't take its address), and a view of it as an
+	// array, which is how the compute shaders read it whatever it is
+	ID3D11ShaderResourceView* mDepth        = nullptr;
+	ID3D11ShaderResourceView* mDepthArray   = nullptr;
+	bool                      mMultisampled = false;
+
+	// The GPU levels, the first half the size of the depth buffer and the last the level copied to the CPU, with a view of each
+	// to read it as an array and write it. The first level's size is a multiple of the last's, so each level is exactly half of
+	// the one before and a texel covers the same texels of the level below in every level
+	ID3D11Texture2D*                        mPyramid = nullptr;
+	int                                     mNumGpuLevels = 0;
+	std::vector<ID3D11ShaderResourceView*>  mLevelSRVs;
+	std::vector<ID3D11UnorderedAccessView*> mLevelUAVs;
+	ID3D11Buffer*                           mConstantBuffer = nullptr;
+
+	Copy mCopies[GpuReadback::MaxCopiesPerOwner];
+	int  mNextCopy = 0;
+
+	// The depth that last arrived: the GPU's last level and the levels above it made on the CPU down to a single texel, with
+	// the depth buffer pixels across one texel of the first of them and the size and camera of the copy
+	struct Level
+	{
+		int                width = 0;
+		int                height = 0;
+		std::vector<float> depths; // Farthest depth over each texel, row by row
+	};
+	std::vector<Level> mLevels;        // Kept when reset, so only allocates when the levels get larger
+	int                mNumLevels = 0; // 0 until a copy has arrived
+	int                mTexelPixels = 1;
+	int                mWidth = 0;
+	int                mHeight = 0;
+	CMatrix4x4         mViewProjection;
+};
+
+
+#endif //_HIZ_BUFFER_H_INCLUDED_
@@ -0,0 +1,47 @@
+//--------------------------------------------------------------------------------------
+// Hi-Z pyramid compute shader for multisampled depth
+//--------------------------------------------------------------------------------------
+// Makes the first level of the occlusion culling depth pyramid from a multisampled depth buffer, as HiZ_cs.hlsl does from
+// one that isn't. Each texel is the farthest of every sample of the 2x2 pixels under it, so the edges of models, where only
+// some samples are covered, don't hide what is behind them
+
+
+//--------------------------------------------------------------------------------------
+// Constants / textures
+//--------------------------------------------------------------------------------------
+
+static const uint HiZThreadGroupSize = 8; // Must match HIZ_THREAD_GROUP_SIZE in HiZBuffer.cpp
+
+// These variables must match exactly the HiZConstants structure in HiZBuffer.cpp
+cbuffer HiZConstants : register(b0)
+{
+	uint2 gSourceSize; // Parts of the depth buffer read and the level written that are in use
+	uint2 gDestSize;
+}
+
+Texture2DMSArray<float> Source : register(t0); // The depth buffer, viewed as an array of one slice
+RWTexture2D<float>      Dest   : register(u0);
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+[numthreads(HiZThreadGroupSize, HiZThreadGroupSize, 1)]
+void main(uint3 id : SV_DispatchThreadID)
+{
+	if (any(id.xy >= gDestSize))  return;
+
+	uint width, height, elements, samples;
+	Source.GetDimensions(width, height, elements, samples);
+
+	uint2 first = id.xy * 2;
+	uint2 last  = min(first + 1, gSourceSize - 1);
+	float depth = 1.0f;
+	for (uint i = 0; i < samples; ++i)
+	{
+		depth = min(depth, min(min(Source.Load(int3(first.x, first.y, 0), i), Source.Load(int3(last.x, first.y, 0), i)),
+		                       min(Source.Load(int3(first.x, last.y,  0), i), Source.Load(int3(last.x, last.y,  0), i))));
+	}
+	Dest[id.xy] = depth;
+}
@@ -0,0 +1,42 @@
+//--------------------------------------------------------------------------------------
+// Hi-Z pyramid compute shader
+//--------------------------------------------------------------------------------------
+// Makes one level of the occlusion culling depth pyramid from the level below it, or the first level from a depth buffer
+// (see HiZBuffer.h). Each texel is the farthest of the 2x2 texels under it. The level below is rounded up to an even size
+// by repeating its last row and column, so every texel of it is under a texel of this level. Depths are reversed, so the
+// farthest is the smallest
+// The compute shaders don't use the rendering constant buffers so have their own, and don't include Common.hlsli
+
+
+//--------------------------------------------------------------------------------------
+// Constants / textures
+//--------------------------------------------------------------------------------------
+
+static const uint HiZThreadGroupSize = 8; // Must match HIZ_THREAD_GROUP_SIZE in HiZBuffer.cpp
+
+// These variables must match exactly the HiZConstants structure in HiZBuffer.cpp
+cbuffer HiZConstants : register(b0) // Compute shaders have their own constant buffer slots, so b0 is not the per-frame constants here
+{
+	uint2 gSourceSize; // Parts of the level read and the level written that are in use
+	uint2 gDestSize;
+}
+
+Texture2DArray<float> Source : register(t0); // The depth buffer or the level below, viewed as an array of one slice
+RWTexture2D<float>    Dest   : register(u0);
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+[numthreads(HiZThreadGroupSize, HiZThreadGroupSize, 1)]
+void main(uint3 id : SV_DispatchThreadID)
+{
+	if (any(id.xy >= gDestSize))  return;
+
+	uint2 first = id.xy * 2;
+	uint2 last  = min(first + 1, gSourceSize - 1);
+	float depth = min(min(Source.Load(int4(first.x, first.y, 0, 0)), Source.Load(int4(last.x, first.y, 0, 0))),
+	                  min(Source.Load(int4(first.x, last.y,  0, 0)), Source.Load(int4(last.x, last.y,  0, 0))));
+	Dest[id.xy] = depth;
+}
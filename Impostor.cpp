@@ -0,0 +1,280 @@
+//--------------------------------------------------------------------------------------
+// Impostors - distant models drawn as billboards showing views baked at load time
+//--------------------------------------------------------------------------------------
+
+#include "Impostor.h"
+#include "Mesh.h"
+#include "Model.h"
+#include "TextureStreamer.h"
+#include "GraphicsHelpers.h"
+#include "StateCache.h"
+#include "State.h"
+#include "Shader.h"
+#include "GpuEvents.h"
+#include "GpuMemory.h"
+#include "Common.h"
+
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
+
+
+std::vector<Impostor*> gImpostors;
+
+// The pixel shader of each kind of pass, as a material has (see Material.h). None for the water views pass (see Render)
+static ID3D11PixelShader* const* const ImpostorPixelShaders[NumMaterialPasses] =
+{
+	&gImpostorPixelShader, &gRefractedImpostorPixelShader, &gReflectedImpostorPixelShader, &gImpostorDepthPixelShader, nullptr
+};
+
+
+//--------------------------------------------------------------------------------------
+// Construction / Usage
+//--------------------------------------------------------------------------------------
+
+// Bake the views of the given mesh drawn with the given material, on the immediate context
+// Will throw a std::runtime_error exception on failure (same as Mesh)
+Impostor::Impostor(Mesh* mesh, const Material& material)
+{
+	BoundingSphere bounds = mesh->Bounds();
+	mCentre = bounds.centre;
+	mRadius = bounds.radius * BoundsMargin;
+	mTint   = material.tint;
+
+	try
+	{
+		CreateResources();
+
+		// The model is drawn the way its material draws it in the main pass, apart from the pixel shader
+		SetVertexShader(*material.vertexShader);
+		SetShaderResource(0, material.diffuseSpecularMap->SRV()); // First parameter must match texture slot number in the shader
+		SetSampler(0, material.sampler != nullptr ? material.sampler : gAnisotropicSampler);
+		gPerModelConstants.objectColour = { 1, 1, 1 }; // The tint is applied when the impostor is lit
+		gPerModelConstants.textureLayer = static_cast<float>(material.textureLayer);
+		Bake(mesh);
+	}
+	catch (std::runtime_error)
+	{
+		Release(); // Destructor isn't called when a constructor throws
+		throw;
+	}
+}
+
+Impostor::~Impostor()
+{
+	Release();
+}
+
+
+// Draw copies of the impostor placed by the given world matrices in the given kind of pass, with one instanced draw for
+// every MaxInstances
+void Impostor::Render(MaterialPass pass, const CMatrix4x4* worldMatrices, unsigned int numInstances)
+{
+	ID3D11PixelShader* const* pixelShader = ImpostorPixelShaders[static_cast<int>(pass)];
+	if (numInstances == 0 || pixelShader == nullptr)  return;
+
+	// Billboards with no vertex buffer, the vertex shader makes the corners from the vertex ID (see Impostor_vs.hlsl)
+	SetVertexShader(gImpostorVertexShader);
+	SetPixelShader(*pixelShader);
+	SetInputLayout(nullptr);
+	SetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP);
+
+	// The colour atlas is read as the material's texture, layer 0 of an array of one. The normal and depth atlas is needed
+	// by the depth pass too, for the coverage. The t23 must match the slot in ImpostorLighting.hlsli
+	SetShaderResource(0, mAtlasSRVs[0]);
+	SetShaderResource(23, mAtlasSRVs[1]);
+	gPerModelConstants.objectColour = mTint;
+	gPerModelConstants.textureLayer = 0;
+	SetConstants(1, gPerModelConstantBuffer, gPerModelConstants);
+
+	for (unsigned int first = 0; first < numInstances; first += MaxInstances)
+	{
+		unsigned int numDrawn = (std::min)(numInstances - first, MaxInstances);
+
+		// Discarding the old contents lets the GPU carry on using them for earlier draws while we write to fresh memory
+		D3D11_MAPPED_SUBRESOURCE mapped;
+		if (FAILED(gD3DContext->Map(mInstanceBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped)))  return;
+		InstanceData* instances = static_cast<InstanceData*>(mapped.pData);
+		for (unsigned int i = 0; i < numDrawn; ++i)  instances[i] = { worldMatrices[first + i], mCentre, mRadius };
+		gD3DContext->Unmap(mInstanceBuffer, 0);
+		CountMap(numDrawn * sizeof(InstanceData));
+
+		SetShaderResource(9, mInstanceBufferSRV, VertexShaderStage); // First parameter must match texture slot number in the shader
+		gD3DContext->DrawInstanced(4, numDrawn, 0, 0);
+		CountDrawCall();
+	}
+}
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions
+//--------------------------------------------------------------------------------------
+
+// The direction from the model's centre that a frame is baked from: the centre of the frame on the octahedron unfolded
+// into the atlas, upper half in the middle. Must match OctahedralDirection in Impostor_vs.hlsl
+CVector3 Impostor::FrameDirection(int frameX, int frameY)
+{
+	float x = (frameX + 0.5f) / FramesAcross * 2 - 1;
+	float z = (frameY + 0.5f) / FramesAcross * 2 - 1;
+	CVector3 direction = { x, 1 - std::abs(x) - std::abs(z), z };
+	if (direction.y < 0) // Unfold the lower half of the octahedron
+	{
+		float fold = -direction.y;
+		direction.x += direction.x >= 0 ? -fold : fold;
+		direction.z += direction.z >= 0 ? -fold : fold;
+	}
+	return Normalise(direction);
+}
+
+// The x and y axes of the camera baking a frame from the given direction, which looks back along it. Chosen as the shadow map
+// chooses the light's (see ShadowMap::Update). Must match FrameAxes in Impostor_vs.hlsl
+void Impostor::FrameAxes(const CVector3& direction, CVector3& axisX, CVector3& axisY)
+{
+	CVector3 forward = direction * -1.0f;
+	CVector3 up = std::abs(direction.y) < 0.99f ? CVector3{ 0, 1, 0 } : CVector3{ 1, 0, 0 };
+	axisX = Normalise(Cross(up, forward));
+	axisY = Cross(forward, axisX);
+}
+
+
+// Create the atlas and the instance buffer, throws a std::runtime_error exception on failure
+void Impostor::CreateResources()
+{
+	// The view of both slices at once isn't needed, the bake selects the two slices' render targets together
+	ID3D11RenderTargetView* arrayRenderTarget = nullptr;
+	bool created = CreateRenderTargetArray(FramesAcross * FrameSize, FramesAcross * FrameSize, DXGI_FORMAT_R8G8B8A8_UNORM, 2,
+	                                       &mAtlas, &arrayRenderTarget, mAtlasRenderTargets, mAtlasSRVs, MipLevels);
+	if (arrayRenderTarget)  arrayRenderTarget->Release();
+	if (!created)  throw std::runtime_error("Error creating impostor atlas");
+	SetDebugNames("Impostor Colour", mAtlas, mAtlasSRVs[0], mAtlasRenderTargets[0]);
+	SetDebugNames("Impostor Normal Depth", nullptr, mAtlasSRVs[1], mAtlasRenderTargets[1]);
+	RegisterGpuResource(mAtlas, "Impostors");
+
+	// Dynamic structured buffer, rewritten by the CPU for each draw and read by the vertex shader
+	D3D11_BUFFER_DESC bufferDesc = {};
+	bufferDesc.ByteWidth           = sizeof(InstanceData) * MaxInstances;
+	bufferDesc.Usage               = D3D11_USAGE_DYNAMIC;
+	bufferDesc.BindFlags           = D3D11_BIND_SHADER_RESOURCE;
+	bufferDesc.CPUAccessFlags      = D3D11_CPU_ACCESS_WRITE;
+	bufferDesc.MiscFlags           = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+	bufferDesc.StructureByteStride = sizeof(InstanceData);
+
+	D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+	srvDesc.Format              = DXGI_FORMAT_UNKNOWN; // Structured buffers have no format
+	srvDesc.ViewDimension       = D3D11_SRV_DIMENSION_BUFFER;
+	srvDesc.Buffer.FirstElement = 0;
+	srvDesc.Buffer.NumElements  = MaxInstances;
+	if (FAILED(gD3DDevice->CreateBuffer(&bufferDesc, nullptr, &mInstanceBuffer)) ||
+	    FAILED(gD3DDevice->CreateShaderResourceView(mInstanceBuffer, &srvDesc, &mInstanceBufferSRV)))
+	{
+		throw std::runtime_error("Error creating impostor instance buffer");
+	}
+	RegisterGpuResource(mInstanceBuffer, "Impostors");
+}
+
+
+// Draw every frame into the atlas, with the material's vertex shader, texture and constants already selected. Throws a
+// std::runtime_error exception on failure
+void Impostor::Bake(Mesh* mesh)
+{
+	GpuEventScope event("Bake Impostor");
+
+	// A depth buffer for the bake only, the size of the whole atlas
+	ID3D11Texture2D*        depthTexture = nullptr;
+	ID3D11DepthStencilView* depthStencil = nullptr;
+	if (!CreateDepthBuffer(FramesAcross * FrameSize, FramesAcross * FrameSize, &depthTexture, &depthStencil))
+	{
+		if (depthTexture)  depthTexture->Release();
+		throw std::runtime_error("Error creating impostor depth buffer");
+	}
+
+	// A model of its own at the origin, so world space is the mesh's model space. Skinned meshes are in their default pose
+	Model* model = nullptr;
+	try
+	{
+		model = new Model(mesh);
+	}
+	catch (std::runtime_error)
+	{
+		depthStencil->Release();
+		depthTexture->Release();
+		throw;
+	}
+
+	SetRenderTargets(2, mAtlasRenderTargets, depthStencil);
+	const float clearColour[4] = { 0, 0, 0, 0 }; // No coverage where there is no model
+	ClearRenderTarget(mAtlasRenderTargets[0], clearColour);
+	ClearRenderTarget(mAtlasRenderTargets[1], clearColour);
+	ClearDepth(depthStencil);
+
+	SetGeometryShader(nullptr);
+	SetPixelShader(gImpostorBakePixelShader);
+	SetBlendState(gNoBlendingState);
+	SetDepthStencilState(gUseDepthBufferState);
+	SetRasterizerState(gCullBackState);
+
+	// Nothing is clipped against the water. The rest of the frame's constants are as the last frame left them, the bake
+	// doesn't light anything
+	PerFrameConstants frameConstants = gPerFrameConstants;
+	frameConstants.waterClipPlane  = { 0, 0, 0, 1 };
+	frameConstants.waterClipMargin = 0;
+	SetConstants(0, gPerFrameConstantBuffer, frameConstants);
+
+	for (int frameY = 0; frameY < FramesAcross; ++frameY)
+	{
+		for (int frameX = 0; frameX < FramesAcross; ++frameX)
+		{
+			// Orthographic camera looking back along the frame's direction from twice the radius away, so the sphere fills the
+			// frame and its depth goes from the near to the far side. Reversed depth like the cameras' (see Camera::UpdateMatrices)
+			CVector3 direction = FrameDirection(frameX, frameY);
+			CVector3 axisX, axisY;
+			FrameAxes(direction, axisX, axisY);
+			CMatrix4x4 cameraMatrix = MatrixIdentity();
+			cameraMatrix.SetRow(0, axisX);
+			cameraMatrix.SetRow(1, axisY);
+			cameraMatrix.SetRow(2, direction * -1.0f);
+			cameraMatrix.SetRow(3, mCentre + direction * (2 * mRadius));
+
+			float depthNear = mRadius;
+			float depthFar  = 3 * mRadius;
+			CMatrix4x4 projection = MatrixIdentity();
+			projection.e00 = 1 / mRadius;
+			projection.e11 = 1 / mRadius;
+			projection.e22 = -1 / (depthFar - depthNear);
+			projection.e32 = depthFar / (depthFar - depthNear);
+
+			gPerViewConstants.cameraMatrix         = cameraMatrix;
+			gPerViewConstants.viewMatrix           = InverseAffine(cameraMatrix);
+			gPerViewConstants.projectionMatrix     = projection;
+			gPerViewConstants.viewProjectionMatrix = gPerViewConstants.viewMatrix * projection;
+			SetConstants(4, gPerViewConstantBuffer, gPerViewConstants);
+
+			D3D11_VIEWPORT viewport = { static_cast<float>(frameX * FrameSize), static_cast<float>(frameY * FrameSize),
+			                            static_cast<float>(FrameSize), static_cast<float>(FrameSize), 0, 1 };
+			SetViewport(viewport);
+			model->Render(); // Full detail
+		}
+	}
+
+	SetRenderTargets(0, nullptr, nullptr);
+	gD3DContext->GenerateMips(mAtlasSRVs[0]);
+	gD3DContext->GenerateMips(mAtlasSRVs[1]);
+
+	delete model;
+	depthStencil->Release();
+	depthTexture->Release();
+}
+
+
+// Release all the resources, used by the destructor and when the constructor fails
+void Impostor::Release()
+{
+	if (mInstanceBufferSRV)  { mInstanceBufferSRV->Release();  mInstanceBufferSRV = nullptr; }
+	if (mInstanceBuffer)     { mInstanceBuffer->Release();     mInstanceBuffer = nullptr; }
+	for (int slice = 0; slice < 2; ++slice)
+	{
+		if (mAtlasSRVs[slice])           { mAtlasSRVs[slice]->Release();           mAtlasSRVs[slice] = nullptr; }
+		if (mAtlasRenderTargets[slice])  { mAtlasRenderTargets[slice]->Release();  mAtlasRenderTargets[slice] = nullptr; }
+	}
+	if (mAtlas)  { mAtlas->Release();  mAtlas = nullptr; }
+}
@@ -0,0 +1,118 @@
+//--------------------------------------------------------------------------------------
+// Impostors - distant models drawn as billboards showing views baked at load time
+//--------------------------------------------------------------------------------------
+// A model a few dozen pixels across on screen still costs its whole mesh: its vertices, skinning
+// and a draw call in every pass, most of all in the refraction and reflection, where it is then
+// blurred and distorted by the water. An impostor is baked once, when its mesh arrives: the model
+// is drawn from 8x8 directions covering every side of it, each into a frame of an atlas. The
+// directions are points on an octahedron unfolded into the square of the atlas, so the frames are
+// spread evenly over the sphere of views. Each frame keeps the texture colour and specular, and the
+// normal and depth of the surface, rather than a lit picture - so the impostor is lit by the scene's
+// lights as they are when it is drawn, and its pixels are clipped against the water as the model's
+// would be.
+//
+// When drawn, each model using the impostor is a billboard facing along the baked direction nearest
+// the camera's (see Impostor_vs.hlsl), all of them with one instanced draw. Each pixel is moved
+// onto the baked surface and lit by the same shader code as the model in that kind of pass (see
+// ImpostorLighting.hlsli). The frames jump from one direction to the next as the camera moves
+// round, which is only noticeable when the impostor is large on screen.
+//
+// The scene swaps the impostor in for a model when the model is small on screen, and sooner in the
+// water passes (see RenderLitModels in Scene.cpp). The frames are baked with the material's texture
+// as it is streamed at the time, and skinned models in their default pose.
+
+#include "Material.h"
+#include "CVector3.h"
+#include "CMatrix4x4.h"
+#include <d3d11.h>
+#include <vector>
+
+#ifndef _IMPOSTOR_H_INCLUDED_
+#define _IMPOSTOR_H_INCLUDED_
+
+class Mesh;
+
+class Impostor
+{
+//--------------------------------------------------------------------------------------
+// Construction / Usage
+//--------------------------------------------------------------------------------------
+public:
+
+	// Bake the views of the given mesh drawn with the given material. Call between frames on the main thread, it renders
+	// on the immediate context and leaves no render targets selected
+	// Will throw a std::runtime_error exception on failure (same as Mesh)
+	Impostor(Mesh* mesh, const Material& material);
+	~Impostor();
+
+	Impostor(const Impostor&) = delete;
+	Impostor& operator=(const Impostor&) = delete;
+
+
+	// Draw copies of the impostor placed by the given world matrices (the root matrices of the models it stands for) in the
+	// given kind of pass, with one instanced draw for every MaxInstances. Not for the water views pass, which draws each
+	// triangle into both views with the billboard facing the wrong camera for one of them. Selects its shaders, textures and
+	// tint, the camera, per-frame constants and states must have been set already
+	void Render(MaterialPass pass, const CMatrix4x4* worldMatrices, unsigned int numInstances);
+
+
+	// Frames across the atlas in each direction, must match ImpostorFrames in Impostor_vs.hlsl, and the pixels across each
+	static constexpr int FramesAcross = 8;
+	static constexpr int FrameSize    = 128;
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions / data
+//--------------------------------------------------------------------------------------
+private:
+
+	// Most instances in one draw, the scene's impostors each stand for a few models
+	static constexpr unsigned int MaxInstances = 256;
+
+	// The sphere baked is this much larger than the mesh's bounds, so the edges of the model are never on the edge of a frame
+	static constexpr float BoundsMargin = 1.05f;
+
+	// Mip levels of the atlas, down to frames of 8 pixels. Fewer than a full chain, so smaller mips don't blend the frames
+	static constexpr unsigned int MipLevels = 5;
+
+	// Data for each instance in the GPU buffer, must match ImpostorInstance in Common.hlsli
+	struct InstanceData
+	{
+		CMatrix4x4 worldMatrix;
+		CVector3   centre;
+		float      radius;
+	};
+
+	// The direction from the model's centre that a frame is baked from, and its camera's x and y axes. Must match
+	// OctahedralDirection and FrameAxes in Impostor_vs.hlsl
+	static CVector3 FrameDirection(int frameX, int frameY);
+	static void     FrameAxes(const CVector3& direction, CVector3& axisX, CVector3& axisY);
+
+	// Create the atlas and instance buffer / draw every frame into the atlas, throw a std::runtime_error exception on
+	// failure. Release all the resources, used by the destructor and when the constructor fails
+	void CreateResources();
+	void Bake(Mesh* mesh);
+	void Release();
+
+
+	CVector3 mCentre; // Of the baked sphere, in model space
+	float    mRadius;
+	CVector3 mTint;   // The material's, applied when lit like the model's
+
+	// The atlas, two slices of the same size: texture colour and specular, and normal, depth and coverage. Each slice has
+	// its own render target and a view for the shaders that reads it as an array of one
+	ID3D11Texture2D*          mAtlas = nullptr;
+	ID3D11RenderTargetView*   mAtlasRenderTargets[2] = {};
+	ID3D11ShaderResourceView* mAtlasSRVs[2] = {};
+
+	// Structured buffer of the instances for the current draw, rewritten for each draw
+	ID3D11Buffer*             mInstanceBuffer    = nullptr;
+	ID3D11ShaderResourceView* mInstanceBufferSRV = nullptr;
+};
+
+
+// The impostors of the scene's models, baked when their meshes arrive (see SwapStreamedMeshes in Scene.cpp)
+extern std::vector<Impostor*> gImpostors;
+
+
+#endif //_IMPOSTOR_H_INCLUDED_
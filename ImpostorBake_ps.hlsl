@@ -0,0 +1,38 @@
+//--------------------------------------------------------------------------------------
+// Pixel shader baking a model's views into an impostor's atlas
+//--------------------------------------------------------------------------------------
+// Draws the model unlit into the two slices of the atlas at once (see Impostor::Bake): the texture
+// colour and specular, and the normal in the view space of the frame's camera with the depth across
+// the baking sphere. The impostor shaders light the pixels later as the model's would (see
+// ImpostorLighting.hlsli).
+
+#include "Common.hlsli"
+
+
+//--------------------------------------------------------------------------------------
+// Textures (texture maps)
+//--------------------------------------------------------------------------------------
+
+Texture2DArray DiffuseSpecularMap : register(t0); // The model's material texture, a layer of an array (see Material.h)
+SamplerState   StandardFilter     : register(s0);
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+struct ImpostorBakeOutput
+{
+	float4 colour      : SV_Target0; // Diffuse in rgb, specular in alpha as in the material's texture
+	float4 normalDepth : SV_Target1; // View space normal xy (0->1 for -1->1), depth, coverage
+};
+
+ImpostorBakeOutput main(LightingPixelShaderInput input)
+{
+	ImpostorBakeOutput output;
+	output.colour = DiffuseSpecularMap.Sample(StandardFilter, float3(input.uv, gTextureLayer));
+
+	float3 viewNormal = mul(gViewMatrix, float4(normalize(input.worldNormal), 0)).xyz;
+	output.normalDepth = float4(viewNormal.xy * 0.5f + 0.5f, input.projectedPosition.z, 1);
+	return output;
+}
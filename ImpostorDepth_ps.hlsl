@@ -0,0 +1,18 @@
+//--------------------------------------------------------------------------------------
+// Pixel shader for impostors in the depth prepass
+//--------------------------------------------------------------------------------------
+// The lit models' depth pass has no pixel shader, but the billboards only cover the baked surface
+// where its coverage says so. Removes the same pixels as the impostor shaders, so the main pass
+// after finds the same depths (see ImpostorLighting.hlsli).
+
+#include "ImpostorLighting.hlsli"
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+void main(LightingPixelShaderInput input)
+{
+	clip(ImpostorCoverage(input) - 0.5f);
+}
@@ -0,0 +1,65 @@
+//--------------------------------------------------------------------------------------
+// Lit impostors
+//--------------------------------------------------------------------------------------
+// The impostor pixel shaders light the surface baked into an impostor's atlas (see Impostor.h) as the
+// lit models' shaders light the model itself. The colour atlas takes the place of the material's
+// texture in slot 0, and the normal and depth atlas is in a slot of its own. Each pixel of the
+// billboard is moved onto the baked surface, with its baked normal, then lit by the same shader code
+// as the model in that kind of pass - including the clipping against the water.
+
+#ifndef _IMPOSTOR_LIGHTING_HLSLI_DEFINED_
+#define _IMPOSTOR_LIGHTING_HLSLI_DEFINED_
+
+#include "WaterTextureLighting.hlsli"
+
+
+//--------------------------------------------------------------------------------------
+// Texture maps
+//--------------------------------------------------------------------------------------
+
+// The baked normal in xy (view space of the frame's camera, 0->1 for -1->1), the depth across the baking sphere (1 at its
+// near side) in z and coverage in alpha. The t23 must match the slot used in Impostor::Render
+Texture2DArray ImpostorNormalDepthMap : register(t23);
+
+
+//--------------------------------------------------------------------------------------
+// Surface
+//--------------------------------------------------------------------------------------
+
+// Whether the pixel of the billboard is on the baked surface, from the coverage in the normal and depth atlas
+float ImpostorCoverage(LightingPixelShaderInput input)
+{
+	return ImpostorNormalDepthMap.Sample(StandardFilter, float3(input.uv, 0)).a;
+}
+
+// Move a pixel of the billboard onto the baked surface and give it the baked normal, removing the pixels the surface doesn't
+// cover. The vertex shader gives the frame's direction scaled by the baking sphere's radius in place of the normal (see Impostor_vs)
+void ImpostorSurface(inout LightingPixelShaderInput input)
+{
+	// The billboard's x axis in the world, from how the position and uv change across the pixel. Found before any pixels are
+	// removed so the neighbouring pixels are still there
+	float3 positionDX = ddx(input.worldPosition);
+	float3 positionDY = ddy(input.worldPosition);
+	float2 uvDX = ddx(input.uv);
+	float2 uvDY = ddy(input.uv);
+	float  determinant = uvDX.x * uvDY.y - uvDX.y * uvDY.x;
+	float3 axisX = normalize((positionDX * uvDY.y - positionDY * uvDX.y) * sign(determinant));
+
+	float4 normalDepth = ImpostorNormalDepthMap.Sample(StandardFilter, float3(input.uv, 0));
+	clip(normalDepth.a - 0.5f);
+
+	float  radius = length(input.worldNormal);
+	float3 axisZ  = input.worldNormal / radius; // Towards the camera the frame was baked from
+	float3 axisY  = cross(axisX, axisZ);
+
+	// The baked normal faces the baking camera, so its z (along the camera's forward) is negative - towards axisZ here
+	float2 normalXY = normalDepth.xy * 2 - 1;
+	float  normalZ  = sqrt(saturate(1 - dot(normalXY, normalXY)));
+	input.worldNormal = normalXY.x * axisX + normalXY.y * axisY + normalZ * axisZ;
+
+	// The baking camera was twice the radius from the centre, its depth went from 1 to 0 over the sphere's near to far side
+	input.worldPosition += axisZ * (normalDepth.z * 2 - 1) * radius;
+}
+
+
+#endif // _IMPOSTOR_LIGHTING_HLSLI_DEFINED_
@@ -0,0 +1,18 @@
+//--------------------------------------------------------------------------------------
+// Pixel shader for impostors in the main pass and the environment map
+//--------------------------------------------------------------------------------------
+// The surface baked into the impostor's atlas, lit as the pixel lighting shader lights the model
+// (see ImpostorLighting.hlsli)
+
+#include "ImpostorLighting.hlsli"
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+float4 main(LightingPixelShaderInput input) : SV_Target
+{
+	ImpostorSurface(input);
+	return PixelLighting(input);
+}
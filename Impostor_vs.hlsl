@@ -0,0 +1,95 @@
+//--------------------------------------------------------------------------------------
+// Impostor vertex shader
+//--------------------------------------------------------------------------------------
+// Draws the models far enough away as impostors (see Impostor.h): one instance for each model, each a billboard with no
+// vertex buffer, drawn as a triangle strip like the particles. The billboard shows the frame of the impostor's atlas baked
+// from the direction nearest the camera's, and is turned to face along that direction rather than the camera, so the
+// pixel shader can place each pixel on the baked surface (see ImpostorLighting.hlsli)
+
+#include "Common.hlsli"
+
+
+//--------------------------------------------------------------------------------------
+// Instance data
+//--------------------------------------------------------------------------------------
+
+StructuredBuffer<ImpostorInstance> Instances : register(t9); // The t9 must match the slot used in Impostor::Render
+
+
+//--------------------------------------------------------------------------------------
+// Frames
+//--------------------------------------------------------------------------------------
+
+// Frames across the atlas in each direction, must match Impostor::FramesAcross
+static const uint ImpostorFrames = 8;
+
+// Direction from the model's centre of a point on the atlas (-1 to 1 across it). The directions are on a unit octahedron
+// unfolded into the square, upper half in the middle, so the frames cover every view. Must match FrameDirection in Impostor.cpp
+float3 OctahedralDirection(float2 encoded)
+{
+	float3 direction = float3(encoded.x, 1 - abs(encoded.x) - abs(encoded.y), encoded.y);
+	float  fold = saturate(-direction.y); // Unfold the lower half of the octahedron
+	direction.xz += (direction.xz >= 0) ? -fold : fold;
+	return normalize(direction);
+}
+
+// The point on the atlas of a direction, the reverse of the above
+float2 OctahedralPoint(float3 direction)
+{
+	direction /= abs(direction.x) + abs(direction.y) + abs(direction.z);
+	float2 encoded = direction.xz;
+	if (direction.y < 0)  encoded = (1 - abs(direction.zx)) * (direction.xz >= 0 ? 1 : -1); // Fold over the upper half
+	return encoded;
+}
+
+// The axes across a frame baked from the given direction, as the camera that baked it had them. Must match FrameAxes in Impostor.cpp
+void FrameAxes(float3 direction, out float3 axisX, out float3 axisY)
+{
+	float3 up = abs(direction.y) < 0.99f ? float3(0, 1, 0) : float3(1, 0, 0);
+	axisX = normalize(cross(up, -direction));
+	axisY = cross(-direction, axisX);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+// Vertices 0, 1, 2 and 3 are the top-left, top-right, bottom-left and bottom-right corners
+LightingPixelShaderInput main(uint vertexID : SV_VertexID, uint instanceID : SV_InstanceID)
+{
+	LightingPixelShaderInput output;
+	ImpostorInstance instance = Instances[instanceID];
+
+	// The frame baked nearest the direction of the camera, found in model space
+	float3x3 rotation = (float3x3)instance.worldMatrix;
+	float3 worldCentre = mul(instance.worldMatrix, float4(instance.centre, 1)).xyz;
+	float3 cameraPosition = mul(gCameraMatrix, float4(0, 0, 0, 1)).xyz;
+	float3 modelDirection = mul(cameraPosition - worldCentre, rotation);
+	float2 frameUV = OctahedralPoint(normalize(modelDirection)) * 0.5f + 0.5f;
+	float2 frame = min(floor(frameUV * ImpostorFrames), ImpostorFrames - 1);
+	float3 frameDirection = OctahedralDirection((frame + 0.5f) / ImpostorFrames * 2 - 1);
+
+	// The billboard covers the frame's square, which is the baking sphere's diameter across. The world matrix scales it with the model
+	float3 axisX, axisY;
+	FrameAxes(frameDirection, axisX, axisY);
+	float3 worldX = mul(rotation, axisX);
+	float3 worldY = mul(rotation, axisY);
+	float  worldRadius = instance.radius * length(worldX);
+
+	float2 corner = float2(vertexID & 1, vertexID >> 1);
+	float2 offset = float2(corner.x * 2 - 1, 1 - corner.y * 2) * instance.radius;
+	float4 worldPosition = float4(worldCentre + worldX * offset.x + worldY * offset.y, 1);
+	float4 viewPosition  = mul(gViewMatrix, worldPosition);
+	output.projectedPosition = mul(gProjectionMatrix, viewPosition);
+	output.worldPosition = worldPosition.xyz;
+
+	// The normal carries the frame's direction in the world scaled by the world radius, which is all the pixel shader needs to
+	// take the baked depth and normal into the world
+	output.worldNormal = normalize(mul(rotation, frameDirection)) * worldRadius;
+
+	output.clipDistance = dot(worldPosition, gWaterClipPlane);
+	output.uv = (frame + corner) / ImpostorFrames;
+
+	return output;
+}
@@ -0,0 +1,55 @@
+//--------------------------------------------------------------------------------------
+// Instance culling compute shader
+//--------------------------------------------------------------------------------------
+// Tests every instance of an instanced model against the frustum of the pass being rendered, including any planes added
+// to cut it down (e.g. the water plane for the refraction and reflection passes). The visible instances are appended
+// to the buffer read by InstancedTransform_vs, and the number of them is copied into the arguments of the indirect draws
+// (see InstancedModel::RenderGpuCulled), so the CPU never looks at individual instances
+
+
+//--------------------------------------------------------------------------------------
+// Constants / buffers
+//--------------------------------------------------------------------------------------
+
+#include "Common.hlsli"
+
+static const uint InstanceCullThreadGroupSize = 64; // Must match INSTANCE_CULL_THREAD_GROUP_SIZE in InstancedModel.cpp
+
+// These variables must match exactly the CullConstants structure in InstancedModel.cpp
+cbuffer CullConstants : register(b0)
+{
+	float4 gCullPlanes[8];   // Frustum planes, (a, b, c, d) with the normal facing inwards (see Frustum.h)
+	uint   gNumCullPlanes;
+	uint   gNumInstances;
+	float2 gCullPadding;
+	float4 gMeshBounds;      // Sphere around the mesh in its default pose, centre in xyz and radius in w
+}
+
+StructuredBuffer<InstanceData>       AllInstances     : register(t0);
+AppendStructuredBuffer<InstanceData> VisibleInstances : register(u0);
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+[numthreads(InstanceCullThreadGroupSize, 1, 1)]
+void main(uint3 id : SV_DispatchThreadID)
+{
+	if (id.x >= gNumInstances)  return;
+	InstanceData instance = AllInstances[id.x];
+
+	// Place the mesh's sphere with the instance's matrix, scaling the radius by the largest scale in the matrix, as
+	// TransformSphere does on the CPU
+	float3 centre = mul(instance.worldMatrix, float4(gMeshBounds.xyz, 1)).xyz;
+	float3 scale = float3(length(float3(instance.worldMatrix[0][0], instance.worldMatrix[1][0], instance.worldMatrix[2][0])),
+	                      length(float3(instance.worldMatrix[0][1], instance.worldMatrix[1][1], instance.worldMatrix[2][1])),
+	                      length(float3(instance.worldMatrix[0][2], instance.worldMatrix[1][2], instance.worldMatrix[2][2])));
+	float radius = gMeshBounds.w * max(scale.x, max(scale.y, scale.z));
+
+	for (uint plane = 0; plane < gNumCullPlanes; ++plane)
+	{
+		if (dot(gCullPlanes[plane].xyz, centre) + gCullPlanes[plane].w < -radius)  return;
+	}
+	VisibleInstances.Append(instance);
+}
@@ -0,0 +1,267 @@
+//--------------------------------------------------------------------------------------
+// Class drawing many copies of a mesh with one draw call
+//--------------------------------------------------------------------------------------
+
+#include "InstancedModel.h"
+#include "Model.h"
+#include "Mesh.h"
+#include "StateCache.h"
+#include "Shader.h"
+#include "GpuMemory.h"
+#include "Common.h"
+
+#include <stdexcept>
+#include <cstddef>
+
+
+// Settings for the instance culling shader, matches CullConstants in InstanceCull_cs.hlsl
+struct CullConstants
+{
+	CVector4     planes[Frustum::MaxPlanes];
+	unsigned int numPlanes;
+	unsigned int numInstances;
+	float        padding[2];
+	CVector3     meshCentre;
+	float        meshRadius;
+};
+
+// Number of instances culled by each thread group, must match numthreads in InstanceCull_cs.hlsl
+static const unsigned int INSTANCE_CULL_THREAD_GROUP_SIZE = 64;
+
+
+// Create an instanced model for the given mesh, with space for up to maxInstances copies. The mesh must be rigid (no bones)
+// Will throw a std::runtime_error exception on failure (same as Mesh)
+InstancedModel::InstancedModel(Mesh* mesh, unsigned int maxInstances)
+	: mMesh(mesh), mMaxInstances(maxInstances)
+{
+	if (maxInstances == 0)  throw std::runtime_error("Instanced model needs space for at least one instance");
+	mInstances.reserve(maxInstances);
+
+	try
+	{
+		CreateBuffers();
+	}
+	catch (std::runtime_error)
+	{
+		ReleaseBuffers(); // Destructor isn't called when a constructor throws
+		throw;
+	}
+}
+
+InstancedModel::~InstancedModel()
+{
+	ReleaseBuffers();
+}
+
+
+// Add a copy of the mesh with the given world matrix and tint, or placed at a model's position. Returns false if full
+bool InstancedModel::AddInstance(const CMatrix4x4& worldMatrix, const CVector3& colour /*= { 1, 1, 1 }*/)
+{
+	if (mInstances.size() >= mMaxInstances)  return false;
+	mInstances.push_back({ worldMatrix, colour, 0 });
+	return true;
+}
+
+bool InstancedModel::AddInstance(Model* model, const CVector3& colour /*= { 1, 1, 1 }*/)
+{
+	return AddInstance(model->WorldMatrix(), colour);
+}
+
+
+// Render the instances that might be inside the given view frustum. Returns the number of instances drawn
+unsigned int InstancedModel::Render(const Frustum& frustum)
+{
+	if (mInstances.empty())  return 0;
+
+	// Copy the visible instances into the buffer. Discarding the old contents lets the GPU carry on using them for earlier
+	// draws while we write to fresh memory
+	D3D11_MAPPED_SUBRESOURCE mapped;
+	if (FAILED(gD3DContext->Map(mInstanceBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped)))  return 0;
+	InstanceData* bufferInstances = static_cast<InstanceData*>(mapped.pData);
+	unsigned int numVisible = 0;
+	for (auto& instance : mInstances)
+	{
+		if (mMesh->IsInstanceVisible(instance.worldMatrix, frustum))  bufferInstances[numVisible++] = instance;
+	}
+	gD3DContext->Unmap(mInstanceBuffer, 0);
+	CountMap(numVisible * sizeof(InstanceData));
+
+	if (numVisible == 0)  return 0;
+
+	// The instance buffer is only read by the vertex shader
+	SetShaderResource(9, mInstanceBufferSRV, VertexShaderStage); // First parameter must match texture slot number in the shader
+	mMesh->RenderInstanced(numVisible);
+	return numVisible;
+}
+
+
+//--------------------------------------------------------------------------------------
+// GPU culling
+//--------------------------------------------------------------------------------------
+
+// Send all the instances to the GPU for RenderGpuCulled. Call once per frame on the immediate context. The buffer isn't
+// dynamic because the passes reading it may be recorded on other contexts (see CommandRecorder.h)
+void InstancedModel::UploadInstances()
+{
+	mNumUploadedInstances = NumInstances();
+	if (mNumUploadedInstances == 0)  return;
+
+	D3D11_BOX box = { 0, 0, 0, static_cast<UINT>(sizeof(InstanceData) * mNumUploadedInstances), 1, 1 };
+	gD3DContext->UpdateSubresource(mAllInstanceBuffer, 0, &box, mInstances.data(), 0, 0);
+}
+
+
+// Render the instances that might be inside the given view frustum, culling them on the GPU. Leaves the compute shader stage
+// with nothing bound
+void InstancedModel::RenderGpuCulled(const Frustum& frustum)
+{
+	if (mNumUploadedInstances == 0)  return;
+
+	// The culling settings for this pass. Each pass has its own frustum, so these change every time
+	D3D11_MAPPED_SUBRESOURCE mapped;
+	if (FAILED(gD3DContext->Map(mCullConstantBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped)))  return;
+	CullConstants* constants = static_cast<CullConstants*>(mapped.pData);
+	for (int plane = 0; plane < frustum.numPlanes; ++plane)  constants->planes[plane] = frustum.planes[plane];
+	constants->numPlanes    = frustum.numPlanes;
+	constants->numInstances = mNumUploadedInstances;
+	constants->meshCentre   = mMesh->DefaultBounds().centre;
+	constants->meshRadius   = mMesh->DefaultBounds().radius;
+	gD3DContext->Unmap(mCullConstantBuffer, 0);
+	CountMap(sizeof(CullConstants));
+
+	// The visible instances buffer is still bound to the vertex shader from the last draw, it can't be written while it is
+	SetShaderResource(9, nullptr, VertexShaderStage);
+
+	// Append the visible instances, starting from an empty buffer
+	UINT initialCount = 0;
+	gD3DContext->CSSetShader(gInstanceCullComputeShader, nullptr, 0);
+	gD3DContext->CSSetConstantBuffers(0, 1, &mCullConstantBuffer);
+	gD3DContext->CSSetShaderResources(0, 1, &mAllInstanceBufferSRV);
+	gD3DContext->CSSetUnorderedAccessViews(0, 1, &mVisibleBufferUAV, &initialCount);
+	gD3DContext->Dispatch((mNumUploadedInstances + INSTANCE_CULL_THREAD_GROUP_SIZE - 1) / INSTANCE_CULL_THREAD_GROUP_SIZE, 1, 1);
+
+	ID3D11ShaderResourceView*  nullSRV = nullptr;
+	ID3D11UnorderedAccessView* nullUAV = nullptr;
+	gD3DContext->CSSetShaderResources(0, 1, &nullSRV);
+	gD3DContext->CSSetUnorderedAccessViews(0, 1, &nullUAV, nullptr);
+	gD3DContext->CSSetShader(nullptr, nullptr, 0);
+
+	// The number of visible instances is the instance count of every sub-mesh's draw
+	for (unsigned int subMesh = 0; subMesh < mNumSubMeshes; ++subMesh)
+	{
+		UINT offset = subMesh * sizeof(D3D11_DRAW_INDEXED_INSTANCED_INDIRECT_ARGS) + offsetof(D3D11_DRAW_INDEXED_INSTANCED_INDIRECT_ARGS, InstanceCount);
+		gD3DContext->CopyStructureCount(mIndirectArgsBuffer, offset, mVisibleBufferUAV);
+	}
+
+	SetShaderResource(9, mVisibleBufferSRV, VertexShaderStage); // First parameter must match texture slot number in the shader
+	mMesh->RenderInstanced(0, mIndirectArgsBuffer);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions
+//--------------------------------------------------------------------------------------
+
+// Create the GPU buffers for the instances, throws a std::runtime_error exception on failure
+void InstancedModel::CreateBuffers()
+{
+	// Dynamic structured buffer, rewritten by the CPU for each draw and read by the vertex shader
+	D3D11_BUFFER_DESC bufferDesc = {};
+	bufferDesc.ByteWidth           = sizeof(InstanceData) * mMaxInstances;
+	bufferDesc.Usage               = D3D11_USAGE_DYNAMIC;
+	bufferDesc.BindFlags           = D3D11_BIND_SHADER_RESOURCE;
+	bufferDesc.CPUAccessFlags      = D3D11_CPU_ACCESS_WRITE;
+	bufferDesc.MiscFlags           = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+	bufferDesc.StructureByteStride = sizeof(InstanceData);
+	if (FAILED(gD3DDevice->CreateBuffer(&bufferDesc, nullptr, &mInstanceBuffer)))
+	{
+		throw std::runtime_error("Error creating instance buffer");
+	}
+
+	D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+	srvDesc.Format              = DXGI_FORMAT_UNKNOWN; // Structured buffers have no format
+	srvDesc.ViewDimension       = D3D11_SRV_DIMENSION_BUFFER;
+	srvDesc.Buffer.FirstElement = 0;
+	srvDesc.Buffer.NumElements  = mMaxInstances;
+	if (FAILED(gD3DDevice->CreateShaderResourceView(mInstanceBuffer, &srvDesc, &mInstanceBufferSRV)))
+	{
+		throw std::runtime_error("Error creating instance buffer view");
+	}
+
+
+	// GPU culling - all the instances, written by UploadInstances and read by the culling shader
+	bufferDesc.Usage          = D3D11_USAGE_DEFAULT;
+	bufferDesc.CPUAccessFlags = 0;
+	if (FAILED(gD3DDevice->CreateBuffer(&bufferDesc, nullptr, &mAllInstanceBuffer)) ||
+	    FAILED(gD3DDevice->CreateShaderResourceView(mAllInstanceBuffer, &srvDesc, &mAllInstanceBufferSRV)))
+	{
+		throw std::runtime_error("Error creating instance culling buffer");
+	}
+
+	// The visible instances, appended by the culling shader and read by the vertex shader
+	bufferDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS;
+	D3D11_UNORDERED_ACCESS_VIEW_DESC uavDesc = {};
+	uavDesc.Format              = DXGI_FORMAT_UNKNOWN;
+	uavDesc.ViewDimension       = D3D11_UAV_DIMENSION_BUFFER;
+	uavDesc.Buffer.FirstElement = 0;
+	uavDesc.Buffer.NumElements  = mMaxInstances;
+	uavDesc.Buffer.Flags        = D3D11_BUFFER_UAV_FLAG_APPEND;
+	if (FAILED(gD3DDevice->CreateBuffer(&bufferDesc, nullptr, &mVisibleBuffer)) ||
+	    FAILED(gD3DDevice->CreateShaderResourceView(mVisibleBuffer, &srvDesc, &mVisibleBufferSRV)) ||
+	    FAILED(gD3DDevice->CreateUnorderedAccessView(mVisibleBuffer, &uavDesc, &mVisibleBufferUAV)))
+	{
+		throw std::runtime_error("Error creating visible instance buffer");
+	}
+
+	// Indirect draw arguments for each sub-mesh, the instance counts are filled in on the GPU
+	std::vector<D3D11_DRAW_INDEXED_INSTANCED_INDIRECT_ARGS> args;
+	mMesh->GetIndirectArgs(args);
+	mNumSubMeshes = static_cast<unsigned int>(args.size());
+	if (mNumSubMeshes > 0)
+	{
+		D3D11_BUFFER_DESC argsDesc = {};
+		argsDesc.ByteWidth = static_cast<UINT>(sizeof(D3D11_DRAW_INDEXED_INSTANCED_INDIRECT_ARGS) * args.size());
+		argsDesc.Usage     = D3D11_USAGE_DEFAULT;
+		argsDesc.MiscFlags = D3D11_RESOURCE_MISC_DRAWINDIRECT_ARGS;
+		D3D11_SUBRESOURCE_DATA argsData = {};
+		argsData.pSysMem = args.data();
+		if (FAILED(gD3DDevice->CreateBuffer(&argsDesc, &argsData, &mIndirectArgsBuffer)))
+		{
+			throw std::runtime_error("Error creating indirect draw arguments");
+		}
+	}
+
+	// Culling settings for each pass
+	D3D11_BUFFER_DESC constantsDesc = {};
+	constantsDesc.ByteWidth      = sizeof(CullConstants);
+	constantsDesc.Usage          = D3D11_USAGE_DYNAMIC;
+	constantsDesc.BindFlags      = D3D11_BIND_CONSTANT_BUFFER;
+	constantsDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+	if (FAILED(gD3DDevice->CreateBuffer(&constantsDesc, nullptr, &mCullConstantBuffer)))
+	{
+		throw std::runtime_error("Error creating instance culling constants");
+	}
+
+	for (ID3D11Resource* buffer : { mInstanceBuffer, mAllInstanceBuffer, mVisibleBuffer, mIndirectArgsBuffer })
+	{
+		RegisterGpuResource(buffer, "Instancing");
+	}
+	RegisterGpuResource(mCullConstantBuffer, "Constant Buffers");
+}
+
+
+void InstancedModel::ReleaseBuffers()
+{
+	if (mCullConstantBuffer)    mCullConstantBuffer  ->Release();
+	if (mIndirectArgsBuffer)    mIndirectArgsBuffer  ->Release();
+	if (mVisibleBufferUAV)      mVisibleBufferUAV    ->Release();
+	if (mVisibleBufferSRV)      mVisibleBufferSRV    ->Release();
+	if (mVisibleBuffer)         mVisibleBuffer       ->Release();
+	if (mAllInstanceBufferSRV)  mAllInstanceBufferSRV->Release();
+	if (mAllInstanceBuffer)     mAllInstanceBuffer   ->Release();
+	if (mInstanceBufferSRV)     mInstanceBufferSRV   ->Release();
+	if (mInstanceBuffer)        mInstanceBuffer      ->Release();
+	mCullConstantBuffer = mIndirectArgsBuffer = mVisibleBuffer = mAllInstanceBuffer = mInstanceBuffer = nullptr;
+	mVisibleBufferUAV = nullptr;
+	mVisibleBufferSRV = mAllInstanceBufferSRV = mInstanceBufferSRV = nullptr;
+}
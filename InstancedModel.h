@@ -0,0 +1,108 @@
+//--------------------------------------------------------------------------------------
+// Class drawing many copies of a mesh with one draw call
+//--------------------------------------------------------------------------------------
+// Each Model is drawn with its own draw call and constant buffer update, which limits a
+// scene to a few hundred models. An instanced model collects the world matrix and tint of
+// every copy of a mesh into a buffer on the GPU, then draws them all with hardware
+// instancing - the vertex shader reads the instance data using SV_InstanceID (see
+// InstancedTransform_vs.hlsl). Fine for thousands of crates, rocks or light flares.
+//
+// The instances can also be culled on the GPU (RenderGpuCulled). All the instances are sent
+// to the GPU once per frame, then in each pass a compute shader tests them against that
+// pass's frustum and writes the visible ones for the draw, along with the arguments for an
+// indirect draw of each sub-mesh. The CPU cost of a pass is then the same however many
+// instances there are, at the cost of not knowing how many were drawn.
+
+#include "CVector3.h"
+#include "CMatrix4x4.h"
+#include "Frustum.h"
+#include <d3d11.h>
+#include <vector>
+
+#ifndef _INSTANCED_MODEL_H_INCLUDED_
+#define _INSTANCED_MODEL_H_INCLUDED_
+
+class Mesh;
+class Model;
+
+class InstancedModel
+{
+//--------------------------------------------------------------------------------------
+// Construction / Usage
+//--------------------------------------------------------------------------------------
+public:
+
+	// Create an instanced model for the given mesh, with space for up to maxInstances copies. The mesh must be rigid (no bones)
+	// Will throw a std::runtime_error exception on failure (same as Mesh)
+	InstancedModel(Mesh* mesh, unsigned int maxInstances);
+	~InstancedModel();
+
+
+	// Remove all instances, e.g. at the start of a frame before adding the instances for that frame. Keeps the memory used
+	void ClearInstances()  { mInstances.clear(); }
+
+	// Add a copy of the mesh with the given world matrix and tint (the object colour for the tinted texture shaders), or
+	// placed at a model's position (root node only, other nodes are in their default positions). Returns false if full
+	bool AddInstance(const CMatrix4x4& worldMatrix, const CVector3& colour = { 1, 1, 1 });
+	bool AddInstance(Model* model, const CVector3& colour = { 1, 1, 1 });
+
+	unsigned int NumInstances()  { return static_cast<unsigned int>(mInstances.size()); }
+	unsigned int MaxInstances()  { return mMaxInstances; }
+
+
+	// Render the instances that might be inside the given view frustum. Returns the number of instances drawn
+	// Select InstancedTransform_vs for the vertex shader first. All other per-frame constants must have been set already
+	// along with the pixel shader, textures, samplers, states etc.
+	unsigned int Render(const Frustum& frustum);
+
+
+	// Send all the instances to the GPU for RenderGpuCulled. Call once per frame, after adding the instances and before any
+	// pass renders them, on the immediate context
+	void UploadInstances();
+
+	// Render the instances that might be inside the given view frustum, culling them on the GPU. Setup as for Render above
+	// The instances are as they were at the last UploadInstances. Leaves the compute shader stage with nothing bound
+	void RenderGpuCulled(const Frustum& frustum);
+
+
+//--------------------------------------------------------------------------------------
+// Private data
+//--------------------------------------------------------------------------------------
+private:
+
+	// Data for each instance in the GPU buffer, must match InstanceData in Common.hlsli
+	struct InstanceData
+	{
+		CMatrix4x4 worldMatrix;
+		CVector3   colour;
+		float      padding;
+	};
+
+	Mesh*                     mMesh;
+	std::vector<InstanceData> mInstances; // Space reserved for mMaxInstances, so adding instances never allocates
+	unsigned int              mMaxInstances;
+
+	// Structured buffer holding the visible instances for the current draw, rewritten each time the instances are rendered
+	ID3D11Buffer*             mInstanceBuffer    = nullptr;
+	ID3D11ShaderResourceView* mInstanceBufferSRV = nullptr;
+
+	// GPU culling - every instance (from UploadInstances), the visible instances appended by the culling shader, and the
+	// indirect draw arguments for each sub-mesh with the number of visible instances copied in
+	unsigned int               mNumUploadedInstances = 0;
+	ID3D11Buffer*              mAllInstanceBuffer     = nullptr;
+	ID3D11ShaderResourceView*  mAllInstanceBufferSRV  = nullptr;
+	ID3D11Buffer*              mVisibleBuffer         = nullptr;
+	ID3D11ShaderResourceView*  mVisibleBufferSRV      = nullptr;
+	ID3D11UnorderedAccessView* mVisibleBufferUAV      = nullptr;
+	ID3D11Buffer*              mIndirectArgsBuffer    = nullptr;
+	unsigned int               mNumSubMeshes          = 0;
+	ID3D11Buffer*              mCullConstantBuffer    = nullptr;
+
+	// Create the GPU buffers above, throws a std::runtime_error exception on failure. Release them, used by the destructor
+	// and when the constructor fails
+	void CreateBuffers();
+	void ReleaseBuffers();
+};
+
+
+#endif //_INSTANCED_MODEL_H_INCLUDED_
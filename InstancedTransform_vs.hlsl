@@ -0,0 +1,38 @@
+//--------------------------------------------------------------------------------------
+// Instanced Vertex Shader
+//--------------------------------------------------------------------------------------
+// Same as BasicTransformWorldPos_vs for models drawn with hardware instancing (see InstancedModel.h). The world matrix and
+// tint of each copy come from a buffer indexed by the instance ID rather than from the per-model constant buffer
+
+#include "Common.hlsli"
+
+
+//--------------------------------------------------------------------------------------
+// Instance data
+//--------------------------------------------------------------------------------------
+
+StructuredBuffer<InstanceData> Instances : register(t9); // The t9 must match the slot used in InstancedModel::Render
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+TintedPixelShaderInput main(BasicVertex input, uint instanceID : SV_InstanceID)
+{
+	TintedPixelShaderInput output;
+	InstanceData instance = Instances[instanceID];
+
+	// The per-model world matrix places the mesh node relative to the instance (and decodes quantised positions), then
+	// the instance's matrix places it in the world
+	float4 modelPosition = float4(input.position, 1);
+	float4 worldPosition = mul(instance.worldMatrix, mul(gWorldMatrix, modelPosition));
+	output.worldPosition = worldPosition.xyz;
+	float4 viewPosition  = mul(gViewMatrix, worldPosition);
+	output.projectedPosition = mul(gProjectionMatrix, viewPosition);
+
+	output.uv   = input.uv;
+	output.tint = instance.colour;
+
+	return output;
+}
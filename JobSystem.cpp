@@ -0,0 +1,140 @@
+//--------------------------------------------------------------------------------------
+// Work-stealing job system - the pool of threads shared by all the app's parallel work
+//--------------------------------------------------------------------------------------
+
+#include "JobSystem.h"
+#include "CpuProfiler.h"
+#include "AllocationCounter.h"
+
+
+JobSystem* gJobSystem = nullptr;
+
+// The queue of the calling thread: its own if it is a worker, otherwise the one shared by threads outside the pool. There is
+// only one job system so a single index for each thread is enough
+static thread_local int tThisQueue = 0;
+
+
+//--------------------------------------------------------------------------------------
+// Construction / Usage
+//--------------------------------------------------------------------------------------
+
+// Create the worker threads, by default one for each core other than the one the calling thread is using
+JobSystem::JobSystem(int numWorkers /*= -1*/)
+{
+	if (numWorkers < 0)  numWorkers = (std::max)(1, static_cast<int>(std::thread::hardware_concurrency()) - 1);
+
+	for (int i = 0; i <= numWorkers; ++i)  mQueues.push_back(std::make_unique<Queue>());
+	for (int i = 1; i <= numWorkers; ++i)  mWorkers.emplace_back(&JobSystem::WorkerThread, this, i);
+}
+
+// Finishes the jobs already queued - the workers only stop when there are none left
+JobSystem::~JobSystem()
+{
+	{
+		std::lock_guard<std::mutex> lock(mSleepMutex);
+		mQuit = true;
+	}
+	mWake.notify_all();
+	for (auto& worker : mWorkers)  worker.join();
+}
+
+
+// Queue a job, counted by the given counter until it has finished. If the calling thread's queue is full the job is run
+// straight away instead
+void JobSystem::Run(const Job& job, JobCounter& counter)
+{
+	Queue& queue = *mQueues[tThisQueue];
+	bool queued = false;
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.tail - queue.head < QueueSize)
+		{
+			counter.mCount.fetch_add(1, std::memory_order_relaxed);
+			queue.jobs[queue.tail & (QueueSize - 1)] = { job, &counter, SelectedAllocationCounter() };
+			++queue.tail;
+			queued = true;
+		}
+	}
+	if (!queued)
+	{
+		job.function(job.data, job.index);
+		return;
+	}
+
+	// Wake a worker if any are asleep. A worker only sleeps after counting itself as sleeping and then seeing no queued jobs
+	// with the mutex locked, so either it sees this job or it is seen here and woken
+	mQueuedJobs.fetch_add(1);
+	if (mSleepingWorkers.load() > 0)
+	{
+		{ std::lock_guard<std::mutex> lock(mSleepMutex); }
+		mWake.notify_one();
+	}
+}
+
+
+// Run queued jobs on the calling thread until all the jobs counted by the counter have finished
+void JobSystem::Wait(JobCounter& counter)
+{
+	while (!counter.Done())
+	{
+		if (!RunNextJob())  std::this_thread::yield();
+	}
+}
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions
+//--------------------------------------------------------------------------------------
+
+// Workers run jobs, and sleep when there are none in any queue
+void JobSystem::WorkerThread(int queue)
+{
+	gCpuProfiler.NameThread("Job Worker");
+	tThisQueue = queue;
+	while (true)
+	{
+		if (RunNextJob())  continue;
+
+		std::unique_lock<std::mutex> lock(mSleepMutex);
+		if (mQuit)  return;
+		++mSleepingWorkers;
+		mWake.wait(lock, [this]() { return mQuit || mQueuedJobs.load() > 0; });
+		--mSleepingWorkers;
+	}
+}
+
+
+// Take a job from this thread's queue, or steal one from another, and run it. Returns false if there were none
+bool JobSystem::RunNextJob()
+{
+	if (mQueuedJobs.load(std::memory_order_relaxed) == 0)  return false;
+
+	// Own queue first, newest job first. Then the others in turn from the next one along, so the thieves spread out
+	QueuedJob queued;
+	bool found = TakeJob(*mQueues[tThisQueue], true, queued);
+	int numQueues = static_cast<int>(mQueues.size());
+	for (int i = 1; !found && i < numQueues; ++i)
+	{
+		found = TakeJob(*mQueues[(tThisQueue + i) % numQueues], false, queued);
+	}
+	if (!found)  return false;
+
+	std::atomic<uint64_t>* allocations = SelectAllocationCounter(queued.allocations);
+	queued.job.function(queued.job.data, queued.job.index);
+	SelectAllocationCounter(allocations);
+	queued.counter->mCount.fetch_sub(1, std::memory_order_release); // So a thread that sees it done sees what the job wrote
+	return true;
+}
+
+
+// Take the newest job from the given queue, or the oldest one to steal it. Returns false if the queue is empty
+bool JobSystem::TakeJob(Queue& queue, bool newest, QueuedJob& job)
+{
+	std::lock_guard<std::mutex> lock(queue.mutex);
+	if (queue.head == queue.tail)  return false;
+
+	if (newest)  job = queue.jobs[--queue.tail & (QueueSize - 1)];
+	else         job = queue.jobs[queue.head++ & (QueueSize - 1)];
+	mQueuedJobs.fetch_sub(1, std::memory_order_relaxed);
+	return true;
+}
@@ -0,0 +1,180 @@
+//--------------------------------------------------------------------------------------
+// Work-stealing job system - the pool of threads shared by all the app's parallel work
+//--------------------------------------------------------------------------------------
+// Loading, recording passes, culling and simulating the scene all want to run on several cores.
+// Instead of each of them starting threads of its own, they hand small jobs to this pool, which
+// has one worker thread for every core but one. Each thread has its own queue of jobs: it takes
+// the jobs it added itself newest first, which keeps the data they use in its cache, and when it
+// has none left it steals the oldest job from another thread's queue. The threads outside the
+// pool (the main thread) share one more queue.
+//
+// Jobs are counted by a JobCounter, which is waited on to know they have finished. A job may
+// start more jobs on the counter it was started with, so waiting on the counter waits for the
+// children too. Waiting doesn't just block, the waiting thread runs queued jobs until the count
+// reaches zero - so the main thread carries on working with the pool, and a job that waits for
+// its children helps run them.
+//
+// A job is a plain function pointer and data pointer and the queues have a fixed size, so starting
+// jobs every frame allocates nothing. Jobs must not throw exceptions - catch them in the job and
+// keep the message for the code that waits on it. Any job may run on any thread, including inside
+// another job's wait, so jobs that change a thread's state (e.g. gD3DContext, see CommandRecorder)
+// must put it back or not wait themselves. A job counts its allocations with the allocation
+// counter that was selected on the thread that started it (see AllocationCounter.h).
+
+#include <atomic>
+#include <algorithm>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "stdint.h"
+
+#ifndef _JOB_SYSTEM_H_INCLUDED_
+#define _JOB_SYSTEM_H_INCLUDED_
+
+// The number of jobs started with this counter that haven't finished yet
+class JobCounter
+{
+public:
+	bool Done() const  { return mCount.load(std::memory_order_acquire) == 0; }
+
+private:
+	friend class JobSystem;
+	std::atomic<int> mCount{ 0 };
+};
+
+
+class JobSystem
+{
+//--------------------------------------------------------------------------------------
+// Construction / Usage
+//--------------------------------------------------------------------------------------
+public:
+
+	// A job calls the function with the data pointer and an index, e.g. to tell apart the jobs of a loop
+	struct Job
+	{
+		void (*function)(void* data, int index);
+		void* data;
+		int   index;
+	};
+
+
+	// Create the worker threads, by default one for each core other than the one the calling thread is using
+	JobSystem(int numWorkers = -1);
+	~JobSystem(); // Finishes the jobs already queued
+
+
+	// Queue a job, counted by the given counter until it has finished. Call from any thread. If the calling thread's queue is
+	// full the job is run straight away instead
+	void Run(const Job& job, JobCounter& counter);
+
+	// Queue a call to the given function object, e.g. a lambda. Only a pointer to it is kept, so it must still exist when the
+	// job runs - wait on the counter before it goes out of scope
+	template <class Function>
+	void Run(Function& function, JobCounter& counter)
+	{
+		Run({ [](void* data, int) { (*static_cast<Function*>(data))(); }, &function, 0 }, counter);
+	}
+
+	// Run the function for each index from 0 to count - 1, across the pool, and return when every call has finished. The
+	// indexes are split into jobs of batchSize calls each, which should be enough work to be worth a job. A loop of a
+	// single batch is run on the calling thread without using the pool at all
+	template <class Function>
+	void ParallelFor(int count, int batchSize, const Function& function)
+	{
+		if (count <= batchSize)
+		{
+			for (int i = 0; i < count; ++i)  function(i);
+			return;
+		}
+		ParallelLoop<Function> loop = { &function, count, batchSize };
+		JobCounter counter;
+		for (int batch = 0; batch * batchSize < count; ++batch)
+		{
+			Run({ &ParallelLoop<Function>::RunBatch, &loop, batch }, counter);
+		}
+		Wait(counter);
+	}
+
+	// Run queued jobs on the calling thread until all the jobs counted by the counter have finished, including any started
+	// by those jobs. When there's nothing left to run but the counted jobs are still running elsewhere, it yields the core
+	void Wait(JobCounter& counter);
+
+
+	// The number of threads running jobs, the workers and one thread waiting
+	int NumThreads()  { return static_cast<int>(mWorkers.size()) + 1; }
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions / data
+//--------------------------------------------------------------------------------------
+private:
+
+	// Jobs waiting to run in each queue, a power of two. A queue full of waiting jobs is plenty for the whole pool
+	static constexpr int QueueSize = 256;
+
+	struct QueuedJob
+	{
+		Job                    job;
+		JobCounter*            counter;
+		std::atomic<uint64_t>* allocations; // The allocation counter selected when the job was started
+	};
+
+	// Jobs added by one thread. It adds and takes jobs at the back, other threads steal from the front. A new job is written
+	// at tail, the oldest is at head - jobs[i & (QueueSize - 1)] for head <= i < tail
+	struct Queue
+	{
+		std::mutex mutex;
+		QueuedJob  jobs[QueueSize];
+		uint64_t   head = 0;
+		uint64_t   tail = 0;
+	};
+
+	// The indexes of a ParallelFor, with the function to call
+	template <class Function>
+	struct ParallelLoop
+	{
+		const Function* function;
+		int             count;
+		int             batchSize;
+
+		static void RunBatch(void* data, int batch)
+		{
+			const ParallelLoop& loop = *static_cast<ParallelLoop*>(data);
+			int end = (std::min)(loop.count, (batch + 1) * loop.batchSize);
+			for (int i = batch * loop.batchSize; i < end; ++i)  (*loop.function)(i);
+		}
+	};
+
+
+	// Workers run jobs, and sleep when there are none in any queue
+	void WorkerThread(int queue);
+
+	// Take a job from this thread's queue, or steal one from another, and run it. Returns false if there were none
+	bool RunNextJob();
+
+	// Take the newest job from the given queue, or the oldest one to steal it. Returns false if the queue is empty
+	bool TakeJob(Queue& queue, bool newest, QueuedJob& job);
+
+
+	// A queue for each worker, and one more for the threads outside the pool (the first one)
+	std::vector<std::unique_ptr<Queue>> mQueues;
+	std::vector<std::thread>            mWorkers;
+
+	// For sleeping workers, they are woken when a job is queued. The count of queued jobs is kept outside the queues so the
+	// workers can tell there is work without locking them all
+	std::mutex              mSleepMutex;
+	std::condition_variable mWake;
+	std::atomic<int>        mQueuedJobs{ 0 };
+	std::atomic<int>        mSleepingWorkers{ 0 };
+	bool                    mQuit = false; // Only accessed with mSleepMutex locked
+};
+
+
+// The pool used by the whole app, created at the start of InitGeometry (see Scene.cpp)
+extern JobSystem* gJobSystem;
+
+
+#endif //_JOB_SYSTEM_H_INCLUDED_
@@ -0,0 +1,243 @@
+//--------------------------------------------------------------------------------------
+// Light grid - clustered lighting for many point lights
+//--------------------------------------------------------------------------------------
+
+#include "LightGrid.h"
+#include "StateCache.h"
+#include "GpuMemory.h"
+#include "Common.h"
+
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
+
+
+LightGrid* gLightGrid = nullptr;
+
+
+// Create a grid of cells filling the box between the given corners, with space for up to maxLights lights
+// Will throw a std::runtime_error exception on failure (same as Mesh)
+LightGrid::LightGrid(const CVector3& minCorner, const CVector3& maxCorner, unsigned int maxLights)
+	: mMinCorner(minCorner), mMaxLights(maxLights)
+{
+	if (maxLights == 0)  throw std::runtime_error("Light grid needs space for at least one light");
+	mCellSize = { (maxCorner.x - minCorner.x) / CellsX, (maxCorner.y - minCorner.y) / CellsY, (maxCorner.z - minCorner.z) / CellsZ };
+	if (mCellSize.x <= 0 || mCellSize.y <= 0 || mCellSize.z <= 0)  throw std::runtime_error("Light grid box is empty");
+	mCellsPerUnit = { 1 / mCellSize.x, 1 / mCellSize.y, 1 / mCellSize.z };
+
+	mLights.reserve(maxLights);
+	mCellLists.resize(NumGridCells * 2);
+	mCellLightIndices.resize(MaxLightIndices);
+
+	try
+	{
+		CreateBuffers();
+	}
+	catch (std::runtime_error)
+	{
+		ReleaseBuffers(); // Destructor isn't called when a constructor throws
+		throw;
+	}
+}
+
+LightGrid::~LightGrid()
+{
+	ReleaseBuffers();
+}
+
+
+// Add a point light, the colour includes its strength. Its light fades to nothing at the given range. Shadowed lights are
+// shadowed by the shadow maps. Returns false if full
+bool LightGrid::AddLight(const CVector3& position, const CVector3& colour, float range, bool shadowed /*= false*/)
+{
+	if (mLights.size() >= mMaxLights)  return false;
+	mLights.push_back({ position, range, colour, shadowed ? 1.0f : 0.0f });
+	return true;
+}
+
+
+// Find the lights reaching each cell and send the lights and the cells' lists to the GPU. Call once per frame on the
+// immediate context
+void LightGrid::Update()
+{
+	// Count the lights reaching each cell first, so each cell's list can be given its place in the shared list, then add the
+	// lights to the lists. A cell whose list doesn't fit in the space left loses the lights that don't fit
+	std::fill(mCellLists.begin(), mCellLists.end(), 0);
+	for (const Light& light : mLights)
+	{
+		CellRange cells = LightCells(light);
+		for (int z = cells.min[2]; z <= cells.max[2]; ++z)
+		for (int y = cells.min[1]; y <= cells.max[1]; ++y)
+		for (int x = cells.min[0]; x <= cells.max[0]; ++x)
+		{
+			if (LightReachesCell(light, x, y, z))  ++mCellLists[((z * CellsY + y) * CellsX + x) * 2 + 1];
+		}
+	}
+
+	uint32_t numIndices = 0;
+	mMaxCellLights = 0;
+	mDroppedLights = 0;
+	for (int cell = 0; cell < NumGridCells; ++cell)
+	{
+		uint32_t count = mCellLists[cell * 2 + 1];
+		uint32_t fits  = (std::min)(count, static_cast<uint32_t>(MaxLightIndices) - numIndices);
+		mMaxCellLights = (std::max)(mMaxCellLights, count);
+		mDroppedLights += count - fits;
+		mCellLists[cell * 2]     = numIndices;
+		mCellLists[cell * 2 + 1] = 0; // Counted again as the list is filled
+		numIndices += fits;
+	}
+
+	// The space given to a cell ends where the next cell's list starts
+	for (uint32_t lightIndex = 0; lightIndex < mLights.size(); ++lightIndex)
+	{
+		const Light& light = mLights[lightIndex];
+		CellRange cells = LightCells(light);
+		for (int z = cells.min[2]; z <= cells.max[2]; ++z)
+		for (int y = cells.min[1]; y <= cells.max[1]; ++y)
+		for (int x = cells.min[0]; x <= cells.max[0]; ++x)
+		{
+			if (!LightReachesCell(light, x, y, z))  continue;
+			int cell = (z * CellsY + y) * CellsX + x;
+			uint32_t listEnd = (cell + 1 < NumGridCells) ? mCellLists[(cell + 1) * 2] : numIndices;
+			uint32_t& count  = mCellLists[cell * 2 + 1];
+			if (mCellLists[cell * 2] + count < listEnd)  mCellLightIndices[mCellLists[cell * 2] + count++] = lightIndex;
+		}
+	}
+
+	// Only the parts of the buffers in use are copied. The cells are always all in use - a cell with no lights has a count of 0
+	if (!mLights.empty())
+	{
+		D3D11_BOX box = { 0, 0, 0, static_cast<UINT>(sizeof(Light) * mLights.size()), 1, 1 };
+		gD3DContext->UpdateSubresource(mLightBuffer, 0, &box, mLights.data(), 0, 0);
+	}
+	if (numIndices > 0)
+	{
+		D3D11_BOX box = { 0, 0, 0, static_cast<UINT>(sizeof(uint32_t) * numIndices), 1, 1 };
+		gD3DContext->UpdateSubresource(mLightIndexBuffer, 0, &box, mCellLightIndices.data(), 0, 0);
+	}
+	gD3DContext->UpdateSubresource(mCellBuffer, 0, nullptr, mCellLists.data(), 0, 0);
+}
+
+
+// Select the lights and the cells' lists for the pixel shaders, in the slots used by LightGrid.hlsli
+void LightGrid::SetShaderResources()
+{
+	SetShaderResource(16, mLightBufferSRV); // First parameter must match texture slot number in the shader
+	SetShaderResource(17, mCellBufferSRV);
+	SetShaderResource(18, mLightIndexBufferSRV);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions
+//--------------------------------------------------------------------------------------
+
+// Find the range of cells the box around a light's range overlaps, clamped to the grid. Lights outside the grid still reach
+// the edge cells, which are also used by pixels outside the grid
+LightGrid::CellRange LightGrid::LightCells(const Light& light)
+{
+	const float position[3]     = { light.position.x,  light.position.y,  light.position.z };
+	const float minCorner[3]    = { mMinCorner.x,      mMinCorner.y,      mMinCorner.z };
+	const float cellsPerUnit[3] = { mCellsPerUnit.x,   mCellsPerUnit.y,   mCellsPerUnit.z };
+	const int   numCells[3]     = { CellsX, CellsY, CellsZ };
+
+	CellRange cells;
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		// Clamped as floats first, a light with a huge range would overflow an int
+		float low  = (position[axis] - light.range - minCorner[axis]) * cellsPerUnit[axis];
+		float high = (position[axis] + light.range - minCorner[axis]) * cellsPerUnit[axis];
+		low  = (std::min)((std::max)(low,  0.0f), static_cast<float>(numCells[axis] - 1));
+		high = (std::min)((std::max)(high, 0.0f), static_cast<float>(numCells[axis] - 1));
+		cells.min[axis] = static_cast<int>(std::floor(low));
+		cells.max[axis] = static_cast<int>(std::floor(high));
+	}
+	return cells;
+}
+
+
+// Whether a light's range reaches a cell - whether its sphere overlaps the cell's box. The edge cells stretch out to
+// infinity, because pixels outside the grid use them
+bool LightGrid::LightReachesCell(const Light& light, int x, int y, int z)
+{
+	const float position[3]  = { light.position.x, light.position.y, light.position.z };
+	const float minCorner[3] = { mMinCorner.x, mMinCorner.y, mMinCorner.z };
+	const float cellSize[3]  = { mCellSize.x, mCellSize.y, mCellSize.z };
+	const int   cell[3]      = { x, y, z };
+	const int   numCells[3]  = { CellsX, CellsY, CellsZ };
+
+	// Distance squared from the light to the nearest point of the box
+	float distanceSquared = 0;
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		float boxMin = minCorner[axis] + cell[axis] * cellSize[axis];
+		float boxMax = boxMin + cellSize[axis];
+		float d = 0;
+		if      (position[axis] < boxMin && cell[axis] > 0)                   d = boxMin - position[axis];
+		else if (position[axis] > boxMax && cell[axis] < numCells[axis] - 1)  d = position[axis] - boxMax;
+		distanceSquared += d * d;
+	}
+	return distanceSquared <= light.range * light.range;
+}
+
+
+// Create the GPU buffers, throws a std::runtime_error exception on failure
+void LightGrid::CreateBuffers()
+{
+	// Structured buffers written by Update each frame and read by the pixel shaders. Not dynamic, see Update
+	D3D11_BUFFER_DESC bufferDesc = {};
+	bufferDesc.Usage     = D3D11_USAGE_DEFAULT;
+	bufferDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+	bufferDesc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+
+	D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+	srvDesc.Format              = DXGI_FORMAT_UNKNOWN; // Structured buffers have no format
+	srvDesc.ViewDimension       = D3D11_SRV_DIMENSION_BUFFER;
+	srvDesc.Buffer.FirstElement = 0;
+
+	bufferDesc.ByteWidth           = sizeof(Light) * mMaxLights;
+	bufferDesc.StructureByteStride = sizeof(Light);
+	srvDesc.Buffer.NumElements     = mMaxLights;
+	if (FAILED(gD3DDevice->CreateBuffer(&bufferDesc, nullptr, &mLightBuffer)) ||
+	    FAILED(gD3DDevice->CreateShaderResourceView(mLightBuffer, &srvDesc, &mLightBufferSRV)))
+	{
+		throw std::runtime_error("Error creating light buffer");
+	}
+
+	// Each cell's start and count, a uint2 in the shaders
+	bufferDesc.ByteWidth           = sizeof(uint32_t) * 2 * NumGridCells;
+	bufferDesc.StructureByteStride = sizeof(uint32_t) * 2;
+	srvDesc.Buffer.NumElements     = NumGridCells;
+	if (FAILED(gD3DDevice->CreateBuffer(&bufferDesc, nullptr, &mCellBuffer)) ||
+	    FAILED(gD3DDevice->CreateShaderResourceView(mCellBuffer, &srvDesc, &mCellBufferSRV)))
+	{
+		throw std::runtime_error("Error creating light grid cell buffer");
+	}
+
+	bufferDesc.ByteWidth           = sizeof(uint32_t) * MaxLightIndices;
+	bufferDesc.StructureByteStride = sizeof(uint32_t);
+	srvDesc.Buffer.NumElements     = MaxLightIndices;
+	if (FAILED(gD3DDevice->CreateBuffer(&bufferDesc, nullptr, &mLightIndexBuffer)) ||
+	    FAILED(gD3DDevice->CreateShaderResourceView(mLightIndexBuffer, &srvDesc, &mLightIndexBufferSRV)))
+	{
+		throw std::runtime_error("Error creating light grid index buffer");
+	}
+	RegisterGpuResource(mLightBuffer, "Light Grid");
+	RegisterGpuResource(mCellBuffer, "Light Grid");
+	RegisterGpuResource(mLightIndexBuffer, "Light Grid");
+}
+
+
+// Release the GPU buffers, used by the destructor and when the constructor fails
+void LightGrid::ReleaseBuffers()
+{
+	if (mLightIndexBufferSRV)  mLightIndexBufferSRV->Release();
+	if (mLightIndexBuffer)     mLightIndexBuffer   ->Release();
+	if (mCellBufferSRV)        mCellBufferSRV      ->Release();
+	if (mCellBuffer)           mCellBuffer         ->Release();
+	if (mLightBufferSRV)       mLightBufferSRV     ->Release();
+	if (mLightBuffer)          mLightBuffer        ->Release();
+	mLightIndexBuffer = mCellBuffer = mLightBuffer = nullptr;
+	mLightIndexBufferSRV = mCellBufferSRV = mLightBufferSRV = nullptr;
+}
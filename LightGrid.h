@@ -0,0 +1,141 @@
+//--------------------------------------------------------------------------------------
+// Light grid - clustered lighting for many point lights
+//--------------------------------------------------------------------------------------
+// The shaders used to light every pixel with the two lights in the per-frame constants.
+// Lighting every pixel with every one of hundreds of lights would be far too slow, but a light's
+// range only covers a small part of the scene. The box around the scene is split into a grid of
+// cells (clusters). Once per frame each light is added to the list of every cell its range
+// reaches, and the lights and the lists are sent to the GPU in structured buffers. A pixel
+// shader finds the cell its pixel is in and only adds up the lights in that cell's list, so the
+// cost of lighting a pixel depends on how many lights are near it, not on how many there are.
+//
+// The cells are in world space rather than in each camera's view, so the one grid built each
+// frame serves every pass - the main pass, the reflection and refraction and the environment map
+// faces. The lights' light fades to nothing at their range (see LightGrid.hlsli), lights that
+// reach the whole scene are in every cell. Pixels outside the box use the nearest cell.
+
+#include "CVector3.h"
+#include <d3d11.h>
+#include <vector>
+#include "stdint.h"
+
+#ifndef _LIGHT_GRID_H_INCLUDED_
+#define _LIGHT_GRID_H_INCLUDED_
+
+class LightGrid
+{
+//--------------------------------------------------------------------------------------
+// Construction / Usage
+//--------------------------------------------------------------------------------------
+public:
+
+	// Create a grid of cells filling the box between the given corners, with space for up to maxLights lights
+	// Will throw a std::runtime_error exception on failure (same as Mesh)
+	LightGrid(const CVector3& minCorner, const CVector3& maxCorner, unsigned int maxLights);
+	~LightGrid();
+
+
+	// Remove all lights, e.g. at the start of a frame before adding the lights for that frame. Keeps the memory used
+	void ClearLights()  { mLights.clear(); }
+
+	// Add a point light, the colour includes its strength. Its light fades to nothing at the given range. Shadowed lights are
+	// shadowed by the shadow maps (see ShadowMap.h), which are for the key light only. Returns false if full
+	bool AddLight(const CVector3& position, const CVector3& colour, float range, bool shadowed = false);
+
+	// Find the lights reaching each cell and send the lights and the cells' lists to the GPU. Call once per frame, after
+	// adding the lights and before any pass renders them, on the immediate context. The buffers aren't dynamic because the
+	// passes reading them may be recorded on other contexts (see CommandRecorder.h)
+	void Update();
+
+	// Select the lights and the cells' lists for the pixel shaders, in the slots used by LightGrid.hlsli
+	void SetShaderResources();
+
+
+	//-------------------------------------
+	// Data access
+	//-------------------------------------
+
+	// The values the shaders need to find a pixel's cell, for the per-frame constants: the corner of the box with the lowest
+	// coordinates, the cells per world unit in x, y and z, and the number of cells in x, y and z
+	const CVector3& MinCorner()    { return mMinCorner; }
+	const CVector3& CellsPerUnit() { return mCellsPerUnit; }
+	CVector3        NumCells()     { return { static_cast<float>(CellsX), static_cast<float>(CellsY), static_cast<float>(CellsZ) }; }
+
+	unsigned int NumLights()  { return static_cast<unsigned int>(mLights.size()); }
+
+	// The most lights in any one cell at the last Update, and the number of times a light wasn't added to a cell because
+	// the lists were full, which should be 0
+	unsigned int MaxCellLights()  { return mMaxCellLights; }
+	unsigned int DroppedLights()  { return mDroppedLights; }
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions / data
+//--------------------------------------------------------------------------------------
+private:
+
+	// Number of cells in each direction. The scene is wide and flat, so it has fewer cells vertically
+	static constexpr int CellsX       = 32;
+	static constexpr int CellsY       = 4;
+	static constexpr int CellsZ       = 32;
+	static constexpr int NumGridCells = CellsX * CellsY * CellsZ;
+
+	// Space in the cells' lists, shared by all the cells - on average this many lights in each cell
+	static constexpr int MaxLightIndices = NumGridCells * 32;
+
+	// A point light in the GPU buffer, must match PointLight in LightGrid.hlsli
+	struct Light
+	{
+		CVector3 position;
+		float    range;
+		CVector3 colour;
+		float    shadowed; // 1 or 0
+	};
+
+	// The cells a light reaches might include, from the box around its range. Inclusive, clamped to the grid
+	struct CellRange
+	{
+		int min[3];
+		int max[3];
+	};
+
+	// Find the range of cells for a light / whether the light reaches a cell
+	CellRange LightCells(const Light& light);
+	bool      LightReachesCell(const Light& light, int x, int y, int z);
+
+	// Create the GPU buffers, throws a std::runtime_error exception on failure. Release them, used by the destructor and
+	// when the constructor fails
+	void CreateBuffers();
+	void ReleaseBuffers();
+
+
+	CVector3 mMinCorner;
+	CVector3 mCellSize;
+	CVector3 mCellsPerUnit;
+
+	// Lights for this frame, space reserved for mMaxLights so adding lights never allocates
+	std::vector<Light> mLights;
+	unsigned int       mMaxLights;
+
+	// The start and count in mCellLightIndices of each cell's list, and the lists themselves, the light indexes in each cell
+	// one after another. Cells are in x, then y, then z order. Sized once so building them doesn't allocate
+	std::vector<uint32_t> mCellLists;        // Two per cell
+	std::vector<uint32_t> mCellLightIndices;
+	unsigned int          mMaxCellLights = 0;
+	unsigned int          mDroppedLights = 0;
+
+	// Structured buffers for the lights, the cells' starts and counts, and the lists
+	ID3D11Buffer*             mLightBuffer         = nullptr;
+	ID3D11ShaderResourceView* mLightBufferSRV      = nullptr;
+	ID3D11Buffer*             mCellBuffer          = nullptr;
+	ID3D11ShaderResourceView* mCellBufferSRV       = nullptr;
+	ID3D11Buffer*             mLightIndexBuffer    = nullptr;
+	ID3D11ShaderResourceView* mLightIndexBufferSRV = nullptr;
+};
+
+
+// The lights reaching each part of the scene, created in InitScene (see Scene.cpp)
+extern LightGrid* gLightGrid;
+
+
+#endif //_LIGHT_GRID_H_INCLUDED_
@@ -0,0 +1,62 @@
+//--------------------------------------------------------------------------------------
+// Light grid - the point lights reaching each part of the scene
+//--------------------------------------------------------------------------------------
+// The lights and the lists of lights in each cell of the grid built on the C++ side each frame
+// (see LightGrid.h). A shader finds the cell of its pixel with LightCell, then loops over the
+// lights in that cell's list:
+//
+//	uint2 cell = LightCell(worldPosition);
+//	for (uint i = 0; i < cell.y; ++i)
+//	{
+//		PointLight light = Lights[LightIndices[cell.x + i]];
+//		...
+//	}
+
+#ifndef _LIGHT_GRID_HLSLI_DEFINED_
+#define _LIGHT_GRID_HLSLI_DEFINED_
+
+#include "Common.hlsli"
+
+
+//--------------------------------------------------------------------------------------
+// Buffers
+//--------------------------------------------------------------------------------------
+
+// Must match Light in LightGrid.h
+struct PointLight
+{
+	float3 position;
+	float  range;    // The light fades to nothing at this distance
+	float3 colour;   // Includes the light's strength
+	float  shadowed; // 1 for the key light, which is shadowed by the shadow maps (see ShadowMap.hlsli)
+};
+
+// The slots must match LightGrid::SetShaderResources
+StructuredBuffer<PointLight> Lights       : register(t16);
+StructuredBuffer<uint2>      LightCells   : register(t17); // Start and count of each cell's list in LightIndices
+StructuredBuffer<uint>       LightIndices : register(t18); // The lists of each cell's lights, one after another
+
+
+//--------------------------------------------------------------------------------------
+// Functions
+//--------------------------------------------------------------------------------------
+
+// The start and count of the list of lights for the cell containing the given world position. Positions outside the grid
+// use the nearest cell, the C++ side adds the lights near the grid to its edge cells to match
+uint2 LightCell(float3 worldPosition)
+{
+	int3 cell = int3(floor((worldPosition - gLightGridMin) * gLightGridScale));
+	cell = clamp(cell, 0, int3(gLightGridSize) - 1);
+	return LightCells[(cell.z * int(gLightGridSize.y) + cell.y) * int(gLightGridSize.x) + cell.x];
+}
+
+// How much of a light's colour reaches the given distance. The light falls off with 1 / distance as the shaders always
+// used, multiplied by a curve going smoothly from 1 to 0 at the light's range, so a light can be left out of the cells
+// it doesn't reach without a visible edge. Lights with a range far larger than the scene are as they were before
+float LightFalloff(float distance, float range)
+{
+	float fade = saturate(1 - pow(distance / range, 4));
+	return fade * fade / distance;
+}
+
+#endif // _LIGHT_GRID_HLSLI_DEFINED_
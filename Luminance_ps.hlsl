@@ -0,0 +1,27 @@
+//--------------------------------------------------------------------------------------
+// Scene luminance Pixel Shader
+//--------------------------------------------------------------------------------------
+// Writes the log of the brightness of the HDR scene into the small luminance texture. Its mip-maps then average the logs,
+// the smallest mip-map is the log of the geometric mean brightness, which isn't thrown by a few very bright pixels (the lights)
+
+#include "PostProcess.hlsli"
+
+
+//--------------------------------------------------------------------------------------
+// Textures (texture maps)
+//--------------------------------------------------------------------------------------
+
+Texture2D    SceneMap : register(t0);
+SamplerState LinearFilter : register(s0);
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+float main(PostProcessPixelShaderInput input) : SV_Target
+{
+	// The luminance texture is much smaller than the scene, a bilinear sample averages a few scene pixels into each texel
+	float3 sceneColour = SceneMap.SampleLevel(LinearFilter, SceneUV(input.uv, SceneMap), 0).rgb;
+	return log(max(Luminance(sceneColour), 0.0001f)); // Black pixels would give -infinity
+}
@@ -0,0 +1,88 @@
+//--------------------------------------------------------------------------------------
+// Materials - how the lit scene objects are drawn in each kind of pass
+//--------------------------------------------------------------------------------------
+// Each pass used to select the shaders for all the lit models itself, and the draw loop set the
+// texture of each model by hand. A material gathers everything an object is drawn with other
+// than its mesh: the shaders for each kind of pass, the texture and sampler, the blend state and
+// a tint. The draw list (see DrawList.h) sorts the draws of a pass by their shaders and material,
+// so each of these is only bound when it changes. The textures are layers of texture arrays, so
+// the models with different textures can share the array and be drawn together.
+
+#include "CVector3.h"
+#include "Shader.h"
+#include <d3d11.h>
+
+#ifndef _MATERIAL_H_INCLUDED_
+#define _MATERIAL_H_INCLUDED_
+
+class StreamedTexture;
+
+// The kinds of pass the lit objects are drawn in, each uses its own pixel shader. The environment map faces are drawn like
+// the main pass. The depth pass is the main pass's depth prepass. The water views pass draws the refraction and reflection at
+// once, with the water views geometry shader after the material's vertex shader (see WaterViews_gs.hlsl)
+enum class MaterialPass
+{
+	Main,
+	Refracted,
+	Reflected,
+	Depth,
+	WaterViews,
+};
+const int NumMaterialPasses = 5;
+
+
+struct Material
+{
+	// The shaders are the addresses of the app's shader variables (see Shader.h) rather than the shaders themselves, so the
+	// shaders swapped in by hot reloading are used straight away. A null pixel shader address switches the pixel shader off,
+	// as the depth pass does. The vertex shader is used in every pass, so the depths of the prepass match the main pass exactly
+	ID3D11VertexShader* const* vertexShader = &gPixelLightingVertexShader;
+	ID3D11PixelShader*  const* pixelShaders[NumMaterialPasses] =
+	{
+		&gPixelLightingPixelShader, &gRefractedPixelLightingPixelShader, &gReflectedPixelLightingPixelShader, nullptr,
+		&gWaterViewsPixelLightingPixelShader
+	};
+
+	// Cheaper pixel shaders for the passes whose output is only seen through the water, used instead of the shaders above when
+	// the render settings ask for simple water lighting (see Settings.h). nullptr for the passes that keep the shader above
+	ID3D11PixelShader*  const* simplePixelShaders[NumMaterialPasses] =
+	{
+		nullptr, &gRefractedSimpleLightingPixelShader, &gReflectedSimpleLightingPixelShader, nullptr,
+		&gWaterViewsSimpleLightingPixelShader
+	};
+
+	StreamedTexture*    diffuseSpecularMap = nullptr; // Slot 0, a texture array - materials that share it differ by their layer
+	int                 textureLayer   = 0;           // (see CookTextureArray). The shaders read the layer from gTextureLayer
+	float               textureRepeats = 1;           // Times the texture repeats across the model, for texture streaming
+	ID3D11SamplerState* sampler    = nullptr;         // Slot 0, nullptr for the standard sampler selected by each pass
+	ID3D11BlendState*   blendState = nullptr;         // nullptr for no blending. The lit objects are drawn before the water
+	                                                  // in an order chosen for speed, so blending can't need a back to front order
+	CVector3            tint = { 1, 1, 1 };           // Multiplies the diffuse colour of the texture
+
+	// The pixel shader of a pass, its simple version if asked for and the material has one
+	ID3D11PixelShader* PixelShader(MaterialPass pass, bool simple = false) const
+	{
+		ID3D11PixelShader* const* shader = pixelShaders[static_cast<int>(pass)];
+		if (simple && simplePixelShaders[static_cast<int>(pass)] != nullptr)  shader = simplePixelShaders[static_cast<int>(pass)];
+		return shader != nullptr ? *shader : nullptr;
+	}
+
+	// Whether the materials use the same shaders in every pass / are the same in every way
+	bool SameShaders(const Material& other) const
+	{
+		for (int pass = 0; pass < NumMaterialPasses; ++pass)
+		{
+			if (pixelShaders[pass] != other.pixelShaders[pass] || simplePixelShaders[pass] != other.simplePixelShaders[pass])  return false;
+		}
+		return vertexShader == other.vertexShader;
+	}
+	bool operator==(const Material& other) const
+	{
+		return SameShaders(other) && diffuseSpecularMap == other.diffuseSpecularMap && textureLayer == other.textureLayer &&
+		       textureRepeats == other.textureRepeats && sampler == other.sampler &&
+		       blendState == other.blendState && tint.x == other.tint.x && tint.y == other.tint.y && tint.z == other.tint.z;
+	}
+};
+
+
+#endif //_MATERIAL_H_INCLUDED_
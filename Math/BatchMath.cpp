@@ -0,0 +1,246 @@
+//--------------------------------------------------------------------------------------
+// Batch math - transforms and frustum tests over whole arrays of points, spheres and matrices
+//--------------------------------------------------------------------------------------
+
+#include "BatchMath.h"
+#include "SimdHelpers.h"
+#include <algorithm>
+
+#ifdef MATH_SIMD
+
+/*-----------------------------------------------------------------------------------------
+    SIMD helpers
+-----------------------------------------------------------------------------------------*/
+// See SimdHelpers.h for the helpers shared with CMatrix4x4.cpp. An SSE register holds the same coordinate of four points
+
+// Return the dot product of four points with the same (a, b, c) and add d: a * x + b * y + c * z + d for each point
+static inline __m128 Dot4(__m128 x, __m128 y, __m128 z, float a, float b, float c, float d)
+{
+    __m128 result = MultiplyAdd(x, _mm_set1_ps(a), _mm_set1_ps(d));
+    result = MultiplyAdd(y, _mm_set1_ps(b), result);
+    return   MultiplyAdd(z, _mm_set1_ps(c), result);
+}
+#endif
+
+
+/*-----------------------------------------------------------------------------------------
+    Arrays
+-----------------------------------------------------------------------------------------*/
+
+// Return the given count rounded up to a multiple of BatchWidth
+static inline size_t PaddedCount(size_t count)
+{
+    return (count + BatchWidth - 1) / BatchWidth * BatchWidth;
+}
+
+// Set the number of points, keeping those already there up to that many. Only allocates when the array grows
+void PointArray::Resize(size_t newCount)
+{
+    size_t padded = PaddedCount(newCount);
+    x.resize(padded);
+    y.resize(padded);
+    z.resize(padded);
+    for (size_t i = newCount; i < padded; ++i)  x[i] = y[i] = z[i] = 0;
+    count = newCount;
+}
+
+// Set the number of spheres, keeping those already there up to that many. Only allocates when the array grows
+void SphereArray::Resize(size_t newCount)
+{
+    size_t padded = PaddedCount(newCount);
+    x.resize(padded);
+    y.resize(padded);
+    z.resize(padded);
+    radius.resize(padded);
+    for (size_t i = newCount; i < padded; ++i)
+    {
+        x[i] = y[i] = z[i] = 0;
+        radius[i] = -1;
+    }
+    count = newCount;
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Points
+-----------------------------------------------------------------------------------------*/
+
+// Transform each point as a position (w = 1) by an affine matrix. transformed may be the points themselves
+void TransformPoints(const PointArray& points, const CMatrix4x4& m, PointArray& transformed)
+{
+    transformed.Resize(points.count);
+    size_t padded = PaddedCount(points.count);
+
+#ifdef MATH_SIMD
+    __m128 m00 = _mm_set1_ps(m.e00), m01 = _mm_set1_ps(m.e01), m02 = _mm_set1_ps(m.e02);
+    __m128 m10 = _mm_set1_ps(m.e10), m11 = _mm_set1_ps(m.e11), m12 = _mm_set1_ps(m.e12);
+    __m128 m20 = _mm_set1_ps(m.e20), m21 = _mm_set1_ps(m.e21), m22 = _mm_set1_ps(m.e22);
+    __m128 m30 = _mm_set1_ps(m.e30), m31 = _mm_set1_ps(m.e31), m32 = _mm_set1_ps(m.e32);
+    for (size_t i = 0; i < padded; i += BatchWidth)
+    {
+        __m128 x = _mm_loadu_ps(&points.x[i]);
+        __m128 y = _mm_loadu_ps(&points.y[i]);
+        __m128 z = _mm_loadu_ps(&points.z[i]);
+        _mm_storeu_ps(&transformed.x[i], MultiplyAdd(z, m20, MultiplyAdd(y, m10, MultiplyAdd(x, m00, m30))));
+        _mm_storeu_ps(&transformed.y[i], MultiplyAdd(z, m21, MultiplyAdd(y, m11, MultiplyAdd(x, m01, m31))));
+        _mm_storeu_ps(&transformed.z[i], MultiplyAdd(z, m22, MultiplyAdd(y, m12, MultiplyAdd(x, m02, m32))));
+    }
+#else
+    for (size_t i = 0; i < padded; ++i)
+    {
+        float x = points.x[i], y = points.y[i], z = points.z[i];
+        transformed.x[i] = x * m.e00 + y * m.e10 + z * m.e20 + m.e30;
+        transformed.y[i] = x * m.e01 + y * m.e11 + z * m.e21 + m.e31;
+        transformed.z[i] = x * m.e02 + y * m.e12 + z * m.e22 + m.e32;
+    }
+#endif
+}
+
+
+// Transform each point as a position (w = 1) by a projecting matrix and divide x and y by the w it gives. Points with w of
+// 0 or less aren't divided. projected may be the points themselves
+void ProjectPoints(const PointArray& points, const CMatrix4x4& m, PointArray& projected)
+{
+    projected.Resize(points.count);
+    size_t padded = PaddedCount(points.count);
+
+#ifdef MATH_SIMD
+    __m128 m00 = _mm_set1_ps(m.e00), m01 = _mm_set1_ps(m.e01), m03 = _mm_set1_ps(m.e03);
+    __m128 m10 = _mm_set1_ps(m.e10), m11 = _mm_set1_ps(m.e11), m13 = _mm_set1_ps(m.e13);
+    __m128 m20 = _mm_set1_ps(m.e20), m21 = _mm_set1_ps(m.e21), m23 = _mm_set1_ps(m.e23);
+    __m128 m30 = _mm_set1_ps(m.e30), m31 = _mm_set1_ps(m.e31), m33 = _mm_set1_ps(m.e33);
+    __m128 zero = _mm_setzero_ps();
+    __m128 one  = _mm_set1_ps(1.0f);
+    for (size_t i = 0; i < padded; i += BatchWidth)
+    {
+        __m128 x = _mm_loadu_ps(&points.x[i]);
+        __m128 y = _mm_loadu_ps(&points.y[i]);
+        __m128 z = _mm_loadu_ps(&points.z[i]);
+        __m128 outX = MultiplyAdd(z, m20, MultiplyAdd(y, m10, MultiplyAdd(x, m00, m30)));
+        __m128 outY = MultiplyAdd(z, m21, MultiplyAdd(y, m11, MultiplyAdd(x, m01, m31)));
+        __m128 outW = MultiplyAdd(z, m23, MultiplyAdd(y, m13, MultiplyAdd(x, m03, m33)));
+
+        // Divide by w where it is in front, by 1 elsewhere. One divide for both x and y
+        __m128 inFront = _mm_cmpgt_ps(outW, zero);
+        __m128 invW = _mm_div_ps(one, _mm_or_ps(_mm_and_ps(inFront, outW), _mm_andnot_ps(inFront, one)));
+        _mm_storeu_ps(&projected.x[i], _mm_mul_ps(outX, invW));
+        _mm_storeu_ps(&projected.y[i], _mm_mul_ps(outY, invW));
+        _mm_storeu_ps(&projected.z[i], outW);
+    }
+#else
+    for (size_t i = 0; i < padded; ++i)
+    {
+        float x = points.x[i], y = points.y[i], z = points.z[i];
+        float outX = x * m.e00 + y * m.e10 + z * m.e20 + m.e30;
+        float outY = x * m.e01 + y * m.e11 + z * m.e21 + m.e31;
+        float outW = x * m.e03 + y * m.e13 + z * m.e23 + m.e33;
+        float invW = outW > 0 ? 1.0f / outW : 1.0f;
+        projected.x[i] = outX * invW;
+        projected.y[i] = outY * invW;
+        projected.z[i] = outW;
+    }
+#endif
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Matrices
+-----------------------------------------------------------------------------------------*/
+
+// Multiply count pairs of matrices, out[i] = m1[i] * m2[i]. out may be either input
+void MultiplyMatrices(const CMatrix4x4* m1, const CMatrix4x4* m2, CMatrix4x4* out, size_t count)
+{
+#ifdef MATH_SIMD
+    for (size_t i = 0; i < count; ++i)
+    {
+        // Everything is loaded before anything is stored, in case out is one of the inputs
+        __m128 r0 = LoadRow(m2[i], 0), r1 = LoadRow(m2[i], 1), r2 = LoadRow(m2[i], 2), r3 = LoadRow(m2[i], 3);
+        __m128 out0 = TransformRow(LoadRow(m1[i], 0), r0, r1, r2, r3);
+        __m128 out1 = TransformRow(LoadRow(m1[i], 1), r0, r1, r2, r3);
+        __m128 out2 = TransformRow(LoadRow(m1[i], 2), r0, r1, r2, r3);
+        __m128 out3 = TransformRow(LoadRow(m1[i], 3), r0, r1, r2, r3);
+        StoreRow(out[i], 0, out0);
+        StoreRow(out[i], 1, out1);
+        StoreRow(out[i], 2, out2);
+        StoreRow(out[i], 3, out3);
+    }
+#else
+    for (size_t i = 0; i < count; ++i)  out[i] = MultiplyScalar(m1[i], m2[i]);
+#endif
+}
+
+// Multiply count matrices by the same one, out[i] = m1[i] * m2. out may be m1
+void MultiplyMatrices(const CMatrix4x4* m1, const CMatrix4x4& m2, CMatrix4x4* out, size_t count)
+{
+#ifdef MATH_SIMD
+    __m128 r0 = LoadRow(m2, 0), r1 = LoadRow(m2, 1), r2 = LoadRow(m2, 2), r3 = LoadRow(m2, 3);
+    for (size_t i = 0; i < count; ++i)
+    {
+        __m128 out0 = TransformRow(LoadRow(m1[i], 0), r0, r1, r2, r3);
+        __m128 out1 = TransformRow(LoadRow(m1[i], 1), r0, r1, r2, r3);
+        __m128 out2 = TransformRow(LoadRow(m1[i], 2), r0, r1, r2, r3);
+        __m128 out3 = TransformRow(LoadRow(m1[i], 3), r0, r1, r2, r3);
+        StoreRow(out[i], 0, out0);
+        StoreRow(out[i], 1, out1);
+        StoreRow(out[i], 2, out2);
+        StoreRow(out[i], 3, out3);
+    }
+#else
+    for (size_t i = 0; i < count; ++i)  out[i] = MultiplyScalar(m1[i], m2);
+#endif
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Frustum tests
+-----------------------------------------------------------------------------------------*/
+
+// Test the four spheres from index first, a multiple of BatchWidth, against the frustum. Returns a bit for each, set if it
+// might be inside. As SphereInFrustum, a sphere is outside if it is entirely outside one of the planes
+unsigned int SpheresInFrustum4(const Frustum& frustum, const SphereArray& spheres, size_t first)
+{
+#ifdef MATH_SIMD
+    __m128 x = _mm_loadu_ps(&spheres.x[first]);
+    __m128 y = _mm_loadu_ps(&spheres.y[first]);
+    __m128 z = _mm_loadu_ps(&spheres.z[first]);
+    __m128 radius = _mm_loadu_ps(&spheres.radius[first]);
+    __m128 negativeRadius = _mm_sub_ps(_mm_setzero_ps(), radius);
+
+    __m128 inside = _mm_cmpge_ps(radius, _mm_setzero_ps()); // Empty spheres are never visible
+    for (int i = 0; i < frustum.numPlanes; ++i)
+    {
+        const CVector4& plane = frustum.planes[i];
+        __m128 distance = Dot4(x, y, z, plane.x, plane.y, plane.z, plane.w);
+        inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negativeRadius));
+    }
+    return static_cast<unsigned int>(_mm_movemask_ps(inside));
+#else
+    unsigned int inside = 0;
+    for (size_t s = 0; s < BatchWidth; ++s)
+    {
+        BoundingSphere sphere;
+        sphere.centre = { spheres.x[first + s], spheres.y[first + s], spheres.z[first + s] };
+        sphere.radius = spheres.radius[first + s];
+        if (SphereInFrustum(frustum, sphere))  inside |= 1u << s;
+    }
+    return inside;
+#endif
+}
+
+// Test every sphere against the frustum in the same way as SphereInFrustum. Returns how many might be inside
+size_t SpheresInFrustum(const Frustum& frustum, const SphereArray& spheres, std::vector<char>& inside)
+{
+    inside.resize(spheres.count);
+    size_t numInside = 0;
+    for (size_t first = 0; first < spheres.count; first += BatchWidth)
+    {
+        unsigned int mask = SpheresInFrustum4(frustum, spheres, first);
+        size_t last = (std::min)(first + BatchWidth, spheres.count);
+        for (size_t i = first; i < last; ++i)
+        {
+            inside[i] = (mask >> (i - first)) & 1;
+            numInside += inside[i];
+        }
+    }
+    return numInside;
+}
@@ -0,0 +1,97 @@
+//--------------------------------------------------------------------------------------
+// Batch math - transforms and frustum tests over whole arrays of points, spheres and matrices
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+// The vector and matrix classes work on one value per call, which suits most code but not a loop over thousands of
+// bounds, labels or particles. These functions work through whole arrays, with the matrix or frustum loaded into registers
+// once for the lot. Points and spheres are stored as a structure of arrays - all the x's, then all the y's and so on - so
+// SSE works on four of them at once without shuffling them into place. The arrays are padded to a multiple of four, so the
+// loops never have a few left over. Matrices stay as they are: a row of a matrix already fills an SSE register (see
+// CMatrix4x4.h). Define MATH_NO_SIMD to use plain C++ everywhere
+
+#ifndef _BATCH_MATH_H_DEFINED_
+#define _BATCH_MATH_H_DEFINED_
+
+#include "CVector3.h"
+#include "CMatrix4x4.h"
+#include "Frustum.h"
+#include <vector>
+#include <cstddef>
+
+
+// Points and spheres are worked on this many at a time. The arrays below hold a multiple of this many
+const size_t BatchWidth = 4;
+
+
+// Points as separate arrays of x, y and z, count of them. The padding after the last point is zero
+struct PointArray
+{
+    std::vector<float> x, y, z;
+    size_t count = 0;
+
+    // Set the number of points, keeping those already there up to that many. Only allocates when the array grows
+    void Resize(size_t newCount);
+
+    void     Set(size_t i, const CVector3& point)  { x[i] = point.x;  y[i] = point.y;  z[i] = point.z; }
+    CVector3 Get(size_t i) const                   { return { x[i], y[i], z[i] }; }
+};
+
+
+// Bounding spheres as separate arrays of centre x, y, z and radius, count of them. The padding after the last sphere is
+// empty spheres (negative radius), which are never visible
+struct SphereArray
+{
+    std::vector<float> x, y, z, radius;
+    size_t count = 0;
+
+    // Set the number of spheres, keeping those already there up to that many. Only allocates when the array grows
+    void Resize(size_t newCount);
+
+    void Set(size_t i, const BoundingSphere& sphere)
+    {
+        x[i] = sphere.centre.x;  y[i] = sphere.centre.y;  z[i] = sphere.centre.z;  radius[i] = sphere.radius;
+    }
+};
+
+
+/*-----------------------------------------------------------------------------------------
+    Points
+-----------------------------------------------------------------------------------------*/
+
+// Transform each point as a position (w = 1) by an affine matrix, e.g. a world or view matrix. transformed is resized to
+// match, and may be the points themselves
+void TransformPoints(const PointArray& points, const CMatrix4x4& m, PointArray& transformed);
+
+// Transform each point as a position (w = 1) by a projecting matrix, e.g. a view-projection matrix, and divide x and y by
+// the w it gives. Each result is (x / w, y / w, w), for a camera's projection w is the distance in front of the camera.
+// Points with w of 0 or less are behind the camera, their x and y aren't divided and are to be ignored. projected is
+// resized to match, and may be the points themselves
+void ProjectPoints(const PointArray& points, const CMatrix4x4& m, PointArray& projected);
+
+
+/*-----------------------------------------------------------------------------------------
+    Matrices
+-----------------------------------------------------------------------------------------*/
+
+// Multiply count pairs of matrices, out[i] = m1[i] * m2[i]. out may be either input
+void MultiplyMatrices(const CMatrix4x4* m1, const CMatrix4x4* m2, CMatrix4x4* out, size_t count);
+
+// Multiply count matrices by the same one, out[i] = m1[i] * m2, e.g. a hierarchy's matrices by its world matrix. The rows
+// of m2 stay in registers throughout. out may be m1
+void MultiplyMatrices(const CMatrix4x4* m1, const CMatrix4x4& m2, CMatrix4x4* out, size_t count);
+
+
+/*-----------------------------------------------------------------------------------------
+    Frustum tests
+-----------------------------------------------------------------------------------------*/
+
+// Test the four spheres from index first, a multiple of BatchWidth, against the frustum in the same way as SphereInFrustum.
+// Returns a bit for each, bit 0 for the first, set if it might be inside
+unsigned int SpheresInFrustum4(const Frustum& frustum, const SphereArray& spheres, size_t first);
+
+// Test every sphere against the frustum in the same way as SphereInFrustum. inside is resized to the number of spheres and
+// set to 1 for each that might be inside, 0 for the others. Returns how many might be inside
+size_t SpheresInFrustum(const Frustum& frustum, const SphereArray& spheres, std::vector<char>& inside);
+
+
+#endif // _BATCH_MATH_H_DEFINED_
@@ -3,9 +3,36 @@
 //--------------------------------------------------------------------------------------
 
 #include "CMatrix4x4.h"
+#include "SimdHelpers.h"
 
 #include <algorithm>
 
+#ifdef MATH_SIMD
+
+/*-----------------------------------------------------------------------------------------
+    SIMD helpers
+-----------------------------------------------------------------------------------------*/
+// See SimdHelpers.h for the helpers shared with BatchMath.cpp. An SSE register holds four floats, i.e. one row of a matrix
+
+// Return the cross product of the x, y and z of two rows. The w of the result is 0
+static inline __m128 CrossRow(__m128 a, __m128 b)
+{
+    __m128 aYZX = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 bYZX = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 aZXY = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 1, 0, 2));
+    __m128 bZXY = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 1, 0, 2));
+    return _mm_sub_ps(_mm_mul_ps(aYZX, bZXY), _mm_mul_ps(aZXY, bYZX));
+}
+
+// Return the sum of the four elements of a row, in every element
+static inline __m128 SumRow(__m128 v)
+{
+    v = _mm_add_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_add_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+}
+
+#endif // MATH_SIMD
+
 /*-----------------------------------------------------------------------------------------
     Member functions
 -----------------------------------------------------------------------------------------*/
@@ -32,6 +59,9 @@ CVector3 CMatrix4x4::GetRow(int iRow) const
 // Post-multiply this matrix by the given one
 CMatrix4x4& CMatrix4x4::operator*=(const CMatrix4x4& m)
 {
+#ifdef MATH_SIMD
+    *this = *this * m; // All the rows are loaded before any are stored, so no special case is needed for multiplying by self
+#else
     if (this == &m)
     {
         // Special case of multiplying by self - no copy optimisations so use binary version
@@ -73,6 +103,7 @@ CMatrix4x4& CMatrix4x4::operator*=(const CMatrix4x4& m)
         e31 = t1;
         e32 = t2;
     }
+#endif
     return *this;
 }
 
@@ -80,14 +111,7 @@ CMatrix4x4& CMatrix4x4::operator*=(const CMatrix4x4& m)
 // Return the given CVector4 transformed by this matrix
 CVector4 CMatrix4x4::operator*=(const CVector4& v)
 {
-    CVector4 vOut;
-
-	vOut.x = v.x * e00 + v.y * e10 + v.z * e20 + v.w * e30;
-	vOut.y = v.x * e01 + v.y * e11 + v.z * e21 + v.w * e31;
-	vOut.z = v.x * e02 + v.y * e12 + v.z * e22 + v.w * e32;
-	vOut.w = v.x * e03 + v.y * e13 + v.z * e23 + v.w * e33;
-
-	return vOut;
+    return v * *this;
 }
 
 
@@ -97,6 +121,48 @@ CVector4 CMatrix4x4::operator*=(const CVector4& v)
 
 // Matrix-matrix multiplication
 CMatrix4x4 operator*(const CMatrix4x4& m1, const CMatrix4x4& m2)
+{
+#ifdef MATH_SIMD
+    // Each row of the result is the matching row of m1 transformed by m2
+    __m128 r0 = LoadRow(m2, 0);
+    __m128 r1 = LoadRow(m2, 1);
+    __m128 r2 = LoadRow(m2, 2);
+    __m128 r3 = LoadRow(m2, 3);
+    __m128 out0 = TransformRow(LoadRow(m1, 0), r0, r1, r2, r3);
+    __m128 out1 = TransformRow(LoadRow(m1, 1), r0, r1, r2, r3);
+    __m128 out2 = TransformRow(LoadRow(m1, 2), r0, r1, r2, r3);
+    __m128 out3 = TransformRow(LoadRow(m1, 3), r0, r1, r2, r3);
+
+    CMatrix4x4 mOut;
+    StoreRow(mOut, 0, out0);
+    StoreRow(mOut, 1, out1);
+    StoreRow(mOut, 2, out2);
+    StoreRow(mOut, 3, out3);
+    return mOut;
+#else
+    return MultiplyScalar(m1, m2);
+#endif
+}
+
+// Return the given CVector4 transformed by the given matrix
+CVector4 operator*(const CVector4& v, const CMatrix4x4& m)
+{
+#ifdef MATH_SIMD
+    CVector4 vOut;
+    _mm_storeu_ps(&vOut.x, TransformRow(_mm_loadu_ps(&v.x), LoadRow(m, 0), LoadRow(m, 1), LoadRow(m, 2), LoadRow(m, 3)));
+    return vOut;
+#else
+    return TransformScalar(v, m);
+#endif
+}
+
+
+/*-----------------------------------------------------------------------------------------
+  Plain C++ versions
+-----------------------------------------------------------------------------------------*/
+
+// Matrix-matrix multiplication
+CMatrix4x4 MultiplyScalar(const CMatrix4x4& m1, const CMatrix4x4& m2)
 {
     CMatrix4x4 mOut;
 
@@ -124,7 +190,7 @@ CMatrix4x4 operator*(const CMatrix4x4& m1, const CMatrix4x4& m2)
 }
 
 // Return the given CVector4 transformed by the given matrix
-CVector4 operator*(const CVector4& v, const CMatrix4x4& m)
+CVector4 TransformScalar(const CVector4& v, const CMatrix4x4& m)
 {
     CVector4 vOut;
 
@@ -223,6 +289,43 @@ CMatrix4x4 MatrixScaling(const float s)
 // Return the inverse of given matrix assuming that it is an affine matrix
 // Advanced calulation needed to get the view matrix from the camera's positioning matrix
 CMatrix4x4 InverseAffine(const CMatrix4x4& m)
+{
+#ifdef MATH_SIMD
+    // The inverse of the upper left 3x3 has columns (row1 x row2, row2 x row0, row0 x row1) / determinant. The cross
+    // products have 0 in w, so the transpose below also gives 0 in the right column
+    __m128 r0 = LoadRow(m, 0);
+    __m128 r1 = LoadRow(m, 1);
+    __m128 r2 = LoadRow(m, 2);
+    __m128 c0 = CrossRow(r1, r2);
+    __m128 c1 = CrossRow(r2, r0);
+    __m128 c2 = CrossRow(r0, r1);
+    __m128 c3 = _mm_setzero_ps();
+    __m128 invDet = _mm_div_ps(_mm_set1_ps(1.0f), SumRow(_mm_mul_ps(r0, c0))); // Determinant is row0 . (row1 x row2)
+    c0 = _mm_mul_ps(c0, invDet);
+    c1 = _mm_mul_ps(c1, invDet);
+    c2 = _mm_mul_ps(c2, invDet);
+    _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+
+    // Transform negative translation by inverted 3x3 to get inverse, then put 1 in the bottom right
+    __m128 t = LoadRow(m, 3);
+    __m128 translation = _mm_mul_ps(_mm_shuffle_ps(t, t, _MM_SHUFFLE(0, 0, 0, 0)), c0);
+    translation = MultiplyAdd(_mm_shuffle_ps(t, t, _MM_SHUFFLE(1, 1, 1, 1)), c1, translation);
+    translation = MultiplyAdd(_mm_shuffle_ps(t, t, _MM_SHUFFLE(2, 2, 2, 2)), c2, translation);
+    translation = _mm_sub_ps(_mm_set_ps(1.0f, 0.0f, 0.0f, 0.0f), translation);
+
+    CMatrix4x4 mOut;
+    StoreRow(mOut, 0, c0);
+    StoreRow(mOut, 1, c1);
+    StoreRow(mOut, 2, c2);
+    StoreRow(mOut, 3, translation);
+    return mOut;
+#else
+    return InverseAffineScalar(m);
+#endif
+}
+
+// Plain C++ version of InverseAffine
+CMatrix4x4 InverseAffineScalar(const CMatrix4x4& m)
 {
     CMatrix4x4 mOut;
 
@@ -2,6 +2,8 @@
 // Matrix4x4 class (cut down version) to hold matrices for 3D
 //--------------------------------------------------------------------------------------
 // Code in .cpp file
+// Multiplication, vector transform and InverseAffine use SSE where the CPU supports it (all x64 CPUs do). Building with
+// /arch:AVX2 also uses fused multiply-add. Define MATH_NO_SIMD to use plain C++ everywhere
 
 #ifndef _CMATRIX4X4_H_DEFINED_
 #define _CMATRIX4X4_H_DEFINED_
@@ -9,10 +11,16 @@
 #include "CVector3.h"
 #include "CVector4.h"
 #include <cmath>
+#include <cstring>
 
+#if !defined(MATH_NO_SIMD) && (defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__))
+#define MATH_SIMD
+#endif
 
-// Matrix class
-class CMatrix4x4
+
+// Matrix class. Aligned to 16 bytes so each row can be loaded straight into an SSE register. The elements are still
+// 16 floats with nothing in between, so the matrix can be copied directly into a constant buffer
+class alignas(16) CMatrix4x4
 {
 // Concrete class - public access
 public:
@@ -36,7 +44,7 @@ public:
     CVector3 GetRow(int iRow) const;
 
     // Initialise this matrix with a pointer to 16 floats 
-    void SetValues(float* matrixValues)  { *this = *reinterpret_cast<CMatrix4x4*>(matrixValues); }
+    void SetValues(float* matrixValues)  { std::memcpy(&e00, matrixValues, 16 * sizeof(float)); } // Values needn't be aligned
 
  
     // Helper functions
@@ -118,4 +126,15 @@ CMatrix4x4 MatrixScaling(const float s);
 CMatrix4x4 InverseAffine(const CMatrix4x4& m);
 
 
+/*-----------------------------------------------------------------------------------------
+  Plain C++ versions
+-----------------------------------------------------------------------------------------*/
+
+// The operators and InverseAffine above use these when SIMD isn't available. They are always available so the SIMD
+// versions can be checked and timed against them (see RunMathBenchmark in Benchmark.h)
+CMatrix4x4 MultiplyScalar(const CMatrix4x4& m1, const CMatrix4x4& m2);
+CVector4   TransformScalar(const CVector4& v, const CMatrix4x4& m);
+CMatrix4x4 InverseAffineScalar(const CMatrix4x4& m);
+
+
 #endif // _CMATRIX4X4_H_DEFINED_
@@ -0,0 +1,131 @@
+//--------------------------------------------------------------------------------------
+// View frustum and bounding volume tests, for culling models that can't be seen
+//--------------------------------------------------------------------------------------
+
+#include "Frustum.h"
+#include <algorithm>
+
+
+//--------------------------------------------------------------------------------------
+// Bounding volumes
+//--------------------------------------------------------------------------------------
+
+// Grow the box to contain the given point / box
+void BoundingBox::Add(const CVector3& point)
+{
+	min = { (std::min)(min.x, point.x), (std::min)(min.y, point.y), (std::min)(min.z, point.z) };
+	max = { (std::max)(max.x, point.x), (std::max)(max.y, point.y), (std::max)(max.z, point.z) };
+}
+
+void BoundingBox::Add(const BoundingBox& box)
+{
+	if (box.IsEmpty())  return;
+	Add(box.min);
+	Add(box.max);
+}
+
+
+// Return the sphere around the given box
+BoundingSphere SphereFromBox(const BoundingBox& box)
+{
+	BoundingSphere sphere;
+	if (box.IsEmpty())  return sphere;
+
+	sphere.centre = (box.min + box.max) * 0.5f;
+	sphere.radius = Length(box.max - box.min) * 0.5f;
+	return sphere;
+}
+
+
+// Return the given sphere transformed by the given matrix. Any scaling in the matrix scales the radius (by the largest
+// scale if it isn't uniform)
+BoundingSphere TransformSphere(const BoundingSphere& sphere, const CMatrix4x4& m)
+{
+	BoundingSphere transformed;
+	if (sphere.radius < 0)  return transformed;
+
+	CVector4 centre = CVector4(sphere.centre, 1) * m;
+	CVector3 scale = m.GetScale();
+	transformed.centre = { centre.x, centre.y, centre.z };
+	transformed.radius = sphere.radius * (std::max)({ scale.x, scale.y, scale.z });
+	return transformed;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Frustum
+//--------------------------------------------------------------------------------------
+
+// Get the frustum for a camera from its view-projection matrix
+// A point p is projected to (x, y, z, w) = p * viewProjection, and is visible if -w <= x <= w, -w <= y <= w and 0 <= z <= w.
+// Each of those tests is a plane equation using the columns of the matrix, e.g. the left plane is w + x >= 0, or
+// p.(column3 + column0) >= 0
+Frustum FrustumFromMatrix(const CMatrix4x4& viewProjection)
+{
+	const CMatrix4x4& m = viewProjection;
+	CVector4 column0 = { m.e00, m.e10, m.e20, m.e30 };
+	CVector4 column1 = { m.e01, m.e11, m.e21, m.e31 };
+	CVector4 column2 = { m.e02, m.e12, m.e22, m.e32 };
+	CVector4 column3 = { m.e03, m.e13, m.e23, m.e33 };
+
+	auto plane = [](const CVector4& a, const CVector4& b, float sign)
+	{
+		CVector4 p = { a.x + sign * b.x, a.y + sign * b.y, a.z + sign * b.z, a.w + sign * b.w };
+
+		// Normalise so the plane equation gives the distance to the plane, needed for the sphere test
+		float length = std::sqrt(p.x * p.x + p.y * p.y + p.z * p.z);
+		if (length > 0)  { p.x /= length;  p.y /= length;  p.z /= length;  p.w /= length; }
+		return p;
+	};
+
+	Frustum frustum;
+	frustum.planes[Frustum::Left  ] = plane(column3, column0,  1);
+	frustum.planes[Frustum::Right ] = plane(column3, column0, -1);
+	frustum.planes[Frustum::Bottom] = plane(column3, column1,  1);
+	frustum.planes[Frustum::Top   ] = plane(column3, column1, -1);
+	frustum.planes[Frustum::Near  ] = plane(column3, column2, -1); // Depths are reversed, 1 at the near plane (see Camera.cpp)
+	frustum.planes[Frustum::Far   ] = plane(column2, column2,  0); // Always passes for an infinite far plane
+	return frustum;
+}
+
+
+// Add an extra plane to the frustum, given as (a, b, c, d) like the others with (a, b, c) normalised. Spheres completely
+// on the outside of the plane are culled. Does nothing if there is no room for another plane
+void AddClipPlane(Frustum& frustum, const CVector4& plane)
+{
+	if (frustum.numPlanes < Frustum::MaxPlanes)  frustum.planes[frustum.numPlanes++] = plane;
+}
+
+
+// Test if any part of a sphere might be inside the frustum. Spheres near the corners of the frustum can pass without
+// being inside, which is fine for culling (they are just drawn)
+bool SphereInFrustum(const Frustum& frustum, const BoundingSphere& sphere)
+{
+	if (sphere.radius < 0)  return false;
+
+	for (int i = 0; i < frustum.numPlanes; ++i)
+	{
+		const CVector4& plane = frustum.planes[i];
+		float distance = plane.x * sphere.centre.x + plane.y * sphere.centre.y + plane.z * sphere.centre.z + plane.w;
+		if (distance < -sphere.radius)  return false;
+	}
+	return true;
+}
+
+
+// Test if any part of a box might be inside the frustum. The box is outside a plane if its corner furthest along the plane
+// normal is outside it
+bool BoxInFrustum(const Frustum& frustum, const BoundingBox& box)
+{
+	if (box.IsEmpty())  return false;
+
+	for (int i = 0; i < frustum.numPlanes; ++i)
+	{
+		const CVector4& plane = frustum.planes[i];
+		float x = (plane.x >= 0) ? box.max.x : box.min.x;
+		float y = (plane.y >= 0) ? box.max.y : box.min.y;
+		float z = (plane.z >= 0) ? box.max.z : box.min.z;
+		if (plane.x * x + plane.y * y + plane.z * z + plane.w < 0)  return false;
+	}
+	return true;
+}
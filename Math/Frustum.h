@@ -0,0 +1,72 @@
+//--------------------------------------------------------------------------------------
+// View frustum and bounding volume tests, for culling models that can't be seen
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+
+#ifndef _FRUSTUM_H_DEFINED_
+#define _FRUSTUM_H_DEFINED_
+
+#include "CVector3.h"
+#include "CVector4.h"
+#include "CMatrix4x4.h"
+
+
+// Axis aligned bounding box. An empty box has min > max
+struct BoundingBox
+{
+	CVector3 min = {  3.0e38f,  3.0e38f,  3.0e38f };
+	CVector3 max = { -3.0e38f, -3.0e38f, -3.0e38f };
+
+	bool IsEmpty() const  { return min.x > max.x; }
+
+	// Grow the box to contain the given point / box
+	void Add(const CVector3& point);
+	void Add(const BoundingBox& box);
+};
+
+
+// Bounding sphere. A negative radius is an empty sphere, which is never visible
+struct BoundingSphere
+{
+	CVector3 centre = { 0, 0, 0 };
+	float    radius = -1;
+};
+
+// Return the sphere around the given box
+BoundingSphere SphereFromBox(const BoundingBox& box);
+
+// Return the given sphere transformed by the given matrix. Any scaling in the matrix scales the radius (by the largest
+// scale if it isn't uniform)
+BoundingSphere TransformSphere(const BoundingSphere& sphere, const CMatrix4x4& m);
+
+
+// The six planes surrounding the volume a camera can see. Each plane is stored as (a, b, c, d) with the normal (a, b, c)
+// facing into the frustum, so a point p is on the inside of the plane if a*p.x + b*p.y + c*p.z + d >= 0
+// A couple of extra planes can be added to cut the volume down further (see AddClipPlane)
+struct Frustum
+{
+	enum Planes { Left, Right, Bottom, Top, Near, Far, NumPlanes };
+	static const int MaxPlanes = NumPlanes + 2;
+
+	CVector4 planes[MaxPlanes];
+	int      numPlanes = NumPlanes;
+};
+
+// Get the frustum for a camera from its view-projection matrix. Works with any matrix, e.g. the camera matrix
+// reflected in the water to render the reflections
+Frustum FrustumFromMatrix(const CMatrix4x4& viewProjection);
+
+// Add an extra plane to the frustum, given as (a, b, c, d) like the others with (a, b, c) normalised. Spheres completely
+// on the outside of the plane are culled. E.g. cull models entirely above or below the water when rendering refraction
+// or reflection. Does nothing if there is no room for another plane
+void AddClipPlane(Frustum& frustum, const CVector4& plane);
+
+// Test if any part of a sphere might be inside the frustum. Spheres near the corners of the frustum can pass without
+// being inside, which is fine for culling (they are just drawn)
+bool SphereInFrustum(const Frustum& frustum, const BoundingSphere& sphere);
+
+// Test if any part of a box might be inside the frustum. As with spheres, boxes near the corners can pass without being inside
+bool BoxInFrustum(const Frustum& frustum, const BoundingBox& box);
+
+
+#endif // _FRUSTUM_H_DEFINED_
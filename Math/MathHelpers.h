@@ -43,6 +43,14 @@ constexpr float ToDegrees(float r)
 }
 
 
+// Blend from a to b, t of 0 gives a and 1 gives b. For any type that can be added and scaled, e.g. CVector3
+template <class T>
+T Lerp(const T& a, const T& b, float t)
+{
+    return a + (b - a) * t;
+}
+
+
 
 // Return random integer from a to b (inclusive)
 // Can only return up to RAND_MAX different values, spread evenly across the given range
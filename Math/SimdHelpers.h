@@ -0,0 +1,46 @@
+//--------------------------------------------------------------------------------------
+// SIMD helpers shared by the matrix and batch math code
+//--------------------------------------------------------------------------------------
+// Internal to the Math folder - included by CMatrix4x4.cpp and BatchMath.cpp only. Everything here is only defined
+// when MATH_SIMD is (see CMatrix4x4.h). An SSE register holds four floats, i.e. one row of a matrix or the same
+// coordinate of four points
+
+#ifndef _SIMD_HELPERS_H_DEFINED_
+#define _SIMD_HELPERS_H_DEFINED_
+
+#include "CMatrix4x4.h"
+
+#ifdef MATH_SIMD
+#include <emmintrin.h>
+#if defined(__FMA__) || (defined(_MSC_VER) && defined(__AVX2__))
+#include <immintrin.h>
+#define MATH_FMA
+#endif
+
+
+// Return a * b + c for each element, in one instruction when the CPU has fused multiply-add
+static inline __m128 MultiplyAdd(__m128 a, __m128 b, __m128 c)
+{
+#ifdef MATH_FMA
+    return _mm_fmadd_ps(a, b, c);
+#else
+    return _mm_add_ps(_mm_mul_ps(a, b), c);
+#endif
+}
+
+// Return the row vector v transformed by the matrix with the given rows: x * row0 + y * row1 + z * row2 + w * row3
+static inline __m128 TransformRow(__m128 v, __m128 r0, __m128 r1, __m128 r2, __m128 r3)
+{
+    __m128 result = _mm_mul_ps(_mm_shuffle_ps(v, v, _MM_SHUFFLE(0, 0, 0, 0)), r0);
+    result = MultiplyAdd(_mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1)), r1, result);
+    result = MultiplyAdd(_mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 2, 2, 2)), r2, result);
+    return   MultiplyAdd(_mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3)), r3, result);
+}
+
+// The matrix is aligned (see CMatrix4x4.h) so rows can use aligned loads and stores
+static inline __m128 LoadRow(const CMatrix4x4& m, int row)   { return _mm_load_ps(&m.e00 + row * 4); }
+static inline void StoreRow(CMatrix4x4& m, int row, __m128 v) { _mm_store_ps(&m.e00 + row * 4, v); }
+
+#endif // MATH_SIMD
+
+#endif // _SIMD_HELPERS_H_DEFINED_
@@ -6,8 +6,17 @@
 // expected to select these things. A later lab will introduce a more robust loader.
 
 #include "Mesh.h"
-#include "Shader.h" // Needed for helper function CreateSignatureForVertexLayout
+#include "Shader.h" // Needed for helper function GetInputLayout
 #include "GraphicsHelpers.h" // Helper functions to unclutter the code here
+#include "StateCache.h"
+#include "MappedFile.h"
+#include "AssetArchive.h"
+#include "MeshOptimiser.h"
+#include "CpuProfiler.h"
+#include "GpuEvents.h"
+#include "GpuMemory.h"
+#include "JobSystem.h"
+#include "VertexFormat.h"
 #include "CVector2.h" 
 #include "CVector3.h" 
 
@@ -17,6 +26,216 @@
 #include <assimp/DefaultLogger.hpp>
 
 #include <memory>
+#include <algorithm>
+#include <cmath>
+#include <type_traits>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <unordered_map>
+#include <mutex>
+#ifdef MATH_SIMD
+#include <emmintrin.h>
+#endif
+
+
+//--------------------------------------------------------------------------------------
+// Mesh loader settings
+//--------------------------------------------------------------------------------------
+
+MeshLoaderSettings gMeshLoaderSettings;
+
+
+// Absolute matrices for each node in the default pose, calculated for instanced rendering. Kept here rather than created for
+// each render to avoid allocating memory every time a mesh is drawn - meshes are drawn several times every frame
+// Shared by all meshes, but one for each thread so meshes can be rendered on several threads at once (see CommandRecorder.h)
+static thread_local std::vector<CMatrix4x4> gAbsoluteMatrices;
+
+
+// Temporary data of the meshes loaded on each thread - the mesh buffer data and the copy kept for the cooked mesh. Reset when
+// each mesh has created its buffers, so loading many meshes reuses the same memory instead of many heap allocations. The
+// sub-meshes are converted in parallel into arenas of their own (see the constructor)
+static thread_local LinearAllocator gImportArena;
+
+// The import arena for this thread, or nullptr to use the heap (see useImportArena in MeshLoaderSettings)
+static LinearAllocator* ImportArena()
+{
+	return gMeshLoaderSettings.useImportArena ? &gImportArena : nullptr;
+}
+
+// Loads on this thread using the import arena, including loads inside other loads
+static thread_local int gImportArenaLoads = 0;
+
+namespace
+{
+	// Resets the thread's import arena when the outermost load using it ends, even if it throws. A load waiting for its
+	// sub-mesh jobs can run another mesh's whole load on the same thread (see JobSystem::Wait). That inner load adds to the
+	// same arena, and must not reset it while the outer load's data is still in it
+	class ImportArenaScope
+	{
+	public:
+		ImportArenaScope()   { ++gImportArenaLoads; }
+		~ImportArenaScope()  { if (--gImportArenaLoads == 0)  gImportArena.Reset(); }
+
+		ImportArenaScope(const ImportArenaScope&) = delete;
+		ImportArenaScope& operator=(const ImportArenaScope&) = delete;
+	};
+}
+
+
+// Settings for the skinning compute shader for one sub-mesh, matches SkinningConstants in Skinning_cs.hlsl. Offsets are
+// in bytes from the start of a vertex. A tangent offset of 0 means the vertices have no tangents
+struct SkinningConstants
+{
+	unsigned int numVertices;
+	unsigned int vertexSize;
+	unsigned int tangentOffset;
+	unsigned int bonesOffset;
+};
+
+// Number of vertices skinned by each thread group, must match numthreads in Skinning_cs.hlsl
+static const unsigned int SKINNING_THREAD_GROUP_SIZE = 64;
+
+
+// Levels of detail stop when simplifying can't remove at least this fraction of the triangles of the level before, e.g. when
+// most of what is left is on the edges of the mesh or on seams, which aren't simplified
+static const float LOD_MIN_REDUCTION = 0.2f;
+
+
+// Make up to the given number of levels of detail for a sub-mesh, each with about half the triangles of the one before (see
+// SimplifyMesh in MeshOptimiser.h). Positions are as for OptimiseSubMesh. The errors say how far each level's surface moved
+static void GenerateLods(const std::vector<uint32_t>& indices, std::vector<std::vector<uint32_t>>& lodIndices,
+                         std::vector<float>& lodErrors, const float* positions, size_t positionStride, unsigned int numVertices,
+                         unsigned int maxLods)
+{
+	const std::vector<uint32_t>* previous = &indices;
+	float error = 0;
+	for (unsigned int lod = 0; lod < maxLods; ++lod)
+	{
+		size_t targetIndices = previous->size() / 6 * 3;
+		std::vector<uint32_t> simplified;
+		float lodError = SimplifyMesh(*previous, simplified, positions, positionStride, numVertices, targetIndices);
+		if (simplified.empty() || simplified.size() > previous->size() * (1 - LOD_MIN_REDUCTION))  break;
+
+		// Each level is simplified from the one before, so its errors add to those already made
+		error += lodError;
+		lodIndices.push_back(std::move(simplified));
+		lodErrors.push_back(error);
+		previous = &lodIndices.back();
+	}
+}
+
+
+// Reorder the triangles and vertices of a sub-mesh (see MeshOptimiser.h), reporting the vertex cache results before and after
+// in the debugger output window. Positions are 3 floats the given number of bytes apart, indexed by the original indices
+// The triangles of any levels of detail are reordered for the vertex cache too and their indices changed to match the new
+// vertex order. Returns the new number of vertices, lower if some weren't used
+static unsigned int OptimiseSubMesh(std::vector<uint32_t>& indices, unsigned char* vertices, unsigned int numVertices,
+                                    unsigned int vertexSize, const float* positions, size_t positionStride, const std::string& name,
+                                    std::vector<std::vector<uint32_t>>* lodIndices = nullptr)
+{
+	VertexCacheStats before = AnalyseVertexCache(indices, numVertices);
+	OptimiseVertexCache(indices, numVertices);
+	OptimiseOverdraw(indices, positions, positionStride, numVertices);
+	VertexCacheStats after = AnalyseVertexCache(indices, numVertices);
+
+	// The levels of detail only use vertices of the full mesh, so reordering the vertices for all the indices together keeps
+	// the full mesh's vertices in the order it uses them
+	size_t numMeshIndices = indices.size();
+	if (lodIndices != nullptr)
+	{
+		for (auto& lod : *lodIndices)
+		{
+			OptimiseVertexCache(lod, numVertices);
+			indices.insert(indices.end(), lod.begin(), lod.end());
+		}
+	}
+	unsigned int numUsed = static_cast<unsigned int>(OptimiseVertexFetch(indices, vertices, numVertices, vertexSize));
+	if (lodIndices != nullptr)
+	{
+		auto lodStart = indices.begin() + numMeshIndices;
+		for (auto& lod : *lodIndices)
+		{
+			std::copy(lodStart, lodStart + lod.size(), lod.begin());
+			lodStart += lod.size();
+		}
+		indices.resize(numMeshIndices);
+	}
+
+	char report[256];
+	sprintf_s(report, "Mesh optimised: %s - %u triangles, ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n",
+	          name.c_str(), static_cast<unsigned int>(indices.size() / 3), before.acmr, after.acmr, before.atvr, after.atvr);
+	OutputDebugStringA(report);
+	if (lodIndices != nullptr)
+	{
+		for (size_t lod = 0; lod < lodIndices->size(); ++lod)
+		{
+			sprintf_s(report, "  Level of detail %u - %u triangles\n", static_cast<unsigned int>(lod + 1),
+			          static_cast<unsigned int>((*lodIndices)[lod].size() / 3));
+			OutputDebugStringA(report);
+		}
+	}
+	return numUsed;
+}
+
+
+// Start / stop the assimp logger chosen in gMeshLoaderSettings. The logger is shared by all imports, so it is created once
+// before loading meshes, rather than for each one. Loading meshes without calling these is fine, there is no logging
+void InitMeshLoader()
+{
+	if (gMeshLoaderSettings.logLevel == MeshLoaderSettings::LogLevel::None)  return;
+
+	auto severity = (gMeshLoaderSettings.logLevel == MeshLoaderSettings::LogLevel::Verbose) ? Assimp::Logger::VERBOSE : Assimp::Logger::NORMAL;
+	Assimp::DefaultLogger::create("", severity);
+}
+
+void ShutdownMeshLoader()
+{
+	Assimp::DefaultLogger::kill(); // Safe to call if there is no logger
+}
+
+
+//--------------------------------------------------------------------------------------
+// Vertex layouts
+//--------------------------------------------------------------------------------------
+// The vertex formats of imported meshes and grids. Their attributes depend on the mesh and the loader settings, so each
+// layout has a bool template parameter for each choice and the one to use is picked with SelectVertexLayout (see VertexFormat.h)
+
+namespace
+{
+	// Imported meshes - position and normal, then tangent, UV and bones when the sub-mesh has them. Quantised vertices use
+	// 16-bit positions and UVs, and 32-bit normals / tangents - 20 bytes rather than 44. Skinned meshes are never quantised,
+	// the skinning compute shader reads and writes full precision vertices (see Skin)
+	template <bool Quantise, bool Tangents, bool UVs, bool Bones>
+	struct ModelVertexLayout
+	{
+		static constexpr bool Quantised = Quantise && !Bones;
+		using Position = std::conditional_t<Quantised, PositionUnorm16,   PositionFloat3>;
+		using Normal   = std::conditional_t<Quantised, NormalOctahedral,  NormalFloat3>;
+		using Tangent  = std::conditional_t<Quantised, TangentOctahedral, TangentFloat3>;
+		using UV       = std::conditional_t<Quantised, UVHalf2,           UVFloat2>;
+
+		using Format = typename AddAttributes<typename AddAttributes<typename AddAttributes<VertexFormat<Position, Normal>,
+		               Tangents, Tangent>::type, UVs, UV>::type, Bones, BoneIndices, BoneWeights>::type;
+
+		// The skinning shader finds the position and normal at fixed offsets (see Skinning_cs.hlsl)
+		static_assert(!Bones || (Format::template Offset<PositionFloat3>() == 0 && Format::template Offset<NormalFloat3>() == 12),
+		              "Skinned vertices must start with a float position and normal");
+	};
+
+	// Grids - position, then normal and UV if asked for
+	template <bool Normals, bool UVs>
+	struct GridVertexLayout
+	{
+		using Format = typename AddAttributes<typename AddAttributes<VertexFormat<PositionFloat3>, Normals, NormalFloat3>::type,
+		               UVs, UVFloat2>::type;
+	};
+}
+
+
+//--------------------------------------------------------------------------------------
+// Construction
+//--------------------------------------------------------------------------------------
 
 
 // Pass the name of the mesh file to load. Uses assimp (http://www.assimp.org/) to support many file types
@@ -24,30 +243,33 @@
 // Will throw a std::runtime_error exception on failure (since constructors can't return errors).
 Mesh::Mesh(const std::string& fileName, bool requireTangents /*= false*/)
 {
+	// Importing with assimp is slow, so the results are saved in a "cooked" mesh file next to the original (see SaveCookedMesh).
+	// Use that instead if it was made from the current version of the mesh file with the current loader settings - checked with
+	// a hash of the mesh file and settings
+	const MeshLoaderSettings& settings = gMeshLoaderSettings;
+	LinearAllocator* arena = ImportArena();
+	ImportArenaScope arenaScope; // Frees the temporaries when the constructor ends, even if it throws
+	std::string cookedFileName = fileName + (requireTangents ? ".tangents.mesh" : ".mesh");
+	uint64_t sourceHash = 0;
+	if (settings.useCookedMeshes)
+	{
+		AssetFile sourceFile(fileName);
+		if (sourceFile.IsOpen())
+		{
+			float importSettings[] = { static_cast<float>(settings.postProcessFlags), settings.smoothingAngle,
+			                           static_cast<float>(settings.maxBonesPerVertex), static_cast<float>(settings.maxBonesPerMesh),
+			                           settings.quantiseVertices ? 1.0f : 0.0f, settings.optimiseMeshes ? 1.0f : 0.0f,
+			                           static_cast<float>(settings.maxLods) };
+			sourceHash = HashData(sourceFile.Data(), sourceFile.Size()) ^ HashData(importSettings, sizeof(importSettings));
+		}
+	}
+	if (sourceHash != 0 && LoadCookedMesh(cookedFileName, sourceHash))  return;
+
+
 	Assimp::Importer importer;
 
-	// Flags for processing the mesh. Assimp provides a huge amount of control - right click any of these
-	// and "Peek Definition" to see documention above each constant
-	unsigned int assimpFlags = aiProcess_MakeLeftHanded |
-		aiProcess_GenSmoothNormals |
-		aiProcess_FixInfacingNormals |
-		aiProcess_GenUVCoords |
-		aiProcess_TransformUVCoords |
-		aiProcess_FlipUVs |
-		aiProcess_FlipWindingOrder |
-		aiProcess_Triangulate |
-		aiProcess_JoinIdenticalVertices |
-		aiProcess_ImproveCacheLocality |
-		aiProcess_SortByPType |
-		aiProcess_FindInvalidData |
-		aiProcess_OptimizeMeshes |
-		aiProcess_FindInstances |
-		aiProcess_FindDegenerates |
-		aiProcess_RemoveRedundantMaterials |
-		aiProcess_Debone |
-		aiProcess_SplitByBoneCount |
-		aiProcess_LimitBoneWeights |
-		aiProcess_RemoveComponent;
+	// Flags for processing the mesh. Assimp provides a huge amount of control - see MeshLoaderSettings in Mesh.h
+	unsigned int assimpFlags = settings.postProcessFlags;
 
 	// Flags to specify what mesh data to ignore
 	int removeComponents = aiComponent_LIGHTS | aiComponent_CAMERAS | aiComponent_TEXTURES | aiComponent_COLORS |
@@ -64,23 +286,21 @@ Mesh::Mesh(const std::string& fileName, bool requireTangents /*= false*/)
 	}
 
 	// Other miscellaneous settings
-	importer.SetPropertyFloat(AI_CONFIG_PP_GSN_MAX_SMOOTHING_ANGLE, 80.0f); // Smoothing angle for normals
+	importer.SetPropertyFloat(AI_CONFIG_PP_GSN_MAX_SMOOTHING_ANGLE, settings.smoothingAngle); // Smoothing angle for normals
 	importer.SetPropertyInteger(AI_CONFIG_PP_SBP_REMOVE, aiPrimitiveType_POINT | aiPrimitiveType_LINE);  // Remove points and lines (keep triangles only)
 	importer.SetPropertyBool(AI_CONFIG_PP_FD_REMOVE, true);                 // Remove degenerate triangles
 	importer.SetPropertyBool(AI_CONFIG_PP_DB_ALL_OR_NONE, true);            // Default to removing bones/weights from meshes that don't need skinning
 
 	// Set maximum bones that can affect one vertex, and also maximum bones affecting a single mesh
-	unsigned int maxBonesPerVertex = 4; // The shaders support 4 bones per verted (null bones are added if necessary)
-	unsigned int maxBonesPerMesh = 256; // Bone indexes are stored in a byte, so no more than 256 
-	importer.SetPropertyInteger(AI_CONFIG_PP_LBW_MAX_WEIGHTS, maxBonesPerVertex);
-	importer.SetPropertyInteger(AI_CONFIG_PP_SBBC_MAX_BONES, maxBonesPerMesh);
+	importer.SetPropertyInteger(AI_CONFIG_PP_LBW_MAX_WEIGHTS, (std::min)(settings.maxBonesPerVertex, 4u)); // Vertices have space for 4 bones
+	importer.SetPropertyInteger(AI_CONFIG_PP_SBBC_MAX_BONES,  (std::min)(settings.maxBonesPerMesh, 256u));
 
 	importer.SetPropertyInteger(AI_CONFIG_PP_RVC_FLAGS, removeComponents);
 
-	// Import mesh with assimp given above requirements - log output
-	Assimp::DefaultLogger::create("", Assimp::DefaultLogger::VERBOSE);
+	importer.SetIOHandler(NewAssetIOSystem()); // Read the file (and any it refers to) from the asset archive if it's there
+
+	// Import mesh with assimp given above requirements - logs to the logger started by InitMeshLoader, if any
 	const aiScene* scene = importer.ReadFile(fileName, assimpFlags);
-	Assimp::DefaultLogger::kill();
 	if (scene == nullptr)  throw std::runtime_error("Error loading mesh (" + fileName + "). " + importer.GetErrorString());
 	if (scene->mNumMeshes == 0)  throw std::runtime_error("No usable geometry in mesh: " + fileName);
 
@@ -103,529 +323,1565 @@ Mesh::Mesh(const std::string& fileName, bool requireTangents /*= false*/)
 	for (unsigned int m = 0; m < scene->mNumMeshes; ++m)
 		if (scene->mMeshes[m]->HasBones())  mHasBones = true;
 
+	// Skinned meshes look up the node of each bone by name, and the node of each sub-mesh without bones. Both are found once
+	// here rather than by searching the nodes for every bone of every sub-mesh, which is slow on meshes with many bones
+	std::unordered_map<std::string, unsigned int> nodeIndices;
+	std::vector<unsigned int> subMeshNodes;
+	if (mHasBones)
+	{
+		nodeIndices.reserve(mNodes.size());
+		subMeshNodes.resize(scene->mNumMeshes, 0);
+		for (unsigned int nodeIndex = 0; nodeIndex < mNodes.size(); ++nodeIndex)
+		{
+			nodeIndices.emplace(mNodes[nodeIndex].name, nodeIndex); // The first node of a name, as a search would find
+			for (auto subMeshIndex : mNodes[nodeIndex].subMeshes)  subMeshNodes[subMeshIndex] = nodeIndex;
+		}
+	}
+
+
+	// Quantised positions are stored relative to a bounding cube around the whole mesh. A cube rather than a box keeps the
+	// scale the same on each axis, so the same matrix can decode positions and (octahedral) normals. The decoding is added
+	// to the world matrices used for rendering (see Render)
+	// Skinned meshes are not quantised, the skinning compute shader reads and writes full precision vertices (see Skin)
+	mQuantisedVertices = settings.quantiseVertices && !mHasBones;
+	if (mQuantisedVertices)
+	{
+		CVector3 minPosition = reinterpret_cast<CVector3&>(scene->mMeshes[0]->mVertices[0]);
+		CVector3 maxPosition = minPosition;
+		for (unsigned int m = 0; m < scene->mNumMeshes; ++m)
+		{
+			for (unsigned int v = 0; v < scene->mMeshes[m]->mNumVertices; ++v)
+			{
+				const aiVector3D& position = scene->mMeshes[m]->mVertices[v];
+				minPosition = { (std::min)(minPosition.x, position.x), (std::min)(minPosition.y, position.y), (std::min)(minPosition.z, position.z) };
+				maxPosition = { (std::max)(maxPosition.x, position.x), (std::max)(maxPosition.y, position.y), (std::max)(maxPosition.z, position.z) };
+			}
+		}
+		CVector3 extents = maxPosition - minPosition;
+		float size = (std::max)({ extents.x, extents.y, extents.z });
+		if (size <= 0)  size = 1;
+		mPositionDecodeMatrix = MatrixScaling(size) * MatrixTranslation(minPosition);
+	}
+	CVector3 positionMin   = mPositionDecodeMatrix.GetPosition();
+	float    positionScale = 1.0f / mPositionDecodeMatrix.e00;
+
+
+	// The offset matrix of each bone (transform from skinned mesh root to bone root). Found before the sub-meshes are converted
+	// below, as several sub-meshes can share the nodes of their bones
+	if (mHasBones)
+	{
+		for (auto& node : mNodes)
+		{
+			node.offsetMatrix = MatrixIdentity();
+		}
+		for (unsigned int m = 0; m < scene->mNumMeshes; ++m)
+		{
+			for (unsigned int i = 0; i < scene->mMeshes[m]->mNumBones; ++i)
+			{
+				aiBone* assimpBone = scene->mMeshes[m]->mBones[i];
+				auto boneNode = nodeIndices.find(assimpBone->mName.C_Str());
+				if (boneNode == nodeIndices.end())  throw std::runtime_error("Bone with no matching node in " + fileName);
+				mNodes[boneNode->second].offsetMatrix.SetValues(&assimpBone->mOffsetMatrix.a1);
+				mNodes[boneNode->second].offsetMatrix.Transpose(); // Assimp stores matrices differently to this app
+			}
+		}
+	}
+
 
 	// A mesh is made of sub-meshes, each one can have a different material (texture)
-	// Import each sub-mesh in the file to seperate index / vertex buffer (could share buffers between sub-meshes but that would make things more complex)
+	// Convert each sub-mesh in the file from the assimp data to its vertices and indices, to put in the mesh's shared buffers at
+	// the end. The sub-meshes are independent, so they are converted in parallel by the job system (see JobSystem.h)
 	mSubMeshes.resize(scene->mNumMeshes);
-	for (unsigned int m = 0; m < scene->mNumMeshes; ++m)
+	ArenaVector<CookedSubMesh> cookedSubMeshes(scene->mNumMeshes, arena); // CPU-side copy of the data, used to write the cooked mesh file
+	std::vector<std::unique_ptr<LinearAllocator>> subMeshArenas(scene->mNumMeshes);
+	auto convertSubMesh = [&](unsigned int m)
 	{
 		aiMesh* assimpMesh = scene->mMeshes[m];
 		std::string subMeshName = assimpMesh->mName.C_Str();
 		auto& subMesh = mSubMeshes[m]; // Short name for the submesh we're currently preparing - makes code below more readable
 
+		// The sub-meshes are converted on several threads at once, so each takes its temporaries from an arena of its own rather
+		// than the loading thread's. Big enough for all its data in one block: the vertices (at most 64 bytes each) and the
+		// indices, with room for the levels of detail
+		LinearAllocator* subMeshArena = nullptr;
+		if (arena != nullptr)
+		{
+			size_t bytes = static_cast<size_t>(assimpMesh->mNumVertices) * 65 + static_cast<size_t>(assimpMesh->mNumFaces) * 24 + 4096;
+			subMeshArenas[m] = std::make_unique<LinearAllocator>(bytes);
+			subMeshArena = subMeshArenas[m].get();
+		}
+
 
 		//-----------------------------------
 
 		// Check for presence of position and normal data. Tangents and UVs are optional.
-		std::vector<D3D11_INPUT_ELEMENT_DESC> vertexElements;
-		unsigned int offset = 0;
-
 		if (!assimpMesh->HasPositions())  throw std::runtime_error("No position data for sub-mesh " + subMeshName + " in " + fileName);
-		unsigned int positionOffset = offset;
-		vertexElements.push_back({ "position", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, positionOffset, D3D11_INPUT_PER_VERTEX_DATA, 0 });
-		offset += 12;
-
 		if (!assimpMesh->HasNormals())  throw std::runtime_error("No normal data for sub-mesh " + subMeshName + " in " + fileName);
-		unsigned int normalOffset = offset;
-		vertexElements.push_back({ "normal", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, normalOffset, D3D11_INPUT_PER_VERTEX_DATA, 0 });
-		offset += 12;
+		if (requireTangents && !assimpMesh->HasTangentsAndBitangents())  throw std::runtime_error("No tangent data for sub-mesh " + subMeshName + " in " + fileName);
+		bool hasUVs = assimpMesh->GetNumUVChannels() > 0 && assimpMesh->HasTextureCoords(0);
+		if (hasUVs && assimpMesh->mNumUVComponents[0] != 2)  throw std::runtime_error("Unsupported texture coordinates in " + subMeshName + " in " + fileName);
 
-		unsigned int tangentOffset = offset;
-		if (requireTangents)
-		{
-			if (!assimpMesh->HasTangentsAndBitangents())  throw std::runtime_error("No tangent data for sub-mesh " + subMeshName + " in " + fileName);
-			vertexElements.push_back({ "tangent", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, tangentOffset, D3D11_INPUT_PER_VERTEX_DATA, 0 });
-			offset += 12;
-		}
 
-		unsigned int uvOffset = offset;
-		if (assimpMesh->GetNumUVChannels() > 0 && assimpMesh->HasTextureCoords(0))
-		{
-			if (assimpMesh->mNumUVComponents[0] != 2)  throw std::runtime_error("Unsupported texture coordinates in " + subMeshName + " in " + fileName);
-			vertexElements.push_back({ "uv", 0, DXGI_FORMAT_R32G32_FLOAT, 0, uvOffset, D3D11_INPUT_PER_VERTEX_DATA, 0 });
-			offset += 8;
-		}
+		//-----------------------------------
 
-		unsigned int bonesOffset = offset;
-		if (mHasBones)
-		{
-			vertexElements.push_back({ "bones"  , 0, DXGI_FORMAT_R8G8B8A8_UINT,      0, bonesOffset,     D3D11_INPUT_PER_VERTEX_DATA, 0 });
-			offset += 4;
-			vertexElements.push_back({ "weights", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 0, bonesOffset + 4, D3D11_INPUT_PER_VERTEX_DATA, 0 });
-			offset += 16;
-		}
+		// Create CPU-side buffers to hold current mesh data - exact content depends on the vertex format chosen below, so just a block of bytes
+		// Note: arena vectors don't clear new elements (see ArenaAllocator), which would be a waste of time for large arrays.
+		subMesh.numVertices = assimpMesh->mNumVertices;
+		subMesh.numIndices = assimpMesh->mNumFaces * 3;
+		subMesh.indexFormat = ChooseIndexFormat(subMesh.numVertices); // 16-bit indices (2 bytes each) if possible, otherwise 32-bit (4 bytes)
+		ArenaVector<D3D11_INPUT_ELEMENT_DESC> vertexElements(subMeshArena);
+		ArenaVector<unsigned char> vertices(subMeshArena);
 
-		subMesh.vertexSize = offset;
 
+		//-----------------------------------
 
-		// Create a "vertex layout" to describe to DirectX what is data in each vertex of this mesh
-		auto shaderSignature = CreateSignatureForVertexLayout(vertexElements.data(), static_cast<int>(vertexElements.size()));
-		HRESULT hr = gD3DDevice->CreateInputLayout(vertexElements.data(), static_cast<UINT>(vertexElements.size()),
-			shaderSignature->GetBufferPointer(), shaderSignature->GetBufferSize(),
-			&subMesh.vertexLayout);
-		if (shaderSignature)  shaderSignature->Release();
-		if (FAILED(hr))  throw std::runtime_error("Failure creating input layout for " + fileName);
+		// Copy mesh data from assimp to our CPU-side vertex buffer, a whole vertex at a time in the vertex format of the attributes
+		// this sub-mesh has (see ModelVertexLayout above)
+		auto importVertices = [&](auto layout)
+		{
+			using Layout = decltype(layout);
+			using Format = typename Layout::Format;
+			using Tangent = typename Layout::Tangent;
+			using UV      = typename Layout::UV;
+
+			auto elements = Format::Elements();
+			vertexElements.assign(elements.begin(), elements.end());
+			subMesh.vertexSize = Format::Size();
+			vertices.resize(static_cast<size_t>(subMesh.numVertices) * subMesh.vertexSize);
+			auto vertexData = reinterpret_cast<typename Format::Vertex*>(vertices.data());
+
+			auto assimpPositions = reinterpret_cast<const CVector3*>(assimpMesh->mVertices);
+			auto assimpNormals   = reinterpret_cast<const CVector3*>(assimpMesh->mNormals);
+			auto assimpTangents  = reinterpret_cast<const CVector3*>(assimpMesh->mTangents);
+			auto assimpUVs       = assimpMesh->mTextureCoords[0];
+
+			// In a mesh that uses skinning any sub-meshes that don't contain bones are given bones so the whole mesh can use one
+			// shader - their node as the only bone. Sub-meshes with bones start with no influences, they are added below
+			unsigned char subMeshNode = (mHasBones && !assimpMesh->HasBones()) ? static_cast<unsigned char>(subMeshNodes[m]) : 0;
+			float         nodeWeight  = (mHasBones && !assimpMesh->HasBones()) ? 1.0f : 0.0f;
+
+			for (unsigned int i = 0; i < subMesh.numVertices; ++i)
+			{
+				auto& vertex = vertexData[i];
+
+				CVector3 position = assimpPositions[i];
+				subMesh.bounds.Add(position);
+				if (Layout::Quantised)  position = (position - positionMin) * positionScale; // 0->1 within the mesh's bounding cube
+				Layout::Position::Write(Format::template Get<typename Layout::Position>(vertex), position);
+				Layout::Normal::Write(Format::template Get<typename Layout::Normal>(vertex), assimpNormals[i]);
+
+				if (auto tangent = Format::template Find<Tangent>(vertex))  Tangent::Write(*tangent, assimpTangents[i]);
+				if (auto uv = Format::template Find<UV>(vertex))  UV::Write(*uv, CVector2(assimpUVs[i].x, assimpUVs[i].y));
+				if (auto bones = Format::template Find<BoneIndices>(vertex))  *bones = { { subMeshNode, 0, 0, 0 } };
+				if (auto weights = Format::template Find<BoneWeights>(vertex))  *weights = { { nodeWeight, 0, 0, 0 } };
+			}
 
+			if (Format::template Has<BoneIndices>() && assimpMesh->HasBones())
+			{
+				// Number of influences given to each vertex so far, so each new one goes straight into the next free slot
+				ArenaVector<unsigned char> numInfluences(subMesh.numVertices, 0, subMeshArena);
 
+				// Go through each assimp bone, their nodes were found above
+				for (unsigned int i = 0; i < assimpMesh->mNumBones; ++i)
+				{
+					aiBone* assimpBone = assimpMesh->mBones[i];
+					unsigned int nodeIndex = nodeIndices.find(assimpBone->mName.C_Str())->second;
 
-		//-----------------------------------
+					// Go through each weight of the bone and add it to the vertex it influences. A vertex can only have up to 4
+					// influences, any more are ignored. Zero weights are skipped, they don't take up a slot
+					for (unsigned int j = 0; j < assimpBone->mNumWeights; ++j)
+					{
+						unsigned int vertexIndex = assimpBone->mWeights[j].mVertexId;
+						float        weight      = assimpBone->mWeights[j].mWeight;
+						unsigned char& influence = numInfluences[vertexIndex];
+						if (weight == 0.0f || influence == 4)  continue;
+
+						auto& vertex = vertexData[vertexIndex];
+						Format::template Find<BoneIndices>(vertex)->bone[influence]   = static_cast<uint8_t>(nodeIndex);
+						Format::template Find<BoneWeights>(vertex)->weight[influence] = weight;
+						++influence;
+					}
+				}
+			}
+		};
+		SelectVertexLayout<ModelVertexLayout>(importVertices, mQuantisedVertices, requireTangents, hasUVs, mHasBones);
 
-		// Create CPU-side buffers to hold current mesh data - exact content is flexible so can't use a structure for a vertex - so just a block of bytes
-		// Note: for large arrays a unique_ptr is better than a vector because vectors default-initialise all the values which is a waste of time.
-		subMesh.numVertices = assimpMesh->mNumVertices;
-		subMesh.numIndices = assimpMesh->mNumFaces * 3;
-		auto vertices = std::make_unique<unsigned char[]>(subMesh.numVertices * subMesh.vertexSize);
-		auto indices  = std::make_unique<unsigned char[]>(subMesh.numIndices * 4); // Using 32 bit indexes (4 bytes) for each indeex
 
 
 		//-----------------------------------
 
-		// Copy mesh data from assimp to our CPU-side vertex buffer
+		// Copy face data from assimp to our CPU-side index buffer
+		if (!assimpMesh->HasFaces())  throw std::runtime_error("No face data in " + subMeshName + " in " + fileName);
 
-		CVector3* assimpPosition = reinterpret_cast<CVector3*>(assimpMesh->mVertices);
-		unsigned char* position = vertices.get() + positionOffset;
-		unsigned char* positionEnd = position + subMesh.numVertices * subMesh.vertexSize;
-		while (position != positionEnd)
+		// Room for the indices of the levels of detail, which are added after these. Each has about half the triangles of the one
+		// before, so together they have fewer than the full mesh
+		std::vector<uint32_t> faceIndices;
+		faceIndices.reserve(static_cast<size_t>(subMesh.numIndices) * 2);
+		faceIndices.resize(subMesh.numIndices);
+		for (unsigned int face = 0; face < assimpMesh->mNumFaces; ++face)
 		{
-			*(CVector3*)position = *assimpPosition;
-			position += subMesh.vertexSize;
-			++assimpPosition;
+			faceIndices[face * 3    ] = assimpMesh->mFaces[face].mIndices[0];
+			faceIndices[face * 3 + 1] = assimpMesh->mFaces[face].mIndices[1];
+			faceIndices[face * 3 + 2] = assimpMesh->mFaces[face].mIndices[2];
 		}
 
-		CVector3* assimpNormal = reinterpret_cast<CVector3*>(assimpMesh->mNormals);
-		unsigned char* normal = vertices.get() + normalOffset;
-		unsigned char* normalEnd = normal + subMesh.numVertices * subMesh.vertexSize;
-		while (normal != normalEnd)
+		// Simplify the sub-mesh for its levels of detail, while the indices still match the assimp positions
+		std::vector<std::vector<uint32_t>> lodIndices;
+		std::vector<float> lodErrors;
+		if (settings.maxLods > 0)
 		{
-			*(CVector3*)normal = *assimpNormal;
-			normal += subMesh.vertexSize;
-			++assimpNormal;
+			GenerateLods(faceIndices, lodIndices, lodErrors, &assimpMesh->mVertices[0].x, sizeof(aiVector3D), subMesh.numVertices,
+			             settings.maxLods);
 		}
 
-		if (requireTangents)
+		// Reorder for faster rendering. aiProcess_ImproveCacheLocality has done some of this already, but doesn't
+		// reduce overdraw or reorder the vertices
+		if (settings.optimiseMeshes)
 		{
-			CVector3* assimpTangent = reinterpret_cast<CVector3*>(assimpMesh->mTangents);
-			unsigned char* tangent = vertices.get() + tangentOffset;
-			unsigned char* tangentEnd = tangent + subMesh.numVertices * subMesh.vertexSize;
-			while (tangent != tangentEnd)
-			{
-				*(CVector3*)tangent = *assimpTangent;
-				tangent += subMesh.vertexSize;
-				++assimpTangent;
-			}
+			subMesh.numVertices = OptimiseSubMesh(faceIndices, vertices.data(), subMesh.numVertices, subMesh.vertexSize,
+			                                      &assimpMesh->mVertices[0].x, sizeof(aiVector3D), subMeshName + " in " + fileName,
+			                                      &lodIndices);
 		}
 
-		if (assimpMesh->GetNumUVChannels() > 0 && assimpMesh->HasTextureCoords(0))
+		// The indices of the levels of detail follow the full mesh's
+		subMesh.lods.resize(lodIndices.size());
+		for (size_t lod = 0; lod < lodIndices.size(); ++lod)
 		{
-			aiVector3D* assimpUV = assimpMesh->mTextureCoords[0];
-			unsigned char* uv = vertices.get() + uvOffset;
-			unsigned char* uvEnd = uv + subMesh.numVertices * subMesh.vertexSize;
-			while (uv != uvEnd)
-			{
-				*(CVector2*)uv = CVector2(assimpUV->x, assimpUV->y);
-				uv += subMesh.vertexSize;
-				++assimpUV;
-			}
+			subMesh.lods[lod].numIndices = static_cast<unsigned int>(lodIndices[lod].size());
+			subMesh.lods[lod].error      = lodErrors[lod];
+			subMesh.numLodIndices += subMesh.lods[lod].numIndices;
+			faceIndices.insert(faceIndices.end(), lodIndices[lod].begin(), lodIndices[lod].end());
 		}
+		ArenaVector<unsigned char> indices(faceIndices.size() * IndexSize(subMesh.indexFormat), subMeshArena);
 
-
-		if (mHasBones)
+		auto copyFaces = [&](auto* index) // Called with a pointer to uint16_t or uint32_t depending on the index format
 		{
-			if (assimpMesh->HasBones())
-			{
-				// Set all bones and weights to 0 to start with
-				unsigned char* bones = vertices.get() + bonesOffset;
-				unsigned char* bonesEnd = bones + subMesh.numVertices * subMesh.vertexSize;
-				while (bones != bonesEnd)
-				{
-					memset(bones, 0, 20);
-					bones += subMesh.vertexSize;
-				}
+			using IndexType = std::remove_reference_t<decltype(*index)>;
+			for (auto faceIndex : faceIndices)  *index++ = static_cast<IndexType>(faceIndex);
+		};
+		if (subMesh.indexFormat == DXGI_FORMAT_R16_UINT)  copyFaces(reinterpret_cast<uint16_t*>(indices.data()));
+		else                                              copyFaces(reinterpret_cast<uint32_t*>(indices.data()));
+
+		cookedSubMeshes[m].vertexElements = std::move(vertexElements);
+		cookedSubMeshes[m].vertices = std::move(vertices);
+		cookedSubMeshes[m].indices  = std::move(indices);
+	};
+
+	// Jobs must not throw, so each sub-mesh keeps its error and the first is thrown once they have all finished
+	std::vector<std::string> subMeshErrors(scene->mNumMeshes);
+	auto convertJob = [&](int m)
+	{
+		try                               { convertSubMesh(m); }
+		catch (const std::exception& e)  { subMeshErrors[m] = e.what(); }
+	};
+	if (gJobSystem != nullptr)  gJobSystem->ParallelFor(static_cast<int>(scene->mNumMeshes), 1, convertJob);
+	else                        for (unsigned int m = 0; m < scene->mNumMeshes; ++m)  convertJob(m);
+	for (auto& error : subMeshErrors)
+	{
+		if (!error.empty())  throw std::runtime_error(error);
+	}
 
-				for (auto& node : mNodes)
-				{
-					node.offsetMatrix = MatrixIdentity();
-				}
 
-				// Go through each assimp bone
-				bones = vertices.get() + bonesOffset;
-				for (unsigned int i = 0; i < assimpMesh->mNumBones; ++i)
-				{
-					// Get offset matrix for the bone (transform from skinned mesh root to bone root
-					aiBone* assimpBone = assimpMesh->mBones[i];
-					std::string boneName = assimpBone->mName.C_Str();
-					unsigned int nodeIndex;
-					for (nodeIndex = 0; nodeIndex < mNodes.size(); ++nodeIndex)
-					{
-						if (mNodes[nodeIndex].name == boneName)
-						{
-							mNodes[nodeIndex].offsetMatrix.SetValues(&assimpBone->mOffsetMatrix.a1);
-							mNodes[nodeIndex].offsetMatrix.Transpose(); // Assimp stores matrices differently to this app
-							break;
-						}
-					}
-					if (nodeIndex == mNodes.size())  throw std::runtime_error("Bone with no matching node in " + fileName);
+	//-----------------------------------
 
-					// Go through each weight of the bone and update the vertex it influences
-					// Find the first 0 weight on that vertex and put the new influence / weight there.
-					// A vertex can only have up to 4 influences
-					for (unsigned int j = 0; j < assimpBone->mNumWeights; ++j)
-					{
-						unsigned int vertexIndex = assimpBone->mWeights[j].mVertexId;
-						unsigned char* bone = bones + vertexIndex * subMesh.vertexSize;
-						float* weight = (float*)(bone + 4);
-						float* lastWeight = weight + 3;
-						while (*weight != 0.0f && weight != lastWeight)
-						{
-							bone++; weight++;
-						}
-						if (*weight == 0.0f)
-						{
-							*bone = nodeIndex;
-							*weight = assimpBone->mWeights[j].mWeight;
-						}
-					}
-				}
-			}
-			else
-			{
-				// In a mesh that uses skinning any sub-meshes that don't contain bones are given bones so the whole mesh can use one shader
-				unsigned int subMeshNode = 0;
-				for (unsigned int nodeIndex = 0; nodeIndex < mNodes.size(); ++nodeIndex)
-				{
-					for (auto& subMeshIndex : mNodes[nodeIndex].subMeshes)
-					{
-						if (subMeshIndex == m)
-							subMeshNode = nodeIndex;
-					}
-				}
+	// Create the vertex layouts and add the converted data to the mesh buffers, in order on this thread - the layouts are shared
+	// by all meshes (see GetInputLayout). The buffer data is reserved up front, then the GPU buffers for every sub-mesh are
+	// created together at the end
+	MeshBufferData bufferData(arena);
+	size_t vertexBytes = 0, indexBytes = 0;
+	for (auto& data : cookedSubMeshes)
+	{
+		vertexBytes += data.vertices.size() + 64; // With room for padding between sub-meshes (see CreateSubMeshResources)
+		indexBytes  += data.indices.size() + 4;
+	}
+	bufferData.vertices.reserve(vertexBytes);
+	bufferData.indices.reserve(indexBytes);
+	for (unsigned int m = 0; m < scene->mNumMeshes; ++m)
+	{
+		const CookedSubMesh& data = cookedSubMeshes[m];
+		CreateSubMeshResources(mSubMeshes[m], data.vertexElements.data(), static_cast<unsigned int>(data.vertexElements.size()),
+		                       data.vertices.data(), data.indices.data(), bufferData, fileName);
+	}
 
-				unsigned char* bones = vertices.get() + bonesOffset;
-				unsigned char* bonesEnd = bones + subMesh.numVertices * subMesh.vertexSize;
-				while (bones != bonesEnd)
-				{
-					memset(bones, 0, 20);
-					bones[0] = subMeshNode;
-					*(float*)(bones + 4) = 1.0f;
-					bones += subMesh.vertexSize;
-				}
+	CreateMeshBuffers(bufferData, fileName);
 
-			}
-		}
+	CalculateNodeBounds();
 
+	// Save the imported mesh so the next load is fast. Not fatal if this fails, the mesh will just be imported again next time
+	if (sourceHash != 0)
+	{
+		SaveCookedMesh(cookedFileName, sourceHash, cookedSubMeshes);
+		AssetFileWritten(cookedFileName);
+	}
+}
 
 
-		//-----------------------------------
 
-		// Copy face data from assimp to our CPU-side index buffer
-		if (!assimpMesh->HasFaces())  throw std::runtime_error("No face data in " + subMeshName + " in " + fileName);
+//--------------------------------------------------------------------------------------
+// Grid topology
+//--------------------------------------------------------------------------------------
+// A grid's indices only depend on its subdivisions. When they are reordered for the vertex cache (see OptimiseSubMesh) the
+// new order of the vertices does too, as long as the grid is the same size - the overdraw step looks at the positions. So
+// grids made again with the same settings, e.g. when the quality preset is changed back, share the indices and vertex order
+// made the first time. Optimising takes far longer than generating, especially for large grids
 
-		DWORD* index = reinterpret_cast<DWORD*>(indices.get());
-		for (unsigned int face = 0; face < assimpMesh->mNumFaces; ++face)
+namespace
+{
+	struct GridTopology
+	{
+		int      subDivX, subDivZ;
+		CVector3 size;      // Only matters to optimised grids, zero for the others
+		bool     optimised;
+
+		unsigned int               numVertices;
+		DXGI_FORMAT                indexFormat;
+		std::vector<uint32_t>      vertexOrder; // The grid vertex (row * (subDivX + 1) + column) of each vertex, empty for row order
+		std::vector<unsigned char> indices;     // In indexFormat
+
+		size_t Bytes() const  { return vertexOrder.size() * sizeof(uint32_t) + indices.size(); }
+
+		// The GPU index buffer made from the indices, shared by the grids using it, and released when the last of them is
+		// (see SharedGridIndexBuffer). Guarded by gGridTopologyMutex
+		mutable std::weak_ptr<ID3D11Buffer> indexBuffer;
+	};
+
+	// The topologies made recently, most recently used last. Meshes can be made on any thread (e.g. the loads of
+	// WorldStreamer.h), so the cache is locked. A grid being made keeps its topology even if the cache drops it meanwhile
+	std::vector<std::shared_ptr<const GridTopology>> gGridTopologies;
+	std::mutex gGridTopologyMutex;
+
+	// Most memory the cached topologies use between them, the least recently used are dropped past this. A 2048x2048 grid's
+	// topology is about 100MB
+	const size_t GRID_TOPOLOGY_CACHE_BYTES = 128 * 1024 * 1024;
+
+	// About the number of vertices or indices worth a job when generating a grid across the job system
+	const int GRID_ITEMS_PER_JOB = 16384;
+
+	// Run the function for each index from 0 to count - 1 in batches of batchSize across the job system, or in a plain loop
+	// if there isn't one
+	template <class Function>
+	void GridParallelFor(int count, int batchSize, const Function& function)
+	{
+		if (gJobSystem != nullptr)  gJobSystem->ParallelFor(count, batchSize, function);
+		else                        for (int i = 0; i < count; ++i)  function(i);
+	}
+
+	// Rows of a grid in each job, for rows of the given number of vertices or indices
+	int GridBatchRows(int rowItems)
+	{
+		return (std::max)(1, GRID_ITEMS_PER_JOB / (std::max)(1, rowItems));
+	}
+
+
+	// Write the indices of a row of grid squares, two triangles each, from the square whose top left vertex is given. rowStep
+	// is the number of vertices in a row of the grid
+	void WriteGridIndexRow(uint32_t* indices, uint32_t tlIndex, uint32_t rowStep, int numSquares)
+	{
+		int x = 0;
+#ifdef MATH_SIMD
+		// Two squares at a time, 12 indices in three registers. Each index is the first top left vertex plus a fixed offset
+		int step = static_cast<int>(rowStep);
+		const __m128i offsets0 = _mm_setr_epi32(0,        step,     1,        1);
+		const __m128i offsets1 = _mm_setr_epi32(step,     step + 1, 1,        step + 1);
+		const __m128i offsets2 = _mm_setr_epi32(2,        2,        step + 1, step + 2);
+		const __m128i two = _mm_set1_epi32(2);
+		__m128i tl = _mm_set1_epi32(static_cast<int>(tlIndex));
+		for (; x + 2 <= numSquares; x += 2, indices += 12)
 		{
-			*index++ = assimpMesh->mFaces[face].mIndices[0];
-			*index++ = assimpMesh->mFaces[face].mIndices[1];
-			*index++ = assimpMesh->mFaces[face].mIndices[2];
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(indices),     _mm_add_epi32(tl, offsets0));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(indices + 4), _mm_add_epi32(tl, offsets1));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(indices + 8), _mm_add_epi32(tl, offsets2));
+			tl = _mm_add_epi32(tl, two);
 		}
+		tlIndex += x;
+#endif
+		for (; x < numSquares; ++x, ++tlIndex)
+		{
+			// Bottom-left triangle in grid square (looking down on the grid)
+			*indices++ = tlIndex;
+			*indices++ = tlIndex + rowStep;
+			*indices++ = tlIndex + 1;
 
+			// Top-right triangle in grid square
+			*indices++ = tlIndex + 1;
+			*indices++ = tlIndex + rowStep;
+			*indices++ = tlIndex + rowStep + 1;
+		}
+	}
 
-		//-----------------------------------
 
-		D3D11_BUFFER_DESC bufferDesc;
-		D3D11_SUBRESOURCE_DATA initData;
+	// Make the topology of a grid (see above), using the given index format. The grid's size only matters if it is optimised
+	std::shared_ptr<GridTopology> MakeGridTopology(int subDivX, int subDivZ, const CVector3& size, bool optimise,
+	                                               DXGI_FORMAT indexFormat)
+	{
+		auto topology = std::make_shared<GridTopology>();
+		topology->subDivX     = subDivX;
+		topology->subDivZ     = subDivZ;
+		topology->size        = optimise ? size : CVector3(0, 0, 0);
+		topology->optimised   = optimise;
+		topology->numVertices = (subDivX + 1) * (subDivZ + 1);
+		topology->indexFormat = indexFormat;
+
+		// Row by row, in batches of rows across the job system. To keep model rendering code simpler using a triangle
+		// list, even though a strip would work nicely here
+		uint32_t rowStep = static_cast<uint32_t>(subDivX + 1);
+		std::vector<uint32_t> indices(static_cast<size_t>(subDivX) * subDivZ * 6);
+		GridParallelFor(subDivZ, GridBatchRows(subDivX * 6), [&](int z)
+		{
+			WriteGridIndexRow(&indices[static_cast<size_t>(z) * subDivX * 6], z * rowStep, rowStep, subDivX);
+		});
 
-		// Create GPU-side vertex buffer and copy the vertices imported by assimp into it
-		bufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER; // Indicate it is a vertex buffer
-		bufferDesc.Usage = D3D11_USAGE_DEFAULT;          // Default usage for this buffer - we'll see other usages later
-		bufferDesc.ByteWidth = subMesh.numVertices * subMesh.vertexSize; // Size of the buffer in bytes
-		bufferDesc.CPUAccessFlags = 0;
-		bufferDesc.MiscFlags = 0;
-		initData.pSysMem = vertices.get(); // Fill the new vertex buffer with data loaded by assimp
+		// Row by row order reuses almost none of the vertices of the previous row on wide grids - each vertex is shaded twice.
+		// Reorder for the vertex cache. The vertices reordered are the grid vertex numbers rather than the vertices themselves,
+		// which gives the new vertex order for any vertex layout
+		if (optimise)
+		{
+			std::vector<float> positions(topology->numVertices * 3);
+			GridParallelFor(subDivZ + 1, GridBatchRows(subDivX + 1), [&](int z)
+			{
+				for (int x = 0; x <= subDivX; ++x)
+				{
+					float* position = &positions[(z * rowStep + x) * 3];
+					position[0] = static_cast<float>(x) / subDivX * size.x;
+					position[1] = 0;
+					position[2] = static_cast<float>(z) / subDivZ * size.z;
+				}
+			});
+
+			topology->vertexOrder.resize(topology->numVertices);
+			for (uint32_t i = 0; i < topology->numVertices; ++i)  topology->vertexOrder[i] = i;
+			topology->numVertices = OptimiseSubMesh(indices, reinterpret_cast<unsigned char*>(topology->vertexOrder.data()),
+			                                        topology->numVertices, sizeof(uint32_t), positions.data(), 3 * sizeof(float),
+			                                        "grid mesh");
+			topology->vertexOrder.resize(topology->numVertices);
+		}
 
-		hr = gD3DDevice->CreateBuffer(&bufferDesc, &initData, &subMesh.vertexBuffer);
-		if (FAILED(hr))  throw std::runtime_error("Failure creating vertex buffer for " + fileName);
+		auto copyIndices = [&](auto* currIndex) // Called with a pointer to uint16_t or uint32_t depending on the index format
+		{
+			using IndexType = std::remove_reference_t<decltype(*currIndex)>;
+			for (auto index : indices)  *currIndex++ = static_cast<IndexType>(index);
+		};
+		topology->indices.resize(indices.size() * (indexFormat == DXGI_FORMAT_R16_UINT ? sizeof(uint16_t) : sizeof(uint32_t)));
+		if (indexFormat == DXGI_FORMAT_R16_UINT)  copyIndices(reinterpret_cast<uint16_t*>(topology->indices.data()));
+		else                                      copyIndices(reinterpret_cast<uint32_t*>(topology->indices.data()));
+		return topology;
+	}
 
 
-		// Create GPU-side index buffer and copy the vertices imported by assimp into it
-		bufferDesc.BindFlags = D3D11_BIND_INDEX_BUFFER; // Indicate it is an index buffer
-		bufferDesc.Usage = D3D11_USAGE_DEFAULT;         // Default usage for this buffer - we'll see other usages later
-		bufferDesc.ByteWidth = subMesh.numIndices * sizeof(DWORD); // Size of the buffer in bytes
-		bufferDesc.CPUAccessFlags = 0;
-		bufferDesc.MiscFlags = 0;
-		initData.pSysMem = indices.get(); // Fill the new index buffer with data loaded by assimp
+	// Return the topology of a grid from the cache, making it if it isn't there
+	std::shared_ptr<const GridTopology> FindGridTopology(int subDivX, int subDivZ, const CVector3& size, bool optimise,
+	                                                     DXGI_FORMAT indexFormat)
+	{
+		CVector3 key = optimise ? size : CVector3(0, 0, 0);
+		auto matches = [&](const GridTopology& topology)
+		{
+			return topology.subDivX == subDivX && topology.subDivZ == subDivZ && topology.optimised == optimise &&
+			       topology.indexFormat == indexFormat && topology.size.x == key.x && topology.size.z == key.z;
+		};
+		{
+			std::lock_guard<std::mutex> lock(gGridTopologyMutex);
+			for (auto it = gGridTopologies.begin(); it != gGridTopologies.end(); ++it)
+			{
+				if (!matches(**it))  continue;
+				auto topology = *it;
+				gGridTopologies.erase(it);
+				gGridTopologies.push_back(topology);
+				return topology;
+			}
+		}
+
+		// Made without the lock, so other threads can make other grids meanwhile. Two threads wanting the same new grid both
+		// make it, only one is kept
+		std::shared_ptr<const GridTopology> topology = MakeGridTopology(subDivX, subDivZ, size, optimise, indexFormat);
+		if (topology->Bytes() > GRID_TOPOLOGY_CACHE_BYTES)  return topology;
 
-		hr = gD3DDevice->CreateBuffer(&bufferDesc, &initData, &subMesh.indexBuffer);
-		if (FAILED(hr))  throw std::runtime_error("Failure creating index buffer for " + fileName);
+		std::lock_guard<std::mutex> lock(gGridTopologyMutex);
+		if (std::none_of(gGridTopologies.begin(), gGridTopologies.end(), [&](const auto& cached) { return matches(*cached); }))
+		{
+			gGridTopologies.push_back(topology);
+		}
+		size_t bytes = 0;
+		for (auto& cached : gGridTopologies)  bytes += cached->Bytes();
+		while (bytes > GRID_TOPOLOGY_CACHE_BYTES)
+		{
+			bytes -= gGridTopologies.front()->Bytes();
+			gGridTopologies.erase(gGridTopologies.begin());
+		}
+		return topology;
 	}
-}
 
 
+	// Return the index buffer of a grid topology, creating it if no grid is using it now. The buffer is released when the
+	// last grid using it releases its pointer. Will throw a std::runtime_error exception on failure (same as Mesh)
+	std::shared_ptr<ID3D11Buffer> SharedGridIndexBuffer(const GridTopology& topology)
+	{
+		std::lock_guard<std::mutex> lock(gGridTopologyMutex);
+		auto buffer = topology.indexBuffer.lock();
+		if (buffer)  return buffer;
+
+		D3D11_BUFFER_DESC bufferDesc = {};
+		bufferDesc.BindFlags = D3D11_BIND_INDEX_BUFFER;
+		bufferDesc.Usage     = D3D11_USAGE_IMMUTABLE; // Never changes, as there may be any number of grids using it
+		bufferDesc.ByteWidth = static_cast<UINT>(topology.indices.size());
+		D3D11_SUBRESOURCE_DATA initData = {};
+		initData.pSysMem = topology.indices.data();
+
+		ID3D11Buffer* indexBuffer = nullptr;
+		if (FAILED(gD3DDevice->CreateBuffer(&bufferDesc, &initData, &indexBuffer)))
+		{
+			throw std::runtime_error("Failure creating index buffer for grid mesh");
+		}
+		SetDebugName(indexBuffer, "grid mesh Shared Indices");
+		RegisterGpuResource(indexBuffer, "Meshes");
+		buffer = std::shared_ptr<ID3D11Buffer>(indexBuffer, [](ID3D11Buffer* released) { released->Release(); });
+		topology.indexBuffer = buffer;
+		return buffer;
+	}
+}
 
 
 // Special mesh constructor for water lab - creates a grid (no model file required)
 // Create a grid in the XZ plane from minPt to maxPt with the given number of subdivisions in X and Z. 
 // Optionally select whether to create normals (upwards), and/or UVs (0->1 square over the entire grid)
-Mesh::Mesh(CVector3 minPt, CVector3 maxPt, int subDivX, int subDivZ, bool normals /*= false*/, bool uvs /*= true*/ )
+Mesh::Mesh(CVector3 minPt, CVector3 maxPt, int subDivX, int subDivZ, bool normals /*= false*/, bool uvs /*= true*/,
+           bool bufferless /*= false*/)
 {
 	// Create a single node, disable skinning
 	mNodes.push_back({"Grid", MatrixIdentity(), MatrixIdentity(), 0, {}, {0}});
 	mHasBones = false;
 
 	mSubMeshes.resize(1); // Grid will be in a single sub-mesh
+	mSubMeshes[0].bounds.Add(minPt);
+	mSubMeshes[0].bounds.Add(maxPt);
+	CalculateNodeBounds();
+
+	// A bufferless grid only needs to know its size, the vertex shader generates the vertices 0->1 across the grid and
+	// the render matrix scales them to cover minPt to maxPt (see Render / RenderSubMesh)
+	if (bufferless)
+	{
+		mBufferlessGrid = true;
+		mPositionDecodeMatrix = MatrixScaling(CVector3(maxPt.x - minPt.x, 1, maxPt.z - minPt.z)) * MatrixTranslation(minPt);
+		SetGridSubdivisions(subDivX, subDivZ);
+		return;
+	}
 
-	// Determine vertex layout based on parameters
+	// The indices, and the order of the vertices when they are reordered for the vertex cache, are shared by grids of the
+	// same subdivisions (see GridTopology above). Large grids (such as the main water grid) need 32-bit indices, smaller ones
+	// use 16-bit to save memory and bandwidth
+	unsigned int numGridVertices = (subDivX + 1) * (subDivZ + 1);
+	auto topology = FindGridTopology(subDivX, subDivZ, maxPt - minPt, gMeshLoaderSettings.optimiseMeshes,
+	                                 ChooseIndexFormat(numGridVertices));
+	mSubMeshes[0].numVertices = topology->numVertices;
+	mSubMeshes[0].numIndices  = subDivX * subDivZ * 6; // Two triangles for each grid square
+	mSubMeshes[0].indexFormat = topology->indexFormat;
+
+	// Create the grid vertices (CPU-side), to be passed to the GPU afterwards, in the vertex format of the attributes asked for
+	// (see GridVertexLayout above). Each vertex is placed from its column and row, so there is no error building up across
+	// the grid and the vertices can be written in any order - in batches of rows on the job system, and in the topology's
+	// vertex order if it has one
 	std::vector<D3D11_INPUT_ELEMENT_DESC> vertexElements;
-	unsigned int offset = 0;
+	std::unique_ptr<char[]> vertexData;
+	auto createVertices = [&](auto layout)
+	{
+		using Format = typename decltype(layout)::Format;
+		using Vertex = typename Format::Vertex;
+		auto elements = Format::Elements();
+		vertexElements.assign(elements.begin(), elements.end());
+		mSubMeshes[0].vertexSize = Format::Size();
+		vertexData = std::make_unique<char[]>(mSubMeshes[0].numVertices * mSubMeshes[0].vertexSize); // Smart pointer
+
+		CVector3 size = maxPt - minPt;
+		CVector3 normal = CVector3(0,1,0); // All normals will be up (useful to make grid use same data as ordinary models so it can use the same shaders)
+		auto writeVertex = [&](Vertex& vertex, int x, int z)
+		{
+			float u = static_cast<float>(x) / subDivX;
+			float v = static_cast<float>(z) / subDivZ;
+			PositionFloat3::Write(Format::template Get<PositionFloat3>(vertex), { minPt.x + u * size.x, minPt.y, minPt.z + v * size.z });
+			if (auto vertexNormal = Format::template Find<NormalFloat3>(vertex))  NormalFloat3::Write(*vertexNormal, normal);
+			if (auto vertexUV = Format::template Find<UVFloat2>(vertex))  UVFloat2::Write(*vertexUV, CVector2(u, 1 - v)); // V axis is opposite direction to Z
+		};
+
+		auto vertices = reinterpret_cast<Vertex*>(vertexData.get());
+		int rowVertices = subDivX + 1;
+		int numRows = (static_cast<int>(mSubMeshes[0].numVertices) + rowVertices - 1) / rowVertices;
+		GridParallelFor(numRows, GridBatchRows(rowVertices), [&](int row)
+		{
+			unsigned int first = row * rowVertices;
+			unsigned int last  = (std::min)(first + rowVertices, mSubMeshes[0].numVertices);
+			for (unsigned int i = first; i < last; ++i)
+			{
+				unsigned int gridVertex = topology->vertexOrder.empty() ? i : topology->vertexOrder[i];
+				writeVertex(vertices[i], gridVertex % rowVertices, gridVertex / rowVertices);
+			}
+		});
+	};
+	SelectVertexLayout<GridVertexLayout>(createVertices, normals, uvs);
+
+
+	// Create the vertex layout and GPU-side vertex buffer. The index buffer is shared with the other grids of this topology,
+	// so CreateMeshBuffers doesn't make one - every grid of the same subdivisions has the same indices
+	mSharedIndexBuffer = SharedGridIndexBuffer(*topology);
+	mIndexBuffer = mSharedIndexBuffer.get();
+	MeshBufferData bufferData;
+	CreateSubMeshResources(mSubMeshes[0], vertexElements.data(), static_cast<unsigned int>(vertexElements.size()), vertexData.get(),
+	                       topology->indices.data(), bufferData, "grid mesh");
+	CreateMeshBuffers(bufferData, "grid mesh");
+}
 
-	unsigned int positionOffset = offset;
-	vertexElements.push_back({ "position", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, positionOffset, D3D11_INPUT_PER_VERTEX_DATA, 0 });
-	offset += 12;
 
-	unsigned int normalOffset = offset;
-	if (normals)
+// Creates a box filling the given bounds, with normals and UVs (0->1 across each face)
+Mesh::Mesh(const BoundingBox& box)
+{
+	mNodes.push_back({"Box", MatrixIdentity(), MatrixIdentity(), 0, {}, {0}});
+	mHasBones = false;
+
+	mSubMeshes.resize(1);
+	mSubMeshes[0].bounds = box;
+	CalculateNodeBounds();
+
+	// Four vertices for each face so each has its own normal. A face is at the minimum or maximum of one axis and spans the
+	// next two axes, its triangles wound clockwise seen from outside
+	using Format = GridVertexLayout<true, true>::Format;
+	auto elements = Format::Elements();
+	std::vector<Format::Vertex> vertices;
+	std::vector<uint16_t>       indices;
+	const float boxMin[] = { box.min.x, box.min.y, box.min.z };
+	const float boxMax[] = { box.max.x, box.max.y, box.max.z };
+	for (int axis = 0; axis < 3; ++axis)
 	{
-		vertexElements.push_back({ "normal", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, normalOffset, D3D11_INPUT_PER_VERTEX_DATA, 0 });
-		offset += 12;
+		for (int side = 0; side < 2; ++side)
+		{
+			int u = (axis + 1) % 3;
+			int v = (axis + 2) % 3;
+			float normal[3] = { 0, 0, 0 };
+			normal[axis] = side ? 1.0f : -1.0f;
+
+			uint16_t first = static_cast<uint16_t>(vertices.size());
+			for (int corner = 0; corner < 4; ++corner)
+			{
+				float position[3];
+				position[axis] = side ? boxMax[axis] : boxMin[axis];
+				position[u] = (corner & 1) ? boxMax[u] : boxMin[u];
+				position[v] = (corner & 2) ? boxMax[v] : boxMin[v];
+
+				Format::Vertex vertex;
+				PositionFloat3::Write(Format::Get<PositionFloat3>(vertex), CVector3(position[0], position[1], position[2]));
+				NormalFloat3::Write(Format::Get<NormalFloat3>(vertex), CVector3(normal[0], normal[1], normal[2]));
+				UVFloat2::Write(Format::Get<UVFloat2>(vertex), CVector2(static_cast<float>(corner & 1), static_cast<float>(corner >> 1)));
+				vertices.push_back(vertex);
+			}
+			const uint16_t outside[] = { 0, 1, 2, 1, 3, 2 }; // On the maximum side, reversed on the minimum side
+			for (int i = 0; i < 6; ++i)  indices.push_back(first + outside[side ? i : 5 - i]);
+		}
 	}
 
-	unsigned int uvOffset = offset;
-	if (uvs)
+	mSubMeshes[0].numVertices = static_cast<unsigned int>(vertices.size());
+	mSubMeshes[0].vertexSize  = Format::Size();
+	mSubMeshes[0].numIndices  = static_cast<unsigned int>(indices.size());
+	mSubMeshes[0].indexFormat = DXGI_FORMAT_R16_UINT;
+
+	MeshBufferData bufferData;
+	CreateSubMeshResources(mSubMeshes[0], elements.data(), static_cast<unsigned int>(elements.size()), vertices.data(), indices.data(),
+	                       bufferData, "box mesh");
+	CreateMeshBuffers(bufferData, "box mesh");
+}
+
+
+
+Mesh::~Mesh()
+{
+	ReleaseSubMeshes();
+}
+
+
+//--------------------------------------------------------------------------------------
+// Cooked mesh files
+//--------------------------------------------------------------------------------------
+// A cooked mesh file holds the result of importing a mesh with assimp, in the same layout as the GPU buffers, so it
+// can be loaded with no processing. The file is written after the first import and used from then on. Layout:
+// - CookedMeshHeader
+// - For each node: name length (uint32_t) and name, default and offset matrices, parent index,
+//                  number of child nodes (uint32_t) and their indexes, number of sub-meshes (uint32_t) and their indexes
+// - For each sub-mesh: CookedSubMeshHeader, its vertex elements (CookedVertexElement), its levels of detail (CookedLod),
+//                      vertex data, index data (the sub-mesh's own indices followed by those of its levels of detail)
+// Increase the version number if this layout or the import settings in the constructor change
+
+namespace
+{
+	const char     CookedMeshID[4]   = { 'M', 'E', 'S', 'H' };
+	const uint32_t CookedMeshVersion = 6;
+	const uint32_t CookedMaxLods     = 16;
+
+	struct CookedMeshHeader
 	{
-		vertexElements.push_back({ "uv", 0, DXGI_FORMAT_R32G32_FLOAT, 0, uvOffset, D3D11_INPUT_PER_VERTEX_DATA, 0 });
-		offset += 8;
-	}
+		char     id[4];
+		uint32_t version;
+		uint64_t sourceHash; // Hash of the mesh file this was cooked from. The cooked file is out of date if this doesn't match
+		uint32_t hasBones;
+		uint32_t numNodes;
+		uint32_t numSubMeshes;
+		uint32_t quantisedVertices; // If set, the matrix to decode quantised positions follows the header
+	};
+
+	struct CookedSubMeshHeader
+	{
+		uint32_t vertexSize;
+		uint32_t numVertices;
+		uint32_t numIndices;
+		uint32_t indexFormat; // DXGI_FORMAT, 16 or 32-bit
+		uint32_t numVertexElements;
+		uint32_t numLods;
+		float    boundsMin[3]; // Bounding box of the sub-mesh
+		float    boundsMax[3];
+	};
+
+	struct CookedVertexElement
+	{
+		char     semanticName[16];
+		uint32_t format; // DXGI_FORMAT
+		uint32_t offset;
+	};
 
-	mSubMeshes[0].vertexSize = offset;
+	struct CookedLod
+	{
+		uint32_t numIndices;
+		float    error;
+	};
 
-	// Create a vertex layout object from above array - used by DirectX to understand the data in each vertex of this mesh
-	auto shaderSignature = CreateSignatureForVertexLayout(vertexElements.data(), static_cast<int>(vertexElements.size()));
-	HRESULT hr = gD3DDevice->CreateInputLayout(vertexElements.data(), static_cast<UINT>(vertexElements.size()),
-		shaderSignature->GetBufferPointer(), shaderSignature->GetBufferSize(),
-		&mSubMeshes[0].vertexLayout);
-	if (shaderSignature)  shaderSignature->Release();
-	if (FAILED(hr))  throw std::runtime_error("Failure creating input layout for grid mesh");
 
+	// Reads values from a block of memory, checking it doesn't read past the end. Data is read with memcpy, so it doesn't
+	// need to be aligned. Reading fails (returns false / nullptr) if there isn't enough data left
+	class CookedReader
+	{
+	public:
+		CookedReader(const unsigned char* data, size_t size) : mPos(data), mEnd(data + size) {}
 
+		template <class T>
+		bool Read(T& value)
+		{
+			if (static_cast<size_t>(mEnd - mPos) < sizeof(T))  return false;
+			memcpy(&value, mPos, sizeof(T));
+			mPos += sizeof(T);
+			return true;
+		}
 
-	//-----------------------------------
-																			   
-	// Allocate space to create the grid vertices (CPU-side first)
-	mSubMeshes[0].numVertices = (subDivX + 1) * (subDivZ + 1);
-	auto vertexData = std::make_unique<char[]>(mSubMeshes[0].numVertices * mSubMeshes[0].vertexSize); // Smart pointer
-  
-	// Create the grid vertices (CPU-side), to be passed to the GPU afterwards
-	float xStep = (maxPt.x - minPt.x) / subDivX; // X-size of a single grid square
-	float zStep = (maxPt.z - minPt.z) / subDivZ; // Z-size of a single grid square
-	float uStep = 1.0f / subDivX;                // U-size of a single grid square (UVs go from 0 to 1 over the whole grid)
-	float vStep = 1.0f / subDivZ;                // V-size of a single grid square (UVs go from 0 to 1 over the whole grid)
-	CVector3 pt = minPt;                         // Start position at bottom-left of grid (looking down on it)
-	CVector3 normal = CVector3(0,1,0);           // All normals will be up (useful to make grid use same data as ordinary models so it can use the same shaders)
-	CVector2 uv = CVector2(0,1);                 // UVs also start at bottom-left (V axis is opposite direction to Z)
-	// A 2D array of data, only complexity is that some data is optional. So byte-offsets and pointer casting is needed
-	auto currVert = vertexData.get();
-	for (int z = 0; z <= subDivZ; ++z)
-	{
-		for (int x = 0; x <= subDivX; ++x)
-		{
-			*reinterpret_cast<CVector3*>(currVert) = pt;
-			currVert += sizeof(CVector3);
-			if (normals)
+		// Use the next size bytes where they are - no copy
+		const unsigned char* Skip(size_t size)
+		{
+			if (static_cast<size_t>(mEnd - mPos) < size)  return nullptr;
+			const unsigned char* data = mPos;
+			mPos += size;
+			return data;
+		}
+
+	private:
+		const unsigned char* mPos;
+		const unsigned char* mEnd;
+	};
+}
+
+
+// Load a cooked mesh file (see above). The vertex and index data are copied from the memory-mapped file into the mesh buffers
+// Returns false if the file doesn't exist, is out of date or broken in any way, leaving the mesh empty
+bool Mesh::LoadCookedMesh(const std::string& cookedFileName, uint64_t sourceHash)
+{
+	AssetFile file(cookedFileName);
+	if (!file.IsOpen())  return false;
+
+	CookedReader reader(file.Data(), file.Size());
+	CookedMeshHeader header;
+	if (!reader.Read(header) || memcmp(header.id, CookedMeshID, sizeof(CookedMeshID)) != 0 ||
+	    header.version != CookedMeshVersion || header.sourceHash != sourceHash || header.numSubMeshes == 0)  return false;
+
+	CMatrix4x4 positionDecodeMatrix = MatrixIdentity();
+	if (header.quantisedVertices != 0 && !reader.Read(positionDecodeMatrix))  return false;
+
+	bool ok = true;
+	try
+	{
+		mHasBones = (header.hasBones != 0);
+		mQuantisedVertices = (header.quantisedVertices != 0);
+		mPositionDecodeMatrix = positionDecodeMatrix;
+
+		// Read node hierarchy
+		auto readIndexList = [&](std::vector<unsigned int>& list, unsigned int maxIndex)
+		{
+			uint32_t count;
+			if (!reader.Read(count) || count > maxIndex)  return false;
+			list.resize(count);
+			for (auto& index : list)
+			{
+				uint32_t value;
+				if (!reader.Read(value) || value >= maxIndex)  return false;
+				index = value;
+			}
+			return true;
+		};
+		mNodes.resize(header.numNodes);
+		for (auto& node : mNodes)
+		{
+			uint32_t nameLength;
+			const unsigned char* name = nullptr;
+			uint32_t parentIndex;
+			ok = reader.Read(nameLength) && (name = reader.Skip(nameLength)) != nullptr &&
+			     reader.Read(node.defaultMatrix) && reader.Read(node.offsetMatrix) &&
+			     reader.Read(parentIndex) && parentIndex < header.numNodes &&
+			     readIndexList(node.childNodes, header.numNodes) && readIndexList(node.subMeshes, header.numSubMeshes);
+			if (!ok)  break;
+			node.name.assign(reinterpret_cast<const char*>(name), nameLength);
+			node.parentIndex = parentIndex;
+		}
+
+		// Read geometry and create GPU resources from the file data
+		mSubMeshes.resize(header.numSubMeshes);
+		MeshBufferData bufferData(ImportArena()); // Reset by the constructor calling this
+		for (auto& subMesh : mSubMeshes)
+		{
+			if (!ok)  break;
+
+			CookedSubMeshHeader subMeshHeader;
+			ok = reader.Read(subMeshHeader) && subMeshHeader.numVertexElements > 0 && subMeshHeader.numVertexElements <= 8 &&
+			     subMeshHeader.numLods <= CookedMaxLods;
+			if (!ok)  break;
+
+			D3D11_INPUT_ELEMENT_DESC vertexElements[8];
+			for (unsigned int i = 0; i < subMeshHeader.numVertexElements && ok; ++i)
 			{
-				*reinterpret_cast<CVector3*>(currVert) = normal;
-				currVert += sizeof(CVector3);
+				const unsigned char* data = reader.Skip(sizeof(CookedVertexElement));
+				ok = (data != nullptr);
+				if (!ok)  break;
+
+				// Names are used in place in the mapped file, make sure they are terminated
+				auto element = reinterpret_cast<const CookedVertexElement*>(data);
+				ok = (memchr(element->semanticName, 0, sizeof(element->semanticName)) != nullptr);
+				vertexElements[i] = { element->semanticName, 0, static_cast<DXGI_FORMAT>(element->format), 0, element->offset, D3D11_INPUT_PER_VERTEX_DATA, 0 };
 			}
-			if (uvs)
+			if (!ok)  break;
+
+			subMesh.lods.resize(subMeshHeader.numLods);
+			for (auto& lod : subMesh.lods)
 			{
-				*reinterpret_cast<CVector2*>(currVert) = uv;
-				currVert += sizeof(CVector2);
+				CookedLod cookedLod;
+				ok = reader.Read(cookedLod) && cookedLod.numIndices > 0;
+				if (!ok)  break;
+				lod.numIndices = cookedLod.numIndices;
+				lod.error      = cookedLod.error;
+				subMesh.numLodIndices += lod.numIndices;
 			}
-			pt.x += xStep;
-			uv.x += uStep;
+			if (!ok)  break;
+
+			subMesh.vertexSize  = subMeshHeader.vertexSize;
+			subMesh.numVertices = subMeshHeader.numVertices;
+			subMesh.numIndices  = subMeshHeader.numIndices;
+			subMesh.indexFormat = static_cast<DXGI_FORMAT>(subMeshHeader.indexFormat);
+			subMesh.bounds.min  = CVector3(subMeshHeader.boundsMin);
+			subMesh.bounds.max  = CVector3(subMeshHeader.boundsMax);
+			ok = (subMesh.indexFormat == DXGI_FORMAT_R16_UINT || subMesh.indexFormat == DXGI_FORMAT_R32_UINT);
+			if (!ok)  break;
+			const unsigned char* vertices = reader.Skip(static_cast<size_t>(subMesh.numVertices) * subMesh.vertexSize);
+			const unsigned char* indices  = reader.Skip((static_cast<size_t>(subMesh.numIndices) + subMesh.numLodIndices) *
+			                                            IndexSize(subMesh.indexFormat));
+			ok = (vertices != nullptr && indices != nullptr && subMesh.numVertices > 0 && subMesh.numIndices > 0);
+			if (!ok)  break;
+
+			CreateSubMeshResources(subMesh, vertexElements, subMeshHeader.numVertexElements, vertices, indices, bufferData, cookedFileName);
 		}
-		pt.x = minPt.x;
-		pt.z += zStep;
-		uv.x = 0;
-		uv.y -= vStep; // V axis is opposite direction to Z
+		if (ok)  CreateMeshBuffers(bufferData, cookedFileName);
 	}
+	catch (std::runtime_error)
+	{
+		ok = false;
+	}
+
+	if (ok)  CalculateNodeBounds();
+
+	// Leave the mesh empty on failure, ready to import the original mesh file instead
+	if (!ok)
+	{
+		mQuantisedVertices = false;
+		mPositionDecodeMatrix = MatrixIdentity();
+		ReleaseSubMeshes();
+		mSubMeshes.clear();
+		mNodes.clear();
+	}
+	return ok;
+}
 
 
-	// Allocate space to create the grid indices. To keep model rendering code simpler using a triangle
-	// list, even though a strip would work nicely here
-	mSubMeshes[0].numIndices = subDivX * subDivZ * 6; // Two triangles for each grid square
-	auto indexData = std::make_unique<char[]>(mSubMeshes[0].numIndices * 4); // 4 byte integer for each index
+// Save the mesh as a cooked mesh file (see above). The sub-mesh data must be in the same order as mSubMeshes
+// Failure is not an error, the mesh will just be imported from the original file next time
+void Mesh::SaveCookedMesh(const std::string& cookedFileName, uint64_t sourceHash, const ArenaVector<CookedSubMesh>& subMeshData)
+{
+	std::ofstream file(cookedFileName, std::ios::binary);
+	if (!file)  return;
 
-	// Create the grid indexes (CPU-side first)
-	uint32_t tlIndex = 0;
-	auto currIndex = reinterpret_cast<uint32_t*>(indexData.get()); // uint32_t = 4-byte indexes
-	for (int z = 0; z < subDivZ; ++z)
+	auto write = [&](const void* data, size_t size) { file.write(static_cast<const char*>(data), size); };
+	auto writeIndexList = [&](const std::vector<unsigned int>& list)
 	{
-		for (int x = 0; x < subDivX; ++x)
+		uint32_t count = static_cast<uint32_t>(list.size());
+		write(&count, sizeof(count));
+		for (auto index : list)
 		{
-			// Bottom-left triangle in grid square (looking down on the grid)
-			*currIndex++ = tlIndex;
-			*currIndex++ = tlIndex + subDivX + 1;
-			*currIndex++ = tlIndex + 1;
+			uint32_t value = index;
+			write(&value, sizeof(value));
+		}
+	};
+
+	CookedMeshHeader header = {};
+	memcpy(header.id, CookedMeshID, sizeof(CookedMeshID));
+	header.version      = CookedMeshVersion;
+	header.sourceHash   = sourceHash;
+	header.hasBones     = mHasBones ? 1 : 0;
+	header.numNodes     = static_cast<uint32_t>(mNodes.size());
+	header.numSubMeshes = static_cast<uint32_t>(mSubMeshes.size());
+	header.quantisedVertices = mQuantisedVertices ? 1 : 0;
+	write(&header, sizeof(header));
+	if (mQuantisedVertices)  write(&mPositionDecodeMatrix, sizeof(mPositionDecodeMatrix));
+
+	for (auto& node : mNodes)
+	{
+		uint32_t nameLength  = static_cast<uint32_t>(node.name.size());
+		uint32_t parentIndex = node.parentIndex;
+		write(&nameLength, sizeof(nameLength));
+		write(node.name.data(), nameLength);
+		write(&node.defaultMatrix, sizeof(node.defaultMatrix));
+		write(&node.offsetMatrix, sizeof(node.offsetMatrix));
+		write(&parentIndex, sizeof(parentIndex));
+		writeIndexList(node.childNodes);
+		writeIndexList(node.subMeshes);
+	}
 
-			// Top-right triangle in grid square
-			*currIndex++ = tlIndex + 1;
-			*currIndex++ = tlIndex + subDivX + 1;
-			*currIndex++ = tlIndex + subDivX + 2;
+	for (unsigned int m = 0; m < mSubMeshes.size(); ++m)
+	{
+		const SubMesh& subMesh = mSubMeshes[m];
+		const CookedSubMesh& data = subMeshData[m];
+
+		CookedSubMeshHeader subMeshHeader = {};
+		subMeshHeader.vertexSize        = subMesh.vertexSize;
+		subMeshHeader.numVertices       = subMesh.numVertices;
+		subMeshHeader.numIndices        = subMesh.numIndices;
+		subMeshHeader.indexFormat       = subMesh.indexFormat;
+		memcpy(subMeshHeader.boundsMin, &subMesh.bounds.min, sizeof(subMeshHeader.boundsMin));
+		memcpy(subMeshHeader.boundsMax, &subMesh.bounds.max, sizeof(subMeshHeader.boundsMax));
+		subMeshHeader.numVertexElements = static_cast<uint32_t>(data.vertexElements.size());
+		subMeshHeader.numLods           = static_cast<uint32_t>(subMesh.lods.size());
+		write(&subMeshHeader, sizeof(subMeshHeader));
+
+		for (auto& vertexElement : data.vertexElements)
+		{
+			CookedVertexElement element = {};
+			strncpy_s(element.semanticName, vertexElement.SemanticName, _TRUNCATE);
+			element.format = vertexElement.Format;
+			element.offset = vertexElement.AlignedByteOffset;
+			write(&element, sizeof(element));
+		}
 
-			++tlIndex;
+		for (auto& lod : subMesh.lods)
+		{
+			CookedLod cookedLod = { lod.numIndices, lod.error };
+			write(&cookedLod, sizeof(cookedLod));
+		}
+
+		write(data.vertices.data(), static_cast<size_t>(subMesh.numVertices) * subMesh.vertexSize);
+		write(data.indices.data(),  (static_cast<size_t>(subMesh.numIndices) + subMesh.numLodIndices) * IndexSize(subMesh.indexFormat));
+	}
+
+	// Don't leave a partly written file behind
+	file.close();
+	if (!file)  std::remove(cookedFileName.c_str());
+}
+
+
+//--------------------------------------------------------------------------------------
+// Sub-mesh resources
+//--------------------------------------------------------------------------------------
+
+// Create the vertex layout for a sub-mesh, which must have its sizes set already, and add its vertices and indices to the
+// data for the mesh buffers (created by CreateMeshBuffers once every sub-mesh is added). The indices of the sub-mesh's levels
+// of detail follow its own, they are added too. The name is used in error messages
+// Will throw a std::runtime_error exception on failure
+void Mesh::CreateSubMeshResources(SubMesh& subMesh, const D3D11_INPUT_ELEMENT_DESC* vertexElements, unsigned int numVertexElements,
+                                  const void* vertices, const void* indices, MeshBufferData& bufferData, const std::string& name)
+{
+	// Create a "vertex layout" to describe to DirectX what is data in each vertex of this mesh
+	// Sub-meshes and meshes with the same vertex elements share their layout (see Shader.cpp)
+	subMesh.vertexLayout = GetInputLayout(vertexElements, static_cast<int>(numVertexElements));
+	if (subMesh.vertexLayout == nullptr)  throw std::runtime_error("Failure creating input layout for " + name);
+
+	// The layout for position only draws reads just the position, so depth only passes fetch less. Rigid meshes read it from
+	// the separate position buffer, where the positions are packed with nothing between them. Skinned meshes read it from the
+	// full vertices of their skinned buffers
+	const D3D11_INPUT_ELEMENT_DESC* positionElement = nullptr;
+	for (unsigned int i = 0; i < numVertexElements; ++i)
+	{
+		if (strcmp(vertexElements[i].SemanticName, "position") == 0)  positionElement = &vertexElements[i];
+	}
+	if (positionElement != nullptr)
+	{
+		D3D11_INPUT_ELEMENT_DESC positionLayout = *positionElement;
+		if (gMeshLoaderSettings.positionStreams && !mHasBones)
+		{
+			subMesh.positionSize = (positionElement->Format == DXGI_FORMAT_R16G16B16A16_UNORM) ? 8 : 12; // Quantised or float
+			positionLayout.AlignedByteOffset = 0;
+		}
+		subMesh.positionLayout = GetInputLayout(&positionLayout, 1);
+		if (subMesh.positionLayout == nullptr)  throw std::runtime_error("Failure creating position input layout for " + name);
+	}
+
+
+	// Add the vertices to the end of the mesh's vertex data. The draw finds them by counting whole vertices of this sub-mesh's
+	// size from the start of the buffer, so pad with zeros up to a multiple of that size first. Same for the indices
+	auto append = [](ArenaVector<unsigned char>& data, const void* source, unsigned int elementSize, unsigned int numElements)
+	{
+		size_t start = (data.size() + elementSize - 1) / elementSize * elementSize;
+		data.resize(start, 0);
+		auto bytes = static_cast<const unsigned char*>(source);
+		data.insert(data.end(), bytes, bytes + static_cast<size_t>(numElements) * elementSize);
+		return static_cast<unsigned int>(start / elementSize);
+	};
+	subMesh.baseVertex = append(bufferData.vertices, vertices, subMesh.vertexSize, subMesh.numVertices);
+	if (subMesh.positionSize != 0)
+	{
+		subMesh.basePosition = append(bufferData.positions, nullptr, subMesh.positionSize, 0);
+		auto vertex = static_cast<const unsigned char*>(vertices) + positionElement->AlignedByteOffset;
+		for (unsigned int i = 0; i < subMesh.numVertices; ++i, vertex += subMesh.vertexSize)
+		{
+			bufferData.positions.insert(bufferData.positions.end(), vertex, vertex + subMesh.positionSize);
+		}
+	}
+	subMesh.startIndex = append(bufferData.indices, indices, IndexSize(subMesh.indexFormat), subMesh.numIndices + subMesh.numLodIndices);
+	unsigned int lodStart = subMesh.startIndex + subMesh.numIndices;
+	for (auto& lod : subMesh.lods)
+	{
+		lod.startIndex = lodStart;
+		lodStart += lod.numIndices;
+	}
+
+
+	if (mHasBones)
+	{
+		// Where the skinning shader finds the parts of each vertex it needs. Position and normal are always first
+		SkinningConstants skinningConstants = {};
+		skinningConstants.numVertices = subMesh.numVertices;
+		skinningConstants.vertexSize  = subMesh.vertexSize;
+		for (unsigned int i = 0; i < numVertexElements; ++i)
+		{
+			if (strcmp(vertexElements[i].SemanticName, "tangent") == 0)  skinningConstants.tangentOffset = vertexElements[i].AlignedByteOffset;
+			if (strcmp(vertexElements[i].SemanticName, "bones"  ) == 0)  skinningConstants.bonesOffset   = vertexElements[i].AlignedByteOffset;
 		}
-		++tlIndex;
+
+		D3D11_BUFFER_DESC constantsDesc = {};
+		constantsDesc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+		constantsDesc.Usage     = D3D11_USAGE_IMMUTABLE; // These never change
+		constantsDesc.ByteWidth = sizeof(SkinningConstants);
+		D3D11_SUBRESOURCE_DATA constantsData = {};
+		constantsData.pSysMem = &skinningConstants;
+		HRESULT hr = gD3DDevice->CreateBuffer(&constantsDesc, &constantsData, &subMesh.skinningConstants);
+		if (FAILED(hr))  throw std::runtime_error("Failure creating skinning constants for " + name);
+		RegisterGpuResource(subMesh.skinningConstants, "Constant Buffers");
 	}
+}
 
-  
-	// Create the vertex buffer and fill it with the loaded vertex data
+
+// Create the GPU-side vertex and index buffers holding every sub-mesh from the data collected by CreateSubMeshResources
+// The name is used in error messages. Will throw a std::runtime_error exception on failure
+void Mesh::CreateMeshBuffers(const MeshBufferData& bufferData, const std::string& name)
+{
 	D3D11_BUFFER_DESC bufferDesc;
-	bufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
-	bufferDesc.Usage = D3D11_USAGE_DEFAULT; // Not a dynamic buffer
-	bufferDesc.ByteWidth = mSubMeshes[0].numVertices * mSubMeshes[0].vertexSize; // Buffer size
+	D3D11_SUBRESOURCE_DATA initData;
+
+	// Create GPU-side vertex buffer and copy the vertices into it
+	bufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER; // Indicate it is a vertex buffer
+	bufferDesc.Usage = D3D11_USAGE_DEFAULT;          // Default usage for this buffer - we'll see other usages later
+	bufferDesc.ByteWidth = static_cast<UINT>(bufferData.vertices.size()); // Size of the buffer in bytes
 	bufferDesc.CPUAccessFlags = 0;
 	bufferDesc.MiscFlags = 0;
-	D3D11_SUBRESOURCE_DATA initData; // Initial data
-	initData.pSysMem = vertexData.get();   
-	if (FAILED(gD3DDevice->CreateBuffer( &bufferDesc, &initData, &mSubMeshes[0].vertexBuffer)))
+	initData.pSysMem = bufferData.vertices.data(); // Fill the new vertex buffer with the given data
+
+	// Skinned meshes - the skinning compute shader also reads the vertices as raw bytes (see Skin)
+	if (mHasBones)
 	{
-		throw std::runtime_error("Failure creating vertex buffer for grid mesh");
+		bufferDesc.BindFlags |= D3D11_BIND_SHADER_RESOURCE;
+		bufferDesc.MiscFlags  = D3D11_RESOURCE_MISC_BUFFER_ALLOW_RAW_VIEWS;
 	}
 
+	HRESULT hr = gD3DDevice->CreateBuffer(&bufferDesc, &initData, &mVertexBuffer);
+	if (FAILED(hr))  throw std::runtime_error("Failure creating vertex buffer for " + name);
+	SetDebugName(mVertexBuffer, name + " Vertices");
+	RegisterGpuResource(mVertexBuffer, "Meshes");
 
-	// Create the index buffer
-	bufferDesc.BindFlags = D3D11_BIND_INDEX_BUFFER;
-	bufferDesc.Usage = D3D11_USAGE_DEFAULT;
-	bufferDesc.ByteWidth = mSubMeshes[0].numIndices * 4;
-	bufferDesc.CPUAccessFlags = 0;
-	bufferDesc.MiscFlags = 0;
-	initData.pSysMem = indexData.get();   
-	if (FAILED(gD3DDevice->CreateBuffer( &bufferDesc, &initData, &mSubMeshes[0].indexBuffer)))
+	if (mHasBones)
 	{
-		throw std::runtime_error("Failure creating index buffer for grid mesh");
+		// Each sub-mesh is skinned on its own, give each a view of just its part of the buffer. Skinned vertices are made of
+		// 32-bit values, so every sub-mesh starts on a multiple of 4 bytes as raw views need
+		for (auto& subMesh : mSubMeshes)
+		{
+			D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+			srvDesc.Format               = DXGI_FORMAT_R32_TYPELESS; // Raw views read the buffer as 32-bit values
+			srvDesc.ViewDimension        = D3D11_SRV_DIMENSION_BUFFEREX;
+			srvDesc.BufferEx.FirstElement = subMesh.baseVertex * subMesh.vertexSize / 4;
+			srvDesc.BufferEx.NumElements  = subMesh.numVertices * subMesh.vertexSize / 4;
+			srvDesc.BufferEx.Flags        = D3D11_BUFFEREX_SRV_FLAG_RAW;
+			hr = gD3DDevice->CreateShaderResourceView(mVertexBuffer, &srvDesc, &subMesh.vertexBufferSRV);
+			if (FAILED(hr))  throw std::runtime_error("Failure creating skinning view of vertex buffer for " + name);
+		}
+	}
+
+
+	// Create GPU-side index buffer and copy the indices into it, unless the mesh shares one already (see mSharedIndexBuffer)
+	if (mIndexBuffer == nullptr)
+	{
+		bufferDesc.BindFlags = D3D11_BIND_INDEX_BUFFER; // Indicate it is an index buffer
+		bufferDesc.Usage = D3D11_USAGE_DEFAULT;         // Default usage for this buffer - we'll see other usages later
+		bufferDesc.ByteWidth = static_cast<UINT>(bufferData.indices.size()); // Size of the buffer in bytes
+		bufferDesc.CPUAccessFlags = 0;
+		bufferDesc.MiscFlags = 0;
+		initData.pSysMem = bufferData.indices.data(); // Fill the new index buffer with the given data
+
+		hr = gD3DDevice->CreateBuffer(&bufferDesc, &initData, &mIndexBuffer);
+		if (FAILED(hr))  throw std::runtime_error("Failure creating index buffer for " + name);
+		SetDebugName(mIndexBuffer, name + " Indices");
+		RegisterGpuResource(mIndexBuffer, "Meshes");
+	}
+
+
+	// Create the buffer of positions for position only draws, if the sub-meshes have them
+	if (!bufferData.positions.empty())
+	{
+		bufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+		bufferDesc.ByteWidth = static_cast<UINT>(bufferData.positions.size());
+		initData.pSysMem = bufferData.positions.data();
+
+		hr = gD3DDevice->CreateBuffer(&bufferDesc, &initData, &mPositionBuffer);
+		if (FAILED(hr))  throw std::runtime_error("Failure creating position buffer for " + name);
+		SetDebugName(mPositionBuffer, name + " Positions");
+		RegisterGpuResource(mPositionBuffer, "Meshes");
 	}
 }
 
 
+// Choose the smallest index format that can index the given number of vertices
+DXGI_FORMAT Mesh::ChooseIndexFormat(unsigned int numVertices)
+{
+	return (numVertices <= 0x10000) ? DXGI_FORMAT_R16_UINT : DXGI_FORMAT_R32_UINT;
+}
 
-Mesh::~Mesh()
+// Size in bytes of a single index in the given format
+unsigned int Mesh::IndexSize(DXGI_FORMAT indexFormat)
+{
+	return (indexFormat == DXGI_FORMAT_R16_UINT) ? 2 : 4;
+}
+
+
+// Release the GPU resources of the mesh and all sub-meshes
+void Mesh::ReleaseSubMeshes()
 {
 	for (auto& subMesh : mSubMeshes)
 	{
-		if (subMesh.indexBuffer)   subMesh.indexBuffer ->Release();
-		if (subMesh.vertexBuffer)  subMesh.vertexBuffer->Release();
+		if (subMesh.skinningConstants)  subMesh.skinningConstants->Release();
+		if (subMesh.vertexBufferSRV)    subMesh.vertexBufferSRV  ->Release();
 		if (subMesh.vertexLayout)  subMesh.vertexLayout->Release();
+		if (subMesh.positionLayout)  subMesh.positionLayout->Release();
+		subMesh.skinningConstants = nullptr;
+		subMesh.vertexBufferSRV   = nullptr;
+		subMesh.vertexLayout = nullptr;
+		subMesh.positionLayout = nullptr;
 	}
+	if (mSharedIndexBuffer)  mSharedIndexBuffer.reset(); // Other grids may still be using it
+	else if (mIndexBuffer)   mIndexBuffer->Release();
+	if (mVertexBuffer)    mVertexBuffer  ->Release();
+	if (mPositionBuffer)  mPositionBuffer->Release();
+	mIndexBuffer    = nullptr;
+	mVertexBuffer   = nullptr;
+	mPositionBuffer = nullptr;
 }
 
 
+
 //--------------------------------------------------------------------------------------
 
 // Helper function for Render function - renders a given sub-mesh. World matrices / textures / states etc. must already be set
-void Mesh::RenderSubMesh(const SubMesh& subMesh, bool useTessellation /*= false*/)
+// A vertex buffer with the same layout holding just this sub-mesh can be given to draw instead, e.g. the skinned vertices of a model
+// The level of detail is chosen from the pixels a distance of 1 in the node's space covers (see Render)
+void Mesh::RenderSubMesh(const SubMesh& subMesh, bool useTessellation /*= false*/, unsigned int numInstances /*= 1*/,
+                         ID3D11Buffer* vertexBuffer /*= nullptr*/, float lodPixelsPerUnit /*= 0*/, bool positionOnly /*= false*/)
 {
-	// Set vertex buffer as next data source for GPU
-	UINT stride = subMesh.vertexSize;
-	UINT offset = 0;
-	gD3DContext->IASetVertexBuffers(0, 1, &subMesh.vertexBuffer, &stride, &offset);
+	// A bufferless grid has no vertex data, the vertex shader generates it from the vertex and instance IDs. Each instance is
+	// one row of grid squares drawn as a triangle strip - two vertices for each column, rather than six for a triangle list
+	if (mBufferlessGrid)
+	{
+		SetInputLayout(nullptr);
+		SetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP);
+		gD3DContext->DrawInstanced((mGridSubDivX + 1) * 2, mGridSubDivZ, 0, 0);
+		CountDrawCall();
+		return;
+	}
+
+	unsigned int baseVertex = SetSubMeshBuffers(subMesh, useTessellation, vertexBuffer, positionOnly);
+
+	// The coarsest level of detail whose surface is less than a pixel from the full sub-mesh's. Levels only differ in their
+	// indices, so it is just a different part of the index buffer. No pixel size given means full detail
+	unsigned int numIndices = subMesh.numIndices;
+	unsigned int startIndex = subMesh.startIndex;
+	for (auto& lod : subMesh.lods)
+	{
+		if (lodPixelsPerUnit <= 0 || lod.error * lodPixelsPerUnit >= 1.0f)  break;
+		numIndices = lod.numIndices;
+		startIndex = lod.startIndex;
+	}
+
+	// Render the sub-mesh's part of the mesh buffers, or several copies of it placed by the vertex shader
+	if (numInstances == 1)  gD3DContext->DrawIndexed(numIndices, startIndex, baseVertex);
+	else                    gD3DContext->DrawIndexedInstanced(numIndices, numInstances, startIndex, baseVertex, 0);
+	CountDrawCall();
+}
+
+
+// Set the vertex / index buffers, vertex layout and topology to draw a sub-mesh, from the mesh buffers or the given vertex buffer
+// Position only draws use the layout with just the position, read from the position buffer if the mesh has one. Returns the
+// base vertex to draw with - a given vertex buffer holds just this sub-mesh, so starts at vertex 0
+unsigned int Mesh::SetSubMeshBuffers(const SubMesh& subMesh, bool useTessellation, ID3D11Buffer* vertexBuffer, bool positionOnly /*= false*/)
+{
+	// Set the mesh vertex buffer as next data source for GPU. Every sub-mesh uses the same buffer, so the state cache only
+	// passes this on to DirectX for the first sub-mesh (or when the vertex size changes)
+	unsigned int baseVertex = 0;
+	if (vertexBuffer != nullptr)
+	{
+		SetVertexBuffer(vertexBuffer, subMesh.vertexSize);
+	}
+	else if (positionOnly && subMesh.positionSize != 0)
+	{
+		SetVertexBuffer(mPositionBuffer, subMesh.positionSize);
+		baseVertex = subMesh.basePosition;
+	}
+	else
+	{
+		SetVertexBuffer(mVertexBuffer, subMesh.vertexSize);
+		baseVertex = subMesh.baseVertex;
+	}
 
 	// Indicate the layout of vertex buffer
-	gD3DContext->IASetInputLayout(subMesh.vertexLayout);
+	SetInputLayout(positionOnly ? subMesh.positionLayout : subMesh.vertexLayout);
 
-	// Set index buffer as next data source for GPU, indicate it uses 32-bit integers
-	gD3DContext->IASetIndexBuffer(subMesh.indexBuffer, DXGI_FORMAT_R32_UINT, 0);
+	// Set index buffer as next data source for GPU, indicate whether it uses 16 or 32-bit integers
+	SetIndexBuffer(mIndexBuffer, subMesh.indexFormat);
 
 	// Using triangle lists only in this class
-	gD3DContext->IASetPrimitiveTopology(useTessellation ? D3D11_PRIMITIVE_TOPOLOGY_3_CONTROL_POINT_PATCHLIST : D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-
-	// Render mesh
-	gD3DContext->DrawIndexed(subMesh.numIndices, 0, 0);
+	SetPrimitiveTopology(useTessellation ? D3D11_PRIMITIVE_TOPOLOGY_3_CONTROL_POINT_PATCHLIST : D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+	return baseVertex;
 }
 
 
 
-// Render the mesh with the given matrices
+// Render the mesh with the given absolute matrices from UpdateAbsoluteMatrices. A single node mesh can be given its world
+// matrix directly. Skinned meshes draw a model's skinned vertex buffers instead, one for each sub-mesh (see Skin)
 // Handles rigid body meshes (including single part meshes) as well as skinned meshes
 // LIMITATION: The mesh must use a single texture throughout
-void Mesh::Render(std::vector<CMatrix4x4>& modelMatrices, bool useTessellation)
+// Levels of detail are chosen from the pixels a world space distance of 1 covers at the mesh, 0 for full detail
+// Position only draws give the vertex shader just the vertex positions, for depth only passes
+void Mesh::Render(const std::vector<CMatrix4x4>& absoluteMatrices, bool useTessellation, ID3D11Buffer* const* skinnedVertices,
+                  float lodPixelsPerUnit, bool positionOnly)
 {
-	// Skinning needs all matrices available in the shader at the same time, so first calculate all the absolute
-	// matrices before rendering anything
-	std::vector<CMatrix4x4> absoluteMatrices(modelMatrices.size());
-	absoluteMatrices[0] = modelMatrices[0]; // First matrix for a model is the root matrix, already in world space
-	for (unsigned int nodeIndex = 1; nodeIndex < mNodes.size(); ++nodeIndex)
-	{
-		// Multiply each model matrix by its parent's absolute world matrix (already calculated earlier in this loop)
-		// Same process as for rigid bodies, simply done prior to rendering now
-		absoluteMatrices[nodeIndex] = modelMatrices[nodeIndex] * absoluteMatrices[mNodes[nodeIndex].parentIndex];
-	}
+	CpuProfileScope profile("Mesh Render");
 
-	if (mHasBones) // Render a mesh that uses skinning
+	// The level of detail errors are in the space of each node, scaled by its matrix into world space
+	auto nodeLodPixelsPerUnit = [&](unsigned int nodeIndex)
 	{
-		// Advanced point: the above loop will get the absolute world matrices **of the bones**. However, they are
-		// not actually rendered, they merely influence the skinned mesh, which has its origin at a particular node.
-		// So for each bone there is a fixed offset (transform) between where that bone is and where the root of the
-		// skinned mesh is. We need to apply that offset to each of the bone matrices calculated in the last loop to make
-		// the bone influences work on the skinned mesh.
-		// These offset matrices are fixed for the model and have been calculated when the mesh was imported
-		for (unsigned int nodeIndex = 0; nodeIndex < mNodes.size(); ++nodeIndex)
-		{
-			absoluteMatrices[nodeIndex] = mNodes[nodeIndex].offsetMatrix * absoluteMatrices[nodeIndex];
-		}
-
-		// Send all matrices over to the GPU for skinning via a constant buffer - each matrix can represent a bone which influences nearby vertices
-		// MISSING - code to fill the gPerModelConstants.boneMatrices array with the contents of the absoluteMatrices vector
-		for (unsigned int nodeIndex = 0; nodeIndex < mNodes.size(); ++nodeIndex)
-		{
-			gPerModelConstants.boneMatrices[nodeIndex] = absoluteMatrices[nodeIndex];
-		}
-		UpdateConstantBuffer(gPerModelConstantBuffer, gPerModelConstants); // Send to GPU
+		CVector3 scale = absoluteMatrices[nodeIndex].GetScale();
+		return lodPixelsPerUnit * (std::max)({ scale.x, scale.y, scale.z });
+	};
 
-		// Indicate that the constant buffer we just updated is for use in the vertex shader (VS), geometry shader (GS) and pixel shader (PS)
-		gD3DContext->VSSetConstantBuffers(1, 1, &gPerModelConstantBuffer); // First parameter must match constant buffer number in the shader
-		gD3DContext->HSSetConstantBuffers(1, 1, &gPerModelConstantBuffer);
-		gD3DContext->DSSetConstantBuffers(1, 1, &gPerModelConstantBuffer);
-		gD3DContext->GSSetConstantBuffers(1, 1, &gPerModelConstantBuffer);
-		gD3DContext->PSSetConstantBuffers(1, 1, &gPerModelConstantBuffer);
+	// Quantised vertices and bufferless grids have their positions scaled and offset by the position decode matrix
+	bool decodePositions = mQuantisedVertices || mBufferlessGrid;
 
-		// Already sent over all the absolute matrices for the entire mesh so we can render sub-meshes directly
-		// rather than iterating through the nodes. 
-		for (auto& subMesh : mSubMeshes)
+	if (mHasBones) // Render a mesh that uses skinning
+	{
+		// The vertices have already been moved by the bones into world space for this frame (see Skin), so every pass draws
+		// them like a single rigid part with no transform - the usual vertex shaders work unchanged
+		if (skinnedVertices == nullptr)  return;
+		gPerModelConstants.worldMatrix       = MatrixIdentity();
+		gPerModelConstants.quantisedVertices = 0.0f;
+		gPerModelConstants.gridSubdivisions  = CVector2(0, 0);
+		SetConstants(1, gPerModelConstantBuffer, gPerModelConstants); // Other per-model settings such as object colour
+
+		// Render sub-meshes directly rather than iterating through the nodes
+		for (unsigned int subMeshIndex = 0; subMeshIndex < mSubMeshes.size(); ++subMeshIndex)
 		{
-			RenderSubMesh(subMesh, useTessellation);
+			RenderSubMesh(mSubMeshes[subMeshIndex], useTessellation, 1, skinnedVertices[subMeshIndex], nodeLodPixelsPerUnit(0), positionOnly);
 		}
 	}
 	else
 	{
 		// Render a mesh without skinning. Although slightly reorganised to use the matrices calculated
-		// above, this is basically the same code as the rigid body animation lab
+		// in UpdateAbsoluteMatrices, this is basically the same code as the rigid body animation lab
 		// Iterate through each node
 		for (unsigned int nodeIndex = 0; nodeIndex < mNodes.size(); ++nodeIndex)
 		{
-			// Send this node's matrix to the GPU via a constant buffer
-			gPerModelConstants.worldMatrix = absoluteMatrices[nodeIndex];
-			UpdateConstantBuffer(gPerModelConstantBuffer, gPerModelConstants); // Send to GPU
-
-			// Indicate that the constant buffer we just updated is for use in the vertex shader (VS) and pixel shader (PS)
-			gD3DContext->VSSetConstantBuffers(1, 1, &gPerModelConstantBuffer); // First parameter must match constant buffer number in the shader
-			gD3DContext->HSSetConstantBuffers(1, 1, &gPerModelConstantBuffer);
-			gD3DContext->DSSetConstantBuffers(1, 1, &gPerModelConstantBuffer);
-			gD3DContext->GSSetConstantBuffers(1, 1, &gPerModelConstantBuffer);
-			gD3DContext->PSSetConstantBuffers(1, 1, &gPerModelConstantBuffer);
+			// Send this node's matrix to the GPU via a constant buffer. Quantised / generated positions are decoded by the same matrix
+			if (decodePositions)     gPerModelConstants.worldMatrix = mPositionDecodeMatrix * absoluteMatrices[nodeIndex];
+			else                     gPerModelConstants.worldMatrix = absoluteMatrices[nodeIndex];
+			gPerModelConstants.quantisedVertices = mQuantisedVertices ? 1.0f : 0.0f;
+			gPerModelConstants.gridSubdivisions  = CVector2(static_cast<float>(mGridSubDivX), static_cast<float>(mGridSubDivZ));
+			// Send to GPU and indicate that the constants are for use in the shaders. Each draw's constants go to a new part of the
+			// constant ring, so the driver doesn't need to find new memory for a discarded buffer every draw (see StateCache.h)
+			SetConstants(1, gPerModelConstantBuffer, gPerModelConstants); // First parameter must match constant buffer number in the shader
 
 			// Render the sub-meshes attached to this node (no bones - rigid movement)
+			float nodePixelsPerUnit = nodeLodPixelsPerUnit(nodeIndex);
 			for (auto& subMeshIndex : mNodes[nodeIndex].subMeshes)
 			{
-				RenderSubMesh(mSubMeshes[subMeshIndex], useTessellation);
+				RenderSubMesh(mSubMeshes[subMeshIndex], useTessellation, 1, nullptr, nodePixelsPerUnit, positionOnly);
 			}
 		}
 	}
 }
 
 
+// Test if any part of the mesh, positioned with the given matrices, might be inside the given view frustum. Uses the bounding
+// spheres of the nodes calculated when the mesh was loaded. Skinned meshes are always visible - their vertices follow the bones
+bool Mesh::IsVisible(const std::vector<CMatrix4x4>& absoluteMatrices, const Frustum& frustum)
+{
+	if (mHasBones)  return true;
+
+	for (unsigned int nodeIndex = 0; nodeIndex < mNodes.size(); ++nodeIndex)
+	{
+		if (SphereInFrustum(frustum, TransformSphere(mNodes[nodeIndex].bounds, absoluteMatrices[nodeIndex])))  return true;
+	}
+	return false;
+}
+
+
+// Render many copies of the mesh in one draw call per sub-mesh. The vertex shader gets the world matrix of each instance
+// from a buffer using SV_InstanceID (see InstancedModel.h), the nodes are placed relative to it in their default positions
+// With an indirect arguments buffer (see GetIndirectArgs) the number of instances comes from the buffer instead
+// LIMITATION: Rigid meshes only - skinned meshes and bufferless grids are not drawn
+void Mesh::RenderInstanced(unsigned int numInstances, ID3D11Buffer* indirectArgs /*= nullptr*/)
+{
+	if (mHasBones || mBufferlessGrid || (numInstances == 0 && indirectArgs == nullptr))  return;
+
+	// The per-model world matrix places each node relative to the instance, the shader then multiplies by the instance's matrix
+	CalculateDefaultMatrices();
+	for (unsigned int nodeIndex = 0; nodeIndex < mNodes.size(); ++nodeIndex)
+	{
+		if (mNodes[nodeIndex].subMeshes.empty())  continue;
+
+		if (mQuantisedVertices)  gPerModelConstants.worldMatrix = mPositionDecodeMatrix * gAbsoluteMatrices[nodeIndex];
+		else                     gPerModelConstants.worldMatrix = gAbsoluteMatrices[nodeIndex];
+		gPerModelConstants.quantisedVertices = mQuantisedVertices ? 1.0f : 0.0f;
+		gPerModelConstants.gridSubdivisions  = CVector2(0, 0);
+		SetConstants(1, gPerModelConstantBuffer, gPerModelConstants);
+
+		for (auto& subMeshIndex : mNodes[nodeIndex].subMeshes)
+		{
+			if (indirectArgs == nullptr)
+			{
+				RenderSubMesh(mSubMeshes[subMeshIndex], false, numInstances);
+			}
+			else
+			{
+				SetSubMeshBuffers(mSubMeshes[subMeshIndex], false, nullptr);
+				gD3DContext->DrawIndexedInstancedIndirect(indirectArgs, subMeshIndex * sizeof(D3D11_DRAW_INDEXED_INSTANCED_INDIRECT_ARGS));
+				CountDrawCall();
+			}
+		}
+	}
+}
+
+
+// Get the arguments to draw all copies of each sub-mesh with DrawIndexedInstancedIndirect, one entry for each sub-mesh in
+// order, with the instance count left at 0 to be filled in
+void Mesh::GetIndirectArgs(std::vector<D3D11_DRAW_INDEXED_INSTANCED_INDIRECT_ARGS>& args)
+{
+	args.clear();
+	for (auto& subMesh : mSubMeshes)
+	{
+		args.push_back({ subMesh.numIndices, 0, subMesh.startIndex, static_cast<INT>(subMesh.baseVertex), 0 });
+	}
+}
+
+
+// Test if a copy of the mesh in its default pose, placed with the given world matrix, might be inside the given view frustum
+bool Mesh::IsInstanceVisible(const CMatrix4x4& worldMatrix, const Frustum& frustum)
+{
+	return SphereInFrustum(frustum, TransformSphere(mDefaultBounds, worldMatrix));
+}
+
+
+// GPU memory used by the mesh's vertex and index buffers (bytes). Bufferless grids use none
+size_t Mesh::GpuBytes()
+{
+	size_t bytes = 0;
+	if (mVertexBuffer   != nullptr)  bytes += GpuResourceBytes(mVertexBuffer);
+	if (mIndexBuffer    != nullptr)  bytes += GpuResourceBytes(mIndexBuffer);
+	if (mPositionBuffer != nullptr)  bytes += GpuResourceBytes(mPositionBuffer);
+	return bytes;
+}
+
+
+// Create the vertex buffers for a model's skinned vertices, one for each sub-mesh, and the views for the skinning shader to
+// write them (see Skin). The buffers start as a copy of the sub-mesh vertices, the skinning only changes the positions,
+// normals and tangents. The buffers are added to the given vectors as they are created, so the caller can release them
+// even if this fails. Skinned meshes only. Will throw a std::runtime_error exception on failure
+void Mesh::CreateSkinnedVertexBuffers(std::vector<ID3D11Buffer*>& buffers, std::vector<ID3D11UnorderedAccessView*>& views)
+{
+	for (auto& subMesh : mSubMeshes)
+	{
+		D3D11_BUFFER_DESC bufferDesc = {};
+		bufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER | D3D11_BIND_UNORDERED_ACCESS;
+		bufferDesc.Usage     = D3D11_USAGE_DEFAULT;
+		bufferDesc.ByteWidth = subMesh.numVertices * subMesh.vertexSize;
+		bufferDesc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_ALLOW_RAW_VIEWS;
+		ID3D11Buffer* buffer = nullptr;
+		if (FAILED(gD3DDevice->CreateBuffer(&bufferDesc, nullptr, &buffer)))
+		{
+			throw std::runtime_error("Failure creating skinned vertex buffer");
+		}
+		buffers.push_back(buffer);
+		RegisterGpuResource(buffer, "Skinned Vertices");
+
+		// Copy this sub-mesh's part of the mesh vertex buffer
+		D3D11_BOX box = {};
+		box.left   = subMesh.baseVertex * subMesh.vertexSize;
+		box.right  = box.left + bufferDesc.ByteWidth;
+		box.bottom = 1;
+		box.back   = 1;
+		gD3DContext->CopySubresourceRegion(buffer, 0, 0, 0, 0, mVertexBuffer, 0, &box);
+
+		D3D11_UNORDERED_ACCESS_VIEW_DESC uavDesc = {};
+		uavDesc.Format              = DXGI_FORMAT_R32_TYPELESS; // Raw views write the buffer as 32-bit values
+		uavDesc.ViewDimension       = D3D11_UAV_DIMENSION_BUFFER;
+		uavDesc.Buffer.FirstElement = 0;
+		uavDesc.Buffer.NumElements  = bufferDesc.ByteWidth / 4;
+		uavDesc.Buffer.Flags        = D3D11_BUFFER_UAV_FLAG_RAW;
+		ID3D11UnorderedAccessView* view = nullptr;
+		if (FAILED(gD3DDevice->CreateUnorderedAccessView(buffer, &uavDesc, &view)))
+		{
+			throw std::runtime_error("Failure creating skinned vertex buffer view");
+		}
+		views.push_back(view);
+	}
+}
+
+
+// Move the vertices of every sub-mesh by a model's bone matrices (from UpdateAbsoluteMatrices, uploaded to a structured
+// buffer) into the model's skinned vertex buffers, using the skinning compute shader. Call when the model's bones move,
+// before any pass draws it, rather than skinning in the vertex shader of every pass. Does nothing for rigid meshes
+// Leaves the compute shader stage with nothing bound
+void Mesh::Skin(ID3D11ShaderResourceView* boneMatrices, ID3D11UnorderedAccessView* const* skinnedVertices)
+{
+	if (!mHasBones)  return;
+
+	// The skinned buffers may still be bound for drawing from last frame, they can't be written while they are
+	SetVertexBuffer(nullptr, 0);
+
+	gD3DContext->CSSetShader(gSkinningComputeShader, nullptr, 0);
+	gD3DContext->CSSetShaderResources(1, 1, &boneMatrices);
+	for (unsigned int subMeshIndex = 0; subMeshIndex < mSubMeshes.size(); ++subMeshIndex)
+	{
+		const SubMesh& subMesh = mSubMeshes[subMeshIndex];
+		gD3DContext->CSSetConstantBuffers(0, 1, &subMesh.skinningConstants);
+		gD3DContext->CSSetShaderResources(0, 1, &subMesh.vertexBufferSRV);
+		gD3DContext->CSSetUnorderedAccessViews(0, 1, &skinnedVertices[subMeshIndex], nullptr);
+		gD3DContext->Dispatch((subMesh.numVertices + SKINNING_THREAD_GROUP_SIZE - 1) / SKINNING_THREAD_GROUP_SIZE, 1, 1);
+	}
+
+	ID3D11ShaderResourceView*  nullSRVs[2] = {};
+	ID3D11UnorderedAccessView* nullUAV = nullptr;
+	gD3DContext->CSSetShaderResources(0, 2, nullSRVs);
+	gD3DContext->CSSetUnorderedAccessViews(0, 1, &nullUAV, nullptr);
+	gD3DContext->CSSetShader(nullptr, nullptr, 0);
+}
+
+
+// Bring the absolute (world) matrices for a model up to date from its matrices (see Model.h). Only the nodes marked in
+// dirtyNodes and the nodes below them in the hierarchy are recalculated, and the marks are cleared. For skinned meshes
+// the bone matrices (absolute matrices combined with each bone's offset) are updated too, otherwise they are not used
+void Mesh::UpdateAbsoluteMatrices(const std::vector<CMatrix4x4>& modelMatrices, std::vector<char>& dirtyNodes,
+                                  std::vector<CMatrix4x4>& absoluteMatrices, std::vector<CMatrix4x4>& boneMatrices)
+{
+	absoluteMatrices.resize(mNodes.size()); // Only allocates the first time
+	if (mHasBones)  boneMatrices.resize(mNodes.size());
+
+	// Nodes are stored depth-first so a parent always comes before its children. Marking a child as dirty when its parent
+	// is dirty passes the change down the hierarchy in a single loop. The marks are cleared once all nodes are done
+	for (unsigned int nodeIndex = 0; nodeIndex < mNodes.size(); ++nodeIndex)
+	{
+		unsigned int parentIndex = mNodes[nodeIndex].parentIndex;
+		if (dirtyNodes[parentIndex])  dirtyNodes[nodeIndex] = true;
+		if (!dirtyNodes[nodeIndex])  continue;
+
+		// First matrix for a model is the root matrix, already in world space. Multiply each other model matrix by its
+		// parent's absolute world matrix (already calculated earlier in this loop)
+		if (nodeIndex == 0)  absoluteMatrices[0] = modelMatrices[0];
+		else                 absoluteMatrices[nodeIndex] = modelMatrices[nodeIndex] * absoluteMatrices[parentIndex];
+
+		// Advanced point: the above gets the absolute world matrices **of the bones**. However, they are not actually
+		// rendered, they merely influence the skinned mesh, which has its origin at a particular node. So for each bone
+		// there is a fixed offset (transform) between where that bone is and where the root of the skinned mesh is. We
+		// need to apply that offset to each of the bone matrices to make the bone influences work on the skinned mesh.
+		// These offset matrices are fixed for the model and have been calculated when the mesh was imported
+		if (mHasBones)  boneMatrices[nodeIndex] = mNodes[nodeIndex].offsetMatrix * absoluteMatrices[nodeIndex];
+	}
+	for (auto& dirty : dirtyNodes)  dirty = false;
+}
+
+
 //--------------------------------------------------------------------------------------
 // Helper functions
 //--------------------------------------------------------------------------------------
 
+// Calculate the matrix of every node in its default position, relative to the root, into gAbsoluteMatrices. The root
+// itself is at the origin - an instance's world matrix replaces it
+void Mesh::CalculateDefaultMatrices()
+{
+	std::vector<CMatrix4x4>& absoluteMatrices = gAbsoluteMatrices;
+	if (absoluteMatrices.size() < mNodes.size())  absoluteMatrices.resize(mNodes.size());
+	absoluteMatrices[0] = MatrixIdentity();
+	for (unsigned int nodeIndex = 1; nodeIndex < mNodes.size(); ++nodeIndex)
+	{
+		absoluteMatrices[nodeIndex] = mNodes[nodeIndex].defaultMatrix * absoluteMatrices[mNodes[nodeIndex].parentIndex];
+	}
+}
+
+
+// Calculate the bounding sphere of each node from the bounds of its sub-meshes, and the sphere around the whole mesh in its
+// default pose. Call after loading
+void Mesh::CalculateNodeBounds()
+{
+	for (auto& node : mNodes)
+	{
+		BoundingBox box;
+		for (auto subMeshIndex : node.subMeshes)  box.Add(mSubMeshes[subMeshIndex].bounds);
+		node.bounds = SphereFromBox(box);
+	}
+
+	// Box around the node spheres in their default positions, then the sphere around that
+	CalculateDefaultMatrices();
+	BoundingBox meshBox;
+	for (unsigned int nodeIndex = 0; nodeIndex < mNodes.size(); ++nodeIndex)
+	{
+		BoundingSphere sphere = TransformSphere(mNodes[nodeIndex].bounds, gAbsoluteMatrices[nodeIndex]);
+		if (sphere.radius < 0)  continue;
+		CVector3 extent = { sphere.radius, sphere.radius, sphere.radius };
+		meshBox.Add(sphere.centre - extent);
+		meshBox.Add(sphere.centre + extent);
+	}
+	mDefaultBounds = SphereFromBox(meshBox);
+}
+
+
+// Change the number of subdivisions of a bufferless grid, does nothing for other meshes
+void Mesh::SetGridSubdivisions(int subDivX, int subDivZ)
+{
+	if (!mBufferlessGrid)  return;
+
+	mGridSubDivX = (std::max)(subDivX, 1);
+	mGridSubDivZ = (std::max)(subDivZ, 1);
+	mSubMeshes[0].numVertices = (mGridSubDivX + 1) * (mGridSubDivZ + 1);
+	mSubMeshes[0].numIndices  = 0;
+}
+
+
 // Count the number of nodes with given assimp node as root - recursive
 unsigned int Mesh::CountNodes(aiNode* assimpNode)
 {
@@ -6,15 +6,104 @@
 // expected to select these things
 
 #include "CMatrix4x4.h"
+#include "Frustum.h"
+#include "LinearAllocator.h"
 #define NOMINMAX // Use this to stop Windows headers defining "min" and "max", which breaks some libraries (e.g. assimp)
 #include <d3d11.h>
 #include <assimp/scene.h>
+#include <assimp/postprocess.h>
 #include <string>
 #include <vector>
+#include <memory>
+#include <cstdint>
 
 #ifndef _MESH_H_INCLUDED_
 #define _MESH_H_INCLUDED_
 
+
+//--------------------------------------------------------------------------------------
+// Mesh loader settings
+//--------------------------------------------------------------------------------------
+
+// Settings used for every mesh file imported with assimp. Change gMeshLoaderSettings before loading meshes
+struct MeshLoaderSettings
+{
+	// Assimp log output (to the debugger output window). Logging slows down imports a lot, especially verbose logging,
+	// so it is off in release builds - assimp then uses a null logger that costs nothing
+	enum class LogLevel { None, Normal, Verbose };
+#ifdef _DEBUG
+	LogLevel logLevel = LogLevel::Normal;
+#else
+	LogLevel logLevel = LogLevel::None;
+#endif
+
+	// Assimp post-processing steps. Right click any of these and "Peek Definition" to see documention for each one
+	// aiProcess_CalcTangentSpace is added for meshes that require tangents
+	unsigned int postProcessFlags = aiProcess_MakeLeftHanded |
+		aiProcess_GenSmoothNormals |
+		aiProcess_FixInfacingNormals |
+		aiProcess_GenUVCoords |
+		aiProcess_TransformUVCoords |
+		aiProcess_FlipUVs |
+		aiProcess_FlipWindingOrder |
+		aiProcess_Triangulate |
+		aiProcess_JoinIdenticalVertices |
+		aiProcess_ImproveCacheLocality |
+		aiProcess_SortByPType |
+		aiProcess_FindInvalidData |
+		aiProcess_OptimizeMeshes |
+		aiProcess_FindInstances |
+		aiProcess_FindDegenerates |
+		aiProcess_RemoveRedundantMaterials |
+		aiProcess_Debone |
+		aiProcess_SplitByBoneCount |
+		aiProcess_LimitBoneWeights |
+		aiProcess_RemoveComponent;
+
+	float smoothingAngle = 80.0f; // Maximum angle in degrees between faces that share smoothed normals
+
+	// Maximum bones that can affect one vertex, and maximum bones affecting a single sub-mesh
+	unsigned int maxBonesPerVertex = 4;   // The shaders support up to 4 bones per vertex (null bones are added if necessary)
+	unsigned int maxBonesPerMesh   = 256; // Bone indexes are stored in a byte, so no more than 256
+
+	// Store vertices in a compact quantised layout: 16-bit positions relative to the mesh bounds, octahedral normals and
+	// tangents in 32 bits each and half-float UVs. About half the size of the full float layout, so less memory and less
+	// vertex fetching in every pass. Shaders must decode the normals with ModelNormal (see Common.hlsli)
+	bool quantiseVertices = false;
+
+	// Reorder the triangles and vertices of each sub-mesh for vertex cache reuse, less overdraw and in-order vertex fetching
+	// (see MeshOptimiser.h). Done once when a mesh is imported, the result is kept in the cooked mesh. The vertex cache
+	// results are reported in the debugger output window
+	bool optimiseMeshes = true;
+
+	// Number of coarser levels of detail made for each sub-mesh by simplifying it (see MeshOptimiser.h), each with about half
+	// the triangles of the one before. They use the same vertices, only adding indices, and are kept in the cooked mesh.
+	// Render chooses one from the size of the mesh on screen. 0 for no levels of detail
+	unsigned int maxLods = 3;
+
+	// Load the cooked mesh file saved by an earlier import when it is up to date, and save one after importing. Turn off to
+	// import every mesh with assimp, e.g. to time imports (see RunLoadBenchmark in Benchmark.h)
+	bool useCookedMeshes = true;
+
+	// Take the temporary data of each load (vertices, indices and the data for the mesh buffers) from linear allocators reset
+	// once the mesh's buffers are created, rather than from the heap (see LinearAllocator.h) - one kept by the loading thread
+	// and one for each sub-mesh, as they are converted in parallel. Only turned off to compare load times
+	bool useImportArena = true;
+
+	// Also keep the positions of rigid meshes in a separate, tightly packed vertex buffer, read by position only draws (the
+	// shadow maps) instead of the full vertices, so they fetch 8 or 12 bytes a vertex rather than 20 to 56. Costs the memory
+	// of the extra copy of the positions. Skinned meshes draw their models' skinned vertices, which have no separate positions
+	bool positionStreams = true;
+};
+
+extern MeshLoaderSettings gMeshLoaderSettings;
+
+// Start / stop the assimp logger chosen in gMeshLoaderSettings. The logger is shared by all imports, so it is created once
+// before loading meshes, rather than for each one. Loading meshes without calling these is fine, there is no logging
+void InitMeshLoader();
+void ShutdownMeshLoader();
+
+
 class Mesh
 {
 //--------------------------------------------------------------------------------------
@@ -31,7 +120,14 @@ public:
 	// Special mesh constructor for water lab - creates a grid (no model file required)
 	// Create a grid in the XZ plane from minPt to maxPt with the given number of subdivisions in X and Z. 
 	// Optionally select whether to create normals (upwards), and/or UVs (0->1 square over the entire grid)
-	Mesh(CVector3 minPt, CVector3 maxPt, int subDivX, int subDivZ, bool normals = false, bool uvs = true );
+	// A bufferless grid has no vertex or index buffers at all, the vertex shader generates the vertices from the vertex and
+	// instance IDs (see GridVertexPosition in Common.hlsli). It needs a shader written for it, normals and uvs are ignored
+	// and it can't be tessellated, but it uses no GPU memory and its subdivisions can be changed at any time (see below)
+	Mesh(CVector3 minPt, CVector3 maxPt, int subDivX, int subDivZ, bool normals = false, bool uvs = true, bool bufferless = false);
+
+	// Creates a box filling the given bounds, with normals and UVs (0->1 across each face). Used as a stand-in for a mesh
+	// that is still loading (see InitGeometry in Scene.cpp)
+	Mesh(const BoundingBox& box);
 
 	~Mesh();
 
@@ -40,14 +136,83 @@ public:
 	// or bones (skinned animation), or they can be dummy nodes to create child parts in a more convenient way
 	unsigned int NumberNodes()  { return static_cast<unsigned int>(mNodes.size()); }
 
+	// Sphere around the whole mesh in its default pose, relative to the root node
+	BoundingSphere Bounds()  { return mDefaultBounds; }
+
     // The default matrix for a given node - used to set the initial position for a new model
     CMatrix4x4 GetNodeDefaultMatrix(unsigned int node) { return mNodes[node].defaultMatrix; }
 
+	// The name of a node in the mesh file, e.g. to match the tracks of its animations to it (see Animation.h)
+	const std::string& GetNodeName(unsigned int node)  { return mNodes[node].name; }
+
+
+	// Whether the mesh is skinned, i.e. its vertices are moved by bones rather than each node moving its own sub-meshes
+	bool HasBones()  { return mHasBones; }
 
-	// Render the mesh with the given matrices
+
+	// Bring the absolute (world) matrices for a model up to date from its matrices (see Model.h). Only the nodes marked in
+	// dirtyNodes and the nodes below them in the hierarchy are recalculated, and the marks are cleared. For skinned meshes
+	// the bone matrices (absolute matrices combined with each bone's offset) are updated too, otherwise they are not used
+	void UpdateAbsoluteMatrices(const std::vector<CMatrix4x4>& modelMatrices, std::vector<char>& dirtyNodes,
+	                            std::vector<CMatrix4x4>& absoluteMatrices, std::vector<CMatrix4x4>& boneMatrices);
+
+	// Render the mesh with the given absolute matrices from UpdateAbsoluteMatrices. A single node mesh can be given its world
+	// matrix directly. Skinned meshes draw a model's skinned vertex buffers instead, one for each sub-mesh (see Skin)
 	// Handles rigid body meshes (including single part meshes) as well as skinned meshes
 	// LIMITATION: The mesh must use a single texture throughout
-	void Render(std::vector<CMatrix4x4>& modelMatrices, bool useTessellation = false);
+	// Levels of detail are chosen from the pixels a world space distance of 1 covers at the mesh: the coarsest level whose
+	// surface is less than a pixel from the full mesh is drawn. Pass a smaller value to allow more error, 0 for full detail
+	// Position only draws give the vertex shader just the vertex positions, for depth only passes like the shadow maps
+	void Render(const std::vector<CMatrix4x4>& absoluteMatrices, bool useTessellation = false,
+	            ID3D11Buffer* const* skinnedVertices = nullptr, float lodPixelsPerUnit = 0, bool positionOnly = false);
+
+	// Test if any part of the mesh, positioned with the given absolute matrices, might be inside the given view frustum. Uses the bounding
+	// spheres of the nodes calculated when the mesh was loaded. Skinned meshes are always visible - their vertices follow the bones
+	bool IsVisible(const std::vector<CMatrix4x4>& absoluteMatrices, const Frustum& frustum);
+
+
+	// Skinned meshes are skinned once per frame by a compute shader rather than in the vertex shader of every pass. Each
+	// model using the mesh has its own vertex buffers for the result, one for each sub-mesh, created here. The buffers are
+	// added to the vectors as they are created so the caller can release them if this fails
+	// Will throw a std::runtime_error exception on failure (same as the constructor)
+	void CreateSkinnedVertexBuffers(std::vector<ID3D11Buffer*>& buffers, std::vector<ID3D11UnorderedAccessView*>& views);
+
+	// Move the vertices by the given bone matrices (a structured buffer of the matrices from UpdateAbsoluteMatrices) into a
+	// model's skinned vertex buffers. Call when the bones have moved, before rendering. Does nothing for rigid meshes
+	void Skin(ID3D11ShaderResourceView* boneMatrices, ID3D11UnorderedAccessView* const* skinnedVertices);
+
+
+	// Render many copies of the mesh in one draw call per sub-mesh. The vertex shader gets the world matrix of each instance
+	// from a buffer using SV_InstanceID (see InstancedModel.h), the nodes are placed relative to it in their default positions
+	// LIMITATION: Rigid meshes only - skinned meshes and bufferless grids are not drawn
+	// With an indirect arguments buffer (see GetIndirectArgs) the number of instances comes from the buffer instead, e.g.
+	// written on the GPU after culling the instances there
+	void RenderInstanced(unsigned int numInstances, ID3D11Buffer* indirectArgs = nullptr);
+
+	// Get the arguments to draw all copies of each sub-mesh with DrawIndexedInstancedIndirect, one entry for each sub-mesh
+	// in order, with the instance count left at 0 to be filled in. For the indirect arguments buffer used by RenderInstanced
+	void GetIndirectArgs(std::vector<D3D11_DRAW_INDEXED_INSTANCED_INDIRECT_ARGS>& args);
+
+	// Sphere around the whole mesh in its default pose, relative to the root node
+	const BoundingSphere& DefaultBounds()  { return mDefaultBounds; }
+
+	// Test if a copy of the mesh in its default pose, placed with the given world matrix, might be inside the given view frustum
+	bool IsInstanceVisible(const CMatrix4x4& worldMatrix, const Frustum& frustum);
+
+	// GPU memory used by the mesh's vertex and index buffers (bytes), e.g. to keep streamed meshes in a budget (see WorldStreamer.h)
+	// A grid's index buffer shared with other grids is counted in full by each
+	size_t GpuBytes();
+
+
+	// Change the number of subdivisions of a bufferless grid (see constructor above), does nothing for other meshes. Cheap,
+	// nothing is created on the GPU
+	void SetGridSubdivisions(int subDivX, int subDivZ);
+	int  GridSubDivX()  { return mGridSubDivX; }
+	int  GridSubDivZ()  { return mGridSubDivZ; }
+
+	// Matrix placing the vertices of a bufferless grid, which are generated 0->1 across it, when its model has the given world
+	// matrix. The vertex shader's world matrix, for compute shaders that make the grid's vertices (see WaterVertexCache.h)
+	CMatrix4x4 GridWorldMatrix(const CMatrix4x4& worldMatrix)  { return mPositionDecodeMatrix * worldMatrix; }
 
 
 
@@ -57,18 +222,42 @@ public:
 private:
 
 	// A mesh is made of multiple sub-meshes. Each one uses a single material (texture).
-	// Each sub-mesh has a vertex / index buffer on the GPU. Could share buffers for performance but that would be complex.
+	// The vertices and indices of all the sub-meshes are in one vertex buffer and one index buffer for the whole mesh, so the
+	// buffers are bound once for the mesh and each sub-mesh is a single draw of its part of them
 	struct SubMesh
 	{
 		unsigned int       vertexSize = 0;         // Size in bytes of a single vertex (depends on what it contains, uvs, tangents etc.)
 		ID3D11InputLayout* vertexLayout = nullptr; // DirectX specification of data held in a single vertex
+		ID3D11InputLayout* positionLayout = nullptr; // Only the position, for position only draws. Read from mPositionBuffer
+		                                             // when the mesh has one, otherwise from the full vertices
+		unsigned int       positionSize = 0;        // Size in bytes of a position in mPositionBuffer, 0 if it isn't used
 
-		// GPU-side vertex and index buffers
+		// Where the sub-mesh's part of the mesh buffers starts, in vertices of this sub-mesh's size / indices of its format.
+		// Indices are relative to the first vertex, so 16-bit indices still work however large the whole mesh is
 		unsigned int       numVertices = 0;
-		ID3D11Buffer*      vertexBuffer = nullptr;
+		unsigned int       baseVertex  = 0;
+		unsigned int       basePosition = 0; // The same in mPositionBuffer, in positions of this sub-mesh's size
+
+		// Skinned meshes only - this sub-mesh's vertices as raw data and the settings for the skinning shader (see Skin)
+		ID3D11ShaderResourceView* vertexBufferSRV   = nullptr;
+		ID3D11Buffer*             skinningConstants = nullptr;
 
 		unsigned int       numIndices = 0;
-		ID3D11Buffer*      indexBuffer  = nullptr;
+		unsigned int       startIndex = 0;
+		DXGI_FORMAT        indexFormat  = DXGI_FORMAT_R32_UINT; // 16-bit indices are used when there are few enough vertices
+
+		// Coarser levels of detail, coarsest last, each a triangle list using the same vertices. Their indices follow the
+		// sub-mesh's own in the index buffer. The error is the furthest the surface moved, in the space of the node
+		struct Lod
+		{
+			unsigned int numIndices = 0;
+			unsigned int startIndex = 0;
+			float        error = 0;
+		};
+		std::vector<Lod>   lods;
+		unsigned int       numLodIndices = 0; // Total of the levels' indices
+
+		BoundingBox        bounds; // Around the sub-mesh vertices, in the space of the node that renders it
 	};
 
 
@@ -88,6 +277,31 @@ private:
 
 		std::vector<unsigned int> childNodes; // Child nodes that are controlled by this node (indexes into the mNodes vector below)
 		std::vector<unsigned int> subMeshes;  // The geometry representing this node (indexes into the mSubMeshes vector below)
+
+		BoundingSphere bounds; // Around this node's sub-meshes, in the node's space. Empty if it has no sub-meshes
+	};
+
+
+	// CPU-side copy of a sub-mesh's data kept after importing a mesh, until it has been saved in a cooked mesh file. The indices
+	// of the levels of detail follow the sub-mesh's own
+	// The data comes from the loading thread's import arena (see useImportArena in MeshLoaderSettings)
+	struct CookedSubMesh
+	{
+		ArenaVector<D3D11_INPUT_ELEMENT_DESC> vertexElements;
+		ArenaVector<unsigned char>            vertices;
+		ArenaVector<unsigned char>            indices;
+	};
+
+	// The vertices and indices of the sub-meshes collected while loading, to create the mesh buffers from, and the positions
+	// on their own when they are kept separately too (see positionStreams in MeshLoaderSettings). Taken from the given linear
+	// allocator, or the heap if nullptr
+	struct MeshBufferData
+	{
+		MeshBufferData(LinearAllocator* arena = nullptr) : vertices(arena), positions(arena), indices(arena) {}
+
+		ArenaVector<unsigned char> vertices;
+		ArenaVector<unsigned char> positions;
+		ArenaVector<unsigned char> indices;
 	};
 
 
@@ -103,7 +317,43 @@ private:
 	unsigned int ReadNodes(aiNode* assimpNode, unsigned int nodeIndex, unsigned int parentIndex);
 
 	// Helper function for Render function - renders a given sub-mesh. World matrices / textures / states etc. must already be set
-	void RenderSubMesh(const SubMesh& subMesh, bool useTessellation = false);
+	// A vertex buffer with the same layout holding just this sub-mesh can be given to draw instead. The level of detail is
+	// chosen from the pixels a distance of 1 in the node's space covers (see Render)
+	void RenderSubMesh(const SubMesh& subMesh, bool useTessellation = false, unsigned int numInstances = 1,
+	                   ID3D11Buffer* vertexBuffer = nullptr, float lodPixelsPerUnit = 0, bool positionOnly = false);
+
+	// Set the vertex / index buffers, vertex layout and topology to draw a sub-mesh, as used by RenderSubMesh. Returns the
+	// base vertex to draw with, which depends on the buffer chosen
+	unsigned int SetSubMeshBuffers(const SubMesh& subMesh, bool useTessellation, ID3D11Buffer* vertexBuffer, bool positionOnly = false);
+
+	// Calculate the matrix of every node in its default position, relative to the root, into gAbsoluteMatrices
+	void CalculateDefaultMatrices();
+
+	// Calculate the bounding sphere of each node from the bounds of its sub-meshes, and the sphere around the whole mesh in its
+	// default pose. Call after loading
+	void CalculateNodeBounds();
+
+
+	// Load / save the mesh as a "cooked" mesh file - the result of a previous import, which loads much faster (see Mesh.cpp)
+	// Load returns false if the file doesn't exist or wasn't made from the mesh file with the given hash
+	bool LoadCookedMesh(const std::string& cookedFileName, uint64_t sourceHash);
+	void SaveCookedMesh(const std::string& cookedFileName, uint64_t sourceHash, const ArenaVector<CookedSubMesh>& subMeshData);
+
+	// Create the vertex layout for a sub-mesh and add its vertices and indices to the data for the mesh buffers. The indices
+	// include those of its levels of detail, which must have their sizes set. Throws a std::runtime_error exception on failure
+	void CreateSubMeshResources(SubMesh& subMesh, const D3D11_INPUT_ELEMENT_DESC* vertexElements, unsigned int numVertexElements,
+	                            const void* vertices, const void* indices, MeshBufferData& bufferData, const std::string& name);
+
+	// Create the mesh vertex and index buffers once all the sub-meshes have been added to the data. Throws a std::runtime_error
+	// exception on failure
+	void CreateMeshBuffers(const MeshBufferData& bufferData, const std::string& name);
+
+	// Release the GPU resources of the mesh and all sub-meshes
+	void ReleaseSubMeshes();
+
+	// Choose the smallest index format that can index the given number of vertices, and get the size of an index in a format
+	static DXGI_FORMAT  ChooseIndexFormat(unsigned int numVertices);
+	static unsigned int IndexSize(DXGI_FORMAT indexFormat);
 
 
 
@@ -115,7 +365,33 @@ private:
     std::vector<SubMesh> mSubMeshes; // The mesh geometry. Nodes refer to sub-meshes in this vector
     std::vector<Node>    mNodes;     // The mesh hierarchy. First entry is root. remainder aree stored in depth-first order
 
+	// GPU-side vertex and index buffers holding every sub-mesh (see SubMesh). Sub-meshes with different vertex sizes or index
+	// formats share them, each starts at a multiple of its own vertex / index size
+	ID3D11Buffer* mVertexBuffer = nullptr;
+	ID3D11Buffer* mIndexBuffer  = nullptr;
+
+	// Grids with buffers share their index buffer with the other grids of the same topology (see CreateGridIndexBuffer in
+	// Mesh.cpp). mIndexBuffer then points at this buffer, which is released when the last grid using it is
+	std::shared_ptr<ID3D11Buffer> mSharedIndexBuffer;
+
+	// Just the positions of every sub-mesh, packed one after another, for position only draws (see positionStreams in
+	// MeshLoaderSettings). nullptr if the mesh doesn't have them, position only draws then read the full vertices
+	ID3D11Buffer* mPositionBuffer = nullptr;
+
+	// Around the whole mesh in its default pose, relative to the root node. Used to cull instances (see RenderInstanced)
+	BoundingSphere mDefaultBounds;
+
 	bool mHasBones; // If any submesh has bones, then all submeshes are given bones - makes rendering easier (one shader for the whole mesh)
+
+	// Whether the vertices use the quantised layout (see MeshLoaderSettings), and the matrix that converts the quantised
+	// positions (0->1 in a cube around the mesh) back to model space. It is combined with the world / bone matrices in Render
+	bool       mQuantisedVertices = false;
+	CMatrix4x4 mPositionDecodeMatrix = MatrixIdentity();
+
+	// Bufferless grids only (see constructor). The generated vertices are 0->1 across the grid, placed by mPositionDecodeMatrix
+	bool mBufferlessGrid = false;
+	int  mGridSubDivX = 0;
+	int  mGridSubDivZ = 0;
 };
 
 
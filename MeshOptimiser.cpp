@@ -0,0 +1,526 @@
+//--------------------------------------------------------------------------------------
+// Reordering of mesh triangles and vertices for faster rendering
+//--------------------------------------------------------------------------------------
+
+#include "MeshOptimiser.h"
+#include "CVector3.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <memory>
+
+
+//--------------------------------------------------------------------------------------
+// Analysis
+//--------------------------------------------------------------------------------------
+
+// Vertex reuse of a triangle list with a simulated first in, first out cache of the given number of vertices
+VertexCacheStats AnalyseVertexCache(const std::vector<uint32_t>& indices, size_t numVertices, unsigned int cacheSize /*= 16*/)
+{
+	VertexCacheStats stats;
+	if (indices.empty() || numVertices == 0)  return stats;
+
+	// A vertex is in the cache if it was added within the last cacheSize misses, no need to model the cache entries
+	std::vector<size_t> addedAt(numVertices, 0);
+	std::vector<char>   used(numVertices, 0);
+	size_t misses = 0;
+	size_t numUsed = 0;
+	for (auto index : indices)
+	{
+		if (!used[index] || misses - addedAt[index] >= cacheSize)
+		{
+			if (!used[index])  ++numUsed;
+			used[index] = 1;
+			addedAt[index] = misses++;
+		}
+	}
+
+	stats.acmr = static_cast<float>(misses) / (indices.size() / 3);
+	stats.atvr = static_cast<float>(misses) / numUsed;
+	return stats;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Vertex cache
+//--------------------------------------------------------------------------------------
+
+namespace
+{
+	// Size of the cache the scores are worked out for. Larger than real caches, so the order also suits larger caches
+	const int ScoreCacheSize = 32;
+
+	// Score of a vertex from its position in the cache (-1 if not in it) and the number of triangles still to draw that use
+	// it. Triangles using recently used vertices score highest, and vertices with few triangles left are boosted so they
+	// are finished off rather than left behind to be shaded again later. Values from Forsyth's article
+	float VertexScore(int cachePosition, unsigned int trianglesLeft)
+	{
+		if (trianglesLeft == 0)  return -1.0f;
+
+		float score = 0;
+		if (cachePosition >= 0)
+		{
+			// The last triangle's vertices score the same, otherwise the order would depend on the order within the triangle
+			if (cachePosition < 3)  score = 0.75f;
+			else                    score = std::pow(1.0f - (cachePosition - 3) / static_cast<float>(ScoreCacheSize - 3), 1.5f);
+		}
+		return score + 2.0f / std::sqrt(static_cast<float>(trianglesLeft));
+	}
+}
+
+
+// Reorder the triangles of a triangle list for vertex cache reuse. Each step draws the best scoring triangle using the
+// vertices in the cache, only those triangles need their scores updated. When there are none, the next triangle not yet
+// drawn is used
+void OptimiseVertexCache(std::vector<uint32_t>& indices, size_t numVertices)
+{
+	size_t numTriangles = indices.size() / 3;
+	if (numTriangles == 0)  return;
+
+	// Triangles using each vertex. Those still to draw are kept at the start of each vertex's list
+	std::vector<uint32_t> trianglesLeft(numVertices, 0);
+	for (auto index : indices)  ++trianglesLeft[index];
+	std::vector<uint32_t> firstTriangle(numVertices + 1, 0);
+	for (size_t v = 0; v < numVertices; ++v)  firstTriangle[v + 1] = firstTriangle[v] + trianglesLeft[v];
+	std::vector<uint32_t> vertexTriangles(indices.size());
+	{
+		std::vector<uint32_t> next(firstTriangle.begin(), firstTriangle.end() - 1);
+		for (size_t i = 0; i < indices.size(); ++i)  vertexTriangles[next[indices[i]]++] = static_cast<uint32_t>(i / 3);
+	}
+
+	std::vector<int>   cachePosition(numVertices, -1);
+	std::vector<float> vertexScore(numVertices);
+	for (size_t v = 0; v < numVertices; ++v)  vertexScore[v] = VertexScore(-1, trianglesLeft[v]);
+
+	std::vector<float> triangleScore(numTriangles);
+	std::vector<char>  drawn(numTriangles, 0);
+	for (size_t t = 0; t < numTriangles; ++t)
+	{
+		triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+	}
+
+	std::vector<uint32_t> newIndices;
+	newIndices.reserve(indices.size());
+	uint32_t cache[ScoreCacheSize + 3];
+	int      cacheCount = 0;
+	size_t   nextUndrawn = 0;
+	int64_t  best = -1;
+	while (newIndices.size() < indices.size())
+	{
+		if (best < 0)
+		{
+			while (drawn[nextUndrawn])  ++nextUndrawn;
+			best = static_cast<int64_t>(nextUndrawn);
+		}
+
+		// Draw the triangle, removing it from the lists of triangles left for its vertices
+		const uint32_t* triangle = &indices[best * 3];
+		drawn[best] = 1;
+		for (int i = 0; i < 3; ++i)
+		{
+			uint32_t v = triangle[i];
+			newIndices.push_back(v);
+			uint32_t* list = &vertexTriangles[firstTriangle[v]];
+			uint32_t* last = list + --trianglesLeft[v];
+			*std::find(list, last, static_cast<uint32_t>(best)) = *last;
+		}
+
+		// Its vertices go to the front of the cache, pushing the others back. Those pushed off the end are out of the cache
+		uint32_t newCache[ScoreCacheSize + 3] = { triangle[0], triangle[1], triangle[2] };
+		int newCount = 3;
+		for (int i = 0; i < cacheCount; ++i)
+		{
+			uint32_t v = cache[i];
+			if (v != triangle[0] && v != triangle[1] && v != triangle[2])  newCache[newCount++] = v;
+		}
+		for (int i = 0; i < newCount; ++i)  cachePosition[newCache[i]] = (i < ScoreCacheSize) ? i : -1;
+
+		// New scores for the vertices that moved and the triangles using them
+		for (int i = 0; i < newCount; ++i)
+		{
+			uint32_t v = newCache[i];
+			float score = VertexScore(cachePosition[v], trianglesLeft[v]);
+			float change = score - vertexScore[v];
+			vertexScore[v] = score;
+			for (uint32_t t = 0; t < trianglesLeft[v]; ++t)  triangleScore[vertexTriangles[firstTriangle[v] + t]] += change;
+		}
+		cacheCount = (std::min)(newCount, ScoreCacheSize);
+		std::copy(newCache, newCache + cacheCount, cache);
+
+		// The next triangle is the best one using a cached vertex
+		best = -1;
+		float bestScore = -1;
+		for (int i = 0; i < cacheCount; ++i)
+		{
+			uint32_t v = cache[i];
+			for (uint32_t t = 0; t < trianglesLeft[v]; ++t)
+			{
+				uint32_t candidate = vertexTriangles[firstTriangle[v] + t];
+				if (triangleScore[candidate] > bestScore)
+				{
+					bestScore = triangleScore[candidate];
+					best = candidate;
+				}
+			}
+		}
+	}
+
+	indices.swap(newIndices);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Overdraw
+//--------------------------------------------------------------------------------------
+
+// Reorder clusters of triangles of a cache optimised list to reduce overdraw. A cluster starts wherever a triangle has no
+// vertices in the cache, so changing the order of the clusters hardly changes the vertex reuse. Clusters facing out from
+// the centre of the mesh are drawn first - those on the outside of a convex-ish mesh, which hide the rest
+void OptimiseOverdraw(std::vector<uint32_t>& indices, const float* positions, size_t positionStride, size_t numVertices,
+                      float threshold /*= 1.05f*/)
+{
+	size_t numTriangles = indices.size() / 3;
+	if (numTriangles < 2)  return;
+
+	auto position = [&](uint32_t index)
+	{
+		return *reinterpret_cast<const CVector3*>(reinterpret_cast<const unsigned char*>(positions) + index * positionStride);
+	};
+
+	// Find the clusters using the same cache model as AnalyseVertexCache
+	const unsigned int CacheSize = 16;
+	std::vector<size_t> clusterStarts;
+	{
+		std::vector<size_t> addedAt(numVertices, 0);
+		std::vector<char>   used(numVertices, 0);
+		size_t misses = 0;
+		for (size_t t = 0; t < numTriangles; ++t)
+		{
+			int triangleMisses = 0;
+			for (int i = 0; i < 3; ++i)
+			{
+				uint32_t index = indices[t * 3 + i];
+				if (!used[index] || misses - addedAt[index] >= CacheSize)
+				{
+					used[index] = 1;
+					addedAt[index] = misses++;
+					++triangleMisses;
+				}
+			}
+			if (t == 0 || triangleMisses == 3)  clusterStarts.push_back(t);
+		}
+	}
+	if (clusterStarts.size() < 2)  return;
+	clusterStarts.push_back(numTriangles);
+
+	// Centre of the mesh, weighted by triangle area
+	CVector3 meshCentre = { 0, 0, 0 };
+	float    meshArea = 0;
+	for (size_t t = 0; t < numTriangles; ++t)
+	{
+		CVector3 p0 = position(indices[t * 3]), p1 = position(indices[t * 3 + 1]), p2 = position(indices[t * 3 + 2]);
+		float area = Length(Cross(p1 - p0, p2 - p0));
+		meshCentre += (p0 + p1 + p2) * (area / 3);
+		meshArea += area;
+	}
+	if (meshArea > 0)  meshCentre = meshCentre * (1 / meshArea);
+
+	// How much each cluster faces out from the centre of the mesh
+	struct Cluster
+	{
+		size_t start;
+		size_t end;
+		float  sortKey;
+	};
+	std::vector<Cluster> clusters;
+	for (size_t c = 0; c + 1 < clusterStarts.size(); ++c)
+	{
+		CVector3 centre = { 0, 0, 0 };
+		CVector3 normal = { 0, 0, 0 };
+		float    area = 0;
+		for (size_t t = clusterStarts[c]; t < clusterStarts[c + 1]; ++t)
+		{
+			CVector3 p0 = position(indices[t * 3]), p1 = position(indices[t * 3 + 1]), p2 = position(indices[t * 3 + 2]);
+			CVector3 triangleNormal = Cross(p1 - p0, p2 - p0); // Length is twice the area
+			float triangleArea = Length(triangleNormal);
+			centre += (p0 + p1 + p2) * (triangleArea / 3);
+			normal += triangleNormal;
+			area += triangleArea;
+		}
+		if (area > 0)  centre = centre * (1 / area);
+		float normalLength = Length(normal);
+		float sortKey = (normalLength > 0) ? Dot(centre - meshCentre, normal * (1 / normalLength)) : 0;
+		clusters.push_back({ clusterStarts[c], clusterStarts[c + 1], sortKey });
+	}
+	std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster& a, const Cluster& b) { return a.sortKey > b.sortKey; });
+
+	std::vector<uint32_t> newIndices;
+	newIndices.reserve(indices.size());
+	for (auto& cluster : clusters)
+	{
+		newIndices.insert(newIndices.end(), indices.begin() + cluster.start * 3, indices.begin() + cluster.end * 3);
+	}
+
+	// Keep the old order if the clusters lost too much vertex reuse between them
+	if (AnalyseVertexCache(newIndices, numVertices).acmr <= AnalyseVertexCache(indices, numVertices).acmr * threshold)
+	{
+		indices.swap(newIndices);
+	}
+}
+
+
+//--------------------------------------------------------------------------------------
+// Vertex fetch
+//--------------------------------------------------------------------------------------
+
+// Reorder the vertices into the order the indices first use them, and update the indices to match. Vertices no triangle uses
+// are removed. Returns the new number of vertices
+size_t OptimiseVertexFetch(std::vector<uint32_t>& indices, unsigned char* vertices, size_t numVertices, size_t vertexSize)
+{
+	const uint32_t Unused = 0xffffffff;
+	std::vector<uint32_t> newIndex(numVertices, Unused);
+	auto newVertices = std::make_unique<unsigned char[]>(numVertices * vertexSize);
+	uint32_t numUsed = 0;
+	for (auto& index : indices)
+	{
+		if (newIndex[index] == Unused)
+		{
+			memcpy(newVertices.get() + numUsed * vertexSize, vertices + index * vertexSize, vertexSize);
+			newIndex[index] = numUsed++;
+		}
+		index = newIndex[index];
+	}
+
+	memcpy(vertices, newVertices.get(), numUsed * vertexSize);
+	return numUsed;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Simplification
+//--------------------------------------------------------------------------------------
+
+namespace
+{
+	// Sum of squared distances to a set of planes, as a symmetric 4x4 matrix (Garland & Heckbert's quadric). Doubles as
+	// the values are sums of many small squares
+	struct Quadric
+	{
+		double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+
+		void AddPlane(double a, double b, double c, double d)
+		{
+			a2 += a * a;  ab += a * b;  ac += a * c;  ad += a * d;
+			b2 += b * b;  bc += b * c;  bd += b * d;
+			c2 += c * c;  cd += c * d;
+			d2 += d * d;
+		}
+
+		void Add(const Quadric& q)
+		{
+			a2 += q.a2;  ab += q.ab;  ac += q.ac;  ad += q.ad;  b2 += q.b2;
+			bc += q.bc;  bd += q.bd;  c2 += q.c2;  cd += q.cd;  d2 += q.d2;
+		}
+
+		// Sum of squared distances from the given point to the planes
+		double Error(const CVector3& p) const
+		{
+			double x = p.x, y = p.y, z = p.z;
+			double error = a2 * x * x + 2 * ab * x * y + 2 * ac * x * z + 2 * ad * x +
+			               b2 * y * y + 2 * bc * y * z + 2 * bd * y +
+			               c2 * z * z + 2 * cd * z + d2;
+			return (std::max)(error, 0.0);
+		}
+	};
+
+	struct Collapse
+	{
+		uint32_t from;
+		uint32_t to;
+		double   error;
+	};
+}
+
+
+// Simplify a triangle list down to about the given number of indices. Each pass finds the cost of moving each vertex onto each
+// of its neighbours, then makes the cheapest collapses that don't affect each other and don't flip any triangles over
+float SimplifyMesh(const std::vector<uint32_t>& indices, std::vector<uint32_t>& result, const float* positions,
+                   size_t positionStride, size_t numVertices, size_t targetIndexCount)
+{
+	result = indices;
+	if (indices.size() <= targetIndexCount)  return 0;
+
+	auto position = [&](uint32_t index)
+	{
+		return *reinterpret_cast<const CVector3*>(reinterpret_cast<const unsigned char*>(positions) + index * positionStride);
+	};
+
+	// Find the vertices sharing a position. Each position is represented by the first of its vertices
+	std::vector<uint32_t> positionIndex(numVertices);
+	{
+		std::vector<uint32_t> sorted(numVertices);
+		for (uint32_t v = 0; v < numVertices; ++v)  sorted[v] = v;
+		auto less = [&](uint32_t a, uint32_t b)
+		{
+			CVector3 pa = position(a), pb = position(b);
+			if (pa.x != pb.x)  return pa.x < pb.x;
+			if (pa.y != pb.y)  return pa.y < pb.y;
+			if (pa.z != pb.z)  return pa.z < pb.z;
+			return a < b;
+		};
+		std::sort(sorted.begin(), sorted.end(), less);
+		for (size_t i = 0; i < numVertices; ++i)
+		{
+			CVector3 p = position(sorted[i]);
+			bool same = (i > 0);
+			if (same)
+			{
+				CVector3 previous = position(sorted[i - 1]);
+				same = (previous.x == p.x && previous.y == p.y && previous.z == p.z);
+			}
+			positionIndex[sorted[i]] = same ? positionIndex[sorted[i - 1]] : sorted[i];
+		}
+	}
+
+	// Vertices that must stay where they are: those on a seam, and those on the edge of the mesh - where an edge between two
+	// positions is only used by one triangle. Seam vertices can't be collapsed onto either, it would be unclear which of the
+	// vertices at the position should be used
+	std::vector<char> seam(numVertices, 0), locked(numVertices, 0);
+	for (uint32_t v = 0; v < numVertices; ++v)
+	{
+		if (positionIndex[v] != v)  seam[v] = seam[positionIndex[v]] = 1;
+	}
+	for (uint32_t v = 0; v < numVertices; ++v)
+	{
+		if (seam[positionIndex[v]])  seam[v] = 1;
+		locked[v] = seam[v];
+	}
+	{
+		std::vector<std::pair<uint32_t, uint32_t>> edges;
+		for (size_t t = 0; t < indices.size(); t += 3)
+		{
+			for (int i = 0; i < 3; ++i)
+			{
+				uint32_t a = positionIndex[indices[t + i]], b = positionIndex[indices[t + (i + 1) % 3]];
+				edges.push_back({ (std::min)(a, b), (std::max)(a, b) });
+			}
+		}
+		std::sort(edges.begin(), edges.end());
+		for (size_t i = 0; i < edges.size();)
+		{
+			size_t j = i;
+			while (j < edges.size() && edges[j] == edges[i])  ++j;
+			if (j - i == 1)  locked[edges[i].first] = locked[edges[i].second] = 1;
+			i = j;
+		}
+		for (uint32_t v = 0; v < numVertices; ++v)  if (locked[positionIndex[v]])  locked[v] = 1;
+	}
+
+	// The planes of the triangles around each vertex
+	std::vector<Quadric> quadrics(numVertices, Quadric{});
+	for (size_t t = 0; t < indices.size(); t += 3)
+	{
+		CVector3 p0 = position(indices[t]), p1 = position(indices[t + 1]), p2 = position(indices[t + 2]);
+		CVector3 normal = Cross(p1 - p0, p2 - p0);
+		float length = Length(normal);
+		if (length <= 0)  continue;
+		normal = normal * (1 / length);
+		double d = -Dot(normal, p0);
+		for (int i = 0; i < 3; ++i)  quadrics[indices[t + i]].AddPlane(normal.x, normal.y, normal.z, d);
+	}
+
+	double maxError = 0;
+	std::vector<uint32_t> remap(numVertices);
+	std::vector<char>     touched(numVertices);
+	std::vector<uint32_t> firstTriangle(numVertices + 1), vertexTriangles;
+	std::vector<Collapse> collapses;
+	while (result.size() > targetIndexCount)
+	{
+		// Triangles using each vertex
+		std::fill(firstTriangle.begin(), firstTriangle.end(), 0);
+		for (auto index : result)  ++firstTriangle[index + 1];
+		for (size_t v = 0; v < numVertices; ++v)  firstTriangle[v + 1] += firstTriangle[v];
+		vertexTriangles.resize(result.size());
+		{
+			std::vector<uint32_t> next(firstTriangle.begin(), firstTriangle.end() - 1);
+			for (size_t i = 0; i < result.size(); ++i)  vertexTriangles[next[result[i]]++] = static_cast<uint32_t>(i / 3);
+		}
+
+		// Cost of each possible collapse along the edges of the triangles, cheapest first
+		collapses.clear();
+		for (size_t t = 0; t < result.size(); t += 3)
+		{
+			for (int i = 0; i < 3; ++i)
+			{
+				uint32_t a = result[t + i], b = result[t + (i + 1) % 3];
+				if (!locked[a] && !seam[b])  collapses.push_back({ a, b, quadrics[a].Error(position(b)) + quadrics[b].Error(position(b)) });
+				if (!locked[b] && !seam[a])  collapses.push_back({ b, a, quadrics[b].Error(position(a)) + quadrics[a].Error(position(a)) });
+			}
+		}
+		if (collapses.empty())  break;
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse& x, const Collapse& y) { return x.error < y.error; });
+
+		// Make the collapses in order, skipping any next to a vertex already changed this pass - their costs are out of date.
+		// Each collapse removes the triangles using both vertices, stop when enough have gone
+		for (uint32_t v = 0; v < numVertices; ++v)  remap[v] = v;
+		std::fill(touched.begin(), touched.end(), 0);
+		size_t indicesLeft = result.size();
+		size_t numCollapsed = 0;
+		for (auto& collapse : collapses)
+		{
+			if (indicesLeft <= targetIndexCount)  break;
+			if (touched[collapse.from] || touched[collapse.to])  continue;
+
+			// Moving the vertex mustn't turn any of its remaining triangles over
+			CVector3 to = position(collapse.to);
+			bool flips = false;
+			size_t removed = 0;
+			for (uint32_t i = firstTriangle[collapse.from]; i < firstTriangle[collapse.from + 1] && !flips; ++i)
+			{
+				const uint32_t* triangle = &result[vertexTriangles[i] * 3];
+				if (triangle[0] == collapse.to || triangle[1] == collapse.to || triangle[2] == collapse.to)
+				{
+					++removed;
+					continue;
+				}
+				CVector3 p[3], moved[3];
+				for (int k = 0; k < 3; ++k)
+				{
+					p[k] = moved[k] = position(triangle[k]);
+					if (triangle[k] == collapse.from)  moved[k] = to;
+				}
+				CVector3 oldNormal = Cross(p[1] - p[0], p[2] - p[0]);
+				CVector3 newNormal = Cross(moved[1] - moved[0], moved[2] - moved[0]);
+				flips = (Dot(oldNormal, newNormal) <= 0);
+			}
+			if (flips)  continue;
+
+			remap[collapse.from] = collapse.to;
+			quadrics[collapse.to].Add(quadrics[collapse.from]);
+			maxError = (std::max)(maxError, collapse.error);
+			for (uint32_t i = firstTriangle[collapse.from]; i < firstTriangle[collapse.from + 1]; ++i)
+			{
+				const uint32_t* triangle = &result[vertexTriangles[i] * 3];
+				touched[triangle[0]] = touched[triangle[1]] = touched[triangle[2]] = 1;
+			}
+			indicesLeft -= removed * 3;
+			++numCollapsed;
+		}
+		if (numCollapsed == 0)  break;
+
+		// Rebuild the triangle list without the triangles that have collapsed to a line
+		size_t numIndices = 0;
+		for (size_t t = 0; t < result.size(); t += 3)
+		{
+			uint32_t a = remap[result[t]], b = remap[result[t + 1]], c = remap[result[t + 2]];
+			if (a == b || b == c || c == a)  continue;
+			result[numIndices++] = a;
+			result[numIndices++] = b;
+			result[numIndices++] = c;
+		}
+		result.resize(numIndices);
+	}
+
+	return static_cast<float>(std::sqrt(maxError));
+}
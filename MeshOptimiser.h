@@ -0,0 +1,63 @@
+//--------------------------------------------------------------------------------------
+// Reordering of mesh triangles and vertices for faster rendering
+//--------------------------------------------------------------------------------------
+// The GPU keeps the results of the last few vertex shader runs, so a vertex used by several
+// triangles drawn close together is only shaded once. The order of the triangles decides how
+// often that happens, measured as ACMR (average cache miss ratio - vertices shaded per
+// triangle, 0.5 at best for a large grid, 3 at worst) or ATVR (average transform to vertex
+// ratio - times each vertex is shaded, 1 at best). Plain row order grids and many exported
+// meshes are well above the best values. Three steps are applied to each sub-mesh in turn:
+// - Vertex cache: reorder the triangles so each one reuses the vertices of recent ones, using
+//   Tom Forsyth's "Linear-Speed Vertex Cache Optimisation"
+// - Overdraw: split the new order into clusters where the cache starts from empty anyway, and
+//   draw the clusters facing out from the mesh first, so they hide the ones behind them. The
+//   clusters are kept in their old order if that costs too much vertex reuse
+// - Vertex fetch: reorder the vertices into the order the triangles first use them, so the
+//   vertex data is read from memory in order
+// Used when importing meshes (then stored in the cooked mesh) and for generated grids.
+//
+// Coarser levels of detail are made by simplifying the triangle list, collapsing edges so a
+// vertex moves onto a neighbouring one (quadric error metrics, Garland & Heckbert). Vertices
+// are never moved or created, only triangles removed, so every level of detail uses the same
+// vertices and only needs its own indices. Vertices on the edge of the mesh or on a seam
+// (several vertices at the same position with different normals or UVs) are never moved, so
+// the outline and texture mapping are kept.
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#ifndef _MESH_OPTIMISER_H_INCLUDED_
+#define _MESH_OPTIMISER_H_INCLUDED_
+
+
+// Vertex reuse of a triangle list with a simulated cache of the given number of vertices (first in, first out, as on
+// most GPUs). ACMR is vertices shaded per triangle, ATVR is vertices shaded per vertex used
+struct VertexCacheStats
+{
+	float acmr = 0;
+	float atvr = 0;
+};
+VertexCacheStats AnalyseVertexCache(const std::vector<uint32_t>& indices, size_t numVertices, unsigned int cacheSize = 16);
+
+
+// Reorder the triangles of a triangle list for vertex cache reuse
+void OptimiseVertexCache(std::vector<uint32_t>& indices, size_t numVertices);
+
+// Reorder clusters of triangles of a cache optimised list to reduce overdraw. Positions are 3 floats, the given number of
+// bytes apart. The old order is kept if the new one has an ACMR more than the given ratio worse
+void OptimiseOverdraw(std::vector<uint32_t>& indices, const float* positions, size_t positionStride, size_t numVertices,
+                      float threshold = 1.05f);
+
+// Reorder the vertices (each vertexSize bytes) into the order the indices first use them, and update the indices to match
+// Vertices no triangle uses are removed. Returns the new number of vertices
+size_t OptimiseVertexFetch(std::vector<uint32_t>& indices, unsigned char* vertices, size_t numVertices, size_t vertexSize);
+
+
+// Simplify a triangle list down to about the given number of indices, or as near as it can get, into result. Positions are
+// as for OptimiseOverdraw. Returns the largest distance a part of the surface moved, in the units of the positions
+float SimplifyMesh(const std::vector<uint32_t>& indices, std::vector<uint32_t>& result, const float* positions,
+                   size_t positionStride, size_t numVertices, size_t targetIndexCount);
+
+
+#endif //_MESH_OPTIMISER_H_INCLUDED_
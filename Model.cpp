@@ -6,10 +6,16 @@
 
 #include "Model.h"
 #include "Mesh.h"
+#include "StateCache.h"
 #include "GraphicsHelpers.h"
+#include "GpuMemory.h"
 #include "Common.h"
 
+#include <cstring>
+#include <stdexcept>
 
+
+// Will throw a std::runtime_error exception on failure (same as Mesh) - only models of skinned meshes can fail
 Model::Model(Mesh* mesh, CVector3 position /*= { 0,0,0 }*/, CVector3 rotation /*= { 0,0,0 }*/, float scale /*= 1*/)
     : mMesh(mesh)
 {
@@ -17,15 +23,124 @@ Model::Model(Mesh* mesh, CVector3 position /*= { 0,0,0 }*/, CVector3 rotation /*
     mWorldMatrices.resize(mesh->NumberNodes());
     for (int i = 0; i < mWorldMatrices.size(); ++i)
         mWorldMatrices[i] = mesh->GetNodeDefaultMatrix(i);
+    mDirtyNodes.resize(mWorldMatrices.size(), true);
+
+    if (!mesh->HasBones())  return;
+
+    // Skinned meshes - a bone matrix for every node. Dynamic so the CPU can rewrite it when the model moves
+    D3D11_BUFFER_DESC bufferDesc = {};
+    bufferDesc.ByteWidth           = sizeof(CMatrix4x4) * mesh->NumberNodes();
+    bufferDesc.Usage               = D3D11_USAGE_DYNAMIC;
+    bufferDesc.BindFlags           = D3D11_BIND_SHADER_RESOURCE;
+    bufferDesc.CPUAccessFlags      = D3D11_CPU_ACCESS_WRITE;
+    bufferDesc.MiscFlags           = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+    bufferDesc.StructureByteStride = sizeof(CMatrix4x4);
+    if (FAILED(gD3DDevice->CreateBuffer(&bufferDesc, nullptr, &mBoneBuffer)))
+    {
+        throw std::runtime_error("Error creating bone matrix buffer");
+    }
+    RegisterGpuResource(mBoneBuffer, "Models");
+
+    D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+    srvDesc.Format              = DXGI_FORMAT_UNKNOWN; // Structured buffers have no format
+    srvDesc.ViewDimension       = D3D11_SRV_DIMENSION_BUFFER;
+    srvDesc.Buffer.FirstElement = 0;
+    srvDesc.Buffer.NumElements  = mesh->NumberNodes();
+    if (FAILED(gD3DDevice->CreateShaderResourceView(mBoneBuffer, &srvDesc, &mBoneBufferSRV)))
+    {
+        ReleaseBuffers(); // Destructor isn't called when a constructor throws
+        throw std::runtime_error("Error creating bone matrix buffer view");
+    }
+
+    // The vertices moved by the bones, written by the skinning shader and drawn by every pass (see Mesh::Skin)
+    try
+    {
+        mesh->CreateSkinnedVertexBuffers(mSkinnedVertexBuffers, mSkinnedVertexUAVs);
+    }
+    catch (std::runtime_error&)
+    {
+        ReleaseBuffers();
+        throw;
+    }
+}
+
+Model::~Model()
+{
+    ReleaseBuffers();
+}
+
+
+// Release the GPU buffers of a skinned model
+void Model::ReleaseBuffers()
+{
+    for (auto view : mSkinnedVertexUAVs)       view->Release();
+    for (auto buffer : mSkinnedVertexBuffers)  buffer->Release();
+    mSkinnedVertexUAVs.clear();
+    mSkinnedVertexBuffers.clear();
+
+    if (mBoneBufferSRV)  mBoneBufferSRV->Release();
+    if (mBoneBuffer)     mBoneBuffer->Release();
+    mBoneBufferSRV = nullptr;
+    mBoneBuffer    = nullptr;
 }
 
 
 
 // The render function simply passes this model's matrices over to Mesh:Render.
 // All other per-frame constants must have been set already along with shaders, textures, samplers, states etc.
-void Model::Render(bool useTessellation /*= false*/)
+void Model::Render(bool useTessellation /*= false*/, float lodPixelsPerUnit /*= 0*/, bool positionOnly /*= false*/)
 {
-    mMesh->Render(mWorldMatrices, useTessellation);
+    UpdateMatrices();
+    mMesh->Render(mAbsoluteMatrices, useTessellation, mSkinnedVertexBuffers.data(), lodPixelsPerUnit, positionOnly);
+}
+
+
+// Recalculate the cached absolute matrices of any nodes that have changed since the last call, and upload the bone
+// matrices of a skinned model and skin its vertices. Render and IsVisible do this themselves, but call it before drawing
+// the model on several threads at once so they don't all try to
+void Model::UpdateMatrices()
+{
+    UpdateAbsoluteMatrices();
+
+    // Every pass that draws the model this frame uses the same skinned vertices, so the bone matrices are only sent to the
+    // GPU and the vertices skinned here, and only when the model has moved
+    if (mBonesDirty)
+    {
+        mBonesDirty = false;
+        D3D11_MAPPED_SUBRESOURCE mapped;
+        if (SUCCEEDED(gD3DContext->Map(mBoneBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped)))
+        {
+            std::memcpy(mapped.pData, mBoneMatrices.data(), sizeof(CMatrix4x4) * mBoneMatrices.size());
+            gD3DContext->Unmap(mBoneBuffer, 0);
+            CountMap(static_cast<unsigned int>(sizeof(CMatrix4x4) * mBoneMatrices.size()));
+        }
+        mMesh->Skin(mBoneBufferSRV, mSkinnedVertexUAVs.data());
+    }
+}
+
+// Only the CPU part of UpdateMatrices, safe to call for different models on different threads at once
+void Model::UpdateAbsoluteMatrices()
+{
+    if (!mAnyDirty)  return;
+    mMesh->UpdateAbsoluteMatrices(mWorldMatrices, mDirtyNodes, mAbsoluteMatrices, mBoneMatrices);
+    mAnyDirty = false;
+    mBonesDirty = (mBoneBuffer != nullptr);
+}
+
+
+// Test if any part of the model might be inside the given view frustum (e.g. from Camera::ViewFrustum), so it is worth
+// rendering. Uses bounding spheres, so it can be true for models just outside the frustum
+bool Model::IsVisible(const Frustum& frustum)
+{
+    UpdateMatrices();
+    return mMesh->IsVisible(mAbsoluteMatrices, frustum);
+}
+
+
+// Sphere around the whole model in world space, from the mesh's default pose
+BoundingSphere Model::Bounds()
+{
+    return TransformSphere(mMesh->Bounds(), mWorldMatrices[0]);
 }
 
 
@@ -34,7 +149,18 @@ void Model::Control(int node, float frameTime, KeyCode turnUp, KeyCode turnDown,
                                                KeyCode turnCW, KeyCode turnCCW, KeyCode moveForward, KeyCode moveBackward)
 {
     auto& matrix = mWorldMatrices[node]; // Use reference to node matrix to make code below more readable
+    CMatrix4x4 startMatrix = matrix;    // To see if anything changed
 
+    ControlMatrix(matrix, frameTime, turnUp, turnDown, turnLeft, turnRight, turnCW, turnCCW, moveForward, moveBackward);
+
+	// Only recalculate the absolute matrices if a key was actually held
+	if (std::memcmp(&matrix, &startMatrix, sizeof(CMatrix4x4)) != 0)  SetDirty(node);
+}
+
+// The same control of a world matrix that isn't in a model
+void Model::ControlMatrix(CMatrix4x4& matrix, float frameTime, KeyCode turnUp, KeyCode turnDown, KeyCode turnLeft, KeyCode turnRight,
+                                                              KeyCode turnCW, KeyCode turnCCW, KeyCode moveForward, KeyCode moveBackward)
+{
 	if (KeyHeld( turnUp ))
 	{
 		matrix = MatrixRotationX(ROTATION_SPEED * frameTime) * matrix;
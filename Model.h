@@ -3,11 +3,17 @@
 //--------------------------------------------------------------------------------------
 // Holds a pointer to a mesh as well as position, rotation and scaling, which are converted to a world matrix when required
 // This is more of a convenience class, the Mesh class does most of the difficult work.
+// The absolute (world) matrix of each node is cached and only recalculated for the nodes that have moved, so a model
+// that doesn't move costs no matrix work however many passes draw it
+// Models of skinned meshes keep their bone matrices in a GPU buffer sized for the mesh, and their own copy of the mesh
+// vertices moved by those bones. Both are updated only when the model moves and shared by every pass that draws it
 
 #include "CVector3.h"
 #include "CMatrix4x4.h"
+#include "Frustum.h"
 #include "Input.h"
 
+#include <d3d11.h>
 #include <vector>
 
 #ifndef _MODEL_H_INCLUDED_
@@ -22,18 +28,43 @@ public:
 	// Construction / Usage
 	//-------------------------------------
 
+    // Will throw a std::runtime_error exception on failure (same as Mesh) - only models of skinned meshes can fail
     Model(Mesh* mesh, CVector3 position = { 0,0,0 }, CVector3 rotation = { 0,0,0 }, float scale = 1);
+    ~Model();
 
 
     // The render function simply passes this model's matrices over to Mesh:Render.
     // All other per-frame constants must have been set already along with shaders, textures, samplers, states etc.
-    void Render(bool useTessellation = false);
+    // The mesh's level of detail is chosen from the pixels a distance of 1 covers at the model (see Mesh::Render)
+    // Position only draws give the vertex shader just the vertex positions, for depth only passes like the shadow maps
+    void Render(bool useTessellation = false, float lodPixelsPerUnit = 0, bool positionOnly = false);
+
+	// Recalculate the cached absolute matrices of any nodes that have changed since the last call, and upload the bone
+	// matrices of a skinned model. Render and IsVisible do this themselves, but call it before drawing the model on several
+	// threads at once so they don't all try to
+	void UpdateMatrices();
+
+	// Only the CPU part of UpdateMatrices, recalculating the absolute matrices. Uses no DirectX context, so different models
+	// can be updated on different threads at once. UpdateMatrices still needs calling after, to upload any bone matrices
+	void UpdateAbsoluteMatrices();
+
+	// Test if any part of the model might be inside the given view frustum (e.g. from Camera::ViewFrustum), so it is worth
+	// rendering. Uses bounding spheres, so it can be true for models just outside the frustum
+	bool IsVisible(const Frustum& frustum);
+
+	// Sphere around the whole model in world space, from the mesh's default pose. Moving parts may go outside it
+	BoundingSphere Bounds();
 
 
 	// Control a given node in the model using keys provided. Amount of motion performed depends on frame time
 	void Control(int node, float frameTime, KeyCode turnUp, KeyCode turnDown, KeyCode turnLeft, KeyCode turnRight,  
 				                            KeyCode turnCW, KeyCode turnCCW, KeyCode moveForward, KeyCode moveBackward );
 
+	// The same control of a world matrix that isn't in a model, e.g. a copy of a model's matrix being updated on another thread
+	// (see the scene update in Scene.cpp). Only reads the keys, so it is safe to call on any thread while no messages are handled
+	static void ControlMatrix(CMatrix4x4& matrix, float frameTime, KeyCode turnUp, KeyCode turnDown, KeyCode turnLeft, KeyCode turnRight,
+	                          KeyCode turnCW, KeyCode turnCCW, KeyCode moveForward, KeyCode moveBackward);
+
 
 	//-------------------------------------
 	// Data access
@@ -52,7 +83,15 @@ public:
 	CMatrix4x4 WorldMatrix(int node = 0)  { return mWorldMatrices[node]; }
 
     // Setters - model only stores matricies , so if user sets position, rotation or scale, just update those aspects of the matrix
-	void SetPosition(CVector3 position, int node = 0)  { mWorldMatrices[node].SetRow(3, position); }
+    // Each marks the node as changed so its absolute matrix (and those of the nodes below it) is recalculated when next needed
+	void SetPosition(CVector3 position, int node = 0)
+    {
+        // The scene sets some positions every frame whether they change or not, no need to recalculate anything then
+        CVector3 current = Position(node);
+        if (position.x == current.x && position.y == current.y && position.z == current.z)  return;
+        mWorldMatrices[node].SetRow(3, position);
+        SetDirty(node);
+    }
 
 	void SetRotation(CVector3 rotation, int node = 0)
     {
@@ -60,6 +99,7 @@ public:
         mWorldMatrices[node] = MatrixScaling(Scale(node)) *
                                MatrixRotationZ(rotation.z) * MatrixRotationX(rotation.x) * MatrixRotationY(rotation.y) *
                                MatrixTranslation(Position(node));
+        SetDirty(node);
     }
 
 	// Two ways to set scale: x,y,z separately, or all to the same value
@@ -69,22 +109,44 @@ public:
         mWorldMatrices[node].SetRow(0, Normalise(mWorldMatrices[node].GetRow(0)) * scale.x); 
         mWorldMatrices[node].SetRow(1, Normalise(mWorldMatrices[node].GetRow(1)) * scale.y); 
         mWorldMatrices[node].SetRow(2, Normalise(mWorldMatrices[node].GetRow(2)) * scale.z); 
+        SetDirty(node);
     }
 	void SetScale(float scale)  { SetScale({ scale, scale, scale });}
 
-    void SetWorldMatrix(CMatrix4x4 matrix, int node = 0)  { mWorldMatrices[node] = matrix; }
+    void SetWorldMatrix(CMatrix4x4 matrix, int node = 0)  { mWorldMatrices[node] = matrix;  SetDirty(node); }
 
 
 	//-------------------------------------
 	// Private data / members
 	//-------------------------------------
 private:
+	// Mark a node as changed, so its absolute matrix is recalculated by UpdateMatrices
+	void SetDirty(int node)  { mDirtyNodes[node] = true;  mAnyDirty = true; }
+
+	void ReleaseBuffers();
+
     Mesh* mMesh;
 
 	// World matrices for the model
     // Now that meshes have multiple parts, we need multiple matrices. The root matrix (the first one) is the world matrix
     // for the entire model. The remaining matrices are relative to their parent part. The hierarchy is defined in the mesh (nodes)
 	std::vector<CMatrix4x4> mWorldMatrices;
+
+	// Cached absolute (world) matrix for each node, and for skinned meshes each bone matrix (see Mesh::UpdateAbsoluteMatrices)
+	// The flags mark the nodes changed since they were last calculated
+	std::vector<CMatrix4x4> mAbsoluteMatrices;
+	std::vector<CMatrix4x4> mBoneMatrices;
+	std::vector<char>       mDirtyNodes;
+	bool                    mAnyDirty = true;
+	bool                    mBonesDirty = false; // Bone matrices recalculated but not yet uploaded
+
+	// GPU copy of mBoneMatrices for skinned meshes, read by the skinning shader as a structured buffer. Null for other meshes
+	ID3D11Buffer*             mBoneBuffer = nullptr;
+	ID3D11ShaderResourceView* mBoneBufferSRV = nullptr;
+
+	// Skinned meshes only - the mesh vertices moved by the bones, one buffer for each sub-mesh (see Mesh::Skin)
+	std::vector<ID3D11Buffer*>              mSkinnedVertexBuffers;
+	std::vector<ID3D11UnorderedAccessView*> mSkinnedVertexUAVs;
 };
 
 
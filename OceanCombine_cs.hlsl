@@ -0,0 +1,52 @@
+//--------------------------------------------------------------------------------------
+// Ocean combine compute shader
+//--------------------------------------------------------------------------------------
+// Final step of the ocean simulation. Unpacks the results of the inverse FFT into the two textures used by the
+// water shaders: the displacement of the surface, and the slopes (for normals) with a foam amount. The foam
+// builds up where the waves are squashed and fades over time, read from last frame's texture at the same texel
+
+#include "OceanFFT.hlsli"
+
+
+//--------------------------------------------------------------------------------------
+// Textures
+//--------------------------------------------------------------------------------------
+
+Texture2DArray<float4> OceanFFTResult : register(t0); // Output of OceanFFT_cs, same layout as the output of OceanSpectrum_cs
+Texture2D<float4>      LastNormalFoam : register(t1); // Last frame's NormalFoamOut, for the foam left over
+
+RWTexture2D<float4> DisplacementOut : register(u0); // xyz offset of the water surface in world units (before wave scaling)
+RWTexture2D<float4> NormalFoamOut   : register(u1); // x, z slopes of the surface, the Jacobian and the amount of foam
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+[numthreads(OceanThreadGroupSize, OceanThreadGroupSize, 1)]
+void main(uint3 id : SV_DispatchThreadID)
+{
+	if (any(id.xy >= gOceanFFTSize))  return;
+
+	// The spectrum had its zero frequency in the centre - that shifts the FFT results, which flips the sign of every other texel
+	float sign = ((id.x + id.y) & 1) ? -1.0f : 1.0f;
+	float4 result0 = OceanFFTResult[uint3(id.xy, 0)] * sign;
+	float4 result1 = OceanFFTResult[uint3(id.xy, 1)] * sign;
+
+	float height = result0.x;
+	float displacementX = result0.y * gOceanChoppiness;
+	float displacementZ = result0.z * gOceanChoppiness;
+	DisplacementOut[id.xy] = float4(displacementX, height, displacementZ, 0);
+
+	// The Jacobian measures how much the horizontal displacement squashes the surface. It drops below 1 at sharp
+	// crests, and below 0 where the surface folds over itself - where waves break. Use that for foam
+	float jxx = 1 + gOceanChoppiness * result1.y;
+	float jzz = 1 + gOceanChoppiness * result1.z;
+	float jxz = gOceanChoppiness * result1.w;
+	float jacobian = jxx * jzz - jxz * jxz;
+	// Foam is always there while the surface is squashed, then lingers after the crest has passed
+	float newFoam = saturate(gOceanFoamThreshold - jacobian);
+	float foam = saturate(max(newFoam, LastNormalFoam[id.xy].w * gOceanFoamKeep + newFoam * gOceanFoamBuild));
+
+	NormalFoamOut[id.xy] = float4(result0.w, result1.x, jacobian, foam);
+}
@@ -0,0 +1,278 @@
+//--------------------------------------------------------------------------------------
+// Class encapsulating an FFT ocean simulation on the GPU
+//--------------------------------------------------------------------------------------
+
+#include "OceanFFT.h"
+#include "Shader.h"
+#include "Common.h"
+#include "GraphicsHelpers.h"
+#include "GpuEvents.h"
+#include "GpuMemory.h"
+
+#include <random>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+
+
+// Create the simulation with the given FFT size (128, 256 or 512). The ocean patch covers patchSize x patchSize
+// world units, and repeats beyond that. Wind direction and speed control the size and direction of the waves
+// Will throw a std::runtime_error exception on failure (same as Mesh)
+OceanFFT::OceanFFT(int resolution /*= 256*/, float patchSize /*= 200.0f*/, CVector2 windDirection /*= { 1.0f, 0.6f }*/, float windSpeed /*= 20.0f*/)
+	: mResolution(resolution), mPatchSize(patchSize), mWindDirection(Normalise(windDirection)), mWindSpeed(windSpeed)
+{
+	mConstantBuffer = CreateConstantBuffer(sizeof(OceanConstants));
+	if (mConstantBuffer == nullptr)  throw std::runtime_error("Error creating ocean constant buffer");
+
+	SetResolution(resolution);
+}
+
+OceanFFT::~OceanFFT()
+{
+	ReleaseTextures();
+	if (mConstantBuffer)  mConstantBuffer->Release();
+}
+
+
+// Change the FFT size (128, 256 or 512), recreating the textures. Throws a std::runtime_error exception on failure
+void OceanFFT::SetResolution(int resolution)
+{
+	// The FFT shader needs a power of two, and one thread per texel in each row (see OceanFFT_cs.hlsl)
+	if (resolution != 128 && resolution != 256 && resolution != 512)
+		throw std::runtime_error("Ocean FFT size must be 128, 256 or 512");
+
+	ReleaseTextures();
+	mResolution = resolution;
+	CreateTextures();
+}
+
+
+// Run the simulation for the given time in seconds. The foam builds up and fades by the time since the last call (up to
+// a limit, none if the time went back). Leaves the compute shader stage with nothing bound
+// The textures used by this class must not be bound to other shader stages when this is called
+void OceanFFT::Simulate(float time)
+{
+	ID3D11ShaderResourceView*  nullSRVs[2] = { nullptr, nullptr };
+	ID3D11ShaderResourceView*  nullSRV = nullptr;
+	ID3D11UnorderedAccessView* nullUAVs[2] = { nullptr, nullptr };
+
+	float foamStep = (std::min)((std::max)(time - mLastTime, 0.0f), MaxFoamStep);
+	mLastTime = time;
+
+	mConstants.time          = time;
+	mConstants.patchSize     = mPatchSize;
+	mConstants.choppiness    = Choppiness;
+	mConstants.foamThreshold = FoamThreshold;
+	mConstants.fftSize       = mResolution;
+	mConstants.fftDirection  = 0;
+	mConstants.foamBuild     = FoamBuildRate * FoamDecay * foamStep;
+	mConstants.foamKeep      = std::exp(-FoamDecay * foamStep);
+	UpdateConstantBuffer(mConstantBuffer, mConstants);
+	gD3DContext->CSSetConstantBuffers(0, 1, &mConstantBuffer);
+
+	unsigned int numGroups = mResolution / 16; // Must match OceanThreadGroupSize in OceanFFT.hlsli
+
+	// Animate the spectrum to the current time: initial spectrum -> spectrum 0
+	gD3DContext->CSSetShader(gOceanSpectrumComputeShader, nullptr, 0);
+	gD3DContext->CSSetShaderResources(0, 1, &mInitialSpectrumSRV);
+	gD3DContext->CSSetUnorderedAccessViews(0, 1, &mSpectrumUAV[0], nullptr);
+	gD3DContext->Dispatch(numGroups, numGroups, 1);
+
+	// Inverse FFT of rows: spectrum 0 -> spectrum 1. One thread group per row for each of the two slices
+	// A texture can't be bound for reading and writing at the same time, so unbind the UAV before using it as a shader resource
+	gD3DContext->CSSetShader(gOceanFFTComputeShader, nullptr, 0);
+	gD3DContext->CSSetUnorderedAccessViews(0, 1, &mSpectrumUAV[1], nullptr);
+	gD3DContext->CSSetShaderResources(0, 1, &mSpectrumSRV[0]);
+	gD3DContext->Dispatch(1, mResolution, 2);
+
+	// Inverse FFT of columns: spectrum 1 -> spectrum 0
+	mConstants.fftDirection = 1;
+	UpdateConstantBuffer(mConstantBuffer, mConstants);
+	gD3DContext->CSSetShaderResources(0, 1, &nullSRV);
+	gD3DContext->CSSetUnorderedAccessViews(0, 1, &mSpectrumUAV[0], nullptr);
+	gD3DContext->CSSetShaderResources(0, 1, &mSpectrumSRV[1]);
+	gD3DContext->Dispatch(1, mResolution, 2);
+
+	// Unpack the results into the displacement and the other normal/foam texture, adding to the foam in the last one
+	int lastNormalFoam = mCurrentNormalFoam;
+	mCurrentNormalFoam = 1 - mCurrentNormalFoam;
+	ID3D11UnorderedAccessView* outputUAVs[2] = { mDisplacementUAV, mNormalFoamUAV[mCurrentNormalFoam] };
+	ID3D11ShaderResourceView*  inputSRVs[2]  = { mSpectrumSRV[0], mNormalFoamSRV[lastNormalFoam] };
+	gD3DContext->CSSetShader(gOceanCombineComputeShader, nullptr, 0);
+	gD3DContext->CSSetShaderResources(0, 1, &nullSRV);
+	gD3DContext->CSSetUnorderedAccessViews(0, 2, outputUAVs, nullptr);
+	gD3DContext->CSSetShaderResources(0, 2, inputSRVs);
+	gD3DContext->Dispatch(numGroups, numGroups, 1);
+
+	// Unbind everything so the results can be used by the water shaders, then fill in the mip-maps for the pixel shader
+	gD3DContext->CSSetShaderResources(0, 2, nullSRVs);
+	gD3DContext->CSSetUnorderedAccessViews(0, 2, nullUAVs, nullptr);
+	gD3DContext->CSSetShader(nullptr, nullptr, 0);
+	gD3DContext->GenerateMips(mDisplacementSRV);
+	gD3DContext->GenerateMips(mNormalFoamSRV[mCurrentNormalFoam]);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions
+//--------------------------------------------------------------------------------------
+
+// Generate the initial wave heights / phases (Phillips spectrum) for the current resolution into the texture data
+// Each texel holds h0(k) and conj(h0(-k)), i.e. the wave with wave vector k and its conjugate travelling the opposite way
+void OceanFFT::GenerateInitialSpectrum(std::vector<float>& spectrumData)
+{
+	const float Pi = 3.14159265f;
+	const float Gravity = 9.81f;
+	int N = mResolution;
+
+	// Random gaussian numbers give each wave a random amplitude and phase. Fixed seed so the ocean looks the same each run
+	std::mt19937 randomGenerator(1234);
+	std::normal_distribution<float> gaussian(0.0f, 1.0f);
+	std::vector<CVector2> random(N * N);
+	for (auto& r : random)  r = { gaussian(randomGenerator), gaussian(randomGenerator) };
+
+	// Phillips spectrum: the average (squared) height of the wave with the given wave vector
+	float largestWave  = mWindSpeed * mWindSpeed / Gravity; // Largest waves the wind can make
+	float smallestWave = mPatchSize / N;                    // Suppress waves too small for the FFT to show properly
+	auto phillips = [&](CVector2 k)
+	{
+		float kLengthSq = Dot(k, k);
+		if (kLengthSq < 0.000001f)  return 0.0f;
+		float kDotWind = Dot(k, mWindDirection);
+		return std::exp(-1.0f / (kLengthSq * largestWave * largestWave)) / (kLengthSq * kLengthSq) *
+		       (kDotWind * kDotWind / kLengthSq) * std::exp(-kLengthSq * smallestWave * smallestWave);
+	};
+
+	// Fill in h0(k) and conj(h0(-k)) for each texel, the zero frequency is in the centre of the texture
+	spectrumData.resize(N * N * 4);
+	double totalVariance = 0;
+	for (int y = 0; y < N; ++y)
+	{
+		for (int x = 0; x < N; ++x)
+		{
+			CVector2 k = { 2 * Pi * (x - N / 2) / mPatchSize, 2 * Pi * (y - N / 2) / mPatchSize };
+			int mirrorX = (N - x) % N; // Texel for -k
+			int mirrorY = (N - y) % N;
+
+			CVector2 h0      = random[y * N + x]             * std::sqrt(phillips(k)  * 0.5f);
+			CVector2 h0Minus = random[mirrorY * N + mirrorX] * std::sqrt(phillips({ -k.x, -k.y }) * 0.5f);
+
+			float* texel = &spectrumData[(y * N + x) * 4];
+			texel[0] = h0.x;
+			texel[1] = h0.y;
+			texel[2] = h0Minus.x;
+			texel[3] = -h0Minus.y;
+			totalVariance += Dot(h0, h0) + Dot(h0Minus, h0Minus);
+		}
+	}
+
+	// The overall height of Phillips waves is usually tuned with a constant. Instead, scale the spectrum so the water has the
+	// required RMS height. The height variance is the sum of the squared wave heights, so this keeps the waves the same size
+	// whatever the FFT resolution, patch size and wind speed
+	if (totalVariance <= 0)  return;
+	float scale = RMSWaveHeight / static_cast<float>(std::sqrt(totalVariance));
+	for (auto& value : spectrumData)  value *= scale;
+}
+
+
+// Create the textures for the current resolution. Throws a std::runtime_error exception on failure
+void OceanFFT::CreateTextures()
+{
+	int N = mResolution;
+
+	// Initial spectrum, never changes so immutable texture created from the data generated above
+	std::vector<float> spectrumData;
+	GenerateInitialSpectrum(spectrumData);
+
+	D3D11_TEXTURE2D_DESC textureDesc = {};
+	textureDesc.Width  = N;
+	textureDesc.Height = N;
+	textureDesc.MipLevels = 1;
+	textureDesc.ArraySize = 1;
+	textureDesc.Format = DXGI_FORMAT_R32G32B32A32_FLOAT;
+	textureDesc.SampleDesc.Count = 1;
+	textureDesc.Usage = D3D11_USAGE_IMMUTABLE;
+	textureDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+	D3D11_SUBRESOURCE_DATA initData = {};
+	initData.pSysMem = spectrumData.data();
+	initData.SysMemPitch = N * 4 * sizeof(float);
+	if (FAILED(gD3DDevice->CreateTexture2D(&textureDesc, &initData, &mInitialSpectrum)) ||
+		FAILED(gD3DDevice->CreateShaderResourceView(mInitialSpectrum, nullptr, &mInitialSpectrumSRV)))
+	{
+		throw std::runtime_error("Error creating ocean initial spectrum");
+	}
+
+	// Spectrum / FFT working textures. Two slices, each holding two complex values per texel (see OceanSpectrum_cs.hlsl)
+	textureDesc.ArraySize = 2;
+	textureDesc.Usage = D3D11_USAGE_DEFAULT;
+	textureDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS;
+	for (int i = 0; i < 2; ++i)
+	{
+		if (FAILED(gD3DDevice->CreateTexture2D(&textureDesc, nullptr, &mSpectrum[i])) ||
+			FAILED(gD3DDevice->CreateShaderResourceView(mSpectrum[i], nullptr, &mSpectrumSRV[i])) ||
+			FAILED(gD3DDevice->CreateUnorderedAccessView(mSpectrum[i], nullptr, &mSpectrumUAV[i])))
+		{
+			throw std::runtime_error("Error creating ocean FFT textures");
+		}
+	}
+
+	// Output textures are half floats with a full set of mip-maps. The compute shader writes the top level (the default
+	// UAV is mip 0) and GenerateMips does the rest, which requires the render target bind flag
+	textureDesc.MipLevels = 0;
+	textureDesc.ArraySize = 1;
+	textureDesc.Format = DXGI_FORMAT_R16G16B16A16_FLOAT;
+	textureDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS | D3D11_BIND_RENDER_TARGET;
+	textureDesc.MiscFlags = D3D11_RESOURCE_MISC_GENERATE_MIPS;
+	if (FAILED(gD3DDevice->CreateTexture2D(&textureDesc, nullptr, &mDisplacement)) ||
+		FAILED(gD3DDevice->CreateShaderResourceView(mDisplacement, nullptr, &mDisplacementSRV)) ||
+		FAILED(gD3DDevice->CreateUnorderedAccessView(mDisplacement, nullptr, &mDisplacementUAV)))
+	{
+		throw std::runtime_error("Error creating ocean output textures");
+	}
+	for (int i = 0; i < 2; ++i)
+	{
+		if (FAILED(gD3DDevice->CreateTexture2D(&textureDesc, nullptr, &mNormalFoam[i])) ||
+			FAILED(gD3DDevice->CreateShaderResourceView(mNormalFoam[i], nullptr, &mNormalFoamSRV[i])) ||
+			FAILED(gD3DDevice->CreateUnorderedAccessView(mNormalFoam[i], nullptr, &mNormalFoamUAV[i])))
+		{
+			throw std::runtime_error("Error creating ocean output textures");
+		}
+
+		// The first frame adds to the foam in here, so start with none
+		const float noFoam[4] = { 0, 0, 0, 0 };
+		gD3DContext->ClearUnorderedAccessViewFloat(mNormalFoamUAV[i], noFoam);
+	}
+	SetDebugNames("Ocean Initial Spectrum", mInitialSpectrum, mInitialSpectrumSRV);
+	SetDebugNames("Ocean Spectrum 0", mSpectrum[0], mSpectrumSRV[0]);
+	SetDebugNames("Ocean Spectrum 1", mSpectrum[1], mSpectrumSRV[1]);
+	SetDebugNames("Ocean Displacement", mDisplacement, mDisplacementSRV);
+	SetDebugNames("Ocean Normal Foam 0", mNormalFoam[0], mNormalFoamSRV[0]);
+	SetDebugNames("Ocean Normal Foam 1", mNormalFoam[1], mNormalFoamSRV[1]);
+	for (ID3D11Resource* texture : { mInitialSpectrum, mSpectrum[0], mSpectrum[1], mDisplacement, mNormalFoam[0], mNormalFoam[1] })
+	{
+		RegisterGpuResource(texture, "Ocean");
+	}
+}
+
+
+// Release the textures - safe to call when they haven't been created
+void OceanFFT::ReleaseTextures()
+{
+	for (int i = 0; i < 2; ++i)
+	{
+		if (mNormalFoamUAV[i])  { mNormalFoamUAV[i]->Release();  mNormalFoamUAV[i] = nullptr; }
+		if (mNormalFoamSRV[i])  { mNormalFoamSRV[i]->Release();  mNormalFoamSRV[i] = nullptr; }
+		if (mNormalFoam[i])     { mNormalFoam[i]->Release();     mNormalFoam[i]    = nullptr; }
+	}
+	if (mDisplacementUAV)  { mDisplacementUAV->Release();  mDisplacementUAV  = nullptr; }
+	if (mDisplacementSRV)  { mDisplacementSRV->Release();  mDisplacementSRV  = nullptr; }
+	if (mDisplacement)     { mDisplacement->Release();     mDisplacement     = nullptr; }
+	for (int i = 0; i < 2; ++i)
+	{
+		if (mSpectrumUAV[i])  { mSpectrumUAV[i]->Release();  mSpectrumUAV[i] = nullptr; }
+		if (mSpectrumSRV[i])  { mSpectrumSRV[i]->Release();  mSpectrumSRV[i] = nullptr; }
+		if (mSpectrum[i])     { mSpectrum[i]->Release();     mSpectrum[i]    = nullptr; }
+	}
+	if (mInitialSpectrumSRV)  { mInitialSpectrumSRV->Release();  mInitialSpectrumSRV = nullptr; }
+	if (mInitialSpectrum)     { mInitialSpectrum->Release();     mInitialSpectrum    = nullptr; }
+}
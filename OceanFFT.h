@@ -0,0 +1,125 @@
+//--------------------------------------------------------------------------------------
+// Class encapsulating an FFT ocean simulation on the GPU
+//--------------------------------------------------------------------------------------
+// Instead of scrolling a fixed normal/height map, the waves are generated each frame from a
+// wave spectrum (the Phillips spectrum: wind-driven waves of many wavelengths, each moving at
+// its own speed). The spectrum is animated and converted to world space with an inverse FFT
+// in compute shaders, giving a square patch of ocean that tiles seamlessly. The results are
+// two textures used by the water shaders: surface displacement, and surface slopes with foam.
+// Foam is made where the waves are squashed (the Jacobian of the displacement) and builds up and
+// fades over time in the texture itself - each frame reads the last one's - so it trails behind
+// breaking crests. The water shaders get the result from a single fetch of the texture.
+// The FFT size can be chosen (128, 256 or 512) to trade detail for speed.
+
+#include "CVector2.h"
+#include <d3d11.h>
+#include <vector>
+
+#ifndef _OCEAN_FFT_H_INCLUDED_
+#define _OCEAN_FFT_H_INCLUDED_
+
+class OceanFFT
+{
+//--------------------------------------------------------------------------------------
+// Construction / Usage
+//--------------------------------------------------------------------------------------
+public:
+
+	// Create the simulation with the given FFT size (128, 256 or 512). The ocean patch covers patchSize x patchSize
+	// world units, and repeats beyond that. Wind direction and speed control the size and direction of the waves
+	// Will throw a std::runtime_error exception on failure (same as Mesh)
+	OceanFFT(int resolution = 256, float patchSize = 200.0f, CVector2 windDirection = { 1.0f, 0.6f }, float windSpeed = 20.0f);
+	~OceanFFT();
+
+	// Change the FFT size (128, 256 or 512), recreating the textures. Throws a std::runtime_error exception on failure
+	void SetResolution(int resolution);
+
+
+	// Run the simulation for the given time in seconds. The foam builds up and fades by the time since the last call (up to
+	// a limit, none if the time went back). Leaves the compute shader stage with nothing bound
+	// The textures used by this class must not be bound to other shader stages when this is called
+	void Simulate(float time);
+
+
+	// Textures for the water shaders. Displacement is xyz world offset, NormalFoam is x and z slopes, Jacobian and foam amount
+	// Both are mip-mapped and tile every PatchSize world units
+	ID3D11ShaderResourceView* DisplacementSRV()  { return mDisplacementSRV; }
+	ID3D11ShaderResourceView* NormalFoamSRV()    { return mNormalFoamSRV[mCurrentNormalFoam]; }
+
+	// The displacement texture itself, for copying back to the CPU (see WaterHeights.h)
+	ID3D11Texture2D* DisplacementTexture()  { return mDisplacement; }
+
+	int   Resolution()  { return mResolution; }
+	float PatchSize()   { return mPatchSize; }
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions / data
+//--------------------------------------------------------------------------------------
+private:
+
+	// Overall size of the waves. The spectrum is scaled so the root-mean-square height of the water is this many world units
+	// (before the user's wave scale) - the waves rarely go more than about three times this above or below the water plane
+	static constexpr float RMSWaveHeight = 2.5f;
+
+	static constexpr float Choppiness    = 1.0f; // Scale of horizontal displacement, sharpens crests. Too high and waves fold over
+	static constexpr float FoamThreshold = 0.6f; // Foam appears where the surface Jacobian is below this
+	static constexpr float FoamBuildRate = 2.0f; // Where the waves stay squashed the foam builds up to this many times what they make
+	static constexpr float FoamDecay     = 0.5f; // Part of the foam left is lost at this rate per second, so it trails the crests
+	static constexpr float MaxFoamStep   = 0.1f; // Most seconds of foam build up and decay in one call, after a pause or hitch
+
+	// Create / release the textures for the current resolution. Create throws a std::runtime_error exception on failure
+	void CreateTextures();
+	void ReleaseTextures();
+
+	// Generate the initial wave heights / phases (Phillips spectrum) for the current resolution into the texture data
+	void GenerateInitialSpectrum(std::vector<float>& spectrumData);
+
+
+	// Constants for the ocean compute shaders. There is a structure in the shader code that exactly matches this one
+	struct OceanConstants
+	{
+		float        time;
+		float        patchSize;
+		float        choppiness;
+		float        foamThreshold;
+
+		unsigned int fftSize;
+		unsigned int fftDirection;
+		float        foamBuild; // Foam added where the surface is squashed, and part of the last foam kept, since the last call
+		float        foamKeep;
+	};
+
+	int      mResolution;
+	float    mPatchSize;
+	CVector2 mWindDirection;
+	float    mWindSpeed;
+
+	float mLastTime = 0;
+
+	OceanConstants mConstants;
+	ID3D11Buffer*  mConstantBuffer = nullptr;
+
+	// Initial spectrum generated on the CPU
+	ID3D11Texture2D*          mInitialSpectrum    = nullptr;
+	ID3D11ShaderResourceView* mInitialSpectrumSRV = nullptr;
+
+	// Two 2-slice texture arrays, the FFT passes read one and write the other
+	ID3D11Texture2D*           mSpectrum[2]    = {};
+	ID3D11ShaderResourceView*  mSpectrumSRV[2] = {};
+	ID3D11UnorderedAccessView* mSpectrumUAV[2] = {};
+
+	// Final results
+	ID3D11Texture2D*           mDisplacement    = nullptr;
+	ID3D11ShaderResourceView*  mDisplacementSRV = nullptr;
+	ID3D11UnorderedAccessView* mDisplacementUAV = nullptr;
+
+	// Normal and foam textures, used in turn. The combine shader reads the foam of last frame's to write this frame's
+	ID3D11Texture2D*           mNormalFoam[2]     = {};
+	ID3D11ShaderResourceView*  mNormalFoamSRV[2]  = {};
+	ID3D11UnorderedAccessView* mNormalFoamUAV[2]  = {};
+	int                        mCurrentNormalFoam = 0; // The texture written by the last Simulate
+};
+
+
+#endif //_OCEAN_FFT_H_INCLUDED_
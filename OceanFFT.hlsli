@@ -0,0 +1,62 @@
+//--------------------------------------------------------------------------------------
+// Include file for the ocean FFT compute shaders
+//--------------------------------------------------------------------------------------
+// The ocean simulation (see OceanFFT.cpp) is done in three compute shader steps:
+//   OceanSpectrum_cs - animates the wave spectrum to the current time
+//   OceanFFT_cs      - inverse FFT of the spectrum into world space (run twice, rows then columns)
+//   OceanCombine_cs  - writes the final displacement, slope and foam textures used by the water shaders
+// The compute shaders don't use the rendering constant buffers so have their own, and don't include Common.hlsli
+
+#ifndef _OCEAN_FFT_HLSLI_DEFINED_
+#define _OCEAN_FFT_HLSLI_DEFINED_
+
+
+//--------------------------------------------------------------------------------------
+// Constants
+//--------------------------------------------------------------------------------------
+
+static const float Pi      = 3.14159265f;
+static const float Gravity = 9.81f;
+
+static const uint OceanThreadGroupSize = 16;  // Spectrum and combine shaders work on 16x16 blocks of texels
+static const uint MaxOceanFFTSize      = 512; // Largest FFT size supported, one thread per texel in a row / column of the FFT
+
+
+//--------------------------------------------------------------------------------------
+// Constant Buffers
+//--------------------------------------------------------------------------------------
+
+// These variables must match exactly the OceanConstants structure in OceanFFT.h
+cbuffer OceanConstants : register(b0) // Compute shaders have their own constant buffer slots, so b0 is not the per-frame constants here
+{
+	float gOceanTime;          // Seconds of simulation
+	float gOceanPatchSize;     // World size of the square of ocean the FFT covers - it repeats beyond that
+	float gOceanChoppiness;    // Scale of the horizontal displacement that sharpens the wave crests
+	float gOceanFoamThreshold; // Foam appears where the surface is squashed (Jacobian) below this value
+
+	uint  gOceanFFTSize;       // Resolution of the FFT: 128, 256 or 512
+	uint  gOceanFFTDirection;  // 0 for the row pass of the FFT, 1 for the column pass
+	float gOceanFoamBuild;     // Foam added where the surface is squashed since the last frame (see OceanCombine_cs)
+	float gOceanFoamKeep;      // Part of last frame's foam still there
+}
+
+
+//--------------------------------------------------------------------------------------
+// Helper functions
+//--------------------------------------------------------------------------------------
+
+// Complex numbers are stored in float2 (real, imaginary). Each float4 texel of the FFT holds two of them
+float2 ComplexMul(float2 a, float2 b)
+{
+	return float2(a.x * b.x - a.y * b.y, a.x * b.y + a.y * b.x);
+}
+
+// Returns a + ib for complex a and b. When a and b are spectra of real-valued results (heights, displacements etc.)
+// then the inverse FFT of a + ib gives the first result in the real part and the second in the imaginary part.
+// So one FFT is enough for two results
+float2 PackComplex(float2 a, float2 b)
+{
+	return float2(a.x - b.y, a.y + b.x);
+}
+
+#endif // _OCEAN_FFT_HLSLI_DEFINED_
@@ -0,0 +1,63 @@
+//--------------------------------------------------------------------------------------
+// Ocean inverse FFT compute shader
+//--------------------------------------------------------------------------------------
+// A 2D inverse FFT is done as 1D FFTs of every row, then 1D FFTs of every column of the result. This shader does one
+// of those passes (chosen by gOceanFFTDirection). Each thread group transforms a whole row / column in groupshared
+// memory, one thread per texel. Uses the radix-2 Stockham algorithm, which needs no bit reversal of the data
+
+#include "OceanFFT.hlsli"
+
+
+//--------------------------------------------------------------------------------------
+// Textures
+//--------------------------------------------------------------------------------------
+
+// Input and output are different textures as D3D11 can only read float4 values from a UAV with an optional feature
+Texture2DArray<float4>   FFTInput  : register(t0);
+RWTexture2DArray<float4> FFTOutput : register(u0);
+
+// Two copies of the row / column being transformed, each step of the FFT reads one and writes the other
+groupshared float4 gFFTData[2][MaxOceanFFTSize];
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+// Dispatch with one group for each row / column (y) for each slice of the texture array (z)
+// Thread groups are the maximum FFT size, threads beyond the current size just take part in the synchronisation
+[numthreads(MaxOceanFFTSize, 1, 1)]
+void main(uint3 groupID : SV_GroupID, uint3 threadID : SV_GroupThreadID)
+{
+	uint t = threadID.x;
+	uint3 texel = (gOceanFFTDirection == 0) ? uint3(t, groupID.y, groupID.z) : uint3(groupID.y, t, groupID.z);
+
+	if (t < gOceanFFTSize)  gFFTData[0][t] = FFTInput[texel];
+	GroupMemoryBarrierWithGroupSync();
+
+	// Each step combines pairs of transforms of size 'step' into transforms of twice the size, until the whole row is done
+	// Both complex numbers in each float4 are transformed together
+	uint halfSize = gOceanFFTSize / 2;
+	uint source = 0;
+	[loop] for (uint step = 1; step < gOceanFFTSize; step *= 2)
+	{
+		if (t < halfSize)
+		{
+			uint   k = t & (step - 1); // Position in the current sub-transform
+			float  angle = Pi * k / step; // Positive angle for the inverse transform
+			float2 twiddle = float2(cos(angle), sin(angle));
+
+			float4 a = gFFTData[source][t];
+			float4 b = gFFTData[source][t + halfSize];
+			b = float4(ComplexMul(b.xy, twiddle), ComplexMul(b.zw, twiddle));
+
+			uint destination = (t - k) * 2 + k;
+			gFFTData[1 - source][destination]        = a + b;
+			gFFTData[1 - source][destination + step] = a - b;
+		}
+		GroupMemoryBarrierWithGroupSync();
+		source = 1 - source;
+	}
+
+	if (t < gOceanFFTSize)  FFTOutput[texel] = gFFTData[source][t];
+}
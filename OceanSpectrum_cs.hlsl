@@ -0,0 +1,56 @@
+//--------------------------------------------------------------------------------------
+// Ocean spectrum compute shader
+//--------------------------------------------------------------------------------------
+// First step of the ocean simulation. Each texel is one wave frequency (k). The initial height and phase of
+// every wave was generated on the C++ side (Phillips spectrum, see OceanFFT.cpp), here the waves are moved
+// on to the current time and the other values needed for rendering are derived from the heights
+
+#include "OceanFFT.hlsli"
+
+
+//--------------------------------------------------------------------------------------
+// Textures
+//--------------------------------------------------------------------------------------
+
+// Initial spectrum: h0(k) in xy and conj(h0(-k)) in zw
+Texture2D<float4> InitialSpectrum : register(t0);
+
+// Output spectrum, two slices of two complex values each - see end of shader for contents
+RWTexture2DArray<float4> SpectrumOut : register(u0);
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+[numthreads(OceanThreadGroupSize, OceanThreadGroupSize, 1)]
+void main(uint3 id : SV_DispatchThreadID)
+{
+	if (any(id.xy >= gOceanFFTSize))  return;
+
+	// Wave vector for this texel. The zero frequency is in the centre of the texture
+	float2 k = 2.0f * Pi * (float2(id.xy) - 0.5f * gOceanFFTSize) / gOceanPatchSize;
+	float  kLength = max(length(k), 0.0001f);
+
+	// Deep water waves: the speed of each wave depends on its wavelength (dispersion relation w^2 = gk)
+	float  omega = sqrt(Gravity * kLength) * gOceanTime;
+	float2 phase = float2(cos(omega), sin(omega));
+
+	// Height spectrum at the current time. Combining the wave with its opposite (-k) keeps the final heights real
+	float4 h0 = InitialSpectrum[id.xy];
+	float2 h  = ComplexMul(h0.xy, phase) + ComplexMul(h0.zw, float2(phase.x, -phase.y));
+
+	// Everything else is derived from the height spectrum by multiplying by terms in k (differentiation in the spectrum)
+	float2 ih = float2(-h.y, h.x);              // i * h
+	float2 displacementX = ih * k.x / kLength;  // Horizontal displacement towards the wave crests makes them choppier
+	float2 displacementZ = ih * k.y / kLength;
+	float2 slopeX = ih * k.x;                   // Slope of the surface (dh/dx, dh/dz) for the normals
+	float2 slopeZ = ih * k.y;
+	float2 dDxdx = -h * k.x * k.x / kLength;    // Derivatives of the displacement for the Jacobian (used for foam)
+	float2 dDzdz = -h * k.y * k.y / kLength;
+	float2 dDxdz = -h * k.x * k.y / kLength;
+
+	// Pack eight real results into four complex values (see PackComplex)
+	SpectrumOut[uint3(id.xy, 0)] = float4(PackComplex(h, displacementX), PackComplex(displacementZ, slopeX));
+	SpectrumOut[uint3(id.xy, 1)] = float4(PackComplex(slopeZ, dDxdx),    PackComplex(dDzdz, dDxdz));
+}
@@ -0,0 +1,34 @@
+//--------------------------------------------------------------------------------------
+// Include file for the overdraw debug view shaders
+//--------------------------------------------------------------------------------------
+// OverdrawCount_ps is drawn in place of the pixel shaders of the passes counted, the heatmap shaders then show the counts
+// over the screen (see OverdrawView.h). The counters have two slices the size of the viewport:
+//   0 - the pixels shaded at each pixel
+//   1 - the quads run for them, in QuadUnits. Each pixel shaded adds its share of its quad, so each pixel of a full quad
+//       adds a quarter of a quad and a quad with a single pixel adds a whole quad for it. A quad runs four lanes
+
+#ifndef _OVERDRAW_HLSLI_DEFINED_
+#define _OVERDRAW_HLSLI_DEFINED_
+
+
+// Units the quads are counted in, so the share of any number of pixels from 1 to 4 is a whole number
+static const uint QuadUnits = 12;
+
+// Overdraw at which the heatmap is at its hottest
+static const float MaxOverdraw = 8;
+
+// Height of the colour key at the bottom of the heatmap, in pixels
+static const float KeyHeight = 12;
+
+
+// Colour for 0->1 through blue, green, yellow and red to white
+float3 HeatColour(float heat)
+{
+	const float3 colours[] = { float3(0, 0, 1), float3(0, 1, 0), float3(1, 1, 0), float3(1, 0, 0), float3(1, 1, 1) };
+	float scaled = saturate(heat) * 4;
+	int   index  = min(int(scaled), 3);
+	return lerp(colours[index], colours[index + 1], scaled - index);
+}
+
+
+#endif // _OVERDRAW_HLSLI_DEFINED_
@@ -0,0 +1,40 @@
+//--------------------------------------------------------------------------------------
+// Overdraw Count Pixel Shader
+//--------------------------------------------------------------------------------------
+// Drawn in place of the pixel shaders of the passes counted by the overdraw view (see OverdrawView.h). Adds to the counters
+// of its pixel and writes no colour. Only reads the position, which comes first in the output of every vertex shader, so
+// it can stand in for any pixel shader
+
+#include "Overdraw.hlsli"
+
+
+//--------------------------------------------------------------------------------------
+// Textures (texture maps)
+//--------------------------------------------------------------------------------------
+
+RWTexture2DArray<uint> OverdrawCounters : register(u7); // Slot must match PixelShaderOverrideUAVSlot in StateCache.h
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+// The depth test comes first, a shader writing to a UAV would otherwise run for hidden pixels too
+[earlydepthstencil]
+void main(float4 projectedPosition : SV_Position, uint coverage : SV_Coverage)
+{
+	// Helper lanes have no coverage. Count the pixels shaded in this quad from the differences with the pixels beside and
+	// below, each pixel's neighbour is on the other side depending on where it is in the quad
+	uint2  pixel = uint2(projectedPosition.xy);
+	float  shaded = coverage != 0 ? 1 : 0;
+	float2 side = 1 - 2 * float2(pixel & 1);
+	float  rowShaded  = 2 * shaded + side.x * ddx_fine(shaded);
+	float  quadShaded = 2 * rowShaded + side.y * ddy_fine(rowShaded);
+
+	// Writes from helper lanes are thrown away anyway
+	if (coverage != 0)
+	{
+		InterlockedAdd(OverdrawCounters[uint3(pixel, 0)], 1);
+		InterlockedAdd(OverdrawCounters[uint3(pixel, 1)], QuadUnits / uint(quadShaded + 0.5f));
+	}
+}
@@ -0,0 +1,32 @@
+//--------------------------------------------------------------------------------------
+// Overdraw Heatmap Pixel Shader
+//--------------------------------------------------------------------------------------
+// The pixels shaded at each pixel (see OverdrawView.h), black for none, then blue for one through to white for MaxOverdraw or
+// more. A key of the colours for each count is along the bottom
+
+#include "PostProcess.hlsli" // For the input from PostProcess_vs, the post-processing constants aren't used
+#include "Overdraw.hlsli"
+
+
+//--------------------------------------------------------------------------------------
+// Textures (texture maps)
+//--------------------------------------------------------------------------------------
+
+Texture2DArray<uint> OverdrawCounters : register(t0);
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+float4 main(PostProcessPixelShaderInput input) : SV_Target
+{
+	// The counters are the size of the viewport
+	uint width, height, slices;
+	OverdrawCounters.GetDimensions(width, height, slices);
+
+	// The key has a band for each count from 0 to MaxOverdraw
+	float count = (input.projectedPosition.y > height - KeyHeight) ? floor(input.uv.x * (MaxOverdraw + 1))
+	                                                               : OverdrawCounters.Load(int4(input.projectedPosition.xy, 0, 0));
+	return float4(count == 0 ? 0 : HeatColour((count - 1) / (MaxOverdraw - 1)), 1);
+}
@@ -0,0 +1,151 @@
+//--------------------------------------------------------------------------------------
+// Debug view of the overdraw and quad occupancy of the passes
+//--------------------------------------------------------------------------------------
+
+#include "OverdrawView.h"
+#include "GpuEvents.h"
+#include "GpuMemory.h"
+#include "Shader.h"
+#include "State.h"
+#include "StateCache.h"
+#include "Common.h"
+
+
+OverdrawView* gOverdrawView = nullptr;
+
+// The choices of passes to count, as flags of the GpuPass values. The first is the passes drawn into the main view, the
+// underwater fog isn't included, it is a full-screen pass with dual-source blending, which needs the real shader's outputs
+#define PASS_FLAG(pass) (1u << static_cast<int>(GpuPass::pass))
+static const struct { const char* name; unsigned int passes; } Selections[] =
+{
+	{ "Main View",   PASS_FLAG(DepthPrepass) | PASS_FLAG(MainLit) | PASS_FLAG(WaterSurface) | PASS_FLAG(SkyAndLights) },
+	{ "Lit",         PASS_FLAG(MainLit)      },
+	{ "Water",       PASS_FLAG(WaterSurface) },
+	{ "Sky",         PASS_FLAG(SkyAndLights) },
+	{ "Height",      PASS_FLAG(WaterHeight)  },
+	{ "Refraction",  PASS_FLAG(Refraction)   },
+	{ "Reflection",  PASS_FLAG(Reflection)   },
+	{ "Views",       PASS_FLAG(WaterViews)   },
+	{ "Environment", PASS_FLAG(Environment)  },
+};
+#undef PASS_FLAG
+static const int NumSelections = sizeof(Selections) / sizeof(Selections[0]);
+
+
+OverdrawView::~OverdrawView()
+{
+	Release();
+}
+
+
+void OverdrawView::NextSelection()
+{
+	mSelection = (mSelection + 1) % NumSelections;
+}
+
+const char* OverdrawView::ModeName()
+{
+	switch (mMode)
+	{
+		case OverdrawMode::Overdraw:       return "Overdraw";
+		case OverdrawMode::QuadEfficiency: return "Quad Efficiency";
+		default:                           return "Off";
+	}
+}
+
+const char* OverdrawView::SelectionName()
+{
+	return Selections[mSelection].name;
+}
+
+
+// Clear the counters at the start of the frame's rendering, creating them first if needed. Returns false if they can't be
+// created
+bool OverdrawView::BeginFrame(int width, int height)
+{
+	if (mMode == OverdrawMode::Off)  return true;
+
+	if (mCounters == nullptr || width != mWidth || height != mHeight)
+	{
+		Release();
+		D3D11_TEXTURE2D_DESC textureDesc = {};
+		textureDesc.Width  = width;
+		textureDesc.Height = height;
+		textureDesc.MipLevels = 1;
+		textureDesc.ArraySize = 2;
+		textureDesc.Format = DXGI_FORMAT_R32_UINT; // The only format the shader can add to atomically
+		textureDesc.SampleDesc.Count = 1;
+		textureDesc.Usage = D3D11_USAGE_DEFAULT;
+		textureDesc.BindFlags = D3D11_BIND_UNORDERED_ACCESS | D3D11_BIND_SHADER_RESOURCE;
+		if (FAILED(gD3DDevice->CreateTexture2D(&textureDesc, nullptr, &mCounters)) ||
+			FAILED(gD3DDevice->CreateUnorderedAccessView(mCounters, nullptr, &mCountersUAV)) ||
+			FAILED(gD3DDevice->CreateShaderResourceView(mCounters, nullptr, &mCountersSRV)))
+		{
+			Release();
+			gLastError = "Error creating overdraw counters";
+			return false;
+		}
+		SetDebugNames("Overdraw Counters", mCounters, mCountersSRV);
+		RegisterGpuResource(mCounters, "Overdraw View");
+		mWidth  = width;
+		mHeight = height;
+	}
+
+	const UINT zero[4] = {};
+	gD3DContext->ClearUnorderedAccessViewUint(mCountersUAV, zero);
+	return true;
+}
+
+
+// Count the pass's pixels if it is chosen. Called by the profiler on the thread recording the pass, the override is per thread
+void OverdrawView::BeginPass(GpuPass pass)
+{
+	if (mMode == OverdrawMode::Off || mCountersUAV == nullptr)  return;
+	if (Selections[mSelection].passes & (1u << static_cast<int>(pass)))  SetPixelShaderOverride(gOverdrawCountPixelShader, mCountersUAV);
+}
+
+void OverdrawView::EndPass(GpuPass pass)
+{
+	if (mMode == OverdrawMode::Off || mCountersUAV == nullptr)  return;
+	if (Selections[mSelection].passes & (1u << static_cast<int>(pass)))  SetPixelShaderOverride(nullptr, nullptr);
+}
+
+
+// Draw the heatmap over the whole of the given render target, a full-screen triangle reading the counters
+void OverdrawView::Render(ID3D11RenderTargetView* renderTarget, int width, int height)
+{
+	if (mMode == OverdrawMode::Off || mCountersSRV == nullptr)  return;
+
+	GpuEventScope event("Overdraw View");
+	SetRenderTargets(1, &renderTarget, nullptr);
+	D3D11_VIEWPORT vp = { 0, 0, static_cast<FLOAT>(width), static_cast<FLOAT>(height), 0.0f, 1.0f };
+	SetViewport(vp);
+
+	SetBlendState(gNoBlendingState);
+	SetDepthStencilState(gNoDepthBufferState);
+	SetRasterizerState(gCullNoneState);
+	SetInputLayout(nullptr);
+	SetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+	SetHullShader(nullptr);
+	SetDomainShader(nullptr);
+	SetGeometryShader(nullptr);
+	SetVertexShader(gPostProcessVertexShader);
+	SetPixelShader(mMode == OverdrawMode::Overdraw ? gOverdrawHeatmapPixelShader : gQuadEfficiencyHeatmapPixelShader);
+	SetShaderResource(0, mCountersSRV);
+
+	gD3DContext->Draw(3, 0);
+	CountDrawCall();
+
+	SetShaderResource(0, nullptr);
+	SetDepthStencilState(gUseDepthBufferState);
+	SetRasterizerState(gCullBackState);
+}
+
+
+void OverdrawView::Release()
+{
+	if (mCountersSRV)  { mCountersSRV->Release();  mCountersSRV = nullptr; }
+	if (mCountersUAV)  { mCountersUAV->Release();  mCountersUAV = nullptr; }
+	if (mCounters)     { mCounters->Release();     mCounters    = nullptr; }
+	mWidth = mHeight = 0;
+}
@@ -0,0 +1,91 @@
+//--------------------------------------------------------------------------------------
+// Debug view of the overdraw and quad occupancy of the passes
+//--------------------------------------------------------------------------------------
+// The pipeline statistics (see GpuProfiler.h) say how many pixels a pass shaded, but not where.
+// This view shows it as a heatmap over the screen. While it is on, the chosen passes are drawn
+// with a counting pixel shader in place of their own (see SetPixelShaderOverride in
+// StateCache.h), which adds to a counter for its pixel in a UAV. It counts each pixel that passes
+// the depth test, even those the real shader would throw away with clip(), which are the pixels
+// the real shader pays for. Draws with no pixel shader (depth only) aren't counted.
+//
+// The shader also counts the quad lanes it ran in. Pixels are shaded in 2x2 quads, and the lanes
+// of a quad outside the triangle still run as helpers, so small and thin triangles waste much
+// of their shading. The quad efficiency view shows the pixels shaded per lane run, from 1 for
+// full quads down to 0.25 for quads with a single pixel.
+//
+// Each pass counts in the pixels of its own target, so passes drawn at a lower resolution (the
+// water textures, the environment map) fill the top-left of the heatmap at their own size. The
+// chosen passes draw nothing into their targets, their images are garbage while the view is on.
+// The counters are made when the view is first used, at the size of the viewport.
+
+#include "GpuProfiler.h"
+#include <d3d11.h>
+
+#ifndef _OVERDRAW_VIEW_H_INCLUDED_
+#define _OVERDRAW_VIEW_H_INCLUDED_
+
+enum class OverdrawMode
+{
+	Off,
+	Overdraw,       // Pixels shaded at each pixel
+	QuadEfficiency, // Pixels shaded per quad lane run at each pixel
+	NumModes,
+};
+
+class OverdrawView
+{
+//--------------------------------------------------------------------------------------
+// Construction / Usage
+//--------------------------------------------------------------------------------------
+public:
+
+	OverdrawView() = default;
+	~OverdrawView();
+
+
+	// Which heatmap is shown, and the passes counted for it: the passes of the main view together, or one pass
+	OverdrawMode Mode()  { return mMode; }
+	void SetMode(OverdrawMode mode)  { mMode = mode; }
+	void NextSelection();
+
+	// Names for display, e.g. "Overdraw" and "Main View"
+	const char* ModeName();
+	const char* SelectionName();
+
+
+	// Call at the start of each frame's rendering, before any pass, with the size of the viewport. Clears the counters when
+	// the view is on, creating them first if needed. Returns false if they can't be created
+	bool BeginFrame(int width, int height);
+
+	// Called by GpuProfiler::BeginPass / EndPass on the thread recording the pass. Count the pass's pixels if it is chosen
+	void BeginPass(GpuPass pass);
+	void EndPass(GpuPass pass);
+
+	// Draw the heatmap over the whole of the given render target of the given size, after post-processing and before the stats
+	// overlay. Does nothing when the view is off. Uses the immediate context and the state cache, leaves no textures bound
+	void Render(ID3D11RenderTargetView* renderTarget, int width, int height);
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions / data
+//--------------------------------------------------------------------------------------
+private:
+
+	void Release();
+
+	OverdrawMode mMode = OverdrawMode::Off;
+	int          mSelection = 0; // Index in the list of choices in OverdrawView.cpp
+
+	// Two slices of counters: the pixels shaded and the quad lanes run for them (see Overdraw.hlsli)
+	ID3D11Texture2D*           mCounters    = nullptr;
+	ID3D11UnorderedAccessView* mCountersUAV = nullptr;
+	ID3D11ShaderResourceView*  mCountersSRV = nullptr;
+	int                        mWidth  = 0;
+	int                        mHeight = 0;
+};
+
+
+extern OverdrawView* gOverdrawView;
+
+
+#endif //_OVERDRAW_VIEW_H_INCLUDED_
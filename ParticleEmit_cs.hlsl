@@ -0,0 +1,109 @@
+//--------------------------------------------------------------------------------------
+// Particle emission compute shader
+//--------------------------------------------------------------------------------------
+// Starts this frame's new particles (see ParticleSystem.h). Each thread group takes one emitter and
+// its threads take its particles in turn. Each new particle takes an unused particle from the dead
+// list and is appended to this frame's list of live particles after the ones the simulation kept.
+// Only as many particles as there are unused ones are emitted, the rest are dropped, so a full
+// system stops emitting rather than overwriting. Spread in position, velocity and lifetime comes
+// from a hash of the particle's number and the frame, not from the CPU
+
+
+//--------------------------------------------------------------------------------------
+// Constants / buffers
+//--------------------------------------------------------------------------------------
+
+#include "Particles.hlsli"
+
+StructuredBuffer<ParticleEmitter> Emitters : register(t0);
+Texture2D<float>                  ShoreMap : register(t1); // Ground height under the water (see WaterBody.h), for foam
+
+RWStructuredBuffer<Particle>  Particles    : register(u0);
+ConsumeStructuredBuffer<uint> DeadList     : register(u1);
+AppendStructuredBuffer<uint>  AliveOut     : register(u2);
+RWBuffer<uint>                EmittedCount : register(u3); // Particles emitted so far this frame, cleared to 0 first
+
+
+//--------------------------------------------------------------------------------------
+// Helper functions
+//--------------------------------------------------------------------------------------
+
+// PCG hash, a well mixed 32-bit number from any other
+uint Hash(uint value)
+{
+	uint state = value * 747796405u + 2891336453u;
+	uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+	return (word >> 22u) ^ word;
+}
+
+// Random number from -1 to 1, moving the seed on to the next
+float RandomSigned(inout uint seed)
+{
+	seed = Hash(seed);
+	return (seed & 0xffffff) / float(0x800000) - 1;
+}
+
+float3 RandomSigned3(inout uint seed)
+{
+	float x = RandomSigned(seed);
+	float y = RandomSigned(seed);
+	float z = RandomSigned(seed);
+	return float3(x, y, z);
+}
+
+// Ground height under the water at a world xz point from the shore map, or far below the water outside it
+float ShoreHeight(float2 worldXZ)
+{
+	float2 uv = (worldXZ - gParticleShoreMapOrigin) * gParticleShoreMapScale;
+	if (any(uv < 0) || any(uv >= 1))  return gParticleWaterHeight - 1e6f;
+
+	uint width, height;
+	ShoreMap.GetDimensions(width, height);
+	return ShoreMap.Load(int3(uv * float2(width, height), 0));
+}
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+[numthreads(ParticleThreadGroupSize, 1, 1)]
+void main(uint3 groupID : SV_GroupID, uint3 threadID : SV_GroupThreadID)
+{
+	ParticleEmitter emitter = Emitters[groupID.x];
+	for (uint i = threadID.x; i < emitter.count; i += ParticleThreadGroupSize)
+	{
+		uint seed = Hash(gRandomSeed ^ Hash(groupID.x * 65537u + i));
+		float3 position = emitter.position + RandomSigned3(seed) * emitter.positionSpread;
+
+		// Foam only starts where the shore makes the water shallow. Tested before taking a particle, so the rest aren't used up
+		if (emitter.flags & ParticleOnShore)
+		{
+			if (gParticleShoreMapEnabled == 0)  return;
+			float depth = gParticleWaterHeight - ShoreHeight(position.xz);
+			if (depth < 0 || depth > gShoreFoamDepth)  continue;
+			position.y = gParticleWaterHeight;
+		}
+
+		// Stop when the unused particles have run out
+		uint emitted;
+		InterlockedAdd(EmittedCount[0], 1, emitted);
+		if (emitted >= gDeadCount)  return;
+
+		Particle particle;
+		particle.position  = position;
+		particle.age       = 0;
+		particle.velocity  = emitter.velocity + RandomSigned3(seed) * emitter.velocitySpread;
+		particle.lifetime  = max(emitter.lifetime + RandomSigned(seed) * emitter.lifetimeSpread, 0);
+		particle.colour    = emitter.colour;
+		particle.alpha     = emitter.alpha;
+		particle.startSize = emitter.startSize;
+		particle.endSize   = emitter.endSize;
+		particle.drag      = emitter.drag;
+		particle.flags     = emitter.flags;
+
+		uint index = DeadList.Consume();
+		Particles[index] = particle;
+		AliveOut.Append(index);
+	}
+}
@@ -0,0 +1,63 @@
+//--------------------------------------------------------------------------------------
+// Particle simulation compute shader
+//--------------------------------------------------------------------------------------
+// Moves every live particle on by a frame (see ParticleSystem.h). Each thread takes one particle
+// from the list of live particles of the last frame. Particles that are still alive afterwards
+// are appended to this frame's list, so the list stays packed with the dead ones left out, and
+// the dead ones are appended to the list of unused particles for the emit shader to take
+
+
+//--------------------------------------------------------------------------------------
+// Constants / buffers
+//--------------------------------------------------------------------------------------
+
+#include "Particles.hlsli"
+
+StructuredBuffer<uint>         AliveIn   : register(t0); // Indexes in Particles of the particles that were alive last frame
+RWStructuredBuffer<Particle>   Particles : register(u0);
+AppendStructuredBuffer<uint>   DeadList  : register(u1);
+AppendStructuredBuffer<uint>   AliveOut  : register(u2);
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+[numthreads(ParticleThreadGroupSize, 1, 1)]
+void main(uint3 id : SV_DispatchThreadID)
+{
+	if (id.x >= gAliveCount)  return;
+	uint index = AliveIn[id.x];
+	Particle particle = Particles[index];
+
+	// Particles that lived for one frame (e.g. light flares) die here having been drawn once
+	particle.age += gParticleFrameTime;
+	if (particle.age >= particle.lifetime)
+	{
+		DeadList.Append(index);
+		return;
+	}
+
+	// Drag slows the particle whatever the frame time. Floating particles drift on the water, others fall
+	particle.velocity *= exp(-particle.drag * gParticleFrameTime);
+	if (particle.flags & ParticleFloating)
+	{
+		particle.position.xz += particle.velocity.xz * gParticleFrameTime;
+		particle.position.y = gParticleWaterHeight;
+	}
+	else
+	{
+		particle.velocity.y -= gParticleGravity * gParticleFrameTime;
+		particle.position += particle.velocity * gParticleFrameTime;
+
+		// Spray is gone once it falls back into the water
+		if ((particle.flags & ParticleDieInWater) && particle.velocity.y < 0 && particle.position.y < gParticleWaterHeight)
+		{
+			DeadList.Append(index);
+			return;
+		}
+	}
+
+	Particles[index] = particle;
+	AliveOut.Append(index);
+}
@@ -0,0 +1,127 @@
+//--------------------------------------------------------------------------------------
+// Particle sort compute shader
+//--------------------------------------------------------------------------------------
+// Sorts the live particles back to front for blending, with a bitonic sort (see ParticleSystem.h).
+// The sort keys are the distance from the camera and the particle's index, one for every particle
+// the system can hold: the live ones first, then keys of distance 0 that sort to the end, so the
+// draw reads the first gAliveCount. A bitonic sort merges ever larger sorted blocks, each merge a
+// series of steps that compare and swap keys a fixed distance apart. Steps closer than a thread
+// group are done together in group shared memory, the others one dispatch each. Chosen by gSortMode:
+//   SortBuildKeys   - write the keys and sort each block of ParticleSortGroupSize keys
+//   SortMergeStep   - one step of a merge, keys gSortStep apart in blocks of gSortLevel
+//   SortMergeGroup  - the remaining steps of a merge, once the keys are within a thread group
+
+
+//--------------------------------------------------------------------------------------
+// Constants / buffers
+//--------------------------------------------------------------------------------------
+
+#include "Particles.hlsli"
+
+static const uint SortBuildKeys  = 0; // Must match SortMode in ParticleSystem.h
+static const uint SortMergeStep  = 1;
+static const uint SortMergeGroup = 2;
+
+// These variables must match exactly the SortConstants structure in ParticleSystem.h
+cbuffer SortConstants : register(b2)
+{
+	uint gSortLevel; // Size of the blocks being merged, each sorted the opposite way to the one before
+	uint gSortStep;  // Distance between the keys compared
+	uint gSortMode;
+	uint paddingSort;
+}
+
+StructuredBuffer<uint>     AliveList : register(t0);
+StructuredBuffer<Particle> Particles : register(t1);
+RWStructuredBuffer<uint2>  SortKeys  : register(u0); // Distance as uint (positive floats sort as uints) and particle index
+
+groupshared uint2 sharedKeys[ParticleSortGroupSize];
+
+
+//--------------------------------------------------------------------------------------
+// Helper functions
+//--------------------------------------------------------------------------------------
+
+// Whether the keys at two indexes in a block of the given level are in the right order. The whole array ends up furthest
+// first, so the first block of each pair is sorted that way and the second the other way
+bool InOrder(uint2 first, uint2 second, uint index, uint level)
+{
+	bool furthestFirst = (index & level) == 0;
+	return furthestFirst ? first.x >= second.x : first.x <= second.x;
+}
+
+// Compare and swap the keys in shared memory for the steps of a merge at the given level, from the given step down to 1
+void MergeShared(uint thread, uint globalIndex, uint level, uint firstStep)
+{
+	for (uint step = firstStep; step > 0; step >>= 1)
+	{
+		GroupMemoryBarrierWithGroupSync();
+		uint partner = thread ^ step;
+		if (partner > thread)
+		{
+			uint2 first  = sharedKeys[thread];
+			uint2 second = sharedKeys[partner];
+			if (!InOrder(first, second, globalIndex, level))
+			{
+				sharedKeys[thread]  = second;
+				sharedKeys[partner] = first;
+			}
+		}
+	}
+	GroupMemoryBarrierWithGroupSync();
+}
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+[numthreads(ParticleSortGroupSize, 1, 1)]
+void main(uint3 id : SV_DispatchThreadID, uint3 threadID : SV_GroupThreadID)
+{
+	uint index = id.x;
+	uint thread = threadID.x;
+
+	// One step across blocks larger than a thread group, straight in the buffer. Each pair is swapped by its first key's thread
+	if (gSortMode == SortMergeStep)
+	{
+		uint partner = index ^ gSortStep;
+		if (partner > index)
+		{
+			uint2 first  = SortKeys[index];
+			uint2 second = SortKeys[partner];
+			if (!InOrder(first, second, index, gSortLevel))
+			{
+				SortKeys[index]   = second;
+				SortKeys[partner] = first;
+			}
+		}
+		return;
+	}
+
+	if (gSortMode == SortBuildKeys)
+	{
+		// Keys of live particles are never 0, so the unused keys sort after all of them
+		uint2 key = uint2(0, 0xffffffff);
+		if (index < gAliveCount)
+		{
+			uint particle = AliveList[index];
+			float distance = length(Particles[particle].position - gSortCameraPosition);
+			key = uint2(asuint(max(distance, 1e-6f)), particle);
+		}
+		sharedKeys[thread] = key;
+
+		// Every merge within the thread group, up to a sorted block of the whole group
+		for (uint level = 2; level <= ParticleSortGroupSize; level <<= 1)
+		{
+			MergeShared(thread, index, level, level >> 1);
+		}
+	}
+	else // SortMergeGroup
+	{
+		sharedKeys[thread] = SortKeys[index];
+		MergeShared(thread, index, gSortLevel, ParticleSortGroupSize >> 1);
+	}
+
+	SortKeys[index] = sharedKeys[thread];
+}
@@ -0,0 +1,321 @@
+//--------------------------------------------------------------------------------------
+// GPU particle system - spray, splashes, foam and light flares
+//--------------------------------------------------------------------------------------
+
+#include "ParticleSystem.h"
+#include "WaterBody.h"
+#include "Shader.h"
+#include "StateCache.h"
+#include "GraphicsHelpers.h"
+#include "GpuEvents.h"
+#include "GpuMemory.h"
+#include "Common.h"
+
+#include <stdexcept>
+#include <algorithm>
+#include <numeric>
+#include <cstddef>
+#include <cstring>
+#include <cfloat>
+
+
+// Create the buffers for up to the given number of particles, a power of 2 of at least SortGroupSize
+// Will throw a std::runtime_error exception on failure (same as Mesh)
+ParticleSystem::ParticleSystem(unsigned int maxParticles /*= 131072*/)
+	: mMaxParticles(maxParticles)
+{
+	if (maxParticles < SortGroupSize || (maxParticles & (maxParticles - 1)) != 0)
+	{
+		throw std::runtime_error("Particle system size must be a power of 2 of at least 512");
+	}
+	mEmitters.reserve(MaxEmitters);
+
+	// Structured buffers the compute shaders write and the vertex shader reads
+	auto createBuffer = [](unsigned int numElements, unsigned int stride, UINT bindFlags, UINT uavFlags, const void* initialData,
+	                       ID3D11Buffer** buffer, ID3D11ShaderResourceView** srv, ID3D11UnorderedAccessView** uav)
+	{
+		D3D11_BUFFER_DESC bufferDesc = {};
+		bufferDesc.ByteWidth           = numElements * stride;
+		bufferDesc.Usage               = D3D11_USAGE_DEFAULT;
+		bufferDesc.BindFlags           = bindFlags;
+		bufferDesc.MiscFlags           = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+		bufferDesc.StructureByteStride = stride;
+		D3D11_SUBRESOURCE_DATA data = { initialData, 0, 0 };
+		if (FAILED(gD3DDevice->CreateBuffer(&bufferDesc, initialData ? &data : nullptr, buffer)))  return false;
+		RegisterGpuResource(*buffer, "Particles");
+
+		D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+		srvDesc.Format              = DXGI_FORMAT_UNKNOWN; // Structured buffers have no format
+		srvDesc.ViewDimension       = D3D11_SRV_DIMENSION_BUFFER;
+		srvDesc.Buffer.FirstElement = 0;
+		srvDesc.Buffer.NumElements  = numElements;
+		if (srv && FAILED(gD3DDevice->CreateShaderResourceView(*buffer, &srvDesc, srv)))  return false;
+
+		D3D11_UNORDERED_ACCESS_VIEW_DESC uavDesc = {};
+		uavDesc.Format              = DXGI_FORMAT_UNKNOWN;
+		uavDesc.ViewDimension       = D3D11_UAV_DIMENSION_BUFFER;
+		uavDesc.Buffer.FirstElement = 0;
+		uavDesc.Buffer.NumElements  = numElements;
+		uavDesc.Buffer.Flags        = uavFlags;
+		return uav == nullptr || SUCCEEDED(gD3DDevice->CreateUnorderedAccessView(*buffer, &uavDesc, uav));
+	};
+	const UINT shaderBuffer = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS;
+
+	// The unused list starts with every particle in it, the live lists are empty (their counts are set in the first Update)
+	std::vector<unsigned int> allParticles(maxParticles);
+	std::iota(allParticles.begin(), allParticles.end(), 0);
+	bool created =
+		createBuffer(maxParticles, sizeof(Particle), shaderBuffer, 0, nullptr, &mParticleBuffer, &mParticleBufferSRV, &mParticleBufferUAV) &&
+		createBuffer(maxParticles, sizeof(unsigned int), D3D11_BIND_UNORDERED_ACCESS, D3D11_BUFFER_UAV_FLAG_APPEND, allParticles.data(),
+		             &mDeadList, nullptr, &mDeadListUAV) &&
+		createBuffer(maxParticles, sizeof(unsigned int), shaderBuffer, D3D11_BUFFER_UAV_FLAG_APPEND, nullptr,
+		             &mAliveLists[0], &mAliveListSRVs[0], &mAliveListUAVs[0]) &&
+		createBuffer(maxParticles, sizeof(unsigned int), shaderBuffer, D3D11_BUFFER_UAV_FLAG_APPEND, nullptr,
+		             &mAliveLists[1], &mAliveListSRVs[1], &mAliveListUAVs[1]) &&
+		createBuffer(maxParticles, sizeof(unsigned int) * 2, shaderBuffer, 0, nullptr, &mSortKeys, &mSortKeysSRV, &mSortKeysUAV);
+	if (!created)
+	{
+		Release();
+		throw std::runtime_error("Error creating particle buffers");
+	}
+
+	// The emitters are rewritten by the CPU each frame and read by the emit shader
+	D3D11_BUFFER_DESC emitterDesc = {};
+	emitterDesc.ByteWidth           = sizeof(ParticleEmitter) * MaxEmitters;
+	emitterDesc.Usage               = D3D11_USAGE_DYNAMIC;
+	emitterDesc.BindFlags           = D3D11_BIND_SHADER_RESOURCE;
+	emitterDesc.CPUAccessFlags      = D3D11_CPU_ACCESS_WRITE;
+	emitterDesc.MiscFlags           = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+	emitterDesc.StructureByteStride = sizeof(ParticleEmitter);
+	if (FAILED(gD3DDevice->CreateBuffer(&emitterDesc, nullptr, &mEmitterBuffer)) ||
+	    FAILED(gD3DDevice->CreateShaderResourceView(mEmitterBuffer, nullptr, &mEmitterBufferSRV)))
+	{
+		Release();
+		throw std::runtime_error("Error creating particle emitter buffer");
+	}
+	RegisterGpuResource(mEmitterBuffer, "Particles");
+
+	// A single count shared by the emit shader's threads
+	D3D11_BUFFER_DESC countDesc = {};
+	countDesc.ByteWidth = sizeof(unsigned int);
+	countDesc.Usage     = D3D11_USAGE_DEFAULT;
+	countDesc.BindFlags = D3D11_BIND_UNORDERED_ACCESS;
+	D3D11_UNORDERED_ACCESS_VIEW_DESC countUAVDesc = {};
+	countUAVDesc.Format             = DXGI_FORMAT_R32_UINT;
+	countUAVDesc.ViewDimension      = D3D11_UAV_DIMENSION_BUFFER;
+	countUAVDesc.Buffer.NumElements = 1;
+	if (FAILED(gD3DDevice->CreateBuffer(&countDesc, nullptr, &mEmittedCount)) ||
+	    FAILED(gD3DDevice->CreateUnorderedAccessView(mEmittedCount, &countUAVDesc, &mEmittedCountUAV)))
+	{
+		Release();
+		throw std::runtime_error("Error creating particle count buffer");
+	}
+	RegisterGpuResource(mEmittedCount, "Particles");
+
+	// Four vertices for each particle's billboard, the instance count is copied in on the GPU
+	D3D11_DRAW_INSTANCED_INDIRECT_ARGS args = { 4, 0, 0, 0 };
+	D3D11_BUFFER_DESC argsDesc = {};
+	argsDesc.ByteWidth = sizeof(args);
+	argsDesc.Usage     = D3D11_USAGE_DEFAULT;
+	argsDesc.MiscFlags = D3D11_RESOURCE_MISC_DRAWINDIRECT_ARGS;
+	D3D11_SUBRESOURCE_DATA argsData = { &args, 0, 0 };
+	if (FAILED(gD3DDevice->CreateBuffer(&argsDesc, &argsData, &mDrawArgs)))
+	{
+		Release();
+		throw std::runtime_error("Error creating particle draw arguments");
+	}
+	RegisterGpuResource(mDrawArgs, "Particles");
+
+	// The counts are a constant buffer the GPU copies into, so it can't be dynamic like the others
+	D3D11_BUFFER_DESC countsDesc = {};
+	countsDesc.ByteWidth = sizeof(ParticleCounts);
+	countsDesc.Usage     = D3D11_USAGE_DEFAULT;
+	countsDesc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+	mConstantBuffer     = CreateConstantBuffer(sizeof(ParticleConstants));
+	mSortConstantBuffer = CreateConstantBuffer(sizeof(SortConstants));
+	if (mConstantBuffer == nullptr || mSortConstantBuffer == nullptr || FAILED(gD3DDevice->CreateBuffer(&countsDesc, nullptr, &mCountsBuffer)))
+	{
+		Release();
+		throw std::runtime_error("Error creating particle constant buffers");
+	}
+	RegisterGpuResource(mCountsBuffer, "Constant Buffers");
+
+	SetDebugNames("Particles", mParticleBuffer, mParticleBufferSRV);
+}
+
+ParticleSystem::~ParticleSystem()
+{
+	Release();
+}
+
+
+// Add an emitter for this frame's new particles. Returns false if there are already as many emitters as can be given to the
+// GPU in a frame
+bool ParticleSystem::Emit(const ParticleEmitter& emitter)
+{
+	if (mEmitters.size() >= MaxEmitters)  return false;
+	if (emitter.count > 0)  mEmitters.push_back(emitter);
+	return true;
+}
+
+
+// Simulate the particles over the given frame time, emit this frame's particles, then sort them from the given camera
+// position for Render, and forget this frame's emitters. Leaves the compute shader stage with nothing bound
+void ParticleSystem::Update(float frameTime, const CVector3& cameraPosition, WaterBody* water, float shoreFoamDepth)
+{
+	ParticleConstants constants = {};
+	constants.frameTime      = frameTime;
+	constants.gravity        = Gravity;
+	constants.maxParticles   = mMaxParticles;
+	constants.numEmitters    = static_cast<unsigned int>(mEmitters.size());
+	constants.cameraPosition = cameraPosition;
+	constants.randomSeed     = mFrame * 0x9e3779b9u;
+	constants.waterHeight    = water ? water->Height() : -FLT_MAX;
+	constants.shoreFoamDepth = shoreFoamDepth;
+	ID3D11ShaderResourceView* shoreMap = water ? water->ShoreMapSRV() : nullptr;
+	if (shoreMap)
+	{
+		CVector2 size = water->ShoreMapMax() - water->ShoreMapMin();
+		constants.shoreMapOrigin[0] = water->ShoreMapMin().x;
+		constants.shoreMapOrigin[1] = water->ShoreMapMin().y;
+		constants.shoreMapScale[0]  = 1 / (std::max)(size.x, 0.001f);
+		constants.shoreMapScale[1]  = 1 / (std::max)(size.y, 0.001f);
+		constants.shoreMapEnabled   = 1;
+	}
+
+	// Send this frame's emitters. Discarding the old contents lets the GPU carry on reading them for the last frame
+	if (!mEmitters.empty())
+	{
+		D3D11_MAPPED_SUBRESOURCE mapped;
+		if (SUCCEEDED(gD3DContext->Map(mEmitterBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped)))
+		{
+			memcpy(mapped.pData, mEmitters.data(), mEmitters.size() * sizeof(ParticleEmitter));
+			gD3DContext->Unmap(mEmitterBuffer, 0);
+			CountMap(static_cast<unsigned int>(mEmitters.size() * sizeof(ParticleEmitter)));
+		}
+		else  constants.numEmitters = 0;
+	}
+	UpdateConstantBuffer(mConstantBuffer, constants);
+
+	ID3D11ShaderResourceView*  nullSRVs[2] = {};
+	ID3D11UnorderedAccessView* nullUAVs[4] = {};
+	int last = mCurrent;
+	int next = 1 - mCurrent;
+
+	// The lists' counts are set when they are first bound: every particle unused and none alive
+	if (!mStarted)
+	{
+		UINT startCounts[3] = { mMaxParticles, 0, 0 };
+		ID3D11UnorderedAccessView* lists[3] = { mDeadListUAV, mAliveListUAVs[0], mAliveListUAVs[1] };
+		gD3DContext->CSSetUnorderedAccessViews(0, 3, lists, startCounts);
+		gD3DContext->CSSetUnorderedAccessViews(0, 3, nullUAVs, nullptr);
+		mStarted = true;
+	}
+
+	ID3D11Buffer* constantBuffers[3] = { mConstantBuffer, mCountsBuffer, mSortConstantBuffer };
+	gD3DContext->CSSetConstantBuffers(0, 3, constantBuffers);
+
+	////-------- Simulate --------////
+
+	// Every particle alive last frame is moved on, the CPU doesn't know how many there are so enough threads are run for all
+	// of them. The count of the list being read is copied in first. This frame's list starts empty, the others keep their counts
+	gD3DContext->CopyStructureCount(mCountsBuffer, offsetof(ParticleCounts, aliveCount), mAliveListUAVs[last]);
+	{
+		UINT counts[3] = { static_cast<UINT>(-1), static_cast<UINT>(-1), 0 };
+		ID3D11UnorderedAccessView* uavs[3] = { mParticleBufferUAV, mDeadListUAV, mAliveListUAVs[next] };
+		gD3DContext->CSSetShader(gParticleSimulateComputeShader, nullptr, 0);
+		gD3DContext->CSSetShaderResources(0, 1, &mAliveListSRVs[last]);
+		gD3DContext->CSSetUnorderedAccessViews(0, 3, uavs, counts);
+		gD3DContext->Dispatch(mMaxParticles / ThreadGroupSize, 1, 1);
+		gD3DContext->CSSetShaderResources(0, 1, nullSRVs);
+		gD3DContext->CSSetUnorderedAccessViews(0, 3, nullUAVs, nullptr);
+	}
+
+	////-------- Emit --------////
+
+	// One thread group for each emitter, with the number of unused particles copied in so they don't take more than there are
+	if (constants.numEmitters > 0)
+	{
+		gD3DContext->CopyStructureCount(mCountsBuffer, offsetof(ParticleCounts, deadCount), mDeadListUAV);
+		const UINT zero[4] = {};
+		gD3DContext->ClearUnorderedAccessViewUint(mEmittedCountUAV, zero);
+
+		UINT counts[4] = { static_cast<UINT>(-1), static_cast<UINT>(-1), static_cast<UINT>(-1), static_cast<UINT>(-1) };
+		ID3D11UnorderedAccessView* uavs[4] = { mParticleBufferUAV, mDeadListUAV, mAliveListUAVs[next], mEmittedCountUAV };
+		ID3D11ShaderResourceView*  srvs[2] = { mEmitterBufferSRV, shoreMap };
+		gD3DContext->CSSetShader(gParticleEmitComputeShader, nullptr, 0);
+		gD3DContext->CSSetShaderResources(0, 2, srvs);
+		gD3DContext->CSSetUnorderedAccessViews(0, 4, uavs, counts);
+		gD3DContext->Dispatch(constants.numEmitters, 1, 1);
+		gD3DContext->CSSetShaderResources(0, 2, nullSRVs);
+		gD3DContext->CSSetUnorderedAccessViews(0, 4, nullUAVs, nullptr);
+	}
+
+	// This frame's live particles are what the sort reads and the draw draws
+	gD3DContext->CopyStructureCount(mCountsBuffer, offsetof(ParticleCounts, aliveCount), mAliveListUAVs[next]);
+	gD3DContext->CopyStructureCount(mDrawArgs, offsetof(D3D11_DRAW_INSTANCED_INDIRECT_ARGS, InstanceCount), mAliveListUAVs[next]);
+
+	////-------- Sort --------////
+
+	// Each block of a thread group is sorted with the keys as they are made, then the blocks are merged into ever larger ones,
+	// the steps further apart than a thread group one dispatch at a time, the closer ones all together
+	ID3D11ShaderResourceView* sortSRVs[2] = { mAliveListSRVs[next], mParticleBufferSRV };
+	gD3DContext->CSSetShader(gParticleSortComputeShader, nullptr, 0);
+	gD3DContext->CSSetShaderResources(0, 2, sortSRVs);
+	gD3DContext->CSSetUnorderedAccessViews(0, 1, &mSortKeysUAV, nullptr);
+	Sort(0, 0, SortBuildKeys);
+	for (unsigned int level = SortGroupSize * 2; level <= mMaxParticles; level *= 2)
+	{
+		for (unsigned int step = level / 2; step >= SortGroupSize; step /= 2)  Sort(level, step, SortMergeStep);
+		Sort(level, 0, SortMergeGroup);
+	}
+	gD3DContext->CSSetShaderResources(0, 2, nullSRVs);
+	gD3DContext->CSSetUnorderedAccessViews(0, 1, nullUAVs, nullptr);
+	gD3DContext->CSSetShader(nullptr, nullptr, 0);
+
+	mCurrent = next;
+	mEmitters.clear();
+	++mFrame;
+}
+
+
+// Draw the live particles, back to front, with one indirect draw. The setup is done by the caller (see ParticleSystem.h)
+void ParticleSystem::Render()
+{
+	// The particles and their order are only read by the vertex shader, and are unbound again so the compute shaders can
+	// write them next frame
+	SetShaderResource(9,  mParticleBufferSRV, VertexShaderStage); // First parameter must match texture slot number in the shader
+	SetShaderResource(10, mSortKeysSRV,       VertexShaderStage);
+	SetInputLayout(nullptr);
+	gD3DContext->DrawInstancedIndirect(mDrawArgs, 0);
+	CountDrawCall();
+	SetShaderResource(9,  nullptr, VertexShaderStage);
+	SetShaderResource(10, nullptr, VertexShaderStage);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions
+//--------------------------------------------------------------------------------------
+
+// Run a pass of the sort shader over all the keys
+void ParticleSystem::Sort(unsigned int level, unsigned int step, SortMode mode)
+{
+	UpdateConstantBuffer(mSortConstantBuffer, SortConstants{ level, step, mode, 0 });
+	gD3DContext->Dispatch(mMaxParticles / SortGroupSize, 1, 1);
+}
+
+
+void ParticleSystem::Release()
+{
+	ID3D11UnorderedAccessView** uavs[] = { &mParticleBufferUAV, &mDeadListUAV, &mAliveListUAVs[0], &mAliveListUAVs[1],
+	                                       &mEmittedCountUAV, &mSortKeysUAV };
+	ID3D11ShaderResourceView**  srvs[] = { &mEmitterBufferSRV, &mParticleBufferSRV, &mAliveListSRVs[0], &mAliveListSRVs[1],
+	                                       &mSortKeysSRV };
+	ID3D11Buffer**           buffers[] = { &mEmitterBuffer, &mParticleBuffer, &mDeadList, &mAliveLists[0], &mAliveLists[1],
+	                                       &mEmittedCount, &mSortKeys, &mDrawArgs, &mConstantBuffer, &mCountsBuffer,
+	                                       &mSortConstantBuffer };
+	for (auto uav    : uavs)     if (*uav)     { (*uav)->Release();     *uav     = nullptr; }
+	for (auto srv    : srvs)     if (*srv)     { (*srv)->Release();     *srv     = nullptr; }
+	for (auto buffer : buffers)  if (*buffer)  { (*buffer)->Release();  *buffer  = nullptr; }
+}
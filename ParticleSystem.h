@@ -0,0 +1,214 @@
+//--------------------------------------------------------------------------------------
+// GPU particle system - spray, splashes, foam and light flares
+//--------------------------------------------------------------------------------------
+// Every particle lives on the GPU from when it is emitted until it dies, the CPU only says where
+// particles start each frame. The particles are in one buffer, with lists of the indexes of the
+// live particles and of the unused ones. Each frame, in compute shaders:
+// - Simulate: every live particle moves on by the frame time. Those still alive are appended to
+//   this frame's live list, which stays packed, and the dead ones go back to the unused list
+// - Emit: the emitters given this frame start their particles, each taking an unused particle
+//   and appending it to the live list. When the unused particles run out the rest are dropped
+// - Sort: the live particles are sorted back to front from the camera with a bitonic sort
+// The live list's count is copied into the arguments of an indirect draw, so the particles are
+// drawn as billboards with one DrawInstancedIndirect, however many there are. The CPU never
+// knows how many particles are alive - a hundred thousand cost it no more than ten.
+//
+// Blended particles (spray, foam) and additive ones (light flares) are drawn together in the one
+// draw with premultiplied alpha (see Particle_ps.hlsl). An emitter can also have its particles die
+// when they fall back into the water, float on the surface, or only start where the water over the
+// shore map is shallow, which is how the foam along the shore is made.
+//
+// The particles are drawn in the main pass only, sorted for the main camera. The reflection and
+// refraction passes still draw the light flares as an instanced model (see Scene.cpp).
+
+#include "CVector3.h"
+#include <d3d11.h>
+#include <vector>
+
+#ifndef _PARTICLE_SYSTEM_H_INCLUDED_
+#define _PARTICLE_SYSTEM_H_INCLUDED_
+
+class WaterBody;
+
+
+// Particle flags, for an emitter's particles. Must match the flags in Particles.hlsli
+enum ParticleFlags : unsigned int
+{
+	ParticleAdditive   = 1, // Added to the scene rather than blended over it, e.g. light flares
+	ParticleDieInWater = 2, // Dies when it falls back into the water, e.g. spray
+	ParticleOnShore    = 4, // Only emitted where the water over the shore map is shallow, e.g. foam
+	ParticleFloating   = 8, // Stays on the water surface and isn't pulled down
+};
+
+// Particles to start this frame, all alike except for the spreads. Sizes are half the width of the billboard. Passed straight
+// to the GPU, must match ParticleEmitter in Particles.hlsli
+struct ParticleEmitter
+{
+	CVector3     position       = { 0, 0, 0 };
+	unsigned int count          = 1;           // Particles to emit this frame
+	CVector3     positionSpread = { 0, 0, 0 }; // Particles start anywhere in the box this far either side of the position
+	float        lifetime       = 1;           // Seconds, 0 to live for one frame
+	CVector3     velocity       = { 0, 0, 0 };
+	float        lifetimeSpread = 0;           // Lifetime is up to this much either way
+	CVector3     velocitySpread = { 0, 0, 0 }; // Velocity is up to this much either way in each axis
+	float        drag           = 0;           // Part of the velocity lost each second
+	CVector3     colour         = { 1, 1, 1 };
+	float        alpha          = 1;           // When emitted, fades out over the lifetime
+	float        startSize      = 1;
+	float        endSize        = 1;
+	unsigned int flags          = 0;           // ParticleFlags
+	float        padding        = 0;
+};
+
+
+class ParticleSystem
+{
+//--------------------------------------------------------------------------------------
+// Construction / Usage
+//--------------------------------------------------------------------------------------
+public:
+
+	// Create the buffers for up to the given number of particles, a power of 2 of at least SortGroupSize
+	// Will throw a std::runtime_error exception on failure (same as Mesh)
+	ParticleSystem(unsigned int maxParticles = 131072);
+	~ParticleSystem();
+
+	ParticleSystem(const ParticleSystem&) = delete;
+	ParticleSystem& operator=(const ParticleSystem&) = delete;
+
+
+	// Add an emitter for this frame's new particles. Call for each emitter each frame before Update. Emitters with no
+	// particles are skipped. Returns false if there are already as many emitters as can be given to the GPU in a frame
+	bool Emit(const ParticleEmitter& emitter);
+
+	// Simulate the particles over the given frame time (seconds), emit this frame's particles, then sort them from the given
+	// camera position for Render, and forget this frame's emitters. The particles fall into the given water body (nullptr for
+	// none), and its shore map is where the ParticleOnShore particles start, in water up to the given depth. Call once per
+	// frame on the immediate context. Leaves the compute shader stage with nothing bound
+	void Update(float frameTime, const CVector3& cameraPosition, WaterBody* water, float shoreFoamDepth);
+
+	// Draw the live particles, back to front, with one indirect draw. Select Particle_vs and Particle_ps, the particle
+	// texture, premultiplied alpha blending and a read-only depth buffer first. All other per-frame constants must have been
+	// set already. The particles are as they were at the last Update
+	void Render();
+
+	unsigned int MaxParticles()  { return mMaxParticles; }
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions / data
+//--------------------------------------------------------------------------------------
+private:
+
+	// Threads in each group of the emit and simulate shaders, and in each group of the sort shader, which sorts blocks of this
+	// many particles in group shared memory. Must match ParticleThreadGroupSize and ParticleSortGroupSize in Particles.hlsli
+	static constexpr unsigned int ThreadGroupSize = 64;
+	static constexpr unsigned int SortGroupSize   = 512;
+
+	// Most emitters given to the GPU each frame
+	static constexpr unsigned int MaxEmitters = 4096;
+
+	// Pull on falling particles, world units per second squared
+	static constexpr float Gravity = 20.0f;
+
+	// A particle, only so its size is known. The GPU reads and writes these, see Particle in Particles.hlsli
+	struct Particle
+	{
+		CVector3     position;
+		float        age;
+		CVector3     velocity;
+		float        lifetime;
+		CVector3     colour;
+		float        alpha;
+		float        startSize;
+		float        endSize;
+		float        drag;
+		unsigned int flags;
+	};
+
+	// Constants for the compute shaders. There is a structure in Particles.hlsli that exactly matches this one
+	struct ParticleConstants
+	{
+		float        frameTime;
+		float        gravity;
+		unsigned int maxParticles;
+		unsigned int numEmitters;
+
+		CVector3     cameraPosition;
+		unsigned int randomSeed;
+
+		float        waterHeight;
+		float        shoreFoamDepth;
+		float        shoreMapOrigin[2];
+
+		float        shoreMapScale[2];
+		float        shoreMapEnabled;
+		float        padding;
+	};
+
+	// Counts of the lists, copied in on the GPU, matches ParticleCounts in Particles.hlsli
+	struct ParticleCounts
+	{
+		unsigned int aliveCount;
+		unsigned int deadCount;
+		unsigned int padding[2];
+	};
+
+	// A pass of the sort shader, matches SortConstants in ParticleSort_cs.hlsl
+	enum SortMode : unsigned int { SortBuildKeys, SortMergeStep, SortMergeGroup };
+	struct SortConstants
+	{
+		unsigned int level;
+		unsigned int step;
+		SortMode     mode;
+		unsigned int padding;
+	};
+
+	// Run a pass of the sort shader over all the keys
+	void Sort(unsigned int level, unsigned int step, SortMode mode);
+
+	void Release();
+
+
+	unsigned int mMaxParticles;
+	unsigned int mFrame = 0;       // Frames updated, for the random numbers
+	bool         mStarted = false; // Whether the lists' counts have been set yet
+
+	// This frame's emitters, and the buffer they are sent to the GPU in
+	std::vector<ParticleEmitter> mEmitters;
+	ID3D11Buffer*                mEmitterBuffer    = nullptr;
+	ID3D11ShaderResourceView*    mEmitterBufferSRV = nullptr;
+
+	// Every particle, read by the vertex shader and written by the compute shaders
+	ID3D11Buffer*              mParticleBuffer    = nullptr;
+	ID3D11ShaderResourceView*  mParticleBufferSRV = nullptr;
+	ID3D11UnorderedAccessView* mParticleBufferUAV = nullptr;
+
+	// Indexes of the unused particles, and of the live particles last frame and this frame in turn. The lists are append /
+	// consume buffers, their counts are kept on the GPU
+	ID3D11Buffer*              mDeadList    = nullptr;
+	ID3D11UnorderedAccessView* mDeadListUAV = nullptr;
+	ID3D11Buffer*              mAliveLists[2]    = {};
+	ID3D11ShaderResourceView*  mAliveListSRVs[2] = {};
+	ID3D11UnorderedAccessView* mAliveListUAVs[2] = {};
+	int                        mCurrent = 0; // The live list written by the last Update
+
+	// Particles emitted so far in the frame, so the emitters don't take more than there are unused
+	ID3D11Buffer*              mEmittedCount    = nullptr;
+	ID3D11UnorderedAccessView* mEmittedCountUAV = nullptr;
+
+	// Sort keys for every particle the system can hold
+	ID3D11Buffer*              mSortKeys    = nullptr;
+	ID3D11ShaderResourceView*  mSortKeysSRV = nullptr;
+	ID3D11UnorderedAccessView* mSortKeysUAV = nullptr;
+
+	// Arguments for the indirect draw, the instance count is copied in on the GPU
+	ID3D11Buffer* mDrawArgs = nullptr;
+
+	ID3D11Buffer* mConstantBuffer     = nullptr;
+	ID3D11Buffer* mCountsBuffer       = nullptr; // Not dynamic, the counts are copied into it on the GPU
+	ID3D11Buffer* mSortConstantBuffer = nullptr;
+};
+
+
+#endif //_PARTICLE_SYSTEM_H_INCLUDED_
@@ -0,0 +1,32 @@
+//--------------------------------------------------------------------------------------
+// Particle pixel shader
+//--------------------------------------------------------------------------------------
+// Shades a particle billboard (see Particle_vs.hlsl). Output is premultiplied alpha, so blended and added particles can be
+// drawn together in one draw: the blend state adds the colour and keeps (1 - alpha) of what is behind, and additive particles
+// output an alpha of 0
+
+#include "Common.hlsli"
+
+
+//--------------------------------------------------------------------------------------
+// Textures (texture maps)
+//--------------------------------------------------------------------------------------
+
+// The particle texture is a soft blob on black, with no alpha channel. Its brightness is used as the coverage
+Texture2D    ParticleMap    : register(t0);
+SamplerState StandardFilter : register(s0);
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+float4 main(ParticlePixelShaderInput input) : SV_Target
+{
+	float3 mapColour = ParticleMap.Sample(StandardFilter, input.uv).rgb;
+	float  coverage = max(mapColour.r, max(mapColour.g, mapColour.b)) * input.colour.a;
+
+	// The texture is already dark where the coverage is low, so only the alpha needs scaling for the blend
+	float3 colour = input.colour.rgb * mapColour * input.colour.a;
+	return float4(colour, coverage * (1 - input.additive));
+}
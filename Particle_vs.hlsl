@@ -0,0 +1,45 @@
+//--------------------------------------------------------------------------------------
+// Particle vertex shader
+//--------------------------------------------------------------------------------------
+// Draws the live particles as camera facing billboards with no vertex buffer, one instance for each particle in back to
+// front order (see ParticleSystem::Render). The four vertices of each instance are the corners of its billboard, drawn as
+// a triangle strip. The corners are spread out in camera space, so the billboard faces the camera whichever way it turns
+
+#define PARTICLE_RENDERING
+#include "Common.hlsli"
+#include "Particles.hlsli"
+
+
+//--------------------------------------------------------------------------------------
+// Textures
+//--------------------------------------------------------------------------------------
+
+StructuredBuffer<Particle> Particles : register(t9);  // The t9 and t10 must match the slots used in ParticleSystem::Render
+StructuredBuffer<uint2>    SortKeys  : register(t10); // Distance and particle index, furthest first (see ParticleSort_cs)
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+// Vertices 0, 1, 2 and 3 are the top-left, top-right, bottom-left and bottom-right corners
+ParticlePixelShaderInput main(uint vertexID : SV_VertexID, uint instanceID : SV_InstanceID)
+{
+	ParticlePixelShaderInput output;
+
+	Particle particle = Particles[SortKeys[instanceID].y];
+	float life = particle.lifetime > 0 ? saturate(particle.age / particle.lifetime) : 0;
+	float size = lerp(particle.startSize, particle.endSize, life);
+
+	float2 corner = float2(vertexID & 1, vertexID >> 1);
+	float4 viewPosition = mul(gViewMatrix, float4(particle.position, 1));
+	viewPosition.xy += float2(corner.x * 2 - 1, 1 - corner.y * 2) * size;
+	output.projectedPosition = mul(gProjectionMatrix, viewPosition);
+	output.uv = corner;
+
+	// Fade out over the particle's life. Additive particles give no coverage, so nothing behind is hidden (see Particle_ps)
+	output.colour   = float4(particle.colour, particle.alpha * (1 - life));
+	output.additive = (particle.flags & ParticleAdditive) ? 1.0f : 0.0f;
+
+	return output;
+}
@@ -0,0 +1,102 @@
+//--------------------------------------------------------------------------------------
+// Particle system definitions shared by the particle shaders (see ParticleSystem.h)
+//--------------------------------------------------------------------------------------
+// The particle vertex shader uses the rendering constant buffers, so defines PARTICLE_RENDERING
+// before including this file to leave out the compute shaders' constant buffers below
+
+#ifndef _PARTICLES_HLSLI_DEFINED_
+#define _PARTICLES_HLSLI_DEFINED_
+
+
+//--------------------------------------------------------------------------------------
+// Constants
+//--------------------------------------------------------------------------------------
+
+static const uint ParticleThreadGroupSize = 64;  // Must match ThreadGroupSize in ParticleSystem.h
+static const uint ParticleSortGroupSize   = 512; // Must match SortGroupSize in ParticleSystem.h
+
+// Particle flags, must match the ParticleFlags in ParticleSystem.h
+static const uint ParticleAdditive   = 1; // Added to the scene rather than blended over it, e.g. light flares
+static const uint ParticleDieInWater = 2; // Dies when it falls back into the water, e.g. spray
+static const uint ParticleOnShore    = 4; // Only emitted where the water over the shore map is shallow, e.g. foam
+static const uint ParticleFloating   = 8; // Stays on the water surface and isn't pulled down
+
+
+//--------------------------------------------------------------------------------------
+// Structures
+//--------------------------------------------------------------------------------------
+
+// A live particle. Only the GPU reads and writes these
+struct Particle
+{
+	float3 position;
+	float  age;       // Seconds since it was emitted
+	float3 velocity;
+	float  lifetime;  // Seconds, 0 to live for one frame
+	float3 colour;
+	float  alpha;     // When emitted, fades out over the lifetime
+	float  startSize; // Half the width of the billboard when emitted and when it dies
+	float  endSize;
+	float  drag;      // Part of the velocity lost each second
+	uint   flags;
+};
+
+// These variables must match exactly the ParticleEmitter structure in ParticleSystem.h
+struct ParticleEmitter
+{
+	float3 position;
+	uint   count;          // Particles to emit this frame
+	float3 positionSpread; // Particles start anywhere in the box this far either side of the position
+	float  lifetime;
+	float3 velocity;
+	float  lifetimeSpread; // Lifetime is up to this much either way
+	float3 velocitySpread; // Velocity is up to this much either way in each axis
+	float  drag;
+	float3 colour;
+	float  alpha;
+	float  startSize;
+	float  endSize;
+	uint   flags;
+	float  padding;
+};
+
+
+//--------------------------------------------------------------------------------------
+// Constant Buffers
+//--------------------------------------------------------------------------------------
+// The compute shaders don't use the rendering constant buffers so have their own, and don't include Common.hlsli
+
+#ifndef PARTICLE_RENDERING
+
+// These variables must match exactly the ParticleConstants structure in ParticleSystem.h
+cbuffer ParticleConstants : register(b0) // Compute shaders have their own constant buffer slots, so b0 is not the per-frame constants here
+{
+	float  gParticleFrameTime;
+	float  gParticleGravity;
+	uint   gMaxParticles;
+	uint   gNumEmitters;
+
+	float3 gSortCameraPosition; // Particles are sorted back to front from here
+	uint   gRandomSeed;         // Different every frame
+
+	float  gParticleWaterHeight;
+	float  gShoreFoamDepth;     // Deepest water foam on the shore is emitted over
+	float2 gParticleShoreMapOrigin;
+
+	float2 gParticleShoreMapScale;
+	float  gParticleShoreMapEnabled;
+	float  paddingParticles;
+}
+
+// Counts of the particle lists, copied in on the GPU (see ParticleSystem::Update). Must match ParticleCounts in ParticleSystem.h
+cbuffer ParticleCounts : register(b1)
+{
+	uint  gAliveCount; // Particles in the list being read, or in the list just written once the particles have been emitted
+	uint  gDeadCount;  // Unused particles that can be emitted
+	uint2 paddingCounts;
+}
+
+#endif // PARTICLE_RENDERING
+
+
+#endif // _PARTICLES_HLSLI_DEFINED_
@@ -5,6 +5,9 @@
 // lighting per pixel. Also samples a samples a diffuse + specular texture map and combines with light colour.
 
 #include "Common.hlsli" // Shaders can also use include files - note the extension
+#include "LightGrid.hlsli" // The point lights, found from the pixel's cell of the light grid
+#include "ShadowMap.hlsli" // Shadows of the key light
+#include "Caustics.hlsli"  // The key light focused by the waves, under the water
 
 
 //--------------------------------------------------------------------------------------
@@ -14,7 +17,8 @@
 // Here we allow the shader access to a texture that has been loaded from the C++ side and stored in GPU memory.
 // Note that textures are often called maps (because texture mapping describes wrapping a texture round a mesh).
 // Get used to people using the word "texture" and "map" interchangably.
-Texture2D DiffuseSpecularMap : register(t0); // Textures here can contain a diffuse map (main colour) in their rgb channels and a specular map (shininess) in the a channel
+Texture2DArray DiffuseSpecularMap : register(t0); // Textures here can contain a diffuse map (main colour) in their rgb channels and a specular map (shininess) in the a channel
+                                                  // Each model's texture is a layer of an array shared by the models (see Material.h)
 SamplerState StandardFilter  : register(s0); // Filtering used on most textures (trilinear or anisotropic - chosen on the C++ side)
 
 
@@ -27,7 +31,7 @@ SamplerState StandardFilter  : register(s0); // Filtering used on most textures
 // code doesn't have to be written several times (the reflection and refraction shaders use this code as part of their work)
 // In Visual Studio, on the HLSL properties for this file, the Entry Point has been defined to this function name
 
-// Standard two light diffuse and specular lighting
+// Standard diffuse and specular lighting from the lights reaching the pixel's light grid cell
 float4 PixelLighting(LightingPixelShaderInput input) : SV_Target
 {
     // Normal might have been scaled by model scaling or interpolation so renormalise
@@ -39,38 +43,35 @@ float4 PixelLighting(LightingPixelShaderInput input) : SV_Target
     // Direction from pixel to camera
     float3 cameraDirection = normalize(gCameraPosition - input.worldPosition);
 
-	//// Light 1 ////
-
-	// Direction and distance from pixel to light
-	float3 light1Direction = normalize(gLight1Position - input.worldPosition);
-    float3 light1Dist = length(gLight1Position - input.worldPosition);
-    
-    // Equations from lighting lecture
-    float3 diffuseLight1 = gLight1Colour * max(dot(input.worldNormal, light1Direction), 0) / light1Dist; 
-    float3 halfway = normalize(light1Direction + cameraDirection);
-    float3 specularLight1 =  diffuseLight1 * pow(max(dot(input.worldNormal, halfway), 0), gSpecularPower); // Multiplying by diffuseLight instead of light colour - my own personal preference
-
-
-	//// Light 2 ////
+	// Sum the effect of the lights - add the ambient at this stage rather than for each light (or we will get too much ambient)
+	float3 diffuseLight = gAmbientColour;
+	float3 specularLight = 0;
 
-	float3 light2Direction = normalize(gLight2Position - input.worldPosition);
-    float3 light2Dist = length(gLight2Position - input.worldPosition);
-    float3 diffuseLight2 = gLight2Colour * max(dot(input.worldNormal, light2Direction), 0) / light2Dist; 
-    halfway = normalize(light2Direction + cameraDirection);
-    float3 specularLight2 =  diffuseLight2 * pow(max(dot(input.worldNormal, halfway), 0), gSpecularPower);
+	uint2 cell = LightCell(input.worldPosition);
+	for (uint i = 0; i < cell.y; ++i)
+	{
+		PointLight light = Lights[LightIndices[cell.x + i]];
 
+		// Direction and distance from pixel to light
+		float3 lightVector = light.position - input.worldPosition;
+		float  lightDist = length(lightVector);
+		float3 lightDirection = lightVector / lightDist;
 
-	// Sum the effect of the lights - add the ambient at this stage rather than for each light (or we will get too much ambient)
-	float3 diffuseLight = gAmbientColour + diffuseLight1 + diffuseLight2;
-	float3 specularLight = specularLight1 + specularLight2;
+		// Equations from lighting lecture
+		float3 diffuseLightI = light.colour * max(dot(input.worldNormal, lightDirection), 0) * LightFalloff(lightDist, light.range);
+		if (light.shadowed != 0)  diffuseLightI *= ShadowFactor(input.worldPosition) * CausticsFactor(input.worldPosition, light.position);
+		float3 halfway = normalize(lightDirection + cameraDirection);
+		diffuseLight  += diffuseLightI;
+		specularLight += diffuseLightI * pow(max(dot(input.worldNormal, halfway), 0), gSpecularPower); // Multiplying by diffuseLight instead of light colour - my own personal preference
+	}
 
 
 	////////////////////
 	// Combine lighting and textures
 
     // Sample diffuse material and specular material colour for this pixel from a texture using a given sampler that you set up in the C++ code
-    float4 textureColour = DiffuseSpecularMap.Sample(StandardFilter, input.uv);
-    float3 diffuseMaterialColour = textureColour.rgb; // Diffuse material colour in texture RGB (base colour of model)
+    float4 textureColour = DiffuseSpecularMap.Sample(StandardFilter, float3(input.uv, gTextureLayer));
+    float3 diffuseMaterialColour = textureColour.rgb * gObjectColour; // Diffuse material colour in texture RGB (base colour of model), tinted by the material
     float specularMaterialColour = textureColour.a;   // Specular material colour in texture A (shininess of the surface)
 
     // Combine lighting with texture colours
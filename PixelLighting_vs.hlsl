@@ -30,11 +30,14 @@ LightingPixelShaderInput main(BasicVertex modelVertex)
 
     // Also transform model normals into world space using world matrix - lighting will be calculated in world space
     // Pass this normal to the pixel shader as it is needed to calculate per-pixel lighting
-    float4 modelNormal = float4(modelVertex.normal, 0);      // For normals add a 0 in the 4th element to indicate it is a vector
+    float4 modelNormal = float4(ModelNormal(modelVertex), 0); // For normals add a 0 in the 4th element to indicate it is a vector
     output.worldNormal = mul(gWorldMatrix, modelNormal).xyz; // Only needed the 4th element to do this multiplication by 4x4 matrix...
                                                              //... it is not needed for lighting so discard afterwards with the .xyz
     output.worldPosition = worldPosition.xyz; // Also pass world position to pixel shader for lighting
 
+    // Hardware clipping against the water for the refraction / reflection passes, nothing is clipped in other passes
+    output.clipDistance = dot(worldPosition, gWaterClipPlane);
+
     // Pass texture coordinates (UVs) on to the pixel shader, the vertex shader doesn't need them
     output.uv = modelVertex.uv;
 
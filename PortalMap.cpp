@@ -0,0 +1,375 @@
+//--------------------------------------------------------------------------------------
+// Portal map - the cells of a level's interiors and the portals joining them, to find what can be seen
+//--------------------------------------------------------------------------------------
+
+#include "PortalMap.h"
+#include "AssetArchive.h"
+#include "CMatrix4x4.h"
+
+#include <assimp/Importer.hpp>
+#include <assimp/scene.h>
+#include <assimp/postprocess.h>
+
+#include <Windows.h>
+#include <algorithm>
+#include <stdexcept>
+#include <cmath>
+
+
+PortalSettings gPortalSettings;
+PortalMap*     gPortalMap = nullptr;
+
+
+//--------------------------------------------------------------------------------------
+// Construction
+//--------------------------------------------------------------------------------------
+
+// Load the cells and portals from the nodes of the given mesh file
+// Will throw a std::runtime_error exception on failure (same as Mesh)
+PortalMap::PortalMap(const std::wstring& fileName)
+{
+	// The mesh files are read by name in the system's code page, as the scene's mesh file names are
+	char name[MAX_PATH];
+	if (WideCharToMultiByte(CP_ACP, 0, fileName.c_str(), -1, name, MAX_PATH, nullptr, nullptr) == 0)
+	{
+		throw std::runtime_error("Error reading portal map file name");
+	}
+
+	// Only the positions are needed, in the scene's left-handed space like the other meshes
+	Assimp::Importer importer;
+	importer.SetPropertyInteger(AI_CONFIG_PP_RVC_FLAGS, aiComponent_NORMALS | aiComponent_TANGENTS_AND_BITANGENTS |
+	                            aiComponent_COLORS | aiComponent_TEXCOORDS | aiComponent_BONEWEIGHTS | aiComponent_ANIMATIONS |
+	                            aiComponent_TEXTURES | aiComponent_LIGHTS | aiComponent_CAMERAS | aiComponent_MATERIALS);
+	importer.SetIOHandler(NewAssetIOSystem()); // Read the file from the asset archive if it's there
+	const aiScene* scene = importer.ReadFile(name, aiProcess_MakeLeftHanded | aiProcess_RemoveComponent | aiProcess_JoinIdenticalVertices);
+	if (scene == nullptr)  throw std::runtime_error(std::string("Error loading portal map (") + name + "). " + importer.GetErrorString());
+
+	mCells.emplace_back(); // The outdoors
+	std::vector<std::vector<CVector3>> portalPoints;
+	std::vector<std::string> portalNames;
+	ReadNode(scene, scene->mRootNode, MatrixIdentity(), -1, -1, portalPoints, portalNames);
+	for (size_t cell = 1; cell < mCells.size(); ++cell)
+	{
+		if (mCells[cell].bounds.IsEmpty())  throw std::runtime_error(std::string("Portal map cell has no mesh: ") + name);
+	}
+	BuildPortals(portalPoints, portalNames);
+}
+
+
+// Read the cells and portals from a node and its children, with the node's parent's world matrix. Nodes whose name begins Cell
+// or Portal start a new one, the meshes of the node and its children are added to it: to the given cell's box, or to the given
+// portal's points and name, -1 for neither
+void PortalMap::ReadNode(const aiScene* scene, const aiNode* node, const CMatrix4x4& parentMatrix, int cell, int portal,
+                         std::vector<std::vector<CVector3>>& portalPoints, std::vector<std::string>& portalNames)
+{
+	// Assimp's matrices are stored by columns, as Mesh reads them
+	CMatrix4x4 matrix;
+	matrix.SetValues(const_cast<float*>(&node->mTransformation.a1));
+	matrix.Transpose();
+	matrix = matrix * parentMatrix;
+
+	std::string name = node->mName.C_Str();
+	if (name.compare(0, 4, "Cell") == 0)
+	{
+		cell = static_cast<int>(mCells.size());
+		portal = -1;
+		mCells.emplace_back();
+	}
+	else if (name.compare(0, 6, "Portal") == 0)
+	{
+		portal = static_cast<int>(portalPoints.size());
+		cell = -1;
+		portalPoints.emplace_back();
+		portalNames.push_back(name);
+	}
+
+	if (cell >= 0 || portal >= 0)
+	{
+		for (unsigned int m = 0; m < node->mNumMeshes; ++m)
+		{
+			const aiMesh* mesh = scene->mMeshes[node->mMeshes[m]];
+			for (unsigned int v = 0; v < mesh->mNumVertices; ++v)
+			{
+				const aiVector3D& vertex = mesh->mVertices[v];
+				CVector4 world = CVector4(vertex.x, vertex.y, vertex.z, 1.0f) * matrix;
+				CVector3 point(world.x, world.y, world.z);
+				if (cell >= 0)  mCells[cell].bounds.Add(point);
+				else            portalPoints[portal].push_back(point);
+			}
+		}
+	}
+
+	for (unsigned int child = 0; child < node->mNumChildren; ++child)
+	{
+		ReadNode(scene, node->mChildren[child], matrix, cell, portal, portalPoints, portalNames);
+	}
+}
+
+
+// Turn the points of each portal into a polygon in order and join it to its cells. Throws a std::runtime_error exception for a
+// portal that isn't flat or touches more than two cells
+void PortalMap::BuildPortals(std::vector<std::vector<CVector3>>& portalPoints, const std::vector<std::string>& portalNames)
+{
+	const float SamePoint = 0.01f; // Points this close are the same corner, e.g. from two triangles of a quad
+
+	for (size_t p = 0; p < portalPoints.size(); ++p)
+	{
+		const std::string& name = portalNames[p];
+		std::vector<CVector3>& points = portalPoints[p];
+
+		// The corners, each once
+		Portal portal;
+		for (const CVector3& point : points)
+		{
+			bool found = false;
+			for (const CVector3& vertex : portal.vertices)  found = found || Length(point - vertex) < SamePoint;
+			if (!found)  portal.vertices.push_back(point);
+		}
+		if (portal.vertices.size() < 3)  throw std::runtime_error("Portal has fewer than three corners: " + name);
+
+		// The plane, its normal summed over the triangles from the centre to each pair of corners so no one thin triangle decides it
+		CVector3 centre = { 0, 0, 0 };
+		for (const CVector3& vertex : portal.vertices)
+		{
+			centre = centre + vertex;
+			portal.bounds.Add(vertex);
+		}
+		centre = centre / static_cast<float>(portal.vertices.size());
+		CVector3 normal = { 0, 0, 0 };
+		for (size_t i = 0; i < portal.vertices.size(); ++i)
+		{
+			CVector3 cross = Cross(portal.vertices[i] - centre, portal.vertices[(i + 1) % portal.vertices.size()] - centre);
+			if (Dot(cross, normal) < 0)  cross = cross * -1.0f; // Corners not in order yet, keep them all facing one way
+			normal = normal + cross;
+		}
+		if (Length(normal) < SamePoint * SamePoint)  throw std::runtime_error("Portal has no area: " + name);
+		normal = Normalise(normal);
+		for (const CVector3& vertex : portal.vertices)
+		{
+			if (std::abs(Dot(vertex - centre, normal)) > SamePoint * 10)  throw std::runtime_error("Portal isn't flat: " + name);
+		}
+
+		// Put the corners in order around the centre, by their angle in the plane
+		CVector3 axisX = Normalise(portal.vertices[0] - centre);
+		CVector3 axisY = Cross(normal, axisX);
+		std::sort(portal.vertices.begin(), portal.vertices.end(), [&](const CVector3& a, const CVector3& b)
+		{
+			return std::atan2(Dot(a - centre, axisY), Dot(a - centre, axisX)) <
+			       std::atan2(Dot(b - centre, axisY), Dot(b - centre, axisX));
+		});
+
+		// The cells the portal touches, the outdoors if it only touches one
+		int cells[2] = { -1, -1 };
+		int numCells = 0;
+		for (int cell = 1; cell < NumCells(); ++cell)
+		{
+			const BoundingBox& box = mCells[cell].bounds;
+			bool touches = portal.bounds.min.x <= box.max.x + CellMargin && portal.bounds.max.x >= box.min.x - CellMargin &&
+			               portal.bounds.min.y <= box.max.y + CellMargin && portal.bounds.max.y >= box.min.y - CellMargin &&
+			               portal.bounds.min.z <= box.max.z + CellMargin && portal.bounds.max.z >= box.min.z - CellMargin;
+			if (!touches)  continue;
+			if (numCells == 2)  throw std::runtime_error("Portal touches more than two cells: " + name);
+			cells[numCells++] = cell;
+		}
+		if (numCells == 0)  throw std::runtime_error("Portal doesn't touch a cell: " + name);
+		if (numCells == 1)  cells[1] = Outdoors;
+
+		// The plane faces into the first cell - the cell whose centre is on that side
+		const BoundingBox& frontBox = mCells[cells[0]].bounds;
+		CVector3 frontCentre = (frontBox.min + frontBox.max) * 0.5f;
+		if (Dot(frontCentre - centre, normal) < 0)  normal = normal * -1.0f;
+		portal.plane = CVector4(normal, -Dot(normal, centre));
+		portal.frontCell = cells[0];
+		portal.backCell  = cells[1];
+
+		int index = static_cast<int>(mPortals.size());
+		mCells[cells[0]].portals.push_back(index);
+		mCells[cells[1]].portals.push_back(index);
+		mPortals.push_back(std::move(portal));
+	}
+}
+
+
+//--------------------------------------------------------------------------------------
+// Usage
+//--------------------------------------------------------------------------------------
+
+// Find the cells visible from a camera at the given position with the given frustum, and the frustum each is seen through, for
+// the IsVisible functions below. Call once a frame for the main camera
+void PortalMap::FindVisibleCells(const CVector3& cameraPosition, const Frustum& frustum)
+{
+	mViews.clear();
+	mPath.clear();
+	mCameraPosition = cameraPosition;
+	mFarPlane = frustum.planes[Frustum::Far];
+	mCameraCell = CellAt(cameraPosition);
+	VisitCell(mCameraCell, frustum, 0);
+
+	// A cell seen through several portals has several views
+	mNumVisibleCells = 0;
+	for (size_t i = 0; i < mViews.size(); ++i)
+	{
+		bool first = true;
+		for (size_t j = 0; j < i; ++j)  first = first && mViews[j].cell != mViews[i].cell;
+		if (first)  ++mNumVisibleCells;
+	}
+}
+
+
+// Whether some of a sphere might be seen in the cells found visible by FindVisibleCells: it is in or overlaps one of them, and
+// is in the frustum that cell is seen through
+bool PortalMap::IsVisible(const BoundingSphere& sphere) const
+{
+	if (sphere.radius < 0)  return false;
+
+	CVector3 extent = { sphere.radius, sphere.radius, sphere.radius };
+	BoundingBox box;
+	box.min = sphere.centre - extent;
+	box.max = sphere.centre + extent;
+	for (const CellView& view : mViews)
+	{
+		if (Overlaps(view.cell, box) && SphereInFrustum(view.frustum, sphere))  return true;
+	}
+	return false;
+}
+
+// Whether some of a box might be seen, as above. An empty box is anywhere (e.g. the open water), so is visible if the outdoors is
+bool PortalMap::IsVisible(const BoundingBox& box) const
+{
+	for (const CellView& view : mViews)
+	{
+		if (box.IsEmpty())
+		{
+			if (view.cell == Outdoors)  return true;
+		}
+		else if (Overlaps(view.cell, box) && BoxInFrustum(view.frustum, box))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions
+//--------------------------------------------------------------------------------------
+
+// The cell containing a point, the outdoors if it isn't in any of the others
+int PortalMap::CellAt(const CVector3& point) const
+{
+	for (int cell = 1; cell < NumCells(); ++cell)
+	{
+		const BoundingBox& box = mCells[cell].bounds;
+		if (point.x >= box.min.x && point.y >= box.min.y && point.z >= box.min.z &&
+		    point.x <= box.max.x && point.y <= box.max.y && point.z <= box.max.z)  return cell;
+	}
+	return Outdoors;
+}
+
+
+// Whether a box overlaps a cell, the outdoors overlaps anything not wholly inside one of the others
+bool PortalMap::Overlaps(int cell, const BoundingBox& box) const
+{
+	if (cell == Outdoors)
+	{
+		for (int other = 1; other < NumCells(); ++other)
+		{
+			const BoundingBox& inside = mCells[other].bounds;
+			if (box.min.x >= inside.min.x && box.min.y >= inside.min.y && box.min.z >= inside.min.z &&
+			    box.max.x <= inside.max.x && box.max.y <= inside.max.y && box.max.z <= inside.max.z)  return false;
+		}
+		return true;
+	}
+
+	const BoundingBox& bounds = mCells[cell].bounds;
+	return box.min.x <= bounds.max.x && box.max.x >= bounds.min.x &&
+	       box.min.y <= bounds.max.y && box.max.y >= bounds.min.y &&
+	       box.min.z <= bounds.max.z && box.max.z >= bounds.min.z;
+}
+
+
+// Add a view of a cell through the given frustum, then follow its portals to the cells beyond. Each portal seen is cut to the
+// frustum, and the cell beyond it is seen through the frustum of the camera's position and the edges of what is left, closed
+// by the portal's plane and the camera's far plane. Portals back to the cells on the way here aren't followed
+void PortalMap::VisitCell(int cell, const Frustum& frustum, int depth)
+{
+	mViews.push_back({ cell, frustum });
+	if (depth == MaxDepth)  return;
+
+	mPath.push_back(cell);
+	for (int p : mCells[cell].portals)
+	{
+		const Portal& portal = mPortals[p];
+		int next = portal.frontCell == cell ? portal.backCell : portal.frontCell;
+		if (std::find(mPath.begin(), mPath.end(), next) != mPath.end())  continue;
+
+		// The portal's plane facing into the next cell. The camera must be behind it to see into the cell
+		CVector4 plane = portal.plane;
+		if (next != portal.frontCell)  plane = CVector4(-plane.x, -plane.y, -plane.z, -plane.w);
+		float cameraDistance = plane.x * mCameraPosition.x + plane.y * mCameraPosition.y + plane.z * mCameraPosition.z + plane.w;
+		if (cameraDistance > InPortalDistance)  continue;
+
+		// Standing in the opening, the portal fills the view, so the next cell is seen through the same frustum in front of it
+		Frustum nextFrustum = frustum;
+		if (cameraDistance > -InPortalDistance)
+		{
+			AddClipPlane(nextFrustum, plane);
+			VisitCell(next, nextFrustum, depth + 1);
+			continue;
+		}
+
+		// What is left of the portal in the frustum
+		mClipped = portal.vertices;
+		for (int i = 0; i < frustum.numPlanes && mClipped.size() >= 3; ++i)  ClipPolygon(mClipped, frustum.planes[i], mClipScratch);
+		if (mClipped.size() < 3)  continue;
+
+		// A plane through the camera and each edge, facing into the portal. A portal cut to many edges keeps the frustum it was
+		// cut by rather than drop some of them
+		int numEdges = static_cast<int>(mClipped.size());
+		if (numEdges + 2 <= Frustum::MaxPlanes)
+		{
+			CVector3 centre = { 0, 0, 0 };
+			for (const CVector3& vertex : mClipped)  centre = centre + vertex;
+			centre = centre / static_cast<float>(numEdges);
+
+			nextFrustum.numPlanes = 0;
+			for (int i = 0; i < numEdges; ++i)
+			{
+				CVector3 normal = Cross(mClipped[i] - mCameraPosition, mClipped[(i + 1) % numEdges] - mCameraPosition);
+				if (Length(normal) < 1e-6f)  continue; // Edge on end to the camera, the other edges close the frustum
+				normal = Normalise(normal);
+				if (Dot(normal, centre - mCameraPosition) < 0)  normal = normal * -1.0f;
+				nextFrustum.planes[nextFrustum.numPlanes++] = CVector4(normal, -Dot(normal, mCameraPosition));
+			}
+			nextFrustum.planes[nextFrustum.numPlanes++] = plane;
+			nextFrustum.planes[nextFrustum.numPlanes++] = mFarPlane;
+		}
+		else
+		{
+			AddClipPlane(nextFrustum, plane);
+		}
+		VisitCell(next, nextFrustum, depth + 1);
+	}
+	mPath.pop_back();
+}
+
+
+// Cut a polygon to the inside of a plane (as a frustum plane), keeping the corners in order (Sutherland-Hodgman clipping). The
+// cut polygon is built in the given vector, then swapped with the polygon
+void PortalMap::ClipPolygon(std::vector<CVector3>& polygon, const CVector4& plane, std::vector<CVector3>& clipped)
+{
+	auto distance = [&](const CVector3& p) { return plane.x * p.x + plane.y * p.y + plane.z * p.z + plane.w; };
+
+	clipped.clear();
+	for (size_t i = 0; i < polygon.size(); ++i)
+	{
+		const CVector3& a = polygon[i];
+		const CVector3& b = polygon[(i + 1) % polygon.size()];
+		float distanceA = distance(a);
+		float distanceB = distance(b);
+		if (distanceA >= 0)  clipped.push_back(a);
+		if ((distanceA >= 0) != (distanceB >= 0))  clipped.push_back(a + (b - a) * (distanceA / (distanceA - distanceB)));
+	}
+	polygon.swap(clipped);
+}
@@ -0,0 +1,165 @@
+//--------------------------------------------------------------------------------------
+// Portal map - the cells of a level's interiors and the portals joining them, to find what can be seen
+//--------------------------------------------------------------------------------------
+// Indoors, most of a level is behind walls however close it is, which neither the frustum nor the
+// occlusion culling of earlier frames can tell until it is drawn. A portal map divides the level into
+// cells - rooms, corridors - and the openings between them - doors, windows - called portals. What
+// is outside all the cells is the outdoors, a cell of its own. From the cell the camera is in, only
+// the cells seen through its portals can be visible, and only in the part of the view through the
+// portal. So each frame the camera's frustum is clipped by the portals of its cell, then by the
+// portals of the cells seen through those, and so on, giving the visible cells each with the
+// frustum it is seen through (see FindVisibleCells).
+//
+// The map is loaded from a mesh file whose nodes are named for what they are: each node named
+// Cell... has the mesh of a room (only its box is used), and each node named Portal... has a flat
+// polygon across an opening. A portal joins the cells whose boxes it touches, or the one it touches
+// and the outdoors. The file is given with -portals on the command line (see Benchmark.h), without
+// it there is no map and everything is outdoors.
+//
+// The scene culls the main pass's models by the visible cells, and only renders the refraction and
+// reflection of the water bodies in a visible cell (see Scene.cpp).
+
+#include "Frustum.h"
+#include "CVector3.h"
+#include "CVector4.h"
+#include <string>
+#include <vector>
+
+#ifndef _PORTAL_MAP_H_INCLUDED_
+#define _PORTAL_MAP_H_INCLUDED_
+
+struct aiScene;
+struct aiNode;
+
+
+//--------------------------------------------------------------------------------------
+// Settings
+//--------------------------------------------------------------------------------------
+
+// Settings for the portal map, from the command line (see ParseBenchmarkCommandLine)
+struct PortalSettings
+{
+	std::wstring fileName; // Empty for no portal map
+};
+
+extern PortalSettings gPortalSettings;
+
+
+//--------------------------------------------------------------------------------------
+// Portal map class
+//--------------------------------------------------------------------------------------
+
+class PortalMap
+{
+//--------------------------------------------------------------------------------------
+// Construction / Usage
+//--------------------------------------------------------------------------------------
+public:
+
+	// Load the cells and portals from the nodes of the given mesh file (see above)
+	// Will throw a std::runtime_error exception on failure (same as Mesh)
+	PortalMap(const std::wstring& fileName);
+
+
+	// Find the cells visible from a camera at the given position with the given frustum, and the frustum each is seen
+	// through, for the IsVisible functions below. Call once a frame for the main camera
+	void FindVisibleCells(const CVector3& cameraPosition, const Frustum& frustum);
+
+	// Whether some of a sphere / box might be seen in the cells found visible by FindVisibleCells: it is in or overlaps one
+	// of them, and is in the frustum that cell is seen through. An empty box is anywhere (e.g. the open water), so is visible
+	// if the outdoors is
+	bool IsVisible(const BoundingSphere& sphere) const;
+	bool IsVisible(const BoundingBox&    box)    const;
+
+
+	// The cells including the outdoors / those found visible by FindVisibleCells / the one the camera is in
+	int NumCells()        const { return static_cast<int>(mCells.size()); }
+	int NumVisibleCells() const { return mNumVisibleCells; }
+	int CameraCell()      const { return mCameraCell; }
+
+	// The outdoors is always the first cell
+	static constexpr int Outdoors = 0;
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions / data
+//--------------------------------------------------------------------------------------
+private:
+
+	// Most portals followed from the camera's cell to a cell it can see. Past this the cells are too small on screen to matter
+	static constexpr int MaxDepth = 8;
+
+	// A portal's box must be this close to a cell's box to join it, for the gap a modeller leaves between a door and its frame
+	static constexpr float CellMargin = 0.5f;
+
+	// Within this distance of a portal's plane the camera is in the opening, and sees the whole of its view through it
+	static constexpr float InPortalDistance = 0.5f;
+
+	struct Cell
+	{
+		BoundingBox      bounds;  // Empty for the outdoors
+		std::vector<int> portals; // Indexes in mPortals
+	};
+
+	// A flat convex polygon, its vertices in order around it. The plane faces into the front cell, the other is behind it
+	struct Portal
+	{
+		std::vector<CVector3> vertices;
+		BoundingBox           bounds;
+		CVector4              plane;
+		int                   frontCell;
+		int                   backCell;
+	};
+
+	// A visible cell and the frustum it is seen through. A cell seen through more than one portal has a view for each
+	struct CellView
+	{
+		int     cell;
+		Frustum frustum;
+	};
+
+
+	// Read the cells and portals from a node and its children, with the node's parent's world matrix. Nodes whose name begins
+	// Cell or Portal start a new one, the meshes of the node and its children are added to it: to the given cell's box, or
+	// to the given portal's points and name, -1 for neither
+	void ReadNode(const aiScene* scene, const aiNode* node, const CMatrix4x4& parentMatrix, int cell, int portal,
+	              std::vector<std::vector<CVector3>>& portalPoints, std::vector<std::string>& portalNames);
+
+	// Turn the points of each portal into a polygon in order and join it to its cells. Throws a std::runtime_error exception
+	// for a portal that isn't flat or touches more than two cells
+	void BuildPortals(std::vector<std::vector<CVector3>>& portalPoints, const std::vector<std::string>& portalNames);
+
+	// The cell containing a point, the outdoors if it isn't in any of the others
+	int CellAt(const CVector3& point) const;
+
+	// Whether a box overlaps a cell, the outdoors overlaps anything not wholly inside one of the others
+	bool Overlaps(int cell, const BoundingBox& box) const;
+
+	// Add a view of a cell through the given frustum, then follow its portals to the cells beyond (see FindVisibleCells)
+	void VisitCell(int cell, const Frustum& frustum, int depth);
+
+	// Cut a polygon to the inside of a plane (as a frustum plane), built in the other vector given
+	static void ClipPolygon(std::vector<CVector3>& polygon, const CVector4& plane, std::vector<CVector3>& clipped);
+
+
+	std::vector<Cell>   mCells;
+	std::vector<Portal> mPortals;
+
+	// Found by FindVisibleCells, along with the position and far plane of its camera, and the cells on the way to the one being
+	// visited so portals back to them aren't followed
+	std::vector<CellView> mViews;
+	int                   mNumVisibleCells = 0;
+	int                   mCameraCell = Outdoors;
+	CVector3              mCameraPosition;
+	CVector4              mFarPlane;
+	std::vector<int>      mPath;
+	std::vector<CVector3> mClipped;     // The portal being cut to the frustum, and the cut built from it. Kept between portals
+	std::vector<CVector3> mClipScratch; // so they only allocate for the largest
+};
+
+
+// The level's portal map, nullptr if there isn't one (see PortalSettings)
+extern PortalMap* gPortalMap;
+
+
+#endif //_PORTAL_MAP_H_INCLUDED_
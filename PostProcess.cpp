@@ -0,0 +1,309 @@
+//--------------------------------------------------------------------------------------
+// HDR post-processing - exposure, bloom and tonemapping
+//--------------------------------------------------------------------------------------
+
+#include "PostProcess.h"
+#include "Shader.h"
+#include "State.h"
+#include "StateCache.h"
+#include "GpuEvents.h"
+#include "GpuMemory.h"
+#include "RenderTargetPool.h"
+#include "Common.h"
+#include "GraphicsHelpers.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+
+// Create the HDR scene texture and the texture the exposure adapts in, for a viewport of the given size. The scene is
+// multisampled with the given number of samples per pixel (MSAA), which must match the depth buffer used with it
+// Will throw a std::runtime_error exception on failure (same as Mesh)
+PostProcess::PostProcess(int width, int height, unsigned int samples /*= 1*/)
+	: mWidth(width), mHeight(height)
+{
+	mConstantBuffer = CreateConstantBuffer(sizeof(PostProcessConstants));
+	if (mConstantBuffer == nullptr)  throw std::runtime_error("Error creating post-processing constant buffer");
+
+	if (!CreateRenderTarget(width, height, HDRFormat, &mScene, &mSceneRenderTarget, &mSceneSRV))
+	{
+		Release();
+		throw std::runtime_error("Error creating HDR scene texture");
+	}
+	if (!SetSamples(samples))
+	{
+		Release();
+		throw std::runtime_error("Error creating multisampled HDR scene texture");
+	}
+
+	// Start adapted to the key brightness, so the first frames have an exposure of 1
+	float initialLuminance = ExposureKey;
+	D3D11_SUBRESOURCE_DATA initialData = { &initialLuminance, sizeof(float), 0 };
+	D3D11_TEXTURE2D_DESC textureDesc = {};
+	textureDesc.Width  = 1;
+	textureDesc.Height = 1;
+	textureDesc.MipLevels = 1;
+	textureDesc.ArraySize = 1;
+	textureDesc.Format = DXGI_FORMAT_R32_FLOAT;
+	textureDesc.SampleDesc.Count = 1;
+	textureDesc.Usage = D3D11_USAGE_DEFAULT;
+	textureDesc.BindFlags = D3D11_BIND_UNORDERED_ACCESS | D3D11_BIND_SHADER_RESOURCE;
+	textureDesc.MiscFlags = 0;
+	if (FAILED(gD3DDevice->CreateTexture2D(&textureDesc, &initialData, &mAdaptedLuminance)) ||
+		FAILED(gD3DDevice->CreateUnorderedAccessView(mAdaptedLuminance, nullptr, &mAdaptedLuminanceUAV)) ||
+		FAILED(gD3DDevice->CreateShaderResourceView(mAdaptedLuminance, nullptr, &mAdaptedLuminanceSRV)))
+	{
+		Release();
+		throw std::runtime_error("Error creating adapted luminance texture");
+	}
+
+	SetDebugNames("HDR Scene", mScene, mSceneSRV, mSceneRenderTarget);
+	SetDebugNames("Adapted Luminance", mAdaptedLuminance, mAdaptedLuminanceSRV);
+	SetDebugName(mConstantBuffer, "Post-Process Constants");
+	for (ID3D11Resource* texture : { mScene, mAdaptedLuminance })
+	{
+		RegisterGpuResource(texture, "Post-Process");
+	}
+}
+
+PostProcess::~PostProcess()
+{
+	Release();
+}
+
+
+// Copy the scene rendered so far into a texture of the same size and format that isn't multisampled, resolving the
+// samples if the scene is
+void PostProcess::CopyScene(ID3D11Texture2D* target)
+{
+	if (mMultisampledScene != nullptr)  gD3DContext->ResolveSubresource(target, 0, mMultisampledScene, 0, HDRFormat);
+	else                                gD3DContext->CopyResource(target, mScene);
+}
+
+
+// Change the number of samples per pixel in the scene texture, recreating it. Returns false on failure
+bool PostProcess::SetSamples(unsigned int samples)
+{
+	ReleaseMultisampledScene();
+	mSamples = 1;
+	if (samples > 1 && !CreateRenderTarget(mWidth, mHeight, HDRFormat, &mMultisampledScene, &mMultisampledSceneRenderTarget,
+	                                       &mMultisampledSceneSRV, samples))
+	{
+		ReleaseMultisampledScene();
+		return false;
+	}
+	SetDebugNames("Multisampled HDR Scene", mMultisampledScene, mMultisampledSceneSRV, mMultisampledSceneRenderTarget);
+	RegisterGpuResource(mMultisampledScene, "Post-Process");
+	mSamples = samples;
+	return true;
+}
+
+
+// Tonemap the scene into the given render target (the back buffer), adding bloom. Call once the scene is rendered
+// Uses the immediate context and the state cache, leaves no textures bound. The UV scale is the part of the scene texture
+// rendered to (see SceneRenderTarget), which is scaled up to fill the render target, or only the columns outputWidth pixels
+// across from outputLeft when the width isn't 0
+// Without adaptExposure the exposure isn't measured or adapted, the one adapted by an earlier call this frame is used
+// Returns false with a message in gLastError if the pool couldn't create the textures it needs, drawing nothing
+bool PostProcess::Render(ID3D11RenderTargetView* renderTarget, CVector2 sceneUVScale /*= { 1, 1 }*/,
+                         int outputLeft /*= 0*/, int outputWidth /*= 0*/, bool adaptExposure /*= true*/)
+{
+	// The part of the scene texture rendered to, in pixels, and the part of the render target it fills
+	unsigned int sceneWidth  = static_cast<unsigned int>(mWidth  * sceneUVScale.x + 0.5f);
+	unsigned int sceneHeight = static_cast<unsigned int>(mHeight * sceneUVScale.y + 0.5f);
+	unsigned int left  = static_cast<unsigned int>(outputLeft);
+	unsigned int width = static_cast<unsigned int>(outputWidth > 0 ? outputWidth : mWidth);
+	bool upscale = mUpscaling && (sceneWidth < width || sceneHeight < static_cast<unsigned int>(mHeight));
+	bool measureExposure = mAutoExposure && adaptExposure;
+
+	// The log of the scene brightness, averaged by its mip-maps down to 1x1. Logs of brightness are negative, so need a float
+	// format. And the bright parts of the scene at half size, which is enough as it is blurred anyway, with a second texture
+	// for the two passes of the blur to ping-pong between. Brackets around std::max stop the Windows max macro interfering
+	unsigned int bloomWidth  = (std::max)(mWidth  / 2, 1);
+	unsigned int bloomHeight = (std::max)(mHeight / 2, 1);
+	const RenderTargetPool::Target* luminance = nullptr;
+	const RenderTargetPool::Target* bloom[2] = {};
+	if (measureExposure)
+	{
+		luminance = gRenderTargetPool->Acquire({ LuminanceSize, LuminanceSize, DXGI_FORMAT_R16_FLOAT, 0 }, "Luminance");
+		if (luminance == nullptr)  return false;
+	}
+	if (mBloom)
+	{
+		const RenderTargetPool::Desc bloomDesc = { static_cast<int>(bloomWidth), static_cast<int>(bloomHeight), HDRFormat };
+		bloom[0] = gRenderTargetPool->Acquire(bloomDesc, "Bloom");
+		bloom[1] = bloom[0] ? gRenderTargetPool->Acquire(bloomDesc, "Bloom") : nullptr;
+		if (bloom[1] == nullptr)
+		{
+			for (auto target : { luminance, bloom[0] })  if (target)  gRenderTargetPool->Return(target);
+			return false;
+		}
+	}
+
+	// Upscaling tonemaps into the part of an 8-bit texture the scene was rendered to, scales that up into a second one
+	// and sharpens it into the render target. They are the size of the viewport so the scene fits at any scale
+	const RenderTargetPool::Target* upscaleSource = nullptr;
+	const RenderTargetPool::Target* upscaled = nullptr;
+	if (upscale)
+	{
+		upscaleSource = gRenderTargetPool->Acquire({ mWidth, mHeight, DXGI_FORMAT_R8G8B8A8_UNORM }, "Upscale Source");
+		upscaled = upscaleSource ? gRenderTargetPool->Acquire({ mWidth, mHeight, DXGI_FORMAT_R8G8B8A8_UNORM }, "Upscaled") : nullptr;
+		if (upscaled == nullptr)
+		{
+			for (auto target : { luminance, bloom[0], bloom[1], upscaleSource })  if (target)  gRenderTargetPool->Return(target);
+			return false;
+		}
+	}
+
+	mConstants.exposureKey    = ExposureKey;
+	mConstants.manualExposure = 1.0f;
+	mConstants.autoExposure   = mAutoExposure ? 1.0f : 0.0f;
+	mConstants.adaptationRate = AdaptationRate;
+	mConstants.adaptationTime = mAdaptationTime;
+	mConstants.bloomThreshold = BloomThreshold;
+	mConstants.bloomStrength  = mBloom ? BloomStrength : 0.0f;
+	mConstants.sharpness      = Sharpness;
+	mConstants.blurStep       = { 0, 0 };
+	mConstants.sceneUVScale   = sceneUVScale;
+	UpdateConstantBuffer(mConstantBuffer, mConstants);
+	if (adaptExposure)  mAdaptationTime = 0;
+
+	// Average the samples of each pixel with MSAA. Tonemapping after the resolve lets bright edges bleed into dark ones, but
+	// the bloom hides that around the lights, which is where it shows most
+	if (mMultisampledScene != nullptr)
+	{
+		GpuEventScope event("Resolve MSAA");
+		gD3DContext->ResolveSubresource(mScene, 0, mMultisampledScene, 0, HDRFormat);
+	}
+
+	// Every step draws a triangle over its whole target with no depth buffer or blending
+	SetBlendState(gNoBlendingState);
+	SetDepthStencilState(gNoDepthBufferState);
+	SetRasterizerState(gCullNoneState);
+	SetInputLayout(nullptr);
+	SetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+	SetHullShader(nullptr);
+	SetDomainShader(nullptr);
+	SetGeometryShader(nullptr);
+	SetVertexShader(gPostProcessVertexShader);
+	SetConstantBuffer(3, mConstantBuffer, PixelShaderStage);
+	SetSampler(0, gBilinearMirrorSampler); // Mirroring at the edges is as good as clamping here
+
+	////-------- Exposure --------////
+
+	if (measureExposure)
+	{
+		GpuEventScope event("Exposure");
+
+		// Average the log brightness of the scene with mip-maps, the luminance can't be a render target while they are made
+		DrawFullScreen(mSceneSRV, luminance->renderTarget, LuminanceSize, LuminanceSize, gLuminancePixelShader);
+		SetRenderTargets(0, nullptr, nullptr);
+		gD3DContext->GenerateMips(luminance->srv);
+
+		// Adapt towards it with a single compute shader thread
+		ID3D11ShaderResourceView*  nullSRV = nullptr;
+		ID3D11UnorderedAccessView* nullUAV = nullptr;
+		gD3DContext->CSSetShader(gAdaptExposureComputeShader, nullptr, 0);
+		gD3DContext->CSSetConstantBuffers(3, 1, &mConstantBuffer);
+		gD3DContext->CSSetShaderResources(0, 1, &luminance->srv);
+		gD3DContext->CSSetUnorderedAccessViews(0, 1, &mAdaptedLuminanceUAV, nullptr);
+		gD3DContext->Dispatch(1, 1, 1);
+		gD3DContext->CSSetShaderResources(0, 1, &nullSRV);
+		gD3DContext->CSSetUnorderedAccessViews(0, 1, &nullUAV, nullptr);
+		gD3DContext->CSSetShader(nullptr, nullptr, 0);
+	}
+	SetShaderResource(1, mAdaptedLuminanceSRV);
+
+	////-------- Bloom --------////
+
+	if (mBloom)
+	{
+		GpuEventScope event("Bloom");
+		DrawFullScreen(mSceneSRV, bloom[0]->renderTarget, bloomWidth, bloomHeight, gBloomBrightPixelShader);
+
+		// Blur across into the second texture, then down back into the first
+		mConstants.blurStep = { 1.0f / bloomWidth, 0 };
+		UpdateConstantBuffer(mConstantBuffer, mConstants);
+		DrawFullScreen(bloom[0]->srv, bloom[1]->renderTarget, bloomWidth, bloomHeight, gBloomBlurPixelShader);
+
+		mConstants.blurStep = { 0, 1.0f / bloomHeight };
+		UpdateConstantBuffer(mConstantBuffer, mConstants);
+		DrawFullScreen(bloom[1]->srv, bloom[0]->renderTarget, bloomWidth, bloomHeight, gBloomBlurPixelShader);
+	}
+
+	////-------- Tonemap --------////
+
+	// The bloom texture must be bound after its render target has been replaced, or DirectX unbinds it. When upscaling, the
+	// tonemapped scene is kept at the resolution it was rendered at, in the same part of its texture
+	{
+		GpuEventScope event("Tonemap");
+		ID3D11RenderTargetView* tonemapTarget = upscale ? upscaleSource->renderTarget : renderTarget;
+		SetRenderTargets(1, &tonemapTarget, nullptr);
+		SetShaderResource(2, mBloom ? bloom[0]->srv : nullptr);
+		if (upscale)  DrawFullScreen(mSceneSRV, tonemapTarget, sceneWidth, sceneHeight, gTonemapPixelShader);
+		else          DrawFullScreen(mSceneSRV, tonemapTarget, width, mHeight, gTonemapPixelShader, left);
+	}
+
+	////-------- Upscale --------////
+
+	// Both steps read single texels (Load), so need no sampler. The upscaled scene is in the same columns as the output, the
+	// sharpening reads the pixel it writes
+	if (upscale)
+	{
+		GpuEventScope event("Upscale");
+		DrawFullScreen(upscaleSource->srv, upscaled->renderTarget, width, mHeight, gUpscalePixelShader, left);
+		DrawFullScreen(upscaled->srv, renderTarget, width, mHeight, gSharpenPixelShader, left);
+	}
+
+	// Detach the textures so they can be render targets again next frame
+	SetShaderResource(0, nullptr);
+	SetShaderResource(1, nullptr);
+	SetShaderResource(2, nullptr);
+	SetDepthStencilState(gUseDepthBufferState);
+
+	// Done with the textures for this frame, others can have them now
+	for (auto target : { luminance, bloom[0], bloom[1], upscaleSource, upscaled })  if (target)  gRenderTargetPool->Return(target);
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions
+//--------------------------------------------------------------------------------------
+
+// Draw a triangle covering a target of the given size with the given pixel shader, reading the source texture in slot 0
+// The target can start the given number of pixels in from the left of the render target
+void PostProcess::DrawFullScreen(ID3D11ShaderResourceView* source, ID3D11RenderTargetView* renderTarget,
+                                 unsigned int width, unsigned int height, ID3D11PixelShader* shader, unsigned int left /*= 0*/)
+{
+	// The target is set first, DirectX unbinds a texture that is still a render target when it is bound for reading
+	SetRenderTargets(1, &renderTarget, nullptr);
+	SetShaderResource(0, source);
+
+	D3D11_VIEWPORT vp = { static_cast<FLOAT>(left), 0, static_cast<FLOAT>(width), static_cast<FLOAT>(height), 0.0f, 1.0f };
+	SetViewport(vp);
+
+	SetPixelShader(shader);
+	gD3DContext->Draw(3, 0);
+	CountDrawCall();
+}
+
+
+void PostProcess::ReleaseMultisampledScene()
+{
+	if (mMultisampledSceneSRV)           { mMultisampledSceneSRV->Release();           mMultisampledSceneSRV           = nullptr; }
+	if (mMultisampledSceneRenderTarget)  { mMultisampledSceneRenderTarget->Release();  mMultisampledSceneRenderTarget  = nullptr; }
+	if (mMultisampledScene)              { mMultisampledScene->Release();              mMultisampledScene              = nullptr; }
+}
+
+void PostProcess::Release()
+{
+	ReleaseMultisampledScene();
+	if (mAdaptedLuminanceSRV)    { mAdaptedLuminanceSRV->Release();    mAdaptedLuminanceSRV    = nullptr; }
+	if (mAdaptedLuminanceUAV)    { mAdaptedLuminanceUAV->Release();    mAdaptedLuminanceUAV    = nullptr; }
+	if (mAdaptedLuminance)       { mAdaptedLuminance->Release();       mAdaptedLuminance       = nullptr; }
+	if (mSceneSRV)               { mSceneSRV->Release();               mSceneSRV               = nullptr; }
+	if (mSceneRenderTarget)      { mSceneRenderTarget->Release();      mSceneRenderTarget      = nullptr; }
+	if (mScene)                  { mScene->Release();                  mScene                  = nullptr; }
+	if (mConstantBuffer)         { mConstantBuffer->Release();         mConstantBuffer         = nullptr; }
+}
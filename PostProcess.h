@@ -0,0 +1,147 @@
+//--------------------------------------------------------------------------------------
+// HDR post-processing - exposure, bloom and tonemapping
+//--------------------------------------------------------------------------------------
+// The scene is rendered into a floating point texture rather than straight to the back buffer,
+// so lights and their reflections can be brighter than white. This class turns it into the image
+// on screen: the brightness of the scene is measured each frame and the exposure adapts to it over
+// time, the parts brighter than white are blurred into a glow (bloom), then a filmic tone curve
+// maps the result into the range the screen can show. The HDR textures are R11G11B10_FLOAT, which
+// is 4 bytes per pixel like RGBA8 so costs no more bandwidth, but has no alpha channel.
+//
+// When the scene is rendered to less than the whole viewport (dynamic resolution or a render scale
+// below 1) it is tonemapped at that resolution, then scaled up with a filter that follows the edges
+// and sharpened (after AMD's FidelityFX Super Resolution 1), rather than stretched bilinearly.
+
+#include "CVector2.h"
+#include <d3d11.h>
+
+#ifndef _POST_PROCESS_H_INCLUDED_
+#define _POST_PROCESS_H_INCLUDED_
+
+class PostProcess
+{
+//--------------------------------------------------------------------------------------
+// Construction / Usage
+//--------------------------------------------------------------------------------------
+public:
+
+	// HDR format used for the scene and other textures that hold scene colours (e.g. the reflection)
+	static constexpr DXGI_FORMAT HDRFormat = DXGI_FORMAT_R11G11B10_FLOAT;
+
+	// Create the HDR scene texture and the texture the exposure adapts in, for a viewport of the given size. The scene is
+	// multisampled with the given number of samples per pixel (MSAA), which must match the depth buffer used with it. The
+	// luminance and bloom textures are only needed during Render, so come from the render target pool (see RenderTargetPool.h)
+	// Will throw a std::runtime_error exception on failure (same as Mesh)
+	PostProcess(int width, int height, unsigned int samples = 1);
+	~PostProcess();
+
+
+	// The HDR texture to render the scene into, the same size as the viewport
+	ID3D11RenderTargetView* SceneRenderTarget()  { return mMultisampledSceneRenderTarget != nullptr ? mMultisampledSceneRenderTarget : mSceneRenderTarget; }
+
+	// Copy the scene rendered so far into a texture of the same size and format that isn't multisampled, resolving the
+	// samples if the scene is (e.g. for screen-space reflections, which read the scene before the water is drawn)
+	void CopyScene(ID3D11Texture2D* target);
+
+	// Change the number of samples per pixel in the scene texture, recreating it. Returns false on failure, leaving the scene
+	// with one sample per pixel (no MSAA)
+	bool SetSamples(unsigned int samples);
+	unsigned int Samples()  { return mSamples; }
+
+	// Call once per frame with the time passed since the last frame, for the exposure adaptation
+	void Update(float frameTime)  { mAdaptationTime += frameTime; }
+
+	// Tonemap the scene into the given render target (the back buffer), adding bloom. Call once the scene is rendered
+	// Uses the immediate context and the state cache, leaves no textures bound. The UV scale is the part of the scene texture
+	// rendered to (see SceneRenderTarget), which is scaled up to fill the render target (see SetUpscaling), or only the
+	// columns outputWidth pixels across from outputLeft when the width isn't 0, e.g. one view of a split screen
+	// Without adaptExposure the exposure isn't measured or adapted, the one adapted by an earlier call this frame is used
+	// Returns false with a message in gLastError if the pool couldn't create the textures it needs, drawing nothing
+	bool Render(ID3D11RenderTargetView* renderTarget, CVector2 sceneUVScale = { 1, 1 }, int outputLeft = 0, int outputWidth = 0,
+	            bool adaptExposure = true);
+
+
+	// Automatic exposure adapts to the brightness of the scene, otherwise the scene brightness is used as it is
+	void SetAutoExposure(bool autoExposure)  { mAutoExposure = autoExposure; }
+	bool AutoExposure()  { return mAutoExposure; }
+
+	void SetBloom(bool bloom)  { mBloom = bloom; }
+	bool Bloom()  { return mBloom; }
+
+	// A scene rendered to less than all of its texture is scaled up with edge-adaptive upscaling and sharpening, otherwise
+	// it is stretched with bilinear filtering, which is cheaper but blurrier
+	void SetUpscaling(bool upscaling)  { mUpscaling = upscaling; }
+	bool Upscaling()  { return mUpscaling; }
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions / data
+//--------------------------------------------------------------------------------------
+private:
+
+	// The average scene brightness is mapped to ExposureKey by automatic exposure. Mid-grey is 0.18 in photography, this
+	// scene is lit for an 8-bit back buffer so is brighter than that. The exposure moves a fraction 1 - e^-rate of the
+	// way to the current brightness each second
+	static constexpr float ExposureKey    = 0.4f;
+	static constexpr float AdaptationRate = 1.5f;
+
+	static constexpr float BloomThreshold = 1.0f; // Brightness after exposure (where white is 1) above which the scene blooms
+	static constexpr float BloomStrength  = 0.6f;
+
+	static constexpr float Sharpness = 0.87f; // Of the upscaled scene, 2^-0.2 - the default in FidelityFX Super Resolution
+
+	static constexpr unsigned int LuminanceSize = 256; // The luminance texture is square with a full chain of mip-maps
+
+	void Release();
+	void ReleaseMultisampledScene();
+
+	// Draw a triangle covering a target of the given size with the given pixel shader, reading the source texture in slot 0
+	// The target can start the given number of pixels in from the left of the render target
+	void DrawFullScreen(ID3D11ShaderResourceView* source, ID3D11RenderTargetView* renderTarget,
+	                    unsigned int width, unsigned int height, ID3D11PixelShader* shader, unsigned int left = 0);
+
+	// Constants for the post-processing shaders. There is a structure in the shader code that exactly matches this one
+	struct PostProcessConstants
+	{
+		float    exposureKey;
+		float    manualExposure;
+		float    autoExposure;
+		float    adaptationRate;
+
+		float    adaptationTime;
+		float    bloomThreshold;
+		float    bloomStrength;
+		float    sharpness;
+
+		CVector2 blurStep;
+		CVector2 sceneUVScale;
+	};
+	PostProcessConstants mConstants = {};
+	ID3D11Buffer*        mConstantBuffer = nullptr;
+
+	int   mWidth;
+	int   mHeight;
+	bool  mAutoExposure = true;
+	bool  mBloom = true;
+	bool  mUpscaling = true;
+	float mAdaptationTime = 0;
+
+	// The scene rendered by the main pass. With MSAA the main pass renders into the multisampled texture instead, which is
+	// resolved into this one at the start of Render (shaders can't filter a multisampled texture)
+	ID3D11Texture2D*          mScene = nullptr;
+	ID3D11RenderTargetView*   mSceneRenderTarget = nullptr;
+	ID3D11ShaderResourceView* mSceneSRV = nullptr;
+
+	unsigned int              mSamples = 1;
+	ID3D11Texture2D*          mMultisampledScene = nullptr;
+	ID3D11RenderTargetView*   mMultisampledSceneRenderTarget = nullptr;
+	ID3D11ShaderResourceView* mMultisampledSceneSRV = nullptr; // Not used, CreateRenderTarget always makes one
+
+	// The brightness the exposure is adapted to, a single texel kept from frame to frame (R32_FLOAT)
+	ID3D11Texture2D*           mAdaptedLuminance = nullptr;
+	ID3D11UnorderedAccessView* mAdaptedLuminanceUAV = nullptr;
+	ID3D11ShaderResourceView*  mAdaptedLuminanceSRV = nullptr;
+};
+
+
+#endif //_POST_PROCESS_H_INCLUDED_
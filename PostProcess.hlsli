@@ -0,0 +1,79 @@
+//--------------------------------------------------------------------------------------
+// Include file for the post-processing shaders
+//--------------------------------------------------------------------------------------
+// The scene is rendered into an HDR texture, then turned into the image on screen (see PostProcess.cpp) in these steps:
+//   Luminance_ps      - log of the brightness of the scene into a small texture, its mip-maps average it
+//   AdaptExposure_cs  - moves the brightness the eye is adapted to towards that average over time
+//   BloomBright_ps    - the parts of the scene brighter than white at the current exposure, into a half size texture
+//   BloomBlur_ps      - blurs that, run twice - across then down
+//   Tonemap_ps        - scales the scene by the exposure, adds the bloom and maps the result into the 0->1 range
+//   Upscale_ps        - when rendered below the viewport resolution, scales the tonemapped scene up keeping edges sharp
+//   Sharpen_ps        - then sharpens the result into the back buffer
+// The post-processing shaders don't use the rendering constant buffers so have their own, and don't include Common.hlsli
+
+#ifndef _POST_PROCESS_HLSLI_DEFINED_
+#define _POST_PROCESS_HLSLI_DEFINED_
+
+
+//--------------------------------------------------------------------------------------
+// Constant Buffers
+//--------------------------------------------------------------------------------------
+
+// These variables must match exactly the PostProcessConstants structure in PostProcess.h
+cbuffer PostProcessConstants : register(b3) // Slot 3 in all stages, including the compute shader
+{
+	float  gExposureKey;     // The average brightness of the scene is scaled to this with automatic exposure
+	float  gManualExposure;  // Scale of the scene brightness when automatic exposure is off
+	float  gAutoExposure;    // 1 for automatic exposure, 0 for manual
+	float  gAdaptationRate;  // How quickly the exposure adapts to changes in brightness, higher is quicker
+
+	float  gAdaptationTime;  // Seconds passed since the exposure was last adapted
+	float  gBloomThreshold;  // Brightness (after exposure) above which the scene blooms
+	float  gBloomStrength;   // Amount of bloom added to the scene, 0 for none
+	float  gSharpness;       // Amount the upscaled scene is sharpened, 0 for none to 1 for the most
+
+	float2 gBlurStep;        // UV offset between the samples of the bloom blur, across or down the bloom texture
+	float2 gSceneUVScale;    // Part of the scene texture rendered to, less than all of it with dynamic resolution (see Scene.cpp)
+}
+
+
+//--------------------------------------------------------------------------------------
+// Shader input / output
+//--------------------------------------------------------------------------------------
+
+// The post-processing is drawn as a single triangle covering the viewport (see PostProcess_vs)
+struct PostProcessPixelShaderInput
+{
+	float4 projectedPosition : SV_Position;
+	float2 uv                : uv;
+};
+
+
+//--------------------------------------------------------------------------------------
+// Helper functions
+//--------------------------------------------------------------------------------------
+
+// Perceived brightness of a colour
+float Luminance(float3 colour)
+{
+	return dot(colour, float3(0.2126f, 0.7152f, 0.0722f));
+}
+
+// UV in the part of the scene texture rendered to (see gSceneUVScale) from a UV across the viewport. It is kept half a texel
+// inside that part so filtering doesn't pick up the old pixels around it
+float2 SceneUV(float2 uv, Texture2D sceneMap)
+{
+	float2 sceneSize;
+	sceneMap.GetDimensions(sceneSize.x, sceneSize.y);
+	float2 halfTexel = 0.5f / sceneSize;
+	return clamp(uv * gSceneUVScale, halfTexel, gSceneUVScale - halfTexel);
+}
+
+// Scale of the scene brightness from the adapted brightness (see AdaptExposure_cs)
+float Exposure(float adaptedLuminance)
+{
+	return gAutoExposure > 0 ? gExposureKey / max(adaptedLuminance, 0.0001f) : gManualExposure;
+}
+
+
+#endif // _POST_PROCESS_HLSLI_DEFINED_
@@ -0,0 +1,24 @@
+//--------------------------------------------------------------------------------------
+// Post-processing Vertex Shader
+//--------------------------------------------------------------------------------------
+// Draws a single triangle covering the whole viewport with no vertex buffer (same as Sky_vs), with the UVs across the
+// viewport for the post-processing pixel shaders to sample the scene with
+
+#include "PostProcess.hlsli"
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+// Vertices 0, 1 and 2 are at the corners (-1,1), (3,1) and (-1,-3) of a triangle that covers the -1 to 1 viewport
+PostProcessPixelShaderInput main(uint vertexID : SV_VertexID)
+{
+	PostProcessPixelShaderInput output;
+
+	float2 corner = float2((vertexID << 1) & 2, vertexID & 2);
+	output.projectedPosition = float4(corner * float2(2, -2) + float2(-1, 1), 0, 1);
+	output.uv = corner;
+
+	return output;
+}
@@ -0,0 +1,44 @@
+//--------------------------------------------------------------------------------------
+// Quad Efficiency Heatmap Pixel Shader
+//--------------------------------------------------------------------------------------
+// The pixels shaded per quad lane run at each pixel (see OverdrawView.h), from red where each quad shaded a single pixel,
+// through yellow, to green where the quads were full. Black where nothing was shaded. A key of the colours from 0.25 to 1
+// is along the bottom
+
+#include "PostProcess.hlsli" // For the input from PostProcess_vs, the post-processing constants aren't used
+#include "Overdraw.hlsli"
+
+
+//--------------------------------------------------------------------------------------
+// Textures (texture maps)
+//--------------------------------------------------------------------------------------
+
+Texture2DArray<uint> OverdrawCounters : register(t0);
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+float4 main(PostProcessPixelShaderInput input) : SV_Target
+{
+	// The counters are the size of the viewport
+	uint width, height, slices;
+	OverdrawCounters.GetDimensions(width, height, slices);
+
+	float efficiency;
+	if (input.projectedPosition.y > height - KeyHeight)
+	{
+		efficiency = lerp(0.25f, 1.0f, input.uv.x);
+	}
+	else
+	{
+		uint pixels = OverdrawCounters.Load(int4(input.projectedPosition.xy, 0, 0));
+		uint quads  = OverdrawCounters.Load(int4(input.projectedPosition.xy, 1, 0)); // In QuadUnits
+		if (pixels == 0)  return float4(0, 0, 0, 1);
+		efficiency = float(pixels) * QuadUnits / (4.0f * quads); // Four lanes to a quad
+	}
+
+	// Red to yellow to green, the middle of the heat colours backwards
+	return float4(HeatColour(lerp(0.75f, 0.25f, (efficiency - 0.25f) / 0.75f)), 1);
+}
@@ -0,0 +1,18 @@
+//--------------------------------------------------------------------------------------
+// Pixel shader for impostors in reflection (for impostors above the water)
+//--------------------------------------------------------------------------------------
+// The surface baked into the impostor's atlas, lit as the reflected pixel lighting shader lights the
+// model (see ImpostorLighting.hlsli)
+
+#include "ImpostorLighting.hlsli"
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+WaterTexturePixelShaderOutput main(LightingPixelShaderInput input)
+{
+	ImpostorSurface(input);
+	return ReflectedPixelLighting(input, gCameraMatrix); // The reflected camera, selected by the reflection pass
+}
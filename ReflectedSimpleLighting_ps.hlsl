@@ -0,0 +1,18 @@
+//--------------------------------------------------------------------------------------
+// Pixel shader for geometry being reflected with simple lighting
+//--------------------------------------------------------------------------------------
+// The reflected pixel lighting shader with diffuse lighting only, for the lower quality presets
+// (see SIMPLE_WATER_TEXTURE_LIGHTING in WaterTextureLighting.hlsli)
+
+#define SIMPLE_WATER_TEXTURE_LIGHTING
+#include "WaterTextureLighting.hlsli"
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+WaterTexturePixelShaderOutput main(LightingPixelShaderInput input)
+{
+  return ReflectedPixelLighting(input, gCameraMatrix); // The reflected camera, selected by the reflection pass
+}
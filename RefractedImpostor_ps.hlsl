@@ -0,0 +1,18 @@
+//--------------------------------------------------------------------------------------
+// Pixel shader for impostors in refraction (for impostors below the water)
+//--------------------------------------------------------------------------------------
+// The surface baked into the impostor's atlas, lit as the refracted pixel lighting shader lights the
+// model (see ImpostorLighting.hlsli)
+
+#include "ImpostorLighting.hlsli"
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+WaterTexturePixelShaderOutput main(LightingPixelShaderInput input)
+{
+	ImpostorSurface(input);
+	return RefractedPixelLighting(input, gCameraMatrix);
+}
@@ -0,0 +1,18 @@
+//--------------------------------------------------------------------------------------
+// Pixel shader for geometry in refraction with simple lighting (for geometry below the water)
+//--------------------------------------------------------------------------------------
+// The refracted pixel lighting shader with diffuse lighting only, for the lower quality presets
+// (see SIMPLE_WATER_TEXTURE_LIGHTING in WaterTextureLighting.hlsli)
+
+#define SIMPLE_WATER_TEXTURE_LIGHTING
+#include "WaterTextureLighting.hlsli"
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+WaterTexturePixelShaderOutput main(LightingPixelShaderInput input)
+{
+    return RefractedPixelLighting(input, gCameraMatrix);
+}
@@ -15,23 +15,18 @@
 // We make sure each map gets a unique slot across all the shaders in use at any given point
 
 Texture2D DiffuseMap : register(t0);
-Texture2D WaterHeightMap : register(t2); // Water height map - each pixel contains the y coordinate of the surface of the water at that point - rendered in an earlier pass
+// The water surface height comes from the water depth map in slot 2 (see WaterSurfaceHeight in Common.hlsli)
 
 SamplerState StandardFilter : register(s0); // Filtering used on most textures (trilinear or anisotropic - chosen on the C++ side)
-SamplerState BilinearMirror : register(s1); // We use mirror mode for the reflection and refraction because pixels off screen might come
-                                            // into view due to the water wiggling. Mirror mode will put some vaguely sensible colours there
-                                            // although it is a bit of a cheat. An alternative solution is to render the reflection / refraction
-                                            // maps larger than they need to be but that adds complexity for little gain
 
 //--------------------------------------------------------------------------------------
 // Shader code
 //--------------------------------------------------------------------------------------
 
-float4 main(WorldPositionPixelShaderInput input) : SV_Target
+WaterTexturePixelShaderOutput main(TintedPixelShaderInput input)
 {
-	// Sample the height map of the water to find if this pixel is underwater
-	float2 screenUV = input.projectedPosition.xy / float2(gViewportWidth, gViewportHeight);
-	float waterHeight = WaterHeightMap.Sample(BilinearMirror, screenUV).x;
+	// Get the height of the water surface at this pixel to find if it is underwater
+	float waterHeight = WaterSurfaceHeight(input.projectedPosition);
 	float objectDepth = waterHeight - input.worldPosition.y;
 	clip(objectDepth); // Remove pixels with negative depth - i.e. above the water
 
@@ -39,13 +34,15 @@ float4 main(WorldPositionPixelShaderInput input) : SV_Target
 	float3 diffuseMaterial = DiffuseMap.Sample(StandardFilter, input.uv).rgb;
 	clip(dot(diffuseMaterial, diffuseMaterial) - 0.1f); // Refracted blended pixels have issues especially when completely see through (makes what is behind them distort too little) 
 														// so clip pixels that are close to transparent in reflections/refractions
-	diffuseMaterial *= gObjectColour;
+	diffuseMaterial *= input.tint;
 
 	// Darken the colour based on the depth underwater
 	float3 depthDarken = saturate(objectDepth / WaterExtinction);
 	float3 refractionColour = lerp(diffuseMaterial, normalize(WaterExtinction) * WaterDiffuseLevel, depthDarken);
 
-	// Store the darkened colour in rgb and a value representing how deep the pixel is in alpha (used for refraction distortion)
-	// This is written to a 8-bit RGBA texture, so this alpha depth value has limited accuracy
-	return float4(refractionColour, saturate(objectDepth / MaxDistortionDistance)); // Alpha ranges 0->1 for depths of 0 to MaxDistortionDistance
+	// Store the darkened colour and a value representing how deep the pixel is (used for refraction distortion)
+	WaterTexturePixelShaderOutput output;
+	output.colour = float4(refractionColour, 1.0f);
+	output.distortion = saturate(objectDepth / MaxDistortionDistance); // Ranges 0->1 for depths of 0 to MaxDistortionDistance
+	return output;
 }
@@ -0,0 +1,254 @@
+//--------------------------------------------------------------------------------------
+// Render graph - runs the scene passes from the textures they read and write
+//--------------------------------------------------------------------------------------
+
+#include "RenderGraph.h"
+#include "GraphicsHelpers.h"
+#include "StateCache.h"
+#include "CpuProfiler.h"
+#include "GpuEvents.h"
+#include "Common.h"
+
+#include <cstring>
+
+
+RenderGraph* gRenderGraph;
+
+
+//--------------------------------------------------------------------------------------
+// Construction / Usage
+//--------------------------------------------------------------------------------------
+
+// Start describing a new frame, forgetting the passes and textures of the last one
+void RenderGraph::BeginFrame()
+{
+	mNumTextures = 0;
+	mNumPasses = 0;
+	mFirstViewPass = 0;
+	mNumCulledPasses = 0;
+	mNumTransientTextures = 0;
+	mNumPooledTexturesUsed = 0;
+}
+
+
+// Start describing another view of the frame, once the last view has been executed. Its textures are forgotten, and only
+// the passes added after this are compiled and executed
+void RenderGraph::BeginView()
+{
+	mNumTextures = 0;
+	mFirstViewPass = mNumPasses;
+}
+
+
+// Add a texture created outside the graph, any of the views can be nullptr. Returns the texture's index in the graph
+int RenderGraph::ImportTexture(const char* name, ID3D11ShaderResourceView* srv, ID3D11RenderTargetView* renderTarget /*= nullptr*/,
+                               ID3D11DepthStencilView* depthStencil /*= nullptr*/)
+{
+	if (mNumTextures == MaxTextures)  return -1;
+	TextureInfo& texture = mTextures[mNumTextures];
+	texture = {};
+	texture.name         = name;
+	texture.srv          = srv;
+	texture.renderTarget = renderTarget;
+	texture.depthStencil = depthStencil;
+	return mNumTextures++;
+}
+
+
+// Add a texture only used this frame, which the graph finds in its pool when it is compiled. Returns the texture's index
+int RenderGraph::CreateTexture(const char* name, const TextureDesc& desc)
+{
+	if (mNumTextures == MaxTextures)  return -1;
+	TextureInfo& texture = mTextures[mNumTextures];
+	texture = {};
+	texture.name      = name;
+	texture.transient = true;
+	texture.desc      = desc;
+	return mNumTextures++;
+}
+
+
+// Mark a texture as a result of the frame. Passes that don't lead to one of these are culled
+void RenderGraph::SetOutput(int texture)
+{
+	if (texture >= 0)  mTextures[texture].output = true;
+}
+
+
+// Add a pass recorded by the given function with the given camera and index (see CommandRecorder::Job). Returns the pass's
+// index in the graph
+int RenderGraph::AddPass(const char* name, void (*record)(Camera* camera, int index), Camera* camera, int index,
+                         GpuPass timing /*= GpuPass::NumPasses*/)
+{
+	if (mNumPasses == MaxPasses)  return -1;
+	PassInfo& pass = mPasses[mNumPasses];
+	pass.name      = name;
+	pass.record    = record;
+	pass.camera    = camera;
+	pass.index     = index;
+	pass.timing    = timing;
+	pass.numReads  = 0;
+	pass.numWrites = 0;
+	pass.culled    = false;
+	pass.stats     = StateCacheStats();
+	return mNumPasses++;
+}
+
+
+// Declare a texture read by a pass. With a slot the graph binds the texture there before the pass and unbinds it after
+void RenderGraph::Read(int pass, int texture, int slot /*= -1*/, unsigned int stages /*= PixelShaderStage*/)
+{
+	if (pass < 0 || texture < 0 || mPasses[pass].numReads == MaxReads)  return;
+	mPasses[pass].reads[mPasses[pass].numReads++] = { texture, slot, stages };
+}
+
+
+// Declare a texture rendered to by a pass
+void RenderGraph::Write(int pass, int texture)
+{
+	if (pass < 0 || texture < 0 || mPasses[pass].numWrites == MaxWrites)  return;
+	mPasses[pass].writes[mPasses[pass].numWrites++] = texture;
+}
+
+
+// Cull the passes that aren't needed and take textures for the transient textures from the render target pool, each given
+// back after the last pass using it. Returns false with a message in gLastError on failure
+bool RenderGraph::Compile()
+{
+	// Work back from the last pass: a pass is needed if it writes an output or a texture read by a later pass that is needed
+	bool needed[MaxTextures];
+	for (int i = 0; i < mNumTextures; ++i)  needed[i] = mTextures[i].output;
+	for (int p = mNumPasses - 1; p >= mFirstViewPass; --p)
+	{
+		PassInfo& pass = mPasses[p];
+		pass.culled = true;
+		for (int w = 0; w < pass.numWrites; ++w)  if (needed[pass.writes[w]])  pass.culled = false;
+		if (pass.culled)
+		{
+			++mNumCulledPasses;
+			continue;
+		}
+		for (int r = 0; r < pass.numReads; ++r)  needed[pass.reads[r].texture] = true;
+	}
+
+	// Lifetimes of the transient textures over the passes that are left
+	for (int i = 0; i < mNumTextures; ++i)  mTextures[i].firstPass = mTextures[i].lastPass = -1;
+	auto use = [this](int texture, int pass)
+	{
+		TextureInfo& info = mTextures[texture];
+		if (info.firstPass < 0)  info.firstPass = pass;
+		info.lastPass = pass;
+	};
+	for (int p = mFirstViewPass; p < mNumPasses; ++p)
+	{
+		const PassInfo& pass = mPasses[p];
+		if (pass.culled)  continue;
+		for (int r = 0; r < pass.numReads; ++r)   use(pass.reads[r].texture, p);
+		for (int w = 0; w < pass.numWrites; ++w)  use(pass.writes[w], p);
+	}
+
+	// Take a pooled texture for each transient texture before its first pass, and give it back after its last, so a texture
+	// first used after that can be given the same one. Nothing is rendered until Execute, which runs the passes in the same
+	// order. Transient textures of culled passes have no first pass and are given nothing
+	for (int p = mFirstViewPass; p < mNumPasses; ++p)
+	{
+		for (int i = 0; i < mNumTextures; ++i)
+		{
+			TextureInfo& texture = mTextures[i];
+			if (!texture.transient || texture.firstPass != p)  continue;
+
+			texture.pooled = gRenderTargetPool->Acquire(texture.desc, texture.name);
+			if (texture.pooled == nullptr)
+			{
+				// Give back those already taken, so the pool isn't left with textures in use
+				for (int j = 0; j < mNumTextures; ++j)
+				{
+					if (mTextures[j].pooled != nullptr && mTextures[j].lastPass >= p)  gRenderTargetPool->Return(mTextures[j].pooled);
+				}
+				return false;
+			}
+			texture.srv          = texture.pooled->srv;
+			texture.renderTarget = texture.pooled->renderTarget;
+			texture.depthStencil = texture.pooled->depthStencil;
+			++mNumTransientTextures;
+
+			bool shared = false;
+			for (int j = 0; j < mNumTextures && !shared; ++j)  shared = j != i && mTextures[j].pooled == texture.pooled;
+			if (!shared)  ++mNumPooledTexturesUsed;
+		}
+		for (int i = 0; i < mNumTextures; ++i)
+		{
+			if (mTextures[i].pooled != nullptr && mTextures[i].lastPass == p)  gRenderTargetPool->Return(mTextures[i].pooled);
+		}
+	}
+	return true;
+}
+
+
+// Record the passes that weren't culled, in the order they were added. With a command recorder each pass is recorded on
+// its own thread, otherwise they are rendered one after another on this thread
+bool RenderGraph::Execute(CommandRecorder* recorder)
+{
+	int numJobs = 0;
+	for (int p = mFirstViewPass; p < mNumPasses; ++p)
+	{
+		if (!mPasses[p].culled)  mJobs[numJobs++] = { RecordPass, mPasses[p].camera, p };
+	}
+
+	if (recorder != nullptr)  return recorder->Record(mJobs, numJobs);
+
+	for (int job = 0; job < numJobs; ++job)  mJobs[job].record(mJobs[job].camera, mJobs[job].index);
+	return true;
+}
+
+
+// Calls made by all the passes with the given name this frame
+StateCacheStats RenderGraph::PassStats(const char* name)
+{
+	StateCacheStats stats;
+	for (int p = 0; p < mNumPasses; ++p)
+	{
+		if (strcmp(mPasses[p].name, name) == 0)  stats += mPasses[p].stats;
+	}
+	return stats;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions
+//--------------------------------------------------------------------------------------
+
+// Job function for every pass, the index is the pass in the graph. Binds the pass's inputs, times it, labels it for graphics
+// debuggers and records it. Runs on the thread recording the pass, so the bindings go to that thread's context
+void RenderGraph::RecordPass(Camera* camera, int pass)
+{
+	PassInfo& info = gRenderGraph->mPasses[pass];
+	CpuProfileScope profile(info.name);
+
+	// Passes added more than once in a view (e.g. for each group of water) show their index after the name
+	bool repeated = false;
+	for (int p = gRenderGraph->mFirstViewPass; p < gRenderGraph->mNumPasses && !repeated; ++p)
+	{
+		repeated = p != pass && strcmp(gRenderGraph->mPasses[p].name, info.name) == 0;
+	}
+	GpuEventScope event(info.name, repeated ? info.index : -1);
+
+	StateCacheStats statsBefore = GetStateCacheStats(); // The thread's stats, may include earlier passes on the same thread
+	for (int r = 0; r < info.numReads; ++r)
+	{
+		const PassRead& read = info.reads[r];
+		if (read.slot >= 0)  SetShaderResource(read.slot, gRenderGraph->mTextures[read.texture].srv, read.stages);
+	}
+
+	if (info.timing != GpuPass::NumPasses)  gGpuProfiler->BeginPass(info.timing);
+	info.record(camera, info.index);
+	if (info.timing != GpuPass::NumPasses)  gGpuProfiler->EndPass(info.timing);
+
+	// Unbind the inputs so later passes can render to them (if you don't do this DX emits lots of warnings)
+	for (int r = 0; r < info.numReads; ++r)
+	{
+		const PassRead& read = info.reads[r];
+		if (read.slot >= 0)  SetShaderResource(read.slot, nullptr, read.stages);
+	}
+	info.stats = GetStateCacheStats() - statsBefore;
+}
@@ -0,0 +1,185 @@
+//--------------------------------------------------------------------------------------
+// Render graph - runs the scene passes from the textures they read and write
+//--------------------------------------------------------------------------------------
+// Each frame the passes are described to the graph along with the textures each one reads and
+// writes, instead of being called directly. From that the graph:
+// - culls the passes whose results nothing uses, e.g. the environment map when the water only
+//   shows the planar reflection, or a water height pass when neither water texture is rendered
+// - binds the textures a pass reads to their shader slots before it and unbinds them after, so
+//   a texture is never still bound as an input when a later pass renders to it
+// - takes the transient textures, the ones only used within the frame, from the render target
+//   pool (see RenderTargetPool.h). Those not in use at the same time share a texture when they
+//   have the same description, e.g. the water height depth of each group of water, and so can
+//   the post-processing after the graph. DirectX 11 can't place several resources in the same
+//   memory, so sharing whole textures is as near as it gets to memory aliasing
+// - times the passes with the GPU profiler, and counts the DirectX calls each pass makes with the
+//   state cache stats (see StateCache.h)
+// Textures that last longer than a frame (e.g. the water textures, reused by the temporal mode)
+// are created outside the graph and imported into it each frame.
+// A frame rendering more than one view (e.g. a split screen) describes each view after the last
+// has been executed. The passes of the earlier views are kept, so the numbers for display cover
+// the whole frame.
+//
+// The passes are still recorded as CommandRecorder jobs, one after another on this thread or
+// each on its own thread. Describing a frame allocates nothing once the pool has its textures.
+
+#include "CommandRecorder.h"
+#include "GpuProfiler.h"
+#include "StateCache.h"
+#include "RenderTargetPool.h"
+#include <d3d11.h>
+
+#ifndef _RENDER_GRAPH_H_INCLUDED_
+#define _RENDER_GRAPH_H_INCLUDED_
+
+class Camera;
+
+class RenderGraph
+{
+//--------------------------------------------------------------------------------------
+// Construction / Usage
+//--------------------------------------------------------------------------------------
+public:
+
+	// Size and type of a transient texture, as the render target pool describes them
+	using TextureDesc = RenderTargetPool::Desc;
+
+
+	RenderGraph() {}
+
+
+	// Start describing a new frame, forgetting the passes and textures of the last one. Textures and passes are given as
+	// indices, only valid until the next call to this
+	void BeginFrame();
+
+	// Start describing another view of the frame, once the last view has been executed. Its textures are forgotten, and
+	// only the passes added after this are compiled and executed. The indices of the earlier passes stay valid
+	void BeginView();
+
+	// Add a texture created outside the graph, any of the views can be nullptr. Returns the texture's index in the graph
+	int ImportTexture(const char* name, ID3D11ShaderResourceView* srv, ID3D11RenderTargetView* renderTarget = nullptr,
+	                  ID3D11DepthStencilView* depthStencil = nullptr);
+
+	// Add a texture only used this frame, which the graph finds in its pool when it is compiled. Returns the texture's index
+	int CreateTexture(const char* name, const TextureDesc& desc);
+
+	// Mark a texture as a result of the frame, e.g. the scene texture that is post-processed afterwards. Passes that don't
+	// lead to one of these are culled
+	void SetOutput(int texture);
+
+
+	// Add a pass recorded by the given function with the given camera and index (see CommandRecorder::Job). It is timed as
+	// the given profiler pass, unless that is GpuPass::NumPasses for passes that time their parts themselves
+	// Returns the pass's index in the graph
+	int AddPass(const char* name, void (*record)(Camera* camera, int index), Camera* camera, int index,
+	            GpuPass timing = GpuPass::NumPasses);
+
+	// Declare a texture read by a pass. With a slot the graph binds the texture there in the given shader stages before
+	// the pass and unbinds it after, otherwise the pass binds it itself and this only orders the passes
+	void Read(int pass, int texture, int slot = -1, unsigned int stages = PixelShaderStage);
+
+	// Declare a texture rendered to by a pass. The pass selects its render targets itself
+	void Write(int pass, int texture);
+
+
+	// Cull the passes that aren't needed and take textures for the transient textures from the render target pool, each given
+	// back after the last pass using it. Returns false with a message in gLastError on failure
+	bool Compile();
+
+	// Record the passes that weren't culled, in the order they were added. With a command recorder each pass is recorded on
+	// its own thread (see CommandRecorder::Record), otherwise they are rendered one after another on this thread
+	// Returns false with a message in gLastError if the command recorder failed
+	bool Execute(CommandRecorder* recorder);
+
+
+	// Views of a texture, for the passes to use while they are recorded. Can be called from several threads at once
+	ID3D11ShaderResourceView* SRV(int texture)           { return mTextures[texture].srv; }
+	ID3D11RenderTargetView*   RenderTarget(int texture)  { return mTextures[texture].renderTarget; }
+	ID3D11DepthStencilView*   DepthStencil(int texture)  { return mTextures[texture].depthStencil; }
+
+
+	// Numbers for display: passes added and culled this frame, transient textures used this frame and the pooled textures
+	// that held them, summed over the frame's views
+	int NumPasses()             { return mNumPasses; }
+	int NumCulledPasses()       { return mNumCulledPasses; }
+	int NumTransientTextures()  { return mNumTransientTextures; }
+	int NumPooledTextures()     { return mNumPooledTexturesUsed; }
+
+	// Name of a pass added this frame in any of its views, whether it was culled, and the DirectX calls it made (all zero if
+	// culled). Valid after Execute until the next BeginFrame
+	const char*            PassName(int pass)    { return mPasses[pass].name; }
+	bool                   PassCulled(int pass)  { return mPasses[pass].culled; }
+	const StateCacheStats& PassStats(int pass)   { return mPasses[pass].stats; }
+
+	// Calls made by all the passes with the given name this frame, e.g. every group's "Refraction" pass
+	StateCacheStats PassStats(const char* name);
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions / data
+//--------------------------------------------------------------------------------------
+private:
+
+	static constexpr int MaxPasses = 64; // Over all the views of a frame
+	static constexpr int MaxTextures = 64;
+	static constexpr int MaxReads = 12; // For each pass
+	static constexpr int MaxWrites = 4;
+
+	struct TextureInfo
+	{
+		const char*               name;
+		ID3D11ShaderResourceView* srv;
+		ID3D11RenderTargetView*   renderTarget;
+		ID3D11DepthStencilView*   depthStencil;
+		bool                      transient;
+		TextureDesc               desc;
+		const RenderTargetPool::Target* pooled; // Given to a transient texture by Compile
+		bool                      output;
+		int                       firstPass; // First and last passes using a transient texture, found by Compile
+		int                       lastPass;
+	};
+
+	struct PassRead
+	{
+		int          texture;
+		int          slot;
+		unsigned int stages;
+	};
+
+	struct PassInfo
+	{
+		const char* name;
+		void      (*record)(Camera* camera, int index);
+		Camera*     camera;
+		int         index;
+		GpuPass     timing;
+		PassRead    reads[MaxReads];
+		int         numReads;
+		int         writes[MaxWrites];
+		int         numWrites;
+		bool        culled;
+		StateCacheStats stats; // Written by the thread recording the pass
+	};
+
+	// Job function for every pass, the index is the pass in the graph. Binds the pass's inputs, times it and records it
+	static void RecordPass(Camera* camera, int pass);
+
+	TextureInfo mTextures[MaxTextures];
+	int         mNumTextures = 0;
+	PassInfo    mPasses[MaxPasses];
+	int         mNumPasses = 0;
+	int         mFirstViewPass = 0; // First pass of the view being described, earlier passes are kept for display
+
+	CommandRecorder::Job mJobs[MaxPasses];
+
+	int mNumCulledPasses = 0;
+	int mNumTransientTextures = 0;
+	int mNumPooledTexturesUsed = 0;
+};
+
+
+// The graph used by the scene, created in InitGeometry (see Scene.cpp)
+extern RenderGraph* gRenderGraph;
+
+
+#endif //_RENDER_GRAPH_H_INCLUDED_
@@ -0,0 +1,128 @@
+//--------------------------------------------------------------------------------------
+// Render target pool - textures only needed for part of a frame, shared by whatever needs one
+//--------------------------------------------------------------------------------------
+
+#include "RenderTargetPool.h"
+#include "GraphicsHelpers.h"
+#include "GpuEvents.h"
+#include "GpuMemory.h"
+#include "Common.h"
+
+#include <string>
+
+
+RenderTargetPool* gRenderTargetPool = nullptr;
+
+
+//--------------------------------------------------------------------------------------
+// Construction / Usage
+//--------------------------------------------------------------------------------------
+
+// Releases the textures
+RenderTargetPool::~RenderTargetPool()
+{
+	for (auto& pooled : mPool)  ReleaseTarget(*pooled);
+}
+
+
+// A free texture of the given description, created along with its views if the pool hasn't got one. It is in use until
+// given back. Returns nullptr with a message in gLastError on failure
+const RenderTargetPool::Target* RenderTargetPool::Acquire(const Desc& desc, const char* name)
+{
+	for (auto& pooled : mPool)
+	{
+		if (pooled->inUse || !(pooled->desc == desc))  continue;
+		pooled->inUse = true;
+		pooled->usedThisFrame = true;
+		return &pooled->target;
+	}
+
+	auto pooled = std::make_unique<PooledTarget>();
+	pooled->desc = desc;
+	Target& target = pooled->target;
+	bool created = (desc.format == DXGI_FORMAT_UNKNOWN) ?
+	               CreateDepthBuffer(desc.width, desc.height, &target.texture, &target.depthStencil, &target.srv, desc.samples) :
+	               CreateRenderTarget(desc.width, desc.height, desc.format, &target.texture, &target.renderTarget, &target.srv,
+	                                  desc.samples, desc.mipLevels);
+	if (!created)
+	{
+		ReleaseTarget(*pooled);
+		gLastError = std::string("Error creating render target for ") + name;
+		return nullptr;
+	}
+
+	// Pooled textures are shared by users with different names, so they are named by the order they were made
+	SetDebugNames("Render Target Pool " + std::to_string(mNumCreated++), target.texture, target.srv, target.renderTarget,
+	              target.depthStencil);
+	RegisterGpuResource(target.texture, "Render Target Pool");
+
+	pooled->inUse = true;
+	pooled->usedThisFrame = true;
+	mPool.push_back(std::move(pooled));
+	return &mPool.back()->target;
+}
+
+
+// Give back a texture from Acquire, for whatever asks for one later
+void RenderTargetPool::Return(const Target* target)
+{
+	for (auto& pooled : mPool)
+	{
+		if (&pooled->target == target)  pooled->inUse = false;
+	}
+}
+
+
+// Call once a frame, after the last texture has been given back. Releases the textures unused for a while
+void RenderTargetPool::EndFrame()
+{
+	mNumUsed = 0;
+	for (size_t i = 0; i < mPool.size();)
+	{
+		PooledTarget& pooled = *mPool[i];
+		if (pooled.usedThisFrame || pooled.inUse)
+		{
+			pooled.usedThisFrame = false;
+			pooled.framesUnused = 0;
+			++mNumUsed;
+		}
+		else if (++pooled.framesUnused > ReleaseAfterFrames)
+		{
+			ReleaseTarget(pooled);
+			mPool.erase(mPool.begin() + i);
+			continue;
+		}
+		++i;
+	}
+}
+
+
+// Release the textures not in use. They are created again when next asked for
+void RenderTargetPool::ReleaseFreeTargets()
+{
+	for (size_t i = 0; i < mPool.size();)
+	{
+		if (mPool[i]->inUse)
+		{
+			++i;
+			continue;
+		}
+		ReleaseTarget(*mPool[i]);
+		mPool.erase(mPool.begin() + i);
+	}
+}
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions
+//--------------------------------------------------------------------------------------
+
+void RenderTargetPool::ReleaseTarget(PooledTarget& pooled)
+{
+	Target& target = pooled.target;
+	if (target.depthStencil)  target.depthStencil->Release();
+	if (target.renderTarget)  target.renderTarget->Release();
+	if (target.srv)           target.srv->Release();
+	if (target.texture)       target.texture->Release();
+	target = {};
+}
@@ -0,0 +1,118 @@
+//--------------------------------------------------------------------------------------
+// Render target pool - textures only needed for part of a frame, shared by whatever needs one
+//--------------------------------------------------------------------------------------
+// Textures that are rendered to and read within a frame (the water height depth of each group of
+// water, the bloom and luminance of the post-processing) don't each need one of their own. They
+// are asked for from this pool by description - size, format, mip-maps and MSAA samples - and
+// given back once finished with, so whatever asks for the same description later in the frame is
+// given the same texture. Each pooled texture is created with its views the first time it is
+// needed and keeps them, so asking for one is a search of a short list with no DirectX calls.
+// Textures left unused for a while are released, e.g. those the size of the viewport before it
+// changed.
+//
+// The render graph takes its transient textures from here, giving each back after the last pass
+// that uses it (see RenderGraph.h), and the post-processing takes its textures for the length of
+// Render. All that work reaches the GPU in the order it is given on the immediate context, so a
+// texture given back is only rendered to again by work that comes after the work using it.
+// Textures kept from frame to frame (e.g. the water textures reused by the temporal mode, and the
+// adapted exposure) stay outside the pool. Only used on the main thread.
+
+#include <d3d11.h>
+#include <vector>
+#include <memory>
+
+#ifndef _RENDER_TARGET_POOL_H_INCLUDED_
+#define _RENDER_TARGET_POOL_H_INCLUDED_
+
+class RenderTargetPool
+{
+//--------------------------------------------------------------------------------------
+// Construction / Usage
+//--------------------------------------------------------------------------------------
+public:
+
+	// Size and type of a pooled texture. Depth buffers have no format, they are always made by CreateDepthBuffer (see
+	// GraphicsHelpers.h). More than one mip level (0 for a full chain) lets the texture generate its mips
+	struct Desc
+	{
+		int          width;
+		int          height;
+		DXGI_FORMAT  format;        // DXGI_FORMAT_UNKNOWN for a depth buffer
+		unsigned int mipLevels = 1;
+		unsigned int samples   = 1; // MSAA, shaders read a multisampled texture as Texture2DMS. No mips when multisampled
+
+		bool operator==(const Desc& other) const
+		{
+			return width == other.width && height == other.height && format == other.format &&
+			       mipLevels == other.mipLevels && samples == other.samples;
+		}
+	};
+
+	// A pooled texture and its views. A depth buffer has no render target view, a colour texture no depth stencil view
+	struct Target
+	{
+		ID3D11Texture2D*          texture = nullptr;
+		ID3D11ShaderResourceView* srv = nullptr;
+		ID3D11RenderTargetView*   renderTarget = nullptr;
+		ID3D11DepthStencilView*   depthStencil = nullptr;
+	};
+
+
+	RenderTargetPool() {}
+	~RenderTargetPool(); // Releases the textures
+
+	RenderTargetPool(const RenderTargetPool&) = delete;
+	RenderTargetPool& operator=(const RenderTargetPool&) = delete;
+
+
+	// A free texture of the given description, created along with its views if the pool hasn't got one. It is in use until
+	// given back. The name is what it is for, for the error message. Returns nullptr with a message in gLastError on failure
+	const Target* Acquire(const Desc& desc, const char* name);
+
+	// Give back a texture from Acquire, for whatever asks for one later
+	void Return(const Target* target);
+
+	// Call once a frame, after the last texture has been given back. Releases the textures unused for a while
+	void EndFrame();
+
+	// Release the textures not in use, e.g. when the viewport changes size. They are created again when next asked for
+	void ReleaseFreeTargets();
+
+
+	// Numbers for display: textures in the pool, and how many of them were used this frame
+	int NumTargets()      { return static_cast<int>(mPool.size()); }
+	int NumUsedTargets()  { return mNumUsed; }
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions / data
+//--------------------------------------------------------------------------------------
+private:
+
+	// Textures unused for this many frames are released, so one isn't released and created again each time something goes
+	// in and out of view
+	static constexpr int ReleaseAfterFrames = 60;
+
+	struct PooledTarget
+	{
+		Desc   desc;
+		Target target;
+		bool   inUse = false;
+		bool   usedThisFrame = false;
+		int    framesUnused = 0;
+	};
+
+	static void ReleaseTarget(PooledTarget& pooled);
+
+	// Pointers, so the targets given out stay where they are as the pool grows
+	std::vector<std::unique_ptr<PooledTarget>> mPool;
+	int mNumUsed = 0;    // Counted by EndFrame
+	int mNumCreated = 0; // For the debug names
+};
+
+
+// The pool used by the app, created in InitGeometry (see Scene.cpp)
+extern RenderTargetPool* gRenderTargetPool;
+
+
+#endif //_RENDER_TARGET_POOL_H_INCLUDED_
@@ -0,0 +1,202 @@
+//--------------------------------------------------------------------------------------
+// Interactive ripples on the water from the objects moving through it
+//--------------------------------------------------------------------------------------
+
+#include "Ripples.h"
+#include "Shader.h"
+#include "Common.h"
+#include "GraphicsHelpers.h"
+#include "GpuEvents.h"
+#include "GpuMemory.h"
+
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+
+// Create the simulation textures, of the given size in texels (a multiple of 16) across the given world size
+// Will throw a std::runtime_error exception on failure (same as Mesh)
+Ripples::Ripples(unsigned int resolution /*= 256*/, float worldSize /*= 128*/)
+	: mResolution(resolution), mWorldSize(worldSize), mTexelSize(worldSize / resolution)
+{
+	if (resolution == 0 || resolution % 16 != 0)  throw std::runtime_error("Ripples size must be a multiple of 16");
+	if (WaveSpeed * TimeStep / mTexelSize > 0.7f)  throw std::runtime_error("Ripple texels are too small for the wave speed");
+
+	mConstantBuffer = CreateConstantBuffer(sizeof(RippleConstants));
+	if (mConstantBuffer == nullptr)  throw std::runtime_error("Error creating ripples constant buffer");
+
+	// Two channels of height as half floats, starting flat. Read by the water shaders and written by the compute shader
+	std::vector<uint16_t> flat(resolution * resolution * 2, 0);
+	D3D11_SUBRESOURCE_DATA initialData = { flat.data(), resolution * 2 * sizeof(uint16_t), 0 };
+
+	D3D11_TEXTURE2D_DESC textureDesc = {};
+	textureDesc.Width  = resolution;
+	textureDesc.Height = resolution;
+	textureDesc.MipLevels = 1;
+	textureDesc.ArraySize = 1;
+	textureDesc.Format = DXGI_FORMAT_R16G16_FLOAT;
+	textureDesc.SampleDesc.Count = 1;
+	textureDesc.Usage = D3D11_USAGE_DEFAULT;
+	textureDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS;
+	for (int i = 0; i < 2; ++i)
+	{
+		if (FAILED(gD3DDevice->CreateTexture2D(&textureDesc, &initialData, &mTextures[i])) ||
+			FAILED(gD3DDevice->CreateShaderResourceView(mTextures[i], nullptr, &mSRVs[i])) ||
+			FAILED(gD3DDevice->CreateUnorderedAccessView(mTextures[i], nullptr, &mUAVs[i])))
+		{
+			Release();
+			throw std::runtime_error("Error creating ripple textures");
+		}
+		SetDebugNames("Ripples", mTextures[i], mSRVs[i]);
+		RegisterGpuResource(mTextures[i], "Ripples");
+	}
+}
+
+Ripples::~Ripples()
+{
+	Release();
+}
+
+
+// Add an object pushing through the water this frame, as a sphere. The ID identifies the object from one frame to the next
+void Ripples::AddInteractor(int id, const CVector3& centre, float radius)
+{
+	mInteractors.push_back({ id, centre, radius });
+}
+
+
+// Run the simulation steps due by the given time, around the given camera position on water at the given height, then
+// forget this frame's interactors
+void Ripples::Simulate(float time, const CVector3& cameraPosition, float waterHeight)
+{
+	// Steps due by now. Any more than the most for one frame are skipped, and the simulation runs behind
+	int stepsDue = static_cast<int>(time / TimeStep);
+	int numSteps = (std::min)(stepsDue - mStepsDone, MaxStepsPerFrame);
+	mStepsDone = stepsDue;
+	if (numSteps <= 0)
+	{
+		mInteractors.clear();
+		return;
+	}
+
+	// Centre the square on the camera a whole texel at a time. The heights are moved across with it in the first step
+	int originX = static_cast<int>(std::floor(cameraPosition.x / mTexelSize)) - static_cast<int>(mResolution / 2);
+	int originZ = static_cast<int>(std::floor(cameraPosition.z / mTexelSize)) - static_cast<int>(mResolution / 2);
+	int shiftX = originX - mOriginX;
+	int shiftZ = originZ - mOriginZ;
+
+	// Start from flat water the first time and when the camera reaches water at another height, by moving the whole square
+	// away. The footprints of the old water are no use either
+	if (!mStarted || std::abs(waterHeight - mWaterHeight) > 1.0f)
+	{
+		shiftX = static_cast<int>(mResolution);
+		mLastFootprints.clear();
+	}
+	mStarted = true;
+	mOriginX = originX;
+	mOriginZ = originZ;
+	mWaterHeight = waterHeight;
+
+	// The footprint of each interactor now and at the last step. An ID not seen before starts where it is, so objects don't
+	// splash when the simulation starts. Keep the ones that reach the square and have been in the water, nearest first
+	float squareMinX = originX * mTexelSize;
+	float squareMinZ = originZ * mTexelSize;
+	std::vector<std::pair<float, int>> candidates; // Distance squared from the camera and index in now / before
+	std::vector<Footprint> now, before;
+	for (const Interactor& interactor : mInteractors)
+	{
+		if (interactor.id >= static_cast<int>(mLastFootprints.size()))  mLastFootprints.resize(interactor.id + 1, { 0, 0, 0, -1 });
+		Footprint current = FindFootprint(interactor.centre, interactor.radius);
+		Footprint last = mLastFootprints[interactor.id].depth < 0 ? current : mLastFootprints[interactor.id];
+		mLastFootprints[interactor.id] = current;
+		if (current.radius == 0 && last.radius == 0)  continue;
+
+		float reach = (std::max)(current.radius, last.radius);
+		if (current.x + reach < squareMinX || current.x - reach > squareMinX + mWorldSize ||
+		    current.z + reach < squareMinZ || current.z - reach > squareMinZ + mWorldSize)  continue;
+
+		float dx = current.x - cameraPosition.x;
+		float dz = current.z - cameraPosition.z;
+		candidates.push_back({ dx * dx + dz * dz, static_cast<int>(now.size()) });
+		now.push_back(current);
+		before.push_back(last);
+	}
+	mInteractors.clear();
+
+	int numInteractors = (std::min)(static_cast<int>(candidates.size()), MaxInteractors);
+	if (numInteractors < static_cast<int>(candidates.size()))
+	{
+		std::nth_element(candidates.begin(), candidates.begin() + numInteractors, candidates.end());
+	}
+	for (int i = 0; i < numInteractors; ++i)
+	{
+		mConstants.now[i]    = now[candidates[i].second];
+		mConstants.before[i] = before[candidates[i].second];
+	}
+
+	mConstants.resolution   = mResolution;
+	mConstants.origin       = { squareMinX, squareMinZ };
+	mConstants.texelSize    = mTexelSize;
+	mConstants.courant      = (WaveSpeed * TimeStep / mTexelSize) * (WaveSpeed * TimeStep / mTexelSize);
+	mConstants.damping      = Damping;
+	mConstants.pushStrength = PushStrength;
+
+	ID3D11ShaderResourceView*  nullSRV = nullptr;
+	ID3D11UnorderedAccessView* nullUAV = nullptr;
+
+	gD3DContext->CSSetShader(gRipplesComputeShader, nullptr, 0);
+	gD3DContext->CSSetConstantBuffers(0, 1, &mConstantBuffer);
+	unsigned int numGroups = mResolution / 16; // Must match RippleThreadGroupSize in Ripples_cs.hlsl
+	for (int step = 0; step < numSteps; ++step)
+	{
+		// Only the first step moves the square and pushes the water, the objects have only moved once
+		mConstants.shift[0]       = step == 0 ? shiftX : 0;
+		mConstants.shift[1]       = step == 0 ? shiftZ : 0;
+		mConstants.numInteractors = step == 0 ? numInteractors : 0;
+		UpdateConstantBuffer(mConstantBuffer, mConstants);
+
+		gD3DContext->CSSetShaderResources(0, 1, &mSRVs[mCurrent]);
+		gD3DContext->CSSetUnorderedAccessViews(0, 1, &mUAVs[1 - mCurrent], nullptr);
+		gD3DContext->Dispatch(numGroups, numGroups, 1);
+		gD3DContext->CSSetShaderResources(0, 1, &nullSRV);
+		gD3DContext->CSSetUnorderedAccessViews(0, 1, &nullUAV, nullptr);
+		mCurrent = 1 - mCurrent;
+	}
+	gD3DContext->CSSetShader(nullptr, nullptr, 0);
+}
+
+
+// Set the constants the water shaders need to find the ripples. A strength of 0 switches them off
+void Ripples::SetShaderConstants(PerFrameConstants& constants, float strength /*= 1*/)
+{
+	constants.rippleOrigin   = { mOriginX * mTexelSize, mOriginZ * mTexelSize };
+	constants.rippleScale    = 1 / mWorldSize;
+	constants.rippleStrength = mStarted ? strength : 0.0f;
+	constants.ripplePlaneY   = mWaterHeight;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions
+//--------------------------------------------------------------------------------------
+
+// The footprint on the water at the current height of a sphere
+Ripples::Footprint Ripples::FindFootprint(const CVector3& centre, float radius)
+{
+	float aboveWater = centre.y - mWaterHeight;
+	if (std::abs(aboveWater) >= radius)  return { centre.x, centre.z, 0, 0 };
+	return { centre.x, centre.z, std::sqrt(radius * radius - aboveWater * aboveWater), radius - aboveWater };
+}
+
+
+void Ripples::Release()
+{
+	for (int i = 0; i < 2; ++i)
+	{
+		if (mUAVs[i])      { mUAVs[i]->Release();      mUAVs[i]     = nullptr; }
+		if (mSRVs[i])      { mSRVs[i]->Release();      mSRVs[i]     = nullptr; }
+		if (mTextures[i])  { mTextures[i]->Release();  mTextures[i] = nullptr; }
+	}
+	if (mConstantBuffer)  { mConstantBuffer->Release();  mConstantBuffer = nullptr; }
+}
@@ -0,0 +1,139 @@
+//--------------------------------------------------------------------------------------
+// Interactive ripples on the water from the objects moving through it
+//--------------------------------------------------------------------------------------
+// A small wave-equation heightfield simulated on the GPU, covering a fixed square of the water
+// around the camera at a fixed resolution. Each step a compute shader moves every texel's height
+// towards its neighbours' from its last two heights, and objects crossing the water push the
+// water aside where their footprint on the surface has moved since the last step. The square
+// follows the camera a whole texel at a time, so the ripples stay where they are in the world.
+// The water shaders add the result to the wave heights and normals near the camera.
+//
+// The cost is bounded: steps are at a fixed rate with at most a few each frame, and only the
+// objects nearest the camera, up to a fixed number, are given to the simulation.
+
+#include "CVector2.h"
+#include "CVector3.h"
+#include <d3d11.h>
+#include <vector>
+
+#ifndef _RIPPLES_H_INCLUDED_
+#define _RIPPLES_H_INCLUDED_
+
+struct PerFrameConstants;
+
+class Ripples
+{
+//--------------------------------------------------------------------------------------
+// Construction / Usage
+//--------------------------------------------------------------------------------------
+public:
+
+	// Create the simulation textures, of the given size in texels (a multiple of 16) across the given world size
+	// Will throw a std::runtime_error exception on failure (same as Mesh)
+	Ripples(unsigned int resolution = 256, float worldSize = 128);
+	~Ripples();
+
+
+	// Add an object pushing through the water this frame, as a sphere. The ID identifies the object from one frame to the
+	// next, small numbers as it indexes a table. Call for every object each frame before Simulate, however far away
+	void AddInteractor(int id, const CVector3& centre, float radius);
+
+	// Run the simulation steps due by the given time (seconds, which only ever goes forward), around the given camera
+	// position on water at the given height, then forget this frame's interactors. Call once per frame on the immediate
+	// context. The ripple texture must not be bound to any shader stage when this is called, and the compute shader stage is
+	// left with nothing bound
+	void Simulate(float time, const CVector3& cameraPosition, float waterHeight);
+
+	// Set the constants the water shaders need to find the ripples. A strength of 0 switches them off
+	void SetShaderConstants(PerFrameConstants& constants, float strength = 1);
+
+	// The ripple heights for the water shaders in the r channel, 0 outside the simulated square
+	ID3D11ShaderResourceView* SRV()  { return mSRVs[mCurrent]; }
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions / data
+//--------------------------------------------------------------------------------------
+private:
+
+	void Release();
+
+	// The simulation runs at a fixed rate so it stays stable whatever the frame rate, and doesn't try to catch up after a slow
+	// frame, it just runs behind
+	static constexpr float TimeStep         = 1.0f / 60.0f;
+	static constexpr int   MaxStepsPerFrame = 2;
+
+	// Speed of the ripples in world units per second and how much of their height they keep each step. The speed must stay
+	// under 0.7 texels per step or the simulation blows up
+	static constexpr float WaveSpeed = 10.0f;
+	static constexpr float Damping   = 0.985f;
+
+	// How much water an object pushes aside, as a height for each unit of its depth in the water
+	static constexpr float PushStrength = 0.5f;
+
+	// Most objects given to the shader each step (must match MaxRippleInteractors in Ripples_cs.hlsl)
+	static constexpr int MaxInteractors = 16;
+
+	// Where an object crosses the water surface: centre xz, radius of the circle, and depth of the object under the surface.
+	// A radius of 0 is out of the water
+	struct Footprint
+	{
+		float x, z, radius, depth;
+	};
+
+	// The footprint on the water at the current height of a sphere
+	Footprint FindFootprint(const CVector3& centre, float radius);
+
+	// Constants for the ripple compute shader. There is a structure in the shader code that exactly matches this one
+	struct RippleConstants
+	{
+		int          shift[2];       // Texels the square has moved since the last step
+		unsigned int resolution;
+		unsigned int numInteractors;
+
+		CVector2     origin;         // World xz of the square's corner with the lowest coordinates
+		float        texelSize;      // World units
+		float        courant;        // (wave speed * time step / texel size) squared
+
+		float        damping;
+		float        pushStrength;
+		CVector2     padding;
+
+		Footprint    now[MaxInteractors];    // Of each interactor at this step
+		Footprint    before[MaxInteractors]; // And at the last step
+	};
+
+	unsigned int mResolution;
+	float        mWorldSize;
+	float        mTexelSize;
+
+	// The square's corner in texels from the world origin, and the water height it is simulated at
+	int   mOriginX = 0;
+	int   mOriginZ = 0;
+	float mWaterHeight = 0;
+	bool  mStarted = false;
+	int   mStepsDone = 0; // Since time 0
+
+	// This frame's interactors, and each ID's footprint when the last step was run
+	struct Interactor
+	{
+		int      id;
+		CVector3 centre;
+		float    radius;
+	};
+	std::vector<Interactor> mInteractors;
+	std::vector<Footprint>  mLastFootprints;
+
+	RippleConstants mConstants;
+	ID3D11Buffer*   mConstantBuffer = nullptr;
+
+	// Two textures used in turn, each step reads the last and writes the other. Each holds the height at its step in r and the
+	// height the step before in g
+	ID3D11Texture2D*           mTextures[2] = {};
+	ID3D11ShaderResourceView*  mSRVs[2]     = {};
+	ID3D11UnorderedAccessView* mUAVs[2]     = {};
+	int                        mCurrent     = 0;
+};
+
+
+#endif //_RIPPLES_H_INCLUDED_
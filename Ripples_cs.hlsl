@@ -0,0 +1,105 @@
+//--------------------------------------------------------------------------------------
+// Ripples compute shader
+//--------------------------------------------------------------------------------------
+// One step of the ripple simulation (see Ripples.h). Each texel is a point on the water around the
+// camera, holding its height at the last two steps. The wave equation moves the height towards the
+// average of its neighbours, keeping its speed from the last step. Then each object crossing the
+// water pushes the water out of the way where its footprint on the surface has moved to, and lets
+// it back where it has moved from, so an object standing still makes no ripples
+// The compute shaders don't use the rendering constant buffers so have their own, and don't include Common.hlsli
+
+
+//--------------------------------------------------------------------------------------
+// Constants
+//--------------------------------------------------------------------------------------
+
+static const uint RippleThreadGroupSize = 16; // Must match the thread groups dispatched in Ripples::Simulate
+static const uint MaxRippleInteractors  = 16; // Must match MaxInteractors in Ripples.h
+static const uint RippleEdgeTexels      = 8;  // Ripples fade out over this many texels at the edges instead of bouncing back
+
+
+//--------------------------------------------------------------------------------------
+// Constant Buffers
+//--------------------------------------------------------------------------------------
+
+// These variables must match exactly the RippleConstants structure in Ripples.h
+cbuffer RippleConstants : register(b0) // Compute shaders have their own constant buffer slots, so b0 is not the per-frame constants here
+{
+	int2   gShift;            // Texels the square has moved since the last step
+	uint   gResolution;
+	uint   gNumInteractors;
+
+	float2 gOrigin;           // World xz of the square's corner with the lowest coordinates
+	float  gTexelSize;        // World units
+	float  gCourant;          // (wave speed * time step / texel size) squared
+
+	float  gDamping;          // Part of the height kept each step
+	float  gPushStrength;     // Height of water pushed aside for each unit of an object's depth in the water
+	float2 paddingRipples;
+
+	float4 gFootprintsNow[MaxRippleInteractors];    // Where each object crosses the water: centre xz, radius, depth
+	float4 gFootprintsBefore[MaxRippleInteractors]; // And where it did at the last step
+}
+
+
+//--------------------------------------------------------------------------------------
+// Textures
+//--------------------------------------------------------------------------------------
+
+Texture2D<float2>   RipplesIn  : register(t0); // Height at the last step and the step before
+RWTexture2D<float2> RipplesOut : register(u0);
+
+
+//--------------------------------------------------------------------------------------
+// Functions
+//--------------------------------------------------------------------------------------
+
+// Height at the last step and the step before of a texel of this step's square, from where it was in the last step's.
+// Flat water outside the last step's square
+float2 LastHeights(int2 texel)
+{
+	int2 lastTexel = texel + gShift;
+	if (any(lastTexel < 0) || any(lastTexel >= int(gResolution)))  return 0;
+	return RipplesIn.Load(int3(lastTexel, 0));
+}
+
+
+// Height of water pushed aside at the given world position by an object with the given footprint, rounded off to nothing
+// at the edge of the footprint
+float Push(float4 footprint, float2 worldXZ)
+{
+	if (footprint.z == 0)  return 0;
+	float2 offset = worldXZ - footprint.xy;
+	float  t = saturate(1 - dot(offset, offset) / (footprint.z * footprint.z));
+	return gPushStrength * footprint.w * t * t;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+[numthreads(RippleThreadGroupSize, RippleThreadGroupSize, 1)]
+void main(uint3 id : SV_DispatchThreadID)
+{
+	if (any(id.xy >= gResolution))  return;
+	int2 texel = int2(id.xy);
+
+	// Wave equation, the acceleration of the height is from how far it is from the average of its neighbours
+	float2 heights   = LastHeights(texel);
+	float  laplacian = LastHeights(texel + int2(1, 0)).x + LastHeights(texel - int2(1, 0)).x +
+	                   LastHeights(texel + int2(0, 1)).x + LastHeights(texel - int2(0, 1)).x - 4 * heights.x;
+	float  height    = (2 * heights.x - heights.y + gCourant * laplacian) * gDamping;
+
+	// The texture's v goes the same way as world z, as the water shaders sample it
+	float2 worldXZ = gOrigin + (texel + 0.5f) * gTexelSize;
+	for (uint i = 0; i < gNumInteractors; ++i)
+	{
+		height += Push(gFootprintsBefore[i], worldXZ) - Push(gFootprintsNow[i], worldXZ);
+	}
+
+	// Soak up the ripples reaching the edges, the water beyond is flat
+	uint  edgeDistance = min(min(id.x, id.y), min(gResolution - 1 - id.x, gResolution - 1 - id.y));
+	float edgeFade = saturate(edgeDistance / (float)RippleEdgeTexels);
+	RipplesOut[id.xy] = float2(height, heights.x) * edgeFade;
+}
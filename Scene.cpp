@@ -6,10 +6,56 @@
 #include "Scene.h"
 #include "Mesh.h"
 #include "Model.h"
+#include "InstancedModel.h"
+#include "LightGrid.h"
+#include "ShadowMap.h"
+#include "Caustics.h"
+#include "WaveComposite.h"
+#include "Ripples.h"
+#include "ParticleSystem.h"
+#include "WaterHeights.h"
+#include "Buoyancy.h"
+#include "Animation.h"
+#include "AssetArchive.h"
+#include "WaterClipmap.h"
+#include "Terrain.h"
+#include "OceanFFT.h"
+#include "EnvironmentMap.h"
+#include "PostProcess.h"
+#include "WaterBody.h"
+#include "GpuProfiler.h"
+#include "CpuProfiler.h"
+#include "SpikeDetector.h"
+#include "GpuEvents.h"
+#include "GpuMemory.h"
+#include "GpuReadback.h"
+#include "GpuUploader.h"
+#include "FrameCapture.h"
+#include "StatsOverlay.h"
+#include "OverdrawView.h"
+#include "DynamicResolution.h"
+#include "RenderGraph.h"
+#include "RenderTargetPool.h"
+#include "TextureStreamer.h"
+#include "TextureCooker.h"
+#include "CommandRecorder.h"
+#include "JobSystem.h"
+#include "SceneObjects.h"
+#include "Impostor.h"
+#include "DrawList.h"
+#include "HiZBuffer.h"
+#include "Benchmark.h"
+#include "StressScene.h"
+#include "PortalMap.h"
+#include "WorldStreamer.h"
+#include "WaterVertexCache.h"
+#include "Settings.h"
 #include "Camera.h"
 #include "State.h"
+#include "StateCache.h"
 #include "Shader.h"
 #include "Input.h"
+#include "Direct3DSetup.h"
 #include "Common.h"
 
 #include "CVector2.h" 
@@ -18,10 +64,18 @@
 #include "MathHelpers.h"     // Helper functions for maths
 #include "GraphicsHelpers.h" // Helper functions to unclutter the code here
 #include "ColourRGBA.h" 
+#include "AllocationCounter.h"
 
 #include <array>
+#include <algorithm>
 #include <sstream>
 #include <memory>
+#include <functional>
+#include <atomic>
+#include <cstring>
+#include <cfloat>
+#include <cmath>
+#include <vector>
 
 
 //--------------------------------------------------------------------------------------
@@ -32,36 +86,289 @@
 const float ROTATION_SPEED = 1.5f;  // Radians per second for rotation
 const float MOVEMENT_SPEED = 50.0f; // Units per second for movement (what a unit of length is depends on 3D model - i.e. an artist decision usually)
 
-// Lock FPS to monitor refresh rate, which will typically set it to 60fps. Press 'p' to toggle to full fps
+// Lock FPS to monitor refresh rate, which will typically set it to 60fps. Press 'p' to toggle to full fps. Starts as the vsync
+// render setting (see Settings.h)
 bool lockFPS = true;
 bool wireframe = true;
 
 // Meshes, models and cameras, same meaning as TL-Engine. Meshes prepared in InitGeometry function, Models & camera in InitScene
-Mesh* gSkyMesh;
 Mesh* gGroundMesh;
 Mesh* gTrollMesh;
 Mesh* gCrateMesh;
 Mesh* gLightMesh;
 Mesh* gWaterMesh;
+Mesh* gWaterCoarseMesh;
 
-Model* gSky;
 Model* gGround;
 Model* gTroll;
 Model* gCrate;
 Model* gWater;
+Model* gWaterCoarse;
+
+// The animations in the troll's mesh file, and the animators playing them on the models, updated every frame in parallel (see
+// Animation.h). The troll only gets an animator if its file has animations, once it has loaded (see SwapStreamedMeshes)
+AnimationSet*          gTrollAnimations;
+std::vector<Animator*> gAnimators;
+
+// The stress scene's meshes and its models of them, drawn as scene objects with the others, if there is one (see StressScene.h)
+std::vector<Mesh*>  gStressMeshes;
+std::vector<Model*> gStressModels;
+
+// All the models above, the lights and the grids of the water bodies, for the work done on each of them every frame
+std::vector<Model*> gSceneModels;
+
+// The ground, troll and crate are drawn as scene objects, sorted by material and culled together (see SceneObjects.h). The
+// ground is hidden when the terrain is drawn instead
+int gGroundObject = -1;
+
+// The pipeline states of the draws that aren't scene objects (see StateCache.h), made in InitGeometry. Each has a version for
+// passes cut to a scissor rectangle, chosen by SetScenePipeline
+enum ScenePipeline { SkyPipeline, LightsPipeline, RefractedLightsPipeline, ReflectedLightsPipeline, ParticlesPipeline,
+                     NumScenePipelines };
+PipelineState gScenePipelines[NumScenePipelines][2];
 
 Camera* gCamera;
 
 
-// Store lights in an array in this exercise
-const int NUM_LIGHTS = 2;
+// The ground can be drawn as the Hills.x mesh (gGround), or as a heightmap terrain sampled from the same mesh, drawn as
+// quadtree tiles with levels of detail and culled tile by tile (see Terrain.h). The terrain also keeps the camera above
+// the ground. Press '6' to switch
+Terrain* gTerrain;
+bool     gTerrainEnabled = true;
+const float CameraGroundClearance = 2.0f; // Lowest the camera can go above the terrain
+
+
+// The water surface can be drawn as the original fixed grid (gWater), as a camera-centred clipmap of grid tiles, which
+// puts dense vertices near the camera and covers a much larger area for the same cost, or as a coarse grid (gWaterCoarse)
+// that is tessellated on the GPU by distance / screen-space size. Press 'G' to cycle through them
+enum class WaterGeometry { Grid, Clipmap, Tessellated };
+WaterGeometry gWaterGeometry = WaterGeometry::Clipmap;
+WaterClipmap* gWaterClipmap;
+
+// The fixed grid can be moved by the waves once a frame in a compute shader, and every pass drawing it reads the moved
+// vertices instead of each moving them again in its vertex shader (see WaterVertexCache.h). Press Numpad 0 to switch
+bool gCacheWaterVertices = true;
+bool gWaterVerticesCached = false; // This frame: the cache is on and the water is drawn as the grid
+
+// The areas of water in the level, each at its own height (see WaterBody.h). The first is the open water, drawn with the
+// geometry above, the others are lakes, pools or rivers with grids of their own. The bodies in view are put in groups by
+// height each frame, each group rendering its own reflection and refraction (see GroupWaterBodies)
+std::vector<WaterBody*> gWaterBodies;
+std::vector<int>        gWaterBodyGroups; // Group of each body this frame, -1 if it is out of view
+
+// Each water body's shore map, the ground under it baked from the terrain, gives the depth of water for the foam along the
+// shore and the fading at the water's edge, instead of the refraction depth rendered each frame (see WaterBody.h). Press '7'
+// to switch
+bool gShoreMaps = true;
+
+// The water waves come from an FFT ocean simulation run in compute shaders each frame (see OceanFFT.h), or from the original
+// scrolling normal/height map. Press 'O' to switch between them and 'F' to cycle the FFT size between 128, 256 and 512
+OceanFFT* gOcean;
+bool      gOceanEnabled = true;
+float     gOceanTime = 0; // Seconds of ocean simulation
+
+// Number of heap allocations made during the last call to RenderScene, shown in the stats overlay or the window title. Counted
+// on the main thread and in the jobs it starts while rendering, e.g. recording passes, not by the simulation job or the
+// streaming and hot reload threads running at the same time. Should be zero once everything has settled - allocating memory
+// during rendering is slow
+uint64_t gRenderAllocations = 0;
+
+// Number of state changes sent to DirectX and skipped by the state cache during the last call to RenderScene
+StateCacheStats gRenderStateStats;
+
+// The stats overlay is drawn over each frame, with the settings that are otherwise shown in the window title (see
+// StatsOverlay.h). Press '9' to switch between the overlay and the window title
+bool gShowStats = true;
+
+// Press F11 to capture the next frame when the app is started from RenderDoc (see GpuEvents.h)
+bool gCaptureFrame = false;
+
+// Models that are outside the view frustum of the camera being rendered are skipped. This is the frustum of the camera
+// chosen by SelectCamera, which is the reflected camera in the reflection pass. Counts are for the last call to RenderScene
+// The refraction and reflection passes add the water plane to the frustum (see WaterCullPlane)
+// Each thread has its own frustum, and the counts are shared by all threads, for passes recorded in parallel (see below)
+thread_local Frustum      gViewFrustum;
+std::atomic<unsigned int> gModelsRendered(0);
+std::atomic<unsigned int> gModelsCulled(0);
+
+// The water reflects the scene with a planar reflection (the whole scene rendered again, mirrored), an environment cube map
+// (see EnvironmentMap.h), or both: the planar reflection for the water near the camera and the cube map further away, where
+// only the part of the reflection pass covering the near water is rendered. Screen-space reflections trace the reflected rays
+// through the main pass instead, falling back to the cube map where they miss, so no scene needs rendering again at all.
+// Press 'V' to cycle between them
+enum class ReflectionMode
+{
+	Planar,
+	Hybrid,
+	Environment,
+	ScreenSpace,
+};
+ReflectionMode  gReflectionMode = ReflectionMode::Hybrid;
+const float     HybridReflectionDistance = 150.0f; // Distance from the camera where the hybrid mode fades to the cube map
+const float     WaterShadingLodDistance  = 600.0f; // Water further from the camera is shaded more cheaply (see WaterSurface_ps.hlsl)
+bool            gWaterShadingLod = true;           // F7 switches it off, to shade all the water fully
+
+// Water further than this from the camera is shaded in a checkerboard of 2x2 pixel blocks, the skipped blocks filled in from
+// their neighbours afterwards (see WaterCheckerboardFill_ps.hlsl). Needs the depth prepass and no MSAA, as the fill reads the
+// scene's pixels, and isn't used from under the water. A reduced shading rate in hardware (VRS) would need vendor extensions
+const float     WaterCheckerboardDistance = 300.0f;
+bool            gWaterCheckerboard = true;         // F8 switches it off
+EnvironmentMap* gEnvironmentMap;
+
+// The key light (the second light) casts shadows from cascaded shadow maps, rendered once a frame before the passes that
+// light the scene, which all sample the same cascades (see ShadowMap.h). The finest cascade is rendered every frame and the
+// others in turn. Press F4 to switch the shadows off
+ShadowMap* gShadowMap;
+bool       gShadows = true;
+
+// The waves focus the key light into caustics on everything under the water. They are generated from the wave normals once
+// a frame into a texture tiling like the waves, and the lit shaders project it down the key light (see Caustics.h). Press F5
+// to switch the caustics off
+Caustics* gCaustics;
+WaveComposite* gWaveComposite; // The layers of the wave normal/height map combined for the water shaders
+bool      gCausticsEnabled = true;
+
+// When the camera goes under the water the reflection and refraction textures of the water above it are no use - they show
+// the world above the surface as seen from above it. The passes for that water are skipped, the water surface shader shows
+// the sky through the surface from below instead, and the whole scene is fogged by the water in one full-screen pass at the
+// end of the main pass (see RenderUnderwaterFog). Found each frame in RenderScene
+bool gCameraUnderwater = false;
+
+// Objects moving through the water near the camera leave ripples, simulated on the GPU in a square of the water around the
+// camera and added to the waves by the water shaders (see Ripples.h). Press F6 to switch the ripples off
+Ripples* gRipples;
+bool     gRipplesEnabled = true;
+
+// Spray thrown up by objects moving through the water and foam along the shore are GPU particles, emitted, moved and sorted
+// by compute shaders and drawn in the main pass with one indirect draw (see ParticleSystem.h). With particle flares the main
+// pass draws the light flares as one-frame particles too, sorted in with the spray, instead of as the instanced model. The
+// water passes keep the instanced flares. Press End to switch the particles off and Delete to switch the particle flares
+ParticleSystem*       gParticles;
+bool                  gParticlesEnabled = true;
+bool                  gParticleFlares   = false;
+std::vector<CVector3> gParticleObjectCentres; // Where each scene object was last frame, for its speed through the water
+float                 gParticleTime = 0;      // Ocean time at the last particle update
+
+// Reflection and refraction change little from one frame to the next, so with temporal water textures only one of them is
+// rendered each frame, in turn. The water finds where it was in the other, left over from the last frame, from the camera
+// matrix it was rendered with (reprojection). That history is thrown away and both rendered when the camera has moved or
+// turned too far for it to line up well. Moving models show a frame late in the texture that wasn't rendered, which can't be
+// seen at normal frame rates. Press 'T' to switch temporal water textures on and off
+struct WaterTextureHistory
+{
+	CMatrix4x4 viewProjectionMatrix; // Camera when the texture was last rendered
+	CVector3   cameraPosition;
+	CVector3   cameraFacing;
+	CVector2   uvScale;              // Part of the texture rendered to, its resolution can change (see gDynamicResolution)
+	bool       valid = false;        // False when the texture hasn't been rendered since it was created or last used
+};
+bool                gTemporalWaterTextures = false;
+const float         TemporalMaxCameraMove = 0.5f;    // Furthest the camera can move in a frame and still use the history
+const float         TemporalMinCameraTurn = 0.9995f; // Dot product of the facing directions, about 2 degrees of turn
+
+// Most groups of water bodies at different heights that can be in view at once, each needs its own water textures. Bodies
+// beyond that join the group nearest their height. Bodies closer in height than the tolerance are put in the same group
+const int   MaxWaterGroups = 4;
+const float WaterGroupTolerance = 0.01f;
+
+// Water hidden behind other geometry (e.g. terrain, or walls when indoors) would still cost its refraction and reflection
+// passes. An occlusion query around each group's water in the main pass counts the pixels of it that are drawn, and the
+// result is read a few frames later without waiting for the GPU. A group with none of its water drawn skips its passes. It
+// is still drawn in the main pass (with old textures, which can't be seen) so the query finds out when it comes into view
+// again. Groups are rendered when their results aren't ready, so there are only ever a few frames of old water textures
+// as hidden water comes into view. Press 'Q' to switch the queries off
+bool      gWaterOcclusionQueries = true;
+const int WaterQueryLatency = 3; // Frames between issuing a query and reading it
+int       gWaterQuerySlot = 0;   // The query of each set issued this frame
+
+// Water often covers only a strip of the screen, and only that part of the refraction and reflection is ever used. Each frame
+// the rectangle each group's water covers on the screen is found from the bounds of its bodies and the waves, and the
+// refraction and reflection passes are cut to it with the scissor test, so their cost follows how much of the screen is water.
+// Press 'U' to switch the scissor test off
+bool gWaterScissor = true;
+
+// The shadow, environment, water height, refraction, reflection and main passes can be recorded on worker threads, each into
+// its own deferred context, and played back in order (see CommandRecorder.h). Press 'M' to switch between that and rendering
+// them in turn. The water height, refraction and reflection passes are rendered for each group of water bodies in view
+const int        NumScenePasses = 3 + 3 * MaxWaterGroups;
+bool             gParallelPasses = false;
+CommandRecorder* gCommandRecorder;
+
+// The main pass renders into an HDR texture, which is tonemapped into the back buffer with bloom and an exposure that adapts
+// to the brightness of the scene (see PostProcess.h). The reflection, refraction and environment map are HDR too, so the
+// lights are as bright in the water as they are in the scene. Press 'X' to switch the bloom and 'Y' the automatic exposure
+// The main pass is multisampled (gMSAASamples, see Direct3DSetup.cpp) and resolved before post-processing. The water textures
+// are smaller and blurred by the distortion anyway, so they aren't. Press '1' to cycle between 4x, 2x and no MSAA
+PostProcess* gPostProcess;
+
+// The light flares glow brighter than white, so they bloom
+const float LightFlareBrightness = 4.0f;
+
+// Lit models in the refraction and reflection passes are clipped against the water by the GPU (SV_ClipDistance), leaving
+// the pixel shaders to test only the pixels close to the waves. Press 'C' to switch back to clipping every pixel in the shaders
+bool gHardwareWaterClip = true;
+
+// The main pass first renders the depth of the lit models and water with no pixel shader, then shades them with an equal
+// depth test, so each pixel on screen runs the lit model or water pixel shader once however much the geometry overlaps
+// Press 'Z' to switch the depth prepass off
+bool gDepthPrepass = true;
+
+// Times each rendering pass on the GPU, the average times are shown in the window title (and used in benchmark mode)
+GpuProfiler* gGpuProfiler;
+
+
+// Store lights in an array in this exercise. The two main lights are followed by rows of lamps along the water. The lights
+// reaching each part of the scene are found each frame with a light grid, so the shaders only add up the lights near each
+// pixel (see LightGrid.h). Press F3 to switch the dock lamps off
+const int NUM_DOCK_LAMPS = 32;
+const int NUM_LIGHTS = 2 + NUM_DOCK_LAMPS;
 struct Light
 {
 	Model*   model;
 	CVector3 colour;
 	float    strength;
+	float    range; // The light fades to nothing at this distance
 };
 Light gLights[NUM_LIGHTS];
+bool  gDockLamps = true;
+
+// The stress scene's lights, if it has any (see StressScene.h). They don't have models, their flares are placed directly
+std::vector<StressLight> gStressLights;
+
+// The light flares are all drawn together with hardware instancing, each tinted with its light's colour (see InstancedModel.h)
+InstancedModel* gLightInstances;
+
+// Cull the instanced models on the GPU and draw them with indirect draws, rather than culling each instance on the CPU in
+// every pass (see InstancedModel::RenderGpuCulled). The number of instances drawn isn't known then, they are all counted
+// as rendered. Press '4' to switch
+bool gGpuInstanceCulling = true;
+
+// Cull the lit models hidden behind what was drawn a few frames before, from a pyramid of each pass's depth: the main pass's
+// and each water group's refraction and reflection (see HiZBuffer.h). Press Home to switch
+bool       gOcclusionCulling = true;
+HiZBuffer* gMainHiZ = nullptr; // The main pass's, the water texture sets have their own
+
+// Draw the lit models at the coarsest level of detail (see Mesh.h) whose error is under this many pixels on screen. The
+// refraction, reflection and environment passes are distorted, blurred or small, so they allow more error. Press '5' to
+// switch levels of detail off
+bool  gMeshLods = true;
+float gLodPixelError = 1.0f;
+float gWaterPassLodBias = 4.0f;
+
+// The lit models with an impostor (see Impostor.h) are drawn as it when they are less than this many pixels across on screen.
+// The water passes multiply it by their level of detail bias, so they swap to impostors nearer the camera. Press Page Up to switch
+bool  gDrawImpostors = true;
+float gImpostorPixels = 64.0f;
+std::atomic<unsigned int> gImpostorsRendered(0); // In the last frame, of the models counted as rendered
+
+// The refraction and reflection passes see less of the scene than the main pass: the refraction is darkened by the water
+// beyond a short distance (see WaterExtinction), and both are distorted and lower resolution. So they drop the lit models
+// further from the camera than their view distance, or smaller than this many pixels across, unless the model is always
+// drawn (see SceneObjects::SetAlwaysDrawn). The terrain and sky are always drawn. Press Space to switch
+bool        gSecondaryPassCulling = true;
+const float RefractionViewDistance = 500.0f;
+const float ReflectionViewDistance = 2000.0f;
+const float SecondaryPassMinPixels = 4.0f;
 
 
 // Additional light information
@@ -69,6 +376,7 @@ CVector3 gAmbientColour = { 0.5f, 0.5f, 0.5f }; // Background level of light (sl
 float    gSpecularPower = 256; // Specular power controls shininess - same for all models in this app
 
 ColourRGBA gBackgroundColor = { 0.5f, 0.5f, 0.5f, 1.0f };
+const float BackgroundDistortion[4] = { 1, 0, 0, 0 }; // The distortion textures are fully distorted where nothing is rendered
 
 // Variables controlling light1's orbiting
 const float gLightOrbitRadius = 20.0f;
@@ -84,12 +392,21 @@ const float gLightOrbitSpeed = 0.7f;
 // IMPORTANT: Any new data you add in C++ code (CPU-side) is not automatically available to the GPU
 //            Anything the shaders need (per-frame or per-model) needs to be sent via a constant buffer
 
-PerFrameConstants gPerFrameConstants;      // The constants (settings) that need to be sent to the GPU each frame (see common.h for structure)
+// The constant variables are per-thread (see Common.h). Those for the main thread are set up each frame and copied for each pass
+thread_local PerFrameConstants gPerFrameConstants; // The constants (settings) that need to be sent to the GPU each frame (see common.h for structure)
+PerFrameConstants              gFrameConstants;    // Copy of the main thread's constants that each pass starts from (see BeginScenePass)
 ID3D11Buffer*     gPerFrameConstantBuffer; // The GPU buffer that will recieve the constants above
 
-PerModelConstants gPerModelConstants;      // As above, but constants (settings) that change per-model (e.g. world matrix)
+thread_local PerViewConstants gPerViewConstants; // The camera of the pass, sent each time it changes (see SelectCamera)
+PerViewConstants              gFrameViewConstants; // The main camera, which each pass starts from as the frame constants above
+ID3D11Buffer*     gPerViewConstantBuffer;
+
+thread_local PerModelConstants gPerModelConstants; // As above, but constants (settings) that change per-model (e.g. world matrix)
 ID3D11Buffer*     gPerModelConstantBuffer; // --"--
 
+WaterConstants gWaterConstants;      // Water settings that can be tuned while the app runs (see Common.h), sent when they change
+ID3D11Buffer*  gWaterConstantBuffer;
+
 
 
 //--------------------------------------------------------------------------------------
@@ -99,165 +416,626 @@ ID3D11Buffer*     gPerModelConstantBuffer; // --"--
 // DirectX objects controlling textures used in this lab
 ID3D11Resource*           gSkyDiffuseSpecularMap = nullptr;
 ID3D11ShaderResourceView* gSkyDiffuseSpecularMapSRV = nullptr;
-ID3D11Resource*           gGroundDiffuseSpecularMap = nullptr;
-ID3D11ShaderResourceView* gGroundDiffuseSpecularMapSRV = nullptr;
-ID3D11Resource*           gCrateDiffuseSpecularMap = nullptr;
-ID3D11ShaderResourceView* gCrateDiffuseSpecularMapSRV = nullptr;
-ID3D11Resource*           gTrollDiffuseSpecularMap = nullptr;
-ID3D11ShaderResourceView* gTrollDiffuseSpecularMapSRV = nullptr;
+
+// The lit models' textures are packed into the layers of one texture array, so switching between the models' materials
+// doesn't change the texture (see CookTextureArray). It is streamed in as it is seen closer up, owned by gTextureStreamer
+// (see TextureStreamer.h)
+StreamedTexture* gLitModelDiffuseSpecularMaps = nullptr;
+const char* const LitModelTextureFiles[] = { "GrassDiffuseSpecular.dds", "TrollDiffuseSpecular.dds", "CargoA.dds" };
+const int NumLitModelTextures = sizeof(LitModelTextureFiles) / sizeof(LitModelTextureFiles[0]);
+const int GroundTextureLayer = 0; // Layers in the order of the files above
+const int TrollTextureLayer  = 1;
+const int CrateTextureLayer  = 2;
 
 ID3D11Resource*           gLightDiffuseMap = nullptr;
 ID3D11ShaderResourceView* gLightDiffuseMapSRV = nullptr;
 
 
 //// Water textures / render targets
-ID3D11Resource*           gWaterNormalMap = nullptr;          // The normal/height map used for the waves on the surface of the water
+ID3D11Resource*           gWaterNormalMap = nullptr;          // The normal map used for the waves on the surface of the water
 ID3D11ShaderResourceView* gWaterNormalMapSRV = nullptr;       // --"--
-ID3D11Texture2D*          gWaterHeight = nullptr;            // The height of the water above the floor at each pixel - a data texture rendered each frame
-ID3D11ShaderResourceView* gWaterHeightSRV = nullptr;          // --"--  Used to detect the boundary between above water and underwater
-ID3D11RenderTargetView*   gWaterHeightRenderTarget = nullptr; // --"--
-ID3D11Texture2D*          gReflection = nullptr;             // The reflected scene is rendered into this texture 
-ID3D11ShaderResourceView* gReflectionSRV = nullptr;           // --"-- For reading the texture in shaders
-ID3D11RenderTargetView*   gReflectionRenderTarget = nullptr;  // --"-- For writing to the texture as a render target
-ID3D11Texture2D*          gRefraction = nullptr;             // The refracted scene is rendered into this texture
-ID3D11ShaderResourceView* gRefractionSRV = nullptr;           // --"-- For reading the texture in shaders
-ID3D11RenderTargetView*   gRefractionRenderTarget = nullptr;  // --"-- For writing to the texture as a render target
+ID3D11Resource*           gWaterWaveHeightMap = nullptr;      // The height map for the waves, made from the same file as the normals
+ID3D11ShaderResourceView* gWaterWaveHeightMapSRV = nullptr;   // --"--
+
+// Each group of water bodies in view renders the reflection and refraction at its own height into a set of these textures.
+// The sets are made the first time that many groups are in view and kept after, so a set stays with the group at the same
+// height from frame to frame (keeping its history for temporal water textures)
+// The refraction and the reflection are the two slices of texture arrays, 0 and 1, so the water views pass can render both at
+// once (see RenderWaterViewsPass). The other passes and the water surface shader use the views of a single slice
+struct WaterTextureSet
+{
+	ID3D11Texture2D*          views = nullptr;                  // The refracted and reflected scenes are rendered into this array
+	ID3D11RenderTargetView*   viewsRenderTarget = nullptr;      // --"-- Both slices, for the water views pass
+	ID3D11ShaderResourceView* reflectionSRV = nullptr;          // The reflection slice, for reading the texture in shaders
+	ID3D11RenderTargetView*   reflectionRenderTarget = nullptr; // --"-- For writing to the texture as a render target
+	ID3D11ShaderResourceView* refractionSRV = nullptr;          // The refraction slice, for reading the texture in shaders
+	ID3D11RenderTargetView*   refractionRenderTarget = nullptr; // --"-- For writing to the texture as a render target
+	ID3D11Texture2D*          viewsDistortion = nullptr;                  // Height above the water of the reflected scene (0->1 up to
+	ID3D11RenderTargetView*   viewsDistortionRenderTarget = nullptr;      // MaxDistortionDistance), how much to distort the reflection,
+	ID3D11ShaderResourceView* reflectionDistortionSRV = nullptr;          // and depth below the water of the refracted scene. Slices
+	ID3D11RenderTargetView*   reflectionDistortionRenderTarget = nullptr; // as above
+	ID3D11ShaderResourceView* refractionDistortionSRV = nullptr;          // --"--
+	ID3D11RenderTargetView*   refractionDistortionRenderTarget = nullptr; // --"--
+	ID3D11Texture2D*          viewsDepthTexture = nullptr;      // Depth buffers for the refraction and reflection, slices as
+	ID3D11DepthStencilView*   viewsDepthStencil = nullptr;      // above. Read when upsampling the refraction, and to build the
+	ID3D11DepthStencilView*   refractionDepthStencil = nullptr; // occlusion culling depth of each (see below)
+	ID3D11ShaderResourceView* refractionDepthSRV = nullptr;     // --"--
+	ID3D11DepthStencilView*   reflectionDepthStencil = nullptr; // --"--
+	ID3D11ShaderResourceView* reflectionDepthSRV = nullptr;     // --"--
+
+	float height = 0;      // Height of the water group using the set, or that last used it
+	bool  inUse  = false;  // Whether a group is using the set this frame
+
+	// Occlusion queries for the group's water in the main pass, one for each frame until its result is read (see above)
+	ID3D11Query* occlusionQueries[WaterQueryLatency] = {};
+	bool         queryIssued[WaterQueryLatency] = {};
+	bool         hidden = false; // None of the water was drawn in the last query result read
+
+	// The part of the textures the group's water covers on the screen this frame (see WaterScreenRect)
+	D3D11_RECT screenRect = {};
+
+	// Whether the refraction and reflection passes are rendered this frame, and the camera they were last rendered with
+	bool renderRefraction = false;
+	bool renderReflection = false;
+	WaterTextureHistory refractionHistory;
+	WaterTextureHistory reflectionHistory;
+
+	// The group's water height depth buffer in the render graph this frame (see RenderSceneFromCamera)
+	int heightDepth = -1;
+
+	// The occlusion culling depth of the refraction and reflection passes, from earlier frames (see gOcclusionCulling)
+	HiZBuffer refractionHiZ;
+	HiZBuffer reflectionHiZ;
+};
+WaterTextureSet gWaterTextureSets[MaxWaterGroups]; // The sets in use this frame are the groups of water bodies in view
+
+// A group rendering both its refraction and reflection in a frame can render them in one water views pass, which draws each
+// lit model once for both: the material's vertex shader runs once and the water views geometry shader sends each triangle to
+// both slices of the textures, as seen from each camera (see WaterViews_gs.hlsl). That halves the draw calls of the two
+// passes. The sky and lights are then drawn into each slice on its own. Press F9 to switch back to the separate passes
+bool gWaterViews = true;
+ID3D11Buffer* gWaterViewConstantBuffer; // The water views of the pass (see WaterViewConstants in Common.h)
+
+// Screen-space refraction skips the refraction pass altogether. The water surface shader sees through the water into the main
+// pass rendered so far instead, from copies of its colour and depth taken before the water is drawn, and works out the depth
+// below the water for the tint and distortion from the depth copy. Saves a full scene pass per group of water bodies, but
+// nothing that is off screen or hidden behind something above the water can be seen through it. Press Insert to switch
+bool gScreenSpaceRefraction = false;
+
+// The textures above can be rendered smaller than the viewport to save most of the fill-rate cost of the three extra scene passes.
+// When they are, the water surface shader upsamples the refraction using depth to keep object edges sharp. Press 'R' to cycle
+// between full, half and quarter size
+float gWaterTextureScale = 0.5f;
+
+// The refraction and reflection have mip-maps, made after each pass that renders them, so the water surface shader can blur
+// them where the waves are rough or far away rather than showing a sharp mirror image (see WaterSurface_ps.hlsl). A few levels
+// cover the blur wanted, the distortion textures read alongside them need none
+const unsigned int WaterTextureMipLevels = 5;
+
+// Dynamic resolution renders the main scene and the water textures into a smaller part of their render targets when the
+// GPU takes longer than the target frame time, scaled up to the back buffer by the tonemapping (see DynamicResolution.h). The
+// water passes get a fixed share of the frame time, the main scene gets what is left after every other pass. The main and
+// water scales are controlled separately, as looking across a lot of water makes the water passes slow but not the main one
+// Press '2' to cycle between off, 60fps (16.6ms) and 120fps (8.3ms)
+float             gFrameTimeTarget = 0; // Milliseconds, 0 for dynamic resolution off
+const float       WaterFrameTimeShare = 0.3f;
+DynamicResolution gMainResolution(0.5f);
+DynamicResolution gWaterResolution(0.5f);
+unsigned int      gDynamicResolutionFrame = 0; // GPU profiler frame the scales were last updated for
+
+// Every pass has a depth buffer of its own at its own size: the main pass uses gDepthStencil, the environment map its own
+// (see EnvironmentMap.h) and the water passes those below. None is shared by passes of different sizes, so the main depth is
+// never overwritten by another pass and stays readable after the main pass (gDepthShaderView). Depth buffers are always cleared
+// whole to 0 (the far depth, depths are reversed) even when only a scissor rectangle or part of the viewport is rendered: a
+// whole clear to the far value only marks the GPU's compressed depth tiles as cleared, where a partial clear would have to
+// write the pixels.
+//
+// The water textures need their own depth buffers, matching their size. The refraction depth (in each texture set) is kept for the
+// upsampling, which also needs a full size copy of the scene depth (taken in the main pass just before the water is rendered)
+// The set's depth is an array with a second slice for the reflection, used by the water views pass only
+// The others are only used within a frame, so are transient textures in the render graph, shared by the groups of water
+// (see RenderSceneFromCamera): the depth of the water surface alone, from which the refraction and reflection shaders rebuild
+// the water height to tell above water from underwater, and the reflection pass depth buffer
+ID3D11Texture2D*          gSceneDepthCopy           = nullptr; // Copy of the main depth buffer, read when upsampling
+ID3D11DepthStencilView*   gSceneDepthCopyView       = nullptr; // --"-- (not used, but the copy must match the depth buffer exactly)
+ID3D11ShaderResourceView* gSceneDepthCopySRV        = nullptr; // --"--
+ID3D11Texture2D*          gSceneColourCopy          = nullptr; // Copy of the HDR scene before the water is rendered, traced through
+ID3D11RenderTargetView*   gSceneColourCopyTarget    = nullptr; // by screen-space reflections (render target not used)
+ID3D11ShaderResourceView* gSceneColourCopySRV       = nullptr; // --"--
 
 
 //--------------------------------------------------------------------------------------
-// Initialise scene geometry, constant buffers and states
+// Split screen
 //--------------------------------------------------------------------------------------
 
-// Prepare the geometry required for the scene
-// Returns true on success
-bool InitGeometry()
+// The window can be split between two views side by side, the main camera (the pilot) on the left and an observer camera
+// watching from a fixed point on the right. The work that doesn't depend on the camera is done once for both: the waves,
+// ripples, caustics and particles, the skinning, the light grid, the shadow maps and environment map (fitted to the main
+// camera), the per-frame constants, and the choices UpdateScene makes around the main camera (the water clipmap, terrain
+// tiles and streamed chunks). Each view then renders its own water height, refraction, reflection and main passes, at half
+// the width into the corner of the same textures, as dynamic resolution renders into part of them, and is post-processed
+// into its half of the back buffer. The results carried from one frame to the next for a single camera - the temporal water
+// textures, the occlusion culling depth and the water occlusion queries - are off while the window is split, the views would
+// overwrite each other's. Press Numpad 1 to switch
+bool    gSplitScreen = false;
+Camera* gObserverCamera;
+
+const float CameraFOV = PI / 3; // Horizontal field of view of a view filling the window
+
+// Width in pixels of each view, the whole viewport when the window isn't split
+int ViewWidth()  { return gSplitScreen ? (std::max)(gViewportWidth / 2, 1) : gViewportWidth; }
+
+// Whether occlusion culling, temporal water textures and water occlusion queries are used this frame (see above)
+bool OcclusionCullingActive()       { return gOcclusionCulling      && !gSplitScreen; }
+bool TemporalWaterTexturesActive()  { return gTemporalWaterTextures && !gSplitScreen; }
+bool WaterOcclusionQueriesActive()  { return gWaterOcclusionQueries && !gSplitScreen; }
+
+// Fit the cameras to the shape of the views, when the window is resized or split. A split view is half as wide, so its
+// horizontal field of view is narrowed to keep the vertical one
+void FitCamerasToViews()
 {
-	////--------------- Load meshes ---------------////
+	float fov = 2 * std::atan(std::tan(CameraFOV * 0.5f) * ViewWidth() / gViewportWidth);
+	for (Camera* camera : { gCamera, gObserverCamera })
+	{
+		camera->SetAspectRatio(static_cast<float>(ViewWidth()) / gViewportHeight);
+		camera->SetFOV(fov);
+	}
+}
 
-	// Load mesh geometry data, just like TL-Engine this doesn't create anything in the scene. Create a Model for that.
-	try
+
+//--------------------------------------------------------------------------------------
+// Water textures
+//--------------------------------------------------------------------------------------
+
+// Size of the water textures in pixels. Brackets around std::max stop the Windows max macro interfering
+int WaterTextureWidth()   { return (std::max)(static_cast<int>(gViewportWidth  * gWaterTextureScale), 1); }
+int WaterTextureHeight()  { return (std::max)(static_cast<int>(gViewportHeight * gWaterTextureScale), 1); }
+
+// Size of the part of the water textures and of the main scene render target rendered to this frame (see gFrameTimeTarget),
+// by each view of a split screen
+int WaterRenderWidth()   { return (std::max)(static_cast<int>(WaterTextureWidth() * gWaterResolution.Scale() * ViewWidth() / gViewportWidth), 1); }
+int WaterRenderHeight()  { return (std::max)(static_cast<int>(WaterTextureHeight() * gWaterResolution.Scale()), 1); }
+int MainRenderWidth()    { return (std::max)(static_cast<int>(ViewWidth()     * gMainResolution.Scale()), 1); }
+int MainRenderHeight()   { return (std::max)(static_cast<int>(gViewportHeight * gMainResolution.Scale()), 1); }
+
+// Fraction of the water textures rendered to this frame, used to find the rendered part in the water surface shader
+CVector2 WaterUVScale()
+{
+	return { static_cast<float>(WaterRenderWidth())  / WaterTextureWidth(),
+	         static_cast<float>(WaterRenderHeight()) / WaterTextureHeight() };
+}
+
+// Whether the water textures are rendered at a lower resolution than the main scene this frame, so the refraction is
+// upsampled using the refraction and scene depths
+bool UpsampleRefraction()  { return WaterRenderWidth() < MainRenderWidth() && !gScreenSpaceRefraction; }
+
+// Whether the far water is shaded in a checkerboard this frame (see WaterCheckerboardDistance). The fill relies on the water
+// depth from the prepass and on one sample per pixel, and the view from under the water is too close to gain much
+bool WaterCheckerboardActive()  { return gWaterCheckerboard && gDepthPrepass && gMSAASamples == 1 && !gCameraUnderwater; }
+
+
+// Create the reflection and refraction textures of a water texture set at the size given by gWaterTextureScale
+// Returns false on failure
+bool CreateWaterTextureSet(WaterTextureSet& set)
+{
+	int width  = WaterTextureWidth();
+	int height = WaterTextureHeight();
+
+	// Reflection and refraction are HDR like the scene. The HDR format has no alpha, so the height / depth used for the distortion
+	// is rendered into a single 8-bit channel texture alongside each of them. Slice 0 of each array is the refraction, 1 the
+	// reflection. The views are filled in even on failure, so they are released
+	ID3D11RenderTargetView*   sliceTargets[2] = {};
+	ID3D11ShaderResourceView* sliceSRVs[2]    = {};
+	bool created = CreateRenderTargetArray(width, height, PostProcess::HDRFormat, 2, &set.views, &set.viewsRenderTarget, sliceTargets, sliceSRVs,
+	                                       WaterTextureMipLevels);
+	set.refractionRenderTarget = sliceTargets[0];  set.refractionSRV = sliceSRVs[0];
+	set.reflectionRenderTarget = sliceTargets[1];  set.reflectionSRV = sliceSRVs[1];
+	if (!created)
 	{
-		gSkyMesh    = new Mesh("Skybox.x");
-		gGroundMesh = new Mesh("Hills.x");
-		gTrollMesh  = new Mesh("Troll.x");
-		gCrateMesh  = new Mesh("CargoContainer.x");
-		gLightMesh  = new Mesh("Light.x");
-		gWaterMesh  = new Mesh(CVector3(-200,0,-200), CVector3(200,0,200), 400, 400, true); // Using special constructor that creates a grid - see Mesh.cpp
+		gLastError = "Error creating refraction / reflection texture";
+		return false;
 	}
-	catch (std::runtime_error e)  // Constructors cannot return error messages so use exceptions to catch mesh errors (fairly standard approach this)
+	ID3D11RenderTargetView*   distortionTargets[2] = {};
+	ID3D11ShaderResourceView* distortionSRVs[2]    = {};
+	created = CreateRenderTargetArray(width, height, DXGI_FORMAT_R8_UNORM, 2, &set.viewsDistortion, &set.viewsDistortionRenderTarget,
+	                                  distortionTargets, distortionSRVs);
+	set.refractionDistortionRenderTarget = distortionTargets[0];  set.refractionDistortionSRV = distortionSRVs[0];
+	set.reflectionDistortionRenderTarget = distortionTargets[1];  set.reflectionDistortionSRV = distortionSRVs[1];
+	if (!created)
+	{
+		gLastError = "Error creating refraction / reflection distortion texture";
+		return false;
+	}
+	ID3D11DepthStencilView*   depthStencils[2] = {};
+	ID3D11ShaderResourceView* depthSRVs[2]     = {};
+	created = CreateDepthBufferArray(width, height, 2, &set.viewsDepthTexture, &set.viewsDepthStencil, depthStencils, depthSRVs);
+	set.refractionDepthStencil = depthStencils[0];  set.refractionDepthSRV = depthSRVs[0];
+	set.reflectionDepthStencil = depthStencils[1];  set.reflectionDepthSRV = depthSRVs[1];
+	if (!created)
 	{
-		gLastError = e.what(); // This picks up the error message put in the exception (see Mesh.cpp)
+		gLastError = "Error creating refraction depth buffer";
 		return false;
 	}
 
+	// Named with the set's index for graphics debuggers, which matches the index shown on its passes (see RenderGraph::RecordPass)
+	std::string index = " " + std::to_string(&set - gWaterTextureSets);
+	SetDebugNames("Water Views" + index, set.views, nullptr, set.viewsRenderTarget);
+	SetDebugNames("Refraction" + index, nullptr, set.refractionSRV, set.refractionRenderTarget);
+	SetDebugNames("Reflection" + index, nullptr, set.reflectionSRV, set.reflectionRenderTarget);
+	SetDebugNames("Water Views Distortion" + index, set.viewsDistortion, nullptr, set.viewsDistortionRenderTarget);
+	SetDebugNames("Refraction Distortion" + index, nullptr, set.refractionDistortionSRV, set.refractionDistortionRenderTarget);
+	SetDebugNames("Reflection Distortion" + index, nullptr, set.reflectionDistortionSRV, set.reflectionDistortionRenderTarget);
+	SetDebugNames("Water Views Depth" + index, set.viewsDepthTexture, nullptr, nullptr, set.viewsDepthStencil);
+	SetDebugNames("Refraction Depth" + index, nullptr, set.refractionDepthSRV, nullptr, set.refractionDepthStencil);
+	SetDebugNames("Reflection Depth" + index, nullptr, set.reflectionDepthSRV, nullptr, set.reflectionDepthStencil);
+	RegisterGpuResource(set.views, "Water Textures");
+	RegisterGpuResource(set.viewsDistortion, "Water Textures");
+	RegisterGpuResource(set.viewsDepthTexture, "Water Textures");
+
+	D3D11_QUERY_DESC queryDesc = {};
+	queryDesc.Query = D3D11_QUERY_OCCLUSION;
+	for (int i = 0; i < WaterQueryLatency; ++i)
+	{
+		if (FAILED(gD3DDevice->CreateQuery(&queryDesc, &set.occlusionQueries[i])))
+		{
+			gLastError = "Error creating water occlusion query";
+			return false;
+		}
+		set.queryIssued[i] = false;
+	}
+	set.hidden = false;
 
-	////--------------- Load / prepare textures & GPU states ---------------////
+	// Nothing has been rendered into the new textures yet
+	set.refractionHistory.valid = false;
+	set.reflectionHistory.valid = false;
+	return true;
+}
 
-	// Load textures and create DirectX objects for them
-	// The LoadTexture function requires you to pass a ID3D11Resource* (e.g. &gTrollDiffuseMap), which manages the GPU memory for the
-	// texture and also a ID3D11ShaderResourceView* (e.g. &gTrollDiffuseMapSRV), which allows us to use the texture in shaders
-	// The function will fill in these pointers with usable data. The variables used here are globals found near the top of the file.
-	if (!LoadTexture("CubeMapB.jpg",             &gSkyDiffuseSpecularMap,    &gSkyDiffuseSpecularMapSRV) ||
-		!LoadTexture("GrassDiffuseSpecular.dds", &gGroundDiffuseSpecularMap, &gGroundDiffuseSpecularMapSRV) ||
-		!LoadTexture("TrollDiffuseSpecular.dds", &gTrollDiffuseSpecularMap,  &gTrollDiffuseSpecularMapSRV) ||
-		!LoadTexture("CargoA.dds",               &gCrateDiffuseSpecularMap,  &gCrateDiffuseSpecularMapSRV) ||
-		!LoadTexture("Flare.jpg",                &gLightDiffuseMap,          &gLightDiffuseMapSRV) ||
-		!LoadTexture("WaterNormalHeight.png",    &gWaterNormalMap,           &gWaterNormalMapSRV))
+
+// Release the textures of a water texture set - safe to call when they haven't been created
+void ReleaseWaterTextureSet(WaterTextureSet& set)
+{
+	set.refractionHiZ.Release();
+	set.reflectionHiZ.Release();
+	for (auto& query : set.occlusionQueries)
 	{
-		gLastError = "Error loading textures";
-		return false;
+		if (query)  { query->Release();  query = nullptr; }
 	}
+	if (set.refractionDistortionRenderTarget) { set.refractionDistortionRenderTarget->Release(); set.refractionDistortionRenderTarget = nullptr; }
+	if (set.refractionDistortionSRV)          { set.refractionDistortionSRV->Release();          set.refractionDistortionSRV          = nullptr; }
+	if (set.reflectionDistortionRenderTarget) { set.reflectionDistortionRenderTarget->Release(); set.reflectionDistortionRenderTarget = nullptr; }
+	if (set.reflectionDistortionSRV)          { set.reflectionDistortionSRV->Release();          set.reflectionDistortionSRV          = nullptr; }
+	if (set.viewsDistortionRenderTarget)      { set.viewsDistortionRenderTarget->Release();      set.viewsDistortionRenderTarget      = nullptr; }
+	if (set.viewsDistortion)                  { set.viewsDistortion->Release();                  set.viewsDistortion                  = nullptr; }
+	if (set.reflectionDepthSRV)     { set.reflectionDepthSRV->Release();     set.reflectionDepthSRV     = nullptr; }
+	if (set.reflectionDepthStencil) { set.reflectionDepthStencil->Release(); set.reflectionDepthStencil = nullptr; }
+	if (set.refractionDepthSRV)     { set.refractionDepthSRV->Release();     set.refractionDepthSRV     = nullptr; }
+	if (set.refractionDepthStencil) { set.refractionDepthStencil->Release(); set.refractionDepthStencil = nullptr; }
+	if (set.viewsDepthStencil)      { set.viewsDepthStencil->Release();      set.viewsDepthStencil      = nullptr; }
+	if (set.viewsDepthTexture)      { set.viewsDepthTexture->Release();      set.viewsDepthTexture      = nullptr; }
+	if (set.refractionRenderTarget) { set.refractionRenderTarget->Release(); set.refractionRenderTarget = nullptr; }
+	if (set.refractionSRV)          { set.refractionSRV->Release();          set.refractionSRV          = nullptr; }
+	if (set.reflectionRenderTarget) { set.reflectionRenderTarget->Release(); set.reflectionRenderTarget = nullptr; }
+	if (set.reflectionSRV)          { set.reflectionSRV->Release();          set.reflectionSRV          = nullptr; }
+	if (set.viewsRenderTarget)      { set.viewsRenderTarget->Release();      set.viewsRenderTarget      = nullptr; }
+	if (set.views)                  { set.views->Release();                  set.views                  = nullptr; }
+}
 
 
-	// Create all filtering modes, blending modes etc. used by the app (see State.cpp/.h)
-	if (!CreateStates())
+// Create the copies of the scene used by the water. The water texture sets are created when they are first needed (see
+// GroupWaterBodies) and the depth buffers they share by the render graph. Returns false on failure
+bool CreateWaterTextures()
+{
+	if (!CreateDepthBuffer(gViewportWidth, gViewportHeight, &gSceneDepthCopy, &gSceneDepthCopyView, &gSceneDepthCopySRV))
 	{
-		gLastError = "Error creating states";
+		gLastError = "Error creating scene depth copy";
 		return false;
 	}
 
-
-
-	////--------------- Create textures needed for water rendering ---------------////
-	
-	// Using a helper function to load textures from files above. Here we create the scene texture manually
-	// as we are creating a special kind of texture (one that we can render to). Many settings to prepare:
-	D3D11_TEXTURE2D_DESC textureDesc = {};
-	textureDesc.Width  = gViewportWidth;  // Reflection / refraction / water surface textures are full screen size - could experiment with making them smaller
-	textureDesc.Height = gViewportHeight;
-	textureDesc.MipLevels = 1; // No mip-maps when rendering to textures (or we would have to render every level)
-	textureDesc.ArraySize = 1;
-	textureDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM; // RGBA texture (8-bits each)
-	textureDesc.SampleDesc.Count = 1;
-	textureDesc.SampleDesc.Quality = 0;
-	textureDesc.Usage = D3D11_USAGE_DEFAULT;
-	textureDesc.BindFlags = D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE; // IMPORTANT: Indicate we will use texture as render target, and pass it to shaders
-	textureDesc.CPUAccessFlags = 0;
-	textureDesc.MiscFlags = 0;
-	if (FAILED(gD3DDevice->CreateTexture2D(&textureDesc, NULL, &gReflection)))
-	{
-		gLastError = "Error creating reflection texture";
+	// Same format as the HDR scene (see PostProcess.h), which it is copied from
+	if (!CreateRenderTarget(gViewportWidth, gViewportHeight, PostProcess::HDRFormat, &gSceneColourCopy, &gSceneColourCopyTarget, &gSceneColourCopySRV))
+	{
+		gLastError = "Error creating scene colour copy";
 		return false;
 	}
 
-	// We created the relection texture above, now we get a "view" of it as a render target, i.e. get a special pointer to the texture that we use when rendering to it
-	if (FAILED(gD3DDevice->CreateRenderTargetView(gReflection, NULL, &gReflectionRenderTarget)))
+	SetDebugNames("Scene Depth Copy", gSceneDepthCopy, gSceneDepthCopySRV, nullptr, gSceneDepthCopyView);
+	SetDebugNames("Scene Colour Copy", gSceneColourCopy, gSceneColourCopySRV, gSceneColourCopyTarget);
+	RegisterGpuResource(gSceneDepthCopy, "Water Textures");
+	RegisterGpuResource(gSceneColourCopy, "Water Textures");
+	return true;
+}
+
+
+// Release the textures created above and the water texture sets - safe to call when they haven't been created
+void ReleaseWaterTextures()
+{
+	for (auto& set : gWaterTextureSets)  ReleaseWaterTextureSet(set);
+
+	if (gSceneColourCopySRV)       { gSceneColourCopySRV->Release();       gSceneColourCopySRV       = nullptr; }
+	if (gSceneColourCopyTarget)    { gSceneColourCopyTarget->Release();    gSceneColourCopyTarget    = nullptr; }
+	if (gSceneColourCopy)          { gSceneColourCopy->Release();          gSceneColourCopy          = nullptr; }
+	if (gSceneDepthCopySRV)        { gSceneDepthCopySRV->Release();        gSceneDepthCopySRV        = nullptr; }
+	if (gSceneDepthCopyView)       { gSceneDepthCopyView->Release();       gSceneDepthCopyView       = nullptr; }
+	if (gSceneDepthCopy)           { gSceneDepthCopy->Release();           gSceneDepthCopy           = nullptr; }
+
+	// The pooled textures include the water depth buffers, which match the water texture size, and the bloom of the viewport
+	if (gRenderTargetPool)  gRenderTargetPool->ReleaseFreeTargets();
+}
+
+
+//--------------------------------------------------------------------------------------
+// Initialise scene geometry, constant buffers and states
+//--------------------------------------------------------------------------------------
+
+// A load run as a job on the thread pool during InitGeometry. It keeps the result, or the message of the exception that
+// stopped it - jobs mustn't throw (see JobSystem.h)
+template <class Result>
+struct LoadJob
+{
+	std::function<Result()> load;
+	Result                  result = Result();
+	std::string             error;
+
+	void operator()()
 	{
-		gLastError = "Error creating reflection render target view";
-		return false;
+		try
+		{
+			result = load();
+		}
+		catch (std::runtime_error e)
+		{
+			error = e.what();
+		}
 	}
+};
+
+
+// A mesh loaded in the background after the first frame, so it doesn't hold up the start of the app. Until it has loaded the
+// scene's mesh is a box of about its size, and its models draw that, then SwapStreamedMeshes puts the mesh in place
+struct StreamedMesh
+{
+	Mesh**         mesh;       // The scene's mesh, the box until the load has finished
+	Model**        model;      // The scene's model of the mesh, replaced by a model of the loaded mesh
+	AnimationSet** animations; // Also read the animations in the file into this, or nullptr
+	LoadJob<std::unique_ptr<Mesh>> load;
+	std::unique_ptr<AnimationSet>  animationSet;
+	JobCounter                     counter;
+	bool                           swapped = false;
+};
+std::vector<std::unique_ptr<StreamedMesh>> gStreamedMeshes;
+
 
-	// We also need to send this texture (resource) to the shaders. To do that we must create a shader-resource "view"
-	D3D11_SHADER_RESOURCE_VIEW_DESC srDesc = {};
-	srDesc.Format = textureDesc.Format;
-	srDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
-	srDesc.Texture2D.MostDetailedMip = 0;
-	srDesc.Texture2D.MipLevels = 1;
-	if (FAILED(gD3DDevice->CreateShaderResourceView(gReflection, &srDesc, &gReflectionSRV)))
+// Make the pipeline states above, once the shaders and states they use have been created
+void CreateScenePipelines()
+{
+	for (int scissor = 0; scissor < 2; ++scissor)
 	{
-		gLastError = "Error creating reflection shader resource view";
-		return false;
+		ID3D11RasterizerState* cullNone = scissor ? gCullNoneScissorState : gCullNoneState;
+
+		// The sky is a single triangle on the far plane, the depth test only lets through pixels nothing has been drawn to (see
+		// RenderSky). The reflection pass culls front faces, the triangle must be drawn either way
+		PipelineState& sky = gScenePipelines[SkyPipeline][scissor];
+		sky.vertexShader      = &gSkyVertexShader;
+		sky.pixelShader       = &gSkyPixelShader;
+		sky.blendState        = gNoBlendingState;
+		sky.depthStencilState = gDepthFarPlaneState;
+		sky.rasterizerState   = cullNone;
+
+		// The instanced vertex shader places and tints each light, with a pixel shader for each kind of pass. Additive blending,
+		// read-only depth buffer and no culling (standard set-up for blending)
+		PipelineState lights;
+		lights.vertexShader      = &gInstancedTransformVertexShader;
+		lights.blendState        = gAdditiveBlendingState;
+		lights.depthStencilState = gDepthReadOnlyState;
+		lights.rasterizerState   = cullNone;
+		lights.pixelShader = &gTintedTexturePixelShader;           gScenePipelines[LightsPipeline][scissor]          = lights;
+		lights.pixelShader = &gRefractedTintedTexturePixelShader;  gScenePipelines[RefractedLightsPipeline][scissor] = lights;
+		lights.pixelShader = &gReflectedTintedTexturePixelShader;  gScenePipelines[ReflectedLightsPipeline][scissor] = lights;
+
+		// Particles are billboards made in the vertex shader from the particle buffer, with premultiplied alpha so blended and
+		// additive particles can be drawn in the one draw (see ParticleSystem.h)
+		PipelineState& particles = gScenePipelines[ParticlesPipeline][scissor];
+		particles.vertexShader      = &gParticleVertexShader;
+		particles.pixelShader       = &gParticlePixelShader;
+		particles.blendState        = gPremultipliedAlphaBlendingState;
+		particles.depthStencilState = gDepthReadOnlyState;
+		particles.rasterizerState   = cullNone;
+		particles.topology          = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP;
 	}
+}
+
+
+// Prepare the geometry required for the scene
+// Returns true on success
+bool InitGeometry()
+{
+	////--------------- Load meshes and textures ---------------////
+
+	// Mesh files and textures are loaded in parallel as jobs on the thread pool (see JobSystem.h), which is possible because
+	// DirectX devices are free-threaded - resources can be created from any thread (the context is not, see LoadTexture).
+	// Each load keeps its result in a LoadJob, along with the message of any exception, and they are all waited for below.
+	// Meshes are held in unique_ptrs until every load has finished so they are released if any load fails
+	// The mesh and texture files are read from the asset archive, which is written again when the app closes if any of them
+	// were loose files (see AssetArchive.h)
+	OpenAssetArchive("Assets.pak");
+	gJobSystem = new JobSystem(); // Also used by the shader loading, pass recording and scene update
+	gMeshLoaderSettings.quantiseVertices = true; // Compact vertices for the loaded meshes, all the scene shaders support them
+	InitMeshLoader(); // Assimp logging for all the mesh loads, see MeshLoaderSettings in Mesh.h
+	auto loadMesh = [](const char* fileName) -> LoadJob<std::unique_ptr<Mesh>>
+	{
+		return { [fileName]() { return std::unique_ptr<Mesh>(new Mesh(fileName)); } };
+	};
+	LoadJob<std::unique_ptr<Mesh>> meshes[] =
+	{
+		loadMesh("Hills.x"),
+		loadMesh("Light.x"),
+	};
+	LoadJob<std::unique_ptr<Terrain>> terrain = { []() { return std::unique_ptr<Terrain>(new Terrain("Hills.x")); } };
 
+	// The stress scene's meshes, only loaded when there is one (see StressScene.h)
+	LoadJob<std::unique_ptr<Mesh>> stressMeshes[NumStressMeshes];
+	for (int i = 0; i < NumStressMeshes; ++i)  stressMeshes[i] = loadMesh(StressMeshFiles[i]);
+	bool stressScene = gStressScene.numObjects > 0;
 
+	// Load textures and create DirectX objects for them
+	// The LoadTexture function requires you to pass a ID3D11Resource* (e.g. &gTrollDiffuseMap), which manages the GPU memory for the
+	// texture and also a ID3D11ShaderResourceView* (e.g. &gTrollDiffuseMapSRV), which allows us to use the texture in shaders
+	// The function will fill in these pointers with usable data. The variables used here are globals found near the top of the file.
+	auto loadTexture = [](const char* fileName, ID3D11Resource** texture, ID3D11ShaderResourceView** textureSRV) -> LoadJob<bool>
+	{
+		return { [=]()
+		{
+			// Image files other than DDS are decoded with WIC, which uses COM. Worker threads need their own COM initialisation
+			HRESULT comResult = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+			bool loaded = LoadTexture(fileName, texture, textureSRV);
+			if (SUCCEEDED(comResult))  CoUninitialize();
+			return loaded;
+		} };
+	};
+
+	// The water normal / height map is split into separately compressed normals and heights (see LoadNormalHeightMap)
+	auto loadWaterMaps = [](const char* fileName) -> LoadJob<bool>
+	{
+		return { [=]()
+		{
+			HRESULT comResult = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+			bool loaded = LoadNormalHeightMap(fileName, &gWaterNormalMap, &gWaterNormalMapSRV, &gWaterWaveHeightMap, &gWaterWaveHeightMapSRV);
+			if (SUCCEEDED(comResult))  CoUninitialize();
+			return loaded;
+		} };
+	};
+
+	// Streamed textures only load their small mip-maps here, the rest is loaded when it is needed (see TextureStreamer.h)
+	gTextureStreamer = new TextureStreamer();
+	auto streamTexture = [](const char* fileName, StreamedTexture** texture, float repeats = 1) -> LoadJob<bool>
+	{
+		return { [=]()
+		{
+			*texture = gTextureStreamer->AddTexture(fileName, repeats);
+			return *texture != nullptr;
+		} };
+	};
+
+	// Texture arrays are packed from their files the first time, then streamed like the other textures. The models using
+	// them say how often their layer repeats when they are drawn (see Material.h)
+	auto streamTextureArray = [](const char* arrayFileName, const char* const* fileNames, int numFiles, StreamedTexture** texture) -> LoadJob<bool>
+	{
+		return { [=]()
+		{
+			std::vector<std::string> sources(fileNames, fileNames + numFiles);
+			if (!CookTextureArray(arrayFileName, sources.data(), numFiles))  return false;
+			*texture = gTextureStreamer->AddTexture(arrayFileName);
+			return *texture != nullptr;
+		} };
+	};
+	LoadJob<bool> textures[] =
+	{
+		loadTexture("CubeMapB.jpg",             &gSkyDiffuseSpecularMap,    &gSkyDiffuseSpecularMapSRV),
+		streamTextureArray("LitModels.array.dds", LitModelTextureFiles, NumLitModelTextures, &gLitModelDiffuseSpecularMaps),
+		loadTexture("Flare.jpg",                &gLightDiffuseMap,          &gLightDiffuseMapSRV),
+		loadWaterMaps("WaterNormalHeight.png"),
+	};
+
+	JobCounter loads;
+	for (auto& mesh : meshes)  gJobSystem->Run(mesh, loads);
+	gJobSystem->Run(terrain, loads);
+	if (stressScene)  for (auto& mesh : stressMeshes)  gJobSystem->Run(mesh, loads);
+	for (auto& texture : textures)  gJobSystem->Run(texture, loads);
 
-	// Same again for refraction texture. Structures already set up so can save a few lines
-	if (FAILED(gD3DDevice->CreateTexture2D(&textureDesc, NULL, &gRefraction)))
+	// Load mesh geometry data, just like TL-Engine this doesn't create anything in the scene. Create a Model for that.
+	// The generated water meshes are made here while the files load, then this thread helps with the loads still waiting
+	std::string error;
+	try
 	{
-		gLastError = "Error creating refraction texture";
-		return false;
+		gWaterMesh  = new Mesh(CVector3(-200,0,-200), CVector3(200,0,200), gRenderSettings.waterGrid, gRenderSettings.waterGrid, true, true, true); // Using special constructor that creates a (bufferless) grid - see Mesh.cpp
+		gWaterClipmap = new WaterClipmap(); // Alternative water surface made of grid tiles around the camera - see WaterClipmap.cpp
+		gWaterCoarseMesh = new Mesh(CVector3(-200,0,-200), CVector3(200,0,200), 40, 40, true); // Coarse grid for tessellated water, 100 times fewer vertices
+	}
+	catch (std::runtime_error e)  // Constructors cannot return error messages so use exceptions to catch mesh errors (fairly standard approach this)
+	{
+		error = e.what(); // This picks up the error message put in the exception (see Mesh.cpp)
 	}
-	if (FAILED(gD3DDevice->CreateRenderTargetView(gRefraction, NULL, &gRefractionRenderTarget)))
+	gJobSystem->Wait(loads); // Even after a failure, the loads write to the variables above
+
+	for (auto& mesh : meshes)  if (error.empty())  error = mesh.error;
+	for (auto& mesh : stressMeshes)  if (error.empty())  error = mesh.error;
+	if (error.empty())  error = terrain.error;
+	if (!error.empty())
 	{
-		gLastError = "Error creating refraction render target view";
+		gLastError = error;
 		return false;
 	}
-	if (FAILED(gD3DDevice->CreateShaderResourceView(gRefraction, &srDesc, &gRefractionSRV)))
+	gGroundMesh = meshes[0].result.release();
+	gLightMesh  = meshes[1].result.release();
+	gTerrain    = terrain.result.release();
+	if (stressScene)  for (auto& mesh : stressMeshes)  gStressMeshes.push_back(mesh.result.release());
+
+	// The troll and the crate are only scenery, the scene is laid out on the hills. So they are loaded in the background
+	// while the first frames are drawn, as boxes (in model space) around where each mesh will be until then. The troll's
+	// animations are read in the same job as its mesh, as they are matched to the mesh's nodes. The benchmark waits for them,
+	// so every run measures the whole scene
+	auto streamMesh = [](const char* fileName, const BoundingBox& box, Mesh** mesh, Model** model, AnimationSet** animations)
+	{
+		*mesh = new Mesh(box);
+		StreamedMesh* streamed = new StreamedMesh{ mesh, model, animations };
+		gStreamedMeshes.emplace_back(streamed);
+		streamed->load.load = [streamed, fileName]()
+		{
+			std::unique_ptr<Mesh> loaded(new Mesh(fileName));
+			if (streamed->animations != nullptr)  streamed->animationSet.reset(new AnimationSet(fileName, loaded.get()));
+			return loaded;
+		};
+		gJobSystem->Run(streamed->load, streamed->counter);
+	};
+	try
+	{
+		streamMesh("Troll.x",          { { -1.4f, 0, -1.3f  }, { 1.4f,  2.5f,  1.3f } }, &gTrollMesh, &gTroll, &gTrollAnimations);
+		streamMesh("CargoContainer.x", { { -1.15f, 0, -3.0f }, { 1.15f, 2.65f, 3.0f } }, &gCrateMesh, &gCrate, nullptr);
+	}
+	catch (std::runtime_error e)
 	{
-		gLastError = "Error creating refraction shader resource view";
+		gLastError = e.what();
 		return false;
 	}
+	if (gBenchmark.enabled)
+	{
+		for (auto& streamed : gStreamedMeshes)  gJobSystem->Wait(streamed->counter);
+	}
 
-
-	// Same again for the water height texture.
-	textureDesc.Format = srDesc.Format = DXGI_FORMAT_R32_FLOAT; // Water surface height is just one value per pixel - so texture only needs red channel using a 32-bit float
-	if (FAILED(gD3DDevice->CreateTexture2D(&textureDesc, NULL, &gWaterHeight)))
+	bool texturesLoaded = true;
+	for (auto& texture : textures)  texturesLoaded = texture.result && texture.error.empty() && texturesLoaded;
+	if (!texturesLoaded)
 	{
-		gLastError = "Error creating water height texture";
+		gLastError = "Error loading textures";
 		return false;
 	}
-	if (FAILED(gD3DDevice->CreateRenderTargetView(gWaterHeight, NULL, &gWaterHeightRenderTarget)))
+
+	try
+	{
+		gLightInstances = new InstancedModel(gLightMesh, NUM_LIGHTS + gStressScene.numLights); // See InstancedModel.cpp
+	}
+	catch (std::runtime_error e)
 	{
-		gLastError = "Error creating water height render target view";
+		gLastError = e.what();
 		return false;
 	}
-	if (FAILED(gD3DDevice->CreateShaderResourceView(gWaterHeight, &srDesc, &gWaterHeightSRV)))
+
+
+	// Create all filtering modes, blending modes etc. used by the app (see State.cpp/.h)
+	if (!CreateStates())
 	{
-		gLastError = "Error creating water height shader resource view";
+		gLastError = "Error creating states";
 		return false;
 	}
 
 
+
+	////--------------- Create textures needed for water rendering ---------------////
+	
+	if (!CreateWaterTextures())  return false; // Sets gLastError on failure
+
+
 	////--------------- Prepare shaders and constant buffers to communicate with them ---------------////
 
 	// Load the shaders required for the geometry we will use (see Shader.cpp / .h)
@@ -266,18 +1044,62 @@ bool InitGeometry()
 		gLastError = "Error loading shaders";
 		return false;
 	}
+	CreateScenePipelines();
 
 	// Create GPU-side constant buffers to receive the gPerFrameConstants and gPerModelConstants structures above
 	// These allow us to pass data from CPU to shaders such as lighting information or matrices
 	// See the comments above where these variable are declared and also the UpdateScene function
 	gPerFrameConstantBuffer       = CreateConstantBuffer(sizeof(gPerFrameConstants));
+	gPerViewConstantBuffer        = CreateConstantBuffer(sizeof(gPerViewConstants));
 	gPerModelConstantBuffer       = CreateConstantBuffer(sizeof(gPerModelConstants));
-	if (gPerFrameConstantBuffer == nullptr || gPerModelConstantBuffer == nullptr)
+	gWaterConstantBuffer          = CreateConstantBuffer(sizeof(gWaterConstants));
+	gWaterViewConstantBuffer      = CreateConstantBuffer(sizeof(WaterViewConstants));
+	if (gPerFrameConstantBuffer == nullptr || gPerViewConstantBuffer == nullptr || gPerModelConstantBuffer == nullptr ||
+	    gWaterConstantBuffer == nullptr || gWaterViewConstantBuffer == nullptr)
 	{
 		gLastError = "Error creating constant buffers";
 		return false;
 	}
 
+
+	////--------------- Prepare the FFT ocean simulation ---------------////
+
+	try
+	{
+		gGpuReadback = new GpuReadback(); // See GpuReadback.cpp
+		gGpuUploader = new GpuUploader(); // See GpuUploader.cpp
+		if (gBenchmark.enabled && gBenchmark.frameCaptureInterval > 0)
+		{
+			gFrameCapture = new FrameCapture(gBenchmark.frameCaptureFolder, gBenchmark.frameCaptureInterval); // See FrameCapture.cpp
+		}
+		gOcean = new OceanFFT(); // See OceanFFT.cpp
+		gEnvironmentMap = new EnvironmentMap(); // See EnvironmentMap.cpp
+		gShadowMap = new ShadowMap(); // See ShadowMap.cpp
+		gCaustics = new Caustics(); // See Caustics.cpp
+		gWaterVertexCache = new WaterVertexCache(); // See WaterVertexCache.cpp
+		gWaveComposite = new WaveComposite(); // See WaveComposite.cpp
+		gMainHiZ = new HiZBuffer(); // See HiZBuffer.cpp
+		gRipples = new Ripples(); // See Ripples.cpp
+		gParticles = new ParticleSystem(); // See ParticleSystem.cpp
+		gWaterHeights = new WaterHeights(gWaterWaveHeightMap); // See WaterHeights.cpp
+		gRenderTargetPool = new RenderTargetPool(); // See RenderTargetPool.cpp
+		gPostProcess = new PostProcess(gViewportWidth, gViewportHeight, gMSAASamples); // See PostProcess.cpp
+		gGpuProfiler = new GpuProfiler(); // See GpuProfiler.cpp
+		gSpikeDetector = new SpikeDetector(); // See SpikeDetector.cpp
+		gCommandRecorder = new CommandRecorder(NumScenePasses); // See CommandRecorder.cpp
+		gRenderGraph = new RenderGraph(); // See RenderGraph.cpp
+		gStatsOverlay = new StatsOverlay(); // See StatsOverlay.cpp
+		gOverdrawView = new OverdrawView(); // See OverdrawView.cpp
+	}
+	catch (std::runtime_error e)
+	{
+		gLastError = e.what();
+		return false;
+	}
+
+	// Per-frame and per-model constants go in one large buffer when the GPU supports it, otherwise in the buffers above
+	InitConstantRing(); // See StateCache.cpp
+
 	return true;
 }
 
@@ -288,11 +1110,72 @@ bool InitScene()
 {
 	////--------------- Set up scene ---------------////
 
-	gSky    = new Model(gSkyMesh);
-	gGround = new Model(gGroundMesh);
-	gTroll  = new Model(gTrollMesh);
-	gCrate  = new Model(gCrateMesh);
-	gWater  = new Model(gWaterMesh);
+	// Models of skinned meshes create GPU buffers for their bones and skinned vertices, which can fail (see Model.h)
+	try
+	{
+		gGround = new Model(gGroundMesh);
+		gTroll  = new Model(gTrollMesh);
+		gCrate  = new Model(gCrateMesh);
+		gWater  = new Model(gWaterMesh);
+		gWaterCoarse = new Model(gWaterCoarseMesh);
+		for (int i = 0; i < NUM_LIGHTS; ++i)
+		{
+			gLights[i].model = new Model(gLightMesh);
+		}
+
+		// The open water is the first body. Lakes and pools are added after it with the area they cover, their height and the
+		// size of their grid, e.g. new WaterBody({ 100, 100 }, { 150, 160 }, 25.0f, 50, 60)
+		gWaterBodies.push_back(new WaterBody(10.0f));
+	}
+	catch (std::runtime_error e)
+	{
+		gLastError = e.what();
+		return false;
+	}
+
+	// The stress scene's objects and lights, laid out around the open water, if there is one (see StressScene.h)
+	std::vector<StressObject> stressObjects;
+	BoundingSphere stressBounds[NumStressMeshes];
+	for (size_t i = 0; i < gStressMeshes.size(); ++i)  stressBounds[i] = gStressMeshes[i]->Bounds();
+	LayoutStressScene(stressBounds, gTerrain, gWaterBodies[0]->Height(), stressObjects, gStressLights);
+
+	// With world streaming the stress objects and the lakes belong to chunks streamed in around the camera, and the streamer
+	// keeps the objects' models. Each chunk loads its own meshes, so the ones loaded for the layout aren't needed (see WorldStreamer.h)
+	if (gWorldStreaming.chunkSize > 0)
+	{
+		gWorldStreamer = new WorldStreamer(gTerrain->Bounds(), StressMeshFiles, stressBounds, NumStressMeshes);
+		for (WaterBody* body : gWaterBodies)  gWorldStreamer->AddWaterBody(body);
+	}
+	std::vector<Model*> stressModels;
+	std::vector<Mesh*>  stressModelMeshes;
+	try
+	{
+		for (auto& object : stressObjects)
+		{
+			Mesh* mesh = gStressMeshes[object.mesh];
+			Model* model = gWorldStreamer != nullptr ? gWorldStreamer->AddObject(object.mesh, object.position, &mesh) :
+			                                           new Model(mesh); // Rigid meshes, which can't fail
+			model->SetPosition(object.position);
+			model->SetRotation({ 0.0f, object.rotation, 0.0f });
+			model->SetScale(object.scale);
+			stressModels.push_back(model);
+			stressModelMeshes.push_back(mesh);
+		}
+	}
+	catch (std::runtime_error e)
+	{
+		gLastError = e.what();
+		return false;
+	}
+	if (gWorldStreamer == nullptr)
+	{
+		gStressModels = stressModels;
+	}
+	else
+	{
+		for (Mesh* mesh : gStressMeshes)  delete mesh;
+		gStressMeshes.clear();
+	}
 
 	// Initial positions
 	gTroll->SetPosition({ 45, 0, 45 });
@@ -300,17 +1183,47 @@ bool InitScene()
 	gCrate->SetPosition({ 65, 0, -170 });
 	gCrate->SetRotation({ 0.0f, ToRadians(40.0f), 0.0f });
 	gCrate->SetScale(12.0f);
-	gSky->SetRotation({0, ToRadians(90.0f), 0});
-	gSky->SetScale(10);
-	gWater->SetPosition({ 0, 10, 0 });
-	
-
-	// Light set-up
-	for (int i = 0; i < NUM_LIGHTS; ++i)
+	gWater->SetPosition({ 0, gWaterBodies[0]->Height(), 0 });
+	gWaterCoarse->SetPosition(gWater->Position());
+
+	// The lit models all use the standard pixel lighting shaders, with their own layers of the texture array
+	Material groundMaterial, trollMaterial, crateMaterial;
+	groundMaterial.diffuseSpecularMap = trollMaterial.diffuseSpecularMap = crateMaterial.diffuseSpecularMap = gLitModelDiffuseSpecularMaps;
+	groundMaterial.textureLayer = GroundTextureLayer;
+	trollMaterial.textureLayer  = TrollTextureLayer;
+	crateMaterial.textureLayer  = CrateTextureLayer;
+	groundMaterial.textureRepeats = 16; // Repeats many times across the hills
+
+	gSceneObjects = new SceneObjects();
+	gSceneObjects->Add(gGround, gGroundMesh, groundMaterial);
+	gSceneObjects->Add(gTroll,  gTrollMesh,  trollMaterial);
+	gSceneObjects->Add(gCrate,  gCrateMesh,  crateMaterial);
+
+	// The stress objects use the textures of the models above in turn, so there are several materials for each mesh
+	for (size_t i = 0; i < stressModels.size(); ++i)
+	{
+		Material material = crateMaterial;
+		material.textureLayer = static_cast<int>(i / NumStressMeshes) % NumLitModelTextures;
+		gSceneObjects->Add(stressModels[i], stressModelMeshes[i], material);
+	}
+	gSceneObjects->Sort();
+	gGroundObject = gSceneObjects->Find(gGround);
+	gSceneObjects->SetAlwaysDrawn(gGroundObject, true); // The hills are seen across the water from anywhere
+	if (gWorldStreamer != nullptr)  gWorldStreamer->Register(gSceneObjects);
+
+	gSceneModels = { gGround, gTroll, gCrate, gWater, gWaterCoarse };
+	for (int i = 0; i < NUM_LIGHTS; ++i)  gSceneModels.push_back(gLights[i].model);
+	gSceneModels.insert(gSceneModels.end(), gStressModels.begin(), gStressModels.end());
+	for (WaterBody* body : gWaterBodies)  if (!body->IsOpenWater())  gSceneModels.push_back(body->Grid());
+
+	// The ground under the water doesn't change, so the shore maps are baked once here
+	for (WaterBody* body : gWaterBodies)
 	{
-		gLights[i].model = new Model(gLightMesh);
+		if (!body->BakeShoreMap(gTerrain))  return false;
 	}
+	
 
+	// Light set-up
 	gLights[0].colour = { 0.8f, 0.8f, 1.0f };
 	gLights[0].strength = 20;
 	gLights[0].model->SetPosition({ 40, 20, -40 });
@@ -321,15 +1234,70 @@ bool InitScene()
 	gLights[1].model->SetPosition({ 25, 800, -950 });
 	gLights[1].model->SetScale(pow(gLights[1].strength, 0.5f));
 
+	// The main lights reach the whole scene, as the lights did before they had a range
+	gLights[0].range = gLights[1].range = 100000;
+
+	// Dock lamps in rows of warm lights on posts, a little above the water or the ground, whichever is higher
+	const int lampsPerRow = 8;
+	for (int i = 0; i < NUM_DOCK_LAMPS; ++i)
+	{
+		Light& lamp = gLights[2 + i];
+		float x = -140 + 40.0f * (i % lampsPerRow);
+		float z = -120 + 80.0f * (i / lampsPerRow);
+		lamp.colour = { 1.0f, 0.7f, 0.4f };
+		lamp.strength = 8;
+		lamp.range = 60;
+		lamp.model->SetPosition({ x, (std::max)(gTerrain->Height(x, z), gWaterBodies[0]->Height()) + 6, z });
+		lamp.model->SetScale(pow(lamp.strength, 0.5f));
+	}
+
+	// The grid covers the ground and the space above it where the lamps and models are. The main lights are outside it
+	try
+	{
+		const BoundingBox& bounds = gTerrain->Bounds();
+		gLightGrid = new LightGrid(bounds.min, { bounds.max.x, (std::max)(bounds.max.y, gWaterBodies[0]->Height()) + 50, bounds.max.z },
+		                           NUM_LIGHTS + gStressScene.numLights);
+	}
+	catch (std::runtime_error e)
+	{
+		gLastError = e.what();
+		return false;
+	}
+
+	// The cells and portals of the level's interiors, if a file of them was given (see PortalMap.h)
+	if (!gPortalSettings.fileName.empty())
+	{
+		try
+		{
+			gPortalMap = new PortalMap(gPortalSettings.fileName);
+		}
+		catch (std::runtime_error e)
+		{
+			gLastError = e.what();
+			return false;
+		}
+	}
+
 
 	////--------------- Set up camera ---------------////
 
 	gCamera = new Camera();
 	gCamera->Position() = { -80, 50, 200 };
 	gCamera->SetRotation({ ToRadians(16.0f), ToRadians(145.0f), 0.0f });
-	gCamera->SetNearClip(5);
+	gCamera->SetNearClip(1); // The reversed depth has the precision for a near clip this close (see Camera::UpdateMatrices)
 	gCamera->SetFarClip(100000);
 
+	// The observer of the split screen looks across the water at the main camera's starting point (see gSplitScreen)
+	gObserverCamera = new Camera();
+	gObserverCamera->Position() = { 180, 90, -180 };
+	gObserverCamera->SetRotation({ ToRadians(20.0f), ToRadians(-45.0f), 0.0f });
+	gObserverCamera->SetNearClip(1);
+	gObserverCamera->SetFarClip(100000);
+	FitCamerasToViews();
+
+	if (!ApplyRenderSettings())  return false;
+
+	InitSceneUpdates();
 	return true;
 }
 
@@ -337,33 +1305,57 @@ bool InitScene()
 // Release the geometry and scene resources created above
 void ReleaseResources()
 {
+	// The present thread uses the swap chain and the immediate context
+	SetPresentThread(false);
+
+	// Meshes still loading in the background use the device and the mesh loader, so must finish first
+	for (auto& streamed : gStreamedMeshes)  gJobSystem->Wait(streamed->counter);
+	gStreamedMeshes.clear(); // The meshes that loaded but were never swapped in
+	delete gWorldStreamer;  gWorldStreamer = nullptr; // Also waits for its loads
+
+	ReleaseConstantRing();
+	delete gOverdrawView;  gOverdrawView = nullptr;
+	delete gStatsOverlay;  gStatsOverlay = nullptr;
+	delete gRenderGraph;  gRenderGraph = nullptr;
+	delete gCommandRecorder;  gCommandRecorder = nullptr;
+	delete gSpikeDetector;  gSpikeDetector = nullptr;
+	delete gGpuProfiler;  gGpuProfiler = nullptr;
+	delete gOcean;  gOcean = nullptr;
+	delete gWaterHeights;  gWaterHeights = nullptr;
+	delete gParticles;  gParticles = nullptr;
+	delete gRipples;  gRipples = nullptr;
+	delete gWaveComposite;  gWaveComposite = nullptr;
+	delete gMainHiZ;  gMainHiZ = nullptr;
+	delete gWaterVertexCache;  gWaterVertexCache = nullptr;
+	delete gCaustics;  gCaustics = nullptr;
+	delete gShadowMap;  gShadowMap = nullptr;
+	delete gEnvironmentMap;  gEnvironmentMap = nullptr;
+	delete gPostProcess;  gPostProcess = nullptr;
+	delete gRenderTargetPool;  gRenderTargetPool = nullptr;
+	delete gFrameCapture;  gFrameCapture = nullptr;
+	delete gGpuReadback;  gGpuReadback = nullptr;
+	delete gGpuUploader;  gGpuUploader = nullptr;
+	ShutdownMeshLoader();
+
 	ReleaseStates();
 
-	if (gRefractionRenderTarget)   gRefractionRenderTarget->Release();
-	if (gRefractionSRV)            gRefractionSRV->Release();
-	if (gRefraction)               gRefraction->Release();
-	if (gReflectionRenderTarget)   gReflectionRenderTarget->Release();
-	if (gReflectionSRV)            gReflectionSRV->Release();
-	if (gReflection)               gReflection->Release();
-	if (gWaterHeightRenderTarget)  gWaterHeightRenderTarget->Release();
-	if (gWaterHeightSRV)           gWaterHeightSRV->Release();
-	if (gWaterHeight)              gWaterHeight->Release();
+	ReleaseWaterTextures();
+	if (gWaterWaveHeightMapSRV)    gWaterWaveHeightMapSRV->Release();
+	if (gWaterWaveHeightMap)       gWaterWaveHeightMap->Release();
 	if (gWaterNormalMapSRV)        gWaterNormalMapSRV->Release();
 	if (gWaterNormalMap)           gWaterNormalMap->Release();
 
 
 	if (gLightDiffuseMapSRV)           gLightDiffuseMapSRV->Release();
 	if (gLightDiffuseMap)              gLightDiffuseMap->Release();
-	if (gCrateDiffuseSpecularMapSRV)   gCrateDiffuseSpecularMapSRV->Release();
-	if (gCrateDiffuseSpecularMap)      gCrateDiffuseSpecularMap->Release();
-	if (gTrollDiffuseSpecularMapSRV)   gTrollDiffuseSpecularMapSRV->Release();
-	if (gTrollDiffuseSpecularMap)      gTrollDiffuseSpecularMap->Release();
-	if (gGroundDiffuseSpecularMapSRV)  gGroundDiffuseSpecularMapSRV->Release();
-	if (gGroundDiffuseSpecularMap)     gGroundDiffuseSpecularMap->Release();
+	delete gTextureStreamer;  gTextureStreamer = nullptr; // Releases the streamed textures
 	if (gSkyDiffuseSpecularMapSRV)     gSkyDiffuseSpecularMapSRV->Release();
 	if (gSkyDiffuseSpecularMap)        gSkyDiffuseSpecularMap->Release();
 
+	if (gWaterViewConstantBuffer)       gWaterViewConstantBuffer->Release();
+	if (gWaterConstantBuffer)           gWaterConstantBuffer->Release();
 	if (gPerModelConstantBuffer)        gPerModelConstantBuffer->Release();
+	if (gPerViewConstantBuffer)         gPerViewConstantBuffer->Release();
 	if (gPerFrameConstantBuffer)        gPerFrameConstantBuffer->Release();
 
 	ReleaseShaders();
@@ -373,189 +1365,1206 @@ void ReleaseResources()
 	{
 		delete gLights[i].model;  gLights[i].model = nullptr;
 	}
+	delete gLightGrid;  gLightGrid = nullptr;
+	delete gObserverCamera;  gObserverCamera = nullptr;
 	delete gCamera;  gCamera = nullptr;
+	gSceneModels.clear();
+	delete gSceneObjects;  gSceneObjects = nullptr;
+	for (WaterBody* body : gWaterBodies)  delete body;
+	gWaterBodies.clear();
+	delete gWaterCoarse;  gWaterCoarse = nullptr;
 	delete gWater;   gWater = nullptr;
 	delete gCrate;   gCrate = nullptr;
+	for (Model* model : gStressModels)  delete model;
+	gStressModels.clear();
+	gStressLights.clear();
+	for (Animator* animator : gAnimators)  delete animator;
+	gAnimators.clear();
 	delete gTroll;   gTroll = nullptr;
 	delete gGround;  gGround = nullptr;
-	delete gSky;     gSky = nullptr;
 
+	delete gTerrain;  gTerrain = nullptr;
+	delete gPortalMap;  gPortalMap = nullptr;
+	delete gWaterClipmap;  gWaterClipmap = nullptr;
+	delete gWaterCoarseMesh;  gWaterCoarseMesh = nullptr;
 	delete gWaterMesh;   gWaterMesh = nullptr;
+	delete gLightInstances;  gLightInstances = nullptr;
+	for (Impostor* impostor : gImpostors)  delete impostor;
+	gImpostors.clear();
 	delete gLightMesh;   gLightMesh = nullptr;
 	delete gCrateMesh;   gCrateMesh = nullptr;
+	for (Mesh* mesh : gStressMeshes)  delete mesh;
+	gStressMeshes.clear();
+	delete gTrollAnimations;  gTrollAnimations = nullptr;
 	delete gTrollMesh;   gTrollMesh = nullptr;
 	delete gGroundMesh;  gGroundMesh = nullptr;
-	delete gSkyMesh;     gSkyMesh = nullptr;
-}
-
 
+	delete gJobSystem;  gJobSystem = nullptr;
 
-//--------------------------------------------------------------------------------------
-// Scene Rendering
-//--------------------------------------------------------------------------------------
-
+	CloseAssetArchive(); // Not fatal if it can't be written, the loose files are used again next time
+}
 
-//**************************
-// Split the rendering of models into lit models and non-lit models. They need different
-// shaders when rendering the normal scene, reflected and refracted scenes and this
-// breaking up of the code makes dealing with the different shaders simpler - see RenderSceneFromCamer
 
-// Render lit models. Assumes most GPU setup has been done (e.g. shader selection, camera matrix setup), but will do
-// per-model setup (model textures, model-specific states etc.)
-void RenderLitModels()
+// Resize the resources that depend on the viewport size, when the window has changed size: the back buffer, main depth
+// buffer, HDR scene and post-processing textures, and the water textures. Meshes, textures and shaders are kept, so this
+// only takes a few milliseconds. Call between frames. Returns false on failure
+bool ResizeScene(int width, int height)
 {
-	gD3DContext->PSSetShaderResources(0, 1, &gGroundDiffuseSpecularMapSRV); // First parameter must match texture slot number in the shader
-	gGround->Render();
+	if (width == gViewportWidth && height == gViewportHeight)  return true;
+	gViewportWidth  = width;
+	gViewportHeight = height;
 
-	gD3DContext->PSSetShaderResources(0, 1, &gTrollDiffuseSpecularMapSRV);
-	gTroll->Render();
-
-	gD3DContext->PSSetShaderResources(0, 1, &gCrateDiffuseSpecularMapSRV); 
-	gCrate->Render();
-}
+	// The water texture sets are created again at the new size when they are next used (see GroupWaterBodies)
+	ReleaseWaterTextures();
+	if (!ResizeSwapChain() || !CreateWaterTextures())  return false;
 
+	// The exposure starts again from the key brightness, which isn't noticeable after a resize
+	try
+	{
+		PostProcess* postProcess = new PostProcess(width, height, gMSAASamples);
+		postProcess->SetBloom(gPostProcess->Bloom());
+		postProcess->SetAutoExposure(gPostProcess->AutoExposure());
+		postProcess->SetUpscaling(gPostProcess->Upscaling());
+		delete gPostProcess;
+		gPostProcess = postProcess;
+	}
+	catch (std::runtime_error e)
+	{
+		gLastError = e.what();
+		return false;
+	}
 
-// Render models that don't use lighting. Assumes most GPU setup has been done (e.g. shader selection, camera matrix setup), but will do
-// per-model setup (model textures, model-specific states etc.)
-void RenderOtherModels()
-{
-	////--------------- Render sky ---------------////
+	FitCamerasToViews();
+	return true;
+}
 
-	// Using a pixel shader that tints the texture - don't need a tint on the sky so set it to white
-	gPerModelConstants.objectColour = { 1, 1, 1 };
 
-	// Sky points inwards
-	gD3DContext->RSSetState(gCullNoneState);
+// Whether the pipelines have been warmed up for the current render targets (see WarmUpPipelines)
+bool gPipelinesWarm = false;
 
-	// Render sky
-	gD3DContext->PSSetShaderResources(0, 1, &gSkyDiffuseSpecularMapSRV);
-	gSky->Render();
 
+// Change the scene to gRenderSettings (see Settings.h), recreating the resources that depend on them: the main depth buffer
+// and HDR scene texture for the MSAA, the water textures and the standard sampler. Each is only recreated if it has changed,
+// except the sampler, which is quick to create. Call between frames. Returns false on failure
+bool ApplyRenderSettings()
+{
+	lockFPS = gRenderSettings.vsync;
 
+	// The water grid is bufferless, so this doesn't create anything (see Mesh.h). The wave layers are read each frame by the
+	// wave composite and the simulation's buoyancy
+	gWaterMesh->SetGridSubdivisions(gRenderSettings.waterGrid, gRenderSettings.waterGrid);
 
-	////--------------- Render lights ---------------////
+	if (!CreateAnisotropicSampler(gRenderSettings.anisotropy))  return false;
 
-	// Select the texture and sampler to use in the pixel shader
-	gD3DContext->PSSetShaderResources(0, 1, &gLightDiffuseMapSRV); // First parameter must match texture slot number in the shaer
+	// Skip any MSAA the GPU can't do, as InitDirect3D does
+	unsigned int samples = gRenderSettings.msaaSamples;
+	while (samples > 1 && !MultisampleSupported(samples))  samples /= 2;
+	if (samples != gMSAASamples)
+	{
+		if (!CreateMainDepthBuffer(samples) || !gPostProcess->SetSamples(samples))  return false;
+		gMSAASamples = samples;
+		gPipelinesWarm = false; // Every pass into the main targets is drawn at a new sample count
+	}
 
-	// States - additive blending, read-only depth buffer and no culling (standard set-up for blending)
-	gD3DContext->OMSetBlendState(gAdditiveBlendingState, nullptr, 0xffffff);
-	gD3DContext->OMSetDepthStencilState(gDepthReadOnlyState, 0);
-	gD3DContext->RSSetState(gCullNoneState);
+	// The main scene's resolution is the largest scale of its dynamic resolution, so only changes its scale
+	if (gRenderSettings.renderScale != gMainResolution.MaxScale())  gMainResolution.SetMaxScale(gRenderSettings.renderScale);
 
-	// Render all the lights in the array
-	for (int i = 0; i < NUM_LIGHTS; ++i)
+	if (gRenderSettings.waterTextureScale != gWaterTextureScale)
 	{
-		gPerModelConstants.objectColour = gLights[i].colour; // Set any per-model constants apart from the world matrix just before calling render (light colour here)
-		gLights[i].model->Render();
+		gWaterTextureScale = gRenderSettings.waterTextureScale;
+		ReleaseWaterTextures();
+		if (!CreateWaterTextures())  return false;
 	}
+	return true;
+}
+
+
+
+//--------------------------------------------------------------------------------------
+// Scene Rendering
+//--------------------------------------------------------------------------------------
 
-	// Restore standard states
-	gD3DContext->OMSetBlendState(gNoBlendingState, nullptr, 0xffffff);
-	gD3DContext->OMSetDepthStencilState(gUseDepthBufferState, 0);
-	gD3DContext->RSSetState(gCullBackState);
 
+// Get a plane to add to the view frustum to cull models that are entirely above the water (for refraction), or entirely
+// below it (for reflection). The pixel shaders clip those pixels anyway, but this skips whole draw calls. The plane is
+// moved away from the water by the highest the waves can reach, so models the waves might uncover are still drawn
+CVector4 WaterCullPlane(bool keepBelow)
+{
+	const float MaxWaveHeight = 400.0f / 32.0f; // Must match MaxWaveHeight in Common.hlsli
+	float margin = MaxWaveHeight * gPerFrameConstants.waveScale;
+	if (keepBelow)  return {  0, -1,  0,   gPerFrameConstants.waterPlaneY + margin  }; // Inside if y <= water + margin
+	else            return {  0,  1,  0, -(gPerFrameConstants.waterPlaneY - margin) }; // Inside if y >= water - margin
 }
 
 
-void SelectCamera(Camera* camera)
+// Choose the plane the GPU clips lit models against in the refraction (keepBelow) or reflection pass, the same plane used
+// for culling. Only sets gPerFrameConstants, the pass sends them to the GPU (see SendFrameConstants)
+void SetWaterClipPlane(bool keepBelow)
 {
-	// Set camera matrices in the constant buffer and send over to GPU
-	gPerFrameConstants.cameraMatrix = camera->WorldMatrix();
-	gPerFrameConstants.viewMatrix = camera->ViewMatrix();
-	gPerFrameConstants.projectionMatrix = camera->ProjectionMatrix();
-	gPerFrameConstants.viewProjectionMatrix = camera->ViewProjectionMatrix();
-	UpdateConstantBuffer(gPerFrameConstantBuffer, gPerFrameConstants);
+	if (!gHardwareWaterClip)  return;
+	const float MaxWaveHeight = 400.0f / 32.0f; // Must match MaxWaveHeight in Common.hlsli
+	gPerFrameConstants.waterClipPlane  = WaterCullPlane(keepBelow);
+	gPerFrameConstants.waterClipMargin = MaxWaveHeight * gPerFrameConstants.waveScale;
+}
 
-	// Indicate that the constant buffer we just updated is for use in the vertex shader (VS) and pixel shader (PS)
-	gD3DContext->VSSetConstantBuffers(0, 1, &gPerFrameConstantBuffer); // First parameter must match constant buffer number in the shader 
-	gD3DContext->PSSetConstantBuffers(0, 1, &gPerFrameConstantBuffer);
+// Stop clipping against the water, for the other passes
+void ClearWaterClipPlane()
+{
+	gPerFrameConstants.waterClipPlane  = { 0, 0, 0, 1 }; // Every point is in front of this plane
+	gPerFrameConstants.waterClipMargin = 0;
 }
 
 
-// Render everything in the scene from the given camera
-void RenderSceneFromCamera(Camera* camera)
-{
-	SelectCamera(camera);
+// Height in pixels of the viewport of the pass being rendered on this thread (see SetViewport)
+static thread_local int gPassViewportHeight = 1;
 
+// Multiplies the pixels of error allowed in the levels of detail of the pass being rendered on this thread. Set by the water
+// and environment passes, cleared by BeginScenePass
+static thread_local float gPassLodBias = 1;
 
-	////--------------- Prepare common states / textures / samplers ---------------///
-	// The water normal / height map is used in many stages of the following code, so it is permanently left in slot 1
-	gD3DContext->PSSetShaderResources(1, 1, &gWaterNormalMapSRV); // First parameter must match texture slot number in the shader
-	gD3DContext->VSSetShaderResources(1, 1, &gWaterNormalMapSRV); // We also need the water height map in the water vertex shader to displace the water surface (quite rare to use a texture in the vertex shader)
+// Whether the pass being rendered on this thread is cut to a scissor rectangle, so the functions that select their own
+// rasterizer states choose the scissor versions. Set by the refraction and reflection passes, cleared by BeginScenePass
+static thread_local bool gPassScissor = false;
 
-	gD3DContext->PSSetSamplers(0, 1, &gAnisotropic4xSampler);  // Standard sampler for most textures goes in slot 0 (first parameter - must match value in shaders)
-	gD3DContext->VSSetSamplers(0, 1, &gAnisotropic4xSampler);  // Use in vertex shader as well
-	gD3DContext->PSSetSamplers(1, 1, &gBilinearMirrorSampler); // Mirroring sampler used when distorting reflection and refraction - when wiggling UVs we sometimes get 
-	                                                           // pixels outside the bounds of the texture. Using mirror mode ensures theses are a reasonable local colour
-	                                                           // This sampler also disables mip-maps - we won't have them for a scene we render ourselves
+// Which of the scene objects the pass being rendered on this thread draws (see SceneObjects::Passes). Set by the environment,
+// refraction and reflection passes, set back to the main pass by BeginScenePass
+static thread_local unsigned int gPassObjects = SceneObjects::MainPass;
 
-	// Standard states - no blending, ordinary depth buffer and back-face culling
-	gD3DContext->OMSetBlendState(gNoBlendingState, nullptr, 0xffffff);
-	gD3DContext->OMSetDepthStencilState(gUseDepthBufferState, 0);
-	gD3DContext->RSSetState(gCullBackState);
+// The occlusion culling depth of the pass being rendered on this thread, nullptr for none (see gOcclusionCulling). Set by the
+// main, refraction and reflection passes, cleared by BeginScenePass
+static thread_local const HiZBuffer* gPassOcclusion = nullptr;
 
+// The portal map whose visible cells cull the pass being rendered on this thread, nullptr for none. The cells are found for the
+// main camera, so only the main pass sets it, cleared by BeginScenePass
+static thread_local const PortalMap* gPassPortals = nullptr;
 
-	//***************************
-	// Render water height
-	//***************************
+// Lit models further than this from the camera, or fewer pixels across, are dropped from the pass being rendered on this
+// thread, 0 for no limit (see gSecondaryPassCulling). Set by the refraction and reflection passes, cleared by BeginScenePass
+static thread_local float gPassViewDistance = 0;
+static thread_local float gPassMinPixels = 0;
 
-	// Target the water height texture for rendering
-	gD3DContext->OMSetRenderTargets(1, &gWaterHeightRenderTarget, gDepthStencil);
+// The kind of pass being rendered on this thread, which chooses the pixel shader of each material. Set by the refraction and
+// reflection passes, set back to the main pass by BeginScenePass
+static thread_local MaterialPass gPassMaterial = MaterialPass::Main;
 
-	// Clear the water depth texture and depth buffer
-	// Note we reuse the same depth buffer for all the rendering passes, clearing it each time
-	float Zero[4] = {0,0,0,0};
-	gD3DContext->ClearRenderTargetView(gWaterHeightRenderTarget, Zero);
-	gD3DContext->ClearDepthStencilView(gDepthStencil, D3D11_CLEAR_DEPTH, 1.0f, 0);
+// The scene objects that passed culling in the pass being rendered on this thread, and their draws in sort key order. Kept
+// between passes so they only allocate when there are more objects in view than ever before
+static thread_local std::vector<int> gVisibleObjects;
+static thread_local DrawList gDrawList;
 
-	// Select shaders
-	gD3DContext->VSSetShader(gWaterSurfaceVertexShader, nullptr, 0);
-	gD3DContext->PSSetShader(gWaterHeightPixelShader, nullptr, 0);
-	gD3DContext->GSSetShader(nullptr, nullptr, 0);  // Switch off geometry shader when not using it (pass nullptr for first parameter)
+// The visible objects drawn as impostors in the pass being rendered on this thread, taken out of gVisibleObjects (see
+// SplitImpostors), and the world matrices of those sharing an impostor for its draw. Kept between passes like the above
+static thread_local std::vector<int>        gImpostorObjects;
+static thread_local std::vector<CMatrix4x4> gImpostorMatrices;
 
-	// Render heights of water surface
-	gWater->Render();
+// Pixels across a bounding sphere on screen in the current pass, at the sphere's near side, with the camera selected by SelectCamera
+static float SpherePixels(const BoundingSphere& bounds)
+{
+	float distance = Length(bounds.centre - gPerViewConstants.cameraMatrix.GetPosition()) - bounds.radius;
+	distance = (std::max)(distance, 1.0f); // Camera is inside or very close to the sphere, the model fills the screen
 
+	// Projected diameter - element e11 of the projection matrix scales view space y to the -1 to 1 range of the viewport
+	return bounds.radius * gPerViewConstants.projectionMatrix.e11 * gPassViewportHeight / distance;
+}
 
-	//***************************
-	// Render refracted scene
-	//***************************
+// Report the size of a model on screen in the current pass to the texture streamer, so it can load enough of the model's
+// texture. Uses the model's bounding sphere (or the given sphere) and the camera selected by SelectCamera. Repeats is the number
+// of times the texture repeats across the model, which needs more texels on screen
+void RequestTextureSize(const BoundingSphere& bounds, StreamedTexture* texture, float repeats)
+{
+	texture->RequestSize(SpherePixels(bounds) * repeats);
+}
 
-	// Target the refraction texture for rendering and clear depth buffer
-	gD3DContext->OMSetRenderTargets(1, &gRefractionRenderTarget, gDepthStencil);
-	gD3DContext->ClearRenderTargetView(gRefractionRenderTarget, &gBackgroundColor.r);
-	gD3DContext->ClearDepthStencilView(gDepthStencil, D3D11_CLEAR_DEPTH, 1.0f, 0);
+// Pixels covered at a model by a world space distance of 1 in the current pass, divided by the error allowed, to choose the
+// model's level of detail (see Mesh::Render). Uses the near side of the model's bounding sphere like RequestTextureSize
+float ModelLodPixelsPerUnit(const BoundingSphere& bounds)
+{
+	if (!gMeshLods)  return 0; // Full detail
 
-	// Select the water height map (rendered in the last step) as a texture, so the refraction shader can tell what is underwater
-	gD3DContext->PSSetShaderResources(2, 1, &gWaterHeightSRV); // First parameter must match texture slot number in the shader
+	float distance = Length(bounds.centre - gPerViewConstants.cameraMatrix.GetPosition()) - bounds.radius;
+	distance = (std::max)(distance, 1.0f);
 
-	////// Render lit models
+	// Element e11 of the projection matrix scales view space y to the -1 to 1 range, i.e. to half the viewport height
+	float pixelsPerUnit = gPerViewConstants.projectionMatrix.e11 * gPassViewportHeight * 0.5f / distance;
+	return pixelsPerUnit / (gLodPixelError * gPassLodBias);
+}
 
-	// Select shaders for refraction rendering of lit models
-	gD3DContext->VSSetShader(gPixelLightingVertexShader, nullptr, 0);
-	gD3DContext->PSSetShader(gRefractedPixelLightingPixelShader, nullptr, 0);
-	
-	RenderLitModels();
 
-	////// Render sky and lights
+// Cull the scene objects drawn in this pass against the frustum of the camera selected by SelectCamera and the pass's occlusion
+// culling depth, into gVisibleObjects, then against the pass's visible cells if it has them, and its view distance and smallest
+// size on screen. The objects are counted for the stats if countModels is set. The water views pass also gives the frustum of
+// its second view, the objects drawn in that view and its occlusion culling depth
+void CullSceneObjects(bool countModels, const Frustum* otherFrustum = nullptr, unsigned int otherPasses = 0,
+                      const HiZBuffer* otherOcclusion = nullptr)
+{
+	int numObjects = otherFrustum == nullptr ?
+	                 gSceneObjects->Cull(gViewFrustum, gPassObjects, gVisibleObjects, gPassOcclusion) :
+	                 gSceneObjects->Cull(gViewFrustum, gPassObjects, *otherFrustum, otherPasses, gVisibleObjects, gPassOcclusion, otherOcclusion);
+	if (gPassPortals != nullptr)
+	{
+		gVisibleObjects.erase(std::remove_if(gVisibleObjects.begin(), gVisibleObjects.end(),
+		                                     [](int object) { return !gPassPortals->IsVisible(gSceneObjects->Bounds(object)); }),
+		                      gVisibleObjects.end());
+	}
+	if (gPassViewDistance > 0 || gPassMinPixels > 0)
+	{
+		// The distance to the near side of the bounds, as SpherePixels. Both use the selected camera, which in the water views
+		// pass is the refraction's - the reflected camera is the same distance from the water, so is close enough
+		CVector3 cameraPosition = gPerViewConstants.cameraMatrix.GetPosition();
+		float viewDistance = gPassViewDistance > 0 ? gPassViewDistance : FLT_MAX;
+		gVisibleObjects.erase(std::remove_if(gVisibleObjects.begin(), gVisibleObjects.end(), [&](int object)
+		{
+			if (gSceneObjects->AlwaysDrawn(object))  return false;
+			const BoundingSphere& bounds = gSceneObjects->Bounds(object);
+			return Length(bounds.centre - cameraPosition) - bounds.radius > viewDistance || SpherePixels(bounds) < gPassMinPixels;
+		}), gVisibleObjects.end());
+	}
+	if (!countModels)  return;
+	gModelsRendered += static_cast<unsigned int>(gVisibleObjects.size());
+	gModelsCulled   += numObjects - static_cast<unsigned int>(gVisibleObjects.size());
+}
 
-	// Select shaders for refraction rendering of non-lit models
-	gD3DContext->VSSetShader(gBasicTransformWorldPosVertexShader, nullptr, 0);
-	gD3DContext->PSSetShader(gRefractedTintedTexturePixelShader, nullptr, 0);
-	
-	RenderOtherModels();
 
+// Select the texture, sampler, blend state and tint of a material. Not used in the depth pass, which only needs the shaders
+static void SetMaterial(const Material& material)
+{
+	SetShaderResource(0, material.diffuseSpecularMap->SRV()); // First parameter must match texture slot number in the shader
+	SetSampler(0, material.sampler != nullptr ? material.sampler : gAnisotropicSampler);
+	SetBlendState(material.blendState != nullptr ? material.blendState : gNoBlendingState);
+	gPerModelConstants.objectColour = material.tint; // Sent with each model's world matrix
+	gPerModelConstants.textureLayer = static_cast<float>(material.textureLayer);
+}
 
-	//***************************
-	// Render reflected scene
-	//***************************
 
-	// Reflect the camera's matrix in the water plane - to show what is seen in the reflection.
+// Render the terrain tiles, which are drawn with the ground's material but their own vertex shader. They aren't counted in
+// the model stats, the title shows them. The water views pass also gives the frustum of its second view
+static void RenderTerrain(MaterialPass pass, const Frustum* otherFrustum = nullptr)
+{
+	const Material& material = gSceneObjects->GetMaterial(gGroundObject);
+	SetVertexShader(gTerrainVertexShader);
+	SetPixelShader(material.PixelShader(pass, gRenderSettings.simpleWaterLighting));
+	if (pass != MaterialPass::Depth)
+	{
+		// The textures are streamed, each pass that draws them says how much it needs (see TextureStreamer.h)
+		RequestTextureSize(gTerrain->Sphere(), material.diffuseSpecularMap, material.textureRepeats);
+		SetMaterial(material);
+	}
+	gTerrain->Render(gViewFrustum, otherFrustum);
+}
+
+
+// Draw the scene objects culled into gVisibleObjects in the given kind of pass. The draws are sorted by their keys (see
+// DrawList.h), and the shaders and materials are only selected when they change from one draw to the next
+static void RenderDrawList(MaterialPass pass)
+{
+	gDrawList.Build(*gSceneObjects, gVisibleObjects, pass, gPerViewConstants.cameraMatrix.GetPosition());
+
+	int shader   = -1;
+	int material = -1;
+	for (const DrawList::Draw& draw : gDrawList.Draws())
+	{
+		const BoundingSphere& bounds = gSceneObjects->Bounds(draw.object);
+		const Material& objectMaterial = gSceneObjects->GetMaterial(draw.object);
+		int objectMaterialID = gSceneObjects->MaterialID(draw.object);
+		if (gSceneObjects->ShaderID(objectMaterialID) != shader)
+		{
+			shader = gSceneObjects->ShaderID(objectMaterialID);
+			SetVertexShader(*objectMaterial.vertexShader);
+			SetPixelShader(objectMaterial.PixelShader(pass, gRenderSettings.simpleWaterLighting)); // Only the water passes have simple shaders
+		}
+		if (pass != MaterialPass::Depth)
+		{
+			RequestTextureSize(bounds, objectMaterial.diffuseSpecularMap, objectMaterial.textureRepeats);
+			if (objectMaterialID != material)
+			{
+				material = objectMaterialID;
+				SetMaterial(objectMaterial);
+			}
+		}
+		gSceneObjects->GetModel(draw.object)->Render(false, ModelLodPixelsPerUnit(bounds));
+	}
+
+	// Put back the sampler and blend state the pass selected (see BeginScenePass) for what is drawn after. The state cache
+	// skips these when no material changed them
+	SetSampler(0, gAnisotropicSampler);
+	SetBlendState(gNoBlendingState);
+}
+
+
+// Move the objects in gVisibleObjects that have an impostor and are small enough on screen in this pass to gImpostorObjects.
+// The pass's level of detail bias makes the water passes swap sooner. A pass and its depth prepass split the same way
+static void SplitImpostors()
+{
+	gImpostorObjects.clear();
+	if (!gDrawImpostors)  return;
+
+	float maxPixels = gImpostorPixels * gPassLodBias;
+	size_t numKept = 0;
+	for (int object : gVisibleObjects)
+	{
+		if (gSceneObjects->GetImpostor(object) != nullptr && SpherePixels(gSceneObjects->Bounds(object)) < maxPixels)
+		{
+			gImpostorObjects.push_back(object);
+		}
+		else
+		{
+			gVisibleObjects[numKept++] = object;
+		}
+	}
+	gVisibleObjects.resize(numKept);
+}
+
+
+// Draw the objects split into gImpostorObjects in the given kind of pass, one instanced draw for the objects sharing each
+// impostor. Leaves the standard sampler and blend state like RenderDrawList
+static void RenderImpostors(MaterialPass pass)
+{
+	if (gImpostorObjects.empty())  return;
+	if (pass != MaterialPass::Depth)  gImpostorsRendered += static_cast<unsigned int>(gImpostorObjects.size());
+
+	std::sort(gImpostorObjects.begin(), gImpostorObjects.end(), [](int a, int b)
+	{
+		return std::less<Impostor*>()(gSceneObjects->GetImpostor(a), gSceneObjects->GetImpostor(b));
+	});
+	for (size_t first = 0; first < gImpostorObjects.size();)
+	{
+		Impostor* impostor = gSceneObjects->GetImpostor(gImpostorObjects[first]);
+		gImpostorMatrices.clear();
+		size_t next = first;
+		for (; next < gImpostorObjects.size() && gSceneObjects->GetImpostor(gImpostorObjects[next]) == impostor; ++next)
+		{
+			gImpostorMatrices.push_back(gSceneObjects->Transform(gImpostorObjects[next]));
+		}
+		impostor->Render(pass, gImpostorMatrices.data(), static_cast<unsigned int>(gImpostorMatrices.size()));
+		first = next;
+	}
+}
+
+
+//**************************
+// Split the rendering of models into lit models and non-lit models. They need different
+// shaders when rendering the normal scene, reflected and refracted scenes and this
+// breaking up of the code makes dealing with the different shaders simpler - see RenderSceneFromCamer
+
+// Render lit models. Assumes most GPU setup has been done (e.g. camera matrix setup). The shaders, textures and states come
+// from each model's material, for the kind of pass set in gPassMaterial
+void RenderLitModels()
+{
+	GpuEventScope event("Lit Models");
+
+	if (gTerrainEnabled)  RenderTerrain(gPassMaterial);
+	CullSceneObjects(true);
+	SplitImpostors();
+	RenderDrawList(gPassMaterial);
+	RenderImpostors(gPassMaterial);
+}
+
+
+// Render the depth of the lit models only, for the depth prepass in the main pass. The materials' depth pass switches off the
+// pixel shader and uses the vertex shader that shades the models after, so the depths match exactly - as must the levels of detail
+void RenderLitModelsDepth()
+{
+	GpuEventScope event("Lit Models Depth");
+
+	// Culling isn't counted here, the models are counted when they are shaded
+	if (gTerrainEnabled)  RenderTerrain(MaterialPass::Depth);
+	CullSceneObjects(false);
+	SplitImpostors();
+	RenderDrawList(MaterialPass::Depth);
+	RenderImpostors(MaterialPass::Depth);
+}
+
+
+// Select one of the scene's pipeline states, the scissor version if the pass is cut to a scissor rectangle
+static void SetScenePipeline(ScenePipeline pipeline)
+{
+	SetPipelineState(gScenePipelines[pipeline][gPassScissor ? 1 : 0]);
+}
+
+
+// Render models that don't use lighting, with the given pipeline state for the kind of pass (one of the lights pipelines, see
+// CreateScenePipelines). Assumes most GPU setup has been done (e.g. camera matrix setup), but will do per-model setup (model
+// textures etc.). Leaves the standard states
+void RenderOtherModels(ScenePipeline pipeline)
+{
+	GpuEventScope event("Lights");
+
+	////--------------- Render lights ---------------////
+
+	// Select the texture and sampler to use in the pixel shader
+	SetShaderResource(0, gLightDiffuseMapSRV); // First parameter must match texture slot number in the shaer
+
+	// Render all the lights in one draw call
+	SetScenePipeline(pipeline);
+	if (gGpuInstanceCulling)
+	{
+		gLightInstances->RenderGpuCulled(gViewFrustum);
+		gModelsRendered += gLightInstances->NumInstances();
+	}
+	else
+	{
+		unsigned int lightsRendered = gLightInstances->Render(gViewFrustum);
+		gModelsRendered += lightsRendered;
+		gModelsCulled   += gLightInstances->NumInstances() - lightsRendered;
+	}
+
+	// Restore standard states
+	SetBlendState(gNoBlendingState);
+	SetDepthStencilState(gUseDepthBufferState);
+	SetRasterizerState(gPassScissor ? gCullBackScissorState : gCullBackState);
+
+}
+
+
+// Render the particles as they were at the last update, over everything else in the pass (see gParticles). The particle
+// texture is the light flare's, which serves for spray and foam too
+void RenderParticles()
+{
+	GpuEventScope event("Particles");
+
+	SetShaderResource(0, gLightDiffuseMapSRV);
+	SetScenePipeline(ParticlesPipeline);
+	gParticles->Render();
+
+	// Restore standard states
+	SetBlendState(gNoBlendingState);
+	SetDepthStencilState(gUseDepthBufferState);
+	SetRasterizerState(gPassScissor ? gCullBackScissorState : gCullBackState);
+	SetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+}
+
+
+// Emit this frame's spray from the scene objects moving through the given water, and foam along its shore around the camera.
+// Spray is thrown up in proportion to an object's speed through the surface, so still objects throw none
+void EmitWaterParticles(WaterBody* water, float frameTime)
+{
+	const float SprayPerUnitMoved = 40.0f; // Particles for each world unit an object moves through the surface, per unit radius
+	const float ShoreFoamPerSecond = 600.0f;
+	const float ShoreFoamArea = 60.0f;     // Foam starts within this distance of the camera in x and z
+
+	gParticleObjectCentres.resize(gSceneObjects->NumObjects(), { 0, -FLT_MAX, 0 });
+	for (int object = 0; object < gSceneObjects->NumObjects(); ++object)
+	{
+		const BoundingSphere& bounds = gSceneObjects->Bounds(object);
+		CVector3 lastCentre = gParticleObjectCentres[object];
+		gParticleObjectCentres[object] = bounds.centre;
+		if (object == gGroundObject || lastCentre.y == -FLT_MAX || frameTime <= 0)  continue;
+		if (std::abs(bounds.centre.y - water->Height()) > bounds.radius)  continue;
+
+		CVector3 velocity = (bounds.centre - lastCentre) * (1 / frameTime);
+		float moved = Length(bounds.centre - lastCentre);
+		ParticleEmitter spray;
+		spray.position       = { bounds.centre.x, water->Height(), bounds.centre.z };
+		spray.positionSpread = { bounds.radius * 0.7f, 0, bounds.radius * 0.7f };
+		spray.count          = static_cast<unsigned int>(moved * bounds.radius * SprayPerUnitMoved);
+		spray.velocity       = velocity * 0.3f + CVector3{ 0, 4, 0 };
+		spray.velocitySpread = { 2, 2, 2 };
+		spray.lifetime       = 1.5f;
+		spray.lifetimeSpread = 0.5f;
+		spray.drag           = 0.5f;
+		spray.colour         = { 0.9f, 0.95f, 1.0f };
+		spray.alpha          = 0.6f;
+		spray.startSize      = 0.3f;
+		spray.endSize        = 1.0f;
+		spray.flags          = ParticleDieInWater;
+		gParticles->Emit(spray);
+	}
+
+	// Foam starts only where the shore map shows shallow water (tested on the GPU), so it is emitted over the whole area
+	ParticleEmitter foam;
+	foam.position       = { gCamera->Position().x, water->Height(), gCamera->Position().z };
+	foam.positionSpread = { ShoreFoamArea, 0, ShoreFoamArea };
+	foam.count          = static_cast<unsigned int>(ShoreFoamPerSecond * frameTime);
+	foam.velocitySpread = { 0.3f, 0, 0.3f };
+	foam.lifetime       = 4;
+	foam.lifetimeSpread = 1;
+	foam.colour         = { 0.9f, 0.9f, 0.9f };
+	foam.alpha          = 0.5f;
+	foam.startSize      = 0.5f;
+	foam.endSize        = 2.0f;
+	foam.flags          = ParticleOnShore | ParticleFloating;
+	gParticles->Emit(foam);
+}
+
+// Emit a light's flare for this frame as an additive particle of the given size (half its width) and colour
+void EmitFlareParticle(const CVector3& position, float size, const CVector3& colour)
+{
+	ParticleEmitter flare;
+	flare.position  = position;
+	flare.lifetime  = 0;
+	flare.colour    = colour;
+	flare.startSize = size;
+	flare.endSize   = size;
+	flare.flags     = ParticleAdditive;
+	gParticles->Emit(flare);
+}
+
+
+// Render the sky as a single triangle covering the viewport on the far plane (see Sky_vs.hlsl). Call after the opaque
+// geometry, the depth test then only lets through the pixels nothing has been drawn to, so those are the only ones shaded
+// Selects its own shaders, leaves no culling and the standard depth state
+void RenderSky()
+{
+	GpuEventScope event("Sky");
+	SetScenePipeline(SkyPipeline);
+	SetShaderResource(0, gSkyDiffuseSpecularMapSRV);
+	SetInputLayout(nullptr);
+	gD3DContext->Draw(3, 0);
+	CountDrawCall();
+
+	SetDepthStencilState(gUseDepthBufferState);
+}
+
+
+// Set the per-view constants for a camera, without sending them
+void SetViewConstants(PerViewConstants& constants, Camera* camera)
+{
+	constants.cameraMatrix         = camera->WorldMatrix();
+	constants.viewMatrix           = camera->ViewMatrix();
+	constants.projectionMatrix     = camera->ProjectionMatrix();
+	constants.viewProjectionMatrix = camera->ViewProjectionMatrix();
+}
+
+// Send the per-view constants to the GPU for use in all shaders. The state cache binds them to the stages in use now, and to
+// the others (e.g. hull and domain shaders for the tessellated water) when they get a shader (see StateCache.h)
+void SendViewConstants()
+{
+	SetConstants(4, gPerViewConstantBuffer, gPerViewConstants); // First parameter must match constant buffer number in the shader
+}
+
+// Send the per-frame constants to the GPU, once in each pass after the pass has changed any it needs to (e.g. the water height)
+// Selecting a camera doesn't send them, so passes rendering several views send them once for all of them
+void SendFrameConstants()
+{
+	SetConstants(0, gPerFrameConstantBuffer, gPerFrameConstants);
+}
+
+
+// Render the surface geometry of a water body. The open water uses the currently selected water geometry mode, other bodies
+// their own grid. Selects the vertex shader (and tessellation shaders), the pixel shader, textures and states must already be set
+void RenderWaterSurface(WaterBody* body)
+{
+	if (!body->IsOpenWater())
+	{
+		SetVertexShader(gWaterSurfaceVertexShader);
+		body->Grid()->Render();
+	}
+	else if (gWaterGeometry == WaterGeometry::Tessellated)
+	{
+		// The hull and domain shaders do the work of the vertex shader here - see WaterSurface_hs.hlsl / WaterSurface_ds.hlsl
+		SetVertexShader(gWaterSurfaceTessVertexShader);
+		SetHullShader(gWaterSurfaceHullShader);
+		SetDomainShader(gWaterSurfaceDomainShader);
+		gWaterCoarse->Render(true);
+
+		// Switch off tessellation when finished (pass nullptr for first parameter)
+		SetHullShader(nullptr);
+		SetDomainShader(nullptr);
+	}
+	else if (gWaterVerticesCached)
+	{
+		// The grid's vertices were moved by the waves earlier in the frame (see WaterVertexCache.h)
+		SetVertexShader(gWaterSurfaceCachedVertexShader);
+		SetShaderResource(24, gWaterVertexCache->SRV(), VertexShaderStage);
+		gWater->Render();
+	}
+	else
+	{
+		SetVertexShader(gWaterSurfaceVertexShader);
+		if (gWaterGeometry == WaterGeometry::Clipmap)  gWaterClipmap->Render();
+		else                                           gWater->Render();
+	}
+}
+
+// Render the surfaces of the water bodies in the given group this frame (see GroupWaterBodies), or of all the bodies in
+// view if the group is -1. With shoreMaps set each body's shore map is selected for the water surface pixel shader, unless
+// they are switched off (see gShoreMaps), and its flow map
+void RenderWaterSurfaces(int group, bool shoreMaps = false)
+{
+	GpuEventScope event("Water Surfaces", group);
+	for (size_t i = 0; i < gWaterBodies.size(); ++i)
+	{
+		if (gWaterBodyGroups[i] < 0 || (group >= 0 && gWaterBodyGroups[i] != group))  continue;
+
+		if (shoreMaps)
+		{
+			gWaterBodies[i]->SetShoreMapConstants(gPerFrameConstants);
+			if (!gShoreMaps)  gPerFrameConstants.shoreMapEnabled = 0;
+			gWaterBodies[i]->SetFlowMapConstants(gPerFrameConstants);
+			SendFrameConstants();
+			SetShaderResource(15, gShoreMaps ? gWaterBodies[i]->ShoreMapSRV() : nullptr);
+			SetShaderResource(22, gWaterBodies[i]->FlowMapSRV());
+		}
+		RenderWaterSurface(gWaterBodies[i]);
+	}
+}
+
+
+// Set the viewport to cover a render target of the given size
+void SetViewport(int width, int height)
+{
+	D3D11_VIEWPORT vp;
+	vp.Width  = static_cast<FLOAT>(width);
+	vp.Height = static_cast<FLOAT>(height);
+	vp.MinDepth = 0.0f;
+	vp.MaxDepth = 1.0f;
+	vp.TopLeftX = 0;
+	vp.TopLeftY = 0;
+	SetViewport(vp);
+	gPassViewportHeight = height;
+}
+
+
+// Select the camera to render from and send its matrices to the GPU. Only the small per-view constants are sent
+void SelectCamera(Camera* camera)
+{
+	SetViewConstants(gPerViewConstants, camera);
+
+	// Models are culled against this camera's view until another camera is selected
+	gViewFrustum = camera->ViewFrustum();
+
+	SendViewConstants();
+}
+
+
+// Start a pass (see below). Each pass sets up everything it needs itself, so it can be recorded on its own on any thread
+// (see CommandRecorder.h), starting from this frame's per-frame constants and the states, textures and samplers common to
+// all the passes. The pass selects its camera and sends the per-frame constants after this
+void BeginScenePass()
+{
+	gPerFrameConstants = gFrameConstants;
+	gPerViewConstants  = gFrameViewConstants;
+	gPassScissor = false;
+	gPassLodBias = 1;
+	gPassObjects = SceneObjects::MainPass;
+	gPassMaterial = MaterialPass::Main;
+	gPassOcclusion = nullptr;
+	gPassPortals = nullptr;
+	gPassViewDistance = 0;
+	gPassMinPixels = 0;
+
+	////--------------- Prepare common states / textures / samplers ---------------///
+	// The water normal / height map layers, combined this frame, are used in many stages of the following code, so are
+	// permanently left in slot 1. We also need the heights in the water vertex shader to displace the water surface (quite rare
+	// to use a texture in the vertex shader), or in the domain shader for tessellated water
+	const unsigned int waterStages = VertexShaderStage | DomainShaderStage | PixelShaderStage;
+	SetConstantBuffer(2, gWaterConstantBuffer); // Water settings, used by the shaders when they are built to read them (see Common.hlsli)
+	SetShaderResource(1, gWaveComposite->SRV(), waterStages); // First parameter must match texture slot number in the shader
+
+	// Similarly the FFT ocean textures, which replace the normal / height map when the ocean is enabled
+	SetShaderResource(7, gOcean->DisplacementSRV(), waterStages);
+	SetShaderResource(8, gOcean->NormalFoamSRV(),   waterStages);
+	SetShaderResource(21, gRipples->SRV(),          waterStages); // And the ripples added to either
+
+	// The lights and the light grid's lists, used by the lit models' and the water's pixel shaders, and the caustics for the lit
+	// models under the water. The slots and samplers must match Caustics.hlsli
+	gLightGrid->SetShaderResources();
+	SetShaderResource(20, gCaustics->SRV());
+
+	SetSampler(0, gAnisotropicSampler, waterStages); // Standard sampler for most textures goes in slot 0 (first parameter - must match value in shaders)
+	SetSampler(1, gBilinearMirrorSampler);             // Mirroring sampler used when distorting reflection and refraction - when wiggling UVs we sometimes get 
+	                                                   // pixels outside the bounds of the texture. Using mirror mode ensures theses are a reasonable local colour
+	                                                   // This sampler also disables mip-maps - we won't have them for a scene we render ourselves
+	SetSampler(2, gShadowSampler);                     // Compares with the shadow maps' depths, the render graph binds the shadow maps (see RenderSceneFromCamera)
+	SetSampler(3, gTrilinearSampler);                  // Wrapping sampler for the caustics, which repeat like the waves
+
+	// Standard states - no blending, ordinary depth buffer and back-face culling
+	SetBlendState(gNoBlendingState);
+	SetDepthStencilState(gUseDepthBufferState);
+	SetRasterizerState(gCullBackState);
+	SetGeometryShader(nullptr);  // Switch off geometry shader when not using it (pass nullptr for first parameter)
+}
+
+
+//***************************
+// Temporal water textures
+//***************************
+
+// Whether a water texture's history can be used from the given camera, i.e. it lines up well enough after reprojection
+bool IsHistoryUsable(const WaterTextureHistory& history, Camera* camera)
+{
+	return history.valid &&
+	       Length(camera->Position() - history.cameraPosition) < TemporalMaxCameraMove &&
+	       Dot(Normalise(camera->ZAxis()), history.cameraFacing) > TemporalMinCameraTurn;
+}
+
+// Record the camera a water texture is rendered with this frame
+void UpdateHistory(WaterTextureHistory& history, Camera* camera)
+{
+	history.viewProjectionMatrix = camera->ViewProjectionMatrix();
+	history.cameraPosition       = camera->Position();
+	history.cameraFacing         = Normalise(camera->ZAxis());
+	history.uvScale              = WaterUVScale();
+	history.valid                = true;
+}
+
+//***************************
+// Water groups
+//***************************
+
+// Choose the water texture set, i.e. the group, for a water body in view at the given height and return its index. The body
+// joins a group already at this height, otherwise takes a free set, creating one if none have been created yet. When all
+// MaxWaterGroups sets are in use it joins the group nearest its height. Returns -1 if a set can't be created
+int ChooseWaterGroup(float height)
+{
+	for (int i = 0; i < MaxWaterGroups; ++i)
+	{
+		if (gWaterTextureSets[i].inUse && std::abs(gWaterTextureSets[i].height - height) < WaterGroupTolerance)  return i;
+	}
+
+	// Prefer a set that has already been created
+	int chosen = -1;
+	for (int i = 0; i < MaxWaterGroups; ++i)
+	{
+		if (gWaterTextureSets[i].inUse)  continue;
+		if (chosen < 0 || (gWaterTextureSets[chosen].views == nullptr && gWaterTextureSets[i].views != nullptr))  chosen = i;
+	}
+	if (chosen >= 0)
+	{
+		WaterTextureSet& set = gWaterTextureSets[chosen];
+		if (set.views == nullptr && !CreateWaterTextureSet(set))
+		{
+			ReleaseWaterTextureSet(set);
+			return -1;
+		}
+
+		// The set's textures, queries and occlusion culling depth are of water at another height, they can't be reused
+		if (std::abs(set.height - height) >= WaterGroupTolerance)
+		{
+			set.refractionHistory.valid = false;
+			set.reflectionHistory.valid = false;
+			set.refractionHiZ.Reset();
+			set.reflectionHiZ.Reset();
+			for (auto& issued : set.queryIssued)  issued = false;
+			set.hidden = false;
+		}
+		set.height = height;
+		set.inUse  = true;
+		return chosen;
+	}
+
+	float nearest = FLT_MAX;
+	for (int i = 0; i < MaxWaterGroups; ++i)
+	{
+		float distance = std::abs(gWaterTextureSets[i].height - height);
+		if (distance < nearest)
+		{
+			nearest = distance;
+			chosen = i;
+		}
+	}
+	return chosen;
+}
+
+
+// The rectangle of the water textures that a group's water covers on the screen, with a margin for the waves and the
+// distortion. The refraction and reflection textures line up with the screen (see HybridReflectionRect), so the same
+// rectangle is used for both. The waves reach the given height above and below the water
+D3D11_RECT WaterScreenRect(Camera* camera, int group, float waveHeight)
+{
+	D3D11_RECT fullRect = { 0, 0, WaterRenderWidth(), WaterRenderHeight() };
+	if (!gWaterScissor)  return fullRect;
+
+	// Bounds of the water in projection space (-1 to 1 across the viewport, y up)
+	float minX = 1, maxX = -1, minY = 1, maxY = -1;
+	CMatrix4x4 viewProjectionMatrix = camera->ViewProjectionMatrix();
+	for (size_t i = 0; i < gWaterBodies.size(); ++i)
+	{
+		if (gWaterBodyGroups[i] != group)  continue;
+		WaterBody* body = gWaterBodies[i];
+
+		if (body->IsOpenWater())
+		{
+			// The open water reaches the horizon, so covers every row below it. The horizon is the row of the water at an
+			// infinite depth, the limit of the row found in HybridReflectionRect. Only when the camera is above the waves and level
+			float heightAboveWater = camera->Position().y - (body->Height() + waveHeight);
+			if (heightAboveWater <= 0 || camera->YAxis().y < 0.05f || std::abs(camera->XAxis().y) > 0.01f)  return fullRect;
+
+			float horizonY = camera->ProjectionMatrix().e11 * -camera->ZAxis().y / camera->YAxis().y;
+			minX = -1;
+			maxX =  1;
+			minY = -1;
+			maxY = (std::max)(maxY, horizonY);
+			continue;
+		}
+
+		// Project the corners of the body's box onto the screen. If any is behind the camera the box could cover any of it
+		BoundingBox bounds = body->Bounds(waveHeight);
+		for (int corner = 0; corner < 8; ++corner)
+		{
+			CVector3 point = { corner & 1 ? bounds.max.x : bounds.min.x,
+			                   corner & 2 ? bounds.max.y : bounds.min.y,
+			                   corner & 4 ? bounds.max.z : bounds.min.z };
+			CVector4 projected = CVector4(point, 1) * viewProjectionMatrix;
+			if (projected.w < camera->NearClip())  return fullRect;
+
+			minX = (std::min)(minX, projected.x / projected.w);
+			maxX = (std::max)(maxX, projected.x / projected.w);
+			minY = (std::min)(minY, projected.y / projected.w);
+			maxY = (std::max)(maxY, projected.y / projected.w);
+		}
+	}
+	if (minX > maxX)  return { 0, 0, 0, 0 }; // No water in the group
+
+	// To pixels of the water textures, y down. The margin also covers the small camera movement allowed when the textures are
+	// reused on the next frame (see IsHistoryUsable)
+	const float margin = 0.05f; // Fraction of the texture size
+	float width  = static_cast<float>(WaterRenderWidth());
+	float height = static_cast<float>(WaterRenderHeight());
+	auto toPixels = [](float position, float size) { return static_cast<LONG>((std::min)((std::max)(position, 0.0f), 1.0f) * size); };
+	D3D11_RECT rect;
+	rect.left   = toPixels(0.5f + 0.5f * minX - margin, width);
+	rect.right  = toPixels(0.5f + 0.5f * maxX + margin, width);
+	rect.top    = toPixels(0.5f - 0.5f * maxY - margin, height);
+	rect.bottom = toPixels(0.5f - 0.5f * minY + margin, height);
+	return rect;
+}
+
+
+// The water the camera is over or in - the body whose rectangle holds it, otherwise the open water (the first body)
+WaterBody* CameraWaterBody(Camera* camera)
+{
+	CVector3 position = camera->Position();
+	for (WaterBody* body : gWaterBodies)
+	{
+		if (body->IsOpenWater())  continue;
+		BoundingBox bounds = body->Bounds(0);
+		if (position.x >= bounds.min.x && position.x <= bounds.max.x && position.z >= bounds.min.z && position.z <= bounds.max.z)
+		{
+			return body;
+		}
+	}
+	return gWaterBodies[0];
+}
+
+
+// Put the water bodies in view of the camera into groups by height, each using one water texture set, so the reflection and
+// refraction are only rendered for the water in view, once for each height. Then choose whether the refraction and reflection
+// passes are rendered for each group this frame. Both are unless temporal water textures are on, then the refraction is
+// rendered on even frames and the reflection on odd frames, while the other's history is usable. The reflection pass is only
+// used in the planar and hybrid modes. Groups whose water was hidden a few frames ago skip all their passes (see
+// gWaterOcclusionQueries). With a portal map, bodies outside the cells the camera can see aren't in view (see PortalMap.h), and
+// with world streaming neither are bodies in chunks that aren't streamed in (see WorldStreamer.h)
+void GroupWaterBodies(Camera* camera)
+{
+	static unsigned int frame = 0;
+	++frame;
+
+	for (auto& set : gWaterTextureSets)  set.inUse = false;
+
+	const float MaxWaveHeight = 400.0f / 32.0f; // Must match MaxWaveHeight in Common.hlsli
+	Frustum frustum = camera->ViewFrustum();
+	gWaterBodyGroups.resize(gWaterBodies.size()); // Only allocates when bodies are added
+
+	// Cull the bodies across the thread pool, each only writes its own entry. Then group the visible ones in order, so the
+	// groups are the same however the culling was spread out (0 marks a visible body until then)
+	float waveHeight = MaxWaveHeight * gPerFrameConstants.waveScale;
+	gJobSystem->ParallelFor(static_cast<int>(gWaterBodies.size()), 16, [&](int i)
+	{
+		bool visible = gWaterBodies[i]->IsVisible(frustum, waveHeight) &&
+		               (gWorldStreamer == nullptr || gWorldStreamer->IsResident(gWaterBodies[i])) &&
+		               (gPortalMap == nullptr || gPortalMap->IsVisible(gWaterBodies[i]->Bounds(waveHeight)));
+		gWaterBodyGroups[i] = visible ? 0 : -1;
+	});
+	for (size_t i = 0; i < gWaterBodies.size(); ++i)
+	{
+		if (gWaterBodyGroups[i] == 0)  gWaterBodyGroups[i] = ChooseWaterGroup(gWaterBodies[i]->Height());
+	}
+	for (int group = 0; group < MaxWaterGroups; ++group)
+	{
+		WaterTextureSet& set = gWaterTextureSets[group];
+		if (set.inUse)  set.screenRect = WaterScreenRect(camera, group, MaxWaveHeight * gPerFrameConstants.waveScale);
+	}
+
+	bool planarReflection = gReflectionMode == ReflectionMode::Planar || gReflectionMode == ReflectionMode::Hybrid;
+	bool refractionTurn = frame % 2 == 0;
+	gWaterQuerySlot = frame % WaterQueryLatency;
+	for (auto& set : gWaterTextureSets)
+	{
+		// The textures and queries of a set out of use will be out of date when it is used again
+		if (!set.inUse)
+		{
+			set.refractionHistory.valid = false;
+			set.reflectionHistory.valid = false;
+			for (auto& issued : set.queryIssued)  issued = false;
+			set.hidden = false;
+			continue;
+		}
+
+		// Read the query issued WaterQueryLatency frames ago, its slot is reused this frame. If the result isn't ready keep the
+		// last one - DONOTFLUSH, don't push the GPU to finish the work just because we asked
+		if (set.queryIssued[gWaterQuerySlot])
+		{
+			UINT64 pixelsDrawn = 0;
+			HRESULT result = gD3DContext->GetData(set.occlusionQueries[gWaterQuerySlot], &pixelsDrawn, sizeof(pixelsDrawn), D3D11_ASYNC_GETDATA_DONOTFLUSH);
+			if (result == S_OK)  set.hidden = pixelsDrawn == 0;
+		}
+		set.queryIssued[gWaterQuerySlot] = WaterOcclusionQueriesActive();
+		if (!WaterOcclusionQueriesActive())  set.hidden = false;
+
+		// Skip the passes for hidden water, their textures will be out of date when it comes into view. The same for water
+		// seen from under it, which doesn't use them
+		if (set.hidden || (gCameraUnderwater && camera->Position().y < set.height))
+		{
+			set.renderRefraction = false;
+			set.renderReflection = false;
+			set.refractionHistory.valid = false;
+			set.reflectionHistory.valid = false;
+			continue;
+		}
+
+		set.renderRefraction = !gScreenSpaceRefraction;
+		set.renderReflection = planarReflection;
+		if (gScreenSpaceRefraction)  set.refractionHistory.valid = false;
+		if (TemporalWaterTexturesActive())
+		{
+			if (!refractionTurn && IsHistoryUsable(set.refractionHistory, camera))                     set.renderRefraction = false;
+			if (refractionTurn && planarReflection && IsHistoryUsable(set.reflectionHistory, camera))  set.renderReflection = false;
+		}
+
+		if (set.renderRefraction)  UpdateHistory(set.refractionHistory, camera);
+		if (set.renderReflection)  UpdateHistory(set.reflectionHistory, camera);
+		if (!planarReflection)     set.reflectionHistory.valid = false;
+	}
+}
+
+
+//***************************
+// Render environment map
+//***************************
+// Render shadow maps
+//***************************
+// Render the depth of the shadow casters into the cascades chosen for this frame (see ShadowMap::Update), from the key light.
+// The camera isn't used, each cascade has its own view. The lit models are drawn with only their positions and no pixel
+// shader, at the levels of detail the cascade's texels need
+void RenderShadowPass(Camera* /*camera*/, int /*index*/)
+{
+	bool frameConstantsSent = false;
+	for (int cascade = 0; cascade < ShadowMap::NumCascades; ++cascade)
+	{
+		if (!gShadowMap->RenderCascade(cascade))  continue;
+		GpuEventScope event("Cascade", cascade);
+
+		BeginScenePass();
+		if (!frameConstantsSent)  SendFrameConstants(); // The same for every cascade, only the view changes
+		frameConstantsSent = true;
+		gPerViewConstants.viewProjectionMatrix = gShadowMap->ViewProjection(cascade);
+		gViewFrustum = FrustumFromMatrix(gShadowMap->ViewProjection(cascade));
+		SendViewConstants();
+		SetViewport(gShadowMap->Size(), gShadowMap->Size());
+		gPassObjects = SceneObjects::ShadowPass;
+
+		SetRenderTargets(0, nullptr, gShadowMap->DepthStencil(cascade));
+		ClearDepth(gShadowMap->DepthStencil(cascade));
+
+		// Depth bias and no depth clipping, so casters nearer the light than the cascade still cast shadows into it
+		SetRasterizerState(gShadowCasterState);
+		SetPixelShader(nullptr);
+		if (gTerrainEnabled)
+		{
+			SetVertexShader(gTerrainVertexShader);
+			gTerrain->Render(gViewFrustum);
+		}
+
+		// No materials are needed, the draws only differ by their models, so they aren't sorted
+		CullSceneObjects(false);
+		SetVertexShader(gShadowDepthVertexShader);
+		float lodPixelsPerUnit = gMeshLods ? gShadowMap->TexelsPerUnit(cascade) / gLodPixelError : 0;
+		for (int object : gVisibleObjects)
+		{
+			gSceneObjects->GetModel(object)->Render(false, lodPixelsPerUnit, true);
+		}
+	}
+
+	// Detach the shadow maps from rendering before the passes read them
+	SetRenderTargets(0, nullptr, nullptr);
+}
+
+
+//***************************
+// Render the faces of the environment map chosen for this frame (see EnvironmentMap::Update). The camera isn't used, each
+// face has its own. Only the models above the water are needed but the others are cheap to leave in at this size
+void RenderEnvironmentPass(Camera* /*camera*/, int /*index*/)
+{
+	for (unsigned int i = 0; i < gEnvironmentMap->NumFaces(); ++i)
+	{
+		unsigned int face = gEnvironmentMap->FirstFace() + i;
+		Camera faceCamera = gEnvironmentMap->FaceCamera(face);
+		GpuEventScope event("Face", face);
+
+		BeginScenePass();
+		if (i == 0)  SendFrameConstants(); // The same for every face, only the view changes
+		SelectCamera(&faceCamera);
+		SetViewport(gEnvironmentMap->Size(), gEnvironmentMap->Size());
+		gPassLodBias = gWaterPassLodBias;
+		gPassObjects = SceneObjects::EnvironmentPass;
+
+		ID3D11RenderTargetView* renderTarget = gEnvironmentMap->FaceRenderTarget(face);
+		SetRenderTargets(1, &renderTarget, gEnvironmentMap->DepthStencil());
+		ClearRenderTarget(renderTarget, &gBackgroundColor.r);
+		ClearDepth(gEnvironmentMap->DepthStencil());
+
+		RenderLitModels();
+
+		RenderSky();
+		RenderOtherModels(LightsPipeline);
+	}
+
+	// Detach the cube map from rendering before making its mip-maps
+	GpuEventScope event("Mip-maps");
+	SetRenderTargets(0, nullptr, nullptr);
+	gEnvironmentMap->GenerateMips();
+}
+
+
+//***************************
+// Render water height
+//***************************
+// The water height, refraction and reflection passes are rendered for each group of water bodies in view, given by the
+// index (see GroupWaterBodies). They use the group's water height and textures. The render graph times them with the GPU
+// profiler, which times each kind of pass once a frame, so with several groups in view it shows the times for the last group
+// The graph also binds the water height depth for the refraction and reflection passes (see RenderSceneFromCamera)
+void RenderWaterHeightPass(Camera* camera, int group)
+{
+	const WaterTextureSet& set = gWaterTextureSets[group];
+	BeginScenePass();
+	gPerFrameConstants.waterPlaneY = set.height;
+	SendFrameConstants();
+	SelectCamera(camera);
+
+	// The water textures may be smaller than the viewport (see gWaterTextureScale), and only part of them may be rendered to (see
+	// gFrameTimeTarget). The viewport is restored for the main scene
+	SetViewport(WaterRenderWidth(), WaterRenderHeight());
+
+	// Only the depth of the water surface is rendered, with no render target or pixel shader. The refraction and reflection
+	// shaders rebuild the height of the water from the depth (see WaterSurfaceHeight in Common.hlsli), so there is no colour
+	// texture to write, which is much quicker
+	ID3D11DepthStencilView* heightDepthStencil = gRenderGraph->DepthStencil(set.heightDepth);
+	SetRenderTargets(0, nullptr, heightDepthStencil);
+	ClearDepth(heightDepthStencil);
+
+	// Select shaders (vertex shader is chosen by RenderWaterSurface)
+	SetPixelShader(nullptr);
+
+	// Render heights of water surface, only of the bodies in this group as the others are at other heights
+	RenderWaterSurfaces(group);
+}
+
+
+//***************************
+// Render refracted scene
+//***************************
+// Make the mip-maps of a water texture slice from its top level once a pass has rendered it (see WaterTextureMipLevels). The
+// whole slice is filtered, including the part outside the rectangle rendered, which was cleared to the background colour, so the
+// smaller levels blend a little of it into the edges of the rectangle. The texture can't be a render target while its mip-maps
+// are made, so nothing is targeted afterwards
+void GenerateWaterTextureMips(ID3D11ShaderResourceView* slice)
+{
+	GpuEventScope event("Water Mip-maps");
+	SetRenderTargets(0, nullptr, nullptr);
+	gD3DContext->GenerateMips(slice);
+}
+
+void RenderRefractionPass(Camera* camera, int group)
+{
+	// Only models that reach under the water can be seen in the refraction. Lit models are also clipped to it on the GPU
+	const WaterTextureSet& set = gWaterTextureSets[group];
+	BeginScenePass();
+	gPerFrameConstants.waterPlaneY = set.height;
+	SetWaterClipPlane(true);
+	SendFrameConstants();
+	SelectCamera(camera);
+	AddClipPlane(gViewFrustum, WaterCullPlane(true));
+
+	// Only the part of the refraction under the water on the screen is rendered. The clears below aren't cut by the scissor
+	// test, but clearing a whole target is fast
+	SetViewport(WaterRenderWidth(), WaterRenderHeight());
+	gPassScissor = true;
+	gPassLodBias = gWaterPassLodBias;
+	gPassObjects = SceneObjects::RefractionPass;
+	gPassMaterial = MaterialPass::Refracted;
+	gPassOcclusion = OcclusionCullingActive() ? &set.refractionHiZ : nullptr;
+	gPassViewDistance = gSecondaryPassCulling ? RefractionViewDistance : 0;
+	gPassMinPixels = gSecondaryPassCulling ? SecondaryPassMinPixels : 0;
+	SetRasterizerState(gCullBackScissorState);
+	SetScissorRect(set.screenRect);
+
+	// Target the refraction texture and its distortion for rendering and clear depth buffer. Refraction has its own depth buffer,
+	// which is used when upsampling the refraction in the water surface shader
+	ID3D11RenderTargetView* refractionTargets[2] = { set.refractionRenderTarget, set.refractionDistortionRenderTarget };
+	SetRenderTargets(2, refractionTargets, set.refractionDepthStencil);
+	ClearRenderTarget(set.refractionRenderTarget, &gBackgroundColor.r);
+	ClearRenderTarget(set.refractionDistortionRenderTarget, BackgroundDistortion);
+	ClearDepth(set.refractionDepthStencil);
+
+	// The water depth (rendered in the last step) is selected as a texture by the render graph, so the refraction shader can
+	// tell what is underwater
+
+	////// Render lit models
+
+	// The materials select their shaders for refraction rendering (see gPassMaterial)
+	RenderLitModels();
+
+	////// Render lights
+
+	// The sky is all above the water, so isn't rendered in the refraction
+
+	RenderOtherModels(RefractedLightsPipeline);
+
+	// Restore culling state
+	gPassScissor = false;
+	SetRasterizerState(gCullBackState);
+
+	GenerateWaterTextureMips(set.refractionSRV);
+}
+
+
+//***************************
+// Render reflected scene
+//***************************
+
+// The rectangle of the reflection texture that the hybrid reflection mode needs, covering the water nearer the camera than
+// HybridReflectionDistance. Rows on the screen further up show water further away: with no roll, all the water points on a
+// row of the screen are the same depth from the camera. So the rectangle is the rows below the water at that depth, with a
+// margin for the waves and the distortion. The reflection texture lines up with the screen, so the same rows are used
+D3D11_RECT HybridReflectionRect(Camera* camera, float waterHeight)
+{
+	D3D11_RECT rect = { 0, 0, WaterRenderWidth(), WaterRenderHeight() };
+
+	// Find the top of the rectangle only when the camera is above the water, level and not looking straight up or down
+	float heightAboveWater = camera->Position().y - waterHeight;
+	if (heightAboveWater <= 0 || camera->YAxis().y < 0.05f || std::abs(camera->XAxis().y) > 0.01f)  return rect;
+
+	// Camera space y of the water at the fade distance in front of the camera, then its row on the screen
+	float depth = HybridReflectionDistance;
+	float viewY = (-heightAboveWater - depth * camera->ZAxis().y) / camera->YAxis().y;
+	float projectedY = camera->ProjectionMatrix().e11 * viewY / depth;
+
+	const float margin = 0.05f; // Fraction of the texture height
+	float top = (0.5f - 0.5f * projectedY - margin) * WaterRenderHeight();
+	rect.top = static_cast<LONG>((std::min)((std::max)(top, 0.0f), static_cast<float>(WaterRenderHeight())));
+	return rect;
+}
+
+// The part of a water group's reflection texture to render: the part over the water on the screen, and in the hybrid mode only
+// the part over the near water. Pass the camera before it is reflected
+D3D11_RECT ReflectionRect(Camera* camera, const WaterTextureSet& set)
+{
+	D3D11_RECT reflectionRect = set.screenRect;
+	if (gReflectionMode == ReflectionMode::Hybrid)
+	{
+		reflectionRect.top = (std::max)(reflectionRect.top, HybridReflectionRect(camera, set.height).top);
+	}
+	return reflectionRect;
+}
+
+// Change the camera to the camera reflected in water at the given height
+void ReflectCamera(Camera* camera, float waterHeight)
+{
+	// Reflect the camera's matrix in the water plane - to show what is seen in the reflection.
 	// Will assume the water is horizontal in the xz plane, which makes the reflection simple:
 	// - Negate the y component of the x,y and z axes of the reflected camera matrix
 	// - Put the reflected camera y position on the opposite side of the water y position
-	CMatrix4x4 originalMatrix = camera->WorldMatrix();
 	camera->XAxis().y *= -1; // Negate y component of each axis of the matrix
 	camera->YAxis().y *= -1;
 	camera->ZAxis().y *= -1;
@@ -563,122 +2572,850 @@ void RenderSceneFromCamera(Camera* camera)
 	// Camera distance above water = Camera.y - Water.y
 	// Reflected camera is same distance below water = Water.y - (Camera.y - Water.y) = 2*Water.y - Camera.y
 	// (Position is on bottom row (row 3) of matrix so Camera.y is matrix element e31)
-	camera->Position().y = gWater->Position().y * 2 - camera->Position().y;
-	
-	// Use camera with reflected matrix for rendering
+	camera->Position().y = waterHeight * 2 - camera->Position().y;
+}
+
+// The camera is changed to the reflected camera - pass a copy of the real camera
+void RenderReflectionPass(Camera* camera, int group)
+{
+	// The rectangle to render is found before the camera is reflected
+	const WaterTextureSet& set = gWaterTextureSets[group];
+	D3D11_RECT reflectionRect = ReflectionRect(camera, set);
+	ReflectCamera(camera, set.height);
+
+	// Use camera with reflected matrix for rendering. Only models that reach above the water can be seen in the reflection
+	BeginScenePass();
+	gPerFrameConstants.waterPlaneY = set.height;
+	SetWaterClipPlane(false);
+	SendFrameConstants();
+	SelectCamera(camera);
+	AddClipPlane(gViewFrustum, WaterCullPlane(false));
+
+	// IMPORTANT: when rendering in a mirror must switch from back face culling to front face culling (because clockwise / anti-clockwise order of points will be reversed)
+	// Everything is cut to the rectangle above with the scissor test, the sky and lights choose scissor states too (see gPassScissor)
+	// The clears below aren't cut by the scissor test, but clearing a whole target is fast
+	gPassScissor = true;
+	gPassLodBias = gWaterPassLodBias;
+	gPassObjects = SceneObjects::ReflectionPass;
+	gPassMaterial = MaterialPass::Reflected;
+	gPassOcclusion = OcclusionCullingActive() ? &set.reflectionHiZ : nullptr;
+	gPassViewDistance = gSecondaryPassCulling ? ReflectionViewDistance : 0;
+	gPassMinPixels = gSecondaryPassCulling ? SecondaryPassMinPixels : 0;
+	SetRasterizerState(gCullFrontScissorState);
+	SetScissorRect(reflectionRect);
+
+	// Target the reflection texture and its distortion for rendering and clear depth buffer. The reflection depth is kept in the
+	// texture set for its occlusion culling depth
+	SetViewport(WaterRenderWidth(), WaterRenderHeight());
+	ID3D11RenderTargetView* reflectionTargets[2] = { set.reflectionRenderTarget, set.reflectionDistortionRenderTarget };
+	SetRenderTargets(2, reflectionTargets, set.reflectionDepthStencil);
+	ClearRenderTarget(set.reflectionRenderTarget, &gBackgroundColor.r);
+	ClearRenderTarget(set.reflectionDistortionRenderTarget, BackgroundDistortion);
+	ClearDepth(set.reflectionDepthStencil);
+
+	// The water depth selected by the render graph is used here to tell what is above the water
+
+	////// Render lit models
+
+	// The materials select their shaders for reflection rendering (see gPassMaterial)
+	RenderLitModels();
+
+	////// Render sky and lights
+
+	// The sky is far away so nothing can be between it and the water, it doesn't need clipping like the models
+	RenderSky();
+
+	RenderOtherModels(ReflectedLightsPipeline);
+
+	// Restore culling state
+	gPassScissor = false;
+	SetRasterizerState(gCullBackState);
+
+	GenerateWaterTextureMips(set.reflectionSRV);
+}
+
+
+//***************************
+// Render refracted and reflected scenes together
+//***************************
+// Renders a group's refraction and reflection in one pass in place of the two passes above (see gWaterViews). The lit models
+// are drawn once for both, into both slices of the water textures, by the water views geometry shader. Each view keeps its own
+// scissor rectangle and clip plane. The objects of the refraction in view of the camera and those of the reflection in view
+// of the reflected camera are drawn into both views, the clip planes remove what the other view can't see. The sky and the
+// lights are drawn into each slice on its own afterwards, as the separate passes do. Doesn't change the camera passed
+void RenderWaterViewsPass(Camera* camera, int group)
+{
+	const WaterTextureSet& set = gWaterTextureSets[group];
+	D3D11_RECT reflectionRect = ReflectionRect(camera, set);
+	Camera reflectedCamera = *camera;
+	ReflectCamera(&reflectedCamera, set.height);
+
+	// The refraction's camera is selected and its clip plane set, which also sets the clip margin the lit models' shaders use
+	// in both views. The geometry shader clips each view to its own plane
+	BeginScenePass();
+	gPerFrameConstants.waterPlaneY = set.height;
+	SetWaterClipPlane(true);
+	SendFrameConstants();
+	SelectCamera(camera);
+	AddClipPlane(gViewFrustum, WaterCullPlane(true));
+	Frustum reflectionFrustum = reflectedCamera.ViewFrustum();
+	AddClipPlane(reflectionFrustum, WaterCullPlane(false));
+
+	const CVector4 noClipPlane = { 0, 0, 0, 1 }; // As ClearWaterClipPlane
+	WaterViewConstants viewConstants;
+	viewConstants.viewProjectionMatrices[0] = camera->ViewProjectionMatrix();
+	viewConstants.viewProjectionMatrices[1] = reflectedCamera.ViewProjectionMatrix();
+	viewConstants.cameraMatrices[0] = camera->WorldMatrix();
+	viewConstants.cameraMatrices[1] = reflectedCamera.WorldMatrix();
+	viewConstants.clipPlanes[0] = gHardwareWaterClip ? WaterCullPlane(true)  : noClipPlane;
+	viewConstants.clipPlanes[1] = gHardwareWaterClip ? WaterCullPlane(false) : noClipPlane;
+	SetConstants(5, gWaterViewConstantBuffer, viewConstants); // First parameter must match constant buffer number in the shader
+
+	gPassScissor = true;
+	gPassLodBias = gWaterPassLodBias;
+	gPassObjects = SceneObjects::RefractionPass;
+	gPassMaterial = MaterialPass::WaterViews;
+	gPassOcclusion = OcclusionCullingActive() ? &set.refractionHiZ : nullptr;
+	gPassViewDistance = gSecondaryPassCulling ? ReflectionViewDistance : 0; // Drawn into both views, so the longer distance
+	gPassMinPixels = gSecondaryPassCulling ? SecondaryPassMinPixels : 0;
+
+	// The two views have the same viewport but each its own scissor rectangle, which is chosen with the viewport, so it is given
+	// twice. The mirrored view needs the opposite culling, the geometry shader culls each view, so the rasterizer culls nothing
+	const D3D11_VIEWPORT viewport = { 0, 0, static_cast<FLOAT>(WaterRenderWidth()), static_cast<FLOAT>(WaterRenderHeight()), 0, 1 };
+	const D3D11_VIEWPORT viewports[2]    = { viewport, viewport };
+	const D3D11_RECT     scissorRects[2] = { set.screenRect, reflectionRect };
+	SetViewports(2, viewports);
+	SetScissorRects(2, scissorRects);
+	gPassViewportHeight = WaterRenderHeight();
+	SetRasterizerState(gCullNoneScissorState);
+
+	// Target both slices of the textures and the depth buffers, the clears clear both
+	ID3D11RenderTargetView* viewsTargets[2] = { set.viewsRenderTarget, set.viewsDistortionRenderTarget };
+	SetRenderTargets(2, viewsTargets, set.viewsDepthStencil);
+	ClearRenderTarget(set.viewsRenderTarget, &gBackgroundColor.r);
+	ClearRenderTarget(set.viewsDistortionRenderTarget, BackgroundDistortion);
+	ClearDepth(set.viewsDepthStencil);
+
+	// The water depth is selected as a texture by the render graph, as for the separate passes
+
+	////// Render lit models
+
+	{
+		GpuEventScope event("Lit Models");
+		SetGeometryShader(gWaterViewsGeometryShader);
+		if (gTerrainEnabled)  RenderTerrain(gPassMaterial, &reflectionFrustum);
+		CullSceneObjects(true, &reflectionFrustum, SceneObjects::ReflectionPass, OcclusionCullingActive() ? &set.reflectionHiZ : nullptr);
+		RenderDrawList(gPassMaterial);
+		SetGeometryShader(nullptr);
+	}
+
+	////// Render the lights into the refraction
+
+	// Slice by slice from here, with one viewport and scissor rectangle. The sky is all above the water, so isn't in the refraction
+	SetViewport(WaterRenderWidth(), WaterRenderHeight());
+	SetScissorRect(set.screenRect);
+	ID3D11RenderTargetView* refractionTargets[2] = { set.refractionRenderTarget, set.refractionDistortionRenderTarget };
+	SetRenderTargets(2, refractionTargets, set.refractionDepthStencil);
+	RenderOtherModels(RefractedLightsPipeline);
+
+	////// Render the sky and lights into the reflection
+
+	SelectCamera(&reflectedCamera);
+	AddClipPlane(gViewFrustum, WaterCullPlane(false));
+	SetScissorRect(reflectionRect);
+	ID3D11RenderTargetView* reflectionTargets[2] = { set.reflectionRenderTarget, set.reflectionDistortionRenderTarget };
+	SetRenderTargets(2, reflectionTargets, set.reflectionDepthStencil);
+	RenderSky();
+	RenderOtherModels(ReflectedLightsPipeline);
+
+	// Restore culling state
+	gPassScissor = false;
+	SetRasterizerState(gCullBackState);
+
+	GenerateWaterTextureMips(set.refractionSRV);
+	GenerateWaterTextureMips(set.reflectionSRV);
+}
+
+
+// Copy the main depth buffer into gSceneDepthCopy for the water surface shader. DirectX can't copy or resolve a multisampled
+// depth buffer into one that isn't, so with MSAA the copy is drawn with a shader that keeps the nearest sample of each pixel
+// The HDR scene and main depth buffer are targeted again afterwards, but the caller must select its shaders again
+void CopySceneDepth()
+{
+	GpuEventScope event("Copy Scene Depth");
+	if (gMSAASamples == 1)
+	{
+		gD3DContext->CopyResource(gSceneDepthCopy, gDepthStencilTexture);
+		return;
+	}
+
+	// Can't read the depth buffer while it is being rendered to, so target the copy alone. The copy is cleared to the far
+	// distance first, which the ordinary depth test keeps where nothing was rendered
+	SetRenderTargets(0, nullptr, gSceneDepthCopyView);
+	ClearDepth(gSceneDepthCopyView);
+	SetShaderResource(0, gDepthShaderView);
+
+	SetInputLayout(nullptr);
+	SetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+	SetVertexShader(gPostProcessVertexShader);
+	SetPixelShader(gDepthResolvePixelShader);
+	SetRasterizerState(gCullNoneState);
+	gD3DContext->Draw(3, 0);
+	CountDrawCall();
+
+	SetShaderResource(0, nullptr);
+	SetRasterizerState(gCullBackState);
+	ID3D11RenderTargetView* sceneRenderTarget = gPostProcess->SceneRenderTarget();
+	SetRenderTargets(1, &sceneRenderTarget, gDepthStencil);
+}
+
+
+// Fog the whole of the main scene rendered so far by the water the camera is under, from the distance to each pixel in the
+// main depth buffer. One full-screen draw blended into the scene (see UnderwaterFog_ps.hlsl), rather than fog in every lit
+// shader. The depth buffer can't be read while it is bound, so the scene is targeted alone. With MSAA the shader can't read
+// the multisampled depth buffer, so it reads the nearest samples copied into gSceneDepthCopy instead
+// The HDR scene and main depth buffer are targeted again afterwards, but the caller must select its shaders again
+void RenderUnderwaterFog()
+{
+	GpuEventScope event("Underwater Fog");
+	if (gMSAASamples > 1)  CopySceneDepth();
+
+	ID3D11RenderTargetView* sceneRenderTarget = gPostProcess->SceneRenderTarget();
+	SetRenderTargets(1, &sceneRenderTarget, nullptr);
+	SetShaderResource(6, gMSAASamples > 1 ? gSceneDepthCopySRV : gDepthShaderView); // Slot must match UnderwaterFog_ps.hlsl
+
+	SetInputLayout(nullptr);
+	SetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+	SetVertexShader(gPostProcessVertexShader);
+	SetPixelShader(gUnderwaterFogPixelShader);
+	SetBlendState(gUnderwaterFogBlendingState);
+	SetDepthStencilState(gNoDepthBufferState);
+	SetRasterizerState(gCullNoneState);
+	gD3DContext->Draw(3, 0);
+	CountDrawCall();
+
+	SetShaderResource(6, nullptr);
+	SetBlendState(gNoBlendingState);
+	SetDepthStencilState(gUseDepthBufferState);
+	SetRasterizerState(gCullBackState);
+	SetRenderTargets(1, &sceneRenderTarget, gDepthStencil);
+}
+
+
+//***************************
+// Render main scene
+//***************************
+void RenderMainPass(Camera* camera, int /*index*/)
+{
+	BeginScenePass();
+	SendFrameConstants();
 	SelectCamera(camera);
+	gPassOcclusion = OcclusionCullingActive() ? gMainHiZ : nullptr;
+	gPassPortals = gPortalMap;
+
+	// Finally target the HDR scene texture for rendering (tonemapped into the back buffer afterwards), clear depth buffer. With
+	// dynamic resolution only part of it is rendered to, scaled up by the tonemapping
+	SetViewport(MainRenderWidth(), MainRenderHeight());
+	ID3D11RenderTargetView* sceneRenderTarget = gPostProcess->SceneRenderTarget();
+	SetRenderTargets(1, &sceneRenderTarget, gDepthStencil);
+	ClearDepth(gDepthStencil);
+
+	// When the water textures are smaller than the viewport, the water surface shader upsamples the refraction by comparing the
+	// refraction depth with the full size scene depth under the water. Can't read the depth buffer while rendering to it, so it
+	// is copied after the lit models and before the water are rendered. Screen-space reflections and refraction use the same copy
+	bool screenSpaceReflections = gReflectionMode == ReflectionMode::ScreenSpace;
+	bool checkerboard = WaterCheckerboardActive();
+	bool readSceneDepth = UpsampleRefraction() || screenSpaceReflections || gScreenSpaceRefraction || checkerboard;
+	bool copySceneDepth = readSceneDepth;
+
+	////// Depth prepass
+
+	// Render the depth of the lit models and water with no pixel shader, which is much quicker than shading them. They are then
+	// shaded with an equal depth test, so the pixels hidden behind other geometry (e.g. ground under the water) aren't shaded
+	if (gDepthPrepass)
+	{
+		gGpuProfiler->BeginPass(GpuPass::DepthPrepass);
+		BeginGpuEvent("Depth Prepass");
+		RenderLitModelsDepth();
+		if (copySceneDepth)  CopySceneDepth();
+		copySceneDepth = false;
+
+		// The water depth is drawn with no pixel shader too, which the lit models may not have selected if none were in view
+		// From under the water its surface is seen from behind
+		SetPixelShader(nullptr);
+
+		if (gCameraUnderwater)  SetRasterizerState(gCullNoneState);
+		RenderWaterSurfaces(-1);
+		SetRasterizerState(gCullBackState);
+		EndGpuEvent();
+		gGpuProfiler->EndPass(GpuPass::DepthPrepass);
+
+		SetDepthStencilState(gDepthEqualState);
+	}
+
+	////// Render lit models
+
+	// The materials select their shaders for ordinary rendering
+	gGpuProfiler->BeginPass(GpuPass::MainLit);
+	RenderLitModels();
+	gGpuProfiler->EndPass(GpuPass::MainLit);
+
+
+	////// Render water surface - combining reflection and refraction
+	// Render water before transparent objects or it will draw over them
+
+	gGpuProfiler->BeginPass(GpuPass::WaterSurface);
+	BeginGpuEvent("Water Surface");
+
+	// Select the scene depth for upsampling the refraction (see above), copying it if the prepass hasn't already
+	if (copySceneDepth)  CopySceneDepth();
+	if (readSceneDepth)  SetShaderResource(6, gSceneDepthCopySRV);
+
+	// Screen-space reflections and refraction also need the colour of the scene so far, which can't be read while rendering to
+	// it either
+	if (screenSpaceReflections || gScreenSpaceRefraction)
+	{
+		gPostProcess->CopyScene(gSceneColourCopy);
+		SetShaderResource(11, gSceneColourCopySRV);
+	}
+
+	// The environment map is also what is seen through the surface from under the water, in every mode
+	SetShaderResource(9, gReflectionMode != ReflectionMode::Planar || gCameraUnderwater ? gEnvironmentMap->SRV() : nullptr);
+	SetPixelShader(gWaterSurfacePixelShader);
+	if (gCameraUnderwater)  SetRasterizerState(gCullNoneState);
+
+	// Render each group of water bodies with its own reflection and refraction textures (rendered in the previous steps), and
+	// the matrices to find the water in them. The planar reflection is only rendered in the planar and hybrid modes, the water
+	// shader doesn't read it otherwise
+	bool planarReflection = gReflectionMode == ReflectionMode::Planar || gReflectionMode == ReflectionMode::Hybrid;
+	for (int group = 0; group < MaxWaterGroups; ++group)
+	{
+		const WaterTextureSet& set = gWaterTextureSets[group];
+		if (!set.inUse)  continue;
+
+		gPerFrameConstants.waterPlaneY = set.height;
+		gPerFrameConstants.refractionViewProjectionMatrix = set.refractionHistory.viewProjectionMatrix;
+		gPerFrameConstants.reflectionViewProjectionMatrix = planarReflection ? set.reflectionHistory.viewProjectionMatrix :
+		                                                                       set.refractionHistory.viewProjectionMatrix;
+		gPerFrameConstants.refractionUVScale = set.refractionHistory.uvScale;
+		gPerFrameConstants.reflectionUVScale = planarReflection ? set.reflectionHistory.uvScale : set.refractionHistory.uvScale;
+		SendFrameConstants();
+
+		SetShaderResource(3, gScreenSpaceRefraction ? nullptr : set.refractionSRV); // First parameter must match texture slot number in the shader
+		SetShaderResource(4, planarReflection ? set.reflectionSRV : nullptr);
+		SetShaderResource(12, gScreenSpaceRefraction ? nullptr : set.refractionDistortionSRV);
+		SetShaderResource(13, planarReflection ? set.reflectionDistortionSRV : nullptr);
+		if (UpsampleRefraction())  SetShaderResource(5, set.refractionDepthSRV);
+
+		// Count the pixels of the water drawn, to skip the passes for this group when it is hidden (see gWaterOcclusionQueries)
+		// The constants above are sent with each body's shore map
+		if (set.queryIssued[gWaterQuerySlot])  gD3DContext->Begin(set.occlusionQueries[gWaterQuerySlot]);
+		RenderWaterSurfaces(group, true);
+		if (set.queryIssued[gWaterQuerySlot])  gD3DContext->End(set.occlusionQueries[gWaterQuerySlot]);
+	}
+
+	// Fill in the blocks of far water the checkerboard skipped, drawing the water again with the same equal depth test. The fill
+	// reads the water shaded so far from a copy of the scene (the copy for screen-space reflections isn't needed any more)
+	if (checkerboard)
+	{
+		GpuEventScope event("Water Checkerboard Fill");
+		SetShaderResource(11, nullptr);
+		gPostProcess->CopyScene(gSceneColourCopy);
+		SetShaderResource(11, gSceneColourCopySRV);
+		SetPixelShader(gWaterCheckerboardFillPixelShader);
+		RenderWaterSurfaces(-1);
+	}
+	SetRasterizerState(gCullBackState);
+
+	// Detach the reflection/refraction maps from being source textures so they can be used as a render target again next frame (if you don't do this DX emits lots of warnings)
+	SetShaderResource(3, nullptr);
+	SetShaderResource(4, nullptr);
+	SetShaderResource(5, nullptr);
+	SetShaderResource(6, nullptr);
+	SetShaderResource(9, nullptr);
+	SetShaderResource(11, nullptr);
+	SetShaderResource(12, nullptr);
+	SetShaderResource(13, nullptr);
+	SetShaderResource(15, nullptr);
+	SetShaderResource(22, nullptr);
+
+	EndGpuEvent();
+	gGpuProfiler->EndPass(GpuPass::WaterSurface);
+
+
+	////// Render sky and lights
+
+	// The sky and lights aren't in the depth prepass, they use their own depth tests
+	gGpuProfiler->BeginPass(GpuPass::SkyAndLights);
+	RenderSky();
+	if (!gParticlesEnabled || !gParticleFlares)  RenderOtherModels(LightsPipeline);
+	if (gParticlesEnabled)  RenderParticles();
+	gGpuProfiler->EndPass(GpuPass::SkyAndLights);
+
+	////// Underwater fog
+
+	// Last, so it fogs everything seen through the water including the sky and lights
+	if (gCameraUnderwater)
+	{
+		gGpuProfiler->BeginPass(GpuPass::UnderwaterFog);
+		RenderUnderwaterFog();
+		gGpuProfiler->EndPass(GpuPass::UnderwaterFog);
+	}
+}
+
+
+// Render everything in the scene from the given camera, one pass after another on this thread, or with each pass recorded
+// on its own thread (see gParallelPasses). The passes are given their own copy of the camera - the reflection pass changes
+// it, and getting a camera's matrices updates it, so passes recorded at the same time can't share one
+// The passes are described to the render graph with the textures they read and write, it culls the passes nothing uses and
+// binds the textures read from shader slots (see RenderGraph.h). Returns false if the graph's textures can't be created
+// The shadow maps and environment map are shared by the views of a split screen (see gSplitScreen), only the first view
+// renders them
+bool RenderSceneFromCamera(Camera* camera, bool firstView = true)
+{
+	static Camera passCameras[NumScenePasses];
+	for (auto& passCamera : passCameras)  passCamera = *camera;
+	int numPasses = 0;
+	auto addPass = [&](ScenePass pass, void (*record)(Camera*, int), int index, GpuPass timing)
+	{
+		return gRenderGraph->AddPass(ScenePassNames[static_cast<int>(pass)], record, &passCameras[numPasses++], index, timing);
+	};
+
+	// The HDR scene is the result of the frame. The environment map is added every frame but only read by the main pass when
+	// the water uses it, otherwise its pass is culled. A later view keeps the first view's passes for their stats
+	if (firstView)  gRenderGraph->BeginFrame();
+	else            gRenderGraph->BeginView();
+	int scene = gRenderGraph->ImportTexture("Scene", nullptr, gPostProcess->SceneRenderTarget(), gDepthStencil);
+	gRenderGraph->SetOutput(scene);
+
+	// The shadow maps come first, every pass that lights the scene reads them. The graph binds them for each of those passes
+	// Their slot must match ShadowMap.hlsli
+	const int shadowSlot = 19;
+	int shadowMaps = -1;
+	if (gShadows)
+	{
+		shadowMaps = gRenderGraph->ImportTexture("Shadow Maps", gShadowMap->SRV());
+		if (firstView)
+		{
+			int shadowPass = addPass(ScenePass::Shadows, RenderShadowPass, 0, GpuPass::Shadows);
+			gRenderGraph->Write(shadowPass, shadowMaps);
+		}
+	}
+	auto readShadowMaps = [&](int pass)  { if (shadowMaps >= 0)  gRenderGraph->Read(pass, shadowMaps, shadowSlot); };
+
+	int environmentMap = gRenderGraph->ImportTexture("Environment Map", gEnvironmentMap->SRV());
+	if (firstView)
+	{
+		int environmentPass = addPass(ScenePass::Environment, RenderEnvironmentPass, 0, GpuPass::Environment);
+		readShadowMaps(environmentPass);
+		gRenderGraph->Write(environmentPass, environmentMap);
+	}
+
+	// Each group of water bodies in view has its own water height, refraction and reflection passes, the refraction and
+	// reflection when they are scheduled this frame (see GroupWaterBodies), or a water views pass for both when both are (see
+	// gWaterViews). The water height pass is culled when neither is.
+	// The depth buffers only used within these passes are transient, so the groups share them. The water textures are kept
+	// from one frame to the next for the temporal mode so they are imported instead
+	const RenderGraph::TextureDesc waterDepthDesc = { WaterTextureWidth(), WaterTextureHeight(), DXGI_FORMAT_UNKNOWN };
+	int refractions[MaxWaterGroups];
+	int reflections[MaxWaterGroups];
+	for (int group = 0; group < MaxWaterGroups; ++group)
+	{
+		WaterTextureSet& set = gWaterTextureSets[group];
+		refractions[group] = reflections[group] = -1;
+		if (!set.inUse)  continue;
+
+		refractions[group] = gRenderGraph->ImportTexture("Refraction", set.refractionSRV, set.refractionRenderTarget, set.refractionDepthStencil);
+		reflections[group] = gRenderGraph->ImportTexture("Reflection", set.reflectionSRV, set.reflectionRenderTarget);
+		if (set.hidden)  continue;
+
+		set.heightDepth = gRenderGraph->CreateTexture("Water Height Depth", waterDepthDesc);
+		int heightPass = addPass(ScenePass::WaterHeight, RenderWaterHeightPass, group, GpuPass::WaterHeight);
+		gRenderGraph->Write(heightPass, set.heightDepth);
+		if (gWaterViews && set.renderRefraction && set.renderReflection)
+		{
+			// Both in the one pass, which has a depth buffer for the reflection in the texture set
+			int viewsPass = addPass(ScenePass::WaterViews, RenderWaterViewsPass, group, GpuPass::WaterViews);
+			gRenderGraph->Read(viewsPass, set.heightDepth, 2);
+			readShadowMaps(viewsPass);
+			gRenderGraph->Write(viewsPass, refractions[group]);
+			gRenderGraph->Write(viewsPass, reflections[group]);
+			continue;
+		}
+		if (set.renderRefraction)
+		{
+			int refractionPass = addPass(ScenePass::Refraction, RenderRefractionPass, group, GpuPass::Refraction);
+			gRenderGraph->Read(refractionPass, set.heightDepth, 2);
+			readShadowMaps(refractionPass);
+			gRenderGraph->Write(refractionPass, refractions[group]);
+		}
+		if (set.renderReflection)
+		{
+			int reflectionPass = addPass(ScenePass::Reflection, RenderReflectionPass, group, GpuPass::Reflection);
+			gRenderGraph->Read(reflectionPass, set.heightDepth, 2);
+			readShadowMaps(reflectionPass);
+			gRenderGraph->Write(reflectionPass, reflections[group]);
+		}
+	}
+
+	// The main pass binds the water textures itself, each group's in turn, and times its parts itself
+	int mainPass = addPass(ScenePass::Main, RenderMainPass, 0, GpuPass::NumPasses);
+	gRenderGraph->Write(mainPass, scene);
+	readShadowMaps(mainPass);
+	if (gReflectionMode != ReflectionMode::Planar || gCameraUnderwater)  gRenderGraph->Read(mainPass, environmentMap);
+	bool planarReflection = gReflectionMode == ReflectionMode::Planar || gReflectionMode == ReflectionMode::Hybrid;
+	for (int group = 0; group < MaxWaterGroups; ++group)
+	{
+		if (refractions[group] < 0)  continue;
+		if (!gScreenSpaceRefraction)  gRenderGraph->Read(mainPass, refractions[group]);
+		if (planarReflection)  gRenderGraph->Read(mainPass, reflections[group]);
+	}
 
-	// IMPORTANT: when rendering in a mirror must switch from back face culling to front face culling (because clockwise / anti-clockwise order of points will be reversed)
-	gD3DContext->RSSetState(gCullFrontState);
+	if (!gRenderGraph->Compile())  return false;
 
-	// Target the reflection texture for rendering and clear depth buffer
-	gD3DContext->OMSetRenderTargets(1, &gReflectionRenderTarget, gDepthStencil);
-	gD3DContext->ClearRenderTargetView(gReflectionRenderTarget, &gBackgroundColor.r);
-	gD3DContext->ClearDepthStencilView(gDepthStencil, D3D11_CLEAR_DEPTH, 1.0f, 0);
+	// Fall back to rendering the passes in turn if command lists can't be recorded
+	if (!gRenderGraph->Execute(gParallelPasses ? gCommandRecorder : nullptr))  gParallelPasses = false;
+	return true;
+}
 
-	// Note that water height map is still selected as a texture (from the previous step) and will be used here to tell what is above the water
 
-	////// Render lit models
+// Build the occlusion culling depth of the passes just rendered, the main pass and each water group's refraction and reflection,
+// for the frames to come to cull against (see gOcclusionCulling). Returns false if the textures couldn't be created
+bool BuildOcclusionPyramids()
+{
+	if (!OcclusionCullingActive())
+	{
+		gMainHiZ->Reset();
+		for (auto& set : gWaterTextureSets)
+		{
+			set.refractionHiZ.Reset();
+			set.reflectionHiZ.Reset();
+		}
+		return true;
+	}
 
-	// Select shaders for reflection rendering of lit models
-	gD3DContext->VSSetShader(gPixelLightingVertexShader, nullptr, 0);
-	gD3DContext->PSSetShader(gReflectedPixelLightingPixelShader, nullptr, 0);
-	
-	RenderLitModels();
+	gGpuProfiler->BeginPass(GpuPass::Occlusion);
+	GpuEventScope event("Hi-Z");
 
-	////// Render sky and lights
+	// The depth buffers are read, so can't still be bound
+	SetRenderTargets(0, nullptr, nullptr);
 
-	// Select shaders for reflection rendering of non-lit models
-	gD3DContext->VSSetShader(gBasicTransformWorldPosVertexShader, nullptr, 0);
-	gD3DContext->PSSetShader(gReflectedTintedTexturePixelShader, nullptr, 0);
-	
-	RenderOtherModels();
+	bool built = gMainHiZ->Build(gDepthShaderView, MainRenderWidth(), MainRenderHeight(), gCamera->ViewProjectionMatrix());
+	for (auto& set : gWaterTextureSets)
+	{
+		if (!set.inUse)  continue;
+		if (set.renderRefraction)
+		{
+			built = built && set.refractionHiZ.Build(set.refractionDepthSRV, WaterRenderWidth(), WaterRenderHeight(),
+			                                         set.refractionHistory.viewProjectionMatrix);
+		}
+		if (set.renderReflection)
+		{
+			Camera reflectedCamera = *gCamera;
+			ReflectCamera(&reflectedCamera, set.height);
+			built = built && set.reflectionHiZ.Build(set.reflectionDepthSRV, WaterRenderWidth(), WaterRenderHeight(),
+			                                         reflectedCamera.ViewProjectionMatrix());
+		}
+	}
 
-	// Restore original camera and culling state
-	camera->WorldMatrix() = originalMatrix;
-	SelectCamera(camera);
-	gD3DContext->RSSetState(gCullBackState);
+	gGpuProfiler->EndPass(GpuPass::Occlusion);
+	return built;
+}
 
-	// Detach the water height map from being a source texture so it can be used as a render target again next frame (if you don't do this DX emits lots of warnings)
-	ID3D11ShaderResourceView* gNullSRV = nullptr;
-	gD3DContext->PSSetShaderResources(2, 1, &gNullSRV);
 
+// Exposure, bloom and tonemapping from the HDR scene texture into the back buffer, into the view's columns starting from
+// the given one (see gSplitScreen). The exposure adapts once a frame, to the main camera's view
+static void PostProcessView(int left, bool mainView)
+{
+	gGpuProfiler->BeginPass(GpuPass::PostProcess);
+	BeginGpuEvent("Post-Process");
+	if (!gPostProcess->Render(gBackBufferRenderTarget, { static_cast<float>(MainRenderWidth())  / gViewportWidth,
+	                                                     static_cast<float>(MainRenderHeight()) / gViewportHeight }, left, ViewWidth(),
+	                          mainView))
+	{
+		PostQuitMessage(0); // Have lost the post-processing textures, can't continue
+	}
+	EndGpuEvent();
+	gGpuProfiler->EndPass(GpuPass::PostProcess);
+}
 
-	//***************************
-	// Render main scene
-	//***************************
-	
-	// Finally target the back buffer for rendering, clear depth buffer
-	gD3DContext->OMSetRenderTargets(1, &gBackBufferRenderTarget, gDepthStencil);
-	gD3DContext->ClearDepthStencilView(gDepthStencil, D3D11_CLEAR_DEPTH, 1.0f, 0);
 
-	////// Render lit models
+// Render the observer camera's view of a split screen into the right half of the back buffer, after the main camera's view
+// is post-processed into the left half (see gSplitScreen). Everything RenderFrame did for the frame before rendering the main
+// camera is kept, only what depends on the camera is chosen again: its per-frame constants, the portal cells it can see and
+// the groups of water in its view. Whether the main camera is under the water is put back after, for the window title
+// Its passes are timed in the GPU profiler's second view, so the main camera's times aren't overwritten
+static void RenderObserverView()
+{
+	GpuEventScope event("Observer View");
+	gGpuProfiler->SetView(1);
+	bool cameraUnderwater = gCameraUnderwater;
 
-	// Select shaders for ordinary rendering of lit models
-	gD3DContext->VSSetShader(gPixelLightingVertexShader, nullptr, 0);
-	gD3DContext->PSSetShader(gPixelLightingPixelShader, nullptr, 0);
-	RenderLitModels();
+	WaterBody* cameraWater = CameraWaterBody(gObserverCamera);
+	gCameraUnderwater = gObserverCamera->Position().y < cameraWater->Height();
+	gFrameConstants.cameraPosition   = gObserverCamera->Position();
+	gFrameConstants.cameraUnderwater = gCameraUnderwater ? 1.0f : 0.0f;
+	gFrameConstants.waterCheckerboardDistance = WaterCheckerboardActive() ? WaterCheckerboardDistance : FLT_MAX;
 
+	if (gPortalMap != nullptr)  gPortalMap->FindVisibleCells(gObserverCamera->Position(), gObserverCamera->ViewFrustum());
+	GroupWaterBodies(gObserverCamera);
 
-	////// Render water surface - combining reflection and refraction
-	// Render water before transparent objects or it will draw over them
+	if (!RenderSceneFromCamera(gObserverCamera, false))  PostQuitMessage(0);
+	PostProcessView(gViewportWidth - ViewWidth(), false);
 
-	// Select the reflection and refraction textures (rendered in the previous steps)
-	gD3DContext->PSSetShaderResources(3, 1, &gRefractionSRV); // First parameter must match texture slot number in the shader
-	gD3DContext->PSSetShaderResources(4, 1, &gReflectionSRV);
+	gCameraUnderwater = cameraUnderwater;
+	gGpuProfiler->SetView(0);
+}
 
-	gD3DContext->VSSetShader(gWaterSurfaceVertexShader, nullptr, 0);
-	gD3DContext->PSSetShader(gWaterSurfacePixelShader, nullptr, 0);
-	gWater->Render();
 
-	// Detach the reflection/refraction maps from being source textures so they can be used as a render target again next frame (if you don't do this DX emits lots of warnings)
-	gD3DContext->PSSetShaderResources(3, 1, &gNullSRV);
-	gD3DContext->PSSetShaderResources(4, 1, &gNullSRV);
+// Render one frame of the scene, presented unless it is a warm-up frame (see WarmUpPipelines)
+static void RenderFrame(bool present)
+{
+	CpuProfileScope profile(present ? "Render Scene" : "Warm-up Frame");
+	AllocationScope allocations; // This thread's allocations and those of the jobs it starts (see gRenderAllocations)
 
+	// Capture this frame with RenderDoc when asked to, from the start of the frame until it has been presented
+	bool captureFrame = present && (gCaptureFrame || IsBenchmarkCaptureFrame());
+	if (present)  gCaptureFrame = false;
+	if (captureFrame)  BeginGpuCapture();
 
-	////// Render sky and lights
+	// The state cache skips setting things that are already set. Start each frame from a clean slate in case anything outside
+	// the cache has changed the state (see StateCache.h)
+	ResetStateCache();
+	ResetStateCacheStats();
+	gModelsRendered = gModelsCulled = gImpostorsRendered = 0;
 
-	// Select shaders for ordinary rendering of non-lit models
-	gD3DContext->VSSetShader(gBasicTransformVertexShader, nullptr, 0);
-	gD3DContext->PSSetShader(gTintedTexturePixelShader, nullptr, 0);
-	RenderOtherModels();
-}
+	// Hand over the data that has arrived from the GPU since last frame (the ocean heights, occlusion culling depth etc.),
+	// before any pass that uses it has started (see GpuReadback.h)
+	gGpuReadback->Update();
 
+	// Copy the next part of the data on its way to the GPU, e.g. the mip-maps of streamed textures (see GpuUploader.h)
+	gGpuUploader->Update();
+
+	gGpuProfiler->BeginFrame();
+	if (!gOverdrawView->BeginFrame(gViewportWidth, gViewportHeight))  PostQuitMessage(0);
 
-// Rendering the scene
-void RenderScene()
-{
 	//// Common settings ////
 
-	// Set up the light information in the constant buffer
-	// Don't send to the GPU yet, the function RenderSceneFromCamera will do that
-	gPerFrameConstants.light1Colour   = gLights[0].colour * gLights[0].strength;
-	gPerFrameConstants.light1Position = gLights[0].model->Position();
-	gPerFrameConstants.light2Colour   = gLights[1].colour * gLights[1].strength;
-	gPerFrameConstants.light2Position = gLights[1].model->Position();
+	// Send the lights and the lists of lights in each cell of the light grid to the GPU, and put what the shaders need to find
+	// a pixel's cell in the constant buffer. Don't send that to the GPU yet, the function RenderSceneFromCamera will do that
+	// Each light has a flare in the instanced draw of each pass (see RenderOtherModels), or in the main pass a one-frame
+	// particle with particle flares (see gParticleFlares)
+	const int numLights = gDockLamps ? NUM_LIGHTS : 2;
+	gLightGrid->ClearLights();
+	gLightInstances->ClearInstances();
+	for (int i = 0; i < numLights; ++i)
+	{
+		gLightGrid->AddLight(gLights[i].model->Position(), gLights[i].colour * gLights[i].strength, gLights[i].range, i == 1);
+		gLightInstances->AddInstance(gLights[i].model, gLights[i].colour * LightFlareBrightness);
+		if (gParticlesEnabled && gParticleFlares)
+		{
+			EmitFlareParticle(gLights[i].model->Position(), gLightMesh->DefaultBounds().radius * gLights[i].model->Scale().x,
+			                  gLights[i].colour * LightFlareBrightness);
+		}
+	}
+	for (auto& light : gStressLights)
+	{
+		gLightGrid->AddLight(light.position, light.colour * light.strength, light.range);
+		gLightInstances->AddInstance(MatrixScaling(std::sqrt(light.strength)) * MatrixTranslation(light.position),
+		                             light.colour * LightFlareBrightness);
+		if (gParticlesEnabled && gParticleFlares)
+		{
+			EmitFlareParticle(light.position, gLightMesh->DefaultBounds().radius * std::sqrt(light.strength),
+			                  light.colour * LightFlareBrightness);
+		}
+	}
+	gLightGrid->Update();
+	if (gGpuInstanceCulling)  gLightInstances->UploadInstances();
+	gPerFrameConstants.lightGridMin   = gLightGrid->MinCorner();
+	gPerFrameConstants.lightGridScale = gLightGrid->CellsPerUnit();
+	gPerFrameConstants.lightGridSize  = gLightGrid->NumCells();
 
 	gPerFrameConstants.ambientColour  = gAmbientColour;
 	gPerFrameConstants.specularPower  = gSpecularPower;
 	gPerFrameConstants.cameraPosition = gCamera->Position();
 
-	gPerFrameConstants.viewportWidth  = static_cast<float>(gViewportWidth);
-	gPerFrameConstants.viewportHeight = static_cast<float>(gViewportHeight);
+	// The size of the main pass rendered to this frame, which is less than the viewport with dynamic resolution
+	gPerFrameConstants.viewportWidth  = static_cast<float>(MainRenderWidth());
+	gPerFrameConstants.viewportHeight = static_cast<float>(MainRenderHeight());
+	gPerFrameConstants.waterTextureScale = gWaterTextureScale;
+	gPerFrameConstants.sceneUVScale      = { static_cast<float>(MainRenderWidth())  / gViewportWidth,
+	                                         static_cast<float>(MainRenderHeight()) / gViewportHeight };
+	gPerFrameConstants.waterViewportSize = { static_cast<float>(WaterRenderWidth()), static_cast<float>(WaterRenderHeight()) };
+
+	gPerFrameConstants.oceanEnabled   = gOceanEnabled ? 1.0f : 0.0f;
+	gPerFrameConstants.oceanPatchSize = gOcean->PatchSize();
+
+	// Planar reflection everywhere, near the camera only, or nowhere (see ReflectionMode)
+	gPerFrameConstants.planarReflectionDistance = gReflectionMode == ReflectionMode::Planar ? FLT_MAX :
+	                                              gReflectionMode == ReflectionMode::Hybrid ? HybridReflectionDistance : 0.0f;
+	gPerFrameConstants.screenSpaceReflections   = gReflectionMode == ReflectionMode::ScreenSpace ? 1.0f : 0.0f;
+	gPerFrameConstants.screenSpaceRefraction    = gScreenSpaceRefraction ? 1.0f : 0.0f;
+	gPerFrameConstants.waterLodDistance         = gWaterShadingLod ? WaterShadingLodDistance : FLT_MAX;
+
+	// Whether the camera is under the water it is over or in
+	WaterBody* cameraWater = CameraWaterBody(gCamera);
+	gCameraUnderwater = gCamera->Position().y < cameraWater->Height();
+	gPerFrameConstants.cameraUnderwater = gCameraUnderwater ? 1.0f : 0.0f;
+	gPerFrameConstants.waterCheckerboardDistance = WaterCheckerboardActive() ? WaterCheckerboardDistance : FLT_MAX;
+
+	// The cells the camera can see, for culling the main pass and the water (see PortalMap.h)
+	if (gPortalMap != nullptr)  gPortalMap->FindVisibleCells(gCamera->Position(), gCamera->ViewFrustum());
+
+	// Group the water in view by height and choose which of the refraction and reflection to render for each group this frame
+	GroupWaterBodies(gCamera);
+
+	// Choose the environment map faces to capture this frame, from the water under the camera. It is also seen through the
+	// surface from under the water
+	if (gReflectionMode != ReflectionMode::Planar || gCameraUnderwater)
+	{
+		gEnvironmentMap->Update({ gCamera->Position().x, gWaterBodies[0]->Height(), gCamera->Position().z });
+	}
+
+	// Fit the shadow cascades around the camera's view and choose the ones to render this frame. The key light is far enough
+	// away to shine in one direction across the scene, for the shadows and the caustics. Shadows are cast by everything in the
+	// light grid's box, which holds the ground and the models on it
+	const BoundingBox& terrainBounds = gTerrain->Bounds();
+	BoundingBox casterBounds = { terrainBounds.min, { terrainBounds.max.x, (std::max)(terrainBounds.max.y, gWaterBodies[0]->Height()) + 50,
+	                                                   terrainBounds.max.z } };
+	CVector3 keyLightDirection = (casterBounds.min + casterBounds.max) * 0.5f - gLights[1].model->Position();
+	if (gShadows)
+	{
+		gShadowMap->Update(gCamera, keyLightDirection, casterBounds);
+		gShadowMap->SetShaderConstants(gPerFrameConstants);
+	}
+	else
+	{
+		gPerFrameConstants.numShadowCascades = 0;
+	}
+	gCaustics->SetShaderConstants(gPerFrameConstants, gCausticsEnabled ? 1.0f : 0.0f);
+
+	// The passes start from a copy of these, they may be recorded on other threads (see BeginScenePass)
+	ClearWaterClipPlane();
+	gFrameConstants = gPerFrameConstants;
+	SetViewConstants(gFrameViewConstants, gCamera);
+
+	// Send the water settings to the GPU the first frame and whenever they change
+	static WaterConstants sentWaterConstants;
+	static bool           waterConstantsSent = false;
+	if (!waterConstantsSent || memcmp(&sentWaterConstants, &gWaterConstants, sizeof(WaterConstants)) != 0)
+	{
+		UpdateConstantBuffer(gWaterConstantBuffer, gWaterConstants);
+		sentWaterConstants = gWaterConstants;
+		waterConstantsSent = true;
+	}
+
+	// Switch to any streamed textures that have loaded and start loading the ones the last frame needed. The passes use
+	// them on other threads, so this is the only place they can change
+	gTextureStreamer->Update();
+
+	// Same for shaders recompiled by hot reload (see Shader.cpp)
+	UpdateShaders();
+
+	// Bring the models' cached world matrices up to date here, as the passes may all draw them at once on other threads. Each
+	// model is separate so the matrices are calculated across the thread pool (see JobSystem.h), a few models to a job. Then
+	// only the main thread can upload the bone matrices of skinned models
+	gJobSystem->ParallelFor(static_cast<int>(gSceneModels.size()), 4, [](int i) { gSceneModels[i]->UpdateAbsoluteMatrices(); });
+	for (Model* model : gSceneModels)  model->UpdateMatrices();
+	gSceneObjects->UpdateBounds();
+
+
+	////--------------- Ocean simulation ---------------////
+
+	// Update the ocean textures with compute shaders before any rendering uses them
+	if (gOceanEnabled)
+	{
+		gGpuProfiler->BeginPass(GpuPass::OceanSimulation);
+		GpuEventScope event("Ocean Simulation");
+		gOcean->Simulate(gOceanTime);
+		gGpuProfiler->EndPass(GpuPass::OceanSimulation);
+
+		// Copy the waves towards the CPU for the simulation to float things on (see WaterHeights.h)
+		if (!gWaterHeights->Update(gOcean->DisplacementTexture(), gOcean->PatchSize()))  PostQuitMessage(0);
+	}
+	else
+	{
+		// Or combine the layers of the wave normal/height map, so the water shaders sample them once
+		gGpuProfiler->BeginPass(GpuPass::WaveComposite);
+		GpuEventScope event("Wave Composite");
+		gWaveComposite->Generate(gWaterNormalMapSRV, gWaterWaveHeightMapSRV, gPerFrameConstants.waterMovement, gRenderSettings.waveLayers);
+		gGpuProfiler->EndPass(GpuPass::WaveComposite);
+	}
+
+	// Then the caustics from the waves, lit by the key light from the same direction as the shadows
+	if (gCausticsEnabled)
+	{
+		gGpuProfiler->BeginPass(GpuPass::Caustics);
+		GpuEventScope event("Caustics");
+		gCaustics->Generate(keyLightDirection, gOceanEnabled ? gOcean->NormalFoamSRV() : gWaterNormalMapSRV,
+		                    gOceanEnabled ? gOcean->PatchSize() : 0, gPerFrameConstants.waveScale, gPerFrameConstants.waterMovement);
+		gGpuProfiler->EndPass(GpuPass::Caustics);
+	}
+
+	// And the ripples from the scene objects moving through the water the camera is over, each as its bounding sphere. The
+	// ground is left out, it never moves but its sphere reaches everywhere. The ripples follow the camera, so their constants
+	// are only known now and are set in the copy the passes start from
+	if (gRipplesEnabled)
+	{
+		gGpuProfiler->BeginPass(GpuPass::Ripples);
+		GpuEventScope event("Ripples");
+		for (int object = 0; object < gSceneObjects->NumObjects(); ++object)
+		{
+			const BoundingSphere& bounds = gSceneObjects->Bounds(object);
+			if (object != gGroundObject)  gRipples->AddInteractor(object, bounds.centre, bounds.radius);
+		}
+		gRipples->Simulate(gOceanTime, gCamera->Position(), cameraWater->Height());
+		gGpuProfiler->EndPass(GpuPass::Ripples);
+	}
+	gRipples->SetShaderConstants(gFrameConstants, gRipplesEnabled ? 1.0f : 0.0f);
+
+	// Then the particles, moved on by the ocean time since the last update and sorted for the main camera. The ocean time
+	// stands still when the simulation is paused, and so do the particles
+	float particleFrameTime = (std::min)(std::max(gOceanTime - gParticleTime, 0.0f), 0.1f);
+	gParticleTime = gOceanTime;
+	if (gParticlesEnabled)
+	{
+		gGpuProfiler->BeginPass(GpuPass::Particles);
+		GpuEventScope event("Particles");
+		EmitWaterParticles(cameraWater, particleFrameTime);
+		gParticles->Update(particleFrameTime, gCamera->Position(), cameraWater, gWaterConstants.shoreFoamDepth);
+		gGpuProfiler->EndPass(GpuPass::Particles);
+	}
+
+	// Then the water grid moved by the waves and ripples, for every pass that draws it
+	gWaterVerticesCached = gCacheWaterVertices && gWaterGeometry == WaterGeometry::Grid;
+	if (gWaterVerticesCached)
+	{
+		GpuEventScope event("Water Vertices");
+		if (!gWaterVertexCache->Update(gWaterMesh, gWater->WorldMatrix(), gFrameConstants,
+		                               gWaveComposite->SRV(), gOcean->DisplacementSRV(), gRipples->SRV()))  PostQuitMessage(0);
+	}
 
 
 	////--------------- Main scene rendering ---------------////
 
-	// Setup the viewport to the size of the main window
-	D3D11_VIEWPORT vp;
-	vp.Width = static_cast<FLOAT>(gViewportWidth);
-	vp.Height = static_cast<FLOAT>(gViewportHeight);
-	vp.MinDepth = 0.0f;
-	vp.MaxDepth = 1.0f;
-	vp.TopLeftX = 0;
-	vp.TopLeftY = 0;
-	gD3DContext->RSSetViewports(1, &vp);
+	// Render the scene from the main camera (viewports are set for each pass)
+	if (!RenderSceneFromCamera(gCamera))  PostQuitMessage(0); // Have lost the water depth buffers, can't continue
+
+	// Then the occlusion culling depth of what was just rendered, for the frames to come
+	if (!BuildOcclusionPyramids())  PostQuitMessage(0);
+
+
+	////--------------- Post-processing ---------------////
 
-	// Render the scene from the main camera
-	RenderSceneFromCamera(gCamera);
+	// Exposure, bloom and tonemapping from the HDR scene texture into the back buffer, or its left half in split screen
+	PostProcessView(0, true);
+
+	// Then the observer's view into the right half, which reuses the scene textures
+	if (gSplitScreen)  RenderObserverView();
+
+	// Unbind the ocean, caustics, ripple textures and cached water vertices, the compute shaders write to them next frame
+	const unsigned int oceanStages = VertexShaderStage | DomainShaderStage | PixelShaderStage;
+	SetShaderResource(7, nullptr, oceanStages);
+	SetShaderResource(8, nullptr, oceanStages);
+	SetShaderResource(20, nullptr);
+	SetShaderResource(21, nullptr, oceanStages);
+	SetShaderResource(24, nullptr, VertexShaderStage);
 
 
 	////--------------- Scene completion ---------------////
@@ -701,10 +3438,96 @@ void RenderScene()
 	//gD3DContext->CopyResource( gBackBufferTexture, gRefraction );
 	//gD3DContext->CopyResource( gBackBufferTexture, gReflection );
 
+	// Or see the overdraw or quad efficiency of the passes as a heatmap in place of the image (see OverdrawView.h)
+	gOverdrawView->Render(gBackBufferRenderTarget, gViewportWidth, gViewportHeight);
+
+
+	////--------------- Stats overlay ---------------////
+
+	// Drawn over the finished image, with the state cache stats of the frame so far
+	if (gShowStats)
+	{
+		GpuEventScope event("Stats Overlay");
+		gStatsOverlay->Render(gBackBufferRenderTarget, gViewportWidth, gViewportHeight, GetStateCacheStats(), gRenderAllocations);
+	}
+
+
+	gGpuProfiler->EndFrame();
+	gRenderTargetPool->EndFrame(); // Every pooled texture has been given back by now
+	if (!present)  return;
+
+	// Benchmark runs can save every few frames to compare with another build's (see FrameCapture.h). Copied back on the GPU,
+	// so this frame doesn't wait for it
+	if (gFrameCapture != nullptr)  gFrameCapture->Capture(gBackBufferTexture, BenchmarkFrameNumber());
 
 	// When drawing to the off-screen back buffer is complete, we "present" the image to the front buffer (the screen)
-	// Set first parameter to 1 to lock to vsync
-	gSwapChain->Present(lockFPS ? 1 : 0, 0);
+	// Lock to vsync if lockFPS is set
+	{
+		CpuProfileScope presentProfile("Present");
+		PresentFrame(lockFPS);
+	}
+	if (captureFrame)  EndGpuCapture();
+
+	gRenderAllocations = allocations.Count();
+	gRenderStateStats = GetStateCacheStats();
+}
+
+
+// Draw the frame once, without presenting, for each option that changes the shaders, states and render targets the passes
+// use, set the other way from how it is, then put the options back. A driver may only finish compiling a shader when it is
+// first drawn with a particular set of states and target formats, which would hitch the first frame that uses it, e.g. the
+// first after pressing a key that changes the water geometry. Drawing the real passes covers exactly the combinations they
+// use, which a separate list of tiny draws would have to be kept in step with. Usually a few hundred milliseconds in all
+static void WarmUpPipelines()
+{
+	CpuProfileScope profile("Warm Up Pipelines");
+
+	bool* const switches[] = { &gWaterViews, &gHardwareWaterClip, &gDepthPrepass, &gWaterCheckerboard, &gScreenSpaceRefraction,
+	                           &gTemporalWaterTextures, &gOceanEnabled, &gGpuInstanceCulling };
+	for (bool* option : switches)
+	{
+		*option = !*option;
+		RenderFrame(false);
+		*option = !*option;
+	}
+
+	WaterGeometry waterGeometry = gWaterGeometry;
+	for (WaterGeometry geometry : { WaterGeometry::Grid, WaterGeometry::Clipmap, WaterGeometry::Tessellated })
+	{
+		if (geometry == waterGeometry)  continue;
+		gWaterGeometry = geometry;
+		RenderFrame(false);
+	}
+	gWaterGeometry = waterGeometry;
+
+	ReflectionMode reflectionMode = gReflectionMode;
+	for (ReflectionMode mode : { ReflectionMode::Planar, ReflectionMode::Hybrid, ReflectionMode::Environment, ReflectionMode::ScreenSpace })
+	{
+		if (mode == reflectionMode)  continue;
+		gReflectionMode = mode;
+		RenderFrame(false);
+	}
+	gReflectionMode = reflectionMode;
+
+	// And from under the water, or above it if the camera is already under, for the underwater fog and the surface seen from
+	// below. The simulation has its own copy of the camera, so this one can be moved for a frame
+	CMatrix4x4 cameraMatrix = gCamera->WorldMatrix();
+	float waterHeight = CameraWaterBody(gCamera)->Height();
+	gCamera->Position().y = gCamera->Position().y < waterHeight ? waterHeight + 5 : waterHeight - 5;
+	RenderFrame(false);
+	gCamera->WorldMatrix() = cameraMatrix;
+}
+
+
+// Rendering the scene. The first frame, and the first after the main targets are recreated, warms up the pipelines first
+void RenderScene()
+{
+	if (!gPipelinesWarm)
+	{
+		gPipelinesWarm = true;
+		WarmUpPipelines();
+	}
+	RenderFrame(true);
 }
 
 
@@ -713,43 +3536,634 @@ void RenderScene()
 // Scene Update
 //--------------------------------------------------------------------------------------
 
-// Update models and camera. frameTime is the time passed since the last frame
+// The scene is updated in two parts. The moving parts - the camera, troll, orbiting light, water height and waves - are
+// simulated in fixed steps as a job on the thread pool (see JobSystem.h), from their own copy of the scene, while the frame
+// before is rendered on the main thread. Everything else, the keys that change settings or recreate resources and the choices made around the camera
+// (water and terrain tiles), stays on the main thread in UpdateScene, where nothing is being rendered. The next frame shows
+// what the simulation job finished, so the simulation and the rendering overlap rather than taking turns. Press F2 to run
+// the simulation on the main thread instead, before rendering, to compare
+bool gParallelUpdate = true;
+
+// Low latency mode, toggled with F1. The frame is presented on a thread of its own (see SetPresentThread), so the main thread
+// never blocks in Present, and after waiting for the swap chain it reads the keys that arrived while it waited (LatchInput).
+// Then the camera shown is moved on from the simulated one by those keys (see UpdateScene), so the view constants are built
+// from input read just before the frame is submitted rather than a frame earlier when the simulation started
+bool gLowLatency = false;
+
+// The parts of the scene that move over time, as they were at the end of a step. Frames rendered between steps show a blend
+// of the last two
+struct SceneState
+{
+	CMatrix4x4 camera;
+	CMatrix4x4 troll;
+	CMatrix4x4 light; // The orbiting light
+	float      waterHeight;
+	float      waveScale;
+	CVector2   waterMovement;
+	float      oceanTime;
+
+	std::vector<CMatrix4x4> floating; // Each of gFloatingModels, as the buoyancy simulation left them
+};
+
+// A simulated frame: the last two steps and how far the frame's time is between them, 0 for the step before last and 1 for
+// the latest
+struct SceneUpdate
+{
+	SceneState previous;
+	SceneState latest;
+	float      blend;
+};
+
+// Double-buffered - the frame being rendered shows one update while the simulation job writes the other for the next frame.
+// They change over in FinishSceneUpdate, once the job has finished
+SceneUpdate gSceneUpdates[2];
+int         gShownUpdate = 0;
+
+// The models floating on the water, each a body of the simulation's buoyancy (see Buoyancy.h)
+std::vector<Model*> gFloatingModels;
+
+namespace
+{
+	// The simulation's own copy of the moving parts, carried on from step to step. Only the thread running the simulation uses
+	// these, so the scene being rendered is never changed under it
+	Camera      gSimCamera;
+	SceneState  gSimState;
+	SceneState  gSimPreviousState;
+	float       gSimTime = 0;        // Time passed that hasn't been simulated yet, less than UpdateTimeStep after a frame
+	float       gLightRotate = 0;
+	bool        gLightOrbiting = true;
+	float       gPathTime = 0;       // Time along the benchmark path being played or recorded
+	float       gNextPathKey = 0;
+	std::string gPathSaveError;      // Set when a recorded path can't be saved, shown by the main thread (see UpdateScene)
+
+	JobCounter  gSimulation;         // Counts the simulation job while it runs
+	float       gSimFrameTime = 0;   // The time the job moves the scene on by
+	bool        gSimOceanEnabled = true; // Copy of gOceanEnabled, which the keys change while the job runs
+	int         gSimWaveLayers = 4;      // Copy of the wave layers render setting, which can change while the job runs
+	Buoyancy    gSimBuoyancy;        // The floating models
+
+
+	// Move the simulated scene on by one step of the given length in seconds. Only reads the keys held, and keys no other code
+	// uses (0 and B), so it is safe on another thread while the main thread renders
+	void SimulateStep(SceneState& state, float stepTime)
+	{
+		// Orbit one light
+		state.light.SetRow(3, { 40 + cos(gLightRotate) * gLightOrbitRadius, 20, -40 + sin(gLightRotate) * gLightOrbitRadius });
+		if (gLightOrbiting)  gLightRotate -= gLightOrbitSpeed * stepTime;
+		if (KeyHit(Key_0))  gLightOrbiting = !gLightOrbiting;
+
+		// In benchmark mode the camera, troll and water height follow a path instead of the keys (see Benchmark.h)
+		gPathTime += stepTime;
+		if (gBenchmark.enabled)
+		{
+			BenchmarkKey key = BenchmarkPathKey(gPathTime);
+			gSimCamera.Position() = key.cameraPosition;
+			gSimCamera.SetRotation(key.cameraRotation);
+			CVector3 trollScale = { Length(state.troll.GetRow(0)), Length(state.troll.GetRow(1)), Length(state.troll.GetRow(2)) };
+			state.troll = MatrixScaling(trollScale) * MatrixRotationY(key.trollRotation) * MatrixTranslation(key.trollPosition);
+			state.waterHeight = key.waterHeight;
+		}
+		else
+		{
+			// Control of camera & troll
+			gSimCamera.Control(stepTime, Key_Up, Key_Down, Key_Left, Key_Right, Key_W, Key_S, Key_A, Key_D);
+			Model::ControlMatrix(state.troll, stepTime, Key_None, Key_None, Key_J, Key_L, Key_None, Key_None, Key_I, Key_K);
+
+			// Control the height of the open water
+			if (KeyHeld(Key_Period))  state.waterHeight += 5.0f * stepTime;
+			if (KeyHeld(Key_Comma ))  state.waterHeight -= 5.0f * stepTime;
+
+			// Record a path for benchmark mode, press B to start and again to stop and save it. A key every quarter second
+			// is plenty, the path is smoothly interpolated between them when played back
+			const float pathKeyTime = 0.25f;
+			if (KeyHit(Key_B))
+			{
+				if (!IsRecordingPath())
+				{
+					StartPathRecording();
+					gPathTime = gNextPathKey = 0;
+				}
+				else if (!StopPathRecording(L"benchmark_path.txt"))
+				{
+					gPathSaveError = gLastError;
+				}
+			}
+			if (IsRecordingPath() && gPathTime >= gNextPathKey)
+			{
+				RecordPathKey({ gPathTime, gSimCamera.Position(), gSimCamera.Rotation(), state.troll.GetRow(3),
+				                state.troll.GetEulerAngles().y, state.waterHeight });
+				gNextPathKey += pathKeyTime;
+			}
+		}
+
+		// Keep the camera above the ground. The terrain heights never change, so can be read while the terrain is rendered
+		if (gTerrainEnabled)
+		{
+			CVector3& cameraPosition = gSimCamera.Position();
+			cameraPosition.y = (std::max)(cameraPosition.y, gTerrain->Height(cameraPosition.x, cameraPosition.z) + CameraGroundClearance);
+		}
+		state.camera = gSimCamera.WorldMatrix();
+
+		// Control wave height
+		if (KeyHeld(Key_Plus ))  state.waveScale += 0.5f * stepTime;
+		if (KeyHeld(Key_Minus))  state.waveScale -= 0.5f * stepTime;
+		if (state.waveScale < 0)  state.waveScale = 0;
+
+		// Move water
+		const float waterSpeed = 1.0f;
+		state.waterMovement += stepTime * waterSpeed * CVector2(0.01f, 0.015f);
+		state.oceanTime += stepTime;
+
+		// Float things on the open water
+		gSimBuoyancy.Step(stepTime, { state.waveScale, state.waterMovement, gSimOceanEnabled, gSimWaveLayers }, state.waterHeight, state.floating.data());
+	}
+
+	// Simulate the scene for a frame into the update not being shown. Runs as many steps as are needed to catch up with the
+	// time passed, up to MaxUpdatesPerFrame except in benchmark mode (see Scene.h)
+	void SimulateScene(float frameTime)
+	{
+		CpuProfileScope profile("Simulate Scene");
+
+		gSimTime += frameTime;
+		int numSteps = 0;
+		while (gSimTime >= UpdateTimeStep && (numSteps < MaxUpdatesPerFrame || gBenchmark.enabled))
+		{
+			gSimPreviousState = gSimState;
+			SimulateStep(gSimState, UpdateTimeStep);
+			gSimTime -= UpdateTimeStep;
+			++numSteps;
+		}
+		if (gSimTime >= UpdateTimeStep)  gSimTime = 0; // Too far behind to catch up, the scene slows down instead
+		// Copied member by member, so the floating models' matrices reuse the update's memory
+		SceneUpdate& update = gSceneUpdates[1 - gShownUpdate];
+		update.previous = gSimPreviousState;
+		update.latest   = gSimState;
+		update.blend    = gSimTime / UpdateTimeStep;
+	}
+
+	void SimulationJob(void* /*data*/, int /*index*/)
+	{
+		SimulateScene(gSimFrameTime);
+	}
+}
+
+
+// Start the simulation from the scene as it was set up in InitScene, with nothing to blend
+void InitSceneUpdates()
+{
+	gSimCamera = *gCamera;
+	gSimOceanEnabled = gOceanEnabled;
+	gSimWaveLayers = gRenderSettings.waveLayers;
+	gSimState = { gCamera->WorldMatrix(), gTroll->WorldMatrix(), gLights[0].model->WorldMatrix(), gWaterBodies[0]->Height(),
+	              0.6f, { 0, 0 }, 0 };
+
+	// The crate floats, as the box of CargoContainer.x (whose origin is in the middle of its base)
+	gFloatingModels = { gCrate };
+	gSimBuoyancy.Clear();
+	gSimBuoyancy.Add(gCrate->WorldMatrix(), { -1.15f, 0, -3 }, { 1.15f, 2.65f, 3 });
+	for (Model* model : gFloatingModels)  gSimState.floating.push_back(model->WorldMatrix());
+
+	gSimPreviousState = gSimState;
+	gSimTime = 0;
+	gSceneUpdates[0] = gSceneUpdates[1] = { gSimState, gSimState, 1 };
+	gShownUpdate = 0;
+}
+
+
+// Place the moving parts of the scene as given
+void SetSceneState(const SceneState& state)
+{
+	gCamera->WorldMatrix() = state.camera;
+	gTroll->SetWorldMatrix(state.troll);
+	gLights[0].model->SetWorldMatrix(state.light);
+	gPerFrameConstants.waterPlaneY = state.waterHeight;
+	gWaterBodies[0]->SetHeight(state.waterHeight);
+	gWater->SetPosition({ gWater->Position().x, state.waterHeight, gWater->Position().z });
+	gWaterCoarse->SetPosition(gWater->Position());
+	gPerFrameConstants.waveScale = state.waveScale;
+	gPerFrameConstants.waterMovement = state.waterMovement;
+	gOceanTime = state.oceanTime;
+	gPerFrameConstants.flowTime = state.oceanTime;
+}
+
+// Blend between two world matrices. The rows are blended then made at right angles again, keeping their blended lengths (the
+// scale). The matrices are only an update apart, so this is very close to blending the rotations properly
+CMatrix4x4 BlendWorldMatrices(const CMatrix4x4& from, const CMatrix4x4& to, float blend)
+{
+	CVector3 x = Lerp(from.GetRow(0), to.GetRow(0), blend);
+	CVector3 y = Lerp(from.GetRow(1), to.GetRow(1), blend);
+	CVector3 z = Lerp(from.GetRow(2), to.GetRow(2), blend);
+	CVector3 scale = { Length(x), Length(y), Length(z) };
+	z = Normalise(z);
+	x = Normalise(Cross(y, z));
+	y = Cross(z, x);
+
+	CMatrix4x4 blended = to;
+	blended.SetRow(0, x * scale.x);
+	blended.SetRow(1, y * scale.y);
+	blended.SetRow(2, z * scale.z);
+	blended.SetRow(3, Lerp(from.GetRow(3), to.GetRow(3), blend));
+	return blended;
+}
+
+
+// Start simulating the next frame as a job (see gParallelUpdate). frameTime is the time it moves the scene on by
+void StartSceneUpdate(float frameTime)
+{
+	gSimOceanEnabled = gOceanEnabled;
+	gSimWaveLayers = gRenderSettings.waveLayers;
+	if (!gParallelUpdate)
+	{
+		SimulateScene(frameTime);
+		return;
+	}
+	gSimFrameTime = frameTime;
+	gJobSystem->Run({ &SimulationJob, nullptr, 0 }, gSimulation);
+}
+
+// Wait for the simulation started by StartSceneUpdate, which the next frame will show. This thread runs other jobs while it
+// waits, which may be the simulation itself if no worker has started it
+void FinishSceneUpdate()
+{
+	{
+		CpuProfileScope profile("Wait For Update");
+		gJobSystem->Wait(gSimulation);
+	}
+	gShownUpdate = 1 - gShownUpdate;
+}
+
+// In low latency mode, handle the key messages that arrived while waiting for the swap chain (see gLowLatency). Only the keys,
+// other messages (resizing, closing) wait for the main loop as usual
+void LatchInput()
+{
+	if (!gLowLatency)  return;
+	MSG msg;
+	while (PeekMessage(&msg, nullptr, WM_KEYFIRST, WM_KEYLAST, PM_REMOVE))
+	{
+		TranslateMessage(&msg);
+		DispatchMessage(&msg);
+	}
+}
+
+
+// Put the meshes that have finished loading in the background (see InitGeometry) in place of their boxes: each model of a box
+// is replaced by a model of the mesh where the box was. Called during the update, when nothing is drawing the models and the
+// simulation doesn't use them. A mesh that failed to load keeps its box, and the error is shown
+void SwapStreamedMeshes()
+{
+	for (auto& streamed : gStreamedMeshes)
+	{
+		if (streamed->swapped || !streamed->counter.Done())  continue;
+		streamed->swapped = true;
+
+		Model* box = *streamed->model;
+		Model* model = nullptr;
+		std::string error = streamed->load.error;
+		if (error.empty())
+		{
+			try
+			{
+				model = new Model(streamed->load.result.get());
+			}
+			catch (std::runtime_error e)
+			{
+				error = e.what();
+			}
+		}
+		if (!error.empty())
+		{
+			MessageBoxA(gHWnd, error.c_str(), NULL, MB_OK);
+			continue;
+		}
+		model->SetWorldMatrix(box->WorldMatrix());
+
+		int object = gSceneObjects->Find(box);
+		gSceneObjects->Replace(object, model, streamed->load.result.get());
+
+		// Bake the mesh's impostor, for when it is far away. The mesh is still drawn if it can't be made
+		try
+		{
+			Impostor* impostor = new Impostor(streamed->load.result.get(), gSceneObjects->GetMaterial(object)); // See Impostor.cpp
+			gImpostors.push_back(impostor);
+			gSceneObjects->SetImpostor(object, impostor);
+		}
+		catch (std::runtime_error e)
+		{
+			MessageBoxA(gHWnd, e.what(), NULL, MB_OK);
+		}
+
+		std::replace(gSceneModels.begin(), gSceneModels.end(), box, model);
+		std::replace(gFloatingModels.begin(), gFloatingModels.end(), box, model);
+		delete box;
+		delete *streamed->mesh;
+		*streamed->model = model;
+		*streamed->mesh  = streamed->load.result.release();
+
+		if (streamed->animations != nullptr)
+		{
+			*streamed->animations = streamed->animationSet.release();
+			if ((*streamed->animations)->NumClips() > 0)
+			{
+				gAnimators.push_back(new Animator(*streamed->animations, model));
+				gAnimators.back()->Play(0, 0);
+			}
+		}
+	}
+}
+
+
+// Show the last simulated frame and deal with the keys that change settings. frameTime is the time passed since the last frame
 void UpdateScene(float frameTime)
 {
-	// Orbit one light - a bit of a cheat with the static variable [ask the tutor if you want to know what this is]
-	static float lightRotate = 0.0f;
-	static bool go = true;
-	gLights[0].model->SetPosition( {40 + cos(lightRotate) * gLightOrbitRadius, 20, -40 + sin(lightRotate) * gLightOrbitRadius} );
-	if (go)  lightRotate -= gLightOrbitSpeed * frameTime;
-	if (KeyHit(Key_0))  go = !go;
-
-	// Control of camera & troll
-	gCamera->Control(frameTime, Key_Up, Key_Down, Key_Left, Key_Right, Key_W, Key_S, Key_A, Key_D);
-	gTroll->Control(0, frameTime, Key_None, Key_None, Key_J, Key_L, Key_None, Key_None, Key_I, Key_K);
-
-
-	 // Control water height
-	gPerFrameConstants.waterPlaneY = gWater->Position().y;
-	if (KeyHeld(Key_Period))  gPerFrameConstants.waterPlaneY += 5.0f * frameTime;
-	if (KeyHeld(Key_Comma ))  gPerFrameConstants.waterPlaneY -= 5.0f * frameTime;
-	gWater->SetPosition({gWater->Position().x, gPerFrameConstants.waterPlaneY, gWater->Position().z});
-
-    // Control wave height
-	static float waveScale = 0.6f;
-	if (KeyHeld(Key_Plus ))  waveScale += 0.5f * frameTime;
-	if (KeyHeld(Key_Minus))  waveScale -= 0.5f * frameTime;
-	if (waveScale < 0)  waveScale = 0;
-	gPerFrameConstants.waveScale = waveScale;
-
-	// Move water
-	static CVector2 waterPos = {0, 0};
-	const float waterSpeed = 1.0f;
-	waterPos += frameTime * waterSpeed * CVector2(0.01f, 0.015f);
-	gPerFrameConstants.waterMovement = waterPos;
+	CpuProfileScope profile("Update Scene");
+
+	// The frame before has finished, time it and save a trace if it was a spike (see SpikeDetector.h). Before the scene moves
+	// on, so the trace has the scene state the frame was drawn with
+	gSpikeDetector->EndFrame({ gCamera->Position(), gPerFrameConstants.waterPlaneY, gPerFrameConstants.waveScale });
+
+	// Before the models are placed, so the models of meshes just loaded are placed too
+	SwapStreamedMeshes();
+
+	// Stream the chunks of the level in and out around the camera (see WorldStreamer.h). The benchmark waits for the loads, so
+	// every run has the same chunks in on the same frames
+	if (gWorldStreamer != nullptr && !gWorldStreamer->Update(gCamera->Position(), gBenchmark.enabled))
+	{
+		MessageBoxA(gHWnd, gLastError.c_str(), NULL, MB_OK);
+	}
+
+	// Place the moving parts between the last two steps simulated
+	const SceneUpdate& update = gSceneUpdates[gShownUpdate];
+	const SceneState& from = update.previous;
+	const SceneState& to   = update.latest;
+	float blend = update.blend;
+	SetSceneState({ BlendWorldMatrices(from.camera, to.camera, blend), BlendWorldMatrices(from.troll, to.troll, blend),
+	                BlendWorldMatrices(from.light, to.light, blend), Lerp(from.waterHeight, to.waterHeight, blend),
+	                Lerp(from.waveScale, to.waveScale, blend), Lerp(from.waterMovement, to.waterMovement, blend),
+	                Lerp(from.oceanTime, to.oceanTime, blend) });
+
+	// Late latch the camera in low latency mode: move it on from where the simulation left it by the keys held now, which the
+	// simulation running during the last frame didn't see. Not kept, the next frame starts again from the simulated camera.
+	// Not when the simulation runs before rendering, it has just read the same keys, nor in benchmark mode
+	if (gLowLatency && gParallelUpdate && !gBenchmark.enabled)
+	{
+		gCamera->Control(frameTime, Key_Up, Key_Down, Key_Left, Key_Right, Key_W, Key_S, Key_A, Key_D);
+	}
+
+	// The floating models only where they have moved, so those asleep keep their matrices and aren't updated
+	for (size_t i = 0; i < gFloatingModels.size(); ++i)
+	{
+		bool still = std::memcmp(&from.floating[i], &to.floating[i], sizeof(CMatrix4x4)) == 0;
+		CMatrix4x4 matrix = still ? to.floating[i] : BlendWorldMatrices(from.floating[i], to.floating[i], blend);
+		CMatrix4x4 current = gFloatingModels[i]->WorldMatrix();
+		if (std::memcmp(&matrix, &current, sizeof(CMatrix4x4)) != 0)  gFloatingModels[i]->SetWorldMatrix(matrix);
+	}
+
+	// Play the animations of the animated models, before anything reads their matrices. Here rather than in the simulation, the
+	// poses only need the frame's time and nothing is being rendered now
+	if (!gAnimators.empty())
+	{
+		CpuProfileScope animationProfile("Animation");
+		Animator::UpdateAll(gAnimators, frameTime);
+	}
+
+	if (!gPathSaveError.empty())
+	{
+		MessageBoxA(gHWnd, gPathSaveError.c_str(), NULL, MB_OK);
+		gPathSaveError.clear();
+	}
+
+	if (gBenchmark.enabled)
+	{
+		lockFPS = false;
+	}
+	else
+	{
+		// Save the CPU timings of the last few frames as a Chrome trace, to see where the CPU frame time goes (see CpuProfiler.h)
+		if (KeyHit(Key_8) && !gCpuProfiler.WriteTrace(L"cpu_trace.json"))
+		{
+			MessageBoxA(gHWnd, gLastError.c_str(), NULL, MB_OK);
+		}
+
+		// Capture the next frame when started from RenderDoc (see GpuEvents.h)
+		if (KeyHit(Key_F11))  gCaptureFrame = true;
+	}
+
+	// Cycle water geometry mode and choose the water clipmap tiles around the camera for this frame
+	if (KeyHit(Key_G))  gWaterGeometry = static_cast<WaterGeometry>((static_cast<int>(gWaterGeometry) + 1) % 3);
+	if (gWaterGeometry == WaterGeometry::Clipmap)  gWaterClipmap->Update(gCamera->Position(), gPerFrameConstants.waterPlaneY);
+
+	// Switch between the terrain and the ground mesh. Choose the terrain tiles around the camera for this frame (the simulation
+	// keeps the camera above the ground)
+	if (KeyHit(Key_6))  gTerrainEnabled = !gTerrainEnabled;
+	gSceneObjects->SetPasses(gGroundObject, gTerrainEnabled ? 0 : SceneObjects::AllPasses);
+	if (KeyHit(Key_7))  gShoreMaps = !gShoreMaps;
+	if (KeyHit(Key_9))  gShowStats = !gShowStats;
+	if (gTerrainEnabled)
+	{
+		gTerrain->Update(gCamera->Position());
+		gTerrain->SetTerrainConstants(gPerFrameConstants);
+	}
+
+	// Change the density of the fixed water grid. It is bufferless, so this doesn't create anything (see Mesh.h)
+	if (KeyHit(Key_N) && gWaterGeometry == WaterGeometry::Grid)
+	{
+		int subDivs = gWaterMesh->GridSubDivX() * 2;
+		if (subDivs > 1600)  subDivs = 100;
+		gWaterMesh->SetGridSubdivisions(subDivs, subDivs);
+	}
+
+	// Cycle MSAA in the main pass between 4x, 2x and off, skipping any the GPU can't do - need to recreate the depth buffer and the
+	// HDR scene texture
+	if (KeyHit(Key_1))
+	{
+		unsigned int samples = gMSAASamples;
+		do { samples = (samples == 1 ? 4 : samples / 2); } while (samples > 1 && !MultisampleSupported(samples));
+		if (!CreateMainDepthBuffer(samples) || !gPostProcess->SetSamples(samples))  PostQuitMessage(0); // Have lost the main pass targets, can't continue
+		gMSAASamples = samples;
+	}
+
+	// Dynamic resolution off, or holding 60fps or 120fps. The scales are only changed when the GPU profiler has new times
+	if (KeyHit(Key_2))
+	{
+		gFrameTimeTarget = (gFrameTimeTarget == 0 ? 16.6f : gFrameTimeTarget > 10.0f ? 8.3f : 0.0f);
+		gMainResolution.Reset();
+		gWaterResolution.Reset();
+	}
+	if (gFrameTimeTarget > 0 && gGpuProfiler->CompletedFrames() != gDynamicResolutionFrame)
+	{
+		gDynamicResolutionFrame = gGpuProfiler->CompletedFrames();
+		float waterTime = gGpuProfiler->PassTime(GpuPass::WaterHeight) + gGpuProfiler->PassTime(GpuPass::Refraction) +
+		                  gGpuProfiler->PassTime(GpuPass::Reflection) + gGpuProfiler->PassTime(GpuPass::WaterViews);
+		float mainTime  = gGpuProfiler->PassTime(GpuPass::DepthPrepass) + gGpuProfiler->PassTime(GpuPass::MainLit) +
+		                  gGpuProfiler->PassTime(GpuPass::WaterSurface) + gGpuProfiler->PassTime(GpuPass::SkyAndLights);
+		float otherTime = gGpuProfiler->TotalTime() - waterTime - mainTime; // Ocean, environment map and post-processing
+		gWaterResolution.Update(waterTime, gFrameTimeTarget * WaterFrameTimeShare);
+		gMainResolution.Update(mainTime, gFrameTimeTarget - otherTime - (std::min)(waterTime, gFrameTimeTarget * WaterFrameTimeShare));
+	}
+
+	// Constants written to the constant ring and bound by offset, or to a discarded buffer for each draw, to compare them
+	if (KeyHit(Key_3))  SetConstantRingEnabled(!ConstantRingEnabled());
+
+	// Instanced models culled on the GPU or the CPU
+	if (KeyHit(Key_4))  gGpuInstanceCulling = !gGpuInstanceCulling;
+
+	// Levels of detail for the lit models, or always full detail
+	if (KeyHit(Key_5))  gMeshLods = !gMeshLods;
+
+	// Distant models drawn as their impostors, or always as their meshes
+	if (KeyHit(Key_Prior))  gDrawImpostors = !gDrawImpostors;
+
+	// Exposure adaptation, and switching bloom and automatic exposure on or off
+	gPostProcess->Update(frameTime);
+	if (KeyHit(Key_X))  gPostProcess->SetBloom(!gPostProcess->Bloom());
+	if (KeyHit(Key_Y))  gPostProcess->SetAutoExposure(!gPostProcess->AutoExposure());
+
+	// Switch between edge-adaptive upscaling with sharpening and bilinear stretching, for the scene rendered below the viewport
+	// resolution (a render scale below 1 or dynamic resolution)
+	if (KeyHit(Key_Back))  gPostProcess->SetUpscaling(!gPostProcess->Upscaling());
+
+	// FFT ocean on or off, and choice of FFT size - need to recreate the ocean textures for that
+	if (KeyHit(Key_O))  gOceanEnabled = !gOceanEnabled;
+	if (KeyHit(Key_F))
+	{
+		try
+		{
+			gOcean->SetResolution(gOcean->Resolution() == 512 ? 128 : gOcean->Resolution() * 2);
+		}
+		catch (std::runtime_error e)
+		{
+			gLastError = e.what();
+			PostQuitMessage(0); // Have lost the ocean textures, can't continue
+		}
+	}
 	
 	// Toggle FPS limiting
 	if (KeyHit(Key_P))  lockFPS = !lockFPS;
 
+	// Change to the next quality preset (see Settings.h), keeping the FPS limiting as it is. The settings from the file and the
+	// command line are replaced by the preset's
+	if (KeyHit(Key_Tab))
+	{
+		gRenderSettings = QualityPresetSettings(static_cast<QualityPreset>((static_cast<int>(gRenderSettings.quality) + 1) % NumQualityPresets));
+		gRenderSettings.vsync = lockFPS;
+		if (!ApplyRenderSettings())  PostQuitMessage(0); // Have lost the main pass or water targets, can't continue
+	}
+
+	// Toggle recording the passes on worker threads
+	if (KeyHit(Key_M))  gParallelPasses = !gParallelPasses;
+
+	// Toggle simulating the next frame on the thread pool while this one is rendered
+	if (KeyHit(Key_F2))  gParallelUpdate = !gParallelUpdate;
+
+	// Toggle low latency mode, presenting on a thread of its own and late latching the camera
+	if (KeyHit(Key_F1))
+	{
+		gLowLatency = !gLowLatency;
+		SetPresentThread(gLowLatency);
+	}
+
+	// Toggle the dock lamps
+	if (KeyHit(Key_F3))  gDockLamps = !gDockLamps;
+
+	// Toggle the shadows. The cascades are all rendered again when they come back on, they will be out of date
+	if (KeyHit(Key_F4))
+	{
+		gShadows = !gShadows;
+		if (gShadows)  gShadowMap->Invalidate();
+	}
+
+	// Toggle the caustics under the water
+	if (KeyHit(Key_F5))  gCausticsEnabled = !gCausticsEnabled;
+	if (KeyHit(Key_F6))  gRipplesEnabled = !gRipplesEnabled;
+
+	// Toggle the cheaper shading of far water, and its checkerboard
+	if (KeyHit(Key_F7))  gWaterShadingLod = !gWaterShadingLod;
+	if (KeyHit(Key_F8))  gWaterCheckerboard = !gWaterCheckerboard;
+
+	// Toggle rendering the refraction and reflection together in the water views pass
+	if (KeyHit(Key_F9))  gWaterViews = !gWaterViews;
+
+	// Toggle seeing through the water into the main pass in place of the refraction pass
+	if (KeyHit(Key_Insert))  gScreenSpaceRefraction = !gScreenSpaceRefraction;
+
+	// Toggle culling the lit models hidden behind what was drawn in earlier frames
+	if (KeyHit(Key_Home))  gOcclusionCulling = !gOcclusionCulling;
+
+	// Toggle dropping the small and distant lit models from the refraction and reflection
+	if (KeyHit(Key_Space))  gSecondaryPassCulling = !gSecondaryPassCulling;
+
+	// Toggle moving the water grid once a frame for all of its passes
+	if (KeyHit(Key_Numpad0))  gCacheWaterVertices = !gCacheWaterVertices;
+
+	// Toggle splitting the window between the main camera and the observer camera
+	if (KeyHit(Key_Numpad1))
+	{
+		gSplitScreen = !gSplitScreen;
+		FitCamerasToViews();
+	}
+
+	// Toggle the GPU particles, and drawing the main pass's light flares as particles
+	if (KeyHit(Key_End))     gParticlesEnabled = !gParticlesEnabled;
+	if (KeyHit(Key_Delete))  gParticleFlares   = !gParticleFlares;
+
+	// Cycle the water clarity between flood water, unclear sea water and clear tropical water. Only changes debug builds, other
+	// builds have the water settings built into the shaders (see WaterConstants in Common.h)
+	if (KeyHit(Key_E))
+	{
+		static int waterClarity = 0;
+		const CVector3 extinctions[] = { { 9, 7, 3 }, { 15, 16, 25 }, { 15, 75, 300 } };
+		waterClarity = (waterClarity + 1) % 3;
+		gWaterConstants.waterExtinction = extinctions[waterClarity];
+	}
+
+	// Toggle recompiling shaders when their files change
+	if (KeyHit(Key_H))  gShaderHotReload = !gShaderHotReload;
+
+	// Toggle clipping of the refracted / reflected models against the water in hardware or in the pixel shaders
+	if (KeyHit(Key_C))  gHardwareWaterClip = !gHardwareWaterClip;
+
+	// Toggle the occlusion queries that skip the refraction and reflection of hidden water
+	if (KeyHit(Key_Q))  gWaterOcclusionQueries = !gWaterOcclusionQueries;
+
+	// Toggle cutting the refraction and reflection passes to the water on the screen
+	if (KeyHit(Key_U))  gWaterScissor = !gWaterScissor;
+
+	// Toggle rendering the refraction and reflection on alternate frames
+	if (KeyHit(Key_T))  gTemporalWaterTextures = !gTemporalWaterTextures;
+
+	// Toggle the depth prepass in the main pass
+	if (KeyHit(Key_Z))  gDepthPrepass = !gDepthPrepass;
+
+	// Cycle the debug view between the image, the overdraw and the quad efficiency, or with shift held the passes it shows
+	if (KeyHit(Key_Next))
+	{
+		if (KeyHeld(Key_Shift))  gOverdrawView->NextSelection();
+		else  gOverdrawView->SetMode(static_cast<OverdrawMode>((static_cast<int>(gOverdrawView->Mode()) + 1) % static_cast<int>(OverdrawMode::NumModes)));
+	}
+
+	// Cycle between planar, hybrid, environment map and screen-space reflections. The environment map is captured in full
+	// again when it comes back into use after planar reflections
+	if (KeyHit(Key_V))
+	{
+		gReflectionMode = static_cast<ReflectionMode>((static_cast<int>(gReflectionMode) + 1) % 4);
+		if (gReflectionMode == ReflectionMode::Planar)  gEnvironmentMap->Invalidate();
+	}
+
+	// Cycle the size of the water textures between full, half and quarter size - need to recreate them
+	if (KeyHit(Key_R))
+	{
+		gWaterTextureScale = (gWaterTextureScale == 1.0f ? 0.5f : gWaterTextureScale == 0.5f ? 0.25f : 1.0f);
+		ReleaseWaterTextures();
+		if (!CreateWaterTextures())  PostQuitMessage(0); // Have lost the water textures, can't continue
+	}
+
+}
+
+
+// Show the frame time, settings and GPU times in the window title or the stats overlay. frameTime is the time passed since
+// the last frame was rendered
+void UpdateWindowTitle(float frameTime)
+{
 	// Show frame time / FPS in the window title //
 	const float fpsUpdateTime = 0.5f; // How long between updates (in seconds)
 	static float totalFrameTime = 0;
@@ -763,9 +4177,136 @@ void UpdateScene(float frameTime)
 		std::ostringstream frameTimeMs;
 		frameTimeMs.precision(2);
 		frameTimeMs << std::fixed << avgFrameTime * 1000;
-		std::string windowTitle = "CO3303 Week 16: Water Rendering - Frame Time: " + frameTimeMs.str() +
+		const std::string appTitle = "CO3303 Week 16: Water Rendering";
+		std::string windowTitle = appTitle + " - Frame Time: " + frameTimeMs.str() +
 			"ms, FPS: " + std::to_string(static_cast<int>(1 / avgFrameTime + 0.5f));
-		SetWindowTextA(gHWnd, windowTitle.c_str());
+		size_t settingsStart = windowTitle.size() + 2; // The settings follow, after a ", "
+		windowTitle += std::string(", Quality: ") + QualityPresetName(gRenderSettings.quality);
+		if (gWaterGeometry == WaterGeometry::Clipmap)  windowTitle += ", Water Tiles: " + std::to_string(gWaterClipmap->NumTiles());
+		if (gTerrainEnabled)  windowTitle += ", Terrain Tiles: " + std::to_string(gTerrain->NumTiles());
+		if (gWaterGeometry == WaterGeometry::Grid)     windowTitle += ", Water Grid: " + std::to_string(gWaterMesh->GridSubDivX());
+		windowTitle += ", Water Textures: " + std::to_string(static_cast<int>(gWaterTextureScale * 100)) + "%";
+		int waterGroups = 0, hiddenGroups = 0;
+		for (auto& set : gWaterTextureSets)
+		{
+			if (set.inUse)                ++waterGroups;
+			if (set.inUse && set.hidden)  ++hiddenGroups;
+		}
+		windowTitle += ", Water Groups: " + std::to_string(waterGroups) + "/" + std::to_string(gWaterBodies.size());
+		if (gWaterOcclusionQueries)  windowTitle += " (" + std::to_string(hiddenGroups) + " hidden)";
+		if (gWaterScissor)
+		{
+			// Fraction of the water textures rendered, for the group with the largest rectangle
+			float coverage = 0;
+			for (auto& set : gWaterTextureSets)
+			{
+				if (!set.inUse || set.hidden)  continue;
+				float area = static_cast<float>((set.screenRect.right - set.screenRect.left) * (set.screenRect.bottom - set.screenRect.top));
+				coverage = (std::max)(coverage, area / (WaterRenderWidth() * WaterRenderHeight()));
+			}
+			windowTitle += ", Water Scissor: " + std::to_string(static_cast<int>(coverage * 100 + 0.5f)) + "%";
+		}
+		if (gOceanEnabled)  windowTitle += ", Ocean FFT: " + std::to_string(gOcean->Resolution());
+		if (!gShowStats)  windowTitle += ", Render Allocations: " + std::to_string(gRenderAllocations); // The overlay shows it each frame
+		windowTitle += ", State Changes: " + std::to_string(gRenderStateStats.issued) +
+		               " (" + std::to_string(gRenderStateStats.filtered) + " skipped)";
+		if (ConstantRingSupported())  windowTitle += ConstantRingEnabled() ? ", Constant Ring" : ", Constant Discards";
+		if (gGpuInstanceCulling)  windowTitle += ", GPU Instance Culling";
+		if (gOcclusionCulling)  windowTitle += ", Occlusion Culling";
+		if (gMeshLods)  windowTitle += ", Mesh LODs";
+		if (gDrawImpostors)  windowTitle += ", Impostors: " + std::to_string(gImpostorsRendered);
+		if (gPortalMap != nullptr)
+		{
+			windowTitle += ", Cells: " + std::to_string(gPortalMap->NumVisibleCells()) + "/" + std::to_string(gPortalMap->NumCells());
+		}
+		if (gShoreMaps)  windowTitle += ", Shore Maps";
+		windowTitle += ", Lights: " + std::to_string(gLightGrid->NumLights()) + " (max " +
+		               std::to_string(gLightGrid->MaxCellLights()) + " per cell)";
+		if (gDockLamps)  windowTitle += ", Dock Lamps: " + std::to_string(NUM_DOCK_LAMPS);
+		if (!gStressModels.empty())  windowTitle += ", Stress Objects: " + std::to_string(gStressModels.size());
+		if (gWorldStreamer != nullptr)
+		{
+			windowTitle += ", Chunks: " + std::to_string(gWorldStreamer->NumResident()) + "/" + std::to_string(gWorldStreamer->NumChunks()) +
+			               " (" + std::to_string(gWorldStreamer->NumLoading()) + " loading, " +
+			               std::to_string(gWorldStreamer->ResidentBytes() / (1024 * 1024)) + "/" +
+			               std::to_string(gWorldStreamer->Budget() / (1024 * 1024)) + " MB)";
+		}
+		if (gShadows)  windowTitle += ", Shadows";
+		if (gCausticsEnabled)  windowTitle += ", Caustics";
+		if (gRipplesEnabled)   windowTitle += ", Ripples";
+		if (gParticlesEnabled)  windowTitle += gParticleFlares ? ", Particles + Flares" : ", Particles";
+		if (gWaterShadingLod)  windowTitle += ", Water LOD";
+		if (WaterCheckerboardActive())  windowTitle += ", Water Checkerboard";
+		if (gWaterViews)  windowTitle += ", Water Views";
+		if (gScreenSpaceRefraction)  windowTitle += ", Screen-Space Refraction";
+		if (gCameraUnderwater) windowTitle += ", Underwater";
+		windowTitle += ", Passes: " + std::to_string(gRenderGraph->NumPasses() - gRenderGraph->NumCulledPasses()) +
+		               " (" + std::to_string(gRenderGraph->NumCulledPasses()) + " culled), Transient Textures: " +
+		               std::to_string(gRenderGraph->NumTransientTextures()) + " in " + std::to_string(gRenderGraph->NumPooledTextures()) +
+		               ", State Objects: " + std::to_string(NumStateObjects());
+		if (gParallelPasses)  windowTitle += gCommandRecorder->DriverCommandLists() ? ", Parallel Passes" : ", Parallel Passes (Emulated)";
+		if (gParallelUpdate)  windowTitle += ", Parallel Update";
+		if (gLowLatency)  windowTitle += ", Low Latency";
+		windowTitle += std::string(", Water Clip: ") + (gHardwareWaterClip ? "Hardware" : "Pixel");
+		if (gDepthPrepass)  windowTitle += ", Depth Prepass";
+		if (gSecondaryPassCulling)  windowTitle += ", Water Pass Culling";
+		if (gWaterVerticesCached)  windowTitle += ", Cached Water Vertices";
+		if (gSplitScreen)  windowTitle += ", Split Screen";
+		if (gOverdrawView->Mode() != OverdrawMode::Off)
+		{
+			windowTitle += std::string(", Debug View: ") + gOverdrawView->ModeName() + " (" + gOverdrawView->SelectionName() + ")";
+		}
+		if (gTemporalWaterTextures)  windowTitle += ", Temporal Water";
+		windowTitle += ", MSAA: " + (gMSAASamples > 1 ? std::to_string(gMSAASamples) + "x" : std::string("Off"));
+		if (gFrameTimeTarget > 0)
+		{
+			windowTitle += ", Resolution (" + std::to_string(static_cast<int>(std::round(1000 / gFrameTimeTarget))) + "fps): " +
+			               std::to_string(static_cast<int>(gMainResolution.Scale() * 100)) + "% (water " +
+			               std::to_string(static_cast<int>(gWaterResolution.Scale() * 100)) + "%)";
+		}
+		else if (gMainResolution.Scale() < 1)
+		{
+			windowTitle += ", Render Scale: " + std::to_string(static_cast<int>(std::round(gMainResolution.Scale() * 100))) + "%";
+		}
+		if (gMainResolution.Scale() < 1)  windowTitle += std::string(", Upscaling: ") + (gPostProcess->Upscaling() ? "Sharpened" : "Bilinear");
+		windowTitle += std::string(", Exposure: ") + (gPostProcess->AutoExposure() ? "Auto" : "Fixed");
+		if (gPostProcess->Bloom())  windowTitle += ", Bloom";
+		const char* reflectionModes[] = { "Planar", "Hybrid", "Environment", "Screen Space" };
+		windowTitle += std::string(", Reflection: ") + reflectionModes[static_cast<int>(gReflectionMode)];
+		windowTitle += ", Models Culled: " + std::to_string(gModelsCulled) + "/" + std::to_string(gModelsRendered + gModelsCulled);
+		windowTitle += ", Streamed Textures: " + std::to_string(gTextureStreamer->UsedBytes() / (1024 * 1024)) + "/" +
+		               std::to_string(gTextureStreamer->Budget() / (1024 * 1024)) + "MB";
+
+		if (gShaderHotReload)
+		{
+			std::string shaderErrors = ShaderReloadErrors();
+			windowTitle += shaderErrors.empty() ? ", Shader Hot Reload" : ", Shader Errors: " + shaderErrors;
+		}
+		if (IsRecordingPath())  windowTitle += ", Recording path";
+		if (GpuCaptureAvailable())  windowTitle += ", RenderDoc (F11 to capture)";
+
+		// Average GPU time for each pass in milliseconds
+		std::ostringstream gpuTimes;
+		gpuTimes.precision(2);
+		gpuTimes << std::fixed;
+		for (int pass = 0; pass < static_cast<int>(GpuPass::NumPasses); ++pass)
+		{
+			gpuTimes << (pass == 0 ? ", GPU ms - " : ", ") << GpuProfiler::PassName(static_cast<GpuPass>(pass)) << ": "
+			         << gGpuProfiler->AveragePassTime(static_cast<GpuPass>(pass));
+		}
+		gGpuProfiler->ResetAverages();
+
+		// The overlay shows the frame time and pass times itself, so only needs the settings
+		if (gShowStats)
+		{
+			gStatsOverlay->SetInfo(windowTitle.substr(settingsStart));
+			SetWindowTextA(gHWnd, appTitle.c_str());
+		}
+		else
+		{
+			windowTitle += gpuTimes.str();
+			SetWindowTextA(gHWnd, windowTitle.c_str());
+		}
 		totalFrameTime = 0;
 		frameCount = 0;
 	}
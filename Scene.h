@@ -21,6 +21,14 @@ bool InitScene();
 // Release the geometry resources created above
 void ReleaseResources();
 
+// Resize the render targets and other resources that depend on the viewport size, when the window has changed size. Call
+// between frames. Returns false on failure
+bool ResizeScene(int width, int height);
+
+// Change the scene to the render settings in gRenderSettings (see Settings.h), recreating the resources that depend on them.
+// Called by InitScene and when the quality preset is changed. Call between frames. Returns false on failure
+bool ApplyRenderSettings();
+
 
 //--------------------------------------------------------------------------------------
 // Scene Render and Update
@@ -28,8 +36,37 @@ void ReleaseResources();
 
 void RenderScene();
 
-// frameTime is the time passed since the last frame
+// The render graph passes the scene adds (see RenderSceneFromCamera), in the order it adds them, and the names it gives
+// them. Passes added for each group of water share a name. The benchmark saves the DirectX calls made under each name
+enum class ScenePass { Shadows, Environment, WaterHeight, WaterViews, Refraction, Reflection, Main, NumPasses };
+const char* const ScenePassNames[] = { "Shadows", "Environment", "Water Height", "Water Views", "Refraction", "Reflection", "Main" };
+static_assert(sizeof(ScenePassNames) / sizeof(ScenePassNames[0]) == static_cast<int>(ScenePass::NumPasses), "A scene pass has no name");
+
+// The moving parts of the scene are simulated in fixed steps of this many seconds, however often it is rendered, so they
+// move the same way at any frame rate. Each frame runs as many steps as are needed to catch up with the time passed, up to
+// a limit so a long frame doesn't lead to longer and longer frames catching up, except in benchmark mode
+const float UpdateTimeStep     = 1.0f / 120.0f;
+const int   MaxUpdatesPerFrame = 8;
+
+// A frame is updated in two parts (see the main loop in Main.cpp). UpdateScene shows the moving parts as the last simulated
+// frame left them, blended between its last two steps, and deals with the keys that change settings. frameTime is the time
+// passed since the last frame. Then StartSceneUpdate simulates the next frame as a job on the thread pool, moving the scene
+// on by frameTime, while this one is rendered, and FinishSceneUpdate waits for it after rendering. Input is read by the
+// simulation, so it shows a frame later than it would if the scene were simulated before rendering
 void UpdateScene(float frameTime);
+void StartSceneUpdate(float frameTime);
+void FinishSceneUpdate();
+
+// Handle the keys pressed since the main loop last handled messages, in low latency mode (toggled with F1). Call after
+// WaitForSwapChain, before UpdateScene, so the frame sees the keys pressed while it waited
+void LatchInput();
+
+// Start the simulation from the scene as InitScene left it. Called by InitScene
+void InitSceneUpdates();
+
+// Show the frame time and settings in the window title or stats overlay, call once per rendered frame. frameTime is the
+// time passed since the last frame
+void UpdateWindowTitle(float frameTime);
 
 
 #endif //_SCENE_H_INCLUDED_
@@ -0,0 +1,182 @@
+//--------------------------------------------------------------------------------------
+// Lit objects of the scene, kept as arrays of each of their properties
+//--------------------------------------------------------------------------------------
+
+#include "SceneObjects.h"
+#include "Model.h"
+#include "Mesh.h"
+#include "HiZBuffer.h"
+
+#include <algorithm>
+#include <numeric>
+
+
+SceneObjects* gSceneObjects = nullptr;
+
+
+// Add an object drawing the given model, which must use the given mesh, with the given material in the given passes
+void SceneObjects::Add(Model* model, Mesh* mesh, const Material& material, unsigned int passes /*= AllPasses*/)
+{
+	mModels.push_back(model);
+	mTransforms.push_back(model->WorldMatrix());
+	mBounds.push_back(TransformSphere(mesh->Bounds(), model->WorldMatrix()));
+	mBoundArray.Resize(mBounds.size());
+	mBoundArray.Set(mBounds.size() - 1, mBounds.back());
+	mMeshIDs.push_back(FindMeshID(mesh));
+	mMaterialIDs.push_back(FindMaterialID(material));
+	mPasses.push_back(passes);
+	mSkinned.push_back(mesh->HasBones());
+	mImpostors.push_back(nullptr);
+	mAlwaysDrawn.push_back(false);
+}
+
+
+// Put the objects in order of material then mesh, the order they are drawn in
+void SceneObjects::Sort()
+{
+	std::vector<int> order(mModels.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [this](int a, int b)
+	{
+		if (mMaterialIDs[a] != mMaterialIDs[b])  return mMaterialIDs[a] < mMaterialIDs[b];
+		return mMeshIDs[a] < mMeshIDs[b];
+	});
+
+	// Each array is rearranged the same way
+	auto reorder = [&order](auto& array)
+	{
+		auto sorted = array;
+		for (size_t i = 0; i < order.size(); ++i)  sorted[i] = array[order[i]];
+		array.swap(sorted);
+	};
+	reorder(mModels);
+	reorder(mTransforms);
+	reorder(mBounds);
+	reorder(mMeshIDs);
+	reorder(mMaterialIDs);
+	reorder(mPasses);
+	reorder(mSkinned);
+	reorder(mImpostors);
+	reorder(mAlwaysDrawn);
+	for (size_t i = 0; i < mBounds.size(); ++i)  mBoundArray.Set(i, mBounds[i]);
+}
+
+
+// Index of the object drawing the given model, or -1 if there isn't one
+int SceneObjects::Find(Model* model)
+{
+	auto found = std::find(mModels.begin(), mModels.end(), model);
+	return found == mModels.end() ? -1 : static_cast<int>(found - mModels.begin());
+}
+
+
+// Change the model and mesh an object draws, keeping its material, passes and whether it is always drawn. The old mesh must not be used by any other object
+void SceneObjects::Replace(int object, Model* model, Mesh* mesh)
+{
+	mModels[object] = model;
+	mMeshes[mMeshIDs[object]] = mesh; // Keeps the mesh ID, so the objects stay sorted
+	mTransforms[object] = model->WorldMatrix();
+	mBounds[object] = TransformSphere(mesh->Bounds(), model->WorldMatrix());
+	mBoundArray.Set(object, mBounds[object]);
+	mSkinned[object] = mesh->HasBones();
+	mImpostors[object] = nullptr;
+}
+
+
+// Copy each model's world matrix and place its mesh's bounds with it. Call once per frame, before culling
+void SceneObjects::UpdateBounds()
+{
+	for (size_t i = 0; i < mModels.size(); ++i)
+	{
+		mTransforms[i] = mModels[i]->WorldMatrix();
+		mBounds[i] = TransformSphere(mMeshes[mMeshIDs[i]]->Bounds(), mTransforms[i]);
+		mBoundArray.Set(i, mBounds[i]);
+	}
+}
+
+
+// Write the indexes of the objects in any of the given passes that might be seen in the frustum to visible, in draw order.
+// Objects hidden in the occlusion culling depth, if given, are culled too. Returns how many objects were in those passes
+int SceneObjects::Cull(const Frustum& frustum, unsigned int passes, std::vector<int>& visible,
+                       const HiZBuffer* occlusion /*= nullptr*/) const
+{
+	visible.clear(); // Keeps its memory, so only allocates when there are more objects than ever before
+	int numTested = 0;
+	for (size_t first = 0; first < mBounds.size(); first += BatchWidth)
+	{
+		// Four spheres against the frustum at once, those not in the passes too as it costs no more
+		unsigned int inFrustum = SpheresInFrustum4(frustum, mBoundArray, first);
+		size_t last = (std::min)(first + BatchWidth, mBounds.size());
+		for (size_t i = first; i < last; ++i)
+		{
+			if ((mPasses[i] & passes) == 0)  continue;
+			++numTested;
+			bool seen = ((inFrustum >> (i - first)) & 1) && (occlusion == nullptr || !occlusion->IsOccluded(mBounds[i]));
+			if (mSkinned[i] || seen)  visible.push_back(static_cast<int>(i));
+		}
+	}
+	return numTested;
+}
+
+// Cull for two views at once, the objects visible in either are written to visible
+int SceneObjects::Cull(const Frustum& frustum, unsigned int passes, const Frustum& otherFrustum, unsigned int otherPasses,
+                       std::vector<int>& visible, const HiZBuffer* occlusion /*= nullptr*/,
+                       const HiZBuffer* otherOcclusion /*= nullptr*/) const
+{
+	auto seen = [this](unsigned int inFrustum, const HiZBuffer* viewOcclusion, size_t i)
+	{
+		return ((inFrustum >> (i % BatchWidth)) & 1) && (viewOcclusion == nullptr || !viewOcclusion->IsOccluded(mBounds[i]));
+	};
+
+	visible.clear();
+	int numTested = 0;
+	for (size_t first = 0; first < mBounds.size(); first += BatchWidth)
+	{
+		unsigned int inFrustum      = SpheresInFrustum4(frustum,      mBoundArray, first);
+		unsigned int inOtherFrustum = SpheresInFrustum4(otherFrustum, mBoundArray, first);
+		size_t last = (std::min)(first + BatchWidth, mBounds.size());
+		for (size_t i = first; i < last; ++i)
+		{
+			bool inPasses      = (mPasses[i] & passes) != 0;
+			bool inOtherPasses = (mPasses[i] & otherPasses) != 0;
+			if (!inPasses && !inOtherPasses)  continue;
+			++numTested;
+			if (mSkinned[i] || (inPasses      && seen(inFrustum,      occlusion,      i)) ||
+			                   (inOtherPasses && seen(inOtherFrustum, otherOcclusion, i)))
+			{
+				visible.push_back(static_cast<int>(i));
+			}
+		}
+	}
+	return numTested;
+}
+
+
+// ID of the mesh or material in the tables, adding it if it isn't there
+int SceneObjects::FindMeshID(Mesh* mesh)
+{
+	auto found = std::find(mMeshes.begin(), mMeshes.end(), mesh);
+	if (found != mMeshes.end())  return static_cast<int>(found - mMeshes.begin());
+	mMeshes.push_back(mesh);
+	return static_cast<int>(mMeshes.size()) - 1;
+}
+
+int SceneObjects::FindMaterialID(const Material& material)
+{
+	auto found = std::find(mMaterials.begin(), mMaterials.end(), material);
+	if (found != mMaterials.end())  return static_cast<int>(found - mMaterials.begin());
+
+	// A new material shares the shader ID of the first material with the same shaders, or has a new one
+	int shaderID = mShaderIDs.empty() ? 0 : *std::max_element(mShaderIDs.begin(), mShaderIDs.end()) + 1;
+	for (size_t i = 0; i < mMaterials.size(); ++i)
+	{
+		if (mMaterials[i].SameShaders(material))
+		{
+			shaderID = mShaderIDs[i];
+			break;
+		}
+	}
+	mMaterials.push_back(material);
+	mShaderIDs.push_back(shaderID);
+	return static_cast<int>(mMaterials.size()) - 1;
+}
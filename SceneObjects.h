@@ -0,0 +1,146 @@
+//--------------------------------------------------------------------------------------
+// Lit objects of the scene, kept as arrays of each of their properties
+//--------------------------------------------------------------------------------------
+// The lit models used to be drawn one by one, with hand-written code for each in every pass.
+// Here they are a list of objects, each a model with a mesh, a material and the passes it is
+// drawn in. Each property is its own array (structure of arrays), so culling only reads the
+// array of bounding spheres, one after another in memory, and the draw loop works through the
+// objects that passed in order. The objects are sorted by material then mesh, which keeps the
+// objects drawn together near each other in memory - thousands of objects stay cheap to cull and
+// draw. Each pass sorts the objects it draws again by their sort keys (see DrawList.h).
+//
+// The models still keep their node matrices and skinning (see Model.h), and are moved as
+// before. Once a frame UpdateBounds copies each model's world matrix into the array of
+// transforms and places its mesh's bounds with it. The bounds are kept a second time as arrays
+// of centre x, y, z and radius too, so culling tests four at once (see BatchMath.h).
+
+#include "Material.h"
+#include "Frustum.h"
+#include "BatchMath.h"
+#include "CMatrix4x4.h"
+#include <vector>
+
+#ifndef _SCENE_OBJECTS_H_INCLUDED_
+#define _SCENE_OBJECTS_H_INCLUDED_
+
+class Model;
+class Mesh;
+class HiZBuffer;
+class Impostor;
+
+class SceneObjects
+{
+//--------------------------------------------------------------------------------------
+// Construction / Usage
+//--------------------------------------------------------------------------------------
+public:
+
+	// The passes an object is drawn in, combined with |
+	enum Passes : unsigned int
+	{
+		EnvironmentPass = 1,
+		RefractionPass  = 2,
+		ReflectionPass  = 4,
+		MainPass        = 8,
+		ShadowPass      = 16, // Casts shadows from the key light (see ShadowMap.h)
+		AllPasses       = 31,
+	};
+
+	// Add an object drawing the given model, which must use the given mesh, with the given material in the given passes. The
+	// model stays owned by the caller, the material is copied. Call Sort once the objects have been added
+	void Add(Model* model, Mesh* mesh, const Material& material, unsigned int passes = AllPasses);
+
+	// Put the objects in order of material then mesh, close to the order they are drawn in. Changes the objects' indexes
+	void Sort();
+
+	// Index of the object drawing the given model, or -1 if there isn't one
+	int Find(Model* model);
+
+	// Change the model and mesh an object draws, keeping its material and passes, e.g. to swap a stand-in for a mesh that has
+	// finished loading. The old mesh must not be used by any other object, the new one takes its place in the draw order
+	void Replace(int object, Model* model, Mesh* mesh);
+
+	// Change the passes an object is drawn in, 0 to hide it
+	void SetPasses(int object, unsigned int passes)  { mPasses[object] = passes; }
+
+	// Keep an object in the passes that drop small and distant objects (the refraction and reflection, see Scene.cpp), e.g. a
+	// large landmark whose absence would leave a hole in the reflection. Objects aren't always drawn when added
+	void SetAlwaysDrawn(int object, bool alwaysDrawn)  { mAlwaysDrawn[object] = alwaysDrawn; }
+
+	// Give an object an impostor to be drawn as when it is small on screen (see Impostor.h), nullptr for none. The impostor
+	// stays owned by the caller. Replace takes the object's impostor away, it was baked from the old mesh
+	void SetImpostor(int object, Impostor* impostor)  { mImpostors[object] = impostor; }
+
+
+	// Copy each model's world matrix and place its mesh's bounds with it. Call once per frame, after the models have moved and
+	// before culling
+	void UpdateBounds();
+
+	// Write the indexes of the objects in any of the given passes that might be seen in the frustum to visible, in draw order.
+	// Objects hidden in the given occlusion culling depth are culled too, if there is one (see HiZBuffer.h). Returns how many
+	// objects were in those passes. Doesn't change the objects, so passes on several threads can cull at once.
+	// Skinned objects are never culled, their bones may move parts outside the mesh's bounds (as Model::IsVisible)
+	int Cull(const Frustum& frustum, unsigned int passes, std::vector<int>& visible, const HiZBuffer* occlusion = nullptr) const;
+
+	// The same for a pass drawing two views at once (see WaterViews_gs.hlsl): the objects in the first passes seen in the first
+	// frustum and those in the other passes seen in the other frustum, each view with its own occlusion culling depth if any.
+	// Each visible object is drawn into both views
+	int Cull(const Frustum& frustum, unsigned int passes, const Frustum& otherFrustum, unsigned int otherPasses,
+	         std::vector<int>& visible, const HiZBuffer* occlusion = nullptr, const HiZBuffer* otherOcclusion = nullptr) const;
+
+
+	//-------------------------------------
+	// Data access
+	//-------------------------------------
+
+	int                   NumObjects() const        { return static_cast<int>(mModels.size()); }
+	Model*                GetModel(int object)      { return mModels[object]; }
+	const BoundingSphere& Bounds(int object) const  { return mBounds[object]; }
+	int                   MeshID(int object) const      { return mMeshIDs[object]; }
+	int                   MaterialID(int object) const  { return mMaterialIDs[object]; }
+	const Material&       GetMaterial(int object) const { return mMaterials[mMaterialIDs[object]]; }
+	const CMatrix4x4&     Transform(int object) const   { return mTransforms[object]; }
+	unsigned int          Passes(int object) const      { return mPasses[object]; }
+	Impostor*             GetImpostor(int object) const { return mImpostors[object]; }
+	bool                  AlwaysDrawn(int object) const { return mAlwaysDrawn[object] != 0; }
+
+	// Materials with the same shader ID use the same shaders in every pass
+	int                   ShaderID(int materialID) const  { return mShaderIDs[materialID]; }
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions / data
+//--------------------------------------------------------------------------------------
+private:
+
+	// ID of the mesh or material in the tables below, adding it if it isn't there
+	int FindMeshID(Mesh* mesh);
+	int FindMaterialID(const Material& material);
+
+
+	// One entry in each for every object
+	std::vector<Model*>         mModels;
+	std::vector<CMatrix4x4>     mTransforms; // World matrix of the model's root, from the last UpdateBounds
+	std::vector<BoundingSphere> mBounds;     // World space, from the last UpdateBounds
+	std::vector<int>            mMeshIDs;
+	std::vector<int>            mMaterialIDs;
+	std::vector<unsigned int>   mPasses;
+	std::vector<char>           mSkinned;
+	std::vector<Impostor*>      mImpostors;
+	std::vector<char>           mAlwaysDrawn;
+
+	// The same bounds as mBounds as a structure of arrays, which Cull tests four at a time. Kept in step with mBounds
+	SphereArray mBoundArray;
+
+	// The meshes and materials used, indexed by ID, and the shader ID of each material
+	std::vector<Mesh*>    mMeshes;
+	std::vector<Material> mMaterials;
+	std::vector<int>      mShaderIDs;
+};
+
+
+// The lit objects of the scene, the terrain is drawn separately. Created in InitScene (see Scene.cpp)
+extern SceneObjects* gSceneObjects;
+
+
+#endif //_SCENE_OBJECTS_H_INCLUDED_
@@ -0,0 +1,249 @@
+//--------------------------------------------------------------------------------------
+// Render settings - quality presets, read from a settings file and the command line at startup
+//--------------------------------------------------------------------------------------
+
+#include "Settings.h"
+#include "Common.h"
+
+#include <Windows.h>
+#include <shellapi.h>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+
+
+//--------------------------------------------------------------------------------------
+// Global data
+//--------------------------------------------------------------------------------------
+
+RenderSettings gRenderSettings;
+
+// Names of the presets and of the settings, in the file and on the command line (with a - in front)
+static const char* const PresetNames[NumQualityPresets] = { "low", "medium", "high", "ultra" };
+static const char* const SettingNames[] = { "quality", "msaa", "watergrid", "watertextures", "anisotropy", "wavelayers",
+                                            "waterlighting", "renderscale", "vsync" };
+
+static const char* const SettingsHelp = "Settings are: quality low|medium|high|ultra, msaa 1|2|4, watergrid 1 to 1600, "
+                                        "watertextures 0.1 to 1, anisotropy 1 to 16, wavelayers 1 to 4, "
+                                        "waterlighting full|simple, renderscale 0.5 to 1, vsync 0|1";
+
+
+//--------------------------------------------------------------------------------------
+// Presets
+//--------------------------------------------------------------------------------------
+
+// The settings of a quality preset, with vsync on
+RenderSettings QualityPresetSettings(QualityPreset quality)
+{
+	RenderSettings settings; // High
+	settings.quality = quality;
+	switch (quality)
+	{
+	case QualityPreset::Low:
+		settings.msaaSamples       = 1;
+		settings.waterGrid         = 100;
+		settings.waterTextureScale = 0.25f;
+		settings.anisotropy        = 1;
+		settings.waveLayers        = 2;
+		settings.simpleWaterLighting = true;
+		settings.renderScale       = 0.75f;
+		break;
+
+	case QualityPreset::Medium:
+		settings.msaaSamples       = 2;
+		settings.waterGrid         = 200;
+		settings.waterTextureScale = 0.5f;
+		settings.anisotropy        = 2;
+		settings.waveLayers        = 3;
+		settings.simpleWaterLighting = true;
+		break;
+
+	case QualityPreset::Ultra:
+		settings.msaaSamples       = 4;
+		settings.waterGrid         = 800;
+		settings.waterTextureScale = 1.0f;
+		settings.anisotropy        = 16;
+		settings.waveLayers        = 4;
+		break;
+
+	default:
+		break;
+	}
+	return settings;
+}
+
+// Name of a quality preset as in the settings file, e.g. "high"
+const char* QualityPresetName(QualityPreset quality)
+{
+	return PresetNames[static_cast<int>(quality)];
+}
+
+
+//--------------------------------------------------------------------------------------
+// Reading settings
+//--------------------------------------------------------------------------------------
+
+// Settings text is read in lower case without spaces at either end. Only ASCII is expected, so wide command line arguments are
+// narrowed a character at a time
+static std::string CleanText(const std::string& text)
+{
+	size_t start = text.find_first_not_of(" \t\r");
+	if (start == std::string::npos)  return "";
+	size_t end = text.find_last_not_of(" \t\r");
+	std::string clean = text.substr(start, end - start + 1);
+	for (auto& c : clean)  c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+	return clean;
+}
+
+static std::string CleanText(const std::wstring& text)
+{
+	std::string narrow;
+	for (auto c : text)  narrow += static_cast<char>(c < 128 ? c : '?');
+	return CleanText(narrow);
+}
+
+
+static bool ValidSettings(const RenderSettings& settings)
+{
+	return (settings.msaaSamples == 1 || settings.msaaSamples == 2 || settings.msaaSamples == 4) &&
+	       settings.waterGrid >= 1 && settings.waterGrid <= 1600 &&
+	       settings.waterTextureScale >= 0.1f && settings.waterTextureScale <= 1.0f &&
+	       settings.anisotropy >= 1 && settings.anisotropy <= 16 &&
+	       settings.waveLayers >= 1 && settings.waveLayers <= 4 &&
+	       settings.renderScale >= 0.5f && settings.renderScale <= 1.0f;
+}
+
+// Change one setting, other than the quality preset, from its text. Returns false if there is no such setting or the value
+// is not valid for it
+static bool SetRenderSetting(RenderSettings& settings, const std::string& name, const std::string& value)
+{
+	size_t used = 0; // Characters of the value read as a number, all of them must be
+	try
+	{
+		if      (name == "msaa")           settings.msaaSamples       = std::stoi(value, &used);
+		else if (name == "watergrid")      settings.waterGrid         = std::stoi(value, &used);
+		else if (name == "watertextures")  settings.waterTextureScale = std::stof(value, &used);
+		else if (name == "anisotropy")     settings.anisotropy        = std::stoi(value, &used);
+		else if (name == "wavelayers")     settings.waveLayers        = std::stoi(value, &used);
+		else if (name == "renderscale")    settings.renderScale       = std::stof(value, &used);
+		else if (name == "waterlighting" && (value == "full" || value == "simple"))
+		{
+			settings.simpleWaterLighting = (value == "simple");
+			used = value.size();
+		}
+		else if (name == "vsync" && (value == "0" || value == "1"))  { settings.vsync = (value == "1");  used = 1; }
+		else return false;
+	}
+	catch (const std::logic_error&) // Thrown by stoi / stof for text that isn't a number
+	{
+		return false;
+	}
+	return used == value.size() && ValidSettings(settings);
+}
+
+
+// Read the settings file and the command line into gRenderSettings. Call once at startup, before Direct3D is set up. A settings
+// file that doesn't exist leaves the preset's settings, unless it was chosen with -settings
+// Returns false with a message in gLastError if a setting is not valid or the file can't be read
+bool LoadRenderSettings()
+{
+	// The command line first, it can choose the file. Arguments that aren't settings are left to ParseBenchmarkCommandLine
+	int numArgs;
+	LPWSTR* args = CommandLineToArgvW(GetCommandLineW(), &numArgs);
+	if (args == nullptr)
+	{
+		gLastError = "Error reading command line";
+		return false;
+	}
+
+	std::map<std::string, std::string> commandLineSettings;
+	std::wstring fileName = L"settings.ini";
+	bool fileChosen = false;
+	for (int i = 1; i < numArgs; ++i) // First argument is the program name
+	{
+		std::wstring arg = args[i];
+		if (!IsRenderSettingsOption(arg))  continue;
+		if (i + 1 >= numArgs) // Last on the command line, so it has no value
+		{
+			gLastError = "Missing value for render setting \"" + CleanText(arg.substr(1)) + "\". " + SettingsHelp;
+			LocalFree(args);
+			return false;
+		}
+		if (arg == L"-settings")
+		{
+			fileName = args[++i];
+			fileChosen = true;
+		}
+		else
+		{
+			commandLineSettings[CleanText(arg.substr(1))] = CleanText(std::wstring(args[++i]));
+		}
+	}
+	LocalFree(args);
+
+	std::map<std::string, std::string> fileSettings;
+	std::ifstream file(fileName);
+	if (!file && fileChosen)
+	{
+		gLastError = "Error opening render settings file";
+		return false;
+	}
+	std::string line;
+	while (std::getline(file, line))
+	{
+		line = CleanText(line);
+		if (line.empty() || line[0] == '#' || line[0] == ';' || line[0] == '[')  continue;
+
+		size_t equals = line.find('=');
+		if (equals == std::string::npos)
+		{
+			gLastError = "Error reading render settings file, each line needs name = value";
+			return false;
+		}
+		fileSettings[CleanText(line.substr(0, equals))] = CleanText(line.substr(equals + 1));
+	}
+
+	// The preset the others start from, the command line's over the file's
+	std::string quality = "high";
+	if (fileSettings.count("quality"))         quality = fileSettings["quality"];
+	if (commandLineSettings.count("quality"))  quality = commandLineSettings["quality"];
+	int preset = 0;
+	while (preset < NumQualityPresets && quality != PresetNames[preset])  ++preset;
+	if (preset == NumQualityPresets)
+	{
+		gLastError = "Invalid quality preset \"" + quality + "\". " + SettingsHelp;
+		return false;
+	}
+	RenderSettings settings = QualityPresetSettings(static_cast<QualityPreset>(preset));
+	fileSettings.erase("quality");
+	commandLineSettings.erase("quality");
+
+	for (auto* source : { &fileSettings, &commandLineSettings })
+	{
+		for (auto& setting : *source)
+		{
+			if (!SetRenderSetting(settings, setting.first, setting.second))
+			{
+				gLastError = "Invalid render setting \"" + setting.first + " " + setting.second + "\". " + SettingsHelp;
+				return false;
+			}
+		}
+	}
+
+	gRenderSettings = settings;
+	return true;
+}
+
+
+// Whether a command line argument is one of the settings (with a value after it), so other command line readers can skip it
+bool IsRenderSettingsOption(const std::wstring& arg)
+{
+	if (arg == L"-settings")  return true;
+	for (auto name : SettingNames)
+	{
+		if (arg == L"-" + std::wstring(name, name + std::strlen(name)))  return true;
+	}
+	return false;
+}
@@ -0,0 +1,79 @@
+//--------------------------------------------------------------------------------------
+// Render settings - quality presets, read from a settings file and the command line at startup
+//--------------------------------------------------------------------------------------
+// The settings that trade image quality for speed start from a quality preset (low, medium, high or
+// ultra). Any of them can then be set on its own in the settings file, and again on the command
+// line, which wins over the file. The file is settings.ini in the working folder, if there is one,
+// with a "name = value" setting on each line. Lines starting with # or ; and [section] lines are
+// ignored. The same settings go on the command line with a - in front, e.g. -quality low -msaa 1.
+// Press Tab to change to the next preset while the app runs. The keys for the settings on their own
+// (N, R, 1 and P) still change each one after that.
+//
+// Settings:
+//   quality         low|medium|high|ultra  Preset the others start from (default high)
+//   msaa            1|2|4    Samples per pixel in the main pass, 1 for no MSAA. Lowered to what the GPU can do
+//   watergrid       N        Subdivisions across each side of the fixed water grid, 1 to 1600 (see gWaterMesh)
+//   watertextures   S        Size of the refraction/reflection textures relative to the viewport, 0.1 to 1
+//   anisotropy      N        Samples of the standard texture sampler, 1 to 16 (1 is trilinear)
+//   wavelayers      N        Sizes of the wave normal/height map combined to make the waves, 1 to 4
+//   waterlighting   full|simple  Lighting of the models seen in the refraction and reflection. Simple is diffuse
+//                            only, with no specular, shadows or caustics (see WaterTextureLighting.hlsli)
+//   renderscale     S        Resolution of the main scene relative to the viewport, 0.5 to 1. Below 1 the scene is
+//                            upscaled and sharpened to the viewport (see PostProcess.h), 0.67-0.77 looks close to 1
+//   vsync           0|1      Lock the frame rate to the display, not part of the presets (default 1)
+// Command line only:
+//   -settings file.ini       Settings file to read instead of settings.ini, which must exist
+
+#include <string>
+
+#ifndef _SETTINGS_H_INCLUDED_
+#define _SETTINGS_H_INCLUDED_
+
+
+//--------------------------------------------------------------------------------------
+// Settings
+//--------------------------------------------------------------------------------------
+
+enum class QualityPreset
+{
+	Low,
+	Medium,
+	High,
+	Ultra,
+};
+const int NumQualityPresets = 4;
+
+// Defaults are the high preset
+struct RenderSettings
+{
+	QualityPreset quality           = QualityPreset::High; // The preset these started from
+	unsigned int  msaaSamples       = 4;
+	int           waterGrid         = 400;
+	float         waterTextureScale = 0.5f;
+	unsigned int  anisotropy        = 4;
+	int           waveLayers        = 4;
+	bool          simpleWaterLighting = false; // Cheaper pixel shaders for the refraction and reflection (see Material.h)
+	float         renderScale       = 1.0f; // Largest main scene resolution, dynamic resolution goes down from here
+	bool          vsync             = true;
+};
+
+extern RenderSettings gRenderSettings;
+
+
+// The settings of a quality preset, with vsync on
+RenderSettings QualityPresetSettings(QualityPreset quality);
+
+// Name of a quality preset as in the settings file, e.g. "high"
+const char* QualityPresetName(QualityPreset quality);
+
+
+// Read the settings file and the command line into gRenderSettings. Call once at startup, before Direct3D is set up. A settings
+// file that doesn't exist leaves the preset's settings, unless it was chosen with -settings
+// Returns false with a message in gLastError if a setting is not valid or the file can't be read
+bool LoadRenderSettings();
+
+// Whether a command line argument is one of the settings above (with a value after it), so other command line readers can skip it
+bool IsRenderSettingsOption(const std::wstring& arg);
+
+
+#endif //_SETTINGS_H_INCLUDED_
@@ -5,9 +5,25 @@
 
 #include "Shader.h"
 #include "Common.h"
+#include "MappedFile.h"
+#include "AssetArchive.h" // For FileWriteTime
+#include "JobSystem.h"
+#include "GpuMemory.h"
 #include <d3dcompiler.h>
+#include <d3d11shader.h>
 #include <fstream>
 #include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <functional>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+#include <set>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
 
 //--------------------------------------------------------------------------------------
 // Global Variables
@@ -16,10 +32,14 @@
 //**** Update Shader.h if you add things here ****//
 
 // Vertex and pixel shader DirectX objects
-ID3D11VertexShader*   gBasicTransformVertexShader = nullptr;
+ID3D11VertexShader*   gInstancedTransformVertexShader = nullptr;
 ID3D11VertexShader*   gPixelLightingVertexShader  = nullptr;
 ID3D11PixelShader*    gTintedTexturePixelShader   = nullptr;
 ID3D11PixelShader*    gPixelLightingPixelShader   = nullptr;
+ID3D11VertexShader*   gSkyVertexShader            = nullptr;
+ID3D11PixelShader*    gSkyPixelShader             = nullptr;
+ID3D11VertexShader*   gTerrainVertexShader        = nullptr;
+ID3D11VertexShader*   gShadowDepthVertexShader    = nullptr;
 
 
 //**********************
@@ -28,227 +48,901 @@ ID3D11PixelShader*    gPixelLightingPixelShader   = nullptr;
 ID3D11VertexShader* gBasicTransformWorldPosVertexShader = nullptr;
 ID3D11VertexShader* gWaterSurfaceVertexShader           = nullptr;
 ID3D11PixelShader*  gWaterSurfacePixelShader            = nullptr;
-ID3D11PixelShader*  gWaterHeightPixelShader             = nullptr;
+ID3D11PixelShader*  gWaterCheckerboardFillPixelShader   = nullptr;
 ID3D11PixelShader*  gReflectedPixelLightingPixelShader  = nullptr;
 ID3D11PixelShader*  gReflectedTintedTexturePixelShader  = nullptr;
 ID3D11PixelShader*  gRefractedPixelLightingPixelShader  = nullptr;
 ID3D11PixelShader*  gRefractedTintedTexturePixelShader  = nullptr;
+ID3D11GeometryShader* gWaterViewsGeometryShader           = nullptr;
+ID3D11PixelShader*    gWaterViewsPixelLightingPixelShader = nullptr;
+ID3D11PixelShader*    gRefractedSimpleLightingPixelShader  = nullptr;
+ID3D11PixelShader*    gReflectedSimpleLightingPixelShader  = nullptr;
+ID3D11PixelShader*    gWaterViewsSimpleLightingPixelShader = nullptr;
+
+ID3D11VertexShader* gWaterSurfaceTessVertexShader = nullptr;
+ID3D11HullShader*   gWaterSurfaceHullShader       = nullptr;
+ID3D11DomainShader* gWaterSurfaceDomainShader     = nullptr;
+
+ID3D11ComputeShader* gWaterDisplaceComputeShader     = nullptr;
+ID3D11VertexShader*  gWaterSurfaceCachedVertexShader = nullptr;
+
+ID3D11ComputeShader* gOceanSpectrumComputeShader = nullptr;
+ID3D11ComputeShader* gOceanFFTComputeShader      = nullptr;
+ID3D11ComputeShader* gOceanCombineComputeShader  = nullptr;
+ID3D11ComputeShader* gCausticsComputeShader      = nullptr;
+ID3D11ComputeShader* gRipplesComputeShader       = nullptr;
+ID3D11ComputeShader* gWaveCompositeComputeShader = nullptr;
+
+ID3D11ComputeShader* gSkinningComputeShader = nullptr;
+ID3D11ComputeShader* gInstanceCullComputeShader = nullptr;
+ID3D11ComputeShader* gHiZComputeShader = nullptr;
+ID3D11ComputeShader* gHiZMultisampledComputeShader = nullptr;
+
+ID3D11ComputeShader* gParticleSimulateComputeShader = nullptr;
+ID3D11ComputeShader* gParticleEmitComputeShader     = nullptr;
+ID3D11ComputeShader* gParticleSortComputeShader     = nullptr;
+ID3D11VertexShader*  gParticleVertexShader          = nullptr;
+ID3D11PixelShader*   gParticlePixelShader           = nullptr;
+
+ID3D11VertexShader* gImpostorVertexShader         = nullptr;
+ID3D11PixelShader*  gImpostorPixelShader          = nullptr;
+ID3D11PixelShader*  gRefractedImpostorPixelShader = nullptr;
+ID3D11PixelShader*  gReflectedImpostorPixelShader = nullptr;
+ID3D11PixelShader*  gImpostorDepthPixelShader     = nullptr;
+ID3D11PixelShader*  gImpostorBakePixelShader      = nullptr;
+
+
+//**********************
+// Post-processing shaders
+
+ID3D11VertexShader*  gPostProcessVertexShader    = nullptr;
+ID3D11PixelShader*   gLuminancePixelShader       = nullptr;
+ID3D11ComputeShader* gAdaptExposureComputeShader = nullptr;
+ID3D11PixelShader*   gBloomBrightPixelShader     = nullptr;
+ID3D11PixelShader*   gBloomBlurPixelShader       = nullptr;
+ID3D11PixelShader*   gTonemapPixelShader         = nullptr;
+ID3D11PixelShader*   gUpscalePixelShader         = nullptr;
+ID3D11PixelShader*   gSharpenPixelShader         = nullptr;
+ID3D11PixelShader*   gDepthResolvePixelShader    = nullptr;
+ID3D11PixelShader*   gUnderwaterFogPixelShader   = nullptr;
+
+ID3D11VertexShader*  gStatsOverlayVertexShader   = nullptr;
+ID3D11PixelShader*   gStatsOverlayPixelShader    = nullptr;
+
+ID3D11PixelShader*   gOverdrawCountPixelShader         = nullptr;
+ID3D11PixelShader*   gOverdrawHeatmapPixelShader       = nullptr;
+ID3D11PixelShader*   gQuadEfficiencyHeatmapPixelShader = nullptr;
 
 //**********************
 
 
 //--------------------------------------------------------------------------------------
-// Shader creation / destruction
+// Shader library
 //--------------------------------------------------------------------------------------
+// Opening and reading a separate .cso file for every shader adds up as the number of shaders grows. Instead LoadShaders
+// packs the bytecode of all the app's shaders into a single library file, and creates every shader straight from that
+// one memory-mapped file. The library is written the first time the app runs and again whenever a .cso file changes
+// (same idea as cooked meshes, see Mesh.cpp). Layout:
+// - ShaderLibraryHeader
+// - A ShaderLibraryEntry for each shader
+// - The bytecode of each shader
+// Shaders that aren't in the library (e.g. if it couldn't be written) are loaded from their .cso files as before
 
-// Load shaders required for this app, returns true on success
-bool LoadShaders()
+namespace
 {
-	// Shaders must be added to the Visual Studio project to be compiled, they use the extension ".hlsl".
-	// To load them for use, include them here without the extension. Use the correct function for each.
-	// Ensure you release the shaders in the ShutdownDirect3D function below
-	gBasicTransformVertexShader   = LoadVertexShader("BasicTransform_vs"  );
-	gPixelLightingVertexShader    = LoadVertexShader("PixelLighting_vs"   );
-	gTintedTexturePixelShader     = LoadPixelShader ("TintedTexture_ps"   );
-	gPixelLightingPixelShader     = LoadPixelShader ("PixelLighting_ps"   );
+	const char     ShaderLibraryFileName[] = "Shaders.pak";
+	const char     ShaderLibraryID[4]      = { 'S', 'L', 'I', 'B' };
+	const uint32_t ShaderLibraryVersion    = 1;
 
-	if (gBasicTransformVertexShader == nullptr || gPixelLightingVertexShader == nullptr ||
-		gTintedTexturePixelShader   == nullptr || gPixelLightingPixelShader  == nullptr)
+	struct ShaderLibraryHeader
 	{
-		gLastError = "Error loading shaders";
-		return false;
+		char     id[4];
+		uint32_t version;
+		uint32_t numShaders;
+		uint32_t padding;
+	};
+
+	struct ShaderLibraryEntry
+	{
+		char     name[48];
+		uint64_t sourceTime; // Last write time of the .cso file the bytecode was taken from. Out of date if this doesn't match
+		uint32_t offset;     // Position of the bytecode from the start of the file
+		uint32_t size;
+	};
+
+	// The open library and where each shader's bytecode is in it. Only changed in LoadShaders and ReleaseShaders, so
+	// shaders can be created from it on several threads at once
+	std::unique_ptr<MappedFile>                           gShaderLibrary;
+	std::map<std::string, std::pair<const void*, size_t>> gShaderLibraryCode; // Bytecode and size for each shader name
+
+
+	// Bytecode for one shader, either in the library or read from its .cso file into fileData
+	struct ShaderByteCode
+	{
+		const void*       data = nullptr;
+		size_t            size = 0;
+		std::vector<char> fileData;
+	};
+
+
+	// Read an entire compiled shader object file, returns false on failure
+	bool ReadShaderFile(const std::string& fileName, std::vector<char>& data)
+	{
+		std::ifstream shaderFile(fileName, std::ios::in | std::ios::binary | std::ios::ate);
+		if (!shaderFile.is_open())  return false;
+
+		std::streamoff fileSize = shaderFile.tellg();
+		if (fileSize <= 0)  return false;
+		shaderFile.seekg(0, std::ios::beg);
+		data.resize(static_cast<size_t>(fileSize));
+		shaderFile.read(data.data(), fileSize);
+		return !shaderFile.fail();
 	}
 
-	gBasicTransformWorldPosVertexShader = LoadVertexShader("BasicTransformWorldPos_vs");
-	gWaterSurfaceVertexShader           = LoadVertexShader("WaterSurface_vs"          );
-	gWaterSurfacePixelShader            = LoadPixelShader ("WaterSurface_ps"          );
-	gWaterHeightPixelShader             = LoadPixelShader ("WaterHeight_ps"   );
-	gReflectedPixelLightingPixelShader  = LoadPixelShader ("ReflectedPixelLighting_ps");
-	gReflectedTintedTexturePixelShader  = LoadPixelShader ("ReflectedTintedTexture_ps");
-	gRefractedPixelLightingPixelShader  = LoadPixelShader ("RefractedPixelLighting_ps");
-	gRefractedTintedTexturePixelShader  = LoadPixelShader ("RefractedTintedTexture_ps");
 
-	return true;
+	// Find the shaders in the open library. Returns false if the library is broken, or out of date for any of the given
+	// shaders - their .cso file is newer or they are missing. A shader with no .cso file uses the library as it is
+	bool ReadShaderLibrary(const std::vector<std::string>& shaderNames)
+	{
+		const unsigned char* data = gShaderLibrary->Data();
+		size_t               size = gShaderLibrary->Size();
+
+		ShaderLibraryHeader header;
+		if (size < sizeof(header))  return false;
+		memcpy(&header, data, sizeof(header));
+		if (memcmp(header.id, ShaderLibraryID, sizeof(ShaderLibraryID)) != 0 || header.version != ShaderLibraryVersion ||
+		    header.numShaders > (size - sizeof(header)) / sizeof(ShaderLibraryEntry))  return false;
+
+		std::map<std::string, ShaderLibraryEntry> entries;
+		for (uint32_t i = 0; i < header.numShaders; ++i)
+		{
+			ShaderLibraryEntry entry;
+			memcpy(&entry, data + sizeof(header) + i * sizeof(entry), sizeof(entry));
+			entry.name[sizeof(entry.name) - 1] = '\0';
+			if (entry.offset > size || entry.size > size - entry.offset)  return false;
+			entries[entry.name] = entry;
+		}
+
+		for (auto& shaderName : shaderNames)
+		{
+			auto     entry = entries.find(shaderName);
+			uint64_t time;
+			bool     hasFile = FileWriteTime(shaderName + ".cso", time);
+			if (hasFile && (entry == entries.end() || entry->second.sourceTime != time))  return false;
+		}
+
+		for (auto& entry : entries)
+		{
+			gShaderLibraryCode[entry.first] = { data + entry.second.offset, entry.second.size };
+		}
+		return true;
+	}
+
+
+	// Write a new library from the .cso files of the given shaders. Returns false if any of them can't be read or the
+	// library can't be written
+	bool WriteShaderLibrary(const std::vector<std::string>& shaderNames)
+	{
+		std::vector<ShaderLibraryEntry> entries(shaderNames.size());
+		std::vector<std::vector<char>>  byteCode(shaderNames.size());
+		uint32_t offset = static_cast<uint32_t>(sizeof(ShaderLibraryHeader) + shaderNames.size() * sizeof(ShaderLibraryEntry));
+		for (size_t i = 0; i < shaderNames.size(); ++i)
+		{
+			auto& entry = entries[i];
+			if (shaderNames[i].size() >= sizeof(entry.name))  return false;
+			if (!FileWriteTime(shaderNames[i] + ".cso", entry.sourceTime) || !ReadShaderFile(shaderNames[i] + ".cso", byteCode[i]))  return false;
+
+			memset(entry.name, 0, sizeof(entry.name));
+			memcpy(entry.name, shaderNames[i].data(), shaderNames[i].size());
+			entry.offset = offset;
+			entry.size   = static_cast<uint32_t>(byteCode[i].size());
+			offset += (entry.size + 3) & ~3u; // Keep the bytecode 4-byte aligned, DirectX reads it as 32-bit values
+		}
+
+		std::ofstream file(ShaderLibraryFileName, std::ios::binary);
+		if (!file)  return false;
+
+		ShaderLibraryHeader header = {};
+		memcpy(header.id, ShaderLibraryID, sizeof(ShaderLibraryID));
+		header.version    = ShaderLibraryVersion;
+		header.numShaders = static_cast<uint32_t>(entries.size());
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(ShaderLibraryEntry));
+		for (auto& code : byteCode)
+		{
+			const char padding[4] = {};
+			file.write(code.data(), code.size());
+			file.write(padding, (4 - code.size() % 4) % 4);
+		}
+
+		// Don't leave a partly written file behind
+		file.close();
+		if (!file)
+		{
+			std::remove(ShaderLibraryFileName);
+			return false;
+		}
+		return true;
+	}
+
+
+	// Open the shader library for the given shaders, writing it first if it is missing or out of date. If that fails
+	// the shaders are loaded from their .cso files
+	void OpenShaderLibrary(const std::vector<std::string>& shaderNames)
+	{
+		gShaderLibraryCode.clear();
+		gShaderLibrary.reset(new MappedFile(ShaderLibraryFileName));
+		if (gShaderLibrary->IsOpen() && ReadShaderLibrary(shaderNames))  return;
+
+		gShaderLibraryCode.clear();
+		gShaderLibrary.reset(); // Must be closed before it can be written again
+		if (!WriteShaderLibrary(shaderNames))  return;
+
+		gShaderLibrary.reset(new MappedFile(ShaderLibraryFileName));
+		if (!gShaderLibrary->IsOpen() || !ReadShaderLibrary(shaderNames))
+		{
+			gShaderLibraryCode.clear();
+			gShaderLibrary.reset();
+		}
+	}
+
+	void CloseShaderLibrary()
+	{
+		gShaderLibraryCode.clear();
+		gShaderLibrary.reset();
+	}
+
+
+	// Get the bytecode for a shader from the library if it is there, otherwise from its .cso file. Returns false on failure
+	bool GetShaderByteCode(const std::string& shaderName, ShaderByteCode& byteCode)
+	{
+		auto code = gShaderLibraryCode.find(shaderName);
+		if (code != gShaderLibraryCode.end())
+		{
+			byteCode.data = code->second.first;
+			byteCode.size = code->second.second;
+			return true;
+		}
+
+		if (!ReadShaderFile(shaderName + ".cso", byteCode.fileData))  return false;
+		byteCode.data = byteCode.fileData.data();
+		byteCode.size = byteCode.fileData.size();
+		return true;
+	}
+
+
+	// Create a shader object from bytecode, one overload for each type of shader
+	HRESULT CreateShader(const ShaderByteCode& byteCode, ID3D11VertexShader**   shader)  { return gD3DDevice->CreateVertexShader  (byteCode.data, byteCode.size, nullptr, shader); }
+	HRESULT CreateShader(const ShaderByteCode& byteCode, ID3D11HullShader**     shader)  { return gD3DDevice->CreateHullShader    (byteCode.data, byteCode.size, nullptr, shader); }
+	HRESULT CreateShader(const ShaderByteCode& byteCode, ID3D11DomainShader**   shader)  { return gD3DDevice->CreateDomainShader  (byteCode.data, byteCode.size, nullptr, shader); }
+	HRESULT CreateShader(const ShaderByteCode& byteCode, ID3D11GeometryShader** shader)  { return gD3DDevice->CreateGeometryShader(byteCode.data, byteCode.size, nullptr, shader); }
+	HRESULT CreateShader(const ShaderByteCode& byteCode, ID3D11PixelShader**    shader)  { return gD3DDevice->CreatePixelShader   (byteCode.data, byteCode.size, nullptr, shader); }
+	HRESULT CreateShader(const ShaderByteCode& byteCode, ID3D11ComputeShader**  shader)  { return gD3DDevice->CreateComputeShader (byteCode.data, byteCode.size, nullptr, shader); }
+
+	// Load any type of shader, used by the Load...Shader functions at the bottom of this file. Returns nullptr on failure
+	template <class T>
+	T* LoadShader(const std::string& shaderName)
+	{
+		ShaderByteCode byteCode;
+		if (!GetShaderByteCode(shaderName, byteCode))  return nullptr;
+
+		T* shader;
+		if (FAILED(CreateShader(byteCode, &shader)))  return nullptr;
+		return shader;
+	}
+
+
+	// Find the cost of a shader from its bytecode. Costs are left at zero if the bytecode can't be reflected
+	ShaderCost ReflectShaderCost(const std::string& shaderName, const ShaderByteCode& byteCode)
+	{
+		ShaderCost cost;
+		cost.name = shaderName;
+		ID3D11ShaderReflection* reflection = nullptr;
+		if (FAILED(D3DReflect(byteCode.data, byteCode.size, IID_ID3D11ShaderReflection, reinterpret_cast<void**>(&reflection))))
+		{
+			return cost;
+		}
+
+		D3D11_SHADER_DESC desc;
+		if (SUCCEEDED(reflection->GetDesc(&desc)))
+		{
+			cost.instructions   = desc.InstructionCount;
+			cost.arithmetic     = desc.FloatInstructionCount + desc.IntInstructionCount + desc.UintInstructionCount;
+			cost.textureFetches = desc.TextureNormalInstructions + desc.TextureLoadInstructions + desc.TextureCompInstructions +
+			                      desc.TextureBiasInstructions + desc.TextureGradientInstructions;
+			cost.tempRegisters  = desc.TempRegisterCount;
+			for (UINT i = 0; i < desc.ConstantBuffers; ++i)
+			{
+				D3D11_SHADER_BUFFER_DESC bufferDesc;
+				if (FAILED(reflection->GetConstantBufferByIndex(i)->GetDesc(&bufferDesc)) || bufferDesc.Type != D3D_CT_CBUFFER)  continue;
+				++cost.constantBuffers;
+				cost.constantBytes += bufferDesc.Size;
+			}
+		}
+		reflection->Release();
+		return cost;
+	}
+
+
+	// Compiler target for each type of shader, used when shaders are recompiled (see hot reload below)
+	const char* ShaderProfile(ID3D11VertexShader*)    { return "vs_5_0"; }
+	const char* ShaderProfile(ID3D11HullShader*)      { return "hs_5_0"; }
+	const char* ShaderProfile(ID3D11DomainShader*)    { return "ds_5_0"; }
+	const char* ShaderProfile(ID3D11GeometryShader*)  { return "gs_5_0"; }
+	const char* ShaderProfile(ID3D11PixelShader*)     { return "ps_5_0"; }
+	const char* ShaderProfile(ID3D11ComputeShader*)   { return "cs_5_0"; }
+
+
+	// One of the app's shaders (see LoadShaders): its name, and functions to create it and to put it in its variable. The
+	// create function can be used on any thread, the replace function must only be used where the shader isn't in use
+	struct ShaderLoad
+	{
+		template <class T>
+		ShaderLoad(const char* shaderName, T*& shader)
+			: name(shaderName), profile(ShaderProfile(static_cast<T*>(nullptr))),
+			  create([](const ShaderByteCode& byteCode) -> ID3D11DeviceChild*
+			  {
+				  T* newShader;
+				  return SUCCEEDED(CreateShader(byteCode, &newShader)) ? newShader : nullptr;
+			  }),
+			  replace([&shader](ID3D11DeviceChild* newShader)
+			  {
+				  if (shader)  shader->Release();
+				  shader = static_cast<T*>(newShader);
+			  }) {}
+
+		// Create the shader from the library or its .cso file and find its cost, returns false on failure
+		bool Load()
+		{
+			ShaderByteCode byteCode;
+			ID3D11DeviceChild* shader = GetShaderByteCode(name, byteCode) ? create(byteCode) : nullptr;
+			if (shader != nullptr)  cost = ReflectShaderCost(name, byteCode);
+			replace(shader);
+			return shader != nullptr;
+		}
+
+		std::string                                            name;
+		const char*                                            profile;
+		ShaderCost                                             cost;
+		std::function<ID3D11DeviceChild*(const ShaderByteCode&)> create;
+		std::function<void(ID3D11DeviceChild*)>                  replace;
+	};
+
+	// The shaders loaded by LoadShaders
+	std::vector<ShaderLoad> gShaders;
 }
 
 
-void ReleaseShaders()
+//--------------------------------------------------------------------------------------
+// Input layout cache
+//--------------------------------------------------------------------------------------
+// Creating an input layout needs a shader signature compiled to match (see CreateSignatureForVertexLayout), which
+// is slow to do for every sub-mesh of every mesh. Meshes with the same vertex elements share one layout instead
+
+namespace
 {
-	if (gBasicTransformWorldPosVertexShader)  gBasicTransformWorldPosVertexShader->Release();
-	if (gWaterSurfaceVertexShader          )  gWaterSurfaceVertexShader          ->Release();
-	if (gWaterSurfacePixelShader           )  gWaterSurfacePixelShader           ->Release();
-	if (gWaterHeightPixelShader            )  gWaterHeightPixelShader            ->Release();
-	if (gReflectedPixelLightingPixelShader )  gReflectedPixelLightingPixelShader ->Release();
-	if (gReflectedTintedTexturePixelShader )  gReflectedTintedTexturePixelShader ->Release();
-	if (gRefractedPixelLightingPixelShader )  gRefractedPixelLightingPixelShader ->Release();
-	if (gRefractedTintedTexturePixelShader )  gRefractedTintedTexturePixelShader ->Release();
+	std::map<std::string, ID3D11InputLayout*> gInputLayouts; // Key is made from the vertex elements
+	std::mutex                                gInputLayoutsMutex;
 
-	if (gPixelLightingPixelShader  )  gPixelLightingPixelShader  ->Release();
-	if (gTintedTexturePixelShader  )  gTintedTexturePixelShader  ->Release();
-	if (gPixelLightingVertexShader )  gPixelLightingVertexShader ->Release();
-	if (gBasicTransformVertexShader)  gBasicTransformVertexShader->Release();
+	void ReleaseInputLayouts()
+	{
+		std::lock_guard<std::mutex> lock(gInputLayoutsMutex);
+		for (auto& inputLayout : gInputLayouts)  inputLayout.second->Release();
+		gInputLayouts.clear();
+	}
 }
 
 
+//--------------------------------------------------------------------------------------
+// Shader hot reload
+//--------------------------------------------------------------------------------------
+// While gShaderHotReload is set, a worker thread watches the .hlsl files of the app's shaders and the files they
+// #include. When any of them changes the shaders using it are compiled again on that thread, and UpdateShaders swaps
+// them in at the start of the next frame. If a shader doesn't compile the old one is kept and the errors are shown in
+// the debugger output window. Recompiled shaders only last until the app quits - rebuild to update the .cso files
+
+#ifdef _DEBUG
+bool gShaderHotReload = true;
+#else
+bool gShaderHotReload = false;
+#endif
 
-// Load a vertex shader, include the file in the project and pass the name (without the .hlsl extension)
-// to this function. The returned pointer needs to be released before quitting. Returns nullptr on failure. 
-ID3D11VertexShader* LoadVertexShader(std::string shaderName)
+namespace
 {
-	// Open compiled shader object file
-	std::ifstream shaderFile(shaderName + ".cso", std::ios::in | std::ios::binary | std::ios::ate);
-	if (!shaderFile.is_open())
+	// How often the worker thread looks for changed files
+	const std::chrono::milliseconds HotReloadInterval(500);
+
+	std::thread             gHotReloadThread;
+	std::mutex              gHotReloadMutex; // For everything below
+	std::condition_variable gHotReloadWake;
+	bool                    gHotReloadStop = false;
+
+	// Shaders compiled by the worker thread waiting for UpdateShaders, with their index in gShaders and their new cost
+	struct ReloadedShader
 	{
-		return nullptr;
+		size_t             index;
+		ID3D11DeviceChild* shader;
+		ShaderCost         cost;
+	};
+	std::vector<ReloadedShader> gReloadedShaders;
+
+	// Names of the shaders whose last compile failed
+	std::set<std::string> gShaderReloadErrors;
+
+
+	// Add a source file and the files it #includes (and so on) to the given set. Only looks for #include "file"
+	// lines, which is all the shaders here use. Files that can't be opened are added but not searched
+	void FindShaderFiles(const std::string& fileName, std::set<std::string>& files)
+	{
+		if (!files.insert(fileName).second)  return; // Already searched
+
+		std::ifstream file(fileName);
+		std::string line;
+		while (std::getline(file, line))
+		{
+			auto include = line.find("#include");
+			if (include == std::string::npos)  continue;
+			auto start = line.find('"', include);
+			auto end   = (start == std::string::npos) ? start : line.find('"', start + 1);
+			if (end != std::string::npos)  FindShaderFiles(line.substr(start + 1, end - start - 1), files);
+		}
 	}
 
-	// Read file into vector of chars
-	std::streamoff fileSize = shaderFile.tellg();
-	shaderFile.seekg(0, std::ios::beg);
-	std::vector<char> byteCode(fileSize);
-	shaderFile.read(&byteCode[0], fileSize);
-	if (shaderFile.fail())
+
+	// Definitions passed to the compiler, must match the HLSL compiler settings in the project (see the permutations in
+	// Common.hlsli). Debug builds read the water settings from a constant buffer so they can be tuned
+	const D3D_SHADER_MACRO ShaderDefines[] =
 	{
-		return nullptr;
+#ifdef _DEBUG
+		{ "WATER_RUNTIME_CONSTANTS", "1" },
+#endif
+		{ nullptr, nullptr }
+	};
+
+
+	// Compile one shader from its .hlsl file and find its cost. Returns the new shader object, or nullptr if it doesn't compile
+	ID3D11DeviceChild* CompileShader(const ShaderLoad& shader, ShaderCost& cost)
+	{
+		// Always optimise, the shaders are being tuned for speed
+		std::string fileName = shader.name + ".hlsl";
+		std::wstring wideFileName(fileName.begin(), fileName.end());
+		ID3DBlob* compiledShader = nullptr;
+		ID3DBlob* errors = nullptr;
+		HRESULT hr = D3DCompileFromFile(wideFileName.c_str(), ShaderDefines, D3D_COMPILE_STANDARD_FILE_INCLUDE, "main", shader.profile,
+		                                D3DCOMPILE_OPTIMIZATION_LEVEL3, 0, &compiledShader, &errors);
+		if (errors)
+		{
+			OutputDebugStringA(static_cast<const char*>(errors->GetBufferPointer()));
+			errors->Release();
+		}
+		if (FAILED(hr))
+		{
+			OutputDebugStringA(("Shader hot reload: " + shader.name + " failed to compile, keeping the old shader\n").c_str());
+			return nullptr;
+		}
+
+		ShaderByteCode byteCode;
+		byteCode.data = compiledShader->GetBufferPointer();
+		byteCode.size = compiledShader->GetBufferSize();
+		ID3D11DeviceChild* newShader = shader.create(byteCode);
+		cost = ReflectShaderCost(shader.name, byteCode);
+		compiledShader->Release();
+		return newShader;
 	}
 
-	// Create shader object from loaded file (we will use the object later when rendering)
-	ID3D11VertexShader* shader;
-	HRESULT hr = gD3DDevice->CreateVertexShader(byteCode.data(), byteCode.size(), nullptr, &shader);
-	if (FAILED(hr))
+
+	// The worker thread. Compares the latest write time of each shader's files with the last look, starting from when
+	// the thread started, so only changes made while it runs cause a recompile
+	void HotReloadThread()
 	{
-		return nullptr;
+		std::vector<uint64_t> shaderTimes(gShaders.size(), 0);
+		bool firstLook = true;
+
+		std::unique_lock<std::mutex> lock(gHotReloadMutex);
+		while (!gHotReloadStop)
+		{
+			lock.unlock();
+			for (size_t i = 0; i < gShaders.size(); ++i)
+			{
+				std::set<std::string> files;
+				FindShaderFiles(gShaders[i].name + ".hlsl", files);
+				uint64_t latestTime = 0;
+				for (auto& file : files)
+				{
+					uint64_t time;
+					if (FileWriteTime(file, time))  latestTime = (std::max)(latestTime, time);
+				}
+				if (latestTime == shaderTimes[i])  continue;
+				shaderTimes[i] = latestTime;
+				if (firstLook)  continue;
+
+				ShaderCost cost;
+				ID3D11DeviceChild* newShader = CompileShader(gShaders[i], cost);
+				std::lock_guard<std::mutex> reloadLock(gHotReloadMutex);
+				if (newShader != nullptr)
+				{
+					gReloadedShaders.push_back({ i, newShader, cost });
+					gShaderReloadErrors.erase(gShaders[i].name);
+				}
+				else
+				{
+					gShaderReloadErrors.insert(gShaders[i].name);
+				}
+			}
+			firstLook = false;
+			lock.lock();
+
+			gHotReloadWake.wait_for(lock, HotReloadInterval, []() { return gHotReloadStop; });
+		}
 	}
 
-	return shader;
+
+	void StopHotReload()
+	{
+		if (!gHotReloadThread.joinable())  return;
+		{
+			std::lock_guard<std::mutex> lock(gHotReloadMutex);
+			gHotReloadStop = true;
+		}
+		gHotReloadWake.notify_all();
+		gHotReloadThread.join();
+
+		// Drop any shaders that were never swapped in
+		for (auto& reloaded : gReloadedShaders)  reloaded.shader->Release();
+		gReloadedShaders.clear();
+		gShaderReloadErrors.clear();
+	}
 }
 
 
-// Load a hull shader, include the file in the project and pass the name (without the .hlsl extension)
-// to this function. The returned pointer needs to be released before quitting. Returns nullptr on failure. 
-ID3D11HullShader* LoadHullShader(std::string shaderName)
+// Call once per frame on the main thread before rendering: starts or stops watching the shader files to match
+// gShaderHotReload, and swaps in any shaders that have been recompiled. The passes use the shaders on other threads,
+// so this is the only place they can change
+void UpdateShaders()
 {
-	// Open compiled shader object file
-	std::ifstream shaderFile(shaderName + ".cso", std::ios::in | std::ios::binary | std::ios::ate);
-	if (!shaderFile.is_open())
+	if (!gShaderHotReload)
 	{
-		return nullptr;
+		StopHotReload();
+		return;
 	}
-
-	// Read file into vector of chars
-	std::streamoff fileSize = shaderFile.tellg();
-	shaderFile.seekg(0, std::ios::beg);
-	std::vector<char> byteCode(fileSize);
-	shaderFile.read(&byteCode[0], fileSize);
-	if (shaderFile.fail())
+	if (!gHotReloadThread.joinable())
 	{
-		return nullptr;
+		gHotReloadStop = false;
+		gHotReloadThread = std::thread(HotReloadThread);
+		return;
 	}
 
-	// Create shader object from loaded file (we will use the object later when rendering)
-	ID3D11HullShader* shader;
-	HRESULT hr = gD3DDevice->CreateHullShader(byteCode.data(), byteCode.size(), nullptr, &shader);
-	if (FAILED(hr))
+	std::lock_guard<std::mutex> lock(gHotReloadMutex);
+	for (auto& reloaded : gReloadedShaders)
 	{
-		return nullptr;
+		gShaders[reloaded.index].replace(reloaded.shader);
+		gShaders[reloaded.index].cost = reloaded.cost;
+		OutputDebugStringA(("Shader hot reload: " + gShaders[reloaded.index].name + " updated\n").c_str());
 	}
+	gReloadedShaders.clear();
+}
 
-	return shader;
+
+// Names of the shaders that failed to compile the last time they changed, separated by commas. Empty if there are none
+std::string ShaderReloadErrors()
+{
+	std::lock_guard<std::mutex> lock(gHotReloadMutex);
+	std::string names;
+	for (auto& name : gShaderReloadErrors)  names += (names.empty() ? "" : ", ") + name;
+	return names;
 }
 
 
-// Load a domain shader, include the file in the project and pass the name (without the .hlsl extension)
-// to this function. The returned pointer needs to be released before quitting. Returns nullptr on failure. 
-ID3D11DomainShader* LoadDomainShader(std::string shaderName)
+//--------------------------------------------------------------------------------------
+// Shader cost report
+//--------------------------------------------------------------------------------------
+
+// The costs of the app's shaders, in the order LoadShaders loads them
+std::vector<ShaderCost> ShaderCosts()
+{
+	std::vector<ShaderCost> costs;
+	for (auto& shader : gShaders)  costs.push_back(shader.cost);
+	return costs;
+}
+
+// The cost of one of the app's shaders by name, nullptr if there is no such shader
+const ShaderCost* FindShaderCost(const char* name)
 {
-	// Open compiled shader object file
-	std::ifstream shaderFile(shaderName + ".cso", std::ios::in | std::ios::binary | std::ios::ate);
-	if (!shaderFile.is_open())
+	for (auto& shader : gShaders)  if (shader.name == name)  return &shader.cost;
+	return nullptr;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Shader creation / destruction
+//--------------------------------------------------------------------------------------
+
+// Load shaders required for this app, returns true on success
+bool LoadShaders()
+{
+	// Shaders must be added to the Visual Studio project to be compiled, they use the extension ".hlsl".
+	// To load them for use, include them here without the extension, with the variable to load them into.
+	// The type of the variable decides the type of shader loaded. Ensure you release the shaders in ReleaseShaders below
+	gShaders =
 	{
-		return nullptr;
+		{ "InstancedTransform_vs", gInstancedTransformVertexShader },
+		{ "PixelLighting_vs",      gPixelLightingVertexShader      },
+		{ "TintedTexture_ps",      gTintedTexturePixelShader       },
+		{ "PixelLighting_ps",      gPixelLightingPixelShader       },
+		{ "Sky_vs",                gSkyVertexShader                },
+		{ "Sky_ps",                gSkyPixelShader                 },
+		{ "Terrain_vs",            gTerrainVertexShader            },
+		{ "ShadowDepth_vs",        gShadowDepthVertexShader        },
+
+		{ "BasicTransformWorldPos_vs", gBasicTransformWorldPosVertexShader },
+		{ "WaterSurface_vs",           gWaterSurfaceVertexShader           },
+		{ "WaterSurface_ps",           gWaterSurfacePixelShader            },
+		{ "WaterCheckerboardFill_ps",  gWaterCheckerboardFillPixelShader   },
+		{ "ReflectedPixelLighting_ps", gReflectedPixelLightingPixelShader  },
+		{ "ReflectedTintedTexture_ps", gReflectedTintedTexturePixelShader  },
+		{ "RefractedPixelLighting_ps", gRefractedPixelLightingPixelShader  },
+		{ "RefractedTintedTexture_ps", gRefractedTintedTexturePixelShader  },
+		{ "WaterViews_gs",             gWaterViewsGeometryShader           },
+		{ "WaterViewsPixelLighting_ps", gWaterViewsPixelLightingPixelShader },
+		{ "RefractedSimpleLighting_ps",  gRefractedSimpleLightingPixelShader  },
+		{ "ReflectedSimpleLighting_ps",  gReflectedSimpleLightingPixelShader  },
+		{ "WaterViewsSimpleLighting_ps", gWaterViewsSimpleLightingPixelShader },
+
+		{ "WaterSurfaceTess_vs", gWaterSurfaceTessVertexShader },
+		{ "WaterSurface_hs",     gWaterSurfaceHullShader       },
+		{ "WaterSurface_ds",     gWaterSurfaceDomainShader     },
+
+		{ "WaterDisplace_cs",      gWaterDisplaceComputeShader     },
+		{ "WaterSurfaceCached_vs", gWaterSurfaceCachedVertexShader },
+
+		{ "OceanSpectrum_cs", gOceanSpectrumComputeShader },
+		{ "OceanFFT_cs",      gOceanFFTComputeShader      },
+		{ "OceanCombine_cs",  gOceanCombineComputeShader  },
+		{ "Caustics_cs",      gCausticsComputeShader      },
+		{ "Ripples_cs",       gRipplesComputeShader       },
+		{ "WaveComposite_cs", gWaveCompositeComputeShader },
+
+		{ "Skinning_cs",     gSkinningComputeShader     },
+		{ "InstanceCull_cs", gInstanceCullComputeShader },
+		{ "HiZ_cs",             gHiZComputeShader             },
+		{ "HiZMultisampled_cs", gHiZMultisampledComputeShader },
+
+		{ "ParticleSimulate_cs", gParticleSimulateComputeShader },
+		{ "ParticleEmit_cs",     gParticleEmitComputeShader     },
+		{ "ParticleSort_cs",     gParticleSortComputeShader     },
+		{ "Particle_vs",         gParticleVertexShader          },
+		{ "Particle_ps",         gParticlePixelShader           },
+
+		{ "Impostor_vs",          gImpostorVertexShader         },
+		{ "Impostor_ps",          gImpostorPixelShader          },
+		{ "RefractedImpostor_ps", gRefractedImpostorPixelShader },
+		{ "ReflectedImpostor_ps", gReflectedImpostorPixelShader },
+		{ "ImpostorDepth_ps",     gImpostorDepthPixelShader     },
+		{ "ImpostorBake_ps",      gImpostorBakePixelShader      },
+
+		{ "PostProcess_vs",   gPostProcessVertexShader    },
+		{ "Luminance_ps",     gLuminancePixelShader       },
+		{ "AdaptExposure_cs", gAdaptExposureComputeShader },
+		{ "BloomBright_ps",   gBloomBrightPixelShader     },
+		{ "BloomBlur_ps",     gBloomBlurPixelShader       },
+		{ "Tonemap_ps",       gTonemapPixelShader         },
+		{ "Upscale_ps",       gUpscalePixelShader         },
+		{ "Sharpen_ps",       gSharpenPixelShader         },
+		{ "DepthResolve_ps",  gDepthResolvePixelShader    },
+		{ "UnderwaterFog_ps", gUnderwaterFogPixelShader   },
+
+		{ "StatsOverlay_vs", gStatsOverlayVertexShader },
+		{ "StatsOverlay_ps", gStatsOverlayPixelShader  },
+
+		{ "OverdrawCount_ps",         gOverdrawCountPixelShader         },
+		{ "OverdrawHeatmap_ps",       gOverdrawHeatmapPixelShader       },
+		{ "QuadEfficiencyHeatmap_ps", gQuadEfficiencyHeatmapPixelShader },
+	};
+
+	// Read all the bytecode at once from the shader library, then create the shader objects in parallel on the thread pool -
+	// the device can be used from several threads at once and drivers do much of their work when a shader is created
+	std::vector<std::string> shaderNames;
+	for (auto& shader : gShaders)  shaderNames.push_back(shader.name);
+	OpenShaderLibrary(shaderNames);
+
+	gJobSystem->ParallelFor(static_cast<int>(gShaders.size()), 1, [](int i) { gShaders[i].Load(); });
+
+	if (gInstancedTransformVertexShader == nullptr || gPixelLightingVertexShader == nullptr ||
+		gTintedTexturePixelShader       == nullptr || gPixelLightingPixelShader  == nullptr ||
+		gSkyVertexShader                == nullptr || gSkyPixelShader            == nullptr ||
+		gTerrainVertexShader            == nullptr || gShadowDepthVertexShader   == nullptr)
+	{
+		gLastError = "Error loading shaders";
+		return false;
 	}
 
-	// Read file into vector of chars
-	std::streamoff fileSize = shaderFile.tellg();
-	shaderFile.seekg(0, std::ios::beg);
-	std::vector<char> byteCode(fileSize);
-	shaderFile.read(&byteCode[0], fileSize);
-	if (shaderFile.fail())
+	if (gBasicTransformWorldPosVertexShader == nullptr || gWaterSurfaceVertexShader          == nullptr ||
+		gWaterSurfacePixelShader            == nullptr || gWaterCheckerboardFillPixelShader  == nullptr ||
+		gReflectedPixelLightingPixelShader  == nullptr || gReflectedTintedTexturePixelShader == nullptr ||
+		gRefractedPixelLightingPixelShader  == nullptr || gRefractedTintedTexturePixelShader == nullptr ||
+		gWaterViewsGeometryShader           == nullptr || gWaterViewsPixelLightingPixelShader == nullptr ||
+		gRefractedSimpleLightingPixelShader == nullptr || gReflectedSimpleLightingPixelShader == nullptr ||
+		gWaterViewsSimpleLightingPixelShader == nullptr)
 	{
-		return nullptr;
+		gLastError = "Error loading water shaders";
+		return false;
 	}
 
-	// Create shader object from loaded file (we will use the object later when rendering)
-	ID3D11DomainShader* shader;
-	HRESULT hr = gD3DDevice->CreateDomainShader(byteCode.data(), byteCode.size(), nullptr, &shader);
-	if (FAILED(hr))
+	if (gWaterSurfaceTessVertexShader == nullptr || gWaterSurfaceHullShader == nullptr || gWaterSurfaceDomainShader == nullptr)
 	{
-		return nullptr;
+		gLastError = "Error loading tessellated water shaders";
+		return false;
 	}
 
-	return shader;
-}
+	if (gWaterDisplaceComputeShader == nullptr || gWaterSurfaceCachedVertexShader == nullptr)
+	{
+		gLastError = "Error loading water vertex cache shaders";
+		return false;
+	}
 
+	if (gOceanSpectrumComputeShader == nullptr || gOceanFFTComputeShader == nullptr || gOceanCombineComputeShader == nullptr ||
+		gCausticsComputeShader      == nullptr || gRipplesComputeShader      == nullptr || gWaveCompositeComputeShader == nullptr)
+	{
+		gLastError = "Error loading ocean compute shaders";
+		return false;
+	}
 
-// Load a geometry shader, include the file in the project and pass the name (without the .hlsl extension)
-// to this function. The returned pointer needs to be released before quitting. Returns nullptr on failure. 
-// Basically the same code as above but for pixel shaders
-ID3D11GeometryShader* LoadGeometryShader(std::string shaderName)
-{
-	// Open compiled shader object file
-	std::ifstream shaderFile(shaderName + ".cso", std::ios::in | std::ios::binary | std::ios::ate);
-	if (!shaderFile.is_open())
+	if (gSkinningComputeShader == nullptr || gInstanceCullComputeShader == nullptr ||
+		gHiZComputeShader      == nullptr || gHiZMultisampledComputeShader == nullptr)
 	{
-		return nullptr;
+		gLastError = "Error loading skinning / culling compute shaders";
+		return false;
 	}
 
-	// Read file into vector of chars
-	std::streamoff fileSize = shaderFile.tellg();
-	shaderFile.seekg(0, std::ios::beg);
-	std::vector<char>byteCode(fileSize);
-	shaderFile.read(&byteCode[0], fileSize);
-	if (shaderFile.fail())
+	if (gParticleSimulateComputeShader == nullptr || gParticleEmitComputeShader == nullptr || gParticleSortComputeShader == nullptr ||
+		gParticleVertexShader          == nullptr || gParticlePixelShader       == nullptr)
 	{
-		return nullptr;
+		gLastError = "Error loading particle shaders";
+		return false;
 	}
 
-	// Create shader object from loaded file (we will use the object later when rendering)
-	ID3D11GeometryShader* shader;
-	HRESULT hr = gD3DDevice->CreateGeometryShader(byteCode.data(), byteCode.size(), nullptr, &shader);
-	if (FAILED(hr))
+	if (gImpostorVertexShader         == nullptr || gImpostorPixelShader          == nullptr ||
+		gRefractedImpostorPixelShader == nullptr || gReflectedImpostorPixelShader == nullptr ||
+		gImpostorDepthPixelShader     == nullptr || gImpostorBakePixelShader      == nullptr)
 	{
-		return nullptr;
+		gLastError = "Error loading impostor shaders";
+		return false;
 	}
 
-	return shader;
+	if (gPostProcessVertexShader == nullptr || gLuminancePixelShader == nullptr || gAdaptExposureComputeShader == nullptr ||
+		gBloomBrightPixelShader  == nullptr || gBloomBlurPixelShader == nullptr || gTonemapPixelShader         == nullptr ||
+		gDepthResolvePixelShader == nullptr || gUnderwaterFogPixelShader == nullptr ||
+		gUpscalePixelShader      == nullptr || gSharpenPixelShader       == nullptr)
+	{
+		gLastError = "Error loading post-processing shaders";
+		return false;
+	}
+
+	if (gStatsOverlayVertexShader == nullptr || gStatsOverlayPixelShader == nullptr)
+	{
+		gLastError = "Error loading stats overlay shaders";
+		return false;
+	}
+
+	if (gOverdrawCountPixelShader == nullptr || gOverdrawHeatmapPixelShader == nullptr || gQuadEfficiencyHeatmapPixelShader == nullptr)
+	{
+		gLastError = "Error loading overdraw view shaders";
+		return false;
+	}
+
+	return true;
+}
+
+
+// Release shaders used by the app
+void ReleaseShaders()
+{
+	StopHotReload();
+	gShaders.clear();
+	ReleaseInputLayouts();
+	CloseShaderLibrary();
+
+	if (gQuadEfficiencyHeatmapPixelShader)  gQuadEfficiencyHeatmapPixelShader->Release();
+	if (gOverdrawHeatmapPixelShader      )  gOverdrawHeatmapPixelShader      ->Release();
+	if (gOverdrawCountPixelShader        )  gOverdrawCountPixelShader        ->Release();
+
+	if (gStatsOverlayPixelShader   )  gStatsOverlayPixelShader   ->Release();
+	if (gStatsOverlayVertexShader  )  gStatsOverlayVertexShader  ->Release();
+
+	if (gUnderwaterFogPixelShader  )  gUnderwaterFogPixelShader  ->Release();
+	if (gDepthResolvePixelShader   )  gDepthResolvePixelShader   ->Release();
+	if (gSharpenPixelShader        )  gSharpenPixelShader        ->Release();
+	if (gUpscalePixelShader        )  gUpscalePixelShader        ->Release();
+	if (gTonemapPixelShader        )  gTonemapPixelShader        ->Release();
+	if (gBloomBlurPixelShader      )  gBloomBlurPixelShader      ->Release();
+	if (gBloomBrightPixelShader    )  gBloomBrightPixelShader    ->Release();
+	if (gAdaptExposureComputeShader)  gAdaptExposureComputeShader->Release();
+	if (gLuminancePixelShader      )  gLuminancePixelShader      ->Release();
+	if (gPostProcessVertexShader   )  gPostProcessVertexShader   ->Release();
+
+	if (gImpostorBakePixelShader     )  gImpostorBakePixelShader     ->Release();
+	if (gImpostorDepthPixelShader    )  gImpostorDepthPixelShader    ->Release();
+	if (gReflectedImpostorPixelShader)  gReflectedImpostorPixelShader->Release();
+	if (gRefractedImpostorPixelShader)  gRefractedImpostorPixelShader->Release();
+	if (gImpostorPixelShader         )  gImpostorPixelShader         ->Release();
+	if (gImpostorVertexShader        )  gImpostorVertexShader        ->Release();
+
+	if (gParticlePixelShader          )  gParticlePixelShader          ->Release();
+	if (gParticleVertexShader         )  gParticleVertexShader         ->Release();
+	if (gParticleSortComputeShader    )  gParticleSortComputeShader    ->Release();
+	if (gParticleEmitComputeShader    )  gParticleEmitComputeShader    ->Release();
+	if (gParticleSimulateComputeShader)  gParticleSimulateComputeShader->Release();
+
+	if (gHiZMultisampledComputeShader)  gHiZMultisampledComputeShader->Release();
+	if (gHiZComputeShader)              gHiZComputeShader->Release();
+	if (gInstanceCullComputeShader)  gInstanceCullComputeShader->Release();
+	if (gSkinningComputeShader)      gSkinningComputeShader->Release();
+
+	if (gWaveCompositeComputeShader)  gWaveCompositeComputeShader->Release();
+	if (gRipplesComputeShader      )  gRipplesComputeShader      ->Release();
+	if (gCausticsComputeShader     )  gCausticsComputeShader     ->Release();
+	if (gOceanCombineComputeShader )  gOceanCombineComputeShader ->Release();
+	if (gOceanFFTComputeShader     )  gOceanFFTComputeShader     ->Release();
+	if (gOceanSpectrumComputeShader)  gOceanSpectrumComputeShader->Release();
+
+	if (gWaterSurfaceCachedVertexShader)  gWaterSurfaceCachedVertexShader->Release();
+	if (gWaterDisplaceComputeShader    )  gWaterDisplaceComputeShader    ->Release();
+
+	if (gWaterSurfaceDomainShader    )  gWaterSurfaceDomainShader    ->Release();
+	if (gWaterSurfaceHullShader      )  gWaterSurfaceHullShader      ->Release();
+	if (gWaterSurfaceTessVertexShader)  gWaterSurfaceTessVertexShader->Release();
+
+	if (gBasicTransformWorldPosVertexShader)  gBasicTransformWorldPosVertexShader->Release();
+	if (gWaterSurfaceVertexShader          )  gWaterSurfaceVertexShader          ->Release();
+	if (gWaterSurfacePixelShader           )  gWaterSurfacePixelShader           ->Release();
+	if (gWaterCheckerboardFillPixelShader  )  gWaterCheckerboardFillPixelShader  ->Release();
+	if (gReflectedPixelLightingPixelShader )  gReflectedPixelLightingPixelShader ->Release();
+	if (gReflectedTintedTexturePixelShader )  gReflectedTintedTexturePixelShader ->Release();
+	if (gRefractedPixelLightingPixelShader )  gRefractedPixelLightingPixelShader ->Release();
+	if (gRefractedTintedTexturePixelShader )  gRefractedTintedTexturePixelShader ->Release();
+	if (gWaterViewsGeometryShader          )  gWaterViewsGeometryShader          ->Release();
+	if (gWaterViewsPixelLightingPixelShader)  gWaterViewsPixelLightingPixelShader->Release();
+	if (gRefractedSimpleLightingPixelShader )  gRefractedSimpleLightingPixelShader ->Release();
+	if (gReflectedSimpleLightingPixelShader )  gReflectedSimpleLightingPixelShader ->Release();
+	if (gWaterViewsSimpleLightingPixelShader)  gWaterViewsSimpleLightingPixelShader->Release();
+
+	if (gShadowDepthVertexShader   )  gShadowDepthVertexShader   ->Release();
+	if (gTerrainVertexShader       )  gTerrainVertexShader       ->Release();
+	if (gSkyPixelShader            )  gSkyPixelShader            ->Release();
+	if (gSkyVertexShader           )  gSkyVertexShader           ->Release();
+	if (gPixelLightingPixelShader  )  gPixelLightingPixelShader  ->Release();
+	if (gTintedTexturePixelShader  )  gTintedTexturePixelShader  ->Release();
+	if (gPixelLightingVertexShader )  gPixelLightingVertexShader ->Release();
+	if (gInstancedTransformVertexShader)  gInstancedTransformVertexShader->Release();
 }
 
 
+
+// Load a shader, include the file in the project and pass the name (without the .hlsl extension) to these functions.
+// The bytecode comes from the shader library if it has been opened by LoadShaders, otherwise from the .cso file.
+// The returned pointer needs to be released before quitting. Returns nullptr on failure. 
+ID3D11VertexShader*   LoadVertexShader  (std::string shaderName)  { return LoadShader<ID3D11VertexShader  >(shaderName); }
+ID3D11HullShader*     LoadHullShader    (std::string shaderName)  { return LoadShader<ID3D11HullShader    >(shaderName); }
+ID3D11DomainShader*   LoadDomainShader  (std::string shaderName)  { return LoadShader<ID3D11DomainShader  >(shaderName); }
+ID3D11GeometryShader* LoadGeometryShader(std::string shaderName)  { return LoadShader<ID3D11GeometryShader>(shaderName); }
+ID3D11PixelShader*    LoadPixelShader   (std::string shaderName)  { return LoadShader<ID3D11PixelShader   >(shaderName); }
+ID3D11ComputeShader*  LoadComputeShader (std::string shaderName)  { return LoadShader<ID3D11ComputeShader >(shaderName); }
+
+
 // Special method to load a geometry shader that can use the stream-out stage, Use like the other functions in this file except
 // also pass the stream out declaration, number of entries in the declaration and the size of each output element. 
 // The returned pointer needs to be released before quitting. Returns nullptr on failure. 
 ID3D11GeometryShader* LoadStreamOutGeometryShader(std::string shaderName, D3D11_SO_DECLARATION_ENTRY* soDecl, unsigned int soNumEntries, unsigned int soStride)
 {
-	// Open compiled shader object file
-	std::ifstream shaderFile(shaderName + ".cso", std::ios::in | std::ios::binary | std::ios::ate);
-	if (!shaderFile.is_open())
-	{
-		return nullptr;
-	}
-
-	// Read file into vector of chars
-	std::streamoff fileSize = shaderFile.tellg();
-	shaderFile.seekg(0, std::ios::beg);
-	std::vector<char>byteCode(fileSize);
-	shaderFile.read(&byteCode[0], fileSize);
-	if (shaderFile.fail())
+	ShaderByteCode byteCode;
+	if (!GetShaderByteCode(shaderName, byteCode))
 	{
 		return nullptr;
 	}
 
 	// Create shader object from loaded file (we will use the object later when rendering)
 	ID3D11GeometryShader* shader;
-	HRESULT hr = gD3DDevice->CreateGeometryShaderWithStreamOutput(byteCode.data(), byteCode.size(),
+	HRESULT hr = gD3DDevice->CreateGeometryShaderWithStreamOutput(byteCode.data, byteCode.size,
 		                                                          soDecl, soNumEntries, &soStride, 1, D3D11_SO_NO_RASTERIZED_STREAM, nullptr, &shader);
 	if(FAILED(hr))
 	{
@@ -260,42 +954,48 @@ ID3D11GeometryShader* LoadStreamOutGeometryShader(std::string shaderName, D3D11_
 
 
 
-
-// Load a pixel shader, include the file in the project and pass the name (without the .hlsl extension)
-// to this function. The returned pointer needs to be released before quitting. Returns nullptr on failure. 
-// Basically the same code as above but for pixel shaders
-ID3D11PixelShader* LoadPixelShader(std::string shaderName)
+// Get an input layout for the given vertex elements, creating it the first time these elements are used. Meshes with the
+// same vertex elements share one layout. The returned pointer has been AddRef'd, release it when finished with it
+// Returns nullptr on failure. Can be called from several threads at once (meshes are loaded in parallel)
+ID3D11InputLayout* GetInputLayout(const D3D11_INPUT_ELEMENT_DESC vertexLayout[], int numElements)
 {
-	// Open compiled shader object file
-	std::ifstream shaderFile(shaderName + ".cso", std::ios::in | std::ios::binary | std::ios::ate);
-	if (!shaderFile.is_open())
-	{
-		return nullptr;
-	}
-
-	// Read file into vector of chars
-	std::streamoff fileSize = shaderFile.tellg();
-	shaderFile.seekg(0, std::ios::beg);
-	std::vector<char>byteCode(fileSize);
-	shaderFile.read(&byteCode[0], fileSize);
-	if (shaderFile.fail())
+	// Key is the semantic names and other values of each element, so the same elements always give the same key
+	std::string key;
+	for (int elt = 0; elt < numElements; ++elt)
 	{
-		return nullptr;
+		auto& element = vertexLayout[elt];
+		uint32_t values[] = { element.SemanticIndex, static_cast<uint32_t>(element.Format), element.InputSlot,
+		                      element.AlignedByteOffset, static_cast<uint32_t>(element.InputSlotClass), element.InstanceDataStepRate };
+		key += element.SemanticName;
+		key += '\0';
+		key.append(reinterpret_cast<const char*>(values), sizeof(values));
 	}
 
-	// Create shader object from loaded file (we will use the object later when rendering)
-	ID3D11PixelShader* shader;
-	HRESULT hr = gD3DDevice->CreatePixelShader(byteCode.data(), byteCode.size(), nullptr, &shader);
-	if (FAILED(hr))
+	std::lock_guard<std::mutex> lock(gInputLayoutsMutex);
+	auto& inputLayout = gInputLayouts[key];
+	if (inputLayout == nullptr)
 	{
-		return nullptr;
+		auto shaderSignature = CreateSignatureForVertexLayout(vertexLayout, numElements);
+		if (shaderSignature == nullptr)
+		{
+			gInputLayouts.erase(key);
+			return nullptr;
+		}
+		HRESULT hr = gD3DDevice->CreateInputLayout(vertexLayout, numElements,
+			shaderSignature->GetBufferPointer(), shaderSignature->GetBufferSize(), &inputLayout);
+		shaderSignature->Release();
+		if (FAILED(hr))
+		{
+			gInputLayouts.erase(key);
+			return nullptr;
+		}
 	}
 
-	return shader;
+	inputLayout->AddRef();
+	return inputLayout;
 }
 
 
-
 // Very advanced topic: When creating a vertex layout for geometry (see Scene.cpp), you need the signature
 // (bytecode) of a shader that uses that vertex layout. This is an annoying requirement and tends to create
 // unnecessary coupling between shaders and vertex buffers.
@@ -314,6 +1014,11 @@ ID3DBlob* CreateSignatureForVertexLayout(const D3D11_INPUT_ELEMENT_DESC vertexLa
 		else if (format == DXGI_FORMAT_R32G32_FLOAT)       shaderSource += "float2";
 		else if (format == DXGI_FORMAT_R32_FLOAT)          shaderSource += "float";
 		else if (format == DXGI_FORMAT_R8G8B8A8_UINT)      shaderSource += "uint4";
+		// Normalised and half float formats (quantised vertices, see Mesh.cpp) are converted to floats as they are read
+		else if (format == DXGI_FORMAT_R16G16B16A16_UNORM || format == DXGI_FORMAT_R16G16B16A16_SNORM ||
+		         format == DXGI_FORMAT_R16G16B16A16_FLOAT || format == DXGI_FORMAT_R8G8B8A8_UNORM)  shaderSource += "float4";
+		else if (format == DXGI_FORMAT_R16G16_UNORM || format == DXGI_FORMAT_R16G16_SNORM ||
+		         format == DXGI_FORMAT_R16G16_FLOAT)  shaderSource += "float2";
 		else return nullptr; // Unsupported type in layout
 
 		uint8_t index = static_cast<uint8_t>(vertexLayout[elt].SemanticIndex);
@@ -368,6 +1073,7 @@ ID3D11Buffer* CreateConstantBuffer(int size)
 		return nullptr;
 	}
 
+	RegisterGpuResource(constantBuffer, "Constant Buffers");
 	return constantBuffer;
 }
 
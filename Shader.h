@@ -7,6 +7,7 @@
 
 #include <d3d11.h>
 #include <string>
+#include <vector>
 
 //--------------------------------------------------------------------------------------
 // Global Variables
@@ -16,19 +17,78 @@
 // so the DirectX content is clearer. However, try to architect your own code in a better way.
 
 // Vertex, geometry and pixel shader DirectX objects
-extern ID3D11VertexShader* gBasicTransformVertexShader;
+extern ID3D11VertexShader* gInstancedTransformVertexShader;
 extern ID3D11VertexShader* gPixelLightingVertexShader;
 extern ID3D11PixelShader*  gTintedTexturePixelShader;
 extern ID3D11PixelShader*  gPixelLightingPixelShader;
+extern ID3D11VertexShader* gSkyVertexShader;
+extern ID3D11PixelShader*  gSkyPixelShader;
+extern ID3D11VertexShader* gTerrainVertexShader; // Heightmap terrain tiles (see Terrain.h)
+extern ID3D11VertexShader* gShadowDepthVertexShader; // Position only models for the shadow maps (see ShadowMap.h)
 
 extern ID3D11VertexShader* gBasicTransformWorldPosVertexShader;
 extern ID3D11VertexShader* gWaterSurfaceVertexShader;
 extern ID3D11PixelShader*  gWaterSurfacePixelShader;
-extern ID3D11PixelShader*  gWaterHeightPixelShader;
+extern ID3D11PixelShader*  gWaterCheckerboardFillPixelShader; // Fills in the far water the surface shader skips (see WaterWaves.hlsli)
 extern ID3D11PixelShader*  gReflectedPixelLightingPixelShader;
 extern ID3D11PixelShader*  gReflectedTintedTexturePixelShader;
 extern ID3D11PixelShader*  gRefractedPixelLightingPixelShader;
 extern ID3D11PixelShader*  gRefractedTintedTexturePixelShader;
+extern ID3D11GeometryShader* gWaterViewsGeometryShader;          // Refraction and reflection drawn at once (see WaterViews_gs.hlsl)
+extern ID3D11PixelShader*    gWaterViewsPixelLightingPixelShader; // --"--
+extern ID3D11PixelShader*    gRefractedSimpleLightingPixelShader;  // Diffuse lighting only, for the lower quality presets
+extern ID3D11PixelShader*    gReflectedSimpleLightingPixelShader;  // (see RenderSettings::simpleWaterLighting in Settings.h)
+extern ID3D11PixelShader*    gWaterViewsSimpleLightingPixelShader; // --"--
+
+extern ID3D11VertexShader* gWaterSurfaceTessVertexShader;
+extern ID3D11HullShader*   gWaterSurfaceHullShader;
+extern ID3D11DomainShader* gWaterSurfaceDomainShader;
+
+extern ID3D11ComputeShader* gWaterDisplaceComputeShader;     // The open water grid moved once a frame (see WaterVertexCache.h)
+extern ID3D11VertexShader*  gWaterSurfaceCachedVertexShader; // --"--
+
+extern ID3D11ComputeShader* gOceanSpectrumComputeShader;
+extern ID3D11ComputeShader* gOceanFFTComputeShader;
+extern ID3D11ComputeShader* gOceanCombineComputeShader;
+extern ID3D11ComputeShader* gCausticsComputeShader; // Caustics from the water waves (see Caustics.h)
+extern ID3D11ComputeShader* gRipplesComputeShader;  // Ripples from objects moving through the water (see Ripples.h)
+extern ID3D11ComputeShader* gWaveCompositeComputeShader; // Combines the wave normal/height map layers (see WaveComposite.h)
+
+extern ID3D11ComputeShader* gSkinningComputeShader;
+extern ID3D11ComputeShader* gInstanceCullComputeShader; // Culls the instances of an instanced model (see InstancedModel::RenderGpuCulled)
+extern ID3D11ComputeShader* gHiZComputeShader;             // Build the occlusion culling depth pyramids (see HiZBuffer.h)
+extern ID3D11ComputeShader* gHiZMultisampledComputeShader; // --"-- From a multisampled depth buffer
+
+extern ID3D11ComputeShader* gParticleSimulateComputeShader; // GPU particles (see ParticleSystem.h)
+extern ID3D11ComputeShader* gParticleEmitComputeShader;     // --"--
+extern ID3D11ComputeShader* gParticleSortComputeShader;     // --"--
+extern ID3D11VertexShader*  gParticleVertexShader;          // --"--
+extern ID3D11PixelShader*   gParticlePixelShader;           // --"--
+
+extern ID3D11VertexShader* gImpostorVertexShader;         // Distant models drawn as billboards (see Impostor.h)
+extern ID3D11PixelShader*  gImpostorPixelShader;          // --"-- One for each kind of pass, as the materials have
+extern ID3D11PixelShader*  gRefractedImpostorPixelShader; // --"--
+extern ID3D11PixelShader*  gReflectedImpostorPixelShader; // --"--
+extern ID3D11PixelShader*  gImpostorDepthPixelShader;     // --"--
+extern ID3D11PixelShader*  gImpostorBakePixelShader;      // --"-- Renders a model's views into the impostor's atlas
+
+extern ID3D11VertexShader*  gPostProcessVertexShader;
+extern ID3D11PixelShader*   gLuminancePixelShader;
+extern ID3D11ComputeShader* gAdaptExposureComputeShader;
+extern ID3D11PixelShader*   gBloomBrightPixelShader;
+extern ID3D11PixelShader*   gBloomBlurPixelShader;
+extern ID3D11PixelShader*   gTonemapPixelShader;
+extern ID3D11PixelShader*   gUpscalePixelShader;      // Edge-adaptive upscaling of the tonemapped scene, then sharpening (see PostProcess.h)
+extern ID3D11PixelShader*   gSharpenPixelShader;
+extern ID3D11PixelShader*   gDepthResolvePixelShader; // Copies the nearest sample of a multisampled depth buffer (see CopySceneDepth in Scene.cpp)
+extern ID3D11PixelShader*   gUnderwaterFogPixelShader; // Fogs the scene seen from under the water (see RenderUnderwaterFog in Scene.cpp)
+
+extern ID3D11VertexShader* gStatsOverlayVertexShader; // Stats drawn over the frame (see StatsOverlay.h)
+extern ID3D11PixelShader*  gStatsOverlayPixelShader;
+
+extern ID3D11PixelShader* gOverdrawCountPixelShader;         // Counts the pixels shaded for the overdraw view (see OverdrawView.h)
+extern ID3D11PixelShader* gOverdrawHeatmapPixelShader;       // --"--
+extern ID3D11PixelShader* gQuadEfficiencyHeatmapPixelShader; // --"--
 
 
 //--------------------------------------------------------------------------------------
@@ -42,6 +102,47 @@ bool LoadShaders();
 void ReleaseShaders();
 
 
+//--------------------------------------------------------------------------------------
+// Shader hot reload
+//--------------------------------------------------------------------------------------
+
+// While set, the app's shaders are compiled again whenever their .hlsl files (or the files they include) change. On by
+// default in debug builds. Changes take effect in UpdateShaders
+extern bool gShaderHotReload;
+
+// Call once per frame on the main thread before rendering: swaps in any shaders that have been recompiled
+void UpdateShaders();
+
+// Names of the shaders that failed to compile the last time they changed, separated by commas. Empty if there are none
+std::string ShaderReloadErrors();
+
+
+//--------------------------------------------------------------------------------------
+// Shader cost report
+//--------------------------------------------------------------------------------------
+
+// The cost of a shader found from its bytecode with D3DReflect, the same figures the compiler lists after its assembly.
+// These count the instructions in the bytecode rather than those run - loops and branches aren't followed - but an edit
+// that adds to them makes the shader dearer. Shown in the stats overlay and saved with the benchmark results
+struct ShaderCost
+{
+	std::string  name;
+	unsigned int instructions    = 0; // All instructions
+	unsigned int arithmetic      = 0; // Float, int and uint maths
+	unsigned int textureFetches  = 0; // Samples, loads and gathers
+	unsigned int tempRegisters   = 0;
+	unsigned int constantBuffers = 0; // Used by the shader
+	unsigned int constantBytes   = 0; // Total size of those constant buffers
+};
+
+// The costs of the app's shaders, in the order LoadShaders loads them. Shaders swapped in by hot reload have their new costs
+std::vector<ShaderCost> ShaderCosts();
+
+// The cost of one of the app's shaders by name, nullptr if there is no such shader. Doesn't allocate, for the stats overlay.
+// Only valid until the next call to UpdateShaders
+const ShaderCost* FindShaderCost(const char* name);
+
+
 //--------------------------------------------------------------------------------------
 // Constant buffer creation / destruction
 //--------------------------------------------------------------------------------------
@@ -56,12 +157,14 @@ ID3D11Buffer* CreateConstantBuffer(int size);
 //--------------------------------------------------------------------------------------
 
 // Load a shader, include the file in the project and pass the name (without the .hlsl extension)
-// to this function. The returned pointer needs to be released before quitting. Returns nullptr on failure
+// to this function. The bytecode comes from the shader library (see Shader.cpp) if it has it, otherwise the .cso file
+// The returned pointer needs to be released before quitting. Returns nullptr on failure
 ID3D11VertexShader*   LoadVertexShader  (std::string shaderName);
 ID3D11HullShader*     LoadHullShader    (std::string shaderName);
 ID3D11DomainShader*   LoadDomainShader  (std::string shaderName);
 ID3D11GeometryShader* LoadGeometryShader(std::string shaderName);
 ID3D11PixelShader*    LoadPixelShader   (std::string shaderName);
+ID3D11ComputeShader*  LoadComputeShader (std::string shaderName);
 
 // Special method to load a geometry shader that can use the stream-out stage, Use like the other functions in this file except
 // also pass the stream out declaration, number of entries in the declaration and the size of each output element. 
@@ -72,5 +175,10 @@ ID3D11GeometryShader* LoadStreamOutGeometryShader(std::string shaderName, D3D11_
 // Helper function. Returns nullptr on failure.
 ID3DBlob* CreateSignatureForVertexLayout(const D3D11_INPUT_ELEMENT_DESC vertexLayout[], int numElements);
 
+// Get an input layout for the given vertex elements, creating it the first time these elements are used. Meshes with the
+// same vertex elements share one layout. The returned pointer has been AddRef'd, release it when finished with it
+// Returns nullptr on failure. Can be called from several threads at once
+ID3D11InputLayout* GetInputLayout(const D3D11_INPUT_ELEMENT_DESC vertexLayout[], int numElements);
+
 
 #endif //_SHADER_H_INCLUDED_
@@ -0,0 +1,26 @@
+//--------------------------------------------------------------------------------------
+// Shadow Depth Vertex Shader
+//--------------------------------------------------------------------------------------
+// Transforms model positions into a shadow map cascade, for the depth only draws of the shadow pass
+// (see RenderShadowPass in Scene.cpp). The vertices are read with only their position, so there is
+// nothing else for the input assembler to fetch. No pixel shader is used
+
+#include "Common.hlsli"
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+// The position is all that is read from the models' vertices (see SubMesh::positionLayout in Mesh.h)
+struct PositionVertex
+{
+	float3 position : position;
+};
+
+float4 main(PositionVertex input) : SV_Position
+{
+	// The view-projection matrix is the cascade's, from world space to the light's view
+	float4 worldPosition = mul(gWorldMatrix, float4(input.position, 1));
+	return mul(gViewProjectionMatrix, worldPosition);
+}
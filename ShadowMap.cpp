@@ -0,0 +1,200 @@
+//--------------------------------------------------------------------------------------
+// Cascaded shadow maps for the key light
+//--------------------------------------------------------------------------------------
+
+#include "ShadowMap.h"
+#include "Common.h"
+#include "GpuEvents.h"
+#include "GpuMemory.h"
+
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
+
+static_assert(sizeof(PerFrameConstants::shadowMatrices) == sizeof(CMatrix4x4) * ShadowMap::NumCascades,
+              "PerFrameConstants needs a shadow matrix for each cascade");
+
+
+// Create the cascades, each of the given size in texels, covering the view out to the given distance from the camera
+// Will throw a std::runtime_error exception on failure (same as Mesh)
+ShadowMap::ShadowMap(unsigned int size /*= 2048*/, float shadowDistance /*= 1000*/)
+	: mSize(size), mShadowDistance(shadowDistance)
+{
+	// A depth texture array with a layer for each cascade. Typeless so it can be rendered as depth and read as a float
+	D3D11_TEXTURE2D_DESC textureDesc = {};
+	textureDesc.Width  = size;
+	textureDesc.Height = size;
+	textureDesc.MipLevels = 1;
+	textureDesc.ArraySize = NumCascades;
+	textureDesc.Format = DXGI_FORMAT_R32_TYPELESS;
+	textureDesc.SampleDesc.Count = 1;
+	textureDesc.Usage = D3D11_USAGE_DEFAULT;
+	textureDesc.BindFlags = D3D11_BIND_DEPTH_STENCIL | D3D11_BIND_SHADER_RESOURCE;
+	if (FAILED(gD3DDevice->CreateTexture2D(&textureDesc, nullptr, &mTexture)))
+	{
+		Release();
+		throw std::runtime_error("Error creating shadow maps");
+	}
+
+	// A depth buffer view of each cascade's layer
+	for (int cascade = 0; cascade < NumCascades; ++cascade)
+	{
+		D3D11_DEPTH_STENCIL_VIEW_DESC dsvDesc = {};
+		dsvDesc.Format = DXGI_FORMAT_D32_FLOAT;
+		dsvDesc.ViewDimension = D3D11_DSV_DIMENSION_TEXTURE2DARRAY;
+		dsvDesc.Texture2DArray.MipSlice = 0;
+		dsvDesc.Texture2DArray.FirstArraySlice = cascade;
+		dsvDesc.Texture2DArray.ArraySize = 1;
+		if (FAILED(gD3DDevice->CreateDepthStencilView(mTexture, &dsvDesc, &mDepthStencils[cascade])))
+		{
+			Release();
+			throw std::runtime_error("Error creating shadow map depth buffers");
+		}
+	}
+
+	D3D11_SHADER_RESOURCE_VIEW_DESC srDesc = {};
+	srDesc.Format = DXGI_FORMAT_R32_FLOAT;
+	srDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2DARRAY;
+	srDesc.Texture2DArray.MostDetailedMip = 0;
+	srDesc.Texture2DArray.MipLevels = 1;
+	srDesc.Texture2DArray.FirstArraySlice = 0;
+	srDesc.Texture2DArray.ArraySize = NumCascades;
+	if (FAILED(gD3DDevice->CreateShaderResourceView(mTexture, &srDesc, &mSRV)))
+	{
+		Release();
+		throw std::runtime_error("Error creating shadow map view");
+	}
+	SetDebugNames("Shadow Maps", mTexture, mSRV);
+	RegisterGpuResource(mTexture, "Shadow Maps");
+}
+
+ShadowMap::~ShadowMap()
+{
+	Release();
+}
+
+
+// Choose the cascades to render this frame and fit them around the given camera's view, for a light shining in the given
+// direction. Call once per frame before rendering. All the cascades are chosen on the first call and after Invalidate
+void ShadowMap::Update(Camera* camera, const CVector3& lightDirection, const BoundingBox& casterBounds)
+{
+	// The first cascade every frame, the second every other frame and the last two every fourth frame, one on the frames
+	// between the second's. So two at most are rendered each frame
+	const unsigned int staggered[4] = { 0, 1 << 2, 0, 1 << 3 };
+	mRenderCascades = 1 | ((mFrame & 1) == 0 ? 1 << 1 : staggered[mFrame & 3]);
+	if (mValidCascades != (1 << NumCascades) - 1)
+	{
+		mRenderCascades = mValidCascades = (1 << NumCascades) - 1;
+	}
+	++mFrame;
+
+	// The light looks along its direction. Its x and y axes only need to be at right angles to that
+	CVector3 lightZ = Normalise(lightDirection);
+	CVector3 up = std::abs(lightZ.y) < 0.99f ? CVector3{ 0, 1, 0 } : CVector3{ 1, 0, 0 };
+	CVector3 lightX = Normalise(Cross(up, lightZ));
+	CVector3 lightY = Cross(lightZ, lightX);
+	CMatrix4x4 lightMatrix = MatrixIdentity();
+	lightMatrix.SetRow(0, lightX);
+	lightMatrix.SetRow(1, lightY);
+	lightMatrix.SetRow(2, lightZ);
+	CMatrix4x4 lightView = InverseAffine(lightMatrix);
+
+	// Shadow casters are found back along the light as far as the box around them reaches
+	float casterNear = 3.0e38f;
+	for (int corner = 0; corner < 8; ++corner)
+	{
+		CVector3 point = { (corner & 1) ? casterBounds.max.x : casterBounds.min.x, (corner & 2) ? casterBounds.max.y : casterBounds.min.y,
+		                   (corner & 4) ? casterBounds.max.z : casterBounds.min.z };
+		casterNear = (std::min)(casterNear, Dot(point, lightZ));
+	}
+
+	// Camera's view, the fov is horizontal
+	CVector3 cameraPosition = camera->Position();
+	CVector3 cameraX = Normalise(camera->XAxis());
+	CVector3 cameraY = Normalise(camera->YAxis());
+	CVector3 cameraZ = Normalise(camera->ZAxis());
+	float tanX = std::tan(camera->FOV() * 0.5f);
+	float tanY = tanX / camera->AspectRatio();
+	float nearClip = camera->NearClip();
+	float farClip  = (std::min)(mShadowDistance, camera->FarClip());
+
+	for (int cascade = 0; cascade < NumCascades; ++cascade)
+	{
+		if (!RenderCascade(cascade))  continue;
+
+		// Distances of the cascade's part of the view, blended between logarithmic and even splits
+		auto split = [&](int i)
+		{
+			float t = static_cast<float>(i) / NumCascades;
+			float logSplit  = nearClip * std::pow(farClip / nearClip, t);
+			float evenSplit = nearClip + (farClip - nearClip) * t;
+			return LogSplitBlend * logSplit + (1 - LogSplitBlend) * evenSplit;
+		};
+		float splitNear = split(cascade);
+		float splitFar  = split(cascade + 1);
+
+		// Sphere around the corners of the part of the view. The corners keep the same shape around their average as the
+		// camera turns, so the radius only changes with the camera settings. It is rounded up so it doesn't flicker either
+		CVector3 corners[8];
+		CVector3 centre = { 0, 0, 0 };
+		for (int corner = 0; corner < 8; ++corner)
+		{
+			float distance = (corner & 4) ? splitFar : splitNear;
+			corners[corner] = cameraPosition + cameraZ * distance + cameraX * (distance * tanX * ((corner & 1) ? 1.0f : -1.0f)) +
+			                  cameraY * (distance * tanY * ((corner & 2) ? 1.0f : -1.0f));
+			centre = centre + corners[corner];
+		}
+		centre = centre / 8;
+		float radius = 0;
+		for (auto& corner : corners)  radius = (std::max)(radius, Length(corner - centre));
+		radius = std::ceil(radius);
+
+		// Snap the centre to whole texels across the light, so the texels stay in the same places in the world
+		float texelSize = 2 * radius / mSize;
+		CVector3 lightCentre = { Dot(centre, lightX), Dot(centre, lightY), Dot(centre, lightZ) };
+		lightCentre.x = std::floor(lightCentre.x / texelSize) * texelSize;
+		lightCentre.y = std::floor(lightCentre.y / texelSize) * texelSize;
+
+		// Orthographic projection of the box around the sphere, reaching back along the light to the furthest caster. A
+		// little is added so casters exactly at the ends aren't clipped. The depth is reversed like the cameras' (see
+		// Camera::UpdateMatrices), 1 at the near end, so the same depth states are used for shadow casters
+		float depthNear = (std::min)(casterNear, lightCentre.z - radius) - 1;
+		float depthFar  = lightCentre.z + radius + 1;
+		CMatrix4x4 projection = MatrixIdentity();
+		projection.e00 = 1 / radius;
+		projection.e11 = 1 / radius;
+		projection.e22 = -1 / (depthFar - depthNear);
+		projection.e30 = -lightCentre.x / radius;
+		projection.e31 = -lightCentre.y / radius;
+		projection.e32 = depthFar / (depthFar - depthNear);
+
+		mCascades[cascade].viewProjection = lightView * projection;
+		mCascades[cascade].radius = radius;
+	}
+}
+
+
+// Set the constants the shaders need to sample the cascades. Each cascade's matrix goes from world space to its texture
+// UVs and depth, using the matrix it was last rendered with
+void ShadowMap::SetShaderConstants(PerFrameConstants& constants)
+{
+	CMatrix4x4 toUV = MatrixScaling({ 0.5f, -0.5f, 1 });
+	toUV.SetRow(3, { 0.5f, 0.5f, 0 });
+	for (int cascade = 0; cascade < NumCascades; ++cascade)
+	{
+		constants.shadowMatrices[cascade] = mCascades[cascade].viewProjection * toUV;
+	}
+	constants.numShadowCascades = static_cast<float>(NumCascades);
+	constants.shadowTexelSize   = 1.0f / mSize;
+}
+
+
+void ShadowMap::Release()
+{
+	if (mSRV)  { mSRV->Release();  mSRV = nullptr; }
+	for (auto& depthStencil : mDepthStencils)
+	{
+		if (depthStencil)  { depthStencil->Release();  depthStencil = nullptr; }
+	}
+	if (mTexture)  { mTexture->Release();  mTexture = nullptr; }
+}
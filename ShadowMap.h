@@ -0,0 +1,101 @@
+//--------------------------------------------------------------------------------------
+// Cascaded shadow maps for the key light
+//--------------------------------------------------------------------------------------
+// The key light is far enough away to be treated as a directional light for its shadows. The
+// camera's view out to the shadow distance is split into cascades, nearer ones covering less of
+// the scene so their texels are smaller on screen. Each cascade is a layer of one depth texture
+// array, rendered from the light with position only, depth only draws (see RenderShadowPass in
+// Scene.cpp). The shadow maps are rendered once per frame, before any pass that uses them - the
+// main, refraction, reflection and environment passes all sample the same cascades, so the water
+// passes add nothing to the cost of the shadows.
+//
+// Each cascade fits a sphere around its part of the view, which doesn't change size as the camera
+// turns, and its position is snapped to whole texels, so the shadow edges don't shimmer as the
+// camera moves. The finest cascade is rendered every frame and the others in turn, every second or
+// fourth frame. A cascade keeps the matrix it was rendered with until it is rendered again, so
+// the shaders always find the shadows where they were rendered. The scene is mostly static and
+// the far cascades are small on screen, so moving models lagging a few frames there isn't seen.
+
+#include "Camera.h"
+#include "CVector3.h"
+#include "CMatrix4x4.h"
+#include "Frustum.h"
+#include <d3d11.h>
+
+#ifndef _SHADOW_MAP_H_INCLUDED_
+#define _SHADOW_MAP_H_INCLUDED_
+
+struct PerFrameConstants;
+
+class ShadowMap
+{
+//--------------------------------------------------------------------------------------
+// Construction / Usage
+//--------------------------------------------------------------------------------------
+public:
+
+	// Number of cascades, must match the size of shadowMatrices in PerFrameConstants (see Common.h)
+	static constexpr int NumCascades = 4;
+
+	// Create the cascades, each of the given size in texels, covering the view out to the given distance from the camera
+	// Will throw a std::runtime_error exception on failure (same as Mesh)
+	ShadowMap(unsigned int size = 2048, float shadowDistance = 1000);
+	~ShadowMap();
+
+
+	// Choose the cascades to render this frame and fit them around the given camera's view, for a light shining in the given
+	// direction. The box is around everything that casts shadows, so the cascades reach back far enough to include it. Call
+	// once per frame before rendering. All the cascades are chosen on the first call and after Invalidate
+	void Update(Camera* camera, const CVector3& lightDirection, const BoundingBox& casterBounds);
+
+	// Render all the cascades again on the next Update, e.g. after the shadows have been switched off for a while
+	void Invalidate()  { mValidCascades = 0; }
+
+
+	// Whether a cascade was chosen by the last Update, and the matrix from world space to its light space to render it with
+	bool              RenderCascade(int cascade)   { return (mRenderCascades & (1 << cascade)) != 0; }
+	const CMatrix4x4& ViewProjection(int cascade)  { return mCascades[cascade].viewProjection; }
+
+	// Texels per world unit in a cascade, which is its resolution on the models, to choose their levels of detail
+	float TexelsPerUnit(int cascade)  { return mSize / (2 * mCascades[cascade].radius); }
+
+	// Target for rendering a cascade
+	ID3D11DepthStencilView* DepthStencil(int cascade)  { return mDepthStencils[cascade]; }
+	unsigned int            Size()                     { return mSize; }
+
+	// The texture array of all the cascades for the shaders, and the constants the shaders need to sample it
+	ID3D11ShaderResourceView* SRV()  { return mSRV; }
+	void SetShaderConstants(PerFrameConstants& constants);
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions / data
+//--------------------------------------------------------------------------------------
+private:
+
+	void Release();
+
+	// Proportion of each split distance from the logarithmic split, the rest from even splits. Logarithmic splits give every
+	// cascade the same texels on screen but make the nearest one tiny, so a blend of the two is used
+	static constexpr float LogSplitBlend = 0.75f;
+
+	struct Cascade
+	{
+		CMatrix4x4 viewProjection; // World space to the cascade's light space, as used by the last render of the cascade
+		float      radius = 1;     // Of the sphere around the cascade's part of the view
+	};
+	Cascade mCascades[NumCascades];
+
+	unsigned int mSize;
+	float        mShadowDistance;
+	unsigned int mFrame          = 0;
+	unsigned int mValidCascades  = 0; // Cascades rendered since creation or Invalidate, each bit is one cascade
+	unsigned int mRenderCascades = 0; // Cascades chosen by the last Update
+
+	ID3D11Texture2D*          mTexture = nullptr;
+	ID3D11DepthStencilView*   mDepthStencils[NumCascades] = {};
+	ID3D11ShaderResourceView* mSRV = nullptr;
+};
+
+
+#endif //_SHADOW_MAP_H_INCLUDED_
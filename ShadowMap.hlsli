@@ -0,0 +1,50 @@
+//--------------------------------------------------------------------------------------
+// Shadow maps - the cascaded shadow maps of the key light
+//--------------------------------------------------------------------------------------
+// The cascades rendered on the C++ side once per frame (see ShadowMap.h). Every pass lighting
+// the scene samples the same cascades, from whichever camera it is rendering.
+
+#ifndef _SHADOW_MAP_HLSLI_DEFINED_
+#define _SHADOW_MAP_HLSLI_DEFINED_
+
+#include "Common.hlsli"
+
+
+//--------------------------------------------------------------------------------------
+// Textures and samplers
+//--------------------------------------------------------------------------------------
+
+// The slots must match the ones used in Scene.cpp
+Texture2DArray<float>  ShadowMaps   : register(t19); // Depth from the key light, one layer for each cascade
+SamplerComparisonState ShadowFilter : register(s2);  // Compares with the 4 nearest depths and blends the results
+
+
+//--------------------------------------------------------------------------------------
+// Functions
+//--------------------------------------------------------------------------------------
+
+// How much of the key light reaches the given world position, from 0 in shadow to 1 lit. The finest cascade holding the
+// position is used, the cascades aren't chosen by distance from the camera so the water passes' cameras find the same ones
+// Positions outside every cascade are lit
+float ShadowFactor(float3 worldPosition)
+{
+	for (int cascade = 0; cascade < int(gNumShadowCascades); ++cascade)
+	{
+		float3 shadowPosition = mul(gShadowMatrices[cascade], float4(worldPosition, 1)).xyz;
+
+		// A texel of margin so the filter below stays inside the cascade
+		float margin = gShadowTexelSize * 1.5f;
+		if (any(shadowPosition.xy < margin) || any(shadowPosition.xy > 1 - margin) || shadowPosition.z < 0)  continue; // Depths reversed
+
+		// Four filtered comparisons half a texel apart, for softer edges than one. Each blends the four nearest texels' results
+		float offset = gShadowTexelSize * 0.5f;
+		float lit = ShadowMaps.SampleCmpLevelZero(ShadowFilter, float3(shadowPosition.xy + float2(-offset, -offset), cascade), shadowPosition.z) +
+		            ShadowMaps.SampleCmpLevelZero(ShadowFilter, float3(shadowPosition.xy + float2( offset, -offset), cascade), shadowPosition.z) +
+		            ShadowMaps.SampleCmpLevelZero(ShadowFilter, float3(shadowPosition.xy + float2(-offset,  offset), cascade), shadowPosition.z) +
+		            ShadowMaps.SampleCmpLevelZero(ShadowFilter, float3(shadowPosition.xy + float2( offset,  offset), cascade), shadowPosition.z);
+		return lit * 0.25f;
+	}
+	return 1;
+}
+
+#endif // _SHADOW_MAP_HLSLI_DEFINED_
@@ -0,0 +1,57 @@
+//--------------------------------------------------------------------------------------
+// Sharpen Pixel Shader
+//--------------------------------------------------------------------------------------
+// Sharpens the upscaled scene (see Upscale_ps) into the back buffer, winning back the detail lost to the lower resolution.
+// After AMD's FidelityFX Super Resolution 1 "RCAS": each pixel has its 4 neighbours (a cross) subtracted from it, by as
+// much as can be without the result going outside the range of the neighbourhood, so sharpening never clips or rings.
+// Areas with contrast already get less, flat areas and soft edges get most. gSharpness scales it, 1 is the most
+
+#include "PostProcess.hlsli"
+
+
+//--------------------------------------------------------------------------------------
+// Textures (texture maps)
+//--------------------------------------------------------------------------------------
+
+Texture2D SourceMap : register(t0); // Upscaled scene, the same size as the viewport
+
+
+//--------------------------------------------------------------------------------------
+// Sharpening settings
+//--------------------------------------------------------------------------------------
+
+// Most of the neighbours that can be subtracted. Beyond this the filter falls apart, 0.25 would divide by zero
+static const float MaxLobe = 0.25f - 1.0f / 16;
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+float4 main(PostProcessPixelShaderInput input) : SV_Target
+{
+	//   b
+	// d e f
+	//   h
+	float2 size;
+	SourceMap.GetDimensions(size.x, size.y);
+	int2 pixel = int2(input.projectedPosition.xy);
+	int2 last  = int2(size) - 1;
+	float3 b = SourceMap.Load(int3(clamp(pixel + int2( 0, -1), 0, last), 0)).rgb;
+	float3 d = SourceMap.Load(int3(clamp(pixel + int2(-1,  0), 0, last), 0)).rgb;
+	float3 e = SourceMap.Load(int3(pixel, 0)).rgb;
+	float3 f = SourceMap.Load(int3(clamp(pixel + int2( 1,  0), 0, last), 0)).rgb;
+	float3 h = SourceMap.Load(int3(clamp(pixel + int2( 0,  1), 0, last), 0)).rgb;
+
+	// The largest negative weight for the cross that keeps the result above 0 (hitting the minimum) and below 1 (hitting the
+	// maximum) in each channel, using the smallest of the channels
+	float3 minRing = min(min(b, d), min(f, h));
+	float3 maxRing = max(max(b, d), max(f, h));
+	float3 hitMin  = minRing / (4 * maxRing + 1.0f / 65536);
+	float3 hitMax  = (1 - maxRing) / (4 * minRing - 4 - 1.0f / 65536);
+	float3 lobes   = max(-hitMin, hitMax);
+	float  lobe    = max(-MaxLobe, min(max(lobes.r, max(lobes.g, lobes.b)), 0)) * gSharpness;
+
+	float3 colour = (lobe * (b + d + f + h) + e) / (4 * lobe + 1);
+	return float4(colour, 1);
+}
@@ -0,0 +1,60 @@
+//--------------------------------------------------------------------------------------
+// Skinning compute shader
+//--------------------------------------------------------------------------------------
+// Moves the vertices of a skinned sub-mesh by its bones once per frame, writing them to a vertex buffer belonging to
+// the model (see Mesh::Skin). Every pass then draws that buffer like a rigid mesh, rather than each pass doing the
+// skinning again in its vertex shader. The vertices are read and written as raw bytes because their layout depends on
+// the mesh - the output has the same layout as the input, only the position, normal and tangent are changed
+
+
+//--------------------------------------------------------------------------------------
+// Constants / buffers
+//--------------------------------------------------------------------------------------
+
+static const uint SkinningThreadGroupSize = 64; // Must match SKINNING_THREAD_GROUP_SIZE in Mesh.cpp
+
+// These variables must match exactly the SkinningConstants structure in Mesh.cpp
+cbuffer SkinningConstants : register(b0)
+{
+	uint gNumVertices;
+	uint gVertexSize;    // Bytes in each vertex
+	uint gTangentOffset; // Byte offset of the tangent in each vertex, 0 if the mesh has no tangents
+	uint gBonesOffset;   // Byte offset of the 4 bone indexes (one byte each), followed by the 4 weights (floats)
+}
+
+ByteAddressBuffer          SourceVertices : register(t0); // The sub-mesh's vertex buffer, in its default pose
+StructuredBuffer<float4x4> BoneMatrices   : register(t1); // The model's bone matrices, from model space to world space
+
+RWByteAddressBuffer SkinnedVertices : register(u0); // Vertex buffer drawn by the passes, in world space
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+[numthreads(SkinningThreadGroupSize, 1, 1)]
+void main(uint3 id : SV_DispatchThreadID)
+{
+	if (id.x >= gNumVertices)  return;
+	uint vertex = id.x * gVertexSize;
+
+	// Blend the matrices of the (up to) four bones that influence this vertex by their weights
+	uint   bones   = SourceVertices.Load(vertex + gBonesOffset);
+	float4 weights = asfloat(SourceVertices.Load4(vertex + gBonesOffset + 4));
+	float4x4 skinMatrix = BoneMatrices[ bones        & 0xff] * weights.x +
+	                      BoneMatrices[(bones >>  8) & 0xff] * weights.y +
+	                      BoneMatrices[(bones >> 16) & 0xff] * weights.z +
+	                      BoneMatrices[(bones >> 24)       ] * weights.w;
+
+	// Position is first in the vertex, followed by the normal
+	float3 position = asfloat(SourceVertices.Load3(vertex));
+	float3 normal   = asfloat(SourceVertices.Load3(vertex + 12));
+	SkinnedVertices.Store3(vertex,      asuint(mul(skinMatrix, float4(position, 1)).xyz));
+	SkinnedVertices.Store3(vertex + 12, asuint(normalize(mul(skinMatrix, float4(normal, 0)).xyz)));
+
+	if (gTangentOffset != 0)
+	{
+		float3 tangent = asfloat(SourceVertices.Load3(vertex + gTangentOffset));
+		SkinnedVertices.Store3(vertex + gTangentOffset, asuint(normalize(mul(skinMatrix, float4(tangent, 0)).xyz)));
+	}
+}
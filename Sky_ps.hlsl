@@ -0,0 +1,63 @@
+//--------------------------------------------------------------------------------------
+// Sky Pixel Shader
+//--------------------------------------------------------------------------------------
+// Samples the sky texture in the direction of each pixel (see Sky_vs). The texture holds the six faces of a cube laid out in
+// a cross, four faces side by side in the middle row with the top and bottom faces above and below the second of them
+
+#include "Common.hlsli"
+
+
+//--------------------------------------------------------------------------------------
+// Textures (texture maps)
+//--------------------------------------------------------------------------------------
+
+Texture2D    SkyMap : register(t0);
+SamplerState StandardFilter : register(s0);
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+WaterTexturePixelShaderOutput main(SkyPixelShaderInput input)
+{
+	// The sky faces are turned 90 degrees around the y axis from the world axes
+	float3 direction = normalize(input.worldDirection);
+	float3 skyDirection = float3(-direction.z, direction.y, direction.x);
+
+	// Find the cube face the direction points at, and the point on it (-1 to 1 on each axis). The point is kept slightly in from
+	// the edges so samples don't pick up the neighbouring area of the texture, which isn't always the neighbouring face
+	float3 absDirection = abs(skyDirection);
+	float2 uv;
+	if (absDirection.y >= absDirection.x && absDirection.y >= absDirection.z)
+	{
+		float2 facePoint = clamp(skyDirection.xz / absDirection.y, -0.99f, 0.99f);
+		uv.x = 0.375f + 0.125f * facePoint.x;
+		uv.y = skyDirection.y > 0 ? (1 + facePoint.y) / 6 : (5 - facePoint.y) / 6;
+	}
+	else if (absDirection.x >= absDirection.z)
+	{
+		float2 facePoint = clamp(skyDirection.zy / absDirection.x, -0.99f, 0.99f);
+		uv.x = skyDirection.x > 0 ? 0.625f - 0.125f * facePoint.x : 0.125f + 0.125f * facePoint.x;
+		uv.y = 0.5f - facePoint.y / 6;
+	}
+	else
+	{
+		float2 facePoint = clamp(skyDirection.xy / absDirection.z, -0.99f, 0.99f);
+		uv.x = skyDirection.z > 0 ? 0.375f + 0.125f * facePoint.x : 0.875f - 0.125f * facePoint.x;
+		uv.y = 0.5f - facePoint.y / 6;
+	}
+
+	// The uvs jump where the faces meet, which would choose the smallest mip-map along those lines. Choose the mip-map from
+	// how fast the direction changes instead, which is smooth. A face covers a quarter of the texture width over 90 degrees
+	float directionChange = max(length(ddx(direction)), length(ddy(direction)));
+	float2 uvChange = directionChange * float2(0.125f, 1.0f / 6);
+	float3 skyColour = SkyMap.SampleGrad(StandardFilter, uv, float2(uvChange.x, 0), float2(0, uvChange.y)).rgb;
+
+	// The sky is drawn in the reflection too, where it is as far above the water as possible so fully distorted. Other passes
+	// only have one render target, so the distortion is ignored
+	WaterTexturePixelShaderOutput output;
+	output.colour = float4(skyColour, 1.0f);
+	output.distortion = 1.0f;
+	return output;
+}
@@ -0,0 +1,30 @@
+//--------------------------------------------------------------------------------------
+// Sky Vertex Shader
+//--------------------------------------------------------------------------------------
+// Draws the sky as a single triangle covering the whole viewport, with no vertex buffer. The triangle is placed on the
+// far plane (depth 0, depths are reversed), so with a greater-or-equal depth test it only covers the pixels that nothing else
+// has been drawn to
+
+#include "Common.hlsli"
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+// Vertices 0, 1 and 2 are at the corners (-1,1), (3,1) and (-1,-3) of a triangle that covers the -1 to 1 viewport
+SkyPixelShaderInput main(uint vertexID : SV_VertexID)
+{
+	SkyPixelShaderInput output;
+
+	float2 corner = float2((vertexID << 1) & 2, vertexID & 2);
+	float2 viewportPosition = corner * float2(2, -2) + float2(-1, 1);
+	output.projectedPosition = float4(viewportPosition, 0, 1); // z = 0, the far depth (depths are reversed, see Camera.cpp)
+
+	// Direction through this corner of the viewport in view space, the projection divides x and y by z and scales them. Then
+	// into world space with the camera's matrix. Not normalised - the direction must be interpolated linearly across the screen
+	float3 viewDirection = float3(viewportPosition.x / gProjectionMatrix[0][0], viewportPosition.y / gProjectionMatrix[1][1], 1);
+	output.worldDirection = mul(gCameraMatrix, float4(viewDirection, 0)).xyz;
+
+	return output;
+}
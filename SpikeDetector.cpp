@@ -0,0 +1,130 @@
+//--------------------------------------------------------------------------------------
+// Frame spike detector - saves a trace of the last few seconds when a frame takes too long
+//--------------------------------------------------------------------------------------
+
+#include "SpikeDetector.h"
+#include "Timer.h"
+#include "Common.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+
+SpikeSettings  gSpikeSettings;
+SpikeDetector* gSpikeDetector = nullptr;
+
+
+//--------------------------------------------------------------------------------------
+// Construction / Usage
+//--------------------------------------------------------------------------------------
+
+// Finishes writing the trace being saved
+SpikeDetector::~SpikeDetector()
+{
+	if (mWriter.joinable())  mWriter.join();
+}
+
+
+// Call once a frame on the main thread, between frames. The frame that has just finished is the time since the last call
+void SpikeDetector::EndFrame(const SpikeSceneState& state)
+{
+	uint64_t now = Timer::HighResCount();
+	uint64_t frameStart = mLastCount;
+	mLastCount = now;
+	if (frameStart == 0)  return; // Nothing to time before the first call
+	float frameTimeMs = static_cast<float>(static_cast<double>(now - frameStart) * 1000.0 / Timer::HighResFrequency());
+	++mFrame;
+
+	// Save the spike waiting for the GPU's results once they have had time to arrive
+	if (mSpikeCountdown > 0 && --mSpikeCountdown == 0)  SaveTrace(mSpike);
+	if (mCooldown > 0)  --mCooldown;
+
+	// A spike is much longer than the median of the frames before it. The median rather than the mean, so earlier spikes don't
+	// raise the bar
+	if (gSpikeSettings.threshold > 0 && mNumFrameTimes == MedianFrames && mSpikeCountdown == 0 && mCooldown == 0 &&
+	    mNumTraces < MaxTraces && frameTimeMs >= gSpikeSettings.minimumTimeMs)
+	{
+		float sortedTimes[MedianFrames];
+		std::copy(mFrameTimes, mFrameTimes + MedianFrames, sortedTimes);
+		std::nth_element(sortedTimes, sortedTimes + MedianFrames / 2, sortedTimes + MedianFrames);
+		float medianTimeMs = sortedTimes[MedianFrames / 2];
+		if (frameTimeMs >= medianTimeMs * gSpikeSettings.threshold)
+		{
+			mSpike = { mFrame, frameStart, now, frameTimeMs, medianTimeMs, state };
+			mSpikeCountdown = TraceDelayFrames;
+		}
+	}
+
+	mFrameTimes[mFrame % MedianFrames] = frameTimeMs;
+	mNumFrameTimes = (std::min)(mNumFrameTimes + 1, MedianFrames);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions
+//--------------------------------------------------------------------------------------
+
+// Copy the profilers' recent data for a spike and start writing its trace. Skipped if the last trace is still being written,
+// rather than wait for it
+void SpikeDetector::SaveTrace(const Spike& spike)
+{
+	if (mWriting)  return;
+	if (mWriter.joinable())  mWriter.join(); // Finished, but the thread still needs joining
+
+	uint64_t traceCounts = static_cast<uint64_t>(TraceSeconds * Timer::HighResFrequency());
+	uint64_t since = (spike.start > traceCounts) ? spike.start - traceCounts : 0;
+	gCpuProfiler.Snapshot(since, mCpuSnapshot);
+	if (gGpuProfiler != nullptr)  gGpuProfiler->RecentFrames(since, mGpuFrames);
+	else                          mGpuFrames.clear();
+
+	mWriting = true;
+	mWriter = std::thread([this, spike]()
+	{
+		WriteTrace(spike, mCpuSnapshot, mGpuFrames);
+		mWriting = false;
+	});
+	++mNumTraces;
+	mCooldown = CooldownFrames;
+}
+
+
+// Write a trace file from the copied data, on the writing thread. A file that can't be written is skipped, there is no one
+// to tell on this thread
+void SpikeDetector::WriteTrace(const Spike& spike, const CpuProfiler::TraceSnapshot& cpu, const std::vector<GpuFrameTimings>& gpu)
+{
+	std::wostringstream fileName;
+	fileName << L"spike_frame" << spike.frame << L".json";
+	std::ofstream file(fileName.str());
+	file.precision(3);
+	file << std::fixed;
+
+	file << "{\"traceEvents\":[\n";
+	bool first = true;
+	gCpuProfiler.WriteTraceEvents(file, cpu, first);
+
+	// The GPU passes on a track after the CPU threads
+	int gpuTrack = static_cast<int>(cpu.threadNames.size());
+	file << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << gpuTrack << ",\"args\":{\"name\":\"GPU\"}}";
+	for (auto& frame : gpu)
+	{
+		double frameStart = gCpuProfiler.TraceTime(frame.cpuStart);
+		for (int pass = 0; pass < static_cast<int>(GpuPass::NumPasses); ++pass)
+		{
+			if (!frame.passUsed[pass])  continue;
+			file << ",\n{\"name\":\"" << GpuProfiler::PassName(static_cast<GpuPass>(pass)) << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << gpuTrack
+			     << ",\"ts\":" << frameStart + frame.passStart[pass] * 1000.0 << ",\"dur\":" << frame.passTime[pass] * 1000.0 << "}";
+		}
+	}
+
+	// A marker across every track at the start of the spike frame, and a section covering it
+	file << ",\n{\"name\":\"Spike\",\"ph\":\"i\",\"s\":\"g\",\"pid\":0,\"tid\":0,\"ts\":" << gCpuProfiler.TraceTime(spike.start) << "}";
+	file << ",\n{\"name\":\"Spike Frame\",\"ph\":\"X\",\"pid\":0,\"tid\":" << gpuTrack + 1 << ",\"ts\":" << gCpuProfiler.TraceTime(spike.start)
+	     << ",\"dur\":" << gCpuProfiler.TraceTime(spike.end) - gCpuProfiler.TraceTime(spike.start) << "}";
+	file << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << gpuTrack + 1 << ",\"args\":{\"name\":\"Spikes\"}}";
+	file << "\n],\n";
+
+	file << "\"otherData\":{\"frame\":" << spike.frame << ",\"frameTimeMs\":" << spike.frameTimeMs << ",\"medianFrameTimeMs\":" << spike.medianTimeMs
+	     << ",\"cameraPosition\":[" << spike.state.cameraPosition.x << "," << spike.state.cameraPosition.y << "," << spike.state.cameraPosition.z
+	     << "],\"waterHeight\":" << spike.state.waterHeight << ",\"waveScale\":" << spike.state.waveScale << "}}\n";
+}
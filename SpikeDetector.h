@@ -0,0 +1,140 @@
+//--------------------------------------------------------------------------------------
+// Frame spike detector - saves a trace of the last few seconds when a frame takes too long
+//--------------------------------------------------------------------------------------
+// The average frame time hides the hitches that are actually noticed: a texture loading, a shader
+// being created, the driver doing work of its own. The CPU profiler always keeps the sections of
+// the last few frames and the GPU profiler the pass times of the last few seconds of frames (see
+// CpuProfiler.h and GpuProfiler.h), so when a frame takes much longer than the median of the
+// frames before it, all that is needed is to save them. The trace is a Chrome trace like the one
+// from the 8 key: the CPU sections of each thread, the GPU passes on a track of their own (placed
+// from when the CPU began rendering the frame, the GPU clock can't be lined up with the CPU's),
+// a marker on the spike frame, and the frame number and scene state in the trace's metadata.
+//
+// The GPU's results arrive a few frames late, so the trace is saved a few frames after the spike.
+// The sections are copied on the main thread, which is quick, and written to the file on a thread
+// of the detector's own so that the save doesn't make the next spike. Spikes soon after a save
+// are ignored, as are those while the last trace is still being written, and only so many traces
+// are saved in a run. The files are spike_frameN.json, a trace that can't be written is skipped.
+//
+// Command line options (read with the benchmark options, see Benchmark.h):
+//   -spikethreshold F   Frames taking F times the median frame time or longer are spikes, 0 for
+//                       none (default 2)
+//   -spikemin MS        Frames shorter than this many milliseconds are never spikes (default 20),
+//                       so a frame missing vsync isn't one
+
+#include "CpuProfiler.h"
+#include "GpuProfiler.h"
+#include "CVector3.h"
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+
+#ifndef _SPIKE_DETECTOR_H_INCLUDED_
+#define _SPIKE_DETECTOR_H_INCLUDED_
+
+
+//--------------------------------------------------------------------------------------
+// Settings
+//--------------------------------------------------------------------------------------
+
+struct SpikeSettings
+{
+	float threshold     = 2;  // Multiple of the median frame time, 0 for no spike traces
+	float minimumTimeMs = 20;
+};
+
+extern SpikeSettings gSpikeSettings;
+
+
+//--------------------------------------------------------------------------------------
+// Detector
+//--------------------------------------------------------------------------------------
+
+// What the scene was doing during a frame, saved with its trace
+struct SpikeSceneState
+{
+	CVector3 cameraPosition;
+	float    waterHeight;
+	float    waveScale;
+};
+
+class SpikeDetector
+{
+//--------------------------------------------------------------------------------------
+// Construction / Usage
+//--------------------------------------------------------------------------------------
+public:
+
+	SpikeDetector() = default;
+	~SpikeDetector(); // Finishes writing the trace being saved
+
+	SpikeDetector(const SpikeDetector&) = delete;
+	SpikeDetector& operator=(const SpikeDetector&) = delete;
+
+
+	// Call once a frame on the main thread, between frames. The frame that has just finished is the time since the last call,
+	// and did what the given scene state says. Saves a trace if a spike a few frames ago is now ready to be saved
+	void EndFrame(const SpikeSceneState& state);
+
+	// Traces saved so far
+	int NumTraces()  { return mNumTraces; }
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions / data
+//--------------------------------------------------------------------------------------
+private:
+
+	// Frames the median is taken over, and needed before any frame can be a spike
+	static constexpr int MedianFrames = 120;
+
+	// Frames to wait after a spike before saving, for the GPU's results (see GpuProfiler.h)
+	static constexpr int TraceDelayFrames = 6;
+
+	// Seconds before the spike frame in each trace, as much of it as the profilers still have
+	static constexpr float TraceSeconds = 3.0f;
+
+	// Frames after a trace is saved when spikes are ignored, and the most traces saved in a run
+	static constexpr int CooldownFrames = 120;
+	static constexpr int MaxTraces = 20;
+
+	struct Spike
+	{
+		int             frame;
+		uint64_t        start, end; // High-resolution counts (see Timer.h)
+		float           frameTimeMs;
+		float           medianTimeMs;
+		SpikeSceneState state;
+	};
+
+	// Copy the profilers' recent data for a spike and start writing its trace
+	void SaveTrace(const Spike& spike);
+
+	// Write a trace file from the copied data, on the writing thread
+	static void WriteTrace(const Spike& spike, const CpuProfiler::TraceSnapshot& cpu, const std::vector<GpuFrameTimings>& gpu);
+
+
+	float    mFrameTimes[MedianFrames]; // Ring of the most recent frame times, milliseconds
+	int      mNumFrameTimes = 0;
+	int      mFrame = 0;      // Frames finished
+	uint64_t mLastCount = 0;  // When the last frame finished, 0 before the first
+
+	Spike mSpike;              // Waiting for the GPU's results before saving
+	int   mSpikeCountdown = 0; // Frames until the spike is saved, 0 for none waiting
+	int   mCooldown = 0;
+	int   mNumTraces = 0;
+
+	// Copies of the profilers' data and the thread writing them, only one trace is written at a time
+	CpuProfiler::TraceSnapshot   mCpuSnapshot;
+	std::vector<GpuFrameTimings> mGpuFrames;
+	std::thread                  mWriter;
+	std::atomic<bool>            mWriting = { false };
+};
+
+
+// The detector used by the app, created in InitGeometry (see Scene.cpp)
+extern SpikeDetector* gSpikeDetector;
+
+
+#endif //_SPIKE_DETECTOR_H_INCLUDED_
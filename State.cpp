@@ -4,10 +4,17 @@
 // - Blender state (Additive blending, alpha blending etc.)
 // - Rasterizer state (Wireframe mode, don't cull back faces etc.)
 // - Depth stencil state (How to use the depth and stencil buffer)
+// - Any other state, made from its description when first asked for and then shared
 //--------------------------------------------------------------------------------------
 
 #include "State.h"
 #include "Common.h"
+#include "MappedFile.h"
+
+#include <unordered_map>
+#include <mutex>
+#include <string>
+#include <cstring>
 
 
 //--------------------------------------------------------------------------------------
@@ -21,28 +28,169 @@
 // A sampler state object represents a way to filter textures, such as bilinear or trilinear. We have one object for each method we want to use
 ID3D11SamplerState* gPointSampler          = nullptr;
 ID3D11SamplerState* gTrilinearSampler      = nullptr;
-ID3D11SamplerState* gAnisotropic4xSampler  = nullptr;
+ID3D11SamplerState* gAnisotropicSampler    = nullptr;
 ID3D11SamplerState* gBilinearMirrorSampler  = nullptr;
+ID3D11SamplerState* gShadowSampler          = nullptr;
 
 // Blend states allow us to switch between blending modes (none, additive, multiplicative etc.)
 ID3D11BlendState* gNoBlendingState       = nullptr;
 ID3D11BlendState* gAdditiveBlendingState = nullptr;
 ID3D11BlendState* gAlphaBlendingState    = nullptr;
+ID3D11BlendState* gPremultipliedAlphaBlendingState = nullptr;
+ID3D11BlendState* gUnderwaterFogBlendingState = nullptr;
 
 
 // Rasterizer states affect how triangles are drawn
 ID3D11RasterizerState* gCullBackState  = nullptr;
+ID3D11RasterizerState* gCullBackScissorState = nullptr;
 ID3D11RasterizerState* gCullFrontState = nullptr;
+ID3D11RasterizerState* gCullFrontScissorState = nullptr;
 ID3D11RasterizerState* gCullNoneState  = nullptr;
+ID3D11RasterizerState* gCullNoneScissorState = nullptr;
 ID3D11RasterizerState* gWireframeState  = nullptr;
+ID3D11RasterizerState* gShadowCasterState = nullptr;
 
 // Depth-stencil states allow us change how the depth buffer is used
 ID3D11DepthStencilState* gUseDepthBufferState = nullptr;
 ID3D11DepthStencilState* gDepthReadOnlyState  = nullptr;
+ID3D11DepthStencilState* gDepthEqualState     = nullptr;
+ID3D11DepthStencilState* gDepthFarPlaneState  = nullptr;
 ID3D11DepthStencilState* gNoDepthBufferState  = nullptr;
 
 
 
+//--------------------------------------------------------------------------------------
+// State objects on demand
+//--------------------------------------------------------------------------------------
+
+namespace
+{
+	// The objects made for one kind of description, found by a hash of the description's bytes. Descriptions with the same
+	// hash are told apart by comparing the bytes
+	template <class Desc, class State>
+	struct StateObjects
+	{
+		struct Entry
+		{
+			Desc   desc;
+			State* state;
+		};
+		std::unordered_multimap<uint64_t, Entry> entries;
+	};
+
+	StateObjects<D3D11_SAMPLER_DESC,       ID3D11SamplerState>      gSamplerStates;
+	StateObjects<D3D11_BLEND_DESC,         ID3D11BlendState>        gBlendStates;
+	StateObjects<D3D11_RASTERIZER_DESC,    ID3D11RasterizerState>   gRasterizerStates;
+	StateObjects<D3D11_DEPTH_STENCIL_DESC, ID3D11DepthStencilState> gDepthStencilStates;
+	std::mutex gStateObjectsMutex; // For all of them
+
+
+	// The object for a description, made with the given function if there isn't one. The description must have no padding
+	// bytes that could differ for the same settings. Returns nullptr with a message in gLastError on failure
+	template <class Desc, class State, class Create>
+	State* FindOrCreateState(StateObjects<Desc, State>& objects, const Desc& desc, Create create, const char* kind)
+	{
+		uint64_t hash = HashData(&desc, sizeof(Desc));
+		std::lock_guard<std::mutex> lock(gStateObjectsMutex);
+		auto range = objects.entries.equal_range(hash);
+		for (auto entry = range.first; entry != range.second; ++entry)
+		{
+			if (memcmp(&entry->second.desc, &desc, sizeof(Desc)) == 0)  return entry->second.state;
+		}
+
+		State* state = nullptr;
+		if (FAILED(create(&desc, &state)))
+		{
+			gLastError = std::string("Error creating ") + kind;
+			return nullptr;
+		}
+		objects.entries.insert({ hash, { desc, state } });
+		return state;
+	}
+
+	template <class Desc, class State>
+	void ReleaseStateObjects(StateObjects<Desc, State>& objects)
+	{
+		for (auto& entry : objects.entries)  entry.second.state->Release();
+		objects.entries.clear();
+	}
+}
+
+
+// The shared state object for a description, made the first time it is asked for. Returns nullptr with a message in
+// gLastError on failure. Sampler and rasterizer descriptions are all 4-byte fields, so have no padding to clear
+ID3D11SamplerState* GetSamplerState(const D3D11_SAMPLER_DESC& desc)
+{
+	return FindOrCreateState(gSamplerStates, desc, [](const D3D11_SAMPLER_DESC* d, ID3D11SamplerState** s)
+	{
+		return gD3DDevice->CreateSamplerState(d, s);
+	}, "sampler state");
+}
+
+ID3D11RasterizerState* GetRasterizerState(const D3D11_RASTERIZER_DESC& desc)
+{
+	return FindOrCreateState(gRasterizerStates, desc, [](const D3D11_RASTERIZER_DESC* d, ID3D11RasterizerState** s)
+	{
+		return gD3DDevice->CreateRasterizerState(d, s);
+	}, "rasterizer state");
+}
+
+// Blend descriptions are copied field by field so the padding after each target's write mask is zero. Without independent
+// blending only the first target's settings are used, so the others are left zero and don't make the same state look new
+ID3D11BlendState* GetBlendState(const D3D11_BLEND_DESC& desc)
+{
+	D3D11_BLEND_DESC key;
+	memset(&key, 0, sizeof(key));
+	key.AlphaToCoverageEnable  = desc.AlphaToCoverageEnable;
+	key.IndependentBlendEnable = desc.IndependentBlendEnable;
+	int numTargets = desc.IndependentBlendEnable ? D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT : 1;
+	for (int i = 0; i < numTargets; ++i)
+	{
+		const D3D11_RENDER_TARGET_BLEND_DESC& target = desc.RenderTarget[i];
+		key.RenderTarget[i].BlendEnable           = target.BlendEnable;
+		key.RenderTarget[i].SrcBlend              = target.SrcBlend;
+		key.RenderTarget[i].DestBlend             = target.DestBlend;
+		key.RenderTarget[i].BlendOp               = target.BlendOp;
+		key.RenderTarget[i].SrcBlendAlpha         = target.SrcBlendAlpha;
+		key.RenderTarget[i].DestBlendAlpha        = target.DestBlendAlpha;
+		key.RenderTarget[i].BlendOpAlpha          = target.BlendOpAlpha;
+		key.RenderTarget[i].RenderTargetWriteMask = target.RenderTargetWriteMask;
+	}
+	return FindOrCreateState(gBlendStates, key, [](const D3D11_BLEND_DESC* d, ID3D11BlendState** s)
+	{
+		return gD3DDevice->CreateBlendState(d, s);
+	}, "blend state");
+}
+
+// Depth-stencil descriptions are copied the same way, for the padding after the stencil masks
+ID3D11DepthStencilState* GetDepthStencilState(const D3D11_DEPTH_STENCIL_DESC& desc)
+{
+	D3D11_DEPTH_STENCIL_DESC key;
+	memset(&key, 0, sizeof(key));
+	key.DepthEnable      = desc.DepthEnable;
+	key.DepthWriteMask   = desc.DepthWriteMask;
+	key.DepthFunc        = desc.DepthFunc;
+	key.StencilEnable    = desc.StencilEnable;
+	key.StencilReadMask  = desc.StencilReadMask;
+	key.StencilWriteMask = desc.StencilWriteMask;
+	key.FrontFace        = desc.FrontFace; // All 4-byte fields
+	key.BackFace         = desc.BackFace;
+	return FindOrCreateState(gDepthStencilStates, key, [](const D3D11_DEPTH_STENCIL_DESC* d, ID3D11DepthStencilState** s)
+	{
+		return gD3DDevice->CreateDepthStencilState(d, s);
+	}, "depth-stencil state");
+}
+
+
+// Number of distinct state objects made so far
+int NumStateObjects()
+{
+	std::lock_guard<std::mutex> lock(gStateObjectsMutex);
+	return static_cast<int>(gSamplerStates.entries.size() + gBlendStates.entries.size() + gRasterizerStates.entries.size() +
+	                        gDepthStencilStates.entries.size());
+}
+
+
 //--------------------------------------------------------------------------------------
 // State creation / destruction
 //--------------------------------------------------------------------------------------
@@ -67,7 +215,8 @@ bool CreateStates()
 	samplerDesc.MinLOD = 0;                 // --"--
 
 	// Then create a DirectX object for your description that can be used by a shader
-	if (FAILED(gD3DDevice->CreateSamplerState(&samplerDesc, &gPointSampler)))
+	gPointSampler = GetSamplerState(samplerDesc);
+	if (gPointSampler == nullptr)
 	{
 		gLastError = "Error creating point sampler";
 		return false;
@@ -85,7 +234,8 @@ bool CreateStates()
 	samplerDesc.MinLOD = 0;                 // --"--
 
 	// Then create a DirectX object for your description that can be used by a shader
-	if (FAILED(gD3DDevice->CreateSamplerState(&samplerDesc, &gTrilinearSampler)))
+	gTrilinearSampler = GetSamplerState(samplerDesc);
+	if (gTrilinearSampler == nullptr)
 	{
 		gLastError = "Error creating point sampler";
 		return false;
@@ -93,37 +243,47 @@ bool CreateStates()
 
 
 	////-------- Anisotropic filtering --------////
-	samplerDesc.Filter = D3D11_FILTER_ANISOTROPIC;        // Anisotropic filtering
-	samplerDesc.AddressU = D3D11_TEXTURE_ADDRESS_WRAP;    // Wrap addressing mode for texture coordinates outside 0->1
-	samplerDesc.AddressV = D3D11_TEXTURE_ADDRESS_WRAP;    // --"--
-	samplerDesc.AddressW = D3D11_TEXTURE_ADDRESS_WRAP;    // --"--
+	// 4x to start with, the render settings choose the number of samples once the scene is set up (see ApplyRenderSettings)
+	if (!CreateAnisotropicSampler(4))  return false;
+
+
+	////-------- Trilinear filtering with mirroring - used for wiggling reflection/refractions --------////
+	// Still named bilinear as most of its uses read the top mip-map only (SampleLevel 0). The water surface shader blurs the
+	// reflection and refraction by reading their mip-maps where the waves are rough
+	samplerDesc.Filter = D3D11_FILTER_MIN_MAG_MIP_LINEAR; // Trilinear filtering
+	samplerDesc.AddressU = D3D11_TEXTURE_ADDRESS_MIRROR;    // Wrap addressing mode for texture coordinates outside 0->1
+	samplerDesc.AddressV = D3D11_TEXTURE_ADDRESS_MIRROR;    // --"--
+	samplerDesc.AddressW = D3D11_TEXTURE_ADDRESS_MIRROR;    // --"--
 	samplerDesc.MaxAnisotropy = 4;                        // Number of samples used if using anisotropic filtering, more is better but max value depends on GPU
 
-	samplerDesc.MaxLOD = D3D11_FLOAT32_MAX; // Controls how much mip-mapping can be used. These settings are full mip-mapping, the usual values
+	samplerDesc.MaxLOD = D3D11_FLOAT32_MAX; // Controls how much mip-mapping can be used. This is for all of it
 	samplerDesc.MinLOD = 0;                 // --"--
 
 	// Then create a DirectX object for your description that can be used by a shader
-	if (FAILED(gD3DDevice->CreateSamplerState(&samplerDesc, &gAnisotropic4xSampler)))
+	gBilinearMirrorSampler = GetSamplerState(samplerDesc);
+	if (gBilinearMirrorSampler == nullptr)
 	{
-		gLastError = "Error creating anisotropic 4x sampler";
+		gLastError = "Error creating bilinear mirror sampler";
 		return false;
 	}
 
 
-	////-------- Bilinear filtering with mirroring - used for wiggling reflection/refractions --------////
-	samplerDesc.Filter = D3D11_FILTER_MIN_MAG_LINEAR_MIP_POINT; // Bilinear filtering
-	samplerDesc.AddressU = D3D11_TEXTURE_ADDRESS_MIRROR;    // Wrap addressing mode for texture coordinates outside 0->1
-	samplerDesc.AddressV = D3D11_TEXTURE_ADDRESS_MIRROR;    // --"--
-	samplerDesc.AddressW = D3D11_TEXTURE_ADDRESS_MIRROR;    // --"--
-	samplerDesc.MaxAnisotropy = 4;                        // Number of samples used if using anisotropic filtering, more is better but max value depends on GPU
+	////-------- Shadow map comparison - used to sample the shadow maps (see ShadowMap.h) --------////
+	samplerDesc.Filter = D3D11_FILTER_COMPARISON_MIN_MAG_LINEAR_MIP_POINT; // Compares the 4 nearest depths and blends the results
+	samplerDesc.AddressU = D3D11_TEXTURE_ADDRESS_BORDER;   // Outside the map is lit...
+	samplerDesc.AddressV = D3D11_TEXTURE_ADDRESS_BORDER;   // --"--
+	samplerDesc.AddressW = D3D11_TEXTURE_ADDRESS_BORDER;   // --"--
+	samplerDesc.BorderColor[0] = samplerDesc.BorderColor[1] = samplerDesc.BorderColor[2] = samplerDesc.BorderColor[3] = 0; // ...at the far depth
+	samplerDesc.ComparisonFunc = D3D11_COMPARISON_GREATER_EQUAL; // Lit where the pixel is no further from the light than the map's depth (reversed)
+	samplerDesc.MaxAnisotropy = 1;
 
-	samplerDesc.MaxLOD = 0; // Controls how much mip-mapping can be used. This is for no mip-mapping
+	samplerDesc.MaxLOD = 0; // No mip-maps
 	samplerDesc.MinLOD = 0; // --"--
 
-	// Then create a DirectX object for your description that can be used by a shader
-	if (FAILED(gD3DDevice->CreateSamplerState(&samplerDesc, &gBilinearMirrorSampler)))
+	gShadowSampler = GetSamplerState(samplerDesc);
+	if (gShadowSampler == nullptr)
 	{
-		gLastError = "Error creating bilinear mirror sampler";
+		gLastError = "Error creating shadow sampler";
 		return false;
 	}
 
@@ -143,12 +303,31 @@ bool CreateStates()
     rasterizerDesc.DepthClipEnable       = TRUE; // Advanced setting - only used in rare cases
 
     // Create a DirectX object for the description above that can be used by a shader
-    if (FAILED(gD3DDevice->CreateRasterizerState(&rasterizerDesc, &gCullBackState)))
+    gCullBackState = GetRasterizerState(rasterizerDesc);
+    if (gCullBackState == nullptr)
     {
         gLastError = "Error creating cull-back state";
         return false;
     }
 
+
+    ////-------- Back face culling, scissor test --------////
+    // As above, but also removes pixels outside a rectangle set with RSSetScissorRects - used to render only the part of the
+    // refraction that the water covers on the screen
+    rasterizerDesc.FillMode              = D3D11_FILL_SOLID;
+    rasterizerDesc.CullMode              = D3D11_CULL_BACK;
+    rasterizerDesc.DepthClipEnable       = TRUE;
+    rasterizerDesc.ScissorEnable         = TRUE;
+
+    // Create a DirectX object for the description above that can be used by a shader
+    gCullBackScissorState = GetRasterizerState(rasterizerDesc);
+    if (gCullBackScissorState == nullptr)
+    {
+        gLastError = "Error creating cull-back-scissor state";
+        return false;
+    }
+    rasterizerDesc.ScissorEnable         = FALSE;
+
 	
 	////-------- Front face culling --------////
 	// This is an unusual mode - it shows inside faces only so the model looks inside-out
@@ -157,11 +336,29 @@ bool CreateStates()
     rasterizerDesc.DepthClipEnable       = TRUE; // Advanced setting - only used in rare cases
 
     // Create a DirectX object for the description above that can be used by a shader
-    if (FAILED(gD3DDevice->CreateRasterizerState(&rasterizerDesc, &gCullFrontState)))
+    gCullFrontState = GetRasterizerState(rasterizerDesc);
+    if (gCullFrontState == nullptr)
     {
         gLastError = "Error creating cull-front state";
         return false;
     }
+
+
+    ////-------- Front face culling, scissor test --------////
+    // As above, but also removes pixels outside a rectangle set with RSSetScissorRects - used to render part of the reflection
+    rasterizerDesc.FillMode              = D3D11_FILL_SOLID;
+    rasterizerDesc.CullMode              = D3D11_CULL_FRONT;
+    rasterizerDesc.DepthClipEnable       = TRUE;
+    rasterizerDesc.ScissorEnable         = TRUE;
+
+    // Create a DirectX object for the description above that can be used by a shader
+    gCullFrontScissorState = GetRasterizerState(rasterizerDesc);
+    if (gCullFrontScissorState == nullptr)
+    {
+        gLastError = "Error creating cull-front-scissor state";
+        return false;
+    }
+    rasterizerDesc.ScissorEnable         = FALSE;
 	
 	
     ////-------- No culling --------////
@@ -171,11 +368,29 @@ bool CreateStates()
     rasterizerDesc.DepthClipEnable       = TRUE; // Advanced setting - only used in rare cases
 
     // Create a DirectX object for the description above that can be used by a shader
-    if (FAILED(gD3DDevice->CreateRasterizerState(&rasterizerDesc, &gCullNoneState)))
+    gCullNoneState = GetRasterizerState(rasterizerDesc);
+    if (gCullNoneState == nullptr)
     {
         gLastError = "Error creating cull-none state";
         return false;
     }
+
+
+    ////-------- No culling, scissor test --------////
+    // As above with the scissor test, for the sky and lights in the refraction and reflection passes
+    rasterizerDesc.FillMode              = D3D11_FILL_SOLID;
+    rasterizerDesc.CullMode              = D3D11_CULL_NONE;
+    rasterizerDesc.DepthClipEnable       = TRUE;
+    rasterizerDesc.ScissorEnable         = TRUE;
+
+    // Create a DirectX object for the description above that can be used by a shader
+    gCullNoneScissorState = GetRasterizerState(rasterizerDesc);
+    if (gCullNoneScissorState == nullptr)
+    {
+        gLastError = "Error creating cull-none-scissor state";
+        return false;
+    }
+    rasterizerDesc.ScissorEnable         = FALSE;
 	
 	
     ////-------- Wireframe mode --------////
@@ -184,11 +399,33 @@ bool CreateStates()
     rasterizerDesc.DepthClipEnable       = TRUE; // Advanced setting - only used in rare cases
 
     // Create a DirectX object for the description above that can be used by a shader
-    if (FAILED(gD3DDevice->CreateRasterizerState(&rasterizerDesc, &gWireframeState)))
+    gWireframeState = GetRasterizerState(rasterizerDesc);
+    if (gWireframeState == nullptr)
     {
         gLastError = "Error creating cull-none state";
         return false;
     }
+
+
+    ////-------- Shadow casters --------////
+    // Back face culling with the depths pushed away from the light, more on slopes, so surfaces don't shadow themselves
+    // (shadow acne). Depth clipping is off so casters nearer the light than the shadow map's near plane still cast shadows
+    rasterizerDesc.FillMode              = D3D11_FILL_SOLID;
+    rasterizerDesc.CullMode              = D3D11_CULL_BACK;
+    rasterizerDesc.DepthClipEnable       = FALSE;
+    rasterizerDesc.DepthBias             = -100; // Negative as the depths are reversed (see ShadowMap::Update)
+    rasterizerDesc.SlopeScaledDepthBias  = -2.0f;
+    rasterizerDesc.DepthBiasClamp        = 0.0f;
+
+    gShadowCasterState = GetRasterizerState(rasterizerDesc);
+    if (gShadowCasterState == nullptr)
+    {
+        gLastError = "Error creating shadow caster state";
+        return false;
+    }
+    rasterizerDesc.DepthClipEnable       = TRUE;
+    rasterizerDesc.DepthBias             = 0;
+    rasterizerDesc.SlopeScaledDepthBias  = 0.0f;
 	
 	
     //--------------------------------------------------------------------------------------
@@ -211,7 +448,8 @@ bool CreateStates()
     blendDesc.RenderTarget[0].RenderTargetWriteMask = D3D11_COLOR_WRITE_ENABLE_ALL;
 
     // Then create a DirectX object for the description that can be used by a shader
-    if (FAILED(gD3DDevice->CreateBlendState(&blendDesc, &gNoBlendingState)))
+    gNoBlendingState = GetBlendState(blendDesc);
+    if (gNoBlendingState == nullptr)
     {
         gLastError = "Error creating no-blend state";
         return false;
@@ -231,12 +469,22 @@ bool CreateStates()
     blendDesc.RenderTarget[0].BlendOpAlpha   = D3D11_BLEND_OP_ADD;
     blendDesc.RenderTarget[0].RenderTargetWriteMask = D3D11_COLOR_WRITE_ENABLE_ALL;
 
+    // The lights are also drawn in the water passes, which write the distortion to a second render target. Adding that up
+    // would make no sense, so the second target is written without blending (see WaterTexturePixelShaderOutput)
+    D3D11_RENDER_TARGET_BLEND_DESC noBlendTarget = blendDesc.RenderTarget[0];
+    noBlendTarget.BlendEnable = FALSE;
+    noBlendTarget.DestBlend   = D3D11_BLEND_ZERO;
+    blendDesc.IndependentBlendEnable = TRUE;
+    blendDesc.RenderTarget[1] = noBlendTarget;
+
     // Then create a DirectX object for the description that can be used by a shader
-    if (FAILED(gD3DDevice->CreateBlendState(&blendDesc, &gAdditiveBlendingState)))
+    gAdditiveBlendingState = GetBlendState(blendDesc);
+    if (gAdditiveBlendingState == nullptr)
     {
         gLastError = "Error creating additive blending state";
         return false;
     }
+    blendDesc.IndependentBlendEnable = FALSE;
     	
 	
 	////-------- Alpha Blending State --------////
@@ -253,11 +501,41 @@ bool CreateStates()
     blendDesc.RenderTarget[0].RenderTargetWriteMask = D3D11_COLOR_WRITE_ENABLE_ALL;
 
     // Then create a DirectX object for the description that can be used by a shader
-    if (FAILED(gD3DDevice->CreateBlendState(&blendDesc, &gAlphaBlendingState)))
+    gAlphaBlendingState = GetBlendState(blendDesc);
+    if (gAlphaBlendingState == nullptr)
     {
         gLastError = "Error creating additive blending state";
         return false;
     }
+
+
+	////-------- Premultiplied Alpha Blending State --------////
+    // The shader has already multiplied its colour by alpha, so the source is added as it is. An alpha of 0 with a colour is
+    // then additive, so blended and additive particles can be drawn together in one draw (see Particle_ps)
+    blendDesc.RenderTarget[0].SrcBlend  = D3D11_BLEND_ONE;
+    blendDesc.RenderTarget[0].DestBlend = D3D11_BLEND_INV_SRC_ALPHA;
+
+    gPremultipliedAlphaBlendingState = GetBlendState(blendDesc);
+    if (gPremultipliedAlphaBlendingState == nullptr)
+    {
+        gLastError = "Error creating premultiplied alpha blending state";
+        return false;
+    }
+
+
+	////-------- Underwater Fog Blending State --------////
+    // Dual-source blending: the shader's second output scales the colour already on screen, separately in red, green and blue,
+    // and the first output is added. So the water's fog can let through more blue than red in one pass (see UnderwaterFog_ps)
+    blendDesc.RenderTarget[0].BlendEnable = TRUE;
+    blendDesc.RenderTarget[0].SrcBlend  = D3D11_BLEND_ONE;
+    blendDesc.RenderTarget[0].DestBlend = D3D11_BLEND_SRC1_COLOR;
+    blendDesc.RenderTarget[0].BlendOp   = D3D11_BLEND_OP_ADD;
+    gUnderwaterFogBlendingState = GetBlendState(blendDesc);
+    if (gUnderwaterFogBlendingState == nullptr)
+    {
+        gLastError = "Error creating underwater fog blending state";
+        return false;
+    }
     	
 	
 	//--------------------------------------------------------------------------------------
@@ -266,16 +544,18 @@ bool CreateStates()
 	// Depth-stencil states adjust how the depth and stencil buffers are used. The stencil buffer is rarely used so 
 	// these states are most often used to switch the depth buffer on and off. See depth buffers lab for details
 	// Each block of code creates a rasterizer state. Copy a block and adjust values to add another mode
+	// Depths are reversed, 1 at the near plane and 0 far away (see Camera::UpdateMatrices), so nearer is GREATER
 	D3D11_DEPTH_STENCIL_DESC depthStencilDesc = {};
 
 	////-------- Enable depth buffer --------////
     depthStencilDesc.DepthEnable      = TRUE;
     depthStencilDesc.DepthWriteMask   = D3D11_DEPTH_WRITE_MASK_ALL;
-    depthStencilDesc.DepthFunc        = D3D11_COMPARISON_LESS;
+    depthStencilDesc.DepthFunc        = D3D11_COMPARISON_GREATER;
     depthStencilDesc.StencilEnable    = FALSE;
 
     // Create a DirectX object for the description above that can be used by a shader
-    if (FAILED(gD3DDevice->CreateDepthStencilState(&depthStencilDesc, &gUseDepthBufferState)))
+    gUseDepthBufferState = GetDepthStencilState(depthStencilDesc);
+    if (gUseDepthBufferState == nullptr)
     {
         gLastError = "Error creating use-depth-buffer state";
         return false;
@@ -286,25 +566,59 @@ bool CreateStates()
     // Disables writing to depth buffer - used for transparent objects because they should not be entered in the buffer but do need to check if they are behind something
     depthStencilDesc.DepthEnable      = TRUE;
     depthStencilDesc.DepthWriteMask   = D3D11_DEPTH_WRITE_MASK_ZERO; // Disable writing to depth buffer
-    depthStencilDesc.DepthFunc        = D3D11_COMPARISON_LESS;
+    depthStencilDesc.DepthFunc        = D3D11_COMPARISON_GREATER;
     depthStencilDesc.StencilEnable    = FALSE;
 
     // Create a DirectX object for the description above that can be used by a shader
-    if (FAILED(gD3DDevice->CreateDepthStencilState(&depthStencilDesc, &gDepthReadOnlyState)))
+    gDepthReadOnlyState = GetDepthStencilState(depthStencilDesc);
+    if (gDepthReadOnlyState == nullptr)
     {
         gLastError = "Error creating depth-read-only state";
         return false;
     }
 
 
+    ////-------- Depth buffer equal only --------////
+    // Only passes pixels at exactly the depth already in the buffer - used after a depth prepass so each pixel is shaded once
+    depthStencilDesc.DepthEnable      = TRUE;
+    depthStencilDesc.DepthWriteMask   = D3D11_DEPTH_WRITE_MASK_ZERO; // Depth is already written by the prepass
+    depthStencilDesc.DepthFunc        = D3D11_COMPARISON_EQUAL;
+    depthStencilDesc.StencilEnable    = FALSE;
+
+    // Create a DirectX object for the description above that can be used by a shader
+    gDepthEqualState = GetDepthStencilState(depthStencilDesc);
+    if (gDepthEqualState == nullptr)
+    {
+        gLastError = "Error creating depth-equal state";
+        return false;
+    }
+
+
+    ////-------- Depth buffer reads only, passing at the far plane --------////
+    // For geometry placed exactly on the far plane (the sky), which must pass where the depth buffer still has its cleared value
+    depthStencilDesc.DepthEnable      = TRUE;
+    depthStencilDesc.DepthWriteMask   = D3D11_DEPTH_WRITE_MASK_ZERO;
+    depthStencilDesc.DepthFunc        = D3D11_COMPARISON_GREATER_EQUAL;
+    depthStencilDesc.StencilEnable    = FALSE;
+
+    // Create a DirectX object for the description above that can be used by a shader
+    gDepthFarPlaneState = GetDepthStencilState(depthStencilDesc);
+    if (gDepthFarPlaneState == nullptr)
+    {
+        gLastError = "Error creating depth-far-plane state";
+        return false;
+    }
+
+
 	////-------- Disable depth buffer --------////
     depthStencilDesc.DepthEnable      = FALSE;
     depthStencilDesc.DepthWriteMask   = D3D11_DEPTH_WRITE_MASK_ALL;
-    depthStencilDesc.DepthFunc        = D3D11_COMPARISON_LESS;
+    depthStencilDesc.DepthFunc        = D3D11_COMPARISON_GREATER;
     depthStencilDesc.StencilEnable    = FALSE;
 
     // Create a DirectX object for the description above that can be used by a shader
-    if (FAILED(gD3DDevice->CreateDepthStencilState(&depthStencilDesc, &gNoDepthBufferState)))
+    gNoDepthBufferState = GetDepthStencilState(depthStencilDesc);
+    if (gNoDepthBufferState == nullptr)
     {
         gLastError = "Error creating no-depth-buffer state";
         return false;
@@ -314,21 +628,43 @@ bool CreateStates()
 }
 
 
-// Release DirectX state objects
+// Release DirectX state objects. The globals above are all from the state objects, so are only cleared
 void ReleaseStates()
 {
-    if (gUseDepthBufferState)    gUseDepthBufferState->Release();
-    if (gDepthReadOnlyState)     gDepthReadOnlyState->Release();
-    if (gNoDepthBufferState)     gNoDepthBufferState->Release();
-    if (gWireframeState)         gWireframeState->Release();
-    if (gCullBackState)          gCullBackState->Release();
-    if (gCullFrontState)         gCullFrontState->Release();
-    if (gCullNoneState)          gCullNoneState->Release();
-    if (gNoBlendingState)        gNoBlendingState->Release();
-    if (gAlphaBlendingState)     gAlphaBlendingState->Release();
-    if (gAdditiveBlendingState)  gAdditiveBlendingState->Release();
-    if (gBilinearMirrorSampler)  gBilinearMirrorSampler->Release();
-    if (gAnisotropic4xSampler)   gAnisotropic4xSampler->Release();
-    if (gTrilinearSampler)       gTrilinearSampler->Release();
-    if (gPointSampler)           gPointSampler->Release();
+    ReleaseStateObjects(gSamplerStates);
+    ReleaseStateObjects(gBlendStates);
+    ReleaseStateObjects(gRasterizerStates);
+    ReleaseStateObjects(gDepthStencilStates);
+
+    gPointSampler = gTrilinearSampler = gAnisotropicSampler = gBilinearMirrorSampler = gShadowSampler = nullptr;
+    gNoBlendingState = gAdditiveBlendingState = gAlphaBlendingState = gPremultipliedAlphaBlendingState = gUnderwaterFogBlendingState = nullptr;
+    gCullBackState = gCullBackScissorState = gCullFrontState = gCullFrontScissorState = nullptr;
+    gCullNoneState = gCullNoneScissorState = gWireframeState = gShadowCasterState = nullptr;
+    gUseDepthBufferState = gDepthReadOnlyState = gDepthEqualState = gDepthFarPlaneState = gNoDepthBufferState = nullptr;
+}
+
+
+// Create gAnisotropicSampler with the given number of samples (1 to 16, 1 is trilinear), replacing the one there is. The
+// standard sampler for most textures, the render settings choose its samples (see Settings.h). Returns false on failure
+bool CreateAnisotropicSampler(unsigned int maxAnisotropy)
+{
+	D3D11_SAMPLER_DESC samplerDesc = {};
+	samplerDesc.Filter = maxAnisotropy > 1 ? D3D11_FILTER_ANISOTROPIC : D3D11_FILTER_MIN_MAG_MIP_LINEAR;
+	samplerDesc.AddressU = D3D11_TEXTURE_ADDRESS_WRAP;    // Wrap addressing mode for texture coordinates outside 0->1
+	samplerDesc.AddressV = D3D11_TEXTURE_ADDRESS_WRAP;    // --"--
+	samplerDesc.AddressW = D3D11_TEXTURE_ADDRESS_WRAP;    // --"--
+	samplerDesc.MaxAnisotropy = maxAnisotropy;            // Number of samples used if using anisotropic filtering, more is better but max value depends on GPU
+
+	samplerDesc.MaxLOD = D3D11_FLOAT32_MAX; // Controls how much mip-mapping can be used. These settings are full mip-mapping, the usual values
+	samplerDesc.MinLOD = 0;                 // --"--
+
+	// The old one stays with the other state objects, so switching back to it makes nothing new
+	ID3D11SamplerState* sampler = GetSamplerState(samplerDesc);
+	if (sampler == nullptr)
+	{
+		gLastError = "Error creating anisotropic sampler";
+		return false;
+	}
+	gAnisotropicSampler = sampler;
+	return true;
 }
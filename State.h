@@ -4,6 +4,7 @@
 // - Blender state (Additive blending, alpha blending etc.)
 // - Rasterizer state (Wireframe mode, don't cull back faces etc.)
 // - Depth stencil state (How to use the depth and stencil buffer)
+// - Any other state, made from its description when first asked for and then shared
 //--------------------------------------------------------------------------------------
 #ifndef _STATE_H_INCLUDED_
 #define _STATE_H_INCLUDED_
@@ -20,20 +21,29 @@
 // GPU "States" //
 extern ID3D11SamplerState* gPointSampler;
 extern ID3D11SamplerState* gTrilinearSampler;
-extern ID3D11SamplerState* gAnisotropic4xSampler;
+extern ID3D11SamplerState* gAnisotropicSampler;
 extern ID3D11SamplerState* gBilinearMirrorSampler;
+extern ID3D11SamplerState* gShadowSampler;
 
 extern ID3D11BlendState* gNoBlendingState;
 extern ID3D11BlendState* gAdditiveBlendingState;
 extern ID3D11BlendState* gAlphaBlendingState;
+extern ID3D11BlendState* gPremultipliedAlphaBlendingState;
+extern ID3D11BlendState* gUnderwaterFogBlendingState;
 
 extern ID3D11RasterizerState*   gCullBackState;
+extern ID3D11RasterizerState*   gCullBackScissorState;
 extern ID3D11RasterizerState*   gCullFrontState;
+extern ID3D11RasterizerState*   gCullFrontScissorState;
 extern ID3D11RasterizerState*   gCullNoneState;
+extern ID3D11RasterizerState*   gCullNoneScissorState;
 extern ID3D11RasterizerState*   gWireframeState;
+extern ID3D11RasterizerState*   gShadowCasterState;
 
 extern ID3D11DepthStencilState* gUseDepthBufferState;
 extern ID3D11DepthStencilState* gDepthReadOnlyState;
+extern ID3D11DepthStencilState* gDepthEqualState;
+extern ID3D11DepthStencilState* gDepthFarPlaneState;
 extern ID3D11DepthStencilState* gNoDepthBufferState;
 
 
@@ -47,5 +57,27 @@ bool CreateStates();
 // Release DirectX state objects
 void ReleaseStates();
 
+// Create gAnisotropicSampler with the given number of samples (1 to 16, 1 is trilinear), replacing the one there is. Returns
+// false on failure
+bool CreateAnisotropicSampler(unsigned int maxAnisotropy);
+
+
+//--------------------------------------------------------------------------------------
+// State objects on demand
+//--------------------------------------------------------------------------------------
+// The states above are made with these, and anything else that needs a state of its own (a material, a quality setting)
+// can ask for one by its description instead of adding a global here. The same settings always give back the same object,
+// made the first time they are asked for and kept until ReleaseStates. So parts of the app asking for the same state share
+// one object, and the state cache, which tells states apart by their objects, sees them as the same (see StateCache.h)
+// The caller doesn't release the object. Can be used from any thread
+// Each returns nullptr with a message in gLastError on failure
+ID3D11SamplerState*      GetSamplerState     (const D3D11_SAMPLER_DESC&       desc);
+ID3D11BlendState*        GetBlendState       (const D3D11_BLEND_DESC&         desc);
+ID3D11RasterizerState*   GetRasterizerState  (const D3D11_RASTERIZER_DESC&    desc);
+ID3D11DepthStencilState* GetDepthStencilState(const D3D11_DEPTH_STENCIL_DESC& desc);
+
+// Number of distinct state objects made so far, of all kinds
+int NumStateObjects();
+
 
 #endif //_STATE_H_INCLUDED_
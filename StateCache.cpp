@@ -0,0 +1,658 @@
+//--------------------------------------------------------------------------------------
+// State cache
+// - Tracks the shaders, constant buffers, textures and samplers bound to each pipeline stage
+// - Tracks the blend, depth-stencil and rasterizer states and input assembler settings
+// - Selects pipeline states, the shaders and states of a kind of draw together, in one call
+// - Skips calls to DirectX that would set something that is already set
+// - Counts the calls made to DirectX of each kind, for the stats
+//--------------------------------------------------------------------------------------
+
+#include "StateCache.h"
+#include "Common.h"
+#include "GpuMemory.h"
+
+#include <d3d11_1.h>
+#include <cstring>
+
+
+//--------------------------------------------------------------------------------------
+// Cached state
+//--------------------------------------------------------------------------------------
+
+// Index of each stage in the arrays below, in the same order as the ShaderStages flags
+enum StageIndex { VS, HS, DS, GS, PS, NUM_STAGES };
+
+// A constant buffer bound to a slot, either all of it (numConstants 0) or part of the constant ring (see SetConstants)
+struct ConstantBinding
+{
+	ID3D11Buffer* buffer = nullptr;
+	UINT          firstConstant = 0; // In 16 byte constants
+	UINT          numConstants = 0;
+
+	bool operator==(const ConstantBinding& other) const
+	{
+		return buffer == other.buffer && firstConstant == other.firstConstant && numConstants == other.numConstants;
+	}
+};
+
+// What the cache knows about a single pipeline stage. "Known" flags are cleared by ResetStateCache, when the cache
+// can't be sure what is bound
+struct StageState
+{
+	IUnknown*     shader = nullptr; // Currently bound shader for this stage
+	bool          shaderKnown = false;
+
+	ConstantBinding boundBuffers[NUM_CACHED_CONSTANT_BUFFERS]    = {}; // What is bound in DirectX
+	bool            boundBuffersKnown[NUM_CACHED_CONSTANT_BUFFERS] = {};
+	ConstantBinding wantedBuffers[NUM_CACHED_CONSTANT_BUFFERS]   = {}; // What the app has asked for with SetConstantBuffer
+
+	ID3D11ShaderResourceView* resources[NUM_CACHED_SHADER_RESOURCES]      = {};
+	bool                      resourcesKnown[NUM_CACHED_SHADER_RESOURCES] = {};
+	ID3D11SamplerState*       samplers[NUM_CACHED_SAMPLERS]      = {};
+	bool                      samplersKnown[NUM_CACHED_SAMPLERS] = {};
+};
+
+// Each thread has its own cache, as it has its own context (see gD3DContext in Common.h)
+static thread_local StageState gStages[NUM_STAGES];
+
+// States that aren't per-stage. The "known" flags work in the same way as above
+static thread_local ID3D11BlendState*        gBlendState        = nullptr;  static thread_local bool gBlendStateKnown        = false;
+static thread_local ID3D11DepthStencilState* gDepthStencilState = nullptr;  static thread_local bool gDepthStencilStateKnown = false;
+static thread_local ID3D11RasterizerState*   gRasterizerState   = nullptr;  static thread_local bool gRasterizerStateKnown   = false;
+static thread_local ID3D11InputLayout*       gInputLayout       = nullptr;  static thread_local bool gInputLayoutKnown       = false;
+static thread_local D3D11_PRIMITIVE_TOPOLOGY gTopology = D3D11_PRIMITIVE_TOPOLOGY_UNDEFINED;  static thread_local bool gTopologyKnown = false;
+static thread_local ID3D11Buffer* gVertexBuffer = nullptr;  static thread_local unsigned int gVertexStride = 0;  static thread_local bool gVertexBufferKnown = false;
+static thread_local ID3D11Buffer* gIndexBuffer  = nullptr;  static thread_local DXGI_FORMAT  gIndexFormat  = DXGI_FORMAT_UNKNOWN;  static thread_local bool gIndexBufferKnown = false;
+
+// The pipeline state selected by SetPipelineState, until one of its parts is changed separately
+static thread_local const PipelineState* gPipelineState = nullptr;
+
+static thread_local StateCacheStats gStats;
+
+// The pixel shader asked for with SetPixelShader, and the shader and UAV drawn with in its place (see SetPixelShaderOverride)
+static thread_local ID3D11PixelShader*         gWantedPixelShader   = nullptr;
+static thread_local ID3D11PixelShader*         gPixelShaderOverride = nullptr;
+static thread_local ID3D11UnorderedAccessView* gOverrideUAV         = nullptr;
+
+
+// The constant ring is shared by all threads. Each context writes it from the start after a discard, which gives that context
+// its own copy of the buffer, so the position written up to is kept per thread along with the context it is for
+static ID3D11Buffer*  gConstantRing = nullptr; // nullptr if the GPU can't bind part of a constant buffer
+static bool           gConstantRingEnabled = true;
+static const unsigned int ConstantRingSize = 1024 * 1024; // Bytes, room for 4096 sets of constants before it wraps round
+static const unsigned int ConstantRingAlignment = 256;    // Offsets and sizes bound must be multiples of 16 constants
+
+struct ConstantRingPosition
+{
+	ID3D11DeviceContext*  context  = nullptr;
+	ID3D11DeviceContext1* context1 = nullptr; // The same context with the DirectX 11.1 functions for binding part of a buffer
+	unsigned int          offset   = ConstantRingSize; // Where the next constants go, the ring size to discard first
+};
+static thread_local ConstantRingPosition gConstantRingPosition;
+
+
+//--------------------------------------------------------------------------------------
+// Helper functions
+//--------------------------------------------------------------------------------------
+
+// Whether a stage is in use, i.e. has a shader. If the cache doesn't know then assume it is
+static bool StageActive(int stage)
+{
+	return !gStages[stage].shaderKnown || gStages[stage].shader != nullptr;
+}
+
+
+// Record a new value for a cached setting. Returns true if the value needs to be sent to DirectX, and counts the call either way,
+// in the given count of its kind if it is sent
+template <class T>
+static bool StateChanged(T& cached, bool& known, T value, unsigned int& kindCount)
+{
+	if (known && cached == value)
+	{
+		++gStats.filtered;
+		return false;
+	}
+	cached = value;
+	known = true;
+	++gStats.issued;
+	++kindCount;
+	return true;
+}
+
+
+// The constant ring position for this thread's current context. A context it hasn't written to yet, or a new command list
+// (see ResetStateCache), starts again with a discard
+static ConstantRingPosition& RingPosition()
+{
+	ConstantRingPosition& position = gConstantRingPosition;
+	if (position.context != gD3DContext)
+	{
+		position.context  = gD3DContext;
+		position.context1 = nullptr;
+		position.offset   = ConstantRingSize;
+		if (SUCCEEDED(gD3DContext->QueryInterface(__uuidof(ID3D11DeviceContext1), reinterpret_cast<void**>(&position.context1))))
+		{
+			position.context1->Release(); // The context is kept alive by its owner, only the pointer is needed
+		}
+	}
+	return position;
+}
+
+
+// Bind a constant buffer to a single stage if it is not already bound there
+static void BindConstantBuffer(int stage, unsigned int slot, const ConstantBinding& binding)
+{
+	StageState& state = gStages[stage];
+	if (!StateChanged(state.boundBuffers[slot], state.boundBuffersKnown[slot], binding, gStats.constantBufferCalls))  return;
+
+	ID3D11Buffer* buffer = binding.buffer;
+	if (binding.numConstants == 0)
+	{
+		switch (stage)
+		{
+			case VS: gD3DContext->VSSetConstantBuffers(slot, 1, &buffer); break;
+			case HS: gD3DContext->HSSetConstantBuffers(slot, 1, &buffer); break;
+			case DS: gD3DContext->DSSetConstantBuffers(slot, 1, &buffer); break;
+			case GS: gD3DContext->GSSetConstantBuffers(slot, 1, &buffer); break;
+			case PS: gD3DContext->PSSetConstantBuffers(slot, 1, &buffer); break;
+		}
+	}
+	else
+	{
+		// Part of the constant ring, only bound by SetConstants when the context has the DirectX 11.1 functions
+		ID3D11DeviceContext1* context1 = RingPosition().context1;
+		switch (stage)
+		{
+			case VS: context1->VSSetConstantBuffers1(slot, 1, &buffer, &binding.firstConstant, &binding.numConstants); break;
+			case HS: context1->HSSetConstantBuffers1(slot, 1, &buffer, &binding.firstConstant, &binding.numConstants); break;
+			case DS: context1->DSSetConstantBuffers1(slot, 1, &buffer, &binding.firstConstant, &binding.numConstants); break;
+			case GS: context1->GSSetConstantBuffers1(slot, 1, &buffer, &binding.firstConstant, &binding.numConstants); break;
+			case PS: context1->PSSetConstantBuffers1(slot, 1, &buffer, &binding.firstConstant, &binding.numConstants); break;
+		}
+	}
+}
+
+
+// Bind the constant buffers that have been asked for but not yet bound to a stage. Called when the stage gets a shader
+static void BindWantedConstantBuffers(int stage)
+{
+	for (unsigned int slot = 0; slot < NUM_CACHED_CONSTANT_BUFFERS; ++slot)
+	{
+		if (gStages[stage].wantedBuffers[slot].buffer != nullptr)  BindConstantBuffer(stage, slot, gStages[stage].wantedBuffers[slot]);
+	}
+}
+
+
+// Record a new shader for a stage. Returns true if the shader needs to be sent to DirectX
+static bool ShaderChanged(int stage, IUnknown* shader)
+{
+	if (!StateChanged(gStages[stage].shader, gStages[stage].shaderKnown, shader, gStats.shaderCalls))  return false;
+	gPipelineState = nullptr; // No longer matches what is bound
+	return true;
+}
+
+// The same for the states that are part of a pipeline state
+template <class T>
+static bool PipelinePartChanged(T& cached, bool& known, T value, unsigned int& kindCount)
+{
+	if (!StateChanged(cached, known, value, kindCount))  return false;
+	gPipelineState = nullptr;
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Shaders
+//--------------------------------------------------------------------------------------
+
+// Select the shader for each stage, pass nullptr to switch a stage off
+void SetVertexShader(ID3D11VertexShader* shader)
+{
+	if (ShaderChanged(VS, shader))  gD3DContext->VSSetShader(shader, nullptr, 0);
+	if (shader != nullptr)  BindWantedConstantBuffers(VS);
+}
+
+void SetHullShader(ID3D11HullShader* shader)
+{
+	if (ShaderChanged(HS, shader))  gD3DContext->HSSetShader(shader, nullptr, 0);
+	if (shader != nullptr)  BindWantedConstantBuffers(HS);
+}
+
+void SetDomainShader(ID3D11DomainShader* shader)
+{
+	if (ShaderChanged(DS, shader))  gD3DContext->DSSetShader(shader, nullptr, 0);
+	if (shader != nullptr)  BindWantedConstantBuffers(DS);
+}
+
+void SetGeometryShader(ID3D11GeometryShader* shader)
+{
+	if (ShaderChanged(GS, shader))  gD3DContext->GSSetShader(shader, nullptr, 0);
+	if (shader != nullptr)  BindWantedConstantBuffers(GS);
+}
+
+void SetPixelShader(ID3D11PixelShader* shader)
+{
+	gWantedPixelShader = shader;
+	if (gPixelShaderOverride != nullptr && shader != nullptr)  shader = gPixelShaderOverride;
+	if (ShaderChanged(PS, shader))  gD3DContext->PSSetShader(shader, nullptr, 0);
+	if (shader != nullptr)  BindWantedConstantBuffers(PS);
+}
+
+
+// Draw with the given pixel shader in place of every pixel shader selected, with the given UAV bound alongside the render
+// targets. The targets bound now are read back and bound again with or without the UAV, and the wanted shader selected again
+void SetPixelShaderOverride(ID3D11PixelShader* shader, ID3D11UnorderedAccessView* uav)
+{
+	bool hadUAV = gOverrideUAV != nullptr;
+	gPixelShaderOverride = shader;
+	gOverrideUAV = uav;
+
+	ID3D11RenderTargetView* renderTargets[PixelShaderOverrideUAVSlot] = {};
+	ID3D11DepthStencilView* depthStencil = nullptr;
+	gD3DContext->OMGetRenderTargets(PixelShaderOverrideUAVSlot, renderTargets, &depthStencil);
+	unsigned int numTargets = 0;
+	for (unsigned int i = 0; i < PixelShaderOverrideUAVSlot; ++i)  if (renderTargets[i] != nullptr)  numTargets = i + 1;
+	if (uav != nullptr || hadUAV)
+	{
+		++gStats.targetCalls;
+		gD3DContext->OMSetRenderTargetsAndUnorderedAccessViews(numTargets, renderTargets, depthStencil, PixelShaderOverrideUAVSlot, 1, &uav, nullptr);
+	}
+	for (auto renderTarget : renderTargets)  if (renderTarget != nullptr)  renderTarget->Release();
+	if (depthStencil != nullptr)  depthStencil->Release();
+
+	gStages[PS].shaderKnown = false;
+	SetPixelShader(gWantedPixelShader);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Constant buffers
+//--------------------------------------------------------------------------------------
+
+// Use the given binding in the given slot for the chosen stages, see SetConstantBuffer
+static void SetConstantBinding(unsigned int slot, const ConstantBinding& binding, unsigned int stages)
+{
+	for (int stage = 0; stage < NUM_STAGES; ++stage)
+	{
+		if ((stages & (1 << stage)) == 0)  continue;
+
+		gStages[stage].wantedBuffers[slot] = binding;
+		if (StageActive(stage))  BindConstantBuffer(stage, slot, binding);
+		else                     ++gStats.filtered; // Will be bound later if the stage is used
+	}
+}
+
+// Use the given constant buffer in the given slot for the chosen stages. It is bound immediately to stages that have a
+// shader, and to the others when they are given a shader. Does nothing if the buffer is already bound
+void SetConstantBuffer(unsigned int slot, ID3D11Buffer* buffer, unsigned int stages /*= AllShaderStages*/)
+{
+	ConstantBinding binding;
+	binding.buffer = buffer;
+	SetConstantBinding(slot, binding, stages);
+}
+
+
+// Send constants to the GPU and use them in the given slot for the chosen stages, see the template version in StateCache.h
+void SetConstantData(unsigned int slot, ID3D11Buffer* buffer, const void* data, unsigned int size, unsigned int stages)
+{
+	gStats.constantBytes += size;
+	ConstantBinding binding;
+	ConstantRingPosition& position = RingPosition();
+	if (gConstantRing != nullptr && gConstantRingEnabled && position.context1 != nullptr)
+	{
+		// Write after the constants already written, which the GPU may still be reading, so no discard is needed. When the ring
+		// is full start again from its beginning with a discard, the driver keeps the old contents until the GPU is done
+		unsigned int alignedSize = (size + ConstantRingAlignment - 1) & ~(ConstantRingAlignment - 1);
+		D3D11_MAP mapType = D3D11_MAP_WRITE_NO_OVERWRITE;
+		if (position.offset + alignedSize > ConstantRingSize)
+		{
+			position.offset = 0;
+			mapType = D3D11_MAP_WRITE_DISCARD;
+		}
+		D3D11_MAPPED_SUBRESOURCE mapped;
+		if (SUCCEEDED(gD3DContext->Map(gConstantRing, 0, mapType, 0, &mapped)))
+		{
+			CountMap(size);
+			memcpy(static_cast<char*>(mapped.pData) + position.offset, data, size);
+			gD3DContext->Unmap(gConstantRing, 0);
+			binding.buffer        = gConstantRing;
+			binding.firstConstant = position.offset / 16;
+			binding.numConstants  = alignedSize / 16;
+			position.offset += alignedSize;
+			SetConstantBinding(slot, binding, stages);
+			return;
+		}
+	}
+
+	// No constant ring, update the given buffer. Its binding doesn't change so the cache usually filters it out
+	D3D11_MAPPED_SUBRESOURCE mapped;
+	if (FAILED(gD3DContext->Map(buffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped)))  return;
+	CountMap(size);
+	memcpy(mapped.pData, data, size);
+	gD3DContext->Unmap(buffer, 0);
+	binding.buffer = buffer;
+	SetConstantBinding(slot, binding, stages);
+}
+
+
+// Create the constant ring used by SetConstants. Returns false if the GPU or driver can't bind part of a constant buffer or
+// write to one without a discard (DirectX 11.1 features), SetConstants then uses the buffers passed to it. Not an error
+bool InitConstantRing()
+{
+	D3D11_FEATURE_DATA_D3D11_OPTIONS options = {};
+	if (FAILED(gD3DDevice->CheckFeatureSupport(D3D11_FEATURE_D3D11_OPTIONS, &options, sizeof(options))) ||
+		!options.ConstantBufferOffsetting || !options.MapNoOverwriteOnDynamicConstantBuffer)
+	{
+		return false;
+	}
+
+	D3D11_BUFFER_DESC bufferDesc = {};
+	bufferDesc.ByteWidth      = ConstantRingSize;
+	bufferDesc.Usage          = D3D11_USAGE_DYNAMIC;
+	bufferDesc.BindFlags      = D3D11_BIND_CONSTANT_BUFFER;
+	bufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+	if (FAILED(gD3DDevice->CreateBuffer(&bufferDesc, nullptr, &gConstantRing)))  return false;
+	RegisterGpuResource(gConstantRing, "Constant Buffers");
+	return true;
+}
+
+void ReleaseConstantRing()
+{
+	if (gConstantRing)  gConstantRing->Release();
+	gConstantRing = nullptr;
+}
+
+
+// Whether the constant ring was created, and switch between it and the buffers passed to SetConstants to compare them
+bool ConstantRingSupported()  { return gConstantRing != nullptr; }
+bool ConstantRingEnabled()    { return gConstantRing != nullptr && gConstantRingEnabled; }
+void SetConstantRingEnabled(bool enabled)  { gConstantRingEnabled = enabled; }
+
+
+//--------------------------------------------------------------------------------------
+// Textures and samplers
+//--------------------------------------------------------------------------------------
+
+// Use the given texture (shader resource view) / sampler in the given slot for the chosen stages. Pass nullptr to unbind
+void SetShaderResource(unsigned int slot, ID3D11ShaderResourceView* resource, unsigned int stages /*= PixelShaderStage*/)
+{
+	for (int stage = 0; stage < NUM_STAGES; ++stage)
+	{
+		if ((stages & (1 << stage)) == 0)  continue;
+		if (slot < NUM_CACHED_SHADER_RESOURCES &&
+		    !StateChanged(gStages[stage].resources[slot], gStages[stage].resourcesKnown[slot], resource, gStats.resourceCalls))  continue;
+		if (slot >= NUM_CACHED_SHADER_RESOURCES)  ++gStats.resourceCalls;
+
+		switch (stage)
+		{
+			case VS: gD3DContext->VSSetShaderResources(slot, 1, &resource); break;
+			case HS: gD3DContext->HSSetShaderResources(slot, 1, &resource); break;
+			case DS: gD3DContext->DSSetShaderResources(slot, 1, &resource); break;
+			case GS: gD3DContext->GSSetShaderResources(slot, 1, &resource); break;
+			case PS: gD3DContext->PSSetShaderResources(slot, 1, &resource); break;
+		}
+	}
+}
+
+void SetSampler(unsigned int slot, ID3D11SamplerState* sampler, unsigned int stages /*= PixelShaderStage*/)
+{
+	for (int stage = 0; stage < NUM_STAGES; ++stage)
+	{
+		if ((stages & (1 << stage)) == 0)  continue;
+		if (slot < NUM_CACHED_SAMPLERS &&
+		    !StateChanged(gStages[stage].samplers[slot], gStages[stage].samplersKnown[slot], sampler, gStats.samplerCalls))  continue;
+		if (slot >= NUM_CACHED_SAMPLERS)  ++gStats.samplerCalls;
+
+		switch (stage)
+		{
+			case VS: gD3DContext->VSSetSamplers(slot, 1, &sampler); break;
+			case HS: gD3DContext->HSSetSamplers(slot, 1, &sampler); break;
+			case DS: gD3DContext->DSSetSamplers(slot, 1, &sampler); break;
+			case GS: gD3DContext->GSSetSamplers(slot, 1, &sampler); break;
+			case PS: gD3DContext->PSSetSamplers(slot, 1, &sampler); break;
+		}
+	}
+}
+
+
+//--------------------------------------------------------------------------------------
+// Fixed function states
+//--------------------------------------------------------------------------------------
+
+// States from State.cpp. Blend factor / sample mask and stencil reference are not supported as the app doesn't use them
+void SetBlendState(ID3D11BlendState* state)
+{
+	if (PipelinePartChanged(gBlendState, gBlendStateKnown, state, gStats.stateCalls))  gD3DContext->OMSetBlendState(state, nullptr, 0xffffff);
+}
+
+void SetDepthStencilState(ID3D11DepthStencilState* state)
+{
+	if (PipelinePartChanged(gDepthStencilState, gDepthStencilStateKnown, state, gStats.stateCalls))  gD3DContext->OMSetDepthStencilState(state, 0);
+}
+
+void SetRasterizerState(ID3D11RasterizerState* state)
+{
+	if (PipelinePartChanged(gRasterizerState, gRasterizerStateKnown, state, gStats.stateCalls))  gD3DContext->RSSetState(state);
+}
+
+
+// Input assembler settings that are usually the same from one draw to the next (see Mesh::RenderSubMesh)
+void SetInputLayout(ID3D11InputLayout* layout)
+{
+	if (StateChanged(gInputLayout, gInputLayoutKnown, layout, gStats.inputCalls))  gD3DContext->IASetInputLayout(layout);
+}
+
+void SetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY topology)
+{
+	if (PipelinePartChanged(gTopology, gTopologyKnown, topology, gStats.inputCalls))  gD3DContext->IASetPrimitiveTopology(topology);
+}
+
+
+// Vertex buffer in slot 0 and index buffer. Both the buffer and its stride / format must match for a call to be skipped
+void SetVertexBuffer(ID3D11Buffer* buffer, unsigned int stride)
+{
+	if (gVertexBufferKnown && gVertexBuffer == buffer && gVertexStride == stride)
+	{
+		++gStats.filtered;
+		return;
+	}
+	gVertexBuffer = buffer;
+	gVertexStride = stride;
+	gVertexBufferKnown = true;
+	++gStats.issued;
+	++gStats.inputCalls;
+
+	UINT offset = 0;
+	gD3DContext->IASetVertexBuffers(0, 1, &buffer, &stride, &offset);
+}
+
+void SetIndexBuffer(ID3D11Buffer* buffer, DXGI_FORMAT format)
+{
+	if (gIndexBufferKnown && gIndexBuffer == buffer && gIndexFormat == format)
+	{
+		++gStats.filtered;
+		return;
+	}
+	gIndexBuffer = buffer;
+	gIndexFormat = format;
+	gIndexBufferKnown = true;
+	++gStats.issued;
+	++gStats.inputCalls;
+	gD3DContext->IASetIndexBuffer(buffer, format, 0);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Pipeline states
+//--------------------------------------------------------------------------------------
+
+// Select everything in a pipeline state, each part through the cache above. Skipped if the state is already selected
+void SetPipelineState(const PipelineState& state)
+{
+	if (gPipelineState == &state)
+	{
+		++gStats.filtered;
+		return;
+	}
+	SetVertexShader  (state.vertexShader   != nullptr ? *state.vertexShader   : nullptr);
+	SetHullShader    (state.hullShader     != nullptr ? *state.hullShader     : nullptr);
+	SetDomainShader  (state.domainShader   != nullptr ? *state.domainShader   : nullptr);
+	SetGeometryShader(state.geometryShader != nullptr ? *state.geometryShader : nullptr);
+	SetPixelShader   (state.pixelShader    != nullptr ? *state.pixelShader    : nullptr);
+	SetBlendState(state.blendState);
+	SetDepthStencilState(state.depthStencilState);
+	SetRasterizerState(state.rasterizerState);
+	SetPrimitiveTopology(state.topology);
+	gPipelineState = &state;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Pass setup
+//--------------------------------------------------------------------------------------
+
+// Render targets, viewport and scissor rectangle, and clears. Always passed on to DirectX, only counted. The UAV of a pixel
+// shader override is bound with the render targets
+void SetRenderTargets(unsigned int numTargets, ID3D11RenderTargetView* const* renderTargets, ID3D11DepthStencilView* depthStencil)
+{
+	++gStats.targetCalls;
+	if (gOverrideUAV != nullptr)
+	{
+		gD3DContext->OMSetRenderTargetsAndUnorderedAccessViews(numTargets, renderTargets, depthStencil, PixelShaderOverrideUAVSlot, 1, &gOverrideUAV, nullptr);
+	}
+	else
+	{
+		gD3DContext->OMSetRenderTargets(numTargets, renderTargets, depthStencil);
+	}
+}
+
+void SetViewport(const D3D11_VIEWPORT& viewport)
+{
+	++gStats.targetCalls;
+	gD3DContext->RSSetViewports(1, &viewport);
+}
+
+void SetScissorRect(const D3D11_RECT& rect)
+{
+	++gStats.targetCalls;
+	gD3DContext->RSSetScissorRects(1, &rect);
+}
+
+void SetViewports(unsigned int numViewports, const D3D11_VIEWPORT* viewports)
+{
+	++gStats.targetCalls;
+	gD3DContext->RSSetViewports(numViewports, viewports);
+}
+
+void SetScissorRects(unsigned int numRects, const D3D11_RECT* rects)
+{
+	++gStats.targetCalls;
+	gD3DContext->RSSetScissorRects(numRects, rects);
+}
+
+void ClearRenderTarget(ID3D11RenderTargetView* renderTarget, const float colour[4])
+{
+	++gStats.targetCalls;
+	gD3DContext->ClearRenderTargetView(renderTarget, colour);
+}
+
+// Clears the depth to 0, the far depth (depths are reversed, see Camera::UpdateMatrices)
+void ClearDepth(ID3D11DepthStencilView* depthStencil)
+{
+	++gStats.targetCalls;
+	gD3DContext->ClearDepthStencilView(depthStencil, D3D11_CLEAR_DEPTH, 0.0f, 0);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Cache control / statistics
+//--------------------------------------------------------------------------------------
+
+// Forget everything the cache knows, so the next call of each kind always goes to DirectX. Call this if any code
+// changes the state without using these functions. The constant buffers asked for are kept, except parts of the constant
+// ring - this is called when a new command list is started, which can't use constants written to the ring for another
+void ResetStateCache()
+{
+	gConstantRingPosition.context = nullptr; // The next constants written start with a discard
+	for (auto& state : gStages)
+	{
+		state.shaderKnown = false;
+		for (auto& known : state.boundBuffersKnown)  known = false;
+		for (auto& wanted : state.wantedBuffers)     if (wanted.numConstants != 0)  wanted = ConstantBinding();
+		for (auto& known : state.resourcesKnown)     known = false;
+		for (auto& known : state.samplersKnown)      known = false;
+	}
+	gBlendStateKnown = gDepthStencilStateKnown = gRasterizerStateKnown = false;
+	gInputLayoutKnown = gTopologyKnown = false;
+	gVertexBufferKnown = gIndexBufferKnown = false;
+	gPipelineState = nullptr;
+}
+
+
+// Get the stats since the last call to ResetStateCacheStats. Use once per frame to see the effect of the cache
+StateCacheStats GetStateCacheStats()
+{
+	return gStats;
+}
+
+void ResetStateCacheStats()
+{
+	gStats = StateCacheStats();
+}
+
+// Add stats gathered on another thread to this thread's stats, e.g. from passes recorded on worker threads
+void AddStateCacheStats(const StateCacheStats& stats)
+{
+	gStats += stats;
+}
+
+// Count a draw call in the stats
+void CountDrawCall()
+{
+	++gStats.draws;
+}
+
+// Count a buffer written by the CPU in the stats
+void CountMap(unsigned int bytes)
+{
+	++gStats.maps;
+	gStats.mappedBytes += bytes;
+}
+
+
+StateCacheStats& StateCacheStats::operator+=(const StateCacheStats& other)
+{
+	issued   += other.issued;
+	filtered += other.filtered;
+	draws    += other.draws;
+	constantBytes += other.constantBytes;
+	shaderCalls         += other.shaderCalls;
+	constantBufferCalls += other.constantBufferCalls;
+	resourceCalls       += other.resourceCalls;
+	samplerCalls        += other.samplerCalls;
+	stateCalls          += other.stateCalls;
+	inputCalls          += other.inputCalls;
+	targetCalls         += other.targetCalls;
+	maps                += other.maps;
+	mappedBytes         += other.mappedBytes;
+	return *this;
+}
+
+StateCacheStats StateCacheStats::operator-(const StateCacheStats& other) const
+{
+	StateCacheStats result;
+	result.issued   = issued   - other.issued;
+	result.filtered = filtered - other.filtered;
+	result.draws    = draws    - other.draws;
+	result.constantBytes = constantBytes - other.constantBytes;
+	result.shaderCalls         = shaderCalls         - other.shaderCalls;
+	result.constantBufferCalls = constantBufferCalls - other.constantBufferCalls;
+	result.resourceCalls       = resourceCalls       - other.resourceCalls;
+	result.samplerCalls        = samplerCalls        - other.samplerCalls;
+	result.stateCalls          = stateCalls          - other.stateCalls;
+	result.inputCalls          = inputCalls          - other.inputCalls;
+	result.targetCalls         = targetCalls         - other.targetCalls;
+	result.maps                = maps                - other.maps;
+	result.mappedBytes         = mappedBytes         - other.mappedBytes;
+	return result;
+}
@@ -0,0 +1,211 @@
+//--------------------------------------------------------------------------------------
+// State cache
+// - Tracks the shaders, constant buffers, textures and samplers bound to each pipeline stage
+// - Tracks the blend, depth-stencil and rasterizer states and input assembler settings
+// - Selects pipeline states, the shaders and states of a kind of draw together, in one call
+// - Skips calls to DirectX that would set something that is already set
+// - Counts the calls made to DirectX of each kind, for the stats
+//--------------------------------------------------------------------------------------
+// Use these functions instead of calling gD3DContext->VSSetShader, VSSetConstantBuffers,
+// OMSetBlendState etc. directly. Constant buffers are only bound to the stages that have a
+// shader, so the hull, domain and geometry stages cost nothing when they are not in use.
+// Setting a shader on a stage binds any constant buffers it is missing.
+// Render targets, viewports and clears aren't cached, but go through here so they are counted.
+#ifndef _STATE_CACHE_H_INCLUDED_
+#define _STATE_CACHE_H_INCLUDED_
+
+#include <d3d11.h>
+
+
+//--------------------------------------------------------------------------------------
+// Shader stages
+//--------------------------------------------------------------------------------------
+
+// Flags to choose which stages a constant buffer is used in, combine with |
+// The compute shader is not part of the rendering pipeline so not tracked here
+enum ShaderStages : unsigned int
+{
+	VertexShaderStage   = 1 << 0,
+	HullShaderStage     = 1 << 1,
+	DomainShaderStage   = 1 << 2,
+	GeometryShaderStage = 1 << 3,
+	PixelShaderStage    = 1 << 4,
+	AllShaderStages     = (1 << 5) - 1,
+};
+
+// Number of slots tracked for each stage. Slots above these bypass the cache
+const unsigned int NUM_CACHED_CONSTANT_BUFFERS  = 6;  // b0 to b5
+const unsigned int NUM_CACHED_SAMPLERS          = 4;  // s0 to s3
+const unsigned int NUM_CACHED_SHADER_RESOURCES  = 22; // t0 to t21
+
+
+//--------------------------------------------------------------------------------------
+// Shaders
+//--------------------------------------------------------------------------------------
+
+// Select the shader for each stage, pass nullptr to switch a stage off
+void SetVertexShader  (ID3D11VertexShader*   shader);
+void SetHullShader    (ID3D11HullShader*     shader);
+void SetDomainShader  (ID3D11DomainShader*   shader);
+void SetGeometryShader(ID3D11GeometryShader* shader);
+void SetPixelShader   (ID3D11PixelShader*    shader);
+
+// Draw with the given pixel shader in place of every pixel shader selected, with the given UAV bound in slot u7 alongside
+// the render targets, until called again with nullptrs. For debug views that count the pixels shaded (see OverdrawView.h).
+// The shader and targets bound now are swapped straight away, and stages switched off stay off. Per thread, like the cache
+const unsigned int PixelShaderOverrideUAVSlot = 7; // Must be after the last render target used
+void SetPixelShaderOverride(ID3D11PixelShader* shader, ID3D11UnorderedAccessView* uav);
+
+
+//--------------------------------------------------------------------------------------
+// Constant buffers
+//--------------------------------------------------------------------------------------
+
+// Use the given constant buffer in the given slot for the chosen stages. It is bound immediately to stages that have a
+// shader, and to the others when they are given a shader. Does nothing if the buffer is already bound
+void SetConstantBuffer(unsigned int slot, ID3D11Buffer* buffer, unsigned int stages = AllShaderStages);
+
+
+// Send constants to the GPU and use them in the given slot for the chosen stages, in place of UpdateConstantBuffer followed
+// by SetConstantBuffer. The constants are written to the next free part of one large buffer, the constant ring, and just
+// that part is bound, so each draw's constants don't need a buffer discard (which the driver must give new memory for).
+// If the GPU can't do that (it needs DirectX 11.1) the given buffer is updated and bound instead. Only valid until the next
+// ResetStateCache, so set constants again at the start of each pass
+void SetConstantData(unsigned int slot, ID3D11Buffer* buffer, const void* data, unsigned int size, unsigned int stages);
+
+template <class T>
+void SetConstants(unsigned int slot, ID3D11Buffer* buffer, const T& constants, unsigned int stages = AllShaderStages)
+{
+	SetConstantData(slot, buffer, &constants, sizeof(T), stages);
+}
+
+
+// Create / release the constant ring used by SetConstants. InitConstantRing returns false if the GPU can't use it, which
+// isn't an error - SetConstants uses the buffers passed to it instead
+bool InitConstantRing();
+void ReleaseConstantRing();
+
+// Whether the constant ring exists, and switch between it and the buffers passed to SetConstants to compare them
+bool ConstantRingSupported();
+bool ConstantRingEnabled();
+void SetConstantRingEnabled(bool enabled);
+
+
+//--------------------------------------------------------------------------------------
+// Textures and samplers
+//--------------------------------------------------------------------------------------
+
+// Use the given texture (shader resource view) / sampler in the given slot for the chosen stages. Pass nullptr to unbind
+void SetShaderResource(unsigned int slot, ID3D11ShaderResourceView* resource, unsigned int stages = PixelShaderStage);
+void SetSampler       (unsigned int slot, ID3D11SamplerState*       sampler,  unsigned int stages = PixelShaderStage);
+
+
+//--------------------------------------------------------------------------------------
+// Fixed function states
+//--------------------------------------------------------------------------------------
+
+// States from State.cpp. Blend factor / sample mask and stencil reference are not supported as the app doesn't use them
+void SetBlendState       (ID3D11BlendState*        state);
+void SetDepthStencilState(ID3D11DepthStencilState* state);
+void SetRasterizerState  (ID3D11RasterizerState*   state);
+
+// Input assembler settings that are usually the same from one draw to the next (see Mesh::RenderSubMesh)
+void SetInputLayout      (ID3D11InputLayout* layout);
+void SetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY topology);
+
+// Vertex buffer in slot 0 (always with no offset, draws say where to start) and index buffer. Meshes keep all their
+// sub-meshes in one buffer of each, so these only change when moving to a different mesh
+void SetVertexBuffer(ID3D11Buffer* buffer, unsigned int stride);
+void SetIndexBuffer (ID3D11Buffer* buffer, DXGI_FORMAT format);
+
+
+//--------------------------------------------------------------------------------------
+// Pipeline states
+//--------------------------------------------------------------------------------------
+
+// The shaders, fixed function states and topology of a kind of draw, selected together with SetPipelineState. Made once the
+// shaders and states exist and not changed after. The shaders are the addresses of the app's shader variables, as in
+// Material, so shaders swapped in by hot reloading are used straight away. A null address switches the stage off. The input
+// layout isn't included, meshes select their own for their vertex format (see Mesh::RenderSubMesh)
+struct PipelineState
+{
+	ID3D11VertexShader*   const* vertexShader   = nullptr;
+	ID3D11HullShader*     const* hullShader     = nullptr;
+	ID3D11DomainShader*   const* domainShader   = nullptr;
+	ID3D11GeometryShader* const* geometryShader = nullptr;
+	ID3D11PixelShader*    const* pixelShader    = nullptr;
+	ID3D11BlendState*        blendState        = nullptr;
+	ID3D11DepthStencilState* depthStencilState = nullptr;
+	ID3D11RasterizerState*   rasterizerState   = nullptr;
+	D3D11_PRIMITIVE_TOPOLOGY topology = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+};
+
+// Select everything in a pipeline state. Only the parts that differ from what is bound are sent to DirectX, and selecting the
+// pipeline state already selected is skipped altogether - changing any of its parts separately in between deselects it
+void SetPipelineState(const PipelineState& state);
+
+
+//--------------------------------------------------------------------------------------
+// Pass setup
+//--------------------------------------------------------------------------------------
+
+// Render targets, viewport and scissor rectangle, and clears. Always passed on to DirectX (setting render targets can
+// unbind textures, so skipping them isn't safe), only counted
+void SetRenderTargets(unsigned int numTargets, ID3D11RenderTargetView* const* renderTargets, ID3D11DepthStencilView* depthStencil);
+void SetViewport     (const D3D11_VIEWPORT& viewport);
+void SetScissorRect  (const D3D11_RECT& rect);
+
+// Several viewports and scissor rectangles, for a geometry shader that picks between them (SV_ViewportArrayIndex)
+void SetViewports    (unsigned int numViewports, const D3D11_VIEWPORT* viewports);
+void SetScissorRects (unsigned int numRects, const D3D11_RECT* rects);
+void ClearRenderTarget(ID3D11RenderTargetView* renderTarget, const float colour[4]);
+void ClearDepth       (ID3D11DepthStencilView* depthStencil);
+
+
+//--------------------------------------------------------------------------------------
+// Cache control / statistics
+//--------------------------------------------------------------------------------------
+
+// Forget everything the cache knows, so the next call of each kind always goes to DirectX. Call this if any code
+// changes the state without using these functions
+void ResetStateCache();
+
+
+// Number of calls passed on to DirectX and number skipped because they wouldn't change anything, with the calls passed on
+// split by kind. Also the draw calls counted with CountDrawCall, the buffers written with CountMap (including by SetConstants)
+// and the bytes of constants sent with SetConstants
+struct StateCacheStats
+{
+	unsigned int issued   = 0; // Shader, constant buffer, texture, sampler, state and input calls
+	unsigned int filtered = 0;
+	unsigned int draws    = 0;
+	unsigned int constantBytes = 0;
+
+	unsigned int shaderCalls         = 0;
+	unsigned int constantBufferCalls = 0;
+	unsigned int resourceCalls       = 0; // Textures and other shader resources
+	unsigned int samplerCalls        = 0;
+	unsigned int stateCalls          = 0; // Blend, depth-stencil and rasterizer states
+	unsigned int inputCalls          = 0; // Input layout, topology, vertex and index buffers
+	unsigned int targetCalls         = 0; // Render targets, viewports, scissor rectangles and clears (see Pass setup above)
+	unsigned int maps                = 0;
+	unsigned int mappedBytes         = 0;
+
+	StateCacheStats& operator+=(const StateCacheStats& other);
+	StateCacheStats  operator-(const StateCacheStats& other) const; // e.g. the stats of a pass, from before and after it
+};
+
+// Count a draw call in the stats, call alongside each Draw... call to DirectX
+void CountDrawCall();
+
+// Count a buffer written by the CPU (Map / Unmap) in the stats, call alongside each Map call for writing
+void CountMap(unsigned int bytes);
+
+// Get the stats since the last call to ResetStateCacheStats. Use once per frame to see the effect of the cache
+// Each thread has its own cache and stats. Stats from other threads can be added to the current thread's stats
+StateCacheStats GetStateCacheStats();
+void ResetStateCacheStats();
+void AddStateCacheStats(const StateCacheStats& stats);
+
+
+#endif //_STATE_CACHE_H_INCLUDED_
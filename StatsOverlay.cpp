@@ -0,0 +1,464 @@
+//--------------------------------------------------------------------------------------
+// Class drawing performance stats over the finished frame
+//--------------------------------------------------------------------------------------
+
+#include "StatsOverlay.h"
+#include "GpuProfiler.h"
+#include "RenderGraph.h"
+#include "Direct3DSetup.h"
+#include "GpuMemory.h"
+#include "Shader.h"
+#include "State.h"
+#include "Timer.h"
+#include "Common.h"
+
+#include <Windows.h>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+
+
+StatsOverlay* gStatsOverlay = nullptr;
+
+// Colours of the overlay
+static const CVector4 BackgroundColour = { 0.0f, 0.0f, 0.0f, 0.6f };
+static const CVector4 TextColour       = { 1.0f, 1.0f, 1.0f, 1.0f };
+static const CVector4 InfoColour       = { 0.7f, 0.7f, 0.7f, 1.0f };
+static const CVector4 GraphColour      = { 0.2f, 0.2f, 0.2f, 0.6f };
+static const CVector4 TargetLineColour = { 0.5f, 0.5f, 1.0f, 0.8f };
+static const CVector4 FastFrameColour  = { 0.2f, 0.9f, 0.2f, 1.0f }; // Frames within 60fps
+static const CVector4 SlowFrameColour  = { 1.0f, 0.8f, 0.1f, 1.0f }; // Within 30fps
+static const CVector4 SpikeColour      = { 1.0f, 0.2f, 0.2f, 1.0f }; // Slower
+
+static const float TargetFrameTime = 1000.0f / 60; // Milliseconds
+static const int   InfoLineChars   = 100;          // Settings are wrapped at this many characters
+
+// Shaders whose costs are listed (see ShaderCosts in Shader.h), the ones most of the GPU time goes on
+static const char* const CostedShaders[] =
+{
+	"WaterSurface_vs", "WaterSurface_ps", "PixelLighting_ps", "RefractedPixelLighting_ps", "ReflectedPixelLighting_ps",
+	"WaterViewsPixelLighting_ps",
+};
+
+
+// Will throw a std::runtime_error exception on failure (same as Mesh)
+StatsOverlay::StatsOverlay()
+{
+	mQuads.reserve(MaxQuads);
+	try
+	{
+		CreateFontAtlas();
+		CreateBuffers();
+	}
+	catch (std::runtime_error)
+	{
+		Release(); // Destructor isn't called when a constructor throws
+		throw;
+	}
+}
+
+StatsOverlay::~StatsOverlay()
+{
+	Release();
+}
+
+
+// Set the settings text shown under the stats, a list of items separated by ", ". The items are wrapped onto as many lines
+// as needed
+void StatsOverlay::SetInfo(const std::string& info)
+{
+	mInfoLines.clear();
+	std::string line;
+	size_t start = 0;
+	while (start < info.size())
+	{
+		size_t end = info.find(", ", start);
+		if (end == std::string::npos)  end = info.size();
+		std::string item = info.substr(start, end - start);
+		start = end + 2;
+
+		if (!line.empty() && line.size() + 2 + item.size() > InfoLineChars)
+		{
+			mInfoLines.push_back(line);
+			line.clear();
+		}
+		line += (line.empty() ? "" : ", ") + item;
+	}
+	if (!line.empty())  mInfoLines.push_back(line);
+}
+
+
+// Draw the overlay into the given render target of the given size. Call once per frame at the end of rendering, after
+// post-processing and before presenting. The frame time is measured from one call to the next
+void StatsOverlay::Render(ID3D11RenderTargetView* renderTarget, int width, int height, const StateCacheStats& stats,
+                          uint64_t allocations)
+{
+	uint64_t count = Timer::HighResCount();
+	if (mLastCount != 0)
+	{
+		mFrameTimes[mNumFrames % HistorySize] = static_cast<float>(static_cast<double>(count - mLastCount) * 1000.0 / Timer::HighResFrequency());
+		++mNumFrames;
+	}
+	mLastCount = count;
+
+	mTargetWidth  = static_cast<float>(width);
+	mTargetHeight = static_cast<float>(height);
+	mQuads.clear();
+	mTextRight = 0;
+
+	// Min, max and 99th percentile of the frame times in the graph. The percentile is the time that 99% of frames are within,
+	// so shows the occasional spikes that an average hides. Sorted in a fixed array so nothing is allocated
+	int   numTimes = mNumFrames < HistorySize ? mNumFrames : HistorySize;
+	float lastTime = 0, minTime = 0, maxTime = 0, p99Time = 0;
+	if (numTimes > 0)
+	{
+		lastTime = mFrameTimes[(mNumFrames - 1) % HistorySize];
+		float sorted[HistorySize];
+		std::copy(mFrameTimes, mFrameTimes + numTimes, sorted);
+		int p99Index = (numTimes * 99 + 99) / 100 - 1;
+		std::nth_element(sorted, sorted + p99Index, sorted + numTimes);
+		p99Time = sorted[p99Index];
+		minTime = *std::min_element(mFrameTimes, mFrameTimes + numTimes);
+		maxTime = *std::max_element(mFrameTimes, mFrameTimes + numTimes);
+	}
+
+	// The background is added first so it is behind everything, its size is set once the rest is laid out
+	const float margin = 8;
+	const float line   = static_cast<float>(mCharHeight);
+	size_t background = mQuads.size();
+	AddRect(margin, margin, 0, 0, BackgroundColour);
+
+	float x = margin * 2;
+	float y = margin * 2;
+	Print(x, y, TextColour, "Frame %.2fms (%.0f fps)  Min %.2f  Max %.2f  P99 %.2f", lastTime, lastTime > 0 ? 1000 / lastTime : 0.0f,
+	      minTime, maxTime, p99Time);
+	y += line;
+
+	// Frame time graph, newest on the right. Scaled to fit the slowest frame, but never less than 30fps so a steady 60fps sits
+	// halfway up
+	float graphScale = (std::max)(maxTime, TargetFrameTime * 2);
+	AddRect(x, y, HistorySize, GraphHeight, GraphColour);
+	for (int i = 0; i < numTimes; ++i)
+	{
+		float time = mFrameTimes[(mNumFrames - numTimes + i) % HistorySize];
+		float barHeight = (std::min)(time / graphScale, 1.0f) * GraphHeight;
+		const CVector4& colour = time <= TargetFrameTime ? FastFrameColour : time <= TargetFrameTime * 2 ? SlowFrameColour : SpikeColour;
+		AddRect(x + HistorySize - numTimes + i, y + GraphHeight - barHeight, 1, barHeight, colour);
+	}
+	AddRect(x, y + GraphHeight - TargetFrameTime / graphScale * GraphHeight, HistorySize, 1, TargetLineColour);
+	Print(x + HistorySize + 4, y, InfoColour, "%.1fms", graphScale);
+	Print(x + HistorySize + 4, y + GraphHeight - line, InfoColour, "0ms");
+	y += GraphHeight + line / 2;
+
+	// CPU side work of the frame
+	Print(x, y, TextColour, "Draws: %u  State changes: %u (%u skipped)  Constants: %.1fKB", stats.draws, stats.issued, stats.filtered,
+	      stats.constantBytes / 1024.0f);
+	y += line;
+	Print(x, y, TextColour, "Shaders: %u  Constant buffers: %u  Textures: %u  Samplers: %u  States: %u  Input: %u  Targets: %u",
+	      stats.shaderCalls, stats.constantBufferCalls, stats.resourceCalls, stats.samplerCalls, stats.stateCalls, stats.inputCalls,
+	      stats.targetCalls);
+	y += line;
+	Print(x, y, TextColour, "Maps: %u (%.1fKB)", stats.maps, stats.mappedBytes / 1024.0f);
+	y += line;
+
+	// Should be zero once everything has settled, allocating memory during rendering is slow
+	Print(x, y, allocations == 0 ? TextColour : SpikeColour, "Render allocations: %llu", allocations);
+	y += line;
+
+	uint64_t videoMemoryUsed, videoMemoryBudget;
+	VideoMemoryUsage(videoMemoryUsed, videoMemoryBudget);
+	if (videoMemoryBudget > 0)
+	{
+		Print(x, y, TextColour, "Video memory: %lluMB / %lluMB", videoMemoryUsed / (1024 * 1024), videoMemoryBudget / (1024 * 1024));
+	}
+	else
+	{
+		Print(x, y, TextColour, "Video memory: not available");
+	}
+	y += line;
+
+	// Where the app's memory goes, the few owners using the most
+	std::vector<GpuMemoryOwner> owners = GpuMemoryByOwner();
+	size_t registeredBytes = 0;
+	unsigned int registeredResources = 0;
+	for (auto& owner : owners)
+	{
+		registeredBytes += owner.bytes;
+		registeredResources += owner.numResources;
+	}
+	Print(x, y, TextColour, "Registered: %.1fMB in %u resources", registeredBytes / (1024.0f * 1024.0f), registeredResources);
+	y += line;
+	const size_t NumOwnersShown = 4;
+	for (size_t i = 0; i < owners.size() && i < NumOwnersShown; ++i)
+	{
+		Print(x, y, TextColour, "  %-16.16s %8.1fMB %5u", owners[i].owner.c_str(), owners[i].bytes / (1024.0f * 1024.0f), owners[i].numResources);
+		y += line;
+	}
+	y += line / 2;
+
+	// GPU work of each pass, from the most recent frame with results: time, primitives read, vertex shader runs, triangles
+	// into and out of the clipper and pixel shader runs
+	Print(x, y, TextColour, "%-12s %8s %9s %9s %9s %9s %10s", "Pass", "GPU ms", "Prims", "VS", "Clip in", "Clip out", "PS");
+	y += line;
+	D3D11_QUERY_DATA_PIPELINE_STATISTICS total = {};
+	for (int pass = 0; pass < static_cast<int>(GpuPass::NumPasses); ++pass)
+	{
+		GpuPass gpuPass = static_cast<GpuPass>(pass);
+		const D3D11_QUERY_DATA_PIPELINE_STATISTICS& statistics = gGpuProfiler->PassStatistics(gpuPass);
+		Print(x, y, TextColour, "%-12s %8.2f %9llu %9llu %9llu %9llu %10llu", GpuProfiler::PassName(gpuPass), gGpuProfiler->PassTime(gpuPass),
+		      statistics.IAPrimitives, statistics.VSInvocations, statistics.CInvocations, statistics.CPrimitives, statistics.PSInvocations);
+		total.IAPrimitives  += statistics.IAPrimitives;
+		total.VSInvocations += statistics.VSInvocations;
+		total.CInvocations  += statistics.CInvocations;
+		total.CPrimitives   += statistics.CPrimitives;
+		total.PSInvocations += statistics.PSInvocations;
+		y += line;
+	}
+	Print(x, y, TextColour, "%-12s %8.2f %9llu %9llu %9llu %9llu %10llu", "Total", gGpuProfiler->TotalTime(),
+	      total.IAPrimitives, total.VSInvocations, total.CInvocations, total.CPrimitives, total.PSInvocations);
+	y += line * 1.5f;
+
+	// Costs of the main shaders from their bytecode: instructions, arithmetic, texture fetches, temp registers and the bytes of
+	// constant buffers they use
+	Print(x, y, TextColour, "%-26s %6s %6s %5s %6s %9s", "Shader", "Instr", "ALU", "Tex", "Temps", "CB bytes");
+	y += line;
+	for (auto name : CostedShaders)
+	{
+		const ShaderCost* cost = FindShaderCost(name);
+		if (cost == nullptr)  continue;
+		Print(x, y, TextColour, "%-26s %6u %6u %5u %6u %9u", name, cost->instructions, cost->arithmetic, cost->textureFetches,
+		      cost->tempRegisters, cost->constantBytes);
+		y += line;
+	}
+	y += line / 2;
+
+	// DirectX calls made by each render graph pass that was recorded this frame
+	Print(x, y, TextColour, "%-16s %6s %6s %8s %6s %10s", "Graph pass", "Draws", "Calls", "Skipped", "Maps", "Constants");
+	y += line;
+	for (int pass = 0; pass < gRenderGraph->NumPasses(); ++pass)
+	{
+		if (gRenderGraph->PassCulled(pass))  continue;
+		const StateCacheStats& passStats = gRenderGraph->PassStats(pass);
+		Print(x, y, TextColour, "%-16.16s %6u %6u %8u %6u %8.1fKB", gRenderGraph->PassName(pass), passStats.draws, passStats.issued,
+		      passStats.filtered, passStats.maps, passStats.constantBytes / 1024.0f);
+		y += line;
+	}
+	y += line / 2;
+
+	// Settings
+	for (auto& infoLine : mInfoLines)
+	{
+		Print(x, y, InfoColour, "%s", infoLine.c_str());
+		y += line;
+	}
+
+	// Fit the background around it all
+	float right = (std::max)(mTextRight, x + HistorySize);
+	mQuads[background].rect = { margin / mTargetWidth * 2 - 1, 1 - margin / mTargetHeight * 2,
+	                            (right + margin) / mTargetWidth * 2 - 1,  1 - (y + margin) / mTargetHeight * 2 };
+
+
+	////-------- Draw the quads --------////
+
+	// Discarding the old contents lets the GPU carry on using them for the last frame while we write to fresh memory
+	D3D11_MAPPED_SUBRESOURCE mapped;
+	if (FAILED(gD3DContext->Map(mQuadBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped)))  return;
+	std::memcpy(mapped.pData, mQuads.data(), mQuads.size() * sizeof(Quad));
+	gD3DContext->Unmap(mQuadBuffer, 0);
+	CountMap(static_cast<unsigned int>(mQuads.size() * sizeof(Quad)));
+
+	SetRenderTargets(1, &renderTarget, nullptr);
+	D3D11_VIEWPORT vp = { 0, 0, mTargetWidth, mTargetHeight, 0.0f, 1.0f };
+	SetViewport(vp);
+
+	SetBlendState(gAlphaBlendingState);
+	SetDepthStencilState(gNoDepthBufferState);
+	SetRasterizerState(gCullNoneState);
+	SetInputLayout(nullptr);
+	SetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP);
+	SetHullShader(nullptr);
+	SetDomainShader(nullptr);
+	SetGeometryShader(nullptr);
+	SetVertexShader(gStatsOverlayVertexShader);
+	SetPixelShader(gStatsOverlayPixelShader);
+	SetShaderResource(0, mQuadBufferSRV, VertexShaderStage);
+	SetShaderResource(0, mFontSRV);
+	SetSampler(0, gPointSampler);
+
+	// Four vertices for each quad, made into its corners by the vertex shader
+	gD3DContext->DrawInstanced(4, static_cast<UINT>(mQuads.size()), 0, 0);
+	CountDrawCall();
+
+	SetShaderResource(0, nullptr, VertexShaderStage);
+	SetShaderResource(0, nullptr);
+	SetBlendState(gNoBlendingState);
+	SetDepthStencilState(gUseDepthBufferState);
+	SetRasterizerState(gCullBackState);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions
+//--------------------------------------------------------------------------------------
+
+// Add a quad showing the given atlas cell, or a solid rectangle, in pixels from the top-left of the target
+void StatsOverlay::AddQuad(float x, float y, float width, float height, const CVector4& colour, int cell)
+{
+	if (mQuads.size() >= MaxQuads)  return;
+
+	// Solid rectangles use the middle of the solid cell, so the edges of the quad never pick up a neighbouring cell
+	CVector2 uv = { static_cast<float>(cell % AtlasColumns) * mCellUVSize.x, static_cast<float>(cell / AtlasColumns) * mCellUVSize.y };
+	CVector2 uvSize = mCellUVSize;
+	if (cell == SolidCell)
+	{
+		uv = uv + mCellUVSize * 0.5f;
+		uvSize = { 0, 0 };
+	}
+
+	mQuads.push_back({ { x / mTargetWidth * 2 - 1, 1 - y / mTargetHeight * 2, (x + width) / mTargetWidth * 2 - 1, 1 - (y + height) / mTargetHeight * 2 },
+	                   colour, uv, uvSize });
+}
+
+
+// Add a line of text at the given position in pixels, formatted like printf. Returns the width of the text in pixels
+float StatsOverlay::Print(float x, float y, const CVector4& colour, const char* format, ...)
+{
+	char text[256];
+	va_list args;
+	va_start(args, format);
+	vsnprintf(text, sizeof(text), format, args);
+	va_end(args);
+
+	float left = x;
+	for (const char* c = text; *c != 0; ++c)
+	{
+		int cell = static_cast<unsigned char>(*c) - FirstChar;
+		if (cell > 0 && cell < NumChars)  AddQuad(x, y, static_cast<float>(mCharWidth), static_cast<float>(mCharHeight), colour, cell); // Cell 0 is the space
+		x += mCharWidth;
+	}
+	mTextRight = (std::max)(mTextRight, x);
+	return x - left;
+}
+
+
+// Create the font atlas with GDI, throws a std::runtime_error exception on failure. Each character is drawn white on black
+// into its cell of a bitmap, then the bitmap is copied into a single channel texture, which the shader uses as the opacity
+void StatsOverlay::CreateFontAtlas()
+{
+	HDC     dc     = CreateCompatibleDC(nullptr);
+	HFONT   font   = CreateFontA(-13, 0, 0, 0, FW_NORMAL, FALSE, FALSE, FALSE, ANSI_CHARSET, OUT_DEFAULT_PRECIS, CLIP_DEFAULT_PRECIS,
+	                             ANTIALIASED_QUALITY, FIXED_PITCH | FF_MODERN, "Consolas");
+	HBITMAP bitmap = nullptr;
+	void*   bits   = nullptr;
+	int     atlasWidth = 0, atlasHeight = 0;
+	if (dc != nullptr && font != nullptr)
+	{
+		SelectObject(dc, font);
+		TEXTMETRICA metrics;
+		GetTextMetricsA(dc, &metrics);
+		mCharWidth  = metrics.tmAveCharWidth;
+		mCharHeight = metrics.tmHeight;
+
+		// Top-down 32-bit bitmap (negative height) so the rows are in the same order as the texture
+		int rows = (NumChars + 1 + AtlasColumns - 1) / AtlasColumns;
+		atlasWidth  = AtlasColumns * mCharWidth;
+		atlasHeight = rows * mCharHeight;
+		BITMAPINFO bitmapInfo = {};
+		bitmapInfo.bmiHeader.biSize        = sizeof(BITMAPINFOHEADER);
+		bitmapInfo.bmiHeader.biWidth       = atlasWidth;
+		bitmapInfo.bmiHeader.biHeight      = -atlasHeight;
+		bitmapInfo.bmiHeader.biPlanes      = 1;
+		bitmapInfo.bmiHeader.biBitCount    = 32;
+		bitmapInfo.bmiHeader.biCompression = BI_RGB;
+		bitmap = CreateDIBSection(dc, &bitmapInfo, DIB_RGB_COLORS, &bits, nullptr, 0);
+	}
+
+	std::vector<uint8_t> texels;
+	if (bitmap != nullptr && bits != nullptr)
+	{
+		SelectObject(dc, bitmap);
+		SetTextColor(dc, RGB(255, 255, 255));
+		SetBkColor(dc, RGB(0, 0, 0));
+		SetBkMode(dc, OPAQUE);
+		for (int cell = 0; cell < NumChars; ++cell)
+		{
+			char c = static_cast<char>(FirstChar + cell);
+			TextOutA(dc, (cell % AtlasColumns) * mCharWidth, (cell / AtlasColumns) * mCharHeight, &c, 1);
+		}
+		RECT solid = { (SolidCell % AtlasColumns) * mCharWidth, (SolidCell / AtlasColumns) * mCharHeight, 0, 0 };
+		solid.right  = solid.left + mCharWidth;
+		solid.bottom = solid.top  + mCharHeight;
+		FillRect(dc, &solid, static_cast<HBRUSH>(GetStockObject(WHITE_BRUSH)));
+		GdiFlush();
+
+		// The text is white so any of the colour channels will do
+		texels.resize(atlasWidth * atlasHeight);
+		const uint8_t* pixels = static_cast<const uint8_t*>(bits);
+		for (size_t i = 0; i < texels.size(); ++i)  texels[i] = pixels[i * 4];
+	}
+
+	if (bitmap)  DeleteObject(bitmap);
+	if (font)    DeleteObject(font);
+	if (dc)      DeleteDC(dc);
+	if (texels.empty())  throw std::runtime_error("Error creating stats overlay font");
+
+	D3D11_TEXTURE2D_DESC textureDesc = {};
+	textureDesc.Width            = atlasWidth;
+	textureDesc.Height           = atlasHeight;
+	textureDesc.MipLevels        = 1;
+	textureDesc.ArraySize        = 1;
+	textureDesc.Format           = DXGI_FORMAT_R8_UNORM;
+	textureDesc.SampleDesc.Count = 1;
+	textureDesc.Usage            = D3D11_USAGE_IMMUTABLE;
+	textureDesc.BindFlags        = D3D11_BIND_SHADER_RESOURCE;
+	D3D11_SUBRESOURCE_DATA initialData = {};
+	initialData.pSysMem     = texels.data();
+	initialData.SysMemPitch = atlasWidth;
+	if (FAILED(gD3DDevice->CreateTexture2D(&textureDesc, &initialData, &mFontTexture)) ||
+	    FAILED(gD3DDevice->CreateShaderResourceView(mFontTexture, nullptr, &mFontSRV)))
+	{
+		throw std::runtime_error("Error creating stats overlay font texture");
+	}
+	RegisterGpuResource(mFontTexture, "Stats Overlay");
+	mCellUVSize = { static_cast<float>(mCharWidth) / atlasWidth, static_cast<float>(mCharHeight) / atlasHeight };
+}
+
+
+// Create the quad buffer, throws a std::runtime_error exception on failure
+void StatsOverlay::CreateBuffers()
+{
+	// Dynamic structured buffer, rewritten by the CPU each frame and read by the vertex shader
+	D3D11_BUFFER_DESC bufferDesc = {};
+	bufferDesc.ByteWidth           = sizeof(Quad) * MaxQuads;
+	bufferDesc.Usage               = D3D11_USAGE_DYNAMIC;
+	bufferDesc.BindFlags           = D3D11_BIND_SHADER_RESOURCE;
+	bufferDesc.CPUAccessFlags      = D3D11_CPU_ACCESS_WRITE;
+	bufferDesc.MiscFlags           = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+	bufferDesc.StructureByteStride = sizeof(Quad);
+
+	D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+	srvDesc.Format              = DXGI_FORMAT_UNKNOWN; // Structured buffers have no format
+	srvDesc.ViewDimension       = D3D11_SRV_DIMENSION_BUFFER;
+	srvDesc.Buffer.FirstElement = 0;
+	srvDesc.Buffer.NumElements  = MaxQuads;
+	if (FAILED(gD3DDevice->CreateBuffer(&bufferDesc, nullptr, &mQuadBuffer)) ||
+	    FAILED(gD3DDevice->CreateShaderResourceView(mQuadBuffer, &srvDesc, &mQuadBufferSRV)))
+	{
+		throw std::runtime_error("Error creating stats overlay buffer");
+	}
+	RegisterGpuResource(mQuadBuffer, "Stats Overlay");
+}
+
+
+void StatsOverlay::Release()
+{
+	if (mQuadBufferSRV)  mQuadBufferSRV->Release();
+	if (mQuadBuffer)     mQuadBuffer   ->Release();
+	if (mFontSRV)        mFontSRV      ->Release();
+	if (mFontTexture)    mFontTexture  ->Release();
+	mQuadBufferSRV = mFontSRV = nullptr;
+	mQuadBuffer = nullptr;
+	mFontTexture = nullptr;
+}
@@ -0,0 +1,123 @@
+//--------------------------------------------------------------------------------------
+// Class drawing performance stats over the finished frame
+//--------------------------------------------------------------------------------------
+// The window title can only show a line of text, updated twice a second, so it hides the
+// frame-to-frame spikes that matter most. This overlay is drawn into the back buffer at the end
+// of each frame: a graph of the recent frame times with their min, max and 99th percentile,
+// the GPU time and pipeline statistics of each pass (see GpuProfiler.h), the draw calls, state changes
+// and constant bytes sent this frame by kind of call and by render graph pass (see StateCache.h
+// and RenderGraph.h), the video memory in use, the costs of the main shaders (see Shader.h), and
+// the current settings that used to be in the window title.
+//
+// Text and the graph bars are all quads, kept in a dynamic structured buffer and drawn with a
+// single instanced draw with no vertex buffer. The glyphs come from a font atlas drawn with GDI
+// when the overlay is created. Nothing is allocated while rendering.
+
+#include "CVector2.h"
+#include "CVector4.h"
+#include "StateCache.h"
+#include <d3d11.h>
+#include <string>
+#include <vector>
+#include "stdint.h"
+
+#ifndef _STATS_OVERLAY_H_INCLUDED_
+#define _STATS_OVERLAY_H_INCLUDED_
+
+class StatsOverlay
+{
+//--------------------------------------------------------------------------------------
+// Construction / Usage
+//--------------------------------------------------------------------------------------
+public:
+
+	// Will throw a std::runtime_error exception on failure (same as Mesh)
+	StatsOverlay();
+	~StatsOverlay();
+
+
+	// Set the settings text shown under the stats, a list of items separated by ", " (as was shown in the window title). The
+	// items are wrapped onto as many lines as needed. Call whenever the settings are updated, not every frame
+	void SetInfo(const std::string& info);
+
+	// Draw the overlay into the given render target of the given size. Call once per frame at the end of rendering, after
+	// post-processing and before presenting. The stats are the state cache stats of the frame so far, and the allocations
+	// are the heap allocations made while rendering the last frame (see AllocationCounter.h). The frame time is measured from
+	// one call to the next. Uses the immediate context and the state cache, leaves no textures bound
+	void Render(ID3D11RenderTargetView* renderTarget, int width, int height, const StateCacheStats& stats, uint64_t allocations);
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions / data
+//--------------------------------------------------------------------------------------
+private:
+
+	static constexpr int HistorySize = 240;  // Frames in the frame time graph, one pixel wide each
+	static constexpr int GraphHeight = 80;   // Pixels
+	static constexpr int MaxQuads    = 8192; // Glyphs and bars drawn each frame, any more are dropped
+
+	// The font atlas holds the printable ASCII characters (32 to 126) in rows of AtlasColumns cells. The cell after the last
+	// character is solid, for the bars and background
+	static constexpr int FirstChar    = 32;
+	static constexpr int NumChars     = 95;
+	static constexpr int SolidCell    = NumChars;
+	static constexpr int AtlasColumns = 16;
+
+	// Quad drawn by the overlay shader, there is a structure in the shader code that exactly matches this one
+	struct Quad
+	{
+		CVector4 rect;   // Left, top, right, bottom in normalised device coordinates
+		CVector4 colour; // Alpha is the opacity
+		CVector2 uv;     // Top-left of the quad in the font atlas
+		CVector2 uvSize;
+	};
+
+	// Create the font atlas with GDI, throws a std::runtime_error exception on failure
+	void CreateFontAtlas();
+
+	// Create the quad buffer, throws a std::runtime_error exception on failure
+	void CreateBuffers();
+
+	void Release();
+
+	// Add a quad showing the given atlas cell, or a solid rectangle, in pixels from the top-left of the target
+	void AddQuad(float x, float y, float width, float height, const CVector4& colour, int cell);
+	void AddRect(float x, float y, float width, float height, const CVector4& colour)  { AddQuad(x, y, width, height, colour, SolidCell); }
+
+	// Add a line of text at the given position in pixels, formatted like printf. Lines longer than the text buffer are cut
+	// short. Returns the width of the text in pixels
+	float Print(float x, float y, const CVector4& colour, const char* format, ...);
+
+
+	// Font atlas and the size of its cells in pixels
+	ID3D11Texture2D*          mFontTexture = nullptr;
+	ID3D11ShaderResourceView* mFontSRV     = nullptr;
+	int                       mCharWidth   = 0;
+	int                       mCharHeight  = 0;
+	CVector2                  mCellUVSize;
+
+	// Quads for the current frame, kept in a vector with space for MaxQuads so adding them never allocates
+	std::vector<Quad>         mQuads;
+	ID3D11Buffer*             mQuadBuffer    = nullptr;
+	ID3D11ShaderResourceView* mQuadBufferSRV = nullptr;
+
+	// Size of the target being drawn to this frame, and the right edge of the widest text so far (pixels)
+	float mTargetWidth  = 1;
+	float mTargetHeight = 1;
+	float mTextRight    = 0;
+
+	// Frame times in milliseconds, a ring of the most recent HistorySize frames. mNumFrames counts the frames so far
+	float    mFrameTimes[HistorySize] = {};
+	int      mNumFrames = 0;
+	uint64_t mLastCount = 0; // High-resolution count at the last call to Render (see Timer.h)
+
+	// The settings, split into lines that fit beside the stats
+	std::vector<std::string> mInfoLines;
+};
+
+
+// The overlay used by the scene, created in InitGeometry (see Scene.cpp)
+extern StatsOverlay* gStatsOverlay;
+
+
+#endif //_STATS_OVERLAY_H_INCLUDED_
@@ -0,0 +1,32 @@
+//--------------------------------------------------------------------------------------
+// Include file for the stats overlay shaders
+//--------------------------------------------------------------------------------------
+// The overlay is drawn as quads read from a structured buffer (see StatsOverlay.h). The overlay shaders don't use the
+// rendering constant buffers, so don't include Common.hlsli
+
+#ifndef _STATS_OVERLAY_HLSLI_DEFINED_
+#define _STATS_OVERLAY_HLSLI_DEFINED_
+
+
+//--------------------------------------------------------------------------------------
+// Shader input / output
+//--------------------------------------------------------------------------------------
+
+// A quad of text or a solid rectangle. Must match exactly the Quad structure in StatsOverlay.h
+struct OverlayQuad
+{
+	float4 rect;   // Left, top, right, bottom in normalised device coordinates
+	float4 colour; // Alpha is the opacity
+	float2 uv;     // Top-left of the quad in the font atlas
+	float2 uvSize;
+};
+
+struct StatsOverlayPixelShaderInput
+{
+	float4 projectedPosition : SV_Position;
+	float4 colour            : colour;
+	float2 uv                : uv;
+};
+
+
+#endif // _STATS_OVERLAY_HLSLI_DEFINED_
@@ -0,0 +1,24 @@
+//--------------------------------------------------------------------------------------
+// Stats overlay pixel shader
+//--------------------------------------------------------------------------------------
+// The colour of the quad, with the opacity from the font atlas. Solid rectangles read the solid cell of the atlas
+
+#include "StatsOverlay.hlsli"
+
+
+//--------------------------------------------------------------------------------------
+// Textures (texture maps)
+//--------------------------------------------------------------------------------------
+
+Texture2D<float> FontAtlas   : register(t0); // Single channel, 1 where the characters are
+SamplerState     PointSample : register(s0); // The overlay is drawn one atlas texel to one pixel
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+float4 main(StatsOverlayPixelShaderInput input) : SV_Target
+{
+	return float4(input.colour.rgb, input.colour.a * FontAtlas.Sample(PointSample, input.uv));
+}
@@ -0,0 +1,33 @@
+//--------------------------------------------------------------------------------------
+// Stats overlay vertex shader
+//--------------------------------------------------------------------------------------
+// Draws the quads of the stats overlay with no vertex buffer, one instance for each quad. The four vertices of each instance
+// are the corners of its quad, drawn as a triangle strip
+
+#include "StatsOverlay.hlsli"
+
+
+//--------------------------------------------------------------------------------------
+// Textures
+//--------------------------------------------------------------------------------------
+
+StructuredBuffer<OverlayQuad> Quads : register(t0); // The t0 must match the slot used in StatsOverlay::Render
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+// Vertices 0, 1, 2 and 3 are the top-left, top-right, bottom-left and bottom-right corners
+StatsOverlayPixelShaderInput main(uint vertexID : SV_VertexID, uint instanceID : SV_InstanceID)
+{
+	StatsOverlayPixelShaderInput output;
+
+	OverlayQuad quad = Quads[instanceID];
+	float2 corner = float2(vertexID & 1, vertexID >> 1);
+	output.projectedPosition = float4(lerp(quad.rect.xy, quad.rect.zw, corner), 0, 1);
+	output.colour = quad.colour;
+	output.uv     = quad.uv + corner * quad.uvSize;
+
+	return output;
+}
@@ -0,0 +1,123 @@
+//--------------------------------------------------------------------------------------
+// Stress scene - thousands of simple models around and under the water, for measuring at scale
+//--------------------------------------------------------------------------------------
+
+#include "StressScene.h"
+#include "Terrain.h"
+#include "MathHelpers.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cmath>
+
+
+//--------------------------------------------------------------------------------------
+// Global data
+//--------------------------------------------------------------------------------------
+
+StressSceneSettings gStressScene;
+
+// Sizes of the objects, as the radius of their bounding spheres in world space. About the size of the crate
+const float MinObjectRadius = 2.0f;
+const float MaxObjectRadius = 8.0f;
+
+// Highest the objects above the water and the lights float over the ground or water, whichever is higher
+const float MaxObjectLift = 30.0f;
+const float MinLightLift  = 3.0f;
+const float MaxLightLift  = 15.0f;
+
+// Each light is a small lamp like the dock lamps, too weak to reach far
+const float MinLightStrength = 4.0f;
+const float MaxLightStrength = 10.0f;
+const float LightRange = 40.0f;
+
+// Points tried for an object under the water before it crosses the surface instead
+const int UnderWaterTries = 20;
+
+// Part of the terrain left out around its edges, where the camera rarely goes
+const float EdgeMargin = 0.1f;
+
+
+//--------------------------------------------------------------------------------------
+// Layout
+//--------------------------------------------------------------------------------------
+
+// Lay out the objects and lights of gStressScene over the given terrain, with the water at the given height. The bounds are
+// of each mesh in StressMeshFiles, in model space. Objects meant to be under water where the ground at a random point isn't
+// deep enough for them try other points, and cross the surface if none is
+void LayoutStressScene(const BoundingSphere* meshBounds, Terrain* terrain, float waterHeight,
+                       std::vector<StressObject>& objects, std::vector<StressLight>& lights)
+{
+	// Same seed, same scene
+	srand(gStressScene.seed);
+
+	const BoundingBox& bounds = terrain->Bounds();
+	CVector3 margin = (bounds.max - bounds.min) * EdgeMargin;
+	auto randomX = [&]() { return Random(bounds.min.x + margin.x, bounds.max.x - margin.x); };
+	auto randomZ = [&]() { return Random(bounds.min.z + margin.z, bounds.max.z - margin.z); };
+
+	// The first objects are above the water, then those under it, then those crossing it, with the meshes in turn
+	int numAbove = static_cast<int>(gStressScene.numObjects * gStressScene.aboveWater);
+	int numUnder = static_cast<int>(gStressScene.numObjects * gStressScene.underWater);
+	objects.clear();
+	objects.reserve(gStressScene.numObjects);
+	for (int i = 0; i < gStressScene.numObjects; ++i)
+	{
+		StressObject object;
+		object.mesh     = i % NumStressMeshes;
+		object.rotation = Random(-PI, PI);
+
+		// The position is of the model's origin, which isn't the centre of its bounds (e.g. the teapot's base). The spheres
+		// are placed by their centres with the turn ignored, so the sphere's offset across is added to its radius
+		const BoundingSphere& sphere = meshBounds[object.mesh];
+		float radius = Random(MinObjectRadius, MaxObjectRadius);
+		object.scale = radius / sphere.radius;
+		float centreY = sphere.centre.y * object.scale;
+		radius += std::sqrt(sphere.centre.x * sphere.centre.x + sphere.centre.z * sphere.centre.z) * object.scale;
+
+		float x = randomX();
+		float z = randomZ();
+		float y = 0;
+		if (i < numAbove)
+		{
+			y = (std::max)(terrain->Height(x, z), waterHeight) + radius + Random(0.0f, MaxObjectLift);
+		}
+		else
+		{
+			bool under = false;
+			if (i < numAbove + numUnder)
+			{
+				for (int tries = 0; tries < UnderWaterTries && !under; ++tries)
+				{
+					float ground = terrain->Height(x, z);
+					under = waterHeight - ground > 2 * radius;
+					if (under)  y = Random(ground + radius, waterHeight - radius);
+					else
+					{
+						x = randomX();
+						z = randomZ();
+					}
+				}
+			}
+
+			// Crossing the surface, the centre within half the radius of it. Kept out of the ground
+			if (!under)  y = (std::max)(waterHeight + Random(-0.5f, 0.5f) * radius, terrain->Height(x, z));
+		}
+		object.position = { x, y - centreY, z };
+		objects.push_back(object);
+	}
+
+	lights.clear();
+	lights.reserve(gStressScene.numLights);
+	for (int i = 0; i < gStressScene.numLights; ++i)
+	{
+		StressLight light;
+		float x = randomX();
+		float z = randomZ();
+		light.position = { x, (std::max)(terrain->Height(x, z), waterHeight) + Random(MinLightLift, MaxLightLift), z };
+		light.colour   = { Random(0.3f, 1.0f), Random(0.3f, 1.0f), Random(0.3f, 1.0f) };
+		light.strength = Random(MinLightStrength, MaxLightStrength);
+		light.range    = LightRange;
+		lights.push_back(light);
+	}
+}
@@ -0,0 +1,67 @@
+//--------------------------------------------------------------------------------------
+// Stress scene - thousands of simple models around and under the water, for measuring at scale
+//--------------------------------------------------------------------------------------
+// The scene itself has only a handful of lit models, too few to show what a change to the
+// culling, instancing or batching costs or saves. With -stress N on the command line (see
+// Benchmark.h) N copies of the teapot, sphere and cube meshes are added to the lit objects,
+// scattered over the terrain at random sizes and turns. A chosen part of them is above the
+// water, a part under it (where the ground is deep enough) and the rest crosses the surface, so
+// each of the refraction, reflection and main passes gets its share. -stresslights K adds K
+// small point lights among them. The layout comes from a seed, so every run of the benchmark
+// with the same options measures the same scene.
+
+#include "CVector3.h"
+#include "Frustum.h"
+#include <vector>
+
+#ifndef _STRESS_SCENE_H_INCLUDED_
+#define _STRESS_SCENE_H_INCLUDED_
+
+class Terrain;
+
+
+// Settings for the stress scene, from the command line (see ParseBenchmarkCommandLine). The parts above and under the water
+// are fractions of the objects that add up to 1 at most, the rest cross the water surface
+struct StressSceneSettings
+{
+	int          numObjects = 0; // 0 for no stress scene
+	float        aboveWater = 0.4f;
+	float        underWater = 0.3f;
+	int          numLights  = 0;
+	unsigned int seed       = 1;
+};
+
+extern StressSceneSettings gStressScene;
+
+
+// The meshes the objects are copies of, loaded with the scene's meshes when there is a stress scene
+const char* const StressMeshFiles[] = { "Teapot.x", "Sphere.x", "Cube.x" };
+const int NumStressMeshes = sizeof(StressMeshFiles) / sizeof(StressMeshFiles[0]);
+
+// Where an object goes, as the arguments of Model's SetPosition, SetRotation and SetScale
+struct StressObject
+{
+	int      mesh;     // Index in StressMeshFiles
+	CVector3 position;
+	float    rotation; // Radians, around y axis
+	float    scale;
+};
+
+// A point light, the colour doesn't include the strength (as Scene.cpp's lights)
+struct StressLight
+{
+	CVector3 position;
+	CVector3 colour;
+	float    strength;
+	float    range;
+};
+
+
+// Lay out the objects and lights of gStressScene over the given terrain, with the water at the given height. The bounds are
+// of each mesh in StressMeshFiles, in model space. Objects meant to be under water where the ground at a random point isn't
+// deep enough for them try other points, and cross the surface if none is
+void LayoutStressScene(const BoundingSphere* meshBounds, Terrain* terrain, float waterHeight,
+                       std::vector<StressObject>& objects, std::vector<StressLight>& lights);
+
+
+#endif //_STRESS_SCENE_H_INCLUDED_
@@ -0,0 +1,392 @@
+//--------------------------------------------------------------------------------------
+// Class encapsulating a heightmap terrain drawn as quadtree chunks with levels of detail
+//--------------------------------------------------------------------------------------
+
+#include "Terrain.h"
+#include "Mesh.h"
+#include "StateCache.h"
+#include "GpuEvents.h"
+#include "GpuMemory.h"
+#include "AssetArchive.h"
+#include "Common.h"
+
+#include <assimp/Importer.hpp>
+#include <assimp/scene.h>
+#include <assimp/postprocess.h>
+
+#include <cmath>
+#include <cfloat>
+#include <stdexcept>
+
+
+// Create a terrain from the given mesh file, sampling its heights on a grid of resolution x resolution points. Tiles are grids
+// of tileResolution squares. Will throw a std::runtime_error exception on failure (same as Mesh)
+Terrain::Terrain(const std::string& fileName, int resolution /*= 513*/, int tileResolution /*= 32*/)
+	: mResolution(resolution), mTileResolution(tileResolution), mNumLevels(1)
+{
+	// Tile resolution must be even so every other vertex of a tile lies on the coarser grid of the next level, and the tiles
+	// of each level must cover the heightfield exactly
+	int numTiles = (tileResolution > 0) ? (resolution - 1) / tileResolution : 0;
+	if (tileResolution < 2 || tileResolution % 2 != 0 || numTiles < 1 || numTiles * tileResolution != resolution - 1 ||
+	    (numTiles & (numTiles - 1)) != 0)
+		throw std::runtime_error("Invalid terrain settings for " + fileName);
+	while ((1 << (mNumLevels - 1)) < numTiles)  ++mNumLevels;
+
+	SampleMesh(fileName);
+	CalculateNodeHeights();
+
+	// Tile ranges and morphs as for the water clipmap (see WaterClipmap.cpp), which needs every point in a level L tile to be
+	// within mLodRanges[L] + (size of a level L+1 node) of the camera before the level L+1 morph starts:
+	//     mLodRanges[L] + sqrt(8*size*size + height*height)  <  mMorphStarts[L+1]
+	// The terrain nodes have height as well as size, so if the ground is steep the range factor is raised to keep to that
+	float tileSize = mTileResolution * mSpacing;
+	float rangeFactor = LodRangeFactor;
+	for (int level = 1; level < mNumLevels; ++level)
+	{
+		float size = tileSize * (1 << (level - 1));
+		float height = 0;
+		for (auto& heights : mNodeHeights[level])  height = (std::max)(height, heights.y - heights.x);
+		rangeFactor = (std::max)(rangeFactor, 1.05f * std::sqrt(8 + (height / size) * (height / size)) / MorphStartRatio);
+	}
+	float previousRange = 0;
+	for (int level = 0; level < mNumLevels; ++level)
+	{
+		float range = rangeFactor * tileSize * (1 << level);
+		mLodRanges.push_back(range);
+		mMorphStarts.push_back(previousRange + (range - previousRange) * MorphStartRatio);
+		previousRange = range;
+	}
+
+	// There is no coarser level for the top level tiles to morph to
+	mMorphStarts.back() = 1e30f;
+	mLodRanges.back()   = 2e30f;
+
+	try
+	{
+		CreateHeightTexture();
+
+		// A single unit tile is shared by every level, the world matrix scales it to the size required
+		mTileMesh = new Mesh(CVector3(0, 0, 0), CVector3(1, 0, 1), tileResolution, tileResolution, true, true, true); // Bufferless grid
+	}
+	catch (std::runtime_error)
+	{
+		// Destructor isn't called when a constructor throws
+		if (mHeightSRV)      mHeightSRV->Release();
+		if (mHeightTexture)  mHeightTexture->Release();
+		throw;
+	}
+}
+
+Terrain::~Terrain()
+{
+	delete mTileMesh;
+	if (mHeightSRV)      mHeightSRV->Release();
+	if (mHeightTexture)  mHeightTexture->Release();
+}
+
+
+// Select the tiles to draw this frame from the given camera position. Call once per frame before rendering
+void Terrain::Update(const CVector3& cameraPosition)
+{
+	mCameraPosition = cameraPosition;
+	mTiles.clear(); // Keeps capacity, so no allocations once the tile count has settled
+
+	// The top level is a single node covering the whole terrain, which is always drawn whatever the distance
+	SelectTiles(0, 0, mNumLevels - 1);
+}
+
+
+// Render the tiles selected by the last call to Update that might be seen in the given frustum, or in the other frustum if
+// there is one. Returns the number drawn
+unsigned int Terrain::Render(const Frustum& frustum, const Frustum* otherFrustum /*= nullptr*/)
+{
+	// Single matrix passed to Mesh::Render for each tile, kept to avoid allocating each frame. One for each thread as the
+	// terrain is rendered in more than one pass, which may be recorded at the same time (see CommandRecorder.h)
+	static thread_local std::vector<CMatrix4x4> tileMatrix(1);
+
+	SetShaderResource(14, mHeightSRV, VertexShaderStage); // Must match the slot in Terrain_vs.hlsl
+
+	unsigned int numRendered = 0;
+	gPerModelConstants.gridResolution = static_cast<float>(mTileResolution);
+	for (auto& tile : mTiles)
+	{
+		// The frustum of the refraction and reflection passes includes the water plane, so tiles entirely on the wrong side of
+		// the water are culled here too
+		BoundingBox bounds = NodeBounds(tile.x, tile.z, tile.level);
+		if (!BoxInFrustum(frustum, bounds) && (otherFrustum == nullptr || !BoxInFrustum(*otherFrustum, bounds)))  continue;
+
+		// Morph settings for this tile's level - used in the terrain vertex shader (see Terrain_vs.hlsl)
+		gPerModelConstants.morphStart = mMorphStarts[tile.level];
+		gPerModelConstants.morphEnd   = mLodRanges[tile.level];
+
+		float size = mTileResolution * (1 << tile.level) * mSpacing;
+		tileMatrix[0] = MatrixScaling({ size, 1, size }) *
+		                MatrixTranslation({ mOrigin.x + tile.x * mSpacing, 0, mOrigin.y + tile.z * mSpacing });
+		mTileMesh->Render(tileMatrix);
+		++numRendered;
+	}
+
+	// Switch morphing off again so the other grids are unaffected
+	gPerModelConstants.morphStart = gPerModelConstants.morphEnd = 0;
+	gPerModelConstants.gridResolution = 0;
+	return numRendered;
+}
+
+
+// Set the terrain values in the given per-frame constants, used by the terrain vertex shader
+void Terrain::SetTerrainConstants(PerFrameConstants& constants)
+{
+	constants.terrainOrigin     = mOrigin;
+	constants.terrainSpacing    = mSpacing;
+	constants.terrainResolution = static_cast<float>(mResolution);
+	constants.terrainUVScale    = mUVScale;
+	constants.terrainUVOffset   = mUVOffset;
+}
+
+
+// Height of the ground at the given point in the xz plane, matching the triangles drawn at full detail. Points outside the
+// terrain get the height at the nearest edge
+float Terrain::Height(float x, float z)
+{
+	float sampleX = (std::min)((std::max)((x - mOrigin.x) / mSpacing, 0.0f), static_cast<float>(mResolution - 1));
+	float sampleZ = (std::min)((std::max)((z - mOrigin.y) / mSpacing, 0.0f), static_cast<float>(mResolution - 1));
+	int   cellX = (std::min)(static_cast<int>(sampleX), mResolution - 2);
+	int   cellZ = (std::min)(static_cast<int>(sampleZ), mResolution - 2);
+	float u = sampleX - cellX;
+	float v = sampleZ - cellZ;
+
+	// The grid tiles split each square along the diagonal from its (0,1) corner to its (1,0) corner (see GridVertexPosition
+	// in Common.hlsli)
+	if (u + v <= 1)
+	{
+		float h00 = Sample(cellX, cellZ);
+		return h00 + u * (Sample(cellX + 1, cellZ) - h00) + v * (Sample(cellX, cellZ + 1) - h00);
+	}
+	float h11 = Sample(cellX + 1, cellZ + 1);
+	return h11 + (1 - u) * (Sample(cellX, cellZ + 1) - h11) + (1 - v) * (Sample(cellX + 1, cellZ) - h11);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions
+//--------------------------------------------------------------------------------------
+
+// Sample the heights of the mesh in the given file onto the heightfield grid. Each sample is the highest point of the mesh
+// above it, found by drawing the triangles onto the grid from above. Also fits the mesh UVs to its x and z positions
+void Terrain::SampleMesh(const std::string& fileName)
+{
+	// The same space as meshes loaded by the Mesh class, with the node transforms applied to the vertices
+	Assimp::Importer importer;
+	importer.SetIOHandler(NewAssetIOSystem());
+	unsigned int flags = aiProcess_MakeLeftHanded | aiProcess_FlipUVs | aiProcess_Triangulate | aiProcess_PreTransformVertices |
+	                     aiProcess_JoinIdenticalVertices | aiProcess_SortByPType;
+	const aiScene* scene = importer.ReadFile(fileName, flags);
+	if (scene == nullptr || scene->mNumMeshes == 0)  throw std::runtime_error("Error loading terrain " + fileName);
+
+	mBounds = BoundingBox{};
+	for (unsigned int m = 0; m < scene->mNumMeshes; ++m)
+	{
+		const aiMesh* mesh = scene->mMeshes[m];
+		for (unsigned int v = 0; v < mesh->mNumVertices; ++v)  mBounds.Add(reinterpret_cast<const CVector3&>(mesh->mVertices[v]));
+	}
+	if (mBounds.IsEmpty())  throw std::runtime_error("No vertices in terrain " + fileName);
+
+	// A square grid over the larger side of the mesh
+	mOrigin  = { mBounds.min.x, mBounds.min.z };
+	mSpacing = (std::max)(mBounds.max.x - mBounds.min.x, mBounds.max.z - mBounds.min.z) / (mResolution - 1);
+	if (mSpacing <= 0)  throw std::runtime_error("Terrain " + fileName + " has no area");
+
+	mHeights.assign(static_cast<size_t>(mResolution) * mResolution, -FLT_MAX);
+	double sumX = 0, sumZ = 0, sumU = 0, sumV = 0, sumXU = 0, sumZV = 0, sumXX = 0, sumZZ = 0;
+	size_t numUVs = 0;
+	for (unsigned int m = 0; m < scene->mNumMeshes; ++m)
+	{
+		const aiMesh* mesh = scene->mMeshes[m];
+		auto position = [&](unsigned int index) { return reinterpret_cast<const CVector3&>(mesh->mVertices[index]); };
+
+		for (unsigned int f = 0; f < mesh->mNumFaces; ++f)
+		{
+			const aiFace& face = mesh->mFaces[f];
+			if (face.mNumIndices != 3)  continue; // Points and lines
+
+			// The samples inside the triangle seen from above, found with barycentric coordinates in the xz plane
+			CVector3 p0 = position(face.mIndices[0]), p1 = position(face.mIndices[1]), p2 = position(face.mIndices[2]);
+			float area = (p1.x - p0.x) * (p2.z - p0.z) - (p2.x - p0.x) * (p1.z - p0.z);
+			if (std::abs(area) < 1e-12f)  continue; // Edge on from above
+
+			auto toSample = [&](float value, float origin) { return (value - origin) / mSpacing; };
+			int minX = (std::max)(static_cast<int>(std::ceil (toSample((std::min)({ p0.x, p1.x, p2.x }), mOrigin.x) - 1e-3f)), 0);
+			int maxX = (std::min)(static_cast<int>(std::floor(toSample((std::max)({ p0.x, p1.x, p2.x }), mOrigin.x) + 1e-3f)), mResolution - 1);
+			int minZ = (std::max)(static_cast<int>(std::ceil (toSample((std::min)({ p0.z, p1.z, p2.z }), mOrigin.y) - 1e-3f)), 0);
+			int maxZ = (std::min)(static_cast<int>(std::floor(toSample((std::max)({ p0.z, p1.z, p2.z }), mOrigin.y) + 1e-3f)), mResolution - 1);
+			for (int z = minZ; z <= maxZ; ++z)
+			{
+				for (int x = minX; x <= maxX; ++x)
+				{
+					float px = mOrigin.x + x * mSpacing;
+					float pz = mOrigin.y + z * mSpacing;
+					float w1 = ((px - p0.x) * (p2.z - p0.z) - (p2.x - p0.x) * (pz - p0.z)) / area;
+					float w2 = ((p1.x - p0.x) * (pz - p0.z) - (px - p0.x) * (p1.z - p0.z)) / area;
+					float w0 = 1 - w1 - w2;
+					const float tolerance = -1e-4f; // Samples on a shared edge must not fall between the triangles
+					if (w0 < tolerance || w1 < tolerance || w2 < tolerance)  continue;
+
+					float& height = mHeights[z * mResolution + x];
+					height = (std::max)(height, w0 * p0.y + w1 * p1.y + w2 * p2.y);
+				}
+			}
+		}
+
+		// Least squares fit of u to x and v to z
+		if (mesh->HasTextureCoords(0))
+		{
+			for (unsigned int v = 0; v < mesh->mNumVertices; ++v)
+			{
+				double x = mesh->mVertices[v].x, z = mesh->mVertices[v].z;
+				double u = mesh->mTextureCoords[0][v].x, t = mesh->mTextureCoords[0][v].y;
+				sumX += x;  sumZ += z;  sumU += u;  sumV += t;
+				sumXU += x * u;  sumZV += z * t;  sumXX += x * x;  sumZZ += z * z;
+				++numUVs;
+			}
+		}
+	}
+
+	// Samples with no mesh over them (e.g. outside an irregular outline) are set to the lowest point
+	for (auto& height : mHeights)  if (height == -FLT_MAX)  height = mBounds.min.y;
+
+	if (numUVs > 1)
+	{
+		auto fit = [&](double sum, double sumT, double sumST, double sumSS, float& scale, float& offset)
+		{
+			double n = static_cast<double>(numUVs);
+			double denominator = n * sumSS - sum * sum;
+			if (std::abs(denominator) < 1e-12)  return;
+			scale  = static_cast<float>((n * sumST - sum * sumT) / denominator);
+			offset = static_cast<float>((sumT - scale * sum) / n);
+		};
+		fit(sumX, sumU, sumXU, sumXX, mUVScale.x, mUVOffset.x);
+		fit(sumZ, sumV, sumZV, sumZZ, mUVScale.y, mUVOffset.y);
+	}
+}
+
+
+// Lowest and highest height in each quadtree node, for the node bounding boxes. Level 0 nodes are the finest tiles, each level
+// above has half as many nodes across, made from four of the level below
+void Terrain::CalculateNodeHeights()
+{
+	int numNodes = (mResolution - 1) / mTileResolution;
+	mNodeHeights.resize(mNumLevels);
+	mNodeHeights[0].resize(numNodes * numNodes);
+	for (int nodeZ = 0; nodeZ < numNodes; ++nodeZ)
+	{
+		for (int nodeX = 0; nodeX < numNodes; ++nodeX)
+		{
+			CVector2 heights = { FLT_MAX, -FLT_MAX };
+			for (int z = nodeZ * mTileResolution; z <= (nodeZ + 1) * mTileResolution; ++z)
+			{
+				for (int x = nodeX * mTileResolution; x <= (nodeX + 1) * mTileResolution; ++x)
+				{
+					heights.x = (std::min)(heights.x, Sample(x, z));
+					heights.y = (std::max)(heights.y, Sample(x, z));
+				}
+			}
+			mNodeHeights[0][nodeZ * numNodes + nodeX] = heights;
+		}
+	}
+
+	for (int level = 1; level < mNumLevels; ++level)
+	{
+		int childNodes = numNodes;
+		numNodes /= 2;
+		mNodeHeights[level].resize(numNodes * numNodes);
+		for (int nodeZ = 0; nodeZ < numNodes; ++nodeZ)
+		{
+			for (int nodeX = 0; nodeX < numNodes; ++nodeX)
+			{
+				CVector2 heights = { FLT_MAX, -FLT_MAX };
+				for (int child = 0; child < 4; ++child)
+				{
+					const CVector2& childHeights = mNodeHeights[level - 1][(nodeZ * 2 + child / 2) * childNodes + nodeX * 2 + child % 2];
+					heights.x = (std::min)(heights.x, childHeights.x);
+					heights.y = (std::max)(heights.y, childHeights.y);
+				}
+				mNodeHeights[level][nodeZ * numNodes + nodeX] = heights;
+			}
+		}
+	}
+
+	// The top node covers everything
+	CVector2 heights = mNodeHeights[mNumLevels - 1][0];
+	mBounds.min = { mOrigin.x, heights.x, mOrigin.y };
+	mBounds.max = { mOrigin.x + (mResolution - 1) * mSpacing, heights.y, mOrigin.y + (mResolution - 1) * mSpacing };
+}
+
+
+// Create the height texture from the heights, one texel for each sample. It never changes
+// Will throw a std::runtime_error exception on failure
+void Terrain::CreateHeightTexture()
+{
+	D3D11_TEXTURE2D_DESC textureDesc = {};
+	textureDesc.Width            = mResolution;
+	textureDesc.Height           = mResolution;
+	textureDesc.MipLevels        = 1;
+	textureDesc.ArraySize        = 1;
+	textureDesc.Format           = DXGI_FORMAT_R32_FLOAT;
+	textureDesc.SampleDesc.Count = 1;
+	textureDesc.Usage            = D3D11_USAGE_IMMUTABLE;
+	textureDesc.BindFlags        = D3D11_BIND_SHADER_RESOURCE;
+	D3D11_SUBRESOURCE_DATA initialData = {};
+	initialData.pSysMem     = mHeights.data();
+	initialData.SysMemPitch = mResolution * sizeof(float);
+	if (FAILED(gD3DDevice->CreateTexture2D(&textureDesc, &initialData, &mHeightTexture)))
+		throw std::runtime_error("Error creating terrain height texture");
+
+	if (FAILED(gD3DDevice->CreateShaderResourceView(mHeightTexture, nullptr, &mHeightSRV)))
+		throw std::runtime_error("Error creating terrain height texture view");
+	SetDebugNames("Terrain Heights", mHeightTexture, mHeightSRV);
+	RegisterGpuResource(mHeightTexture, "Terrain");
+}
+
+
+// Recursively select tiles from the quadtree node at the given position (in heightfield samples) and level
+void Terrain::SelectTiles(int x, int z, int level)
+{
+	// Use this node as a tile if it is the finest level or if the camera is far enough away. Otherwise split into four
+	if (level == 0 || DistanceToNode(x, z, level) > mLodRanges[level - 1])
+	{
+		mTiles.push_back({ x, z, level });
+		return;
+	}
+
+	int childSize = mTileResolution << (level - 1);
+	SelectTiles(x,             z,             level - 1);
+	SelectTiles(x + childSize, z,             level - 1);
+	SelectTiles(x,             z + childSize, level - 1);
+	SelectTiles(x + childSize, z + childSize, level - 1);
+}
+
+
+// Box around a quadtree node, from the lowest to the highest height in it
+BoundingBox Terrain::NodeBounds(int x, int z, int level)
+{
+	int size = mTileResolution << level;
+	int numNodes = (mResolution - 1) / size;
+	const CVector2& heights = mNodeHeights[level][(z / size) * numNodes + x / size];
+
+	BoundingBox bounds;
+	bounds.min = { mOrigin.x + x * mSpacing,          heights.x, mOrigin.y + z * mSpacing };
+	bounds.max = { mOrigin.x + (x + size) * mSpacing, heights.y, mOrigin.y + (z + size) * mSpacing };
+	return bounds;
+}
+
+
+// Distance from the camera to the box around a quadtree node. The vertex shader measures morph distance to each vertex, which
+// is inside the box, so is never nearer than this
+float Terrain::DistanceToNode(int x, int z, int level)
+{
+	BoundingBox bounds = NodeBounds(x, z, level);
+	float dx = (std::max)((std::max)(bounds.min.x - mCameraPosition.x, mCameraPosition.x - bounds.max.x), 0.0f);
+	float dy = (std::max)((std::max)(bounds.min.y - mCameraPosition.y, mCameraPosition.y - bounds.max.y), 0.0f);
+	float dz = (std::max)((std::max)(bounds.min.z - mCameraPosition.z, mCameraPosition.z - bounds.max.z), 0.0f);
+	return std::sqrt(dx * dx + dy * dy + dz * dz);
+}
@@ -0,0 +1,147 @@
+//--------------------------------------------------------------------------------------
+// Class encapsulating a heightmap terrain drawn as quadtree chunks with levels of detail
+//--------------------------------------------------------------------------------------
+// The ground is a heightfield: a square grid of heights, sampled from a mesh when the terrain
+// is created and kept on the GPU as a texture. It is drawn as copies of a small bufferless grid
+// tile, chosen from a quadtree over the heightfield each frame in the same way as the water
+// clipmap (see WaterClipmap.h). The vertex shader reads the height of each vertex from the
+// texture and morphs the vertices at the outside of each ring of tiles onto the coarser grid
+// of the next, so the levels meet without cracks (see Terrain_vs.hlsl). Each pass culls the
+// tiles against its own view, which includes the water plane in the refraction and reflection
+// passes. So the vertex work depends on the terrain in view rather than the size of the level.
+//
+// The heights are also kept on the CPU, for collision and the depth of water over the ground.
+
+#include "CVector2.h"
+#include "CVector3.h"
+#include "Frustum.h"
+#include <d3d11.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#ifndef _TERRAIN_H_INCLUDED_
+#define _TERRAIN_H_INCLUDED_
+
+class Mesh;
+struct PerFrameConstants;
+
+class Terrain
+{
+//--------------------------------------------------------------------------------------
+// Construction / Usage
+//--------------------------------------------------------------------------------------
+public:
+
+	// Create a terrain from the given mesh file (any file assimp reads), which should be a heightfield - one surface seen from
+	// above, e.g. hills. The heights of the mesh are sampled on a grid of resolution x resolution points over its extent in x
+	// and z, resolution must be one more than tileResolution times a power of 2. Tiles are grids of tileResolution squares
+	// Will throw a std::runtime_error exception on failure (same as Mesh)
+	Terrain(const std::string& fileName, int resolution = 513, int tileResolution = 32);
+	~Terrain();
+
+
+	// Select the tiles to draw this frame from the given camera position. Call once per frame before rendering
+	void Update(const CVector3& cameraPosition);
+
+	// Render the tiles selected by the last call to Update that might be seen in the given frustum. Returns the number drawn
+	// Must be rendered with the terrain vertex shader (see Terrain_vs.hlsl) and the per-frame terrain constants (see
+	// SetTerrainConstants). All other per-frame constants must have been set already along with textures, states etc.
+	// A pass drawing two views at once (see WaterViews_gs.hlsl) passes the second view's frustum too, tiles in either are drawn
+	unsigned int Render(const Frustum& frustum, const Frustum* otherFrustum = nullptr);
+
+	// Set the terrain values in the given per-frame constants, used by the terrain vertex shader
+	void SetTerrainConstants(PerFrameConstants& constants);
+
+
+	// Height of the ground at the given point in the xz plane, matching the triangles drawn at full detail. Points outside the
+	// terrain get the height at the nearest edge
+	float Height(float x, float z);
+
+	// Depth of water at the given height over the given point of the ground, 0 if the ground is above the water there
+	float WaterDepth(float x, float z, float waterHeight)  { return (std::max)(waterHeight - Height(x, z), 0.0f); }
+
+	// Box and sphere around the whole terrain
+	const BoundingBox& Bounds()  { return mBounds; }
+	BoundingSphere Sphere()  { return SphereFromBox(mBounds); }
+
+
+	// Number of tiles selected by the last Update - useful to show in the stats
+	unsigned int NumTiles()  { return static_cast<unsigned int>(mTiles.size()); }
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions / data
+//--------------------------------------------------------------------------------------
+private:
+
+	// Distance (in tiles of a given level) at which tiles are replaced by the next coarser level, and the proportion of that
+	// range over which the vertices morph to the coarser grid. As for WaterClipmap, but the range factor is raised if the
+	// ground is steep enough to need it (see .cpp)
+	static constexpr float LodRangeFactor  = 4.5f;
+	static constexpr float MorphStartRatio = 0.66f;
+
+	// Sample the heights of the mesh in the given file onto the heightfield grid
+	void SampleMesh(const std::string& fileName);
+
+	// Lowest and highest height in each quadtree node, for the node bounding boxes
+	void CalculateNodeHeights();
+
+	// Create the height texture from the heights. Throws a std::runtime_error exception on failure
+	void CreateHeightTexture();
+
+	// Recursively select tiles from the quadtree node at the given position (in heightfield samples) and level
+	void SelectTiles(int x, int z, int level);
+
+	// Box around a quadtree node, and the distance from the camera to it
+	BoundingBox NodeBounds(int x, int z, int level);
+	float       DistanceToNode(int x, int z, int level);
+
+	// Height at a sample of the heightfield, clamped to the edges
+	float Sample(int x, int z)
+	{
+		x = (std::min)((std::max)(x, 0), mResolution - 1);
+		z = (std::min)((std::max)(z, 0), mResolution - 1);
+		return mHeights[z * mResolution + x];
+	}
+
+
+	struct Tile
+	{
+		int x, z; // Min corner of the tile in heightfield samples
+		int level;
+	};
+
+	Mesh* mTileMesh = nullptr; // Unit bufferless grid in XZ plane, (0,0) -> (1,1), scaled and positioned for each tile
+
+	int   mResolution;
+	int   mTileResolution;
+	int   mNumLevels;
+
+	// The heightfield, mResolution x mResolution heights in rows of increasing z. Sample (0,0) is at mOrigin, the others are
+	// mSpacing apart
+	std::vector<float> mHeights;
+	CVector2           mOrigin;
+	float              mSpacing = 1;
+	BoundingBox        mBounds;
+
+	// The mesh's UVs, fitted to a scale and offset of the x and z position. The terrain vertex shader makes them the same way
+	CVector2 mUVScale  = { 1, 1 };
+	CVector2 mUVOffset = { 0, 0 };
+
+	// Lowest and highest heights of the nodes of each level, in rows like the heights (level 0 is the finest)
+	std::vector<std::vector<CVector2>> mNodeHeights;
+
+	std::vector<float> mLodRanges;   // Camera distance beyond which a level's tiles are used (see SelectTiles)
+	std::vector<float> mMorphStarts; // Camera distance at which a level's tiles start morphing to the next level
+
+	ID3D11Texture2D*          mHeightTexture = nullptr;
+	ID3D11ShaderResourceView* mHeightSRV     = nullptr;
+
+	// Data from the last Update
+	CVector3 mCameraPosition;
+	std::vector<Tile> mTiles;
+};
+
+
+#endif //_TERRAIN_H_INCLUDED_
@@ -0,0 +1,89 @@
+//--------------------------------------------------------------------------------------
+// Heightmap terrain vertex shader
+//--------------------------------------------------------------------------------------
+// Draws a tile of the terrain (see Terrain.h) - a bufferless grid, the vertices are made from the vertex and instance IDs
+// and raised to the height in the terrain height map. Sends the same data as PixelLighting_vs so the usual lit pixel
+// shaders are used, including the refracted and reflected ones
+
+#include "Common.hlsli"
+
+
+//--------------------------------------------------------------------------------------
+// Textures
+//--------------------------------------------------------------------------------------
+
+// Heights of the terrain, one texel for each sample of the heightfield. Every vertex is exactly on a sample, so the heights
+// are read with Load rather than filtered
+Texture2D<float> TerrainHeightMap : register(t14); // The t14 must match the slot used in Terrain::Render
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+// Height at a sample of the heightfield, clamped to the edges
+float TerrainHeight(int2 sample)
+{
+	sample = clamp(sample, 0, (int)gTerrainResolution - 1);
+	return TerrainHeightMap.Load(int3(sample, 0));
+}
+
+// Normal at a sample of the heightfield, from the slope between its neighbours
+float3 TerrainNormal(int2 sample)
+{
+	float left  = TerrainHeight(sample + int2(-1, 0));
+	float right = TerrainHeight(sample + int2( 1, 0));
+	float back  = TerrainHeight(sample + int2(0, -1));
+	float front = TerrainHeight(sample + int2(0,  1));
+	return normalize(float3(left - right, 2 * gTerrainSpacing, back - front));
+}
+
+// World xz position of a point on the tile grid, given as a grid index (0 -> gGridResolution across the tile), and the
+// heightfield sample there
+float2 TileGridPosition(float2 gridIndex)
+{
+	return mul(gWorldMatrix, float4(gridIndex.x / gGridResolution, 0, gridIndex.y / gGridResolution, 1)).xz;
+}
+
+int2 HeightfieldSample(float2 worldXZ)
+{
+	return (int2)round((worldXZ - gTerrainOrigin) / gTerrainSpacing);
+}
+
+
+LightingPixelShaderInput main(uint vertexID : SV_VertexID, uint instanceID : SV_InstanceID)
+{
+	LightingPixelShaderInput output;
+
+	// Every other vertex (in x and z) of the tile is on the coarser grid of the next level, the others slide onto their
+	// neighbour as they get further from the camera, in the same way as the water clipmap (see WaterSurface_vs.hlsl)
+	float2 gridIndex   = round(GridVertexPosition(vertexID, instanceID).xz * gGridResolution);
+	float2 coarseIndex = gridIndex - fmod(gridIndex, 2);
+
+	float2 position       = TileGridPosition(gridIndex);
+	float2 coarsePosition = TileGridPosition(coarseIndex);
+	int2   sample         = HeightfieldSample(position);
+	int2   coarseSample   = HeightfieldSample(coarsePosition);
+
+	// The morph distance is to the vertex at its own height, which is inside the box Terrain::Update measures to
+	float  height = TerrainHeight(sample);
+	float  morph = saturate((distance(float3(position.x, height, position.y), gCameraPosition) - gMorphStart) / (gMorphEnd - gMorphStart));
+
+	position = lerp(position, coarsePosition, morph);
+	height   = lerp(height, TerrainHeight(coarseSample), morph);
+	float4 worldPosition = float4(position.x, height, position.y, 1);
+	output.worldNormal   = normalize(lerp(TerrainNormal(sample), TerrainNormal(coarseSample), morph));
+
+	// Use camera matrices to transform the vertex from world space into view space and finally into 2D "projection" space
+	float4 viewPosition      = mul(gViewMatrix, worldPosition);
+	output.projectedPosition = mul(gProjectionMatrix, viewPosition);
+	output.worldPosition     = worldPosition.xyz;
+
+	// Hardware clipping against the water for the refraction / reflection passes, nothing is clipped in other passes
+	output.clipDistance = dot(worldPosition, gWaterClipPlane);
+
+	// UVs the same as the mesh the terrain was made from (see Terrain.cpp)
+	output.uv = worldPosition.xz * gTerrainUVScale + gTerrainUVOffset;
+
+	return output;
+}
@@ -0,0 +1,667 @@
+//--------------------------------------------------------------------------------------
+// Texture cooking - converts image files to block compressed DDS files
+//--------------------------------------------------------------------------------------
+
+#include "TextureCooker.h"
+#include "MappedFile.h"
+#include "AssetArchive.h"
+#include "Common.h"
+
+#include <WICTextureLoader.h>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <fstream>
+#include <cstring>
+#include <cstdio>
+#include <cstdint>
+#include <cmath>
+
+
+//--------------------------------------------------------------------------------------
+// Block encoders
+//--------------------------------------------------------------------------------------
+// Each encoder compresses a block of 4x4 pixels, given as 16 RGBA values in row order
+
+namespace
+{
+	// Writes values into a 128-bit block a few bits at a time, lowest bits first (the order used by BC7)
+	class BitWriter
+	{
+	public:
+		BitWriter(uint8_t* block) : mBlock(block)  { memset(mBlock, 0, 16); }
+
+		void Write(unsigned int value, unsigned int numBits)
+		{
+			for (unsigned int bit = 0; bit < numBits; ++bit, ++mPos)
+			{
+				if (value & (1u << bit))  mBlock[mPos / 8] |= static_cast<uint8_t>(1u << (mPos % 8));
+			}
+		}
+
+	private:
+		uint8_t*     mBlock;
+		unsigned int mPos = 0;
+	};
+
+
+	// BC4 - one channel. Two 8-bit end values and a 3-bit index for each pixel. The first value is the larger, which
+	// selects the mode with 6 values between the ends
+	void EncodeBC4Block(const uint8_t pixels[16][4], int channel, uint8_t* block)
+	{
+		uint8_t minValue = 255, maxValue = 0;
+		for (int i = 0; i < 16; ++i)
+		{
+			minValue = (std::min)(minValue, pixels[i][channel]);
+			maxValue = (std::max)(maxValue, pixels[i][channel]);
+		}
+		block[0] = maxValue;
+		block[1] = minValue;
+
+		uint64_t indices = 0;
+		if (maxValue > minValue)
+		{
+			for (int i = 0; i < 16; ++i)
+			{
+				// Nearest of the 8 levels from min (0) to max (7). Index 0 is the max, 1 is the min and 2-7 go down from max
+				int level = ((pixels[i][channel] - minValue) * 14 + (maxValue - minValue)) / ((maxValue - minValue) * 2);
+				uint64_t index = (level == 7) ? 0 : (level == 0) ? 1 : 8 - level;
+				indices |= index << (3 * i);
+			}
+		}
+		for (int i = 0; i < 6; ++i)  block[2 + i] = static_cast<uint8_t>(indices >> (8 * i));
+	}
+
+
+	// BC5 - two channels, each stored as a BC4 block
+	void EncodeBC5Block(const uint8_t pixels[16][4], uint8_t* block)
+	{
+		EncodeBC4Block(pixels, 0, block);
+		EncodeBC4Block(pixels, 1, block + 8);
+	}
+
+
+	// BC7 mode 6 - a single line through RGBA space for the whole block. The two 7-bit RGBA end points each have an extra
+	// shared low bit (the "p-bit"), and each pixel has a 4-bit index choosing one of 16 points along the line
+	const int BC7Weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+	void EncodeBC7Block(const uint8_t pixels[16][4], uint8_t* block)
+	{
+		// The line follows the main direction of the colours (principal axis), found from their covariance by power iteration
+		float mean[4] = {};
+		for (int i = 0; i < 16; ++i)
+			for (int c = 0; c < 4; ++c)  mean[c] += pixels[i][c] / 16.0f;
+
+		float covariance[4][4] = {};
+		for (int i = 0; i < 16; ++i)
+			for (int a = 0; a < 4; ++a)
+				for (int b = 0; b < 4; ++b)  covariance[a][b] += (pixels[i][a] - mean[a]) * (pixels[i][b] - mean[b]);
+
+		float axis[4] = { 1, 1, 1, 1 };
+		for (int iteration = 0; iteration < 8; ++iteration)
+		{
+			float next[4] = {};
+			for (int a = 0; a < 4; ++a)
+				for (int b = 0; b < 4; ++b)  next[a] += covariance[a][b] * axis[b];
+			float length = std::sqrt(next[0] * next[0] + next[1] * next[1] + next[2] * next[2] + next[3] * next[3]);
+			if (length < 1e-6f)  break; // All pixels the same
+			for (int c = 0; c < 4; ++c)  axis[c] = next[c] / length;
+		}
+
+		// End points at the furthest pixels along the line
+		float minT = 0, maxT = 0;
+		for (int i = 0; i < 16; ++i)
+		{
+			float t = 0;
+			for (int c = 0; c < 4; ++c)  t += (pixels[i][c] - mean[c]) * axis[c];
+			minT = (std::min)(minT, t);
+			maxT = (std::max)(maxT, t);
+		}
+
+		// Quantise each end point to 7 bits per channel plus the p-bit that gives the smaller error
+		int endPoints[2][4]; // 8-bit values, including the p-bit
+		int pBits[2];
+		for (int e = 0; e < 2; ++e)
+		{
+			float t = (e == 0) ? minT : maxT;
+			int bestError = INT32_MAX;
+			for (int p = 0; p < 2; ++p)
+			{
+				int values[4];
+				int error = 0;
+				for (int c = 0; c < 4; ++c)
+				{
+					float target = (std::min)((std::max)(mean[c] + axis[c] * t, 0.0f), 255.0f);
+					int q = (std::min)((std::max)(static_cast<int>(std::lround((target - p) / 2)), 0), 127);
+					values[c] = (q << 1) | p;
+					error += static_cast<int>(std::abs(values[c] - target));
+				}
+				if (error < bestError)
+				{
+					bestError = error;
+					pBits[e] = p;
+					memcpy(endPoints[e], values, sizeof(values));
+				}
+			}
+		}
+
+		// Nearest of the 16 points on the line for each pixel
+		int indices[16];
+		for (int i = 0; i < 16; ++i)
+		{
+			int bestError = INT32_MAX;
+			for (int index = 0; index < 16; ++index)
+			{
+				int error = 0;
+				for (int c = 0; c < 4; ++c)
+				{
+					int value = ((64 - BC7Weights[index]) * endPoints[0][c] + BC7Weights[index] * endPoints[1][c] + 32) >> 6;
+					error += (value - pixels[i][c]) * (value - pixels[i][c]);
+				}
+				if (error < bestError)
+				{
+					bestError = error;
+					indices[i] = index;
+				}
+			}
+		}
+
+		// The top bit of the first index isn't stored, it must be 0. Swap the end points if it isn't
+		if (indices[0] & 8)
+		{
+			for (int c = 0; c < 4; ++c)  std::swap(endPoints[0][c], endPoints[1][c]);
+			std::swap(pBits[0], pBits[1]);
+			for (auto& index : indices)  index = 15 - index;
+		}
+
+		BitWriter writer(block);
+		writer.Write(1 << 6, 7); // Mode 6
+		for (int c = 0; c < 4; ++c)
+		{
+			writer.Write(endPoints[0][c] >> 1, 7);
+			writer.Write(endPoints[1][c] >> 1, 7);
+		}
+		writer.Write(pBits[0], 1);
+		writer.Write(pBits[1], 1);
+		writer.Write(indices[0], 3);
+		for (int i = 1; i < 16; ++i)  writer.Write(indices[i], 4);
+	}
+
+
+	// Bytes in each compressed block of a format
+	unsigned int BlockBytes(DXGI_FORMAT format)
+	{
+		return format == DXGI_FORMAT_BC4_UNORM ? 8 : 16;
+	}
+}
+
+
+//--------------------------------------------------------------------------------------
+// DDS files
+//--------------------------------------------------------------------------------------
+// The cooked files are standard DDS files with the "DX10" extended header, which is needed for BC4/5/7. The
+// header's reserved words hold an ID and the hash of the source the file was cooked from
+
+namespace
+{
+	const uint32_t DDSMagic = 0x20534444; // "DDS "
+	const uint32_t CookedTextureID = 0x4b4f4f43; // "COOK"
+	const uint32_t CookedTextureVersion = 1; // Increase if the encoders change, so files are cooked again
+	const uint32_t CookedArrayVersion   = 1; // Increase if the way texture arrays are packed changes
+
+	struct DDSPixelFormat
+	{
+		uint32_t size;
+		uint32_t flags;
+		uint32_t fourCC;
+		uint32_t rgbBitCount;
+		uint32_t rBitMask, gBitMask, bBitMask, aBitMask;
+	};
+
+	struct DDSHeader
+	{
+		uint32_t       size;
+		uint32_t       flags;
+		uint32_t       height;
+		uint32_t       width;
+		uint32_t       pitchOrLinearSize;
+		uint32_t       depth;
+		uint32_t       mipMapCount;
+		uint32_t       reserved1[11]; // Cooked texture ID, source hash (2 words) and version, the rest 0
+		DDSPixelFormat pixelFormat;
+		uint32_t       caps, caps2, caps3, caps4;
+		uint32_t       reserved2;
+	};
+
+	struct DDSHeaderDX10
+	{
+		uint32_t dxgiFormat;
+		uint32_t resourceDimension;
+		uint32_t miscFlag;
+		uint32_t arraySize;
+		uint32_t miscFlags2;
+	};
+
+
+	// Whether a cooked file exists and was cooked from a source with the given hash
+	bool IsCookedFileUpToDate(const std::string& fileName, uint64_t sourceHash)
+	{
+		AssetFile file(fileName);
+		if (!file.IsOpen() || file.Size() < sizeof(DDSMagic) + sizeof(DDSHeader))  return false;
+
+		DDSHeader header;
+		memcpy(&header, file.Data() + sizeof(DDSMagic), sizeof(header));
+		return header.reserved1[0] == CookedTextureID && header.reserved1[3] == CookedTextureVersion &&
+		       (header.reserved1[1] | (static_cast<uint64_t>(header.reserved1[2]) << 32)) == sourceHash;
+	}
+
+
+	// An RGBA8 image with its mip-maps
+	struct Image
+	{
+		unsigned int width;
+		unsigned int height;
+		std::vector<std::vector<uint8_t>> mips; // 4 bytes per pixel, no padding between rows
+	};
+
+	unsigned int MipWidth (const Image& image, unsigned int mip)  { return (std::max)(image.width  >> mip, 1u); }
+	unsigned int MipHeight(const Image& image, unsigned int mip)  { return (std::max)(image.height >> mip, 1u); }
+
+
+	// Compress an image to a DDS file, taking the cooked texture's channels from the image channels chosen
+	bool WriteCookedFile(const Image& image, const CookedTextureDesc& cooked, uint64_t sourceHash)
+	{
+		unsigned int blockBytes = BlockBytes(cooked.format);
+
+		DDSHeader header = {};
+		header.size   = sizeof(DDSHeader);
+		header.flags  = 0x1 | 0x2 | 0x4 | 0x1000 | 0x20000 | 0x80000; // Caps, height, width, pixel format, mip count, linear size
+		header.height = image.height;
+		header.width  = image.width;
+		header.pitchOrLinearSize = ((image.width + 3) / 4) * ((image.height + 3) / 4) * blockBytes;
+		header.mipMapCount  = static_cast<uint32_t>(image.mips.size());
+		header.reserved1[0] = CookedTextureID;
+		header.reserved1[1] = static_cast<uint32_t>(sourceHash);
+		header.reserved1[2] = static_cast<uint32_t>(sourceHash >> 32);
+		header.reserved1[3] = CookedTextureVersion;
+		header.pixelFormat.size   = sizeof(DDSPixelFormat);
+		header.pixelFormat.flags  = 0x4; // Four CC
+		header.pixelFormat.fourCC = 0x30315844; // "DX10"
+		header.caps = 0x1000 | 0x400000 | 0x8; // Texture, mip-maps, complex
+
+		DDSHeaderDX10 header10 = {};
+		header10.dxgiFormat        = cooked.format;
+		header10.resourceDimension = D3D11_RESOURCE_DIMENSION_TEXTURE2D;
+		header10.arraySize         = 1;
+
+		std::ofstream file(cooked.fileName, std::ios::binary);
+		if (!file)  return false;
+		file.write(reinterpret_cast<const char*>(&DDSMagic), sizeof(DDSMagic));
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(reinterpret_cast<const char*>(&header10), sizeof(header10));
+
+		std::vector<uint8_t> blocks;
+		for (unsigned int mip = 0; mip < image.mips.size(); ++mip)
+		{
+			unsigned int width  = MipWidth (image, mip);
+			unsigned int height = MipHeight(image, mip);
+			unsigned int blocksX = (width + 3) / 4;
+			unsigned int blocksY = (height + 3) / 4;
+			blocks.resize(blocksX * blocksY * blockBytes);
+
+			for (unsigned int by = 0; by < blocksY; ++by)
+			{
+				for (unsigned int bx = 0; bx < blocksX; ++bx)
+				{
+					// Gather the block's pixels - mip-maps smaller than 4x4 repeat their edge pixels to fill the block
+					uint8_t pixels[16][4];
+					for (unsigned int i = 0; i < 16; ++i)
+					{
+						unsigned int x = (std::min)(bx * 4 + i % 4, width  - 1);
+						unsigned int y = (std::min)(by * 4 + i / 4, height - 1);
+						const uint8_t* source = &image.mips[mip][(y * width + x) * 4];
+						for (int c = 0; c < 4; ++c)
+						{
+							int channel = cooked.channels[c];
+							pixels[i][c] = (channel >= 0) ? source[channel] : (c == 3 ? 255 : 0);
+						}
+					}
+
+					uint8_t* block = &blocks[(by * blocksX + bx) * blockBytes];
+					if      (cooked.format == DXGI_FORMAT_BC7_UNORM)  EncodeBC7Block(pixels, block);
+					else if (cooked.format == DXGI_FORMAT_BC5_UNORM)  EncodeBC5Block(pixels, block);
+					else                                              EncodeBC4Block(pixels, 0, block);
+				}
+			}
+			file.write(reinterpret_cast<const char*>(blocks.data()), blocks.size());
+		}
+		return file.good();
+	}
+
+
+	// Decode an image file with WIC, using the GPU to make its mip-maps, and read it back. Only 8-bit RGBA / BGRA
+	// images are supported, which covers the usual JPEG and PNG files
+	bool ReadImage(const std::string& fileName, Image& image)
+	{
+		AssetFile file(fileName);
+		if (!file.IsOpen())  return false;
+		ID3D11Resource* resource = nullptr;
+		if (FAILED(DirectX::CreateWICTextureFromMemory(gD3DDevice, gD3DImmediateContext, file.Data(), file.Size(), &resource, nullptr)))
+		{
+			return false;
+		}
+		ID3D11Texture2D* texture = nullptr;
+		HRESULT hr = resource->QueryInterface(__uuidof(ID3D11Texture2D), reinterpret_cast<void**>(&texture));
+		resource->Release();
+		if (FAILED(hr))  return false;
+
+		D3D11_TEXTURE2D_DESC desc;
+		texture->GetDesc(&desc);
+		bool bgra = (desc.Format == DXGI_FORMAT_B8G8R8A8_UNORM || desc.Format == DXGI_FORMAT_B8G8R8A8_UNORM_SRGB);
+		bool rgba = (desc.Format == DXGI_FORMAT_R8G8B8A8_UNORM || desc.Format == DXGI_FORMAT_R8G8B8A8_UNORM_SRGB);
+		if ((!rgba && !bgra) || desc.Width % 4 != 0 || desc.Height % 4 != 0) // Block compressed textures must be a multiple of 4 in size
+		{
+			texture->Release();
+			return false;
+		}
+
+		// Copy to a texture the CPU can read
+		desc.Usage          = D3D11_USAGE_STAGING;
+		desc.BindFlags      = 0;
+		desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+		desc.MiscFlags      = 0;
+		ID3D11Texture2D* staging = nullptr;
+		hr = gD3DDevice->CreateTexture2D(&desc, nullptr, &staging);
+		if (FAILED(hr))
+		{
+			texture->Release();
+			return false;
+		}
+		gD3DImmediateContext->CopyResource(staging, texture);
+		texture->Release();
+
+		image.width  = desc.Width;
+		image.height = desc.Height;
+		image.mips.resize(desc.MipLevels);
+		bool ok = true;
+		for (unsigned int mip = 0; mip < desc.MipLevels && ok; ++mip)
+		{
+			D3D11_MAPPED_SUBRESOURCE mapped;
+			ok = SUCCEEDED(gD3DImmediateContext->Map(staging, mip, D3D11_MAP_READ, 0, &mapped));
+			if (!ok)  break;
+
+			unsigned int width  = MipWidth (image, mip);
+			unsigned int height = MipHeight(image, mip);
+			image.mips[mip].resize(width * height * 4);
+			for (unsigned int y = 0; y < height; ++y)
+			{
+				const uint8_t* row = static_cast<const uint8_t*>(mapped.pData) + y * mapped.RowPitch;
+				memcpy(&image.mips[mip][y * width * 4], row, width * 4);
+			}
+			gD3DImmediateContext->Unmap(staging, mip);
+
+			if (bgra)
+			{
+				for (unsigned int i = 0; i < width * height; ++i)  std::swap(image.mips[mip][i * 4], image.mips[mip][i * 4 + 2]);
+			}
+		}
+		staging->Release();
+		return ok;
+	}
+}
+
+
+//--------------------------------------------------------------------------------------
+// Reading DDS files
+//--------------------------------------------------------------------------------------
+
+// Bytes in a mip-map of the given size in one of the formats ReadDDSTexture accepts
+size_t MipBytes(DXGI_FORMAT format, unsigned int width, unsigned int height)
+{
+	switch (format)
+	{
+		case DXGI_FORMAT_BC1_UNORM: case DXGI_FORMAT_BC4_UNORM:
+			return static_cast<size_t>((width + 3) / 4) * ((height + 3) / 4) * 8;
+		case DXGI_FORMAT_BC2_UNORM: case DXGI_FORMAT_BC3_UNORM: case DXGI_FORMAT_BC5_UNORM: case DXGI_FORMAT_BC7_UNORM:
+			return static_cast<size_t>((width + 3) / 4) * ((height + 3) / 4) * 16;
+		default:
+			return static_cast<size_t>(width) * height * 4;
+	}
+}
+
+// Read the header of a DDS file with a single 2D texture in one of the formats the app uses: the block compressed formats
+// and 8-bit RGBA / BGRA. Cube maps, volumes and arrays aren't accepted. Returns false if the file isn't one of those
+// The texture's data points into the file, which must be kept open while it is used
+bool ReadDDSTexture(const AssetFile& file, DDSTexture& texture)
+{
+	if (!file.IsOpen() || file.Size() < sizeof(DDSMagic) + sizeof(DDSHeader))  return false;
+	uint32_t magic;
+	DDSHeader header;
+	memcpy(&magic, file.Data(), sizeof(magic));
+	memcpy(&header, file.Data() + sizeof(DDSMagic), sizeof(header));
+	if (magic != DDSMagic || header.size != sizeof(DDSHeader) || (header.caps2 & (0x200 | 0x200000)) != 0)  return false; // Cube map, volume
+
+	size_t offset = sizeof(DDSMagic) + sizeof(DDSHeader);
+	const DDSPixelFormat& pixelFormat = header.pixelFormat;
+	texture.format = DXGI_FORMAT_UNKNOWN;
+	if (pixelFormat.flags & 0x4) // Four CC
+	{
+		switch (pixelFormat.fourCC)
+		{
+			case 0x31545844: texture.format = DXGI_FORMAT_BC1_UNORM; break; // "DXT1"
+			case 0x33545844: texture.format = DXGI_FORMAT_BC2_UNORM; break; // "DXT3"
+			case 0x35545844: texture.format = DXGI_FORMAT_BC3_UNORM; break; // "DXT5"
+			case 0x30315844: // "DX10", the format is in the extended header
+			{
+				DDSHeaderDX10 header10;
+				if (file.Size() < offset + sizeof(header10))  return false;
+				memcpy(&header10, file.Data() + offset, sizeof(header10));
+				offset += sizeof(header10);
+				if (header10.resourceDimension != D3D11_RESOURCE_DIMENSION_TEXTURE2D || header10.arraySize != 1 ||
+				    (header10.miscFlag & D3D11_RESOURCE_MISC_TEXTURECUBE) != 0)  return false;
+				texture.format = static_cast<DXGI_FORMAT>(header10.dxgiFormat);
+				break;
+			}
+		}
+	}
+	else if ((pixelFormat.flags & 0x40) && pixelFormat.rgbBitCount == 32) // RGB
+	{
+		bool alpha = (pixelFormat.flags & 0x1) != 0;
+		if      (pixelFormat.rBitMask == 0x00ff0000 && pixelFormat.bBitMask == 0x000000ff)  texture.format = alpha ? DXGI_FORMAT_B8G8R8A8_UNORM : DXGI_FORMAT_B8G8R8X8_UNORM;
+		else if (pixelFormat.rBitMask == 0x000000ff && pixelFormat.bBitMask == 0x00ff0000 && alpha)  texture.format = DXGI_FORMAT_R8G8B8A8_UNORM;
+	}
+	switch (texture.format)
+	{
+		case DXGI_FORMAT_BC1_UNORM: case DXGI_FORMAT_BC2_UNORM: case DXGI_FORMAT_BC3_UNORM: case DXGI_FORMAT_BC4_UNORM:
+		case DXGI_FORMAT_BC5_UNORM: case DXGI_FORMAT_BC7_UNORM:
+		case DXGI_FORMAT_B8G8R8A8_UNORM: case DXGI_FORMAT_B8G8R8X8_UNORM: case DXGI_FORMAT_R8G8B8A8_UNORM:
+			break;
+		default:
+			return false;
+	}
+
+	texture.width   = header.width;
+	texture.height  = header.height;
+	texture.numMips = (header.flags & 0x20000) ? (std::max)(header.mipMapCount, 1u) : 1;
+	texture.data    = file.Data() + offset;
+	texture.dataSize = 0;
+	for (unsigned int mip = 0; mip < texture.numMips; ++mip)
+	{
+		texture.dataSize += MipBytes(texture.format, (std::max)(texture.width >> mip, 1u), (std::max)(texture.height >> mip, 1u));
+	}
+	return texture.width > 0 && texture.height > 0 && file.Size() >= offset + texture.dataSize;
+}
+
+
+namespace
+{
+	// Scale up a mip-map of 4 bytes per pixel to the given size, filtering each channel bilinearly
+	void UpscaleMip(const unsigned char* source, unsigned int sourceWidth, unsigned int sourceHeight,
+	                unsigned int width, unsigned int height, std::vector<uint8_t>& result)
+	{
+		result.resize(static_cast<size_t>(width) * height * 4);
+		for (unsigned int y = 0; y < height; ++y)
+		{
+			float sy = (std::max)((y + 0.5f) * sourceHeight / height - 0.5f, 0.0f);
+			unsigned int y0 = (std::min)(static_cast<unsigned int>(sy), sourceHeight - 1);
+			unsigned int y1 = (std::min)(y0 + 1, sourceHeight - 1);
+			float fy = sy - y0;
+			for (unsigned int x = 0; x < width; ++x)
+			{
+				float sx = (std::max)((x + 0.5f) * sourceWidth / width - 0.5f, 0.0f);
+				unsigned int x0 = (std::min)(static_cast<unsigned int>(sx), sourceWidth - 1);
+				unsigned int x1 = (std::min)(x0 + 1, sourceWidth - 1);
+				float fx = sx - x0;
+				for (int c = 0; c < 4; ++c)
+				{
+					float top    = source[(y0 * sourceWidth + x0) * 4 + c] * (1 - fx) + source[(y0 * sourceWidth + x1) * 4 + c] * fx;
+					float bottom = source[(y1 * sourceWidth + x0) * 4 + c] * (1 - fx) + source[(y1 * sourceWidth + x1) * 4 + c] * fx;
+					result[(static_cast<size_t>(y) * width + x) * 4 + c] = static_cast<uint8_t>(top * (1 - fy) + bottom * fy + 0.5f);
+				}
+			}
+		}
+	}
+}
+
+
+//--------------------------------------------------------------------------------------
+// Cooking
+//--------------------------------------------------------------------------------------
+
+// Make sure the given cooked files are up to date with the source image, cooking them if not. Returns false if the
+// source can't be read or cooked, e.g. its size isn't a multiple of 4 (required for block compression)
+// Decodes the source with the immediate context - the caller must make sure no other thread uses it at the same time
+bool CookTexture(const std::string& sourceFileName, const CookedTextureDesc* cooked, unsigned int numCooked)
+{
+	uint64_t fileHash;
+	{
+		AssetFile sourceFile(sourceFileName);
+		if (!sourceFile.IsOpen())  return false;
+		fileHash = HashData(sourceFile.Data(), sourceFile.Size());
+	}
+
+	// Each cooked file's hash also covers how it is made from the source
+	std::vector<uint64_t> hashes(numCooked);
+	bool upToDate = true;
+	for (unsigned int i = 0; i < numCooked; ++i)
+	{
+		hashes[i] = fileHash ^ HashData(&cooked[i].format, sizeof(cooked[i].format)) ^ HashData(cooked[i].channels, sizeof(cooked[i].channels));
+		upToDate = IsCookedFileUpToDate(cooked[i].fileName, hashes[i]) && upToDate;
+	}
+	if (upToDate)  return true;
+
+	Image image;
+	if (!ReadImage(sourceFileName, image))  return false;
+	for (unsigned int i = 0; i < numCooked; ++i)
+	{
+		if (!WriteCookedFile(image, cooked[i], hashes[i]))
+		{
+			std::remove(cooked[i].fileName.c_str()); // Don't leave a partly written file
+			return false;
+		}
+		AssetFileWritten(cooked[i].fileName);
+	}
+	return true;
+}
+
+
+// Pack DDS textures of the same format into one DDS file holding a texture array, one source in each layer. Returns false if
+// a source can't be read or they can't be packed together
+bool CookTextureArray(const std::string& arrayFileName, const std::string* sourceFileNames, unsigned int numSources)
+{
+	if (numSources < 2)  return false;
+
+	// The sources stay mapped while the array is written
+	std::vector<std::unique_ptr<AssetFile>> files;
+	std::vector<DDSTexture> sources(numSources);
+	std::vector<uint64_t>   hashes(numSources + 1);
+	for (unsigned int i = 0; i < numSources; ++i)
+	{
+		files.emplace_back(new AssetFile(sourceFileNames[i]));
+		if (!ReadDDSTexture(*files.back(), sources[i]))  return false;
+		hashes[i] = HashData(files.back()->Data(), files.back()->Size());
+	}
+	hashes[numSources] = CookedArrayVersion;
+	uint64_t sourceHash = HashData(hashes.data(), hashes.size() * sizeof(uint64_t)); // Changes if the sources are reordered
+	if (IsCookedFileUpToDate(arrayFileName, sourceHash))  return true;
+
+	// The layers are the size of the largest source. Smaller ones must be smaller by a power of two in both directions, and
+	// can only be scaled up when they aren't block compressed
+	DXGI_FORMAT  format  = sources[0].format;
+	unsigned int width   = 0;
+	unsigned int height  = 0;
+	for (const DDSTexture& source : sources)
+	{
+		if (source.format != format)  return false;
+		width  = (std::max)(width,  source.width);
+		height = (std::max)(height, source.height);
+	}
+	bool blocks = format != DXGI_FORMAT_B8G8R8A8_UNORM && format != DXGI_FORMAT_B8G8R8X8_UNORM && format != DXGI_FORMAT_R8G8B8A8_UNORM;
+	unsigned int numMips = 1;
+	while ((width >> numMips) > 0 || (height >> numMips) > 0)  ++numMips; // Full chain of mip-maps down to 1x1
+
+	std::vector<unsigned int> scaledMips(numSources); // Mip-maps of each layer made by scaling up the source
+	for (unsigned int i = 0; i < numSources; ++i)
+	{
+		const DDSTexture& source = sources[i];
+		unsigned int scaled = 0;
+		while ((width >> scaled) > source.width)  ++scaled;
+		if ((width >> scaled) != source.width || (std::max)(height >> scaled, 1u) != source.height)  return false;
+		if (scaled > 0 && blocks)  return false;
+		if (source.numMips < numMips - scaled)  return false; // Needs all of its own mip-maps
+		scaledMips[i] = scaled;
+	}
+
+	DDSHeader header = {};
+	header.size   = sizeof(DDSHeader);
+	header.flags  = 0x1 | 0x2 | 0x4 | 0x1000 | 0x20000 | (blocks ? 0x80000 : 0x8); // Caps, height, width, pixel format, mip count, linear size / pitch
+	header.height = height;
+	header.width  = width;
+	header.pitchOrLinearSize = static_cast<uint32_t>(blocks ? MipBytes(format, width, height) : width * 4);
+	header.mipMapCount  = numMips;
+	header.reserved1[0] = CookedTextureID;
+	header.reserved1[1] = static_cast<uint32_t>(sourceHash);
+	header.reserved1[2] = static_cast<uint32_t>(sourceHash >> 32);
+	header.reserved1[3] = CookedTextureVersion;
+	header.pixelFormat.size   = sizeof(DDSPixelFormat);
+	header.pixelFormat.flags  = 0x4; // Four CC
+	header.pixelFormat.fourCC = 0x30315844; // "DX10"
+	header.caps = 0x1000 | 0x400000 | 0x8; // Texture, mip-maps, complex
+
+	DDSHeaderDX10 header10 = {};
+	header10.dxgiFormat        = format;
+	header10.resourceDimension = D3D11_RESOURCE_DIMENSION_TEXTURE2D;
+	header10.arraySize         = numSources;
+
+	bool written;
+	{
+		std::ofstream file(arrayFileName, std::ios::binary);
+		if (!file)  return false;
+		file.write(reinterpret_cast<const char*>(&DDSMagic), sizeof(DDSMagic));
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(reinterpret_cast<const char*>(&header10), sizeof(header10));
+
+		// Each layer is a whole chain of mip-maps, one layer after another. A source scaled up gives its largest mip-map for
+		// each of the layer's larger ones, then the rest of its own
+		std::vector<uint8_t> upscaled;
+		for (unsigned int i = 0; i < numSources; ++i)
+		{
+			const DDSTexture& source = sources[i];
+			for (unsigned int mip = 0; mip < scaledMips[i]; ++mip)
+			{
+				UpscaleMip(source.data, source.width, source.height, (std::max)(width >> mip, 1u), (std::max)(height >> mip, 1u), upscaled);
+				file.write(reinterpret_cast<const char*>(upscaled.data()), upscaled.size());
+			}
+			size_t bytes = 0;
+			for (unsigned int mip = scaledMips[i]; mip < numMips; ++mip)
+			{
+				bytes += MipBytes(format, (std::max)(width >> mip, 1u), (std::max)(height >> mip, 1u));
+			}
+			file.write(reinterpret_cast<const char*>(source.data), bytes);
+		}
+		written = file.good();
+	}
+	if (written)  AssetFileWritten(arrayFileName);
+	else          std::remove(arrayFileName.c_str()); // Don't leave a partly written file
+	return written;
+}
@@ -0,0 +1,75 @@
+//--------------------------------------------------------------------------------------
+// Texture cooking - converts image files to block compressed DDS files
+//--------------------------------------------------------------------------------------
+// JPEG and PNG files are decoded on the CPU when they are loaded and take 4 bytes per pixel on
+// the GPU. Block compressed formats take 1 byte per pixel or less and are sampled from directly
+// in compressed form, so they are faster to sample as well as smaller. The first time an image
+// is loaded it is "cooked" into one or more DDS files next to the original, with a full chain of
+// mip-maps, and later runs load those instead (same as cooked meshes, see Mesh.cpp). A hash of
+// the source file is kept in each cooked file so it is cooked again if the source changes.
+// DDS textures can also be packed together into a texture array in the same way.
+//
+// Formats supported:
+// - BC7: colour with alpha, 1 byte per pixel. Only the single subset mode is used, which is
+//        simple to encode and a large step up in quality from BC1 / BC3
+// - BC5: two channels, 1 byte per pixel, e.g. the x and y of a normal (z is rebuilt in the shader)
+// - BC4: one channel, 0.5 bytes per pixel, e.g. a height map
+
+#include <d3d11.h>
+#include <string>
+
+#ifndef _TEXTURE_COOKER_H_INCLUDED_
+#define _TEXTURE_COOKER_H_INCLUDED_
+
+class AssetFile;
+
+
+// How one cooked file is made from the source image. Each channel of the cooked texture takes its value from a channel
+// of the source (0-3 for r, g, b, a), or -1 to leave it empty (0, or 255 for alpha)
+struct CookedTextureDesc
+{
+	std::string fileName;
+	DXGI_FORMAT format;      // DXGI_FORMAT_BC7_UNORM, DXGI_FORMAT_BC5_UNORM or DXGI_FORMAT_BC4_UNORM
+	int         channels[4];
+};
+
+
+// Make sure the given cooked files are up to date with the source image, cooking them if not. Returns false if the
+// source can't be read or cooked, e.g. its size isn't a multiple of 4 (required for block compression)
+// Decodes the source with the immediate context - the caller must make sure no other thread uses it at the same time
+// (see LoadTexture)
+bool CookTexture(const std::string& sourceFileName, const CookedTextureDesc* cooked, unsigned int numCooked);
+
+
+// Pack DDS textures of the same format into one DDS file holding a texture array, one source in each layer, so models with
+// different textures can share one texture and be drawn together (see Material.h). The array is cooked again when a source
+// changes. The layers are the size of the largest source - a smaller source must be smaller by a power of two and is scaled
+// up for the larger mip-maps, which only works when it isn't block compressed. Every source needs its full chain of mip-maps
+// Needs at least two sources, a DDS file of one texture is loaded as a plain texture rather than an array. Returns false if
+// a source can't be read or they can't be packed together. Doesn't use the immediate context
+bool CookTextureArray(const std::string& arrayFileName, const std::string* sourceFileNames, unsigned int numSources);
+
+
+// A DDS file holding a single 2D texture, as read by ReadDDSTexture. Its data is each mip-map in turn from the largest, with
+// no padding between the rows (of 4x4 blocks for the block compressed formats)
+struct DDSTexture
+{
+	DXGI_FORMAT          format;
+	unsigned int         width;
+	unsigned int         height;
+	unsigned int         numMips;
+	const unsigned char* data;
+	size_t               dataSize;
+};
+
+// Read the header of a DDS file with a single 2D texture in one of the formats the app uses: the block compressed formats
+// and 8-bit RGBA / BGRA. Cube maps, volumes and arrays aren't accepted. Returns false if the file isn't one of those
+// The texture's data points into the file, which must be kept open while it is used. Used to read the mip-maps of streamed
+// textures without making the texture (see TextureStreamer.cpp)
+bool ReadDDSTexture(const AssetFile& file, DDSTexture& texture);
+
+// Bytes in a mip-map of the given size in one of the formats ReadDDSTexture accepts
+size_t MipBytes(DXGI_FORMAT format, unsigned int width, unsigned int height);
+
+
+#endif //_TEXTURE_COOKER_H_INCLUDED_
@@ -0,0 +1,365 @@
+//--------------------------------------------------------------------------------------
+// Texture streaming - loads textures a part at a time as they are needed
+//--------------------------------------------------------------------------------------
+
+#include "TextureStreamer.h"
+#include "GpuMemory.h"
+#include "GpuEvents.h"
+#include "GraphicsHelpers.h"
+#include "TextureCooker.h"
+#include "AssetArchive.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+
+
+TextureStreamer* gTextureStreamer;
+
+
+//--------------------------------------------------------------------------------------
+// Helper functions
+//--------------------------------------------------------------------------------------
+
+// Get the GPU memory used by a texture (bytes) and its width or height, whichever is larger
+static void TextureInfo(ID3D11Resource* texture, size_t& bytes, unsigned int& size)
+{
+	bytes = 0;
+	size  = 0;
+	ID3D11Texture2D* texture2D = nullptr;
+	if (FAILED(texture->QueryInterface(__uuidof(ID3D11Texture2D), reinterpret_cast<void**>(&texture2D))))  return;
+	D3D11_TEXTURE2D_DESC desc;
+	texture2D->GetDesc(&desc);
+	texture2D->Release();
+
+	size  = (std::max)(desc.Width, desc.Height);
+	bytes = GpuResourceBytes(texture);
+}
+
+
+// Smallest power of two at least as large as the given value
+static unsigned int NextPowerOfTwo(float value)
+{
+	unsigned int size = 1;
+	while (size < value && size < (1u << 31))  size <<= 1;
+	return size;
+}
+
+
+// Whether a file name has the DDS extension (case insensitive)
+static bool IsDDSFile(const std::string& fileName)
+{
+	std::string dds = ".dds";
+	return fileName.size() >= 4 &&
+	       std::equal(dds.rbegin(), dds.rend(), fileName.rbegin(), [](unsigned char a, unsigned char b) { return std::tolower(a) == std::tolower(b); });
+}
+
+
+// Read the mip-maps no larger than the given size from a DDS file and make an empty texture for them, to be filled in by the
+// uploader (see GpuUploader.h). Returns false if the file can't be read this way or has no mip-maps small enough
+static bool ReadTextureMips(const std::string& fileName, unsigned int size, StreamedTexture::Load& load)
+{
+	AssetFile file(fileName);
+	DDSTexture dds;
+	if (!ReadDDSTexture(file, dds))  return false;
+
+	// Skip the mip-maps larger than the size, the same as LoadTexture does
+	unsigned int firstMip = 0;
+	size_t       firstOffset = 0;
+	while (firstMip < dds.numMips && ((std::max)(dds.width >> firstMip, 1u) > size || (std::max)(dds.height >> firstMip, 1u) > size))
+	{
+		firstOffset += MipBytes(dds.format, (std::max)(dds.width >> firstMip, 1u), (std::max)(dds.height >> firstMip, 1u));
+		++firstMip;
+	}
+	if (firstMip == dds.numMips)  return false;
+
+	D3D11_TEXTURE2D_DESC textureDesc = {};
+	textureDesc.Width  = (std::max)(dds.width  >> firstMip, 1u);
+	textureDesc.Height = (std::max)(dds.height >> firstMip, 1u);
+	textureDesc.MipLevels = dds.numMips - firstMip;
+	textureDesc.ArraySize = 1;
+	textureDesc.Format = dds.format;
+	textureDesc.SampleDesc.Count = 1;
+	textureDesc.Usage = D3D11_USAGE_DEFAULT;
+	textureDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+	ID3D11Texture2D* texture = nullptr;
+	if (FAILED(gD3DDevice->CreateTexture2D(&textureDesc, nullptr, &texture)))  return false;
+	if (FAILED(gD3DDevice->CreateShaderResourceView(texture, nullptr, &load.textureSRV)))
+	{
+		texture->Release();
+		return false;
+	}
+	load.texture = texture;
+	SetDebugNames(fileName, load.texture, load.textureSRV);
+
+	// Copy the mip-maps out of the file, which is closed when the load finishes. A single row of a mip-map gives the bytes in a
+	// row of pixels, or of blocks
+	load.data = std::make_shared<const std::vector<uint8_t>>(dds.data + firstOffset, dds.data + dds.dataSize);
+	size_t offset = 0;
+	for (unsigned int mip = firstMip; mip < dds.numMips; ++mip)
+	{
+		unsigned int width  = (std::max)(dds.width  >> mip, 1u);
+		unsigned int height = (std::max)(dds.height >> mip, 1u);
+		load.mips.push_back({ offset, static_cast<unsigned int>(MipBytes(dds.format, width, 1)) });
+		offset += MipBytes(dds.format, width, height);
+	}
+	return true;
+}
+
+
+// Load a texture no larger than the given size, used on a background thread. Only DDS files are streamed so WIC (and
+// the COM initialisation it needs) is never used here. Files ReadTextureMips doesn't accept are made with their data
+static StreamedTexture::Load LoadTextureSize(std::string fileName, unsigned int size)
+{
+	StreamedTexture::Load load;
+	if (ReadTextureMips(fileName, size, load))  return load;
+	if (!LoadTexture(fileName, &load.texture, &load.textureSRV, size))
+	{
+		if (load.textureSRV)  load.textureSRV->Release();
+		if (load.texture)     load.texture->Release();
+		load.textureSRV = nullptr;
+		load.texture    = nullptr;
+	}
+	return load;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Streamed texture
+//--------------------------------------------------------------------------------------
+
+// Report the size in pixels the texture covers on screen where it is drawn. The largest size reported by any pass
+// during a frame decides the size of texture wanted. Can be called from several threads at once
+void StreamedTexture::RequestSize(float pixels)
+{
+	unsigned int size = NextPowerOfTwo(pixels * mRepeats);
+	unsigned int current = mRequestedSize.load();
+	while (size > current && !mRequestedSize.compare_exchange_weak(current, size)) {}
+}
+
+
+//--------------------------------------------------------------------------------------
+// Construction / Usage
+//--------------------------------------------------------------------------------------
+
+// The budget is the most GPU memory (in bytes) all the streamed textures can use between them
+TextureStreamer::TextureStreamer(size_t budget /*= DefaultBudget*/)
+	: mBudget(budget)
+{
+}
+
+// Waits for any loads in progress
+TextureStreamer::~TextureStreamer()
+{
+	for (auto& texture : mTextures)
+	{
+		if (texture->mLoad.valid())
+		{
+			StreamedTexture::Load load = texture->mLoad.get();
+			if (load.textureSRV)  load.textureSRV->Release();
+			if (load.texture)     load.texture->Release();
+		}
+		CancelUpload(*texture);
+		Evict(*texture);
+		if (texture->mLowSRV)  texture->mLowSRV->Release();
+		if (texture->mLow)     texture->mLow->Release();
+	}
+}
+
+
+// Add a texture to be streamed, loading its small version (up to MinSize) now. Can be called from several threads at once
+// Returns nullptr if the file can't be loaded or isn't a DDS file
+StreamedTexture* TextureStreamer::AddTexture(const std::string& fileName, float repeats /*= 1*/)
+{
+	if (!IsDDSFile(fileName))  return nullptr;
+
+	std::unique_ptr<StreamedTexture> texture(new StreamedTexture);
+	texture->mFileName = fileName;
+	texture->mRepeats  = repeats;
+	bool loaded = LoadTexture(fileName, &texture->mLow, &texture->mLowSRV, MinSize);
+	if (!loaded)
+	{
+		// A file without mip-maps can't be loaded smaller, so it can't be streamed. Load all of it instead
+		if (texture->mLowSRV)  texture->mLowSRV->Release();
+		if (texture->mLow)     texture->mLow->Release();
+		texture->mLowSRV = nullptr;
+		texture->mLow    = nullptr;
+		loaded = LoadTexture(fileName, &texture->mLow, &texture->mLowSRV);
+	}
+	if (!loaded)
+	{
+		if (texture->mLowSRV)  texture->mLowSRV->Release();
+		if (texture->mLow)     texture->mLow->Release();
+		return nullptr;
+	}
+	TextureInfo(texture->mLow, texture->mLowBytes, texture->mLowSize);
+	RegisterGpuResource(texture->mLow, "Streamed Textures");
+	if (texture->mLowSize != MinSize)  texture->mFullSize = texture->mLowSize; // Already have all of it
+
+	std::lock_guard<std::mutex> lock(mTexturesMutex);
+	mUsedBytes += texture->mLowBytes;
+	mTextures.push_back(std::move(texture));
+	return mTextures.back().get();
+}
+
+
+// Call once per frame on the main thread before rendering: switches to any larger versions that have finished
+// loading, then starts loads for the textures that were drawn larger than they are, dropping others to fit the budget
+void TextureStreamer::Update()
+{
+	++mFrame;
+
+	// Finished loads. Their mip-maps are given to the uploader, and the texture switches to the new version once they have
+	// all been copied. The GPU makes the copies before this frame's passes, so the new version can be used straight away
+	for (auto& texturePtr : mTextures)
+	{
+		StreamedTexture& texture = *texturePtr;
+		if (texture.mUploading != nullptr)
+		{
+			if (!gGpuUploader->IsPending(&texture))
+			{
+				FinishLoad(texture, texture.mUploading, texture.mUploadingSRV);
+				texture.mUploading    = nullptr;
+				texture.mUploadingSRV = nullptr;
+			}
+			continue;
+		}
+		if (!texture.mLoad.valid() || texture.mLoad.wait_for(std::chrono::seconds(0)) != std::future_status::ready)  continue;
+
+		StreamedTexture::Load load = texture.mLoad.get();
+		if (load.data == nullptr)
+		{
+			FinishLoad(texture, load.texture, load.textureSRV);
+			continue;
+		}
+		for (unsigned int mip = 0; mip < load.mips.size(); ++mip)
+		{
+			gGpuUploader->UploadTexture(&texture, static_cast<ID3D11Texture2D*>(load.texture), mip,
+			                            load.data, load.mips[mip].offset, load.mips[mip].rowPitch);
+		}
+		texture.mUploading    = load.texture;
+		texture.mUploadingSRV = load.textureSRV;
+	}
+
+	// Sizes wanted from the last frame's rendering. A texture that wasn't drawn keeps what it has until space is needed
+	for (auto& texturePtr : mTextures)
+	{
+		StreamedTexture& texture = *texturePtr;
+		unsigned int requested = texture.mRequestedSize.exchange(0);
+		if (requested == 0)  continue;
+
+		texture.mWantedSize = (std::min)((std::max)(requested, MinSize), MaxSize);
+		if (texture.mFullSize != 0)  texture.mWantedSize = (std::min)(texture.mWantedSize, texture.mFullSize);
+		texture.mLastUsedFrame = mFrame;
+	}
+
+	// Start loads for the textures furthest below the size they want first
+	while (mLoadsInProgress < MaxLoadsInProgress)
+	{
+		StreamedTexture* next = nullptr;
+		float nextRatio = 1;
+		for (auto& texturePtr : mTextures)
+		{
+			StreamedTexture& texture = *texturePtr;
+			if (texture.mLoad.valid() || texture.mUploading != nullptr || texture.mLastUsedFrame != mFrame)  continue;
+			float ratio = static_cast<float>(texture.mWantedSize) / texture.ResidentSize();
+			if (ratio > nextRatio)
+			{
+				next = &texture;
+				nextRatio = ratio;
+			}
+		}
+		if (next == nullptr)  break;
+
+		// Estimate the memory needed from the small version, memory goes up with the square of the size. Space is needed
+		// for the old and new large versions at the same time while the new one loads
+		float  scale = static_cast<float>(next->mWantedSize) / next->mLowSize;
+		size_t bytes = static_cast<size_t>(next->mLowBytes * scale * scale);
+		if (!MakeSpace(bytes, next))
+		{
+			// Won't fit. Try again next frame, other textures may have gone out of use by then
+			next->mWantedSize = next->ResidentSize();
+			continue;
+		}
+
+		next->mLoadSize  = next->mWantedSize;
+		next->mLoadBytes = bytes;
+		next->mLoad = std::async(std::launch::async, LoadTextureSize, next->mFileName, next->mLoadSize);
+		mUsedBytes += bytes;
+		++mLoadsInProgress;
+	}
+}
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions
+//--------------------------------------------------------------------------------------
+
+// Drop the larger version of a texture
+void TextureStreamer::Evict(StreamedTexture& texture)
+{
+	if (texture.mHighSRV)  texture.mHighSRV->Release();
+	if (texture.mHigh)     texture.mHigh->Release();
+	texture.mHighSRV = nullptr;
+	texture.mHigh    = nullptr;
+	mUsedBytes -= texture.mHighBytes;
+	texture.mHighBytes = 0;
+	texture.mHighSize  = 0;
+}
+
+
+// Switch a texture to the larger version given, or stop trying to load more of it if there isn't one. The old version can
+// be released straight away, DirectX keeps it until the GPU has finished with it
+void TextureStreamer::FinishLoad(StreamedTexture& texture, ID3D11Resource* newTexture, ID3D11ShaderResourceView* newTextureSRV)
+{
+	--mLoadsInProgress;
+	mUsedBytes -= texture.mLoadBytes;
+	if (newTexture == nullptr)
+	{
+		// Can't load any more of this texture, stop trying
+		texture.mFullSize = texture.ResidentSize();
+		return;
+	}
+
+	Evict(texture);
+	texture.mHigh    = newTexture;
+	texture.mHighSRV = newTextureSRV;
+	TextureInfo(texture.mHigh, texture.mHighBytes, texture.mHighSize);
+	RegisterGpuResource(texture.mHigh, "Streamed Textures");
+	mUsedBytes += texture.mHighBytes;
+
+	// Loaders won't go beyond the size in the file, so asking for more has found the full size
+	if (texture.mHighSize < texture.mLoadSize)  texture.mFullSize = texture.mHighSize;
+}
+
+
+// Drop the larger version waiting for its mip-maps to be uploaded, if there is one
+void TextureStreamer::CancelUpload(StreamedTexture& texture)
+{
+	if (texture.mUploading == nullptr)  return;
+	if (gGpuUploader != nullptr)  gGpuUploader->Cancel(&texture);
+	texture.mUploadingSRV->Release();
+	texture.mUploading->Release();
+	texture.mUploadingSRV = nullptr;
+	texture.mUploading    = nullptr;
+}
+
+
+// Drop the larger versions of the least recently used textures until the given number of bytes fits in the budget.
+// Textures drawn in the last frame are not dropped. Returns false if there isn't enough space even then
+bool TextureStreamer::MakeSpace(size_t bytes, StreamedTexture* except)
+{
+	while (mUsedBytes + bytes > mBudget)
+	{
+		StreamedTexture* oldest = nullptr;
+		for (auto& texturePtr : mTextures)
+		{
+			StreamedTexture& texture = *texturePtr;
+			if (&texture == except || texture.mHigh == nullptr || texture.mLastUsedFrame == mFrame)  continue;
+			if (oldest == nullptr || texture.mLastUsedFrame < oldest->mLastUsedFrame)  oldest = &texture;
+		}
+		if (oldest == nullptr)  return false;
+		Evict(*oldest);
+	}
+	return true;
+}
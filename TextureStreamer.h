@@ -0,0 +1,183 @@
+//--------------------------------------------------------------------------------------
+// Texture streaming - loads textures a part at a time as they are needed
+//--------------------------------------------------------------------------------------
+// Loading every texture at full size takes time at startup and GPU memory whether or not the
+// textures are ever seen up close. Streamed textures start with only their small mip-maps
+// loaded, which is quick. Each frame the passes that draw a texture report how large it
+// appears on screen, and larger versions are loaded on background threads when needed. The
+// total memory used is kept under a fixed budget - when a load wouldn't fit, the large versions
+// of the textures used least recently are dropped, falling back to their small mip-maps.
+//
+// Only DDS files can be streamed, as their mip-maps are stored in the file. Other files need the
+// immediate context to make their mip-maps, which a background thread can't use while rendering.
+//
+// The small version of each texture is always kept, so there is always something to draw and
+// dropping a large version is instant. Switching to a new version only happens in Update, before
+// the passes are rendered, so passes on several threads can safely use the textures (see SRV).
+//
+// The background threads only read the mip-maps from the file and make an empty texture. The
+// mip-maps are copied into it over the following frames by the uploader (see GpuUploader.h), a
+// few megabytes each frame, so a large texture arriving doesn't make the frame it arrives in slow.
+
+#include "GpuUploader.h"
+#include <d3d11.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <future>
+#include <atomic>
+#include <mutex>
+
+#ifndef _TEXTURE_STREAMER_H_INCLUDED_
+#define _TEXTURE_STREAMER_H_INCLUDED_
+
+
+//--------------------------------------------------------------------------------------
+// Streamed texture
+//--------------------------------------------------------------------------------------
+
+class StreamedTexture
+{
+public:
+	// The texture to use in shaders, the largest version loaded so far. Only changes in TextureStreamer::Update
+	ID3D11ShaderResourceView* SRV()  { return mHighSRV != nullptr ? mHighSRV : mLowSRV; }
+
+	// Report the size in pixels the texture covers on screen where it is drawn. The largest size reported by any pass
+	// during a frame decides the size of texture wanted. Can be called from several threads at once
+	void RequestSize(float pixels);
+
+	// Width or height (the larger) of the texture currently used
+	unsigned int ResidentSize()  { return mHighSRV != nullptr ? mHighSize : mLowSize; }
+
+private:
+	friend class TextureStreamer;
+
+	// The result of loading a larger version of the texture on a background thread. The texture is made empty and its mip-maps
+	// are given to the uploader, unless there is no data - files the DDS reader doesn't accept (see ReadDDSTexture) are made
+	// with their data as they are loaded
+	struct Load
+	{
+		ID3D11Resource*           texture = nullptr;
+		ID3D11ShaderResourceView* textureSRV = nullptr;
+
+		struct Mip
+		{
+			size_t       offset;   // In the data
+			unsigned int rowPitch; // Bytes in a row of pixels, or of 4x4 blocks for block compressed textures
+		};
+		GpuUploader::Data data;
+		std::vector<Mip>  mips;
+	};
+
+	std::string mFileName;
+
+	// Number of times the texture repeats across the surface of its model, texels needed = pixels on screen * repeats
+	float mRepeats = 1;
+
+	// Small version, loaded when the texture is added and kept until the texture is released
+	ID3D11Resource*           mLow = nullptr;
+	ID3D11ShaderResourceView* mLowSRV = nullptr;
+	unsigned int              mLowSize = 0;
+	size_t                    mLowBytes = 0;
+
+	// Larger version streamed in, null if the small version is being used
+	ID3D11Resource*           mHigh = nullptr;
+	ID3D11ShaderResourceView* mHighSRV = nullptr;
+	unsigned int              mHighSize = 0;
+	size_t                    mHighBytes = 0;
+
+	// Size of the texture in its file, 0 until it is known - a load asking for more than the file has finds it out
+	unsigned int mFullSize = 0;
+
+	// Largest size asked for by RequestSize since the last Update, and the frame it was last asked for (for LRU eviction)
+	std::atomic<unsigned int> mRequestedSize{ 0 };
+	unsigned int              mWantedSize = 0;
+	unsigned int              mLastUsedFrame = 0;
+
+	// Larger version loaded and waiting for its mip-maps to be uploaded, null if none. Replaces the current larger version
+	// once they all have been
+	ID3D11Resource*           mUploading = nullptr;
+	ID3D11ShaderResourceView* mUploadingSRV = nullptr;
+
+	// Load in progress, if any. It stays in progress until its mip-maps have been uploaded
+	std::future<Load> mLoad;
+	unsigned int      mLoadSize = 0;
+	size_t            mLoadBytes = 0; // Estimate, counted against the budget until the load finishes
+};
+
+
+//--------------------------------------------------------------------------------------
+// Streamer
+//--------------------------------------------------------------------------------------
+
+class TextureStreamer
+{
+//--------------------------------------------------------------------------------------
+// Construction / Usage
+//--------------------------------------------------------------------------------------
+public:
+
+	// The budget is the most GPU memory (in bytes) all the streamed textures can use between them. The small versions of
+	// the textures count towards it but are never dropped, so the budget can be exceeded if it is smaller than those
+	TextureStreamer(size_t budget = DefaultBudget);
+	~TextureStreamer(); // Waits for any loads in progress
+
+
+	// Add a texture to be streamed, loading its small version (up to MinSize) now. Repeats is the number of times the
+	// texture repeats across the model that uses it (e.g. a tiled ground texture), as that needs more texels on screen
+	// Can be called from several threads at once. Returns nullptr if the file can't be loaded or isn't a DDS file
+	StreamedTexture* AddTexture(const std::string& fileName, float repeats = 1);
+
+	// Call once per frame on the main thread before rendering: switches to any larger versions that have finished
+	// loading, then starts loads for the textures that were drawn larger than they are, dropping others to fit the budget
+	void Update();
+
+
+	// Memory used by the textures, including the loads in progress, and the budget for them (bytes)
+	size_t UsedBytes()  { return mUsedBytes; }
+	size_t Budget()     { return mBudget; }
+
+	// Number of loads in progress
+	unsigned int LoadsInProgress()  { return mLoadsInProgress; }
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions / data
+//--------------------------------------------------------------------------------------
+private:
+
+	static constexpr size_t       DefaultBudget = 64 * 1024 * 1024;
+	static constexpr unsigned int MinSize = 128;   // Size of the small versions loaded at the start
+	static constexpr unsigned int MaxSize = 16384; // Largest a texture can be in DirectX 11
+
+	// Loads are run one after another rather than all at once, so streaming doesn't take too much time from rendering
+	static constexpr unsigned int MaxLoadsInProgress = 2;
+
+	// Drop the larger version of a texture
+	void Evict(StreamedTexture& texture);
+
+	// Switch a texture to the larger version given, or stop trying to load more of it if there isn't one
+	void FinishLoad(StreamedTexture& texture, ID3D11Resource* newTexture, ID3D11ShaderResourceView* newTextureSRV);
+
+	// Drop the larger version waiting for its mip-maps to be uploaded, if there is one
+	void CancelUpload(StreamedTexture& texture);
+
+	// Drop the larger versions of the least recently used textures until the given number of bytes fits in the budget.
+	// Textures drawn in the last frame are not dropped. Returns false if there isn't enough space even then
+	bool MakeSpace(size_t bytes, StreamedTexture* except);
+
+	std::vector<std::unique_ptr<StreamedTexture>> mTextures;
+	std::mutex                                    mTexturesMutex; // For AddTexture
+
+	size_t       mBudget;
+	size_t       mUsedBytes = 0;
+	unsigned int mLoadsInProgress = 0;
+	unsigned int mFrame = 0;
+};
+
+
+// The streamer used by the scene, created in InitGeometry (see Scene.cpp)
+extern TextureStreamer* gTextureStreamer;
+
+
+#endif //_TEXTURE_STREAMER_H_INCLUDED_
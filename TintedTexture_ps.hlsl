@@ -1,7 +1,8 @@
 //--------------------------------------------------------------------------------------
 // Light Model Pixel Shader
 //--------------------------------------------------------------------------------------
-// Pixel shader simply samples a diffuse texture map and tints with a fixed colour sent over from the CPU via a constant buffer
+// Pixel shader simply samples a diffuse texture map and tints with a fixed colour from the vertex shader (the object colour
+// sent over from the CPU via a constant buffer, or an instance colour - see InstancedTransform_vs)
 
 #include "Common.hlsli" // Shaders can also use include files - note the extension
 
@@ -24,14 +25,14 @@ SamplerState StandardFilter : register(s0); // Filtering used on most textures (
 
 // Pixel shader entry point
 // This shader just samples a diffuse texture map and tints it to a fixed colour
-float4 main(SimplePixelShaderInput input) : SV_Target
+float4 main(TintedPixelShaderInput input) : SV_Target
 {
     // Sample diffuse material colour for this pixel from a texture using a given sampler that you set up in the C++ code
     // Ignoring any alpha in the texture, just reading RGB
     float3 diffuseMapColour = DiffuseMap.Sample(StandardFilter, input.uv).rgb;
 
     // Blend texture colour with fixed per-object colour
-    float3 finalColour = gObjectColour * diffuseMapColour;
+    float3 finalColour = input.tint * diffuseMapColour;
 
     return float4(finalColour, 1.0f); // Always use 1.0f for alpha - no alpha blending in this lab
 }
\ No newline at end of file
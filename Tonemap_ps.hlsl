@@ -0,0 +1,49 @@
+//--------------------------------------------------------------------------------------
+// Tonemap Pixel Shader
+//--------------------------------------------------------------------------------------
+// Turns the HDR scene into the colours written to the back buffer. The scene is scaled by the exposure and the blurred bloom
+// added, then a filmic curve maps any brightness into the 0->1 range the screen can show. The curve rolls off gently
+// towards white, so bright parts (the lights and their reflections in the water) keep some detail instead of clipping
+
+#include "PostProcess.hlsli"
+
+
+//--------------------------------------------------------------------------------------
+// Textures (texture maps)
+//--------------------------------------------------------------------------------------
+
+Texture2D    SceneMap         : register(t0);
+Texture2D    AdaptedLuminance : register(t1); // Single texel, see AdaptExposure_cs
+Texture2D    BloomMap         : register(t2); // Half size, see BloomBlur_ps
+SamplerState LinearFilter : register(s0);
+
+
+//--------------------------------------------------------------------------------------
+// Helper functions
+//--------------------------------------------------------------------------------------
+
+// Fitted approximation of the ACES filmic curve (Krzysztof Narkowicz). Maps 0->infinity into 0->1
+float3 FilmicToneCurve(float3 colour)
+{
+	return saturate((colour * (2.51f * colour + 0.03f)) / (colour * (2.43f * colour + 0.59f) + 0.14f));
+}
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+float4 main(PostProcessPixelShaderInput input) : SV_Target
+{
+	// Same size as the viewport, but only part of it may have been rendered to (dynamic resolution). Filtering scales that part
+	// up to the viewport, and is the same as reading each pixel when it is all rendered to
+	float3 sceneColour = SceneMap.SampleLevel(LinearFilter, SceneUV(input.uv, SceneMap), 0).rgb;
+	sceneColour *= Exposure(AdaptedLuminance.Load(int3(0, 0, 0)).r);
+
+	[branch] if (gBloomStrength > 0)
+	{
+		sceneColour += BloomMap.SampleLevel(LinearFilter, input.uv, 0).rgb * gBloomStrength;
+	}
+
+	return float4(FilmicToneCurve(sceneColour), 1);
+}
@@ -0,0 +1,47 @@
+//--------------------------------------------------------------------------------------
+// Underwater Fog Pixel Shader
+//--------------------------------------------------------------------------------------
+// With the camera under the water, everything in the main pass is seen through water. Rather than fog every lit shader, the
+// water's extinction and scattering are applied to the whole scene afterwards in one full-screen pass, from the distance to
+// each pixel found from the depth buffer. The same tint as the refraction of the water seen from above is used: red, green
+// and blue light fade over the distances in WaterExtinction, towards the colour of the particulates in the water
+// The result is blended into the scene with dual-source blending (see gUnderwaterFogBlendingState) so each colour channel
+// can fade by its own amount without a copy of the scene
+
+#include "Common.hlsli"
+#include "PostProcess.hlsli" // For the input from PostProcess_vs, the post-processing constants aren't used
+
+
+//--------------------------------------------------------------------------------------
+// Textures (texture maps)
+//--------------------------------------------------------------------------------------
+
+Texture2D<float> SceneDepthMap : register(t6); // The main depth buffer, or its copy with MSAA (see RenderUnderwaterFog in Scene.cpp)
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+struct UnderwaterFogOutput
+{
+	float4 inScattered   : SV_Target0; // Added to the scene
+	float4 transmittance : SV_Target1; // Multiplies the scene
+};
+
+UnderwaterFogOutput main(PostProcessPixelShaderInput input)
+{
+	// Distance along the view ray from the view depth. The viewport is the part of the scene rendered to this frame
+	float  depth = SceneDepthMap.Load(int3(input.projectedPosition.xy, 0));
+	float  viewDepth = gProjectionMatrix[2][3] / (depth - gProjectionMatrix[2][2]);
+	float2 ndc = float2(input.projectedPosition.x / gViewportWidth * 2 - 1, 1 - input.projectedPosition.y / gViewportHeight * 2);
+	float3 viewRay = float3(ndc.x / gProjectionMatrix[0][0], ndc.y / gProjectionMatrix[1][1], 1);
+	float  distance = viewDepth * length(viewRay);
+
+	float3 fog = saturate(distance / WaterExtinction);
+
+	UnderwaterFogOutput output;
+	output.inScattered   = float4(normalize(WaterExtinction) * WaterDiffuseLevel * fog, 0);
+	output.transmittance = float4(1 - fog, 1);
+	return output;
+}
@@ -0,0 +1,133 @@
+//--------------------------------------------------------------------------------------
+// Upscale Pixel Shader
+//--------------------------------------------------------------------------------------
+// Scales the tonemapped scene, rendered to a smaller part of its texture (dynamic resolution or a render scale below 1), up
+// to the viewport. Bilinear filtering blurs edges and makes them stair-step. This filter (after AMD's FidelityFX Super
+// Resolution 1 "EASU") finds the direction and strength of the edge at each pixel from the brightness of the 12 source texels
+// around it, then filters them with a Lanczos-like kernel stretched along the edge and narrowed across it, so edges stay sharp
+// and smooth. The result is kept within the 4 nearest texels, so the kernel's negative lobes don't ring around edges
+// Works on the tonemapped colours rather than the HDR scene, the filter is tuned for values in the 0->1 range
+
+#include "PostProcess.hlsli"
+
+
+//--------------------------------------------------------------------------------------
+// Textures (texture maps)
+//--------------------------------------------------------------------------------------
+
+Texture2D SourceMap : register(t0); // Tonemapped scene, the part gSceneUVScale of it rendered to
+
+
+//--------------------------------------------------------------------------------------
+// Helper functions
+//--------------------------------------------------------------------------------------
+
+// Brightness used to find edges, green counts most as in Luminance but this is cheaper
+float EdgeLuma(float3 colour)
+{
+	return colour.r * 0.5f + colour.g + colour.b * 0.5f;
+}
+
+// Add the direction and length of the edge at one of the 4 texels nearest the pixel, weighted by how near it is. The
+// brightnesses are of the texel (c) and the texels above (a), left (b), right (d) and below (e) it
+void AddEdge(inout float2 direction, inout float edgeLength, float weight, float a, float b, float c, float d, float e)
+{
+	// Change across the texel, and how one-sided it is: 1 for an edge (the change all on one side), 0 for a line or flat
+	float dirX = d - b;
+	float lenX = saturate(abs(dirX) / max(max(abs(d - c), abs(c - b)), 1.0f / 65536));
+	float dirY = e - a;
+	float lenY = saturate(abs(dirY) / max(max(abs(e - c), abs(c - a)), 1.0f / 65536));
+	direction += float2(dirX, dirY) * weight;
+	edgeLength += (lenX * lenX + lenY * lenY) * weight;
+}
+
+// Add a source texel at the given offset from the pixel, filtered with the kernel rotated to the edge direction and
+// stretched by the given amounts along and across it. The kernel reaches as far as the clip distance (squared)
+void AddTap(inout float3 colourTotal, inout float weightTotal, float2 offset, float2 direction, float2 stretch,
+            float lobe, float clip, float3 colour)
+{
+	float2 rotated = float2(dot(offset, direction), dot(offset, float2(-direction.y, direction.x))) * stretch;
+	float distanceSquared = min(dot(rotated, rotated), clip);
+
+	// Lanczos 2 approximated with polynomials: (25/16 (2/5 x^2 - 1)^2 - (25/16 - 1)) (lobe x^2 - 1)^2. The lobe sets the
+	// depth of the negative part, from 0.5 (Lanczos 2) down to about 0.21 on strong edges
+	float base   = 0.4f * distanceSquared - 1;
+	float window = lobe * distanceSquared - 1;
+	float weight = (25.0f / 16 * base * base - (25.0f / 16 - 1)) * (window * window);
+	colourTotal += colour * weight;
+	weightTotal += weight;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+float4 main(PostProcessPixelShaderInput input) : SV_Target
+{
+	// The source texels around the pixel, f is the nearest above and left of it:
+	//      b c
+	//    e f g h
+	//    i j k l
+	//      n o
+	float2 textureSize;
+	SourceMap.GetDimensions(textureSize.x, textureSize.y);
+	float2 sourceSize = textureSize * gSceneUVScale;
+	int2   lastTexel  = int2(sourceSize + 0.5f) - 1;
+
+	float2 position = input.uv * sourceSize - 0.5f;
+	int2   f        = int2(floor(position));
+	float2 fraction = position - f;
+
+	#define TEXEL(x, y) SourceMap.Load(int3(clamp(f + int2(x, y), 0, lastTexel), 0)).rgb
+	float3 b = TEXEL( 0, -1), c = TEXEL( 1, -1);
+	float3 e = TEXEL(-1,  0), fc = TEXEL( 0, 0), g = TEXEL(1, 0), h = TEXEL(2, 0);
+	float3 i = TEXEL(-1,  1), j = TEXEL( 0,  1), k = TEXEL(1, 1), l = TEXEL(2, 1);
+	float3 n = TEXEL( 0,  2), o = TEXEL( 1,  2);
+	#undef TEXEL
+
+	float bL = EdgeLuma(b), cL = EdgeLuma(c);
+	float eL = EdgeLuma(e), fL = EdgeLuma(fc), gL = EdgeLuma(g), hL = EdgeLuma(h);
+	float iL = EdgeLuma(i), jL = EdgeLuma(j), kL = EdgeLuma(k), lL = EdgeLuma(l);
+	float nL = EdgeLuma(n), oL = EdgeLuma(o);
+
+	// Edge at the pixel, blended bilinearly from the 4 nearest texels
+	float2 direction  = 0;
+	float  edgeLength = 0;
+	AddEdge(direction, edgeLength, (1 - fraction.x) * (1 - fraction.y), bL, eL, fL, gL, jL);
+	AddEdge(direction, edgeLength,      fraction.x  * (1 - fraction.y), cL, fL, gL, hL, kL);
+	AddEdge(direction, edgeLength, (1 - fraction.x) *      fraction.y,  fL, iL, jL, kL, nL);
+	AddEdge(direction, edgeLength,      fraction.x  *      fraction.y,  gL, jL, kL, lL, oL);
+
+	// No direction in flat areas, the kernel is round there
+	float directionSquared = dot(direction, direction);
+	direction = directionSquared < 1.0f / 32768 ? float2(1, 0) : direction * rsqrt(directionSquared);
+
+	// Stretch the kernel along the edge, more for diagonal edges which cross more texels, and narrow it across
+	edgeLength = edgeLength * 0.5f;
+	edgeLength *= edgeLength;
+	float  diagonal = 1 / max(abs(direction.x), abs(direction.y));
+	float2 stretch  = float2(1 + (diagonal - 1) * edgeLength, 1 - 0.5f * edgeLength);
+	float  lobe     = 0.5f - 0.29f * edgeLength;
+	float  clip     = 1 / lobe;
+
+	float3 colourTotal = 0;
+	float  weightTotal = 0;
+	AddTap(colourTotal, weightTotal, float2( 0, -1) - fraction, direction, stretch, lobe, clip, b);
+	AddTap(colourTotal, weightTotal, float2( 1, -1) - fraction, direction, stretch, lobe, clip, c);
+	AddTap(colourTotal, weightTotal, float2(-1,  0) - fraction, direction, stretch, lobe, clip, e);
+	AddTap(colourTotal, weightTotal, float2( 0,  0) - fraction, direction, stretch, lobe, clip, fc);
+	AddTap(colourTotal, weightTotal, float2( 1,  0) - fraction, direction, stretch, lobe, clip, g);
+	AddTap(colourTotal, weightTotal, float2( 2,  0) - fraction, direction, stretch, lobe, clip, h);
+	AddTap(colourTotal, weightTotal, float2(-1,  1) - fraction, direction, stretch, lobe, clip, i);
+	AddTap(colourTotal, weightTotal, float2( 0,  1) - fraction, direction, stretch, lobe, clip, j);
+	AddTap(colourTotal, weightTotal, float2( 1,  1) - fraction, direction, stretch, lobe, clip, k);
+	AddTap(colourTotal, weightTotal, float2( 2,  1) - fraction, direction, stretch, lobe, clip, l);
+	AddTap(colourTotal, weightTotal, float2( 0,  2) - fraction, direction, stretch, lobe, clip, n);
+	AddTap(colourTotal, weightTotal, float2( 1,  2) - fraction, direction, stretch, lobe, clip, o);
+
+	// Keep within the nearest texels, which stops ringing
+	float3 minColour = min(min(fc, g), min(j, k));
+	float3 maxColour = max(max(fc, g), max(j, k));
+	return float4(clamp(colourTotal / weightTotal, minColour, maxColour), 1);
+}
@@ -0,0 +1,53 @@
+//--------------------------------------------------------------------------------------
+// Counts heap allocations made with new - used to check the render loop doesn't allocate
+//--------------------------------------------------------------------------------------
+
+#include "AllocationCounter.h"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// Atomic as libraries (e.g. the graphics driver) may allocate from other threads
+static std::atomic<uint64_t> gAllocationCount{ 0 }; // Constant initialised, so ready before any other globals are constructed
+
+// The counter selected on each thread (see AllocationScope). A plain pointer, so it needs no construction on a new thread
+static thread_local std::atomic<uint64_t>* tAllocationCounter = nullptr;
+
+
+// Number of allocations made with new (including std containers, strings etc.) since the program started
+uint64_t AllocationCount()
+{
+	return gAllocationCount.load(std::memory_order_relaxed);
+}
+
+
+// Select the counter that the calling thread's allocations are added to as well as the total, nullptr for none. Returns the
+// one selected before, to put back
+std::atomic<uint64_t>* SelectAllocationCounter(std::atomic<uint64_t>* counter)
+{
+	std::atomic<uint64_t>* previous = tAllocationCounter;
+	tAllocationCounter = counter;
+	return previous;
+}
+
+// The counter selected on the calling thread, nullptr if there is none
+std::atomic<uint64_t>* SelectedAllocationCounter()
+{
+	return tAllocationCounter;
+}
+
+
+// Replacement global new / delete. The other forms of new and delete (arrays, nothrow, sized) call these by default
+void* operator new(std::size_t size)
+{
+	gAllocationCount.fetch_add(1, std::memory_order_relaxed);
+	if (tAllocationCounter != nullptr)  tAllocationCounter->fetch_add(1, std::memory_order_relaxed);
+	void* memory = std::malloc(size == 0 ? 1 : size);
+	if (memory == nullptr)  throw std::bad_alloc();
+	return memory;
+}
+
+void operator delete(void* memory) noexcept
+{
+	std::free(memory);
+}
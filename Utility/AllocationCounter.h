@@ -0,0 +1,50 @@
+//--------------------------------------------------------------------------------------
+// Counts heap allocations made with new - used to check the render loop doesn't allocate
+//--------------------------------------------------------------------------------------
+// Replaces the global operator new / delete (see .cpp). Take the count before and after a
+// piece of code to see how many allocations it made.
+//
+// The total count includes every thread, e.g. the simulation job running while a frame is
+// rendered, or the world streamer's loads. To count a piece of code alone, select a counter on
+// the thread running it with an AllocationScope. The jobs the thread starts meanwhile add to the
+// same counter on whichever thread runs them (see JobSystem.h), and other threads' allocations
+// and jobs don't.
+
+#ifndef _ALLOCATION_COUNTER_H_INCLUDED_
+#define _ALLOCATION_COUNTER_H_INCLUDED_
+
+#include <atomic>
+#include <cstdint>
+
+// Number of allocations made with new (including std containers, strings etc.) since the program started
+uint64_t AllocationCount();
+
+
+// Select the counter that the calling thread's allocations are added to as well as the total, nullptr for none. Returns the
+// one selected before, to put back
+std::atomic<uint64_t>* SelectAllocationCounter(std::atomic<uint64_t>* counter);
+
+// The counter selected on the calling thread, nullptr if there is none
+std::atomic<uint64_t>* SelectedAllocationCounter();
+
+
+// Counts the allocations made on the thread that creates it, and by the jobs it starts, until it is destroyed
+class AllocationScope
+{
+public:
+	AllocationScope()   { mPrevious = SelectAllocationCounter(&mCount); }
+	~AllocationScope()  { SelectAllocationCounter(mPrevious); }
+
+	AllocationScope(const AllocationScope&) = delete;
+	AllocationScope& operator=(const AllocationScope&) = delete;
+
+	// Allocations counted so far
+	uint64_t Count() const  { return mCount.load(std::memory_order_relaxed); }
+
+private:
+	std::atomic<uint64_t>  mCount{ 0 };
+	std::atomic<uint64_t>* mPrevious;
+};
+
+
+#endif //_ALLOCATION_COUNTER_H_INCLUDED_
@@ -5,34 +5,278 @@
 #include "GraphicsHelpers.h"
 #include "../Shader.h"
 #include "../Common.h"
+#include "../TextureCooker.h"
+#include "../GpuMemory.h"
+#include "../GpuEvents.h"
+#include "../AssetArchive.h"
 
 #include <WICTextureLoader.h>
 #include <DDSTextureLoader.h>
 #include <cmath>
 #include <cctype>
-#include <atlbase.h> // C-string to unicode conversion function CA2CT
+#include <mutex>
 
 //--------------------------------------------------------------------------------------
 // Texture Loading
 //--------------------------------------------------------------------------------------
 
+// The WIC loader uses the context to generate mip-maps, and so does texture cooking. Unlike the device the context can only
+// be used by one thread at a time, so lock it in case textures are being loaded on several threads (see InitGeometry).
+// Worker threads have no rendering context of their own (see gD3DContext in Common.h), so always use the immediate context
+static std::mutex gImmediateContextMutex;
+
+
+// Texture files are read through the asset archive (see AssetArchive.h) and created from memory
+static bool LoadDDSFile(const std::string& filename, ID3D11Resource** texture, ID3D11ShaderResourceView** textureSRV, size_t maxSize = 0)
+{
+    AssetFile file(filename);
+    return file.IsOpen() &&
+           SUCCEEDED(DirectX::CreateDDSTextureFromMemory(gD3DDevice, file.Data(), file.Size(), texture, textureSRV, maxSize));
+}
+
+static bool LoadWICFile(const std::string& filename, ID3D11Resource** texture, ID3D11ShaderResourceView** textureSRV, size_t maxSize = 0)
+{
+    AssetFile file(filename);
+    return file.IsOpen() &&
+           SUCCEEDED(DirectX::CreateWICTextureFromMemory(gD3DDevice, gD3DImmediateContext, file.Data(), file.Size(), texture, textureSRV, maxSize));
+}
+
+
 // Using Microsoft's open source DirectX Tool Kit (DirectXTK) to simplify texture loading
 // This function requires you to pass a ID3D11Resource* (e.g. &gTilesDiffuseMap), which manages the GPU memory for the
 // texture and also a ID3D11ShaderResourceView* (e.g. &gTilesDiffuseMapSRV), which allows us to use the texture in shaders
 // The function will fill in these pointers with usable data. Returns false on failure
-bool LoadTexture(std::string filename, ID3D11Resource** texture, ID3D11ShaderResourceView** textureSRV)
+// A maximum size limits the width / height loaded - mip-maps larger than that are skipped in DDS files, other files are
+// shrunk to fit. Used to stream in textures a part at a time (see TextureStreamer.h), 0 loads the full size
+// Other files than DDS are first cooked into a BC7 compressed DDS file next to the original, which is loaded instead. If
+// that isn't possible (see CookTexture) the original is used. The texture is named after the file and recorded in the GPU
+// memory registry (see GpuMemory.h)
+bool LoadTexture(std::string filename, ID3D11Resource** texture, ID3D11ShaderResourceView** textureSRV, size_t maxSize /*= 0*/)
 {
     // DDS files need a different function from other files
     std::string dds = ".dds"; // So check the filename extension (case insensitive)
+    bool loaded;
     if (filename.size() >= 4 &&
         std::equal(dds.rbegin(), dds.rend(), filename.rbegin(), [](unsigned char a, unsigned char b) { return std::tolower(a) == std::tolower(b); }))
     {
-        return SUCCEEDED(DirectX::CreateDDSTextureFromFile(gD3DDevice, CA2CT(filename.c_str()), texture, textureSRV));
+        loaded = LoadDDSFile(filename, texture, textureSRV, maxSize);
     }
     else
     {
-        return SUCCEEDED(DirectX::CreateWICTextureFromFile(gD3DDevice, gD3DContext, CA2CT(filename.c_str()), texture, textureSRV));
+        std::lock_guard<std::mutex> lock(gImmediateContextMutex);
+        CookedTextureDesc cooked = { filename + ".dds", DXGI_FORMAT_BC7_UNORM, { 0, 1, 2, 3 } };
+        if (CookTexture(filename, &cooked, 1))
+        {
+            loaded = LoadDDSFile(cooked.fileName, texture, textureSRV, maxSize);
+        }
+        else
+        {
+            loaded = LoadWICFile(filename, texture, textureSRV, maxSize);
+        }
+    }
+
+    if (loaded)
+    {
+        SetDebugNames(filename, *texture, textureSRV != nullptr ? *textureSRV : nullptr);
+        RegisterGpuResource(*texture, "Textures");
+    }
+    return loaded;
+}
+
+
+// Load a normal map with a height map in its alpha channel as two block compressed textures: the x and y of the normals
+// (BC5) and the heights (BC4). Shaders rebuild the z of each normal. The two are cooked into DDS files next to the original
+// the first time (see TextureCooker.h). Returns false on failure, including when the file can't be cooked
+bool LoadNormalHeightMap(std::string filename, ID3D11Resource** normalMap, ID3D11ShaderResourceView** normalMapSRV,
+                                               ID3D11Resource** heightMap, ID3D11ShaderResourceView** heightMapSRV)
+{
+    std::lock_guard<std::mutex> lock(gImmediateContextMutex);
+    const CookedTextureDesc cooked[] =
+    {
+        { filename + ".normal.dds", DXGI_FORMAT_BC5_UNORM, { 0, 1, -1, -1 } },
+        { filename + ".height.dds", DXGI_FORMAT_BC4_UNORM, { 3, -1, -1, -1 } },
+    };
+    if (!CookTexture(filename, cooked, 2) ||
+        !LoadDDSFile(cooked[0].fileName, normalMap, normalMapSRV) ||
+        !LoadDDSFile(cooked[1].fileName, heightMap, heightMapSRV))
+    {
+        return false;
+    }
+    SetDebugNames(cooked[0].fileName, *normalMap, *normalMapSRV);
+    SetDebugNames(cooked[1].fileName, *heightMap, *heightMapSRV);
+    RegisterGpuResource(*normalMap, "Textures");
+    RegisterGpuResource(*heightMap, "Textures");
+    return true;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Render targets
+//--------------------------------------------------------------------------------------
+
+// Create a texture that can be rendered to and then used in shaders, e.g. for the reflection of the scene. Pass pointers to the
+// texture, render target view (for rendering to it) and shader resource view (for using it in shaders) to be filled in.
+// Samples is the number of samples per pixel for MSAA, shaders read a multisampled texture as Texture2DMS
+// With more than one mip level (0 for a full chain) the texture can generate its mips (GenerateMips on the shader resource),
+// the render target is always of the top level. Multisampled textures have no mips
+// Returns false on failure, the objects created will need to be released before quitting as usual
+bool CreateRenderTarget(int width, int height, DXGI_FORMAT format,
+                        ID3D11Texture2D** texture, ID3D11RenderTargetView** renderTarget, ID3D11ShaderResourceView** textureSRV,
+                        unsigned int samples /*= 1*/, unsigned int mipLevels /*= 1*/)
+{
+    if (samples > 1)  mipLevels = 1;
+
+    D3D11_TEXTURE2D_DESC textureDesc = {};
+    textureDesc.Width  = width;
+    textureDesc.Height = height;
+    textureDesc.MipLevels = mipLevels; // Usually no mip-maps when rendering to textures (or we would have to render every level)
+    textureDesc.ArraySize = 1;
+    textureDesc.Format = format;
+    textureDesc.SampleDesc.Count = samples;
+    textureDesc.SampleDesc.Quality = 0;
+    textureDesc.Usage = D3D11_USAGE_DEFAULT;
+    textureDesc.BindFlags = D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE; // IMPORTANT: Indicate we will use texture as render target, and pass it to shaders
+    textureDesc.CPUAccessFlags = 0;
+    textureDesc.MiscFlags = mipLevels != 1 ? D3D11_RESOURCE_MISC_GENERATE_MIPS : 0;
+    if (FAILED(gD3DDevice->CreateTexture2D(&textureDesc, NULL, texture)))  return false;
+
+    // Get a "view" of the texture as a render target, i.e. get a special pointer to the texture that we use when rendering to it
+    if (FAILED(gD3DDevice->CreateRenderTargetView(*texture, NULL, renderTarget)))  return false;
+
+    // We also need to send this texture (resource) to the shaders. To do that we must create a shader-resource "view"
+    D3D11_SHADER_RESOURCE_VIEW_DESC srDesc = {};
+    srDesc.Format = format;
+    srDesc.ViewDimension = samples > 1 ? D3D11_SRV_DIMENSION_TEXTURE2DMS : D3D11_SRV_DIMENSION_TEXTURE2D;
+    srDesc.Texture2D.MostDetailedMip = 0;
+    srDesc.Texture2D.MipLevels = mipLevels == 0 ? -1 : mipLevels; // -1 for all the levels
+    return SUCCEEDED(gD3DDevice->CreateShaderResourceView(*texture, &srDesc, textureSRV));
+}
+
+
+// Create a depth buffer of the given size. If depthSRV is not nullptr then also create a shader resource view so the depth
+// values can be read as a texture (R32_FLOAT, or Texture2DMS when multisampled) in shaders. Returns false on failure
+bool CreateDepthBuffer(int width, int height,
+                       ID3D11Texture2D** texture, ID3D11DepthStencilView** depthStencil, ID3D11ShaderResourceView** depthSRV /*= nullptr*/,
+                       unsigned int samples /*= 1*/)
+{
+    // Same approach as the main depth buffer (see Direct3DSetup.cpp) - typeless texture so it can be viewed as depth and as a float texture
+    D3D11_TEXTURE2D_DESC dbDesc = {};
+    dbDesc.Width  = width;
+    dbDesc.Height = height;
+    dbDesc.MipLevels = 1;
+    dbDesc.ArraySize = 1;
+    dbDesc.Format = DXGI_FORMAT_R32_TYPELESS;
+    dbDesc.SampleDesc.Count = samples;
+    dbDesc.SampleDesc.Quality = 0;
+    dbDesc.Usage = D3D11_USAGE_DEFAULT;
+    dbDesc.BindFlags = D3D11_BIND_DEPTH_STENCIL | (depthSRV != nullptr ? D3D11_BIND_SHADER_RESOURCE : 0);
+    dbDesc.CPUAccessFlags = 0;
+    dbDesc.MiscFlags = 0;
+    if (FAILED(gD3DDevice->CreateTexture2D(&dbDesc, nullptr, texture)))  return false;
+
+    D3D11_DEPTH_STENCIL_VIEW_DESC dsvDesc = {};
+    dsvDesc.Format = DXGI_FORMAT_D32_FLOAT;
+    dsvDesc.ViewDimension = samples > 1 ? D3D11_DSV_DIMENSION_TEXTURE2DMS : D3D11_DSV_DIMENSION_TEXTURE2D;
+    dsvDesc.Texture2D.MipSlice = 0;
+    if (FAILED(gD3DDevice->CreateDepthStencilView(*texture, &dsvDesc, depthStencil)))  return false;
+
+    if (depthSRV == nullptr)  return true;
+    D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+    srvDesc.Format = DXGI_FORMAT_R32_FLOAT;
+    srvDesc.ViewDimension = samples > 1 ? D3D11_SRV_DIMENSION_TEXTURE2DMS : D3D11_SRV_DIMENSION_TEXTURE2D;
+    srvDesc.Texture2D.MipLevels = 1;
+    srvDesc.Texture2D.MostDetailedMip = 0;
+    return SUCCEEDED(gD3DDevice->CreateShaderResourceView(*texture, &srvDesc, depthSRV));
+}
+
+
+// Create a texture array of render targets, each slice viewed as its own render target and shader resource, and a render
+// target for all the slices at once that a geometry shader picks between (SV_RenderTargetArrayIndex). Each of the slice arrays
+// must have room for numSlices views. With mip levels the render targets are of the top level. Returns false on failure
+bool CreateRenderTargetArray(int width, int height, DXGI_FORMAT format, unsigned int numSlices, ID3D11Texture2D** texture,
+                             ID3D11RenderTargetView** arrayRenderTarget, ID3D11RenderTargetView** sliceRenderTargets,
+                             ID3D11ShaderResourceView** sliceSRVs, unsigned int mipLevels /*= 1*/)
+{
+    D3D11_TEXTURE2D_DESC textureDesc = {};
+    textureDesc.Width  = width;
+    textureDesc.Height = height;
+    textureDesc.MipLevels = mipLevels;
+    textureDesc.ArraySize = numSlices;
+    textureDesc.Format = format;
+    textureDesc.SampleDesc.Count = 1;
+    textureDesc.Usage = D3D11_USAGE_DEFAULT;
+    textureDesc.BindFlags = D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE;
+    textureDesc.MiscFlags = mipLevels != 1 ? D3D11_RESOURCE_MISC_GENERATE_MIPS : 0;
+    if (FAILED(gD3DDevice->CreateTexture2D(&textureDesc, nullptr, texture)))  return false;
+
+    D3D11_RENDER_TARGET_VIEW_DESC rtDesc = {};
+    rtDesc.Format = format;
+    rtDesc.ViewDimension = D3D11_RTV_DIMENSION_TEXTURE2DARRAY;
+    rtDesc.Texture2DArray.MipSlice = 0;
+    rtDesc.Texture2DArray.FirstArraySlice = 0;
+    rtDesc.Texture2DArray.ArraySize = numSlices;
+    if (FAILED(gD3DDevice->CreateRenderTargetView(*texture, &rtDesc, arrayRenderTarget)))  return false;
+
+    // Each slice's views are arrays of one slice. A plain Texture2D view can't pick a slice of an array
+    D3D11_SHADER_RESOURCE_VIEW_DESC srDesc = {};
+    srDesc.Format = format;
+    srDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2DARRAY;
+    srDesc.Texture2DArray.MostDetailedMip = 0;
+    srDesc.Texture2DArray.MipLevels = mipLevels == 0 ? -1 : mipLevels; // -1 for all the levels
+    srDesc.Texture2DArray.ArraySize = 1;
+    rtDesc.Texture2DArray.ArraySize = 1;
+    for (unsigned int slice = 0; slice < numSlices; ++slice)
+    {
+        rtDesc.Texture2DArray.FirstArraySlice = slice;
+        srDesc.Texture2DArray.FirstArraySlice = slice;
+        if (FAILED(gD3DDevice->CreateRenderTargetView(*texture, &rtDesc, &sliceRenderTargets[slice])) ||
+            FAILED(gD3DDevice->CreateShaderResourceView(*texture, &srDesc, &sliceSRVs[slice])))  return false;
+    }
+    return true;
+}
+
+
+// Create an array of depth buffers in the same way, with a depth stencil view for all the slices, one for each slice and a
+// shader resource view of each slice. Returns false on failure
+bool CreateDepthBufferArray(int width, int height, unsigned int numSlices, ID3D11Texture2D** texture,
+                            ID3D11DepthStencilView** arrayDepthStencil, ID3D11DepthStencilView** sliceDepthStencils,
+                            ID3D11ShaderResourceView** sliceSRVs)
+{
+    // Typeless like the single depth buffers above
+    D3D11_TEXTURE2D_DESC dbDesc = {};
+    dbDesc.Width  = width;
+    dbDesc.Height = height;
+    dbDesc.MipLevels = 1;
+    dbDesc.ArraySize = numSlices;
+    dbDesc.Format = DXGI_FORMAT_R32_TYPELESS;
+    dbDesc.SampleDesc.Count = 1;
+    dbDesc.Usage = D3D11_USAGE_DEFAULT;
+    dbDesc.BindFlags = D3D11_BIND_DEPTH_STENCIL | D3D11_BIND_SHADER_RESOURCE;
+    if (FAILED(gD3DDevice->CreateTexture2D(&dbDesc, nullptr, texture)))  return false;
+
+    D3D11_DEPTH_STENCIL_VIEW_DESC dsvDesc = {};
+    dsvDesc.Format = DXGI_FORMAT_D32_FLOAT;
+    dsvDesc.ViewDimension = D3D11_DSV_DIMENSION_TEXTURE2DARRAY;
+    dsvDesc.Texture2DArray.MipSlice = 0;
+    dsvDesc.Texture2DArray.FirstArraySlice = 0;
+    dsvDesc.Texture2DArray.ArraySize = numSlices;
+    if (FAILED(gD3DDevice->CreateDepthStencilView(*texture, &dsvDesc, arrayDepthStencil)))  return false;
+
+    D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+    srvDesc.Format = DXGI_FORMAT_R32_FLOAT;
+    srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2DARRAY;
+    srvDesc.Texture2DArray.MostDetailedMip = 0;
+    srvDesc.Texture2DArray.MipLevels = 1;
+    srvDesc.Texture2DArray.ArraySize = 1;
+    dsvDesc.Texture2DArray.ArraySize = 1;
+    for (unsigned int slice = 0; slice < numSlices; ++slice)
+    {
+        dsvDesc.Texture2DArray.FirstArraySlice = slice;
+        srvDesc.Texture2DArray.FirstArraySlice = slice;
+        if (FAILED(gD3DDevice->CreateDepthStencilView(*texture, &dsvDesc, &sliceDepthStencils[slice])) ||
+            FAILED(gD3DDevice->CreateShaderResourceView(*texture, &srvDesc, &sliceSRVs[slice])))  return false;
     }
+    return true;
 }
 
 
@@ -43,15 +287,16 @@ bool LoadTexture(std::string filename, ID3D11Resource** texture, ID3D11ShaderRes
 // A "projection matrix" contains properties of a camera. Covered mid-module - the maths is an optional topic (not examinable).
 // - Aspect ratio is screen width / height (like 4:3, 16:9)
 // - FOVx is the viewing angle from left->right (high values give a fish-eye look),
-// - near and far clip are the range of z distances that can be rendered
+// - near clip is the nearest z distance that can be rendered. The depth is reversed with no far plane, as the cameras' (see
+//   Camera::UpdateMatrices), so the far clip isn't used
 CMatrix4x4 MakeProjectionMatrix(float aspectRatio /*= 4.0f / 3.0f*/, float FOVx /*= ToRadians(60)*/,
-                                float nearClip /*= 0.1f*/, float farClip /*= 10000.0f*/)
+                                float nearClip /*= 0.1f*/, float /*farClip*/ /*= 10000.0f*/)
 {
     float tanFOVx = std::tan(FOVx * 0.5f);
     float scaleX = 1.0f / tanFOVx;
     float scaleY = aspectRatio / tanFOVx;
-    float scaleZa = farClip / (farClip - nearClip);
-    float scaleZb = -nearClip * scaleZa;
+    float scaleZa = 0.0f;
+    float scaleZb = nearClip;
 
     return CMatrix4x4{ scaleX,   0.0f,    0.0f,   0.0f,
                          0.0f, scaleY,    0.0f,   0.0f,
@@ -8,6 +8,7 @@
 
 #include "CMatrix4x4.h"
 #include "../Common.h"
+#include "../StateCache.h"
 #include <d3d11.h>
 
 
@@ -25,6 +26,7 @@ void UpdateConstantBuffer(ID3D11Buffer* buffer, const T& bufferData)
     gD3DContext->Map(buffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &cb);
     memcpy(cb.pData, &bufferData, sizeof(T));
     gD3DContext->Unmap(buffer, 0);
+    CountMap(sizeof(T));
 }
 
 
@@ -36,7 +38,52 @@ void UpdateConstantBuffer(ID3D11Buffer* buffer, const T& bufferData)
 // This function requires you to pass a ID3D11Resource* (e.g. &gTilesDiffuseMap), which manages the GPU memory for the
 // texture and also a ID3D11ShaderResourceView* (e.g. &gTilesDiffuseMapSRV), which allows us to use the texture in shaders
 // The function will fill in these pointers with usable data. Returns false on failure
-bool LoadTexture(std::string filename, ID3D11Resource** texture, ID3D11ShaderResourceView** textureSRV);
+// Can be called from several threads at once, though non-DDS files are loaded one at a time
+// A maximum size limits the width / height loaded (see TextureStreamer.h), 0 loads the full size
+// Files other than DDS are cooked into a block compressed DDS file the first time, which is loaded instead (see TextureCooker.h)
+bool LoadTexture(std::string filename, ID3D11Resource** texture, ID3D11ShaderResourceView** textureSRV, size_t maxSize = 0);
+
+// Load a normal map with a height map in its alpha channel as two block compressed textures: the x and y of the normals
+// (BC5) and the heights (BC4). Shaders rebuild the z of each normal. Returns false on failure
+bool LoadNormalHeightMap(std::string filename, ID3D11Resource** normalMap, ID3D11ShaderResourceView** normalMapSRV,
+                                               ID3D11Resource** heightMap, ID3D11ShaderResourceView** heightMapSRV);
+
+
+//--------------------------------------------------------------------------------------
+// Render targets
+//--------------------------------------------------------------------------------------
+
+// Create a texture that can be rendered to and then used in shaders, e.g. for the reflection of the scene. Pass pointers to the
+// texture, render target view (for rendering to it) and shader resource view (for using it in shaders) to be filled in.
+// Samples is the number of samples per pixel for MSAA, shaders read a multisampled texture as Texture2DMS
+// With more than one mip level (0 for a full chain) the texture can generate its mips (GenerateMips on the shader resource),
+// the render target is always of the top level. Multisampled textures have no mips
+// Returns false on failure, the objects created will need to be released before quitting as usual
+bool CreateRenderTarget(int width, int height, DXGI_FORMAT format,
+                        ID3D11Texture2D** texture, ID3D11RenderTargetView** renderTarget, ID3D11ShaderResourceView** textureSRV,
+                        unsigned int samples = 1, unsigned int mipLevels = 1);
+
+// Create a depth buffer of the given size. If depthSRV is not nullptr then also create a shader resource view so the depth
+// values can be read as a texture (R32_FLOAT, or Texture2DMS when multisampled) in shaders. Returns false on failure
+bool CreateDepthBuffer(int width, int height,
+                       ID3D11Texture2D** texture, ID3D11DepthStencilView** depthStencil, ID3D11ShaderResourceView** depthSRV = nullptr,
+                       unsigned int samples = 1);
+
+// Create a texture array of render targets, each slice viewed as its own render target and shader resource, and a render
+// target for all the slices at once that a geometry shader picks between (SV_RenderTargetArrayIndex). Each of the slice arrays
+// must have room for numSlices views. The slice shader resources are arrays of one slice, so shaders read them as Texture2DArray
+// With more than one mip level (0 for a full chain) the texture can generate its mips (GenerateMips on a slice's shader
+// resource), the render targets are always of the top level
+// Returns false on failure, the objects created will need to be released before quitting as usual
+bool CreateRenderTargetArray(int width, int height, DXGI_FORMAT format, unsigned int numSlices, ID3D11Texture2D** texture,
+                             ID3D11RenderTargetView** arrayRenderTarget, ID3D11RenderTargetView** sliceRenderTargets,
+                             ID3D11ShaderResourceView** sliceSRVs, unsigned int mipLevels = 1);
+
+// Create an array of depth buffers in the same way, with a depth stencil view for all the slices, one for each slice and a
+// shader resource view of each slice (R32_FLOAT, read as Texture2DArray). Returns false on failure
+bool CreateDepthBufferArray(int width, int height, unsigned int numSlices, ID3D11Texture2D** texture,
+                            ID3D11DepthStencilView** arrayDepthStencil, ID3D11DepthStencilView** sliceDepthStencils,
+                            ID3D11ShaderResourceView** sliceSRVs);
 
 
 //--------------------------------------------------------------------------------------
@@ -46,7 +93,8 @@ bool LoadTexture(std::string filename, ID3D11Resource** texture, ID3D11ShaderRes
 // A "projection matrix" contains properties of a camera. Covered mid-module - the maths is an optional topic (not examinable).
 // - Aspect ratio is screen width / height (like 4:3, 16:9)
 // - FOVx is the viewing angle from left->right (high values give a fish-eye look),
-// - near and far clip are the range of z distances that can be rendered
+// - near clip is the nearest z distance that can be rendered. The depth is reversed with no far plane, as the cameras' (see
+//   Camera::UpdateMatrices), so the far clip isn't used
 CMatrix4x4 MakeProjectionMatrix(float aspectRatio = 4.0f / 3.0f, float FOVx = ToRadians(60),
                                 float nearClip = 0.1f, float farClip = 10000.0f);
 
@@ -0,0 +1,76 @@
+//--------------------------------------------------------------------------------------
+// Linear allocator - fast memory for temporary data that is all freed together
+//--------------------------------------------------------------------------------------
+
+#include "LinearAllocator.h"
+#include <cstdint>
+
+
+// Constructor / Destructor //
+
+// Memory is taken from the heap in blocks of at least the given size, the first when it is first used
+LinearAllocator::LinearAllocator(size_t blockSize /*= 4 * 1024 * 1024*/)
+	: mBlockSize(blockSize)
+{
+}
+
+LinearAllocator::~LinearAllocator()
+{
+	for (auto& block : mBlocks)  ::operator delete(block.data);
+}
+
+
+// Usage //
+
+// Memory for the given number of bytes with the given alignment (a power of 2). Never returns nullptr, throws std::bad_alloc
+// if the heap is out of memory
+void* LinearAllocator::Allocate(size_t bytes, size_t alignment /*= alignof(std::max_align_t)*/)
+{
+	// Try the current block and then any later ones kept from before a reset, adding a new block if none have space.
+	// Alignment is of the actual address, the blocks themselves are only aligned as the heap gives them
+	while (true)
+	{
+		if (mCurrentBlock < mBlocks.size())
+		{
+			Block& block = mBlocks[mCurrentBlock];
+			uintptr_t address = reinterpret_cast<uintptr_t>(block.data) + mOffset;
+			size_t padding = (alignment - address % alignment) % alignment;
+			if (mOffset + padding + bytes <= block.size)
+			{
+				mOffset += padding + bytes;
+				mUsed   += padding + bytes;
+				return block.data + mOffset - bytes;
+			}
+			if (mCurrentBlock + 1 < mBlocks.size())
+			{
+				++mCurrentBlock;
+				mOffset = 0;
+				continue;
+			}
+		}
+
+		// Big enough for this allocation at any alignment
+		size_t size = (bytes + alignment > mBlockSize) ? bytes + alignment : mBlockSize;
+		mBlocks.push_back({ static_cast<unsigned char*>(::operator new(size)), size });
+		mCapacity += size;
+		mCurrentBlock = mBlocks.size() - 1;
+		mOffset = 0;
+	}
+}
+
+
+// Make all the memory free again. Anything allocated before must no longer be used
+void LinearAllocator::Reset()
+{
+	// After a load that needed several blocks, replace them with one block of the same total size. Later loads of the same
+	// size then fit in one block, and allocations that needed a block to themselves fit along with the rest
+	if (mBlocks.size() > 1)
+	{
+		for (auto& block : mBlocks)  ::operator delete(block.data);
+		mBlocks.clear();
+		mBlocks.push_back({ static_cast<unsigned char*>(::operator new(mCapacity)), mCapacity });
+	}
+	mCurrentBlock = 0;
+	mOffset = 0;
+	mUsed = 0;
+}
@@ -0,0 +1,129 @@
+//--------------------------------------------------------------------------------------
+// Linear allocator - fast memory for temporary data that is all freed together
+//--------------------------------------------------------------------------------------
+// Allocating just moves a pointer along a large block of memory, and nothing is freed until
+// Reset, which makes the whole block free again. Suits data that only lives while something is
+// loaded (e.g. the CPU-side copies of a mesh's vertices, see Mesh.cpp), avoiding many separate
+// heap allocations that fragment the heap. Memory is kept after a reset and reused, so once the
+// allocator has grown to fit the largest load no more heap allocations are made.
+// Not thread-safe, give each thread its own allocator.
+
+#ifndef _LINEAR_ALLOCATOR_H_INCLUDED_
+#define _LINEAR_ALLOCATOR_H_INCLUDED_
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+class LinearAllocator
+{
+public:
+
+	// Constructor / Destructor //
+
+	// Memory is taken from the heap in blocks of at least the given size, the first when it is first used
+	LinearAllocator(size_t blockSize = 4 * 1024 * 1024);
+	~LinearAllocator();
+
+	// Not copyable - the blocks would be freed twice
+	LinearAllocator(const LinearAllocator&) = delete;
+	LinearAllocator& operator=(const LinearAllocator&) = delete;
+
+
+	// Usage //
+
+	// Memory for the given number of bytes with the given alignment (a power of 2). Never returns nullptr, throws
+	// std::bad_alloc if the heap is out of memory
+	void* Allocate(size_t bytes, size_t alignment = alignof(std::max_align_t));
+
+	// Make all the memory free again. Anything allocated before must no longer be used
+	void Reset();
+
+	size_t Used()      { return mUsed; }     // Bytes allocated since the last reset, including alignment padding
+	size_t Capacity()  { return mCapacity; } // Bytes in all the blocks
+
+
+private:
+	struct Block
+	{
+		unsigned char* data;
+		size_t         size;
+	};
+
+	size_t             mBlockSize;
+	std::vector<Block> mBlocks;
+	size_t             mCurrentBlock = 0; // Index of the block being allocated from
+	size_t             mOffset       = 0; // Bytes used in that block
+	size_t             mUsed         = 0;
+	size_t             mCapacity     = 0;
+};
+
+
+// Resets a linear allocator when it goes out of scope, so its memory is freed even when a load fails with an exception
+class LinearAllocatorReset
+{
+public:
+	explicit LinearAllocatorReset(LinearAllocator& allocator) : mAllocator(allocator) {}
+	~LinearAllocatorReset()  { mAllocator.Reset(); }
+
+	LinearAllocatorReset(const LinearAllocatorReset&) = delete;
+	LinearAllocatorReset& operator=(const LinearAllocatorReset&) = delete;
+
+private:
+	LinearAllocator& mAllocator;
+};
+
+
+// Allocator for std containers that takes their memory from a linear allocator, or from the heap as usual if given nullptr.
+// Memory from a linear allocator is not freed until it is reset, so containers that keep growing waste some of it - reserve
+// their size first where it is known. Elements are default-initialised rather than zeroed when a container is resized, i.e.
+// an ArenaVector<unsigned char> can be made any size without the cost of clearing it (resize with a value to clear it)
+template <class T>
+class ArenaAllocator
+{
+public:
+	using value_type = T;
+
+	// Containers moved or swapped take the allocator with them, so moving one never copies its elements
+	using propagate_on_container_move_assignment = std::true_type;
+	using propagate_on_container_swap            = std::true_type;
+
+	ArenaAllocator(LinearAllocator* arena = nullptr) : mArena(arena) {}
+	template <class U> ArenaAllocator(const ArenaAllocator<U>& other) : mArena(other.Arena()) {}
+
+	T* allocate(size_t count)
+	{
+		if (mArena != nullptr)  return static_cast<T*>(mArena->Allocate(count * sizeof(T), alignof(T)));
+		return static_cast<T*>(::operator new(count * sizeof(T)));
+	}
+
+	void deallocate(T* memory, size_t)
+	{
+		if (mArena == nullptr)  ::operator delete(memory);
+	}
+
+	template <class U>
+	void construct(U* element)  { ::new(static_cast<void*>(element)) U; }
+
+	template <class U, class... Args>
+	void construct(U* element, Args&&... args)  { ::new(static_cast<void*>(element)) U(std::forward<Args>(args)...); }
+
+	LinearAllocator* Arena() const  { return mArena; }
+
+private:
+	LinearAllocator* mArena;
+};
+
+template <class T, class U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b)  { return a.Arena() == b.Arena(); }
+template <class T, class U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b)  { return a.Arena() != b.Arena(); }
+
+// A vector using an ArenaAllocator, pass the linear allocator (or nullptr) to the constructor
+template <class T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+
+#endif //_LINEAR_ALLOCATOR_H_INCLUDED_
@@ -0,0 +1,51 @@
+//--------------------------------------------------------------------------------------
+// Memory-mapped file class - read-only access to an entire file without copying it
+//--------------------------------------------------------------------------------------
+
+#include "MappedFile.h"
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+
+
+// Constructor / Destructor //
+
+// Map the given file. Use IsOpen to see if it worked (it won't if the file doesn't exist)
+MappedFile::MappedFile(const std::string& fileName)
+{
+	HANDLE file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)  return;
+	mFile = file;
+
+	// Empty files can't be mapped
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)  return;
+
+	mMapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mMapping == nullptr)  return;
+
+	mData = static_cast<const unsigned char*>(MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0));
+	if (mData != nullptr)  mSize = static_cast<size_t>(size.QuadPart);
+}
+
+MappedFile::~MappedFile()
+{
+	if (mData)     UnmapViewOfFile(mData);
+	if (mMapping)  CloseHandle(mMapping);
+	if (mFile)     CloseHandle(mFile);
+}
+
+
+// Get a 64-bit hash (FNV-1a) of a block of data. Not secure, but good enough to tell if a file has changed
+uint64_t HashData(const void* data, size_t size)
+{
+	uint64_t hash = 14695981039346656037ull;
+	auto bytes = static_cast<const unsigned char*>(data);
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
@@ -0,0 +1,48 @@
+//--------------------------------------------------------------------------------------
+// Memory-mapped file class - read-only access to an entire file without copying it
+//--------------------------------------------------------------------------------------
+// The operating system maps the file into memory and pages it in as it is read, so the
+// data can be used directly (e.g. as initial data for a DirectX buffer) with no extra copy
+
+#ifndef _MAPPED_FILE_H_INCLUDED_
+#define _MAPPED_FILE_H_INCLUDED_
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+class MappedFile
+{
+public:
+
+	// Constructor / Destructor //
+
+	// Map the given file. Use IsOpen to see if it worked (it won't if the file doesn't exist)
+	MappedFile(const std::string& fileName);
+	~MappedFile();
+
+	// Not copyable - the file would be unmapped twice
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+
+	// Usage //
+
+	bool                 IsOpen()  { return mData != nullptr; }
+	const unsigned char* Data()    { return mData; }
+	size_t               Size()    { return mSize; }
+
+
+private:
+	void*                mFile    = nullptr; // Windows handles, kept as void* to avoid including Windows.h here
+	void*                mMapping = nullptr;
+	const unsigned char* mData    = nullptr;
+	size_t               mSize    = 0;
+};
+
+
+// Get a 64-bit hash (FNV-1a) of a block of data. Not secure, but good enough to tell if a file has changed
+uint64_t HashData(const void* data, size_t size);
+
+
+#endif //_MAPPED_FILE_H_INCLUDED_
@@ -180,3 +180,22 @@ float Timer::GetLapTime()
 	}
 	return fTime;
 }
+
+
+// High-resolution counter //
+
+// Current count of the high-resolution counter
+uint64_t Timer::HighResCount()
+{
+	LARGE_INTEGER count;
+	QueryPerformanceCounter(&count);
+	return count.QuadPart;
+}
+
+// Counts per second of the high-resolution counter
+uint64_t Timer::HighResFrequency()
+{
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	return frequency.QuadPart;
+}
@@ -41,6 +41,14 @@ public:
 	float GetLapTime();
 
 
+	// High-resolution counter //
+
+	// Current count of the high-resolution counter, and its counts per second. For timing many short sections of code
+	// without a Timer for each (see CpuProfiler.h)
+	static uint64_t HighResCount();
+	static uint64_t HighResFrequency();
+
+
 private:
 	// Is the timer running
 	bool mRunning;
@@ -0,0 +1,304 @@
+//--------------------------------------------------------------------------------------
+// Vertex formats - typed vertex structures and their DirectX layouts from a list of attributes
+//--------------------------------------------------------------------------------------
+// A vertex format is a list of attributes, each giving the type stored in the vertex, its DXGI
+// format and the semantic the vertex shaders read it with, e.g.
+//     using Format = VertexFormat<PositionFloat3, NormalFloat3, UVFloat2>;
+// Format::Vertex is a structure with the attributes in order and no padding between them, and
+// Format::Elements() is the D3D11_INPUT_ELEMENT_DESC array describing it, worked out at compile
+// time. Vertices are then written a whole vertex at a time through the typed structure, rather
+// than one attribute at a time through byte offsets, and the offsets shaders depend on (e.g. the
+// skinning shader's) can be checked with static_assert.
+//
+// The meshes choose their attributes at runtime (tangents, UVs, bones, quantised or not), so
+// SelectVertexLayout turns runtime options into a compile-time layout (see Mesh.cpp).
+
+#include "CVector2.h"
+#include "CVector3.h"
+#include <d3d11.h>
+#include <array>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#ifndef _VERTEX_FORMAT_H_INCLUDED_
+#define _VERTEX_FORMAT_H_INCLUDED_
+
+
+//--------------------------------------------------------------------------------------
+// Quantised vertex data
+//--------------------------------------------------------------------------------------
+// Used by the quantised attributes below. The GPU converts these formats back to floats as it reads the vertices, except
+// for the octahedral normals, which are decoded in the vertex shader (see ModelNormal in Common.hlsli)
+
+// Convert a float to a 16-bit half float (DXGI_FORMAT_R16_FLOAT), rounding to nearest. Values too small for a half are flushed
+// to zero, values too large become infinity
+inline uint16_t FloatToHalf(float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	uint32_t sign     = (bits >> 16) & 0x8000;
+	int      exponent = static_cast<int>((bits >> 23) & 0xff) - 127 + 15;
+	uint32_t mantissa = bits & 0x7fffff;
+	if (exponent <= 0)   return static_cast<uint16_t>(sign);
+	if (exponent >= 31)  return static_cast<uint16_t>(sign | 0x7c00);
+
+	uint32_t half = sign | (exponent << 10) | (mantissa >> 13);
+	if (mantissa & 0x1000)  ++half; // Round up, a carry into the exponent still gives the right value
+	return static_cast<uint16_t>(half);
+}
+
+// Convert a value in the range -1 to 1 / 0 to 1 to a 16-bit normalised integer (DXGI_FORMAT_R16_SNORM / R16_UNORM)
+inline int16_t FloatToSnorm16(float value)
+{
+	value = (std::max)(-1.0f, (std::min)(value, 1.0f));
+	return static_cast<int16_t>(std::lround(value * 32767.0f));
+}
+
+inline uint16_t FloatToUnorm16(float value)
+{
+	value = (std::max)(0.0f, (std::min)(value, 1.0f));
+	return static_cast<uint16_t>(std::lround(value * 65535.0f));
+}
+
+
+//--------------------------------------------------------------------------------------
+// Attributes
+//--------------------------------------------------------------------------------------
+// Each attribute has the Type stored in the vertex, its DXGI Format and Semantic, and Write to store a value in it. Types must
+// be a multiple of 4 bytes with no more than 4 byte alignment, so vertices never have padding
+
+struct PositionFloat3
+{
+	using Type = CVector3;
+	static constexpr DXGI_FORMAT Format   = DXGI_FORMAT_R32G32B32_FLOAT;
+	static constexpr const char* Semantic = "position";
+	static void Write(Type& dest, const CVector3& position)  { dest = position; }
+};
+
+// 16 bits for each of x, y and z, given 0->1 within the mesh bounds. w is always 1
+struct PositionUnorm16
+{
+	struct Type { uint16_t x, y, z, w; };
+	static constexpr DXGI_FORMAT Format   = DXGI_FORMAT_R16G16B16A16_UNORM;
+	static constexpr const char* Semantic = "position";
+	static void Write(Type& dest, const CVector3& position)
+	{
+		dest = { FloatToUnorm16(position.x), FloatToUnorm16(position.y), FloatToUnorm16(position.z), 0xffff };
+	}
+};
+
+// A unit vector in 32 bits (two 16-bit snorms) using octahedral encoding: the vector is projected onto an octahedron, which
+// is then unfolded into a square. Much more accurate than quantising x, y and z separately
+struct Octahedral
+{
+	int16_t x, y;
+};
+
+inline void WriteOctahedral(Octahedral& dest, const CVector3& vector)
+{
+	CVector3 v = vector / (std::abs(vector.x) + std::abs(vector.y) + std::abs(vector.z));
+	float x = v.x;
+	float y = v.y;
+	if (v.z < 0) // Fold the lower half of the octahedron over the upper
+	{
+		x = (1.0f - std::abs(v.y)) * (v.x >= 0 ? 1.0f : -1.0f);
+		y = (1.0f - std::abs(v.x)) * (v.y >= 0 ? 1.0f : -1.0f);
+	}
+	dest = { FloatToSnorm16(x), FloatToSnorm16(y) };
+}
+
+struct NormalFloat3
+{
+	using Type = CVector3;
+	static constexpr DXGI_FORMAT Format   = DXGI_FORMAT_R32G32B32_FLOAT;
+	static constexpr const char* Semantic = "normal";
+	static void Write(Type& dest, const CVector3& normal)  { dest = normal; }
+};
+
+struct NormalOctahedral
+{
+	using Type = Octahedral;
+	static constexpr DXGI_FORMAT Format   = DXGI_FORMAT_R16G16_SNORM;
+	static constexpr const char* Semantic = "normal";
+	static void Write(Type& dest, const CVector3& normal)  { WriteOctahedral(dest, normal); }
+};
+
+struct TangentFloat3
+{
+	using Type = CVector3;
+	static constexpr DXGI_FORMAT Format   = DXGI_FORMAT_R32G32B32_FLOAT;
+	static constexpr const char* Semantic = "tangent";
+	static void Write(Type& dest, const CVector3& tangent)  { dest = tangent; }
+};
+
+struct TangentOctahedral
+{
+	using Type = Octahedral;
+	static constexpr DXGI_FORMAT Format   = DXGI_FORMAT_R16G16_SNORM;
+	static constexpr const char* Semantic = "tangent";
+	static void Write(Type& dest, const CVector3& tangent)  { WriteOctahedral(dest, tangent); }
+};
+
+struct UVFloat2
+{
+	using Type = CVector2;
+	static constexpr DXGI_FORMAT Format   = DXGI_FORMAT_R32G32_FLOAT;
+	static constexpr const char* Semantic = "uv";
+	static void Write(Type& dest, const CVector2& uv)  { dest = uv; }
+};
+
+struct UVHalf2
+{
+	struct Type { uint16_t u, v; };
+	static constexpr DXGI_FORMAT Format   = DXGI_FORMAT_R16G16_FLOAT;
+	static constexpr const char* Semantic = "uv";
+	static void Write(Type& dest, const CVector2& uv)  { dest = { FloatToHalf(uv.x), FloatToHalf(uv.y) }; }
+};
+
+// The (up to) 4 bones influencing a vertex and their weights, unused ones have weight 0
+struct BoneIndices
+{
+	struct Type { uint8_t bone[4]; };
+	static constexpr DXGI_FORMAT Format   = DXGI_FORMAT_R8G8B8A8_UINT;
+	static constexpr const char* Semantic = "bones";
+};
+
+struct BoneWeights
+{
+	struct Type { float weight[4]; };
+	static constexpr DXGI_FORMAT Format   = DXGI_FORMAT_R32G32B32A32_FLOAT;
+	static constexpr const char* Semantic = "weights";
+};
+
+
+//--------------------------------------------------------------------------------------
+// Vertex format
+//--------------------------------------------------------------------------------------
+
+// The data of a vertex, each attribute's Type in order. Nested rather than a std::tuple, which doesn't keep its members in order
+template <class... Attributes>
+struct VertexData;
+
+template <class Attribute>
+struct VertexData<Attribute>
+{
+	typename Attribute::Type value;
+};
+
+template <class Attribute, class... Rest>
+struct VertexData<Attribute, Rest...>
+{
+	typename Attribute::Type value;
+	VertexData<Rest...>      rest;
+};
+
+
+template <class... Attributes>
+class VertexFormat
+{
+public:
+	using Vertex = VertexData<Attributes...>;
+
+	static constexpr unsigned int NumElements = sizeof...(Attributes);
+
+	// Whether the format has the given attribute
+	template <class Attribute>
+	static constexpr bool Has()
+	{
+		const bool matches[] = { std::is_same<Attribute, Attributes>::value... };
+		for (bool match : matches)  if (match)  return true;
+		return false;
+	}
+
+	// Byte offset of the given attribute in the vertex
+	template <class Attribute>
+	static constexpr unsigned int Offset()
+	{
+		const bool         matches[] = { std::is_same<Attribute, Attributes>::value... };
+		const unsigned int sizes[]   = { static_cast<unsigned int>(sizeof(typename Attributes::Type))... };
+		unsigned int offset = 0;
+		for (unsigned int i = 0; i < NumElements && !matches[i]; ++i)  offset += sizes[i];
+		return offset;
+	}
+
+	// Size in bytes of a vertex
+	static constexpr unsigned int Size()  { return static_cast<unsigned int>(sizeof(Vertex)); }
+
+	// Layout of the vertex for GetInputLayout, all in input slot 0
+	static constexpr std::array<D3D11_INPUT_ELEMENT_DESC, NumElements> Elements()
+	{
+		static_assert(Offset<void>() == sizeof(Vertex), "Vertex attributes must not need padding");
+		return {{ { Attributes::Semantic, 0, Attributes::Format, 0, Offset<Attributes>(), D3D11_INPUT_PER_VERTEX_DATA, 0 }... }};
+	}
+
+	// The given attribute of a vertex, which the format must have
+	template <class Attribute>
+	static typename Attribute::Type& Get(Vertex& vertex)
+	{
+		static_assert(Has<Attribute>(), "The vertex format doesn't have this attribute");
+		return *Find<Attribute>(vertex);
+	}
+
+	// The given attribute of a vertex, or nullptr if the format doesn't have it. Lets code that writes several formats (see
+	// SelectVertexLayout) test for optional attributes with an ordinary if, which the compiler removes
+	template <class Attribute>
+	static typename Attribute::Type* Find(Vertex& vertex)  { return Find<Attribute>(vertex, std::integral_constant<bool, Has<Attribute>()>()); }
+
+private:
+	template <class Attribute>
+	static typename Attribute::Type* Find(Vertex&, std::false_type)  { return nullptr; }
+
+	template <class Attribute>
+	static typename Attribute::Type* Find(Vertex& vertex, std::true_type)
+	{
+		return reinterpret_cast<typename Attribute::Type*>(reinterpret_cast<unsigned char*>(&vertex) + Offset<Attribute>());
+	}
+};
+
+
+// Append attributes to a vertex format if Add is true
+template <class Format, bool Add, class... Attributes>
+struct AddAttributes
+{
+	using type = Format;
+};
+
+template <class... FormatAttributes, class... Attributes>
+struct AddAttributes<VertexFormat<FormatAttributes...>, true, Attributes...>
+{
+	using type = VertexFormat<FormatAttributes..., Attributes...>;
+};
+
+
+//--------------------------------------------------------------------------------------
+// Runtime selection
+//--------------------------------------------------------------------------------------
+
+// Calls a function (usually a generic lambda) with a default constructed Layout<...> whose bool template parameters are the
+// given runtime options, e.g. SelectVertexLayout<GridVertexLayout>(function, normals, uvs) calls function with
+// GridVertexLayout<true, false>() when normals is true and uvs false. Every combination is compiled
+template <template <bool...> class Layout, bool... Chosen>
+struct VertexLayoutSelector
+{
+	template <class Function>
+	static void Select(Function& function)  { function(Layout<Chosen...>()); }
+
+	template <class Function, class... Options>
+	static void Select(Function& function, bool option, Options... options)
+	{
+		if (option)  VertexLayoutSelector<Layout, Chosen..., true >::Select(function, options...);
+		else         VertexLayoutSelector<Layout, Chosen..., false>::Select(function, options...);
+	}
+};
+
+template <template <bool...> class Layout, class Function, class... Options>
+void SelectVertexLayout(Function&& function, Options... options)
+{
+	VertexLayoutSelector<Layout>::Select(function, options...);
+}
+
+
+#endif //_VERTEX_FORMAT_H_INCLUDED_
@@ -0,0 +1,209 @@
+//--------------------------------------------------------------------------------------
+// Water bodies - separate areas of water, each with its own surface height
+//--------------------------------------------------------------------------------------
+
+#include "WaterBody.h"
+#include "Terrain.h"
+#include "GpuEvents.h"
+#include "GpuMemory.h"
+#include "Common.h"
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+
+//--------------------------------------------------------------------------------------
+// Construction / Usage
+//--------------------------------------------------------------------------------------
+
+// Open water at the given height, drawn with the scene's water geometry
+WaterBody::WaterBody(float height)
+	: mHeight(height)
+{
+}
+
+// Water over the rectangle of the xz plane between the given corners, drawn as a bufferless grid
+// Will throw a std::runtime_error exception on failure (same as Mesh)
+WaterBody::WaterBody(CVector2 minCorner, CVector2 maxCorner, float height, int subDivX, int subDivZ)
+	: mHeight(height), mMinCorner(minCorner), mMaxCorner(maxCorner)
+{
+	// The grid is made at height 0 and the model placed at the water height, as the water shaders expect
+	mMesh = new Mesh(CVector3(minCorner.x, 0, minCorner.y), CVector3(maxCorner.x, 0, maxCorner.y), subDivX, subDivZ, true, true, true);
+	try
+	{
+		mModel = new Model(mMesh, { 0, height, 0 });
+	}
+	catch (...)
+	{
+		delete mMesh;
+		throw;
+	}
+}
+
+WaterBody::~WaterBody()
+{
+	ReleaseShoreMap();
+	ReleaseFlowMap();
+	delete mModel;
+	delete mMesh;
+}
+
+
+void WaterBody::SetHeight(float height)
+{
+	mHeight = height;
+	if (mModel != nullptr)  mModel->SetPosition({ 0, height, 0 });
+}
+
+
+// Test if any of the water might be seen in the given frustum. The waves reach the given height above and below the plane
+bool WaterBody::IsVisible(const Frustum& frustum, float waveHeight)
+{
+	if (IsOpenWater())  return true;
+	return SphereInFrustum(frustum, SphereFromBox(Bounds(waveHeight)));
+}
+
+// Box around the water including waves of the given height. Empty for the open water, which has no bounds
+BoundingBox WaterBody::Bounds(float waveHeight)
+{
+	BoundingBox bounds;
+	if (IsOpenWater())  return bounds;
+
+	bounds.Add({ mMinCorner.x, mHeight - waveHeight, mMinCorner.y });
+	bounds.Add({ mMaxCorner.x, mHeight + waveHeight, mMaxCorner.y });
+	return bounds;
+}
+
+
+// Bake the shore map from the heights of the given terrain, over the body's rectangle or the whole terrain for the open water
+// Returns false with a message in gLastError on failure
+bool WaterBody::BakeShoreMap(Terrain* terrain)
+{
+	ReleaseShoreMap();
+	if (IsOpenWater())
+	{
+		mShoreMapMin = { terrain->Bounds().min.x, terrain->Bounds().min.z };
+		mShoreMapMax = { terrain->Bounds().max.x, terrain->Bounds().max.z };
+	}
+	else
+	{
+		mShoreMapMin = mMinCorner;
+		mShoreMapMax = mMaxCorner;
+	}
+
+	// The terrain's heights are read at the centre of each texel, the same heights as the triangles drawn at full detail.
+	// Looking down on the heightfield, this is what rendering it with an orthographic camera would give
+	CVector2 size = mShoreMapMax - mShoreMapMin;
+	int width  = (std::min)((std::max)(static_cast<int>(std::ceil(size.x * ShoreMapTexelsPerUnit)), 1), ShoreMapMaxSize);
+	int height = (std::min)((std::max)(static_cast<int>(std::ceil(size.y * ShoreMapTexelsPerUnit)), 1), ShoreMapMaxSize);
+	std::vector<float> heights(width * height);
+	for (int z = 0; z < height; ++z)
+	{
+		for (int x = 0; x < width; ++x)
+		{
+			heights[z * width + x] = terrain->Height(mShoreMapMin.x + (x + 0.5f) * size.x / width,
+			                                         mShoreMapMin.y + (z + 0.5f) * size.y / height);
+		}
+	}
+
+	D3D11_TEXTURE2D_DESC textureDesc = {};
+	textureDesc.Width            = width;
+	textureDesc.Height           = height;
+	textureDesc.MipLevels        = 1;
+	textureDesc.ArraySize        = 1;
+	textureDesc.Format           = DXGI_FORMAT_R32_FLOAT;
+	textureDesc.SampleDesc.Count = 1;
+	textureDesc.Usage            = D3D11_USAGE_IMMUTABLE;
+	textureDesc.BindFlags        = D3D11_BIND_SHADER_RESOURCE;
+	D3D11_SUBRESOURCE_DATA initialData = {};
+	initialData.pSysMem     = heights.data();
+	initialData.SysMemPitch = width * sizeof(float);
+	if (FAILED(gD3DDevice->CreateTexture2D(&textureDesc, &initialData, &mShoreMapTexture)) ||
+	    FAILED(gD3DDevice->CreateShaderResourceView(mShoreMapTexture, nullptr, &mShoreMapSRV)))
+	{
+		ReleaseShoreMap();
+		gLastError = "Error creating water shore map";
+		return false;
+	}
+	SetDebugNames("Shore Map", mShoreMapTexture, mShoreMapSRV);
+	RegisterGpuResource(mShoreMapTexture, "Shore Maps");
+	return true;
+}
+
+
+// Set the shore map values in the given per-frame constants, used by the water surface shader. Switches the shore map off in
+// the shader if there isn't one
+void WaterBody::SetShoreMapConstants(PerFrameConstants& constants)
+{
+	CVector2 size = mShoreMapMax - mShoreMapMin;
+	constants.shoreMapEnabled = (mShoreMapSRV != nullptr) ? 1.0f : 0.0f;
+	constants.shoreMapOrigin  = mShoreMapMin;
+	constants.shoreMapScale   = { 1 / (std::max)(size.x, 0.001f), 1 / (std::max)(size.y, 0.001f) };
+}
+
+
+// Make the flow map from a grid of width x height flow velocities (world units per second in x and z), row by row from the
+// minimum corner, covering the world xz rectangle between the given corners. Returns false with a message in gLastError on failure
+bool WaterBody::CreateFlowMap(CVector2 minCorner, CVector2 maxCorner, int width, int height, const std::vector<CVector2>& flow)
+{
+	ReleaseFlowMap();
+	if (width <= 0 || height <= 0 || flow.size() != static_cast<size_t>(width) * height)
+	{
+		gLastError = "Water flow map is the wrong size";
+		return false;
+	}
+	mFlowMapMin = minCorner;
+	mFlowMapMax = maxCorner;
+
+	D3D11_TEXTURE2D_DESC textureDesc = {};
+	textureDesc.Width            = width;
+	textureDesc.Height           = height;
+	textureDesc.MipLevels        = 1;
+	textureDesc.ArraySize        = 1;
+	textureDesc.Format           = DXGI_FORMAT_R32G32_FLOAT;
+	textureDesc.SampleDesc.Count = 1;
+	textureDesc.Usage            = D3D11_USAGE_IMMUTABLE;
+	textureDesc.BindFlags        = D3D11_BIND_SHADER_RESOURCE;
+	D3D11_SUBRESOURCE_DATA initialData = {};
+	initialData.pSysMem     = flow.data();
+	initialData.SysMemPitch = width * sizeof(CVector2);
+	if (FAILED(gD3DDevice->CreateTexture2D(&textureDesc, &initialData, &mFlowMapTexture)) ||
+	    FAILED(gD3DDevice->CreateShaderResourceView(mFlowMapTexture, nullptr, &mFlowMapSRV)))
+	{
+		ReleaseFlowMap();
+		gLastError = "Error creating water flow map";
+		return false;
+	}
+	SetDebugNames("Flow Map", mFlowMapTexture, mFlowMapSRV);
+	RegisterGpuResource(mFlowMapTexture, "Flow Maps");
+	return true;
+}
+
+
+// Set the flow map values in the given per-frame constants, used by the water surface shader. Switches the flow off in the
+// shader if there is no flow map
+void WaterBody::SetFlowMapConstants(PerFrameConstants& constants)
+{
+	CVector2 size = mFlowMapMax - mFlowMapMin;
+	constants.flowMapEnabled = (mFlowMapSRV != nullptr) ? 1.0f : 0.0f;
+	constants.flowMapOrigin  = mFlowMapMin;
+	constants.flowMapScale   = { 1 / (std::max)(size.x, 0.001f), 1 / (std::max)(size.y, 0.001f) };
+}
+
+
+void WaterBody::ReleaseShoreMap()
+{
+	if (mShoreMapSRV)      mShoreMapSRV->Release();
+	if (mShoreMapTexture)  mShoreMapTexture->Release();
+	mShoreMapSRV     = nullptr;
+	mShoreMapTexture = nullptr;
+}
+
+void WaterBody::ReleaseFlowMap()
+{
+	if (mFlowMapSRV)      mFlowMapSRV->Release();
+	if (mFlowMapTexture)  mFlowMapTexture->Release();
+	mFlowMapSRV     = nullptr;
+	mFlowMapTexture = nullptr;
+}
@@ -0,0 +1,132 @@
+//--------------------------------------------------------------------------------------
+// Water bodies - separate areas of water, each with its own surface height
+//--------------------------------------------------------------------------------------
+// A level can have several areas of water - the open water, lakes, pools or rivers - at
+// different heights. Each reflects and refracts the scene about its own plane, so each height
+// needs its own reflection and refraction textures. Every frame the scene groups the bodies
+// in view by height, and bodies at the same height share one set of textures (see Scene.cpp),
+// so the cost depends on the water in view rather than the number of bodies in the level.
+//
+// The open water is drawn with the scene's own water geometry (the grid, clipmap or tessellated
+// grid chosen with 'G'), which follows the camera. Other bodies have a grid of their own, over
+// the rectangle they cover.
+//
+// Each body can also have a shore map: the height of the ground under it, baked from above once
+// from the terrain. The ground doesn't move, so the depth of water at any point is the water
+// height less one sample of this, without reading what the refraction pass rendered. The water
+// surface shader uses it for the foam along the shore and to fade out the distortion and
+// reflection at the water's edge (see WaterSurface_ps.hlsl).
+//
+// A body can also have a flow map: the direction and speed the water flows at each point, e.g.
+// along a river's course and faster where it narrows. The waves are carried along by it in the
+// water surface shader, which reads the combined wave texture twice, half a cycle apart, and
+// blends between them so neither is seen stretching (see FlowingWaveLayersNormal in
+// WaterWaves.hlsli). Only the wave normals flow, the heights and the FFT ocean don't.
+
+#include "Mesh.h"
+#include "Model.h"
+#include "Frustum.h"
+#include "CVector2.h"
+#include <d3d11.h>
+#include <vector>
+
+#ifndef _WATER_BODY_H_INCLUDED_
+#define _WATER_BODY_H_INCLUDED_
+
+class Terrain;
+struct PerFrameConstants;
+
+class WaterBody
+{
+//--------------------------------------------------------------------------------------
+// Construction / Usage
+//--------------------------------------------------------------------------------------
+public:
+
+	// Open water at the given height, drawn with the scene's water geometry. It has no bounds so is always in view
+	WaterBody(float height);
+
+	// Water over the rectangle of the xz plane between the given corners at the given height, drawn as a bufferless grid
+	// with the given number of subdivisions in x and z (see Mesh.h)
+	// Will throw a std::runtime_error exception on failure (same as Mesh)
+	WaterBody(CVector2 minCorner, CVector2 maxCorner, float height, int subDivX, int subDivZ);
+	~WaterBody();
+
+
+	// Height of the water plane (before adding the waves)
+	float Height()  { return mHeight; }
+	void  SetHeight(float height);
+
+	// The body's own grid, nullptr for the open water
+	Model* Grid()  { return mModel; }
+	bool   IsOpenWater()  { return mModel == nullptr; }
+
+	// Test if any of the water might be seen in the given frustum. The waves reach the given height above and below the plane
+	bool IsVisible(const Frustum& frustum, float waveHeight);
+
+	// Box around the water including waves of the given height. Empty for the open water, which has no bounds
+	BoundingBox Bounds(float waveHeight);
+
+
+	// Bake the shore map from the heights of the given terrain, over the body's rectangle or the whole terrain for the open
+	// water. Call again to rebake it if the ground changes. The heights are stored rather than the depths, so changing the
+	// water height doesn't need a rebake. Returns false with a message in gLastError on failure
+	bool BakeShoreMap(Terrain* terrain);
+
+	// The shore map, nullptr if it hasn't been baked, and the corners of the world xz rectangle it covers
+	ID3D11ShaderResourceView* ShoreMapSRV()  { return mShoreMapSRV; }
+	CVector2                  ShoreMapMin()  { return mShoreMapMin; }
+	CVector2                  ShoreMapMax()  { return mShoreMapMax; }
+
+	// Set the shore map values in the given per-frame constants, used by the water surface shader. Switches the shore map off
+	// in the shader if there isn't one
+	void SetShoreMapConstants(PerFrameConstants& constants);
+
+
+	// Make the flow map from a grid of width x height flow velocities (world units per second in x and z), row by row from
+	// the minimum corner, covering the world xz rectangle between the given corners. The water outside it doesn't flow.
+	// Replaces any flow map already made. Returns false with a message in gLastError on failure
+	bool CreateFlowMap(CVector2 minCorner, CVector2 maxCorner, int width, int height, const std::vector<CVector2>& flow);
+
+	// The flow map, nullptr if there isn't one
+	ID3D11ShaderResourceView* FlowMapSRV()  { return mFlowMapSRV; }
+
+	// Set the flow map values in the given per-frame constants, used by the water surface shader. Switches the flow off in
+	// the shader if there is no flow map
+	void SetFlowMapConstants(PerFrameConstants& constants);
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions / data
+//--------------------------------------------------------------------------------------
+private:
+
+	// Shore map texels per world unit, up to the maximum size in each direction
+	static constexpr float ShoreMapTexelsPerUnit = 1.0f;
+	static constexpr int   ShoreMapMaxSize       = 512;
+
+	void ReleaseShoreMap();
+	void ReleaseFlowMap();
+
+	float    mHeight;
+	CVector2 mMinCorner = { 0, 0 };
+	CVector2 mMaxCorner = { 0, 0 };
+
+	Mesh*  mMesh  = nullptr;
+	Model* mModel = nullptr;
+
+	// Shore map and the world xz rectangle it covers
+	ID3D11Texture2D*          mShoreMapTexture = nullptr;
+	ID3D11ShaderResourceView* mShoreMapSRV     = nullptr;
+	CVector2                  mShoreMapMin     = { 0, 0 };
+	CVector2                  mShoreMapMax     = { 0, 0 };
+
+	// Flow map and the world xz rectangle it covers
+	ID3D11Texture2D*          mFlowMapTexture = nullptr;
+	ID3D11ShaderResourceView* mFlowMapSRV     = nullptr;
+	CVector2                  mFlowMapMin     = { 0, 0 };
+	CVector2                  mFlowMapMax     = { 0, 0 };
+};
+
+
+#endif //_WATER_BODY_H_INCLUDED_
@@ -0,0 +1,64 @@
+//--------------------------------------------------------------------------------------
+// Water checkerboard fill pixel shader
+//--------------------------------------------------------------------------------------
+// Far water is shaded in a checkerboard of 2x2 pixel blocks, the water surface pixel shader skips
+// every other block (see WaterCheckerboardSkipped in WaterWaves.hlsli). The water is then drawn again
+// with this shader, which fills in each skipped pixel from the shaded pixels two across and two up
+// and down, in the blocks either side. Far water changes little over a few pixels, so this is hard
+// to see. As with the refraction upsample, neighbours at a different depth (e.g. an object in front
+// of the water) count for less, so their colour doesn't bleed onto the water
+
+#include "WaterWaves.hlsli" // For the checkerboard test, the vertex shaders are the water surface's
+
+
+//--------------------------------------------------------------------------------------
+// Textures (texture maps)
+//--------------------------------------------------------------------------------------
+
+// Copies of the main pass colour with the shaded water blocks, and of the depth before the water was shaded (which includes
+// the water, from the depth prepass). Slots as in WaterSurface_ps.hlsl
+Texture2D SceneDepthMap  : register(t6);
+Texture2D SceneColourMap : register(t11);
+
+
+//--------------------------------------------------------------------------------------
+// Helper functions
+//--------------------------------------------------------------------------------------
+
+// Convert a value from the depth buffer (0->1) into a distance from the camera using the projection matrix, as in
+// WaterSurface_ps.hlsl
+float LinearDepth(float depthBufferValue)
+{
+	return gProjectionMatrix[2][3] / (depthBufferValue - gProjectionMatrix[2][2]);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+float4 main(WorldPositionPixelShaderInput input) : SV_Target
+{
+	// Only the skipped pixels, the rest were shaded by the water surface shader. Whole blocks are discarded together, which
+	// is nearly free
+	if (!WaterCheckerboardSkipped(input.projectedPosition.xy, input.worldPosition))  discard;
+
+	int2  pixel = int2(input.projectedPosition.xy);
+	int2  maxPixel = int2(gSceneUVScale * float2(gViewportWidth, gViewportHeight)) - 1; // The part of the scene rendered to
+	float referenceDepth = LinearDepth(SceneDepthMap.Load(int3(pixel, 0)).r);
+
+	static const int2 neighbours[4] = { int2(-2, 0), int2(2, 0), int2(0, -2), int2(0, 2) };
+	float3 colour = 0;
+	float  totalWeight = 0;
+	[unroll] for (int i = 0; i < 4; ++i)
+	{
+		int2  neighbour = clamp(pixel + neighbours[i], 0, maxPixel);
+		float depth = LinearDepth(SceneDepthMap.Load(int3(neighbour, 0)).r);
+
+		// Relative depth difference so the same tolerance works near and far
+		float weight = 1 / (0.001f + abs(depth - referenceDepth) / referenceDepth);
+		colour += SceneColourMap.Load(int3(neighbour, 0)).rgb * weight;
+		totalWeight += weight;
+	}
+	return float4(colour / totalWeight, 1);
+}
@@ -0,0 +1,132 @@
+//--------------------------------------------------------------------------------------
+// Class encapsulating a camera-centred LOD clipmap for the water surface
+//--------------------------------------------------------------------------------------
+
+#include "WaterClipmap.h"
+#include "Mesh.h"
+#include "Common.h"
+
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+
+
+// Create the clipmap. The tile mesh is a grid of tileResolution x tileResolution squares. The finest tiles are
+// finestTileSize units wide, and each of the numLevels levels doubles that.
+// Will throw a std::runtime_error exception on failure (same as Mesh)
+WaterClipmap::WaterClipmap(int tileResolution /*= 16*/, float finestTileSize /*= 8.0f*/, int numLevels /*= 8*/)
+	: mTileResolution(tileResolution), mFinestTileSize(finestTileSize), mNumLevels(numLevels), mWaterY(0)
+{
+	// Tile resolution must be even so every other vertex of a tile lies on the coarser grid of the next level
+	if (tileResolution < 2 || tileResolution % 2 != 0 || numLevels < 1)
+		throw std::runtime_error("Invalid water clipmap settings");
+
+	// A single unit tile is shared by every level, the world matrix scales it to the size required
+	mTileMesh = new Mesh(CVector3(0, 0, 0), CVector3(1, 0, 1), tileResolution, tileResolution, true, true, true); // Bufferless grid
+
+	// Tile sizes and LOD ranges for each level
+	// A tile from level L+1 is split into four level L tiles when the camera is within mLodRanges[L] of it, so every
+	// point in a level L tile is at most mLodRanges[L] + (diagonal of level L+1 tile) from the camera. The morph from
+	// level L+1 to L+2 must not have started by that distance or the two levels would not meet at their shared edge:
+	//     mLodRanges[L] + 2*sqrt(2)*size  <  mMorphStarts[L+1]
+	// That is satisfied with LodRangeFactor = 4.5 and MorphStartRatio = 0.66 (a little margin left over)
+	float size = finestTileSize;
+	float previousRange = 0;
+	for (int level = 0; level < numLevels; ++level)
+	{
+		float range = LodRangeFactor * size;
+		mTileSizes.push_back(size);
+		mLodRanges.push_back(range);
+		mMorphStarts.push_back(previousRange + (range - previousRange) * MorphStartRatio);
+		previousRange = range;
+		size *= LevelScale;
+	}
+}
+
+WaterClipmap::~WaterClipmap()
+{
+	delete mTileMesh;
+}
+
+
+// Select the tiles to draw this frame, centred on the given camera position. Call once per frame before rendering
+void WaterClipmap::Update(const CVector3& cameraPosition, float waterY)
+{
+	mCameraPosition = cameraPosition;
+	mWaterY = waterY;
+	mTiles.clear(); // Keeps capacity, so no allocations once the tile count has settled
+
+	// Visit every tile of the coarsest level within range of the camera. The quadtree is aligned to the world (not the camera)
+	// so tiles don't slide over the surface as the camera moves, the selection is what follows the camera
+	int   topLevel = mNumLevels - 1;
+	float topSize  = mTileSizes[topLevel];
+	float range    = mLodRanges[topLevel];
+	int minX = static_cast<int>(std::floor((cameraPosition.x - range) / topSize));
+	int maxX = static_cast<int>(std::floor((cameraPosition.x + range) / topSize));
+	int minZ = static_cast<int>(std::floor((cameraPosition.z - range) / topSize));
+	int maxZ = static_cast<int>(std::floor((cameraPosition.z + range) / topSize));
+	for (int tileZ = minZ; tileZ <= maxZ; ++tileZ)
+	{
+		for (int tileX = minX; tileX <= maxX; ++tileX)
+		{
+			float x = tileX * topSize;
+			float z = tileZ * topSize;
+			if (DistanceToNode(x, z, topSize) <= range)  SelectTiles(x, z, topLevel);
+		}
+	}
+}
+
+
+// Recursively select tiles from the quadtree node at the given position (min x / z corner) and level
+void WaterClipmap::SelectTiles(float x, float z, int level)
+{
+	// Use this node as a tile if it is the finest level or if the camera is far enough away. Otherwise split into four
+	if (level == 0 || DistanceToNode(x, z, mTileSizes[level]) > mLodRanges[level - 1])
+	{
+		mTiles.push_back({ x, z, level });
+		return;
+	}
+
+	float childSize = mTileSizes[level - 1];
+	SelectTiles(x,             z,             level - 1);
+	SelectTiles(x + childSize, z,             level - 1);
+	SelectTiles(x,             z + childSize, level - 1);
+	SelectTiles(x + childSize, z + childSize, level - 1);
+}
+
+
+// Distance from the camera to the (flat, undisplaced) square covered by a quadtree node
+// The vertex shader measures morph distance to the undisplaced vertex in the same way, so the two agree exactly
+float WaterClipmap::DistanceToNode(float x, float z, float size)
+{
+	float dx = (std::max)((std::max)(x - mCameraPosition.x, mCameraPosition.x - (x + size)), 0.0f);
+	float dz = (std::max)((std::max)(z - mCameraPosition.z, mCameraPosition.z - (z + size)), 0.0f);
+	float dy = mWaterY - mCameraPosition.y;
+	return std::sqrt(dx * dx + dy * dy + dz * dz);
+}
+
+
+// Render all the tiles selected by the last call to Update
+// All other per-frame constants must have been set already along with shaders, textures, samplers, states etc.
+void WaterClipmap::Render(bool useTessellation /*= false*/)
+{
+	// Single matrix passed to Mesh::Render for each tile, kept to avoid allocating each frame. One for each thread as the
+	// water is rendered in more than one pass, which may be recorded at the same time (see CommandRecorder.h)
+	static thread_local std::vector<CMatrix4x4> tileMatrix(1);
+
+	gPerModelConstants.gridResolution = static_cast<float>(mTileResolution);
+	for (auto& tile : mTiles)
+	{
+		// Morph settings for this tile's level - used in the water vertex shader (see WaterSurface_vs.hlsl)
+		gPerModelConstants.morphStart = mMorphStarts[tile.level];
+		gPerModelConstants.morphEnd   = mLodRanges[tile.level];
+
+		float size = mTileSizes[tile.level];
+		tileMatrix[0] = MatrixScaling({ size, 1, size }) * MatrixTranslation({ tile.x, mWaterY, tile.z });
+		mTileMesh->Render(tileMatrix, useTessellation);
+	}
+
+	// Switch morphing off again so the ordinary water grid is unaffected
+	gPerModelConstants.morphStart = gPerModelConstants.morphEnd = 0;
+	gPerModelConstants.gridResolution = 0;
+}
@@ -0,0 +1,90 @@
+//--------------------------------------------------------------------------------------
+// Class encapsulating a camera-centred LOD clipmap for the water surface
+//--------------------------------------------------------------------------------------
+// Instead of one fixed grid, the water is drawn as many copies of a small grid tile. Tiles
+// near the camera are small (dense vertices), tiles further away double in size at each
+// level, giving nested rings of tiles that follow the camera. The tiles are chosen from a
+// quadtree every frame (similar to CDLOD), and the water vertex shader "morphs" the vertices
+// at the outside of each ring onto the coarser grid of the next ring so there are no cracks.
+// Vertex work therefore depends on how much water is on screen rather than how big it is.
+
+#include "CVector3.h"
+#include "CMatrix4x4.h"
+#include <vector>
+
+#ifndef _WATER_CLIPMAP_H_INCLUDED_
+#define _WATER_CLIPMAP_H_INCLUDED_
+
+class Mesh;
+
+class WaterClipmap
+{
+//--------------------------------------------------------------------------------------
+// Construction / Usage
+//--------------------------------------------------------------------------------------
+public:
+
+	// Create the clipmap. The tile mesh is a grid of tileResolution x tileResolution squares. The finest tiles are
+	// finestTileSize units wide, and each of the numLevels levels doubles that. The water covers a square centred on
+	// the camera out to roughly LodRangeFactor times the tile size of the coarsest level
+	// Will throw a std::runtime_error exception on failure (same as Mesh)
+	WaterClipmap(int tileResolution = 16, float finestTileSize = 8.0f, int numLevels = 8);
+	~WaterClipmap();
+
+
+	// Select the tiles to draw this frame, centred on the given camera position. Call once per frame before rendering
+	void Update(const CVector3& cameraPosition, float waterY);
+
+	// Render all the tiles selected by the last call to Update
+	// All other per-frame constants must have been set already along with shaders, textures, samplers, states etc.
+	void Render(bool useTessellation = false);
+
+
+	// Number of tiles selected by the last Update - useful to show in the stats
+	unsigned int NumTiles()  { return static_cast<unsigned int>(mTiles.size()); }
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions / data
+//--------------------------------------------------------------------------------------
+private:
+
+	// Tile size at a given level relative to the level below. Must be 2 for the vertex morphing to line up
+	static const int   LevelScale = 2;
+
+	// Distance (in tiles of a given level) at which tiles are replaced by the next coarser level, and the proportion
+	// of that range over which the vertices morph to the coarser grid. See .cpp for the constraints on these values
+	static constexpr float LodRangeFactor   = 4.5f;
+	static constexpr float MorphStartRatio  = 0.66f;
+
+	// Recursively select tiles from the quadtree node at the given position (min x / z corner) and level
+	void SelectTiles(float x, float z, int level);
+
+	// Distance from the camera to the (flat, undisplaced) square covered by a quadtree node
+	float DistanceToNode(float x, float z, float size);
+
+
+	struct Tile
+	{
+		float x, z; // Min corner of tile in world space
+		int   level;
+	};
+
+	Mesh* mTileMesh; // Unit grid in XZ plane, (0,0) -> (1,1), scaled and positioned for each tile
+
+	int   mTileResolution;
+	float mFinestTileSize;
+	int   mNumLevels;
+
+	std::vector<float> mTileSizes;   // World size of tile at each level
+	std::vector<float> mLodRanges;   // Camera distance beyond which a level's tiles are used (see SelectTiles)
+	std::vector<float> mMorphStarts; // Camera distance at which a level's tiles start morphing to the next level
+
+	// Data from the last Update
+	CVector3 mCameraPosition;
+	float    mWaterY;
+	std::vector<Tile> mTiles;
+};
+
+
+#endif //_WATER_CLIPMAP_H_INCLUDED_
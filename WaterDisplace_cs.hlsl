@@ -0,0 +1,48 @@
+//--------------------------------------------------------------------------------------
+// Water displacement compute shader
+//--------------------------------------------------------------------------------------
+// Moves every vertex of the open water grid by the waves and ripples once a frame, into the buffer the water passes draw the
+// grid from (see WaterVertexCache.h). Does exactly what WaterSurface_vs does to each vertex before the camera transforms it
+// Unlike the other compute shaders this one uses the rendering constant buffers and WaterWaves.hlsli, so the displacement
+// can never differ from the vertex shader's. WaterVertexCache::Update copies the constants into the same slots here
+
+#include "WaterWaves.hlsli"
+
+
+//--------------------------------------------------------------------------------------
+// Constants
+//--------------------------------------------------------------------------------------
+
+static const uint WaterDisplaceThreadGroupSize = 8; // Must match the thread groups dispatched in WaterVertexCache::Update
+
+
+//--------------------------------------------------------------------------------------
+// Buffers
+//--------------------------------------------------------------------------------------
+
+// The grid's vertices, row by row (in z) with gGridSubdivisions.x + 1 vertices in each
+RWStructuredBuffer<WaterVertex> DisplacedVertices : register(u0);
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+// One thread for each vertex of the grid
+[numthreads(WaterDisplaceThreadGroupSize, WaterDisplaceThreadGroupSize, 1)]
+void main(uint3 id : SV_DispatchThreadID)
+{
+	uint2 numVertices = uint2(gGridSubdivisions) + 1;
+	if (any(id.xy >= numVertices))  return;
+
+	// The grid position as GridVertexPosition makes it, transformed to world space
+	float2 position = float2(id.xy) / gGridSubdivisions;
+	float4 worldPosition = mul(gWorldMatrix, float4(position.x, 0, position.y, 1.0f));
+
+	// The UVs are taken before the offset, as in the vertex shader
+	WaterVertex vertex;
+	vertex.uv = WaterUV(worldPosition.xyz);
+	vertex.worldPosition = worldPosition.xyz + WaterWaveDisplacement(worldPosition.xyz);
+
+	DisplacedVertices[id.y * numVertices.x + id.x] = vertex;
+}
@@ -0,0 +1,397 @@
+//--------------------------------------------------------------------------------------
+// Water wave heights on the CPU
+//--------------------------------------------------------------------------------------
+
+#include "WaterHeights.h"
+#include "GpuReadback.h"
+#include "Common.h"
+
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+
+WaterHeights* gWaterHeights = nullptr;
+
+
+//--------------------------------------------------------------------------------------
+// Helper functions
+//--------------------------------------------------------------------------------------
+
+namespace
+{
+	// Must match WaterWidth and MaxWaveHeight in Common.hlsli
+	const float WaterWidth    = 400.0f;
+	const float MaxWaveHeight = WaterWidth / 32.0f;
+
+
+	// Convert a half float (as the ocean's textures hold) to a float
+	float HalfToFloat(uint16_t half)
+	{
+		uint32_t sign     = static_cast<uint32_t>(half & 0x8000) << 16;
+		uint32_t exponent = (half >> 10) & 0x1f;
+		uint32_t mantissa = half & 0x3ff;
+
+		uint32_t bits;
+		if (exponent == 0)
+		{
+			// Zero or too small for a normal half, these are a fixed 2^-24 apart
+			float value = mantissa * (1.0f / 16777216.0f);
+			return sign ? -value : value;
+		}
+		else if (exponent == 31)  bits = sign | 0x7f800000 | (mantissa << 13); // Infinity or NaN
+		else                      bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+
+		float value;
+		std::memcpy(&value, &bits, sizeof(value));
+		return value;
+	}
+
+
+	// Decode one 4x4 block of a BC4 texture (8 bytes) into 16 values from 0 to 1, row by row
+	void DecodeBC4Block(const uint8_t* block, float values[16])
+	{
+		// Two end values and six more between them, or four between them plus 0 and 1 when the first end is the smaller
+		float palette[8];
+		float end0 = block[0] / 255.0f;
+		float end1 = block[1] / 255.0f;
+		palette[0] = end0;
+		palette[1] = end1;
+		if (block[0] > block[1])
+		{
+			for (int i = 1; i < 7; ++i)  palette[i + 1] = ((7 - i) * end0 + i * end1) / 7;
+		}
+		else
+		{
+			for (int i = 1; i < 5; ++i)  palette[i + 1] = ((5 - i) * end0 + i * end1) / 5;
+			palette[6] = 0;
+			palette[7] = 1;
+		}
+
+		// Then a 3 bit palette index for each value, 48 bits in all
+		uint64_t indices = 0;
+		for (int i = 0; i < 6; ++i)  indices |= static_cast<uint64_t>(block[2 + i]) << (8 * i);
+		for (int i = 0; i < 16; ++i)  values[i] = palette[(indices >> (3 * i)) & 7];
+	}
+
+
+	bool IsPowerOfTwo(unsigned int value)
+	{
+		return value != 0 && (value & (value - 1)) == 0;
+	}
+}
+
+
+//--------------------------------------------------------------------------------------
+// Construction
+//--------------------------------------------------------------------------------------
+
+// Copy the heights of the water's wave height map (a BC4 texture) for the CPU, waiting for the GPU
+// Will throw a std::runtime_error exception on failure (same as Mesh)
+WaterHeights::WaterHeights(ID3D11Resource* waveHeightMap)
+{
+	ID3D11Texture2D* texture = nullptr;
+	if (FAILED(waveHeightMap->QueryInterface(__uuidof(ID3D11Texture2D), reinterpret_cast<void**>(&texture))))
+	{
+		throw std::runtime_error("Wave height map isn't a 2D texture");
+	}
+	D3D11_TEXTURE2D_DESC desc;
+	texture->GetDesc(&desc);
+	if (desc.Format != DXGI_FORMAT_BC4_UNORM || desc.Width != desc.Height || !IsPowerOfTwo(desc.Width))
+	{
+		texture->Release();
+		throw std::runtime_error("Wave height map must be square BC4 with a power of two size");
+	}
+
+	// Copy the top mip-map to a texture the CPU can read. This is done once, so waiting for the GPU here is fine. Must be the
+	// immediate context, deferred contexts can't read back
+	D3D11_TEXTURE2D_DESC stagingDesc = desc;
+	stagingDesc.MipLevels = 1;
+	stagingDesc.ArraySize = 1;
+	stagingDesc.Usage = D3D11_USAGE_STAGING;
+	stagingDesc.BindFlags = 0;
+	stagingDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+	stagingDesc.MiscFlags = 0;
+	ID3D11Texture2D* staging = nullptr;
+	if (FAILED(gD3DDevice->CreateTexture2D(&stagingDesc, nullptr, &staging)))
+	{
+		texture->Release();
+		throw std::runtime_error("Error creating wave height readback texture");
+	}
+	gD3DImmediateContext->CopySubresourceRegion(staging, 0, 0, 0, 0, texture, 0, nullptr);
+	texture->Release();
+
+	D3D11_MAPPED_SUBRESOURCE mapped;
+	if (FAILED(gD3DImmediateContext->Map(staging, 0, D3D11_MAP_READ, 0, &mapped)))
+	{
+		staging->Release();
+		throw std::runtime_error("Error reading back wave height map");
+	}
+
+	// Each row of blocks is four rows of heights
+	int size = static_cast<int>(desc.Width);
+	mWaveHeights.size = size;
+	mWaveHeights.values.resize(size * size);
+	for (int blockY = 0; blockY < size / 4; ++blockY)
+	{
+		const uint8_t* row = static_cast<const uint8_t*>(mapped.pData) + blockY * mapped.RowPitch;
+		for (int blockX = 0; blockX < size / 4; ++blockX)
+		{
+			float values[16];
+			DecodeBC4Block(row + blockX * 8, values);
+			for (int y = 0; y < 4; ++y)
+			for (int x = 0; x < 4; ++x)
+			{
+				mWaveHeights.values[(blockY * 4 + y) * size + blockX * 4 + x] = values[y * 4 + x];
+			}
+		}
+	}
+	gD3DImmediateContext->Unmap(staging, 0);
+	staging->Release();
+}
+
+WaterHeights::~WaterHeights()
+{
+	if (gGpuReadback)  gGpuReadback->Cancel(this);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Usage
+//--------------------------------------------------------------------------------------
+
+// Copy the ocean's displacement as simulated this frame towards the CPU. The heights change when a copy arrives, in a later
+// frame's GpuReadback::Update. Returns false with a message in gLastError on failure
+bool WaterHeights::Update(ID3D11Texture2D* oceanDisplacement, float patchSize)
+{
+	D3D11_TEXTURE2D_DESC desc;
+	oceanDisplacement->GetDesc(&desc);
+	if (desc.Format != DXGI_FORMAT_R16G16B16A16_FLOAT || desc.Width != desc.Height || !IsPowerOfTwo(desc.Width))
+	{
+		gLastError = "Ocean displacement must be square half floats with a power of two size";
+		return false;
+	}
+
+	// Copy the top mip-map, skipped while the GPU is too far behind for another. When it arrives it is unpacked outside the
+	// mutex then swapped in. The size and patch size are kept with it, the ocean may have changed since
+	if (gGpuReadback->Read(this, oceanDisplacement, 0, nullptr, CopyArrived, mNextCopy))
+	{
+		mCopies[mNextCopy] = { static_cast<int>(desc.Width), patchSize };
+		mNextCopy = (mNextCopy + 1) % GpuReadback::MaxCopiesPerOwner;
+	}
+	return true;
+}
+
+
+// Height of the waves above or below the flat water plane at each of the given world x and z positions
+void WaterHeights::Heights(const Waves& waves, const float* x, const float* z, float* heights, int count) const
+{
+	if (waves.oceanEnabled)
+	{
+		std::shared_lock<std::shared_timed_mutex> lock(mOceanMutex);
+		OceanHeightsAt(mOcean, waves.waveScale, x, z, heights, count);
+	}
+	else
+	{
+		MapHeightsAt(waves, x, z, heights, count);
+	}
+}
+
+// Height of the waves above or below the flat water plane at one world position
+float WaterHeights::Height(const Waves& waves, float x, float z) const
+{
+	float height;
+	Heights(waves, &x, &z, &height, 1);
+	return height;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions
+//--------------------------------------------------------------------------------------
+
+// Called by GpuReadback::Update with a copy of the ocean's displacement that has arrived. Unpacks it outside the mutex then
+// swaps it in. The grids swapped out are refilled by the next copy, so they only allocate when the ocean's size changes
+void WaterHeights::CopyArrived(void* owner, int slot, const D3D11_MAPPED_SUBRESOURCE& mapped)
+{
+	WaterHeights* heights = static_cast<WaterHeights*>(owner);
+	OceanHeights& next = heights->mNextOcean;
+	int size = heights->mCopies[slot].size;
+	Grid* grids[3] = { &next.x, &next.y, &next.z };
+	for (Grid* grid : grids)
+	{
+		grid->size = size;
+		grid->values.resize(size * size);
+	}
+	for (int y = 0; y < size; ++y)
+	{
+		const uint16_t* row = reinterpret_cast<const uint16_t*>(static_cast<const uint8_t*>(mapped.pData) + y * mapped.RowPitch);
+		for (int x = 0; x < size; ++x)
+		{
+			next.x.values[y * size + x] = HalfToFloat(row[x * 4 + 0]);
+			next.y.values[y * size + x] = HalfToFloat(row[x * 4 + 1]);
+			next.z.values[y * size + x] = HalfToFloat(row[x * 4 + 2]);
+		}
+	}
+	next.patchSize = heights->mCopies[slot].patchSize;
+
+	std::lock_guard<std::shared_timed_mutex> lock(heights->mOceanMutex);
+	std::swap(heights->mOcean, next);
+}
+
+
+// The heights of one batch of points from the normal/height map. The same as WaterWaveHeight in WaterWaves.hlsli
+void WaterHeights::MapHeightsAt(const Waves& waves, const float* x, const float* z, float* heights, int count) const
+{
+	const float heightScale = MaxWaveHeight * waves.waveScale;
+	int i = 0;
+
+#ifdef MATH_SIMD
+	const __m128 invWaterWidth = _mm_set1_ps(1 / WaterWidth);
+	const __m128 half          = _mm_set1_ps(0.5f);
+	for (; i + 4 <= count; i += 4)
+	{
+		// Water UVs from the world positions, as WaterUV
+		__m128 waterU = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(x + i), invWaterWidth), half);
+		__m128 waterV = _mm_sub_ps(half, _mm_mul_ps(_mm_loadu_ps(z + i), invWaterWidth));
+
+		__m128 sum = _mm_setzero_ps();
+		for (int layer = 0; layer < waves.waveLayers; ++layer)
+		{
+			float size  = gWaterConstants.waterSizes[layer];
+			float speed = gWaterConstants.waterSpeeds[layer];
+			__m128 u = _mm_mul_ps(_mm_set1_ps(size), _mm_add_ps(waterU, _mm_set1_ps(waves.waterMovement.x * speed)));
+			__m128 v = _mm_mul_ps(_mm_set1_ps(size), _mm_add_ps(waterV, _mm_set1_ps(waves.waterMovement.y * speed)));
+			sum = _mm_add_ps(sum, mWaveHeights.Sample4(u, v));
+		}
+
+		// Average and scale to world units, an equal amount up or down from the water plane
+		__m128 average = _mm_sub_ps(_mm_mul_ps(sum, _mm_set1_ps(1.0f / waves.waveLayers)), half);
+		_mm_storeu_ps(heights + i, _mm_mul_ps(average, _mm_set1_ps(heightScale)));
+	}
+#endif
+
+	// The points left over, or all of them without SIMD
+	for (; i < count; ++i)
+	{
+		float waterU = x[i] / WaterWidth + 0.5f;
+		float waterV = 0.5f - z[i] / WaterWidth;
+		float sum = 0;
+		for (int layer = 0; layer < waves.waveLayers; ++layer)
+		{
+			float size  = gWaterConstants.waterSizes[layer];
+			float speed = gWaterConstants.waterSpeeds[layer];
+			sum += mWaveHeights.Sample(size * (waterU + waves.waterMovement.x * speed), size * (waterV + waves.waterMovement.y * speed));
+		}
+		heights[i] = (sum / waves.waveLayers - 0.5f) * heightScale;
+	}
+}
+
+
+// The heights of one batch of points from the ocean's displacement, as WaterWaveDisplacement in WaterWaves.hlsli samples it
+void WaterHeights::OceanHeightsAt(const OceanHeights& ocean, float waveScale, const float* x, const float* z, float* heights,
+                                  int count) const
+{
+	if (ocean.y.size == 0)
+	{
+		std::fill(heights, heights + count, 0.0f);
+		return;
+	}
+
+	const float uvScale = 1 / ocean.patchSize;
+	int i = 0;
+
+#ifdef MATH_SIMD
+	const __m128 scale4   = _mm_set1_ps(uvScale);
+	const __m128 offset4  = _mm_set1_ps(waveScale * uvScale); // Displacement in world units to UVs
+	const __m128 height4  = _mm_set1_ps(waveScale);
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 u = _mm_mul_ps(_mm_loadu_ps(x + i), scale4);
+		__m128 v = _mm_mul_ps(_mm_loadu_ps(z + i), scale4);
+		__m128 sourceU = _mm_sub_ps(u, _mm_mul_ps(ocean.x.Sample4(u, v), offset4));
+		__m128 sourceV = _mm_sub_ps(v, _mm_mul_ps(ocean.z.Sample4(u, v), offset4));
+		_mm_storeu_ps(heights + i, _mm_mul_ps(ocean.y.Sample4(sourceU, sourceV), height4));
+	}
+#endif
+
+	for (; i < count; ++i)
+	{
+		float u = x[i] * uvScale;
+		float v = z[i] * uvScale;
+		float sourceU = u - ocean.x.Sample(u, v) * waveScale * uvScale;
+		float sourceV = v - ocean.z.Sample(u, v) * waveScale * uvScale;
+		heights[i] = ocean.y.Sample(sourceU, sourceV) * waveScale;
+	}
+}
+
+
+// Sample a grid at the given UVs with bilinear filtering, wrapping at the edges, as the water's sampler does (its top mip-map)
+float WaterHeights::Grid::Sample(float u, float v) const
+{
+	float texelX = u * size - 0.5f;
+	float texelY = v * size - 0.5f;
+	float floorX = std::floor(texelX);
+	float floorY = std::floor(texelY);
+	float blendX = texelX - floorX;
+	float blendY = texelY - floorY;
+
+	int mask = size - 1;
+	int x0 = static_cast<int>(floorX) & mask;
+	int y0 = static_cast<int>(floorY) & mask;
+	int x1 = (x0 + 1) & mask;
+	int y1 = (y0 + 1) & mask;
+
+	float top    = values[y0 * size + x0] + (values[y0 * size + x1] - values[y0 * size + x0]) * blendX;
+	float bottom = values[y1 * size + x0] + (values[y1 * size + x1] - values[y1 * size + x0]) * blendX;
+	return top + (bottom - top) * blendY;
+}
+
+#ifdef MATH_SIMD
+// Four samples at once. SSE has no gather, so only the texel positions and blending use SIMD, the values are loaded one by one
+__m128 WaterHeights::Grid::Sample4(__m128 u, __m128 v) const
+{
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128 gridSize = _mm_set1_ps(static_cast<float>(size));
+	__m128 texelX = _mm_sub_ps(_mm_mul_ps(u, gridSize), half);
+	__m128 texelY = _mm_sub_ps(_mm_mul_ps(v, gridSize), half);
+
+	// Round down - converting rounds towards zero, so take one off where that rounded up (negative values)
+	__m128i intX = _mm_cvttps_epi32(texelX);
+	__m128i intY = _mm_cvttps_epi32(texelY);
+	__m128  roundedUpX = _mm_cmpgt_ps(_mm_cvtepi32_ps(intX), texelX);
+	__m128  roundedUpY = _mm_cmpgt_ps(_mm_cvtepi32_ps(intY), texelY);
+	intX = _mm_add_epi32(intX, _mm_castps_si128(roundedUpX)); // The comparison gives -1 where true
+	intY = _mm_add_epi32(intY, _mm_castps_si128(roundedUpY));
+	__m128 blendX = _mm_sub_ps(texelX, _mm_cvtepi32_ps(intX));
+	__m128 blendY = _mm_sub_ps(texelY, _mm_cvtepi32_ps(intY));
+
+	// Wrap and find each of the four texels' indexes. The size is a power of two, so the rows are found with a shift
+	int shift = 0;
+	while ((1 << shift) < size)  ++shift;
+	const __m128i mask = _mm_set1_epi32(size - 1);
+	const __m128i one  = _mm_set1_epi32(1);
+	__m128i x0 = _mm_and_si128(intX, mask);
+	__m128i x1 = _mm_and_si128(_mm_add_epi32(intX, one), mask);
+	__m128i row0 = _mm_sll_epi32(_mm_and_si128(intY, mask), _mm_cvtsi32_si128(shift));
+	__m128i row1 = _mm_sll_epi32(_mm_and_si128(_mm_add_epi32(intY, one), mask), _mm_cvtsi32_si128(shift));
+
+	alignas(16) int i00[4], i10[4], i01[4], i11[4];
+	_mm_store_si128(reinterpret_cast<__m128i*>(i00), _mm_add_epi32(row0, x0));
+	_mm_store_si128(reinterpret_cast<__m128i*>(i10), _mm_add_epi32(row0, x1));
+	_mm_store_si128(reinterpret_cast<__m128i*>(i01), _mm_add_epi32(row1, x0));
+	_mm_store_si128(reinterpret_cast<__m128i*>(i11), _mm_add_epi32(row1, x1));
+	const float* g = values.data();
+	__m128 v00 = _mm_setr_ps(g[i00[0]], g[i00[1]], g[i00[2]], g[i00[3]]);
+	__m128 v10 = _mm_setr_ps(g[i10[0]], g[i10[1]], g[i10[2]], g[i10[3]]);
+	__m128 v01 = _mm_setr_ps(g[i01[0]], g[i01[1]], g[i01[2]], g[i01[3]]);
+	__m128 v11 = _mm_setr_ps(g[i11[0]], g[i11[1]], g[i11[2]], g[i11[3]]);
+
+	__m128 top    = _mm_add_ps(v00, _mm_mul_ps(_mm_sub_ps(v10, v00), blendX));
+	__m128 bottom = _mm_add_ps(v01, _mm_mul_ps(_mm_sub_ps(v11, v01), blendX));
+	return _mm_add_ps(top, _mm_mul_ps(_mm_sub_ps(bottom, top), blendY));
+}
+#endif
+
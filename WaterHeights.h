@@ -0,0 +1,125 @@
+//--------------------------------------------------------------------------------------
+// Water wave heights on the CPU
+//--------------------------------------------------------------------------------------
+// The waves only exist on the GPU, in the water shaders (see WaterWaves.hlsli). Gameplay code
+// needs the height of the water at arbitrary points too, e.g. to float things on it, and reading
+// back from the GPU on demand would stall it. So the same waves are worked out here:
+// - The scrolling normal/height map: its heights are copied to the CPU once, when created, and
+//   the layers are combined with the same sizes, speeds and filtering as WaterWaveHeight
+// - The FFT ocean: its displacement is copied to the CPU asynchronously, a few frames after it
+//   was simulated, without waiting for the GPU (see GpuReadback.h). The heights lag the rendered
+//   waves by those frames
+// Batches of points are evaluated four at a time with SSE, as the matrices are (see CMatrix4x4.h).
+// The ripples from the objects moving through the water aren't included - they are very small and
+// the objects asking are usually the ones making them.
+
+#include "CVector2.h"
+#include "CMatrix4x4.h" // For MATH_SIMD
+#include "GpuReadback.h"
+#include <d3d11.h>
+#include <vector>
+#include <shared_mutex>
+#ifdef MATH_SIMD
+#include <emmintrin.h>
+#endif
+
+#ifndef _WATER_HEIGHTS_H_INCLUDED_
+#define _WATER_HEIGHTS_H_INCLUDED_
+
+class WaterHeights
+{
+//--------------------------------------------------------------------------------------
+// Construction / Usage
+//--------------------------------------------------------------------------------------
+public:
+
+	// Copy the heights of the water's wave height map (a BC4 texture, see LoadNormalHeightMap) for the CPU, waiting for the
+	// GPU. The map must be square with a power of two size
+	// Will throw a std::runtime_error exception on failure (same as Mesh)
+	WaterHeights(ID3D11Resource* waveHeightMap);
+	~WaterHeights();
+
+
+	// Copy the ocean's displacement as simulated this frame towards the CPU. The heights change when a copy arrives, in a later
+	// frame's GpuReadback::Update. Call once per frame on the immediate context after the ocean simulation. The displacement is
+	// square with a power of two size and tiles every patchSize world units. Returns false with a message in gLastError on failure
+	bool Update(ID3D11Texture2D* oceanDisplacement, float patchSize);
+
+
+	// The state of the waves for the queries, as the per-frame constants of the same names
+	struct Waves
+	{
+		float    waveScale;
+		CVector2 waterMovement;
+		bool     oceanEnabled; // The heights of the FFT ocean, or the scrolling normal/height map if not
+		int      waveLayers;   // Layers of the normal/height map combined, 1 to 4, as the wave composite (see WaveComposite.h)
+	};
+
+	// Height of the waves above or below the flat water plane at each of the given world x and z positions. The ocean is flat
+	// until its first displacement has arrived. Can be called from any thread, at the same time as copies arrive
+	void Heights(const Waves& waves, const float* x, const float* z, float* heights, int count) const;
+
+	// Height of the waves above or below the flat water plane at one world position
+	float Height(const Waves& waves, float x, float z) const;
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions / data
+//--------------------------------------------------------------------------------------
+private:
+
+	// A square grid of values with a power of two size, sampled like a texture with bilinear filtering and wrapping
+	struct Grid
+	{
+		std::vector<float> values;
+		int                size = 0;
+
+		float Sample(float u, float v) const;
+#ifdef MATH_SIMD
+		__m128 Sample4(__m128 u, __m128 v) const; // Four UVs at once
+#endif
+	};
+
+	// The normal/height map heights, 0 to 1
+	Grid mWaveHeights;
+
+	// The ocean's last displacement to arrive, one grid for each axis, and the world size of the patch it covers. Guarded by
+	// the mutex, a copy arriving swaps in a new one while queries may be running. Queries share it, so batches on several threads at
+	// once don't wait for each other
+	struct OceanHeights
+	{
+		Grid  x, y, z;
+		float patchSize = 1;
+	};
+	OceanHeights                    mOcean;
+	OceanHeights                    mNextOcean;  // Filled when a copy arrives outside the mutex, then swapped in
+	mutable std::shared_timed_mutex mOceanMutex; // std::shared_mutex is C++17, the project builds as C++14
+
+	// The size and patch size of each copy on its way, the ocean may have changed by the time it arrives. In the slot given to
+	// GpuReadback::Read, used in turn from mNextCopy
+	struct Copy
+	{
+		int   size;
+		float patchSize;
+	};
+	Copy mCopies[GpuReadback::MaxCopiesPerOwner] = {};
+	int  mNextCopy = 0;
+
+	// Called by GpuReadback::Update with a copy of the ocean's displacement that has arrived
+	static void CopyArrived(void* owner, int slot, const D3D11_MAPPED_SUBRESOURCE& mapped);
+
+	// The heights of one batch of points from the ocean's displacement. The displacement moves the surface sideways too, so
+	// the point that was moved to each position is found first, near enough from the displacement at the position itself
+	void OceanHeightsAt(const OceanHeights& ocean, float waveScale, const float* x, const float* z, float* heights, int count) const;
+
+	// The heights of one batch of points from the normal/height map
+	void MapHeightsAt(const Waves& waves, const float* x, const float* z, float* heights, int count) const;
+
+};
+
+
+// The water heights for gameplay code, created in InitScene (see Scene.cpp)
+extern WaterHeights* gWaterHeights;
+
+
+#endif //_WATER_HEIGHTS_H_INCLUDED_
@@ -0,0 +1,40 @@
+//--------------------------------------------------------------------------------------
+// Cached water surface vertex shader
+//--------------------------------------------------------------------------------------
+// Draws the open water grid from the vertices WaterDisplace_cs moved by the waves this frame (see WaterVertexCache.h), in
+// place of WaterSurface_vs. The grid is still bufferless (see Mesh.h): the vertex and instance IDs pick the vertex from the
+// buffer, which only needs transforming by the pass's camera
+
+#include "WaterWaves.hlsli"
+
+
+//--------------------------------------------------------------------------------------
+// Buffers
+//--------------------------------------------------------------------------------------
+
+// The grid's vertices, row by row (in z) with gGridSubdivisions.x + 1 vertices in each
+StructuredBuffer<WaterVertex> WaterVertices : register(t24);
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+WorldPositionPixelShaderInput main( uint vertexID : SV_VertexID, uint instanceID : SV_InstanceID )
+{
+	WorldPositionPixelShaderInput output;
+
+	// The grid point as GridVertexPosition finds it
+	uint2 gridPoint = uint2(vertexID / 2, instanceID + (vertexID & 1));
+	WaterVertex vertex = WaterVertices[gridPoint.y * (uint(gGridSubdivisions.x) + 1) + gridPoint.x];
+
+	output.worldPosition = vertex.worldPosition;
+
+	// Transformed in the same two steps as WaterSurface_vs, so passes that test depth for equality against each other match
+	float4 viewPosition = mul(gViewMatrix, float4(vertex.worldPosition, 1.0f));
+	output.projectedPosition = mul(gProjectionMatrix, viewPosition);
+
+	output.uv = vertex.uv;
+
+	return output;
+}
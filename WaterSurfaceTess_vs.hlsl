@@ -0,0 +1,22 @@
+//--------------------------------------------------------------------------------------
+// Tessellated water surface vertex shader
+//--------------------------------------------------------------------------------------
+// Vertex shader for the tessellated water surface. The water is a coarse grid here, the tessellation stages
+// add the detail. So this shader only transforms the grid to world space, the domain shader adds the waves
+
+#include "Common.hlsli"
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+WaterControlPoint main(BasicVertex input)
+{
+	WaterControlPoint output;
+
+	float4 modelPosition = float4(input.position, 1.0f);
+	output.worldPosition = mul(gWorldMatrix, modelPosition).xyz;
+
+	return output;
+}
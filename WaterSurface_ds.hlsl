@@ -0,0 +1,38 @@
+//--------------------------------------------------------------------------------------
+// Tessellated water surface domain shader
+//--------------------------------------------------------------------------------------
+// Called for every vertex created by the tessellator. Works out the position of the new vertex in the
+// patch, then displaces it by the water waves - the work WaterSurface_vs does for the ordinary water grid
+
+#include "WaterWaves.hlsli" // Water textures and the wave height function shared with WaterSurface_vs
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+[domain("tri")]
+WorldPositionPixelShaderInput main(WaterPatchTessellation patchConstants, float3 barycentric : SV_DomainLocation,
+                                   const OutputPatch<WaterControlPoint, 3> patch)
+{
+	WorldPositionPixelShaderInput output;
+
+	// Position of the new vertex inside the triangle patch
+	float4 worldPosition = float4(barycentric.x * patch[0].worldPosition +
+	                              barycentric.y * patch[1].worldPosition +
+	                              barycentric.z * patch[2].worldPosition, 1.0f);
+
+	// Get the offset of the water waves at this point and add to water position (see WaterWaves.hlsli)
+	// The UVs are taken before the offset so the waves move over the surface rather than with it
+	float2 waterUV = WaterUV(worldPosition.xyz);
+	worldPosition.xyz += WaterWaveDisplacement(worldPosition.xyz);
+	output.worldPosition = worldPosition.xyz;
+
+	// Transform into 2D "projection" space as the vertex shader would do without tessellation
+	float4 viewPosition      = mul(gViewMatrix, worldPosition);
+	output.projectedPosition = mul(gProjectionMatrix, viewPosition);
+
+	output.uv = waterUV;
+
+	return output;
+}
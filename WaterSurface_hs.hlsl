@@ -0,0 +1,90 @@
+//--------------------------------------------------------------------------------------
+// Tessellated water surface hull shader
+//--------------------------------------------------------------------------------------
+// Chooses how much to tessellate each triangle patch of the coarse water grid. Each edge is split so that
+// its pieces are about TessellationEdgePixels long on screen, so the detail is dense near the camera and
+// drops away with distance. Patches that are off screen are culled by giving them a tessellation of 0
+
+#include "Common.hlsli"
+
+
+//--------------------------------------------------------------------------------------
+// Helper functions
+//--------------------------------------------------------------------------------------
+
+// Tessellation factor for the edge between the two given points (world space)
+// IMPORTANT: must only depend on the two points, so that the patches either side of an edge agree on its tessellation,
+// otherwise there would be cracks in the surface. So use distance from camera rather than view depth, which would also
+// change as the camera rotates
+float EdgeTessellation(float3 p0, float3 p1)
+{
+	// Approximate length of the edge on screen in pixels. gProjectionMatrix[1][1] is the vertical field of view scaling
+	float  edgeLength = distance(p0, p1);
+	float  distanceToCamera = max(distance(0.5f * (p0 + p1), gCameraPosition), 1.0f);
+	float  edgePixels = edgeLength * gProjectionMatrix[1][1] * 0.5f * gViewportHeight / distanceToCamera;
+
+	return clamp(edgePixels / TessellationEdgePixels, 1.0f, MaxTessellation);
+}
+
+
+// Returns true if the given triangle patch is entirely outside the left, right, top or bottom of the view
+// The waves can move the surface up/down by the given margin, so the patch bounds are expanded by that much
+bool PatchOutsideView(float3 p0, float3 p1, float3 p2, float margin)
+{
+	// Extract the view frustum planes from the view-projection matrix. Near and far planes not needed for water
+	float4 planes[4] = { gViewProjectionMatrix[3] + gViewProjectionMatrix[0], gViewProjectionMatrix[3] - gViewProjectionMatrix[0],
+	                     gViewProjectionMatrix[3] + gViewProjectionMatrix[1], gViewProjectionMatrix[3] - gViewProjectionMatrix[1] };
+	for (int i = 0; i < 4; ++i)
+	{
+		float4 plane = planes[i] / length(planes[i].xyz);
+		if (dot(plane.xyz, p0) + plane.w < -margin &&
+			dot(plane.xyz, p1) + plane.w < -margin &&
+			dot(plane.xyz, p2) + plane.w < -margin)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+// Patch constant function - called once for each patch to decide the tessellation factors
+WaterPatchTessellation WaterPatchConstants(InputPatch<WaterControlPoint, 3> patch)
+{
+	WaterPatchTessellation output;
+
+	float3 p0 = patch[0].worldPosition;
+	float3 p1 = patch[1].worldPosition;
+	float3 p2 = patch[2].worldPosition;
+
+	if (PatchOutsideView(p0, p1, p2, (gOceanEnabled > 0 ? 1.0f : 0.5f) * MaxWaveHeight * gWaveScale))
+	{
+		output.edges[0] = output.edges[1] = output.edges[2] = output.inside = 0; // Tessellation of 0 discards the patch
+		return output;
+	}
+
+	// Each edge factor refers to the edge opposite the control point with the same index
+	output.edges[0] = EdgeTessellation(p1, p2);
+	output.edges[1] = EdgeTessellation(p2, p0);
+	output.edges[2] = EdgeTessellation(p0, p1);
+	output.inside   = max(output.edges[0], max(output.edges[1], output.edges[2]));
+
+	return output;
+}
+
+
+// Hull shader main function - called for each control point, which are passed on unchanged
+[domain("tri")]
+[partitioning("fractional_odd")]
+[outputtopology("triangle_cw")]
+[outputcontrolpoints(3)]
+[patchconstantfunc("WaterPatchConstants")]
+[maxtessfactor(64.0f)]
+WaterControlPoint main(InputPatch<WaterControlPoint, 3> patch, uint pointID : SV_OutputControlPointID)
+{
+	return patch[pointID];
+}
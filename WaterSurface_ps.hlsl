@@ -3,73 +3,313 @@
 //--------------------------------------------------------------------------------------
 // Water surface pixel shader, combines refraction, reflection and specular lighting
 
-#include "Common.hlsli"
+#include "WaterWaves.hlsli" // Water normal/height map, FFT ocean textures and the standard sampler are declared here
+#include "LightGrid.hlsli" // The point lights, found from the pixel's cell of the light grid
+#include "ShadowMap.hlsli" // Shadows of the key light, so there are no sun glints in the shade
 
 
 //--------------------------------------------------------------------------------------
 // Textures maps
 //--------------------------------------------------------------------------------------
 
-// Note that the texture register numbers are important - slot 0 is not used here, but is used for the diffuse texture in
-// other shaders, so the first texture goes to slot 1. Similarly there is a water height map used for other shaders in slot 2
-// We make sure each map gets a unique slot across all the shaders in use at any given point
-Texture2D NormalHeightMap : register(t1); // Normal/height map for the water waves
+// Note that the texture register numbers are important - we make sure each map gets a unique slot across all the shaders
+// in use at any given point. The normal/height map in slot 1 and the ocean maps in slots 7 & 8 are in WaterWaves.hlsli
 
-// Water reflection and refraction texture maps (a rendering of the reflected scene and of the scene below the water)
-Texture2D RefractionMap : register(t3);
-Texture2D ReflectionMap : register(t4);
+// Water reflection and refraction texture maps (a rendering of the reflected scene and of the scene below the water). These and
+// the refraction depth below are slices of texture arrays, so the water views pass can render them at once (see Scene.cpp).
+// Each is bound as an array of its one slice, so is read with a slice of 0
+Texture2DArray RefractionMap : register(t3);
+Texture2DArray ReflectionMap : register(t4);
+
+// The distance below / above the water of each pixel in the two textures above, used for distortion. Kept apart as the
+// textures above are HDR with no alpha channel
+Texture2DArray RefractionDistortionMap : register(t12);
+Texture2DArray ReflectionDistortionMap : register(t13);
+
+// Used when the textures above are smaller than the viewport: the refraction depth buffer (same size as the refraction map) and
+// a copy of the full size scene depth buffer taken just before the water is rendered. Only bound when the water textures are
+// rendered at a lower resolution than the main pass (gWaterViewportSize below the viewport size),
+// except the scene depth, which is also bound for screen-space reflections and refraction
+Texture2DArray RefractionDepthMap : register(t5);
+Texture2D      SceneDepthMap      : register(t6);
+
+// Copy of the main pass colour taken just before the water is rendered, with the scene depth above it is what screen-space
+// reflections are traced through, and what screen-space refraction sees through the water in place of the refraction map.
+// Only bound when gScreenSpaceReflections or gScreenSpaceRefraction is 1
+Texture2D SceneColourMap : register(t11);
+
+// Cube map of the scene around the water, reflected by the water further than gPlanarReflectionDistance from the camera
+// instead of the reflection map above (see EnvironmentMap.h). Only bound when it is used
+TextureCube EnvironmentMap : register(t9);
+
+// Height of the ground under the water body being drawn, seen from above (see WaterBody.h). Only bound when gShoreMapEnabled is 1
+Texture2D<float> ShoreMap : register(t15);
 
-SamplerState StandardFilter : register(s0); // Filtering used on most textures (trilinear or anisotropic - chosen on the C++ side)
 SamplerState BilinearMirror : register(s1); // We use mirror mode for the reflection and refraction because pixels off screen might come
                                             // into view due to the water wiggling. Mirror mode will put some vaguely sensible colours there
                                             // although it is a bit of a cheat. An alternative solution is to render the reflection / refraction
                                             // maps larger than they need to be but that adds complexity for little gain
 
+// Screen-space reflection settings. The ray takes steps that get longer as it goes, as the distant parts of the scene are
+// small on screen and don't need as many. The total distance travelled is about 550 units
+static const int   SSRSteps       = 32;   // Steps along the reflected ray before giving up
+static const float SSRFirstStep   = 1.0f; // Length of the first step (world units)
+static const float SSRStepGrowth  = 1.15f;
+static const int   SSRRefinements = 4;    // Halving steps to find where the ray hits more exactly once it has passed behind the scene
+
+// How much rougher water blurs the reflection and refraction maps, by reading their mip-maps (see below). The roughness is the
+// slope of the waves at the pixel and how quickly it changes between pixels, which grows with distance as the waves get smaller
+static const float RoughnessBlur = 6.0f;
+
+
+//--------------------------------------------------------------------------------------
+// Helper functions
+//--------------------------------------------------------------------------------------
+
+// UV in the part of a texture rendered this frame (see gRefractionUVScale) for a position on the screen (0->1 UVs). Positions
+// off the screen are mirrored back onto it, as BilinearMirror does across the whole texture, and the result is kept half a
+// texel inside the rendered part so filtering doesn't pick up the old texels around it
+float2 RenderedUV(float2 screenUV, float2 uvScale, Texture2DArray map)
+{
+	float2 textureSize;
+	float  slices;
+	map.GetDimensions(textureSize.x, textureSize.y, slices);
+	float2 halfTexel = 0.5f / textureSize;
+	screenUV = 1 - abs(1 - abs(screenUV));
+	return clamp(screenUV * uvScale, halfTexel, uvScale - halfTexel);
+}
+
+float2 RenderedUV(float2 screenUV, float2 uvScale, Texture2D map)
+{
+	float2 textureSize;
+	map.GetDimensions(textureSize.x, textureSize.y);
+	float2 halfTexel = 0.5f / textureSize;
+	screenUV = 1 - abs(1 - abs(screenUV));
+	return clamp(screenUV * uvScale, halfTexel, uvScale - halfTexel);
+}
+
+
+// Position on screen (0->1 UVs) of a world point as seen through the given view-projection matrix
+float2 ScreenUV(float3 worldPosition, float4x4 viewProjectionMatrix)
+{
+	float4 projectedPosition = mul(viewProjectionMatrix, float4(worldPosition, 1));
+	return projectedPosition.xy / projectedPosition.w * float2(0.5f, -0.5f) + 0.5f;
+}
+
+
+// Depth of water over the ground at the given world xz position, from the shore map. Points outside the map are taken to be
+// deep water
+float ShoreDepth(float2 worldXZ)
+{
+	float2 uv = (worldXZ - gShoreMapOrigin) * gShoreMapScale;
+	if (any(uv < 0) || any(uv > 1))  return MaxDistortionDistance;
+	return max(gWaterPlaneY - ShoreMap.SampleLevel(BilinearMirror, uv, 0), 0);
+}
+
+
+// Convert a value from the depth buffer (0->1) into a distance from the camera using the projection matrix
+float LinearDepth(float depthBufferValue)
+{
+	return gProjectionMatrix[2][3] / (depthBufferValue - gProjectionMatrix[2][2]);
+}
+
+
+// Sample the reduced size refraction map, but using the depth of the full size scene at this pixel to choose between the four
+// nearest refraction texels (a "bilateral" upsample). Ordinary bilinear filtering blurs the colours of objects in the water with
+// whatever is behind them, which looks like a halo when the refraction is rendered at half or quarter size. Here texels with a
+// depth close to the full size depth are preferred, so edges of objects under the water stay sharp. The UV is in the rendered part
+// of the refraction map (see RenderedUV)
+float4 SampleRefractionUpsampled(float2 uv, float2 pixelPosition)
+{
+	float2 textureSize;
+	float  slices;
+	RefractionMap.GetDimensions(textureSize.x, textureSize.y, slices);
+
+	// Find the four refraction texels around the UV and the bilinear weights for them
+	float2 texelPosition = uv * textureSize - 0.5f;
+	float2 baseTexel = floor(texelPosition);
+	float2 f = texelPosition - baseTexel;
+	float4 bilinearWeights = float4((1 - f.x) * (1 - f.y), f.x * (1 - f.y), (1 - f.x) * f.y, f.x * f.y);
+
+	// Depth of the full size scene here, the upsample reference. Refraction is rendered with the same camera as the main scene
+	// so the depths can be compared directly
+	float referenceDepth = LinearDepth(SceneDepthMap.Load(int3(pixelPosition, 0)).r);
+
+	float4 colour = 0;
+	float totalWeight = 0;
+	[unroll] for (int i = 0; i < 4; ++i)
+	{
+		// Texel centre UV, texels off the edge of the rendered part use the nearest texel in it
+		float2 texelUV = clamp((baseTexel + float2(i % 2, i / 2) + 0.5f) / textureSize, 0.5f / textureSize, gRefractionUVScale - 0.5f / textureSize);
+		float texelDepth = LinearDepth(RefractionDepthMap.SampleLevel(BilinearMirror, float3(texelUV, 0), 0).r);
+
+		// Relative depth difference so the same tolerance works near and far
+		float weight = bilinearWeights[i] / (0.001f + abs(texelDepth - referenceDepth) / referenceDepth);
+		colour += RefractionMap.SampleLevel(BilinearMirror, float3(texelUV, 0), 0) * weight;
+		totalWeight += weight;
+	}
+	return colour / totalWeight;
+}
+
+
+// Depth below the water surface at the given height of the scene seen at a position on the screen (0->1 UVs), from the copy of
+// the main pass depth taken before the water. Rebuilt from the depth as WaterSurfaceHeight does (see Common.hlsli). Where
+// nothing was rendered under the water the depth is taken to be very deep
+float SceneDepthBelowWater(float2 screenUV, float surfaceHeight)
+{
+	float2 viewportSize = float2(gViewportWidth, gViewportHeight);
+	float  depth = SceneDepthMap.Load(int3(clamp(screenUV * viewportSize, 0, viewportSize - 1), 0)).r;
+	if (depth == 0.0f)  return 10000; // Cleared to 0 (reversed depth)
+
+	float2 projected = float2(screenUV.x * 2 - 1, 1 - screenUV.y * 2);
+	float  viewZ = LinearDepth(depth);
+	float4 viewPosition = float4(projected.x * viewZ / gProjectionMatrix[0][0], projected.y * viewZ / gProjectionMatrix[1][1], viewZ, 1);
+	return surfaceHeight - dot(gCameraMatrix[1], viewPosition); // World y only
+}
+
+
+// The scene seen through the water at a position on the screen (0->1 UVs) distorted from the water pixel's own, when the water
+// refracts the main pass rendered so far rather than a refraction texture (gScreenSpaceRefraction). The main pass has the
+// geometry above the water too, so a distorted position that shows something out of the water (e.g. an object standing in
+// it) uses the pixel's own position instead, which is always under the water. Darkened with depth as the refraction pass does
+// (see RefractedPixelLighting in WaterTextureLighting.hlsli)
+float4 ScreenSpaceRefraction(float2 screenUV, float2 distortedUV, float surfaceHeight)
+{
+	float objectDepth = SceneDepthBelowWater(distortedUV, surfaceHeight);
+	if (objectDepth < 0)
+	{
+		distortedUV = screenUV;
+		objectDepth = max(SceneDepthBelowWater(screenUV, surfaceHeight), 0);
+	}
+	float3 sceneColour = SceneColourMap.SampleLevel(BilinearMirror, RenderedUV(distortedUV, gSceneUVScale, SceneColourMap), 0).rgb;
+	float3 depthDarken = saturate(objectDepth / WaterExtinction);
+	return float4(lerp(sceneColour, normalize(WaterExtinction) * WaterDiffuseLevel, depthDarken), 1);
+}
+
+
+// Trace a ray from a point on the water in the given direction (both in world space) through the main pass rendered so far.
+// The ray is stepped in view space and each step is projected to the screen - when it is just behind the scene depth there
+// it has hit something. Returns the colour there,
+// with alpha 1 for a hit fading to 0 near the edges of the screen, or alpha 0 for a miss: the ray left the screen, turned
+// towards the camera past the near clip or didn't reach anything (e.g. the sky, which isn't rendered yet)
+float4 ScreenSpaceReflection(float3 worldPosition, float3 direction)
+{
+	float3 rayPosition  = mul(gViewMatrix, float4(worldPosition, 1)).xyz;
+	float3 rayDirection = mul(gViewMatrix, float4(direction, 0)).xyz;
+	float2 viewportSize = float2(gViewportWidth, gViewportHeight);
+
+	float stepLength = SSRFirstStep;
+	[loop] for (int i = 0; i < SSRSteps; ++i)
+	{
+		float3 previousPosition = rayPosition;
+		rayPosition += rayDirection * stepLength;
+
+		// Project the ray position to the screen, 0->1 UVs with y down
+		float4 projectedPosition = mul(gProjectionMatrix, float4(rayPosition, 1));
+		if (projectedPosition.w <= 0)  break;
+		float2 uv = projectedPosition.xy / projectedPosition.w * float2(0.5f, -0.5f) + 0.5f;
+		if (any(uv < 0) || any(uv > 1))  break;
+
+		float sceneDepth = LinearDepth(SceneDepthMap.Load(int3(uv * viewportSize, 0)).r);
+		// A ray passing behind an object by more than a couple of steps hasn't hit it, carry on as it may hit something further
+		float behind = rayPosition.z - sceneDepth;
+		if (behind > 0 && behind < stepLength * 2)
+		{
+			// Find the hit more exactly between the last two positions
+			float3 front = previousPosition;
+			float3 back  = rayPosition;
+			[unroll] for (int r = 0; r < SSRRefinements; ++r)
+			{
+				float3 middle = (front + back) * 0.5f;
+				float4 projectedMiddle = mul(gProjectionMatrix, float4(middle, 1));
+				uv = projectedMiddle.xy / projectedMiddle.w * float2(0.5f, -0.5f) + 0.5f;
+				float middleSceneDepth = LinearDepth(SceneDepthMap.Load(int3(saturate(uv) * (viewportSize - 1), 0)).r);
+				if (middle.z > middleSceneDepth)  back  = middle;
+				else                              front = middle;
+			}
+
+			// Fade out near the screen edges, where the rays that just miss the screen are nearby
+			float2 edgeDistance = min(uv, 1 - uv);
+			float  fade = saturate(min(edgeDistance.x, edgeDistance.y) * 10);
+			return float4(SceneColourMap.SampleLevel(BilinearMirror, RenderedUV(uv, gSceneUVScale, SceneColourMap), 0).rgb, fade);
+		}
+
+		stepLength *= SSRStepGrowth;
+	}
+	return 0;
+}
+
+
 //--------------------------------------------------------------------------------------
 // Shader code
 //--------------------------------------------------------------------------------------
 
 float4 main(WorldPositionPixelShaderInput input) : SV_Target
 {
-	// Sample the normal at this point on the water's surface. Sample at four different sizes and combine to give complex waves
-	// All UVs are moving, different speeds for each size. Normals are stored in rgb 0->1 range, so they are changed to xyz -1->1 range (* 2 - 1)
-	float2 waterUV = input.uv;
-	float3 normal1 = NormalHeightMap.Sample(StandardFilter, WaterSize1 * (waterUV + gWaterMovement * WaterSpeed1)).xyz * 2.0f - 1.0f;
-	float3 normal2 = NormalHeightMap.Sample(StandardFilter, WaterSize2 * (waterUV + gWaterMovement * WaterSpeed2)).xyz * 2.0f - 1.0f;
-	float3 normal3 = NormalHeightMap.Sample(StandardFilter, WaterSize3 * (waterUV + gWaterMovement * WaterSpeed3)).xyz * 2.0f - 1.0f;
-	float3 normal4 = NormalHeightMap.Sample(StandardFilter, WaterSize4 * (waterUV + gWaterMovement * WaterSpeed4)).xyz * 2.0f - 1.0f;
-  
-	// When sampling the water at different sizes, the normals change because we are not changing the height at each size, so correct the
-	// normals for that. Alternative is to leave this out and scale the heights used in the vertex shader. This approach gives choppier waves.
-	normal1.y *= WaterSize1;
-	normal2.y *= WaterSize2;
-	normal3.y *= WaterSize3;
-	normal4.y *= WaterSize4;
-	
+	// Far water is shaded in a checkerboard, the skipped blocks are filled in afterwards (see WaterCheckerboardFill_ps.hlsl)
+	if (WaterCheckerboardSkipped(input.projectedPosition.xy, input.worldPosition))  discard;
 
-	// TODO - STAGE 2 - Blend four normals together to make complex waves
-	//                  Look at the lines above and read the comments, four normals have been sampled from a normal map. Steps required:
-	//                  - Each normal has been scaled differently, so each normal needs to be renormalised
-	//                  - Average all the normals to a single normal "waterNormal"
-	//                  - Swap the z and the y axes of waterNormal because normal maps point down z, but the water points up the y axis
-	
-	// Renormalize above normals
-    normal1 = normalize(normal1);
-    normal2 = normalize(normal2);
-    normal3 = normalize(normal3);
-    normal4 = normalize(normal4);
-	
-	// Average all the normals
-    float3 waterNormal = (normal1 + normal2 + normal3 + normal4).xyz; // Not this, read comment above
+	float3 waterNormal;
+	float  foam = 0;
+	[branch] if (gOceanEnabled > 0)
+	{
+		// The FFT ocean stores the slopes of the surface, a single sample gives the normal directly. Wave scale scales the slopes
+		float4 normalFoam = OceanNormalFoamMap.Sample(StandardFilter, input.worldPosition.xz / gOceanPatchSize);
+		waterNormal = normalize(float3(-normalFoam.x * gWaveScale, 1.0f, -normalFoam.y * gWaveScale));
+		foam = normalFoam.w * saturate(gWaveScale);
+	}
+	else
+	{
+		// Sample the normal at this point on the water's surface. The layers of the normal map at up to four different sizes, each
+		// moving at its own speed, have been combined into one texture this frame (see WaveComposite_cs.hlsl)
+		// When sampling the water at different sizes, the normals change because we are not changing the height at each size, so the
+		// normals were corrected for that. Alternative is to leave this out and scale the heights used in the vertex shader. This
+		// approach gives choppier waves. Rivers carry the waves along with their flow maps (see WaterBody.h)
+		waterNormal = FlowingWaveLayersNormal(input.uv, input.worldPosition.xz);
     
-	// Swap the z and the y axes of waterNormal
-	float1 temp;
-    temp = waterNormal.y;
-    waterNormal.y = waterNormal.z;
-    waterNormal.z = temp;
+		// Swap the z and the y axes of waterNormal
+		float1 temp;
+		temp = waterNormal.y;
+		waterNormal.y = waterNormal.z;
+		waterNormal.z = temp;
 	
-	waterNormal.y /= (gWaveScale + 0.001f); // User control of wave height also affects normals, +0.001 to avoid divide by 0 if user chooses 0 height waves
-	waterNormal = normalize(waterNormal);   // Final normalization for above line
+		waterNormal.y /= (gWaveScale + 0.001f); // User control of wave height also affects normals, +0.001 to avoid divide by 0 if user chooses 0 height waves
+		waterNormal = normalize(waterNormal);   // Final normalization for above line
+	}
+
+	// Water far from the camera, the most of it on screen near the horizon, is shaded more cheaply: no ripples, no distortion
+	// and no screen-space reflections, which wouldn't be seen at that distance. The distortion and screen-space reflections
+	// fade out before it, so there is no seam where it starts
+	float3 normalToCamera = normalize(gCameraPosition - input.worldPosition);
+	float  cameraDistance = length(gCameraPosition - input.worldPosition);
+	float  nearWeight = saturate((gWaterLodDistance - cameraDistance) / (0.25f * gWaterLodDistance));
+	bool   farWater = nearWeight == 0;
+
+	// The ripples from objects moving through the water near the camera (see WaterWaves.hlsli)
+	[branch] if (!farWater)
+	{
+		waterNormal = AddRippleNormal(waterNormal, input.worldPosition.xz, gWaterPlaneY);
+	}
+
+	// Seen from under the water, the surface shows the scene above through a circle overhead (Snell's window), outside it
+	// the light from above can't reach the camera and the surface reflects the water below instead (total internal reflection).
+	// The scene above comes from the environment map, captured from the surface, in the direction the view refracts to. The
+	// water below is the colour the underwater fog fades to, it covers the reflected scene by the time it reaches the surface.
+	// The refraction and reflection passes aren't rendered, they see the scene from above the water (see Scene.cpp)
+	[branch] if (gCameraUnderwater > 0 && gCameraPosition.y < gWaterPlaneY)
+	{
+		float3 viewDirection = normalize(input.worldPosition - gCameraPosition);
+		float3 underNormal = -waterNormal;
+		float3 refractedDirection = refract(viewDirection, underNormal, WaterRefractiveIndex); // Water to air
+		float3 waterColour = normalize(WaterExtinction) * WaterDiffuseLevel;
+		if (dot(refractedDirection, refractedDirection) == 0)  return float4(waterColour, 1); // Total internal reflection
+
+		// Even inside the window some light is reflected, more towards its edge
+		float f0 = ((WaterRefractiveIndex - 1) / (WaterRefractiveIndex + 1)) * ((WaterRefractiveIndex - 1) / (WaterRefractiveIndex + 1));
+		float fresnel = saturate(lerp(f0, 1, pow(1 - saturate(dot(underNormal, -viewDirection)), 5)));
+		float3 aboveColour = EnvironmentMap.Sample(StandardFilter, refractedDirection).rgb;
+		return float4(lerp(aboveColour * RefractionStrength, waterColour, fresnel), 1);
+	}
 
 	// Doing correct reflection and refraction from a bumpy surface is difficult without going into full raytracing-like solutions. The
 	// usual approximation is to use the xz from the water surface normal to distort the UVs into the reflection and refractions (wiggle!).
@@ -83,46 +323,142 @@ float4 main(WorldPositionPixelShaderInput input) : SV_Target
 	float2 offsetDir = float2(dot(waterNormal2D, normalize(gCameraMatrix[0].xz)), dot(waterNormal2D, normalize(gCameraMatrix[2].xz)));
 
 	// Sample the depth to the refracted scene at this pixel and the height to the refected scene (the textures rendered in earlier passes)
-	float2 screenUV = input.projectedPosition.xy / float2(gViewportWidth, gViewportHeight);
-	float refractionDepth  = RefractionMap.Sample(BilinearMirror, screenUV).a;
-	float reflectionHeight = ReflectionMap.Sample(BilinearMirror, screenUV).a;
+	// The textures line up with the screen, but one of them may have been rendered last frame from where the camera was then
+	// (temporal water textures, see Scene.cpp), so this point is found in each with the matrices they were rendered with.
+	// Points that were off screen then fall back to the mirrored edges, as with the distortion below
+	// The distortion textures have no mip-maps, so SampleLevel is the same as Sample and can be used in the far water branches
+	// Screen-space refraction finds the depth from the copy of the main pass depth at this pixel instead
+	float2 refractionScreenUV;
+	float  refractionDepth;
+	[branch] if (gScreenSpaceRefraction > 0)
+	{
+		refractionScreenUV = input.projectedPosition.xy / float2(gViewportWidth, gViewportHeight);
+		refractionDepth = saturate(SceneDepthBelowWater(refractionScreenUV, input.worldPosition.y) / MaxDistortionDistance);
+	}
+	else
+	{
+		refractionScreenUV = ScreenUV(input.worldPosition, gRefractionViewProjectionMatrix);
+		refractionDepth = RefractionDistortionMap.SampleLevel(BilinearMirror, float3(RenderedUV(refractionScreenUV, gRefractionUVScale, RefractionDistortionMap), 0), 0).r;
+	}
+	float2 reflectionScreenUV = ScreenUV(input.worldPosition, gReflectionViewProjectionMatrix);
+
+	// The depth of water at the water's edge, in the same 0->1 range as the refraction depth. With a shore map it is the depth
+	// over the ground here, which doesn't depend on what the refraction pass saw at this pixel or whether it lines up with the
+	// screen. Foam gathers where the water is shallow, more where the waves are steeper
+	float edgeDepth = refractionDepth;
+	[branch] if (gShoreMapEnabled > 0)
+	{
+		float shoreDepth = ShoreDepth(input.worldPosition.xz);
+		edgeDepth = saturate(shoreDepth / MaxDistortionDistance);
+		float shoreFoam = saturate(1 - shoreDepth / ShoreFoamDepth) * saturate(0.25f + 2 * length(waterNormal.xz));
+		foam = max(foam, shoreFoam);
+	}
 
 	// Distort the UVs in screen space based on the distance travelled by the light and the the offset direction from the surface
 	// normal. This is an approximation, not physically accurate. When light is bent due to reflection/refraction then the further
 	// it travels, the more offset the object we end up seeing at that point. Most games don't account for this and just have a
 	// fixed maximum offset. The advantage of this method is that objects deep underwater are much more distorted. The disadvantage
 	// is that it is more likely to try and sample offscreen.
-	float2 refractionUV = screenUV + RefractionDistortion * refractionDepth  * offsetDir / input.projectedPosition.w;
-	// TODO - STAGE 3: Get reflection distortion working
-	//                 The normals sampled in the previous stage allow us to distort the relflection and refraction. It's working
-	//                 for refraction, but the line below needs to be written to make reflection distortion work. A simple task,
-	//                 the process is exactly the same as the refraction line. Check it is working when you're done
-	float2 reflectionUV = screenUV + ReflectionDistortion * reflectionHeight * offsetDir / input.projectedPosition.w; // Needs more code on this line, see comment above
-	float4 refractColour = RefractionMap.Sample(BilinearMirror, refractionUV) * RefractionStrength; 
-	float4 reflectColour = ReflectionMap.Sample(BilinearMirror, reflectionUV) * ReflectionStrength;
+	// The distortion fades out at the water's edge, so the refraction there doesn't pick up the ground above the water
+	float2 refractionUV = refractionScreenUV;
+	float2 reflectionUV = reflectionScreenUV;
+	[branch] if (!farWater)
+	{
+		float reflectionHeight = ReflectionDistortionMap.SampleLevel(BilinearMirror, float3(RenderedUV(reflectionScreenUV, gReflectionUVScale, ReflectionDistortionMap), 0), 0).r;
+		refractionUV += RefractionDistortion * min(refractionDepth, edgeDepth) * offsetDir * nearWeight / input.projectedPosition.w;
+		// TODO - STAGE 3: Get reflection distortion working
+		//                 The normals sampled in the previous stage allow us to distort the relflection and refraction. It's working
+		//                 for refraction, but the line below needs to be written to make reflection distortion work. A simple task,
+		//                 the process is exactly the same as the refraction line. Check it is working when you're done
+		reflectionUV += ReflectionDistortion * reflectionHeight * offsetDir * nearWeight / input.projectedPosition.w; // Needs more code on this line, see comment above
+	}
+
+	// The reflection and refraction maps have mip-maps (see WaterTextureMipLevels in Scene.cpp). The mip-map is chosen from how
+	// quickly the UVs change between pixels, made larger where the water is rough, so choppy or distant water shows a blurred
+	// image rather than a sharp mirror. As with the cube map below, the changes are found before the branches that sample them
+	float  roughness = length(waterNormal.xz) + length(fwidth(waterNormal.xz));
+	float  blur = 1 + RoughnessBlur * roughness;
+	float2 refractionUVDX = ddx(refractionUV) * gRefractionUVScale * blur;
+	float2 refractionUVDY = ddy(refractionUV) * gRefractionUVScale * blur;
+	float2 reflectionUVDX = ddx(reflectionUV) * gReflectionUVScale * blur;
+	float2 reflectionUVDY = ddy(reflectionUV) * gReflectionUVScale * blur;
+
+	// The refraction is upsampled using depth when it has been rendered smaller than the viewport, except for far water where
+	// the upsampled edges are too small to see. The reflection is not: it is a view from a different camera so there is no
+	// full size depth to compare against, and it is more blurred by the waves anyway. The upsampling keeps to the top mip-map,
+	// its depths are only of that level
+	// Screen-space refraction is from the full size main pass, there is nothing to upsample
+	float4 refractColour;
+	[branch] if (gScreenSpaceRefraction > 0)
+	{
+		refractColour = ScreenSpaceRefraction(refractionScreenUV, refractionUV, input.worldPosition.y);
+	}
+	else if (gWaterViewportSize.x < gViewportWidth && !farWater)
+	{
+		// Compare against the scene depth at the distorted position, which is the pixel that is actually being refracted
+		float2 pixelPosition = clamp(refractionUV * float2(gViewportWidth, gViewportHeight), 0, float2(gViewportWidth, gViewportHeight) - 1);
+		refractColour = SampleRefractionUpsampled(RenderedUV(refractionUV, gRefractionUVScale, RefractionMap), pixelPosition);
+	}
+	else
+	{
+		refractColour = RefractionMap.SampleGrad(BilinearMirror, float3(RenderedUV(refractionUV, gRefractionUVScale, RefractionMap), 0), refractionUVDX, refractionUVDY);
+	}
+	refractColour *= RefractionStrength;
+
+	// Near the camera the reflection comes from the reflection map, further away from the environment map in the direction
+	// reflected off the waves, fading between them. The cube map mip-map is chosen from how quickly the reflected direction
+	// changes between pixels, so it is blurrier where the waves are rough or far away. The changes are found before the
+	// branches below, as they can't be found for pixels next to each other that take different branches
+	float  planarWeight = saturate((gPlanarReflectionDistance - cameraDistance) / max(0.25f * gPlanarReflectionDistance, 0.001f));
+	float3 reflectedDirection = reflect(-normalToCamera, waterNormal);
+	float3 reflectedDirectionDX = ddx(reflectedDirection);
+	float3 reflectedDirectionDY = ddy(reflectedDirection);
+	float4 reflectColour = 0;
+	if (planarWeight > 0)
+	{
+		reflectColour = ReflectionMap.SampleGrad(BilinearMirror, float3(RenderedUV(reflectionUV, gReflectionUVScale, ReflectionMap), 0), reflectionUVDX, reflectionUVDY);
+	}
+	if (planarWeight < 1)
+	{
+		float4 environmentColour = EnvironmentMap.SampleGrad(StandardFilter, reflectedDirection, reflectedDirectionDX, reflectedDirectionDY);
+		reflectColour = lerp(environmentColour, reflectColour, planarWeight);
+	}
+
+	// Screen-space reflections replace the reflection map altogether (planarWeight is 0), tracing the reflected direction
+	// through the scene on screen. Where the ray misses, and on far water, the environment map above is left showing
+	[branch] if (gScreenSpaceReflections > 0 && !farWater)
+	{
+		float4 screenSpaceColour = ScreenSpaceReflection(input.worldPosition, reflectedDirection);
+		reflectColour.rgb = lerp(reflectColour.rgb, screenSpaceColour.rgb, screenSpaceColour.a * nearWeight);
+	}
+	reflectColour *= ReflectionStrength;
 
 	// Fade out reflections at water's edge to avoid errors from using a planar approximation to a bumpy surface
-	reflectColour = lerp(refractColour, reflectColour, saturate(refractionDepth * MaxDistortionDistance / (0.5f * MaxWaveHeight * gWaveScale)));
+	reflectColour = lerp(refractColour, reflectColour, saturate(edgeDepth * MaxDistortionDistance / (0.5f * MaxWaveHeight * gWaveScale)));
 
 	// Specular lighting calculation. As the water reflects the sky and the lights, then strictly speaking specular light is not
-	// needed, because it is just an approximation for the reflection of the light. However, without implementing HDR lighting (high 
-	// dynamic range) the reflected lights are quite dim, so use the specular lighting equations to get a stronger effect.
-	float3 normalToCamera = normalize(gCameraPosition - input.worldPosition);
+	// needed, because it is just an approximation for the reflection of the light. The scene is rendered in HDR (high dynamic
+	// range, see PostProcess.h) so the reflected lights are bright already, the specular adds the sharp highlights of the sun-glints
+	// that the low resolution reflection misses.
 
-	// Light 1
-	float3 vectorToLight = gLight1Position - input.worldPosition; 
-	float3 normalToLight = normalize(vectorToLight);
-	float3 halfwayVector = normalize(normalToLight + normalToCamera);
-	float3 specularLight1 = gLight1Colour * pow( max( dot(waterNormal, halfwayVector), 0 ), gSpecularPower ) / length(vectorToLight);
-
-	// Light 2
-	// TODO - STAGE 5: Add specular light to enhance the reflected lights
-	//                 Two lights in this scene, specular from first big light is calculated above. Do the same specular
-	//                 calculation for the small second light here. Ensure you can see the result
-    float3 specularLight2 = gLight2Colour * pow(max(dot(waterNormal, halfwayVector), 0), gSpecularPower) / length(vectorToLight);; // Not 0, read comment above
+	// The lights of the pixel's light grid cell are added, unless switched off with WATER_SPECULAR_LIGHTS (see Common.hlsli)
+	float3 specularLight = 0;
+#if WATER_SPECULAR_LIGHTS
+	uint2 cell = LightCell(input.worldPosition);
+	for (uint i = 0; i < cell.y; ++i)
+	{
+		PointLight light = Lights[LightIndices[cell.x + i]];
+		float3 vectorToLight = light.position - input.worldPosition;
+		float  lightDist = length(vectorToLight);
+		float3 halfwayVector = normalize(vectorToLight / lightDist + normalToCamera);
+		float3 lightSpecular = light.colour * pow(max(dot(waterNormal, halfwayVector), 0), gSpecularPower) * LightFalloff(lightDist, light.range);
+		if (light.shadowed != 0)  lightSpecular *= ShadowFactor(input.worldPosition);
+		specularLight += lightSpecular;
+	}
+#endif
 	
-	// Add the effect of the two lights into the reflected colour
-	reflectColour.rgb += SpecularStrength * (specularLight1 + specularLight2);
+	// Add the effect of the lights into the reflected colour
+	reflectColour.rgb += SpecularStrength * specularLight;
 
 
 	// Fresnel effect: the reflected and refracted light is blended based on angle of viewer to surface normal. A glancing angle
@@ -131,12 +467,22 @@ float4 main(WorldPositionPixelShaderInput input) : SV_Target
 	//                 Find the Fresnel approximation in the lecture notes and implement here. You will need waterNormal and the
 	//                 normal to the camera. Result should go in the "fresnel" variable below. When correct you should get strong
 	//                 reflection at a glancing angle and little reflection when viewing straight down
+#if WATER_FRESNEL
 	float n1 = 1.0; // Refractive index of air
 	float n2 = WaterRefractiveIndex; 
     float f0 = ((n1 - n2) / (n1 + n2)) * ((n1 - n2) / (n1 + n2));
-    float exp = pow(1 - saturate(dot(waterNormal, normalToCamera)), 5);
+    float cosine = 1 - saturate(dot(waterNormal, normalToCamera));
+    float cosine2 = cosine * cosine;
+    float exp = cosine2 * cosine2 * cosine; // pow(.., 5) as multiplies, cheaper than the exp and log pow uses
     float fresnel = saturate(lerp(f0, 1, exp)); // Not 0.25, read the comment above
+#else
+	float fresnel = 0.5f; // Fresnel switched off (see WATER_FRESNEL in Common.hlsli), equal reflection and refraction everywhere
+#endif
+
+	float4 waterColour = lerp(refractColour, reflectColour, fresnel);
 
-	return lerp(refractColour, reflectColour, fresnel);
+	// Foam from the FFT ocean where the wave crests are sharpest and trailing behind them, and along the shore (see above)
+	waterColour.rgb = lerp(waterColour.rgb, FoamColour, foam * FoamStrength);
+	return waterColour;
 }
 
@@ -0,0 +1,145 @@
+//--------------------------------------------------------------------------------------
+// Lit geometry in the refraction and reflection
+//--------------------------------------------------------------------------------------
+// The work the refracted and reflected pixel lighting shaders add to the standard pixel lighting,
+// shared with the water views shader, which draws both at once (see WaterViewsPixelLighting_ps.hlsl).
+// Each takes the matrix of the camera it is rendered from, used to find the water surface height.
+//
+// The refraction and reflection are distorted, darkened by the water and blended by the Fresnel
+// term, so the lower quality presets light them more cheaply. A shader that defines
+// SIMPLE_WATER_TEXTURE_LIGHTING before including this file lights its pixels with the diffuse of
+// the lights in the pixel's light grid cell only: no specular, and no shadow map or caustics
+// samples (see the simple lighting shaders and RenderSettings::simpleWaterLighting in Settings.h).
+
+#ifndef _WATER_TEXTURE_LIGHTING_HLSLI_DEFINED_
+#define _WATER_TEXTURE_LIGHTING_HLSLI_DEFINED_
+
+#include "Common.hlsli"
+
+// Actually include the pixel lighting shader so the code can be shared. Only need the additional work for refraction and
+// reflection here. Unusual but works fine
+#include "PixelLighting_ps.hlsl"
+
+
+//--------------------------------------------------------------------------------------
+// Texture maps
+//--------------------------------------------------------------------------------------
+
+// Note that the texture register numbers are important - slots 0-5 are not used here, but are used in other shaders
+// We make sure each map gets a unique slot across all the shaders in use at any given point
+
+// The water surface height comes from the water depth map in slot 2 (see WaterSurfaceHeight in Common.hlsli)
+
+
+//--------------------------------------------------------------------------------------
+// Lighting
+//--------------------------------------------------------------------------------------
+
+// Diffuse lighting from the lights reaching the pixel's light grid cell, with no specular, shadows or caustics. All the lights
+// rather than only the nearest, the lamps lighting the ground are what stand out in the reflection
+float3 SimplePixelLighting(LightingPixelShaderInput input)
+{
+    float3 worldNormal = normalize(input.worldNormal);
+
+    float3 diffuseLight = gAmbientColour;
+    uint2 cell = LightCell(input.worldPosition);
+    for (uint i = 0; i < cell.y; ++i)
+    {
+        PointLight light = Lights[LightIndices[cell.x + i]];
+        float3 lightVector = light.position - input.worldPosition;
+        float  lightDist = length(lightVector);
+        diffuseLight += light.colour * max(dot(worldNormal, lightVector / lightDist), 0) * LightFalloff(lightDist, light.range);
+    }
+
+    float3 textureColour = DiffuseSpecularMap.Sample(StandardFilter, float3(input.uv, gTextureLayer)).rgb;
+    return diffuseLight * textureColour * gObjectColour;
+}
+
+// The colour of a lit pixel in the refraction or reflection, by the standard pixel lighting shader (included at the top) or
+// the simple lighting above
+float3 WaterTextureLitColour(LightingPixelShaderInput input)
+{
+#ifdef SIMPLE_WATER_TEXTURE_LIGHTING
+    return SimplePixelLighting(input);
+#else
+    return PixelLighting(input).rgb;
+#endif
+}
+
+
+//--------------------------------------------------------------------------------------
+// Refraction (for geometry below the water)
+//--------------------------------------------------------------------------------------
+
+WaterTexturePixelShaderOutput RefractedPixelLighting(LightingPixelShaderInput input, float4x4 cameraMatrix)
+{
+    // Get the height of the water surface at this pixel to find if it is underwater
+    float waterHeight = WaterSurfaceHeight(input.projectedPosition, cameraMatrix);
+    float objectDepth = waterHeight - input.worldPosition.y;
+
+    // Remove pixels with negative depth - i.e. above the water. With hardware clipping (gWaterClipMargin > 0) everything more
+    // than the margin above the water is already gone, so only pixels in the band near the surface need the test
+    [branch] if (gWaterClipMargin == 0 || input.worldPosition.y > gWaterPlaneY - gWaterClipMargin)
+    {
+        clip(objectDepth);
+    }
+
+    // Get the basic colour for this pixel by calling the standard pixel-lighting shader (included at the top), or the
+    // simple lighting
+    float3 sceneColour = WaterTextureLitColour(input);
+
+    // Darken the colour based on the depth underwater
+    // TODO - STAGE 1: Darken deep water
+    //                 Use the < and > keys to adjust the water height, we would like objects going deep underwater to darken and
+    //                 become blue as happens will real water. The second line below (refractionColour = ...) does the colour tint, 
+    //                 but first you need to calculate a factor of how much to darken. There is a constant "WaterExtinction" in the
+    //                 common.hlsi file. It sets how many metres red, blue and green light can travel in water. We also have the
+    //                 depth underwater of the current pixel in the variable "objectDepth":
+    //                 - Formula needed in line below is simple, object depth divided by water extinction level
+    //                 - However, ensure the result does not exceed 1. There is a HLSL function to do this better than an if, but
+    //                   use an "if" if you don't remember it.
+    //                 When finished ensure objects underwater darken to blue
+    float3 depthDarken = saturate(objectDepth / WaterExtinction); // Not 0, read comment above
+    float3 refractionColour = lerp(sceneColour, normalize(WaterExtinction) * WaterDiffuseLevel, depthDarken);
+
+    // Store the darkened colour and a value representing how deep the pixel is (used for refraction distortion)
+    // The depth value is written to an 8-bit texture, so has limited accuracy
+    WaterTexturePixelShaderOutput output;
+    output.colour = float4(refractionColour, 1.0f);
+    output.distortion = saturate(objectDepth / MaxDistortionDistance); // Ranges 0->1 for depths of 0 to MaxDistortionDistance
+    return output;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Reflection (for geometry above the water, from the mirrored camera)
+//--------------------------------------------------------------------------------------
+
+WaterTexturePixelShaderOutput ReflectedPixelLighting(LightingPixelShaderInput input, float4x4 cameraMatrix)
+{
+  // With hardware clipping (gWaterClipMargin > 0) everything more than the margin below the water is already gone, and pixels
+  // more than the margin above it can't be below the waves, so only pixels in the band near the surface need the water height
+  // map. Further away the flat water plane is close enough for the distortion amount
+  float objectHeight = input.worldPosition.y - gWaterPlaneY;
+  [branch] if (gWaterClipMargin == 0 || objectHeight < gWaterClipMargin)
+  {
+    // Get the height of the water surface at this pixel to find if it is underwater. The bumps on the water surface are
+    // inverted when calculating effective height (downwards!) of this pixel in the reflection - WaterSurfaceHeight does
+    // that for the reflected camera. This is a cheat to enable us to use a simple planar reflection on a bumpy surface
+    objectHeight = input.worldPosition.y - WaterSurfaceHeight(input.projectedPosition, cameraMatrix);
+    clip(objectHeight); // Remove pixels with negative height - i.e. below the water
+  }
+
+  // Get the basic colour for this pixel by calling the standard pixel-lighting shader (included at the top), or the simple
+  // lighting
+  float3 sceneColour = WaterTextureLitColour(input);
+
+  // Store the (reflected) scene colour and a value representing how high the pixel is (used for reflection distortion)
+  // The height value is written to an 8-bit texture, so has limited accuracy
+  WaterTexturePixelShaderOutput output;
+  output.colour = float4(sceneColour, 1.0f);
+  output.distortion = saturate(objectHeight / MaxDistortionDistance); // Ranges 0->1 for heights of 0 to MaxDistortionDistance
+  return output;
+}
+
+#endif // _WATER_TEXTURE_LIGHTING_HLSLI_DEFINED_
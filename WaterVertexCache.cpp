@@ -0,0 +1,151 @@
+//--------------------------------------------------------------------------------------
+// The displaced vertices of the water grid, made once a frame and shared by its passes
+//--------------------------------------------------------------------------------------
+
+#include "WaterVertexCache.h"
+#include "Mesh.h"
+#include "Shader.h"
+#include "State.h"
+#include "StateCache.h"
+#include "Common.h"
+#include "GraphicsHelpers.h"
+#include "GpuEvents.h"
+#include "GpuMemory.h"
+
+#include <stdexcept>
+
+
+WaterVertexCache* gWaterVertexCache = nullptr;
+
+// Must match WaterDisplaceThreadGroupSize in WaterDisplace_cs.hlsl
+const unsigned int WATER_DISPLACE_THREAD_GROUP_SIZE = 8;
+
+
+// The buffer is made by the first Update
+// Will throw a std::runtime_error exception on failure (same as Mesh)
+WaterVertexCache::WaterVertexCache()
+{
+	mFrameConstantBuffer = CreateConstantBuffer(sizeof(PerFrameConstants));
+	mModelConstantBuffer = CreateConstantBuffer(sizeof(PerModelConstants));
+	if (mFrameConstantBuffer == nullptr || mModelConstantBuffer == nullptr)
+	{
+		Release();
+		throw std::runtime_error("Error creating water vertex cache constant buffers");
+	}
+	SetDebugName(mFrameConstantBuffer, "Water Vertex Cache Frame Constants");
+	SetDebugName(mModelConstantBuffer, "Water Vertex Cache Model Constants");
+}
+
+WaterVertexCache::~WaterVertexCache()
+{
+	Release();
+}
+
+
+// Move the vertices of a bufferless water grid, drawn by a model with the given world matrix, by the current waves and
+// ripples into the buffer. Leaves the compute shader stage with nothing bound
+// Returns false with a message in gLastError if the buffer couldn't be made larger for a larger grid
+bool WaterVertexCache::Update(Mesh* grid, const CMatrix4x4& worldMatrix, const PerFrameConstants& frameConstants,
+                              ID3D11ShaderResourceView* waveComposite, ID3D11ShaderResourceView* oceanDisplacement,
+                              ID3D11ShaderResourceView* ripples)
+{
+	unsigned int columns = grid->GridSubDivX() + 1;
+	unsigned int rows    = grid->GridSubDivZ() + 1;
+	if (!Reserve(columns * rows))
+	{
+		gLastError = "Error creating water vertex cache";
+		return false;
+	}
+
+	// The same per-model constants as Mesh::Render sends for the grid, so the vertices are placed exactly as WaterSurface_vs
+	// places them
+	PerModelConstants modelConstants = {};
+	modelConstants.worldMatrix      = grid->GridWorldMatrix(worldMatrix);
+	modelConstants.gridSubdivisions = CVector2(static_cast<float>(grid->GridSubDivX()), static_cast<float>(grid->GridSubDivZ()));
+	UpdateConstantBuffer(mFrameConstantBuffer, frameConstants);
+	UpdateConstantBuffer(mModelConstantBuffer, modelConstants);
+
+	// The buffer may still be bound for drawing from last frame, it can't be written while it is
+	SetShaderResource(24, nullptr, VertexShaderStage);
+
+	ID3D11Buffer* constantBuffers[3] = { mFrameConstantBuffer, mModelConstantBuffer, gWaterConstantBuffer };
+	gD3DContext->CSSetShader(gWaterDisplaceComputeShader, nullptr, 0);
+	gD3DContext->CSSetConstantBuffers(0, 3, constantBuffers); // Slots must match Common.hlsli
+	gD3DContext->CSSetShaderResources(1, 1, &waveComposite);  // --"-- WaterWaves.hlsli
+	gD3DContext->CSSetShaderResources(7, 1, &oceanDisplacement);
+	gD3DContext->CSSetShaderResources(21, 1, &ripples);
+	gD3DContext->CSSetSamplers(0, 1, &gAnisotropicSampler);   // The sampler the vertex shader uses
+	gD3DContext->CSSetUnorderedAccessViews(0, 1, &mVerticesUAV, nullptr);
+	gD3DContext->Dispatch((columns + WATER_DISPLACE_THREAD_GROUP_SIZE - 1) / WATER_DISPLACE_THREAD_GROUP_SIZE,
+	                      (rows    + WATER_DISPLACE_THREAD_GROUP_SIZE - 1) / WATER_DISPLACE_THREAD_GROUP_SIZE, 1);
+
+	ID3D11ShaderResourceView*  nullSRV = nullptr;
+	ID3D11UnorderedAccessView* nullUAV = nullptr;
+	ID3D11Buffer*              nullBuffers[3] = {};
+	gD3DContext->CSSetShaderResources(1, 1, &nullSRV);
+	gD3DContext->CSSetShaderResources(7, 1, &nullSRV);
+	gD3DContext->CSSetShaderResources(21, 1, &nullSRV);
+	gD3DContext->CSSetUnorderedAccessViews(0, 1, &nullUAV, nullptr);
+	gD3DContext->CSSetConstantBuffers(0, 3, nullBuffers);
+	gD3DContext->CSSetShader(nullptr, nullptr, 0);
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions
+//--------------------------------------------------------------------------------------
+
+// Make the buffer hold at least the given number of vertices. Returns false on failure
+bool WaterVertexCache::Reserve(unsigned int numVertices)
+{
+	if (numVertices <= mCapacity)  return true;
+	ReleaseVertices();
+
+	D3D11_BUFFER_DESC bufferDesc = {};
+	bufferDesc.ByteWidth           = numVertices * VertexSize;
+	bufferDesc.Usage               = D3D11_USAGE_DEFAULT;
+	bufferDesc.BindFlags           = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS;
+	bufferDesc.MiscFlags           = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+	bufferDesc.StructureByteStride = VertexSize;
+
+	D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+	srvDesc.Format              = DXGI_FORMAT_UNKNOWN; // Structured buffers have no format
+	srvDesc.ViewDimension       = D3D11_SRV_DIMENSION_BUFFER;
+	srvDesc.Buffer.FirstElement = 0;
+	srvDesc.Buffer.NumElements  = numVertices;
+
+	D3D11_UNORDERED_ACCESS_VIEW_DESC uavDesc = {};
+	uavDesc.Format              = DXGI_FORMAT_UNKNOWN;
+	uavDesc.ViewDimension       = D3D11_UAV_DIMENSION_BUFFER;
+	uavDesc.Buffer.FirstElement = 0;
+	uavDesc.Buffer.NumElements  = numVertices;
+
+	if (FAILED(gD3DDevice->CreateBuffer(&bufferDesc, nullptr, &mVertices)) ||
+		FAILED(gD3DDevice->CreateShaderResourceView(mVertices, &srvDesc, &mVerticesSRV)) ||
+		FAILED(gD3DDevice->CreateUnorderedAccessView(mVertices, &uavDesc, &mVerticesUAV)))
+	{
+		ReleaseVertices();
+		return false;
+	}
+	SetDebugNames("Water Vertex Cache", mVertices, mVerticesSRV);
+	RegisterGpuResource(mVertices, "Water Vertices");
+	mCapacity = numVertices;
+	return true;
+}
+
+
+void WaterVertexCache::ReleaseVertices()
+{
+	if (mVerticesUAV)  { mVerticesUAV->Release();  mVerticesUAV = nullptr; }
+	if (mVerticesSRV)  { mVerticesSRV->Release();  mVerticesSRV = nullptr; }
+	if (mVertices)     { mVertices->Release();     mVertices    = nullptr; }
+	mCapacity = 0;
+}
+
+void WaterVertexCache::Release()
+{
+	ReleaseVertices();
+	if (mModelConstantBuffer)  { mModelConstantBuffer->Release();  mModelConstantBuffer = nullptr; }
+	if (mFrameConstantBuffer)  { mFrameConstantBuffer->Release();  mFrameConstantBuffer = nullptr; }
+}
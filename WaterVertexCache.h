@@ -0,0 +1,82 @@
+//--------------------------------------------------------------------------------------
+// The displaced vertices of the water grid, made once a frame and shared by its passes
+//--------------------------------------------------------------------------------------
+// The water grid goes through WaterSurface_vs in every pass that draws it - the water height
+// pass, the depth prepass, the water surface pass and the checkerboard fill - and each time the
+// vertex shader samples the waves and ripples and moves every vertex by the same amount. Instead
+// a compute shader moves each vertex of the grid once a frame, writing its world position and
+// water UV to a buffer, and the passes draw the grid with WaterSurfaceCached_vs, which reads its
+// vertex from the buffer and only transforms it by the pass's camera. The grid is still drawn as
+// before, a triangle strip for each row with no vertex or index buffers (see Mesh.h), so nothing
+// else changes. The buffer grows with the grid and is never shrunk.
+//
+// Only for the fixed grid of the open water. The clipmap tiles morph their vertices by their
+// distance from the camera, and the tessellated water makes its vertices on the GPU as it goes.
+
+#include "CMatrix4x4.h"
+#include <d3d11.h>
+
+#ifndef _WATER_VERTEX_CACHE_H_INCLUDED_
+#define _WATER_VERTEX_CACHE_H_INCLUDED_
+
+struct PerFrameConstants;
+class Mesh;
+
+class WaterVertexCache
+{
+//--------------------------------------------------------------------------------------
+// Construction / Usage
+//--------------------------------------------------------------------------------------
+public:
+
+	// The buffer is made by the first Update
+	// Will throw a std::runtime_error exception on failure (same as Mesh)
+	WaterVertexCache();
+	~WaterVertexCache();
+
+
+	// Move the vertices of a bufferless water grid, drawn by a model with the given world matrix, by the current waves and
+	// ripples into the buffer. The per-frame constants are those the passes start from this frame, the wave textures are
+	// the wave composite, the ocean displacement and the ripples (the same slots as in WaterWaves.hlsli). Call once per frame
+	// on the immediate context, after the waves and ripples are updated and before any pass draws the grid. Leaves the
+	// compute shader stage with nothing bound
+	// Returns false with a message in gLastError if the buffer couldn't be made larger for a larger grid
+	bool Update(Mesh* grid, const CMatrix4x4& worldMatrix, const PerFrameConstants& frameConstants,
+	            ID3D11ShaderResourceView* waveComposite, ID3D11ShaderResourceView* oceanDisplacement,
+	            ID3D11ShaderResourceView* ripples);
+
+	// The moved vertices for WaterSurfaceCached_vs, in the vertex shader's slot 24. Must be unbound before the next Update
+	ID3D11ShaderResourceView* SRV()  { return mVerticesSRV; }
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions / data
+//--------------------------------------------------------------------------------------
+private:
+
+	// Make the buffer hold at least the given number of vertices. Returns false on failure
+	bool Reserve(unsigned int numVertices);
+
+	void ReleaseVertices();
+	void Release();
+
+	// World position then water UV, as WaterVertex in WaterWaves.hlsli
+	static constexpr unsigned int VertexSize = 5 * sizeof(float);
+
+	// The compute shader reads the rendering constant buffers, so they are copied into buffers of its own. The passes send
+	// theirs through the constant ring (see StateCache.h), which only binds them to the drawing stages
+	ID3D11Buffer* mFrameConstantBuffer = nullptr;
+	ID3D11Buffer* mModelConstantBuffer = nullptr;
+
+	unsigned int               mCapacity = 0; // Vertices the buffer can hold
+	ID3D11Buffer*              mVertices = nullptr;
+	ID3D11ShaderResourceView*  mVerticesSRV = nullptr;
+	ID3D11UnorderedAccessView* mVerticesUAV = nullptr;
+};
+
+
+// The cache used by the app, created in InitScene (see Scene.cpp)
+extern WaterVertexCache* gWaterVertexCache;
+
+
+#endif //_WATER_VERTEX_CACHE_H_INCLUDED_
@@ -0,0 +1,20 @@
+//--------------------------------------------------------------------------------------
+// Pixel shader for lit geometry in the water views pass
+//--------------------------------------------------------------------------------------
+// Lights the pixels of both the refraction and the reflection, drawn at once by the water views
+// geometry shader (see WaterViews_gs.hlsl). Each pixel is shaded as the refracted or reflected pixel
+// lighting shader would, chosen by the view it is in. All the pixels of a triangle are in the same
+// view, so the branch doesn't diverge within a triangle.
+
+#include "WaterTextureLighting.hlsli"
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+WaterTexturePixelShaderOutput main(WaterViewsPixelShaderInput input)
+{
+	[branch] if (input.view == 0)  return RefractedPixelLighting(input.lighting, gWaterViewCameraMatrices[0]);
+	else                           return ReflectedPixelLighting(input.lighting, gWaterViewCameraMatrices[1]);
+}
@@ -0,0 +1,19 @@
+//--------------------------------------------------------------------------------------
+// Pixel shader for geometry in the water views pass with simple lighting
+//--------------------------------------------------------------------------------------
+// The water views pixel lighting shader with diffuse lighting only, for the lower quality presets
+// (see SIMPLE_WATER_TEXTURE_LIGHTING in WaterTextureLighting.hlsli)
+
+#define SIMPLE_WATER_TEXTURE_LIGHTING
+#include "WaterTextureLighting.hlsli"
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+WaterTexturePixelShaderOutput main(WaterViewsPixelShaderInput input)
+{
+	[branch] if (input.view == 0)  return RefractedPixelLighting(input.lighting, gWaterViewCameraMatrices[0]);
+	else                           return ReflectedPixelLighting(input.lighting, gWaterViewCameraMatrices[1]);
+}
@@ -0,0 +1,47 @@
+//--------------------------------------------------------------------------------------
+// Water views geometry shader
+//--------------------------------------------------------------------------------------
+// Draws each triangle of the lit models into both the refraction and the reflection, so the water
+// views pass draws each model once for the two (see RenderWaterViewsPass in Scene.cpp). The shader
+// runs twice for each triangle (geometry shader instancing), once for each view. The vertex shaders
+// are the materials' own, this reprojects their world positions with the view's camera and sends
+// the triangle to the view's slice of the water textures and to its viewport.
+//
+// The reflection is from the camera mirrored in the water, which turns the triangles over, so that
+// view keeps the back faces where the refraction keeps the front faces. The rasterizer can't cull
+// differently for each view, so it culls nothing and the culling is done here.
+
+#include "Common.hlsli"
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+[instance(2)]
+[maxvertexcount(3)]
+void main(triangle LightingPixelShaderInput input[3], uint view : SV_GSInstanceID, inout TriangleStream<WaterViewsPixelShaderInput> output)
+{
+	float4 projected[3];
+	[unroll] for (int i = 0; i < 3; ++i)
+	{
+		projected[i] = mul(gWaterViewProjectionMatrices[view], float4(input[i].worldPosition, 1));
+	}
+
+	// The winding of the triangle on the screen, from the determinant of its projected x, y and w. It has the sign of the
+	// triangle's area on the screen even for points behind the camera, so needs no divide by w. Front faces are clockwise on the
+	// screen, which with y up is a negative area
+	float winding = determinant(float3x3(projected[0].xyw, projected[1].xyw, projected[2].xyw));
+	if (view == 0 ? winding >= 0 : winding <= 0)  return;
+
+	[unroll] for (int j = 0; j < 3; ++j)
+	{
+		WaterViewsPixelShaderInput vertex;
+		vertex.lighting = input[j];
+		vertex.lighting.projectedPosition = projected[j];
+		vertex.lighting.clipDistance = dot(float4(input[j].worldPosition, 1), gWaterViewClipPlanes[view]);
+		vertex.view     = view;
+		vertex.viewport = view;
+		output.Append(vertex);
+	}
+}
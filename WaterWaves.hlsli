@@ -0,0 +1,170 @@
+//--------------------------------------------------------------------------------------
+// Water wave functions shared by the water shaders
+//--------------------------------------------------------------------------------------
+// The water surface height is needed in more than one shader (vertex shader for the ordinary
+// water grid, domain shader for the tessellated water), so the code lives here. The waves come
+// either from the scrolling normal/height map or from the FFT ocean simulation (see OceanFFT.h)
+
+#ifndef _WATER_WAVES_HLSLI_DEFINED_
+#define _WATER_WAVES_HLSLI_DEFINED_
+
+#include "Common.hlsli"
+
+
+//--------------------------------------------------------------------------------------
+// Texture maps
+//--------------------------------------------------------------------------------------
+
+// Note that the texture register numbers are important - slot 0 is not used here, but is used for the diffuse texture in
+// other shaders, so the first texture goes to slot 1. Similarly there is a water depth map used for other shaders in slot 2
+// We make sure each map gets a unique slot across all the shaders in use at any given point
+// The layers of the water wave normal/height map, combined into one texture each frame (see WaveComposite.h). xyz is the sum
+// of the layers' normals with z up, w the average of their heights. It repeats every WaveCompositeTileUVs water UVs
+Texture2D WaveComposite : register(t1);
+
+// FFT ocean results, only used when gOceanEnabled is set. Both repeat every gOceanPatchSize world units
+Texture2D OceanDisplacementMap : register(t7); // xyz offset of the water surface (before wave scale)
+Texture2D OceanNormalFoamMap   : register(t8); // x and z slopes of the surface, Jacobian, foam amount
+
+// Ripples from the objects moving through the water around the camera, added to either kind of waves (see Ripples.h). The
+// height is in the r channel, only used when gRippleStrength isn't 0
+Texture2D RippleMap : register(t21);
+
+// Flow of the water body being drawn in world units per second in x and z, only used when gFlowMapEnabled isn't 0 (see
+// WaterBody.h)
+Texture2D FlowMap : register(t22);
+
+SamplerState StandardFilter : register(s0); // Filtering used on most textures (trilinear or anisotropic - chosen on the C++ side)
+
+
+//--------------------------------------------------------------------------------------
+// Wave functions
+//--------------------------------------------------------------------------------------
+
+// Water UVs are based on world position rather than the grid's own UVs, so the waves continue smoothly across
+// the water however it is split up. For the original 400x400 grid centred at the origin these are the same UVs
+float2 WaterUV(float3 worldPosition)
+{
+	return float2(worldPosition.x / WaterWidth + 0.5f, 0.5f - worldPosition.z / WaterWidth);
+}
+
+
+// Water UVs across one tile of the combined waves, must match CompositeTileUVs in WaveComposite_cs.hlsl
+static const float WaveCompositeTileUVs = 2.0f;
+
+// Sum of the normals of the wave layers at the given water UV, with z up and not normalised (see WaveComposite_cs.hlsl)
+float3 WaveLayersNormal(float2 waterUV)
+{
+	return WaveComposite.Sample(StandardFilter, waterUV / WaveCompositeTileUVs).xyz;
+}
+
+
+// Seconds for the waves to be carried along before they are taken back and start again, see below
+static const float FlowCycle = 2.0f;
+
+// WaveLayersNormal carried along by the flow map of the water body being drawn at the given world xz. The waves are moved
+// on by the flow, but would then stretch more and more, so they are taken back to where they started every FlowCycle. Two
+// samples half a cycle apart are blended, each fading out as it is taken back, and offset from each other so the blend
+// doesn't show one pattern pulsing. One sample of the combined waves as before when there is no flow, two with it, however
+// many layers the waves have (see WaveComposite.h)
+float3 FlowingWaveLayersNormal(float2 waterUV, float2 worldXZ)
+{
+	[branch] if (gFlowMapEnabled == 0)  return WaveLayersNormal(waterUV);
+
+	float2 flowMapUV = (worldXZ - gFlowMapOrigin) * gFlowMapScale;
+	float2 flow = all(flowMapUV >= 0 && flowMapUV <= 1) ? FlowMap.Sample(StandardFilter, flowMapUV).xy : 0;
+	float2 flowUV = float2(flow.x, -flow.y) * (FlowCycle / WaterWidth); // Across water UVs (see WaterUV) in a whole cycle
+
+	float phase0 = frac(gFlowTime / FlowCycle);
+	float phase1 = frac(phase0 + 0.5f);
+	float3 normal0 = WaveLayersNormal(waterUV - flowUV * phase0);
+	float3 normal1 = WaveLayersNormal(waterUV - flowUV * phase1 + 0.5f);
+	return lerp(normal1, normal0, 1 - abs(1 - 2 * phase0));
+}
+
+
+// Height of the waves above/below the water plane at the given water UV, from the layers combined at up to four different
+// sizes (see wavelayers in Settings.h), each moving at its own speed
+// Uses SampleLevel as this is used in vertex / domain shaders, which don't have the information to choose a mip-map
+float WaterWaveHeight(float2 waterUV)
+{
+	float height = WaveComposite.SampleLevel(StandardFilter, waterUV / WaveCompositeTileUVs, 0).w;
+
+	// Scale the average height to world units. -0.5 makes wave movement an equal amount up or down from basic water height
+	return (height - 0.5f) * MaxWaveHeight * gWaveScale;
+}
+
+
+// Ripples over this part of the ripple texture at each edge fade out, the water beyond is flat
+static const float RippleEdgeFade = 0.1f;
+
+// Height of the ripples at the given world xz on water at the given height. 0 for other water and outside the ripple texture
+// Uses SampleLevel, as WaterWaveHeight
+float RippleHeight(float2 worldXZ, float waterPlaneY)
+{
+	if (gRippleStrength == 0 || abs(waterPlaneY - gRipplePlaneY) > 0.5f)  return 0;
+
+	float2 uv = (worldXZ - gRippleOrigin) * gRippleScale;
+	float2 edgeDistance = min(uv, 1 - uv);
+	float  fade = saturate(min(edgeDistance.x, edgeDistance.y) / RippleEdgeFade);
+	return RippleMap.SampleLevel(StandardFilter, uv, 0).r * fade * gRippleStrength;
+}
+
+
+// Tilt a water surface normal (y up) by the slope of the ripples at the given world xz on water at the given height
+float3 AddRippleNormal(float3 normal, float2 worldXZ, float waterPlaneY)
+{
+	if (gRippleStrength == 0)  return normal;
+
+	float width, height;
+	RippleMap.GetDimensions(width, height);
+	float texelSize = 1 / (gRippleScale * width);
+	float2 slope = float2(RippleHeight(worldXZ + float2(texelSize, 0), waterPlaneY) - RippleHeight(worldXZ - float2(texelSize, 0), waterPlaneY),
+	                      RippleHeight(worldXZ + float2(0, texelSize), waterPlaneY) - RippleHeight(worldXZ - float2(0, texelSize), waterPlaneY)) /
+	               (2 * texelSize);
+
+	// Add the slopes as heightfields do, then normalise
+	return normalize(float3(normal.x / normal.y - slope.x, 1, normal.z / normal.y - slope.y));
+}
+
+
+// Offset of the water surface from the flat water plane at the given world position. The FFT ocean moves the
+// surface sideways as well as up and down (making sharper crests), the normal/height map only moves it vertically
+// The ripples are added to either
+float3 WaterWaveDisplacement(float3 worldPosition)
+{
+	float3 ripple = float3(0, RippleHeight(worldPosition.xz, worldPosition.y), 0);
+	[branch] if (gOceanEnabled > 0)
+	{
+		return OceanDisplacementMap.SampleLevel(StandardFilter, worldPosition.xz / gOceanPatchSize, 0).xyz * gWaveScale + ripple;
+	}
+	else
+	{
+		return float3(0, WaterWaveHeight(WaterUV(worldPosition)), 0) + ripple;
+	}
+}
+
+
+// Whether the pixel at the given position, showing the given world position on the water, is in one of the 2x2 blocks of far
+// water the water surface pixel shader skips (see gWaterCheckerboardDistance). WaterCheckerboardFill_ps fills them in from
+// the blocks around them. Whole blocks are skipped, as pixels are shaded in 2x2 quads - skipping single pixels saves nothing
+bool WaterCheckerboardSkipped(float2 pixelPosition, float3 worldPosition)
+{
+	uint2 block = uint2(pixelPosition) / 2;
+	return ((block.x + block.y) & 1) != 0 && distance(worldPosition, gCameraPosition) > gWaterCheckerboardDistance;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Cached water vertices
+//--------------------------------------------------------------------------------------
+
+// A vertex of the water grid moved by the waves, made once a frame by WaterDisplace_cs and read by WaterSurfaceCached_vs
+// (see WaterVertexCache.h). The size must match VertexSize in WaterVertexCache.h
+struct WaterVertex
+{
+	float3 worldPosition;
+	float2 uv; // Water UV, taken before the waves moved the vertex
+};
+
+#endif // _WATER_WAVES_HLSLI_DEFINED_
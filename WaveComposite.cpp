@@ -0,0 +1,95 @@
+//--------------------------------------------------------------------------------------
+// The scrolling wave normal/height map layers combined into one texture each frame
+//--------------------------------------------------------------------------------------
+
+#include "WaveComposite.h"
+#include "Shader.h"
+#include "State.h"
+#include "Common.h"
+#include "GraphicsHelpers.h"
+#include "GpuMemory.h"
+
+#include <stdexcept>
+
+
+// Create the combined texture, of the given size in texels across one tile of the waves (a multiple of 16)
+// Will throw a std::runtime_error exception on failure (same as Mesh)
+WaveComposite::WaveComposite(unsigned int resolution /*= 2048*/)
+	: mResolution(resolution)
+{
+	if (resolution == 0 || resolution % 16 != 0)  throw std::runtime_error("Wave composite size must be a multiple of 16");
+
+	mConstantBuffer = CreateConstantBuffer(sizeof(CompositeConstants));
+	if (mConstantBuffer == nullptr)  throw std::runtime_error("Error creating wave composite constant buffer");
+
+	// Summed normals and the height as half floats, with a full set of mip-maps for the pixel shader. The compute shader writes
+	// the top level and GenerateMips does the rest, which requires the render target bind flag (as Caustics)
+	D3D11_TEXTURE2D_DESC textureDesc = {};
+	textureDesc.Width  = resolution;
+	textureDesc.Height = resolution;
+	textureDesc.MipLevels = 0;
+	textureDesc.ArraySize = 1;
+	textureDesc.Format = DXGI_FORMAT_R16G16B16A16_FLOAT;
+	textureDesc.SampleDesc.Count = 1;
+	textureDesc.Usage = D3D11_USAGE_DEFAULT;
+	textureDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS | D3D11_BIND_RENDER_TARGET;
+	textureDesc.MiscFlags = D3D11_RESOURCE_MISC_GENERATE_MIPS;
+	if (FAILED(gD3DDevice->CreateTexture2D(&textureDesc, nullptr, &mTexture)) ||
+		FAILED(gD3DDevice->CreateShaderResourceView(mTexture, nullptr, &mSRV)) ||
+		FAILED(gD3DDevice->CreateUnorderedAccessView(mTexture, nullptr, &mUAV)))
+	{
+		Release();
+		throw std::runtime_error("Error creating wave composite texture");
+	}
+	SetDebugNames("Wave Composite", mTexture, mSRV);
+	RegisterGpuResource(mTexture, "Waves");
+}
+
+WaveComposite::~WaveComposite()
+{
+	Release();
+}
+
+
+// Combine the given number of layers of the given wave normal map and height map at the given water movement. Leaves the compute
+// shader stage with nothing bound. The combined texture must not be bound to other shader stages when this is called
+void WaveComposite::Generate(ID3D11ShaderResourceView* normalMap, ID3D11ShaderResourceView* heightMap, const CVector2& waterMovement,
+                             int numLayers /*= 4*/)
+{
+	mConstants.waterMovement = waterMovement;
+	mConstants.resolution    = mResolution;
+	mConstants.numLayers     = numLayers;
+	for (int i = 0; i < 4; ++i)
+	{
+		mConstants.waterSizes[i]  = gWaterConstants.waterSizes[i];
+		mConstants.waterSpeeds[i] = gWaterConstants.waterSpeeds[i];
+	}
+	UpdateConstantBuffer(mConstantBuffer, mConstants);
+
+	ID3D11ShaderResourceView*  maps[2]    = { normalMap, heightMap };
+	ID3D11ShaderResourceView*  nullSRVs[2] = {};
+	ID3D11UnorderedAccessView* nullUAV = nullptr;
+
+	gD3DContext->CSSetShader(gWaveCompositeComputeShader, nullptr, 0);
+	gD3DContext->CSSetConstantBuffers(0, 1, &mConstantBuffer);
+	gD3DContext->CSSetShaderResources(0, 2, maps);
+	gD3DContext->CSSetSamplers(0, 1, &gTrilinearSampler); // The layers repeat, so must the sampler
+	gD3DContext->CSSetUnorderedAccessViews(0, 1, &mUAV, nullptr);
+	unsigned int numGroups = mResolution / 16; // Must match CompositeThreadGroupSize in WaveComposite_cs.hlsl
+	gD3DContext->Dispatch(numGroups, numGroups, 1);
+
+	// Unbind everything so the result can be used by the water shaders, then fill in the mip-maps for them
+	gD3DContext->CSSetShaderResources(0, 2, nullSRVs);
+	gD3DContext->CSSetUnorderedAccessViews(0, 1, &nullUAV, nullptr);
+	gD3DContext->CSSetShader(nullptr, nullptr, 0);
+	gD3DContext->GenerateMips(mSRV);
+}
+
+
+void WaveComposite::Release()
+{
+	if (mUAV)             { mUAV->Release();             mUAV             = nullptr; }
+	if (mSRV)             { mSRV->Release();             mSRV             = nullptr; }
+	if (mTexture)         { mTexture->Release();         mTexture         = nullptr; }
+	if (mConstantBuffer)  { mConstantBuffer->Release();  mConstantBuffer  = nullptr; }
+}
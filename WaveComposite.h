@@ -0,0 +1,73 @@
+//--------------------------------------------------------------------------------------
+// The scrolling wave normal/height map layers combined into one texture each frame
+//--------------------------------------------------------------------------------------
+// The waves of the normal/height map are four layers of it at different sizes, each scrolling at
+// its own speed (see WaterConstants). Sampling all four in every water vertex and pixel, in every
+// pass that draws water, costs a lot of fetches. Instead a compute shader combines the layers once
+// a frame into a single texture covering one tile of the waves at a fixed resolution, and the
+// water shaders take one sample from it (see WaterWaves.hlsli). The tile is two map widths across,
+// the size the layers all repeat at. At the default resolution the smallest layer keeps half of
+// its detail, which is only seen close up. Fewer layers can be combined for lower quality settings
+// (see wavelayers in Settings.h), the smallest ones are left out first.
+
+#include "CVector2.h"
+#include <d3d11.h>
+
+#ifndef _WAVE_COMPOSITE_H_INCLUDED_
+#define _WAVE_COMPOSITE_H_INCLUDED_
+
+class WaveComposite
+{
+//--------------------------------------------------------------------------------------
+// Construction / Usage
+//--------------------------------------------------------------------------------------
+public:
+
+	// Create the combined texture, of the given size in texels across one tile of the waves (a multiple of 16)
+	// Will throw a std::runtime_error exception on failure (same as Mesh)
+	WaveComposite(unsigned int resolution = 2048);
+	~WaveComposite();
+
+
+	// Combine the given number of layers (1 to 4, largest first) of the given wave normal map and height map (see
+	// LoadNormalHeightMap) at the given water movement. Call once per frame on the immediate context, before the water is drawn.
+	// The combined texture must not be bound to any shader stage when this is called, and the compute shader stage is left with
+	// nothing bound
+	void Generate(ID3D11ShaderResourceView* normalMap, ID3D11ShaderResourceView* heightMap, const CVector2& waterMovement,
+	              int numLayers = 4);
+
+	// The combined texture for the water shaders, mip-mapped. xyz is the sum of the layers' normals (with z up, before
+	// the wave scale), w the average of their heights from 0 to 1. It tiles every two water UVs
+	ID3D11ShaderResourceView* SRV()  { return mSRV; }
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions / data
+//--------------------------------------------------------------------------------------
+private:
+
+	void Release();
+
+	// Constants for the compute shader. There is a structure in the shader code that exactly matches this one
+	struct CompositeConstants
+	{
+		CVector2     waterMovement;
+		unsigned int resolution;
+		unsigned int numLayers;
+
+		float        waterSizes[4];
+		float        waterSpeeds[4];
+	};
+
+	unsigned int mResolution;
+
+	CompositeConstants mConstants;
+	ID3D11Buffer*      mConstantBuffer = nullptr;
+
+	ID3D11Texture2D*           mTexture = nullptr;
+	ID3D11ShaderResourceView*  mSRV     = nullptr;
+	ID3D11UnorderedAccessView* mUAV     = nullptr;
+};
+
+
+#endif //_WAVE_COMPOSITE_H_INCLUDED_
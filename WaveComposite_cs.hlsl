@@ -0,0 +1,84 @@
+//--------------------------------------------------------------------------------------
+// Wave composite compute shader
+//--------------------------------------------------------------------------------------
+// Combines the scrolling layers of the wave normal/height map into one texture once per frame (see
+// WaveComposite.h). Each texel is a point on one tile of the waves, two water UVs across. The layers
+// are sampled there and combined the way the water shaders did themselves before: the normals are
+// corrected for their layer's size and summed, and the heights averaged
+// The compute shaders don't use the rendering constant buffers so have their own, and don't include Common.hlsli
+
+
+//--------------------------------------------------------------------------------------
+// Constants
+//--------------------------------------------------------------------------------------
+
+static const uint  CompositeThreadGroupSize = 16;  // Must match the thread groups dispatched in WaveComposite::Generate
+static const float CompositeTileUVs         = 2.0f; // Water UVs across the texture, the layers all repeat at this size
+
+
+//--------------------------------------------------------------------------------------
+// Constant Buffers
+//--------------------------------------------------------------------------------------
+
+// These variables must match exactly the CompositeConstants structure in WaveComposite.h
+cbuffer CompositeConstants : register(b0) // Compute shaders have their own constant buffer slots, so b0 is not the per-frame constants here
+{
+	float2 gWaterMovement;    // As the per-frame constants
+	uint   gResolution;       // Of the combined texture
+	uint   gNumLayers;        // Layers combined, 1 to 4 from the largest (see wavelayers in Settings.h)
+
+	float4 gWaterSizes;       // The layers of the wave normal map, as WaterSize1-4 and WaterSpeed1-4 in Common.hlsli
+	float4 gWaterSpeeds;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Textures
+//--------------------------------------------------------------------------------------
+
+Texture2D    WaveNormalMap  : register(t0); // x and y of the wave normals, z is rebuilt
+Texture2D    WaveHeightMap  : register(t1); // Heights of the waves in the r channel, the same size as the normals
+SamplerState StandardFilter : register(s0); // Wraps, the layers repeat
+
+RWTexture2D<float4> CompositeOut : register(u0);
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+[numthreads(CompositeThreadGroupSize, CompositeThreadGroupSize, 1)]
+void main(uint3 id : SV_DispatchThreadID)
+{
+	if (any(id.xy >= gResolution))  return;
+
+	float2 waterUV = (id.xy + 0.5f) * (CompositeTileUVs / gResolution);
+
+	// The mip-map for each layer whose texels are about the size of this texture's, the finer detail would only alias.
+	// Compute shaders can't choose mip-maps themselves
+	float width, height;
+	WaveNormalMap.GetDimensions(width, height);
+	float baseLod = log2(CompositeTileUVs / gResolution * width);
+
+	float3 normal = 0;
+	float  waveHeight = 0;
+	[unroll] for (uint layer = 0; layer < 4; ++layer)
+	{
+		if (layer >= gNumLayers)  break;
+
+		float  size = gWaterSizes[layer];
+		float2 uv   = size * (waterUV + gWaterMovement * gWaterSpeeds[layer]);
+		float  lod  = max(baseLod + log2(size), 0);
+
+		// The normals change with the layer's size because the heights don't, so correct them for it. Each is then scaled
+		// differently, so each is normalised before they are summed
+		float2 xy = WaveNormalMap.SampleLevel(StandardFilter, uv, lod).rg * 2.0f - 1.0f;
+		float3 layerNormal = float3(xy, sqrt(saturate(1.0f - dot(xy, xy))));
+		layerNormal.y *= size;
+		normal += normalize(layerNormal);
+
+		waveHeight += WaveHeightMap.SampleLevel(StandardFilter, uv, lod).r;
+	}
+
+	CompositeOut[id.xy] = float4(normal, waveHeight / gNumLayers);
+}
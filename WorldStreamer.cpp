@@ -0,0 +1,365 @@
+//--------------------------------------------------------------------------------------
+// World streamer - the level divided into chunks, only those near the camera kept in memory
+//--------------------------------------------------------------------------------------
+
+#include "WorldStreamer.h"
+#include "SceneObjects.h"
+#include "WaterBody.h"
+#include "Mesh.h"
+#include "Model.h"
+#include "Common.h"
+
+#include <algorithm>
+#include <unordered_map>
+#include <stdexcept>
+#include <cmath>
+
+
+WorldStreamingSettings gWorldStreaming;
+WorldStreamer*         gWorldStreamer = nullptr;
+
+
+//--------------------------------------------------------------------------------------
+// Construction
+//--------------------------------------------------------------------------------------
+
+// Divide the x and z extent of the given area into chunks of gWorldStreaming.chunkSize. The objects added are copies of the
+// meshes in the given files, the spheres around them (in model space) size their stand-ins
+WorldStreamer::WorldStreamer(const BoundingBox& area, const char* const* meshFiles, const BoundingSphere* meshBounds,
+                             int numMeshFiles)
+	: mMeshFiles(meshFiles, meshFiles + numMeshFiles), mMeshBounds(meshBounds, meshBounds + numMeshFiles),
+	  mMeshBytes(numMeshFiles, 0), mAreaMin(area.min),
+	  mBudget(static_cast<size_t>(gWorldStreaming.budgetMB * 1024 * 1024))
+{
+	CVector3 extent = area.max - area.min;
+	mChunkSize = (std::max)(gWorldStreaming.chunkSize, (std::max)(extent.x, extent.z) / MaxChunksAcross);
+	mChunksX = (std::max)(static_cast<int>(std::ceil(extent.x / mChunkSize)), 1);
+	mChunksZ = (std::max)(static_cast<int>(std::ceil(extent.z / mChunkSize)), 1);
+
+	for (int z = 0; z < mChunksZ; ++z)
+	{
+		for (int x = 0; x < mChunksX; ++x)
+		{
+			Chunk* chunk = new Chunk;
+			mChunks.emplace_back(chunk);
+			chunk->min = { mAreaMin.x + x * mChunkSize, area.min.y, mAreaMin.z + z * mChunkSize };
+			chunk->max = { chunk->min.x + mChunkSize, area.max.y, chunk->min.z + mChunkSize };
+			chunk->standIns.resize(numMeshFiles);
+			chunk->meshes.resize(numMeshFiles);
+
+			// Each chunk loads the files its objects use. Jobs mustn't throw, the message is kept for Update
+			chunk->load = [this, chunk]()
+			{
+				try
+				{
+					for (size_t file = 0; file < mMeshFiles.size(); ++file)
+					{
+						if (chunk->standIns[file] != nullptr)  chunk->meshes[file].reset(new Mesh(mMeshFiles[file]));
+					}
+				}
+				catch (std::runtime_error e)
+				{
+					chunk->error = e.what();
+				}
+			};
+		}
+	}
+}
+
+
+// Waits for the loads still running, then releases the models and meshes of the chunks
+WorldStreamer::~WorldStreamer()
+{
+	for (auto& chunk : mChunks)
+	{
+		gJobSystem->Wait(chunk->counter);
+		for (auto& object : chunk->objects)
+		{
+			delete object.model;
+			delete object.standIn;
+		}
+	}
+}
+
+
+// Add an object, a copy of the given mesh file, to the chunk under the given position. Returns its model, kept by the streamer,
+// drawing the chunk's stand-in for the file, which is given in mesh
+// Will throw a std::runtime_error exception if the stand-in can't be made (same as Mesh)
+Model* WorldStreamer::AddObject(int meshFile, const CVector3& position, Mesh** mesh)
+{
+	Chunk& chunk = ChunkAt(position);
+	std::unique_ptr<Mesh>& standIn = chunk.standIns[meshFile];
+	if (standIn == nullptr)
+	{
+		// A box around the sphere of the mesh it stands in for, one for each file in each chunk so each chunk's objects have
+		// their own mesh to replace (see SceneObjects::Replace)
+		const BoundingSphere& bounds = mMeshBounds[meshFile];
+		CVector3 extent = { bounds.radius, bounds.radius, bounds.radius };
+		standIn.reset(new Mesh(BoundingBox{ bounds.centre - extent, bounds.centre + extent }));
+	}
+
+	ChunkObject object;
+	object.meshFile = meshFile;
+	object.standIn = new Model(standIn.get());
+	chunk.objects.push_back(object);
+
+	*mesh = standIn.get();
+	return object.standIn;
+}
+
+
+// Add a water body to the chunk under its centre. The open water is everywhere, so is never added
+void WorldStreamer::AddWaterBody(WaterBody* body)
+{
+	if (body->IsOpenWater())  return;
+	BoundingBox bounds = body->Bounds(0);
+	mWaterBodies.push_back({ body, &ChunkAt((bounds.min + bounds.max) * 0.5f) });
+}
+
+
+// Find the scene objects of the models added, once the objects have been sorted, and hide those in every pass until their chunks
+// are streamed in
+void WorldStreamer::Register(SceneObjects* objects)
+{
+	mObjects = objects;
+
+	// Looked up by model, there may be many thousands of them
+	std::unordered_map<Model*, ChunkObject*> chunkObjects;
+	for (auto& chunk : mChunks)
+	{
+		for (auto& object : chunk->objects)  chunkObjects[object.standIn] = &object;
+	}
+
+	for (int i = 0; i < objects->NumObjects(); ++i)
+	{
+		auto found = chunkObjects.find(objects->GetModel(i));
+		if (found == chunkObjects.end())  continue;
+		found->second->object = i;
+		found->second->passes = objects->Passes(i);
+		objects->SetPasses(i, 0);
+	}
+}
+
+
+//--------------------------------------------------------------------------------------
+// Usage
+//--------------------------------------------------------------------------------------
+
+// Call once a frame during the update. Swaps in the chunks that have finished loading and streams out those too far from the
+// camera, a few each frame, then starts loads for the nearest chunks in the radius that fit in the budget. Returns false with a
+// message in gLastError if a chunk failed to load
+bool WorldStreamer::Update(const CVector3& cameraPosition, bool waitForLoads)
+{
+	bool ok = true;
+	int swaps = 0;
+	float streamOutDistance = gWorldStreaming.radius * StreamOutMargin;
+
+	// Loads that have finished. Those swapped in past the limit wait loaded for a later frame, those the camera has left behind
+	// are let go straight away
+	for (auto& chunk : mChunks)
+	{
+		if (chunk->state != ChunkState::Loading || !chunk->counter.Done())  continue;
+		if (!chunk->error.empty())
+		{
+			gLastError = chunk->error;
+			ok = false;
+			for (auto& mesh : chunk->meshes)  mesh.reset();
+			chunk->state = ChunkState::Failed;
+			--mNumLoading;
+			continue;
+		}
+
+		bool wanted = Distance(*chunk, cameraPosition) <= streamOutDistance;
+		if (wanted && swaps == MaxSwapsPerFrame)  continue;
+		--mNumLoading;
+		if (wanted)
+		{
+			StreamIn(*chunk);
+			++swaps;
+		}
+		else
+		{
+			for (auto& mesh : chunk->meshes)  mesh.reset();
+			chunk->state = ChunkState::Out;
+		}
+	}
+
+	// Chunks too far away. Chunks with no objects cost nothing to stream in or out
+	for (auto& chunk : mChunks)
+	{
+		if (swaps == MaxSwapsPerFrame)  break;
+		if (chunk->state != ChunkState::In || Distance(*chunk, cameraPosition) <= streamOutDistance)  continue;
+		StreamOut(*chunk);
+		if (!chunk->objects.empty())  ++swaps;
+	}
+
+	// The nearest chunks in the radius that are out, as many as fit in the budget. Room is made by streaming out chunks further
+	// away than the one to load, but the nearest chunk always loads however large it is
+	mCandidates.clear();
+	for (auto& chunk : mChunks)
+	{
+		if (chunk->state != ChunkState::Out)  continue;
+		float distance = Distance(*chunk, cameraPosition);
+		if (distance <= gWorldStreaming.radius)  mCandidates.push_back({ distance, chunk.get() });
+	}
+	std::sort(mCandidates.begin(), mCandidates.end(),
+	          [](const std::pair<float, Chunk*>& a, const std::pair<float, Chunk*>& b) { return a.first < b.first; });
+
+	size_t loadingBytes = 0;
+	for (auto& chunk : mChunks)
+	{
+		if (chunk->state == ChunkState::Loading)  loadingBytes += ExpectedBytes(*chunk);
+	}
+	for (auto& candidate : mCandidates)
+	{
+		if (mNumLoading == MaxLoading)  break;
+		Chunk& chunk = *candidate.second;
+		size_t bytes = ExpectedBytes(chunk);
+		auto overBudget = [&]()
+		{
+			return mResidentBytes + loadingBytes > 0 && mResidentBytes + loadingBytes + bytes > mBudget;
+		};
+		while (overBudget() && swaps < MaxSwapsPerFrame)
+		{
+			Chunk* furthest = nullptr;
+			float furthestDistance = candidate.first;
+			for (auto& other : mChunks)
+			{
+				if (other->state != ChunkState::In || other->bytes == 0)  continue;
+				float distance = Distance(*other, cameraPosition);
+				if (distance > furthestDistance)
+				{
+					furthest = other.get();
+					furthestDistance = distance;
+				}
+			}
+			if (furthest == nullptr)  break;
+			StreamOut(*furthest);
+			++swaps;
+		}
+		if (overBudget())  break; // The nearer chunks fill the budget
+
+		StartLoad(chunk);
+		loadingBytes += bytes;
+	}
+
+	if (waitForLoads)
+	{
+		for (auto& chunk : mChunks)
+		{
+			if (chunk->state == ChunkState::Loading)  gJobSystem->Wait(chunk->counter);
+		}
+	}
+	return ok;
+}
+
+
+// Whether the water body's chunk is streamed in, the open water always is
+bool WorldStreamer::IsResident(const WaterBody* body) const
+{
+	for (auto& waterBody : mWaterBodies)
+	{
+		if (waterBody.first == body)  return waterBody.second->state == ChunkState::In;
+	}
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions
+//--------------------------------------------------------------------------------------
+
+// The chunk under a point, clamped to the grid
+WorldStreamer::Chunk& WorldStreamer::ChunkAt(const CVector3& point)
+{
+	int x = static_cast<int>(std::floor((point.x - mAreaMin.x) / mChunkSize));
+	int z = static_cast<int>(std::floor((point.z - mAreaMin.z) / mChunkSize));
+	x = (std::min)((std::max)(x, 0), mChunksX - 1);
+	z = (std::min)((std::max)(z, 0), mChunksZ - 1);
+	return *mChunks[z * mChunksX + x];
+}
+
+
+// Distance across the ground from a point to the nearest part of a chunk, 0 if the point is over it
+float WorldStreamer::Distance(const Chunk& chunk, const CVector3& point)
+{
+	float x = (std::max)((std::max)(chunk.min.x - point.x, point.x - chunk.max.x), 0.0f);
+	float z = (std::max)((std::max)(chunk.min.z - point.z, point.z - chunk.max.z), 0.0f);
+	return std::sqrt(x * x + z * z);
+}
+
+
+// The memory a chunk's meshes are expected to use, from the sizes of the files loaded so far (0 for those not loaded yet)
+size_t WorldStreamer::ExpectedBytes(const Chunk& chunk) const
+{
+	size_t bytes = 0;
+	for (size_t file = 0; file < mMeshFiles.size(); ++file)
+	{
+		if (chunk.standIns[file] != nullptr)  bytes += mMeshBytes[file];
+	}
+	return bytes;
+}
+
+
+// Start a chunk loading on the thread pool. A chunk with no objects has nothing to load, so is in straight away
+void WorldStreamer::StartLoad(Chunk& chunk)
+{
+	if (chunk.objects.empty())
+	{
+		chunk.state = ChunkState::In;
+		++mNumResident;
+		return;
+	}
+	chunk.state = ChunkState::Loading;
+	++mNumLoading;
+	gJobSystem->Run(chunk.load, chunk.counter);
+}
+
+
+// Put a chunk's loaded meshes in place of its stand-ins and show its objects
+void WorldStreamer::StreamIn(Chunk& chunk)
+{
+	for (auto& object : chunk.objects)
+	{
+		Mesh* mesh = chunk.meshes[object.meshFile].get();
+		object.model = new Model(mesh); // Rigid meshes, which can't fail
+		object.model->SetWorldMatrix(object.standIn->WorldMatrix());
+		object.model->UpdateMatrices(); // The objects don't move, so this is the only update they need
+		if (object.object < 0)  continue; // Not a scene object (see Register)
+		mObjects->Replace(object.object, object.model, mesh);
+		mObjects->SetPasses(object.object, object.passes);
+	}
+
+	chunk.bytes = 0;
+	for (size_t file = 0; file < chunk.meshes.size(); ++file)
+	{
+		if (chunk.meshes[file] == nullptr)  continue;
+		mMeshBytes[file] = chunk.meshes[file]->GpuBytes();
+		chunk.bytes += mMeshBytes[file];
+	}
+	mResidentBytes += chunk.bytes;
+	chunk.state = ChunkState::In;
+	++mNumResident;
+}
+
+
+// Put a chunk's stand-ins back in place of its loaded meshes, hiding its objects, and release the meshes
+void WorldStreamer::StreamOut(Chunk& chunk)
+{
+	for (auto& object : chunk.objects)
+	{
+		if (object.object >= 0)
+		{
+			mObjects->Replace(object.object, object.standIn, chunk.standIns[object.meshFile].get());
+			mObjects->SetPasses(object.object, 0);
+		}
+		delete object.model;
+		object.model = nullptr;
+	}
+	for (auto& mesh : chunk.meshes)  mesh.reset();
+
+	mResidentBytes -= chunk.bytes;
+	chunk.bytes = 0;
+	chunk.state = ChunkState::Out;
+	--mNumResident;
+}
@@ -0,0 +1,196 @@
+//--------------------------------------------------------------------------------------
+// World streamer - the level divided into chunks, only those near the camera kept in memory
+//--------------------------------------------------------------------------------------
+// The scene loads everything at the start and keeps it all, which is fine for one bay but not for
+// a level kilometres across. With streaming on the level's area is a grid of square chunks, and
+// each object and lake belongs to the chunk under it. Chunks within a radius of the camera are
+// streamed in: their mesh files are loaded as one job on the thread pool, then swapped in during
+// the update, a couple of chunks a frame so no frame takes the cost of many. Until then the
+// chunk's objects are scene objects drawing a box stand-in, hidden in every pass. Chunks a little
+// further than the radius are streamed out again, their meshes released, and the nearest chunks
+// are kept first when their meshes would go over the memory budget. A lake is only grouped for
+// its refraction and reflection while its chunk is in (see GroupWaterBodies in Scene.cpp).
+//
+// Each chunk loads its own copy of each mesh file its objects use, as the meshes of different parts
+// of a real level are different. The textures are already streamed by how large they are drawn
+// (see TextureStreamer.h), so the textures of chunks out of view fall out of memory by themselves.
+// The terrain is one heightfield, drawn as tiles chosen around the camera, so it isn't streamed.
+//
+// Streaming is on when -chunksize is given on the command line (see Benchmark.h), and covers the
+// stress scene's objects (see StressScene.h) and the water bodies other than the open water.
+
+#include "Frustum.h"
+#include "CVector3.h"
+#include "JobSystem.h"
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifndef _WORLD_STREAMER_H_INCLUDED_
+#define _WORLD_STREAMER_H_INCLUDED_
+
+class Mesh;
+class Model;
+class SceneObjects;
+class WaterBody;
+
+
+//--------------------------------------------------------------------------------------
+// Settings
+//--------------------------------------------------------------------------------------
+
+// Settings for the world streaming, from the command line (see ParseBenchmarkCommandLine)
+struct WorldStreamingSettings
+{
+	float chunkSize = 0;   // Width of each chunk, 0 for no streaming
+	float radius    = 500; // Chunks with some of their area nearer the camera than this are streamed in
+	float budgetMB  = 64;  // Most GPU memory the meshes of the chunks streamed in can use between them
+};
+
+extern WorldStreamingSettings gWorldStreaming;
+
+
+//--------------------------------------------------------------------------------------
+// World streamer class
+//--------------------------------------------------------------------------------------
+
+class WorldStreamer
+{
+//--------------------------------------------------------------------------------------
+// Construction / Usage
+//--------------------------------------------------------------------------------------
+public:
+
+	// Divide the x and z extent of the given area into chunks of gWorldStreaming.chunkSize. The objects added are copies of the
+	// meshes in the given files, the spheres around them (in model space) size their stand-ins
+	WorldStreamer(const BoundingBox& area, const char* const* meshFiles, const BoundingSphere* meshBounds, int numMeshFiles);
+
+	// Waits for the loads still running, then releases the models and meshes of the chunks
+	~WorldStreamer();
+
+	WorldStreamer(const WorldStreamer&) = delete;
+	WorldStreamer& operator=(const WorldStreamer&) = delete;
+
+
+	// Add an object, a copy of the given mesh file, to the chunk under the given position. Returns its model, which is placed
+	// and kept by the streamer - the caller places it like any other (e.g. SetPosition). The model draws the chunk's stand-in
+	// for the file, given in mesh for adding the object to the scene objects. Call Register once all the objects are sorted
+	// Will throw a std::runtime_error exception if the stand-in can't be made (same as Mesh)
+	Model* AddObject(int meshFile, const CVector3& position, Mesh** mesh);
+
+	// Add a water body to the chunk under its centre. The open water is everywhere, so is never added
+	void AddWaterBody(WaterBody* body);
+
+	// Find the scene objects of the models added, once the objects have been sorted, and hide those in every pass until their
+	// chunks are streamed in
+	void Register(SceneObjects* objects);
+
+
+	// Call once a frame during the update, when nothing is drawing the models. Swaps in the chunks that have finished loading
+	// and streams out those too far from the camera, a few each frame, then starts loads for the nearest chunks in the radius
+	// that fit in the budget. If waitForLoads is set the loads started are finished before returning, so the same chunks are
+	// in on the same frames every run (for the benchmark). Returns false with a message in gLastError if a chunk failed to
+	// load, the chunk stays out
+	bool Update(const CVector3& cameraPosition, bool waitForLoads);
+
+	// Whether the water body's chunk is streamed in, the open water always is
+	bool IsResident(const WaterBody* body) const;
+
+
+	// Stats for the title bar: chunks in all / streamed in / loading, and the memory used by the meshes streamed in and the
+	// budget for them (bytes)
+	int    NumChunks() const      { return static_cast<int>(mChunks.size()); }
+	int    NumResident() const    { return mNumResident; }
+	int    NumLoading() const     { return mNumLoading; }
+	size_t ResidentBytes() const  { return mResidentBytes; }
+	size_t Budget() const         { return mBudget; }
+
+
+//--------------------------------------------------------------------------------------
+// Private helper functions / data
+//--------------------------------------------------------------------------------------
+private:
+
+	// Chunks across the area at most in either direction, however small the chunks are asked to be
+	static constexpr int MaxChunksAcross = 64;
+
+	// Most chunks loading at once, and most swapped in or out in one frame
+	static constexpr int MaxLoading       = 2;
+	static constexpr int MaxSwapsPerFrame = 2;
+
+	// Chunks are streamed out past this much more than the radius, so a camera moving to and fro across the radius doesn't
+	// stream the same chunks in and out over and over
+	static constexpr float StreamOutMargin = 1.25f;
+
+	enum class ChunkState { Out, Loading, In, Failed };
+
+	// An object of a chunk: the file it is a copy of, its model drawing the stand-in and its model of the loaded mesh while the
+	// chunk is in. Its index in the scene objects and the passes it is drawn in while in are found by Register
+	struct ChunkObject
+	{
+		int          meshFile;
+		Model*       standIn;
+		Model*       model  = nullptr;
+		int          object = -1;
+		unsigned int passes = 0;
+	};
+
+	struct Chunk
+	{
+		CVector3   min, max; // Area covered, only x and z are used
+		ChunkState state = ChunkState::Out;
+		std::vector<ChunkObject> objects;
+
+		// The stand-in for each mesh file and the mesh loaded from it while the chunk is in, nullptr for files the chunk doesn't use
+		std::vector<std::unique_ptr<Mesh>> standIns;
+		std::vector<std::unique_ptr<Mesh>> meshes;
+		size_t bytes = 0; // GPU memory used by the meshes
+
+		// The load run on the thread pool, counted by the counter, and the message of the exception that stopped it if any
+		std::function<void()> load;
+		JobCounter            counter;
+		std::string           error;
+	};
+
+	// The chunk under a point, clamped to the grid
+	Chunk& ChunkAt(const CVector3& point);
+
+	// Distance across the ground from a point to the nearest part of a chunk, 0 if the point is over it
+	static float Distance(const Chunk& chunk, const CVector3& point);
+
+	// The memory a chunk's meshes are expected to use, from the sizes of the files loaded so far
+	size_t ExpectedBytes(const Chunk& chunk) const;
+
+	// Start a chunk loading / put its loaded meshes in place of its stand-ins and show its objects / put the stand-ins back and
+	// release the meshes
+	void StartLoad(Chunk& chunk);
+	void StreamIn(Chunk& chunk);
+	void StreamOut(Chunk& chunk);
+
+
+	std::vector<std::string>    mMeshFiles;
+	std::vector<BoundingSphere> mMeshBounds;
+	std::vector<size_t>         mMeshBytes; // GPU memory used by a copy of each file, 0 until one has loaded
+
+	std::vector<std::unique_ptr<Chunk>> mChunks; // Row by row, z then x
+	std::vector<std::pair<const WaterBody*, const Chunk*>> mWaterBodies; // And the chunk of each
+	int      mChunksX, mChunksZ;
+	CVector3 mAreaMin;
+	float    mChunkSize;
+
+	SceneObjects* mObjects = nullptr;
+	size_t        mBudget;
+	size_t        mResidentBytes = 0;
+	int           mNumResident = 0;
+	int           mNumLoading  = 0;
+
+	std::vector<std::pair<float, Chunk*>> mCandidates; // Chunks to stream in, kept between frames so it only allocates once
+};
+
+
+// The level's streamer, nullptr without streaming (see WorldStreamingSettings)
+extern WorldStreamer* gWorldStreamer;
+
+
+#endif //_WORLD_STREAMER_H_INCLUDED_